@@ -1,6 +1,7 @@
 from __future__ import absolute_import, division, print_function
 
 import logging
+import os
 import sys
 import warnings
 
@@ -13,6 +14,13 @@
 
 logging.getLogger("dials").addHandler(logging.NullHandler())
 
+# Report the slowest imports at exit, to find what slows down the startup of
+# short-lived processes
+if os.getenv("DIALS_IMPORT_PROFILE"):
+    from dials.util.import_profile import profile_imports_at_exit
+
+    profile_imports_at_exit()
+
 # Intercept easy_mp exceptions to extract stack traces before they are lost at
 # the libtbx process boundary/the easy_mp API. In the case of a subprocess
 # crash we print the subprocess stack trace, which will be most useful for
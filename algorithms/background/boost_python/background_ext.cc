@@ -10,6 +10,7 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace background { namespace boost_python {
 
@@ -18,6 +19,7 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
   void export_helpers();
 
   BOOST_PYTHON_MODULE(dials_algorithms_background_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_helpers();
   }
 
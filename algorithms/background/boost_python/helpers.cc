@@ -12,6 +12,7 @@
 #include <boost/python/def.hpp>
 #include <dials/algorithms/background/helpers.h>
 #include <dials/algorithms/background/radial_average.h>
+#include <dials/util/boost_python/release_gil.h>
 
 namespace dials { namespace algorithms { namespace background { namespace boost_python {
 
@@ -22,13 +23,15 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
         &set_shoebox_background_value<float>,
         (arg("reflections"), arg("value")));
 
-    class_<RadialAverage>("RadialAverage", no_init)
+    class_<RadialAverage, boost::noncopyable>("RadialAverage", no_init)
       .def(init<boost::shared_ptr<BeamBase>,
                 const Detector&,
                 double,
                 double,
                 std::size_t>())
-      .def("add", &RadialAverage::add)
+      .def("add",
+           DIALS_RELEASE_GIL(&RadialAverage::add),
+           (arg("data"), arg("mask"), arg("nthreads") = 1))
       .def("mean", &RadialAverage::mean)
       .def("weight", &RadialAverage::weight)
       .def("inv_d2", &RadialAverage::inv_d2);
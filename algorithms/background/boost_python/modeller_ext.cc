@@ -11,14 +11,17 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/background/modeller.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace background { namespace boost_python {
 
   using namespace boost::python;
 
   BOOST_PYTHON_MODULE(dials_algorithms_background_modeller_ext) {
+    dials::util::boost_python::import_shared_executor();
     class_<BackgroundStatistics>("BackgroundStatistics", no_init)
-      .def(init<const ImageVolume<>&>())
+      .def(init<const ImageVolume<>&, std::size_t>(
+        (arg("volume"), arg("nthreads") = 1)))
       .def("sum", &BackgroundStatistics::sum)
       .def("sum_sq", &BackgroundStatistics::sum_sq)
       .def("num", &BackgroundStatistics::num)
@@ -31,7 +34,8 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
       .def("mask", &BackgroundStatistics::mask);
 
     class_<MultiPanelBackgroundStatistics>("MultiPanelBackgroundStatistics", no_init)
-      .def(init<const MultiPanelImageVolume<>&>())
+      .def(init<const MultiPanelImageVolume<>&, std::size_t>(
+        (arg("volume"), arg("nthreads") = 1)))
       .def("get", &MultiPanelBackgroundStatistics::get)
       .def("__len__", &MultiPanelBackgroundStatistics::size)
       .def("__iadd__", &MultiPanelBackgroundStatistics::operator+=);
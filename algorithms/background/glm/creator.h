@@ -14,6 +14,7 @@
 
 #include <scitbx/glmtbx/robust_glm.h>
 #include <dials/algorithms/background/glm/robust_poisson_mean.h>
+#include <dials/algorithms/background/glm/robust_poisson_loglinear.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/shoebox.h>
@@ -52,7 +53,8 @@ namespace dials { namespace algorithms {
     enum Model { Constant2d, Constant3d, LogLinear2d, LogLinear3d };
 
     /**
-     * Initialise the creator
+     * Initialise the creator. The expected values for the robust weights are
+     * tabulated once here for all the shoeboxes.
      * @param tuning_constant The robust tuning constant
      * @param max_iter The maximum number of iterations
      * @param min_pixels The minimum number of pixels needed
@@ -64,7 +66,8 @@ namespace dials { namespace algorithms {
         : model_(model),
           tuning_constant_(tuning_constant),
           max_iter_(max_iter),
-          min_pixels_(min_pixels) {
+          min_pixels_(min_pixels),
+          expectation_(tuning_constant) {
       DIALS_ASSERT(tuning_constant > 0);
       DIALS_ASSERT(max_iter > 0);
       DIALS_ASSERT(min_pixels > 0);
@@ -212,8 +215,7 @@ namespace dials { namespace algorithms {
         }
 
         // Compute the result
-        RobustPoissonMean result(
-          Y.const_ref(), median, tuning_constant_, 1e-3, max_iter_);
+        RobustPoissonMean result(Y.const_ref(), median, expectation_, 1e-3, max_iter_);
         DIALS_ASSERT(result.converged());
 
         // Compute the background
@@ -269,8 +271,7 @@ namespace dials { namespace algorithms {
       }
 
       // Compute the result
-      RobustPoissonMean result(
-        Y.const_ref(), median, tuning_constant_, 1e-3, max_iter_);
+      RobustPoissonMean result(Y.const_ref(), median, expectation_, 1e-3, max_iter_);
       DIALS_ASSERT(result.converged());
 
       // Compute the background
@@ -293,6 +294,7 @@ namespace dials { namespace algorithms {
     void compute_loglinear_2d(const af::const_ref<T, af::c_grid<3> > &data,
                               af::ref<T, af::c_grid<3> > background,
                               af::ref<int, af::c_grid<3> > mask) const {
+      af::shared<double> B(3);
       for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
         // Compute number of background pixels
         std::size_t num_background = 0;
@@ -340,25 +342,21 @@ namespace dials { namespace algorithms {
         }
         DIALS_ASSERT(countx > 0 && county > 0);
 
-        // Compute the median value for the starting value
-        double median = detail::median(Y.const_ref());
-        if (median == 0) {
-          median = 1.0;
+        // Setup the initial parameters. The first frame starts from the
+        // median value and the others from the previous frame.
+        if (k == 0) {
+          double median = detail::median(Y.const_ref());
+          if (median == 0) {
+            median = 1.0;
+          }
+          B[0] = std::log(median);
+          B[1] = 0.0;
+          B[2] = 0.0;
         }
 
-        // Setup the initial parameters
-        af::shared<double> B(3);
-        B[0] = std::log(median);
-        B[1] = 0.0;
-        B[2] = 0.0;
-
         // Compute the result
-        scitbx::glmtbx::robust_glm<scitbx::glmtbx::poisson> result(X.const_ref(),
-                                                                   Y.const_ref(),
-                                                                   B.const_ref(),
-                                                                   tuning_constant_,
-                                                                   1e-3,
-                                                                   max_iter_);
+        RobustPoissonLogLinear result(
+          X.const_ref(), Y.const_ref(), B.const_ref(), expectation_, 1e-3, max_iter_);
         DIALS_ASSERT(result.converged());
 
         // Compute the background
@@ -498,6 +496,7 @@ namespace dials { namespace algorithms {
     double tuning_constant_;
     std::size_t max_iter_;
     std::size_t min_pixels_;
+    RobustPoissonExpectation expectation_;
   };
 
 }}  // namespace dials::algorithms
@@ -0,0 +1,185 @@
+/*
+ * robust_poisson_loglinear.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_BACKGROUND_GLM_ROBUST_POISSON_LOGLINEAR_H
+#define DIALS_ALGORITHMS_BACKGROUND_GLM_ROBUST_POISSON_LOGLINEAR_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <scitbx/matrix/inversion.h>
+#include <scitbx/glmtbx/family.h>
+#include <scitbx/glmtbx/robust_glm.h>
+#include <dials/algorithms/background/glm/robust_poisson_mean.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The robust generalized linear model of scitbx::glmtbx::robust_glm for
+   * the poisson family with the log link, as described in Cantoni and
+   * Rochetti (2001) "Robust Inference for Generalized Linear Models". The
+   * expected values for the robust weights are taken from a table rather
+   * than computed for every observation on every iteration.
+   */
+  class RobustPoissonLogLinear {
+    typedef scitbx::glmtbx::poisson family;
+
+  public:
+    /**
+     * Compute the generalized linear model using iteratively reweighted least
+     * squares. The input expects a design matrix of size (nobs, ncoef), a list
+     * of observations of size (nobs) and a list of initial estimates of size
+     * (ncoef).
+     * @param X The design matrix
+     * @param Y The observations
+     * @param B The initial estimate
+     * @param expectation The expectation table
+     * @param tolerance The stopping critera
+     * @param max_iter The maximum number of iterations
+     */
+    RobustPoissonLogLinear(const af::const_ref<double, af::c_grid<2> > &X,
+                           const af::const_ref<double> &Y,
+                           const af::const_ref<double> &B,
+                           const RobustPoissonExpectation &expectation,
+                           double tolerance,
+                           std::size_t max_iter)
+        : beta_(B.begin(), B.end()),
+          niter_(0),
+          error_(0),
+          c_(expectation.c()),
+          tolerance_(tolerance),
+          max_iter_(max_iter) {
+      DIALS_ASSERT(X.accessor()[0] == Y.size());
+      DIALS_ASSERT(X.accessor()[1] == B.size());
+      DIALS_ASSERT(Y.size() > 0);
+      DIALS_ASSERT(B.size() > 0);
+      DIALS_ASSERT(tolerance > 0);
+      DIALS_ASSERT(max_iter > 0);
+      compute(X, Y, expectation);
+    }
+
+    /**
+     * @returns The parameters
+     */
+    af::shared<double> parameters() const {
+      return af::shared<double>(beta_.begin(), beta_.end());
+    }
+
+    /**
+     * @returns The number of iterations
+     */
+    std::size_t niter() const {
+      return niter_;
+    }
+
+    /**
+     * @returns The reletive error at the last iteration
+     */
+    double error() const {
+      return error_;
+    }
+
+    /**
+     * @returns Did the algorithm converge
+     */
+    bool converged() const {
+      return niter_ < max_iter_;
+    }
+
+  private:
+    void compute(const af::const_ref<double, af::c_grid<2> > &X,
+                 const af::const_ref<double> &Y,
+                 const RobustPoissonExpectation &expectation) {
+      // Number of observations and coefficients
+      std::size_t n_obs = X.accessor()[0];
+      std::size_t n_cof = X.accessor()[1];
+
+      // Loop until we reach the maximum number of iterations
+      std::vector<double> U(n_cof);
+      std::vector<double> H(n_cof * n_cof);
+      for (niter_ = 0; niter_ < max_iter_; ++niter_) {
+        // Initialize the sums to zero
+        std::fill(U.begin(), U.end(), 0.0);
+        std::fill(H.begin(), H.end(), 0.0);
+
+        // Build the matrices from the observations
+        for (std::size_t i = 0; i < n_obs; ++i) {
+          const double *x = &X[i * n_cof];
+
+          // Compute the values for eta
+          double eta = 0.0;
+          for (std::size_t j = 0; j < n_cof; ++j) {
+            eta += x[j] * beta_[j];
+          }
+
+          // Compute some required values
+          double mu = family::linkinv(eta);
+          double var = family::variance(mu);
+          double dmu = family::dmu_deta(eta);
+          double phi = family::dispersion();
+          DIALS_ASSERT(phi > 0);
+          DIALS_ASSERT(var > 0);
+          double svar = std::sqrt(phi * var);
+          double res = (Y[i] - mu) / svar;
+
+          // Compute expectation values
+          vec2<double> epsi = expectation(mu);
+
+          // Compute the difference between psi and its expected value
+          double psi = scitbx::glmtbx::huber(res, c_);
+          double psi_m_epsi = psi - epsi[0];
+
+          // Compute the value of Psi and B_diag for this observation
+          double q = psi_m_epsi * dmu / svar;
+          double b = epsi[1] * dmu * dmu / svar;
+
+          // Update the H = X^T B X and U matrices
+          for (std::size_t j = 0; j < n_cof; ++j) {
+            U[j] += q * x[j];
+            for (std::size_t k = 0; k <= j; ++k) {
+              H[j * n_cof + k] += b * x[j] * x[k];
+            }
+          }
+        }
+        for (std::size_t j = 0; j < n_cof; ++j) {
+          for (std::size_t k = j + 1; k < n_cof; ++k) {
+            H[j * n_cof + k] = H[k * n_cof + j];
+          }
+        }
+
+        // Compute delta = H^-1 U
+        scitbx::matrix::inversion_in_place(&H[0], n_cof, &U[0], 1);
+
+        // Compute the relative error in the parameters and update
+        double sum_delta_sq = 0.0;
+        double sum_beta_sq = 0.0;
+        for (std::size_t j = 0; j < n_cof; ++j) {
+          sum_delta_sq += U[j] * U[j];
+          sum_beta_sq += beta_[j] * beta_[j];
+          beta_[j] += U[j];
+        }
+
+        // If error is within tolerance then break
+        error_ = std::sqrt(sum_delta_sq / std::max(1e-10, sum_beta_sq));
+        if (error_ < tolerance_) {
+          break;
+        }
+      }
+    }
+
+    af::shared<double> beta_;
+    std::size_t niter_;
+    double error_;
+    double c_;
+    double tolerance_;
+    std::size_t max_iter_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_BACKGROUND_GLM_ROBUST_POISSON_LOGLINEAR_H
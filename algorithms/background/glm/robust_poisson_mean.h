@@ -11,6 +11,7 @@
 #ifndef SCITBX_GLMTBX_ROBUST_POISSON_MEAN_H
 #define SCITBX_GLMTBX_ROBUST_POISSON_MEAN_H
 
+#include <scitbx/vec2.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/matrix/inversion.h>
 #include <scitbx/matrix/multiply.h>
@@ -20,6 +21,74 @@
 
 namespace dials { namespace algorithms {
 
+  using scitbx::vec2;
+
+  /**
+   * A table of the expected values of the huber function of the residual and
+   * its derivative for the poisson family, used for the robust weights. The
+   * expectation is an expensive function of the poisson mean so it is
+   * tabulated at regular intervals of the mean and linearly interpolated.
+   * Means outside the table are computed directly, so a table with a
+   * maximum mean of zero computes every expectation directly. Copies of the
+   * table share the same values.
+   */
+  class RobustPoissonExpectation {
+    typedef scitbx::glmtbx::poisson family;
+
+  public:
+    /**
+     * Tabulate the expectation
+     * @param c The huber tuning constant
+     * @param max_mean The largest mean in the table
+     * @param div The number of table entries per unit of the mean
+     */
+    RobustPoissonExpectation(double c, double max_mean = 100, std::size_t div = 1000)
+        : c_(c),
+          div_(div),
+          size_((std::size_t)(max_mean * div)),
+          table_(size_, af::init_functor_null<vec2<double> >()) {
+      DIALS_ASSERT(c > 0);
+      DIALS_ASSERT(max_mean >= 0);
+      DIALS_ASSERT(div > 0);
+      for (std::size_t i = 0; i < size_; ++i) {
+        table_[i] = calculate((double)(i + 1) / (double)div_);
+      }
+    }
+
+    /**
+     * @returns The huber tuning constant
+     */
+    double c() const {
+      return c_;
+    }
+
+    /**
+     * @param mu The poisson mean
+     * @returns The expectation of psi and its derivative
+     */
+    vec2<double> operator()(double mu) const {
+      double t = mu * div_;
+      if (t >= 1.0 && t < (double)size_) {
+        std::size_t i = (std::size_t)t;
+        double f = t - (double)i;
+        return table_[i - 1] * (1.0 - f) + table_[i] * f;
+      }
+      return calculate(mu);
+    }
+
+  private:
+    vec2<double> calculate(double mu) const {
+      double svar = std::sqrt(family::dispersion() * family::variance(mu));
+      scitbx::glmtbx::expectation<family> epsi(mu, svar, c_);
+      return vec2<double>(epsi.epsi1, epsi.epsi2);
+    }
+
+    double c_;
+    std::size_t div_;
+    std::size_t size_;
+    af::shared<vec2<double> > table_;
+  };
+
   /**
    * An algorithm to do robust generalized linear model as described in
    * Cantoni and Rochetti (2001) "Robust Inference for Generalized Linear
@@ -53,7 +122,34 @@ namespace dials { namespace algorithms {
       SCITBX_ASSERT(tolerance > 0);
       SCITBX_ASSERT(max_iter > 0);
       beta_ = std::log(mean0);
-      compute(Y);
+      compute(Y, RobustPoissonExpectation(c, 0));
+    }
+
+    /**
+     * Compute the mean using a table of the expected values for the robust
+     * weights.
+     * @param Y The observations
+     * @param mean0 The initial estimate
+     * @param expectation The expectation table
+     * @param tolerance The stopping critera
+     * @param max_iter The maximum number of iterations
+     */
+    RobustPoissonMean(const af::const_ref<double> &Y,
+                      double mean0,
+                      const RobustPoissonExpectation &expectation,
+                      double tolerance,
+                      std::size_t max_iter)
+        : niter_(0),
+          error_(0),
+          c_(expectation.c()),
+          tolerance_(tolerance),
+          max_iter_(max_iter) {
+      SCITBX_ASSERT(Y.size() > 0);
+      SCITBX_ASSERT(mean0 > 0);
+      SCITBX_ASSERT(tolerance > 0);
+      SCITBX_ASSERT(max_iter > 0);
+      beta_ = std::log(mean0);
+      compute(Y, expectation);
     }
 
     /**
@@ -86,7 +182,8 @@ namespace dials { namespace algorithms {
     }
 
   private:
-    void compute(const af::const_ref<double> &Y) {
+    void compute(const af::const_ref<double> &Y,
+                 const RobustPoissonExpectation &expectation) {
       // Number of observations and coefficients
       std::size_t n_obs = Y.size();
 
@@ -106,10 +203,10 @@ namespace dials { namespace algorithms {
         double svar = std::sqrt(phi * var);
 
         // Compute expectation values
-        scitbx::glmtbx::expectation<family> epsi(mu, svar, c_);
+        vec2<double> epsi = expectation(mu);
 
         // The value of the b diagonal parts
-        double b = epsi.epsi2 * w * dmu * dmu / svar;
+        double b = epsi[1] * w * dmu * dmu / svar;
 
         // Build the matrices from the observations
         for (std::size_t i = 0; i < n_obs; ++i) {
@@ -118,7 +215,7 @@ namespace dials { namespace algorithms {
 
           // Compute the difference between psi and its expected value
           double psi = scitbx::glmtbx::huber(res, c_);
-          double psi_m_epsi = psi - epsi.epsi1;
+          double psi_m_epsi = psi - epsi[0];
 
           // Compute the value of Psi and B_diag for this observation
           double q = psi_m_epsi * w * dmu / svar;
@@ -10,4 +10,5 @@
     "PolarTransform",
     "PolarTransformResult",
     "StaticBackgroundModel",
+    "StaticBackgroundModelBuilder",
 )
@@ -24,8 +24,16 @@ def get(self, name):
             model = self.model[name]
         except KeyError:
             with open(name, "rb") as infile:
-                model = pickle.load(infile)
-                self.model[name] = model
+                mapped = infile.read(8) == b"DIALSBGM"
+                if not mapped:
+                    infile.seek(0)
+                    model = pickle.load(infile)
+            if mapped:
+                # Map the model file so processes share the same data
+                from dials.algorithms.background.gmodel import StaticBackgroundModel
+
+                model = StaticBackgroundModel(name)
+            self.model[name] = model
         return model
 
 
@@ -10,19 +10,30 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/algorithms/background/gmodel/builder.h>
 #include <dials/algorithms/background/gmodel/creator.h>
 #include <dials/algorithms/background/gmodel/model.h>
 #include <dials/algorithms/background/gmodel/polar_transform.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace background { namespace boost_python {
 
   using namespace boost::python;
 
   struct StaticBackgroundModelPickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const StaticBackgroundModel &obj) {
+      if (obj.filename().empty()) {
+        return boost::python::tuple();
+      }
+      return boost::python::make_tuple(obj.filename());
+    }
+
     static boost::python::tuple getstate(const StaticBackgroundModel &obj) {
       boost::python::list data;
-      for (std::size_t i = 0; i < obj.size(); ++i) {
-        data.append(obj.data(i));
+      if (obj.filename().empty()) {
+        for (std::size_t i = 0; i < obj.size(); ++i) {
+          data.append(obj.data(i));
+        }
       }
       return boost::python::make_tuple(data);
     }
@@ -39,28 +50,50 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
   };
 
   BOOST_PYTHON_MODULE(dials_algorithms_background_gmodel_ext) {
+    dials::util::boost_python::import_shared_executor();
     class_<PolarTransformResult>("PolarTransformResult", no_init)
       .def("data", &PolarTransformResult::data)
       .def("mask", &PolarTransformResult::mask);
 
     class_<PolarTransform>("PolarTransform", no_init)
-      .def(init<const BeamBase &, const Panel &, const Goniometer &>())
+      .def(init<const BeamBase &, const Panel &, const Goniometer &, std::size_t>(
+        (arg("beam"), arg("panel"), arg("goniometer"), arg("nthreads") = 1)))
       .def("image_xmap", &PolarTransform::image_xmap)
       .def("image_ymap", &PolarTransform::image_ymap)
       .def("discontinuity", &PolarTransform::discontinuity)
-      .def("to_polar", &PolarTransform::to_polar)
-      .def("from_polar", &PolarTransform::from_polar);
+      .def("to_polar",
+           &PolarTransform::to_polar,
+           (arg("data"), arg("mask"), arg("nthreads") = 1))
+      .def("from_polar",
+           &PolarTransform::from_polar,
+           (arg("data"), arg("mask"), arg("nthreads") = 1));
 
     class_<BackgroundModel, boost::noncopyable, boost::shared_ptr<BackgroundModel> >(
       "BackgroundModel", no_init)
       .def("extract", pure_virtual(&BackgroundModel::extract));
 
     class_<StaticBackgroundModel, bases<BackgroundModel> >("StaticBackgroundModel")
+      .def(init<std::string>((arg("filename"))))
       .def("add", &StaticBackgroundModel::add)
       .def("__len__", &StaticBackgroundModel::size)
       .def("data", &StaticBackgroundModel::data)
+      .def("filename", &StaticBackgroundModel::filename)
+      .def("write", &StaticBackgroundModel::write, (arg("filename")))
       .def_pickle(StaticBackgroundModelPickleSuite());
 
+    class_<StaticBackgroundModelBuilder>("StaticBackgroundModelBuilder", no_init)
+      .def(init<const Detector &>((arg("detector"))))
+      .def("add",
+           &StaticBackgroundModelBuilder::add<double>,
+           (arg("panel"), arg("data"), arg("mask"), arg("nthreads") = 1))
+      .def("add",
+           &StaticBackgroundModelBuilder::add<int>,
+           (arg("panel"), arg("data"), arg("mask"), arg("nthreads") = 1))
+      .def("num_images", &StaticBackgroundModelBuilder::num_images)
+      .def("compute",
+           &StaticBackgroundModelBuilder::compute,
+           (arg("min_count") = 5, arg("nsigma") = 6, arg("nthreads") = 1));
+
     class_<GModelBackgroundCreator> creator("Creator", no_init);
     creator
       .def(init<boost::shared_ptr<BackgroundModel>, bool, std::size_t>(
@@ -0,0 +1,208 @@
+/*
+ * builder.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_BACKGROUND_GMODEL_BUILDER_H
+#define DIALS_ALGORITHMS_BACKGROUND_GMODEL_BUILDER_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/background/gmodel/model.h>
+#include <dials/algorithms/image/fill_holes/simple.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dxtbx::model::Detector;
+
+  /**
+   * Build a static background model from a sweep of images, one image at a
+   * time.
+   *
+   * The number of times each pixel was valid and its running sum and sum of
+   * squares are kept, so the memory used is proportional to the size of the
+   * detector and not the number of images. When the model is computed, the
+   * pixels which were valid on enough images and whose variance is consistent
+   * with a poisson distribution, using the index of dispersion as in
+   * PixelFilter, are set to their mean value. The other pixels are filled
+   * from their neighbours.
+   */
+  class StaticBackgroundModelBuilder {
+  public:
+    /**
+     * Initialise the builder
+     * @param detector The detector model
+     */
+    StaticBackgroundModelBuilder(const Detector &detector) {
+      DIALS_ASSERT(detector.size() > 0);
+      for (std::size_t p = 0; p < detector.size(); ++p) {
+        std::size_t height = detector[p].get_image_size()[1];
+        std::size_t width = detector[p].get_image_size()[0];
+        panels_.push_back(PanelSums(af::c_grid<2>(height, width)));
+      }
+    }
+
+    /**
+     * Add an image of a panel. The mask should exclude the pixels which are
+     * not background on this image, such as those in the shoeboxes of the
+     * reflections.
+     * @param panel The panel number
+     * @param data The image data
+     * @param mask The image mask
+     * @param nthreads The number of threads
+     */
+    template <typename T>
+    void add(std::size_t panel,
+             const af::const_ref<T, af::c_grid<2> > &data,
+             const af::const_ref<bool, af::c_grid<2> > &mask,
+             std::size_t nthreads) {
+      DIALS_ASSERT(panel < panels_.size());
+      DIALS_ASSERT(nthreads > 0);
+      PanelSums &sums = panels_[panel];
+      DIALS_ASSERT(data.accessor().all_eq(sums.grid));
+      DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+      detail::parallel_bands(
+        boost::bind(&StaticBackgroundModelBuilder::add_rows<T>,
+                    boost::ref(sums),
+                    boost::cref(data),
+                    boost::cref(mask),
+                    _1,
+                    _2),
+        sums.grid[0],
+        nthreads);
+      sums.num_images++;
+    }
+
+    /**
+     * @param panel The panel number
+     * @returns The number of images added for the panel
+     */
+    std::size_t num_images(std::size_t panel) const {
+      DIALS_ASSERT(panel < panels_.size());
+      return panels_[panel].num_images;
+    }
+
+    /**
+     * Compute the background model
+     * @param min_count The minimum number of images a pixel must be valid on
+     * @param nsigma The number of standard deviations to filter by
+     * @param nthreads The number of threads
+     * @returns The background model
+     */
+    StaticBackgroundModel compute(std::size_t min_count,
+                                  double nsigma,
+                                  std::size_t nthreads) const {
+      DIALS_ASSERT(nsigma > 0);
+      DIALS_ASSERT(nthreads > 0);
+      StaticBackgroundModel result;
+      for (std::size_t p = 0; p < panels_.size(); ++p) {
+        const PanelSums &sums = panels_[p];
+        DIALS_ASSERT(sums.num_images >= 2);
+        std::size_t n_min = min_count;
+        if (n_min < 2 || n_min > sums.num_images) {
+          n_min = sums.num_images;
+        }
+
+        // Compute the mean of the pixels which pass the filter
+        af::versa<double, af::c_grid<2> > data(sums.grid, 0);
+        af::versa<bool, af::c_grid<2> > mask(sums.grid, false);
+        detail::parallel_bands(
+          boost::bind(&StaticBackgroundModelBuilder::filter_rows,
+                      boost::cref(sums),
+                      n_min,
+                      nsigma,
+                      data.ref(),
+                      mask.ref(),
+                      _1,
+                      _2),
+          sums.grid[0],
+          nthreads);
+
+        // Fill in the other pixels from their neighbours
+        if (std::find(mask.begin(), mask.end(), true) != mask.end()) {
+          data = SimpleFill(mask.const_ref()).fill(data.const_ref());
+        }
+        result.add(data.const_ref());
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * The running sums for a panel
+     */
+    struct PanelSums {
+      af::c_grid<2> grid;
+      std::size_t num_images;
+      std::vector<boost::uint32_t> count;
+      std::vector<double> sum1;
+      std::vector<double> sum2;
+
+      PanelSums(af::c_grid<2> grid_)
+          : grid(grid_),
+            num_images(0),
+            count(grid_.size_1d(), 0),
+            sum1(grid_.size_1d(), 0.0),
+            sum2(grid_.size_1d(), 0.0) {}
+    };
+
+    /**
+     * Add a range of rows of an image to the sums
+     */
+    template <typename T>
+    static void add_rows(PanelSums &sums,
+                         const af::const_ref<T, af::c_grid<2> > &data,
+                         const af::const_ref<bool, af::c_grid<2> > &mask,
+                         std::size_t first,
+                         std::size_t last) {
+      std::size_t width = sums.grid[1];
+      for (std::size_t k = first * width; k < last * width; ++k) {
+        double m = mask[k] ? 1.0 : 0.0;
+        double v = m * (double)data[k];
+        sums.count[k] += mask[k];
+        sums.sum1[k] += v;
+        sums.sum2[k] += v * v;
+      }
+    }
+
+    /**
+     * Filter a range of rows of the pixels
+     */
+    static void filter_rows(const PanelSums &sums,
+                            std::size_t min_count,
+                            double nsigma,
+                            af::ref<double, af::c_grid<2> > data,
+                            af::ref<bool, af::c_grid<2> > mask,
+                            std::size_t first,
+                            std::size_t last) {
+      std::size_t width = sums.grid[1];
+      for (std::size_t k = first * width; k < last * width; ++k) {
+        if (sums.count[k] >= min_count) {
+          double s1 = sums.sum1[k];
+          double s2 = sums.sum2[k];
+          double n = sums.count[k];
+          double mean = s1 / n;
+          double var = (s2 - s1 * s1 / n) / (n - 1);
+          if (var <= mean * (1.0 + nsigma * std::sqrt(2.0 / (n - 1)))) {
+            data[k] = mean;
+            mask[k] = true;
+          }
+        }
+      }
+    }
+
+    std::vector<PanelSums> panels_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_BACKGROUND_GMODEL_BUILDER_H
@@ -155,7 +155,7 @@ namespace dials { namespace algorithms {
                               const af::const_ref<T, af::c_grid<3> > &data,
                               af::ref<T, af::c_grid<3> > background,
                               af::ref<int, af::c_grid<3> > mask) const {
-      af::versa<double, af::c_grid<3> > model = model_->extract(panel, bbox);
+      model_->extract_into(panel, bbox, background);
       double sum1 = 0;
       double sum2 = 0;
       double count = 0;
@@ -163,7 +163,7 @@ namespace dials { namespace algorithms {
       for (std::size_t i = 0; i < data.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code) {
           sum1 += data[i];
-          sum2 += model[i];
+          sum2 += background[i];
           count += 1;
         }
       }
@@ -172,7 +172,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(sum2 > 0);
       double scale = sum1 / sum2;
       for (std::size_t i = 0; i < data.size(); ++i) {
-        background[i] = scale * model[i];
+        background[i] *= scale;
         if ((mask[i] & mask_code) == mask_code) {
           mask[i] |= BackgroundUsed;
         }
@@ -190,7 +190,7 @@ namespace dials { namespace algorithms {
                           const af::const_ref<T, af::c_grid<3> > &data,
                           af::ref<T, af::c_grid<3> > background,
                           af::ref<int, af::c_grid<3> > mask) const {
-      af::versa<double, af::c_grid<3> > model = model_->extract(panel, bbox);
+      model_->extract_into(panel, bbox, background);
 
       // Compute number of background pixels
       std::size_t num_background = 0;
@@ -199,30 +199,34 @@ namespace dials { namespace algorithms {
       for (std::size_t i = 0; i < data.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code) {
           num_background++;
-          sum_model += model[i];
+          sum_model += background[i];
         }
       }
       DIALS_ASSERT(sum_model > 0);
       DIALS_ASSERT(num_background >= min_pixels_);
 
-      // Allocate some arrays
+      // Allocate some arrays and compute the variance stabilised values
       af::shared<double> X(num_background, 0);
       af::shared<double> Y(num_background, 0);
       af::shared<double> W(num_background, 1.0);
+      af::shared<double> tX(num_background, 0);
+      af::shared<double> tY(num_background, 0);
       std::size_t l = 0;
       for (std::size_t i = 0; i < data.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code) {
           DIALS_ASSERT(l < Y.size());
           DIALS_ASSERT(data[i] >= 0);
-          X[l] = model[i];
+          X[l] = background[i];
           Y[l] = data[i];
+          tX[l] = 2.0 * std::sqrt(X[l] + 3.0 / 8.0);
+          tY[l] = 2.0 * std::sqrt(Y[l] + 3.0 / 8.0);
           l++;
         }
       }
       DIALS_ASSERT(l == Y.size());
 
       // Estimate the weights for each pixel
-      estimate_pixel_weights(X.const_ref(), Y.const_ref(), W.ref());
+      estimate_pixel_weights(tX.const_ref(), tY.const_ref(), W.ref());
 
       // Estimate the scale parameter
       double scale =
@@ -230,7 +234,7 @@ namespace dials { namespace algorithms {
 
       // Fill in the background shoebox values
       for (std::size_t i = 0; i < data.size(); ++i) {
-        background[i] = scale * model[i];
+        background[i] *= scale;
         if ((mask[i] & mask_code) == mask_code) {
           mask[i] |= BackgroundUsed;
         }
@@ -239,32 +243,37 @@ namespace dials { namespace algorithms {
       return scale;
     }
 
-    void estimate_pixel_weights(const af::const_ref<double> &X,
-                                const af::const_ref<double> &Y,
+    /**
+     * Estimate the weights of the pixels from the variance stabilised model
+     * and data values. The weights are recomputed until the scale of the
+     * model changes by less than a relative tolerance of 1e-6, which it
+     * usually does in a few iterations, for a maximum of 10 iterations.
+     * @param tX The transformed model values
+     * @param tY The transformed data values
+     * @param W The weights
+     */
+    void estimate_pixel_weights(const af::const_ref<double> &tX,
+                                const af::const_ref<double> &tY,
                                 af::ref<double> W) const {
-      af::shared<double> tX(X.size());
-      af::shared<double> tY(X.size());
-      for (std::size_t i = 0; i < X.size(); ++i) {
-        tX[i] = 2.0 * std::sqrt(X[i] + 3.0 / 8.0);
-        tY[i] = 2.0 * std::sqrt(Y[i] + 3.0 / 8.0);
-      }
-
+      const double tolerance = 1e-6;
       double B = 1.0;
       for (std::size_t iter = 0; iter < 10; ++iter) {
         double XWX = 0.0;
         double XWY = 0.0;
-        for (std::size_t i = 0; i < X.size(); ++i) {
-          double mu = B * tX[i];
-          double r = std::abs(tY[i] - mu);
-          W[i] = 1.0;
-          if (r > 3.0) {
-            W[i] = 3.0 / r;
-          }
-          XWX += tX[i] * W[i] * tX[i];
-          XWY += tX[i] * W[i] * tY[i];
+        for (std::size_t i = 0; i < tX.size(); ++i) {
+          double r = std::abs(tY[i] - B * tX[i]);
+          double w = r > 3.0 ? 3.0 / r : 1.0;
+          W[i] = w;
+          XWX += tX[i] * w * tX[i];
+          XWY += tX[i] * w * tY[i];
         }
         DIALS_ASSERT(XWX > 0);
-        B = XWY / XWX;
+        double B_new = XWY / XWX;
+        bool converged = std::abs(B_new - B) <= tolerance * std::abs(B_new);
+        B = B_new;
+        if (converged) {
+          break;
+        }
       }
     }
 
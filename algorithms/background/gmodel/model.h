@@ -12,6 +12,16 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
 #define DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -26,15 +36,70 @@ namespace dials { namespace algorithms {
 
     virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
                                                       int6 bbox) const = 0;
+
+    /**
+     * Extract a shoebox into an existing array. By default this copies the
+     * result of extract.
+     * @param panel The panel
+     * @param bbox The bounding box
+     * @param result The array to fill with the model data
+     */
+    virtual void extract_into(std::size_t panel,
+                              int6 bbox,
+                              af::ref<float, af::c_grid<3> > result) const {
+      af::versa<double, af::c_grid<3> > model = extract(panel, bbox);
+      DIALS_ASSERT(model.accessor().all_eq(result.accessor()));
+      std::copy(model.begin(), model.end(), result.begin());
+    }
   };
 
   /**
    * A simple static background model
+   *
+   * The model is stored in single precision, either in memory or in a file
+   * written by write() which is mapped read only. Copies of the model, and
+   * processes which map the same file, share the same data. When a mapped
+   * model is pickled only the filename is kept.
+   *
+   * The file contains an 8 byte magic string, the number of panels and the
+   * height and width of each panel as 64 bit integers, followed by the float
+   * data of each panel in turn, all in the native byte order.
    */
   class StaticBackgroundModel : public BackgroundModel {
   public:
     StaticBackgroundModel() {}
 
+    /**
+     * Map a model written by write()
+     * @param filename The model file
+     */
+    StaticBackgroundModel(const std::string &filename) : filename_(filename) {
+      using boost::interprocess::file_mapping;
+      using boost::interprocess::mapped_region;
+      using boost::interprocess::read_only;
+      file_mapping file(filename.c_str(), read_only);
+      region_ = boost::make_shared<mapped_region>(file, read_only);
+      const char *begin = static_cast<const char *>(region_->get_address());
+      std::size_t size = region_->get_size();
+      DIALS_ASSERT(size >= 16);
+      if (std::memcmp(begin, magic(), 8) != 0) {
+        throw DIALS_ERROR("Not a background model file");
+      }
+      const boost::uint64_t *header =
+        reinterpret_cast<const boost::uint64_t *>(begin + 8);
+      std::size_t num_panels = header[0];
+      std::size_t offset = 16 + 16 * num_panels;
+      DIALS_ASSERT(size >= offset);
+      for (std::size_t i = 0; i < num_panels; ++i) {
+        af::c_grid<2> grid(header[1 + 2 * i], header[2 + 2 * i]);
+        DIALS_ASSERT(size >= offset + grid.size_1d() * sizeof(float));
+        panels_.push_back(
+          PanelData(reinterpret_cast<const float *>(begin + offset), grid));
+        offset += grid.size_1d() * sizeof(float);
+      }
+      DIALS_ASSERT(size == offset);
+    }
+
     /**
      * Extract a shoebox
      * @param bbox The bounding box
@@ -42,44 +107,51 @@ namespace dials { namespace algorithms {
      */
     virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
                                                       int6 bbox) const {
-      DIALS_ASSERT(panel < data_.size());
+      DIALS_ASSERT(panel < size());
       DIALS_ASSERT(bbox[1] > bbox[0]);
       DIALS_ASSERT(bbox[3] > bbox[2]);
       DIALS_ASSERT(bbox[5] > bbox[4]);
       af::c_grid<3> grid(bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0]);
       af::versa<double, af::c_grid<3> > result(grid, 0);
-      af::const_ref<double, af::c_grid<2> > data = data_[panel].const_ref();
-      for (std::size_t j = 0; j < result.accessor()[1]; ++j) {
-        for (std::size_t i = 0; i < result.accessor()[2]; ++i) {
-          int ii = bbox[0] + i;
-          int jj = bbox[2] + j;
-          if (ii >= 0 && jj >= 0 && ii < data.accessor()[1]
-              && jj < data.accessor()[0]) {
-            double value = data(jj, ii);
-            for (std::size_t k = 0; k < result.accessor()[0]; ++k) {
-              result(k, j, i) = value;
-            }
-          }
-        }
-      }
+      extract_frames(panel, bbox, result.ref());
       return result;
     }
 
+    /**
+     * Extract a shoebox into an existing array
+     * @param panel The panel
+     * @param bbox The bounding box
+     * @param result The array to fill with the model data
+     */
+    virtual void extract_into(std::size_t panel,
+                              int6 bbox,
+                              af::ref<float, af::c_grid<3> > result) const {
+      DIALS_ASSERT(panel < size());
+      DIALS_ASSERT(bbox[1] > bbox[0]);
+      DIALS_ASSERT(bbox[3] > bbox[2]);
+      DIALS_ASSERT(bbox[5] > bbox[4]);
+      DIALS_ASSERT(result.accessor().all_eq(af::c_grid<3>(
+        bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0])));
+      extract_frames(panel, bbox, result);
+    }
+
     /**
      * Add the background model
      * @param data The model data
      */
     void add(const af::const_ref<double, af::c_grid<2> > &data) {
-      af::versa<double, af::c_grid<2> > temp(data.accessor());
+      DIALS_ASSERT(filename_.empty());
+      af::versa<float, af::c_grid<2> > temp(data.accessor());
       std::copy(data.begin(), data.end(), temp.begin());
-      data_.push_back(temp);
+      owned_.push_back(temp);
+      panels_.push_back(PanelData(temp.begin(), temp.accessor()));
     }
 
     /**
      * The number of panels
      */
     std::size_t size() const {
-      return data_.size();
+      return panels_.size();
     }
 
     /**
@@ -88,11 +160,90 @@ namespace dials { namespace algorithms {
      */
     af::versa<double, af::c_grid<2> > data(std::size_t panel) const {
       DIALS_ASSERT(panel < size());
-      return data_[panel];
+      const PanelData &p = panels_[panel];
+      af::versa<double, af::c_grid<2> > result(p.grid);
+      std::copy(p.data, p.data + p.grid.size_1d(), result.begin());
+      return result;
+    }
+
+    /**
+     * @returns The name of the mapped file or an empty string
+     */
+    std::string filename() const {
+      return filename_;
+    }
+
+    /**
+     * Write the model to a file which can be mapped
+     * @param filename The model file
+     */
+    void write(const std::string &filename) const {
+      std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+      DIALS_ASSERT(file.is_open());
+      boost::uint64_t num_panels = size();
+      file.write(magic(), 8);
+      file.write(reinterpret_cast<const char *>(&num_panels), 8);
+      for (std::size_t i = 0; i < size(); ++i) {
+        boost::uint64_t shape[2] = {panels_[i].grid[0], panels_[i].grid[1]};
+        file.write(reinterpret_cast<const char *>(shape), 16);
+      }
+      for (std::size_t i = 0; i < size(); ++i) {
+        file.write(reinterpret_cast<const char *>(panels_[i].data),
+                   panels_[i].grid.size_1d() * sizeof(float));
+      }
+      DIALS_ASSERT(file.good());
     }
 
   protected:
-    af::shared<af::versa<double, af::c_grid<2> > > data_;
+    /**
+     * The data of a panel and its size
+     */
+    struct PanelData {
+      const float *data;
+      af::c_grid<2> grid;
+
+      PanelData(const float *data_, af::c_grid<2> grid_)
+          : data(data_), grid(grid_) {}
+    };
+
+    static const char *magic() {
+      return "DIALSBGM";
+    }
+
+    /**
+     * Copy the model into the first frame of the shoebox, with zero outside
+     * the panel, and then copy the first frame into the others.
+     */
+    template <typename T>
+    void extract_frames(std::size_t panel,
+                        int6 bbox,
+                        af::ref<T, af::c_grid<3> > result) const {
+      const PanelData &p = panels_[panel];
+      int ysize = p.grid[0];
+      int xsize = p.grid[1];
+      std::size_t zsize = result.accessor()[0];
+      std::size_t frame_size = result.accessor()[1] * result.accessor()[2];
+      int width = bbox[1] - bbox[0];
+      int x0 = std::max(bbox[0], 0);
+      int x1 = std::min(bbox[1], xsize);
+      T *out = &result[0];
+      std::fill(out, out + frame_size, T(0));
+      for (int jj = std::max(bbox[2], 0); jj < std::min(bbox[3], ysize); ++jj) {
+        const float *row = p.data + (std::size_t)jj * xsize;
+        T *dst = out + (jj - bbox[2]) * width - bbox[0];
+        for (int ii = x0; ii < x1; ++ii) {
+          dst[ii] = row[ii];
+        }
+      }
+      for (std::size_t k = 1; k < zsize; ++k) {
+        std::copy(out, out + frame_size, out + k * frame_size);
+      }
+    }
+
+    std::vector<PanelData> panels_;
+    std::vector<af::versa<float, af::c_grid<2> > > owned_;
+    boost::shared_ptr<boost::interprocess::mapped_region> region_;
+    std::string filename_;
   };
 
 }}  // namespace dials::algorithms
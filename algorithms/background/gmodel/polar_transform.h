@@ -12,10 +12,14 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GMODEL_POLAR_TRANSFORM_H
 #define DIALS_ALGORITHMS_BACKGROUND_GMODEL_POLAR_TRANSFORM_H
 
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dials/algorithms/polygon/spatial_interpolation.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -57,7 +61,11 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class to do a polar transform along resolution
+   * A class to do a polar transform along resolution. The maps are computed in
+   * bands of rows on separate threads, and the transforms work on blocks of
+   * rows: the overlaps of the pixels with the polar grid, which are most of
+   * the work, are found in parallel and then accumulated in pixel order, so
+   * the results are the same for any number of threads.
    */
   class PolarTransform {
   public:
@@ -66,23 +74,23 @@ namespace dials { namespace algorithms {
      * @param beam The beam model
      * @param panel The panel model
      * @param goniometer The goniometer model
+     * @param nthreads The number of threads
      */
     PolarTransform(const BeamBase &beam,
                    const Panel &panel,
-                   const Goniometer &goniometer) {
+                   const Goniometer &goniometer,
+                   std::size_t nthreads = 1) {
       // Set some image sizes
       vec2<std::size_t> image_size = panel.get_image_size();
       DIALS_ASSERT(image_size[0] > 0);
       DIALS_ASSERT(image_size[1] > 0);
       image_grid_ = af::c_grid<2>(image_size[1], image_size[0]);
+      af::c_grid<2> map_grid(image_size[1] + 1, image_size[0] + 1);
 
       // Allocate map arrays
-      image_xmap_ = af::versa<double, af::c_grid<2> >(
-        af::c_grid<2>(image_size[1] + 1, image_size[0] + 1));
-      image_ymap_ = af::versa<double, af::c_grid<2> >(
-        af::c_grid<2>(image_size[1] + 1, image_size[0] + 1));
-      discontinuity_ = af::versa<bool, af::c_grid<2> >(
-        af::c_grid<2>(image_size[1] + 1, image_size[0] + 1));
+      image_xmap_ = af::versa<double, af::c_grid<2> >(map_grid);
+      image_ymap_ = af::versa<double, af::c_grid<2> >(map_grid);
+      discontinuity_ = af::versa<bool, af::c_grid<2> >(map_grid);
 
       // Setup x, y, z axis for transform
       vec3<double> s0 = beam.get_s0().normalize();
@@ -91,50 +99,32 @@ namespace dials { namespace algorithms {
       vec3<double> yaxis = zaxis.cross(m2);
       vec3<double> xaxis = zaxis.cross(yaxis);
 
-      // Generate temporary array of x, y z coords
-      af::versa<double, af::c_grid<2> > temp_x(
-        af::c_grid<2>(image_size[1] + 1, image_size[0] + 1));
-      af::versa<double, af::c_grid<2> > temp_y(
-        af::c_grid<2>(image_size[1] + 1, image_size[0] + 1));
-      af::versa<double, af::c_grid<2> > temp_z(
-        af::c_grid<2>(image_size[1] + 1, image_size[0] + 1));
-      for (std::size_t j = 0; j < image_size[1] + 1; ++j) {
-        for (std::size_t i = 0; i < image_size[0] + 1; ++i) {
-          vec3<double> s1 = panel.get_pixel_lab_coord(vec2<double>(i, j)).normalize();
-          double z = s1 * zaxis;
-          double y = s1 * yaxis;
-          double x = s1 * xaxis;
-          temp_x(j, i) = x;
-          temp_y(j, i) = y;
-          temp_z(j, i) = z;
-        }
-      }
-
-      // Generate polar coords from image pixels
-      for (std::size_t j = 0; j < image_size[1] + 1; ++j) {
-        for (std::size_t i = 0; i < image_size[0] + 1; ++i) {
-          double z = temp_z(j, i);
-          double y = temp_y(j, i);
-          double x = temp_x(j, i);
-          image_xmap_(j, i) = std::acos(z);
-          image_ymap_(j, i) = std::atan2(y, x);
-
-          // Create an image with the discontinuity shown
-          discontinuity_(j, i) = false;
-          if (x <= 0) {
-            if (j < image_size[1]) {
-              int s1 = detail::sign(temp_y(j, i));
-              int s2 = detail::sign(temp_y(j + 1, i));
-              int s3 = detail::sign(temp_y(j, i + 1));
-              int s4 = detail::sign(temp_y(j + 1, i + 1));
-              if (s1 != s2 || s1 != s3 || s1 != s4 || s2 != s3 || s2 != s4
-                  || s3 != s4) {
-                discontinuity_(j, i) = true;
-              }
-            }
-          }
-        }
-      }
+      // Generate polar coords from image pixels, keeping the x and y coords
+      // to find the pixels where the angle wraps round
+      af::versa<double, af::c_grid<2> > temp_x(map_grid);
+      af::versa<double, af::c_grid<2> > temp_y(map_grid);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PolarTransform::compute_polar_rows,
+                    this,
+                    boost::cref(panel),
+                    xaxis,
+                    yaxis,
+                    zaxis,
+                    temp_x.ref(),
+                    temp_y.ref(),
+                    _1,
+                    _2),
+        map_grid[0],
+        nthreads);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PolarTransform::compute_discontinuity_rows,
+                    this,
+                    temp_x.const_ref(),
+                    temp_y.const_ref(),
+                    _1,
+                    _2),
+        map_grid[0],
+        nthreads);
 
       // Get the min/max x and y
       double map_xmin = image_xmap_[0];
@@ -178,16 +168,17 @@ namespace dials { namespace algorithms {
       double polar_ystep = (polar_ymax - polar_ymin) / polar_ysize;
 
       // Convert polar coords to indices
-      for (std::size_t j = 0; j < image_size[1] + 1; ++j) {
-        for (std::size_t i = 0; i < image_size[0] + 1; ++i) {
-          double px = image_xmap_(j, i);
-          double py = image_ymap_(j, i);
-          double pi = ((px - polar_xmin) / polar_xstep);
-          double pj = ((py - polar_ymin) / polar_ystep);
-          image_xmap_(j, i) = pi;
-          image_ymap_(j, i) = pj;
-        }
-      }
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PolarTransform::scale_rows,
+                    this,
+                    polar_xmin,
+                    polar_xstep,
+                    polar_ymin,
+                    polar_ystep,
+                    _1,
+                    _2),
+        map_grid[0],
+        nthreads);
     }
 
     /**
@@ -229,32 +220,42 @@ namespace dials { namespace algorithms {
      * transform to polar
      * @param data The image data
      * @param mask The image mask
+     * @param nthreads The number of threads
      * @returns The transformed data
      */
-    PolarTransformResult to_polar(
-      const af::const_ref<double, af::c_grid<2> > &data,
-      const af::const_ref<bool, af::c_grid<2> > &mask) const {
+    PolarTransformResult to_polar(const af::const_ref<double, af::c_grid<2> > &data,
+                                  const af::const_ref<bool, af::c_grid<2> > &mask,
+                                  std::size_t nthreads = 1) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(data.accessor().all_eq(image_grid_));
       DIALS_ASSERT(data.accessor()[0] + 1 == discontinuity_.accessor()[0]);
       DIALS_ASSERT(data.accessor()[1] + 1 == discontinuity_.accessor()[1]);
+      DIALS_ASSERT(nthreads > 0);
       af::versa<double, af::c_grid<2> > data_out(polar_grid_, 0);
       af::versa<bool, af::c_grid<2> > mask_out(polar_grid_, true);
       af::versa<bool, af::c_grid<2> > mask_tmp(polar_grid_, false);
 
-      for (std::size_t j = 0; j < image_grid_[0]; ++j) {
-        for (std::size_t i = 0; i < image_grid_[1]; ++i) {
-          // FIXME - Discarding pixels where the angle wraps round. Need to
-          // handle this better
-
-          if (discontinuity_(j, i)) {
-            continue;
-          }
-          vert4 input(gc(j, i), gc(j, i + 1), gc(j + 1, i + 1), gc(j + 1, i));
-          af::shared<Match> matches = quad_to_grid(input, polar_grid_, 0);
-          for (int m = 0; m < matches.size(); ++m) {
-            double fraction = matches[m].fraction;
-            int index = matches[m].out;
+      // Find the overlaps for a block of rows at a time and then accumulate
+      // them in pixel order
+      std::size_t block_size = rows_per_block * nthreads;
+      std::vector<af::shared<Match> > matches(block_size);
+      for (std::size_t first = 0; first < image_grid_[0]; first += block_size) {
+        std::size_t last = std::min(first + block_size, image_grid_[0]);
+        dials::algorithms::detail::parallel_bands(
+          boost::bind(&PolarTransform::match_rows_to_polar,
+                      this,
+                      first,
+                      boost::ref(matches),
+                      _1,
+                      _2),
+          last - first,
+          nthreads);
+        for (std::size_t j = first; j < last; ++j) {
+          const af::shared<Match> &row_matches = matches[j - first];
+          for (std::size_t m = 0; m < row_matches.size(); ++m) {
+            double fraction = row_matches[m].fraction;
+            int i = row_matches[m].in;
+            int index = row_matches[m].out;
             int ii = index % polar_grid_[1];
             int jj = index / polar_grid_[1];
             DIALS_ASSERT(jj >= 0 && jj < polar_grid_[0]);
@@ -285,16 +286,145 @@ namespace dials { namespace algorithms {
      * transform from polar
      * @param data The polar data
      * @param mask The polar mask
+     * @param nthreads The number of threads
      * @returns The transformed data
      */
-    PolarTransformResult from_polar(
-      const af::const_ref<double, af::c_grid<2> > &data,
-      const af::const_ref<bool, af::c_grid<2> > &mask) const {
+    PolarTransformResult from_polar(const af::const_ref<double, af::c_grid<2> > &data,
+                                    const af::const_ref<bool, af::c_grid<2> > &mask,
+                                    std::size_t nthreads = 1) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(data.accessor().all_eq(polar_grid_));
       af::versa<double, af::c_grid<2> > data_out(image_grid_, 0);
       af::versa<bool, af::c_grid<2> > mask_out(image_grid_, true);
-      for (std::size_t j = 0; j < image_grid_[0]; ++j) {
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PolarTransform::from_polar_rows,
+                    this,
+                    data,
+                    mask,
+                    data_out.ref(),
+                    mask_out.ref(),
+                    _1,
+                    _2),
+        image_grid_[0],
+        nthreads);
+      return PolarTransformResult(data_out, mask_out);
+    }
+
+  protected:
+    /**
+     * The number of rows per thread in each block of to_polar
+     */
+    static const std::size_t rows_per_block = 16;
+
+    /**
+     * @returns The corner of a pixel in polar grid coordinates
+     */
+    vec2<double> corner(std::size_t j, std::size_t i) const {
+      return vec2<double>(image_xmap_(j, i), image_ymap_(j, i));
+    }
+
+    /**
+     * Compute the polar coordinates of a band of rows of pixel corners
+     */
+    void compute_polar_rows(const Panel &panel,
+                            vec3<double> xaxis,
+                            vec3<double> yaxis,
+                            vec3<double> zaxis,
+                            af::ref<double, af::c_grid<2> > temp_x,
+                            af::ref<double, af::c_grid<2> > temp_y,
+                            std::size_t first,
+                            std::size_t last) {
+      for (std::size_t j = first; j < last; ++j) {
+        for (std::size_t i = 0; i < image_grid_[1] + 1; ++i) {
+          vec3<double> s1 = panel.get_pixel_lab_coord(vec2<double>(i, j)).normalize();
+          double z = s1 * zaxis;
+          double y = s1 * yaxis;
+          double x = s1 * xaxis;
+          temp_x(j, i) = x;
+          temp_y(j, i) = y;
+          image_xmap_(j, i) = std::acos(z);
+          image_ymap_(j, i) = std::atan2(y, x);
+        }
+      }
+    }
+
+    /**
+     * Mark the pixels in a band of rows where the angle wraps round
+     */
+    void compute_discontinuity_rows(af::const_ref<double, af::c_grid<2> > temp_x,
+                                    af::const_ref<double, af::c_grid<2> > temp_y,
+                                    std::size_t first,
+                                    std::size_t last) {
+      for (std::size_t j = first; j < last; ++j) {
+        for (std::size_t i = 0; i < image_grid_[1] + 1; ++i) {
+          discontinuity_(j, i) = false;
+          if (temp_x(j, i) <= 0) {
+            if (j < image_grid_[0] && i < image_grid_[1]) {
+              int s1 = detail::sign(temp_y(j, i));
+              int s2 = detail::sign(temp_y(j + 1, i));
+              int s3 = detail::sign(temp_y(j, i + 1));
+              int s4 = detail::sign(temp_y(j + 1, i + 1));
+              if (s1 != s2 || s1 != s3 || s1 != s4 || s2 != s3 || s2 != s4
+                  || s3 != s4) {
+                discontinuity_(j, i) = true;
+              }
+            }
+          }
+        }
+      }
+    }
+
+    /**
+     * Convert the polar coordinates of a band of rows to polar grid indices
+     */
+    void scale_rows(double xmin,
+                    double xstep,
+                    double ymin,
+                    double ystep,
+                    std::size_t first,
+                    std::size_t last) {
+      for (std::size_t j = first; j < last; ++j) {
+        for (std::size_t i = 0; i < image_grid_[1] + 1; ++i) {
+          image_xmap_(j, i) = (image_xmap_(j, i) - xmin) / xstep;
+          image_ymap_(j, i) = (image_ymap_(j, i) - ymin) / ystep;
+        }
+      }
+    }
+
+    /**
+     * Find the overlaps of the pixels in a band of rows of a block with the
+     * polar grid. The matches are tagged with the x index of the pixel.
+     */
+    void match_rows_to_polar(std::size_t row0,
+                             std::vector<af::shared<Match> > &matches,
+                             std::size_t first,
+                             std::size_t last) const {
+      for (std::size_t r = first; r < last; ++r) {
+        std::size_t j = row0 + r;
+        matches[r].clear();
+        for (std::size_t i = 0; i < image_grid_[1]; ++i) {
+          // FIXME - Discarding pixels where the angle wraps round. Need to
+          // handle this better
+          if (discontinuity_(j, i)) {
+            continue;
+          }
+          vert4 input(
+            corner(j, i), corner(j, i + 1), corner(j + 1, i + 1), corner(j + 1, i));
+          quad_to_grid(input, polar_grid_, i, matches[r]);
+        }
+      }
+    }
+
+    /**
+     * Transform a band of rows of the image from polar
+     */
+    void from_polar_rows(af::const_ref<double, af::c_grid<2> > data,
+                         af::const_ref<bool, af::c_grid<2> > mask,
+                         af::ref<double, af::c_grid<2> > data_out,
+                         af::ref<bool, af::c_grid<2> > mask_out,
+                         std::size_t first,
+                         std::size_t last) const {
+      for (std::size_t j = first; j < last; ++j) {
         for (std::size_t i = 0; i < image_grid_[1]; ++i) {
           // FIXME - Discarding pixels where the angle wraps round. Need to
           // handle this better
@@ -303,7 +433,8 @@ namespace dials { namespace algorithms {
             mask_out(j, i) = false;
             continue;
           }
-          vert4 input(gc(j, i), gc(j, i + 1), gc(j + 1, i + 1), gc(j + 1, i));
+          vert4 input(
+            corner(j, i), corner(j, i + 1), corner(j + 1, i + 1), corner(j + 1, i));
           af::shared<Match> matches = grid_to_quad(input, polar_grid_, 0);
           for (int m = 0; m < matches.size(); ++m) {
             double fraction = matches[m].fraction;
@@ -322,11 +453,8 @@ namespace dials { namespace algorithms {
           }
         }
       }
-
-      return PolarTransformResult(data_out, mask_out);
     }
 
-  protected:
     af::c_grid<2> image_grid_;
     af::c_grid<2> polar_grid_;
     af::versa<double, af::c_grid<2> > image_xmap_;
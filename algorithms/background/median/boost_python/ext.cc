@@ -11,13 +11,17 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/background/median/creator.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace background { namespace boost_python {
 
   using namespace boost::python;
 
   BOOST_PYTHON_MODULE(dials_algorithms_background_median_ext) {
-    def("create", &create_from_shoebox);
+    dials::util::boost_python::import_shared_executor();
+    def("create",
+        (af::shared<bool>(*)(af::ref<Shoebox<> >, std::size_t)) & create_from_shoebox,
+        (arg("shoeboxes"), arg("nthreads") = 1));
     def("create", &create_from_image_volume);
   }
 
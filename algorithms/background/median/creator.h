@@ -12,10 +12,15 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_MEDIAN_CREATOR_H
 #define DIALS_ALGORITHMS_BACKGROUND_MEDIAN_CREATOR_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/image_volume.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -33,39 +38,89 @@ namespace dials { namespace algorithms {
       return temp[temp.size() / 2];
     }
 
+    /**
+     * Scratch space for computing the median background, which can be
+     * reused between shoeboxes
+     */
+    struct MedianScratch {
+      std::vector<double> values;
+      std::vector<std::size_t> counts;
+    };
+
+    /**
+     * Compute the median of the values. This is the element at size / 2 in
+     * sorted order, as for median above. If the values are small integers,
+     * as they are for count data, the median is found from a histogram of
+     * the values, otherwise it is selected with nth_element. The values are
+     * reordered.
+     * @param values The values
+     * @param max_value The maximum value
+     * @param integer Are all the values integers
+     * @param counts Scratch space for the histogram
+     * @returns The median
+     */
+    inline double select_median(std::vector<double> &values,
+                                double max_value,
+                                bool integer,
+                                std::vector<std::size_t> &counts) {
+      DIALS_ASSERT(values.size() > 0);
+      std::size_t n = values.size();
+      std::size_t k = n / 2;
+      if (integer && max_value < 4.0 * n + 256) {
+        counts.assign((std::size_t)max_value + 1, 0);
+        for (std::size_t i = 0; i < n; ++i) {
+          counts[(std::size_t)values[i]]++;
+        }
+        std::size_t total = 0;
+        for (std::size_t v = 0; v < counts.size(); ++v) {
+          total += counts[v];
+          if (total > k) {
+            return (double)v;
+          }
+        }
+        DIALS_ASSERT(false);
+      }
+      std::nth_element(values.begin(), values.begin() + k, values.end());
+      return values[k];
+    }
+
   }  // namespace detail
 
+  /**
+   * Compute the background of a shoebox as the median of the background
+   * pixels
+   * @param data The shoebox data
+   * @param background The shoebox background
+   * @param mask The shoebox mask
+   * @param scratch The scratch space to use
+   */
   template <typename T>
   void create_from_arrays(const af::const_ref<T, af::c_grid<3> > &data,
                           af::ref<T, af::c_grid<3> > background,
-                          af::ref<int, af::c_grid<3> > mask) {
+                          af::ref<int, af::c_grid<3> > mask,
+                          detail::MedianScratch &scratch) {
     DIALS_ASSERT(data.accessor().all_eq(background.accessor()));
     DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
 
-    // Compute number of background pixels
-    std::size_t num_background = 0;
+    // Copy the background pixels into the scratch space
+    std::vector<double> &Y = scratch.values;
+    Y.clear();
+    double max_value = 0;
+    bool integer = true;
     int mask_code = Valid | Background;
     for (std::size_t i = 0; i < mask.size(); ++i) {
       if ((mask[i] & mask_code) == mask_code) {
-        num_background++;
-      }
-    }
-    DIALS_ASSERT(num_background > 0);
-
-    // Allocate some arrays
-    af::shared<double> Y(num_background, 0);
-    std::size_t j = 0;
-    for (std::size_t i = 0; i < mask.size(); ++i) {
-      if ((mask[i] & mask_code) == mask_code) {
-        DIALS_ASSERT(j < Y.size());
-        DIALS_ASSERT(data[i] >= 0);
-        Y[j++] = data[i];
+        double y = data[i];
+        DIALS_ASSERT(y >= 0);
+        Y.push_back(y);
+        max_value = std::max(max_value, y);
+        integer = integer && (y == std::floor(y));
       }
     }
-    DIALS_ASSERT(j == Y.size());
+    DIALS_ASSERT(Y.size() > 0);
 
     // Compute the median value for the starting value
-    double median = detail::median(Y.const_ref());
+    double median = detail::select_median(Y, max_value, integer, scratch.counts);
 
     // Fill in the background shoebox values
     for (std::size_t i = 0; i < data.size(); ++i) {
@@ -76,27 +131,73 @@ namespace dials { namespace algorithms {
     }
   }
 
+  /**
+   * Compute the background of a shoebox as the median of the background
+   * pixels
+   * @param data The shoebox data
+   * @param background The shoebox background
+   * @param mask The shoebox mask
+   */
+  template <typename T>
+  void create_from_arrays(const af::const_ref<T, af::c_grid<3> > &data,
+                          af::ref<T, af::c_grid<3> > background,
+                          af::ref<int, af::c_grid<3> > mask) {
+    detail::MedianScratch scratch;
+    create_from_arrays(data, background, mask, scratch);
+  }
+
+  namespace detail {
+
+    /**
+     * Compute the background for a range of shoeboxes
+     */
+    inline void create_from_shoebox_range(af::ref<Shoebox<> > sbox,
+                                          af::ref<bool> success,
+                                          std::size_t first,
+                                          std::size_t last) {
+      MedianScratch scratch;
+      for (std::size_t i = first; i < last; ++i) {
+        try {
+          DIALS_ASSERT(sbox[i].is_consistent());
+          create_from_arrays(sbox[i].data.const_ref(),
+                             sbox[i].background.ref(),
+                             sbox[i].mask.ref(),
+                             scratch);
+        } catch (scitbx::error) {
+          success[i] = false;
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
+
+  }  // namespace detail
+
   /**
    * Compute the background values
    * @param sbox The shoeboxes
+   * @param nthreads The number of threads
    * @returns Success True/False
    */
-  inline af::shared<bool> create_from_shoebox(af::ref<Shoebox<> > sbox) {
+  inline af::shared<bool> create_from_shoebox(af::ref<Shoebox<> > sbox,
+                                              std::size_t nthreads) {
     af::shared<bool> success(sbox.size(), true);
-    for (std::size_t i = 0; i < sbox.size(); ++i) {
-      try {
-        DIALS_ASSERT(sbox[i].is_consistent());
-        create_from_arrays(
-          sbox[i].data.const_ref(), sbox[i].background.ref(), sbox[i].mask.ref());
-      } catch (scitbx::error) {
-        success[i] = false;
-      } catch (dials::error) {
-        success[i] = false;
-      }
-    }
+    detail::parallel_bands(
+      boost::bind(&detail::create_from_shoebox_range, sbox, success.ref(), _1, _2),
+      sbox.size(),
+      nthreads);
     return success;
   }
 
+  /**
+   * Compute the background values
+   * @param sbox The shoeboxes
+   * @returns Success True/False
+   */
+  inline af::shared<bool> create_from_shoebox(af::ref<Shoebox<> > sbox) {
+    return create_from_shoebox(sbox, 1);
+  }
+
   /**
    * Compute the background values
    * @param reflections The reflection table
@@ -112,6 +213,7 @@ namespace dials { namespace algorithms {
     af::const_ref<int6> bbox = reflections["bbox"];
     af::const_ref<std::size_t> panel = reflections["panel"];
     af::shared<bool> success(bbox.size(), true);
+    detail::MedianScratch scratch;
     for (std::size_t i = 0; i < bbox.size(); ++i) {
       // Get the image volume
       ImageVolume<> v = volume.get(panel[i]);
@@ -126,7 +228,7 @@ namespace dials { namespace algorithms {
 
       // Compute the background
       try {
-        create_from_arrays(data.const_ref(), bgrd.ref(), mask.ref());
+        create_from_arrays(data.const_ref(), bgrd.ref(), mask.ref(), scratch);
 
         // Need to set the background in volume
         v.set_background(b, bgrd.const_ref());
@@ -11,7 +11,10 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_MODELLER_H
 #define DIALS_ALGORITHMS_BACKGROUND_MODELLER_H
 
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <dials/model/data/image_volume.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials { namespace algorithms {
 
@@ -28,8 +31,9 @@ namespace dials { namespace algorithms {
     /**
      * Initialize from an image volume
      * @param volume The image volume
+     * @param nthreads The number of threads
      */
-    BackgroundStatistics(const ImageVolume<> &volume)
+    BackgroundStatistics(const ImageVolume<> &volume, std::size_t nthreads = 1)
         : accessor_(volume.accessor()[1], volume.accessor()[2]),
           sum_(accessor_, 0.0),
           sum_sq_(accessor_, 0.0),
@@ -37,24 +41,18 @@ namespace dials { namespace algorithms {
           min_(accessor_, -1),
           max_(accessor_, -1) {
       DIALS_ASSERT(volume.is_consistent());
+      DIALS_ASSERT(nthreads > 0);
       typedef ImageVolume<>::float_type FloatType;
       af::const_ref<FloatType, af::c_grid<3> > data = volume.data().const_ref();
       af::const_ref<int, af::c_grid<3> > mask = volume.mask().const_ref();
-      for (std::size_t j = 0; j < accessor_[0]; ++j) {
-        for (std::size_t i = 0; i < accessor_[1]; ++i) {
-          for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
-            double d = data(k, j, i);
-            int m = mask(k, j, i);
-            if ((m & Valid) && !(m & Foreground)) {
-              sum_(j, i) += d;
-              sum_sq_(j, i) += d * d;
-              num_(j, i) += 1;
-              if (min_(j, i) == -1 || min_(j, i) > d) min_(j, i) = d;
-              if (max_(j, i) == -1 || max_(j, i) < d) max_(j, i) = d;
-            }
-          }
-        }
-      }
+      detail::parallel_bands(boost::bind(&BackgroundStatistics::add_rows<FloatType>,
+                                         this,
+                                         data,
+                                         mask,
+                                         _1,
+                                         _2),
+                             accessor_[0],
+                             nthreads);
     }
 
     /**
@@ -156,12 +154,17 @@ namespace dials { namespace algorithms {
      */
     af::versa<double, af::c_grid<2> > dispersion(std::size_t min_images) const {
       DIALS_ASSERT(min_images > 0);
-      af::versa<double, af::c_grid<2> > m = mean(min_images);
-      af::versa<double, af::c_grid<2> > v = variance(min_images);
       af::versa<double, af::c_grid<2> > result(accessor_);
       for (std::size_t i = 0; i < result.size(); ++i) {
-        if (m[i] > 0) {
-          result[i] = v[i] / m[i];
+        if (num_[i] >= min_images) {
+          double m = sum_[i] / num_[i];
+          double v = (sum_sq_[i] - sum_[i] * sum_[i] / num_[i]) / num_[i];
+          if (v < 0) {
+            v = 0;
+          }
+          if (m > 0) {
+            result[i] = v / m;
+          }
         }
       }
       return result;
@@ -180,6 +183,33 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Add the pixels in a range of rows of every frame. The frames are read
+     * in order so the data is read contiguously.
+     */
+    template <typename FloatType>
+    void add_rows(const af::const_ref<FloatType, af::c_grid<3> > &data,
+                  const af::const_ref<int, af::c_grid<3> > &mask,
+                  std::size_t first,
+                  std::size_t last) {
+      std::size_t width = accessor_[1];
+      std::size_t frame_size = accessor_.size_1d();
+      for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
+        const FloatType *d = &data[k * frame_size];
+        const int *m = &mask[k * frame_size];
+        for (std::size_t l = first * width; l < last * width; ++l) {
+          if ((m[l] & Valid) && !(m[l] & Foreground)) {
+            double v = d[l];
+            sum_[l] += v;
+            sum_sq_[l] += v * v;
+            num_[l] += 1;
+            if (min_[l] == -1 || min_[l] > v) min_[l] = v;
+            if (max_[l] == -1 || max_[l] < v) max_[l] = v;
+          }
+        }
+      }
+    }
+
     af::c_grid<2> accessor_;
     af::versa<double, af::c_grid<2> > sum_;
     af::versa<double, af::c_grid<2> > sum_sq_;
@@ -196,10 +226,12 @@ namespace dials { namespace algorithms {
     /**
      * Initialize with multipanel image volume
      * @param volume The multi panel image volume
+     * @param nthreads The number of threads
      */
-    MultiPanelBackgroundStatistics(const MultiPanelImageVolume<> &volume) {
+    MultiPanelBackgroundStatistics(const MultiPanelImageVolume<> &volume,
+                                   std::size_t nthreads = 1) {
       for (std::size_t i = 0; i < volume.size(); ++i) {
-        statistics_.push_back(BackgroundStatistics(volume.get(i)));
+        statistics_.push_back(BackgroundStatistics(volume.get(i), nthreads));
       }
     }
 
@@ -1,6 +1,7 @@
 from __future__ import absolute_import, division, print_function
 
 import logging
+from collections import OrderedDict
 
 from dials_algorithms_background_modeller_ext import (
     BackgroundStatistics,
@@ -14,30 +15,88 @@
     "BackgroundStatistics",
     "FinalizeModel",
     "MultiPanelBackgroundStatistics",
+    "polar_transform",
 ]
 
 logger = logging.getLogger(__name__)
 
+# The polar transforms of the most recently used geometries
+_polar_transforms = OrderedDict()
+_max_polar_transforms = 4
+
+
+def _polar_transform_key(beam, panel, goniometer):
+    """
+    The geometry which determines a polar transform
+    """
+    return (
+        tuple(beam.get_unit_s0()),
+        tuple(goniometer.get_rotation_axis()),
+        tuple(panel.get_d_matrix()),
+        tuple(panel.get_pixel_size()),
+        tuple(panel.get_image_size()),
+        panel.get_px_mm_strategy().name(),
+        panel.get_thickness(),
+        panel.get_mu(),
+    )
+
+
+def polar_transform(beam, panel, goniometer, nthreads=None):
+    """
+    Get the polar transform for a panel. The transforms are cached by geometry,
+    so models of panels with the same geometry share the same maps.
+
+    :param beam: The beam model
+    :param panel: The panel model
+    :param goniometer: The goniometer model
+    :param nthreads: The number of threads (defaults to the shared thread budget)
+    :returns: The polar transform
+    """
+    from dials.algorithms.background.gmodel import PolarTransform
+    from dials.util.ext import get_num_threads
+
+    key = _polar_transform_key(beam, panel, goniometer)
+    transform = _polar_transforms.pop(key, None)
+    if transform is None:
+        if nthreads is None:
+            nthreads = get_num_threads()
+        transform = PolarTransform(beam, panel, goniometer, nthreads=nthreads)
+        while len(_polar_transforms) >= _max_polar_transforms:
+            _polar_transforms.popitem(last=False)
+    _polar_transforms[key] = transform
+    return transform
+
 
 class FinalizeModel(object):
     """
     A class to finalize the background model
     """
 
-    def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100):
+    def __init__(
+        self,
+        experiments,
+        filter_type="median",
+        kernel_size=10,
+        niter=100,
+        nthreads=None,
+    ):
         """
         Initialize the finalizer
 
         :param experiments: The experiment list
         :param kernel_size: The median filter kernel size
         :param niter: The number of iterations for filling holes
+        :param nthreads: The number of threads for the polar transform
         """
-        from dials.algorithms.background.gmodel import PolarTransform
+        from dials.util.ext import get_num_threads
 
         # Set some parameters
         self.filter_type = filter_type
         self.kernel_size = kernel_size
         self.niter = niter
+        if nthreads is None:
+            nthreads = get_num_threads()
+        self.nthreads = nthreads
 
         # Check the input
         assert len(experiments) == 1
@@ -47,9 +106,12 @@ def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100)
         # Save the experiment
         self.experiment = experiment
 
-        # Create the transform object
-        self.transform = PolarTransform(
-            experiment.beam, experiment.detector[0], experiment.goniometer
+        # Get the transform object
+        self.transform = polar_transform(
+            experiment.beam,
+            experiment.detector[0],
+            experiment.goniometer,
+            nthreads=nthreads,
         )
 
     def finalize(self, data, mask):
@@ -73,7 +135,7 @@ def finalize(self, data, mask):
 
         # Transform to polar
         logger.info("Transforming image data to polar grid")
-        result = self.transform.to_polar(data, mask)
+        result = self.transform.to_polar(data, mask, nthreads=self.nthreads)
         data = result.data()
         mask = result.mask()
         sub_data = data.as_1d().select(mask.as_1d())
@@ -122,7 +184,7 @@ def finalize(self, data, mask):
 
         # Transform back
         logger.info("Transforming image data from polar grid")
-        result = self.transform.from_polar(data, mask)
+        result = self.transform.from_polar(data, mask, nthreads=self.nthreads)
         data = result.data()
         mask = result.mask()
         sub_data = data.as_1d().select(mask.as_1d())
@@ -337,7 +399,12 @@ def compute(self):
         self.reflections.compute_bbox(self.experiments)
 
         # Construvt the image integrator processor
-        processor = ProcessorImage(self.experiments, self.reflections, self.params)
+        processor = ProcessorImage(
+            self.experiments,
+            self.reflections,
+            self.params,
+            images_per_task=self.params.modeller.images_per_task,
+        )
         processor.executor = BackgroundModellerExecutor(self.experiments, self.params)
 
         # Do the processing
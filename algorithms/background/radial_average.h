@@ -11,8 +11,15 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_RADIAL_AVERAGE_H
 #define DIALS_ALGORITHMS_BACKGROUND_RADIAL_AVERAGE_H
 
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -21,8 +28,30 @@ namespace dials { namespace algorithms {
   using dxtbx::model::Detector;
   using dxtbx::model::Panel;
 
+  /**
+   * Compute the radial average of a set of images in bins of 1/d^2.
+   *
+   * The bin of each pixel depends only on the geometry so it is computed
+   * once for each panel and kept in a map of bin indices. Adding an image then
+   * only reads the data, the mask and the bin index of each pixel. The maps
+   * are recomputed if the beam direction changes.
+   *
+   * The images are added one panel at a time in the order of the panels in
+   * the detector, after which the next panel added is the first panel of the
+   * next image. Calls on the same object are serialised.
+   */
   class RadialAverage {
   public:
+    typedef boost::uint16_t index_type;
+
+    /**
+     * Initialise the radial average
+     * @param beam The beam model
+     * @param detector The detector model
+     * @param vmin The minimum 1/d^2
+     * @param vmax The maximum 1/d^2
+     * @param num_bins The number of bins
+     */
     RadialAverage(boost::shared_ptr<BeamBase> beam,
                   const Detector &detector,
                   double vmin,
@@ -36,42 +65,70 @@ namespace dials { namespace algorithms {
           vmin_(vmin),
           vmax_(vmax),
           num_bins_(num_bins),
-          current_(0) {
+          current_(0),
+          s0_(0, 0, 0),
+          index_(detector.size()) {
       DIALS_ASSERT(vmax > vmin);
       DIALS_ASSERT(num_bins > 0);
+      DIALS_ASSERT(num_bins < 65536);
+      DIALS_ASSERT(detector.size() > 0);
       for (std::size_t i = 0; i < inv_d2_.size(); ++i) {
         inv_d2_[i] = vmin + i * (vmax - vmin) / num_bins_;
       }
     }
 
+    /**
+     * Add the next panel of an image
+     * @param data The panel data
+     * @param mask The panel mask
+     * @param nthreads The number of threads
+     */
     void add(const af::const_ref<double, af::c_grid<2> > &data,
-             const af::const_ref<bool, af::c_grid<2> > &mask) {
+             const af::const_ref<bool, af::c_grid<2> > &mask,
+             std::size_t nthreads) {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-      vec3<double> s0 = beam_->get_s0();
-      const Panel &panel = detector_[current_++];
-      std::size_t height = panel.get_image_size()[1];
-      std::size_t width = panel.get_image_size()[0];
-      DIALS_ASSERT(data.accessor()[0] == height);
-      DIALS_ASSERT(data.accessor()[1] == width);
-      for (std::size_t j = 0; j < height; ++j) {
-        for (std::size_t i = 0; i < width; ++i) {
-          if (mask(j, i)) {
-            double d = panel.get_resolution_at_pixel(s0, vec2<double>(i, j));
-            double d2 = (1.0 / (d * d));
-            if (d2 >= vmin_ && d2 < vmax_) {
-              double b = vmin_;
-              double a = (vmax_ - vmin_) / num_bins_;
-              int index = std::floor((d2 - b) / a);
-              DIALS_ASSERT(index >= 0 && index < num_bins_);
-              sum_[index] += data(j, i);
-              weight_[index] += 1.0;
-            }
-          }
+      DIALS_ASSERT(nthreads > 0);
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      std::size_t panel = current_;
+      current_ = (current_ + 1) % detector_.size();
+      const af::versa<index_type, af::c_grid<2> > &index = bin_index(panel);
+      DIALS_ASSERT(data.accessor().all_eq(index.accessor()));
+
+      // Accumulate a histogram for each band of rows. Pixels which are masked
+      // or out of range go in an extra bin at the end which is ignored.
+      std::size_t height = data.accessor()[0];
+      std::size_t nbands = std::max((std::size_t)1, std::min(nthreads, height));
+      std::vector<double> sum(nbands * (num_bins_ + 1), 0.0);
+      std::vector<double> weight(nbands * (num_bins_ + 1), 0.0);
+      detail::parallel_bands(boost::bind(&RadialAverage::add_bands,
+                                         this,
+                                         boost::cref(data),
+                                         boost::cref(mask),
+                                         index.const_ref(),
+                                         nbands,
+                                         &sum[0],
+                                         &weight[0],
+                                         _1,
+                                         _2),
+                             nbands,
+                             nbands);
+
+      // Add the histograms in band order
+      for (std::size_t b = 0; b < nbands; ++b) {
+        const double *s = &sum[b * (num_bins_ + 1)];
+        const double *w = &weight[b * (num_bins_ + 1)];
+        for (std::size_t i = 0; i < num_bins_; ++i) {
+          sum_[i] += s[i];
+          weight_[i] += w[i];
         }
       }
     }
 
+    /**
+     * @returns The mean in each bin
+     */
     af::shared<double> mean() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
       af::shared<double> result(sum_.size());
       for (std::size_t i = 0; i < sum_.size(); ++i) {
         if (weight_[i] > 0) {
@@ -83,15 +140,95 @@ namespace dials { namespace algorithms {
       return result;
     }
 
+    /**
+     * @returns The number of pixels in each bin
+     */
     af::shared<double> weight() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
       return weight_;
     }
 
+    /**
+     * @returns The 1/d^2 at the start of each bin
+     */
     af::shared<double> inv_d2() const {
       return inv_d2_;
     }
 
   private:
+    /**
+     * Get the bin index of each pixel on a panel, computing it if the panel
+     * has not been seen with the current beam. Pixels outside the range of
+     * 1/d^2 have an index equal to the number of bins.
+     */
+    const af::versa<index_type, af::c_grid<2> > &bin_index(std::size_t panel) {
+      DIALS_ASSERT(panel < index_.size());
+      vec3<double> s0 = beam_->get_s0();
+      if (s0 != s0_) {
+        for (std::size_t i = 0; i < index_.size(); ++i) {
+          index_[i] = af::versa<index_type, af::c_grid<2> >();
+        }
+        s0_ = s0;
+      }
+      if (index_[panel].size() == 0) {
+        index_[panel] = compute_bin_index(detector_[panel], s0);
+      }
+      return index_[panel];
+    }
+
+    /**
+     * Compute the bin index of each pixel on a panel
+     */
+    af::versa<index_type, af::c_grid<2> > compute_bin_index(
+      const Panel &panel,
+      vec3<double> s0) const {
+      std::size_t height = panel.get_image_size()[1];
+      std::size_t width = panel.get_image_size()[0];
+      af::versa<index_type, af::c_grid<2> > result(
+        af::c_grid<2>(height, width), af::init_functor_null<index_type>());
+      double b = vmin_;
+      double a = (vmax_ - vmin_) / num_bins_;
+      for (std::size_t j = 0; j < height; ++j) {
+        for (std::size_t i = 0; i < width; ++i) {
+          double d = panel.get_resolution_at_pixel(s0, vec2<double>(i, j));
+          double d2 = (1.0 / (d * d));
+          std::size_t index = num_bins_;
+          if (d2 >= vmin_ && d2 < vmax_) {
+            index = (std::size_t)std::floor((d2 - b) / a);
+            DIALS_ASSERT(index < num_bins_);
+          }
+          result(j, i) = (index_type)index;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Accumulate the histograms for a range of bands of rows
+     */
+    void add_bands(const af::const_ref<double, af::c_grid<2> > &data,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   const af::const_ref<index_type, af::c_grid<2> > &index,
+                   std::size_t nbands,
+                   double *sum,
+                   double *weight,
+                   std::size_t first,
+                   std::size_t last) const {
+      std::size_t height = data.accessor()[0];
+      std::size_t width = data.accessor()[1];
+      for (std::size_t b = first; b < last; ++b) {
+        double *s = sum + b * (num_bins_ + 1);
+        double *w = weight + b * (num_bins_ + 1);
+        std::size_t k0 = (b * height / nbands) * width;
+        std::size_t k1 = ((b + 1) * height / nbands) * width;
+        for (std::size_t k = k0; k < k1; ++k) {
+          std::size_t bin = mask[k] ? index[k] : num_bins_;
+          s[bin] += data[k];
+          w[bin] += 1.0;
+        }
+      }
+    }
+
     boost::shared_ptr<BeamBase> beam_;
     Detector detector_;
     af::shared<double> sum_;
@@ -101,6 +238,9 @@ namespace dials { namespace algorithms {
     double vmax_;
     std::size_t num_bins_;
     std::size_t current_;
+    vec3<double> s0_;
+    std::vector<af::versa<index_type, af::c_grid<2> > > index_;
+    mutable boost::mutex mutex_;
   };
 
 }}  // namespace dials::algorithms
@@ -15,14 +15,11 @@
 #include <cmath>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
-#include <scitbx/matrix/inversion.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms { namespace background {
 
-  using scitbx::matrix::inversion_in_place;
-
   /**
    * An abtract class for the background model
    */
@@ -205,6 +202,10 @@ namespace dials { namespace algorithms { namespace background {
 
   /**
    * Create a background model that is a plane per image.
+   *
+   * The normal equations are solved in closed form from the sums of 1, x, y,
+   * x^2, xy, y^2, v, xv and yv over the masked pixels, with the coordinates
+   * taken about their mean so the equations are well conditioned.
    */
   class Linear2dModeller : public Modeller {
   public:
@@ -212,58 +213,90 @@ namespace dials { namespace algorithms { namespace background {
       const af::const_ref<double, af::c_grid<3> > &data,
       const af::const_ref<bool, af::c_grid<3> > &mask) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-      af::shared<double> a(mask.accessor()[0], 0);
-      af::shared<double> b(mask.accessor()[0], 0);
-      af::shared<double> c(mask.accessor()[0], 0);
-      af::shared<double> va(mask.accessor()[0], 0);
-      af::shared<double> vb(mask.accessor()[0], 0);
-      af::shared<double> vc(mask.accessor()[0], 0);
-      for (std::size_t k = 0; k < mask.accessor()[0]; ++k) {
-        af::shared<double> A(3 * 3, 0);
-        af::shared<double> B(3, 0);
-        for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
-              double x = (i + 0.5);
-              double y = (j + 0.5);
-              double p = data(k, j, i);
-              A[0] += 1;
-              A[1] += x;
-              A[2] += y;
-              A[4] += x * x;
-              A[5] += x * y;
-              A[8] += y * y;
-              B[0] += p;
-              B[1] += x * p;
-              B[2] += y * p;
-            }
+      std::size_t zsize = mask.accessor()[0];
+      std::size_t ysize = mask.accessor()[1];
+      std::size_t xsize = mask.accessor()[2];
+      af::shared<double> a(zsize, 0);
+      af::shared<double> b(zsize, 0);
+      af::shared<double> c(zsize, 0);
+      af::shared<double> va(zsize, 0);
+      af::shared<double> vb(zsize, 0);
+      af::shared<double> vc(zsize, 0);
+      for (std::size_t k = 0; k < zsize; ++k) {
+        const double *d = &data[k * ysize * xsize];
+        const bool *m = &mask[k * ysize * xsize];
+
+        // Accumulate the sums along each row and then over the rows
+        double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+        double sp = 0, sxp = 0, syp = 0;
+        for (std::size_t j = 0; j < ysize; ++j) {
+          const double *drow = d + j * xsize;
+          const bool *mrow = m + j * xsize;
+          double rn = 0, rx = 0, rxx = 0, rp = 0, rxp = 0;
+          for (std::size_t i = 0; i < xsize; ++i) {
+            double w = mrow[i] ? 1.0 : 0.0;
+            double p = mrow[i] ? drow[i] : 0.0;
+            double x = (i + 0.5);
+            rn += w;
+            rx += w * x;
+            rxx += w * x * x;
+            rp += p;
+            rxp += p * x;
           }
+          double y = (j + 0.5);
+          n += rn;
+          sx += rx;
+          sy += rn * y;
+          sxx += rxx;
+          sxy += rx * y;
+          syy += rn * y * y;
+          sp += rp;
+          sxp += rxp;
+          syp += rp * y;
         }
-        A[3] = A[1];
-        A[6] = A[2];
-        A[7] = A[5];
-        inversion_in_place(A.begin(), 3, B.begin(), 1);
-        a[k] = B[0];
-        b[k] = B[1];
-        c[k] = B[2];
+
+        // Solve the normal equations about the mean coordinate
+        DIALS_ASSERT(n > 0);
+        double mx = sx / n;
+        double my = sy / n;
+        double mp = sp / n;
+        double suu = sxx - sx * mx;
+        double suv = sxy - sx * my;
+        double svv = syy - sy * my;
+        double sup = sxp - sx * mp;
+        double svp = syp - sy * mp;
+        double det = suu * svv - suv * suv;
+        DIALS_ASSERT(det > 0);
+        b[k] = (svv * sup - suv * svp) / det;
+        c[k] = (suu * svp - suv * sup) / det;
+        a[k] = mp - b[k] * mx - c[k] * my;
+
+        // The diagonal of the inverse of the normal matrix
+        double iaa =
+          1.0 / n + (mx * mx * svv - 2.0 * mx * my * suv + my * my * suu) / det;
+        double ibb = svv / det;
+        double icc = suu / det;
+
+        // Compute the residuals
         double S = 0.0;
         int count = 0;
-        for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
+        for (std::size_t j = 0; j < ysize; ++j) {
+          const double *drow = d + j * xsize;
+          const bool *mrow = m + j * xsize;
+          double y = (j + 0.5);
+          for (std::size_t i = 0; i < xsize; ++i) {
+            if (mrow[i]) {
               double x = (i + 0.5);
-              double y = (j + 0.5);
-              double p = data(k, j, i);
-              double s = (p - a[k] - b[k] * x - c[k] * y);
+              double s = (drow[i] - a[k] - b[k] * x - c[k] * y);
               S += s * s;
               count++;
             }
           }
         }
         DIALS_ASSERT(count > 3);
-        va[k] = S * A[0] / (count - 3);
-        vb[k] = S * A[4] / (count - 3);
-        vc[k] = S * A[8] / (count - 3);
+        va[k] = S * iaa / (count - 3);
+        vb[k] = S * ibb / (count - 3);
+        vc[k] = S * icc / (count - 3);
       }
       return boost::make_shared<Linear2dModel>(a, b, c, va, vb, vc);
     }
@@ -313,6 +346,10 @@ namespace dials { namespace algorithms { namespace background {
 
   /**
    * Create a background model that is a 3d hyper-plane.
+   *
+   * The normal equations are solved in closed form from the sums of the
+   * coordinates, their products and the pixel values over the masked pixels,
+   * with the coordinates taken about their mean.
    */
   class Linear3dModeller : public Modeller {
   public:
@@ -320,52 +357,100 @@ namespace dials { namespace algorithms { namespace background {
       const af::const_ref<double, af::c_grid<3> > &data,
       const af::const_ref<bool, af::c_grid<3> > &mask) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-      af::shared<double> A(4 * 4, 0);
-      af::shared<double> B(4, 0);
-      for (std::size_t k = 0; k < mask.accessor()[0]; ++k) {
-        for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
-              double x = (i + 0.5);
-              double y = (j + 0.5);
-              double z = (k + 0.5);
-              double p = data(k, j, i);
-              A[0] += 1;
-              A[1] += x;
-              A[2] += y;
-              A[3] += z;
-              A[5] += x * x;
-              A[6] += x * y;
-              A[7] += x * z;
-              A[10] += y * y;
-              A[11] += y * z;
-              A[15] += z * z;
-              B[0] += p;
-              B[1] += x * p;
-              B[2] += y * p;
-              B[3] += z * p;
-            }
+      std::size_t zsize = mask.accessor()[0];
+      std::size_t ysize = mask.accessor()[1];
+      std::size_t xsize = mask.accessor()[2];
+
+      // Accumulate the sums along each row and then over the rows and frames
+      double n = 0, sx = 0, sy = 0, sz = 0;
+      double sxx = 0, sxy = 0, sxz = 0, syy = 0, syz = 0, szz = 0;
+      double sp = 0, sxp = 0, syp = 0, szp = 0;
+      for (std::size_t k = 0; k < zsize; ++k) {
+        double z = (k + 0.5);
+        for (std::size_t j = 0; j < ysize; ++j) {
+          const double *drow = &data[(k * ysize + j) * xsize];
+          const bool *mrow = &mask[(k * ysize + j) * xsize];
+          double rn = 0, rx = 0, rxx = 0, rp = 0, rxp = 0;
+          for (std::size_t i = 0; i < xsize; ++i) {
+            double w = mrow[i] ? 1.0 : 0.0;
+            double p = mrow[i] ? drow[i] : 0.0;
+            double x = (i + 0.5);
+            rn += w;
+            rx += w * x;
+            rxx += w * x * x;
+            rp += p;
+            rxp += p * x;
           }
+          double y = (j + 0.5);
+          n += rn;
+          sx += rx;
+          sy += rn * y;
+          sz += rn * z;
+          sxx += rxx;
+          sxy += rx * y;
+          sxz += rx * z;
+          syy += rn * y * y;
+          syz += rn * y * z;
+          szz += rn * z * z;
+          sp += rp;
+          sxp += rxp;
+          syp += rp * y;
+          szp += rp * z;
         }
       }
-      A[4] = A[1];
-      A[8] = A[2];
-      A[9] = A[6];
-      A[12] = A[3];
-      A[13] = A[7];
-      A[14] = A[11];
-      inversion_in_place(A.begin(), 4, B.begin(), 1);
+
+      // Solve the normal equations about the mean coordinate using the
+      // cofactors of the symmetric 3x3 matrix
+      DIALS_ASSERT(n > 0);
+      double mx = sx / n;
+      double my = sy / n;
+      double mz = sz / n;
+      double mp = sp / n;
+      double suu = sxx - sx * mx;
+      double suv = sxy - sx * my;
+      double suw = sxz - sx * mz;
+      double svv = syy - sy * my;
+      double svw = syz - sy * mz;
+      double sww = szz - sz * mz;
+      double sup = sxp - sx * mp;
+      double svp = syp - sy * mp;
+      double swp = szp - sz * mp;
+      double c00 = svv * sww - svw * svw;
+      double c01 = suw * svw - suv * sww;
+      double c02 = suv * svw - suw * svv;
+      double c11 = suu * sww - suw * suw;
+      double c12 = suv * suw - suu * svw;
+      double c22 = suu * svv - suv * suv;
+      double det = suu * c00 + suv * c01 + suw * c02;
+      DIALS_ASSERT(det > 0);
+      double B1 = (c00 * sup + c01 * svp + c02 * swp) / det;
+      double B2 = (c01 * sup + c11 * svp + c12 * swp) / det;
+      double B3 = (c02 * sup + c12 * svp + c22 * swp) / det;
+      double B0 = mp - B1 * mx - B2 * my - B3 * mz;
+
+      // The diagonal of the inverse of the normal matrix
+      double iaa = 1.0 / n
+                   + (mx * (c00 * mx + c01 * my + c02 * mz)
+                      + my * (c01 * mx + c11 * my + c12 * mz)
+                      + mz * (c02 * mx + c12 * my + c22 * mz))
+                       / det;
+      double ibb = c00 / det;
+      double icc = c11 / det;
+      double idd = c22 / det;
+
+      // Compute the residuals
       double S = 0.0;
       int count = 0;
-      for (std::size_t k = 0; k < mask.accessor()[0]; ++k) {
-        for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
+      for (std::size_t k = 0; k < zsize; ++k) {
+        double z = (k + 0.5);
+        for (std::size_t j = 0; j < ysize; ++j) {
+          const double *drow = &data[(k * ysize + j) * xsize];
+          const bool *mrow = &mask[(k * ysize + j) * xsize];
+          double y = (j + 0.5);
+          for (std::size_t i = 0; i < xsize; ++i) {
+            if (mrow[i]) {
               double x = (i + 0.5);
-              double y = (j + 0.5);
-              double z = (k + 0.5);
-              double p = data(k, j, i);
-              double s = (p - B[0] - B[1] * x - B[2] * y - B[3] * z);
+              double s = (drow[i] - B0 - B1 * x - B2 * y - B3 * z);
               S += s * s;
               count++;
             }
@@ -373,11 +458,11 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
       DIALS_ASSERT(count > 4);
-      double va = S * A[0] / (count - 4);
-      double vb = S * A[5] / (count - 4);
-      double vc = S * A[10] / (count - 4);
-      double vd = S * A[15] / (count - 4);
-      return boost::make_shared<Linear3dModel>(B[0], B[1], B[2], B[3], va, vb, vc, vd);
+      double va = S * iaa / (count - 4);
+      double vb = S * ibb / (count - 4);
+      double vc = S * icc / (count - 4);
+      double vd = S * idd / (count - 4);
+      return boost::make_shared<Linear3dModel>(B0, B1, B2, B3, va, vb, vc, vd);
     }
   };
 
@@ -13,6 +13,7 @@
 #define DIALS_ALGORITHMS_BACKGROUND_MOSFLM_OUTLIER_REJECTOR_H
 
 #include <algorithm>
+#include <vector>
 #include <scitbx/array_family/ref_reductions.h>
 #include <boost/math/special_functions/erf.hpp>
 #include <scitbx/math/mean_and_variance.h>
@@ -27,6 +28,7 @@ namespace dials { namespace algorithms { namespace background {
   using model::BackgroundUsed;
   using model::Overlapped;
   using model::Valid;
+  using dials::af::select_index;
   using scitbx::matrix::inversion_in_place;
 
   /**
@@ -58,13 +60,15 @@ namespace dials { namespace algorithms { namespace background {
       // Mark for all slices
       af::c_grid<2> accessor(data.accessor()[1], data.accessor()[2]);
       std::size_t xysize = accessor[0] * accessor[1];
+      std::vector<std::size_t> index;
+      index.reserve(xysize);
       for (std::size_t i = 0; i < data.accessor()[0]; ++i) {
         // Get the 2D slices
         af::const_ref<double, af::c_grid<2> > data_2d(&data[i * xysize], accessor);
         af::ref<int, af::c_grid<2> > mask_2d(&mask[i * xysize], accessor);
 
         // Compute the initial mask using a subset of the available pixels
-        compute_initial_mask(data_2d, mask_2d);
+        compute_initial_mask(data_2d, mask_2d, index);
 
         // Compute the background plane using the subset of pixels
         double a = 0;
@@ -82,26 +86,21 @@ namespace dials { namespace algorithms { namespace background {
     }
 
   private:
-    /**
-     * Compare index array by pixel value
-     */
-    struct compare_pixel_value {
-      af::const_ref<double> data_;
-      compare_pixel_value(const af::const_ref<double> &data) : data_(data) {}
-      bool operator()(std::size_t a, std::size_t b) {
-        return data_[a] < data_[b];
-      }
-    };
-
     /**
      * Calculate the initial mask. Select the fraction of pixels with the lowest
-     * intensity and then update the mask for those pixels.
+     * intensity and then update the mask for those pixels. Only the selected
+     * pixels need to be found, not their order, so the pixels are partially
+     * ordered rather than sorted. Pixels with equal values are selected in
+     * order of index.
+     * @param data The image data
+     * @param mask The mask
+     * @param index The buffer for the pixel indices
      */
     void compute_initial_mask(const af::const_ref<double, af::c_grid<2> > &data,
-                              af::ref<int, af::c_grid<2> > mask) const {
+                              af::ref<int, af::c_grid<2> > mask,
+                              std::vector<std::size_t> &index) const {
       int code = Valid | Background;
-      std::vector<std::size_t> index;
-      index.reserve(data.size());
+      index.clear();
       for (std::size_t i = 0; i < mask.size(); ++i) {
         if ((mask[i] & code) == code && (mask[i] & Overlapped) == 0) {
           index.push_back(i);
@@ -110,9 +109,9 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
       DIALS_ASSERT(index.size() > 0);
-      std::sort(index.begin(), index.end(), compare_pixel_value(data.as_1d()));
       std::size_t nactive = (std::size_t)std::floor(fraction_ * index.size() + 0.5);
       DIALS_ASSERT(nactive > 0 && nactive <= index.size());
+      select_index(index.begin(), index.begin() + nactive, index.end(), data.begin());
       for (std::size_t i = 0; i < nactive; ++i) {
         mask[index[i]] |= BackgroundUsed;
       }
@@ -12,6 +12,7 @@
 #define DIALS_ALGORITHMS_BACKGROUND_TRUNCATED_OUTLIER_REJECTOR_H
 
 #include <algorithm>
+#include <vector>
 #include <scitbx/array_family/ref_reductions.h>
 #include <boost/math/special_functions/erf.hpp>
 #include <scitbx/math/mean_and_variance.h>
@@ -21,7 +22,7 @@
 
 namespace dials { namespace algorithms { namespace background {
 
-  using dials::af::sort_index;
+  using dials::af::select_index;
 
   /**
    * Remove top and bottom n% of pixels to use in background
@@ -49,8 +50,9 @@ namespace dials { namespace algorithms { namespace background {
       // Ensure data is correctly sized.
       DIALS_ASSERT(shoebox.size() == mask.size());
 
-      // Copy valid pixels and indices into list
-      af::shared<int> indices;
+      // Copy valid pixel indices into list
+      std::vector<std::size_t> indices;
+      indices.reserve(shoebox.size());
       for (std::size_t i = 0; i < shoebox.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code
             && (mask[i] & shoebox::Overlapped) == 0) {
@@ -58,17 +60,18 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
 
-      // Sort the pixels into ascending intensity order
-      sort_index(indices.begin(), indices.end(), shoebox.begin());
-      af::shared<double> pixels(indices.size(), af::init_functor_null<double>());
-      for (std::size_t i = 0; i < indices.size(); ++i) {
-        pixels[i] = (double)shoebox[indices[i]];
-      }
-
-      // Set rejected pixels as 'not background'
+      // Select the pixels between the lower and upper cutoffs in intensity
+      // order. Only the pixels in the range are needed, not their order, so
+      // select them by partially ordering the list rather than sorting it.
       std::size_t num_data = indices.size();
       std::size_t i0 = (std::size_t)(lower_ * num_data / 2.0);
       std::size_t i1 = num_data - (std::size_t)(upper_ * num_data / 2.0);
+      select_index(
+        indices.begin(), indices.begin() + i0, indices.end(), shoebox.begin());
+      select_index(
+        indices.begin() + i0, indices.begin() + i1, indices.end(), shoebox.begin());
+
+      // Set rejected pixels as 'not background'
       for (std::size_t i = i0; i < i1; ++i) {
         mask[indices[i]] |= shoebox::BackgroundUsed;
       }
@@ -12,6 +12,7 @@
 #define DIALS_ALGORITHMS_BACKGROUND_TUKEY_OUTLIER_REJECTOR_H
 
 #include <algorithm>
+#include <vector>
 #include <scitbx/array_family/ref_reductions.h>
 #include <scitbx/math/mean_and_variance.h>
 #include <dials/algorithms/shoebox/mask_code.h>
@@ -47,8 +48,9 @@ namespace dials { namespace algorithms { namespace background {
       // Ensure data is correctly sized.
       DIALS_ASSERT(shoebox.size() == mask.size());
 
-      // Copy valid pixels and indices into list
-      af::shared<double> data;
+      // Copy valid pixels into list
+      std::vector<double> data;
+      data.reserve(shoebox.size());
       for (std::size_t i = 0; i < shoebox.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code
             && (mask[i] & shoebox::Overlapped) == 0) {
@@ -56,13 +58,15 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
 
-      // Compute interquartile range
-      std::sort(data.begin(), data.end());
+      // Compute interquartile range. Only the quartiles are needed so select
+      // them rather than sorting the list.
       DIALS_ASSERT(data.size() > 2);
       std::size_t mid = data.size() / 2;
       std::size_t q1i = mid / 2;
       std::size_t q3i = mid + (data.size() - mid) / 2;
       DIALS_ASSERT(q1i < mid && mid < q3i && q3i < data.size());
+      std::nth_element(data.begin(), data.begin() + q3i, data.end());
+      std::nth_element(data.begin(), data.begin() + q1i, data.begin() + q3i);
       double q1 = data[q1i];
       double q3 = data[q3i];
       DIALS_ASSERT(q3 >= q1);
@@ -3,12 +3,14 @@
 import dials_algorithms_centroid_simple_ext
 
 
-def centroid(experiments, reflections, image_volume=None):
+def centroid(experiments, reflections, image_volume=None, nthreads=1):
     """
     Do the centroiding
 
     :param experiments: The experiment list
     :param reflections: The reflection list
+    :param image_volume: The image volume (if the reflections have no shoeboxes)
+    :param nthreads: The number of threads to use
     """
 
     # Create a centroider instance
@@ -22,5 +24,5 @@ def centroid(experiments, reflections, image_volume=None):
             centroider.add(exp.detector)
 
     if image_volume is None:
-        return centroider(reflections)
-    return centroider(reflections, image_volume)
+        return centroider(reflections, nthreads=nthreads)
+    return centroider(reflections, image_volume, nthreads=nthreads)
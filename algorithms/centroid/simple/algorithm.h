@@ -11,11 +11,14 @@
 #ifndef DIALS_ALGORITHMS_CENTROID_SIMPLE_ALGORITHM_H
 #define DIALS_ALGORITHMS_CENTROID_SIMPLE_ALGORITHM_H
 
+#include <vector>
+#include <boost/bind.hpp>
 #include <boost/optional.hpp>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/scan.h>
 #include <dials/model/data/image_volume.h>
 #include <dials/array_family/reflection_table.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials { namespace algorithms {
 
@@ -33,7 +36,7 @@ namespace dials { namespace algorithms {
   template <typename FloatType>
   Centroid centroid_image_volume(std::size_t index,
                                  int6 bbox,
-                                 ImageVolume<FloatType> volume) {
+                                 const ImageVolume<FloatType> &volume) {
     typedef CentroidMaskedImage3d<FloatType> Centroider;
 
     // The mask code to use
@@ -74,21 +77,61 @@ namespace dials { namespace algorithms {
     return result;
   }
 
+  namespace detail {
+
+    /**
+     * The geometry needed to convert a pixel centroid on a panel to mm and
+     * radians: the panel, the squared pixel size and the scan with its squared
+     * oscillation width (or NULL and zero if there is no scan).
+     */
+    struct CentroidPanelGeometry {
+      const Panel *panel;
+      const Scan *scan;
+      double xscale;
+      double yscale;
+      double zscale;
+    };
+
+    /**
+     * The centroid columns of a reflection table
+     */
+    struct CentroidColumns {
+      af::ref<vec3<double> > xyzobs_px_value;
+      af::ref<vec3<double> > xyzobs_px_variance;
+      af::ref<vec3<double> > xyzobs_mm_value;
+      af::ref<vec3<double> > xyzobs_mm_variance;
+
+      CentroidColumns(af::reflection_table reflections)
+          : xyzobs_px_value(reflections["xyzobs.px.value"]),
+            xyzobs_px_variance(reflections["xyzobs.px.variance"]),
+            xyzobs_mm_value(reflections["xyzobs.mm.value"]),
+            xyzobs_mm_variance(reflections["xyzobs.mm.variance"]) {}
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the centroids of a table of reflections. The geometry of each
+   * panel is looked up once before the reflections are processed, and the
+   * reflections are then centroided in bands on separate threads. The moments
+   * and the variances (including the bias term) of each reflection are
+   * computed in a single pass over its pixels.
+   */
   class Centroider {
   public:
     Centroider() {}
 
-    void add(const Detector& detector) {
+    void add(const Detector &detector) {
       detector_.push_back(detector);
       scan_.push_back(boost::none);
     }
 
-    void add(const Detector& detector, const Scan& scan) {
+    void add(const Detector &detector, const Scan &scan) {
       detector_.push_back(detector);
       scan_.push_back(scan);
     }
 
-    void shoebox(af::reflection_table reflections) const {
+    void shoebox(af::reflection_table reflections, std::size_t nthreads = 1) const {
       // Check stuff
       DIALS_ASSERT(reflections.is_consistent());
       DIALS_ASSERT(reflections.size() > 0);
@@ -96,58 +139,36 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(reflections.contains("id"));
       DIALS_ASSERT(detector_.size() > 0);
       DIALS_ASSERT(detector_.size() == scan_.size());
+      DIALS_ASSERT(nthreads > 0);
 
-      // Loop through all the reflections
+      // Get the geometry of each reflection's panel
       af::const_ref<int> id = reflections["id"];
       af::const_ref<Shoebox<> > shoebox = reflections["shoebox"];
-      af::ref<vec3<double> > xyzobs_px_value = reflections["xyzobs.px.value"];
-      af::ref<vec3<double> > xyzobs_px_variance = reflections["xyzobs.px.variance"];
-      af::ref<vec3<double> > xyzobs_mm_value = reflections["xyzobs.mm.value"];
-      af::ref<vec3<double> > xyzobs_mm_variance = reflections["xyzobs.mm.variance"];
+      std::vector<std::size_t> panel(shoebox.size());
       for (std::size_t i = 0; i < shoebox.size(); ++i) {
-        // Compute the pixel centroid
-        Centroid centroid = shoebox[i].centroid_foreground_minus_background();
-
-        // Get the panel
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < detector_.size());
-        const Detector& d = detector_[id[i]];
-        DIALS_ASSERT(shoebox[i].panel < d.size());
-        const Panel& p = d[shoebox[i].panel];
-
-        // Get the mm centroid
-        vec2<double> mm = p.pixel_to_millimeter(
-          vec2<double>(centroid.px.position[0], centroid.px.position[1]));
-        vec2<double> pixel_size = p.get_pixel_size();
-        double xscale = pixel_size[0] * pixel_size[0];
-        double yscale = pixel_size[1] * pixel_size[1];
-        centroid.mm.position[0] = mm[0];
-        centroid.mm.position[1] = mm[1];
-        centroid.mm.std_err_sq[0] = centroid.px.std_err_sq[0] * xscale;
-        centroid.mm.std_err_sq[1] = centroid.px.std_err_sq[1] * yscale;
-
-        // Get the phi centroid
-        double zscale = 0.0;
-        double phi = 0.0;
-        if (scan_[id[i]]) {
-          phi = scan_[id[i]]->get_angle_from_array_index(centroid.px.position[2]);
-          zscale = scan_[id[i]]->get_oscillation()[1];
-          zscale *= zscale;
-        }
-        centroid.mm.position[2] = phi;
-        centroid.mm.std_err_sq[2] = centroid.px.std_err_sq[2] * zscale;
-
-        // Set array values
-        xyzobs_px_value[i] = centroid.px.position;
-        xyzobs_mm_value[i] = centroid.mm.position;
-        xyzobs_px_variance[i] = centroid.px.std_err_sq;
-        xyzobs_mm_variance[i] = centroid.mm.std_err_sq;
+        panel[i] = shoebox[i].panel;
       }
+      std::vector<detail::CentroidPanelGeometry> panels;
+      geometry_list geometry = reflection_geometry(id, panel, panels);
+
+      // Compute the centroids
+      detail::CentroidColumns columns(reflections);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&Centroider::shoebox_band,
+                    this,
+                    shoebox,
+                    boost::cref(geometry),
+                    boost::cref(columns),
+                    _1,
+                    _2),
+        shoebox.size(),
+        nthreads);
     }
 
     template <typename FloatType>
     void volume(af::reflection_table reflections,
-                MultiPanelImageVolume<FloatType> volume) const {
+                MultiPanelImageVolume<FloatType> volume,
+                std::size_t nthreads = 1) const {
       // Check stuff
       DIALS_ASSERT(reflections.is_consistent());
       DIALS_ASSERT(reflections.size() > 0);
@@ -156,57 +177,156 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(reflections.contains("panel"));
       DIALS_ASSERT(detector_.size() > 0);
       DIALS_ASSERT(detector_.size() == scan_.size());
+      DIALS_ASSERT(nthreads > 0);
 
-      // Loop through all the reflections
+      // Get the geometry of each reflection's panel
       af::const_ref<int> id = reflections["id"];
       af::const_ref<std::size_t> panel = reflections["panel"];
       af::const_ref<int6> bbox = reflections["bbox"];
-      af::ref<vec3<double> > xyzobs_px_value = reflections["xyzobs.px.value"];
-      af::ref<vec3<double> > xyzobs_px_variance = reflections["xyzobs.px.variance"];
-      af::ref<vec3<double> > xyzobs_mm_value = reflections["xyzobs.mm.value"];
-      af::ref<vec3<double> > xyzobs_mm_variance = reflections["xyzobs.mm.variance"];
-      for (std::size_t i = 0; i < bbox.size(); ++i) {
-        // Compute the centroid
-        Centroid centroid = centroid_image_volume(i, bbox[i], volume.get(panel[i]));
-
-        // Get the panel
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < detector_.size());
-        const Detector& d = detector_[id[i]];
-        DIALS_ASSERT(panel[i] < d.size());
-        const Panel& p = d[panel[i]];
-
-        // Get the mm centroid
-        vec2<double> mm = p.pixel_to_millimeter(
-          vec2<double>(centroid.px.position[0], centroid.px.position[1]));
-        vec2<double> pixel_size = p.get_pixel_size();
-        double xscale = pixel_size[0] * pixel_size[0];
-        double yscale = pixel_size[1] * pixel_size[1];
-        centroid.mm.position[0] = mm[0];
-        centroid.mm.position[1] = mm[1];
-        centroid.mm.std_err_sq[0] = centroid.px.std_err_sq[0] * xscale;
-        centroid.mm.std_err_sq[1] = centroid.px.std_err_sq[1] * yscale;
-
-        // Get the phi centroid
+      std::vector<detail::CentroidPanelGeometry> panels;
+      geometry_list geometry = reflection_geometry(
+        id, std::vector<std::size_t>(panel.begin(), panel.end()), panels);
+
+      // Get the panel volumes before starting any threads, so that the
+      // volumes are shared and not copied by each reflection
+      std::vector<ImageVolume<FloatType> > panel_volume;
+      for (std::size_t i = 0; i < volume.size(); ++i) {
+        panel_volume.push_back(volume.get(i));
+      }
+      for (std::size_t i = 0; i < panel.size(); ++i) {
+        DIALS_ASSERT(panel[i] < panel_volume.size());
+      }
+
+      // Compute the centroids
+      detail::CentroidColumns columns(reflections);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&Centroider::volume_band<FloatType>,
+                    this,
+                    bbox,
+                    panel,
+                    boost::cref(panel_volume),
+                    boost::cref(geometry),
+                    boost::cref(columns),
+                    _1,
+                    _2),
+        bbox.size(),
+        nthreads);
+    }
+
+  private:
+    typedef std::vector<const detail::CentroidPanelGeometry *> geometry_list;
+
+    /**
+     * Look up the panel geometry of each reflection
+     * @param id The experiment ids
+     * @param panel The panel numbers
+     * @param geometry The geometry of every panel
+     * @returns The geometry of each reflection
+     */
+    geometry_list reflection_geometry(
+      const af::const_ref<int> &id,
+      const std::vector<std::size_t> &panel,
+      std::vector<detail::CentroidPanelGeometry> &geometry) const {
+      // Compute the geometry of each panel once
+      std::vector<std::size_t> offset(detector_.size() + 1, 0);
+      for (std::size_t e = 0; e < detector_.size(); ++e) {
+        offset[e + 1] = offset[e] + detector_[e].size();
+      }
+      geometry.resize(offset.back());
+      for (std::size_t e = 0; e < detector_.size(); ++e) {
+        const Scan *scan = scan_[e] ? &(*scan_[e]) : NULL;
         double zscale = 0.0;
-        double phi = 0.0;
-        if (scan_[id[i]]) {
-          phi = scan_[id[i]]->get_angle_from_array_index(centroid.px.position[2]);
-          zscale = scan_[id[i]]->get_oscillation()[1];
+        if (scan != NULL) {
+          zscale = scan->get_oscillation()[1];
           zscale *= zscale;
         }
-        centroid.mm.position[2] = phi;
-        centroid.mm.std_err_sq[2] = centroid.px.std_err_sq[2] * zscale;
-
-        // Set array values
-        xyzobs_px_value[i] = centroid.px.position;
-        xyzobs_mm_value[i] = centroid.mm.position;
-        xyzobs_px_variance[i] = centroid.px.std_err_sq;
-        xyzobs_mm_variance[i] = centroid.mm.std_err_sq;
+        for (std::size_t j = 0; j < detector_[e].size(); ++j) {
+          const Panel &p = detector_[e][j];
+          vec2<double> pixel_size = p.get_pixel_size();
+          detail::CentroidPanelGeometry &g = geometry[offset[e] + j];
+          g.panel = &p;
+          g.scan = scan;
+          g.xscale = pixel_size[0] * pixel_size[0];
+          g.yscale = pixel_size[1] * pixel_size[1];
+          g.zscale = zscale;
+        }
+      }
+
+      // Look up the geometry of each reflection
+      DIALS_ASSERT(id.size() == panel.size());
+      geometry_list result(id.size());
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] >= 0);
+        DIALS_ASSERT(id[i] < detector_.size());
+        DIALS_ASSERT(panel[i] < detector_[id[i]].size());
+        result[i] = &geometry[offset[id[i]] + panel[i]];
+      }
+      return result;
+    }
+
+    /**
+     * Convert a pixel centroid to mm and radians and set the table values
+     * @param i The reflection index
+     * @param centroid The pixel centroid
+     * @param geometry The panel geometry
+     * @param columns The table columns
+     */
+    void set_centroid(std::size_t i,
+                      Centroid centroid,
+                      const detail::CentroidPanelGeometry &geometry,
+                      const detail::CentroidColumns &columns) const {
+      // Get the mm centroid
+      vec2<double> mm = geometry.panel->pixel_to_millimeter(
+        vec2<double>(centroid.px.position[0], centroid.px.position[1]));
+      centroid.mm.position[0] = mm[0];
+      centroid.mm.position[1] = mm[1];
+      centroid.mm.std_err_sq[0] = centroid.px.std_err_sq[0] * geometry.xscale;
+      centroid.mm.std_err_sq[1] = centroid.px.std_err_sq[1] * geometry.yscale;
+
+      // Get the phi centroid
+      double phi = 0.0;
+      if (geometry.scan != NULL) {
+        phi = geometry.scan->get_angle_from_array_index(centroid.px.position[2]);
+      }
+      centroid.mm.position[2] = phi;
+      centroid.mm.std_err_sq[2] = centroid.px.std_err_sq[2] * geometry.zscale;
+
+      // Set array values
+      columns.xyzobs_px_value[i] = centroid.px.position;
+      columns.xyzobs_mm_value[i] = centroid.mm.position;
+      columns.xyzobs_px_variance[i] = centroid.px.std_err_sq;
+      columns.xyzobs_mm_variance[i] = centroid.mm.std_err_sq;
+    }
+
+    void shoebox_band(af::const_ref<Shoebox<> > shoebox,
+                      const geometry_list &geometry,
+                      const detail::CentroidColumns &columns,
+                      std::size_t first,
+                      std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        set_centroid(i,
+                     shoebox[i].centroid_foreground_minus_background(),
+                     *geometry[i],
+                     columns);
+      }
+    }
+
+    template <typename FloatType>
+    void volume_band(af::const_ref<int6> bbox,
+                     af::const_ref<std::size_t> panel,
+                     const std::vector<ImageVolume<FloatType> > &volume,
+                     const geometry_list &geometry,
+                     const detail::CentroidColumns &columns,
+                     std::size_t first,
+                     std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        set_centroid(i,
+                     centroid_image_volume(i, bbox[i], volume[panel[i]]),
+                     *geometry[i],
+                     columns);
       }
     }
 
-  private:
     std::vector<Detector> detector_;
     std::vector<boost::optional<Scan> > scan_;
   };
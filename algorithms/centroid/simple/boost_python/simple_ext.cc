@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/centroid/simple/algorithm.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -27,11 +28,14 @@ namespace dials { namespace algorithms { namespace boost_python {
   }
 
   BOOST_PYTHON_MODULE(dials_algorithms_centroid_simple_ext) {
+    dials::util::boost_python::import_shared_executor();
     class_<Centroider>("Centroider")
       .def("add", &add_detector)
       .def("add", &add_detector_and_scan)
-      .def("__call__", &Centroider::shoebox)
-      .def("__call__", &Centroider::volume<float>);
+      .def("__call__", &Centroider::shoebox, (arg("reflections"), arg("nthreads") = 1))
+      .def("__call__",
+           &Centroider::volume<float>,
+           (arg("reflections"), arg("volume"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
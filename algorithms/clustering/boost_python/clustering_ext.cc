@@ -0,0 +1,52 @@
+/*
+ * clustering_ext.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <limits>
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/clustering/unit_cell_distance.h>
+#include <dials/util/gil.h>
+#include <dials/util/boost_python/shared_executor.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  af::shared<double> unit_cell_distance_matrix(
+    const af::const_ref<double, af::c_grid<2> > &g6,
+    bool andrews_bernstein,
+    double bound,
+    std::size_t nthreads) {
+    G6Distance distance(g6, andrews_bernstein);
+    dials::util::ScopedReleaseGIL release_gil;
+    return G6DistanceMatrix(distance, bound, nthreads).distances();
+  }
+
+  af::versa<double, af::c_grid<2> > unit_cell_single_linkage(
+    const af::const_ref<double, af::c_grid<2> > &g6,
+    bool andrews_bernstein,
+    std::size_t nthreads) {
+    G6Distance distance(g6, andrews_bernstein);
+    dials::util::ScopedReleaseGIL release_gil;
+    return G6SingleLinkage(distance, nthreads).linkage();
+  }
+
+  BOOST_PYTHON_MODULE(dials_algorithms_clustering_ext) {
+    dials::util::boost_python::import_shared_executor();
+
+    def("unit_cell_distance_matrix",
+        &unit_cell_distance_matrix,
+        (arg("g6"),
+         arg("andrews_bernstein") = true,
+         arg("bound") = std::numeric_limits<double>::infinity(),
+         arg("nthreads") = 1));
+
+    def("unit_cell_single_linkage",
+        &unit_cell_single_linkage,
+        (arg("g6"), arg("andrews_bernstein") = true, arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
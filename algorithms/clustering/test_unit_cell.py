@@ -2,10 +2,21 @@
 
 import random
 
+import numpy as np
+import pytest
+import scipy.cluster.hierarchy as hcluster
+import scipy.spatial.distance as dist
+
 from cctbx import sgtbx
+from cctbx.uctbx.determine_unit_cell import NCDist
 from scitbx.array_family import flex
+from xfel.clustering.singleframe import SingleFrame
 
 from dials.algorithms.clustering.unit_cell import UnitCellCluster
+from dials_algorithms_clustering_ext import (
+    unit_cell_distance_matrix,
+    unit_cell_single_linkage,
+)
 
 
 def test_unit_cell():
@@ -20,3 +31,57 @@ def test_unit_cell():
         crystal_symmetries, lattice_ids=lattice_ids
     )
     clusters, dendrogram, _ = ucs.ab_cluster(write_file_lists=False, doplot=False)
+
+
+def partition(cluster_ids):
+    clusters = {}
+    for i, cluster_id in enumerate(cluster_ids):
+        clusters.setdefault(cluster_id, set()).add(i)
+    return sorted(sorted(c) for c in clusters.values())
+
+
+def test_unit_cell_distances():
+    sgi = sgtbx.space_group_info("P1")
+    g6 = [
+        SingleFrame.make_g6(
+            sgi.any_compatible_crystal_symmetry(
+                volume=random.uniform(990, 1010)
+            ).unit_cell()
+        )
+        for i in range(20)
+    ]
+    g6_cells = flex.double(np.array(g6).ravel().tolist())
+    g6_cells.reshape(flex.grid(len(g6), 6))
+
+    for andrews_bernstein, metric in ((False, "euclidean"), (True, NCDist)):
+        expected = dist.pdist(np.array(g6), metric=metric)
+        for nthreads in (1, 4):
+            distances = unit_cell_distance_matrix(
+                g6_cells, andrews_bernstein=andrews_bernstein, nthreads=nthreads
+            )
+            assert list(distances) == pytest.approx(list(expected))
+
+            # Distances above the bound are stored as the bound
+            bound = float(np.median(expected))
+            bounded = unit_cell_distance_matrix(
+                g6_cells,
+                andrews_bernstein=andrews_bernstein,
+                bound=bound,
+                nthreads=nthreads,
+            )
+            assert list(bounded) == pytest.approx(list(np.minimum(expected, bound)))
+
+            # The single linkage tree matches the one from scipy
+            linkage = unit_cell_single_linkage(
+                g6_cells, andrews_bernstein=andrews_bernstein, nthreads=nthreads
+            ).as_numpy_array()
+            assert linkage.shape == (len(g6) - 1, 4)
+            expected_linkage = hcluster.linkage(expected, method="single")
+            assert list(linkage[:, 2]) == pytest.approx(list(expected_linkage[:, 2]))
+            assert list(linkage[:, 3]) == list(expected_linkage[:, 3])
+            threshold = float(np.median(expected_linkage[:, 2]))
+            clusters = hcluster.fcluster(linkage, threshold, criterion="distance")
+            expected_clusters = hcluster.fcluster(
+                expected_linkage, threshold, criterion="distance"
+            )
+            assert partition(clusters) == partition(expected_clusters)
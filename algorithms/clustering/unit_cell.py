@@ -20,6 +20,7 @@ def ab_cluster(
         schnell=False,
         doplot=True,
         labels="default",
+        nthreads=1,
     ):
         """
         Hierarchical clustering using the unit cell dimentions.
@@ -37,6 +38,7 @@ def ab_cluster(
                        Runs faster if switched off.
         :param labels: 'default' will not display any labels for more than 100 images, but will display
                        file names for fewer. This can be manually overidden with a boolean flag.
+        :param nthreads: The number of threads to use to compute the distances.
         :return: A list of Clusters ordered by largest Cluster to smallest
 
         .. note::
@@ -44,34 +46,43 @@ def ab_cluster(
           around symmetry boundaries.
         """
 
-        import numpy as np
-
-        from cctbx.uctbx.determine_unit_cell import NCDist
+        from dials_algorithms_clustering_ext import (
+            unit_cell_distance_matrix,
+            unit_cell_single_linkage,
+        )
+        from scitbx.array_family import flex
         from xfel.clustering.singleframe import SingleFrame
 
         logger.info("Hierarchical clustering of unit cells")
         import scipy.cluster.hierarchy as hcluster
-        import scipy.spatial.distance as dist
 
-        # 1. Create a numpy array of G6 cells
-        g6_cells = np.array([SingleFrame.make_g6(image.uc) for image in self.members])
+        # 1. Create an array of G6 cells
+        g6_cells = flex.double()
+        for image in self.members:
+            g6_cells.extend(flex.double(list(SingleFrame.make_g6(image.uc))))
+        g6_cells.reshape(flex.grid(len(self.members), 6))
 
         # 2. Do hierarchichal clustering, using the find_distance method above.
         if schnell:
             logger.info("Using Euclidean distance")
-            metric = "euclidean"
         else:
             logger.info(
                 "Using Andrews-Bernstein distance from Andrews & Bernstein "
                 "J Appl Cryst 47:346 (2014)"
             )
-            metric = NCDist
-        pair_distances = dist.pdist(g6_cells, metric=metric)
-        if len(pair_distances) > 0:
+        if len(self.members) > 1:
+            if linkage_method == "single":
+                # The single linkage tree is built as the distances are
+                # computed, so the full distance matrix is never stored
+                this_linkage = unit_cell_single_linkage(
+                    g6_cells, andrews_bernstein=not schnell, nthreads=nthreads
+                ).as_numpy_array()
+            else:
+                pair_distances = unit_cell_distance_matrix(
+                    g6_cells, andrews_bernstein=not schnell, nthreads=nthreads
+                ).as_numpy_array()
+                this_linkage = hcluster.linkage(pair_distances, method=linkage_method)
             logger.info("Distances have been calculated")
-            this_linkage = hcluster.linkage(
-                pair_distances, method=linkage_method, metric=metric
-            )
             cluster_ids = hcluster.fcluster(this_linkage, threshold, criterion=method)
             logger.debug("Clusters have been calculated")
         else:
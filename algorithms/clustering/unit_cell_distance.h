@@ -0,0 +1,322 @@
+/*
+ * unit_cell_distance.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_DISTANCE_H
+#define DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_DISTANCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/bind.hpp>
+#include <cctbx/uctbx/determine_unit_cell/NCDist.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The distance between pairs of unit cells in the G6 representation. This is
+   * either the Euclidean distance between the G6 vectors or the Andrews-Bernstein
+   * distance (Andrews & Bernstein, J Appl Cryst 47:346 (2014)), which takes the
+   * boundaries of the Niggli reduced cells into account.
+   */
+  class G6Distance {
+  public:
+    /**
+     * @param g6 The G6 vectors of the cells, one per row
+     * @param andrews_bernstein Use the Andrews-Bernstein distance
+     */
+    G6Distance(const af::const_ref<double, af::c_grid<2> > &g6, bool andrews_bernstein)
+        : g6_(g6.begin(), g6.end()),
+          size_(g6.accessor()[0]),
+          andrews_bernstein_(andrews_bernstein) {
+      DIALS_ASSERT(g6.accessor()[1] == 6);
+
+      // Make one call before any threads are started, so that any tables
+      // used by NCDist are set up
+      if (andrews_bernstein_ && size_ > 0) {
+        (*this)(0, 0);
+      }
+    }
+
+    /**
+     * @returns The number of cells
+     */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /**
+     * @returns Is the Andrews-Bernstein distance used
+     */
+    bool andrews_bernstein() const {
+      return andrews_bernstein_;
+    }
+
+    /**
+     * @returns The distance between two cells
+     */
+    double operator()(std::size_t i, std::size_t j) const {
+      const double *a = &g6_[6 * i];
+      const double *b = &g6_[6 * j];
+      if (andrews_bernstein_) {
+        double ga[6], gb[6];
+        std::copy(a, a + 6, ga);
+        std::copy(b, b + 6, gb);
+        return NCDist(ga, gb);
+      }
+      double sum = 0;
+      for (std::size_t k = 0; k < 6; ++k) {
+        double d = a[k] - b[k];
+        sum += d * d;
+      }
+      return std::sqrt(sum);
+    }
+
+    /**
+     * Get the distance between two cells, or the bound if the distance is
+     * larger. The Euclidean distance stops as soon as it exceeds the bound.
+     * @returns The bounded distance between two cells
+     */
+    double bounded(std::size_t i, std::size_t j, double bound) const {
+      if (andrews_bernstein_) {
+        return std::min((*this)(i, j), bound);
+      }
+      const double *a = &g6_[6 * i];
+      const double *b = &g6_[6 * j];
+      double bound_sq = bound * bound;
+      double sum = 0;
+      for (std::size_t k = 0; k < 3; ++k) {
+        double d = a[k] - b[k];
+        sum += d * d;
+      }
+      if (sum > bound_sq) {
+        return bound;
+      }
+      for (std::size_t k = 3; k < 6; ++k) {
+        double d = a[k] - b[k];
+        sum += d * d;
+      }
+      return sum > bound_sq ? bound : std::sqrt(sum);
+    }
+
+  private:
+    std::vector<double> g6_;
+    std::size_t size_;
+    bool andrews_bernstein_;
+  };
+
+  /**
+   * Compute the condensed matrix of the distances between all pairs of unit
+   * cells, in the order used by scipy.spatial.distance.pdist. The pairs are
+   * split into equal bands which are computed on separate threads.
+   */
+  class G6DistanceMatrix {
+  public:
+    /**
+     * @param distance The unit cell distance
+     * @param bound Distances larger than this are stored as the bound
+     * @param nthreads The number of threads
+     */
+    G6DistanceMatrix(const G6Distance &distance,
+                     double bound = std::numeric_limits<double>::infinity(),
+                     std::size_t nthreads = 1)
+        : distance_(distance), bound_(bound), offset_(distance.size()) {
+      DIALS_ASSERT(bound > 0);
+      std::size_t n = distance.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        offset_[i] = i * n - i * (i + 1) / 2;
+      }
+      distances_ = af::shared<double>(n > 0 ? n * (n - 1) / 2 : 0);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&G6DistanceMatrix::compute, this, _1, _2),
+        distances_.size(),
+        nthreads);
+    }
+
+    /**
+     * @returns The condensed distance matrix
+     */
+    af::shared<double> distances() const {
+      return distances_;
+    }
+
+  private:
+    void compute(std::size_t first, std::size_t last) {
+      if (first >= last) {
+        return;
+      }
+
+      // Find the pair of the first index
+      std::size_t n = distance_.size();
+      std::size_t i =
+        std::upper_bound(offset_.begin(), offset_.end(), first) - offset_.begin() - 1;
+      std::size_t j = i + 1 + (first - offset_[i]);
+      for (std::size_t k = first; k < last; ++k) {
+        distances_[k] = distance_.bounded(i, j, bound_);
+        if (++j == n) {
+          ++i;
+          j = i + 1;
+        }
+      }
+    }
+
+    const G6Distance &distance_;
+    double bound_;
+    std::vector<std::size_t> offset_;
+    af::shared<double> distances_;
+  };
+
+  /**
+   * Single linkage clustering of unit cells. The merges are the edges of the
+   * minimum spanning tree of the distances, which is found with Prim's
+   * algorithm, so the distances are computed as they are needed and the
+   * memory used is linear in the number of cells. At each step the distances
+   * from the cell last added to the tree to the remaining cells are computed
+   * in chunks on separate threads. The linkage matrix has the same form as
+   * that from scipy.cluster.hierarchy.linkage.
+   */
+  class G6SingleLinkage {
+  public:
+    /**
+     * @param distance The unit cell distance
+     * @param nthreads The number of threads
+     */
+    G6SingleLinkage(const G6Distance &distance, std::size_t nthreads = 1)
+        : distance_(distance),
+          current_(0),
+          min_distance_(distance.size(), std::numeric_limits<double>::infinity()),
+          nearest_(distance.size(), 0) {
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t n = distance.size();
+      DIALS_ASSERT(n > 1);
+
+      // Grow the minimum spanning tree from the first cell
+      for (std::size_t i = 1; i < n; ++i) {
+        remaining_.push_back(i);
+      }
+      std::vector<Edge> edges;
+      while (remaining_.size() > 0) {
+        num_chunks_ = std::min(remaining_.size(), chunks_per_thread * nthreads);
+        chunk_best_.resize(num_chunks_);
+        dials::algorithms::detail::parallel_bands(
+          boost::bind(&G6SingleLinkage::update_chunks, this, _1, _2),
+          num_chunks_,
+          nthreads);
+        std::size_t best = chunk_best_[0];
+        for (std::size_t c = 1; c < num_chunks_; ++c) {
+          if (min_distance_[remaining_[chunk_best_[c]]]
+              < min_distance_[remaining_[best]]) {
+            best = chunk_best_[c];
+          }
+        }
+        current_ = remaining_[best];
+        edges.push_back(Edge(nearest_[current_], current_, min_distance_[current_]));
+        remaining_[best] = remaining_.back();
+        remaining_.pop_back();
+      }
+
+      // Merge the clusters joined by the edges in order of distance
+      std::stable_sort(edges.begin(), edges.end());
+      std::vector<std::size_t> parent(n);
+      std::vector<std::size_t> cluster(n);
+      std::vector<std::size_t> count(n, 1);
+      for (std::size_t i = 0; i < n; ++i) {
+        parent[i] = i;
+        cluster[i] = i;
+      }
+      linkage_ = af::versa<double, af::c_grid<2> >(af::c_grid<2>(n - 1, 4));
+      for (std::size_t k = 0; k < edges.size(); ++k) {
+        std::size_t a = find_root(parent, edges[k].a);
+        std::size_t b = find_root(parent, edges[k].b);
+        DIALS_ASSERT(a != b);
+        linkage_(k, 0) = std::min(cluster[a], cluster[b]);
+        linkage_(k, 1) = std::max(cluster[a], cluster[b]);
+        linkage_(k, 2) = edges[k].distance;
+        linkage_(k, 3) = count[a] + count[b];
+        parent[b] = a;
+        count[a] += count[b];
+        cluster[a] = n + k;
+      }
+    }
+
+    /**
+     * @returns The linkage matrix
+     */
+    af::versa<double, af::c_grid<2> > linkage() const {
+      return linkage_;
+    }
+
+  private:
+    /**
+     * The number of chunks of the remaining cells per thread
+     */
+    static const std::size_t chunks_per_thread = 4;
+
+    /**
+     * An edge of the minimum spanning tree
+     */
+    struct Edge {
+      std::size_t a;
+      std::size_t b;
+      double distance;
+
+      Edge(std::size_t a_, std::size_t b_, double distance_)
+          : a(a_), b(b_), distance(distance_) {}
+
+      bool operator<(const Edge &other) const {
+        return distance < other.distance;
+      }
+    };
+
+    static std::size_t find_root(std::vector<std::size_t> &parent, std::size_t i) {
+      while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+      }
+      return i;
+    }
+
+    /**
+     * Update the distance to the tree of the remaining cells in a band of
+     * chunks, and find the nearest cell in each chunk
+     */
+    void update_chunks(std::size_t first, std::size_t last) {
+      std::size_t size = remaining_.size();
+      for (std::size_t c = first; c < last; ++c) {
+        std::size_t begin = c * size / num_chunks_;
+        std::size_t end = (c + 1) * size / num_chunks_;
+        std::size_t best = begin;
+        for (std::size_t p = begin; p < end; ++p) {
+          std::size_t v = remaining_[p];
+          double d = distance_(current_, v);
+          if (d < min_distance_[v]) {
+            min_distance_[v] = d;
+            nearest_[v] = current_;
+          }
+          if (min_distance_[v] < min_distance_[remaining_[best]]) {
+            best = p;
+          }
+        }
+        chunk_best_[c] = best;
+      }
+    }
+
+    const G6Distance &distance_;
+    std::size_t current_;
+    std::size_t num_chunks_;
+    std::vector<std::size_t> remaining_;
+    std::vector<double> min_distance_;
+    std::vector<std::size_t> nearest_;
+    std::vector<std::size_t> chunk_best_;
+    af::versa<double, af::c_grid<2> > linkage_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_DISTANCE_H
@@ -3,6 +3,7 @@
 from dials_algorithms_filter_ext import *  # noqa: F403; lgtm
 
 __all__ = (  # noqa: F405
+    "FilterPipeline",
     "by_bbox_volume",
     "by_detector_mask",
     "by_resolution_at_centroid",
@@ -11,7 +11,11 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <scitbx/array_family/flex_types.h>
+#include <dials/array_family/reflection_table.h>
 #include <dials/algorithms/filtering/filter.h>
+#include <dials/algorithms/filtering/pipeline.h>
+#include <dials/util/gil.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace filter { namespace boost_python {
 
@@ -35,6 +39,63 @@ namespace dials { namespace algorithms { namespace filter { namespace boost_pyth
     return by_detector_mask_multipanel(panel, bboxes, mask.const_ref(), scan_range);
   }
 
+  void FilterPipeline_add_detector_mask(FilterPipeline &self,
+                                        boost::python::tuple mask_tuple,
+                                        int2 scan_range) {
+    std::vector<af::versa<bool, af::c_grid<2> > > mask;
+    for (std::size_t i = 0; i < len(mask_tuple); ++i) {
+      flex_bool temp = extract<flex_bool>(mask_tuple[i]);
+      DIALS_ASSERT(temp.accessor().all().size() == 2);
+      af::c_grid<2> grid(temp.accessor().all()[0], temp.accessor().all()[1]);
+      af::versa<bool, af::c_grid<2> > panel_mask(grid);
+      std::copy(temp.begin(), temp.end(), panel_mask.begin());
+      mask.push_back(panel_mask);
+    }
+    self.add_detector_mask(mask, scan_range);
+  }
+
+  /**
+   * Get the columns of the reflection table which are present
+   */
+  FilterColumns FilterPipeline_columns(af::reflection_table table) {
+    FilterColumns columns(table.nrows());
+    if (table.contains("s1")) {
+      columns.s1 = table.get<vec3<double> >("s1").const_ref();
+    }
+    if (table.contains("bbox")) {
+      columns.bbox = table.get<int6>("bbox").const_ref();
+    }
+    if (table.contains("panel")) {
+      columns.panel = table.get<std::size_t>("panel").const_ref();
+    }
+    if (table.contains("xyzobs.px.value")) {
+      columns.xyzobs = table.get<vec3<double> >("xyzobs.px.value").const_ref();
+    }
+    if (table.contains("xyzcal.px")) {
+      columns.xyzcal = table.get<vec3<double> >("xyzcal.px").const_ref();
+    }
+    if (table.contains("shoebox")) {
+      columns.shoebox = table.get<Shoebox<> >("shoebox").const_ref();
+    }
+    return columns;
+  }
+
+  af::shared<bool> FilterPipeline_call(const FilterPipeline &self,
+                                       af::reflection_table table,
+                                       std::size_t nthreads) {
+    FilterColumns columns = FilterPipeline_columns(table);
+    dials::util::ScopedReleaseGIL release_gil;
+    return self.evaluate(columns, nthreads);
+  }
+
+  af::shared<std::size_t> FilterPipeline_selection(const FilterPipeline &self,
+                                                   af::reflection_table table,
+                                                   std::size_t nthreads) {
+    FilterColumns columns = FilterPipeline_columns(table);
+    dials::util::ScopedReleaseGIL release_gil;
+    return self.selection(columns, nthreads);
+  }
+
   void export_is_zeta_valid() {
     def("is_zeta_valid",
         (bool (*)(vec3<double>, vec3<double>, vec3<double>, double)) & is_zeta_valid,
@@ -101,11 +162,47 @@ namespace dials { namespace algorithms { namespace filter { namespace boost_pyth
     def("by_shoebox_mask", &by_shoebox_mask);
   }
 
+  void export_filter_pipeline() {
+    class_<FilterPipeline>("FilterPipeline")
+      .def("add_zeta",
+           &FilterPipeline::add_zeta,
+           (arg("g"), arg("b"), arg("min_zeta")))
+      .def("add_xds_small_angle",
+           &FilterPipeline::add_xds_small_angle,
+           (arg("g"), arg("b"), arg("delta_m")))
+      .def("add_xds_angle",
+           &FilterPipeline::add_xds_angle,
+           (arg("g"), arg("b"), arg("delta_m")))
+      .def("add_bbox_volume", &FilterPipeline::add_bbox_volume, (arg("num_bins") = 0))
+      .def("add_detector_mask",
+           &FilterPipeline_add_detector_mask,
+           (arg("mask"), arg("scan_range")))
+      .def("add_centroid_prediction_separation",
+           &FilterPipeline::add_centroid_prediction_separation,
+           (arg("max_separation")))
+      .def("add_resolution",
+           &FilterPipeline::add_resolution,
+           (arg("beam"), arg("detector"), arg("d_min"), arg("d_max") = -1))
+      .def("add_shoebox_mask",
+           &FilterPipeline::add_shoebox_mask,
+           (arg("image_size"), arg("scan_range")))
+      .def("num_filters", &FilterPipeline::num_filters)
+      .def("__len__", &FilterPipeline::num_filters)
+      .def("__call__",
+           &FilterPipeline_call,
+           (arg("reflections"), arg("nthreads") = 1))
+      .def("selection",
+           &FilterPipeline_selection,
+           (arg("reflections"), arg("nthreads") = 1));
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_filter_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_is_zeta_valid();
     export_is_xds_small_angle_valid();
     export_is_xds_angle_valid();
     export_filter_list();
+    export_filter_pipeline();
   }
 
 }}}}  // namespace dials::algorithms::filter::boost_python
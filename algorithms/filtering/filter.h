@@ -299,11 +299,14 @@ namespace dials { namespace algorithms { namespace filter {
   }
 
   /**
-   * Filter the reflection list based on the bounding box volume
+   * Calculate the bounding box volume above which reflections are rejected
+   * from the histogram of the bounding box volumes
    * @param bboxes The list of bounding boxes
+   * @param num_bins The number of histogram bins
+   * @returns The threshold
    */
-  inline af::shared<bool> by_bbox_volume(const af::const_ref<int6> &bboxes,
-                                         std::size_t num_bins) {
+  inline double bbox_volume_threshold(const af::const_ref<int6> &bboxes,
+                                      std::size_t num_bins) {
     // Check the bins are correct
     DIALS_ASSERT(num_bins > 0);
 
@@ -331,12 +334,31 @@ namespace dials { namespace algorithms { namespace filter {
       histo[(int)((volume[i] - min_volume) / bin_size)]++;
     }
 
-    // Calculate the threshold and set any reflections with bounding
-    // box size greater than the threshold to be invalid.
-    double threshold = maximum_deviation(histo.const_ref()) * bin_size;
+    // Calculate the threshold
+    return maximum_deviation(histo.const_ref()) * bin_size;
+  }
+
+  /**
+   * @returns The default number of bins for the bounding box volume histogram
+   */
+  inline std::size_t bbox_volume_num_bins(std::size_t num_reflections) {
+    return (std::size_t)(std::exp((1.0 / 3.0) * std::log((double)num_reflections)));
+  }
+
+  /**
+   * Filter the reflection list based on the bounding box volume
+   * @param bboxes The list of bounding boxes
+   */
+  inline af::shared<bool> by_bbox_volume(const af::const_ref<int6> &bboxes,
+                                         std::size_t num_bins) {
+    // Set any reflections with bounding box size greater than the threshold
+    // to be invalid.
+    double threshold = bbox_volume_threshold(bboxes, num_bins);
     af::shared<bool> result(bboxes.size(), true);
     for (std::size_t i = 0; i < bboxes.size(); ++i) {
-      if (volume[i] > threshold) {
+      int6 bbox = bboxes[i];
+      int volume = (bbox[1] - bbox[0]) * (bbox[3] - bbox[2]) * (bbox[5] - bbox[4]);
+      if (volume > threshold) {
         result[i] = false;
       }
     }
@@ -349,9 +371,7 @@ namespace dials { namespace algorithms { namespace filter {
    * @param bboxes The list of bounding boxes
    */
   inline af::shared<bool> by_bbox_volume(const af::const_ref<int6> &bboxes) {
-    std::size_t num =
-      (std::size_t)(std::exp((1.0 / 3.0) * std::log((double)bboxes.size())));
-    return by_bbox_volume(bboxes, num);
+    return by_bbox_volume(bboxes, bbox_volume_num_bins(bboxes.size()));
   }
 
   /**
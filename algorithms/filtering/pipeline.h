@@ -0,0 +1,429 @@
+/*
+ * pipeline.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_FILTERING_PIPELINE_H
+#define DIALS_ALGORITHMS_FILTERING_PIPELINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/bind.hpp>
+#include <dials/algorithms/filtering/filter.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace filter {
+
+  /**
+   * The reflection columns used by a FilterPipeline. The columns which are not
+   * used by any of the filters may be left empty.
+   */
+  struct FilterColumns {
+    FilterColumns(std::size_t size_)
+        : size(size_),
+          s1((const vec3<double> *)0, 0),
+          bbox((const int6 *)0, 0),
+          panel((const std::size_t *)0, 0),
+          xyzobs((const vec3<double> *)0, 0),
+          xyzcal((const vec3<double> *)0, 0),
+          shoebox((const Shoebox<> *)0, 0) {}
+
+    std::size_t size;
+    af::const_ref<vec3<double> > s1;
+    af::const_ref<int6> bbox;
+    af::const_ref<std::size_t> panel;
+    af::const_ref<vec3<double> > xyzobs;
+    af::const_ref<vec3<double> > xyzcal;
+    af::const_ref<Shoebox<> > shoebox;
+  };
+
+  /**
+   * A set of the reflection filters from filter.h which are evaluated together
+   * in a single pass over the reflections. The filters are added to the
+   * pipeline and then evaluated in parallel for all the reflections, giving a
+   * single flag (or the index) for each reflection which passes all of them.
+   *
+   * The beam vectors needed by the zeta and XDS angle filters are computed
+   * once for each reflection and shared between them, and the cheapest filters
+   * are checked first so that the others are skipped for reflections which
+   * have already been rejected. Each filter gives the same result as the
+   * corresponding function in filter.h, except that a reflection whose
+   * diffracted beam is parallel to the incident beam is rejected rather than
+   * raising an error.
+   */
+  class FilterPipeline {
+  public:
+    FilterPipeline()
+        : use_zeta_(false),
+          use_xds_small_angle_(false),
+          use_xds_angle_(false),
+          use_bbox_volume_(false),
+          use_detector_mask_(false),
+          use_separation_(false),
+          use_resolution_(false),
+          use_shoebox_mask_(false),
+          has_geometry_(false),
+          min_zeta_(0),
+          small_angle_delta_m_(0),
+          angle_delta_m_(0),
+          bbox_volume_num_bins_(0),
+          max_separation_(0),
+          d_min_(0),
+          d_max_(0) {}
+
+    /**
+     * Reject reflections with |zeta| below the minimum (as by_zeta)
+     * @param g The goniometer
+     * @param b The beam
+     * @param min_zeta The minimum zeta value
+     */
+    void add_zeta(const Goniometer &g, const BeamBase &b, double min_zeta) {
+      set_geometry(g.get_rotation_axis(), b.get_s0());
+      use_zeta_ = true;
+      min_zeta_ = min_zeta;
+    }
+
+    /**
+     * Reject reflections for which the XDS small angle approximation does not
+     * hold (as by_xds_small_angle)
+     * @param g The goniometer
+     * @param b The beam
+     * @param delta_m The mosaicity * n_sigma
+     */
+    void add_xds_small_angle(const Goniometer &g, const BeamBase &b, double delta_m) {
+      set_geometry(g.get_rotation_axis(), b.get_s0());
+      use_xds_small_angle_ = true;
+      small_angle_delta_m_ = delta_m;
+    }
+
+    /**
+     * Reject reflections whose angle can not be mapped to the local reflection
+     * coordinate system (as by_xds_angle)
+     * @param g The goniometer
+     * @param b The beam
+     * @param delta_m The mosaicity * n_sigma
+     */
+    void add_xds_angle(const Goniometer &g, const BeamBase &b, double delta_m) {
+      set_geometry(g.get_rotation_axis(), b.get_s0());
+      use_xds_angle_ = true;
+      angle_delta_m_ = delta_m;
+    }
+
+    /**
+     * Reject reflections with a large bounding box volume (as by_bbox_volume)
+     * @param num_bins The number of histogram bins (0 for the cube root of
+     *                 the number of reflections)
+     */
+    void add_bbox_volume(std::size_t num_bins) {
+      use_bbox_volume_ = true;
+      bbox_volume_num_bins_ = num_bins;
+    }
+
+    /**
+     * Reject reflections whose bounding box is outside the image range or
+     * covers bad pixels (as by_detector_mask)
+     * @param mask The mask for each panel
+     * @param scan_range The scan range
+     */
+    void add_detector_mask(const std::vector<af::versa<bool, af::c_grid<2> > > &mask,
+                           int2 scan_range) {
+      DIALS_ASSERT(mask.size() > 0);
+      use_detector_mask_ = true;
+      mask_ = mask;
+      scan_range_ = scan_range;
+    }
+
+    /**
+     * Reject reflections whose observed centroid is far from the predicted
+     * position (as by_centroid_prediction_separation)
+     * @param max_separation The maximum allowed separation
+     */
+    void add_centroid_prediction_separation(double max_separation) {
+      use_separation_ = true;
+      max_separation_ = max_separation;
+    }
+
+    /**
+     * Reject reflections outside a resolution range at their predicted
+     * centroid (as by_resolution_at_centroid)
+     * @param beam The beam
+     * @param detector The detector
+     * @param d_min The maximum resolution
+     * @param d_max The minimum resolution (< 0 for no limit)
+     */
+    void add_resolution(const BeamBase &beam,
+                        const Detector &detector,
+                        double d_min,
+                        double d_max) {
+      use_resolution_ = true;
+      resolution_s0_ = beam.get_s0();
+      detector_ = detector;
+      d_min_ = d_min;
+      d_max_ = d_max < 0 ? std::numeric_limits<double>::max() : d_max;
+    }
+
+    /**
+     * Reject reflections whose shoebox is outside the image range or has
+     * invalid foreground pixels (as by_shoebox_mask)
+     * @param image_size The image size
+     * @param scan_range The scan range
+     */
+    void add_shoebox_mask(int2 image_size, int2 scan_range) {
+      use_shoebox_mask_ = true;
+      image_size_ = tiny<std::size_t, 2>(image_size[0], image_size[1]);
+      shoebox_scan_range_ = scan_range;
+    }
+
+    /**
+     * @returns The number of filters in the pipeline
+     */
+    std::size_t num_filters() const {
+      return use_zeta_ + use_xds_small_angle_ + use_xds_angle_ + use_bbox_volume_
+             + use_detector_mask_ + use_separation_ + use_resolution_
+             + use_shoebox_mask_;
+    }
+
+    /**
+     * Evaluate the filters for all the reflections
+     * @param columns The reflection columns
+     * @param nthreads The number of threads
+     * @returns True/False the reflection passes all the filters
+     */
+    af::shared<bool> evaluate(const FilterColumns &columns,
+                              std::size_t nthreads = 1) const {
+      check_columns(columns);
+      double volume_threshold = std::numeric_limits<double>::max();
+      if (use_bbox_volume_) {
+        std::size_t num_bins = bbox_volume_num_bins_ > 0
+                                 ? bbox_volume_num_bins_
+                                 : bbox_volume_num_bins(columns.size);
+        volume_threshold = bbox_volume_threshold(columns.bbox, num_bins);
+      }
+      af::shared<bool> result(columns.size, af::init_functor_null<bool>());
+      Evaluator evaluator(*this, columns, volume_threshold, result.ref());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&Evaluator::rows, &evaluator, _1, _2), columns.size, nthreads);
+      return result;
+    }
+
+    /**
+     * Evaluate the filters for all the reflections
+     * @param columns The reflection columns
+     * @param nthreads The number of threads
+     * @returns The indices of the reflections which pass all the filters
+     */
+    af::shared<std::size_t> selection(const FilterColumns &columns,
+                                      std::size_t nthreads = 1) const {
+      af::shared<bool> flags = evaluate(columns, nthreads);
+      af::shared<std::size_t> result;
+      for (std::size_t i = 0; i < flags.size(); ++i) {
+        if (flags[i]) {
+          result.push_back(i);
+        }
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Evaluate the filters for a band of reflections
+     */
+    class Evaluator {
+    public:
+      Evaluator(const FilterPipeline &pipeline,
+                const FilterColumns &columns,
+                double volume_threshold,
+                af::ref<bool> result)
+          : pipeline_(pipeline),
+            columns_(columns),
+            volume_threshold_(volume_threshold),
+            result_(result) {}
+
+      void rows(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          result_[i] = pipeline_.is_valid(columns_, volume_threshold_, i);
+        }
+      }
+
+    private:
+      const FilterPipeline &pipeline_;
+      const FilterColumns &columns_;
+      double volume_threshold_;
+      af::ref<bool> result_;
+    };
+
+    /**
+     * Set the rotation axis and beam shared by the geometric filters
+     */
+    void set_geometry(vec3<double> m2, vec3<double> s0) {
+      if (has_geometry_) {
+        DIALS_ASSERT(m2 == m2_ && s0 == s0_);
+      }
+      has_geometry_ = true;
+      m2_ = m2;
+      s0_ = s0;
+    }
+
+    /**
+     * Check the columns needed by the filters are present
+     */
+    void check_columns(const FilterColumns &columns) const {
+      std::size_t n = columns.size;
+      if (use_zeta_ || use_xds_small_angle_ || use_xds_angle_) {
+        DIALS_ASSERT(columns.s1.size() == n);
+      }
+      if (use_bbox_volume_ || use_detector_mask_) {
+        DIALS_ASSERT(columns.bbox.size() == n);
+      }
+      if ((use_detector_mask_ && mask_.size() > 1) || use_resolution_) {
+        DIALS_ASSERT(columns.panel.size() == n);
+      }
+      if (use_separation_) {
+        DIALS_ASSERT(columns.xyzobs.size() == n);
+      }
+      if (use_separation_ || use_resolution_) {
+        DIALS_ASSERT(columns.xyzcal.size() == n);
+      }
+      if (use_shoebox_mask_) {
+        DIALS_ASSERT(columns.shoebox.size() == n);
+      }
+    }
+
+    /**
+     * Check a reflection against all the filters, cheapest first
+     */
+    bool is_valid(const FilterColumns &columns,
+                  double volume_threshold,
+                  std::size_t i) const {
+      if (use_separation_) {
+        vec3<double> obs = columns.xyzobs[i];
+        vec3<double> cal = columns.xyzcal[i];
+        double sep = std::sqrt((obs[0] - cal[0]) * (obs[0] - cal[0])
+                               + (obs[1] - cal[1]) * (obs[1] - cal[1])
+                               + (obs[2] - cal[2]) * (obs[2] - cal[2]));
+        if (sep > max_separation_) {
+          return false;
+        }
+      }
+      if (use_bbox_volume_) {
+        int6 bbox = columns.bbox[i];
+        int volume = (bbox[1] - bbox[0]) * (bbox[3] - bbox[2]) * (bbox[5] - bbox[4]);
+        if (volume > volume_threshold) {
+          return false;
+        }
+      }
+      if (use_detector_mask_) {
+        std::size_t panel = mask_.size() > 1 ? columns.panel[i] : 0;
+        DIALS_ASSERT(panel < mask_.size());
+        if (!is_bbox_valid(columns.bbox[i], mask_[panel].const_ref(), scan_range_)) {
+          return false;
+        }
+      }
+      if (use_zeta_ || use_xds_small_angle_ || use_xds_angle_) {
+        if (!is_geometry_valid(columns.s1[i])) {
+          return false;
+        }
+      }
+      if (use_resolution_) {
+        std::size_t panel = columns.panel[i];
+        DIALS_ASSERT(panel < detector_.size());
+        vec3<double> xyz = columns.xyzcal[i];
+        double resolution = detector_[panel].get_resolution_at_pixel(
+          resolution_s0_, vec2<double>(xyz[0], xyz[1]));
+        if (resolution < d_min_ || resolution > d_max_) {
+          return false;
+        }
+      }
+      if (use_shoebox_mask_) {
+        const Shoebox<> &sbox = columns.shoebox[i];
+        DIALS_ASSERT(sbox.is_consistent());
+        if (is_bbox_outside_image_range(sbox.bbox, image_size_, shoebox_scan_range_)) {
+          return false;
+        }
+        for (std::size_t j = 0; j < sbox.mask.size(); ++j) {
+          if ((sbox.mask[j] & Foreground) && !(sbox.mask[j] & Valid)) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Check the zeta and XDS angle filters with the beam vectors computed once
+     */
+    bool is_geometry_valid(vec3<double> s1) const {
+      vec3<double> e1 = s1.cross(s0_);
+      if (e1.length() == 0) {
+        return false;
+      }
+      e1 = e1.normalize();
+      if (use_zeta_ && !(std::abs(m2_ * e1) >= min_zeta_)) {
+        return false;
+      }
+      if (!use_xds_small_angle_ && !use_xds_angle_) {
+        return true;
+      }
+      vec3<double> ps = (s1 - s0_).normalize();
+      vec3<double> e3 = (s1 + s0_).normalize();
+      double m2e1 = m2_ * e1;
+      double m2e3 = m2_ * e3;
+      double m2ps = m2_ * ps;
+      if (use_xds_small_angle_) {
+        double c3 = -std::abs(small_angle_delta_m_);
+        if (!((m2e1 * m2e1 + 2.0 * c3 * m2e3 * m2ps - c3 * c3) >= 0.0)) {
+          return false;
+        }
+      }
+      if (use_xds_angle_) {
+        double m2e3_m2ps = m2e3 * m2ps;
+        if (m2e1 == 0) {
+          return false;
+        }
+        double rt = std::sqrt(m2e1 * m2e1 + m2e3_m2ps * m2e3_m2ps);
+        double dphi0 = 2.0 * std::atan((m2e3_m2ps + rt) / m2e1);
+        double dphi1 = 2.0 * std::atan((m2e3_m2ps - rt) / m2e1);
+        if (dphi0 > dphi1) {
+          std::swap(dphi0, dphi1);
+        }
+        double delta_m = std::abs(angle_delta_m_);
+        if (!(dphi0 <= -delta_m && dphi1 >= delta_m)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool use_zeta_;
+    bool use_xds_small_angle_;
+    bool use_xds_angle_;
+    bool use_bbox_volume_;
+    bool use_detector_mask_;
+    bool use_separation_;
+    bool use_resolution_;
+    bool use_shoebox_mask_;
+    bool has_geometry_;
+    vec3<double> m2_;
+    vec3<double> s0_;
+    double min_zeta_;
+    double small_angle_delta_m_;
+    double angle_delta_m_;
+    std::size_t bbox_volume_num_bins_;
+    std::vector<af::versa<bool, af::c_grid<2> > > mask_;
+    int2 scan_range_;
+    double max_separation_;
+    vec3<double> resolution_s0_;
+    Detector detector_;
+    double d_min_;
+    double d_max_;
+    tiny<std::size_t, 2> image_size_;
+    int2 shoebox_scan_range_;
+  };
+
+}}}  // namespace dials::algorithms::filter
+
+#endif  // DIALS_ALGORITHMS_FILTERING_PIPELINE_H
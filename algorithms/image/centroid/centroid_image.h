@@ -42,29 +42,21 @@ namespace dials { namespace algorithms {
      * @param image The image pixels
      */
     CentroidImage2d(const af::const_ref<FloatType, af::c_grid<2> > &image)
-        : centroid_algorithm_type(image.as_1d(),
-                                  generate_coords(image.accessor()).const_ref()) {}
+        : centroid_algorithm_type(moments(image)) {}
 
   private:
     /**
-     * Generate coordinates.
-     * @param size The size of the image
+     * Compute the moments from the image grid.
+     * @param image The image pixels
      */
-    af::shared<coord_type> generate_coords(af::c_grid<2> size) {
-      // Check the sizes
-      DIALS_ASSERT(size.all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<coord_type> coords(product(size.const_ref()),
-                                    af::init_functor_null<coord_type>());
-      for (std::size_t j = 0, k = 0; j < size[0]; ++j) {
-        for (std::size_t i = 0; i < size[1]; ++i, ++k) {
-          coords[k] = coord_type(i + 0.5, j + 0.5);
-        }
-      }
-
-      // Return the array
-      return coords;
+    static detail::ImageMoments<FloatType> moments(
+      const af::const_ref<FloatType, af::c_grid<2> > &image) {
+      DIALS_ASSERT(image.accessor().all_gt(0));
+      return detail::ImageMoments<FloatType>(image.as_1d(),
+                                             detail::SelectAllPixels(),
+                                             1,
+                                             image.accessor()[0],
+                                             image.accessor()[1]);
     }
   };
 
@@ -86,31 +78,30 @@ namespace dials { namespace algorithms {
      * @param image The image pixels
      */
     CentroidImage3d(const af::const_ref<FloatType, af::c_grid<3> > &image)
-        : centroid_algorithm_type(image.as_1d(),
-                                  generate_coords(image.accessor()).const_ref()) {}
+        : centroid_algorithm_type(moments(image.accessor(), image.as_1d())) {}
+
+    /**
+     * Initialise the algorithm with pixels which are computed as they are
+     * read, rather than stored in a temporary image.
+     * @param size The size of the image
+     * @param image The image pixels indexed by the pixel index
+     */
+    template <typename ImageType>
+    CentroidImage3d(const af::c_grid<3> &size, const ImageType &image)
+        : centroid_algorithm_type(moments(size, image)) {}
 
   private:
     /**
-     * Generate coordinates.
+     * Compute the moments from the image grid.
      * @param size The size of the image
+     * @param image The image pixels
      */
-    af::shared<coord_type> generate_coords(af::c_grid<3> size) {
-      // Check the sizes
+    template <typename ImageType>
+    static detail::ImageMoments<FloatType> moments(const af::c_grid<3> &size,
+                                                   const ImageType &image) {
       DIALS_ASSERT(size.all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<coord_type> coords(product(size.const_ref()),
-                                    af::init_functor_null<coord_type>());
-      for (std::size_t k = 0, l = 0; k < size[0]; ++k) {
-        for (std::size_t j = 0; j < size[1]; ++j) {
-          for (std::size_t i = 0; i < size[2]; ++i, ++l) {
-            coords[l] = coord_type(i + 0.5, j + 0.5, k + 0.5);
-          }
-        }
-      }
-
-      // Return the array
-      return coords;
+      return detail::ImageMoments<FloatType>(
+        image, detail::SelectAllPixels(), size[0], size[1], size[2]);
     }
   };
 
@@ -45,60 +45,21 @@ namespace dials { namespace algorithms {
      */
     CentroidMaskedImage2d(const af::const_ref<FloatType, af::c_grid<2> > &image,
                           const af::const_ref<bool, af::c_grid<2> > &mask)
-        : centroid_algorithm_type(select_pixels(image, mask).const_ref(),
-                                  generate_coords(image, mask).const_ref()) {}
+        : centroid_algorithm_type(moments(image, mask)) {}
 
   private:
     /**
-     * Get the mask indices.
-     * @param size The size of the image
-     */
-    af::shared<FloatType> select_pixels(
-      const af::const_ref<FloatType, af::c_grid<2> > &image,
-      const af::const_ref<bool, af::c_grid<2> > &mask) {
-      // Check the sizes
-      DIALS_ASSERT(mask.accessor().all_eq(image.accessor()));
-      DIALS_ASSERT(mask.accessor().all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<FloatType> pixels(image.size(), af::init_functor_null<FloatType>());
-      std::size_t count = 0;
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        if (mask[i]) {
-          pixels[count++] = image[i];
-        }
-      }
-      pixels.resize(count);
-
-      // Return the array
-      return pixels;
-    }
-
-    /**
-     * Generate coordinates.
-     * @param size The size of the image
+     * Compute the moments of the masked pixels from the image grid.
+     * @param image The image pixels
+     * @param mask The mask
      */
-    af::shared<coord_type> generate_coords(
+    static detail::ImageMoments<FloatType> moments(
       const af::const_ref<FloatType, af::c_grid<2> > &image,
       const af::const_ref<bool, af::c_grid<2> > &mask) {
-      // Check the sizes
       DIALS_ASSERT(mask.accessor().all_eq(image.accessor()));
       DIALS_ASSERT(mask.accessor().all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<coord_type> coords(image.size(), af::init_functor_null<coord_type>());
-      std::size_t count = 0;
-      for (std::size_t j = 0; j < mask.accessor()[0]; ++j) {
-        for (std::size_t i = 0; i < mask.accessor()[1]; ++i) {
-          if (mask(j, i)) {
-            coords[count++] = coord_type(i + 0.5, j + 0.5);
-          }
-        }
-      }
-      coords.resize(count);
-
-      // Return the array
-      return coords;
+      return detail::ImageMoments<FloatType>(
+        image.as_1d(), mask.as_1d(), 1, image.accessor()[0], image.accessor()[1]);
     }
   };
 
@@ -121,63 +82,38 @@ namespace dials { namespace algorithms {
      */
     CentroidMaskedImage3d(const af::const_ref<FloatType, af::c_grid<3> > &image,
                           const af::const_ref<bool, af::c_grid<3> > &mask)
-        : centroid_algorithm_type(select_pixels(image, mask).const_ref(),
-                                  generate_coords(image, mask).const_ref()) {}
+        : centroid_algorithm_type(
+          moments(image.accessor(), mask.accessor(), image.as_1d(), mask.as_1d())) {}
 
-  private:
     /**
-     * Get the mask indices.
+     * Initialise the algorithm with pixels and a mask which are computed as
+     * they are read, rather than stored in temporary arrays.
      * @param size The size of the image
+     * @param image The image pixels indexed by the pixel index
+     * @param mask The mask indexed by the pixel index
      */
-    af::shared<FloatType> select_pixels(
-      const af::const_ref<FloatType, af::c_grid<3> > &image,
-      const af::const_ref<bool, af::c_grid<3> > &mask) {
-      // Check the sizes
-      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(image.accessor().all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<FloatType> pixels(image.size(), af::init_functor_null<FloatType>());
-      std::size_t count = 0;
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        if (mask[i]) {
-          pixels[count++] = image[i];
-        }
-      }
-      pixels.resize(count);
-
-      // Return the array
-      return pixels;
-    }
+    template <typename ImageType, typename MaskType>
+    CentroidMaskedImage3d(const af::c_grid<3> &size,
+                          const ImageType &image,
+                          const MaskType &mask)
+        : centroid_algorithm_type(moments(size, size, image, mask)) {}
 
+  private:
     /**
-     * Generate coordinates.
+     * Compute the moments of the masked pixels from the image grid.
      * @param size The size of the image
+     * @param mask_size The size of the mask
+     * @param image The image pixels
+     * @param mask The mask
      */
-    af::shared<coord_type> generate_coords(
-      const af::const_ref<FloatType, af::c_grid<3> > &image,
-      const af::const_ref<bool, af::c_grid<3> > &mask) {
-      // Check the sizes
-      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(image.accessor().all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<coord_type> coords(image.size(), af::init_functor_null<coord_type>());
-      std::size_t count = 0;
-      for (std::size_t k = 0; k < image.accessor()[0]; ++k) {
-        for (std::size_t j = 0; j < image.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < image.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
-              coords[count++] = coord_type(i + 0.5, j + 0.5, k + 0.5);
-            }
-          }
-        }
-      }
-
-      coords.resize(count);
-
-      // Return the array
-      return coords;
+    template <typename ImageType, typename MaskType>
+    static detail::ImageMoments<FloatType> moments(const af::c_grid<3> &size,
+                                                   const af::c_grid<3> &mask_size,
+                                                   const ImageType &image,
+                                                   const MaskType &mask) {
+      DIALS_ASSERT(size.all_eq(mask_size));
+      DIALS_ASSERT(size.all_gt(0));
+      return detail::ImageMoments<FloatType>(image, mask, size[0], size[1], size[2]);
     }
   };
 
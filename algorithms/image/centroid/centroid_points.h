@@ -18,6 +18,7 @@
 #include <scitbx/array_family/misc_functions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/image/centroid/bias.h>
+#include <dials/algorithms/image/centroid/image_moments.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -188,6 +189,32 @@ namespace dials { namespace algorithms {
       return matrix;
     }
 
+  protected:
+    /**
+     * Initialise from the moments of an image grid.
+     * @param moments The image moments
+     */
+    CentroidPoints(const detail::ImageMoments<FloatType> &moments)
+        : sum_pixels_((value_type)moments.sum),
+          sum_pixels_sq_((value_type)moments.sum_sq),
+          sum_pixels_coords_(0.0),
+          sum_pixels_delta_sq_(0.0),
+          sum_pixels_delta_cross_(0.0) {
+      // Check the size of the input
+      DIALS_ASSERT(DIM > 1);
+      DIALS_ASSERT(moments.count > 0);
+      DIALS_ASSERT(sum_pixels_ > 0);
+
+      // Copy the moments for the dimensions of the coordinates
+      for (std::size_t i = 0; i < DIM; ++i) {
+        sum_pixels_coords_[i] = moments.sum_coords[i];
+        sum_pixels_delta_sq_[i] = moments.sum_delta_sq[i];
+      }
+      for (std::size_t l = 0; l < DIM * (DIM - 1) / 2; ++l) {
+        sum_pixels_delta_cross_[l] = moments.sum_delta_cross[l];
+      }
+    }
+
   private:
     coord_type pow2c(const coord_type &x) const {
       coord_type r;
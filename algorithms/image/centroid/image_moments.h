@@ -0,0 +1,156 @@
+/*
+ * image_moments.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_CENTROID_IMAGE_MOMENTS_H
+#define DIALS_ALGORITHMS_IMAGE_CENTROID_IMAGE_MOMENTS_H
+
+#include <vector>
+#include <scitbx/vec3.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace detail {
+
+  using scitbx::vec3;
+
+  /**
+   * A mask which selects all the pixels of an image
+   */
+  struct SelectAllPixels {
+    bool operator[](std::size_t) const {
+      return true;
+    }
+  };
+
+  /**
+   * Compute the sums needed by CentroidPoints directly from a 3D image grid,
+   * with pixel coordinates at the pixel centres, without generating the
+   * coordinates of the pixels. A 2D image is a single frame.
+   *
+   * One pass over the pixels computes the column sums, which give the x
+   * moments, and the sum and first x moment of each row, which give the y
+   * and z moments and the cross terms. The sum of the pixels and pixels
+   * squared are accumulated in the pixel type as in CentroidPoints.
+   *
+   * The image and mask can be anything indexed by the pixel index so the
+   * pixels can be selected or computed as they are read.
+   */
+  template <typename FloatType>
+  struct ImageMoments {
+    std::size_t count;
+    double sum;
+    double sum_sq;
+    vec3<double> sum_coords;
+    vec3<double> sum_delta_sq;
+    vec3<double> sum_delta_cross;
+
+    /**
+     * Compute the moments
+     * @param image The image pixels
+     * @param mask The mask of pixels to use
+     * @param nz The number of frames
+     * @param ny The number of rows
+     * @param nx The number of columns
+     */
+    template <typename ImageType, typename MaskType>
+    ImageMoments(const ImageType &image,
+                 const MaskType &mask,
+                 std::size_t nz,
+                 std::size_t ny,
+                 std::size_t nx)
+        : count(0),
+          sum(0),
+          sum_sq(0),
+          sum_coords(0, 0, 0),
+          sum_delta_sq(0, 0, 0),
+          sum_delta_cross(0, 0, 0) {
+      DIALS_ASSERT(nz > 0 && ny > 0 && nx > 0);
+
+      // Sum the columns and the rows
+      std::vector<double> x(nx);
+      std::vector<double> col(nx, 0.0);
+      std::vector<double> row(nz * ny);
+      std::vector<double> row_x(nz * ny);
+      for (std::size_t i = 0; i < nx; ++i) {
+        x[i] = i + 0.5;
+      }
+      FloatType s = 0;
+      FloatType ss = 0;
+      for (std::size_t kj = 0, l = 0; kj < nz * ny; ++kj) {
+        double r = 0;
+        double rx = 0;
+        for (std::size_t i = 0; i < nx; ++i, ++l) {
+          bool m = mask[l];
+          FloatType v = m ? (FloatType)image[l] : FloatType(0);
+          count += m;
+          s += v;
+          ss += v * v;
+          r += v;
+          rx += v * x[i];
+          col[i] += v;
+        }
+        row[kj] = r;
+        row_x[kj] = rx;
+      }
+      sum = s;
+      sum_sq = ss;
+      if (count == 0 || !(sum > 0)) {
+        return;
+      }
+
+      // Sum the rows over the frames and the frames over the rows
+      std::vector<double> y_sum(ny, 0.0);
+      std::vector<double> z_sum(nz, 0.0);
+      for (std::size_t k = 0, kj = 0; k < nz; ++k) {
+        for (std::size_t j = 0; j < ny; ++j, ++kj) {
+          y_sum[j] += row[kj];
+          z_sum[k] += row[kj];
+        }
+      }
+
+      // The first moments and the mean
+      for (std::size_t i = 0; i < nx; ++i) {
+        sum_coords[0] += col[i] * x[i];
+      }
+      for (std::size_t j = 0; j < ny; ++j) {
+        sum_coords[1] += y_sum[j] * (j + 0.5);
+      }
+      for (std::size_t k = 0; k < nz; ++k) {
+        sum_coords[2] += z_sum[k] * (k + 0.5);
+      }
+      vec3<double> m = sum_coords / sum;
+
+      // The second moments about the mean
+      for (std::size_t i = 0; i < nx; ++i) {
+        double dx = x[i] - m[0];
+        sum_delta_sq[0] += col[i] * dx * dx;
+      }
+      for (std::size_t j = 0; j < ny; ++j) {
+        double dy = j + 0.5 - m[1];
+        sum_delta_sq[1] += y_sum[j] * dy * dy;
+      }
+      for (std::size_t k = 0; k < nz; ++k) {
+        double dz = k + 0.5 - m[2];
+        sum_delta_sq[2] += z_sum[k] * dz * dz;
+      }
+
+      // The cross terms in the order xy, xz, yz. The sum over a row of
+      // pixels x (x - mean x) is the moment of the row about the mean.
+      for (std::size_t k = 0, kj = 0; k < nz; ++k) {
+        double dz = k + 0.5 - m[2];
+        for (std::size_t j = 0; j < ny; ++j, ++kj) {
+          double dy = j + 0.5 - m[1];
+          double rdx = row_x[kj] - m[0] * row[kj];
+          sum_delta_cross[0] += dy * rdx;
+          sum_delta_cross[1] += dz * rdx;
+          sum_delta_cross[2] += dz * dy * row[kj];
+        }
+      }
+    }
+  };
+
+}}}  // namespace dials::algorithms::detail
+
+#endif /* DIALS_ALGORITHMS_IMAGE_CENTROID_IMAGE_MOMENTS_H */
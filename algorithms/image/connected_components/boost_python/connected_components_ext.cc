@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/util/boost_python/trace.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -47,6 +48,7 @@ namespace dials { namespace algorithms { namespace boost_python {
   }
 
   BOOST_PYTHON_MODULE(dials_algorithms_image_connected_components_ext) {
+    dials::util::boost_python::import_trace_recorder();
     export_connected_components();
   }
 
@@ -13,13 +13,16 @@
 
 #include <ctime>
 #include <algorithm>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/connected_components.hpp>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/connected_components/union_find.h>
 #include <dials/error.h>
+#include <dials/util/trace.h>
 
 namespace dials { namespace algorithms {
 
@@ -28,25 +31,132 @@ namespace dials { namespace algorithms {
   using scitbx::af::int2;
   using scitbx::af::int3;
 
+  namespace detail {
+
+    /**
+     * A horizontal run of consecutive valid pixels on a row of an image. Each
+     * run is a single element in the union find forest, since all the pixels
+     * in it are connected.
+     */
+    struct PixelRun {
+      int first;       // The first pixel in the run
+      int last;        // One past the last pixel in the run
+      std::size_t id;  // The index of the run in the forest
+
+      PixelRun(int first_, int last_, std::size_t id_)
+          : first(first_), last(last_), id(id_) {}
+    };
+
+    /**
+     * Join the runs on one row to the overlapping runs on another. Both
+     * lists are sorted so this is done in a single pass.
+     * @param forest The union find forest
+     * @param a_first The first run on one row
+     * @param a_last One past the last run on the row
+     * @param b_first The first run on the other row
+     * @param b_last One past the last run on the other row
+     */
+    inline void join_runs(UnionFind &forest,
+                          const PixelRun *a_first,
+                          const PixelRun *a_last,
+                          const PixelRun *b_first,
+                          const PixelRun *b_last) {
+      while (a_first != a_last && b_first != b_last) {
+        if (a_first->first < b_first->last && b_first->first < a_first->last) {
+          forest.join(a_first->id, b_first->id);
+        }
+        if (a_first->last < b_first->last) {
+          ++a_first;
+        } else {
+          ++b_first;
+        }
+      }
+    }
+
+    /**
+     * Add the runs of valid pixels on a row of the image
+     * @param image The image
+     * @param mask The mask
+     * @param k The image number
+     * @param j The row
+     * @param forest The union find forest
+     * @param runs The list of runs to add to
+     * @param lengths The list of run lengths
+     * @param coords The list of pixel coordinates
+     * @param values The list of pixel values
+     */
+    inline void add_runs(const af::const_ref<int, af::c_grid<2> > &image,
+                         const af::const_ref<bool, af::c_grid<2> > &mask,
+                         int k,
+                         int j,
+                         UnionFind &forest,
+                         std::vector<PixelRun> &runs,
+                         af::shared<std::size_t> &lengths,
+                         af::shared<vec3<int> > &coords,
+                         af::shared<int> &values) {
+      int xsize = mask.accessor()[1];
+      int i = 0;
+      while (i < xsize) {
+        if (!mask(j, i)) {
+          ++i;
+          continue;
+        }
+        int first = i;
+        for (; i < xsize && mask(j, i); ++i) {
+          coords.push_back(vec3<int>(k, j, i));
+          values.push_back(image(j, i));
+        }
+        runs.push_back(PixelRun(first, i, forest.add()));
+        lengths.push_back(i - first);
+      }
+    }
+
+    /**
+     * Expand the labels of the runs to the pixels in them
+     * @param forest The union find forest
+     * @param lengths The number of pixels in each run
+     * @param num_pixels The total number of pixels
+     * @returns The label of each pixel
+     */
+    inline af::shared<int> expand_run_labels(const UnionFind &forest,
+                                             const af::shared<std::size_t> &lengths,
+                                             std::size_t num_pixels) {
+      DIALS_ASSERT(forest.size() == lengths.size());
+      af::shared<int> run_labels = forest.labels();
+      af::shared<int> labels(num_pixels, af::init_functor_null<int>());
+      std::size_t k = 0;
+      for (std::size_t i = 0; i < run_labels.size(); ++i) {
+        for (std::size_t j = 0; j < lengths[i]; ++j) {
+          labels[k++] = run_labels[i];
+        }
+      }
+      DIALS_ASSERT(k == num_pixels);
+      return labels;
+    }
+
+  }  // namespace detail
+
   template <std::size_t DIM>
   class LabelImageStack;
 
   /**
    * A class to do connected component labelling on a stack of images.
+   *
+   * Each row of the image is split into runs of valid pixels and the runs
+   * which overlap on neighbouring rows are joined in a union find forest as
+   * the images are added. Only the runs on the previous row are kept, along
+   * with the length of each run, so the memory used is much less than a graph
+   * with a vertex and edges for each pixel. The labels are the same as those
+   * given by boost::connected_components on the pixel graph.
    */
   template <>
   class LabelImageStack<2> {
   public:
-    // Adjacency list type
-    typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-      AdjacencyList;
-
     /**
      * Initialise the class with the size of the desired image.
      * @param size The size of the images
      */
-    LabelImageStack(int2 size)
-        : buffer_(size[1], af::init_functor_null<std::size_t>()), size_(size), k_(0) {}
+    LabelImageStack(int2 size) : size_(size), k_(0) {}
 
     /**
      * @returns The image size
@@ -69,33 +179,25 @@ namespace dials { namespace algorithms {
      */
     void add_image(const af::const_ref<int, af::c_grid<2> > &image,
                    const af::const_ref<bool, af::c_grid<2> > &mask) {
+      DIALS_TRACE_SCOPE("spot_finding", "label_add_image");
       // Check the input
       DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(image.accessor().all_eq(size_));
 
-      // Loop through all the pixels and assign the edges
-      std::size_t vertex_a = 0;
+      // Loop through the rows and join the runs to those on the row above
+      std::vector<detail::PixelRun> previous, current;
       for (std::size_t j = 0; j < size_[0]; ++j) {
-        for (std::size_t i = 0; i < size_[1]; ++i) {
-          if (mask(j, i)) {
-            // Add the vertex
-            vertex_a = add_vertex(graph_);
-            coords_.push_back(vec3<int>(k_, j, i));
-            values_.push_back(image(j, i));
-
-            // Add edges to this vertex
-            if (i > 0 && mask(j, i - 1)) {
-              boost::add_edge(vertex_a, vertex_a - 1, graph_);
-            }
-            if (j > 0 && mask(j - 1, i)) {
-              std::size_t vertex_b = buffer_[i];
-              boost::add_edge(vertex_a, vertex_b - 1, graph_);
-            }
-            buffer_[i] = vertex_a + 1;
-          } else {
-            buffer_[i] = 0;
-          }
+        current.clear();
+        detail::add_runs(
+          image, mask, k_, j, forest_, current, lengths_, coords_, values_);
+        if (!previous.empty() && !current.empty()) {
+          detail::join_runs(forest_,
+                            &previous[0],
+                            &previous[0] + previous.size(),
+                            &current[0],
+                            &current[0] + current.size());
         }
+        std::swap(previous, current);
       }
 
       // Increment image number
@@ -122,37 +224,36 @@ namespace dials { namespace algorithms {
      * @returns The list of labels
      */
     af::shared<int> labels() const {
-      af::shared<int> labels(num_vertices(graph_), af::init_functor_null<int>());
-      int num = boost::connected_components(graph_, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
-      return labels;
+      DIALS_TRACE_SCOPE("spot_finding", "label_components");
+      return detail::expand_run_labels(forest_, lengths_, coords_.size());
     }
 
   private:
-    AdjacencyList graph_;
+    UnionFind forest_;
+    af::shared<std::size_t> lengths_;
     af::shared<vec3<int> > coords_;
     af::shared<int> values_;
-    af::shared<std::size_t> buffer_;
     int2 size_;
     std::size_t k_;
   };
 
   /**
    * A class to do connected component labelling on a stack of images.
+   *
+   * This works in the same way as the 2D labelling but the runs are also
+   * joined to the overlapping runs on the same row of the previous image, so
+   * the runs of the previous image are kept between calls.
    */
   template <>
   class LabelImageStack<3> {
   public:
-    // Adjacency list type
-    typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-      AdjacencyList;
-
     /**
      * Initialise the class with the size of the desired image.
      * @param size The size of the images
      */
     LabelImageStack(int2 size)
-        : buffer_(af::c_grid<2>(size), af::init_functor_null<std::size_t>()),
+        : previous_offset_(size[0] + 1, 0),
+          current_offset_(size[0] + 1, 0),
           size_(size),
           k_(0) {}
 
@@ -177,38 +278,39 @@ namespace dials { namespace algorithms {
      */
     void add_image(const af::const_ref<int, af::c_grid<2> > &image,
                    const af::const_ref<bool, af::c_grid<2> > &mask) {
+      DIALS_TRACE_SCOPE("spot_finding", "label_add_image");
       // Check the input
       DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(image.accessor().all_eq(size_));
 
-      // Loop through all the pixels and assign the edges
-      std::size_t vertex_a = 0;
+      // Loop through the rows and join the runs to those on the row above
+      // and those on the same row of the previous image
+      current_.clear();
       for (std::size_t j = 0; j < size_[0]; ++j) {
-        for (std::size_t i = 0; i < size_[1]; ++i) {
-          if (mask(j, i)) {
-            // Add the vertex
-            vertex_a = add_vertex(graph_);
-            coords_.push_back(vec3<int>(k_, j, i));
-            values_.push_back(image(j, i));
-
-            // Add edges to this vertex
-            if (i > 0 && mask(j, i - 1)) {
-              boost::add_edge(vertex_a, vertex_a - 1, graph_);
-            }
-            if (j > 0 && mask(j - 1, i)) {
-              std::size_t vertex_b = buffer_(j - 1, i);
-              boost::add_edge(vertex_a, vertex_b - 1, graph_);
-            }
-            if (k_ > 0 && buffer_(j, i)) {
-              std::size_t vertex_b = buffer_(j, i);
-              boost::add_edge(vertex_a, vertex_b - 1, graph_);
-            }
-            buffer_(j, i) = vertex_a + 1;
-          } else {
-            buffer_(j, i) = 0;
-          }
+        std::size_t first = current_.size();
+        detail::add_runs(
+          image, mask, k_, j, forest_, current_, lengths_, coords_, values_);
+        std::size_t last = current_.size();
+        current_offset_[j] = first;
+        current_offset_[j + 1] = last;
+        if (first == last) {
+          continue;
+        }
+        const detail::PixelRun *c0 = &current_[0] + first;
+        const detail::PixelRun *c1 = &current_[0] + last;
+        if (j > 0 && current_offset_[j - 1] != first) {
+          detail::join_runs(forest_, &current_[0] + current_offset_[j - 1], c0, c0, c1);
+        }
+        if (k_ > 0 && previous_offset_[j] != previous_offset_[j + 1]) {
+          detail::join_runs(forest_,
+                            &previous_[0] + previous_offset_[j],
+                            &previous_[0] + previous_offset_[j + 1],
+                            c0,
+                            c1);
         }
       }
+      std::swap(previous_, current_);
+      std::swap(previous_offset_, current_offset_);
 
       // Increment image number
       k_++;
@@ -234,17 +336,19 @@ namespace dials { namespace algorithms {
      * @returns The list of labels
      */
     af::shared<int> labels() const {
-      af::shared<int> labels(num_vertices(graph_), af::init_functor_null<int>());
-      int num = boost::connected_components(graph_, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
-      return labels;
+      DIALS_TRACE_SCOPE("spot_finding", "label_components");
+      return detail::expand_run_labels(forest_, lengths_, coords_.size());
     }
 
   private:
-    AdjacencyList graph_;
+    UnionFind forest_;
+    std::vector<detail::PixelRun> previous_;
+    std::vector<detail::PixelRun> current_;
+    std::vector<std::size_t> previous_offset_;
+    std::vector<std::size_t> current_offset_;
+    af::shared<std::size_t> lengths_;
     af::shared<vec3<int> > coords_;
     af::shared<int> values_;
-    af::versa<std::size_t, af::c_grid<2> > buffer_;
     int2 size_;
     std::size_t k_;
   };
@@ -301,12 +405,8 @@ namespace dials { namespace algorithms {
      * @returns The list of labels
      */
     af::shared<int> labels() const {
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
-
       // Create a hash table of the points
-      AdjacencyList graph(coords_.size());
+      UnionFind forest(coords_.size());
       boost::unordered_map<vec3<int>, int, Vec3IntHash> grid(coords_.size(),
                                                              Vec3IntHash(size_));
       for (std::size_t i = 0; i < coords_.size(); ++i) {
@@ -315,22 +415,19 @@ namespace dials { namespace algorithms {
       }
 
       // For each point check the pixels to the left in all three dimensins
-      // and if they are in the list of pixels then add the edges.
+      // and if they are in the list of pixels then join them.
       for (std::size_t i = 0; i < coords_.size(); ++i) {
         int j;
         j = grid[vec3<int>(coords_[i][0] - 1, coords_[i][1], coords_[i][2])];
-        if (j != 0) boost::add_edge(i, j - 1, graph);
+        if (j != 0) forest.join(i, j - 1);
         j = grid[vec3<int>(coords_[i][0], coords_[i][1] - 1, coords_[i][2])];
-        if (j != 0) boost::add_edge(i, j - 1, graph);
+        if (j != 0) forest.join(i, j - 1);
         j = grid[vec3<int>(coords_[i][0], coords_[i][1], coords_[i][2] - 1)];
-        if (j != 0) boost::add_edge(i, j - 1, graph);
+        if (j != 0) forest.join(i, j - 1);
       }
 
       // Do the connected components
-      af::shared<int> labels(num_vertices(graph), af::init_functor_null<int>());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
-      return labels;
+      return forest.labels();
     }
 
   private:
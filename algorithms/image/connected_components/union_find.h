@@ -0,0 +1,107 @@
+/*
+ * union_find.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_CONNECTED_COMPONENTS_UNION_FIND_H
+#define DIALS_ALGORITHMS_IMAGE_CONNECTED_COMPONENTS_UNION_FIND_H
+
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A disjoint set forest used for connected component labelling.
+   *
+   * The root of each set is always its smallest element, so the parent of an
+   * element is never greater than the element itself. The paths are halved as
+   * they are followed when sets are joined. The components can then be
+   * labelled in a single pass in order, giving the same labels as
+   * boost::connected_components on the equivalent graph: the components are
+   * numbered in order of their first element.
+   */
+  class UnionFind {
+  public:
+    UnionFind() {}
+
+    /**
+     * Create the forest with each element in its own set
+     * @param n The number of elements
+     */
+    UnionFind(std::size_t n) : parent_(n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        parent_[i] = i;
+      }
+    }
+
+    /**
+     * @returns The number of elements
+     */
+    std::size_t size() const {
+      return parent_.size();
+    }
+
+    /**
+     * Add an element in its own set
+     * @returns The index of the new element
+     */
+    std::size_t add() {
+      std::size_t index = parent_.size();
+      parent_.push_back(index);
+      return index;
+    }
+
+    /**
+     * Find the root of the set containing an element, halving the path
+     * @param i The element
+     * @returns The root element
+     */
+    std::size_t find(std::size_t i) {
+      DIALS_ASSERT(i < parent_.size());
+      while (parent_[i] != i) {
+        parent_[i] = parent_[parent_[i]];
+        i = parent_[i];
+      }
+      return i;
+    }
+
+    /**
+     * Join the sets containing two elements
+     * @param a The first element
+     * @param b The second element
+     */
+    void join(std::size_t a, std::size_t b) {
+      a = find(a);
+      b = find(b);
+      if (a < b) {
+        parent_[b] = a;
+      } else if (b < a) {
+        parent_[a] = b;
+      }
+    }
+
+    /**
+     * Label the components in order of their first element
+     * @returns The label of each element
+     */
+    af::shared<int> labels() const {
+      af::shared<int> result(parent_.size(), af::init_functor_null<int>());
+      int num = 0;
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        std::size_t p = parent_[i];
+        DIALS_ASSERT(p <= i);
+        result[i] = (p == i) ? num++ : result[p];
+      }
+      return result;
+    }
+
+  private:
+    std::vector<std::size_t> parent_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_CONNECTED_COMPONENTS_UNION_FIND_H
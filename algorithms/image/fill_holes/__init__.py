@@ -2,4 +2,4 @@
 
 from dials_algorithms_image_fill_holes_ext import *  # noqa: F403; lgtm
 
-__all__ = ("diffusion_fill", "simple_fill")  # noqa: F405
+__all__ = ("SimpleFill", "diffusion_fill", "simple_fill")  # noqa: F405
@@ -17,6 +17,11 @@ namespace dials { namespace algorithms { namespace boost_python {
   using namespace boost::python;
 
   BOOST_PYTHON_MODULE(dials_algorithms_image_fill_holes_ext) {
+    class_<SimpleFill>("SimpleFill", no_init)
+      .def(init<const af::const_ref<bool, af::c_grid<2> > &>((arg("mask"))))
+      .def("mask", &SimpleFill::mask)
+      .def("__call__", &SimpleFill::fill, (arg("data")));
+
     def("simple_fill", &simple_fill, (arg("data"), arg("mask")));
 
     def(
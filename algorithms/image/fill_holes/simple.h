@@ -11,6 +11,7 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILL_HOLES_SIMPLE_H
 #define DIALS_ALGORITHMS_IMAGE_FILL_HOLES_SIMPLE_H
 
+#include <algorithm>
 #include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/image/filter/distance.h>
@@ -18,27 +19,118 @@
 
 namespace dials { namespace algorithms {
 
-  namespace detail {
+  /**
+   * A class to fill holes in images. Each masked pixel is set to the mean of
+   * its valid and already filled neighbours, in order of the manhattan
+   * distance to the nearest valid pixel and then in raster order.
+   *
+   * The pixels are put in order with a counting sort on the distance, and
+   * the order and the neighbours used for each pixel only depend on the
+   * mask, so they are computed once and can be used to fill many images
+   * with the same mask.
+   */
+  class SimpleFill {
+  public:
+    /**
+     * Compute the order in which to fill the pixels
+     * @param mask The mask array
+     */
+    SimpleFill(const af::const_ref<bool, af::c_grid<2> > &mask)
+        : mask_(mask.accessor()) {
+      std::copy(mask.begin(), mask.end(), mask_.begin());
+      std::size_t height = mask.accessor()[0];
+      std::size_t width = mask.accessor()[1];
+
+      // Compute the manhattan distance transform of the mask
+      af::versa<int, af::c_grid<2> > distance(mask.accessor());
+      manhattan_distance(mask, true, distance.ref());
+
+      // Sort the pixels to fill by distance, keeping them in raster order
+      // for each distance
+      int max_distance = 0;
+      for (std::size_t k = 0; k < distance.size(); ++k) {
+        DIALS_ASSERT(distance[k] >= 0);
+        max_distance = std::max(max_distance, distance[k]);
+      }
+      std::vector<std::size_t> start(max_distance + 2, 0);
+      for (std::size_t k = 0; k < distance.size(); ++k) {
+        if (distance[k] > 0) {
+          start[distance[k] + 1]++;
+        }
+      }
+      for (std::size_t d = 1; d < start.size(); ++d) {
+        start[d] += start[d - 1];
+      }
+      pixels_.resize(start.back());
+      for (std::size_t k = 0; k < distance.size(); ++k) {
+        if (distance[k] > 0) {
+          pixels_[start[distance[k]]++] = k;
+        }
+      }
+
+      // Find the neighbours used to fill each pixel
+      offsets_.reserve(pixels_.size() + 1);
+      offsets_.push_back(0);
+      for (std::size_t n = 0; n < pixels_.size(); ++n) {
+        std::size_t k = pixels_[n];
+        std::size_t j = k / width;
+        std::size_t i = k % width;
+        std::size_t num = 0;
+        if (j > 0 && distance[k - width] == 0) {
+          neighbours_.push_back(k - width);
+          num++;
+        }
+        if (i > 0 && distance[k - 1] == 0) {
+          neighbours_.push_back(k - 1);
+          num++;
+        }
+        if (j < height - 1 && distance[k + width] == 0) {
+          neighbours_.push_back(k + width);
+          num++;
+        }
+        if (i < width - 1 && distance[k + 1] == 0) {
+          neighbours_.push_back(k + 1);
+          num++;
+        }
+        DIALS_ASSERT(num > 0);
+        offsets_.push_back(neighbours_.size());
+        distance[k] = 0;
+      }
+    }
 
     /**
-     * Struct to provide a pixel node
+     * @returns The mask
      */
-    struct SimpleFillNode {
-      std::size_t j;
-      std::size_t i;
-      int d;
-      SimpleFillNode(std::size_t j_, std::size_t i_, int d_) : j(j_), i(i_), d(d_) {}
-    };
+    af::versa<bool, af::c_grid<2> > mask() const {
+      return mask_;
+    }
 
     /**
-     * Struct to provide pixel node comparison
+     * Fill the holes in an image
+     * @param data The data array
+     * @returns The filled image
      */
-    struct CompareSimpleFillNode {
-      bool operator()(const SimpleFillNode &a, const SimpleFillNode &b) const {
-        return a.d < b.d;
+    af::versa<double, af::c_grid<2> > fill(
+      const af::const_ref<double, af::c_grid<2> > &data) const {
+      DIALS_ASSERT(data.accessor().all_eq(mask_.accessor()));
+      af::versa<double, af::c_grid<2> > result(data.accessor());
+      std::copy(data.begin(), data.end(), result.begin());
+      for (std::size_t n = 0; n < pixels_.size(); ++n) {
+        double sum = 0.0;
+        for (std::size_t m = offsets_[n]; m < offsets_[n + 1]; ++m) {
+          sum += result[neighbours_[m]];
+        }
+        result[pixels_[n]] = sum / (double)(offsets_[n + 1] - offsets_[n]);
       }
-    };
-  }  // namespace detail
+      return result;
+    }
+
+  private:
+    af::versa<bool, af::c_grid<2> > mask_;
+    std::vector<std::size_t> pixels_;
+    std::vector<std::size_t> neighbours_;
+    std::vector<std::size_t> offsets_;
+  };
 
   /**
    * A simple function to fill holes in images
@@ -49,62 +141,8 @@ namespace dials { namespace algorithms {
   inline af::versa<double, af::c_grid<2> > simple_fill(
     const af::const_ref<double, af::c_grid<2> > &data,
     const af::const_ref<bool, af::c_grid<2> > &mask) {
-    // Check the input
     DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-
-    // Compute the manhattan distance transform of the mask
-    af::versa<int, af::c_grid<2> > distance(mask.accessor());
-    manhattan_distance(mask, true, distance.ref());
-
-    // Get a list of the pixels to fill
-    std::vector<detail::SimpleFillNode> pixels;
-    for (std::size_t j = 0; j < height; ++j) {
-      for (std::size_t i = 0; i < width; ++i) {
-        if (distance(j, i) > 0) {
-          pixels.push_back(detail::SimpleFillNode(j, i, distance(j, i)));
-        }
-      }
-    }
-
-    // Sort in order of distance
-    std::sort(pixels.begin(), pixels.end(), detail::CompareSimpleFillNode());
-
-    // Fill in pixels
-    af::versa<double, af::c_grid<2> > result(data.accessor());
-    std::copy(data.begin(), data.end(), result.begin());
-    for (std::size_t k = 0; k < pixels.size(); ++k) {
-      std::size_t j = pixels[k].j;
-      std::size_t i = pixels[k].i;
-      double sum = 0.0;
-      std::size_t num = 0;
-      if (j > 0 && distance(j - 1, i) == 0) {
-        sum += result(j - 1, i);
-        num += 1;
-      }
-      if (i > 0 && distance(j, i - 1) == 0) {
-        sum += result(j, i - 1);
-        num += 1;
-      }
-      if (j < height - 1 && distance(j + 1, i) == 0) {
-        sum += result(j + 1, i);
-        num += 1;
-      }
-      if (i < width - 1 && distance(j, i + 1) == 0) {
-        sum += result(j, i + 1);
-        num += 1;
-      }
-      DIALS_ASSERT(num > 0);
-      result(j, i) = sum / (double)num;
-      distance(j, i) = 0;
-    }
-
-    // Ensure every pixel has been used
-    DIALS_ASSERT(distance.all_eq(0));
-
-    // Return the filled pixels
-    return result;
+    return SimpleFill(mask).fill(data);
   }
 
   /**
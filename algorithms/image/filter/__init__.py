@@ -3,6 +3,8 @@
 from dials_algorithms_image_filter_ext import *  # noqa: F403; lgtm
 
 __all__ = (  # noqa: F405
+    "IndexOfDispersionFilter3DDouble",
+    "IndexOfDispersionFilter3DFloat",
     "IndexOfDispersionFilterDouble",
     "IndexOfDispersionFilterFloat",
     "IndexOfDispersionFilterMaskedDouble",
@@ -12,15 +14,23 @@
     "MeanAndVarianceFilterMaskedDouble",
     "MeanAndVarianceFilterMaskedFloat",
     "anisotropic_diffusion",
+    "anisotropic_diffusion_batch",
+    "bin_image",
+    "bin_mask",
     "chebyshev_distance",
     "convolve",
     "convolve_col",
+    "convolve_direct",
+    "convolve_fft",
     "convolve_row",
+    "euclidean_distance",
+    "euclidean_distance_sq",
     "index_of_dispersion_filter",
     "manhattan_distance",
     "mean_and_variance_filter",
     "mean_filter",
     "median_filter",
+    "median_filter_histogram",
     "summed_area",
     "summed_area_table",
 )
@@ -11,78 +11,258 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILTER_ANISOTROPIC_DIFFUSION_H
 #define DIALS_ALGORITHMS_IMAGE_FILTER_ANISOTROPIC_DIFFUSION_H
 
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
+  namespace detail {
+
+    /**
+     * Do the iterations of anisotropic filtering on an image. Each iteration
+     * reads one buffer and writes the next, so the buffers are swapped
+     * rather than allocated and the rows can be updated in bands in
+     * parallel. The rows either side of a band are only read, so no data
+     * needs to be exchanged between the bands other than waiting for all
+     * of them to finish an iteration.
+     */
+    class AnisotropicDiffusion {
+    public:
+      /**
+       * @param height The height of the image
+       * @param width The width of the image
+       * @param mask The mask (or NULL)
+       * @param kappa The diffusion parameter
+       * @param gamma The step for each iteration
+       */
+      AnisotropicDiffusion(std::size_t height,
+                           std::size_t width,
+                           const bool *mask,
+                           double kappa,
+                           double gamma)
+          : height_(height),
+            width_(width),
+            mask_(mask),
+            kappa_inv2_(1.0 / (kappa * kappa)),
+            gamma_(gamma) {}
+
+      /**
+       * Filter the image. The result is left in the first buffer.
+       * @param A The image
+       * @param B A buffer of the same size
+       * @param niter The number of iterations
+       * @param pool The thread pool (or NULL)
+       * @param num_bands The number of bands of rows
+       */
+      void filter(double *A,
+                  double *B,
+                  std::size_t niter,
+                  dials::util::ThreadPool *pool,
+                  std::size_t num_bands) const {
+        num_bands = std::max((std::size_t)1, std::min(num_bands, height_));
+        std::size_t band_size = (height_ + num_bands - 1) / num_bands;
+        double *src = A;
+        double *dst = B;
+        for (std::size_t iter = 0; iter < niter; ++iter) {
+          if (pool == NULL || num_bands == 1) {
+            rows(src, dst, 0, height_);
+          } else {
+            dials::util::ThreadPool::TaskGroup group(*pool);
+            for (std::size_t first = 0; first < height_; first += band_size) {
+              group.post(boost::bind(&AnisotropicDiffusion::rows,
+                                     this,
+                                     src,
+                                     dst,
+                                     first,
+                                     std::min(first + band_size, height_)));
+            }
+            group.wait();
+          }
+          std::swap(src, dst);
+        }
+        if (src != A) {
+          std::copy(src, src + height_ * width_, A);
+        }
+      }
+
+      /**
+       * Do one iteration for a band of rows
+       * @param src The image before the iteration
+       * @param dst The image after the iteration
+       * @param first The first row
+       * @param last One past the last row
+       */
+      void rows(const double *src,
+                double *dst,
+                std::size_t first,
+                std::size_t last) const {
+        for (std::size_t j = first; j < last; ++j) {
+          const double *AP = &src[j * width_];
+          double *out = &dst[j * width_];
+
+          // The pixels on the edges are not changed
+          if (j == 0 || j + 1 >= height_ || width_ < 3) {
+            std::copy(AP, AP + width_, out);
+            continue;
+          }
+          out[0] = AP[0];
+          out[width_ - 1] = AP[width_ - 1];
+          if (mask_ == NULL) {
+            update(AP - width_, AP, AP + width_, out);
+          } else {
+            update_masked(AP - width_,
+                          AP,
+                          AP + width_,
+                          &mask_[(j - 1) * width_],
+                          &mask_[j * width_],
+                          &mask_[(j + 1) * width_],
+                          out);
+          }
+        }
+      }
+
+    private:
+      /**
+       * The flux from the gradient between two pixels
+       */
+      double flux(double D) const {
+        return (1.0 / (1.0 + (D * D * kappa_inv2_))) * D;
+      }
+
+      void update(const double *AN,
+                  const double *AP,
+                  const double *AS,
+                  double *out) const {
+        for (std::size_t i = 1; i < width_ - 1; ++i) {
+          double DN = AP[i] - AN[i];
+          double DE = AP[i] - AP[i - 1];
+          double DS = AS[i] - AP[i];
+          double DW = AP[i + 1] - AP[i];
+          out[i] = AP[i] + gamma_ * (flux(DS) - flux(DN) + flux(DW) - flux(DE));
+        }
+      }
+
+      void update_masked(const double *AN,
+                         const double *AP,
+                         const double *AS,
+                         const bool *MN,
+                         const bool *MP,
+                         const bool *MS,
+                         double *out) const {
+        for (std::size_t i = 1; i < width_ - 1; ++i) {
+          double P = AP[i];
+          double DN = P - (MN[i] ? AN[i] : P);
+          double DE = P - (MP[i - 1] ? AP[i - 1] : P);
+          double DS = (MS[i] ? AS[i] : P) - P;
+          double DW = (MP[i + 1] ? AP[i + 1] : P) - P;
+          double delta = gamma_ * (flux(DS) - flux(DN) + flux(DW) - flux(DE));
+          out[i] = MP[i] ? P + delta : P;
+        }
+      }
+
+      std::size_t height_;
+      std::size_t width_;
+      const bool *mask_;
+      double kappa_inv2_;
+      double gamma_;
+    };
+
+    /**
+     * Filter a single image
+     */
+    inline af::versa<double, af::c_grid<2> > anisotropic_diffusion(
+      const af::const_ref<double, af::c_grid<2> > &data,
+      const bool *mask,
+      std::size_t niter,
+      double kappa,
+      double gamma,
+      std::size_t nthreads) {
+      // Check input
+      DIALS_ASSERT(niter > 0);
+      DIALS_ASSERT(kappa > 0);
+      DIALS_ASSERT(gamma > 0);
+      DIALS_ASSERT(nthreads > 0);
+
+      // Initialise the buffers
+      af::versa<double, af::c_grid<2> > A(data.accessor());
+      af::versa<double, af::c_grid<2> > B(data.accessor());
+      std::copy(data.begin(), data.end(), A.begin());
+
+      // Do the iterations
+      AnisotropicDiffusion diffusion(
+        data.accessor()[0], data.accessor()[1], mask, kappa, gamma);
+      if (nthreads == 1) {
+        diffusion.filter(A.begin(), B.begin(), niter, NULL, 1);
+      } else {
+        dials::util::ThreadPool pool(nthreads);
+        diffusion.filter(A.begin(), B.begin(), niter, &pool, nthreads);
+      }
+      return A;
+    }
+
+    /**
+     * Filter a stack of images
+     */
+    inline af::versa<double, af::c_grid<3> > anisotropic_diffusion(
+      const af::const_ref<double, af::c_grid<3> > &data,
+      const bool *mask,
+      std::size_t niter,
+      double kappa,
+      double gamma,
+      std::size_t nthreads) {
+      // Check input
+      DIALS_ASSERT(niter > 0);
+      DIALS_ASSERT(kappa > 0);
+      DIALS_ASSERT(gamma > 0);
+      DIALS_ASSERT(nthreads > 0);
+
+      // Initialise the buffers
+      std::size_t nframes = data.accessor()[0];
+      std::size_t height = data.accessor()[1];
+      std::size_t width = data.accessor()[2];
+      std::size_t size = height * width;
+      af::versa<double, af::c_grid<3> > A(data.accessor());
+      af::versa<double, af::c_grid<3> > B(data.accessor());
+      std::copy(data.begin(), data.end(), A.begin());
+
+      // Filter each image as a separate task
+      AnisotropicDiffusion diffusion(height, width, mask, kappa, gamma);
+      dials::util::ThreadPool pool(std::min(nthreads, std::max(nframes, (std::size_t)1)));
+      dials::util::ThreadPool::TaskGroup group(pool);
+      for (std::size_t k = 0; k < nframes; ++k) {
+        group.post(boost::bind(&AnisotropicDiffusion::filter,
+                               &diffusion,
+                               &A[k * size],
+                               &B[k * size],
+                               niter,
+                               (dials::util::ThreadPool *)NULL,
+                               1));
+      }
+      group.wait();
+      return A;
+    }
+
+  }  // namespace detail
+
   /**
    * Do anisotropic filtering on an image
    * @param data The image
    * @param niter The number of iterations
    * @param kappa The diffusion parameter, small values stop diffusion across edges
    * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads
    * @return The filtered image
    */
   inline af::versa<double, af::c_grid<2> > anisotropic_diffusion(
     const af::const_ref<double, af::c_grid<2> > &data,
     std::size_t niter,
     double kappa,
-    double gamma) {
-    // Check input
-    DIALS_ASSERT(niter > 0);
-    DIALS_ASSERT(kappa > 0);
-    DIALS_ASSERT(gamma > 0);
-
-    // Initialise stuff
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-    af::versa<double, af::c_grid<2> > AA(data.accessor());
-    af::versa<double, af::c_grid<2> > BB(data.accessor(), 0);
-    af::ref<double, af::c_grid<2> > A = AA.ref();
-    af::ref<double, af::c_grid<2> > B = BB.ref();
-    std::copy(data.begin(), data.end(), A.begin());
-
-    // Compute inv of kappa
-    double kappa_inv2 = 1.0 / (kappa * kappa);
-
-    // Iterate
-    for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 1; j < height - 1; ++j) {
-        for (std::size_t i = 1; i < width - 1; ++i) {
-          // Gradients
-          double DN = A(j, i) - A(j - 1, i);
-          double DE = A(j, i) - A(j, i - 1);
-          double DS = A(j + 1, i) - A(j, i);
-          double DW = A(j, i + 1) - A(j, i);
-
-          // Diffusion stuff
-          // double CN = std::exp(-(DN*DN*kappa_inv2));
-          // double CE = std::exp(-(DE*DE*kappa_inv2));
-          // double CS = std::exp(-(DS*DS*kappa_inv2));
-          // double CW = std::exp(-(DW*DW*kappa_inv2));
-          double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
-          double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
-          double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
-          double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
-
-          // Components
-          double N = CN * DN;
-          double E = CE * DE;
-          double S = CS * DS;
-          double W = CW * DW;
-
-          // Update image
-          B(j, i) = gamma * (S - N + W - E);
-        }
-      }
-      for (std::size_t i = 0; i < B.size(); ++i) {
-        A[i] += B[i];
-      }
-    }
-
-    // Return filtered image
-    return AA;
+    double gamma,
+    std::size_t nthreads = 1) {
+    return detail::anisotropic_diffusion(data, NULL, niter, kappa, gamma, nthreads);
   }
 
   /**
@@ -92,6 +272,7 @@ namespace dials { namespace algorithms {
    * @param niter The number of iterations
    * @param kappa The diffusion parameter, small values stop diffusion across edges
    * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads
    * @return The filtered image
    */
   inline af::versa<double, af::c_grid<2> > masked_anisotropic_diffusion(
@@ -99,72 +280,54 @@ namespace dials { namespace algorithms {
     const af::const_ref<bool, af::c_grid<2> > &mask,
     std::size_t niter,
     double kappa,
-    double gamma) {
-    // Check input
-    DIALS_ASSERT(niter > 0);
-    DIALS_ASSERT(kappa > 0);
-    DIALS_ASSERT(gamma > 0);
-
-    // Initialise stuff
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-    af::versa<double, af::c_grid<2> > AA(data.accessor());
-    af::versa<double, af::c_grid<2> > BB(data.accessor(), 0);
-    af::ref<double, af::c_grid<2> > A = AA.ref();
-    af::ref<double, af::c_grid<2> > B = BB.ref();
-    std::copy(data.begin(), data.end(), A.begin());
-
-    // Compute inv of kappa
-    double kappa_inv2 = 1.0 / (kappa * kappa);
-
-    // Iterate
-    for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 1; j < height - 1; ++j) {
-        for (std::size_t i = 1; i < width - 1; ++i) {
-          if (mask(j, i)) {
-            // Points
-            double AP = A(j, i);
-            double AN = mask(j - 1, i) ? A(j - 1, i) : AP;
-            double AS = mask(j + 1, i) ? A(j + 1, i) : AP;
-            double AE = mask(j, i - 1) ? A(j, i - 1) : AP;
-            double AW = mask(j, i + 1) ? A(j, i + 1) : AP;
-
-            // Gradients
-            double DN = AP - AN;
-            double DE = AP - AE;
-            double DS = AS - AP;
-            double DW = AW - AP;
-
-            // Diffusion stuff
-            // double CN = std::exp(-(DN*DN*kappa_inv2));
-            // double CE = std::exp(-(DE*DE*kappa_inv2));
-            // double CS = std::exp(-(DS*DS*kappa_inv2));
-            // double CW = std::exp(-(DW*DW*kappa_inv2));
-            double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
-            double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
-            double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
-            double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
-
-            // Components
-            double N = CN * DN;
-            double E = CE * DE;
-            double S = CS * DS;
-            double W = CW * DW;
-
-            // Update image
-            B(j, i) = gamma * (S - N + W - E);
-          } else {
-            B(j, i) = 0;
-          }
-        }
-      }
-      for (std::size_t i = 0; i < B.size(); ++i) {
-        A[i] += B[i];
-      }
-    }
+    double gamma,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+    return detail::anisotropic_diffusion(
+      data, mask.begin(), niter, kappa, gamma, nthreads);
+  }
+
+  /**
+   * Do anisotropic filtering on a stack of images. The images are filtered
+   * in parallel.
+   * @param data The images
+   * @param niter The number of iterations
+   * @param kappa The diffusion parameter, small values stop diffusion across edges
+   * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads
+   * @return The filtered images
+   */
+  inline af::versa<double, af::c_grid<3> > anisotropic_diffusion_batch(
+    const af::const_ref<double, af::c_grid<3> > &data,
+    std::size_t niter,
+    double kappa,
+    double gamma,
+    std::size_t nthreads = 1) {
+    return detail::anisotropic_diffusion(data, NULL, niter, kappa, gamma, nthreads);
+  }
 
-    // Return filtered image
-    return AA;
+  /**
+   * Do anisotropic filtering on a stack of images with the same mask. The
+   * images are filtered in parallel.
+   * @param data The images
+   * @param mask The mask
+   * @param niter The number of iterations
+   * @param kappa The diffusion parameter, small values stop diffusion across edges
+   * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads
+   * @return The filtered images
+   */
+  inline af::versa<double, af::c_grid<3> > masked_anisotropic_diffusion_batch(
+    const af::const_ref<double, af::c_grid<3> > &data,
+    const af::const_ref<bool, af::c_grid<2> > &mask,
+    std::size_t niter,
+    double kappa,
+    double gamma,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(mask.accessor()[0] == data.accessor()[1]);
+    DIALS_ASSERT(mask.accessor()[1] == data.accessor()[2]);
+    return detail::anisotropic_diffusion(
+      data, mask.begin(), niter, kappa, gamma, nthreads);
   }
 
 }}  // namespace dials::algorithms
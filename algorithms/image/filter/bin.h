@@ -0,0 +1,82 @@
+/*
+ * bin.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_FILTER_BIN_H
+#define DIALS_ALGORITHMS_IMAGE_FILTER_BIN_H
+
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * Sum the unmasked pixels of the image in square bins. Only complete bins
+   * are kept so the pixels past the last multiple of the binning at the right
+   * and bottom of the image are ignored.
+   * @param image The image array
+   * @param mask The mask array
+   * @param binning The number of pixels along each side of a bin
+   * @returns The binned image
+   */
+  template <typename T>
+  af::versa<double, af::c_grid<2> > bin_image(
+    const af::const_ref<T, af::c_grid<2> > &image,
+    const af::const_ref<bool, af::c_grid<2> > &mask,
+    std::size_t binning) {
+    DIALS_ASSERT(binning > 0);
+    DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+    std::size_t xsize = image.accessor()[1];
+    std::size_t ybins = image.accessor()[0] / binning;
+    std::size_t xbins = xsize / binning;
+    af::versa<double, af::c_grid<2> > result(af::c_grid<2>(ybins, xbins), 0);
+    for (std::size_t j = 0; j < ybins * binning; ++j) {
+      const T *src = &image[j * xsize];
+      const bool *msk = &mask[j * xsize];
+      double *dst = &result[(j / binning) * xbins];
+      for (std::size_t i = 0, k = 0; i < xbins; ++i) {
+        double sum = 0;
+        for (std::size_t n = 0; n < binning; ++n, ++k) {
+          sum += msk[k] ? (double)src[k] : 0.0;
+        }
+        dst[i] += sum;
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Bin the mask in the same way as bin_image. A bin is valid only if all
+   * of the pixels in it are valid.
+   * @param mask The mask array
+   * @param binning The number of pixels along each side of a bin
+   * @returns The binned mask
+   */
+  inline af::versa<int, af::c_grid<2> > bin_mask(
+    const af::const_ref<bool, af::c_grid<2> > &mask,
+    std::size_t binning) {
+    DIALS_ASSERT(binning > 0);
+    std::size_t xsize = mask.accessor()[1];
+    std::size_t ybins = mask.accessor()[0] / binning;
+    std::size_t xbins = xsize / binning;
+    af::versa<int, af::c_grid<2> > result(af::c_grid<2>(ybins, xbins), 1);
+    for (std::size_t j = 0; j < ybins * binning; ++j) {
+      const bool *msk = &mask[j * xsize];
+      int *dst = &result[(j / binning) * xbins];
+      for (std::size_t i = 0, k = 0; i < xbins; ++i) {
+        bool valid = true;
+        for (std::size_t n = 0; n < binning; ++n, ++k) {
+          valid &= msk[k];
+        }
+        dst[i] &= valid;
+      }
+    }
+    return result;
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_FILTER_BIN_H
@@ -19,7 +19,11 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_anisotropic_diffusion() {
     def("anisotropic_diffusion",
         &anisotropic_diffusion,
-        (arg("data"), arg("niter") = 1, arg("kappa") = 50, arg("gamma") = 0.1));
+        (arg("data"),
+         arg("niter") = 1,
+         arg("kappa") = 50,
+         arg("gamma") = 0.1,
+         arg("nthreads") = 1));
 
     def("anisotropic_diffusion",
         &masked_anisotropic_diffusion,
@@ -27,7 +31,25 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("mask"),
          arg("niter") = 1,
          arg("kappa") = 50,
-         arg("gamma") = 0.1));
+         arg("gamma") = 0.1,
+         arg("nthreads") = 1));
+
+    def("anisotropic_diffusion_batch",
+        &anisotropic_diffusion_batch,
+        (arg("data"),
+         arg("niter") = 1,
+         arg("kappa") = 50,
+         arg("gamma") = 0.1,
+         arg("nthreads") = 1));
+
+    def("anisotropic_diffusion_batch",
+        &masked_anisotropic_diffusion_batch,
+        (arg("data"),
+         arg("mask"),
+         arg("niter") = 1,
+         arg("kappa") = 50,
+         arg("gamma") = 0.1,
+         arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,28 @@
+/*
+ * bin.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/image/filter/bin.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  template <typename T>
+  void bin_image_suite() {
+    def("bin_image", &bin_image<T>, (arg("image"), arg("mask"), arg("binning")));
+  }
+
+  void export_bin() {
+    bin_image_suite<int>();
+    bin_image_suite<float>();
+    bin_image_suite<double>();
+
+    def("bin_mask", &bin_mask, (arg("mask"), arg("binning")));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -18,11 +18,25 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   template <typename FloatType>
   void convolve_suite() {
-    def("convolve", &convolve<FloatType>, (arg("image"), arg("kernel")));
+    def("convolve",
+        &convolve<FloatType>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
 
-    def("convolve_row", &convolve_row<FloatType>, (arg("image"), arg("kernel")));
+    def("convolve_direct",
+        &convolve_direct<FloatType>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
 
-    def("convolve_col", &convolve_col<FloatType>, (arg("image"), arg("kernel")));
+    def("convolve_fft",
+        &convolve_fft<FloatType>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
+
+    def("convolve_row",
+        &convolve_row<FloatType>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
+
+    def("convolve_col",
+        &convolve_col<FloatType>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
   }
 
   void export_convolve() {
@@ -10,6 +10,7 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -22,8 +23,10 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_median();
   void export_distance();
   void export_anisotropic_diffusion();
+  void export_bin();
 
   BOOST_PYTHON_MODULE(dials_algorithms_image_filter_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_summed_area();
     export_mean_and_variance();
     export_index_of_dispersion_filter();
@@ -31,6 +34,7 @@ namespace dials { namespace algorithms { namespace boost_python {
     export_median();
     export_distance();
     export_anisotropic_diffusion();
+    export_bin();
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/image/filter/index_of_dispersion_filter.h>
+#include <dials/util/boost_python/release_gil.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -44,6 +45,29 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("count", &IndexOfDispersionFilterType::count);
   }
 
+  template <typename FloatType>
+  void index_of_dispersion_filter_3d_wrapper(const char *name) {
+    typedef IndexOfDispersionFilter3D<FloatType> IndexOfDispersionFilterType;
+
+    class_<IndexOfDispersionFilterType, boost::noncopyable>(name, no_init)
+      .def(init<int2, int2, int, int, std::size_t>((arg("image_size"),
+                                                    arg("size"),
+                                                    arg("depth"),
+                                                    arg("min_count"),
+                                                    arg("nthreads") = 1)))
+      .def("push",
+           DIALS_RELEASE_GIL_TPL(&IndexOfDispersionFilterType::push),
+           (arg("image"), arg("mask")))
+      .def("flush", DIALS_RELEASE_GIL_TPL(&IndexOfDispersionFilterType::flush))
+      .def("num_frames", &IndexOfDispersionFilterType::num_frames)
+      .def("frame", &IndexOfDispersionFilterType::frame)
+      .def("index_of_dispersion", &IndexOfDispersionFilterType::index_of_dispersion)
+      .def("mean", &IndexOfDispersionFilterType::mean)
+      .def("sample_variance", &IndexOfDispersionFilterType::sample_variance)
+      .def("mask", &IndexOfDispersionFilterType::mask)
+      .def("count", &IndexOfDispersionFilterType::count);
+  }
+
   template <typename FloatType>
   IndexOfDispersionFilter<FloatType> make_index_of_dispersion_filter(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
@@ -78,6 +102,8 @@ namespace dials { namespace algorithms { namespace boost_python {
       "IndexOfDispersionFilterMaskedFloat");
     index_of_dispersion_filter_masked_wrapper<double>(
       "IndexOfDispersionFilterMaskedDouble");
+    index_of_dispersion_filter_3d_wrapper<float>("IndexOfDispersionFilter3DFloat");
+    index_of_dispersion_filter_3d_wrapper<double>("IndexOfDispersionFilter3DDouble");
 
     index_of_dispersion_filter_suite<float>();
     index_of_dispersion_filter_suite<double>();
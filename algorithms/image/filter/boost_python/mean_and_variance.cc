@@ -21,8 +21,9 @@ namespace dials { namespace algorithms { namespace boost_python {
     typedef MeanAndVarianceFilter<FloatType> MeanAndVarianceFilterType;
 
     class_<MeanAndVarianceFilterType>(name, no_init)
-      .def(init<const af::const_ref<FloatType, af::c_grid<2> > &, int2>(
-        (arg("image"), arg("size"))))
+      .def(init<const af::const_ref<FloatType, af::c_grid<2> > &,
+                int2,
+                std::size_t>((arg("image"), arg("size"), arg("nthreads") = 1)))
       .def("mean", &MeanAndVarianceFilterType::mean)
       .def("variance", &MeanAndVarianceFilterType::variance)
       .def("sample_variance", &MeanAndVarianceFilterType::sample_variance);
@@ -36,7 +37,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<const af::const_ref<FloatType, af::c_grid<2> > &,
                 const af::const_ref<int, af::c_grid<2> > &,
                 int2,
-                int>((arg("image"), arg("mask"), arg("size"), arg("min_size"))))
+                int,
+                std::size_t>((arg("image"),
+                              arg("mask"),
+                              arg("size"),
+                              arg("min_size"),
+                              arg("nthreads") = 1)))
       .def("mean", &MeanAndVarianceFilterType::mean)
       .def("variance", &MeanAndVarianceFilterType::variance)
       .def("sample_variance", &MeanAndVarianceFilterType::sample_variance)
@@ -47,8 +53,9 @@ namespace dials { namespace algorithms { namespace boost_python {
   template <typename FloatType>
   MeanAndVarianceFilter<FloatType> make_mean_and_variance_filter(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    int2 size) {
-    return MeanAndVarianceFilter<FloatType>(image, size);
+    int2 size,
+    std::size_t nthreads) {
+    return MeanAndVarianceFilter<FloatType>(image, size, nthreads);
   }
 
   template <typename FloatType>
@@ -56,8 +63,10 @@ namespace dials { namespace algorithms { namespace boost_python {
     const af::const_ref<FloatType, af::c_grid<2> > &image,
     const af::const_ref<int, af::c_grid<2> > &mask,
     int2 size,
-    int min_size) {
-    return MeanAndVarianceFilterMasked<FloatType>(image, mask, size, min_size);
+    int min_size,
+    std::size_t nthreads) {
+    return MeanAndVarianceFilterMasked<FloatType>(
+      image, mask, size, min_size, nthreads);
   }
 
   template <typename FloatType>
@@ -74,11 +83,15 @@ namespace dials { namespace algorithms { namespace boost_python {
 
     def("mean_and_variance_filter",
         &make_mean_and_variance_filter<FloatType>,
-        (arg("image"), arg("kernel")));
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
 
     def("mean_and_variance_filter",
         &make_mean_and_variance_filter_masked<FloatType>,
-        (arg("image"), arg("mask"), arg("kernel"), arg("min_count")));
+        (arg("image"),
+         arg("mask"),
+         arg("kernel"),
+         arg("min_count"),
+         arg("nthreads") = 1));
   }
 
   void export_mean_and_variance() {
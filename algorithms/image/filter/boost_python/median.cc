@@ -25,10 +25,26 @@ namespace dials { namespace algorithms { namespace boost_python {
         (arg("image"), arg("mask"), arg("kernel"), arg("periodic") = false));
   }
 
+  template <typename T>
+  void median_filter_histogram_suite() {
+    def("median_filter_histogram",
+        &median_filter_histogram<T>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
+
+    def("median_filter_histogram",
+        &median_filter_histogram_masked<T>,
+        (arg("image"),
+         arg("mask"),
+         arg("kernel"),
+         arg("periodic") = false,
+         arg("nthreads") = 1));
+  }
+
   void export_median() {
     median_filter_suite<int>();
     median_filter_suite<float>();
     median_filter_suite<double>();
+    median_filter_histogram_suite<int>();
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -18,9 +18,13 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   template <typename T>
   void summed_area_suite() {
-    def("summed_area_table", &summed_area_table<T>, (arg("image")));
+    def("summed_area_table",
+        &summed_area_table<T>,
+        (arg("image"), arg("nthreads") = 1));
 
-    def("summed_area", &summed_area<T>, (arg("image"), arg("size")));
+    def("summed_area",
+        &summed_area<T>,
+        (arg("image"), arg("size"), arg("nthreads") = 1));
   }
 
   void export_summed_area() {
@@ -15,146 +15,462 @@
 
 #include <algorithm>
 #include <cmath>
+#include <complex>
+#include <limits>
+#include <vector>
+#include <boost/bind.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <scitbx/fftpack/complex_to_complex.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  namespace detail {
+
+    /**
+     * Clamp an index to the image so the edge pixels are repeated
+     */
+    inline int clamp_index(int i, int n) {
+      return i < 0 ? 0 : (i >= n ? n - 1 : i);
+    }
+
+    /**
+     * Convolve bands of rows of an image with a 2D kernel directly.
+     */
+    template <typename FloatType>
+    class DirectConvolution {
+    public:
+      DirectConvolution(const af::const_ref<FloatType, af::c_grid<2> > &image,
+                        const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+                        af::ref<FloatType, af::c_grid<2> > result)
+          : image_(image), kernel_(kernel), result_(result) {}
+
+      void rows(std::size_t first, std::size_t last) const {
+        int2 isz = image_.accessor();
+        int2 ksz = kernel_.accessor();
+        int2 mid(ksz[0] / 2, ksz[1] / 2);
+        for (int j = first; j < (int)last; ++j) {
+          for (int i = 0; i < isz[1]; ++i) {
+            FloatType sum = 0.0;
+            for (int jj = 0; jj < ksz[0]; ++jj) {
+              int jjj = clamp_index(j + jj - mid[0], isz[0]);
+              for (int ii = 0; ii < ksz[1]; ++ii) {
+                int iii = clamp_index(i + ii - mid[1], isz[1]);
+                sum += image_(jjj, iii) * kernel_(jj, ii);
+              }
+            }
+            result_(j, i) = sum;
+          }
+        }
+      }
+
+    private:
+      af::const_ref<FloatType, af::c_grid<2> > image_;
+      af::const_ref<FloatType, af::c_grid<2> > kernel_;
+      af::ref<FloatType, af::c_grid<2> > result_;
+    };
+
+    /**
+     * Convolve bands of rows of an image with a 1D kernel along the rows or
+     * the columns.
+     */
+    template <typename FloatType>
+    class SeparableConvolution {
+    public:
+      SeparableConvolution(const af::const_ref<FloatType, af::c_grid<2> > &image,
+                           const af::const_ref<FloatType> &kernel,
+                           bool along_rows,
+                           af::ref<FloatType, af::c_grid<2> > result)
+          : image_(image), kernel_(kernel), along_rows_(along_rows), result_(result) {}
+
+      void rows(std::size_t first, std::size_t last) const {
+        int2 isz = image_.accessor();
+        int ksz = kernel_.size();
+        int mid = ksz / 2;
+        for (int j = first; j < (int)last; ++j) {
+          for (int i = 0; i < isz[1]; ++i) {
+            FloatType sum = 0.0;
+            if (along_rows_) {
+              for (int ii = 0; ii < ksz; ++ii) {
+                sum += image_(j, clamp_index(i + ii - mid, isz[1])) * kernel_[ii];
+              }
+            } else {
+              for (int jj = 0; jj < ksz; ++jj) {
+                sum += image_(clamp_index(j + jj - mid, isz[0]), i) * kernel_[jj];
+              }
+            }
+            result_(j, i) = sum;
+          }
+        }
+      }
+
+    private:
+      af::const_ref<FloatType, af::c_grid<2> > image_;
+      af::const_ref<FloatType> kernel_;
+      bool along_rows_;
+      af::ref<FloatType, af::c_grid<2> > result_;
+    };
+
+    /**
+     * Get the smallest FFT size >= n with no prime factors larger than 5
+     */
+    inline int fft_size(int n) {
+      DIALS_ASSERT(n > 0);
+      for (;; ++n) {
+        int m = n;
+        while (m % 2 == 0) m /= 2;
+        while (m % 3 == 0) m /= 3;
+        while (m % 5 == 0) m /= 5;
+        if (m == 1) {
+          return n;
+        }
+      }
+    }
+
+    /**
+     * Convolve an image with a 2D kernel using FFTs with the overlap-save
+     * method. The image is split into bands of rows; each band is extended
+     * by the rows and columns which the kernel needs, with the edge pixels
+     * repeated, and multiplied by the transform of the kernel. The part of
+     * the inverse transform which has not wrapped around is the result for
+     * the band. The transform of the kernel is computed once and shared by
+     * all the bands, which can be computed in parallel.
+     */
+    template <typename FloatType>
+    class FFTConvolution {
+    public:
+      typedef std::complex<double> complex_type;
+
+      FFTConvolution(const af::const_ref<FloatType, af::c_grid<2> > &image,
+                     const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+                     af::ref<FloatType, af::c_grid<2> > result)
+          : image_(image), ksz_(kernel.accessor()), result_(result) {
+        // Choose the size of the transforms. The bands are at least as high
+        // as the kernel so at least half of each transform is kept.
+        ny_ = fft_size(std::max(ksz_[0], 32) + ksz_[0] - 1);
+        nx_ = fft_size(image.accessor()[1] + ksz_[1] - 1);
+        band_ = ny_ - ksz_[0] + 1;
+
+        // Transform the kernel. The conjugate of the transform gives the
+        // correlation of the image and kernel, as in the direct convolution.
+        kernel_fft_.assign(ny_ * nx_, complex_type(0, 0));
+        for (int jj = 0; jj < ksz_[0]; ++jj) {
+          for (int ii = 0; ii < ksz_[1]; ++ii) {
+            kernel_fft_[jj * nx_ + ii] = kernel(jj, ii);
+          }
+        }
+        scitbx::fftpack::complex_to_complex<double> fft_x(nx_);
+        scitbx::fftpack::complex_to_complex<double> fft_y(ny_);
+        std::vector<complex_type> column(ny_);
+        transform(kernel_fft_, fft_x, fft_y, column, true);
+        for (std::size_t k = 0; k < kernel_fft_.size(); ++k) {
+          kernel_fft_[k] = std::conj(kernel_fft_[k]);
+        }
+      }
+
+      /**
+       * @returns The number of bands
+       */
+      std::size_t num_bands() const {
+        return (image_.accessor()[0] + band_ - 1) / band_;
+      }
+
+      /**
+       * Compute the result for a range of bands
+       * @param first The first band
+       * @param last One past the last band
+       */
+      void bands(std::size_t first, std::size_t last) const {
+        int2 isz = image_.accessor();
+        int2 mid(ksz_[0] / 2, ksz_[1] / 2);
+        double scale = 1.0 / ((double)nx_ * ny_);
+        scitbx::fftpack::complex_to_complex<double> fft_x(nx_);
+        scitbx::fftpack::complex_to_complex<double> fft_y(ny_);
+        std::vector<complex_type> buffer(ny_ * nx_);
+        std::vector<complex_type> column(ny_);
+        for (std::size_t b = first; b < last; ++b) {
+          int j0 = b * band_;
+
+          // Copy the band and the pixels around it which the kernel covers
+          for (int y = 0; y < ny_; ++y) {
+            int jjj = clamp_index(j0 + y - mid[0], isz[0]);
+            for (int x = 0; x < nx_; ++x) {
+              int iii = clamp_index(x - mid[1], isz[1]);
+              buffer[y * nx_ + x] = image_(jjj, iii);
+            }
+          }
+
+          // Multiply the transforms and transform back
+          transform(buffer, fft_x, fft_y, column, true);
+          for (std::size_t k = 0; k < buffer.size(); ++k) {
+            buffer[k] *= kernel_fft_[k];
+          }
+          transform(buffer, fft_x, fft_y, column, false);
+
+          // Copy the part of the result which has not wrapped around
+          int nrows = std::min(band_, isz[0] - j0);
+          for (int j = 0; j < nrows; ++j) {
+            for (int i = 0; i < isz[1]; ++i) {
+              result_(j0 + j, i) = buffer[j * nx_ + i].real() * scale;
+            }
+          }
+        }
+      }
+
+    private:
+      /**
+       * Compute the unnormalised 2D transform of the buffer in place
+       */
+      void transform(std::vector<complex_type> &buffer,
+                     scitbx::fftpack::complex_to_complex<double> &fft_x,
+                     scitbx::fftpack::complex_to_complex<double> &fft_y,
+                     std::vector<complex_type> &column,
+                     bool forward) const {
+        for (int y = 0; y < ny_; ++y) {
+          if (forward) {
+            fft_x.forward(&buffer[y * nx_]);
+          } else {
+            fft_x.backward(&buffer[y * nx_]);
+          }
+        }
+        for (int x = 0; x < nx_; ++x) {
+          for (int y = 0; y < ny_; ++y) {
+            column[y] = buffer[y * nx_ + x];
+          }
+          if (forward) {
+            fft_y.forward(&column[0]);
+          } else {
+            fft_y.backward(&column[0]);
+          }
+          for (int y = 0; y < ny_; ++y) {
+            buffer[y * nx_ + x] = column[y];
+          }
+        }
+      }
+
+      af::const_ref<FloatType, af::c_grid<2> > image_;
+      int2 ksz_;
+      af::ref<FloatType, af::c_grid<2> > result_;
+      int nx_;
+      int ny_;
+      int band_;
+      std::vector<complex_type> kernel_fft_;
+    };
+
+    /**
+     * Check if a kernel is the outer product of a column and a row kernel
+     * by factorising it about its largest element.
+     * @param kernel The kernel
+     * @param col The column kernel
+     * @param row The row kernel
+     * @returns True/False the kernel is separable
+     */
+    template <typename FloatType>
+    bool separate_kernel(const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+                         af::shared<FloatType> &col,
+                         af::shared<FloatType> &row) {
+      int2 ksz = kernel.accessor();
+      std::size_t pivot = 0;
+      for (std::size_t k = 1; k < kernel.size(); ++k) {
+        if (std::abs(kernel[k]) > std::abs(kernel[pivot])) {
+          pivot = k;
+        }
+      }
+      FloatType kmax = std::abs(kernel[pivot]);
+      if (kmax == 0) {
+        return false;
+      }
+      int r = pivot / ksz[1];
+      int c = pivot % ksz[1];
+      col = af::shared<FloatType>(ksz[0]);
+      row = af::shared<FloatType>(ksz[1]);
+      for (int jj = 0; jj < ksz[0]; ++jj) {
+        col[jj] = kernel(jj, c);
+      }
+      for (int ii = 0; ii < ksz[1]; ++ii) {
+        row[ii] = kernel(r, ii) / kernel(r, c);
+      }
+      FloatType tolerance = 16 * std::numeric_limits<FloatType>::epsilon() * kmax;
+      for (int jj = 0; jj < ksz[0]; ++jj) {
+        for (int ii = 0; ii < ksz[1]; ++ii) {
+          if (std::abs(kernel(jj, ii) - col[jj] * row[ii]) > tolerance) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    /**
+     * The smallest kernel area for which the FFT convolution is used
+     */
+    static const int min_fft_kernel_area = 15 * 15;
+
+  }  // namespace detail
+
   /**
-   * Perform a simple convolution between an image and kernel
+   * Perform a seperable row convolution between an image and kernel
    * @param image The image to filter
    * @param kernel The kernel to convolve with
+   * @param nthreads The number of threads
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve(
+  af::versa<FloatType, af::c_grid<2> > convolve_row(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    const af::const_ref<FloatType, af::c_grid<2> > &kernel) {
+    const af::const_ref<FloatType> &kernel,
+    std::size_t nthreads = 1) {
     // Only allow odd-sized kernel sizes
-    DIALS_ASSERT(kernel.accessor()[0] & 1);
-    DIALS_ASSERT(kernel.accessor()[1] & 1);
-
-    // The image sizes and mid-point
-    int2 isz = image.accessor();
-    int2 ksz = kernel.accessor();
-    int2 mid(ksz[0] / 2, ksz[1] / 2);
+    DIALS_ASSERT(kernel.size() & 1);
 
     // Create the output
     af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
                                                 af::init_functor_null<FloatType>());
 
     // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int jj = 0; jj < ksz[0]; ++jj) {
-          for (int ii = 0; ii < ksz[1]; ++ii) {
-            int jjj = j + jj - mid[0];
-            int iii = i + ii - mid[1];
-            if (jjj < 0)
-              jjj = 0;
-            else if (jjj >= isz[0])
-              jjj = isz[0] - 1;
-            if (iii < 0)
-              iii = 0;
-            else if (iii >= isz[1])
-              iii = isz[1] - 1;
-            result(j, i) += image(jjj, iii) * kernel(jj, ii);
-          }
-        }
-      }
-    }
+    typedef detail::SeparableConvolution<FloatType> convolution_type;
+    convolution_type convolution(image, kernel, true, result.ref());
+    detail::parallel_bands(boost::bind(&convolution_type::rows, &convolution, _1, _2),
+                           image.accessor()[0],
+                           nthreads);
 
     // Return the result
     return result;
   }
 
   /**
-   * Perform a seperable row convolution between an image and kernel
+   * Perform a seperable column convolution between an image and kernel
    * @param image The image to filter
    * @param kernel The kernel to convolve with
+   * @param nthreads The number of threads
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve_row(
+  af::versa<FloatType, af::c_grid<2> > convolve_col(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    const af::const_ref<FloatType> &kernel) {
+    const af::const_ref<FloatType> &kernel,
+    std::size_t nthreads = 1) {
     // Only allow odd-sized kernel sizes
     DIALS_ASSERT(kernel.size() & 1);
 
-    // The image sizes and mid-point
-    int2 isz = image.accessor();
-    std::size_t ksz = kernel.size();
-    std::size_t mid = ksz / 2;
-
     // Create the output
     af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
                                                 af::init_functor_null<FloatType>());
 
     // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int ii = 0; ii < ksz; ++ii) {
-          int iii = i + ii - mid;
-          if (iii < 0)
-            iii = 0;
-          else if (iii >= isz[1])
-            iii = isz[1] - 1;
-          result(j, i) += image(j, iii) * kernel[ii];
-        }
-      }
-    }
+    typedef detail::SeparableConvolution<FloatType> convolution_type;
+    convolution_type convolution(image, kernel, false, result.ref());
+    detail::parallel_bands(boost::bind(&convolution_type::rows, &convolution, _1, _2),
+                           image.accessor()[0],
+                           nthreads);
 
     // Return the result
     return result;
   }
 
   /**
-   * Perform a seperable column convolution between an image and kernel
+   * Convolve an image with a kernel by summing over the kernel at every
+   * pixel. The pixels at the edges of the image are repeated.
    * @param image The image to filter
    * @param kernel The kernel to convolve with
+   * @param nthreads The number of threads
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve_col(
+  af::versa<FloatType, af::c_grid<2> > convolve_direct(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    const af::const_ref<FloatType> &kernel) {
+    const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+    std::size_t nthreads = 1) {
     // Only allow odd-sized kernel sizes
-    DIALS_ASSERT(kernel.size() & 1);
+    DIALS_ASSERT(kernel.accessor()[0] & 1);
+    DIALS_ASSERT(kernel.accessor()[1] & 1);
 
-    // The image sizes and mid-point
-    int2 isz = image.accessor();
-    std::size_t ksz = kernel.size();
-    std::size_t mid = ksz / 2;
+    // Create the output
+    af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
+                                                af::init_functor_null<FloatType>());
+
+    // Convolve the image with the kernel
+    typedef detail::DirectConvolution<FloatType> convolution_type;
+    convolution_type convolution(image, kernel, result.ref());
+    detail::parallel_bands(boost::bind(&convolution_type::rows, &convolution, _1, _2),
+                           image.accessor()[0],
+                           nthreads);
+
+    // Return the result
+    return result;
+  }
+
+  /**
+   * Convolve an image with a kernel using FFTs. This gives the same result
+   * as convolve_direct up to rounding.
+   * @param image The image to filter
+   * @param kernel The kernel to convolve with
+   * @param nthreads The number of threads
+   * @returns The convolved image
+   */
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > convolve_fft(
+    const af::const_ref<FloatType, af::c_grid<2> > &image,
+    const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+    std::size_t nthreads = 1) {
+    // Only allow odd-sized kernel sizes
+    DIALS_ASSERT(kernel.accessor()[0] & 1);
+    DIALS_ASSERT(kernel.accessor()[1] & 1);
+    DIALS_ASSERT(image.accessor().all_gt(0));
 
     // Create the output
     af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
                                                 af::init_functor_null<FloatType>());
 
     // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int jj = 0; jj < ksz; ++jj) {
-          int jjj = j + jj - mid;
-          if (jjj < 0)
-            jjj = 0;
-          else if (jjj >= isz[0])
-            jjj = isz[0] - 1;
-          result(j, i) += image(jjj, i) * kernel[jj];
-        }
-      }
-    }
+    typedef detail::FFTConvolution<FloatType> convolution_type;
+    convolution_type convolution(image, kernel, result.ref());
+    detail::parallel_bands(boost::bind(&convolution_type::bands, &convolution, _1, _2),
+                           convolution.num_bands(),
+                           nthreads);
 
     // Return the result
     return result;
   }
 
+  /**
+   * Perform a convolution between an image and kernel. The pixels at the
+   * edges of the image are repeated. A kernel which is the outer product of
+   * a column and a row kernel is applied as a column and a row convolution,
+   * a large kernel is applied using FFTs and otherwise the convolution is
+   * computed directly.
+   * @param image The image to filter
+   * @param kernel The kernel to convolve with
+   * @param nthreads The number of threads
+   * @returns The convolved image
+   */
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > convolve(
+    const af::const_ref<FloatType, af::c_grid<2> > &image,
+    const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+    std::size_t nthreads = 1) {
+    // Only allow odd-sized kernel sizes
+    DIALS_ASSERT(kernel.accessor()[0] & 1);
+    DIALS_ASSERT(kernel.accessor()[1] & 1);
+
+    // Use the cheapest way of computing the convolution
+    int2 ksz = kernel.accessor();
+    af::shared<FloatType> col, row;
+    if (ksz[0] > 1 && ksz[1] > 1 && detail::separate_kernel(kernel, col, row)) {
+      af::versa<FloatType, af::c_grid<2> > temp =
+        convolve_row(image, row.const_ref(), nthreads);
+      return convolve_col(temp.const_ref(), col.const_ref(), nthreads);
+    } else if (ksz[0] * ksz[1] >= detail::min_fft_kernel_area) {
+      return convolve_fft(image, kernel, nthreads);
+    }
+    return convolve_direct(image, kernel, nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_IMAGE_FILTER_CONVOLVE_H */
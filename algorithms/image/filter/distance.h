@@ -11,7 +11,13 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
 #define DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/bind.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -33,7 +39,7 @@ namespace dials { namespace algorithms {
 
     // Go north and east
     for (std::size_t j = 0; j < height; ++j) {
-      for (std::size_t i = 1; i < width; ++i) {
+      for (std::size_t i = 0; i < width; ++i) {
         OutputType N = (j > 0) ? dst(j - 1, i) : max_distance;
         OutputType E = (i > 0) ? dst(j, i - 1) : max_distance;
         if (src(j, i) == value) {
@@ -102,6 +108,179 @@ namespace dials { namespace algorithms {
       }
     }
   }
+
+  namespace detail {
+
+    /**
+     * Compute the squared euclidean distance transform in two passes. The
+     * first computes the distance to the nearest pixel in the same column
+     * by sweeping down and up the rows, so the inner loops run along the
+     * rows and bands of columns can be computed in parallel. The second
+     * computes the lower envelope of the parabolas centred on the pixels of
+     * each row (Felzenszwalb and Huttenlocher), for bands of rows in
+     * parallel.
+     */
+    template <typename InputType, typename OutputType>
+    class EuclideanDistance {
+    public:
+      EuclideanDistance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                        InputType value,
+                        af::ref<OutputType, af::c_grid<2> > dst,
+                        bool squared)
+          : src_(src),
+            value_(value),
+            dst_(dst),
+            squared_(squared),
+            height_(src.accessor()[0]),
+            width_(src.accessor()[1]),
+            max_distance_(height_ + width_),
+            column_(height_ * width_) {}
+
+      /**
+       * Compute the distance to the nearest pixel in the column
+       * @param first The first column
+       * @param last One past the last column
+       */
+      void columns(std::size_t first, std::size_t last) {
+        for (std::size_t j = 0; j < height_; ++j) {
+          const InputType *src = &src_[j * width_];
+          int *g = &column_[j * width_];
+          const int *prev = j > 0 ? &column_[(j - 1) * width_] : NULL;
+          for (std::size_t i = first; i < last; ++i) {
+            if (src[i] == value_) {
+              g[i] = 0;
+            } else {
+              g[i] = prev == NULL ? max_distance_
+                                  : std::min(prev[i] + 1, max_distance_);
+            }
+          }
+        }
+        for (std::size_t j = height_ - 1; j > 0; --j) {
+          int *g = &column_[(j - 1) * width_];
+          const int *next = &column_[j * width_];
+          for (std::size_t i = first; i < last; ++i) {
+            g[i] = std::min(g[i], next[i] + 1);
+          }
+        }
+      }
+
+      /**
+       * Compute the distance to the nearest pixel in the image
+       * @param first The first row
+       * @param last One past the last row
+       */
+      void rows(std::size_t first, std::size_t last) const {
+        std::vector<double> f(width_);
+        std::vector<int> v(width_);
+        std::vector<double> z(width_ + 1);
+        for (std::size_t j = first; j < last; ++j) {
+          const int *g = &column_[j * width_];
+          for (std::size_t i = 0; i < width_; ++i) {
+            f[i] = (double)g[i] * g[i];
+          }
+
+          // Find the parabolas in the lower envelope and where they meet
+          int k = 0;
+          v[0] = 0;
+          z[0] = -std::numeric_limits<double>::infinity();
+          z[1] = std::numeric_limits<double>::infinity();
+          for (int q = 1; q < (int)width_; ++q) {
+            double s = intersection(f, v[k], q);
+            while (s <= z[k]) {
+              --k;
+              s = intersection(f, v[k], q);
+            }
+            ++k;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = std::numeric_limits<double>::infinity();
+          }
+
+          // Read the distance from the lower envelope
+          OutputType *dst = &dst_[j * width_];
+          k = 0;
+          for (int q = 0; q < (int)width_; ++q) {
+            while (z[k + 1] < q) {
+              ++k;
+            }
+            double d = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+            dst[q] = squared_ ? (OutputType)d : (OutputType)std::sqrt(d);
+          }
+        }
+      }
+
+    private:
+      /**
+       * The position where the parabolas centred on p and q meet
+       */
+      static double intersection(const std::vector<double> &f, int p, int q) {
+        return ((f[q] + (double)q * q) - (f[p] + (double)p * p)) / (2.0 * (q - p));
+      }
+
+      af::const_ref<InputType, af::c_grid<2> > src_;
+      InputType value_;
+      af::ref<OutputType, af::c_grid<2> > dst_;
+      bool squared_;
+      std::size_t height_;
+      std::size_t width_;
+      int max_distance_;
+      std::vector<int> column_;
+    };
+
+    template <typename InputType, typename OutputType>
+    void euclidean_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                            InputType value,
+                            af::ref<OutputType, af::c_grid<2> > dst,
+                            bool squared,
+                            std::size_t nthreads) {
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      if (src.size() == 0) {
+        return;
+      }
+      typedef EuclideanDistance<InputType, OutputType> transform_type;
+      transform_type transform(src, value, dst, squared);
+      parallel_bands(boost::bind(&transform_type::columns, &transform, _1, _2),
+                     src.accessor()[1],
+                     nthreads);
+      parallel_bands(boost::bind(&transform_type::rows, &transform, _1, _2),
+                     src.accessor()[0],
+                     nthreads);
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute the exact squared euclidean distance to the given value in linear
+   * time. If no pixels have the value, the distance is taken to be the height
+   * plus the width of the image.
+   * @param src: The src array
+   * @param value: The value to compute the distance to
+   * @param dst: The destination array
+   * @param nthreads: The number of threads
+   */
+  template <typename InputType, typename OutputType>
+  void euclidean_distance_sq(const af::const_ref<InputType, af::c_grid<2> > &src,
+                             InputType value,
+                             af::ref<OutputType, af::c_grid<2> > dst,
+                             std::size_t nthreads = 1) {
+    detail::euclidean_distance(src, value, dst, true, nthreads);
+  }
+
+  /**
+   * Compute the exact euclidean distance to the given value in linear time.
+   * @param src: The src array
+   * @param value: The value to compute the distance to
+   * @param dst: The destination array
+   * @param nthreads: The number of threads
+   */
+  template <typename InputType, typename OutputType>
+  void euclidean_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                          InputType value,
+                          af::ref<OutputType, af::c_grid<2> > dst,
+                          std::size_t nthreads = 1) {
+    detail::euclidean_distance(src, value, dst, false, nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
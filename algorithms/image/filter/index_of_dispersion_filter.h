@@ -13,8 +13,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 #include "mean_and_variance.h"
 
@@ -171,6 +176,297 @@ namespace dials { namespace algorithms {
     af::versa<FloatType, af::c_grid<2> > var_;
   };
 
+  /**
+   * Calculate the masked index of dispersion filtered images over a stack of
+   * images with a 3D (frame, y, x) kernel. The images are given one at a time
+   * and the filter keeps the per pixel sums of the image, the image**2 and
+   * the mask over a window of frames, adding each new frame and subtracting
+   * the one which leaves the window, so the cost per frame does not depend on
+   * the depth of the kernel. The 2D box sums of these are then taken from the
+   * summed area tables as for IndexOfDispersionFilterMasked.
+   *
+   * The filtered image for a frame is ready once the frames after it in the
+   * kernel have been added (or the stack is flushed). The kernel is clipped
+   * at the first and last frames of the stack. As for the 2D filter, pixels
+   * are only used if they are unmasked and the counts under the kernel are
+   * at least min_count. Calls on the same object are serialised.
+   */
+  template <typename FloatType = double>
+  class IndexOfDispersionFilter3D {
+  public:
+    typedef FloatType value_type;
+
+    /**
+     * Initialise the filter
+     * @param image_size The size of the images
+     * @param size Size of the filter kernel in y and x (2 * size + 1)
+     * @param depth Size of the filter kernel in frames (2 * depth + 1)
+     * @param min_count The minimum counts under the filter to include the pixel
+     * @param nthreads The number of threads
+     */
+    IndexOfDispersionFilter3D(int2 image_size,
+                              int2 size,
+                              int depth,
+                              int min_count,
+                              std::size_t nthreads = 1)
+        : accessor_(image_size[0], image_size[1]),
+          size_(size),
+          depth_(depth),
+          window_(2 * depth + 1),
+          min_count_(min_count),
+          nthreads_(nthreads),
+          num_frames_(0),
+          frame_(-1),
+          flushing_(false) {
+      DIALS_ASSERT(image_size.all_gt(0));
+      DIALS_ASSERT(size.all_gt(0));
+      DIALS_ASSERT(depth >= 0);
+      DIALS_ASSERT(nthreads > 0);
+      images_.resize(window_ * accessor_.size_1d(), 0);
+      masks_.resize(window_ * accessor_.size_1d(), 0);
+      sum_ = af::versa<double, af::c_grid<2> >(accessor_, 0);
+      sum_sq_ = af::versa<double, af::c_grid<2> >(accessor_, 0);
+      count_ = af::versa<int, af::c_grid<2> >(accessor_, 0);
+      int volume = (2 * size[0] + 1) * (2 * size[1] + 1) * window_;
+      if (min_count_ <= 0) {
+        min_count_ = volume;
+      } else {
+        DIALS_ASSERT(min_count_ <= volume && min_count_ > 1);
+      }
+    }
+
+    /**
+     * Add the next image of the stack
+     * @param image The image
+     * @param mask The mask (0 = off, 1 = on)
+     * @returns True/False a filtered image is ready
+     */
+    bool push(const af::const_ref<FloatType, af::c_grid<2> > &image,
+              const af::const_ref<int, af::c_grid<2> > &mask) {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      DIALS_ASSERT(!flushing_);
+      DIALS_ASSERT(image.accessor().all_eq(accessor_));
+      DIALS_ASSERT(mask.accessor().all_eq(accessor_));
+
+      // The new frame replaces the frame which leaves the window
+      bool evict = num_frames_ >= window_;
+      detail::parallel_bands(boost::bind(&IndexOfDispersionFilter3D::add_rows,
+                                         this,
+                                         image,
+                                         mask,
+                                         slot(num_frames_),
+                                         evict,
+                                         _1,
+                                         _2),
+                             accessor_[0],
+                             nthreads_);
+      num_frames_++;
+      if (num_frames_ > depth_) {
+        compute(num_frames_ - 1 - depth_);
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * Filter the next of the last frames of the stack once all images have
+     * been added. No more images can be added once the stack is flushed.
+     * @returns True/False a filtered image is ready
+     */
+    bool flush() {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      flushing_ = true;
+      int frame = frame_ + 1;
+      if (frame >= num_frames_) {
+        return false;
+      }
+      if (frame - depth_ - 1 >= 0) {
+        detail::parallel_bands(boost::bind(&IndexOfDispersionFilter3D::remove_rows,
+                                           this,
+                                           slot(frame - depth_ - 1),
+                                           _1,
+                                           _2),
+                               accessor_[0],
+                               nthreads_);
+      }
+      compute(frame);
+      return true;
+    }
+
+    /**
+     * @returns The number of images added
+     */
+    int num_frames() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return num_frames_;
+    }
+
+    /**
+     * @returns The frame of the filtered image (-1 if there is none)
+     */
+    int frame() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return frame_;
+    }
+
+    /**
+     * @returns The filter mask
+     */
+    af::versa<int, af::c_grid<2> > mask() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return mask_;
+    }
+
+    /**
+     * @returns The filter counts
+     */
+    af::versa<int, af::c_grid<2> > count() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return count_filtered_;
+    }
+
+    /**
+     * @returns The filtered image
+     */
+    af::versa<FloatType, af::c_grid<2> > index_of_dispersion() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return index_of_dispersion_;
+    }
+
+    /**
+     * @returns The mean filtered image
+     */
+    af::versa<FloatType, af::c_grid<2> > mean() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return mean_;
+    }
+
+    /**
+     * @returns The sample variance filtered image
+     */
+    af::versa<FloatType, af::c_grid<2> > sample_variance() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return var_;
+    }
+
+  private:
+    /**
+     * @returns The offset of the stored frame in the window buffers
+     */
+    std::size_t slot(int frame) const {
+      return (frame % window_) * accessor_.size_1d();
+    }
+
+    /**
+     * Add the rows of an image to the window sums, subtracting the frame
+     * stored in the same slot if it leaves the window
+     */
+    void add_rows(af::const_ref<FloatType, af::c_grid<2> > image,
+                  af::const_ref<int, af::c_grid<2> > mask,
+                  std::size_t offset,
+                  bool evict,
+                  std::size_t first,
+                  std::size_t last) {
+      const FloatType BIG = (1 << 24);  // About 1.6m counts
+      std::size_t xsize = accessor_[1];
+      for (std::size_t i = first * xsize; i < last * xsize; ++i) {
+        int m = mask[i] && image[i] < BIG;
+        FloatType v = m ? image[i] : 0;
+        if (evict) {
+          double old = images_[offset + i];
+          sum_[i] -= old;
+          sum_sq_[i] -= old * old;
+          count_[i] -= masks_[offset + i];
+        }
+        sum_[i] += v;
+        sum_sq_[i] += (double)v * v;
+        count_[i] += m;
+        images_[offset + i] = v;
+        masks_[offset + i] = m;
+      }
+    }
+
+    /**
+     * Subtract the rows of a frame which leaves the window from the sums
+     */
+    void remove_rows(std::size_t offset, std::size_t first, std::size_t last) {
+      std::size_t xsize = accessor_[1];
+      for (std::size_t i = first * xsize; i < last * xsize; ++i) {
+        double old = images_[offset + i];
+        sum_[i] -= old;
+        sum_sq_[i] -= old * old;
+        count_[i] -= masks_[offset + i];
+        images_[offset + i] = 0;
+        masks_[offset + i] = 0;
+      }
+    }
+
+    /**
+     * Compute the filtered image for a frame from the window sums. New arrays
+     * are allocated so those returned for earlier frames are not changed.
+     */
+    void compute(int frame) {
+      summed_image_ = summed_area<double>(sum_.const_ref(), size_, nthreads_);
+      summed_image_sq_ = summed_area<double>(sum_sq_.const_ref(), size_, nthreads_);
+      count_filtered_ = summed_area<int>(count_.const_ref(), size_, nthreads_);
+      mask_ = af::versa<int, af::c_grid<2> >(accessor_, 0);
+      mean_ = af::versa<FloatType, af::c_grid<2> >(accessor_, 0);
+      var_ = af::versa<FloatType, af::c_grid<2> >(accessor_, 0);
+      index_of_dispersion_ = af::versa<FloatType, af::c_grid<2> >(accessor_, 1);
+      detail::parallel_bands(boost::bind(&IndexOfDispersionFilter3D::compute_rows,
+                                         this,
+                                         slot(frame),
+                                         _1,
+                                         _2),
+                             accessor_[0],
+                             nthreads_);
+      frame_ = frame;
+    }
+
+    /**
+     * Compute the filtered image for the rows of a frame
+     */
+    void compute_rows(std::size_t offset, std::size_t first, std::size_t last) {
+      std::size_t xsize = accessor_[1];
+      for (std::size_t i = first * xsize; i < last * xsize; ++i) {
+        int c = count_filtered_[i];
+        if (masks_[offset + i] && c >= min_count_) {
+          double s = summed_image_[i];
+          double s2 = summed_image_sq_[i];
+          mean_[i] = s / c;
+          var_[i] = (s2 - (s * s / c)) / (c - 1);
+          if (mean_[i] > 0) {
+            index_of_dispersion_[i] = var_[i] / mean_[i];
+            mask_[i] = 1;
+          }
+        }
+      }
+    }
+
+    af::c_grid<2> accessor_;
+    int2 size_;
+    int depth_;
+    int window_;
+    int min_count_;
+    std::size_t nthreads_;
+    int num_frames_;
+    int frame_;
+    bool flushing_;
+    std::vector<FloatType> images_;
+    std::vector<int> masks_;
+    af::versa<double, af::c_grid<2> > sum_;
+    af::versa<double, af::c_grid<2> > sum_sq_;
+    af::versa<int, af::c_grid<2> > count_;
+    af::versa<double, af::c_grid<2> > summed_image_;
+    af::versa<double, af::c_grid<2> > summed_image_sq_;
+    af::versa<int, af::c_grid<2> > count_filtered_;
+    af::versa<int, af::c_grid<2> > mask_;
+    af::versa<FloatType, af::c_grid<2> > index_of_dispersion_;
+    af::versa<FloatType, af::c_grid<2> > mean_;
+    af::versa<FloatType, af::c_grid<2> > var_;
+    mutable boost::mutex mutex_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_IMAGE_FILTER_INDEX_OF_DISPERSION_FILTER_H */
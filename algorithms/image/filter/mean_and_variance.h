@@ -125,9 +125,11 @@ namespace dials { namespace algorithms {
      * Initialise the algorithm.
      * @params image The image to filter
      * @param size The size of the filter kernel (2 * size + 1)
+     * @param nthreads The number of threads
      */
     MeanAndVarianceFilter(const af::const_ref<FloatType, af::c_grid<2> > &image,
-                          int2 size) {
+                          int2 size,
+                          std::size_t nthreads = 1) {
       // Check the input is valid
       DIALS_ASSERT(size.all_gt(0));
       DIALS_ASSERT(image.accessor().all_gt(0));
@@ -145,8 +147,8 @@ namespace dials { namespace algorithms {
       inv_countm1_ = 1.0 / (count - 1);
 
       // Calculate the summed area under the image and image**2
-      sum_ = summed_area<FloatType>(image, size);
-      sq_sum_ = summed_area<FloatType>(image_sq.const_ref(), size);
+      sum_ = summed_area<FloatType>(image, size, nthreads);
+      sq_sum_ = summed_area<FloatType>(image_sq.const_ref(), size, nthreads);
     }
 
     /**
@@ -220,11 +222,13 @@ namespace dials { namespace algorithms {
      * @param mask The mask to use (0 = off, 1 == on)
      * @param size The size of the filter kernel (2 * size + 1)
      * @param min_count The minimum counts to use
+     * @param nthreads The number of threads
      */
     MeanAndVarianceFilterMasked(const af::const_ref<FloatType, af::c_grid<2> > &image,
                                 const af::const_ref<int, af::c_grid<2> > &mask,
                                 int2 size,
-                                int min_count)
+                                int min_count,
+                                std::size_t nthreads = 1)
         : min_count_(min_count), mask_(mask.accessor()) {
       const FloatType BIG = (1 << 24);  // About 1.6m counts
 
@@ -247,7 +251,7 @@ namespace dials { namespace algorithms {
       }
 
       // Calculate the summed area under the mask
-      summed_mask_ = summed_area<int>(mask, size);
+      summed_mask_ = summed_area<int>(mask, size, nthreads);
 
       // Ensure that all masked pixels are zero in the image and update the mask
       af::versa<FloatType, af::c_grid<2> > temp(image.accessor(),
@@ -261,8 +265,8 @@ namespace dials { namespace algorithms {
       }
 
       // Calculate the summed image and the summed image**2
-      summed_image_ = summed_area<FloatType>(temp.const_ref(), size);
-      summed_image_sq_ = summed_area<FloatType>(image_sq.const_ref(), size);
+      summed_image_ = summed_area<FloatType>(temp.const_ref(), size, nthreads);
+      summed_image_sq_ = summed_area<FloatType>(image_sq.const_ref(), size, nthreads);
     }
 
     /**
@@ -12,8 +12,13 @@
 #define DIALS_ALGORITHMS_IMAGE_FILTER_MEDIAN_H
 
 #include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_integral.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -99,8 +104,8 @@ namespace dials { namespace algorithms {
         for (int jj = j - size[0]; jj <= j + size[0]; ++jj) {
           for (int ii = i - size[1]; ii <= i + size[1]; ++ii) {
             if (periodic) {
-              std::size_t jjj = (jj % ysize + ysize) % ysize;
-              std::size_t iii = (ii % xsize + xsize) % xsize;
+              std::size_t jjj = (jj % (int)ysize + (int)ysize) % (int)ysize;
+              std::size_t iii = (ii % (int)xsize + (int)xsize) % (int)xsize;
               DIALS_ASSERT(jjj >= 0 && iii >= 0 && jjj < ysize && iii < xsize);
               if (mask(jjj, iii)) {
                 DIALS_ASSERT(npix < pixels.size());
@@ -128,6 +133,307 @@ namespace dials { namespace algorithms {
     return median;
   }
 
+  namespace detail {
+
+    /**
+     * The largest range of values to use a histogram for
+     */
+    static const std::size_t max_range = 1 << 24;
+
+    /**
+     * A histogram of the integer pixel values in a median filter kernel. The
+     * counts are kept for each value and for coarse bins of 16 values, and
+     * the coarse bin containing the last median is remembered along with the
+     * number of pixels below it, so the median is found by stepping from the
+     * last one rather than by searching the whole histogram.
+     */
+    class MedianHistogram {
+    public:
+      /**
+       * Create the histogram
+       * @param offset The smallest value
+       * @param range The number of values
+       */
+      MedianHistogram(int offset, std::size_t range)
+          : offset_(offset),
+            fine_(range, 0),
+            coarse_((range >> shift) + 1, 0),
+            count_(0),
+            bin_(0),
+            below_(0) {}
+
+      /**
+       * Add a value
+       */
+      void add(int value) {
+        update(value, 1);
+      }
+
+      /**
+       * Remove a value
+       */
+      void remove(int value) {
+        update(value, -1);
+      }
+
+      /**
+       * @returns The number of values
+       */
+      int count() const {
+        return count_;
+      }
+
+      /**
+       * @returns The element at count / 2 in the sorted values
+       */
+      int median() {
+        DIALS_ASSERT(count_ > 0);
+        int rank = count_ / 2;
+        while (below_ + coarse_[bin_] <= rank) {
+          below_ += coarse_[bin_++];
+        }
+        while (below_ > rank) {
+          below_ -= coarse_[--bin_];
+        }
+        int sum = below_;
+        for (std::size_t i = bin_ << shift;; ++i) {
+          sum += fine_[i];
+          if (sum > rank) {
+            return (int)i + offset_;
+          }
+        }
+      }
+
+    private:
+      static const std::size_t shift = 4;
+
+      void update(int value, int n) {
+        std::size_t i = value - offset_;
+        std::size_t b = i >> shift;
+        fine_[i] += n;
+        coarse_[b] += n;
+        count_ += n;
+        if (b < bin_) {
+          below_ += n;
+        }
+      }
+
+      int offset_;
+      std::vector<int> fine_;
+      std::vector<int> coarse_;
+      int count_;
+      std::size_t bin_;
+      int below_;
+    };
+
+    /**
+     * Apply a median filter to bands of rows of an integer image with a
+     * sliding histogram. Along each row the column of pixels entering the
+     * kernel is added to the histogram and the column leaving it removed.
+     */
+    template <typename T>
+    class HistogramMedianFilter {
+    public:
+      HistogramMedianFilter(const af::const_ref<T, af::c_grid<2> > &image,
+                            const bool *mask,
+                            int2 size,
+                            bool periodic,
+                            int offset,
+                            std::size_t range,
+                            af::ref<T, af::c_grid<2> > median)
+          : image_(image),
+            mask_(mask),
+            size_(size),
+            periodic_(periodic),
+            offset_(offset),
+            range_(range),
+            median_(median) {}
+
+      /**
+       * Filter the rows of a band
+       * @param first The first row
+       * @param last One past the last row
+       */
+      void band(int first, int last) const {
+        int ysize = image_.accessor()[0];
+        int xsize = image_.accessor()[1];
+        MedianHistogram hist(offset_, range_);
+        std::vector<int> rows;
+        for (int j = first; j < last; ++j) {
+          rows.clear();
+          for (int jj = j - size_[0]; jj <= j + size_[0]; ++jj) {
+            if (periodic_) {
+              rows.push_back((jj % ysize + ysize) % ysize);
+            } else if (jj >= 0 && jj < ysize) {
+              rows.push_back(jj);
+            }
+          }
+          for (int ii = -size_[1]; ii < size_[1]; ++ii) {
+            column(hist, rows, ii, true);
+          }
+          for (int i = 0; i < xsize; ++i) {
+            column(hist, rows, i + size_[1], true);
+            if (hist.count() > 0) {
+              median_(j, i) = (T)hist.median();
+            }
+            column(hist, rows, i - size_[1], false);
+          }
+          for (int ii = xsize - size_[1]; ii < xsize + size_[1]; ++ii) {
+            column(hist, rows, ii, false);
+          }
+          DIALS_ASSERT(hist.count() == 0);
+        }
+      }
+
+    private:
+      /**
+       * Add or remove the valid pixels of a column of the kernel
+       */
+      void column(MedianHistogram &hist,
+                  const std::vector<int> &rows,
+                  int i,
+                  bool add) const {
+        int xsize = image_.accessor()[1];
+        if (periodic_) {
+          i = (i % xsize + xsize) % xsize;
+        } else if (i < 0 || i >= xsize) {
+          return;
+        }
+        for (std::size_t k = 0; k < rows.size(); ++k) {
+          std::size_t index = rows[k] * xsize + i;
+          if (mask_ == NULL || mask_[index]) {
+            if (add) {
+              hist.add(image_[index]);
+            } else {
+              hist.remove(image_[index]);
+            }
+          }
+        }
+      }
+
+      af::const_ref<T, af::c_grid<2> > image_;
+      const bool *mask_;
+      int2 size_;
+      bool periodic_;
+      int offset_;
+      std::size_t range_;
+      af::ref<T, af::c_grid<2> > median_;
+    };
+
+    /**
+     * Apply the histogram median filter, falling back to sorting the pixels
+     * if the range of values is too large for the histogram.
+     */
+    template <typename T>
+    af::versa<T, af::c_grid<2> > histogram_median_filter(
+      const af::const_ref<T, af::c_grid<2> > &image,
+      const bool *mask,
+      int2 size,
+      bool periodic,
+      std::size_t nthreads) {
+      BOOST_STATIC_ASSERT(boost::is_integral<T>::value);
+      DIALS_ASSERT(size.all_ge(0));
+      DIALS_ASSERT(image.accessor().all_gt(0));
+      DIALS_ASSERT(nthreads > 0);
+
+      // The array for output
+      af::versa<T, af::c_grid<2> > median(image.accessor(), T(0));
+
+      // Get the range of values in the histogram
+      bool first = true;
+      long min_value = 0;
+      long max_value = 0;
+      for (std::size_t i = 0; i < image.size(); ++i) {
+        if (mask == NULL || mask[i]) {
+          long value = image[i];
+          if (first) {
+            min_value = max_value = value;
+            first = false;
+          } else {
+            min_value = std::min(min_value, value);
+            max_value = std::max(max_value, value);
+          }
+        }
+      }
+      if (first) {
+        return median;
+      }
+      std::size_t range = max_value - min_value + 1;
+      if (range > max_range) {
+        return mask == NULL
+                 ? median_filter(image, size)
+                 : median_filter_masked(
+                   image,
+                   af::const_ref<bool, af::c_grid<2> >(mask, image.accessor()),
+                   size,
+                   periodic);
+      }
+
+      // Filter bands of rows in parallel
+      HistogramMedianFilter<T> filter(
+        image, mask, size, periodic, min_value, range, median.ref());
+      int ysize = image.accessor()[0];
+      nthreads = std::min(nthreads, (std::size_t)ysize);
+      if (nthreads == 1) {
+        filter.band(0, ysize);
+      } else {
+        int band_size = (ysize + nthreads - 1) / nthreads;
+        dials::util::ThreadPool pool(nthreads);
+        dials::util::ThreadPool::TaskGroup group(pool);
+        for (int j = 0; j < ysize; j += band_size) {
+          group.post(boost::bind(&HistogramMedianFilter<T>::band,
+                                 &filter,
+                                 j,
+                                 std::min(j + band_size, ysize)));
+        }
+        group.wait();
+      }
+      return median;
+    }
+
+  }  // namespace detail
+
+  /**
+   * Apply a median filter to an integer image using a sliding histogram of
+   * the pixel values in the kernel. The cost per pixel grows with the height
+   * of the kernel rather than its area, so this is much faster than
+   * median_filter for large kernels and gives the same result.
+   * @param image The image to filter
+   * @param size The size of the filter kernel
+   * @param nthreads The number of threads
+   * @returns The filtered image
+   */
+  template <typename T>
+  af::versa<T, af::c_grid<2> > median_filter_histogram(
+    const af::const_ref<T, af::c_grid<2> > &image,
+    int2 size,
+    std::size_t nthreads) {
+    return detail::histogram_median_filter(image, NULL, size, false, nthreads);
+  }
+
+  /**
+   * Apply a median filter to an integer image with a mask using a sliding
+   * histogram of the pixel values in the kernel. This gives the same result
+   * as median_filter_masked.
+   * @param image The image to filter
+   * @param mask The image mask
+   * @param size The size of the filter kernel
+   * @param periodic Wrap the filter
+   * @param nthreads The number of threads
+   * @returns The filtered image
+   */
+  template <typename T>
+  af::versa<T, af::c_grid<2> > median_filter_histogram_masked(
+    const af::const_ref<T, af::c_grid<2> > &image,
+    const af::const_ref<bool, af::c_grid<2> > &mask,
+    int2 size,
+    bool periodic,
+    std::size_t nthreads) {
+    DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+    return detail::histogram_median_filter(
+      image, mask.begin(), size, periodic, nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_IMAGE_FILTER_MEDIAN_H
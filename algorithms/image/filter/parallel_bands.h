@@ -0,0 +1,60 @@
+/*
+ * parallel_bands.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_FILTER_PARALLEL_BANDS_H
+#define DIALS_ALGORITHMS_IMAGE_FILTER_PARALLEL_BANDS_H
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <dials/util/shared_executor.h>
+#include <dials/util/thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace detail {
+
+  /**
+   * Call a function for bands of the range [0, n) on a thread pool. If the
+   * module has a shared executor then the bands are run on its pool, with the
+   * number of threads limited by its budget, and calls made from one of its
+   * workers are run serially.
+   * @param function The function taking the first and last index
+   * @param n The size of the range
+   * @param nthreads The number of threads
+   */
+  template <typename Function>
+  void parallel_bands(Function function, std::size_t n, std::size_t nthreads) {
+    DIALS_ASSERT(nthreads > 0);
+    nthreads = std::min(nthreads, n);
+    dials::util::SharedExecutor *executor = dials::util::shared_executor();
+    if (executor != NULL) {
+      nthreads = executor->concurrency(nthreads);
+    }
+    if (nthreads <= 1) {
+      function(0, n);
+      return;
+    }
+    std::size_t band_size = (n + nthreads - 1) / nthreads;
+    if (executor != NULL) {
+      boost::shared_ptr<dials::util::ThreadPool> pool = executor->pool();
+      dials::util::ThreadPool::TaskGroup group(*pool);
+      for (std::size_t first = 0; first < n; first += band_size) {
+        executor->post(group,
+                       boost::bind(function, first, std::min(first + band_size, n)));
+      }
+      group.wait();
+      return;
+    }
+    dials::util::ThreadPool pool(nthreads);
+    dials::util::ThreadPool::TaskGroup group(pool);
+    for (std::size_t first = 0; first < n; first += band_size) {
+      group.post(boost::bind(function, first, std::min(first + band_size, n)));
+    }
+    group.wait();
+  }
+
+}}}  // namespace dials::algorithms::detail
+
+#endif  // DIALS_ALGORITHMS_IMAGE_FILTER_PARALLEL_BANDS_H
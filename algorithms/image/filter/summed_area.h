@@ -13,23 +13,172 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  namespace detail {
+
+    /**
+     * Compute the summed area table in two passes. The first pass computes
+     * the prefix sum along each row and the second adds each row of the table
+     * to the next. Both passes run along contiguous memory without branches,
+     * so they vectorise, and bands of rows or columns can be computed in
+     * parallel. The additions are made in the same order whether the table
+     * is computed in serial or in parallel, so the result does not depend on
+     * the number of threads.
+     */
+    template <typename T>
+    class SummedAreaTable {
+    public:
+      SummedAreaTable(const af::const_ref<T, af::c_grid<2> > &image,
+                      af::ref<T, af::c_grid<2> > table)
+          : image_(image), table_(table) {}
+
+      /**
+       * Compute the prefix sum along the rows of a band
+       * @param first The first row
+       * @param last One past the last row
+       */
+      void rows(std::size_t first, std::size_t last) const {
+        std::size_t xsize = image_.accessor()[1];
+        for (std::size_t j = first; j < last; ++j) {
+          const T *src = &image_[j * xsize];
+          T *dst = &table_[j * xsize];
+          T sum = 0;
+          for (std::size_t i = 0; i < xsize; ++i) {
+            sum += src[i];
+            dst[i] = sum;
+          }
+        }
+      }
+
+      /**
+       * Add each row to the next for a band of columns
+       * @param first The first column
+       * @param last One past the last column
+       */
+      void columns(std::size_t first, std::size_t last) const {
+        std::size_t ysize = image_.accessor()[0];
+        std::size_t xsize = image_.accessor()[1];
+        for (std::size_t j = 1; j < ysize; ++j) {
+          const T *prev = &table_[(j - 1) * xsize];
+          T *dst = &table_[j * xsize];
+          for (std::size_t i = first; i < last; ++i) {
+            dst[i] += prev[i];
+          }
+        }
+      }
+
+      /**
+       * Compute the prefix sum along a row and add the previous row
+       * @param j The row
+       */
+      void row_and_column(std::size_t j) const {
+        rows(j, j + 1);
+        if (j > 0) {
+          std::size_t xsize = image_.accessor()[1];
+          const T *prev = &table_[(j - 1) * xsize];
+          T *dst = &table_[j * xsize];
+          for (std::size_t i = 0; i < xsize; ++i) {
+            dst[i] += prev[i];
+          }
+        }
+      }
+
+    private:
+      af::const_ref<T, af::c_grid<2> > image_;
+      af::ref<T, af::c_grid<2> > table_;
+    };
+
+    /**
+     * Compute the summed area under each pixel from the summed area table.
+     * The pixels whose rectangle is clipped by the left or right edges are
+     * computed separately so the loop over the rest has no branches.
+     */
+    template <typename T>
+    class SummedAreaFromTable {
+    public:
+      SummedAreaFromTable(const af::const_ref<T, af::c_grid<2> > &table,
+                          int2 size,
+                          af::ref<T, af::c_grid<2> > sum)
+          : table_(table), size_(size), sum_(sum), zeros_(table.accessor()[1], T(0)) {}
+
+      /**
+       * Compute the summed area for a band of rows
+       * @param first The first row
+       * @param last One past the last row
+       */
+      void rows(std::size_t first, std::size_t last) const {
+        int ysize = table_.accessor()[0];
+        int xsize = table_.accessor()[1];
+        int ia = std::min(size_[1] + 1, xsize);
+        int ib = std::max(ia, xsize - size_[1]);
+        for (int j = first; j < (int)last; ++j) {
+          int j0 = j - size_[0] - 1;
+          int j1 = std::min(j + size_[0], ysize - 1);
+          const T *row0 = j0 >= 0 ? &table_[j0 * xsize] : &zeros_[0];
+          const T *row1 = &table_[j1 * xsize];
+          T *dst = &sum_[j * xsize];
+          for (int i = 0; i < ia; ++i) {
+            dst[i] = edge(row0, row1, i);
+          }
+          for (int i = ia; i < ib; ++i) {
+            int i0 = i - size_[1] - 1;
+            int i1 = i + size_[1];
+            double I00 = row0[i0];
+            double I10 = row1[i0];
+            double I01 = row0[i1];
+            double I11 = row1[i1];
+            dst[i] = (I11 + I00 - I01 - I10);
+          }
+          for (int i = ib; i < xsize; ++i) {
+            dst[i] = edge(row0, row1, i);
+          }
+        }
+      }
+
+    private:
+      T edge(const T *row0, const T *row1, int i) const {
+        int xsize = table_.accessor()[1];
+        int i0 = i - size_[1] - 1;
+        int i1 = std::min(i + size_[1], xsize - 1);
+        double I00 = 0, I10 = 0;
+        if (i0 >= 0) {
+          I00 = row0[i0];
+          I10 = row1[i0];
+        }
+        double I01 = row0[i1];
+        double I11 = row1[i1];
+        return (I11 + I00 - I01 - I10);
+      }
+
+      af::const_ref<T, af::c_grid<2> > table_;
+      int2 size_;
+      af::ref<T, af::c_grid<2> > sum_;
+      std::vector<T> zeros_;
+    };
+
+  }  // namespace detail
+
   /**
    * Calculate the summed area table from the image.
    * @param image The image array
+   * @param nthreads The number of threads
    * @returns The summed area table
    */
   template <typename T>
   af::versa<T, af::c_grid<2> > summed_area_table(
-    const af::const_ref<T, af::c_grid<2> > &image) {
+    const af::const_ref<T, af::c_grid<2> > &image,
+    std::size_t nthreads = 1) {
     // Allocate the table
     af::versa<T, af::c_grid<2> > table_arr(image.accessor(),
                                            af::init_functor_null<T>());
@@ -39,14 +188,19 @@ namespace dials { namespace algorithms {
     std::size_t ysize = image.accessor()[0];
     std::size_t xsize = image.accessor()[1];
 
-    // Create the summed area table
-    for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-      for (std::size_t i = 0; i < xsize; ++i, ++k) {
-        T I10 = j > 0 ? table[k - xsize] : 0;
-        T I01 = i > 0 ? table[k - 1] : 0;
-        T I11 = j > 0 && i > 0 ? table[k - xsize - 1] : 0;
-        table[k] = image[k] + I10 + I01 - I11;
+    // Create the summed area table. In serial each row is finished while it
+    // is still in the cache.
+    detail::SummedAreaTable<T> sat(image, table);
+    if (nthreads <= 1) {
+      for (std::size_t j = 0; j < ysize; ++j) {
+        sat.row_and_column(j);
       }
+    } else {
+      typedef detail::SummedAreaTable<T> table_type;
+      detail::parallel_bands(
+        boost::bind(&table_type::rows, &sat, _1, _2), ysize, nthreads);
+      detail::parallel_bands(
+        boost::bind(&table_type::columns, &sat, _1, _2), xsize, nthreads);
     }
 
     // Return the summed area table
@@ -57,50 +211,30 @@ namespace dials { namespace algorithms {
    * Calculate the summed area under each point of the image
    * @param image The image array
    * @param size The size of the rectangle (2 * size + 1)
+   * @param nthreads The number of threads
    * @returns The summed area
    */
   template <typename T>
   af::versa<T, af::c_grid<2> > summed_area(
     const af::const_ref<T, af::c_grid<2> > &image,
-    int2 size) {
+    int2 size,
+    std::size_t nthreads = 1) {
     // Check the sizes are valid
     DIALS_ASSERT(size.all_ge(0));
 
     // Calculate the summed area table
-    af::versa<T, af::c_grid<2> > I_arr = summed_area_table<T>(image);
+    af::versa<T, af::c_grid<2> > I_arr = summed_area_table<T>(image, nthreads);
     af::const_ref<T, af::c_grid<2> > I = I_arr.const_ref();
 
     // Allocate the filtered image
     af::versa<T, af::c_grid<2> > sum_arr(image.accessor(), af::init_functor_null<T>());
     af::ref<T, af::c_grid<2> > sum = sum_arr.ref();
 
-    // Get the size of the image
-    std::size_t ysize = image.accessor()[0];
-    std::size_t xsize = image.accessor()[1];
-
-    // Calculate the local mean at every point
-    for (std::size_t j = 0; j < ysize; ++j) {
-      for (std::size_t i = 0; i < xsize; ++i) {
-        int i0 = i - size[1] - 1, i1 = i + size[1];
-        int j0 = j - size[0] - 1, j1 = j + size[0];
-        i1 = i1 < xsize ? i1 : xsize - 1;
-        j1 = j1 < ysize ? j1 : ysize - 1;
-
-        double I00 = 0, I10 = 0, I01 = 0, I11 = 0;
-        if (i0 >= 0 && j0 >= 0) {
-          I00 = I(j0, i0);
-          I10 = I(j1, i0);
-          I01 = I(j0, i1);
-        } else if (i0 >= 0) {
-          I10 = I(j1, i0);
-        } else if (j0 >= 0) {
-          I01 = I(j0, i1);
-        }
-        I11 = I(j1, i1);
-
-        sum(j, i) = (I11 + I00 - I01 - I10);
-      }
-    }
+    // Calculate the local sum at every point
+    typedef detail::SummedAreaFromTable<T> sum_type;
+    sum_type filter(I, size, sum);
+    detail::parallel_bands(
+      boost::bind(&sum_type::rows, &filter, _1, _2), image.accessor()[0], nthreads);
 
     // Return the summed area image
     return sum_arr;
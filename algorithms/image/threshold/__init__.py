@@ -5,8 +5,11 @@
 __all__ = (  # noqa: F405
     "DispersionExtendedThreshold",
     "DispersionExtendedThresholdDebug",
+    "DispersionExtendedThresholdTiled",
     "DispersionThreshold",
     "DispersionThresholdDebug",
+    "DispersionThresholdPrepared",
+    "DispersionThresholdTiled",
     "dispersion",
     "dispersion_w_gain",
     "gain",
@@ -16,4 +19,5 @@
     "niblack",
     "probability_distribution",
     "sauvola",
+    "UnimodalHistogram",
 )
@@ -11,6 +11,8 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/image/threshold/tiled.h>
+#include <dials/util/boost_python/release_gil.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -18,21 +20,24 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   template <typename FloatType>
   void local_threshold_suite() {
-    def("niblack", &niblack<FloatType>, (arg("image"), arg("size"), arg("n_sigma")));
+    def("niblack",
+        DIALS_RELEASE_GIL_TPL(&niblack<FloatType>),
+        (arg("image"), arg("size"), arg("n_sigma")));
 
-    def(
-      "sauvola", &sauvola<FloatType>, (arg("image"), arg("size"), arg("k"), arg("r")));
+    def("sauvola",
+        DIALS_RELEASE_GIL_TPL(&sauvola<FloatType>),
+        (arg("image"), arg("size"), arg("k"), arg("r")));
 
     def("index_of_dispersion",
-        &index_of_dispersion<FloatType>,
+        DIALS_RELEASE_GIL_TPL(&index_of_dispersion<FloatType>),
         (arg("image"), arg("size"), arg("n_sigma")));
 
     def("index_of_dispersion_masked",
-        &index_of_dispersion_masked<FloatType>,
+        DIALS_RELEASE_GIL_TPL(&index_of_dispersion_masked<FloatType>),
         (arg("image"), arg("mask"), arg("size"), arg("min_count"), arg("n_sigma")));
 
     def("gain",
-        &gain<FloatType>,
+        DIALS_RELEASE_GIL_TPL(&gain<FloatType>),
         (arg("image"),
          arg("mask"),
          arg("gain"),
@@ -41,7 +46,7 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("n_sigma")));
 
     def("dispersion",
-        &dispersion<FloatType>,
+        DIALS_RELEASE_GIL_TPL(&dispersion<FloatType>),
         (arg("image"),
          arg("mask"),
          arg("size"),
@@ -50,7 +55,7 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("min_count")));
 
     def("dispersion_w_gain",
-        &dispersion_w_gain<FloatType>,
+        DIALS_RELEASE_GIL_TPL(&dispersion_w_gain<FloatType>),
         (arg("image"),
          arg("mask"),
          arg("gain"),
@@ -60,16 +65,79 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("min_count")));
   }
 
+  template <typename Algorithm>
+  void tiled_threshold_wrapper(const char *name) {
+    typedef TiledThreshold<Algorithm> threshold_type;
+
+    class_<threshold_type, boost::noncopyable>(name, no_init)
+      .def(init<int2, int2, double, double, double, int, std::size_t, std::size_t>(
+        (arg("image_size"),
+         arg("kernel_size"),
+         arg("n_sigma_b"),
+         arg("n_sigma_s"),
+         arg("threshold"),
+         arg("min_count"),
+         arg("nthreads"),
+         arg("num_bands") = 0)))
+      .def(init<int2,
+                int2,
+                double,
+                double,
+                double,
+                int,
+                boost::shared_ptr<ThreadPool>,
+                std::size_t>((arg("image_size"),
+                              arg("kernel_size"),
+                              arg("n_sigma_b"),
+                              arg("n_sigma_s"),
+                              arg("threshold"),
+                              arg("min_count"),
+                              arg("thread_pool"),
+                              arg("num_bands") = 0)))
+      .def("num_bands", &threshold_type::num_bands)
+      .def("__call__", DIALS_RELEASE_GIL_TPL(&threshold_type::template threshold<int>))
+      .def("__call__",
+           DIALS_RELEASE_GIL_TPL(&threshold_type::template threshold<double>))
+      .def("__call__",
+           DIALS_RELEASE_GIL_TPL(&threshold_type::template threshold_w_gain<int>))
+      .def("__call__",
+           DIALS_RELEASE_GIL_TPL(&threshold_type::template threshold_w_gain<double>));
+  }
+
   void export_local() {
     local_threshold_suite<float>();
     local_threshold_suite<double>();
 
-    class_<DispersionThreshold>("DispersionThreshold", no_init)
+    class_<DispersionThreshold, boost::noncopyable>("DispersionThreshold", no_init)
       .def(init<int2, int2, double, double, double, int>())
-      .def("__call__", &DispersionThreshold::threshold<int>)
-      .def("__call__", &DispersionThreshold::threshold<double>)
-      .def("__call__", &DispersionThreshold::threshold_w_gain<int>)
-      .def("__call__", &DispersionThreshold::threshold_w_gain<double>);
+      .def("__call__", DIALS_RELEASE_GIL(&DispersionThreshold::threshold<int>))
+      .def("__call__", DIALS_RELEASE_GIL(&DispersionThreshold::threshold<double>))
+      .def("__call__", DIALS_RELEASE_GIL(&DispersionThreshold::threshold_w_gain<int>))
+      .def("__call__",
+           DIALS_RELEASE_GIL(&DispersionThreshold::threshold_w_gain<double>));
+
+    class_<DispersionThresholdPrepared, boost::noncopyable>(
+      "DispersionThresholdPrepared", no_init)
+      .def(init<int2,
+                int2,
+                double,
+                double,
+                double,
+                int,
+                const af::const_ref<bool, af::c_grid<2> > &>())
+      .def(init<int2,
+                int2,
+                double,
+                double,
+                double,
+                int,
+                const af::const_ref<bool, af::c_grid<2> > &,
+                const af::const_ref<double, af::c_grid<2> > &>())
+      .def("mask", &DispersionThresholdPrepared::mask)
+      .def("has_gain", &DispersionThresholdPrepared::has_gain)
+      .def("__call__", DIALS_RELEASE_GIL(&DispersionThresholdPrepared::threshold<int>))
+      .def("__call__",
+           DIALS_RELEASE_GIL(&DispersionThresholdPrepared::threshold<double>));
 
     class_<DispersionThresholdDebug>("DispersionThresholdDebug", no_init)
       .def(init<const af::const_ref<double, af::c_grid<2> > &,
@@ -147,12 +215,20 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("value_mask", &DispersionExtendedThresholdDebug::value_mask)
       .def("final_mask", &DispersionExtendedThresholdDebug::final_mask);
 
-    class_<DispersionExtendedThreshold>("DispersionExtendedThreshold", no_init)
+    class_<DispersionExtendedThreshold, boost::noncopyable>(
+      "DispersionExtendedThreshold", no_init)
       .def(init<int2, int2, double, double, double, int>())
-      /* .def("__call__", &DispersionExtendedThreshold::threshold<int>) */
-      .def("__call__", &DispersionExtendedThreshold::threshold<double>)
-      /* .def("__call__", &DispersionExtendedThreshold::threshold_w_gain<int>) */
-      .def("__call__", &DispersionExtendedThreshold::threshold_w_gain<double>);
+      .def("__call__", DIALS_RELEASE_GIL(&DispersionExtendedThreshold::threshold<int>))
+      .def("__call__",
+           DIALS_RELEASE_GIL(&DispersionExtendedThreshold::threshold<double>))
+      .def("__call__",
+           DIALS_RELEASE_GIL(&DispersionExtendedThreshold::threshold_w_gain<int>))
+      .def("__call__",
+           DIALS_RELEASE_GIL(&DispersionExtendedThreshold::threshold_w_gain<double>));
+
+    tiled_threshold_wrapper<DispersionThreshold>("DispersionThresholdTiled");
+    tiled_threshold_wrapper<DispersionExtendedThreshold>(
+      "DispersionExtendedThresholdTiled");
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -10,6 +10,8 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/trace.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -19,6 +21,8 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_local();
 
   BOOST_PYTHON_MODULE(dials_algorithms_image_threshold_ext) {
+    dials::util::boost_python::import_trace_recorder();
+    dials::util::boost_python::import_shared_executor();
     export_unimodal();
     export_local();
   }
@@ -21,6 +21,19 @@ namespace dials { namespace algorithms { namespace boost_python {
     def("probability_distribution",
         &probability_distribution,
         (arg("image"), arg("range")));
+
+    class_<UnimodalHistogram>("UnimodalHistogram", no_init)
+      .def(init<int2>((arg("range"))))
+      .def("add", &UnimodalHistogram::add, (arg("image"), arg("nthreads") = 1))
+      .def("subtract",
+           &UnimodalHistogram::subtract,
+           (arg("image"), arg("nthreads") = 1))
+      .def("__iadd__", &UnimodalHistogram::operator+=)
+      .def("range", &UnimodalHistogram::range)
+      .def("counts", &UnimodalHistogram::counts)
+      .def("count", &UnimodalHistogram::count)
+      .def("probability_distribution",
+           &UnimodalHistogram::probability_distribution);
   }
 
 }}}  // namespace dials::algorithms::boost_python
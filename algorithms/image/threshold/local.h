@@ -11,12 +11,17 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 #define DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <iostream>
+#include <boost/cstdint.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/error.h>
+#include <dials/util/trace.h>
 #include <dials/algorithms/image/filter/mean_and_variance.h>
 #include <dials/algorithms/image/filter/index_of_dispersion_filter.h>
 #include <dials/algorithms/image/filter/distance.h>
@@ -345,21 +350,84 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * A class to compute the threshold using index of dispersion
+   * The types used for the summed area tables of an image. Floating point
+   * images are summed in their own type.
    */
-  class DispersionThreshold {
-  public:
+  template <typename T>
+  struct SummedAreaTableTraits {
+    typedef T value_type;
+
+    /** @returns The pixel value in the table type */
+    static value_type value(T v) {
+      return v;
+    }
+
     /**
-     * Enable more efficient memory usage by putting components required for the
-     * summed area table closer together in memory
+     * Get the sum over a kernel from the table values at its corners.
+     * @param a00 The value before the first row and column
+     * @param a10 The value at the last row before the first column
+     * @param a01 The value before the first row at the last column
+     * @param a11 The value at the last row and column
+     * @returns The sum
      */
-    template <typename T>
-    struct Data {
-      int m;
-      T x;
-      T y;
-    };
+    static double window(value_type a00,
+                         value_type a10,
+                         value_type a01,
+                         value_type a11) {
+      double result = 0;
+      result += a00 - (a10 + a01);
+      result += a11;
+      return result;
+    }
+  };
+
+  /**
+   * The types used for the summed area tables of integer images. These are
+   * summed exactly in unsigned 64 bit integers. The table values for a large
+   * image may wrap around but the sums over a kernel, which are differences of
+   * the table values, are still exact and are converted back to signed values,
+   * so negative pixel values are also handled.
+   */
+  template <typename T>
+  struct IntegerSummedAreaTableTraits {
+    typedef boost::uint64_t value_type;
+
+    static value_type value(T v) {
+      return static_cast<value_type>(static_cast<boost::int64_t>(v));
+    }
 
+    static double window(value_type a00,
+                         value_type a10,
+                         value_type a01,
+                         value_type a11) {
+      return static_cast<double>(static_cast<boost::int64_t>(a00 - (a10 + a01) + a11));
+    }
+  };
+
+  template <>
+  struct SummedAreaTableTraits<int> : IntegerSummedAreaTableTraits<int> {};
+
+  template <>
+  struct SummedAreaTableTraits<unsigned short>
+      : IntegerSummedAreaTableTraits<unsigned short> {};
+
+  /**
+   * A class to compute the threshold using index of dispersion
+   *
+   * The local sums are taken from a summed area table of the mask, src and
+   * src^2. Only the rows of the table which are covered by the kernel are
+   * needed to threshold a row of the image, so the table is kept as a rolling
+   * window of 2 * kernel_size + 2 rows which is filled in as the image is
+   * processed. The rows are stored as separate arrays for the count, sum and
+   * sum of squares so that the loop over the interior of each row, where the
+   * kernel does not need to be clipped, has no branches and can be vectorised
+   * by the compiler. The arithmetic is the same as for a full table so the
+   * result does not depend on how the table is stored. Integer images are
+   * summed exactly in 64 bit integers (see SummedAreaTableTraits). The table
+   * belongs to the object, so calls on the same object are serialised.
+   */
+  class DispersionThreshold {
+  public:
     DispersionThreshold(int2 image_size,
                         int2 kernel_size,
                         double nsig_b,
@@ -386,261 +454,848 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(min_count_ <= num_kernel && min_count_ > 1);
       }
 
-      // Allocate the buffer
-      std::size_t element_size = sizeof(Data<double>);
-      buffer_.resize(element_size * image_size[0] * image_size[1]);
+      // Allocate the rows of the table
+      num_rows_ = std::min(2 * kernel_size[0] + 2, image_size[0]);
+      std::size_t num_elements = num_rows_ * image_size[1];
+      table_m_.resize(num_elements);
+      table_x_.resize(sizeof(double) * num_elements);
+      table_y_.resize(sizeof(double) * num_elements);
     }
 
     /**
-     * Compute the summed area tables for the mask, src and src^2.
+     * Get the number of rows either side of a row of the image which are
+     * needed to threshold it.
+     * @param kernel_size The kernel size
+     * @returns The number of rows
+     */
+    static int halo(int2 kernel_size) {
+      return kernel_size[0];
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold(const af::const_ref<T, af::c_grid<2> > &src,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_TRACE_SCOPE("spot_finding", "dispersion_threshold");
+      // check the input
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+
+      // Compute the image threshold
+      compute(src, mask, Criterion<T>(*this, src, mask, dst));
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param gain - The gain array
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold_w_gain(const af::const_ref<T, af::c_grid<2> > &src,
+                          const af::const_ref<bool, af::c_grid<2> > &mask,
+                          const af::const_ref<double, af::c_grid<2> > &gain,
+                          af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_TRACE_SCOPE("spot_finding", "dispersion_threshold");
+      // check the input
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+
+      // Compute the image threshold
+      compute(src, mask, GainCriterion<T>(*this, src, mask, gain, dst));
+    }
+
+  private:
+    /**
+     * The threshold criterion for a pixel
+     */
+    template <typename T>
+    struct Criterion {
+      Criterion(const DispersionThreshold &parent,
+                const af::const_ref<T, af::c_grid<2> > &src_,
+                const af::const_ref<bool, af::c_grid<2> > &mask_,
+                af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_.begin()),
+            mask(mask_.begin()),
+            dst(dst_.begin()),
+            nsig_b(parent.nsig_b_),
+            nsig_s(parent.nsig_s_),
+            threshold(parent.threshold_),
+            min_count(parent.min_count_) {}
+
+      /**
+       * Threshold the pixel. The criteria are combined without branching. If
+       * any of the first checks fail the square roots may be NaN but then the
+       * pixel is background anyway.
+       * @param k The pixel index
+       * @param m The number of valid pixels in the kernel
+       * @param x The sum of the pixels in the kernel
+       * @param y The sum of the squared pixels in the kernel
+       */
+      void operator()(std::size_t k, double m, double x, double y) const {
+        double a = m * y - x * x - x * (m - 1);
+        double b = m * src[k] - x;
+        double c = x * nsig_b * std::sqrt(2 * (m - 1));
+        double d = nsig_s * std::sqrt(x * m);
+        dst[k] = mask[k] & (m >= min_count) & (x >= 0) & (src[k] > threshold)
+                 & (a > c) & (b > d);
+      }
+
+      const T *src;
+      const bool *mask;
+      bool *dst;
+      double nsig_b;
+      double nsig_s;
+      double threshold;
+      int min_count;
+    };
+
+    /**
+     * The threshold criterion for a pixel with a gain map
+     */
+    template <typename T>
+    struct GainCriterion {
+      GainCriterion(const DispersionThreshold &parent,
+                    const af::const_ref<T, af::c_grid<2> > &src_,
+                    const af::const_ref<bool, af::c_grid<2> > &mask_,
+                    const af::const_ref<double, af::c_grid<2> > &gain_,
+                    af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_.begin()),
+            mask(mask_.begin()),
+            gain(gain_.begin()),
+            dst(dst_.begin()),
+            nsig_b(parent.nsig_b_),
+            nsig_s(parent.nsig_s_),
+            threshold(parent.threshold_),
+            min_count(parent.min_count_) {}
+
+      /**
+       * Threshold the pixel
+       * @param k The pixel index
+       * @param m The number of valid pixels in the kernel
+       * @param x The sum of the pixels in the kernel
+       * @param y The sum of the squared pixels in the kernel
+       */
+      void operator()(std::size_t k, double m, double x, double y) const {
+        double a = m * y - x * x;
+        double b = m * src[k] - x;
+        double c = gain[k] * x * (m - 1 + nsig_b * std::sqrt(2 * (m - 1)));
+        double d = nsig_s * std::sqrt(gain[k] * x * m);
+        dst[k] = mask[k] & (m >= min_count) & (x >= 0) & (src[k] > threshold)
+                 & (a > c) & (b > d);
+      }
+
+      const T *src;
+      const bool *mask;
+      const double *gain;
+      bool *dst;
+      double nsig_b;
+      double nsig_s;
+      double threshold;
+      int min_count;
+    };
+
+    /**
+     * A row of the summed area table
+     */
+    template <typename A>
+    struct Row {
+      int *m;
+      A *x;
+      A *y;
+    };
+
+    /**
+     * Get the storage for a row of the summed area table
+     * @param j The row index in the image
+     * @returns The row of the table
+     */
+    template <typename A>
+    Row<A> row(int j) {
+      DIALS_ASSERT(sizeof(A) <= sizeof(double));
+      std::size_t offset = (j % num_rows_) * image_size_[1];
+      Row<A> result;
+      result.m = &table_m_[offset];
+      result.x = reinterpret_cast<A *>(&table_x_[0]) + offset;
+      result.y = reinterpret_cast<A *>(&table_y_[0]) + offset;
+      return result;
+    }
+
+    /**
+     * Compute a row of the summed area tables for the mask, src and src^2.
+     * @param j The row index
      * @param src The input array
      * @param mask The mask array
      */
     template <typename T>
-    void compute_sat(af::ref<Data<T> > table,
-                     const af::const_ref<T, af::c_grid<2> > &src,
-                     const af::const_ref<bool, af::c_grid<2> > &mask) {
-      // Largest value to consider
-      const T BIG = (1 << 24);  // About 16m counts
-
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
+    void compute_sat_row(int j,
+                         const af::const_ref<T, af::c_grid<2> > &src,
+                         const af::const_ref<bool, af::c_grid<2> > &mask) {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
 
-      // Create the summed area table
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        int m = 0;
-        T x = 0;
-        T y = 0;
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
+      // Largest value to consider
+      const double BIG = (1 << 24);  // About 16m counts
+
+      // Get the row of the image
+      int xsize = image_size_[1];
+      const T *src_row = &src[j * xsize];
+      const bool *mask_row = &mask[j * xsize];
+
+      // Add the row sums to the previous row of the table
+      Row<A> curr = row<A>(j);
+      int m = 0;
+      A x = 0;
+      A y = 0;
+      if (j == 0) {
+        for (int i = 0; i < xsize; ++i) {
+          int mm = (mask_row[i] && src_row[i] < BIG) ? 1 : 0;
+          A v = traits::value(src_row[i]);
           m += mm;
-          x += mm * src[k];
-          y += mm * src[k] * src[k];
-          if (j == 0) {
-            table[k].m = m;
-            table[k].x = x;
-            table[k].y = y;
-          } else {
-            table[k].m = table[k - xsize].m + m;
-            table[k].x = table[k - xsize].x + x;
-            table[k].y = table[k - xsize].y + y;
-          }
+          x += mm * v;
+          y += mm * v * v;
+          curr.m[i] = m;
+          curr.x[i] = x;
+          curr.y[i] = y;
+        }
+      } else {
+        Row<A> prev = row<A>(j - 1);
+        for (int i = 0; i < xsize; ++i) {
+          int mm = (mask_row[i] && src_row[i] < BIG) ? 1 : 0;
+          A v = traits::value(src_row[i]);
+          m += mm;
+          x += mm * v;
+          y += mm * v * v;
+          curr.m[i] = prev.m[i] + m;
+          curr.x[i] = prev.x[i] + x;
+          curr.y[i] = prev.y[i] + y;
         }
       }
     }
 
     /**
-     * Compute the threshold
-     * @param src - The input array
-     * @param mask - The mask array
-     * @param dst The output array
+     * Threshold a pixel where the kernel may be clipped by the image edge.
+     * @param k The index of the start of the image row
+     * @param i The x index of the pixel
+     * @param r0 The table row before the kernel or NULL if off the image
+     * @param r1 The last table row in the kernel
+     * @param criterion The threshold criterion
      */
-    template <typename T>
-    void compute_threshold(af::ref<Data<T> > table,
-                           const af::const_ref<T, af::c_grid<2> > &src,
-                           const af::const_ref<bool, af::c_grid<2> > &mask,
-                           af::ref<bool, af::c_grid<2> > dst) {
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
+    template <typename T, typename Function>
+    void compute_border_pixel(
+      std::size_t k,
+      int i,
+      const Row<typename SummedAreaTableTraits<T>::value_type> *r0,
+      const Row<typename SummedAreaTableTraits<T>::value_type> &r1,
+      const Function &criterion) const {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+      int xsize = image_size_[1];
+      int i0 = i - kernel_size_[1] - 1;
+      int i1 = std::min(i + kernel_size_[1], xsize - 1);
+
+      // Get the table values at the corners of the kernel, using zero for
+      // the corners which are off the image
+      int m00 = 0, m10 = 0, m01 = 0;
+      A x00 = 0, x10 = 0, x01 = 0;
+      A y00 = 0, y10 = 0, y01 = 0;
+      if (i0 >= 0 && r0 != NULL) {
+        m00 = r0->m[i0];
+        x00 = r0->x[i0];
+        y00 = r0->y[i0];
+      }
+      if (i0 >= 0) {
+        m10 = r1.m[i0];
+        x10 = r1.x[i0];
+        y10 = r1.y[i0];
+      }
+      if (r0 != NULL) {
+        m01 = r0->m[i1];
+        x01 = r0->x[i1];
+        y01 = r0->y[i1];
+      }
+
+      // Compute the number of points valid in the local area,
+      // the sum of the pixel values and the sum of the squared pixel
+      // values.
+      double m = m00 - (m10 + m01) + r1.m[i1];
+      double x = traits::window(x00, x10, x01, r1.x[i1]);
+      double y = traits::window(y00, y10, y01, r1.y[i1]);
+      criterion(k + i, m, x, y);
+    }
 
-      // The kernel size
+    /**
+     * Threshold a row of the image
+     * @param j The row index
+     * @param criterion The threshold criterion
+     */
+    template <typename T, typename Function>
+    void compute_threshold_row(int j, const Function &criterion) {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+      int xsize = image_size_[1];
+      int ysize = image_size_[0];
       int kxsize = kernel_size_[1];
       int kysize = kernel_size_[0];
-
-      // Calculate the local mean at every point
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int i0 = i - kxsize - 1, i1 = i + kxsize;
-          int j0 = j - kysize - 1, j1 = j + kysize;
-          i1 = i1 < xsize ? i1 : xsize - 1;
-          j1 = j1 < ysize ? j1 : ysize - 1;
-          int k0 = j0 * xsize;
-          int k1 = j1 * xsize;
-
-          // Compute the number of points valid in the local area,
-          // the sum of the pixel values and the sum of the squared pixel
-          // values.
-          double m = 0;
-          double x = 0;
-          double y = 0;
-          if (i0 >= 0 && j0 >= 0) {
-            const Data<T> &d00 = table[k0 + i0];
-            const Data<T> &d10 = table[k1 + i0];
-            const Data<T> &d01 = table[k0 + i1];
-            m += d00.m - (d10.m + d01.m);
-            x += d00.x - (d10.x + d01.x);
-            y += d00.y - (d10.y + d01.y);
-          } else if (i0 >= 0) {
-            const Data<T> &d10 = table[k1 + i0];
-            m -= d10.m;
-            x -= d10.x;
-            y -= d10.y;
-          } else if (j0 >= 0) {
-            const Data<T> &d01 = table[k0 + i1];
-            m -= d01.m;
-            x -= d01.x;
-            y -= d01.y;
-          }
-          const Data<T> &d11 = table[k1 + i1];
-          m += d11.m;
-          x += d11.x;
-          y += d11.y;
-
-          // Compute the thresholds
-          dst[k] = false;
-          if (mask[k] && m >= min_count_ && x >= 0 && src[k] > threshold_) {
-            double a = m * y - x * x - x * (m - 1);
-            double b = m * src[k] - x;
-            double c = x * nsig_b_ * std::sqrt(2 * (m - 1));
-            double d = nsig_s_ * std::sqrt(x * m);
-            dst[k] = a > c && b > d;
-          }
+      std::size_t k = (std::size_t)j * xsize;
+
+      // Get the table rows at the top and bottom of the kernel
+      int j0 = j - kysize - 1;
+      int j1 = std::min(j + kysize, ysize - 1);
+      Row<A> r1 = row<A>(j1);
+      if (j0 < 0) {
+        for (int i = 0; i < xsize; ++i) {
+          compute_border_pixel<T>(k, i, (const Row<A> *)NULL, r1, criterion);
         }
+        return;
+      }
+      Row<A> r0 = row<A>(j0);
+
+      // The pixels where the kernel is not clipped in x
+      int ib = std::min(kxsize + 1, xsize);
+      int ie = std::max(xsize - kxsize, ib);
+
+      // The left and right edges
+      for (int i = 0; i < ib; ++i) {
+        compute_border_pixel<T>(k, i, &r0, r1, criterion);
+      }
+      for (int i = ie; i < xsize; ++i) {
+        compute_border_pixel<T>(k, i, &r0, r1, criterion);
+      }
+
+      // The interior of the row. The pointers are offset to the first and
+      // last columns of the kernel of the first interior pixel.
+      int i0 = ib - kxsize - 1;
+      int i1 = ib + kxsize;
+      const int *m00 = r0.m + i0;
+      const int *m01 = r0.m + i1;
+      const int *m10 = r1.m + i0;
+      const int *m11 = r1.m + i1;
+      const A *x00 = r0.x + i0;
+      const A *x01 = r0.x + i1;
+      const A *x10 = r1.x + i0;
+      const A *x11 = r1.x + i1;
+      const A *y00 = r0.y + i0;
+      const A *y01 = r0.y + i1;
+      const A *y10 = r1.y + i0;
+      const A *y11 = r1.y + i1;
+      for (int n = 0; n < ie - ib; ++n) {
+        double m = m00[n] - (m10[n] + m01[n]) + m11[n];
+        double x = traits::window(x00[n], x10[n], x01[n], x11[n]);
+        double y = traits::window(y00[n], y10[n], y01[n], y11[n]);
+        criterion(k + ib + n, m, x, y);
       }
     }
 
     /**
-     * Compute the threshold
-     * @param src - The input array
-     * @param mask - The mask array
-     * @param gain - The gain array
-     * @param dst The output array
+     * Compute the threshold, filling in the rows of the summed area table as
+     * they are first needed.
+     * @param src The input array
+     * @param mask The mask array
+     * @param criterion The threshold criterion
      */
-    template <typename T>
-    void compute_threshold(af::ref<Data<T> > table,
-                           const af::const_ref<T, af::c_grid<2> > &src,
-                           const af::const_ref<bool, af::c_grid<2> > &mask,
-                           const af::const_ref<double, af::c_grid<2> > &gain,
-                           af::ref<bool, af::c_grid<2> > dst) {
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
-
-      // The kernel size
-      int kxsize = kernel_size_[1];
+    template <typename T, typename Function>
+    void compute(const af::const_ref<T, af::c_grid<2> > &src,
+                 const af::const_ref<bool, af::c_grid<2> > &mask,
+                 const Function &criterion) {
+      int ysize = image_size_[0];
       int kysize = kernel_size_[0];
-
-      // Calculate the local mean at every point
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int i0 = i - kxsize - 1, i1 = i + kxsize;
-          int j0 = j - kysize - 1, j1 = j + kysize;
-          i1 = i1 < xsize ? i1 : xsize - 1;
-          j1 = j1 < ysize ? j1 : ysize - 1;
-          int k0 = j0 * xsize;
-          int k1 = j1 * xsize;
-
-          // Compute the number of points valid in the local area,
-          // the sum of the pixel values and the num of the squared pixel
-          // values.
-          double m = 0;
-          double x = 0;
-          double y = 0;
-          if (i0 >= 0 && j0 >= 0) {
-            const Data<T> &d00 = table[k0 + i0];
-            const Data<T> &d10 = table[k1 + i0];
-            const Data<T> &d01 = table[k0 + i1];
-            m += d00.m - (d10.m + d01.m);
-            x += d00.x - (d10.x + d01.x);
-            y += d00.y - (d10.y + d01.y);
-          } else if (i0 >= 0) {
-            const Data<T> &d10 = table[k1 + i0];
-            m -= d10.m;
-            x -= d10.x;
-            y -= d10.y;
-          } else if (j0 >= 0) {
-            const Data<T> &d01 = table[k0 + i1];
-            m -= d01.m;
-            x -= d01.x;
-            y -= d01.y;
-          }
-          const Data<T> &d11 = table[k1 + i1];
-          m += d11.m;
-          x += d11.x;
-          y += d11.y;
-
-          // Compute the thresholds
-          dst[k] = false;
-          if (mask[k] && m >= min_count_ && x >= 0 && src[k] > threshold_) {
-            double a = m * y - x * x;
-            double b = m * src[k] - x;
-            double c = gain[k] * x * (m - 1 + nsig_b_ * std::sqrt(2 * (m - 1)));
-            double d = nsig_s_ * std::sqrt(gain[k] * x * m);
-            dst[k] = a > c && b > d;
-          }
+      for (int j = 0, jn = 0; j < ysize; ++j) {
+        int j1 = std::min(j + kysize, ysize - 1);
+        for (; jn <= j1; ++jn) {
+          compute_sat_row(jn, src, mask);
         }
+        compute_threshold_row<T>(j, criterion);
       }
     }
 
+    int2 image_size_;
+    int2 kernel_size_;
+    double nsig_b_;
+    double nsig_s_;
+    double threshold_;
+    int min_count_;
+    int num_rows_;
+    std::vector<int> table_m_;
+    std::vector<char> table_x_;
+    std::vector<char> table_y_;
+    boost::mutex mutex_;
+  };
+
+  /**
+   * A class to compute the dispersion threshold for a sequence of images with
+   * the same mask and gain map.
+   *
+   * The number of valid pixels in the kernel around each pixel only depends
+   * on the mask, so it is computed once along with the terms of the criteria
+   * which depend on it and the gain. Only the summed area tables of the pixel
+   * values and their squares are then computed for each image. Pixels with
+   * values too large for the tables (see DispersionThreshold) are excluded
+   * from the local sums and change the counts, so an image with any valid
+   * pixels that large is thresholded with DispersionThreshold instead. The
+   * result is the same as DispersionThreshold with the same mask and gain.
+   * The tables belong to the object, so calls on the same object are
+   * serialised.
+   */
+  class DispersionThresholdPrepared {
+  public:
     /**
-     * Compute the threshold for the given image and mask.
+     * Prepare the threshold for images with the given mask
+     * @param image_size The size of the image
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param mask The mask array
+     */
+    DispersionThresholdPrepared(int2 image_size,
+                                int2 kernel_size,
+                                double nsig_b,
+                                double nsig_s,
+                                double threshold,
+                                int min_count,
+                                const af::const_ref<bool, af::c_grid<2> > &mask)
+        : image_size_(image_size),
+          kernel_size_(kernel_size),
+          nsig_b_(nsig_b),
+          nsig_s_(nsig_s),
+          threshold_(threshold),
+          min_count_(min_count),
+          fallback_(image_size, kernel_size, nsig_b, nsig_s, threshold, min_count) {
+      init(mask, NULL);
+    }
+
+    /**
+     * Prepare the threshold for images with the given mask and gain map
+     * @param image_size The size of the image
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param mask The mask array
+     * @param gain The gain array
+     */
+    DispersionThresholdPrepared(int2 image_size,
+                                int2 kernel_size,
+                                double nsig_b,
+                                double nsig_s,
+                                double threshold,
+                                int min_count,
+                                const af::const_ref<bool, af::c_grid<2> > &mask,
+                                const af::const_ref<double, af::c_grid<2> > &gain)
+        : image_size_(image_size),
+          kernel_size_(kernel_size),
+          nsig_b_(nsig_b),
+          nsig_s_(nsig_s),
+          threshold_(threshold),
+          min_count_(min_count),
+          fallback_(image_size, kernel_size, nsig_b, nsig_s, threshold, min_count) {
+      DIALS_ASSERT(gain.accessor().all_eq(image_size));
+      init(mask, &gain);
+    }
+
+    /**
+     * @returns The mask
+     */
+    af::versa<bool, af::c_grid<2> > mask() const {
+      return mask_;
+    }
+
+    /**
+     * @returns True/False the threshold uses a gain map
+     */
+    bool has_gain() const {
+      return has_gain_;
+    }
+
+    /**
+     * Compute the threshold for the given image.
      * @param src - The input image array.
-     * @param mask - The mask array.
      * @param dst - The destination array.
      */
     template <typename T>
     void threshold(const af::const_ref<T, af::c_grid<2> > &src,
-                   const af::const_ref<bool, af::c_grid<2> > &mask,
                    af::ref<bool, af::c_grid<2> > dst) {
-      // check the input
+      DIALS_TRACE_SCOPE("spot_finding", "dispersion_threshold");
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
-      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (has_gain_) {
+        if (!compute(src, GainCriterion<T>(*this, src, dst))) {
+          fallback_.threshold_w_gain(src, mask_.const_ref(), gain_.const_ref(), dst);
+        }
+      } else {
+        if (!compute(src, Criterion<T>(*this, src, dst))) {
+          fallback_.threshold(src, mask_.const_ref(), dst);
+        }
+      }
+    }
 
-      // Get the table
-      DIALS_ASSERT(sizeof(T) <= sizeof(double));
+  private:
+    /**
+     * A row of the summed area table
+     */
+    template <typename A>
+    struct Row {
+      A *x;
+      A *y;
+    };
 
-      // Cast the buffer to the table type
-      af::ref<Data<T> > table(reinterpret_cast<Data<T> *>(&buffer_[0]), buffer_.size());
+    /**
+     * Compute the number of valid pixels in the kernel around each pixel and
+     * the terms of the criteria which depend on it
+     */
+    void init(const af::const_ref<bool, af::c_grid<2> > &mask,
+              const af::const_ref<double, af::c_grid<2> > *gain) {
+      DIALS_ASSERT(mask.accessor().all_eq(image_size_));
+      int ysize = image_size_[0];
+      int xsize = image_size_[1];
+      int kysize = kernel_size_[0];
+      int kxsize = kernel_size_[1];
+      std::size_t num_kernel = (2 * kysize + 1) * (2 * kxsize + 1);
+      if (min_count_ <= 0) {
+        min_count_ = num_kernel;
+      }
 
-      // compute the summed area table
-      compute_sat(table, src, mask);
+      // Copy the mask and gain
+      mask_ = af::versa<bool, af::c_grid<2> >(mask.accessor());
+      std::copy(mask.begin(), mask.end(), mask_.begin());
+      has_gain_ = gain != NULL;
+      if (has_gain_) {
+        gain_ = af::versa<double, af::c_grid<2> >(gain->accessor());
+        std::copy(gain->begin(), gain->end(), gain_.begin());
+      }
 
-      // Compute the image threshold
-      compute_threshold(table, src, mask, dst);
+      // The summed area table of the mask
+      std::vector<int> table(mask.size());
+      for (int j = 0, k = 0; j < ysize; ++j) {
+        int m = 0;
+        for (int i = 0; i < xsize; ++i, ++k) {
+          m += mask[k] ? 1 : 0;
+          table[k] = (j > 0 ? table[k - xsize] : 0) + m;
+        }
+      }
+
+      // The count and the terms of the criteria for each pixel
+      count_.resize(mask.size());
+      bound_.resize(mask.size());
+      valid_.resize(mask.size());
+      for (int j = 0, k = 0; j < ysize; ++j) {
+        int j0 = j - kysize - 1;
+        int j1 = std::min(j + kysize, ysize - 1);
+        for (int i = 0; i < xsize; ++i, ++k) {
+          int i0 = i - kxsize - 1;
+          int i1 = std::min(i + kxsize, xsize - 1);
+          int m00 = (j0 >= 0 && i0 >= 0) ? table[j0 * xsize + i0] : 0;
+          int m10 = (i0 >= 0) ? table[j1 * xsize + i0] : 0;
+          int m01 = (j0 >= 0) ? table[j0 * xsize + i1] : 0;
+          int m = m00 - (m10 + m01) + table[j1 * xsize + i1];
+          count_[k] = m;
+          valid_[k] = mask[k] && m >= min_count_;
+          if (valid_[k]) {
+            double md = m;
+            double root = std::sqrt(2 * (md - 1));
+            bound_[k] = has_gain_ ? md - 1 + nsig_b_ * root : root;
+          } else {
+            bound_[k] = 0;
+          }
+        }
+      }
+
+      // Allocate the rows of the table
+      num_rows_ = std::min(2 * kysize + 2, ysize);
+      std::size_t num_elements = num_rows_ * xsize;
+      table_x_.resize(sizeof(double) * num_elements);
+      table_y_.resize(sizeof(double) * num_elements);
     }
 
     /**
-     * Compute the threshold for the given image and mask.
-     * @param src - The input image array.
-     * @param mask - The mask array.
-     * @param gain - The gain array
-     * @param dst - The destination array.
+     * Get the storage for a row of the summed area table
+     * @param j The row index in the image
+     * @returns The row of the table
+     */
+    template <typename A>
+    Row<A> row(int j) {
+      DIALS_ASSERT(sizeof(A) <= sizeof(double));
+      std::size_t offset = (j % num_rows_) * image_size_[1];
+      Row<A> result;
+      result.x = reinterpret_cast<A *>(&table_x_[0]) + offset;
+      result.y = reinterpret_cast<A *>(&table_y_[0]) + offset;
+      return result;
+    }
+
+    /**
+     * Compute a row of the summed area tables for src and src^2
+     * @param j The row index
+     * @param src The input array
+     * @returns False if there are valid pixels too large for the table
      */
     template <typename T>
-    void threshold_w_gain(const af::const_ref<T, af::c_grid<2> > &src,
-                          const af::const_ref<bool, af::c_grid<2> > &mask,
-                          const af::const_ref<double, af::c_grid<2> > &gain,
-                          af::ref<bool, af::c_grid<2> > dst) {
-      // check the input
-      DIALS_ASSERT(src.accessor().all_eq(image_size_));
-      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
-      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+    bool compute_sat_row(int j, const af::const_ref<T, af::c_grid<2> > &src) {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
 
-      // Get the table
-      DIALS_ASSERT(sizeof(T) <= sizeof(double));
+      // Largest value to consider
+      const double BIG = (1 << 24);  // About 16m counts
+
+      // Get the row of the image
+      int xsize = image_size_[1];
+      const T *src_row = &src[j * xsize];
+      const bool *mask_row = &mask_[j * xsize];
+
+      // Add the row sums to the previous row of the table
+      Row<A> curr = row<A>(j);
+      A x = 0;
+      A y = 0;
+      int num_big = 0;
+      if (j == 0) {
+        for (int i = 0; i < xsize; ++i) {
+          int mm = mask_row[i] ? 1 : 0;
+          num_big += mm & (src_row[i] >= BIG);
+          A v = traits::value(src_row[i]);
+          x += mm * v;
+          y += mm * v * v;
+          curr.x[i] = x;
+          curr.y[i] = y;
+        }
+      } else {
+        Row<A> prev = row<A>(j - 1);
+        for (int i = 0; i < xsize; ++i) {
+          int mm = mask_row[i] ? 1 : 0;
+          num_big += mm & (src_row[i] >= BIG);
+          A v = traits::value(src_row[i]);
+          x += mm * v;
+          y += mm * v * v;
+          curr.x[i] = prev.x[i] + x;
+          curr.y[i] = prev.y[i] + y;
+        }
+      }
+      return num_big == 0;
+    }
 
-      // Cast the buffer to the table type
-      af::ref<Data<T> > table((Data<T> *)&buffer_[0], buffer_.size());
+    /**
+     * The threshold criterion for a pixel, using the prepared count and
+     * bound. The arithmetic is the same as DispersionThreshold::Criterion.
+     */
+    template <typename T>
+    struct Criterion {
+      Criterion(const DispersionThresholdPrepared &parent,
+                const af::const_ref<T, af::c_grid<2> > &src_,
+                af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_.begin()),
+            dst(dst_.begin()),
+            count(&parent.count_[0]),
+            bound(&parent.bound_[0]),
+            valid(&parent.valid_[0]),
+            nsig_b(parent.nsig_b_),
+            nsig_s(parent.nsig_s_),
+            threshold(parent.threshold_) {}
+
+      void operator()(std::size_t k, double x, double y) const {
+        double m = count[k];
+        double a = m * y - x * x - x * (m - 1);
+        double b = m * src[k] - x;
+        double c = x * nsig_b * bound[k];
+        double d = nsig_s * std::sqrt(x * m);
+        dst[k] = valid[k] & (x >= 0) & (src[k] > threshold) & (a > c) & (b > d);
+      }
 
-      // compute the summed area table
-      compute_sat(table, src, mask);
+      const T *src;
+      bool *dst;
+      const int *count;
+      const double *bound;
+      const char *valid;
+      double nsig_b;
+      double nsig_s;
+      double threshold;
+    };
 
-      // Compute the image threshold
-      compute_threshold(table, src, mask, gain, dst);
+    /**
+     * The threshold criterion for a pixel with the gain map. The arithmetic
+     * is the same as DispersionThreshold::GainCriterion.
+     */
+    template <typename T>
+    struct GainCriterion {
+      GainCriterion(const DispersionThresholdPrepared &parent,
+                    const af::const_ref<T, af::c_grid<2> > &src_,
+                    af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_.begin()),
+            dst(dst_.begin()),
+            gain(parent.gain_.begin()),
+            count(&parent.count_[0]),
+            bound(&parent.bound_[0]),
+            valid(&parent.valid_[0]),
+            nsig_s(parent.nsig_s_),
+            threshold(parent.threshold_) {}
+
+      void operator()(std::size_t k, double x, double y) const {
+        double m = count[k];
+        double a = m * y - x * x;
+        double b = m * src[k] - x;
+        double c = gain[k] * x * bound[k];
+        double d = nsig_s * std::sqrt(gain[k] * x * m);
+        dst[k] = valid[k] & (x >= 0) & (src[k] > threshold) & (a > c) & (b > d);
+      }
+
+      const T *src;
+      bool *dst;
+      const double *gain;
+      const int *count;
+      const double *bound;
+      const char *valid;
+      double nsig_s;
+      double threshold;
+    };
+
+    /**
+     * Threshold a pixel where the kernel may be clipped by the image edge.
+     * @param k The index of the start of the image row
+     * @param i The x index of the pixel
+     * @param r0 The table row before the kernel or NULL if off the image
+     * @param r1 The last table row in the kernel
+     * @param criterion The threshold criterion
+     */
+    template <typename T, typename Function>
+    void compute_border_pixel(
+      std::size_t k,
+      int i,
+      const Row<typename SummedAreaTableTraits<T>::value_type> *r0,
+      const Row<typename SummedAreaTableTraits<T>::value_type> &r1,
+      const Function &criterion) const {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+      int xsize = image_size_[1];
+      int i0 = i - kernel_size_[1] - 1;
+      int i1 = std::min(i + kernel_size_[1], xsize - 1);
+      A x00 = 0, x10 = 0, x01 = 0;
+      A y00 = 0, y10 = 0, y01 = 0;
+      if (i0 >= 0 && r0 != NULL) {
+        x00 = r0->x[i0];
+        y00 = r0->y[i0];
+      }
+      if (i0 >= 0) {
+        x10 = r1.x[i0];
+        y10 = r1.y[i0];
+      }
+      if (r0 != NULL) {
+        x01 = r0->x[i1];
+        y01 = r0->y[i1];
+      }
+      double x = traits::window(x00, x10, x01, r1.x[i1]);
+      double y = traits::window(y00, y10, y01, r1.y[i1]);
+      criterion(k + i, x, y);
+    }
+
+    /**
+     * Threshold a row of the image
+     * @param j The row index
+     * @param criterion The threshold criterion
+     */
+    template <typename T, typename Function>
+    void compute_threshold_row(int j, const Function &criterion) {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+      int xsize = image_size_[1];
+      int ysize = image_size_[0];
+      int kxsize = kernel_size_[1];
+      int kysize = kernel_size_[0];
+      std::size_t k = (std::size_t)j * xsize;
+
+      // Get the table rows at the top and bottom of the kernel
+      int j0 = j - kysize - 1;
+      int j1 = std::min(j + kysize, ysize - 1);
+      Row<A> r1 = row<A>(j1);
+      if (j0 < 0) {
+        for (int i = 0; i < xsize; ++i) {
+          compute_border_pixel<T>(k, i, (const Row<A> *)NULL, r1, criterion);
+        }
+        return;
+      }
+      Row<A> r0 = row<A>(j0);
+
+      // The left and right edges
+      int ib = std::min(kxsize + 1, xsize);
+      int ie = std::max(xsize - kxsize, ib);
+      for (int i = 0; i < ib; ++i) {
+        compute_border_pixel<T>(k, i, &r0, r1, criterion);
+      }
+      for (int i = ie; i < xsize; ++i) {
+        compute_border_pixel<T>(k, i, &r0, r1, criterion);
+      }
+
+      // The interior of the row
+      int i0 = ib - kxsize - 1;
+      int i1 = ib + kxsize;
+      const A *x00 = r0.x + i0;
+      const A *x01 = r0.x + i1;
+      const A *x10 = r1.x + i0;
+      const A *x11 = r1.x + i1;
+      const A *y00 = r0.y + i0;
+      const A *y01 = r0.y + i1;
+      const A *y10 = r1.y + i0;
+      const A *y11 = r1.y + i1;
+      for (int n = 0; n < ie - ib; ++n) {
+        double x = traits::window(x00[n], x10[n], x01[n], x11[n]);
+        double y = traits::window(y00[n], y10[n], y01[n], y11[n]);
+        criterion(k + ib + n, x, y);
+      }
+    }
+
+    /**
+     * Compute the threshold, filling in the rows of the summed area table as
+     * they are first needed.
+     * @param src The input array
+     * @param criterion The threshold criterion
+     * @returns False if there are valid pixels too large for the table
+     */
+    template <typename T, typename Function>
+    bool compute(const af::const_ref<T, af::c_grid<2> > &src,
+                 const Function &criterion) {
+      int ysize = image_size_[0];
+      int kysize = kernel_size_[0];
+      for (int j = 0, jn = 0; j < ysize; ++j) {
+        int j1 = std::min(j + kysize, ysize - 1);
+        for (; jn <= j1; ++jn) {
+          if (!compute_sat_row(jn, src)) {
+            return false;
+          }
+        }
+        compute_threshold_row<T>(j, criterion);
+      }
+      return true;
     }
 
-  private:
     int2 image_size_;
     int2 kernel_size_;
     double nsig_b_;
     double nsig_s_;
     double threshold_;
     int min_count_;
-    std::vector<char> buffer_;
+    int num_rows_;
+    bool has_gain_;
+    DispersionThreshold fallback_;
+    af::versa<bool, af::c_grid<2> > mask_;
+    af::versa<double, af::c_grid<2> > gain_;
+    std::vector<int> count_;
+    std::vector<double> bound_;
+    std::vector<char> valid_;
+    std::vector<char> table_x_;
+    std::vector<char> table_y_;
+    boost::mutex mutex_;
   };
 
   /**
@@ -949,7 +1604,9 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class to compute the threshold using index of dispersion
+   * A class to compute the threshold using index of dispersion. The summed
+   * area table belongs to the object, so calls on the same object are
+   * serialised.
    */
   class DispersionExtendedThreshold {
   public:
@@ -995,17 +1652,33 @@ namespace dials { namespace algorithms {
       buffer_.resize(element_size * image_size[0] * image_size[1]);
     }
 
+    /**
+     * Get the number of rows either side of a row of the image which are
+     * needed to threshold it. This is the dispersion kernel, the erosion of
+     * the dispersion mask and the larger kernel of the final threshold.
+     * @param kernel_size The kernel size
+     * @returns The number of rows
+     */
+    static int halo(int2 kernel_size) {
+      int erosion_distance = std::min(kernel_size[0], kernel_size[1]);
+      return kernel_size[0] + erosion_distance + kernel_size[0] + 2;
+    }
+
     /**
      * Compute the summed area tables for the mask, src and src^2.
      * @param src The input array
      * @param mask The mask array
      */
     template <typename T>
-    void compute_sat(af::ref<Data<T> > table,
-                     const af::const_ref<T, af::c_grid<2> > &src,
-                     const af::const_ref<bool, af::c_grid<2> > &mask) {
+    void compute_sat(
+      af::ref<Data<typename SummedAreaTableTraits<T>::value_type> > table,
+      const af::const_ref<T, af::c_grid<2> > &src,
+      const af::const_ref<bool, af::c_grid<2> > &mask) {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+
       // Largest value to consider
-      const T BIG = (1 << 24);  // About 16m counts
+      const double BIG = (1 << 24);  // About 16m counts
 
       // Get the size of the image
       std::size_t ysize = src.accessor()[0];
@@ -1014,13 +1687,14 @@ namespace dials { namespace algorithms {
       // Create the summed area table
       for (std::size_t j = 0, k = 0; j < ysize; ++j) {
         int m = 0;
-        T x = 0;
-        T y = 0;
+        A x = 0;
+        A y = 0;
         for (std::size_t i = 0; i < xsize; ++i, ++k) {
           int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
+          A v = traits::value(src[k]);
           m += mm;
-          x += mm * src[k];
-          y += mm * src[k] * src[k];
+          x += mm * v;
+          y += mm * v * v;
           if (j == 0) {
             table[k].m = m;
             table[k].x = x;
@@ -1041,66 +1715,13 @@ namespace dials { namespace algorithms {
      * @param dst The output array
      */
     template <typename T>
-    void compute_dispersion_threshold(af::ref<Data<T> > table,
-                                      const af::const_ref<T, af::c_grid<2> > &src,
-                                      const af::const_ref<bool, af::c_grid<2> > &mask,
-                                      af::ref<bool, af::c_grid<2> > dst) {
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
-
-      // The kernel size
-      int kxsize = kernel_size_[1];
-      int kysize = kernel_size_[0];
-
-      // Calculate the local mean at every point
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int i0 = i - kxsize - 1, i1 = i + kxsize;
-          int j0 = j - kysize - 1, j1 = j + kysize;
-          i1 = i1 < xsize ? i1 : xsize - 1;
-          j1 = j1 < ysize ? j1 : ysize - 1;
-          int k0 = j0 * xsize;
-          int k1 = j1 * xsize;
-
-          // Compute the number of points valid in the local area,
-          // the sum of the pixel values and the sum of the squared pixel
-          // values.
-          double m = 0;
-          double x = 0;
-          double y = 0;
-          if (i0 >= 0 && j0 >= 0) {
-            const Data<T> &d00 = table[k0 + i0];
-            const Data<T> &d10 = table[k1 + i0];
-            const Data<T> &d01 = table[k0 + i1];
-            m += d00.m - (d10.m + d01.m);
-            x += d00.x - (d10.x + d01.x);
-            y += d00.y - (d10.y + d01.y);
-          } else if (i0 >= 0) {
-            const Data<T> &d10 = table[k1 + i0];
-            m -= d10.m;
-            x -= d10.x;
-            y -= d10.y;
-          } else if (j0 >= 0) {
-            const Data<T> &d01 = table[k0 + i1];
-            m -= d01.m;
-            x -= d01.x;
-            y -= d01.y;
-          }
-          const Data<T> &d11 = table[k1 + i1];
-          m += d11.m;
-          x += d11.x;
-          y += d11.y;
-
-          // Compute the thresholds
-          dst[k] = false;
-          if (mask[k] && m >= min_count_ && x >= 0) {
-            double a = m * y - x * x - x * (m - 1);
-            double c = x * nsig_b_ * std::sqrt(2 * (m - 1));
-            dst[k] = (a > c);
-          }
-        }
-      }
+    void compute_dispersion_threshold(
+      af::ref<Data<typename SummedAreaTableTraits<T>::value_type> > table,
+      const af::const_ref<T, af::c_grid<2> > &src,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      af::ref<bool, af::c_grid<2> > dst) {
+      compute_windows<T>(
+        table.begin(), kernel_size_, DispersionCriterion<T>(*this, mask, dst));
     }
 
     /**
@@ -1111,90 +1732,83 @@ namespace dials { namespace algorithms {
      * @param dst The output array
      */
     template <typename T>
-    void compute_dispersion_threshold(af::ref<Data<T> > table,
-                                      const af::const_ref<T, af::c_grid<2> > &src,
-                                      const af::const_ref<bool, af::c_grid<2> > &mask,
-                                      const af::const_ref<double, af::c_grid<2> > &gain,
-                                      af::ref<bool, af::c_grid<2> > dst) {
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
-
-      // The kernel size
-      int kxsize = kernel_size_[1];
-      int kysize = kernel_size_[0];
-
-      // Calculate the local mean at every point
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int i0 = i - kxsize - 1, i1 = i + kxsize;
-          int j0 = j - kysize - 1, j1 = j + kysize;
-          i1 = i1 < xsize ? i1 : xsize - 1;
-          j1 = j1 < ysize ? j1 : ysize - 1;
-          int k0 = j0 * xsize;
-          int k1 = j1 * xsize;
-
-          // Compute the number of points valid in the local area,
-          // the sum of the pixel values and the num of the squared pixel
-          // values.
-          double m = 0;
-          double x = 0;
-          double y = 0;
-          if (i0 >= 0 && j0 >= 0) {
-            const Data<T> &d00 = table[k0 + i0];
-            const Data<T> &d10 = table[k1 + i0];
-            const Data<T> &d01 = table[k0 + i1];
-            m += d00.m - (d10.m + d01.m);
-            x += d00.x - (d10.x + d01.x);
-            y += d00.y - (d10.y + d01.y);
-          } else if (i0 >= 0) {
-            const Data<T> &d10 = table[k1 + i0];
-            m -= d10.m;
-            x -= d10.x;
-            y -= d10.y;
-          } else if (j0 >= 0) {
-            const Data<T> &d01 = table[k0 + i1];
-            m -= d01.m;
-            x -= d01.x;
-            y -= d01.y;
-          }
-          const Data<T> &d11 = table[k1 + i1];
-          m += d11.m;
-          x += d11.x;
-          y += d11.y;
-
-          // Compute the thresholds
-          dst[k] = false;
-          if (mask[k] && m >= min_count_ && x >= 0) {
-            double a = m * y - x * x;
-            double c = gain[k] * x * (m - 1 + nsig_b_ * std::sqrt(2 * (m - 1)));
-            dst[k] = (a > c);
-          }
-        }
-      }
+    void compute_dispersion_threshold(
+      af::ref<Data<typename SummedAreaTableTraits<T>::value_type> > table,
+      const af::const_ref<T, af::c_grid<2> > &src,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      const af::const_ref<double, af::c_grid<2> > &gain,
+      af::ref<bool, af::c_grid<2> > dst) {
+      compute_windows<T>(table.begin(),
+                         kernel_size_,
+                         DispersionGainCriterion<T>(*this, mask, gain, dst));
     }
 
     /**
-     * Erode the dispersion mask
+     * Erode the dispersion mask. A pixel above the dispersion threshold is
+     * kept if its chebyshev distance to the nearest pixel below it is at
+     * least the erosion distance; i.e. if all the pixels on the image within
+     * a square of half size erosion distance - 1 are above the threshold.
+     * This is done as a separable erosion in x and then y by counting the
+     * consecutive pixels above the threshold in each direction, so the
+     * distance transform is not needed.
      * @param dst The dispersion mask
      */
     void erode_dispersion_mask(const af::const_ref<bool, af::c_grid<2> > &mask,
                                af::ref<bool, af::c_grid<2> > dst) {
-      // The distance array
-      af::versa<int, af::c_grid<2> > distance(dst.accessor(), 0);
-
-      // Compute the chebyshev distance to the nearest valid background pixel
-      chebyshev_distance(dst, false, distance.ref());
-
-      // The erosion distance
-      std::size_t erosion_distance = std::min(kernel_size_[0], kernel_size_[1]);
+      int ysize = dst.accessor()[0];
+      int xsize = dst.accessor()[1];
+
+      // The erosion distance. Off the image the pixels count as being above
+      // the threshold, so the count starts at the erosion distance.
+      int erosion_distance = std::min(kernel_size_[0], kernel_size_[1]);
+      int radius = erosion_distance - 1;
+
+      // Erode each row in place. The number of consecutive pixels above the
+      // threshold up to each pixel from the left is kept and then compared
+      // with the number from the right.
+      std::vector<int> left(xsize);
+      bool any_below = false;
+      for (int j = 0; j < ysize; ++j) {
+        bool *row = &dst[j * xsize];
+        int count = erosion_distance;
+        for (int i = 0; i < xsize; ++i) {
+          count = row[i] ? count + 1 : 0;
+          left[i] = count;
+        }
+        count = erosion_distance;
+        for (int i = xsize - 1; i >= 0; --i) {
+          any_below |= !row[i];
+          count = row[i] ? count + 1 : 0;
+          row[i] = std::min(left[i], count) > radius;
+        }
+      }
 
-      // Compute the eroded mask
-      for (std::size_t k = 0; k < dst.size(); ++k) {
-        if (mask[k]) {
-          dst[k] = !(dst[k] && distance[k] >= erosion_distance);
-        } else {
-          dst[k] = false;
+      // The chebyshev distance when there are no pixels below the threshold
+      // is the sum of the image sizes + 1, so no pixels are kept if the
+      // erosion distance is larger than that
+      bool any_kept = any_below || xsize + ysize + 1 >= erosion_distance;
+
+      // Erode each column in the same way, counting down the columns and
+      // then back up to compute the eroded mask
+      af::versa<int, af::c_grid<2> > up(dst.accessor(), af::init_functor_null<int>());
+      std::vector<int> count(xsize, erosion_distance);
+      for (int j = 0; j < ysize; ++j) {
+        const bool *row = &dst[j * xsize];
+        int *up_row = &up[j * xsize];
+        for (int i = 0; i < xsize; ++i) {
+          count[i] = row[i] ? count[i] + 1 : 0;
+          up_row[i] = count[i];
+        }
+      }
+      std::fill(count.begin(), count.end(), erosion_distance);
+      for (int j = ysize - 1; j >= 0; --j) {
+        bool *row = &dst[j * xsize];
+        const bool *mask_row = &mask[j * xsize];
+        const int *up_row = &up[j * xsize];
+        for (int i = 0; i < xsize; ++i) {
+          count[i] = row[i] ? count[i] + 1 : 0;
+          bool kept = any_kept && std::min(up_row[i], count[i]) > radius;
+          row[i] = mask_row[i] && !kept;
         }
       }
     }
@@ -1206,146 +1820,33 @@ namespace dials { namespace algorithms {
      * @param dst The output array
      */
     template <typename T>
-    void compute_final_threshold(af::ref<Data<T> > table,
-                                 const af::const_ref<T, af::c_grid<2> > &src,
-                                 const af::const_ref<bool, af::c_grid<2> > &mask,
-                                 af::ref<bool, af::c_grid<2> > dst) {
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
-
-      // The kernel size
-      int kxsize = kernel_size_[1] + 2;
-      int kysize = kernel_size_[0] + 2;
-
-      // Calculate the local mean at every point
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int i0 = i - kxsize - 1, i1 = i + kxsize;
-          int j0 = j - kysize - 1, j1 = j + kysize;
-          i1 = i1 < xsize ? i1 : xsize - 1;
-          j1 = j1 < ysize ? j1 : ysize - 1;
-          int k0 = j0 * xsize;
-          int k1 = j1 * xsize;
-
-          // Compute the number of points valid in the local area,
-          // the sum of the pixel values and the sum of the squared pixel
-          // values.
-          double m = 0;
-          double x = 0;
-          if (i0 >= 0 && j0 >= 0) {
-            const Data<T> &d00 = table[k0 + i0];
-            const Data<T> &d10 = table[k1 + i0];
-            const Data<T> &d01 = table[k0 + i1];
-            m += d00.m - (d10.m + d01.m);
-            x += d00.x - (d10.x + d01.x);
-          } else if (i0 >= 0) {
-            const Data<T> &d10 = table[k1 + i0];
-            m -= d10.m;
-            x -= d10.x;
-          } else if (j0 >= 0) {
-            const Data<T> &d01 = table[k0 + i1];
-            m -= d01.m;
-            x -= d01.x;
-          }
-          const Data<T> &d11 = table[k1 + i1];
-          m += d11.m;
-          x += d11.x;
-
-          // Compute the thresholds. The pixel is marked True if:
-          // 1. The pixel is valid
-          // 2. It has 1 or more unmasked neighbours
-          // 3. It is within the dispersion masked region
-          // 4. It is greater than the global threshold
-          // 5. It is greater than the local mean threshold
-          //
-          // Otherwise it is false
-          if (mask[k] && m >= 0 && x >= 0) {
-            bool dispersion_mask = !dst[k];
-            bool global_mask = src[k] > threshold_;
-            double mean = (m >= 2 ? (x / m) : 0);
-            bool local_mask = src[k] >= (mean + nsig_s_ * std::sqrt(mean));
-            dst[k] = dispersion_mask && global_mask && local_mask;
-          } else {
-            dst[k] = false;
-          }
-        }
-      }
+    void compute_final_threshold(
+      af::ref<Data<typename SummedAreaTableTraits<T>::value_type> > table,
+      const af::const_ref<T, af::c_grid<2> > &src,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      af::ref<bool, af::c_grid<2> > dst) {
+      compute_windows<T>(table.begin(),
+                         int2(kernel_size_[0] + 2, kernel_size_[1] + 2),
+                         FinalCriterion<T>(*this, src, mask, dst));
     }
 
     /**
      * Compute the threshold
      * @param src - The input array
      * @param mask - The mask array
+     * @param gain - The gain array
      * @param dst The output array
      */
     template <typename T>
-    void compute_final_threshold(af::ref<Data<T> > table,
-                                 const af::const_ref<T, af::c_grid<2> > &src,
-                                 const af::const_ref<bool, af::c_grid<2> > &mask,
-                                 const af::const_ref<double, af::c_grid<2> > &gain,
-                                 af::ref<bool, af::c_grid<2> > dst) {
-      // Get the size of the image
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
-
-      // The kernel size
-      int kxsize = kernel_size_[1] + 2;
-      int kysize = kernel_size_[0] + 2;
-
-      // Calculate the local mean at every point
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int i0 = i - kxsize - 1, i1 = i + kxsize;
-          int j0 = j - kysize - 1, j1 = j + kysize;
-          i1 = i1 < xsize ? i1 : xsize - 1;
-          j1 = j1 < ysize ? j1 : ysize - 1;
-          int k0 = j0 * xsize;
-          int k1 = j1 * xsize;
-
-          // Compute the number of points valid in the local area,
-          // the sum of the pixel values and the sum of the squared pixel
-          // values.
-          double m = 0;
-          double x = 0;
-          if (i0 >= 0 && j0 >= 0) {
-            const Data<T> &d00 = table[k0 + i0];
-            const Data<T> &d10 = table[k1 + i0];
-            const Data<T> &d01 = table[k0 + i1];
-            m += d00.m - (d10.m + d01.m);
-            x += d00.x - (d10.x + d01.x);
-          } else if (i0 >= 0) {
-            const Data<T> &d10 = table[k1 + i0];
-            m -= d10.m;
-            x -= d10.x;
-          } else if (j0 >= 0) {
-            const Data<T> &d01 = table[k0 + i1];
-            m -= d01.m;
-            x -= d01.x;
-          }
-          const Data<T> &d11 = table[k1 + i1];
-          m += d11.m;
-          x += d11.x;
-
-          // Compute the thresholds. The pixel is marked True if:
-          // 1. The pixel is valid
-          // 2. It has 1 or more unmasked neighbours
-          // 3. It is within the dispersion masked region
-          // 4. It is greater than the global threshold
-          // 5. It is greater than the local mean threshold
-          //
-          // Otherwise it is false
-          if (mask[k] && m >= 0 && x >= 0) {
-            bool dispersion_mask = !dst[k];
-            bool global_mask = src[k] > threshold_;
-            double mean = (m >= 2 ? (x / m) : 0);
-            bool local_mask = src[k] >= (mean + nsig_s_ * std::sqrt(gain[k] * mean));
-            dst[k] = dispersion_mask && global_mask && local_mask;
-          } else {
-            dst[k] = false;
-          }
-        }
-      }
+    void compute_final_threshold(
+      af::ref<Data<typename SummedAreaTableTraits<T>::value_type> > table,
+      const af::const_ref<T, af::c_grid<2> > &src,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      const af::const_ref<double, af::c_grid<2> > &gain,
+      af::ref<bool, af::c_grid<2> > dst) {
+      compute_windows<T>(table.begin(),
+                         int2(kernel_size_[0] + 2, kernel_size_[1] + 2),
+                         FinalGainCriterion<T>(*this, src, mask, gain, dst));
     }
 
     /**
@@ -1358,16 +1859,19 @@ namespace dials { namespace algorithms {
     void threshold(const af::const_ref<T, af::c_grid<2> > &src,
                    const af::const_ref<bool, af::c_grid<2> > &mask,
                    af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_TRACE_SCOPE("spot_finding", "dispersion_extended_threshold");
       // check the input
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
 
       // Get the table
-      DIALS_ASSERT(sizeof(T) <= sizeof(double));
+      typedef typename SummedAreaTableTraits<T>::value_type A;
+      DIALS_ASSERT(sizeof(Data<A>) <= sizeof(Data<double>));
 
-      // Cast the buffer to the table type
-      af::ref<Data<T> > table(reinterpret_cast<Data<T> *>(&buffer_[0]), buffer_.size());
+      // Cast the buffer to the table type, which is used by one call at a time
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      af::ref<Data<A> > table(reinterpret_cast<Data<A> *>(&buffer_[0]), buffer_.size());
 
       // compute the summed area table
       compute_sat(table, src, mask);
@@ -1399,6 +1903,7 @@ namespace dials { namespace algorithms {
                           const af::const_ref<bool, af::c_grid<2> > &mask,
                           const af::const_ref<double, af::c_grid<2> > &gain,
                           af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_TRACE_SCOPE("spot_finding", "dispersion_extended_threshold");
       // check the input
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
@@ -1406,10 +1911,12 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
 
       // Get the table
-      DIALS_ASSERT(sizeof(T) <= sizeof(double));
+      typedef typename SummedAreaTableTraits<T>::value_type A;
+      DIALS_ASSERT(sizeof(Data<A>) <= sizeof(Data<double>));
 
-      // Cast the buffer to the table type
-      af::ref<Data<T> > table((Data<T> *)&buffer_[0], buffer_.size());
+      // Cast the buffer to the table type, which is used by one call at a time
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      af::ref<Data<A> > table((Data<A> *)&buffer_[0], buffer_.size());
 
       // compute the summed area table
       compute_sat(table, src, mask);
@@ -1430,6 +1937,226 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * The dispersion criterion for a pixel. The criteria are combined without
+     * branching. If any of the first checks fail the square root may be NaN
+     * but then the pixel is not marked anyway.
+     */
+    template <typename T>
+    struct DispersionCriterion {
+      DispersionCriterion(const DispersionExtendedThreshold &parent,
+                          const af::const_ref<bool, af::c_grid<2> > &mask_,
+                          af::ref<bool, af::c_grid<2> > dst_)
+          : mask(mask_.begin()),
+            dst(dst_.begin()),
+            nsig_b(parent.nsig_b_),
+            min_count(parent.min_count_) {}
+
+      void operator()(std::size_t k, double m, double x, double y) const {
+        double a = m * y - x * x - x * (m - 1);
+        double c = x * nsig_b * std::sqrt(2 * (m - 1));
+        dst[k] = mask[k] & (m >= min_count) & (x >= 0) & (a > c);
+      }
+
+      const bool *mask;
+      bool *dst;
+      double nsig_b;
+      int min_count;
+    };
+
+    /**
+     * The dispersion criterion for a pixel with a gain map
+     */
+    template <typename T>
+    struct DispersionGainCriterion {
+      DispersionGainCriterion(const DispersionExtendedThreshold &parent,
+                              const af::const_ref<bool, af::c_grid<2> > &mask_,
+                              const af::const_ref<double, af::c_grid<2> > &gain_,
+                              af::ref<bool, af::c_grid<2> > dst_)
+          : mask(mask_.begin()),
+            gain(gain_.begin()),
+            dst(dst_.begin()),
+            nsig_b(parent.nsig_b_),
+            min_count(parent.min_count_) {}
+
+      void operator()(std::size_t k, double m, double x, double y) const {
+        double a = m * y - x * x;
+        double c = gain[k] * x * (m - 1 + nsig_b * std::sqrt(2 * (m - 1)));
+        dst[k] = mask[k] & (m >= min_count) & (x >= 0) & (a > c);
+      }
+
+      const bool *mask;
+      const double *gain;
+      bool *dst;
+      double nsig_b;
+      int min_count;
+    };
+
+    /**
+     * The final criterion for a pixel. The pixel is marked True if:
+     * 1. The pixel is valid
+     * 2. It has 1 or more unmasked neighbours
+     * 3. It is within the dispersion masked region
+     * 4. It is greater than the global threshold
+     * 5. It is greater than the local mean threshold
+     *
+     * Otherwise it is false
+     */
+    template <typename T>
+    struct FinalCriterion {
+      FinalCriterion(const DispersionExtendedThreshold &parent,
+                     const af::const_ref<T, af::c_grid<2> > &src_,
+                     const af::const_ref<bool, af::c_grid<2> > &mask_,
+                     af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_.begin()),
+            mask(mask_.begin()),
+            dst(dst_.begin()),
+            nsig_s(parent.nsig_s_),
+            threshold(parent.threshold_) {}
+
+      void operator()(std::size_t k, double m, double x, double y) const {
+        double mean = (m >= 2 ? (x / m) : 0);
+        dst[k] = mask[k] & (m >= 0) & (x >= 0) & !dst[k] & (src[k] > threshold)
+                 & (src[k] >= (mean + nsig_s * std::sqrt(mean)));
+      }
+
+      const T *src;
+      const bool *mask;
+      bool *dst;
+      double nsig_s;
+      double threshold;
+    };
+
+    /**
+     * The final criterion for a pixel with a gain map
+     */
+    template <typename T>
+    struct FinalGainCriterion {
+      FinalGainCriterion(const DispersionExtendedThreshold &parent,
+                         const af::const_ref<T, af::c_grid<2> > &src_,
+                         const af::const_ref<bool, af::c_grid<2> > &mask_,
+                         const af::const_ref<double, af::c_grid<2> > &gain_,
+                         af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_.begin()),
+            mask(mask_.begin()),
+            gain(gain_.begin()),
+            dst(dst_.begin()),
+            nsig_s(parent.nsig_s_),
+            threshold(parent.threshold_) {}
+
+      void operator()(std::size_t k, double m, double x, double y) const {
+        double mean = (m >= 2 ? (x / m) : 0);
+        dst[k] = mask[k] & (m >= 0) & (x >= 0) & !dst[k] & (src[k] > threshold)
+                 & (src[k] >= (mean + nsig_s * std::sqrt(gain[k] * mean)));
+      }
+
+      const T *src;
+      const bool *mask;
+      const double *gain;
+      bool *dst;
+      double nsig_s;
+      double threshold;
+    };
+
+    /**
+     * Apply a criterion to a pixel where the kernel may be clipped by the
+     * image edge.
+     * @param k The index of the start of the image row
+     * @param i The x index of the pixel
+     * @param kxsize The half size of the kernel in x
+     * @param r0 The table row before the kernel or NULL if off the image
+     * @param r1 The last table row in the kernel
+     * @param criterion The criterion
+     */
+    template <typename T, typename Function>
+    void compute_border_pixel(
+      std::size_t k,
+      int i,
+      int kxsize,
+      const Data<typename SummedAreaTableTraits<T>::value_type> *r0,
+      const Data<typename SummedAreaTableTraits<T>::value_type> *r1,
+      const Function &criterion) const {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+      const Data<A> zero = {0, 0, 0};
+      int xsize = image_size_[1];
+      int i0 = i - kxsize - 1;
+      int i1 = std::min(i + kxsize, xsize - 1);
+
+      // Get the table values at the corners of the kernel, using zero for
+      // the corners which are off the image
+      const Data<A> &d00 = (i0 >= 0 && r0 != NULL) ? r0[i0] : zero;
+      const Data<A> &d10 = (i0 >= 0) ? r1[i0] : zero;
+      const Data<A> &d01 = (r0 != NULL) ? r0[i1] : zero;
+      const Data<A> &d11 = r1[i1];
+      double m = d00.m - (d10.m + d01.m) + d11.m;
+      double x = traits::window(d00.x, d10.x, d01.x, d11.x);
+      double y = traits::window(d00.y, d10.y, d01.y, d11.y);
+      criterion(k + i, m, x, y);
+    }
+
+    /**
+     * Apply a criterion to every pixel using the sums over the kernel. The
+     * pixels whose kernel is clipped by the image edge are done separately
+     * so the corners of the kernel for the interior of each row are read
+     * without any branching.
+     * @param table The summed area table
+     * @param kernel_size The half size of the kernel
+     * @param criterion The criterion
+     */
+    template <typename T, typename Function>
+    void compute_windows(const Data<typename SummedAreaTableTraits<T>::value_type> *table,
+                         int2 kernel_size,
+                         const Function &criterion) const {
+      typedef SummedAreaTableTraits<T> traits;
+      typedef typename traits::value_type A;
+      int xsize = image_size_[1];
+      int ysize = image_size_[0];
+      int kxsize = kernel_size[1];
+      int kysize = kernel_size[0];
+
+      // The pixels where the kernel is not clipped in x
+      int ib = std::min(kxsize + 1, xsize);
+      int ie = std::max(xsize - kxsize, ib);
+
+      for (int j = 0; j < ysize; ++j) {
+        std::size_t k = (std::size_t)j * xsize;
+
+        // Get the table rows at the top and bottom of the kernel
+        int j0 = j - kysize - 1;
+        int j1 = std::min(j + kysize, ysize - 1);
+        const Data<A> *r1 = table + (std::size_t)j1 * xsize;
+        if (j0 < 0) {
+          for (int i = 0; i < xsize; ++i) {
+            compute_border_pixel<T>(k, i, kxsize, (const Data<A> *)NULL, r1, criterion);
+          }
+          continue;
+        }
+        const Data<A> *r0 = table + (std::size_t)j0 * xsize;
+
+        // The left and right edges
+        for (int i = 0; i < ib; ++i) {
+          compute_border_pixel<T>(k, i, kxsize, r0, r1, criterion);
+        }
+        for (int i = ie; i < xsize; ++i) {
+          compute_border_pixel<T>(k, i, kxsize, r0, r1, criterion);
+        }
+
+        // The interior of the row. The pointers are offset to the first and
+        // last columns of the kernel of the first interior pixel.
+        const Data<A> *d00 = r0 + (ib - kxsize - 1);
+        const Data<A> *d01 = r0 + (ib + kxsize);
+        const Data<A> *d10 = r1 + (ib - kxsize - 1);
+        const Data<A> *d11 = r1 + (ib + kxsize);
+        for (int n = 0; n < ie - ib; ++n) {
+          double m = d00[n].m - (d10[n].m + d01[n].m) + d11[n].m;
+          double x = traits::window(d00[n].x, d10[n].x, d01[n].x, d11[n].x);
+          double y = traits::window(d00[n].y, d10[n].y, d01[n].y, d11[n].y);
+          criterion(k + ib + n, m, x, y);
+        }
+      }
+    }
+
     int2 image_size_;
     int2 kernel_size_;
     double nsig_b_;
@@ -1437,6 +2164,7 @@ namespace dials { namespace algorithms {
     double threshold_;
     int min_count_;
     std::vector<char> buffer_;
+    boost::mutex mutex_;
   };
 
 }}  // namespace dials::algorithms
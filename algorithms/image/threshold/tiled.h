@@ -0,0 +1,278 @@
+/*
+ * tiled.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/util/thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::util::ThreadPool;
+
+  /**
+   * Threshold a single image in parallel by splitting it into horizontal
+   * bands. Each band is extended above and below by a halo of the rows which
+   * the threshold algorithm needs to classify the pixels in the band, and the
+   * band and its halo are thresholded as a separate image on the thread pool.
+   * The rows of the band itself are then copied into the result. Since the
+   * bands are views of contiguous rows of the input no data is copied.
+   *
+   * The algorithm must have the same constructor as DispersionThreshold, the
+   * threshold and threshold_w_gain methods and a static halo method giving
+   * the number of rows needed either side of a band for a kernel size. The
+   * algorithm for each band is created when the object is created, so
+   * repeated calls on images of the same size do not allocate. The bands
+   * belong to the object, so calls on the same object are serialised.
+   *
+   * The local sums in the summed area tables start at the top of each band's
+   * halo rather than at the top of the image, so for images with non integer
+   * values a pixel very close to the threshold can occasionally be classified
+   * differently from the serial algorithm due to rounding.
+   */
+  template <typename Algorithm>
+  class TiledThreshold {
+  public:
+    /**
+     * Create the threshold algorithm with its own thread pool
+     * @param image_size The size of the image
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param nthreads The number of threads
+     * @param num_bands The number of bands (0 to use one per thread)
+     */
+    TiledThreshold(int2 image_size,
+                   int2 kernel_size,
+                   double nsig_b,
+                   double nsig_s,
+                   double threshold,
+                   int min_count,
+                   std::size_t nthreads,
+                   std::size_t num_bands)
+        : image_size_(image_size) {
+      DIALS_ASSERT(nthreads > 0);
+      pool_ = boost::make_shared<ThreadPool>(nthreads);
+      init(kernel_size, nsig_b, nsig_s, threshold, min_count, num_bands);
+    }
+
+    /**
+     * Create the threshold algorithm using a shared thread pool
+     * @param image_size The size of the image
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param pool The thread pool
+     * @param num_bands The number of bands (0 to use one per thread)
+     */
+    TiledThreshold(int2 image_size,
+                   int2 kernel_size,
+                   double nsig_b,
+                   double nsig_s,
+                   double threshold,
+                   int min_count,
+                   boost::shared_ptr<ThreadPool> pool,
+                   std::size_t num_bands)
+        : image_size_(image_size), pool_(pool) {
+      DIALS_ASSERT(pool_ != NULL);
+      init(kernel_size, nsig_b, nsig_s, threshold, min_count, num_bands);
+    }
+
+    /**
+     * @returns The number of bands
+     */
+    std::size_t num_bands() const {
+      return bands_.size();
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold(const af::const_ref<T, af::c_grid<2> > &src,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      ThreadPool::TaskGroup group(*pool_);
+      for (std::size_t i = 0; i < bands_.size(); ++i) {
+        group.post(boost::bind(&TiledThreshold::threshold_band<T>,
+                               this,
+                               i,
+                               src,
+                               mask,
+                               dst));
+      }
+      group.wait();
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param gain - The gain array
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold_w_gain(const af::const_ref<T, af::c_grid<2> > &src,
+                          const af::const_ref<bool, af::c_grid<2> > &mask,
+                          const af::const_ref<double, af::c_grid<2> > &gain,
+                          af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      ThreadPool::TaskGroup group(*pool_);
+      for (std::size_t i = 0; i < bands_.size(); ++i) {
+        group.post(boost::bind(&TiledThreshold::threshold_band_w_gain<T>,
+                               this,
+                               i,
+                               src,
+                               mask,
+                               gain,
+                               dst));
+      }
+      group.wait();
+    }
+
+  private:
+    /**
+     * A band of the image
+     */
+    struct Band {
+      int first;       // The first row of the band
+      int last;        // One past the last row of the band
+      int halo_first;  // The first row including the halo
+      int halo_last;   // One past the last row including the halo
+      boost::shared_ptr<Algorithm> algorithm;
+      af::versa<bool, af::c_grid<2> > result;
+    };
+
+    /**
+     * Split the image into bands and create the algorithm for each
+     */
+    void init(int2 kernel_size,
+              double nsig_b,
+              double nsig_s,
+              double threshold,
+              int min_count,
+              std::size_t num_bands) {
+      DIALS_ASSERT(image_size_.all_gt(0));
+      int ysize = image_size_[0];
+      int xsize = image_size_[1];
+
+      // Get the number of rows in each band
+      if (num_bands == 0) {
+        num_bands = pool_->size();
+      }
+      num_bands = std::max((std::size_t)1, std::min(num_bands, (std::size_t)ysize));
+      int band_size = (ysize + num_bands - 1) / num_bands;
+      int halo = Algorithm::halo(kernel_size);
+
+      // Create the algorithm for each band
+      for (int first = 0; first < ysize; first += band_size) {
+        int last = std::min(first + band_size, ysize);
+        Band band;
+        band.first = first;
+        band.last = last;
+        band.halo_first = std::max(first - halo, 0);
+        band.halo_last = std::min(last + halo, ysize);
+        int2 size(band.halo_last - band.halo_first, xsize);
+        band.algorithm = boost::make_shared<Algorithm>(
+          size, kernel_size, nsig_b, nsig_s, threshold, min_count);
+        band.result = af::versa<bool, af::c_grid<2> >(af::c_grid<2>(size[0], size[1]));
+        bands_.push_back(band);
+      }
+    }
+
+    /**
+     * Get a view of the band and its halo
+     * @param band The band
+     * @param data The image data
+     * @returns The rows of the image in the band and halo
+     */
+    template <typename T>
+    af::const_ref<T, af::c_grid<2> > view(
+      const Band &band,
+      const af::const_ref<T, af::c_grid<2> > &data) const {
+      std::size_t xsize = image_size_[1];
+      return af::const_ref<T, af::c_grid<2> >(
+        data.begin() + band.halo_first * xsize,
+        af::c_grid<2>(band.halo_last - band.halo_first, xsize));
+    }
+
+    /**
+     * Copy the rows of the band into the result
+     * @param band The band
+     * @param dst The result for the whole image
+     */
+    void copy_band(const Band &band, af::ref<bool, af::c_grid<2> > dst) const {
+      std::size_t xsize = image_size_[1];
+      std::copy(band.result.begin() + (band.first - band.halo_first) * xsize,
+                band.result.begin() + (band.last - band.halo_first) * xsize,
+                dst.begin() + band.first * xsize);
+    }
+
+    /**
+     * Threshold a single band
+     */
+    template <typename T>
+    void threshold_band(std::size_t index,
+                        af::const_ref<T, af::c_grid<2> > src,
+                        af::const_ref<bool, af::c_grid<2> > mask,
+                        af::ref<bool, af::c_grid<2> > dst) {
+      Band &band = bands_[index];
+      band.algorithm->threshold(
+        view(band, src), view(band, mask), band.result.ref());
+      copy_band(band, dst);
+    }
+
+    /**
+     * Threshold a single band with a gain map
+     */
+    template <typename T>
+    void threshold_band_w_gain(std::size_t index,
+                               af::const_ref<T, af::c_grid<2> > src,
+                               af::const_ref<bool, af::c_grid<2> > mask,
+                               af::const_ref<double, af::c_grid<2> > gain,
+                               af::ref<bool, af::c_grid<2> > dst) {
+      Band &band = bands_[index];
+      band.algorithm->threshold_w_gain(
+        view(band, src), view(band, mask), view(band, gain), band.result.ref());
+      copy_band(band, dst);
+    }
+
+    int2 image_size_;
+    boost::shared_ptr<ThreadPool> pool_;
+    std::vector<Band> bands_;
+    boost::mutex mutex_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
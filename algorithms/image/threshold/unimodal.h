@@ -11,11 +11,15 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 #define DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <vector>
+#include <boost/bind.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -58,6 +62,189 @@ namespace dials { namespace algorithms {
     return imax;
   }
 
+  /**
+   * A histogram of image values for unimodal thresholding. Images can be added
+   * and subtracted as the frames change, and the histograms of different
+   * threads can be added together, so the probability distribution can be
+   * computed without rescanning the images. Values outside the range are
+   * not binned, but values above the range are counted.
+   */
+  class UnimodalHistogram {
+  public:
+    /**
+     * @param range The range of values to bin
+     */
+    UnimodalHistogram(int2 range) : range_(range), count_(0), overflow_(0) {
+      DIALS_ASSERT(range[1] >= range[0]);
+      counts_.resize(range[1] - range[0] + 1, 0);
+    }
+
+    /**
+     * Add the values of an image to the histogram
+     * @param image The image
+     * @param nthreads The number of threads
+     */
+    void add(const af::const_ref<int, af::c_grid<2> > &image,
+             std::size_t nthreads = 1) {
+      std::vector<std::size_t> counts;
+      std::size_t count = 0;
+      std::size_t overflow = 0;
+      histogram(image, nthreads, counts, count, overflow);
+      for (std::size_t i = 0; i < counts_.size(); ++i) {
+        counts_[i] += counts[i];
+      }
+      count_ += count;
+      overflow_ += overflow;
+    }
+
+    /**
+     * Subtract the values of an image, which must have been added before, from
+     * the histogram
+     * @param image The image
+     * @param nthreads The number of threads
+     */
+    void subtract(const af::const_ref<int, af::c_grid<2> > &image,
+                  std::size_t nthreads = 1) {
+      std::vector<std::size_t> counts;
+      std::size_t count = 0;
+      std::size_t overflow = 0;
+      histogram(image, nthreads, counts, count, overflow);
+      for (std::size_t i = 0; i < counts_.size(); ++i) {
+        DIALS_ASSERT(counts_[i] >= counts[i]);
+        counts_[i] -= counts[i];
+      }
+      DIALS_ASSERT(count_ >= count);
+      DIALS_ASSERT(overflow_ >= overflow);
+      count_ -= count;
+      overflow_ -= overflow;
+    }
+
+    /**
+     * Add the counts from another histogram
+     * @param other The other histogram
+     */
+    UnimodalHistogram operator+=(const UnimodalHistogram &other) {
+      DIALS_ASSERT(range_.all_eq(other.range_));
+      for (std::size_t i = 0; i < counts_.size(); ++i) {
+        counts_[i] += other.counts_[i];
+      }
+      count_ += other.count_;
+      overflow_ += other.overflow_;
+      return *this;
+    }
+
+    /**
+     * @returns The range of values
+     */
+    int2 range() const {
+      return range_;
+    }
+
+    /**
+     * @returns The number of values in each bin
+     */
+    af::shared<std::size_t> counts() const {
+      af::shared<std::size_t> result(counts_.size());
+      std::copy(counts_.begin(), counts_.end(), result.begin());
+      return result;
+    }
+
+    /**
+     * @returns The number of values in the range
+     */
+    std::size_t count() const {
+      return count_;
+    }
+
+    /**
+     * Calculate the probability distribution of the values, up to the largest
+     * value or the end of the range if any value is above it.
+     * @returns The probability distribution of values
+     */
+    af::shared<double> probability_distribution() const {
+      DIALS_ASSERT(count_ > 0);
+      std::size_t size = counts_.size();
+      if (overflow_ == 0) {
+        while (counts_[size - 1] == 0) {
+          --size;
+        }
+      }
+      af::shared<double> p(size);
+      for (std::size_t i = 0; i < size; ++i) {
+        p[i] = (double)counts_[i] / count_;
+      }
+      return p;
+    }
+
+  private:
+    /**
+     * Histogram the image, with each band of rows counted on a thread
+     */
+    void histogram(const af::const_ref<int, af::c_grid<2> > &image,
+                   std::size_t nthreads,
+                   std::vector<std::size_t> &counts,
+                   std::size_t &count,
+                   std::size_t &overflow) const {
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t nrows = image.accessor()[0];
+      std::size_t nbands = std::max(std::min(nthreads, nrows), std::size_t(1));
+      std::vector<std::vector<std::size_t> > band_counts(
+        nbands, std::vector<std::size_t>(counts_.size(), 0));
+      std::vector<std::size_t> band_overflow(nbands, 0);
+      detail::parallel_bands(boost::bind(&UnimodalHistogram::histogram_bands,
+                                         this,
+                                         boost::cref(image),
+                                         nbands,
+                                         boost::ref(band_counts),
+                                         boost::ref(band_overflow),
+                                         _1,
+                                         _2),
+                             nbands,
+                             nthreads);
+      counts.assign(counts_.size(), 0);
+      for (std::size_t b = 0; b < nbands; ++b) {
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+          counts[i] += band_counts[b][i];
+        }
+        overflow += band_overflow[b];
+      }
+      for (std::size_t i = 0; i < counts.size(); ++i) {
+        count += counts[i];
+      }
+    }
+
+    void histogram_bands(const af::const_ref<int, af::c_grid<2> > &image,
+                         std::size_t nbands,
+                         std::vector<std::vector<std::size_t> > &band_counts,
+                         std::vector<std::size_t> &band_overflow,
+                         std::size_t first,
+                         std::size_t last) const {
+      std::size_t ncols = image.accessor()[1];
+      std::size_t nrows = image.accessor()[0];
+      std::size_t band_size = (nrows + nbands - 1) / nbands;
+      for (std::size_t b = first; b < last; ++b) {
+        std::size_t *c = &band_counts[b][0];
+        std::size_t overflow = 0;
+        std::size_t i0 = std::min(b * band_size, nrows) * ncols;
+        std::size_t i1 = std::min((b + 1) * band_size, nrows) * ncols;
+        for (std::size_t i = i0; i < i1; ++i) {
+          int value = image[i];
+          if (value > range_[1]) {
+            overflow++;
+          } else if (value >= range_[0]) {
+            c[value - range_[0]]++;
+          }
+        }
+        band_overflow[b] = overflow;
+      }
+    }
+
+    int2 range_;
+    std::vector<std::size_t> counts_;
+    std::size_t count_;
+    std::size_t overflow_;
+  };
+
   /**
    * Calculate the probability distribution of an image histogram
    * @param image The image to process
@@ -67,31 +254,9 @@ namespace dials { namespace algorithms {
   inline af::shared<double> probability_distribution(
     const af::const_ref<int, af::c_grid<2> > &image,
     int2 range) {
-    // Get the histogram range
-    int minh = range[0];
-    int maxi = max(image);
-    int maxh = min(int2(maxi, range[1]).const_ref());
-
-    // Histogram the image
-    af::shared<double> p(maxh - minh + 1, af::init_functor_null<double>());
-    std::size_t count = 0;
-    for (std::size_t i = 0; i < image.size(); ++i) {
-      if (minh <= image[i] && image[i] <= maxh) {
-        p[image[i] - minh] += 1;
-        count++;
-      }
-    }
-
-    // Ensure more than 0 counts
-    DIALS_ASSERT(count > 0);
-
-    // Make into probability distribution
-    for (std::size_t i = 0; i < p.size(); ++i) {
-      p[i] /= count;
-    }
-
-    // Return the probability distribution
-    return p;
+    UnimodalHistogram histogram(range);
+    histogram.add(image);
+    return histogram.probability_distribution();
   }
 
 }}  // namespace dials::algorithms
@@ -15,9 +15,10 @@ def __call__(self, reciprocal_lattice_vectors):
 
 
 class AssignIndicesGlobal(AssignIndicesStrategy):
-    def __init__(self, tolerance=0.3):
+    def __init__(self, tolerance=0.3, nproc=1):
         super(AssignIndicesGlobal, self).__init__()
         self._tolerance = tolerance
+        self._nproc = nproc
 
     def __call__(self, reflections, experiments, d_min=None):
         reciprocal_lattice_points = reflections["rlp"]
@@ -44,6 +45,7 @@ def __call__(self, reflections, experiments, d_min=None):
                 phi.select(sel_imgset),
                 UB_matrices,
                 tolerance=self._tolerance,
+                nthreads=self._nproc,
             )
 
             miller_indices = result.miller_indices()
@@ -71,13 +73,36 @@ def __call__(self, reflections, experiments, d_min=None):
 
 class AssignIndicesLocal(AssignIndicesStrategy):
     def __init__(
-        self, d_min=None, epsilon=0.05, delta=8, l_min=0.8, nearest_neighbours=20
+        self,
+        d_min=None,
+        epsilon=0.05,
+        delta=8,
+        l_min=0.8,
+        nearest_neighbours=20,
+        nproc=1,
     ):
         super(AssignIndicesLocal, self).__init__()
         self._epsilon = epsilon
         self._delta = delta
         self._l_min = l_min
         self._nearest_neighbours = nearest_neighbours
+        self._nproc = nproc
+        # the nearest neighbours of the last set of points, which only need
+        # recomputing when the points change
+        self._nn_rlps = None
+        self._nn = None
+
+    def _nearest_neighbour_indices(self, rlps):
+        if (
+            self._nn_rlps is None
+            or len(self._nn_rlps) != len(rlps)
+            or not self._nn_rlps.as_double().all_eq(rlps.as_double())
+        ):
+            self._nn_rlps = rlps.deep_copy()
+            self._nn = ext.reciprocal_space_nearest_neighbours(
+                rlps, nearest_neighbours=self._nearest_neighbours
+            )
+        return self._nn
 
     def __call__(self, reflections, experiments, d_min=None):
         from libtbx.math_utils import nearest_integer as nint
@@ -109,10 +134,11 @@ def __call__(self, reflections, experiments, d_min=None):
             rlps,
             phi,
             UB_matrices,
+            nn=self._nearest_neighbour_indices(rlps),
             epsilon=self._epsilon,
             delta=self._delta,
             l_min=self._l_min,
-            nearest_neighbours=self._nearest_neighbours,
+            nthreads=self._nproc,
         )
         miller_indices = result.miller_indices()
         crystal_ids = result.crystal_ids()
@@ -52,7 +52,7 @@ class FFT3D(Strategy):
 
     phil_scope = phil.parse(fft3d_phil_str)
 
-    def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
+    def __init__(self, max_cell, min_cell=3, params=None, nproc=1, *args, **kwargs):
         """Construct an FFT3D object.
 
         Args:
@@ -72,6 +72,8 @@ def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
                 map.
             min_cell (float): A conservative lower bound on the minimum possible
                 primitive unit cell dimension.
+            nproc (int): The number of threads to use when mapping the reciprocal
+                lattice vectors onto the grid.
         """
         super(FFT3D, self).__init__(max_cell, params=params, *args, **kwargs)
         n_points = self._params.reciprocal_space_grid.n_points
@@ -80,6 +82,14 @@ def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
         )
         self._n_points = self._gridding[0]
         self._min_cell = min_cell
+        self._nproc = nproc
+        self._fft_plan = fftpack.complex_to_complex_3d(self._gridding)
+        # the grid from the last search, which later searches with a subset of
+        # the same reciprocal lattice vectors (e.g. after indexing a lattice)
+        # update rather than rebuild
+        self._grid = None
+        self._grid_vectors = None
+        self._grid_d_min = None
 
     def find_basis_vectors(self, reciprocal_lattice_vectors):
         """Find a list of likely basis vectors.
@@ -201,12 +211,11 @@ def _fft(self, reciprocal_lattice_vectors, d_min):
         # (512**3)*8*2*bytes_to_gb
         # 2.0
 
-        fft = fftpack.complex_to_complex_3d(self._gridding)
         grid_complex = flex.complex_double(
             reals=reciprocal_space_grid,
             imags=flex.double(reciprocal_space_grid.size(), 0),
         )
-        grid_transformed = fft.forward(grid_complex)
+        grid_transformed = self._fft_plan.forward(grid_complex)
         grid_real = flex.pow2(flex.real(grid_transformed))
         del grid_transformed
 
@@ -217,21 +226,59 @@ def _map_centroids_to_reciprocal_space_grid(
     ):
         logger.info("FFT gridding: (%i,%i,%i)" % self._gridding)
 
-        grid = flex.double(flex.grid(self._gridding), 0)
-
         if self._params.b_iso is libtbx.Auto:
             self._params.b_iso = -4 * d_min ** 2 * math.log(0.05)
             logger.debug("Setting b_iso = %.1f" % self._params.b_iso)
         used_in_indexing = flex.bool(reciprocal_lattice_vectors.size(), True)
-        dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
-            grid,
-            reciprocal_lattice_vectors,
-            used_in_indexing,  # do we really need this?
-            d_min,
-            b_iso=self._params.b_iso,
-        )
+
+        removed = None
+        if self._grid is not None and d_min == self._grid_d_min:
+            removed = self._removed_vectors(reciprocal_lattice_vectors)
+        if removed is not None:
+            logger.debug("Removing %i centroids from the FFT grid" % len(removed))
+            grid = self._grid
+            dials_algorithms_indexing_ext.remove_centroids_from_reciprocal_space_grid(
+                grid,
+                removed,
+                reciprocal_lattice_vectors,
+                used_in_indexing,
+                d_min,
+                b_iso=self._params.b_iso,
+                nthreads=self._nproc,
+            )
+        else:
+            grid = flex.double(flex.grid(self._gridding), 0)
+            dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
+                grid,
+                reciprocal_lattice_vectors,
+                used_in_indexing,  # do we really need this?
+                d_min,
+                b_iso=self._params.b_iso,
+                nthreads=self._nproc,
+            )
+        self._grid = grid
+        self._grid_vectors = reciprocal_lattice_vectors.deep_copy()
+        self._grid_d_min = d_min
         return grid, used_in_indexing
 
+    def _removed_vectors(self, reciprocal_lattice_vectors):
+        """Find the vectors removed since the grid was last mapped.
+
+        Returns:
+            The vectors in the last grid that are not in reciprocal_lattice_vectors,
+            or None if reciprocal_lattice_vectors is not an ordered subset of them.
+        """
+        position = {v: i for i, v in enumerate(self._grid_vectors)}
+        keep = flex.bool(len(self._grid_vectors), False)
+        last = -1
+        for v in reciprocal_lattice_vectors:
+            i = position.get(v, -1)
+            if i <= last:
+                return None
+            keep[i] = True
+            last = i
+        return self._grid_vectors.select(~keep)
+
     def _find_peaks(self, grid_real, d_min):
         grid_real_binary = grid_real.deep_copy()
         rmsd = math.sqrt(
@@ -34,3 +34,79 @@ def test_real_space_grid_search(self, setup_rlp):
         )
         basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
         self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
+
+def test_map_centroids_to_reciprocal_space_grid_nthreads(setup_rlp):
+    from scitbx.array_family import flex
+
+    import dials_algorithms_indexing_ext
+
+    grids = []
+    for nthreads in (1, 4):
+        grid = flex.double(flex.grid(64, 64, 64), 0)
+        used = flex.bool(setup_rlp["rlp"].size(), True)
+        dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
+            grid, setup_rlp["rlp"], used, 4.0, b_iso=10, nthreads=nthreads
+        )
+        grids.append((grid, used))
+    assert grids[0][0].all_eq(grids[1][0])
+    assert grids[0][1].all_eq(grids[1][1])
+    assert 0 < grids[0][1].count(True) < setup_rlp["rlp"].size()
+
+
+def test_score_vectors(setup_rlp):
+    from scitbx.array_family import flex
+
+    import dials_algorithms_indexing_ext
+
+    max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+    strategy = RealSpaceGridSearch(
+        max_cell, target_unit_cell=setup_rlp["crystal_symmetry"].unit_cell()
+    )
+    vectors = flex.vec3_double([v.elems for v in strategy.search_vectors][:50])
+    expected = [strategy.compute_functional(v, setup_rlp["rlp"]) for v in vectors]
+    for nthreads in (1, 3):
+        scores = dials_algorithms_indexing_ext.score_vectors(
+            vectors, setup_rlp["rlp"], nthreads=nthreads
+        )
+        assert list(scores) == pytest.approx(expected, abs=1e-6)
+
+
+def test_remove_centroids_from_reciprocal_space_grid(setup_rlp):
+    from scitbx.array_family import flex
+
+    import dials_algorithms_indexing_ext
+
+    rlp = setup_rlp["rlp"]
+    keep = flex.bool(len(rlp), flex.random_selection(len(rlp), len(rlp) // 2))
+    remaining = rlp.select(keep)
+    removed = rlp.select(~keep)
+
+    expected = flex.double(flex.grid(64, 64, 64), 0)
+    expected_used = flex.bool(len(remaining), True)
+    dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
+        expected, remaining, expected_used, 4.0, b_iso=10
+    )
+
+    grid = flex.double(flex.grid(64, 64, 64), 0)
+    dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
+        grid, rlp, flex.bool(len(rlp), True), 4.0, b_iso=10
+    )
+    used = flex.bool(len(remaining), True)
+    dials_algorithms_indexing_ext.remove_centroids_from_reciprocal_space_grid(
+        grid, removed, remaining, used, 4.0, b_iso=10, nthreads=2
+    )
+    assert grid.all_eq(expected)
+    assert used.all_eq(expected_used)
+
+    # a second search with a subset of the vectors updates the grid in place
+    max_cell = max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+    strategy = FFT3D(max_cell)
+    first_grid, _ = strategy._map_centroids_to_reciprocal_space_grid(rlp, 4.0)
+    grid, used = strategy._map_centroids_to_reciprocal_space_grid(remaining, 4.0)
+    assert grid is first_grid
+    expected, expected_used = FFT3D(max_cell)._map_centroids_to_reciprocal_space_grid(
+        remaining, 4.0
+    )
+    assert grid.all_eq(expected)
+    assert used.all_eq(expected_used)
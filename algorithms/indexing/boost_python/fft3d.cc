@@ -25,7 +25,8 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("m2"),
          arg("rl_grid_spacing"),
          arg("d_min"),
-         arg("b_iso")));
+         arg("b_iso"),
+         arg("nthreads") = 1));
 
     def("clean_3d",
         &clean_3d,
@@ -37,7 +38,18 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("reciprocal_space_vectors"),
          arg("selection"),
          arg("d_min"),
-         arg("b_iso") = 0));
+         arg("b_iso") = 0,
+         arg("nthreads") = 1));
+
+    def("remove_centroids_from_reciprocal_space_grid",
+        &remove_centroids_from_reciprocal_space_grid,
+        (arg("grid"),
+         arg("removed_vectors"),
+         arg("remaining_vectors"),
+         arg("selection"),
+         arg("d_min"),
+         arg("b_iso") = 0,
+         arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -11,12 +11,14 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/indexing/index.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
   void export_fft3d();
+  void export_score_vectors();
 
   void export_assign_indices() {
     typedef AssignIndices w_t;
@@ -25,10 +27,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<af::const_ref<scitbx::vec3<double> > const &,
                 af::const_ref<double> const &,
                 af::const_ref<scitbx::mat3<double> > const &,
-                double>((arg("reciprocal_space_points"),
-                         arg("phi"),
-                         arg("UB_matrices"),
-                         arg("tolerance") = 0.3)))
+                double,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("phi"),
+                              arg("UB_matrices"),
+                              arg("tolerance") = 0.3,
+                              arg("nthreads") = 1)))
       .def("miller_indices", &w_t::miller_indices)
       .def("crystal_ids", &w_t::crystal_ids);
   }
@@ -42,19 +46,42 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const double,
                 const double,
                 const double,
-                const int>((arg("reciprocal_space_points"),
-                            arg("phi"),
-                            arg("UB_matrices"),
-                            arg("epsilon") = 0.05,
-                            arg("delta") = 8,
-                            arg("l_min") = 0.8,
-                            arg("nearest_neighbours") = 20)))
+                const int,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("phi"),
+                              arg("UB_matrices"),
+                              arg("epsilon") = 0.05,
+                              arg("delta") = 8,
+                              arg("l_min") = 0.8,
+                              arg("nearest_neighbours") = 20,
+                              arg("nthreads") = 1)))
+      .def(init<af::const_ref<scitbx::vec3<double> > const &,
+                af::const_ref<double> const &,
+                af::const_ref<scitbx::mat3<double> > const &,
+                af::const_ref<std::size_t> const &,
+                const double,
+                const double,
+                const double,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("phi"),
+                              arg("UB_matrices"),
+                              arg("nn"),
+                              arg("epsilon") = 0.05,
+                              arg("delta") = 8,
+                              arg("l_min") = 0.8,
+                              arg("nthreads") = 1)))
       .def("miller_indices", &w_t::miller_indices)
       .def("crystal_ids", &w_t::crystal_ids);
+
+    def("reciprocal_space_nearest_neighbours",
+        &reciprocal_space_nearest_neighbours,
+        (arg("reciprocal_space_points"), arg("nearest_neighbours") = 20));
   }
 
   BOOST_PYTHON_MODULE(dials_algorithms_indexing_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_fft3d();
+    export_score_vectors();
     export_assign_indices();
     export_assign_indices_local();
   }
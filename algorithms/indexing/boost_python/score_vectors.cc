@@ -0,0 +1,21 @@
+/*
+ * score_vectors.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/indexing/score_vectors.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  void export_score_vectors() {
+    def("score_vectors",
+        &score_vectors,
+        (arg("vectors"), arg("reciprocal_lattice_points"), arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -18,9 +18,11 @@
 #include <scitbx/math/utils.h>
 
 #include <cstdlib>
+#include <boost/bind.hpp>
 #include <scitbx/array_family/versa_matrix.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/spot_prediction/rotation_angles.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dxtbx/model/scan_helpers.h>
 
 namespace dials { namespace algorithms {
@@ -41,14 +43,17 @@ namespace dials { namespace algorithms {
     return false;
   }
 
-  // compute a map of the sampling volume of a scan
-  void sampling_volume_map(af::ref<double, af::c_grid<3> > const& data,
-                           af::ref<vec2<double> > const& angle_ranges,
-                           vec3<double> s0,
-                           vec3<double> m2,
-                           double const& rl_grid_spacing,
-                           double d_min,
-                           double b_iso) {
+  // helper function for sampling_volume_map: compute the slabs [first, last)
+  // of the map along the first dimension
+  inline void sampling_volume_map_slabs(af::ref<double, af::c_grid<3> > const& data,
+                                        af::ref<vec2<double> > const& angle_ranges,
+                                        vec3<double> s0,
+                                        vec3<double> m2,
+                                        double rl_grid_spacing,
+                                        double d_min,
+                                        double b_iso,
+                                        std::size_t first,
+                                        std::size_t last) {
     typedef af::c_grid<3>::index_type index_t;
     index_t const gridding_n_real = index_t(data.accessor());
 
@@ -56,7 +61,7 @@ namespace dials { namespace algorithms {
 
     double one_over_d_sq_min = 1 / (d_min * d_min);
 
-    for (std::size_t i = 0; i < gridding_n_real[0]; i++) {
+    for (std::size_t i = first; i < last; i++) {
       double i_rl = (double(i) - double(gridding_n_real[0] / 2.0)) * rl_grid_spacing;
       double i_rl_sq = i_rl * i_rl;
       for (std::size_t j = 0; j < gridding_n_real[1]; j++) {
@@ -74,9 +79,7 @@ namespace dials { namespace algorithms {
 
           // Try to calculate the diffracting rotation angles
           vec2<double> phi;
-          try {
-            phi = calculate_rotation_angles_(pstar0);
-          } catch (error) {
+          if (!calculate_rotation_angles_.calculate(pstar0, phi)) {
             continue;
           }
 
@@ -95,6 +98,30 @@ namespace dials { namespace algorithms {
     }
   }
 
+  // compute a map of the sampling volume of a scan, with slabs of the map
+  // computed in parallel
+  void sampling_volume_map(af::ref<double, af::c_grid<3> > const& data,
+                           af::ref<vec2<double> > const& angle_ranges,
+                           vec3<double> s0,
+                           vec3<double> m2,
+                           double const& rl_grid_spacing,
+                           double d_min,
+                           double b_iso,
+                           std::size_t nthreads = 1) {
+    detail::parallel_bands(boost::bind(&sampling_volume_map_slabs,
+                                       data,
+                                       angle_ranges,
+                                       s0,
+                                       m2,
+                                       rl_grid_spacing,
+                                       d_min,
+                                       b_iso,
+                                       _1,
+                                       _2),
+                           data.accessor()[0],
+                           nthreads);
+  }
+
   /*
   Peak-finding algorithm inspired by the CLEAN algorithm of
   Högbom, J. A. 1974, A&AS, 15, 417.
@@ -175,24 +202,24 @@ namespace dials { namespace algorithms {
     return peaks;
   }
 
-  void map_centroids_to_reciprocal_space_grid(
-    af::ref<double, af::c_grid<3> > const& grid,
+  // helper function for map_centroids_to_reciprocal_space_grid: compute the
+  // grid index and value for the vectors [first, last)
+  inline void map_centroids_to_grid_index(
+    af::c_grid<3> const& accessor,
     af::const_ref<vec3<double> > const& reciprocal_space_vectors,
     af::ref<bool> const& selection,
+    af::ref<std::size_t> const& index,
+    af::ref<double> const& value,
     double d_min,
-    double b_iso = 0) {
-    typedef af::c_grid<3>::index_type index_t;
-    index_t const gridding_n_real = index_t(grid.accessor());
-    DIALS_ASSERT(d_min >= 0);
-    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[1]);
-    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[2]);
-
-    const int n_points = gridding_n_real[0];
+    double b_iso,
+    std::size_t first,
+    std::size_t last) {
+    const int n_points = accessor[0];
     const double rlgrid = 2 / (d_min * n_points);
     const double one_over_rlgrid = 1 / rlgrid;
     const int half_n_points = n_points / 2;
 
-    for (int i = 0; i < reciprocal_space_vectors.size(); i++) {
+    for (std::size_t i = first; i < last; i++) {
       if (!selection[i]) {
         continue;
       }
@@ -217,7 +244,112 @@ namespace dials { namespace algorithms {
       } else {
         T = 1;
       }
-      grid(coord) = T;
+      index[i] = (std::size_t(coord[0]) * n_points + coord[1]) * n_points + coord[2];
+      value[i] = T;
+    }
+  }
+
+  // map the reciprocal space vectors onto the grid. The grid points are
+  // computed in parallel and then written in the order of the vectors, so
+  // where several vectors fall on one point the last one is kept, as before.
+  void map_centroids_to_reciprocal_space_grid(
+    af::ref<double, af::c_grid<3> > const& grid,
+    af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+    af::ref<bool> const& selection,
+    double d_min,
+    double b_iso = 0,
+    std::size_t nthreads = 1) {
+    typedef af::c_grid<3>::index_type index_t;
+    index_t const gridding_n_real = index_t(grid.accessor());
+    DIALS_ASSERT(d_min >= 0);
+    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[1]);
+    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[2]);
+    DIALS_ASSERT(selection.size() == reciprocal_space_vectors.size());
+
+    std::size_t n = reciprocal_space_vectors.size();
+    af::shared<std::size_t> index(n, 0);
+    af::shared<double> value(n, 0);
+    detail::parallel_bands(boost::bind(&map_centroids_to_grid_index,
+                                       af::c_grid<3>(grid.accessor()),
+                                       reciprocal_space_vectors,
+                                       selection,
+                                       index.ref(),
+                                       value.ref(),
+                                       d_min,
+                                       b_iso,
+                                       _1,
+                                       _2),
+                           n,
+                           nthreads);
+    for (std::size_t i = 0; i < n; i++) {
+      if (selection[i]) {
+        grid[index[i]] = value[i];
+      }
+    }
+  }
+
+  // remove vectors from a grid made by map_centroids_to_reciprocal_space_grid.
+  // The grid points of the removed vectors are cleared and the remaining
+  // vectors are written again in order, which leaves the grid exactly as if
+  // it had been mapped from the remaining vectors alone without touching the
+  // rest of the grid.
+  void remove_centroids_from_reciprocal_space_grid(
+    af::ref<double, af::c_grid<3> > const& grid,
+    af::const_ref<vec3<double> > const& removed_vectors,
+    af::const_ref<vec3<double> > const& remaining_vectors,
+    af::ref<bool> const& selection,
+    double d_min,
+    double b_iso = 0,
+    std::size_t nthreads = 1) {
+    typedef af::c_grid<3>::index_type index_t;
+    index_t const gridding_n_real = index_t(grid.accessor());
+    DIALS_ASSERT(d_min >= 0);
+    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[1]);
+    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[2]);
+    DIALS_ASSERT(selection.size() == remaining_vectors.size());
+
+    std::size_t n_removed = removed_vectors.size();
+    af::shared<bool> removed_selection(n_removed, true);
+    af::shared<std::size_t> removed_index(n_removed, 0);
+    af::shared<double> removed_value(n_removed, 0);
+    detail::parallel_bands(boost::bind(&map_centroids_to_grid_index,
+                                       af::c_grid<3>(grid.accessor()),
+                                       removed_vectors,
+                                       removed_selection.ref(),
+                                       removed_index.ref(),
+                                       removed_value.ref(),
+                                       d_min,
+                                       b_iso,
+                                       _1,
+                                       _2),
+                           n_removed,
+                           nthreads);
+
+    std::size_t n = remaining_vectors.size();
+    af::shared<std::size_t> index(n, 0);
+    af::shared<double> value(n, 0);
+    detail::parallel_bands(boost::bind(&map_centroids_to_grid_index,
+                                       af::c_grid<3>(grid.accessor()),
+                                       remaining_vectors,
+                                       selection,
+                                       index.ref(),
+                                       value.ref(),
+                                       d_min,
+                                       b_iso,
+                                       _1,
+                                       _2),
+                           n,
+                           nthreads);
+
+    for (std::size_t i = 0; i < n_removed; i++) {
+      if (removed_selection[i]) {
+        grid[removed_index[i]] = 0;
+      }
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      if (selection[i]) {
+        grid[index[i]] = value[i];
+      }
     }
   }
 
@@ -12,6 +12,7 @@
 #define DIALS_ALGORITHMS_INDEXING_H
 #include <vector>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/vec3.h>
@@ -21,6 +22,8 @@
 #include <scitbx/constants.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <boost/bind.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/prim_minimum_spanning_tree.hpp>
 #include <boost/graph/depth_first_search.hpp>
@@ -30,113 +33,135 @@
 
 namespace dials { namespace algorithms {
 
+  namespace detail {
+
+    /**
+     * Compare assigned reflections by crystal, then miller index, then
+     * reflection index so that reflections sharing an hkl within a crystal
+     * are adjacent and in their original order.
+     */
+    struct compare_crystal_hkl {
+      af::const_ref<int> crystal_ids;
+      af::const_ref<cctbx::miller::index<> > miller_indices;
+
+      compare_crystal_hkl(af::const_ref<int> const& crystal_ids_,
+                          af::const_ref<cctbx::miller::index<> > const& miller_indices_)
+          : crystal_ids(crystal_ids_), miller_indices(miller_indices_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        if (crystal_ids[a] != crystal_ids[b]) {
+          return crystal_ids[a] < crystal_ids[b];
+        }
+        if (miller_indices[a] != miller_indices[b]) {
+          return miller_indices[a] < miller_indices[b];
+        }
+        return a < b;
+      }
+    };
+
+  }  // namespace detail
+
   class AssignIndices {
   public:
     AssignIndices(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
                   af::const_ref<double> const& phi,
                   af::const_ref<scitbx::mat3<double> > const& UB_matrices,
-                  double tolerance = 0.3)
+                  double tolerance = 0.3,
+                  std::size_t nthreads = 1)
         : miller_indices_(reciprocal_space_points.size(),
                           cctbx::miller::index<>(0, 0, 0)),
           crystal_ids_(reciprocal_space_points.size(), -1) {
       DIALS_ASSERT(reciprocal_space_points.size() == phi.size());
 
-      typedef std::pair<const cctbx::miller::index<>, const std::size_t> pair_t;
-      typedef std::multimap<cctbx::miller::index<>, std::size_t> map_t;
-
-      map_t hkl_to_rlp_map;
-
-      std::vector<af::shared<cctbx::miller::index<> > > hkl_ints;
-      std::vector<af::shared<double> > lengths_sq;
-
+      const std::size_t n_ref = reciprocal_space_points.size();
+      const std::size_t n_lattice = UB_matrices.size();
       const double pi_4 = scitbx::constants::pi / 4;
 
-      // loop over crystals and assign one hkl per crystal per reflection
-      for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-        scitbx::mat3<double> A = UB_matrices[i_lattice];
-        scitbx::mat3<double> A_inv = A.inverse();
-        af::shared<cctbx::miller::index<> > hkl_ints_(
-          af::reserve(reciprocal_space_points.size()));
-        af::shared<double> lengths_sq_(af::reserve(reciprocal_space_points.size()));
-        for (int i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
-          scitbx::vec3<double> rlp = reciprocal_space_points[i_ref];
-          scitbx::vec3<double> hkl_f = A_inv * rlp;
-          cctbx::miller::index<> hkl_i;
-          for (std::size_t j = 0; j < 3; j++) {
-            hkl_i[j] = scitbx::math::iround(hkl_f[j]);
-          }
-          scitbx::vec3<double> diff = hkl_f - scitbx::vec3<double>(hkl_i);
-          hkl_ints_.push_back(hkl_i);
-          lengths_sq_.push_back(diff.length_sq());
-        }
-        hkl_ints.push_back(hkl_ints_);
-        lengths_sq.push_back(lengths_sq_);
+      // the nearest hkl and squared distance to it for each lattice, stored
+      // with the lattices for one reflection adjacent
+      af::shared<cctbx::miller::index<> > hkl_ints(n_ref * n_lattice);
+      af::shared<double> lengths_sq(n_ref * n_lattice);
+
+      // assign one hkl per crystal per reflection in parallel bands of
+      // reflections
+      af::shared<scitbx::mat3<double> > A_inv(af::reserve(n_lattice));
+      for (std::size_t i_lattice = 0; i_lattice < n_lattice; i_lattice++) {
+        A_inv.push_back(UB_matrices[i_lattice].inverse());
       }
+      detail::parallel_bands(boost::bind(&AssignIndices::assign_hkl,
+                                         reciprocal_space_points,
+                                         A_inv.const_ref(),
+                                         hkl_ints.ref(),
+                                         lengths_sq.ref(),
+                                         _1,
+                                         _2),
+                             n_ref,
+                             nthreads);
 
       // loop over all reflections and choose the best hkl (and consequently
       // crystal) for each reflection
       double tolerance_sq = tolerance * tolerance;
-      for (int i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
-        af::shared<double> n;
-        af::shared<cctbx::miller::index<> > potential_hkls;
-        for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-          n.push_back(lengths_sq[i_lattice][i_ref]);
-          potential_hkls.push_back(hkl_ints[i_lattice][i_ref]);
+      std::vector<std::size_t> assigned;
+      assigned.reserve(n_ref);
+      for (std::size_t i_ref = 0; i_ref < n_ref && n_lattice > 0; i_ref++) {
+        const std::size_t offset = i_ref * n_lattice;
+        std::size_t i_best_lattice = 0;
+        for (std::size_t i_lattice = 1; i_lattice < n_lattice; i_lattice++) {
+          if (lengths_sq[offset + i_lattice] < lengths_sq[offset + i_best_lattice]) {
+            i_best_lattice = i_lattice;
+          }
         }
-        int i_best_lattice = af::min_index(n.const_ref());
-        if (n[i_best_lattice] > tolerance_sq) {
+        if (lengths_sq[offset + i_best_lattice] > tolerance_sq) {
           continue;
         }
-        cctbx::miller::index<> hkl = potential_hkls[i_best_lattice];
+        cctbx::miller::index<> hkl = hkl_ints[offset + i_best_lattice];
         if (hkl[0] == 0 && hkl[1] == 0 && hkl[2] == 0) {
           continue;
         }
         miller_indices_[i_ref] = hkl;
-        hkl_to_rlp_map.insert(pair_t(hkl, i_ref));
         crystal_ids_[i_ref] = i_best_lattice;
+        assigned.push_back(i_ref);
       }
 
-      cctbx::miller::index<> curr_hkl(0, 0, 0);
-      std::vector<std::size_t> i_same_hkl;
-      // if more than one spot can be assigned the same miller index then
-      // choose the closest one
-      for (map_t::iterator it = hkl_to_rlp_map.begin(); it != hkl_to_rlp_map.end();
-           it++) {
-        if (it->first == cctbx::miller::index<>(0, 0, 0)) {
-          continue;
+      // if more than one spot in a crystal can be assigned the same miller
+      // index then choose the closest one. Sorting brings these spots
+      // together, and each group is resolved pairwise in reflection order.
+      std::sort(assigned.begin(),
+                assigned.end(),
+                detail::compare_crystal_hkl(crystal_ids_.const_ref(),
+                                            miller_indices_.const_ref()));
+      std::size_t first = 0;
+      while (first < assigned.size()) {
+        const int crystal = crystal_ids_[assigned[first]];
+        const cctbx::miller::index<> hkl = miller_indices_[assigned[first]];
+        std::size_t last = first + 1;
+        while (last < assigned.size() && crystal_ids_[assigned[last]] == crystal
+               && miller_indices_[assigned[last]] == hkl) {
+          last++;
         }
-        if (it->first != curr_hkl) {
-          if (i_same_hkl.size() > 1) {
-            for (int i = 0; i < i_same_hkl.size(); i++) {
-              const std::size_t i_ref = i_same_hkl[i];
-              for (int j = i + 1; j < i_same_hkl.size(); j++) {
-                const std::size_t j_ref = i_same_hkl[j];
-                int crystal_i = crystal_ids_[i_ref];
-                int crystal_j = crystal_ids_[j_ref];
-                if (crystal_i != crystal_j) {
-                  continue;
-                } else if (crystal_i == -1) {
-                  continue;
-                }
-                double phi_i = phi[i_ref];
-                double phi_j = phi[j_ref];
-                if (std::abs(phi_i - phi_j) > pi_4) {
-                  continue;
-                }
-                if (lengths_sq[crystal_j][j_ref] < lengths_sq[crystal_i][i_ref]) {
-                  miller_indices_[i_ref] = cctbx::miller::index<>(0, 0, 0);
-                  crystal_ids_[i_ref] = -1;
-                } else {
-                  miller_indices_[j_ref] = cctbx::miller::index<>(0, 0, 0);
-                  crystal_ids_[j_ref] = -1;
-                }
-              }
+        for (std::size_t i = first; i < last; i++) {
+          const std::size_t i_ref = assigned[i];
+          for (std::size_t j = i + 1; j < last; j++) {
+            const std::size_t j_ref = assigned[j];
+            if (crystal_ids_[i_ref] == -1) {
+              break;
+            } else if (crystal_ids_[j_ref] == -1) {
+              continue;
+            }
+            if (std::abs(phi[i_ref] - phi[j_ref]) > pi_4) {
+              continue;
+            }
+            if (lengths_sq[j_ref * n_lattice + crystal]
+                < lengths_sq[i_ref * n_lattice + crystal]) {
+              miller_indices_[i_ref] = cctbx::miller::index<>(0, 0, 0);
+              crystal_ids_[i_ref] = -1;
+            } else {
+              miller_indices_[j_ref] = cctbx::miller::index<>(0, 0, 0);
+              crystal_ids_[j_ref] = -1;
             }
           }
-          curr_hkl = it->first;
-          i_same_hkl.clear();
         }
-        i_same_hkl.push_back(it->second);
+        first = last;
       }
     }
 
@@ -149,6 +174,32 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Compute the nearest hkl in each lattice for the reflections [first, last)
+     */
+    static void assign_hkl(
+      af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+      af::const_ref<scitbx::mat3<double> > const& A_inv,
+      af::ref<cctbx::miller::index<> > const& hkl_ints,
+      af::ref<double> const& lengths_sq,
+      std::size_t first,
+      std::size_t last) {
+      const std::size_t n_lattice = A_inv.size();
+      for (std::size_t i_ref = first; i_ref < last; i_ref++) {
+        scitbx::vec3<double> rlp = reciprocal_space_points[i_ref];
+        for (std::size_t i_lattice = 0; i_lattice < n_lattice; i_lattice++) {
+          scitbx::vec3<double> hkl_f = A_inv[i_lattice] * rlp;
+          cctbx::miller::index<> hkl_i;
+          for (std::size_t j = 0; j < 3; j++) {
+            hkl_i[j] = scitbx::math::iround(hkl_f[j]);
+          }
+          scitbx::vec3<double> diff = hkl_f - scitbx::vec3<double>(hkl_i);
+          hkl_ints[i_ref * n_lattice + i_lattice] = hkl_i;
+          lengths_sq[i_ref * n_lattice + i_lattice] = diff.length_sq();
+        }
+      }
+    }
+
     af::shared<cctbx::miller::index<> > miller_indices_;
     af::shared<int> crystal_ids_;
   };
@@ -171,6 +222,42 @@ namespace dials { namespace algorithms {
     std::vector<Edge>& edges;
   };
 
+  /**
+   * Find the nearest neighbours of each reciprocal space point. The result
+   * only depends on the points, so it can be computed once and passed to
+   * AssignIndicesLocal for each set of UB matrices.
+   * @param reciprocal_space_points The reciprocal space points
+   * @param nearest_neighbours The number of neighbours per point
+   * @returns The indices of the neighbours of point i in [i*k, (i+1)*k)
+   */
+  inline af::shared<std::size_t> reciprocal_space_nearest_neighbours(
+    af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+    int nearest_neighbours) {
+    using annlib_adaptbx::AnnAdaptor;
+    DIALS_ASSERT(nearest_neighbours > 0);
+
+    // convert into a single array for input to AnnAdaptor
+    // based on flex.vec_3.as_double()
+    // scitbx/array_family/boost_python/flex_vec3_double.cpp
+    af::shared<double> rlps_double(reciprocal_space_points.size() * 3,
+                                   af::init_functor_null<double>());
+    double* r = rlps_double.begin();
+    for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
+      for (std::size_t j = 0; j < 3; j++) {
+        *r++ = reciprocal_space_points[i][j];
+      }
+    }
+
+    AnnAdaptor ann = AnnAdaptor(rlps_double, 3, nearest_neighbours);
+    ann.query(rlps_double);
+
+    af::shared<std::size_t> nn(reciprocal_space_points.size() * nearest_neighbours);
+    for (std::size_t i = 0; i < nn.size(); i++) {
+      nn[i] = ann.nn[i];
+    }
+    return nn;
+  }
+
   class AssignIndicesLocal {
   public:
     AssignIndicesLocal(
@@ -180,49 +267,161 @@ namespace dials { namespace algorithms {
       const double epsilon = 0.05,
       const double delta = 5,
       const double l_min = 0.8,
-      const int nearest_neighbours = 20)
+      const int nearest_neighbours = 20,
+      std::size_t nthreads = 1)
         : miller_indices_(reciprocal_space_points.size(),
                           cctbx::miller::index<>(0, 0, 0)),
           crystal_ids_(reciprocal_space_points.size(), -1) {
       DIALS_ASSERT(reciprocal_space_points.size() == phi.size());
+      af::shared<std::size_t> nn =
+        reciprocal_space_nearest_neighbours(reciprocal_space_points, nearest_neighbours);
+      assign(reciprocal_space_points,
+             UB_matrices,
+             nn.const_ref(),
+             epsilon,
+             delta,
+             l_min,
+             nearest_neighbours,
+             nthreads);
+    }
 
-      using annlib_adaptbx::AnnAdaptor;
-      using namespace boost;
+    /**
+     * Assign indices using nearest neighbours already computed with
+     * reciprocal_space_nearest_neighbours for the same points.
+     */
+    AssignIndicesLocal(
+      af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+      af::const_ref<double> const& phi,
+      af::const_ref<scitbx::mat3<double> > const& UB_matrices,
+      af::const_ref<std::size_t> const& nn,
+      const double epsilon = 0.05,
+      const double delta = 5,
+      const double l_min = 0.8,
+      std::size_t nthreads = 1)
+        : miller_indices_(reciprocal_space_points.size(),
+                          cctbx::miller::index<>(0, 0, 0)),
+          crystal_ids_(reciprocal_space_points.size(), -1) {
+      DIALS_ASSERT(reciprocal_space_points.size() == phi.size());
+      DIALS_ASSERT(reciprocal_space_points.size() > 0);
+      DIALS_ASSERT(nn.size() % reciprocal_space_points.size() == 0);
+      assign(reciprocal_space_points,
+             UB_matrices,
+             nn,
+             epsilon,
+             delta,
+             l_min,
+             nn.size() / reciprocal_space_points.size(),
+             nthreads);
+    }
 
-      typedef adjacency_list<vecS, vecS, undirectedS, no_property, MyEdge> Graph;
+    af::shared<cctbx::miller::index<> > miller_indices() {
+      return miller_indices_;
+    }
 
-      typedef Graph::vertex_descriptor Vertex;
-      typedef graph_traits<Graph>::edge_descriptor Edge;
+    af::shared<int> crystal_ids() {
+      return crystal_ids_;
+    }
 
-      // convert into a single array for input to AnnAdaptor
-      // based on flex.vec_3.as_double()
-      // scitbx/array_family/boost_python/flex_vec3_double.cpp
-      af::shared<double> rlps_double(reciprocal_space_points.size() * 3,
-                                     af::init_functor_null<double>());
-      double* r = rlps_double.begin();
-      for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
-        for (std::size_t j = 0; j < 3; j++) {
-          *r++ = reciprocal_space_points[i][j];
+  private:
+    typedef boost::adjacency_list<boost::vecS,
+                                  boost::vecS,
+                                  boost::undirectedS,
+                                  boost::no_property,
+                                  MyEdge>
+      Graph;
+    typedef Graph::vertex_descriptor Vertex;
+    typedef boost::graph_traits<Graph>::edge_descriptor Edge;
+
+    // The assignment parameters, grouped so that assign_lattices stays within
+    // the argument limit of boost::bind
+    struct AssignParameters {
+      double epsilon;
+      double delta;
+      double l_min;
+      std::size_t nearest_neighbours;
+    };
+
+    void assign(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+                af::const_ref<scitbx::mat3<double> > const& UB_matrices,
+                af::const_ref<std::size_t> const& nn,
+                double epsilon,
+                double delta,
+                double l_min,
+                std::size_t nearest_neighbours,
+                std::size_t nthreads) {
+      const std::size_t n_ref = reciprocal_space_points.size();
+      const std::size_t n_lattice = UB_matrices.size();
+
+      // assign the hkl of the largest subtree of each lattice in parallel
+      af::shared<cctbx::miller::index<> > hkl_ints(n_ref * n_lattice);
+      af::shared<bool> in_largest_subtree(n_ref * n_lattice, false);
+      AssignParameters params = {epsilon, delta, l_min, nearest_neighbours};
+      detail::parallel_bands(boost::bind(&AssignIndicesLocal::assign_lattices,
+                                         reciprocal_space_points,
+                                         UB_matrices,
+                                         nn,
+                                         params,
+                                         hkl_ints.ref(),
+                                         in_largest_subtree.ref(),
+                                         _1,
+                                         _2),
+                             n_lattice,
+                             nthreads);
+
+      // combine the lattices in order, rejecting reflections claimed by more
+      // than one lattice
+      for (std::size_t i_lattice = 0; i_lattice < n_lattice; i_lattice++) {
+        const std::size_t offset = i_lattice * n_ref;
+        for (std::size_t i = 0; i < n_ref; i++) {
+          if (!in_largest_subtree[offset + i]) {
+            continue;
+          } else if (crystal_ids_[i] == -2) {
+            continue;
+          } else if (crystal_ids_[i] == -1) {
+            miller_indices_[i] = hkl_ints[offset + i];
+            crystal_ids_[i] = i_lattice;
+          } else {
+            crystal_ids_[i] = -2;
+            miller_indices_[i] = cctbx::miller::index<>(0, 0, 0);
+          }
         }
       }
+    }
 
-      AnnAdaptor ann = AnnAdaptor(rlps_double, 3, nearest_neighbours);
-      ann.query(rlps_double);
+    /**
+     * Assign indices for the lattices [first, last), writing the hkl of each
+     * reflection and whether it is in the largest subtree into the rows of
+     * hkl_ints and in_largest_subtree for each lattice
+     */
+    static void assign_lattices(
+      af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+      af::const_ref<scitbx::mat3<double> > const& UB_matrices,
+      af::const_ref<std::size_t> const& nn,
+      AssignParameters const& params,
+      af::ref<cctbx::miller::index<> > const& hkl_ints,
+      af::ref<bool> const& in_largest_subtree,
+      std::size_t first,
+      std::size_t last) {
+      using namespace boost;
 
+      const double epsilon = params.epsilon;
+      const double delta = params.delta;
+      const double l_min = params.l_min;
+      const std::size_t nearest_neighbours = params.nearest_neighbours;
+      const std::size_t n_ref = reciprocal_space_points.size();
       const double one_over_epsilon = 1.0 / epsilon;
 
-      // loop over crystals and assign one hkl per crystal per reflection
-      for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
+      for (std::size_t i_lattice = first; i_lattice < last; i_lattice++) {
         scitbx::mat3<double> const& A = UB_matrices[i_lattice];
         scitbx::mat3<double> const& A_inv = A.inverse();
 
-        Graph G(reciprocal_space_points.size());
+        Graph G(n_ref);
 
-        for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
+        for (std::size_t i = 0; i < n_ref; i++) {
           std::size_t i_k = i * nearest_neighbours;
           for (std::size_t i_ann = 0; i_ann < nearest_neighbours; i_ann++) {
             std::size_t i_k_plus_i_ann = i_k + i_ann;
-            std::size_t j = ann.nn[i_k_plus_i_ann];
+            std::size_t j = nn[i_k_plus_i_ann];
             if (boost::edge(i, j, G).second) {
               continue;
             }
@@ -266,7 +465,7 @@ namespace dials { namespace algorithms {
           G, &p[0], boost::weight_map(boost::get(&MyEdge::l_ij, G)));
 
         // create a graph for the MST
-        Graph MST(reciprocal_space_points.size());
+        Graph MST(n_ref);
 
         // add all the edges to the MST
         for (size_t i = 0; i < p.size(); ++i) {
@@ -304,8 +503,8 @@ namespace dials { namespace algorithms {
         // edge weight l_ij >= l_min, or if we start a new component
         std::size_t next_subtree = 0;
         int last_component = -1;
-        af::shared<std::size_t> subtree_ids_(reciprocal_space_points.size(), 0);
-        af::shared<cctbx::miller::index<> > hkl_ints_(reciprocal_space_points.size());
+        af::shared<std::size_t> subtree_ids_(n_ref, 0);
+        af::shared<cctbx::miller::index<> > hkl_ints_(n_ref);
 
         for (std::vector<Edge>::iterator it = ordered_edges.begin();
              it != ordered_edges.end();
@@ -347,33 +546,15 @@ namespace dials { namespace algorithms {
           }
         }
 
-        for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
-          if (subtree_ids_[i] != largest_subtree_id) {
-            continue;
-          } else if (crystal_ids_[i] == -2) {
-            continue;
-          } else if (crystal_ids_[i] == -1) {
-            miller_indices_[i] = hkl_ints_[i];
-            crystal_ids_[i] = i_lattice;
-          } else {
-            crystal_ids_[i] = -2;
-            miller_indices_[i] = cctbx::miller::index<>(0, 0, 0);
-          }
+        const std::size_t offset = i_lattice * n_ref;
+        for (std::size_t i = 0; i < n_ref; i++) {
+          hkl_ints[offset + i] = hkl_ints_[i];
+          in_largest_subtree[offset + i] = (subtree_ids_[i] == largest_subtree_id);
         }
       }
     }
 
-    af::shared<cctbx::miller::index<> > miller_indices() {
-      return miller_indices_;
-    }
-
-    af::shared<int> crystal_ids() {
-      return crystal_ids_;
-    }
-
-  private:
     af::shared<cctbx::miller::index<> > miller_indices_;
-    af::shared<std::size_t> subtree_ids_;
     af::shared<int> crystal_ids_;
   };
 
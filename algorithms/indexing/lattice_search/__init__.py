@@ -324,6 +324,7 @@ def __init__(self, reflections, experiments, params=None):
             min_cell=self.params.min_cell,
             target_unit_cell=target_unit_cell,
             params=getattr(self.params, entry_point.name),
+            nproc=self.params.nproc,
         )
 
     def find_candidate_basis_vectors(self):
@@ -0,0 +1,97 @@
+/*
+ * score_vectors.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INDEXING_SCORE_VECTORS_H
+#define DIALS_ALGORITHMS_INDEXING_SCORE_VECTORS_H
+
+#include <algorithm>
+#include <cmath>
+#include <boost/bind.hpp>
+#include <scitbx/vec3.h>
+#include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::vec3;
+
+  namespace detail {
+
+    // The number of reciprocal lattice points scored against each vector at a
+    // time, small enough that a block stays in cache across the vectors
+    const std::size_t score_vectors_block_size = 4096;
+
+    /**
+     * Add the functional of the vectors [first, last) for the points stored
+     * as separate x, y, z arrays already multiplied by 2 pi
+     */
+    inline void score_vectors_bands(af::const_ref<vec3<double> > const& vectors,
+                                    af::const_ref<double> const& x,
+                                    af::const_ref<double> const& y,
+                                    af::const_ref<double> const& z,
+                                    af::ref<double> const& scores,
+                                    std::size_t first,
+                                    std::size_t last) {
+      const std::size_t n = x.size();
+      for (std::size_t block = 0; block < n; block += score_vectors_block_size) {
+        const std::size_t block_end = std::min(block + score_vectors_block_size, n);
+        for (std::size_t i = first; i < last; i++) {
+          const double vx = vectors[i][0];
+          const double vy = vectors[i][1];
+          const double vz = vectors[i][2];
+          double sum = 0;
+          for (std::size_t j = block; j < block_end; j++) {
+            sum += std::cos(x[j] * vx + y[j] * vy + z[j] * vz);
+          }
+          scores[i] += sum;
+        }
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * Score candidate basis vectors against the reciprocal lattice points.
+   * The score of a vector v is sum(cos(2 pi S.v)) over the points S, which
+   * is largest when v is a real space lattice vector.
+   * @param vectors The candidate vectors
+   * @param reciprocal_lattice_points The reciprocal lattice points
+   * @param nthreads The number of threads
+   * @returns The score of each vector
+   */
+  inline af::shared<double> score_vectors(
+    af::const_ref<vec3<double> > const& vectors,
+    af::const_ref<vec3<double> > const& reciprocal_lattice_points,
+    std::size_t nthreads = 1) {
+    const double two_pi = 2 * scitbx::constants::pi;
+    const std::size_t n = reciprocal_lattice_points.size();
+    af::shared<double> x(n, af::init_functor_null<double>());
+    af::shared<double> y(n, af::init_functor_null<double>());
+    af::shared<double> z(n, af::init_functor_null<double>());
+    for (std::size_t j = 0; j < n; j++) {
+      x[j] = two_pi * reciprocal_lattice_points[j][0];
+      y[j] = two_pi * reciprocal_lattice_points[j][1];
+      z[j] = two_pi * reciprocal_lattice_points[j][2];
+    }
+    af::shared<double> scores(vectors.size(), 0);
+    detail::parallel_bands(boost::bind(&detail::score_vectors_bands,
+                                       vectors,
+                                       x.const_ref(),
+                                       y.const_ref(),
+                                       z.const_ref(),
+                                       scores.ref(),
+                                       _1,
+                                       _2),
+                           vectors.size(),
+                           nthreads);
+    return scores;
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INDEXING_SCORE_VECTORS_H
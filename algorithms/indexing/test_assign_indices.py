@@ -244,3 +244,60 @@ def test_index_reflections(dials_regression):
     assert "miller_index" in reflections
     counts = reflections["id"].counts()
     assert dict(counts) == {-1: 1390, 0: 114692}
+
+
+def test_assign_indices_duplicates_and_nthreads():
+    from dials.algorithms.indexing import assign_indices
+
+    A1 = matrix.sqr((0.02, 0, 0, 0, 0.025, 0, 0, 0, 0.03))
+    A2 = euler_angles_as_matrix((10, 20, 30), deg=True) * A1
+    UB_matrices = flex.mat3_double([A1.elems, A2.elems])
+
+    # two spots close to (1,2,3) in the first lattice, one much closer than
+    # the other, and one close to (1,2,3) in the second lattice
+    rlps = flex.vec3_double(
+        [
+            (A1 * matrix.col((1.01, 2, 3))).elems,
+            (A1 * matrix.col((1.15, 2, 3))).elems,
+            (A2 * matrix.col((1, 2.01, 3))).elems,
+        ]
+    )
+    phi = flex.double(len(rlps), 0)
+    result = assign_indices.ext.AssignIndices(rlps, phi, UB_matrices, tolerance=0.3)
+    assert list(result.miller_indices()) == [(1, 2, 3), (0, 0, 0), (1, 2, 3)]
+    assert list(result.crystal_ids()) == [0, -1, 1]
+
+    # the result doesn't depend on the number of threads
+    random.seed(0)
+    rlps = flex.vec3_double(
+        [tuple(random.uniform(-0.3, 0.3) for _ in range(3)) for _ in range(2000)]
+    )
+    phi = flex.double([random.uniform(0, 3) for _ in range(len(rlps))])
+    expected = assign_indices.ext.AssignIndices(rlps, phi, UB_matrices)
+    result = assign_indices.ext.AssignIndices(rlps, phi, UB_matrices, nthreads=4)
+    assert list(result.miller_indices()) == list(expected.miller_indices())
+    assert result.crystal_ids().all_eq(expected.crystal_ids())
+
+
+def test_assign_indices_local_reuse_nearest_neighbours():
+    from dials.algorithms.indexing import assign_indices
+
+    A1 = matrix.sqr((0.02, 0, 0, 0, 0.025, 0, 0, 0, 0.03))
+    A2 = euler_angles_as_matrix((10, 20, 30), deg=True) * A1
+    UB_matrices = flex.mat3_double([A1.elems, A2.elems])
+    hkl = flex.vec3_double(
+        [(h, k, l) for h in range(-5, 6) for k in range(-5, 6) for l in range(1, 6)]
+    )
+    rlps = A1.elems * hkl
+    rlps.extend(A2.elems * hkl)
+    phi = flex.double(len(rlps), 0)
+
+    expected = assign_indices.ext.AssignIndicesLocal(rlps, phi, UB_matrices)
+    nn = assign_indices.ext.reciprocal_space_nearest_neighbours(rlps, 20)
+    assert len(nn) == 20 * len(rlps)
+    for nthreads in (1, 2):
+        result = assign_indices.ext.AssignIndicesLocal(
+            rlps, phi, UB_matrices, nn=nn, nthreads=nthreads
+        )
+        assert list(result.miller_indices()) == list(expected.miller_indices())
+        assert result.crystal_ids().all_eq(expected.crystal_ids())
@@ -17,6 +17,7 @@
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
@@ -39,6 +40,7 @@
 
 #include <dials/algorithms/integration/fit/fitting.h>
 #include <dials/algorithms/integration/interfaces.h>
+#include <dials/util/thread_local.h>
 
 namespace dials { namespace algorithms {
 
@@ -52,12 +54,52 @@ namespace dials { namespace algorithms {
   using dials::algorithms::background::SimpleBackgroundCreator;
   using dials::algorithms::profile_model::gaussian_rs::CoordinateSystem;
   using dials::algorithms::profile_model::gaussian_rs::MaskCalculator3D;
+  using dials::algorithms::profile_model::gaussian_rs::MaskScratch;
+  using dials::algorithms::profile_model::gaussian_rs::PixelDirectionTable;
+  using dials::algorithms::profile_model::gaussian_rs::transform::SparseProfile;
   using dials::algorithms::profile_model::gaussian_rs::transform::TransformForward;
   using dials::algorithms::profile_model::gaussian_rs::transform::TransformReverse;
   using dials::algorithms::profile_model::gaussian_rs::transform::
     TransformReverseNoModel;
   using dials::algorithms::profile_model::gaussian_rs::transform::TransformSpec;
 
+  namespace detail {
+
+    /**
+     * Bucket a batch of reflections by experiment id with a counting sort, so
+     * that the reflections of each experiment can be processed together with
+     * the same model data. Reflections with an invalid experiment id are put
+     * in an extra bucket at the end.
+     * @param reflections The reflection objects
+     * @param num_experiments The number of experiments
+     * @param offsets The offset of each bucket in the order
+     * @param order The reflection indices in bucket order, and within a bucket
+     *  in their original order
+     */
+    inline void bucket_by_experiment(const std::vector<af::Reflection> &reflections,
+                                     std::size_t num_experiments,
+                                     std::vector<std::size_t> &offsets,
+                                     std::vector<std::size_t> &order) {
+      std::vector<std::size_t> experiment(reflections.size());
+      offsets.assign(num_experiments + 2, 0);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        int index = reflections[i].get<int>("id");
+        bool valid = index >= 0 && (std::size_t)index < num_experiments;
+        experiment[i] = valid ? index : num_experiments;
+        offsets[experiment[i] + 1]++;
+      }
+      for (std::size_t e = 0; e <= num_experiments; ++e) {
+        offsets[e + 1] += offsets[e];
+      }
+      std::vector<std::size_t> position(offsets.begin(), offsets.end() - 1);
+      order.resize(reflections.size());
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        order[position[experiment[i]]++] = i;
+      }
+    }
+
+  }  // namespace detail
+
   /**
    * A class to calculate the reflection mask
    */
@@ -88,11 +130,56 @@ namespace dials { namespace algorithms {
      * @param adjacent Is this an adjacent relfection?
      */
     virtual void operator()(af::Reflection &reflection, bool adjacent = false) const {
+      compute(reflection, adjacent);
+    }
+
+    /**
+     * Compute the mask for a batch of reflections
+     * @param reflections The reflection objects
+     * @param adjacent Are these adjacent relfections?
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       bool adjacent = false) const {
+      MaskScratch scratch;
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        compute(reflections[i], adjacent, scratch);
+      }
+    }
+
+    /**
+     * Use a table of pixel corner directions instead of computing them for
+     * each reflection
+     * @param table The pixel direction table for the detector or NULL
+     */
+    void set_pixel_direction_table(boost::shared_ptr<PixelDirectionTable> table) {
+      func_.set_pixel_direction_table(table);
+    }
+
+    /**
+     * Compute the mask for a single reflection without a virtual call
+     * @param reflection The reflection object
+     * @param adjacent Is this an adjacent relfection?
+     */
+    void compute(af::Reflection &reflection, bool adjacent) const {
+      MaskScratch scratch;
+      compute(reflection, adjacent, scratch);
+    }
+
+    /**
+     * Compute the mask for a single reflection using the given scratch space
+     * @param reflection The reflection object
+     * @param adjacent Is this an adjacent relfection?
+     * @param scratch The scratch space
+     */
+    void compute(af::Reflection &reflection,
+                 bool adjacent,
+                 MaskScratch &scratch) const {
       func_.single(reflection.get<Shoebox<> >("shoebox"),
                    reflection.get<vec3<double> >("s1"),
                    reflection.get<vec3<double> >("xyzcal.px")[2],
                    reflection.get<std::size_t>("panel"),
-                   adjacent);
+                   adjacent,
+                   scratch);
     }
 
   protected:
@@ -122,7 +209,29 @@ namespace dials { namespace algorithms {
     virtual void operator()(af::Reflection &reflection, bool adjacent = false) const {
       int index = reflection.get<int>("id");
       DIALS_ASSERT(index >= 0 && index < algorithms_.size());
-      algorithms_[index](reflection, adjacent);
+      algorithms_[index].compute(reflection, adjacent);
+    }
+
+    /**
+     * Compute the mask for a batch of reflections
+     * @param reflections The reflection objects
+     * @param adjacent Are these adjacent relfections?
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       bool adjacent = false) const {
+      // Bucket the reflections by experiment so that each calculator is used
+      // for all its reflections in turn
+      std::vector<std::size_t> offsets;
+      std::vector<std::size_t> order;
+      detail::bucket_by_experiment(reflections, algorithms_.size(), offsets, order);
+      DIALS_ASSERT(offsets[algorithms_.size()] == reflections.size());
+      MaskScratch scratch;
+      for (std::size_t e = 0; e < algorithms_.size(); ++e) {
+        const GaussianRSMaskCalculator &algorithm = algorithms_[e];
+        for (std::size_t j = offsets[e]; j < offsets[e + 1]; ++j) {
+          algorithm.compute(reflections[order[j]], adjacent, scratch);
+        }
+      }
     }
 
   protected:
@@ -155,6 +264,24 @@ namespace dials { namespace algorithms {
       creator_(reflection.get<Shoebox<> >("shoebox"));
     }
 
+
+    /**
+     * Compute the background for a batch of reflections
+     * @param reflections The reflection objects
+     * @param success Set to False for reflections whose background failed
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       std::vector<bool> &success) const {
+      success.assign(reflections.size(), true);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        try {
+          creator_(reflections[i].get<Shoebox<> >("shoebox"));
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
+
   protected:
     SimpleBackgroundCreator creator_;
   };
@@ -187,6 +314,24 @@ namespace dials { namespace algorithms {
       creator_.single(reflection.get<Shoebox<> >("shoebox"));
     }
 
+
+    /**
+     * Compute the background for a batch of reflections
+     * @param reflections The reflection objects
+     * @param success Set to False for reflections whose background failed
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       std::vector<bool> &success) const {
+      success.assign(reflections.size(), true);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        try {
+          creator_.single(reflections[i].get<Shoebox<> >("shoebox"));
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
+
   protected:
     GLMBackgroundCreator creator_;
   };
@@ -217,6 +362,24 @@ namespace dials { namespace algorithms {
       creator_.single(reflection.get<Shoebox<> >("shoebox"));
     }
 
+
+    /**
+     * Compute the background for a batch of reflections
+     * @param reflections The reflection objects
+     * @param success Set to False for reflections whose background failed
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       std::vector<bool> &success) const {
+      success.assign(reflections.size(), true);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        try {
+          creator_.single(reflections[i].get<Shoebox<> >("shoebox"));
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
+
   protected:
     GModelBackgroundCreator creator_;
   };
@@ -234,6 +397,51 @@ namespace dials { namespace algorithms {
     virtual void operator()(
       af::Reflection &reflection,
       const std::vector<af::Reflection> &adjacent_reflections) const {}
+
+    /**
+     * Do nothing for the whole batch
+     */
+    virtual void batch(
+      std::vector<af::Reflection> &reflections,
+      const std::vector<std::vector<af::Reflection> > &adjacent_reflections,
+      std::vector<bool> &success) const {
+      success.assign(reflections.size(), true);
+    }
+  };
+
+  /**
+   * A class implementing the intensity calculator interface by bayesian
+   * integration of the summed counts. This replaces the summed intensity of
+   * each reflection and is intended for very weak data, where there are too
+   * few counts to fit profiles.
+   */
+  class BayesianIntensityCalculator : public IntensityCalculatorIface {
+  public:
+    ~BayesianIntensityCalculator() {}
+
+    /**
+     * Compute the intensity of the reflection
+     * @param reflection The reflection object
+     * @param adjacent_reflections The adjacent reflections list
+     */
+    virtual void operator()(
+      af::Reflection &reflection,
+      const std::vector<af::Reflection> &adjacent_reflections) const {
+      using dials::model::Intensity;
+      Intensity intensity = reflection.get<Shoebox<> >("shoebox").bayesian_intensity();
+      reflection["intensity.sum.value"] = intensity.observed.value;
+      reflection["intensity.sum.variance"] = intensity.observed.variance;
+      reflection["background.sum.value"] = intensity.background.value;
+      reflection["background.sum.variance"] = intensity.background.variance;
+      std::size_t flags = reflection.get<std::size_t>("flags");
+      flags &= ~(af::IntegratedSum | af::FailedDuringSummation);
+      if (intensity.observed.success) {
+        flags |= af::IntegratedSum;
+      } else {
+        flags |= af::FailedDuringSummation;
+      }
+      reflection["flags"] = flags;
+    }
   };
 
   /**
@@ -380,6 +588,38 @@ namespace dials { namespace algorithms {
     virtual void exec(
       af::Reflection &reflection,
       const std::vector<af::Reflection> &adjacent_reflections) const = 0;
+
+    /**
+     * Compute the intensity for a batch of reflections. The reflections of
+     * each experiment are done together so that its reference profiles stay
+     * in cache.
+     * @param reflections The reflection objects
+     * @param adjacent_reflections The adjacent reflections of each reflection
+     * @param success Set to False for reflections whose intensity failed
+     */
+    virtual void batch(
+      std::vector<af::Reflection> &reflections,
+      const std::vector<std::vector<af::Reflection> > &adjacent_reflections,
+      std::vector<bool> &success) const {
+      DIALS_ASSERT(adjacent_reflections.size() == reflections.size());
+      success.assign(reflections.size(), true);
+      std::vector<std::size_t> offsets;
+      std::vector<std::size_t> order;
+      detail::bucket_by_experiment(reflections, num_experiments(), offsets, order);
+      for (std::size_t j = 0; j < order.size(); ++j) {
+        std::size_t i = order[j];
+        try {
+          exec(reflections[i], adjacent_reflections[i]);
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
+
+    /**
+     * @returns The number of experiments with reference profiles
+     */
+    virtual std::size_t num_experiments() const = 0;
   };
 
   /**
@@ -396,6 +636,13 @@ namespace dials { namespace algorithms {
       const GaussianRSMultiCrystalReferenceProfileData &data)
         : data_spec_(data) {}
 
+    /**
+     * @returns The number of experiments with reference profiles
+     */
+    virtual std::size_t num_experiments() const {
+      return data_spec_.size();
+    }
+
     /**
      * Compute the intensity
      * @param reflection The reflection object
@@ -458,28 +705,19 @@ namespace dials { namespace algorithms {
                                          background.const_ref(),
                                          mask.const_ref());
 
-      // Get the transformed shoebox
-      data_const_reference transformed_data = transform.profile().const_ref();
-      data_const_reference transformed_bgrd = transform.background().const_ref();
-      mask_const_reference transformed_mask = transform.mask().const_ref();
-      af::versa<bool, af::c_grid<3> > final_mask(transformed_mask.accessor());
-      DIALS_ASSERT(reference_mask.size() == transformed_mask.size());
-      std::size_t mask_count = 0;
-      for (std::size_t j = 0; j < final_mask.size(); ++j) {
-        final_mask[j] = reference_mask[j] && transformed_mask[j];
-        if (final_mask[j]) {
-          mask_count++;
-        }
-      }
-      if (mask_count == 0) {
+      // Get the grid points in both the transformed shoebox and the reference
+      SparseProfile<double> transformed = transform.sparse(reference_mask);
+      if (transformed.index.size() == 0) {
         throw DIALS_ERROR("No pixels mapped to reciprocal space grid");
       }
+      af::shared<double> reference = transformed.gather(reference_data);
+      af::shared<bool> final_mask(transformed.index.size(), true);
 
       // Do the profile fitting
-      ProfileFitter<double> fit(transformed_data,
-                                transformed_bgrd,
+      ProfileFitter<double> fit(transformed.profile.const_ref(),
+                                transformed.background.const_ref(),
                                 final_mask.const_ref(),
-                                reference_data,
+                                reference.const_ref(),
                                 1e-3,
                                 100);
       DIALS_ASSERT(fit.niter() < 100);
@@ -543,6 +781,13 @@ namespace dials { namespace algorithms {
       const GaussianRSMultiCrystalReferenceProfileData &data)
         : data_spec_(data) {}
 
+    /**
+     * @returns The number of experiments with reference profiles
+     */
+    virtual std::size_t num_experiments() const {
+      return data_spec_.size();
+    }
+
     /**
      * Compute the intensity
      * @param reflection The reflection object
@@ -730,13 +975,17 @@ namespace dials { namespace algorithms {
       vec3<double> s0 = data_spec.spec().beam()->get_s0();
       CoordinateSystem cs(m2, s0, s1, phi);
 
-      // Compute the transform
-      TransformReverse transform(
-        data_spec.spec(), cs, sbox.bbox, sbox.panel, transformed_reference_data);
-
-      // Get the transformed shoebox
-      data_const_reference reference_data = transform.profile().const_ref();
-      std::copy(reference_data.begin(), reference_data.end(), profile.begin());
+      // Compute the transform straight into the profile grid, reusing the
+      // work arrays of the transform for the adjacent reflections
+      TransformReverse transform;
+      af::ref<double, af::c_grid<3> > reference_data(profile.begin(),
+                                                     data.accessor());
+      transform.compute(data_spec.spec(),
+                        cs,
+                        sbox.bbox,
+                        sbox.panel,
+                        transformed_reference_data,
+                        reference_data);
 
       // Compute partiality
       double partiality = compute_partiality(reference_data, mask.const_ref());
@@ -761,17 +1010,15 @@ namespace dials { namespace algorithms {
         vec3<double> s02 = data_spec2.spec().beam()->get_s0();
         CoordinateSystem cs2(m22, s02, s12, phi2);
 
-        // Compute the transform
-        TransformReverse transform(
-          data_spec2.spec(), cs2, sbox.bbox, sbox.panel, transformed_reference_data);
-
-        // Get the transformed shoebox
-        data_const_reference reference_data2 = transform.profile().const_ref();
-
-        // Copy into the large profile grid
-        std::copy(reference_data2.begin(),
-                  reference_data2.end(),
-                  profile.begin() + (j + 1) * reference_data2.size());
+        // Compute the transform into the large profile grid
+        transform.compute(data_spec2.spec(),
+                          cs2,
+                          sbox.bbox,
+                          sbox.panel,
+                          transformed_reference_data,
+                          af::ref<double, af::c_grid<3> >(
+                            profile.begin() + (j + 1) * reference_data.size(),
+                            data.accessor()));
       }
 
       try {
@@ -877,6 +1124,19 @@ namespace dials { namespace algorithms {
       algorithm_->exec(reflection, adjacent_reflections);
     }
 
+    /**
+     * Perform the integration for a batch of reflections
+     * @param reflections The reflection objects
+     * @param adjacent_reflections The adjacent reflections of each reflection
+     * @param success Set to False for reflections whose intensity failed
+     */
+    virtual void batch(
+      std::vector<af::Reflection> &reflections,
+      const std::vector<std::vector<af::Reflection> > &adjacent_reflections,
+      std::vector<bool> &success) const {
+      algorithm_->batch(reflections, adjacent_reflections, success);
+    }
+
   protected:
     boost::shared_ptr<GaussianRSIntensityCalculatorAlgorithm> algorithm_;
   };
@@ -898,27 +1158,86 @@ namespace dials { namespace algorithms {
      * @param threshold The threshold for counts
      */
     ThreadSafeEmpiricalProfileModeller(std::size_t n, int3 datasize, double threshold)
-        : EmpiricalProfileModeller(n, datasize, threshold) {
-      for (std::size_t i = 0; i < n; ++i) {
-        mutex_.push_back(boost::make_shared<boost::mutex>());
-      }
-    }
+        : EmpiricalProfileModeller(n, datasize, threshold),
+          threads_(boost::make_shared<ThreadModellers>()) {}
 
     /**
-     * Add a profile with indices and weights
+     * Add a profile with indices and weights. The profile is added to the
+     * modeller of the calling thread so no lock is needed.
      * @param index The index of the profile to add to
      * @param weight The weight to give the profile
      * @param profile The profile data
      */
     void add_single(std::size_t index, double weight, data_const_reference profile) {
-      DIALS_ASSERT(index < mutex_.size());
-      DIALS_ASSERT(mutex_[index] != NULL);
-      boost::lock_guard<boost::mutex> guard(*mutex_[index]);
-      EmpiricalProfileModeller::add_single(index, weight, profile);
+      DIALS_ASSERT(index < size());
+      local().add_single(index, weight, profile);
+    }
+
+    /**
+     * Add the profiles from the modellers of each thread to this one and
+     * clear them. This must not be called while other threads are adding
+     * profiles.
+     */
+    void reduce() {
+      boost::lock_guard<boost::mutex> guard(threads_->mutex);
+      for (std::size_t i = 0; i < threads_->modellers.size(); ++i) {
+        EmpiricalProfileModeller &modeller = threads_->modellers[i];
+        bool empty = true;
+        for (std::size_t j = 0; j < modeller.size() && empty; ++j) {
+          empty = !modeller.valid(j);
+        }
+        if (!empty) {
+          accumulate_raw_pointer(&modeller);
+          modeller = EmpiricalProfileModeller(size(), datasize(), threshold());
+        }
+      }
+    }
+
+    /**
+     * Reduce the profiles from each thread and finalize the profiles
+     */
+    void finalize() {
+      finalize(1);
+    }
+
+    /**
+     * Reduce the profiles from each thread and finalize the profiles in
+     * parallel
+     * @param nthreads The number of threads
+     */
+    void finalize(std::size_t nthreads) {
+      reduce();
+      EmpiricalProfileModeller::finalize(nthreads);
     }
 
   protected:
-    af::shared<boost::shared_ptr<boost::mutex> > mutex_;
+    /**
+     * The modellers of the threads. These are shared between copies of the
+     * modeller, as the profiles are. Each modeller is allocated separately
+     * so the threads do not write to the same cache lines.
+     */
+    struct ThreadModellers {
+      dials::util::ThreadLocalPtr<EmpiricalProfileModeller> local;
+      boost::mutex mutex;
+      boost::ptr_vector<EmpiricalProfileModeller> modellers;
+    };
+
+    /**
+     * @returns The modeller of the calling thread
+     */
+    EmpiricalProfileModeller &local() {
+      EmpiricalProfileModeller *modeller = threads_->local.get();
+      if (modeller == NULL) {
+        boost::lock_guard<boost::mutex> guard(threads_->mutex);
+        threads_->modellers.push_back(
+          new EmpiricalProfileModeller(size(), datasize(), threshold()));
+        modeller = &threads_->modellers.back();
+        threads_->local.reset(modeller);
+      }
+      return *modeller;
+    }
+
+    boost::shared_ptr<ThreadModellers> threads_;
   };
 
   /**
@@ -1019,14 +1338,11 @@ namespace dials { namespace algorithms {
                                            mask.const_ref());
 
         // Get the indices and weights of the profiles
-        af::shared<std::size_t> indices = sampler_->nearest_n(sbox.panel, xyzpx);
-        for (std::size_t j = 0; j < indices.size(); ++j) {
-          // Get the weighting
-          double weight = sampler_->weight(indices[j], sbox.panel, xyzpx);
-
-          // Add the profile
+        SamplerNeighbours nearest;
+        sampler_->nearest_n_weights(sbox.panel, xyzpx, nearest);
+        for (std::size_t j = 0; j < nearest.size; ++j) {
           modeller_[experiment_id].add_single(
-            indices[j], weight, transform.profile().const_ref());
+            nearest.index[j], nearest.weight[j], transform.profile().const_ref());
         }
 
         // Set the flags
@@ -1044,7 +1360,19 @@ namespace dials { namespace algorithms {
     void accumulate(const GaussianRSReferenceCalculator &other) {
       DIALS_ASSERT(modeller_.size() == other.modeller_.size());
       for (std::size_t i = 0; i < modeller_.size(); ++i) {
-        modeller_[i].accumulate_raw_pointer(&other.modeller_[i]);
+        ThreadSafeEmpiricalProfileModeller other_modeller = other.modeller_[i];
+        other_modeller.reduce();
+        modeller_[i].reduce();
+        modeller_[i].accumulate_raw_pointer(&other_modeller);
+      }
+    }
+
+    /**
+     * Add the profiles from each thread to the profile modellers
+     */
+    virtual void reduce() {
+      for (std::size_t i = 0; i < modeller_.size(); ++i) {
+        modeller_[i].reduce();
       }
     }
 
@@ -1105,6 +1433,9 @@ namespace dials { namespace algorithms {
       // Check we're fully recorded
       bool full = partiality > 0.99;
 
+      // Check the reflection was selected for modelling
+      bool reference = flags & af::ReferenceSpot;
+
       // Check reflection has been integrated
       bool integrated = flags & af::IntegratedSum;
 
@@ -1127,7 +1458,7 @@ namespace dials { namespace algorithms {
       }
 
       // Return whether to use or not
-      return full && integrated && bbox_valid && pixels_valid;
+      return full && reference && integrated && bbox_valid && pixels_valid;
     }
 
     boost::shared_ptr<SamplerIface> sampler_;
@@ -4,8 +4,8 @@
 class IntegrationAlgorithm(object):
     """A class to perform bayesian integration"""
 
-    def __init__(self, **kwargs):
-        pass
+    def __init__(self, nthreads=1, **kwargs):
+        self.nthreads = nthreads
 
     def __call__(self, reflections, image_volume=None):
         """Process the reflections.
@@ -15,7 +15,7 @@ def __call__(self, reflections, image_volume=None):
         """
         # Integrate and return the reflections
         if image_volume is None:
-            intensity = reflections["shoebox"].bayesian_summation_intensity()
+            intensity = reflections["shoebox"].bayesian_intensity(nthreads=self.nthreads)
         else:
             raise RuntimeError("Image volume not supported at the moment")
         reflections["intensity.sum.value"] = intensity.observed_value()
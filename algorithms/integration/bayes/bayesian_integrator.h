@@ -12,6 +12,7 @@
 #define DIALS_ALGORITHMS_INTEGRATION_BAYESIAN_INTEGRATOR_H
 
 #include <algorithm>
+#include <cmath>
 #include <boost/math/special_functions/gamma.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/tiny_algebra.h>
@@ -29,6 +30,75 @@ namespace dials { namespace algorithms {
   using scitbx::af::int6;
   using scitbx::af::sqrt;
 
+  namespace detail {
+
+    /**
+     * A table of log(n!) for small integer counts
+     */
+    class LogFactorialTable {
+    public:
+      enum { size = 1024 };
+
+      LogFactorialTable() {
+        table_[0] = 0.0;
+        for (std::size_t n = 1; n < size; ++n) {
+          table_[n] = table_[n - 1] + std::log((double)n);
+        }
+      }
+
+      double operator[](std::size_t n) const {
+        return table_[n];
+      }
+
+    private:
+      double table_[size];
+    };
+
+    inline const LogFactorialTable &log_factorial_table() {
+      static const LogFactorialTable table;
+      return table;
+    }
+
+    /**
+     * Compute the regularized upper incomplete gamma function Q(C + 1, B),
+     * which is the probability that a poisson variable with mean B is at
+     * most C. For small integer counts this is the sum of the poisson
+     * probabilities, summed from the largest term using the log factorial
+     * table; otherwise boost's gamma_q is used.
+     * @param C The total counts
+     * @param B The total background
+     */
+    inline double poisson_cdf(double C, double B) {
+      const LogFactorialTable &log_factorial = log_factorial_table();
+      if (!(C >= 0 && C < LogFactorialTable::size && C == std::floor(C) && B >= 0)) {
+        return boost::math::gamma_q(C + 1, B);
+      }
+      if (B == 0) {
+        return 1.0;
+      }
+      std::size_t n = (std::size_t)C;
+      if (B >= n) {
+        // The terms decrease from k = n down to k = 0
+        double term = std::exp(n * std::log(B) - B - log_factorial[n]);
+        double sum = term;
+        for (std::size_t k = n; k > 0; --k) {
+          term *= k / B;
+          sum += term;
+        }
+        return std::min(sum, 1.0);
+      }
+      // The terms increase from k = 0 towards k = B
+      double term = std::exp(-B);
+      double sum = term;
+      for (std::size_t k = 1; k <= n; ++k) {
+        term *= B / k;
+        sum += term;
+      }
+      return std::min(sum, 1.0);
+    }
+
+  }  // namespace detail
+
   /**
    * Class to sum the intensity in 3D
    */
@@ -75,10 +145,7 @@ namespace dials { namespace algorithms {
      * @returns The reflection intensity
      */
     FloatType intensity() const {
-      using boost::math::gamma_q;
-      double C = sum_p_;
-      double B = sum_b_;
-      return gamma_q(C + 1, B) * ((C + 1) * gamma_q(C + 1, B) - B * gamma_q(C + 1, B));
+      return intensity_;
     }
 
     /**
@@ -143,30 +210,41 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(signal.size() == background.size());
       DIALS_ASSERT(signal.size() == mask.size());
 
-      // Calculate the signal and background intensity
+      // Calculate the signal and background intensity. The pixels are
+      // classified without branching so that the loop vectorizes.
       int bg_code = Valid | Background | BackgroundUsed;
-      success_ = true;
-      sum_p_ = 0;
-      sum_b_ = 0;
-      n_signal_ = 0;
-      n_background_ = 0;
+      FloatType sum_p = 0;
+      FloatType sum_b = 0;
+      std::size_t n_signal = 0;
+      std::size_t n_background = 0;
+      std::size_t n_invalid = 0;
       for (std::size_t i = 0; i < signal.size(); ++i) {
-        if ((mask[i] & Foreground) == Foreground) {
-          if ((mask[i] & Valid) == Valid) {
-            sum_p_ += signal[i];
-            sum_b_ += background[i];
-            n_signal_++;
-          } else {
-            success_ = false;
-          }
-        } else if ((mask[i] & bg_code) == bg_code) {
-          n_background_++;
-        }
+        int m = mask[i];
+        int is_fg = (m & Foreground) == Foreground;
+        int is_valid = (m & Valid) == Valid;
+        int is_signal = is_fg & is_valid;
+        sum_p += is_signal ? signal[i] : 0;
+        sum_b += is_signal ? background[i] : 0;
+        n_signal += is_signal;
+        n_invalid += is_fg & (is_valid ^ 1);
+        n_background += (is_fg ^ 1) & ((m & bg_code) == bg_code);
       }
+      sum_p_ = sum_p;
+      sum_b_ = sum_b;
+      n_signal_ = n_signal;
+      n_background_ = n_background;
+      success_ = n_invalid == 0;
+
+      // Evaluate the posterior terms once
+      double C = sum_p_;
+      double B = sum_b_;
+      double q = detail::poisson_cdf(C, B);
+      intensity_ = q * ((C + 1) * q - B * q);
     }
 
     FloatType sum_p_;
     FloatType sum_b_;
+    FloatType intensity_;
     std::size_t n_background_;
     std::size_t n_signal_;
     bool success_;
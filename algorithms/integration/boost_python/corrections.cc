@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/integration/corrections.h>
+#include <dials/util/boost_python/release_gil.h>
 
 using namespace boost::python;
 
@@ -36,8 +37,12 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<CorrectionsMulti>("CorrectionsMulti")
       .def("append", &CorrectionsMulti::push_back)
       .def("__len__", &CorrectionsMulti::size)
-      .def("lp", &CorrectionsMulti::lp)
-      .def("qe", &CorrectionsMulti::qe);
+      .def("lp",
+           DIALS_RELEASE_GIL(&CorrectionsMulti::lp),
+           (arg("id"), arg("s1"), arg("nthreads") = 1))
+      .def("qe",
+           DIALS_RELEASE_GIL(&CorrectionsMulti::qe),
+           (arg("id"), arg("s1"), arg("panel"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
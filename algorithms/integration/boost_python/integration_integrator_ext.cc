@@ -10,9 +10,12 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <dials/algorithms/integration/processor.h>
 #include <dials/algorithms/integration/integrator.h>
 #include <dials/algorithms/integration/manager.h>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 using namespace boost::python;
 
@@ -135,34 +138,49 @@ namespace dials { namespace algorithms { namespace boost_python {
   }
 
   /**
-   * Compute the memory for each job
+   * Compute the job for each reflection
    */
-  af::shared<std::size_t> job_list_shoebox_memory(const JobList &self,
-                                                  af::reflection_table data,
-                                                  bool flatten) {
-    // Check the input
+  ReflectionLookup *make_reflection_lookup(const JobList &jobs,
+                                           af::reflection_table data,
+                                           std::size_t nthreads) {
     DIALS_ASSERT(data.is_consistent());
     DIALS_ASSERT(data.contains("bbox"));
     DIALS_ASSERT(data.contains("id"));
     DIALS_ASSERT(data.contains("flags"));
-    DIALS_ASSERT(self.size() > 0);
-    DIALS_ASSERT(data.size() > 0);
-
-    // Get the bounding boxes
+    DIALS_ASSERT(jobs.size() > 0);
     af::const_ref<int6> bbox = data["bbox"];
     af::const_ref<int> id = data["id"];
     af::const_ref<std::size_t> flags = data["flags"];
+    return new ReflectionLookup(id, flags, bbox, jobs, nthreads);
+  }
 
-    // Check all the reflections are in range
-    for (std::size_t i = 0; i < bbox.size(); ++i) {
-      DIALS_ASSERT(id[i] >= 0);
-      DIALS_ASSERT(bbox[i][1] > bbox[i][0]);
-      DIALS_ASSERT(bbox[i][3] > bbox[i][2]);
-      DIALS_ASSERT(bbox[i][5] > bbox[i][4]);
-    }
+  /**
+   * Get a copy of the indices of the reflections in a job
+   */
+  af::shared<std::size_t> reflection_lookup_indices(const ReflectionLookup &self,
+                                                    std::size_t index) {
+    af::const_ref<std::size_t> indices = self.indices(index);
+    return af::shared<std::size_t>(indices.begin(), indices.end());
+  }
 
-    // Create the lookup
-    ReflectionLookup lookup(id, flags, bbox, self);
+  /**
+   * Compute the memory for each job from a precomputed lookup
+   */
+  af::shared<std::size_t> job_list_shoebox_memory_with_lookup(
+    const JobList &self,
+    af::reflection_table data,
+    bool flatten,
+    const ReflectionLookup &lookup) {
+    // Check the input
+    DIALS_ASSERT(data.is_consistent());
+    DIALS_ASSERT(data.contains("bbox"));
+    DIALS_ASSERT(self.size() > 0);
+    DIALS_ASSERT(data.size() > 0);
+    DIALS_ASSERT(lookup.size() == self.size());
+    DIALS_ASSERT(lookup.num_rows() == data.size());
+
+    // Get the bounding boxes
+    af::const_ref<int6> bbox = data["bbox"];
 
     // Compute the memory for each job
     af::shared<std::size_t> result(lookup.size());
@@ -211,6 +229,17 @@ namespace dials { namespace algorithms { namespace boost_python {
     return result;
   }
 
+  /**
+   * Compute the memory for each job
+   */
+  af::shared<std::size_t> job_list_shoebox_memory(const JobList &self,
+                                                  af::reflection_table data,
+                                                  bool flatten) {
+    DIALS_ASSERT(data.size() > 0);
+    boost::scoped_ptr<ReflectionLookup> lookup(make_reflection_lookup(self, data, 1));
+    return job_list_shoebox_memory_with_lookup(self, data, flatten, *lookup);
+  }
+
   /**
    * Wrapper class to allow python function to inherit
    */
@@ -221,6 +250,8 @@ namespace dials { namespace algorithms { namespace boost_python {
   };
 
   BOOST_PYTHON_MODULE(dials_algorithms_integration_integrator_ext) {
+    dials::util::boost_python::import_memory_accounting();
+    dials::util::boost_python::import_shared_executor();
     class_<GroupList::Group>("Group", no_init)
       .def("index", &GroupList::Group::index)
       .def("nindex", &GroupList::Group::nindex)
@@ -240,16 +271,46 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("frames", &JobList::Job::frames)
       .def("nframes", &JobList::Job::nframes);
 
+    class_<BlockPlanner>("BlockPlanner", no_init)
+      .def(init<tiny<int, 2>, const af::const_ref<int6> &, int, int>(
+        (arg("range"), arg("bbox"), arg("block_size"), arg("max_block_size"))))
+      .def("blocks", &BlockPlanner::blocks)
+      .def("num_reflections", &BlockPlanner::num_reflections)
+      .def("num_pixels", &BlockPlanner::num_pixels)
+      .def("num_split", &BlockPlanner::num_split)
+      .def("num_split_uniform", &BlockPlanner::num_split_uniform)
+      .def("adaptive", &BlockPlanner::adaptive);
+
+    void (JobList::*job_list_add_uniform)(tiny<int, 2>, tiny<int, 2>, int) =
+      &JobList::add;
+    void (JobList::*job_list_add_blocks)(
+      tiny<int, 2>, tiny<int, 2>, const af::const_ref<tiny<int, 2> > &) =
+      &JobList::add;
+
     class_<JobList>("JobList")
       .def(init<tiny<int, 2>, const af::const_ref<tiny<int, 2> > &>())
-      .def("add", &JobList::add)
+      .def("add", job_list_add_uniform)
+      .def("add", job_list_add_blocks)
       .def("__len__", &JobList::size)
       .def("__getitem__", &JobList::operator[], return_internal_reference<>())
       .def("split", &job_list_split)
-      .def("shoebox_memory", &job_list_shoebox_memory);
+      .def("shoebox_memory", &job_list_shoebox_memory)
+      .def("shoebox_memory", &job_list_shoebox_memory_with_lookup);
+
+    class_<ReflectionLookup>("ReflectionLookup", no_init)
+      .def("__init__",
+           make_constructor(&make_reflection_lookup,
+                            default_call_policies(),
+                            (arg("jobs"), arg("data"), arg("nthreads") = 1)))
+      .def("__len__", &ReflectionLookup::size)
+      .def("job", &ReflectionLookup::job, return_internal_reference<>())
+      .def("indices", &reflection_lookup_indices)
+      .def("num_rows", &ReflectionLookup::num_rows);
 
     class_<ReflectionManager>("ReflectionManager", no_init)
       .def(init<const JobList &, af::reflection_table>((arg("jobs"), arg("data"))))
+      .def(init<const JobList &, af::reflection_table, const ReflectionLookup &>(
+        (arg("jobs"), arg("data"), arg("lookup"))))
       .def("__len__", &ReflectionManager::size)
       .def("finished", &ReflectionManager::finished)
       .def("accumulate", &ReflectionManager::accumulate)
@@ -259,7 +320,8 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("num_reflections", &ReflectionManager::num_reflections);
 
     class_<ReflectionManagerPerImage>("ReflectionManagerPerImage", no_init)
-      .def(init<int2, af::reflection_table>((arg("frames"), arg("data"))))
+      .def(init<int2, af::reflection_table, std::size_t>(
+        (arg("frames"), arg("data"), arg("batch_size") = 1)))
       .def("__len__", &ReflectionManagerPerImage::size)
       .def("finished", &ReflectionManagerPerImage::finished)
       .def("accumulate", &ReflectionManagerPerImage::accumulate)
@@ -273,7 +335,13 @@ namespace dials { namespace algorithms { namespace boost_python {
       .enable_pickling();
 
     class_<ShoeboxProcessor>("ShoeboxProcessor", no_init)
-      .def(init<af::reflection_table, std::size_t, int, int, bool>())
+      .def(init<af::reflection_table, std::size_t, int, int, bool, std::size_t>(
+        (arg("data"),
+         arg("npanels"),
+         arg("frame0"),
+         arg("frame1"),
+         arg("save"),
+         arg("nthreads") = 1)))
       .def("next", &ShoeboxProcessor::next<double>)
       .def("next", &ShoeboxProcessor::next<int>)
       .def("frame0", &ShoeboxProcessor::frame0)
@@ -2,12 +2,14 @@
 #include <boost/python/class.hpp>
 #include <boost/python/def.hpp>
 #include <boost/python/list.hpp>
+#include <boost/python/tuple.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/array_family/shared.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/panel.h>
+#include <dials/algorithms/integration/kapton_2019.h>
 #include <math.h>
 #include <vector>
 
@@ -86,10 +88,46 @@ scitbx::af::shared<double> get_kapton_path_cpp(
 using namespace boost::python;
 namespace kapton { namespace boost_python { namespace {
 
+  using dials::algorithms::KaptonAbsorption;
+
+  boost::python::tuple shoebox_corrections(
+    const KaptonAbsorption &self,
+    const scitbx::af::const_ref<dials::model::Shoebox<> > &shoebox,
+    const Detector &detector,
+    std::size_t nthreads) {
+    scitbx::af::shared<double> correction(shoebox.size());
+    scitbx::af::shared<double> sigma(shoebox.size());
+    self.shoebox_corrections(
+      shoebox, detector, correction.ref(), sigma.ref(), nthreads);
+    return boost::python::make_tuple(correction, sigma);
+  }
+
   void kapton_init_module() {
     using namespace boost::python;
 
     def("get_kapton_path_cpp", &kapton::get_kapton_path_cpp);
+
+    class_<KaptonAbsorption>("KaptonAbsorption", no_init)
+      .def(init<double, double, double, double, double>((arg("height_mm"),
+                                                         arg("thickness_mm"),
+                                                         arg("half_width_mm"),
+                                                         arg("angle_rad"),
+                                                         arg("abs_coeff"))))
+      .def("path_length", &KaptonAbsorption::path_length, (arg("s1")))
+      .def("correction", &KaptonAbsorption::correction, (arg("s1")))
+      .def("path_lengths",
+           &KaptonAbsorption::path_lengths,
+           (arg("s1"), arg("nthreads") = 1))
+      .def("corrections",
+           &KaptonAbsorption::corrections,
+           (arg("s1"), arg("nthreads") = 1))
+      .def("shoebox_corrections",
+           &shoebox_corrections,
+           (arg("shoebox"), arg("detector"), arg("nthreads") = 1))
+      .def("apply",
+           &KaptonAbsorption::apply,
+           (arg("intensity"), arg("variance"), arg("correction"), arg("sigma")))
+      .staticmethod("apply");
   }
 
 }}}  // namespace kapton::boost_python::
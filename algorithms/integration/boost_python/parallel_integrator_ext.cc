@@ -14,11 +14,16 @@
 #include <dials/algorithms/integration/parallel_integrator.h>
 #include <dials/algorithms/integration/parallel_reference_profiler.h>
 #include <dials/algorithms/integration/algorithms.h>
+#include <dials/util/boost_python/trace.h>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 using namespace boost::python;
 
 namespace dials { namespace algorithms { namespace boost_python {
 
+  using dials::util::ThreadPool;
+
   /**
    * Get the reference profile data
    * @param data The reference profile structure
@@ -140,9 +145,13 @@ namespace dials { namespace algorithms { namespace boost_python {
       return boost::python::make_tuple(obj.size(), obj.datasize(), obj.threshold());
     }
     static boost::python::tuple getstate(
-      const ThreadSafeEmpiricalProfileModeller &obj) {
+      const ThreadSafeEmpiricalProfileModeller &modeller) {
       typedef ThreadSafeEmpiricalProfileModeller::data_type data_type;
       typedef ThreadSafeEmpiricalProfileModeller::mask_type mask_type;
+      // The copy shares the profiles so reducing it includes the profiles
+      // still held by the threads
+      ThreadSafeEmpiricalProfileModeller obj = modeller;
+      obj.reduce();
       boost::python::list data_list;
       boost::python::list mask_list;
       boost::python::list nref_list;
@@ -277,7 +286,9 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const Goniometer &,
                 const Scan &,
                 double,
-                double>());
+                double>())
+      .def("set_pixel_direction_table",
+           &GaussianRSMaskCalculator::set_pixel_direction_table);
 
     // Export GaussianRSMultiCrystalMaskCalculator
     class_<GaussianRSMultiCrystalMaskCalculator, bases<MaskCalculatorIface> >(
@@ -337,6 +348,10 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<NullIntensityCalculator, bases<IntensityCalculatorIface> >(
       "NullIntensityCalculator");
 
+    // Export BayesianIntensityCalculator
+    class_<BayesianIntensityCalculator, bases<IntensityCalculatorIface> >(
+      "BayesianIntensityCalculator");
+
     // Export GaussianRSIntensityCalculator
     class_<GaussianRSIntensityCalculator, bases<IntensityCalculatorIface> >(
       "GaussianRSIntensityCalculator", no_init)
@@ -368,6 +383,28 @@ namespace dials { namespace algorithms { namespace boost_python {
    * Export integrator
    */
   void export_integrator() {
+    class_<ThreadPool, boost::shared_ptr<ThreadPool>, boost::noncopyable>(
+      "ThreadPool", no_init)
+      .def(init<std::size_t, bool>((arg("nthreads"), arg("pin_threads") = false)))
+      .def("size", &ThreadPool::size)
+      .def("num_nodes", &ThreadPool::num_nodes);
+
+    class_<IntegrationTiming>("IntegrationTiming", no_init)
+      .add_property("extract", &IntegrationTiming::extract)
+      .add_property("mask", &IntegrationTiming::mask)
+      .add_property("background", &IntegrationTiming::background)
+      .add_property("centroid", &IntegrationTiming::centroid)
+      .add_property("summation", &IntegrationTiming::summation)
+      .add_property("profile", &IntegrationTiming::profile)
+      .add_property("write", &IntegrationTiming::write)
+      .add_property("read", &IntegrationTiming::read)
+      .add_property("stall", &IntegrationTiming::stall)
+      .add_property("copy", &IntegrationTiming::copy)
+      .add_property("total", &IntegrationTiming::total)
+      .add_property("num_threads", &IntegrationTiming::num_threads)
+      .add_property("num_reflections", &IntegrationTiming::num_reflections)
+      .add_property("thread_time", &IntegrationTiming::thread_time);
+
     class_<ParallelIntegrator>("MultiThreadedIntegrator", no_init)
       .def(init<const af::reflection_table &,
                 ImageSequence,
@@ -378,7 +415,13 @@ namespace dials { namespace algorithms { namespace boost_python {
                 std::size_t,
                 std::size_t,
                 bool,
-                bool>((arg("reflections"),
+                bool,
+                std::size_t,
+                std::size_t,
+                bool,
+                bool,
+                std::size_t,
+                boost::shared_ptr<ThreadPool> >((arg("reflections"),
                        arg("imageset"),
                        arg("compute_mask"),
                        arg("compute_background"),
@@ -387,17 +430,36 @@ namespace dials { namespace algorithms { namespace boost_python {
                        arg("nthreads") = 1,
                        arg("buffer_size") = 0,
                        arg("use_dynamic_mask") = true,
-                       arg("debug") = false)))
+                       arg("debug") = false,
+                       arg("read_ahead") = 0,
+                       arg("read_threads") = 1,
+                       arg("compact_buffer") = false,
+                       arg("compress_buffer") = false,
+                       arg("batch_size") = 1,
+                       arg("thread_pool") = boost::shared_ptr<ThreadPool>())))
       .def("reflections", &ParallelIntegrator::reflections)
+      .def("timing", &ParallelIntegrator::timing)
       .def("compute_required_memory",
            &ParallelIntegrator::compute_required_memory,
-           (arg("imageset")))
+           (arg("imageset"), arg("block_size"), arg("compact") = false))
       .def("compute_max_block_size",
            &ParallelIntegrator::compute_max_block_size,
-           (arg("imageset"), arg("max_memory_usage")))
+           (arg("imageset"), arg("max_memory_usage"), arg("compact") = false))
       .staticmethod("compute_required_memory")
       .staticmethod("compute_max_block_size");
 
+    class_<ParallelProfileFitter>("MultiThreadedProfileFitter", no_init)
+      .def(init<const af::reflection_table &,
+                const IntensityCalculatorIface &,
+                std::size_t,
+                boost::shared_ptr<ThreadPool> >(
+        (arg("reflections"),
+         arg("compute_intensity"),
+         arg("nthreads") = 1,
+         arg("thread_pool") = boost::shared_ptr<ThreadPool>())))
+      .def("reflections", &ParallelProfileFitter::reflections)
+      .def("timing", &ParallelProfileFitter::timing);
+
     class_<ParallelReferenceProfiler>("MultiThreadedReferenceProfiler", no_init)
       .def(init<const af::reflection_table &,
                 ImageSequence,
@@ -408,7 +470,12 @@ namespace dials { namespace algorithms { namespace boost_python {
                 std::size_t,
                 std::size_t,
                 bool,
-                bool>((arg("reflections"),
+                bool,
+                std::size_t,
+                std::size_t,
+                bool,
+                bool,
+                boost::shared_ptr<ThreadPool> >((arg("reflections"),
                        arg("imageset"),
                        arg("compute_mask"),
                        arg("compute_background"),
@@ -417,14 +484,20 @@ namespace dials { namespace algorithms { namespace boost_python {
                        arg("nthreads") = 1,
                        arg("buffer_size") = 0,
                        arg("use_dynamic_mask") = true,
-                       arg("debug") = false)))
+                       arg("debug") = false,
+                       arg("read_ahead") = 0,
+                       arg("read_threads") = 1,
+                       arg("compact_buffer") = false,
+                       arg("compress_buffer") = false,
+                       arg("thread_pool") = boost::shared_ptr<ThreadPool>())))
       .def("reflections", &ParallelReferenceProfiler::reflections)
+      .def("timing", &ParallelReferenceProfiler::timing)
       .def("compute_required_memory",
            &ParallelReferenceProfiler::compute_required_memory,
-           (arg("imageset")))
+           (arg("imageset"), arg("block_size"), arg("compact") = false))
       .def("compute_max_block_size",
            &ParallelReferenceProfiler::compute_max_block_size,
-           (arg("imageset"), arg("max_memory_usage")))
+           (arg("imageset"), arg("max_memory_usage"), arg("compact") = false))
       .staticmethod("compute_required_memory")
       .staticmethod("compute_max_block_size");
 
@@ -441,15 +514,23 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<const SimpleBlockList &, af::reflection_table, std::size_t>())
       .def("data", &SimpleReflectionManager::data)
       .def("finished", &SimpleReflectionManager::finished)
+      .def("job_finished", &SimpleReflectionManager::job_finished)
+      .def("unfinished_jobs", &SimpleReflectionManager::unfinished_jobs)
       .def("block", &SimpleReflectionManager::block)
       .def("job", &SimpleReflectionManager::job)
       .def("num_reflections", &SimpleReflectionManager::num_reflections)
+      .def("indices", &SimpleReflectionManager::indices)
       .def("split", &SimpleReflectionManager::split)
       .def("accumulate", &SimpleReflectionManager::accumulate)
+      .def("skip", &SimpleReflectionManager::skip)
+      .def("release", &SimpleReflectionManager::release)
       .def("__len__", &SimpleReflectionManager::size);
   }
 
   BOOST_PYTHON_MODULE(dials_algorithms_integration_parallel_integrator_ext) {
+    dials::util::boost_python::import_memory_accounting();
+    dials::util::boost_python::import_trace_recorder();
+    dials::util::boost_python::import_shared_executor();
     export_algorithm_interfaces();
     export_algorithms();
     export_integrator();
@@ -0,0 +1,190 @@
+/*
+ * compressed_frame.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_COMPRESSED_FRAME_H
+#define DIALS_ALGORITHMS_INTEGRATION_COMPRESSED_FRAME_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/memory_accounting.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A compressed image of 16 bit codes. The image is split into square tiles
+   * and the codes in each tile are stored relative to the smallest code in
+   * the tile, bit packed with just enough bits for the range of the tile.
+   * Masked pixels are stored as one more than the largest code. The
+   * background of a diffraction image varies slowly and the spots are sparse,
+   * so most tiles need only a few bits per pixel. Every pixel has the same
+   * number of bits within a tile, so any pixel can be decoded directly and
+   * reading a shoebox does not need to decompress the whole tile.
+   */
+  class CompressedFrame {
+  public:
+    typedef unsigned short code_type;
+
+    /**
+     * The number of rows and columns in each tile
+     */
+    static const std::size_t tile_size = 64;
+
+    CompressedFrame() : ysize_(0), xsize_(0), num_tiles_x_(0), masked_(0) {}
+
+    /**
+     * Compress an image
+     * @param codes The codes of the image
+     * @param masked The code of masked pixels
+     */
+    void assign(const af::const_ref<code_type, af::c_grid<2> > &codes,
+                code_type masked) {
+      ysize_ = codes.accessor()[0];
+      xsize_ = codes.accessor()[1];
+      masked_ = masked;
+      num_tiles_x_ = (xsize_ + tile_size - 1) / tile_size;
+      std::size_t num_tiles_y = (ysize_ + tile_size - 1) / tile_size;
+      tiles_.resize(num_tiles_x_ * num_tiles_y);
+      words_.clear();
+      for (std::size_t ty = 0; ty < num_tiles_y; ++ty) {
+        for (std::size_t tx = 0; tx < num_tiles_x_; ++tx) {
+          encode_tile(codes, ty, tx);
+        }
+      }
+
+      // Charge the compressed data to the buffer subsystem
+      if (memory_ == NULL) {
+        memory_ = dials::util::make_memory_charge(dials::util::BufferMemory);
+      }
+      memory_->set(tiles_.capacity() * sizeof(Tile)
+                   + words_.capacity() * sizeof(boost::uint64_t));
+    }
+
+    /**
+     * @returns The size of the image
+     */
+    af::c_grid<2> accessor() const {
+      return af::c_grid<2>(ysize_, xsize_);
+    }
+
+    /**
+     * @returns The code of a pixel
+     */
+    code_type operator()(std::size_t j, std::size_t i) const {
+      const Tile &tile = tiles_[(j / tile_size) * num_tiles_x_ + i / tile_size];
+      boost::uint32_t value = 0;
+      if (tile.bits > 0) {
+        std::size_t p = (j % tile_size) * tile.width + (i % tile_size);
+        std::size_t position = p * tile.bits;
+        std::size_t shift = position % 64;
+        const boost::uint64_t *word = &words_[tile.offset + position / 64];
+        boost::uint64_t v = word[0] >> shift;
+        if (shift + tile.bits > 64) {
+          v |= word[1] << (64 - shift);
+        }
+        value = (boost::uint32_t)(v & ((boost::uint64_t(1) << tile.bits) - 1));
+      }
+      if (value == tile.masked) {
+        return masked_;
+      }
+      return (code_type)(tile.base + value);
+    }
+
+  private:
+    /**
+     * The smallest code, the packed value of masked pixels, the number of
+     * bits per pixel, the width and the first word of a tile
+     */
+    struct Tile {
+      std::size_t offset;
+      boost::uint32_t masked;
+      code_type base;
+      unsigned short width;
+      unsigned char bits;
+    };
+
+    void encode_tile(const af::const_ref<code_type, af::c_grid<2> > &codes,
+                     std::size_t ty,
+                     std::size_t tx) {
+      std::size_t y0 = ty * tile_size;
+      std::size_t x0 = tx * tile_size;
+      std::size_t y1 = std::min(y0 + tile_size, ysize_);
+      std::size_t x1 = std::min(x0 + tile_size, xsize_);
+
+      // Find the range of the unmasked codes
+      bool any_valid = false;
+      bool any_masked = false;
+      code_type lo = 0;
+      code_type hi = 0;
+      for (std::size_t j = y0; j < y1; ++j) {
+        for (std::size_t i = x0; i < x1; ++i) {
+          code_type c = codes(j, i);
+          if (c == masked_) {
+            any_masked = true;
+          } else if (!any_valid) {
+            lo = c;
+            hi = c;
+            any_valid = true;
+          } else {
+            lo = std::min(lo, c);
+            hi = std::max(hi, c);
+          }
+        }
+      }
+
+      // Choose the number of bits. A tile with no unmasked pixels needs no
+      // bits, since every pixel decodes to zero, which is the masked value.
+      Tile &tile = tiles_[ty * num_tiles_x_ + tx];
+      tile.offset = words_.size();
+      tile.base = lo;
+      tile.width = (unsigned short)(x1 - x0);
+      tile.masked = any_valid ? (boost::uint32_t)(hi - lo) + 1 : 0;
+      boost::uint32_t top = any_masked ? tile.masked : (boost::uint32_t)(hi - lo);
+      tile.bits = 0;
+      while ((boost::uint32_t(1) << tile.bits) <= top) {
+        tile.bits++;
+      }
+      if (!any_masked) {
+        tile.masked = boost::uint32_t(1) << tile.bits;
+      }
+      if (tile.bits == 0) {
+        return;
+      }
+
+      // Pack the values
+      std::size_t nbits = (y1 - y0) * (x1 - x0) * tile.bits;
+      words_.resize(tile.offset + (nbits + 63) / 64, 0);
+      boost::uint64_t *words = &words_[tile.offset];
+      std::size_t position = 0;
+      for (std::size_t j = y0; j < y1; ++j) {
+        for (std::size_t i = x0; i < x1; ++i) {
+          code_type c = codes(j, i);
+          boost::uint64_t v = c == masked_ ? tile.masked : c - lo;
+          std::size_t shift = position % 64;
+          words[position / 64] |= v << shift;
+          if (shift + tile.bits > 64) {
+            words[position / 64 + 1] |= v >> (64 - shift);
+          }
+          position += tile.bits;
+        }
+      }
+    }
+
+    std::size_t ysize_;
+    std::size_t xsize_;
+    std::size_t num_tiles_x_;
+    code_type masked_;
+    std::vector<Tile> tiles_;
+    std::vector<boost::uint64_t> words_;
+    boost::shared_ptr<dials::util::MemoryCharge> memory_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_COMPRESSED_FRAME_H
@@ -12,12 +12,15 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_CORRECTIONS_H
 #define DIALS_ALGORITHMS_INTEGRATION_CORRECTIONS_H
 
+#include <cmath>
 #include <vector>
+#include <boost/bind.hpp>
 #include <scitbx/vec3.h>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -103,7 +106,8 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * A class to perform corrections to the intensities.
+   * A class to perform corrections to the intensities. The terms which depend
+   * only on the beam, goniometer and panels are computed once on construction.
    */
   class Corrections {
   public:
@@ -117,6 +121,7 @@ namespace dials { namespace algorithms {
           pf_(beam.get_polarization_fraction()),
           m2_(goniometer.get_rotation_axis()) {
       // Deprecated constructor
+      init();
     }
 
     /**
@@ -131,7 +136,9 @@ namespace dials { namespace algorithms {
           pn_(beam.get_polarization_normal()),
           pf_(beam.get_polarization_fraction()),
           m2_(goniometer.get_rotation_axis()),
-          det_(detector) {}
+          det_(detector) {
+      init();
+    }
 
     /**
      * @param beam The beam model.
@@ -143,7 +150,9 @@ namespace dials { namespace algorithms {
           pn_(beam.get_polarization_normal()),
           pf_(beam.get_polarization_fraction()),
           m2_(0, 0, 0),
-          det_(detector) {}
+          det_(detector) {
+      init();
+    }
 
     /**
      * Perform the LP correction. If no rotation axis is specified then do the
@@ -152,11 +161,15 @@ namespace dials { namespace algorithms {
      * @returns L / P The correction
      */
     double lp(vec3<double> s1) const {
-      if (m2_.length() > 0) {
-        return lp_correction(s0_, pn_, pf_, m2_, s1);
-      } else {
-        return stills_lp_correction(s0_, pn_, pf_, s1);
-      }
+      double s1_length = s1.length();
+      DIALS_ASSERT(s1_length > 0);
+      double inv_s1_length = 1.0 / s1_length;
+      double L = rotation_ ? std::abs(lorentz_ * s1) * inv_s1_length : 1.0;
+      double P1 = (pn_ * s1) * inv_s1_length;
+      double P3 = (s0_unit_ * s1) * inv_s1_length;
+      double P = (1.0 - 2.0 * pf_) * (1.0 - P1 * P1) + pf_ * (1.0 + P3 * P3);
+      DIALS_ASSERT(P != 0);
+      return L / P;
     }
 
     /**
@@ -166,16 +179,44 @@ namespace dials { namespace algorithms {
      * @returns QE term which needs to be divided by (i.e. is efficiency)
      */
     double qe(vec3<double> s1, size_t p) const {
-      return qe_correction(
-        det_[p].get_mu(), det_[p].get_thickness(), s1, det_[p].get_normal());
+      DIALS_ASSERT(p < panel_normal_.size());
+      double mu = panel_mu_[p];
+      double t0 = panel_t0_[p];
+      DIALS_ASSERT(mu >= 0);
+      DIALS_ASSERT(t0 >= 0);
+      double cos_angle = std::abs(panel_normal_[p] * s1) / s1.length();
+      return 1.0 - std::exp(-mu * t0 / cos_angle);
     }
 
   private:
+    /**
+     * Compute the terms that are the same for every reflection
+     */
+    void init() {
+      double s0_length = s0_.length();
+      DIALS_ASSERT(s0_length > 0);
+      s0_unit_ = s0_ / s0_length;
+      rotation_ = m2_.length() > 0;
+      lorentz_ = m2_.cross(s0_) / s0_length;
+      for (std::size_t p = 0; p < det_.size(); ++p) {
+        vec3<double> normal = det_[p].get_normal();
+        panel_normal_.push_back(normal / normal.length());
+        panel_mu_.push_back(det_[p].get_mu());
+        panel_t0_.push_back(det_[p].get_thickness());
+      }
+    }
+
     vec3<double> s0_;
     vec3<double> pn_;
     double pf_;
     vec3<double> m2_;
     Detector det_;
+    vec3<double> s0_unit_;
+    vec3<double> lorentz_;
+    bool rotation_;
+    std::vector<vec3<double> > panel_normal_;
+    std::vector<double> panel_mu_;
+    std::vector<double> panel_t0_;
   };
 
   /**
@@ -202,16 +243,18 @@ namespace dials { namespace algorithms {
      * Perform the LP correction.
      * @param id The list of experiments ids
      * @param s1 The list of incident beam vectors
+     * @param nthreads The number of threads to use
      */
     af::shared<double> lp(const af::const_ref<int> &id,
-                          const af::const_ref<vec3<double> > &s1) const {
+                          const af::const_ref<vec3<double> > &s1,
+                          std::size_t nthreads = 1) const {
       DIALS_ASSERT(id.size() == s1.size());
+      check_ids(id);
       af::shared<double> result(id.size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < compute_.size());
-        result[i] = compute_[id[i]].lp(s1[i]);
-      }
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&CorrectionsMulti::lp_band, this, id, s1, result.ref(), _1, _2),
+        id.size(),
+        nthreads);
       return result;
     }
 
@@ -220,22 +263,53 @@ namespace dials { namespace algorithms {
      * @param id The list of experiments ids
      * @param s1 The list of incident beam vectors
      * @param p The list of panels
+     * @param nthreads The number of threads to use
      */
     af::shared<double> qe(const af::const_ref<int> &id,
                           const af::const_ref<vec3<double> > &s1,
-                          const af::const_ref<std::size_t> &p) const {
+                          const af::const_ref<std::size_t> &p,
+                          std::size_t nthreads = 1) const {
       DIALS_ASSERT(id.size() == s1.size());
       DIALS_ASSERT(id.size() == p.size());
+      check_ids(id);
       af::shared<double> result(id.size(), 0);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(
+          &CorrectionsMulti::qe_band, this, id, s1, p, result.ref(), _1, _2),
+        id.size(),
+        nthreads);
+      return result;
+    }
+
+  private:
+    void check_ids(const af::const_ref<int> &id) const {
       for (std::size_t i = 0; i < id.size(); ++i) {
         DIALS_ASSERT(id[i] >= 0);
         DIALS_ASSERT(id[i] < compute_.size());
+      }
+    }
+
+    void lp_band(af::const_ref<int> id,
+                 af::const_ref<vec3<double> > s1,
+                 af::ref<double> result,
+                 std::size_t first,
+                 std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        result[i] = compute_[id[i]].lp(s1[i]);
+      }
+    }
+
+    void qe_band(af::const_ref<int> id,
+                 af::const_ref<vec3<double> > s1,
+                 af::const_ref<std::size_t> p,
+                 af::ref<double> result,
+                 std::size_t first,
+                 std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
         result[i] = compute_[id[i]].qe(s1[i], p[i]);
       }
-      return result;
     }
 
-  private:
     std::vector<Corrections> compute_;
   };
 }}  // namespace dials::algorithms
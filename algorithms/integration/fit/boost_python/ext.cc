@@ -114,7 +114,7 @@ namespace dials { namespace algorithms { namespace boost_python {
 
     def_make_profile_fitter(&make_profile_fitter_1d_1<float>);
     def_make_profile_fitter(&make_profile_fitter_2d_1<float>);
-    def_make_profile_fitter(&make_profile_fitter_2d_1<float>);
+    def_make_profile_fitter(&make_profile_fitter_3d_1<float>);
     def_make_profile_fitter(&make_profile_fitter_1d_n<float>);
     def_make_profile_fitter(&make_profile_fitter_2d_n<float>);
     def_make_profile_fitter(&make_profile_fitter_3d_n<float>);
@@ -58,6 +58,9 @@ namespace dials { namespace algorithms {
   public:
     typedef T float_type;
 
+    /** The maximum number of profiles which can be deconvolved */
+    enum { MaxProfiles = 10 };
+
     /**
      * Profile fit a single reflection
      */
@@ -297,53 +300,65 @@ namespace dials { namespace algorithms {
       std::size_t N = d.size();
       std::size_t M = p.accessor()[0];
 
-      // Allocate some arrays
-      std::vector<double> v(N);
-      std::vector<double> I(M, 1);
-      std::vector<double> I0(M, 1);
-      std::vector<double> A(M * M);
+      // Gather the masked pixels into contiguous arrays so that the iterations
+      // only touch the pixels which contribute and the inner loops have no
+      // branches. The scratch space holds the data minus background, the
+      // background, the weights and the M gathered profiles.
+      std::size_t K = 0;
+      for (std::size_t i = 0; i < N; ++i) {
+        K += m[i] ? 1 : 0;
+      }
+      std::vector<double> scratch(K * (M + 3) + 1);
+      double *dmb = &scratch[0];
+      double *bg = dmb + K;
+      double *w = bg + K;
+      double *pc = w + K;
+      double sumb = 0.0;
+      for (std::size_t i = 0, k = 0; i < N; ++i) {
+        if (m[i]) {
+          dmb[k] = d[i] - b[i];
+          bg[k] = b[i];
+          sumb += b[i];
+          for (std::size_t j = 0; j < M; ++j) {
+            pc[j * K + k] = p(j, i);
+          }
+          k++;
+        }
+      }
+
+      // The current and previous estimates and the normal matrix
+      double I[MaxProfiles];
+      double I0[MaxProfiles];
+      double A[MaxProfiles * MaxProfiles];
+      std::fill(I, I + M, 1.0);
+      std::fill(I0, I0 + M, 1.0);
 
       // Iterate a number of times
       for (niter_ = 0; niter_ < maxiter; ++niter_) {
-        //
-        // Compute the variance for the given estimate
-        std::copy(b.begin(), b.end(), v.begin());
-        for (std::size_t j = 0; j < M; ++j) {
-          for (std::size_t i = 0; i < N; ++i) {
-            v[i] += std::max(1.0 / N, std::abs(I[j])) * p(j, i);
-          }
-        }
+        // Compute the weights from the variance for the given estimate
+        compute_weights(bg, pc, I, w, K, M, 1.0 / N);
 
         // Compute the matrices to do the profile fitting
-        std::fill(I.begin(), I.end(), 0);
-        for (std::size_t k = 0; k < M; ++k) {
-          for (std::size_t i = 0; i < N; ++i) {
-            if (m[i]) {
-              DIALS_ASSERT(v[i] > 0);
-              I[k] += p(k, i) * (d[i] - b[i]) / v[i];
-            }
-          }
-        }
-
-        std::fill(A.begin(), A.end(), 0);
-        for (std::size_t k = 0; k < M; ++k) {
-          for (std::size_t i = 0; i < N; ++i) {
-            if (m[i]) {
-              A[k + k * M] += p(k, i) * p(k, i) / v[i];
-            }
-          }
-          for (std::size_t j = k + 1; j < M; ++j) {
-            for (std::size_t i = 0; i < N; ++i) {
-              if (m[i]) {
-                A[j + k * M] += p(k, i) * p(j, i) / v[i];
-                A[k + j * M] = A[j + k * M];
-              }
-            }
-          }
-        }
+        switch (M) {
+        case 1:
+          accumulate<1>(dmb, pc, w, K, I, A);
+          break;
+        case 2:
+          accumulate<2>(dmb, pc, w, K, I, A);
+          break;
+        case 3:
+          accumulate<3>(dmb, pc, w, K, I, A);
+          break;
+        case 4:
+          accumulate<4>(dmb, pc, w, K, I, A);
+          break;
+        default:
+          accumulate(dmb, pc, w, K, M, I, A);
+          break;
+        };
 
         // Do the inversion to compute the profile fits
-        inversion_in_place(&A[0], M, &I[0], 1);
+        inversion_in_place(A, M, I, 1);
 
         // Compute error
         error_ = 0;
@@ -356,17 +371,12 @@ namespace dials { namespace algorithms {
         }
 
         // Set the old intensity
-        I0 = I;
+        std::copy(I, I + M, I0);
       }
 
       // Set the return values
       for (std::size_t j = 0; j < M; ++j) {
-        double V = std::abs(I[j]);
-        for (std::size_t i = 0; i < N; ++i) {
-          if (m[i]) {
-            V += b[i];
-          }
-        }
+        double V = std::abs(I[j]) + sumb;
 
         DIALS_ASSERT(V >= 0);
         DIALS_ASSERT(V >= I[j]);
@@ -379,6 +389,99 @@ namespace dials { namespace algorithms {
       correlation_ = compute_correlation(d, b, m, p);
     }
 
+    /**
+     * Compute the weight of each gathered pixel as the reciprocal of the
+     * variance, b + sum_j max(min_intensity, |I_j|) * p_j
+     */
+    static void compute_weights(const double *bg,
+                                const double *pc,
+                                const double *I,
+                                double *w,
+                                std::size_t K,
+                                std::size_t M,
+                                double min_intensity) {
+      std::copy(bg, bg + K, w);
+      for (std::size_t j = 0; j < M; ++j) {
+        const double *pj = pc + j * K;
+        double scale = std::max(min_intensity, std::abs(I[j]));
+        for (std::size_t i = 0; i < K; ++i) {
+          w[i] += scale * pj[i];
+        }
+      }
+      double vmin = K > 0 ? w[0] : 1.0;
+      for (std::size_t i = 0; i < K; ++i) {
+        vmin = std::min(vmin, w[i]);
+        w[i] = 1.0 / w[i];
+      }
+      DIALS_ASSERT(vmin > 0);
+    }
+
+    /**
+     * Accumulate the right hand side and normal matrix for a small fixed
+     * number of profiles. The pixel loop is outermost and the profile loops
+     * are unrolled so the sums stay in registers.
+     */
+    template <std::size_t M>
+    static void accumulate(const double *dmb,
+                           const double *pc,
+                           const double *w,
+                           std::size_t K,
+                           double *I,
+                           double *A) {
+      double rhs[M];
+      double lhs[M * M];
+      std::fill(rhs, rhs + M, 0.0);
+      std::fill(lhs, lhs + M * M, 0.0);
+      for (std::size_t i = 0; i < K; ++i) {
+        double t = dmb[i] * w[i];
+        for (std::size_t k = 0; k < M; ++k) {
+          double pk = pc[k * K + i];
+          double pkw = pk * w[i];
+          rhs[k] += pk * t;
+          for (std::size_t j = k; j < M; ++j) {
+            lhs[j + k * M] += pkw * pc[j * K + i];
+          }
+        }
+      }
+      for (std::size_t k = 0; k < M; ++k) {
+        I[k] = rhs[k];
+        for (std::size_t j = k; j < M; ++j) {
+          A[j + k * M] = lhs[j + k * M];
+          A[k + j * M] = lhs[j + k * M];
+        }
+      }
+    }
+
+    /**
+     * Accumulate the right hand side and normal matrix for any number of
+     * profiles. Each sum is a contiguous loop over the gathered pixels.
+     */
+    static void accumulate(const double *dmb,
+                           const double *pc,
+                           const double *w,
+                           std::size_t K,
+                           std::size_t M,
+                           double *I,
+                           double *A) {
+      for (std::size_t k = 0; k < M; ++k) {
+        const double *pk = pc + k * K;
+        double rhs = 0.0;
+        for (std::size_t i = 0; i < K; ++i) {
+          rhs += pk[i] * dmb[i] * w[i];
+        }
+        I[k] = rhs;
+        for (std::size_t j = k; j < M; ++j) {
+          const double *pj = pc + j * K;
+          double lhs = 0.0;
+          for (std::size_t i = 0; i < K; ++i) {
+            lhs += pk[i] * pj[i] * w[i];
+          }
+          A[j + k * M] = lhs;
+          A[k + j * M] = lhs;
+        }
+      }
+    }
+
     /**
      * Compute the correlation for a single reflection
      */
@@ -17,7 +17,7 @@
 class ProcessorImage(object):
     """Top level processor for per image processing."""
 
-    def __init__(self, experiments, reflections, params):
+    def __init__(self, experiments, reflections, params, images_per_task=1):
         """
         Initialise the manager and the processor.
 
@@ -26,10 +26,13 @@ def __init__(self, experiments, reflections, params):
         results to expose to the user.
 
         :param params: The phil parameters
+        :param images_per_task: The number of consecutive images in each task
         """
 
         # Create the processing manager
-        self.manager = ManagerImage(experiments, reflections, params)
+        self.manager = ManagerImage(
+            experiments, reflections, params, images_per_task=images_per_task
+        )
 
     @property
     def executor(self):
@@ -225,13 +228,14 @@ class ManagerImage(object):
     A class to manage processing book-keeping
     """
 
-    def __init__(self, experiments, reflections, params):
+    def __init__(self, experiments, reflections, params, images_per_task=1):
         """
         Initialise the manager.
 
         :param experiments: The list of experiments
         :param reflections: The list of reflections
         :param params: The phil parameters
+        :param images_per_task: The number of consecutive images in each task
         """
         # Initialise the callbacks
         self.executor = None
@@ -242,6 +246,7 @@ def __init__(self, experiments, reflections, params):
 
         # Save some parameters
         self.params = params
+        self.images_per_task = images_per_task
 
         # Set the finalized flag to False
         self.finalized = False
@@ -264,7 +269,9 @@ def initialize(self):
 
         # Create the reflection manager
         frames = self.experiments[0].scan.get_array_range()
-        self.manager = ReflectionManagerPerImage(frames, self.reflections)
+        self.manager = ReflectionManagerPerImage(
+            frames, self.reflections, batch_size=self.images_per_task
+        )
 
         # Parallel reading of HDF5 from the same handle is not allowed. Python
         # multiprocessing is a bit messed up and used fork on linux so need to
@@ -0,0 +1,272 @@
+/*
+ * integration_timer.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_INTEGRATION_INTEGRATION_TIMER_H
+#define DIALS_ALGORITHMS_INTEGRATION_INTEGRATION_TIMER_H
+
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/array_family/shared.h>
+#include <dials/util/thread_local.h>
+#include <dials/util/timer.h>
+#include <dials/util/trace.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A summary of the time spent in each stage of parallel integration. The
+   * reflection stages are summed over all the worker threads; the image read,
+   * buffer stall and buffer copy times are for the thread reading the images.
+   */
+  class IntegrationTiming {
+  public:
+    enum Stage {
+      Extract,
+      Mask,
+      Background,
+      Centroid,
+      Summation,
+      Profile,
+      Write,
+      NumStages
+    };
+
+    IntegrationTiming()
+        : num_threads_(0),
+          num_reflections_(0),
+          read_(0),
+          stall_(0),
+          copy_(0),
+          total_(0) {
+      std::fill(stage_, stage_ + NumStages, 0.0);
+    }
+
+    /** @returns The name of a reflection stage */
+    static const char *stage_name(std::size_t index) {
+      static const char *names[NumStages] = {
+        "extract", "mask", "background", "centroid", "summation", "profile", "write"};
+      DIALS_ASSERT(index < NumStages);
+      return names[index];
+    }
+
+    /** @returns The time spent in a reflection stage */
+    double stage(std::size_t index) const {
+      DIALS_ASSERT(index < NumStages);
+      return stage_[index];
+    }
+
+    /** @returns The time spent extracting shoeboxes from the buffer */
+    double extract() const {
+      return stage_[Extract];
+    }
+
+    /** @returns The time spent computing masks */
+    double mask() const {
+      return stage_[Mask];
+    }
+
+    /** @returns The time spent computing the background */
+    double background() const {
+      return stage_[Background];
+    }
+
+    /** @returns The time spent computing centroids */
+    double centroid() const {
+      return stage_[Centroid];
+    }
+
+    /** @returns The time spent computing summed intensities */
+    double summation() const {
+      return stage_[Summation];
+    }
+
+    /** @returns The time spent profile fitting or accumulating profiles */
+    double profile() const {
+      return stage_[Profile];
+    }
+
+    /** @returns The time spent inspecting pixels and writing the results */
+    double write() const {
+      return stage_[Write];
+    }
+
+    /** @returns The time spent reading or waiting for images */
+    double read() const {
+      return read_;
+    }
+
+    /** @returns The time spent waiting for a free slot in the buffer */
+    double stall() const {
+      return stall_;
+    }
+
+    /** @returns The time spent copying images into the buffer */
+    double copy() const {
+      return copy_;
+    }
+
+    /** @returns The total elapsed time */
+    double total() const {
+      return total_;
+    }
+
+    /** @returns The number of worker threads */
+    std::size_t num_threads() const {
+      return num_threads_;
+    }
+
+    /** @returns The number of reflections processed */
+    std::size_t num_reflections() const {
+      return num_reflections_;
+    }
+
+    /** @returns The busy time of each worker thread which processed reflections */
+    af::shared<double> thread_time() const {
+      return thread_time_;
+    }
+
+  protected:
+    friend class IntegrationTimer;
+
+    double stage_[NumStages];
+    af::shared<double> thread_time_;
+    std::size_t num_threads_;
+    std::size_t num_reflections_;
+    double read_;
+    double stall_;
+    double copy_;
+    double total_;
+  };
+
+  /**
+   * A class to accumulate the time spent in each stage of parallel integration.
+   * Each worker thread accumulates into its own counters so there is no
+   * contention between threads; the counters are only summed at the end.
+   */
+  class IntegrationTimer : private boost::noncopyable {
+  public:
+    typedef IntegrationTiming::Stage Stage;
+
+    /**
+     * The counters for a single thread
+     */
+    struct Counters {
+      Counters() : num_reflections(0) {
+        std::fill(time, time + IntegrationTiming::NumStages, 0.0);
+      }
+
+      double time[IntegrationTiming::NumStages];
+      std::size_t num_reflections;
+    };
+
+    /**
+     * A helper to time consecutive stages of processing a reflection
+     */
+    class StageClock {
+    public:
+      StageClock(Counters &counters)
+          : counters_(counters), last_(dials::util::monotonic_time()) {
+        counters_.num_reflections++;
+      }
+
+      /**
+       * Add the time since the last lap to a stage
+       * @param stage The stage
+       */
+      void lap(Stage stage) {
+        double now = dials::util::monotonic_time();
+        counters_.time[stage] += now - last_;
+        DIALS_TRACE_SPAN(
+          "integrator", IntegrationTiming::stage_name(stage), last_, now);
+        last_ = now;
+      }
+
+    protected:
+      Counters &counters_;
+      double last_;
+    };
+
+    IntegrationTimer() : read_(0), stall_(0), copy_(0) {}
+
+    /**
+     * @returns The counters for the calling thread
+     */
+    Counters &local() {
+      Counters *counters = local_.get();
+      if (counters == NULL) {
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        counters_.push_back(new Counters());
+        counters = &counters_.back();
+        local_.reset(counters);
+      }
+      return *counters;
+    }
+
+    /**
+     * Add time spent reading or waiting for images
+     */
+    void add_read(double t) {
+      read_ += t;
+    }
+
+    /**
+     * Add time spent waiting for a free slot in the buffer
+     */
+    void add_stall(double t) {
+      stall_ += t;
+    }
+
+    /**
+     * Add time spent copying images into the buffer
+     */
+    void add_copy(double t) {
+      copy_ += t;
+    }
+
+    /**
+     * Sum the counters from all the threads. This must only be called once the
+     * worker threads have finished.
+     * @param num_threads The number of worker threads
+     * @param total The total elapsed time
+     * @returns The timing summary
+     */
+    IntegrationTiming summary(std::size_t num_threads, double total) const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      IntegrationTiming result;
+      result.num_threads_ = num_threads;
+      result.read_ = read_;
+      result.stall_ = stall_;
+      result.copy_ = copy_;
+      result.total_ = total;
+      for (std::size_t i = 0; i < counters_.size(); ++i) {
+        double thread_time = 0;
+        for (std::size_t j = 0; j < IntegrationTiming::NumStages; ++j) {
+          result.stage_[j] += counters_[i].time[j];
+          thread_time += counters_[i].time[j];
+        }
+        result.num_reflections_ += counters_[i].num_reflections;
+        result.thread_time_.push_back(thread_time);
+      }
+      return result;
+    }
+
+  protected:
+    // The counters are owned by the timer, not the thread
+    dials::util::ThreadLocalPtr<Counters> local_;
+    mutable boost::mutex mutex_;
+    boost::ptr_vector<Counters> counters_;
+    double read_;
+    double stall_;
+    double copy_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_INTEGRATION_TIMER_H
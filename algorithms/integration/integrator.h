@@ -16,6 +16,7 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <list>
 #include <vector>
@@ -115,6 +116,306 @@ namespace dials { namespace algorithms {
     std::vector<Group> groups_;
   };
 
+  /**
+   * A class to plan the processing blocks from the reflections.
+   *
+   * As with the uniform blocks, the scan is cut into half blocks and each
+   * block covers two consecutive half blocks. Here the half block boundaries
+   * are placed so that each half block holds a similar number of shoebox
+   * pixels, subject to the boundaries being far enough apart that reflections
+   * starting in one half block end within the block, and close enough that no
+   * block is larger than the maximum block size. Reflections are assigned to
+   * the block whose centre is closest to their own, as in the reflection
+   * lookup, and those not contained in that block are counted as split. If the
+   * uniform blocks for the nominal block size would split fewer reflections
+   * then they are used instead.
+   */
+  class BlockPlanner {
+  public:
+    /**
+     * Plan the blocks
+     * @param range The range of frames
+     * @param bbox The reflection bounding boxes
+     * @param block_size The nominal block size
+     * @param max_block_size The maximum block size allowed by the memory
+     */
+    BlockPlanner(tiny<int, 2> range,
+                 const af::const_ref<int6> &bbox,
+                 int block_size,
+                 int max_block_size) {
+      int nframes = range[1] - range[0];
+      DIALS_ASSERT(nframes > 0);
+      DIALS_ASSERT(block_size > 0);
+      DIALS_ASSERT(max_block_size > 0);
+      block_size = std::min(block_size, std::min(max_block_size, nframes));
+
+      // Plan the uniform blocks and, if the blocks can be larger than one
+      // frame, the adaptive blocks. Use whichever splits fewer reflections.
+      blocks_ = uniform_blocks(range, block_size);
+      num_split_uniform_ = evaluate(blocks_, range, bbox, NULL, NULL);
+      adaptive_ = false;
+      if (max_block_size > 1) {
+        std::vector<tiny<int, 2> > adaptive =
+          adaptive_blocks(range, bbox, block_size, max_block_size);
+        if (is_valid(adaptive, range)
+            && evaluate(adaptive, range, bbox, NULL, NULL) <= num_split_uniform_) {
+          blocks_ = adaptive;
+          adaptive_ = true;
+        }
+      }
+      num_split_ = evaluate(blocks_, range, bbox, &num_reflections_, &num_pixels_);
+    }
+
+    /**
+     * @returns The planned blocks
+     */
+    af::shared<tiny<int, 2> > blocks() const {
+      return af::shared<tiny<int, 2> >(blocks_.begin(), blocks_.end());
+    }
+
+    /**
+     * @returns The number of reflections assigned to each block
+     */
+    af::shared<std::size_t> num_reflections() const {
+      return af::shared<std::size_t>(num_reflections_.begin(),
+                                     num_reflections_.end());
+    }
+
+    /**
+     * @returns The number of shoebox pixels assigned to each block
+     */
+    af::shared<std::size_t> num_pixels() const {
+      return af::shared<std::size_t>(num_pixels_.begin(), num_pixels_.end());
+    }
+
+    /**
+     * @returns The number of reflections which will be split
+     */
+    std::size_t num_split() const {
+      return num_split_;
+    }
+
+    /**
+     * @returns The number of reflections the uniform blocks would split
+     */
+    std::size_t num_split_uniform() const {
+      return num_split_uniform_;
+    }
+
+    /**
+     * @returns True if the adaptive blocks were used
+     */
+    bool adaptive() const {
+      return adaptive_;
+    }
+
+  private:
+    /**
+     * Compute the uniform blocks as in JobList
+     */
+    static std::vector<tiny<int, 2> > uniform_blocks(tiny<int, 2> range,
+                                                     int block_size) {
+      int frame0 = range[0];
+      int frame1 = range[1];
+      int nframes = frame1 - frame0;
+      std::vector<tiny<int, 2> > blocks;
+      if (block_size == 1) {
+        for (int f = frame0; f < frame1; ++f) {
+          blocks.push_back(tiny<int, 2>(f, f + 1));
+        }
+      } else {
+        int nblocks = (int)std::ceil(2.0 * nframes / (double)block_size);
+        int half_block_size = (int)std::ceil((double)nframes / (double)nblocks);
+        std::vector<int> indices(1, frame0);
+        for (int i = 0; i < nblocks && indices.back() < frame1; ++i) {
+          indices.push_back(std::min(frame0 + (i + 1) * half_block_size, frame1));
+        }
+        blocks = blocks_from_boundaries(indices);
+      }
+      return blocks;
+    }
+
+    /**
+     * Place the half block boundaries from the pixel histogram
+     */
+    static std::vector<tiny<int, 2> > adaptive_blocks(
+      tiny<int, 2> range,
+      const af::const_ref<int6> &bbox,
+      int block_size,
+      int max_block_size) {
+      int frame0 = range[0];
+      int frame1 = range[1];
+      int nframes = frame1 - frame0;
+
+      // The number of pixels on each frame and the last frame of the
+      // reflections starting on each frame
+      std::vector<double> pixels(nframes, 0);
+      std::vector<int> last(nframes, 0);
+      double total = 0;
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        int z0 = std::max(bbox[i][4], frame0);
+        int z1 = std::min(bbox[i][5], frame1);
+        if (z0 >= z1) {
+          continue;
+        }
+        double area = (double)(bbox[i][1] - bbox[i][0]) * (bbox[i][3] - bbox[i][2]);
+        for (int z = z0; z < z1; ++z) {
+          pixels[z - frame0] += area;
+        }
+        total += area * (z1 - z0);
+        last[z0 - frame0] = std::max(last[z0 - frame0], z1);
+      }
+
+      // The target number of pixels in each half block
+      int half_block_size = std::max(block_size / 2, 1);
+      int nhalf = (int)std::ceil((double)nframes / (double)half_block_size);
+      double target = total / nhalf;
+
+      // Place each boundary where the half block reaches the target number of
+      // pixels, then clamp it so that the reflections starting in the previous
+      // half block are contained and the block is not too large. Neighbouring
+      // half blocks are kept within a factor of two of each other so that the
+      // block closest to each frame still contains it.
+      std::vector<int> indices(1, frame0);
+      while (indices.back() < frame1) {
+        int p = indices.back();
+        int upper = std::min(p + max_block_size - 1, frame1);
+        int lower = p + 1;
+        if (indices.size() > 1) {
+          int p0 = indices[indices.size() - 2];
+          int width = p - p0;
+          upper = std::min(upper, std::min(p0 + max_block_size, p + 2 * width));
+          lower = std::max(lower, p + (width + 1) / 2);
+          for (int z = p0; z < p; ++z) {
+            lower = std::max(lower, last[z - frame0]);
+          }
+        }
+        int c = p + 1;
+        if (target > 0) {
+          double sum = pixels[p - frame0];
+          while (c < frame1 && sum < target) {
+            sum += pixels[c - frame0];
+            ++c;
+          }
+        } else {
+          c = p + half_block_size;
+        }
+        c = std::max(c, std::min(lower, upper));
+        c = std::min(c, upper);
+        DIALS_ASSERT(c > p);
+        indices.push_back(c);
+      }
+      return blocks_from_boundaries(indices);
+    }
+
+    /**
+     * Make the blocks covering pairs of half blocks
+     */
+    static std::vector<tiny<int, 2> > blocks_from_boundaries(
+      const std::vector<int> &indices) {
+      DIALS_ASSERT(indices.size() >= 2);
+      std::vector<tiny<int, 2> > blocks;
+      if (indices.size() == 2) {
+        blocks.push_back(tiny<int, 2>(indices[0], indices[1]));
+      }
+      for (std::size_t i = 0; i + 2 < indices.size(); ++i) {
+        DIALS_ASSERT(indices[i + 2] > indices[i]);
+        blocks.push_back(tiny<int, 2>(indices[i], indices[i + 2]));
+      }
+      return blocks;
+    }
+
+    /**
+     * Find the block whose centre is closest to each frame, as in the
+     * reflection lookup
+     */
+    static std::vector<std::size_t> closest_blocks(
+      const std::vector<tiny<int, 2> > &blocks,
+      tiny<int, 2> range) {
+      DIALS_ASSERT(blocks.size() > 0);
+      std::vector<std::size_t> lookup;
+      std::size_t closest = 0;
+      for (int frame = range[0]; frame < range[1]; ++frame) {
+        while (closest + 1 < blocks.size()
+               && std::abs((blocks[closest + 1][0] + blocks[closest + 1][1]) / 2.0
+                           - (frame + 0.5))
+                    < std::abs((blocks[closest][0] + blocks[closest][1]) / 2.0
+                               - (frame + 0.5))) {
+          ++closest;
+        }
+        lookup.push_back(closest);
+      }
+      return lookup;
+    }
+
+    /**
+     * Check that the block closest to each frame contains the frame
+     */
+    static bool is_valid(const std::vector<tiny<int, 2> > &blocks,
+                         tiny<int, 2> range) {
+      std::vector<std::size_t> lookup = closest_blocks(blocks, range);
+      for (int frame = range[0]; frame < range[1]; ++frame) {
+        const tiny<int, 2> &block = blocks[lookup[frame - range[0]]];
+        if (frame < block[0] || frame >= block[1]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Assign the reflections to the block with the closest centre and count
+     * the reflections which are not contained in their block.
+     */
+    static std::size_t evaluate(const std::vector<tiny<int, 2> > &blocks,
+                                tiny<int, 2> range,
+                                const af::const_ref<int6> &bbox,
+                                std::vector<std::size_t> *num_reflections,
+                                std::vector<std::size_t> *num_pixels) {
+      int frame0 = range[0];
+      int frame1 = range[1];
+      std::vector<std::size_t> lookup = closest_blocks(blocks, range);
+
+      // Assign the reflections
+      if (num_reflections != NULL) {
+        num_reflections->assign(blocks.size(), 0);
+      }
+      if (num_pixels != NULL) {
+        num_pixels->assign(blocks.size(), 0);
+      }
+      std::size_t num_split = 0;
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        int z0 = std::max(bbox[i][4], frame0);
+        int z1 = std::min(bbox[i][5], frame1);
+        if (z0 >= z1) {
+          continue;
+        }
+        int zc = (int)std::floor((z0 + z1) / 2.0);
+        std::size_t index = lookup[zc - frame0];
+        const tiny<int, 2> &block = blocks[index];
+        if (z0 < block[0] || z1 > block[1]) {
+          num_split++;
+        }
+        if (num_reflections != NULL) {
+          (*num_reflections)[index]++;
+        }
+        if (num_pixels != NULL) {
+          int area = (bbox[i][1] - bbox[i][0]) * (bbox[i][3] - bbox[i][2]);
+          int depth = std::min(z1, block[1]) - std::max(z0, block[0]);
+          (*num_pixels)[index] += std::max(area * depth, 0);
+        }
+      }
+      return num_split;
+    }
+
+    std::vector<tiny<int, 2> > blocks_;
+    std::vector<std::size_t> num_reflections_;
+    std::vector<std::size_t> num_pixels_;
+    std::size_t num_split_;
+    std::size_t num_split_uniform_;
+    bool adaptive_;
+  };
+
   /**
    * A class to manage jobs for multiple sequences
    */
@@ -192,6 +493,32 @@ namespace dials { namespace algorithms {
       groups_.add(int2(j0, j1), expr, range);
     }
 
+    /**
+     * Add a new group of jobs with the given blocks
+     * @param expr The range of experiments
+     * @param range The range of frames
+     * @param blocks The job blocks covering the range
+     */
+    void add(tiny<int, 2> expr,
+             tiny<int, 2> range,
+             const af::const_ref<tiny<int, 2> > &blocks) {
+      DIALS_ASSERT(blocks.size() > 0);
+      DIALS_ASSERT(blocks.front()[0] == range[0]);
+      DIALS_ASSERT(blocks.back()[1] == range[1]);
+      std::size_t j0 = size();
+      for (std::size_t i = 0; i < blocks.size(); ++i) {
+        DIALS_ASSERT(blocks[i][1] > blocks[i][0]);
+        if (i > 0) {
+          DIALS_ASSERT(blocks[i][0] > blocks[i - 1][0]);
+          DIALS_ASSERT(blocks[i][1] > blocks[i - 1][1]);
+          DIALS_ASSERT(blocks[i][0] <= blocks[i - 1][1]);
+        }
+        jobs_.push_back(Job(groups_.size(), expr, blocks[i]));
+      }
+      std::size_t j1 = size();
+      groups_.add(int2(j0, j1), expr, range);
+    }
+
     /**
      * @returns The requested job
      */
@@ -369,18 +696,22 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class to managing reflection lookup indices
+   * A class to managing reflection lookup indices. The job for each reflection
+   * is found in parallel and the reflections are then stored in compressed
+   * sparse row form, in order within each job. The lookup can be computed once
+   * and shared by everything which processes the same jobs and reflections.
    */
   class ReflectionLookup {
   public:
     ReflectionLookup(const af::const_ref<int> &id,
                      const af::const_ref<std::size_t> &flags,
                      const af::const_ref<int6> &bbox,
-                     const JobList &jobs)
+                     const JobList &jobs,
+                     std::size_t nthreads = 1)
         : jobs_(jobs) {
       DIALS_ASSERT(jobs_.size() > 0);
-
-      typedef std::vector<std::size_t> job_list_type;
+      DIALS_ASSERT(id.size() == bbox.size());
+      DIALS_ASSERT(flags.size() == bbox.size());
 
       // Check all the reflections are in range
       for (std::size_t i = 0; i < bbox.size(); ++i) {
@@ -393,68 +724,41 @@ namespace dials { namespace algorithms {
       // Compute the job range lookup table
       JobRangeLookup lookup(jobs);
 
-      // Get which reflections to process in which job and task
-      std::vector<job_list_type> indices(jobs_.size());
-      for (std::size_t index = 0; index < bbox.size(); ++index) {
-        std::size_t eid = id[index];
-        int z0 = bbox[index][4];
-        int z1 = bbox[index][5];
-        const std::size_t &f = flags[index];
-        if (!(f & af::DontIntegrate)) {
-          std::size_t j0 = lookup.first(eid, z0);
-          std::size_t j1 = lookup.last(eid, z1 - 1);
-          DIALS_ASSERT(j0 < jobs_.size());
-          DIALS_ASSERT(j1 < jobs_.size());
-          DIALS_ASSERT(j1 >= j0);
-          DIALS_ASSERT(z0 >= jobs_[j0].frames()[0]);
-          DIALS_ASSERT(z1 <= jobs_[j1].frames()[1]);
-          std::size_t jmin = 0;
-          double dmin = 0;
-          bool inside = false;
-          for (std::size_t j = j0; j <= j1; ++j) {
-            int jz0 = jobs_[j].frames()[0];
-            int jz1 = jobs_[j].frames()[1];
-            if (z0 >= jz0 && z1 <= jz1) {
-              double zc = (z1 + z0) / 2.0;
-              double jc = (jz1 + jz0) / 2.0;
-              double d = std::abs(zc - jc);
-              if (!inside || d < dmin) {
-                jmin = j;
-                dmin = d;
-                inside = true;
-              }
-            }
-          }
-          int jz0 = jobs_[jmin].frames()[0];
-          int jz1 = jobs_[jmin].frames()[1];
-          DIALS_ASSERT(inside == true);
-          DIALS_ASSERT(z0 >= jz0 && z1 <= jz1);
-          indices[jmin].push_back(index);
+      // Get which reflections to process in which job
+      std::vector<std::size_t> job(bbox.size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&ReflectionLookup::assign_jobs,
+                    this,
+                    boost::cref(lookup),
+                    id,
+                    flags,
+                    bbox,
+                    af::ref<std::size_t>(job.empty() ? 0 : &job[0], job.size()),
+                    _1,
+                    _2),
+        bbox.size(),
+        nthreads);
+
+      // Compute offsets from the number of reflections in each job
+      offset_ = af::shared<std::size_t>(jobs_.size() + 1, 0);
+      for (std::size_t i = 0; i < job.size(); ++i) {
+        if (job[i] < jobs_.size()) {
+          offset_[job[i] + 1]++;
         }
       }
-
-      // Compute number of reflections in each task
-      std::vector<std::size_t> num(jobs_.size(), 0);
-      for (std::size_t i = 0; i < num.size(); ++i) {
-        num[i] = indices[i].size();
+      for (std::size_t i = 0; i < jobs_.size(); ++i) {
+        offset_[i + 1] += offset_[i];
       }
 
-      // Compute offsests
-      offset_.push_back(0);
-      std::partial_sum(num.begin(), num.end(), std::back_inserter(offset_));
-
       // Compute indices
-      indices_.resize(offset_.back());
-      std::size_t k = 0;
-      for (std::size_t i = 0; i < indices.size(); ++i) {
-        const job_list_type &ind = indices[i];
-        for (std::size_t j = 0; j < ind.size(); ++j, ++k) {
-          DIALS_ASSERT(k < indices_.size());
-          indices_[k] = ind[j];
-          DIALS_ASSERT(indices_[k] < bbox.size());
+      indices_ = af::shared<std::size_t>(offset_.back());
+      std::vector<std::size_t> position(offset_.begin(), offset_.end() - 1);
+      for (std::size_t i = 0; i < job.size(); ++i) {
+        if (job[i] < jobs_.size()) {
+          indices_[position[job[i]]++] = i;
         }
       }
-      DIALS_ASSERT(k == indices_.size());
+      num_rows_ = bbox.size();
     }
 
     /**
@@ -486,9 +790,70 @@ namespace dials { namespace algorithms {
       return af::const_ref<std::size_t>(&indices_[off], num);
     }
 
+    /**
+     * @returns The number of reflections the lookup was computed for
+     */
+    std::size_t num_rows() const {
+      return num_rows_;
+    }
+
+  private:
+    /**
+     * Find the job for a band of reflections, the one whose frame range
+     * contains the reflection with the centre closest to the reflection's, or
+     * the number of jobs if the reflection is not to be integrated.
+     */
+    void assign_jobs(const JobRangeLookup &lookup,
+                     const af::const_ref<int> &id,
+                     const af::const_ref<std::size_t> &flags,
+                     const af::const_ref<int6> &bbox,
+                     af::ref<std::size_t> job,
+                     std::size_t first,
+                     std::size_t last) const {
+      for (std::size_t index = first; index < last; ++index) {
+        job[index] = jobs_.size();
+        std::size_t eid = id[index];
+        int z0 = bbox[index][4];
+        int z1 = bbox[index][5];
+        const std::size_t &f = flags[index];
+        if (!(f & af::DontIntegrate)) {
+          std::size_t j0 = lookup.first(eid, z0);
+          std::size_t j1 = lookup.last(eid, z1 - 1);
+          DIALS_ASSERT(j0 < jobs_.size());
+          DIALS_ASSERT(j1 < jobs_.size());
+          DIALS_ASSERT(j1 >= j0);
+          DIALS_ASSERT(z0 >= jobs_[j0].frames()[0]);
+          DIALS_ASSERT(z1 <= jobs_[j1].frames()[1]);
+          std::size_t jmin = 0;
+          double dmin = 0;
+          bool inside = false;
+          for (std::size_t j = j0; j <= j1; ++j) {
+            int jz0 = jobs_[j].frames()[0];
+            int jz1 = jobs_[j].frames()[1];
+            if (z0 >= jz0 && z1 <= jz1) {
+              double zc = (z1 + z0) / 2.0;
+              double jc = (jz1 + jz0) / 2.0;
+              double d = std::abs(zc - jc);
+              if (!inside || d < dmin) {
+                jmin = j;
+                dmin = d;
+                inside = true;
+              }
+            }
+          }
+          int jz0 = jobs_[jmin].frames()[0];
+          int jz1 = jobs_[jmin].frames()[1];
+          DIALS_ASSERT(inside == true);
+          DIALS_ASSERT(z0 >= jz0 && z1 <= jz1);
+          job[index] = jmin;
+        }
+      }
+    }
+
     JobList jobs_;
     af::shared<std::size_t> offset_;
     af::shared<std::size_t> indices_;
+    std::size_t num_rows_;
   };
 
   /**
@@ -507,6 +872,22 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(finished_.size() > 0);
     }
 
+    /**
+     * Create the reflection manager with a precomputed lookup
+     * @param jobs The job calculator
+     * @param data The reflection data
+     * @param lookup The reflection lookup for the jobs and data
+     */
+    ReflectionManager(const JobList &jobs,
+                      af::reflection_table data,
+                      const ReflectionLookup &lookup)
+        : lookup_(lookup), data_(data), finished_(lookup_.size(), false) {
+      DIALS_ASSERT(data.is_consistent());
+      DIALS_ASSERT(lookup_.size() == jobs.size());
+      DIALS_ASSERT(lookup_.num_rows() == data.size());
+      DIALS_ASSERT(finished_.size() > 0);
+    }
+
     /**
      * @returns The result data
      */
@@ -1,10 +1,16 @@
 from __future__ import absolute_import, division, print_function
 
 import collections
+import copy
 import functools
 import logging
 import math
+import os
 import random
+import shutil
+import sys
+import tempfile
+import threading
 
 import six
 import six.moves.cPickle as pickle
@@ -15,6 +21,7 @@
 from dials.algorithms.integration.parallel_integrator import (
     IntegratorProcessor,
     ReferenceCalculatorProcessor,
+    ThreadPool,
 )
 from dials.algorithms.integration.processor import (
     Processor2D,
@@ -36,12 +43,14 @@
 from dials.array_family import flex
 from dials.util import Sorry, phil, pprint, tabulate
 from dials.util.command_line import heading
+from dials.util.memory_accounting import log_memory_usage
 from dials.util.report import Report
 from dials_algorithms_integration_integrator_ext import (
     Executor,
     JobList,
     ReflectionManager,
 )
+from dxtbx.model.experiment_list import ExperimentList
 
 logger = logging.getLogger(__name__)
 
@@ -111,17 +120,111 @@ def generate_phil_scope():
                   "number of blocks may be set to 1. If force is True then the"
                   "block size is always calculated."
 
+        adaptive = False
+          .type = bool
+          .help = "Place the block boundaries using the number of shoebox"
+                  "pixels on each frame and the frames covered by the"
+                  "reflections, so that few reflections are split between"
+                  "blocks and each block has a similar amount of work. The"
+                  "block size sets the nominal amount of work per block and"
+                  "no block is larger than memory allows. The uniform blocks"
+                  "are used if they would split fewer reflections."
+
         max_memory_usage = 0.90
           .type = float(value_min=0.0,value_max=1.0)
           .help = "The maximum percentage of available memory to use for"
                   "allocating shoebox arrays."
 
+        read_ahead = 0
+          .type = int(value_min=0)
+          .help = "The number of images to read ahead of processing on"
+                  "separate I/O threads. If 0 then images are read on the same"
+                  "thread which submits the integration jobs."
+
+        read_threads = 1
+          .type = int(value_min=1)
+          .help = "The number of I/O threads used when read_ahead > 0. More"
+                  "than one thread only helps if the image format releases"
+                  "the GIL while reading or decompressing the data."
+
+        compact_buffer = False
+          .type = bool
+          .help = "Store the buffered image data as 16 bit integers with an"
+                  "offset and scale for each image, halving the memory used by"
+                  "the buffer. Values are exact if the unmasked pixels on an"
+                  "image are integers spanning at most 65534 counts, otherwise"
+                  "they are quantised."
+
+        compress_buffer = False
+          .type = bool
+          .help = "Store the buffered image data as for compact_buffer, but"
+                  "compressed in 64x64 pixel tiles, each bit packed with just"
+                  "enough bits for the range of values in the tile. Sparse"
+                  "diffraction images compress several times further, which"
+                  "allows deep buffers for reflections spanning many images."
+
+        batch_size = 1
+          .type = int(value_min=1)
+          .help = "For the threaded integrator, the number of reflections"
+                  "finishing on the same image and panel node which are"
+                  "integrated together as one job. The mask, background and"
+                  "intensity calculators are then given the whole batch at"
+                  "once, which reduces the scheduling overhead for small"
+                  "reflections and lets batched implementations of the"
+                  "calculators work on many reflections in one call."
+
+        stream_output = None
+          .type = path
+          .help = "If set, the integrated reflections from each job are"
+                  "appended to this file as soon as the job finishes instead"
+                  "of being collected in memory, and the input reflections"
+                  "of each job are kept on disk until the job has finished."
+                  "The file is read back in the original reflection order"
+                  "once integration has finished."
+
+        checkpoint = None
+          .type = path
+          .help = "If set, the integrated reflections from each job of the"
+                  "threaded integrator are saved to this directory as soon as"
+                  "the job finishes, so that an interrupted run can be"
+                  "resumed."
+
+        resume = False
+          .type = bool
+          .help = "Reload the jobs saved in the checkpoint directory by an"
+                  "interrupted run and only integrate the remaining jobs. The"
+                  "run must use the same input and parameters, so that the"
+                  "jobs match and the result is the same as that of an"
+                  "uninterrupted run."
+
+        reuse_shoeboxes = False
+          .type = bool
+          .help = "Keep the shoeboxes, masks and backgrounds computed while"
+                  "modelling the reference profiles and reuse them when"
+                  "integrating, so the images are only read and the"
+                  "backgrounds only computed once and only the profile"
+                  "fitting is done in the integration pass. All the"
+                  "reflections are processed while modelling, with only the"
+                  "reference spots used to build the profiles. The shoeboxes"
+                  "from each job are spilled to a temporary directory between"
+                  "the passes, so enough disk space is needed to hold them."
+
       }
 
       use_dynamic_mask = True
         .type = bool
         .help = "Use dynamic mask if available"
 
+      pixel_direction_table = False
+        .type = bool
+        .help = "For the threaded integrator, precompute the directions to the"
+                "pixel corners of each panel in single precision and use them"
+                "for the masks and profile transforms instead of computing"
+                "them for every reflection. Each panel table is built on first"
+                "use and takes 12 bytes per pixel for the masks and again for"
+                "the profiles. Panels with a parallax correction only use the"
+                "table where the attenuation length matches."
+
       debug {
 
         reference {
@@ -222,9 +325,12 @@ def generate_phil_scope():
       include scope dials.algorithms.integration.overlaps_filter.phil_scope
 
       mp {
-        method = *multiprocessing drmaa sge lsf pbs
+        method = *multiprocessing drmaa sge lsf pbs mpi
           .type = choice
-          .help = "The multiprocessing method to use"
+          .help = "The multiprocessing method to use. With mpi, which is only"
+                  "supported by the 3d_threaded integrator, every rank runs"
+                  "the program; rank 0 sends the jobs to the other ranks and"
+                  "gathers the results."
 
         njobs = 1
           .type = int(value_min=1)
@@ -233,6 +339,14 @@ def generate_phil_scope():
         nproc = 1
           .type = int(value_min=1)
           .help = "The number of processes to use per cluster job"
+
+        pin_threads = False
+          .type = bool
+          .help = "For the threaded integrator, pin the worker threads to the"
+                  "NUMA nodes and allocate the image buffer of each panel on"
+                  "one node. Reflections are then processed preferentially on"
+                  "the node holding their panel. Only used when the jobs are"
+                  "run in this process."
       }
 
       summation {
@@ -240,6 +354,12 @@ def generate_phil_scope():
           .type = float
           .help = "Multiplier for variances after integration of still images."
                   "See Leslie 1999."
+
+        estimator = *sum bayesian
+          .type = choice
+          .help = "The estimator of the summed intensity. The bayesian estimate"
+                  "is intended for very weak data, and replaces profile fitting"
+                  "when used with the threaded integrator."
       }
     }
   """,
@@ -391,6 +511,7 @@ def from_phil(params):
         block.units = params.block.units
         block.threshold = params.block.threshold
         block.force = params.block.force
+        block.adaptive = params.block.adaptive
         block.max_memory_usage = params.block.max_memory_usage
 
         # Set the modelling processor parameters
@@ -510,7 +631,9 @@ def _finalize_rotation(reflections, experiments, params):
     reflections, experiments = _finalize(reflections, experiments, params)
 
     # Compute the corrections
-    reflections.compute_corrections(experiments)
+    reflections.compute_corrections(
+        experiments, nthreads=params.integration.mp.nproc
+    )
     return reflections, experiments
 
 
@@ -1079,7 +1202,7 @@ def integrate(self):
                         profile_fitter = pf
                     else:
                         profile_fitter.accumulate(pf)
-                profile_fitter.finalize()
+                profile_fitter.finalize(nthreads=self.params.modelling.mp.nthreads)
 
                 # Get the finalized modeller
                 finalized_profile_fitter = profile_fitter.finalized_model()
@@ -1122,6 +1245,7 @@ def integrate(self):
                 logger.info("Timing information for reference profile formation")
                 logger.info(str(time_info))
                 logger.info("")
+                log_memory_usage("reference profile formation")
 
                 # If we have more than 1 fold then do the validation
                 if num_folds > 1:
@@ -1153,6 +1277,7 @@ def integrate(self):
                     logger.info("Timing information for reference profile validation")
                     logger.info(str(time_info))
                     logger.info("")
+                    log_memory_usage("reference profile validation")
 
                 # Set to the finalized fitter
                 profile_fitter = finalized_profile_fitter
@@ -1189,6 +1314,7 @@ def integrate(self):
         logger.info("Timing information for integration")
         logger.info(str(time_info))
         logger.info("")
+        log_memory_usage("integration")
 
         # Return the reflections
         return self.reflections
@@ -1281,6 +1407,58 @@ class IntegratorStills(Integrator):
     finalize_reflections = staticmethod(_finalize_stills)
 
 
+def _split_by_imageset(experiments, reflections):
+    """
+    Split the experiments and reflections into groups sharing an imageset. The
+    experiment ids of the reflections in each group are numbered from zero.
+
+    :param experiments: The experiment list
+    :param reflections: The reflections
+    :return: A list of (indices, experiments, reflections)
+    """
+    imagesets = experiments.imagesets()
+    if len(imagesets) <= 1:
+        return [(list(range(len(experiments))), experiments, reflections)]
+    indices = [[] for i in range(len(imagesets))]
+    for i, experiment in enumerate(experiments):
+        indices[imagesets.index(experiment.imageset)].append(i)
+    identifiers = dict(reflections.experiment_identifiers())
+    groups = []
+    for group in indices:
+        selection = flex.bool(len(reflections), False)
+        for i in group:
+            selection |= reflections["id"] == i
+        subset = reflections.select(selection)
+        ids = subset["id"].deep_copy()
+        for k in list(subset.experiment_identifiers().keys()):
+            del subset.experiment_identifiers()[k]
+        for j, i in enumerate(group):
+            subset["id"].set_selected(ids == i, j)
+            if i in identifiers:
+                subset.experiment_identifiers()[j] = identifiers[i]
+        groups.append((group, ExperimentList([experiments[i] for i in group]), subset))
+    return groups
+
+
+def _restore_ids(reflections, indices):
+    """
+    Map the experiment ids of a group of reflections back to the original ids
+
+    :param reflections: The reflections numbered from zero
+    :param indices: The original experiment ids
+    :return: The reflections
+    """
+    ids = reflections["id"].deep_copy()
+    identifiers = dict(reflections.experiment_identifiers())
+    for k in list(reflections.experiment_identifiers().keys()):
+        del reflections.experiment_identifiers()[k]
+    for j, i in enumerate(indices):
+        reflections["id"].set_selected(ids == j, i)
+        if j in identifiers:
+            reflections.experiment_identifiers()[i] = identifiers[j]
+    return reflections
+
+
 class Integrator3DThreaded(object):
     """
     Integrator for 3D algorithms
@@ -1377,56 +1555,174 @@ def integrate(self):
         # Do the initialisation
         self.initialise()
 
+        # Each imageset is processed separately. If there is more than one and
+        # the jobs are run in this process then the imagesets are processed
+        # concurrently, sharing one thread pool and the memory budget.
+        groups = _split_by_imageset(self.experiments, self.reflections)
+        if len(groups) == 1:
+            mp = self.params.integration.mp
+            if mp.pin_threads and mp.njobs == 1 and mp.method != "mpi":
+                thread_pool = ThreadPool(mp.nproc, pin_threads=True)
+            else:
+                thread_pool = None
+            self.reflections, self.reference_profiles = self._process(
+                self.experiments, self.reflections, self.params, thread_pool
+            )
+        else:
+            self._process_groups(groups)
+
+        # Do the finalisation
+        self.finalise()
+
+        # Create the integration report
+        self.integration_report = IntegrationReport(self.experiments, self.reflections)
+        logger.info("")
+        logger.info(self.integration_report.as_str(prefix=" "))
+
+        # Print the time info
+        # logger.info("Timing information for integration")
+        # logger.info(str(time_info))
+        # logger.info("")
+
+        # Return the reflections
+        return self.reflections
+
+    def _process(self, experiments, reflections, params, thread_pool=None):
+        """
+        Model the profiles and integrate the reflections from one imageset
+
+        :param experiments: The experiments sharing the imageset
+        :param reflections: The reflections for those experiments
+        :param params: The parameters to use
+        :param thread_pool: A thread pool shared with other imagesets
+        :return: The integrated reflections and the reference profiles
+        """
+
         # Do profile modelling
-        if self.params.integration.profile.fitting:
+        if params.integration.profile.fitting:
 
             logger.info("=" * 80)
             logger.info("")
             logger.info(heading("Modelling reflection profiles"))
             logger.info("")
 
+            # Optionally keep the shoeboxes for the integration pass
+            if params.integration.block.reuse_shoeboxes:
+                spill_directory = tempfile.mkdtemp(
+                    prefix="dials_shoeboxes_", dir=os.getcwd()
+                )
+            else:
+                spill_directory = None
+
             # Compute the reference profiles
             reference_calculator = ReferenceCalculatorProcessor(
-                experiments=self.experiments,
-                reflections=self.reflections,
-                params=self.params,
+                experiments=experiments,
+                reflections=reflections,
+                params=params,
+                spill_directory=spill_directory,
+                thread_pool=thread_pool,
             )
 
             # Get the reference profiles
-            self.reference_profiles = reference_calculator.profiles()
+            reference_profiles = reference_calculator.profiles()
         else:
-            self.reference_profiles = None
+            reference_profiles = None
+            spill_directory = None
 
         logger.info("=" * 80)
         logger.info("")
         logger.info(heading("Integrating reflections"))
         logger.info("")
 
-        integrator = IntegratorProcessor(
-            experiments=self.experiments,
-            reflections=self.reflections,
-            reference=self.reference_profiles,
-            params=self.params,
-        )
+        try:
+            integrator = IntegratorProcessor(
+                experiments=experiments,
+                reflections=reflections,
+                reference=reference_profiles,
+                params=params,
+                spill_directory=spill_directory,
+                thread_pool=thread_pool,
+            )
+        finally:
+            if spill_directory is not None:
+                shutil.rmtree(spill_directory, ignore_errors=True)
 
         # Process the reflections
-        self.reflections = integrator.reflections()
+        return integrator.reflections(), reference_profiles
 
-        # Do the finalisation
-        self.finalise()
+    def _process_groups(self, groups):
+        """
+        Process the reflections from several imagesets. When the jobs are run in
+        this process the imagesets are processed on separate threads which post
+        their reflections to one shared thread pool, so that the threads left
+        idle at the end of one imageset are used by the others. Each concurrent
+        imageset is given an equal share of the memory budget.
 
-        # Create the integration report
-        self.integration_report = IntegrationReport(self.experiments, self.reflections)
-        logger.info("")
-        logger.info(self.integration_report.as_str(prefix=" "))
+        :param groups: The list of (indices, experiments, reflections)
+        """
+        mp = self.params.integration.mp
+        if mp.njobs > 1 or mp.method == "mpi":
+            nconcurrent = 1
+            thread_pool = None
+        else:
+            nconcurrent = min(len(groups), mp.nproc)
+            if nconcurrent > 1 or mp.pin_threads:
+                thread_pool = ThreadPool(mp.nproc, pin_threads=mp.pin_threads)
+            else:
+                thread_pool = None
+
+        # The block size is computed and saved in the parameters so each
+        # imageset needs its own copy. The images must be read ahead so that
+        # the GIL is released while the reflections are processed.
+        def group_params():
+            params = copy.deepcopy(self.params)
+            block = params.integration.block
+            block.max_memory_usage /= nconcurrent
+            if nconcurrent > 1:
+                block.read_ahead = max(block.read_ahead, 1)
+            return params
 
-        # Print the time info
-        # logger.info("Timing information for integration")
-        # logger.info(str(time_info))
-        # logger.info("")
+        logger.info(
+            " Processing %d imagesets, %d at a time\n" % (len(groups), nconcurrent)
+        )
 
-        # Return the reflections
-        return self.reflections
+        # Process the imagesets, taking the next one as each finishes
+        results = [None] * len(groups)
+        pending = collections.deque(enumerate(groups))
+        errors = []
+        lock = threading.Lock()
+
+        def worker():
+            while True:
+                with lock:
+                    if not pending or errors:
+                        return
+                    index, (_, experiments, reflections) = pending.popleft()
+                try:
+                    results[index] = self._process(
+                        experiments, reflections, group_params(), thread_pool
+                    )
+                except Exception:
+                    with lock:
+                        errors.append(sys.exc_info())
+
+        if nconcurrent == 1:
+            worker()
+        else:
+            threads = [threading.Thread(target=worker) for i in range(nconcurrent)]
+            for thread in threads:
+                thread.start()
+            for thread in threads:
+                thread.join()
+        if errors:
+            six.reraise(*errors[0])
+
+        # Put the reflections back together with the original experiment ids
+        self.reflections = flex.reflection_table()
+        self.reference_profiles = []
+        for (indices, _, _), (reflections, reference_profiles) in zip(groups, results):
+            self.reflections.extend(_restore_ids(reflections, indices))
+            self.reference_profiles.append(reference_profiles)
 
     def report(self):
         """
@@ -1525,6 +1821,11 @@ def create_integrator(params, experiments, reflections):
     }.get(params.integration.integrator)
     if not IntegratorClass:
         raise ValueError("Unknown integration type %s" % params.integration.integrator)
+    if (
+        params.integration.mp.method == "mpi"
+        and params.integration.integrator != "3d_threaded"
+    ):
+        raise ValueError("mp.method=mpi requires the 3d_threaded integrator")
 
     # Remove scan if stills
     if experiments.all_stills():
@@ -12,7 +12,9 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_INTERFACES_H
 #define DIALS_ALGORITHMS_INTEGRATION_INTERFACES_H
 
+#include <vector>
 #include <dials/array_family/reflection.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
@@ -25,6 +27,20 @@ namespace dials { namespace algorithms {
 
     virtual void operator()(af::Reflection &reflection,
                             bool adjacent = false) const = 0;
+
+    /**
+     * Compute the mask for a batch of reflections. By default each reflection
+     * is done in turn. Implementations which work better on many reflections
+     * at once, such as an accelerator backend, can override this.
+     * @param reflections The reflections
+     * @param adjacent The reflections are adjacent to others
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       bool adjacent = false) const {
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        (*this)(reflections[i], adjacent);
+      }
+    }
   };
 
   // Implementation for pure virtual destructor
@@ -38,6 +54,24 @@ namespace dials { namespace algorithms {
     virtual ~BackgroundCalculatorIface() = 0;
 
     virtual void operator()(af::Reflection &reflection) const = 0;
+
+    /**
+     * Compute the background for a batch of reflections. By default each
+     * reflection is done in turn.
+     * @param reflections The reflections
+     * @param success Set to False for reflections whose background failed
+     */
+    virtual void batch(std::vector<af::Reflection> &reflections,
+                       std::vector<bool> &success) const {
+      success.assign(reflections.size(), true);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        try {
+          (*this)(reflections[i]);
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
   };
 
   // Implementation for pure virtual destructor
@@ -53,6 +87,28 @@ namespace dials { namespace algorithms {
     virtual void operator()(
       af::Reflection &reflection,
       const std::vector<af::Reflection> &adjacent_reflections) const = 0;
+
+    /**
+     * Compute the intensity for a batch of reflections. By default each
+     * reflection is done in turn.
+     * @param reflections The reflections
+     * @param adjacent_reflections The adjacent reflections of each reflection
+     * @param success Set to False for reflections whose intensity failed
+     */
+    virtual void batch(
+      std::vector<af::Reflection> &reflections,
+      const std::vector<std::vector<af::Reflection> > &adjacent_reflections,
+      std::vector<bool> &success) const {
+      DIALS_ASSERT(adjacent_reflections.size() == reflections.size());
+      success.assign(reflections.size(), true);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        try {
+          (*this)(reflections[i], adjacent_reflections[i]);
+        } catch (dials::error) {
+          success[i] = false;
+        }
+      }
+    }
   };
 
   // Implementation for pure virtual destructor
@@ -66,6 +122,13 @@ namespace dials { namespace algorithms {
     virtual ~ReferenceCalculatorIface() = 0;
 
     virtual void operator()(af::Reflection &reflection) = 0;
+
+    /**
+     * Combine any results kept separately by each thread. This is called
+     * once all the reflections in a block have been processed. By default
+     * there is nothing to do.
+     */
+    virtual void reduce() {}
   };
 
   // Implementation for pure virtual destructor
@@ -0,0 +1,260 @@
+/*
+ * kapton_2019.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_KAPTON_2019_H
+#define DIALS_ALGORITHMS_INTEGRATION_KAPTON_2019_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <boost/bind.hpp>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Foreground;
+  using dials::model::Shoebox;
+  using dials::model::Valid;
+  using dxtbx::model::Detector;
+  using dxtbx::model::Panel;
+  using scitbx::vec2;
+  using scitbx::vec3;
+
+  /**
+   * Absorption by a strip of kapton tape below the crystal, as modelled by
+   * the kapton_2019 correction. The tape is a box of the given thickness and
+   * width, and of a depth much larger than its width, rotated about the z
+   * axis and lying the given height below the crystal at the origin. The path
+   * of a diffracted ray through the tape is found by intersecting the ray
+   * with the three pairs of parallel faces of the box.
+   */
+  class KaptonAbsorption {
+  public:
+    /**
+     * @param height_mm The height of the crystal above the tape
+     * @param thickness_mm The thickness of the tape
+     * @param half_width_mm The half width of the tape
+     * @param angle_rad The rotation of the tape about the z axis
+     * @param abs_coeff The absorption coefficient of kapton (mm^-1)
+     */
+    KaptonAbsorption(double height_mm,
+                     double thickness_mm,
+                     double half_width_mm,
+                     double angle_rad,
+                     double abs_coeff)
+        : abs_coeff_(abs_coeff) {
+      DIALS_ASSERT(height_mm >= 0);
+      DIALS_ASSERT(thickness_mm > 0);
+      DIALS_ASSERT(half_width_mm > 0);
+      DIALS_ASSERT(abs_coeff >= 0);
+      double c = std::cos(angle_rad);
+      double s = std::sin(angle_rad);
+      axis_[0] = vec3<double>(c, s, 0);
+      axis_[1] = vec3<double>(-s, c, 0);
+      axis_[2] = vec3<double>(0, 0, 1);
+
+      // Position of the crystal along the axes of the tape, measured from the
+      // centre of the tape
+      position_[0] = height_mm + thickness_mm / 2.0;
+      position_[1] = 0;
+      position_[2] = 0;
+
+      // Half the size of the tape along each axis
+      half_size_[0] = thickness_mm / 2.0;
+      half_size_[1] = half_width_mm * 10.0;
+      half_size_[2] = half_width_mm;
+    }
+
+    /**
+     * @param s1 The diffracted beam vector
+     * @returns The path length through the tape (mm)
+     */
+    double path_length(vec3<double> s1) const {
+      double length = s1.length();
+      DIALS_ASSERT(length > 0);
+      double t0 = 0.0;
+      double t1 = std::numeric_limits<double>::max();
+      for (std::size_t i = 0; i < 3; ++i) {
+        double d = (axis_[i] * s1) / length;
+        double p = position_[i];
+        double e = half_size_[i];
+        if (d == 0) {
+          if (std::abs(p) >= e) {
+            return 0.0;
+          }
+          continue;
+        }
+        double ta = (-e - p) / d;
+        double tb = (e - p) / d;
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+      }
+      return t1 > t0 ? t1 - t0 : 0.0;
+    }
+
+    /**
+     * @param s1 The diffracted beam vector
+     * @returns The absorption correction (>= 1)
+     */
+    double correction(vec3<double> s1) const {
+      return std::exp(abs_coeff_ * path_length(s1));
+    }
+
+    /**
+     * @param s1 The diffracted beam vectors
+     * @param nthreads The number of threads to use
+     * @returns The path lengths through the tape
+     */
+    af::shared<double> path_lengths(const af::const_ref<vec3<double> > &s1,
+                                    std::size_t nthreads = 1) const {
+      af::shared<double> result(s1.size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(
+          &KaptonAbsorption::path_length_band, this, s1, result.ref(), _1, _2),
+        s1.size(),
+        nthreads);
+      return result;
+    }
+
+    /**
+     * @param s1 The diffracted beam vectors
+     * @param nthreads The number of threads to use
+     * @returns The absorption corrections
+     */
+    af::shared<double> corrections(const af::const_ref<vec3<double> > &s1,
+                                   std::size_t nthreads = 1) const {
+      af::shared<double> result = path_lengths(s1, nthreads);
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = std::exp(abs_coeff_ * result[i]);
+      }
+      return result;
+    }
+
+    /**
+     * Compute the mean and the sample standard deviation of the corrections
+     * for the valid foreground pixels of each shoebox, for rays through the
+     * pixel centres. Shoeboxes with no such pixels get a correction of 1.
+     * @param shoebox The shoeboxes
+     * @param detector The detector model
+     * @param correction The mean corrections
+     * @param sigma The standard deviations of the corrections
+     * @param nthreads The number of threads to use
+     */
+    void shoebox_corrections(const af::const_ref<Shoebox<> > &shoebox,
+                             const Detector &detector,
+                             af::ref<double> correction,
+                             af::ref<double> sigma,
+                             std::size_t nthreads = 1) const {
+      DIALS_ASSERT(correction.size() == shoebox.size());
+      DIALS_ASSERT(sigma.size() == shoebox.size());
+      for (std::size_t i = 0; i < shoebox.size(); ++i) {
+        DIALS_ASSERT(shoebox[i].panel < detector.size());
+      }
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&KaptonAbsorption::shoebox_band,
+                    this,
+                    shoebox,
+                    boost::cref(detector),
+                    correction,
+                    sigma,
+                    _1,
+                    _2),
+        shoebox.size(),
+        nthreads);
+    }
+
+    /**
+     * Apply the corrections to the intensities in place, propagating the
+     * error in the correction if its sigma is given. Then
+     * var(I') = I'^2 ((sig(C) / C)^2 + var(I) / I^2) with I' = C I.
+     * @param intensity The intensities
+     * @param variance The variances of the intensities
+     * @param correction The corrections
+     * @param sigma The sigmas of the corrections (may be empty)
+     */
+    static void apply(af::ref<double> intensity,
+                      af::ref<double> variance,
+                      const af::const_ref<double> &correction,
+                      const af::const_ref<double> &sigma) {
+      DIALS_ASSERT(intensity.size() == correction.size());
+      DIALS_ASSERT(variance.size() == correction.size());
+      DIALS_ASSERT(sigma.size() == 0 || sigma.size() == correction.size());
+      for (std::size_t i = 0; i < correction.size(); ++i) {
+        double c = correction[i];
+        if (sigma.size() == 0) {
+          intensity[i] *= c;
+          variance[i] *= c * c;
+        } else {
+          double term1 = (sigma[i] / c) * (sigma[i] / c);
+          double term2 = variance[i] / (intensity[i] * intensity[i]);
+          intensity[i] *= c;
+          variance[i] = intensity[i] * intensity[i] * (term1 + term2);
+        }
+      }
+    }
+
+  private:
+    void path_length_band(af::const_ref<vec3<double> > s1,
+                          af::ref<double> result,
+                          std::size_t first,
+                          std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        result[i] = path_length(s1[i]);
+      }
+    }
+
+    void shoebox_band(af::const_ref<Shoebox<> > shoebox,
+                      const Detector &detector,
+                      af::ref<double> mean_correction,
+                      af::ref<double> sigma,
+                      std::size_t first,
+                      std::size_t last) const {
+      const int code = Valid | Foreground;
+      for (std::size_t i = first; i < last; ++i) {
+        const Shoebox<> &sbox = shoebox[i];
+        const Panel &panel = detector[sbox.panel];
+        af::const_ref<int, af::c_grid<3> > mask = sbox.mask.const_ref();
+        std::size_t n = 0;
+        double mean = 0.0;
+        double m2 = 0.0;
+        for (std::size_t k = 0; k < sbox.zsize(); ++k) {
+          for (std::size_t j = 0; j < sbox.ysize(); ++j) {
+            double y = j + sbox.yoffset() + 0.5;
+            for (std::size_t l = 0; l < sbox.xsize(); ++l) {
+              if ((mask(k, j, l) & code) != code) {
+                continue;
+              }
+              double x = l + sbox.xoffset() + 0.5;
+              vec3<double> s1 =
+                panel.get_lab_coord(panel.pixel_to_millimeter(vec2<double>(x, y)));
+              double c = correction(s1);
+              double delta = c - mean;
+              n++;
+              mean += delta / n;
+              m2 += delta * (c - mean);
+            }
+          }
+        }
+        mean_correction[i] = n > 0 ? mean : 1.0;
+        sigma[i] = n > 1 ? std::sqrt(m2 / (n - 1)) : 0.0;
+      }
+    }
+
+    double abs_coeff_;
+    vec3<double> axis_[3];
+    double position_[3];
+    double half_size_[3];
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_KAPTON_2019_H
@@ -5,8 +5,8 @@
 
 from scitbx.matrix import col
 
+from dials.algorithms.integration import KaptonAbsorption
 from dials.algorithms.integration.kapton_correction import get_absorption_correction
-from dials.algorithms.shoebox import MaskCode
 from dials.array_family import flex
 
 logging.basicConfig()
@@ -37,6 +37,7 @@ def __init__(
         G = get_absorption_correction()
         attenuation_length_mm = G(self.wavelength_ang)
         self.abs_coeff = 1 / attenuation_length_mm
+        self.absorption = KaptonAbsorption(h, t, w, self.angle_rad, self.abs_coeff)
 
         def create_kapton_face(ori, fast, slow, image_size, pixel_size, name):
             """Create a face of the kapton as a dxtbx detector object"""
@@ -182,30 +183,19 @@ def get_kapton_path_mm(self, s1):
 
     def abs_correction(self, s1):
         """Compute absorption correction using beers law. Takes in a tuple for a single s1 vector and does absorption correction"""
-        kapton_path_mm = self.get_kapton_path_mm(s1)
-        if kapton_path_mm is not None:
-            absorption_correction = 1 / math.exp(
-                -self.abs_coeff * kapton_path_mm
-            )  # unitless, >=1
-        return absorption_correction
-
-    def abs_correction_flex(self, s1_flex):
+        return self.absorption.correction(s1)  # unitless, >=1
+
+    def abs_correction_flex(self, s1_flex, nthreads=1):
         """Compute the absorption correction using beers law. Takes in a flex array of s1 vectors, determines path lengths for each
         and then determines absorption correction for each s1 vector"""
-        kapton_faces = self.faces
-        from dials.algorithms.integration import get_kapton_path_cpp
-
-        # new style, much faster
-        kapton_path_mm = get_kapton_path_cpp(kapton_faces, s1_flex)
-        # old style, really slow
-        # for s1 in s1_flex:
-        #  kapton_path_mm.append(self.get_kapton_path_mm(s1))
-        # determine absorption correction
-        if kapton_path_mm is not None:
-            absorption_correction = 1 / flex.exp(
-                -self.abs_coeff * kapton_path_mm
-            )  # unitless, >=1
-        return absorption_correction
+        return self.absorption.corrections(s1_flex, nthreads=nthreads)  # unitless, >=1
+
+    def abs_correction_shoeboxes(self, shoeboxes, detector, nthreads=1):
+        """Compute the mean and standard deviation of the absorption corrections for
+        the valid foreground pixels of each shoebox"""
+        return self.absorption.shoebox_corrections(
+            shoeboxes, detector, nthreads=nthreads
+        )
 
     def distance_of_point_from_line(self, r0, r1, r2):
         """Evaluates distance between point and a line between two points
@@ -418,6 +408,7 @@ def __init__(
         refl=None,
         smart_sigmas=True,
         logger=None,
+        nthreads=1,
     ):
         self.panel_size_px = panel_size_px
         self.pixel_size_mm = pixel_size_mm
@@ -429,6 +420,7 @@ def __init__(
         self.refl = refl
         self.smart_sigmas = smart_sigmas
         self.logger = logger
+        self.nthreads = nthreads
         self.extract_params()
 
     def extract_params(self):
@@ -480,49 +472,17 @@ def correction_and_within_spot_sigma(params_version, variance_within_spot=True):
             # *map(float, self.panel_size_px)) #
             detector = self.expt.detector
 
-            absorption_corrections = flex.double()
-            absorption_sigmas = (
-                flex.double()
-            )  # std dev of corrections for pixels within a spot, default sigma
-
             if variance_within_spot:
-                mask_code = MaskCode.Foreground | MaskCode.Valid
-                for iref in range(len(self.reflections_sele)):
-                    kapton_correction_vector = flex.double()
-                    # foreground: integration mask
-                    shoebox = self.reflections_sele[iref]["shoebox"]
-                    foreground = (
-                        (shoebox.mask.as_1d() & mask_code) == mask_code
-                    ).iselection()
-                    f_absolute, s_absolute, z_absolute = (
-                        shoebox.coords().select(foreground).parts()
-                    )
-                    panel_number = self.reflections_sele[iref]["panel"]
-                    lab_coords = detector[panel_number].get_lab_coord(
-                        detector[panel_number].pixel_to_millimeter(
-                            flex.vec2_double(f_absolute, s_absolute)
-                        )
-                    )
-                    s1 = lab_coords.each_normalize()
-                    # Real step right here
-                    kapton_correction_vector.extend(absorption.abs_correction_flex(s1))
-                    #
-                    average_kapton_correction = flex.mean(kapton_correction_vector)
-                    absorption_corrections.append(average_kapton_correction)
-                    try:
-                        spot_px_stddev = flex.mean_and_variance(
-                            kapton_correction_vector
-                        ).unweighted_sample_standard_deviation()
-                    except Exception:
-                        assert (
-                            len(kapton_correction_vector) == 1
-                        ), "stddev could not be calculated"
-                        spot_px_stddev = 0
-                    absorption_sigmas.append(spot_px_stddev)
-                return absorption_corrections, absorption_sigmas
+                # mean and std dev of corrections for the foreground pixels of
+                # each spot
+                return absorption.abs_correction_shoeboxes(
+                    self.reflections_sele["shoebox"], detector, nthreads=self.nthreads
+                )
             else:
                 s1_flex = self.reflections_sele["s1"].each_normalize()
-                absorption_corrections = absorption.abs_correction_flex(s1_flex)
+                absorption_corrections = absorption.abs_correction_flex(
+                    s1_flex, nthreads=self.nthreads
+                )
                 return absorption_corrections, None
 
         # loop through modified Kapton parameters to get alternative corrections and estimate sigmas as
@@ -560,11 +520,12 @@ def correction_and_within_spot_sigma(params_version, variance_within_spot=True):
 
 
 class multi_kapton_correction(object):
-    def __init__(self, experiments, integrated, kapton_params, logger=None):
+    def __init__(self, experiments, integrated, kapton_params, logger=None, nthreads=1):
         self.experiments = experiments
         self.reflections = integrated
         self.params = kapton_params
         self.logger = logger
+        self.nthreads = nthreads
 
     def __call__(self):
         self.corrected_reflections = flex.reflection_table()
@@ -599,31 +560,26 @@ def correct(refl_sele, smart_sigmas=True):
                     refl=refl,
                     smart_sigmas=smart_sigmas,
                     logger=self.logger,
+                    nthreads=self.nthreads,
                 )
 
                 k_corr, k_sigmas = kapton_correction()
                 refl_sele["kapton_absorption_correction"] = k_corr
                 if smart_sigmas:
                     refl_sele["kapton_absorption_correction_sigmas"] = k_sigmas
-                    # apply corrections and propagate error
-                    # term1 = (sig(C)/C)^2
-                    # term2 = (sig(Imeas)/Imeas)^2
-                    # I' = C*I
-                    # sig^2(I') = (I')^2*(term1 + term2)
-                    integrated_data = refl_sele["intensity.sum.value"]
-                    integrated_variance = refl_sele["intensity.sum.variance"]
-                    integrated_sigma = flex.sqrt(integrated_variance)
-                    term1 = flex.pow(k_sigmas / k_corr, 2)
-                    term2 = flex.pow(integrated_sigma / integrated_data, 2)
-                    integrated_data *= k_corr
-                    integrated_variance = flex.pow(integrated_data, 2) * (term1 + term2)
-                    refl_sele["intensity.sum.value"] = integrated_data
-                    refl_sele["intensity.sum.variance"] = integrated_variance
-                    # order is purposeful: the two lines above require that integrated_data
-                    # has already been corrected!
                 else:
-                    refl_sele["intensity.sum.value"] *= k_corr
-                    refl_sele["intensity.sum.variance"] *= flex.pow2(k_corr)
+                    k_sigmas = flex.double()
+                # apply corrections in place and propagate error
+                # term1 = (sig(C)/C)^2
+                # term2 = (sig(Imeas)/Imeas)^2
+                # I' = C*I
+                # sig^2(I') = (I')^2*(term1 + term2)
+                KaptonAbsorption.apply(
+                    refl_sele["intensity.sum.value"],
+                    refl_sele["intensity.sum.variance"],
+                    k_corr,
+                    k_sigmas,
+                )
                 return refl_sele
 
             if len(refl_zero) > 0 and self.params.smart_sigmas:
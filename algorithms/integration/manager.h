@@ -27,18 +27,22 @@
 namespace dials { namespace algorithms {
 
   /**
-   * A class to managing reflection lookup indices
+   * A class to managing reflection lookup indices. The images are grouped into
+   * batches of consecutive images, and each reflection must lie within the
+   * images of a single batch.
    */
   class ReflectionLookup2 {
   public:
     ReflectionLookup2(const af::const_ref<int> &id,
                       const af::const_ref<int6> &bbox,
-                      const int2 &frames) {
+                      const int2 &frames,
+                      std::size_t batch_size = 1) {
       DIALS_ASSERT(frames[1] > frames[0]);
+      DIALS_ASSERT(batch_size > 0);
 
-      // Make a list of the frames
-      for (int i = frames[0]; i < frames[1]; ++i) {
-        frames_.push_back(int2(i, i + 1));
+      // Make a list of the batches of frames
+      for (int i = frames[0]; i < frames[1]; i += batch_size) {
+        frames_.push_back(int2(i, std::min(i + (int)batch_size, frames[1])));
       }
 
       // Check all the reflection bboxes are valid
@@ -51,15 +55,15 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(bbox[i][5] <= frames[1]);
       }
 
-      // Count the number of reflections on each image
+      // Count the number of reflections in each batch
+      std::vector<std::size_t> batch(bbox.size());
       std::vector<int> count(frames_.size(), 0);
       for (std::size_t i = 0; i < bbox.size(); ++i) {
-        for (int j = bbox[i][4]; j < bbox[i][5]; ++j) {
-          int k = j - frames[0];
-          DIALS_ASSERT(k >= 0);
-          DIALS_ASSERT(k < count.size());
-          count[k]++;
-        }
+        std::size_t k = (bbox[i][4] - frames[0]) / batch_size;
+        DIALS_ASSERT(k < count.size());
+        DIALS_ASSERT(bbox[i][5] <= frames_[k][1]);
+        batch[i] = k;
+        count[k]++;
       }
 
       // Compute offsests
@@ -71,22 +75,12 @@ namespace dials { namespace algorithms {
       indices_.resize(offset_.back());
       count.assign(count.size(), 0);
       for (std::size_t i = 0; i < bbox.size(); ++i) {
-        for (int j = bbox[i][4]; j < bbox[i][5]; ++j) {
-          int k = j - frames[0];
-          DIALS_ASSERT(k >= 0);
-          DIALS_ASSERT(k < count.size());
-          std::size_t l = offset_[k] + count[k]++;
-          DIALS_ASSERT(l < offset_[k + 1]);
-          DIALS_ASSERT(l < indices_.size());
-          indices_[l] = i;
-        }
+        std::size_t k = batch[i];
+        std::size_t l = offset_[k] + count[k]++;
+        DIALS_ASSERT(l < offset_[k + 1]);
+        indices_[l] = i;
       }
       DIALS_ASSERT(indices_.size() == bbox.size());
-
-      // Check we didn't make any mistakes
-      for (std::size_t i = 0; i < count.size(); ++i) {
-        DIALS_ASSERT(offset_[i] + count[i] == offset_[i + 1]);
-      }
     }
 
     /**
@@ -125,8 +119,12 @@ namespace dials { namespace algorithms {
 
   class ReflectionManagerPerImage {
   public:
-    ReflectionManagerPerImage(int2 frames, af::reflection_table data)
-        : lookup_(init(frames, data)), data_(data), finished_(lookup_.size(), false) {
+    ReflectionManagerPerImage(int2 frames,
+                              af::reflection_table data,
+                              std::size_t batch_size = 1)
+        : lookup_(init(frames, data, batch_size)),
+          data_(data),
+          finished_(lookup_.size(), false) {
       DIALS_ASSERT(finished_.size() > 0);
     }
 
@@ -199,13 +197,15 @@ namespace dials { namespace algorithms {
     /**
      * Initialise the indexer
      */
-    ReflectionLookup2 init(int2 frames, af::reflection_table data) {
+    ReflectionLookup2 init(int2 frames,
+                           af::reflection_table data,
+                           std::size_t batch_size) {
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.size() > 0);
       DIALS_ASSERT(data.contains("id"));
       DIALS_ASSERT(data.contains("bbox"));
       DIALS_ASSERT(frames[1] > frames[0]);
-      return ReflectionLookup2(data["id"], data["bbox"], frames);
+      return ReflectionLookup2(data["id"], data["bbox"], frames, batch_size);
     }
 
     ReflectionLookup2 lookup_;
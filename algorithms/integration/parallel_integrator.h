@@ -13,6 +13,9 @@
 #define DIALS_ALGORITHMS_INTEGRATION_PARALLEL_INTEGRATOR_H
 
 #include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/scan.h>
@@ -20,8 +23,14 @@
 #include <dxtbx/imageset.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
+#include <dials/array_family/radix_sort_index.h>
 #include <dials/error.h>
+#include <dials/util/shared_executor.h>
 #include <dials/util/thread_pool.h>
+#include <dials/util/gil.h>
+#include <dials/util/memory_accounting.h>
+#include <dials/util/timer.h>
+#include <dials/util/trace.h>
 #include <dials/algorithms/shoebox/find_overlapping.h>
 #include <dials/algorithms/integration/sum/summation.h>
 #include <dials/algorithms/centroid/centroid.h>
@@ -29,6 +38,11 @@
 #include <map>
 
 #include <dials/algorithms/integration/interfaces.h>
+#include <dials/algorithms/integration/algorithms.h>
+#include <dials/algorithms/integration/reflection_columns.h>
+#include <dials/algorithms/integration/integration_timer.h>
+#include <dials/algorithms/integration/shoebox_pool.h>
+#include <dials/algorithms/integration/compressed_frame.h>
 
 namespace dials { namespace algorithms {
 
@@ -40,6 +54,7 @@ namespace dials { namespace algorithms {
 
   using dxtbx::ImageSequence;
   using dxtbx::format::Image;
+  using dxtbx::format::ImageBuffer;
   using dxtbx::format::ImageTile;
 
   using dials::model::AdjacencyList;
@@ -64,12 +79,262 @@ namespace dials { namespace algorithms {
     boost::python::object obj_;
   };
 
+  /**
+   * A view of a single buffered image for a panel. The buffer either stores
+   * the pixel values directly or in a compact 16 bit form with an offset and
+   * scale for each image which are decoded when the pixels are read. The
+   * compact codes may also be stored compressed in tiles.
+   */
+  class BufferFrame {
+  public:
+    typedef Shoebox<>::float_type float_type;
+    typedef unsigned short compact_type;
+
+    /**
+     * The value stored for masked pixels in compact storage
+     */
+    static const compact_type compact_masked = 65535;
+
+    /**
+     * The maximum value stored for valid pixels in compact storage
+     */
+    static const compact_type compact_max = 65534;
+
+    /**
+     * Construct a view of directly stored pixel values
+     * @param data The image data
+     */
+    BufferFrame(af::const_ref<float_type, af::c_grid<2> > data)
+        : data_(data.begin()),
+          compact_(NULL),
+          compressed_(NULL),
+          accessor_(data.accessor()),
+          offset_(0),
+          scale_(1),
+          mask_value_(0) {}
+
+    /**
+     * Construct a view of compact pixel values
+     * @param data The compact image data
+     * @param offset The value of the smallest code
+     * @param scale The size of each code step
+     * @param mask_value The value of masked pixels
+     */
+    BufferFrame(af::const_ref<compact_type, af::c_grid<2> > data,
+                double offset,
+                double scale,
+                float_type mask_value)
+        : data_(NULL),
+          compact_(data.begin()),
+          compressed_(NULL),
+          accessor_(data.accessor()),
+          offset_(offset),
+          scale_(scale),
+          mask_value_(mask_value) {}
+
+    /**
+     * Construct a view of compressed compact pixel values
+     * @param data The compressed image data
+     * @param offset The value of the smallest code
+     * @param scale The size of each code step
+     * @param mask_value The value of masked pixels
+     */
+    BufferFrame(const CompressedFrame &data,
+                double offset,
+                double scale,
+                float_type mask_value)
+        : data_(NULL),
+          compact_(NULL),
+          compressed_(&data),
+          accessor_(data.accessor()),
+          offset_(offset),
+          scale_(scale),
+          mask_value_(mask_value) {}
+
+    /**
+     * @returns The size of the image
+     */
+    af::c_grid<2> accessor() const {
+      return accessor_;
+    }
+
+    /**
+     * @returns The pixel value
+     */
+    float_type operator()(std::size_t j, std::size_t i) const {
+      if (data_ != NULL) {
+        return data_[accessor_(j, i)];
+      }
+      compact_type v =
+        compact_ != NULL ? compact_[accessor_(j, i)] : (*compressed_)(j, i);
+      if (v == compact_masked) {
+        return mask_value_;
+      }
+      return (float_type)(offset_ + v * scale_);
+    }
+
+  protected:
+    const float_type *data_;
+    const compact_type *compact_;
+    const CompressedFrame *compressed_;
+    af::c_grid<2> accessor_;
+    double offset_;
+    double scale_;
+    float_type mask_value_;
+  };
+
+  /**
+   * A cache of the masked pixels of a panel, used to apply the dynamic mask to
+   * each image in the buffer. Dynamic masks (e.g. from shadowing by the
+   * goniometer) change slowly, so the mask of each image is compared with that
+   * of the previous image in bands of rows and only the bands which have
+   * changed are updated. The masked pixels of the combined dynamic and static
+   * mask are stored as runs for each band, so applying the mask to an image
+   * only touches the masked pixels rather than every pixel.
+   */
+  class MaskRunCache {
+  public:
+    /**
+     * Initialise the cache with no dynamic mask
+     * @param static_mask The static mask
+     * @param band_size The number of rows in each band
+     */
+    MaskRunCache(const af::const_ref<bool, af::c_grid<2> > &static_mask,
+                 std::size_t band_size = 16)
+        : static_mask_(static_mask.accessor()),
+          dynamic_mask_(static_mask.accessor(), true),
+          mask_(static_mask.accessor()),
+          band_size_(band_size) {
+      DIALS_ASSERT(band_size > 0);
+      std::copy(static_mask.begin(), static_mask.end(), static_mask_.begin());
+      std::copy(static_mask.begin(), static_mask.end(), mask_.begin());
+      std::size_t ysize = static_mask.accessor()[0];
+      std::size_t num_bands = (ysize + band_size - 1) / band_size;
+      static_runs_.resize(num_bands);
+      for (std::size_t i = 0; i < num_bands; ++i) {
+        encode(static_mask_.const_ref(), i, static_runs_[i]);
+      }
+      runs_ = static_runs_;
+    }
+
+    /**
+     * Update the cache with the dynamic mask of the next image
+     * @param mask The dynamic mask
+     * @returns The number of bands which changed
+     */
+    std::size_t update(const af::const_ref<bool, af::c_grid<2> > &mask) {
+      DIALS_ASSERT(mask.accessor().all_eq(mask_.accessor()));
+      std::size_t num_changed = 0;
+      for (std::size_t i = 0; i < runs_.size(); ++i) {
+        std::size_t first = 0, last = 0;
+        band_range(i, first, last);
+        if (std::equal(mask.begin() + first,
+                       mask.begin() + last,
+                       dynamic_mask_.begin() + first)) {
+          continue;
+        }
+        for (std::size_t j = first; j < last; ++j) {
+          dynamic_mask_[j] = mask[j];
+          mask_[j] = mask[j] && static_mask_[j];
+        }
+        encode(mask_.const_ref(), i, runs_[i]);
+        num_changed++;
+      }
+      return num_changed;
+    }
+
+    /**
+     * @returns The combined dynamic and static mask
+     */
+    af::const_ref<bool, af::c_grid<2> > mask() const {
+      return mask_.const_ref();
+    }
+
+    /**
+     * Set the masked pixels of an image to a value
+     * @param dst The image
+     * @param value The value of masked pixels
+     */
+    template <typename T>
+    void apply(T *dst, T value) const {
+      apply_runs(runs_, dst, value);
+    }
+
+    /**
+     * Set the pixels masked by the static mask of an image to a value
+     * @param dst The image
+     * @param value The value of masked pixels
+     */
+    template <typename T>
+    void apply_static(T *dst, T value) const {
+      apply_runs(static_runs_, dst, value);
+    }
+
+  private:
+    typedef std::pair<std::size_t, std::size_t> run_type;
+
+    /**
+     * Get the range of pixels in a band
+     */
+    void band_range(std::size_t band, std::size_t &first, std::size_t &last) const {
+      std::size_t ysize = mask_.accessor()[0];
+      std::size_t xsize = mask_.accessor()[1];
+      first = band * band_size_ * xsize;
+      last = std::min((band + 1) * band_size_, ysize) * xsize;
+    }
+
+    /**
+     * Encode the masked pixels of a band as runs
+     */
+    void encode(const af::const_ref<bool, af::c_grid<2> > &mask,
+                std::size_t band,
+                std::vector<run_type> &runs) const {
+      std::size_t first = 0, last = 0;
+      band_range(band, first, last);
+      runs.clear();
+      std::size_t j = first;
+      while (j < last) {
+        if (mask[j]) {
+          j++;
+          continue;
+        }
+        std::size_t start = j;
+        while (j < last && !mask[j]) {
+          j++;
+        }
+        runs.push_back(run_type(start, j));
+      }
+    }
+
+    /**
+     * Set the pixels in the runs to a value
+     */
+    template <typename T>
+    static void apply_runs(const std::vector<std::vector<run_type> > &runs,
+                           T *dst,
+                           T value) {
+      for (std::size_t i = 0; i < runs.size(); ++i) {
+        for (std::size_t j = 0; j < runs[i].size(); ++j) {
+          std::fill(dst + runs[i][j].first, dst + runs[i][j].second, value);
+        }
+      }
+    }
+
+    af::versa<bool, af::c_grid<2> > static_mask_;
+    af::versa<bool, af::c_grid<2> > dynamic_mask_;
+    af::versa<bool, af::c_grid<2> > mask_;
+    std::size_t band_size_;
+    std::vector<std::vector<run_type> > static_runs_;
+    std::vector<std::vector<run_type> > runs_;
+  };
+
   /**
    * A class to store the image data buffer
    */
   class BufferBase {
   public:
     typedef Shoebox<>::float_type float_type;
+    typedef BufferFrame::compact_type compact_type;
 
     /**
      * Initialise the the size of the panels
@@ -77,23 +342,37 @@ namespace dials { namespace algorithms {
      * @param num_images The number of images
      * @param mask_value The value of masked pixels in the buffer
      * @param external_mask The external mask
+     * @param compact Store the data in compact 16 bit form
+     * @param compress Store the compact data compressed in tiles
+     * @param pool If the pool has threads pinned to several NUMA nodes, the
+     *             panels are spread over the nodes and each panel buffer is
+     *             allocated by a thread on its node.
      */
     BufferBase(const Detector &detector,
                std::size_t num_images,
                float_type mask_value,
-               const Image<bool> &external_mask)
-        : mask_value_(mask_value) {
+               const Image<bool> &external_mask,
+               bool compact,
+               bool compress,
+               dials::util::ThreadPool *pool = NULL)
+        : mask_value_(mask_value), compact_(compact || compress), compress_(compress) {
       std::size_t zsize = num_images;
       DIALS_ASSERT(zsize > 0);
+      std::size_t num_nodes = pool != NULL ? pool->num_nodes() : 1;
+      std::vector<af::c_grid<3> > grid;
       for (std::size_t i = 0; i < detector.size(); ++i) {
         std::size_t xsize = detector[i].get_image_size()[0];
         std::size_t ysize = detector[i].get_image_size()[1];
         DIALS_ASSERT(xsize > 0);
         DIALS_ASSERT(ysize > 0);
 
-        // Allocate all the data buffers
-        data_.push_back(
-          af::versa<float_type, af::c_grid<3> >(af::c_grid<3>(zsize, ysize, xsize)));
+        // Set the size and node of the data buffers
+        grid.push_back(af::c_grid<3>(zsize, ysize, xsize));
+        panel_node_.push_back(i * num_nodes / detector.size());
+        if (compact_) {
+          offset_.push_back(std::vector<double>(zsize, 0.0));
+          scale_.push_back(std::vector<double>(zsize, 1.0));
+        }
 
         // Allocate the static mask buffer
         static_mask_.push_back(
@@ -108,6 +387,57 @@ namespace dials { namespace algorithms {
                                       static_mask_[i].ref());
         }
       }
+
+      // Create the cache of the masked pixels for each panel
+      for (std::size_t i = 0; i < static_mask_.size(); ++i) {
+        mask_cache_.push_back(MaskRunCache(static_mask_[i].const_ref()));
+      }
+
+      // Allocate all the data buffers. The arrays are zero filled when they
+      // are allocated so, with first touch placement, the pages end up on the
+      // node of the thread which allocates them.
+      if (compress_) {
+        compressed_data_.resize(grid.size());
+        compress_codes_.resize(grid.size());
+      } else if (compact_) {
+        compact_data_.resize(grid.size());
+      } else {
+        data_.resize(grid.size());
+      }
+      if (num_nodes > 1) {
+        dials::util::ThreadPool::TaskGroup group(*pool);
+        for (std::size_t i = 0; i < grid.size(); ++i) {
+          group.post(PanelAllocator(*this, i, grid[i]), panel_node_[i]);
+        }
+        group.wait();
+      } else {
+        for (std::size_t i = 0; i < grid.size(); ++i) {
+          PanelAllocator(*this, i, grid[i])();
+        }
+      }
+
+      // Charge the data and mask buffers to the buffer subsystem. Compressed
+      // images charge their own data since its size varies, leaving just the
+      // codes of the image being compressed.
+      std::size_t element_size = compact_ ? sizeof(compact_type) : sizeof(float_type);
+      std::size_t nbytes = 0;
+      for (std::size_t i = 0; i < grid.size(); ++i) {
+        std::size_t nelements = grid[i].size_1d();
+        if (compress_) {
+          nelements /= zsize;
+        }
+        nbytes += nelements * element_size + 4 * static_mask_[i].size();
+      }
+      memory_ = dials::util::make_memory_charge(dials::util::BufferMemory, nbytes);
+    }
+
+    /**
+     * @param panel The panel number
+     * @returns The NUMA node on which the panel buffer was allocated
+     */
+    std::size_t node(std::size_t panel) const {
+      DIALS_ASSERT(panel < panel_node_.size());
+      return panel_node_[panel];
     }
 
     /**
@@ -115,11 +445,17 @@ namespace dials { namespace algorithms {
      * @param data The image data
      * @param index The image index
      */
-    void copy(const Image<double> &data, std::size_t index) {
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+    template <typename T>
+    void copy(const Image<T> &data, std::size_t index) {
+      DIALS_ASSERT(data.n_tiles() == static_mask_.size());
       for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-        copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+        if (compact_) {
+          copy_compact(
+            data.tile(i).data().const_ref(), static_mask_[i].const_ref(), i, index);
+        } else {
+          copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
+          apply_mask(mask_cache_[i], true, data_[i].ref(), index);
+        }
       }
     }
 
@@ -128,42 +464,100 @@ namespace dials { namespace algorithms {
      * @param data The image data
      * @param index The image index
      */
-    void copy(const Image<double> &data, bool mask, std::size_t index) {
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+    template <typename T>
+    void copy(const Image<T> &data, bool mask, std::size_t index) {
+      DIALS_ASSERT(data.n_tiles() == static_mask_.size());
       if (mask) {
         copy(data, index);
       } else {
         for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-          apply_mask_to_all_pixels(data_[i].ref(), index);
+          if (compress_) {
+            af::ref<compact_type, af::c_grid<2> > codes = compress_codes_[i].ref();
+            std::fill(codes.begin(), codes.end(), compact_masked());
+            compressed_data_[i][index].assign(compress_codes_[i].const_ref(),
+                                              compact_masked());
+          } else if (compact_) {
+            apply_mask_to_all_pixels(compact_data_[i].ref(), compact_masked(), index);
+          } else {
+            apply_mask_to_all_pixels(data_[i].ref(), mask_value_, index);
+          }
         }
       }
     }
 
     /**
-     * Copy an image to the buffer
+     * Copy an image to the buffer. The dynamic mask is compared with that of
+     * the previous image and only the parts which have changed are updated.
      * @param data The image data
      * @param mask The mask data
      * @param index The image index
      */
-    void copy(const Image<double> &data, const Image<bool> &mask, std::size_t index) {
+    template <typename T>
+    void copy(const Image<T> &data, const Image<bool> &mask, std::size_t index) {
       DIALS_ASSERT(data.n_tiles() == mask.n_tiles());
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+      DIALS_ASSERT(data.n_tiles() == static_mask_.size());
       for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-        copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(mask.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+        mask_cache_[i].update(mask.tile(i).data().const_ref());
+        if (compact_) {
+          copy_compact(
+            data.tile(i).data().const_ref(), mask_cache_[i].mask(), i, index);
+        } else {
+          copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
+          apply_mask(mask_cache_[i], false, data_[i].ref(), index);
+        }
       }
     }
 
+    /**
+     * @returns Is the data stored in compact form
+     */
+    bool compact() const {
+      return compact_;
+    }
+
+    /**
+     * @returns Is the compact data stored compressed
+     */
+    bool compress() const {
+      return compress_;
+    }
+
     /**
      * @param The panel number
      * @returns The buffer for the panel
      */
     af::const_ref<float_type, af::c_grid<3> > data(std::size_t panel) const {
+      DIALS_ASSERT(!compact_);
       DIALS_ASSERT(panel < data_.size());
       return data_[panel].const_ref();
     }
 
+    /**
+     * @param panel The panel number
+     * @param index The image index
+     * @returns A view of the image for the panel
+     */
+    BufferFrame frame(std::size_t panel, std::size_t index) const {
+      if (!compact_) {
+        af::const_ref<float_type, af::c_grid<3> > buffer = data(panel);
+        return BufferFrame(slice(buffer, index));
+      }
+      if (compress_) {
+        DIALS_ASSERT(panel < compressed_data_.size());
+        DIALS_ASSERT(index < compressed_data_[panel].size());
+        return BufferFrame(compressed_data_[panel][index],
+                           offset_[panel][index],
+                           scale_[panel][index],
+                           mask_value_);
+      }
+      DIALS_ASSERT(panel < compact_data_.size());
+      DIALS_ASSERT(index < offset_[panel].size());
+      return BufferFrame(slice(compact_data_[panel].const_ref(), index),
+                         offset_[panel][index],
+                         scale_[panel][index],
+                         mask_value_);
+    }
+
     /**
      * @param The panel number
      * @returns The buffer for the panel
@@ -174,6 +568,30 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * @returns The compact value of masked pixels
+     */
+    static compact_type compact_masked() {
+      return BufferFrame::compact_masked;
+    }
+
+    /**
+     * Get a single image from a 3D buffer
+     * @param buffer The buffer
+     * @param index The image index
+     */
+    template <typename T>
+    static af::const_ref<T, af::c_grid<2> > slice(
+      af::const_ref<T, af::c_grid<3> > buffer,
+      std::size_t index) {
+      std::size_t ysize = buffer.accessor()[1];
+      std::size_t xsize = buffer.accessor()[2];
+      std::size_t offset = index * (ysize * xsize);
+      DIALS_ASSERT(offset < buffer.size());
+      return af::const_ref<T, af::c_grid<2> >(&buffer[offset],
+                                              af::c_grid<2>(ysize, xsize));
+    }
+
     /**
      * Copy the data from 1 panel
      * @param src The source
@@ -194,41 +612,128 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Copy the data from 1 panel in compact form. The offset and scale for the
+     * image are chosen from the range of unmasked values. If the values are
+     * integers spanning no more than compact_max counts they are stored exactly,
+     * otherwise they are quantised to compact_max steps. If the buffer is
+     * compressed, the codes are then compressed into the image slot.
+     * @param src The source
+     * @param mask The combined dynamic and static mask
+     * @param panel The panel number
+     * @param index The image index
+     */
+    template <typename InputType>
+    void copy_compact(af::const_ref<InputType, af::c_grid<2> > src,
+                      af::const_ref<bool, af::c_grid<2> > mask,
+                      std::size_t panel,
+                      std::size_t index) {
+      std::size_t ysize = src.accessor()[0];
+      std::size_t xsize = src.accessor()[1];
+      DIALS_ASSERT(mask.accessor().all_eq(src.accessor()));
+      compact_type *dst = NULL;
+      if (compress_) {
+        DIALS_ASSERT(panel < compress_codes_.size());
+        DIALS_ASSERT(index < compressed_data_[panel].size());
+        DIALS_ASSERT(compress_codes_[panel].accessor().all_eq(src.accessor()));
+        dst = compress_codes_[panel].begin();
+      } else {
+        DIALS_ASSERT(panel < compact_data_.size());
+        af::ref<compact_type, af::c_grid<3> > data = compact_data_[panel].ref();
+        DIALS_ASSERT(index < data.accessor()[0]);
+        DIALS_ASSERT(src.accessor()[0] == data.accessor()[1]);
+        DIALS_ASSERT(src.accessor()[1] == data.accessor()[2]);
+        dst = &data[index * (xsize * ysize)];
+      }
+
+      // Find the range of the unmasked values
+      bool found = false;
+      bool integral = true;
+      double vmin = 0;
+      double vmax = 0;
+      for (std::size_t j = 0; j < ysize * xsize; ++j) {
+        if (mask[j]) {
+          double v = src[j];
+          if (!found) {
+            vmin = v;
+            vmax = v;
+            found = true;
+          } else {
+            vmin = std::min(vmin, v);
+            vmax = std::max(vmax, v);
+          }
+          if (integral && v != std::floor(v)) {
+            integral = false;
+          }
+        }
+      }
+
+      // Compute the offset and scale
+      double offset = vmin;
+      double scale = 1.0;
+      double range = vmax - vmin;
+      if (!integral || range > BufferFrame::compact_max) {
+        scale = range > 0 ? range / BufferFrame::compact_max : 1.0;
+      }
+      offset_[panel][index] = offset;
+      scale_[panel][index] = scale;
+
+      // Encode the values
+      for (std::size_t j = 0; j < ysize * xsize; ++j) {
+        if (mask[j]) {
+          double code = std::floor((src[j] - offset) / scale + 0.5);
+          code = std::max(0.0, std::min(code, (double)BufferFrame::compact_max));
+          dst[j] = (compact_type)code;
+        } else {
+          dst[j] = compact_masked();
+        }
+      }
+      if (compress_) {
+        compressed_data_[panel][index].assign(compress_codes_[panel].const_ref(),
+                                              compact_masked());
+      }
+    }
+
     /**
      * Mask all pixels
      * @param dst The destination
+     * @param value The masked value
      * @param index The image index
      */
     template <typename OutputType>
     void apply_mask_to_all_pixels(af::ref<OutputType, af::c_grid<3> > dst,
+                                  OutputType value,
                                   std::size_t index) {
       std::size_t ysize = dst.accessor()[1];
       std::size_t xsize = dst.accessor()[2];
       DIALS_ASSERT(index < dst.accessor()[0]);
       for (std::size_t j = 0; j < ysize * xsize; ++j) {
-        dst[index * (xsize * ysize) + j] = mask_value_;
+        dst[index * (xsize * ysize) + j] = value;
       }
     }
 
     /**
-     * Apply the static mask to the dynamic mask
-     * @param src The source
+     * Set the masked pixels of an image in the buffer to the mask value
+     * @param cache The cache of masked pixels
+     * @param static_only Only apply the static mask
      * @param dst The destination
      * @param index The image index
      */
     template <typename OutputType>
-    void apply_mask(af::const_ref<bool, af::c_grid<2> > src,
+    void apply_mask(const MaskRunCache &cache,
+                    bool static_only,
                     af::ref<OutputType, af::c_grid<3> > dst,
                     std::size_t index) {
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
+      std::size_t ysize = dst.accessor()[1];
+      std::size_t xsize = dst.accessor()[2];
       DIALS_ASSERT(index < dst.accessor()[0]);
-      DIALS_ASSERT(src.accessor()[0] == dst.accessor()[1]);
-      DIALS_ASSERT(src.accessor()[1] == dst.accessor()[2]);
-      for (std::size_t j = 0; j < ysize * xsize; ++j) {
-        if (!src[j]) {
-          dst[index * (xsize * ysize) + j] = mask_value_;
-        }
+      DIALS_ASSERT(cache.mask().accessor()[0] == ysize);
+      DIALS_ASSERT(cache.mask().accessor()[1] == xsize);
+      OutputType *image = &dst[index * (xsize * ysize)];
+      if (static_only) {
+        cache.apply_static(image, (OutputType)mask_value_);
+      } else {
+        cache.apply(image, (OutputType)mask_value_);
       }
     }
 
@@ -246,9 +751,46 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Allocate the buffer for a single panel
+     */
+    class PanelAllocator {
+    public:
+      PanelAllocator(BufferBase &buffer, std::size_t panel, af::c_grid<3> grid)
+          : buffer_(buffer), panel_(panel), grid_(grid) {}
+
+      void operator()() const {
+        if (buffer_.compress_) {
+          buffer_.compressed_data_[panel_].resize(grid_[0]);
+          buffer_.compress_codes_[panel_] = af::versa<compact_type, af::c_grid<2> >(
+            af::c_grid<2>(grid_[1], grid_[2]));
+        } else if (buffer_.compact_) {
+          buffer_.compact_data_[panel_] =
+            af::versa<compact_type, af::c_grid<3> >(grid_);
+        } else {
+          buffer_.data_[panel_] = af::versa<float_type, af::c_grid<3> >(grid_);
+        }
+      }
+
+    protected:
+      BufferBase &buffer_;
+      std::size_t panel_;
+      af::c_grid<3> grid_;
+    };
+
     std::vector<af::versa<float_type, af::c_grid<3> > > data_;
+    std::vector<af::versa<compact_type, af::c_grid<3> > > compact_data_;
+    std::vector<std::vector<CompressedFrame> > compressed_data_;
+    std::vector<af::versa<compact_type, af::c_grid<2> > > compress_codes_;
+    std::vector<std::size_t> panel_node_;
+    std::vector<std::vector<double> > offset_;
+    std::vector<std::vector<double> > scale_;
     std::vector<af::versa<bool, af::c_grid<2> > > static_mask_;
+    std::vector<MaskRunCache> mask_cache_;
     float_type mask_value_;
+    bool compact_;
+    bool compress_;
+    boost::shared_ptr<dials::util::MemoryCharge> memory_;
   };
 
   /**
@@ -264,13 +806,25 @@ namespace dials { namespace algorithms {
      * @param num_images The number of images
      * @param mask_value The value of masked pixels in the buffer
      * @param external_mask The external mask
+     * @param compact Store the data in compact 16 bit form
+     * @param compress Store the compact data compressed in tiles
+     * @param pool The thread pool used to place the panels on NUMA nodes
      */
     Buffer(const Detector &detector,
            std::size_t num_images,
            std::size_t num_buffer,
            float_type mask_value,
-           const Image<bool> &external_mask)
-        : buffer_base_(detector, num_buffer, mask_value, external_mask),
+           const Image<bool> &external_mask,
+           bool compact,
+           bool compress,
+           dials::util::ThreadPool *pool = NULL)
+        : buffer_base_(detector,
+                       num_buffer,
+                       mask_value,
+                       external_mask,
+                       compact,
+                       compress,
+                       pool),
           num_images_(num_images),
           num_buffer_(num_buffer),
           buffer_range_(0, num_buffer) {
@@ -292,6 +846,14 @@ namespace dials { namespace algorithms {
       return num_buffer_;
     }
 
+    /**
+     * @param panel The panel number
+     * @returns The NUMA node on which the panel buffer was allocated
+     */
+    std::size_t node(std::size_t panel) const {
+      return buffer_base_.node(panel);
+    }
+
     /**
      * @returns The current buffer image range
      */
@@ -304,7 +866,8 @@ namespace dials { namespace algorithms {
      * @param data The image data
      * @param index The image index
      */
-    void copy(const Image<double> &data, std::size_t index) {
+    template <typename T>
+    void copy(const Image<T> &data, std::size_t index) {
       DIALS_ASSERT(index < num_images_);
       DIALS_ASSERT(index >= buffer_range_[0]);
       DIALS_ASSERT(index <= buffer_range_[1]);
@@ -325,7 +888,8 @@ namespace dials { namespace algorithms {
      * @param mask The mask data
      * @param index The image index
      */
-    void copy(const Image<double> &data, bool mask, std::size_t index) {
+    template <typename T>
+    void copy(const Image<T> &data, bool mask, std::size_t index) {
       DIALS_ASSERT(index < num_images_);
       DIALS_ASSERT(index >= buffer_range_[0]);
       DIALS_ASSERT(index <= buffer_range_[1]);
@@ -346,7 +910,8 @@ namespace dials { namespace algorithms {
      * @param mask The mask data
      * @param index The image index
      */
-    void copy(const Image<double> &data, const Image<bool> &mask, std::size_t index) {
+    template <typename T>
+    void copy(const Image<T> &data, const Image<bool> &mask, std::size_t index) {
       DIALS_ASSERT(index < num_images_);
       DIALS_ASSERT(index >= buffer_range_[0]);
       DIALS_ASSERT(index <= buffer_range_[1]);
@@ -363,10 +928,10 @@ namespace dials { namespace algorithms {
 
     /**
      * @param The panel number
-     * @returns The buffer for the panel
+     * @param index The image index
+     * @returns A view of the buffered image for the panel
      */
-    af::const_ref<float_type, af::c_grid<2> > data(std::size_t panel,
-                                                   std::size_t index) const {
+    BufferFrame frame(std::size_t panel, std::size_t index) const {
       DIALS_ASSERT(index < num_images_);
       DIALS_ASSERT(index >= buffer_range_[0]);
       DIALS_ASSERT(index < buffer_range_[1]);
@@ -374,13 +939,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(buffer_range_[1] <= num_images_);
       DIALS_ASSERT(buffer_range_[1] > buffer_range_[0]);
       DIALS_ASSERT(buffer_range_[1] - buffer_range_[0] == num_buffer_);
-      af::const_ref<float_type, af::c_grid<3> > data_buffer = buffer_base_.data(panel);
-      std::size_t ysize = data_buffer.accessor()[1];
-      std::size_t xsize = data_buffer.accessor()[2];
-      std::size_t offset = (index % num_buffer_) * (ysize * xsize);
-      DIALS_ASSERT(offset < data_buffer.size());
-      return af::const_ref<float_type, af::c_grid<2> >(&data_buffer[offset],
-                                                       af::c_grid<2>(ysize, xsize));
+      return buffer_base_.frame(panel, index % num_buffer_);
     }
 
     /**
@@ -399,9 +958,163 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class to integrate a single reflection
+   * Interface class for integrating reflections, so that the processing loop
+   * can use an integrator specialised for the types of the calculators
+   */
+  class ReflectionIntegratorIface {
+  public:
+    virtual ~ReflectionIntegratorIface() {}
+
+    virtual void operator()(std::size_t index,
+                            ReflectionColumns &columns,
+                            const AdjacencyList &adjacency_list) const = 0;
+
+    virtual void batch(const std::vector<std::size_t> &indices,
+                       ReflectionColumns &columns,
+                       const AdjacencyList &adjacency_list) const = 0;
+  };
+
+  namespace detail {
+
+    /**
+     * Is the calculator type one of the calculator interfaces
+     */
+    template <typename Calculator>
+    struct is_calculator_iface {
+      static const bool value = false;
+    };
+
+    template <>
+    struct is_calculator_iface<MaskCalculatorIface> {
+      static const bool value = true;
+    };
+
+    template <>
+    struct is_calculator_iface<BackgroundCalculatorIface> {
+      static const bool value = true;
+    };
+
+    template <>
+    struct is_calculator_iface<IntensityCalculatorIface> {
+      static const bool value = true;
+    };
+
+    /**
+     * Call the calculators of a reflection integrator. The calls to a concrete
+     * calculator are qualified with its type, so they are bound at compile
+     * time and may be inlined.
+     */
+    template <typename Calculator,
+              bool Virtual = is_calculator_iface<Calculator>::value>
+    struct CalculatorCall {
+      static void mask(const Calculator &calculator,
+                       af::Reflection &reflection,
+                       bool adjacent) {
+        calculator.Calculator::operator()(reflection, adjacent);
+      }
+
+      static void mask_batch(const Calculator &calculator,
+                             std::vector<af::Reflection> &reflections,
+                             bool adjacent) {
+        calculator.Calculator::batch(reflections, adjacent);
+      }
+
+      static void background(const Calculator &calculator,
+                             af::Reflection &reflection) {
+        calculator.Calculator::operator()(reflection);
+      }
+
+      static void background_batch(const Calculator &calculator,
+                                   std::vector<af::Reflection> &reflections,
+                                   std::vector<bool> &success) {
+        calculator.Calculator::batch(reflections, success);
+      }
+
+      static void intensity(const Calculator &calculator,
+                            af::Reflection &reflection,
+                            const std::vector<af::Reflection> &adjacent) {
+        calculator.Calculator::operator()(reflection, adjacent);
+      }
+
+      static void intensity_batch(
+        const Calculator &calculator,
+        std::vector<af::Reflection> &reflections,
+        const std::vector<std::vector<af::Reflection> > &adjacent,
+        std::vector<bool> &success) {
+        calculator.Calculator::batch(reflections, adjacent, success);
+      }
+    };
+
+    /**
+     * Call the calculators through their interfaces with virtual calls
+     */
+    template <typename Calculator>
+    struct CalculatorCall<Calculator, true> {
+      static void mask(const Calculator &calculator,
+                       af::Reflection &reflection,
+                       bool adjacent) {
+        calculator(reflection, adjacent);
+      }
+
+      static void mask_batch(const Calculator &calculator,
+                             std::vector<af::Reflection> &reflections,
+                             bool adjacent) {
+        calculator.batch(reflections, adjacent);
+      }
+
+      static void background(const Calculator &calculator,
+                             af::Reflection &reflection) {
+        calculator(reflection);
+      }
+
+      static void background_batch(const Calculator &calculator,
+                                   std::vector<af::Reflection> &reflections,
+                                   std::vector<bool> &success) {
+        calculator.batch(reflections, success);
+      }
+
+      static void intensity(const Calculator &calculator,
+                            af::Reflection &reflection,
+                            const std::vector<af::Reflection> &adjacent) {
+        calculator(reflection, adjacent);
+      }
+
+      static void intensity_batch(
+        const Calculator &calculator,
+        std::vector<af::Reflection> &reflections,
+        const std::vector<std::vector<af::Reflection> > &adjacent,
+        std::vector<bool> &success) {
+        calculator.batch(reflections, adjacent, success);
+      }
+    };
+
+    /**
+     * Does the intensity calculator need the profile fitting stage. The null
+     * calculator does nothing, so the stage is compiled out.
+     */
+    template <typename Calculator>
+    struct has_profile_stage {
+      static const bool value = true;
+    };
+
+    template <>
+    struct has_profile_stage<NullIntensityCalculator> {
+      static const bool value = false;
+    };
+
+  }  // namespace detail
+
+  /**
+   * A class to integrate a single reflection. The class is templated on the
+   * types of the calculators. With the calculator interfaces the calls are
+   * virtual, which works for any calculators. With concrete calculators the
+   * calls are bound at compile time, and stages which do nothing for the
+   * calculators are compiled out.
    */
-  class ReflectionIntegrator {
+  template <typename MaskCalculator,
+            typename BackgroundCalculator,
+            typename IntensityCalculator>
+  class ReflectionIntegratorT : public ReflectionIntegratorIface {
   public:
     /**
      * Initialise the integrator
@@ -412,15 +1125,20 @@ namespace dials { namespace algorithms {
      * @param zstart The first image index
      * @param underload The underload value
      * @param overload The overload value
-     */
-    ReflectionIntegrator(const MaskCalculatorIface &compute_mask,
-                         const BackgroundCalculatorIface &compute_background,
-                         const IntensityCalculatorIface &compute_intensity,
-                         const Buffer &buffer,
-                         int zstart,
-                         double underload,
-                         double overload,
-                         bool debug)
+     * @param debug Keep the shoeboxes
+     * @param timer The timer to accumulate the time in each stage
+     * @param shoebox_pool The pool to allocate the shoebox arrays from
+     */
+    ReflectionIntegratorT(const MaskCalculator &compute_mask,
+                          const BackgroundCalculator &compute_background,
+                          const IntensityCalculator &compute_intensity,
+                          const Buffer &buffer,
+                          int zstart,
+                          double underload,
+                          double overload,
+                          bool debug,
+                          IntegrationTimer &timer,
+                          ShoeboxPool &shoebox_pool)
         : compute_mask_(compute_mask),
           compute_background_(compute_background),
           compute_intensity_(compute_intensity),
@@ -428,7 +1146,55 @@ namespace dials { namespace algorithms {
           zstart_(zstart),
           underload_(underload),
           overload_(overload),
-          debug_(debug) {}
+          debug_(debug),
+          timer_(timer),
+          shoebox_pool_(shoebox_pool) {}
+
+    /**
+     * Initialise the integrator with the same settings as another integrator
+     * but different calculators
+     * @param compute_mask The mask calculation function
+     * @param compute_background The background calculation function
+     * @param compute_intensity The intensity calculation function
+     * @param other The other integrator
+     */
+    template <typename OtherMask, typename OtherBackground, typename OtherIntensity>
+    ReflectionIntegratorT(
+      const MaskCalculator &compute_mask,
+      const BackgroundCalculator &compute_background,
+      const IntensityCalculator &compute_intensity,
+      const ReflectionIntegratorT<OtherMask, OtherBackground, OtherIntensity> &other)
+        : compute_mask_(compute_mask),
+          compute_background_(compute_background),
+          compute_intensity_(compute_intensity),
+          buffer_(other.buffer_),
+          zstart_(other.zstart_),
+          underload_(other.underload_),
+          overload_(other.overload_),
+          debug_(other.debug_),
+          timer_(other.timer_),
+          shoebox_pool_(other.shoebox_pool_) {}
+
+    /**
+     * @returns The mask calculation function
+     */
+    const MaskCalculator &compute_mask() const {
+      return compute_mask_;
+    }
+
+    /**
+     * @returns The background calculation function
+     */
+    const BackgroundCalculator &compute_background() const {
+      return compute_background_;
+    }
+
+    /**
+     * @returns The intensity calculation function
+     */
+    const IntensityCalculator &compute_intensity() const {
+      return compute_intensity_;
+    }
 
     /**
      * Integrate a reflection using the following procedure:
@@ -440,141 +1206,276 @@ namespace dials { namespace algorithms {
      * 5. Compute the reflection centroid
      * 6. Compute the summed intensity
      * 7. Compute the profile fitted intensity
-     * 8. Delete the shoebox unless debug has been set
+     * 8. Return the shoebox arrays to the pool unless debug has been set
      *
-     * @param reflection The reflection object
-     * @param adjacent_reflections The list of adjacent reflections
+     * The results are written directly into the rows of the column view. Each
+     * row is only written by the thread processing it so no lock is needed.
+     *
+     * @param index The reflection index
+     * @param columns The reflection column view
+     * @param adjacency_list The adjacency list
      */
-
     void operator()(std::size_t index,
-                    af::ref<af::Reflection> reflection_list,
+                    ReflectionColumns &columns,
                     const AdjacencyList &adjacency_list) const {
+      IntegrationTimer::StageClock clock(timer_.local());
+
+      // Borrow the shoebox arrays from the pool. The lease must outlive every
+      // copy of the shoebox made below so that the arrays can be reused.
+      ShoeboxPool::Lease lease(
+        shoebox_pool_.local(), columns.panel(index), columns.bbox(index));
       af::Reflection reflection;
       std::vector<af::Reflection> adjacent_reflections;
 
       // Get the reflection data
-      get_reflection(
-        index, reflection_list, adjacency_list, reflection, adjacent_reflections);
+      get_reflection(index, columns, adjacency_list, reflection, adjacent_reflections);
 
       // Extract the shoebox data
-      extract_shoebox(buffer_, reflection, zstart_, underload_, overload_);
+      Shoebox<> &shoebox = lease.shoebox();
+      extract_shoebox(buffer_, shoebox, zstart_, underload_, overload_);
+      reflection["shoebox"] = shoebox;
+      clock.lap(IntegrationTiming::Extract);
 
       // Compute the mask
-      compute_mask_(reflection);
+      MaskCall::mask(compute_mask_, reflection, false);
 
       // Set all the bounding boxes of adjacent reflections
       // And compute the mask for these reflections too.
       for (std::size_t i = 0; i < adjacent_reflections.size(); ++i) {
-        adjacent_reflections[i]["bbox"] = reflection.get<int6>("bbox");
-        adjacent_reflections[i]["shoebox"] = reflection.get<Shoebox<> >("shoebox");
-        compute_mask_(adjacent_reflections[i], true);
+        adjacent_reflections[i]["bbox"] = shoebox.bbox;
+        adjacent_reflections[i]["shoebox"] = shoebox;
+        MaskCall::mask(compute_mask_, adjacent_reflections[i], true);
       }
+      clock.lap(IntegrationTiming::Mask);
 
       // Compute the background
       try {
-        compute_background_(reflection);
+        BackgroundCall::background(compute_background_, reflection);
       } catch (dials::error) {
-        finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+        clock.lap(IntegrationTiming::Background);
         return;
       }
+      clock.lap(IntegrationTiming::Background);
 
       // Compute the centroid
-      compute_centroid(reflection);
+      columns.set_centroid(index, shoebox.centroid_foreground_minus_background());
+      clock.lap(IntegrationTiming::Centroid);
 
       // Compute the summed intensity
-      compute_summed_intensity(reflection);
+      std::size_t flags = compute_summed_intensity(
+        index, columns, shoebox, reflection.get<std::size_t>("flags"));
+      reflection["flags"] = flags;
+      clock.lap(IntegrationTiming::Summation);
 
       // Compute the profile fitted intensity
-      try {
-        compute_intensity_(reflection, adjacent_reflections);
-      } catch (dials::error) {
-        std::size_t flags = reflection.get<std::size_t>("flags");
-        flags |= af::FailedDuringProfileFitting;
-        reflection["flags"] = flags;
+      if (detail::has_profile_stage<IntensityCalculator>::value) {
+        try {
+          IntensityCall::intensity(
+            compute_intensity_, reflection, adjacent_reflections);
+        } catch (dials::error) {
+          flags = reflection.get<std::size_t>("flags");
+          flags |= af::FailedDuringProfileFitting;
+          reflection["flags"] = flags;
+        }
+      }
+      clock.lap(IntegrationTiming::Profile);
+
+      // Inspect the pixels and set the reflection data
+      reflection["flags"] = inspect_pixels(index,
+                                           columns,
+                                           shoebox,
+                                           reflection.get<std::size_t>("flags"),
+                                           underload_,
+                                           overload_);
+      columns.set_row(index, reflection);
+
+      // Keep the shoebox if debug has been set
+      if (debug_) {
+        columns.set_shoebox(index, shoebox);
       }
+      clock.lap(IntegrationTiming::Write);
+    }
 
-      // Erase the shoebox
-      finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+    /**
+     * Integrate a batch of reflections. The procedure is the same as for a
+     * single reflection but each stage is done for the whole batch before
+     * moving on to the next, so that the mask, background and intensity
+     * calculators are handed all the reflections at once.
+     * @param indices The reflection indices
+     * @param columns The reflection column view
+     * @param adjacency_list The adjacency list
+     */
+    void batch(const std::vector<std::size_t> &indices,
+               ReflectionColumns &columns,
+               const AdjacencyList &adjacency_list) const {
+      IntegrationTimer::StageClock clock(timer_.local());
+      std::size_t n = indices.size();
+
+      // Get the reflection data and extract the shoeboxes. The leases must
+      // outlive every copy of the shoeboxes made below.
+      boost::ptr_vector<ShoeboxPool::Lease> leases;
+      std::vector<af::Reflection> reflections(n);
+      std::vector<std::vector<af::Reflection> > adjacent_reflections(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        std::size_t index = indices[i];
+        leases.push_back(new ShoeboxPool::Lease(
+          shoebox_pool_.local(), columns.panel(index), columns.bbox(index)));
+        get_reflection(
+          index, columns, adjacency_list, reflections[i], adjacent_reflections[i]);
+        Shoebox<> &shoebox = leases[i].shoebox();
+        extract_shoebox(buffer_, shoebox, zstart_, underload_, overload_);
+        reflections[i]["shoebox"] = shoebox;
+      }
+      clock.lap(IntegrationTiming::Extract);
+
+      // Compute the masks of the reflections and then of all the adjacent
+      // reflections, which use the shoebox of the reflection they are next to
+      std::vector<af::Reflection> adjacent;
+      MaskCall::mask_batch(compute_mask_, reflections, false);
+      for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < adjacent_reflections[i].size(); ++j) {
+          adjacent_reflections[i][j]["bbox"] = leases[i].shoebox().bbox;
+          adjacent_reflections[i][j]["shoebox"] = leases[i].shoebox();
+          adjacent.push_back(adjacent_reflections[i][j]);
+        }
+      }
+      MaskCall::mask_batch(compute_mask_, adjacent, true);
+      for (std::size_t i = 0, k = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < adjacent_reflections[i].size(); ++j, ++k) {
+          adjacent_reflections[i][j] = adjacent[k];
+        }
+      }
+      clock.lap(IntegrationTiming::Mask);
+
+      // Compute the backgrounds. Reflections whose background fails are
+      // dropped from the rest of the batch.
+      std::vector<bool> success;
+      BackgroundCall::background_batch(compute_background_, reflections, success);
+      DIALS_ASSERT(success.size() == n);
+      std::vector<std::size_t> selected;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (success[i]) {
+          selected.push_back(i);
+        }
+      }
+      clock.lap(IntegrationTiming::Background);
 
-      // Set the reflection data
-      set_reflection(index, reflection_list, reflection);
+      // Compute the centroids
+      for (std::size_t i = 0; i < selected.size(); ++i) {
+        std::size_t j = selected[i];
+        columns.set_centroid(indices[j],
+                             leases[j].shoebox().centroid_foreground_minus_background());
+      }
+      clock.lap(IntegrationTiming::Centroid);
+
+      // Compute the summed intensities
+      std::vector<af::Reflection> remaining;
+      std::vector<std::vector<af::Reflection> > remaining_adjacent;
+      remaining.reserve(selected.size());
+      remaining_adjacent.reserve(selected.size());
+      for (std::size_t i = 0; i < selected.size(); ++i) {
+        std::size_t j = selected[i];
+        reflections[j]["flags"] =
+          compute_summed_intensity(indices[j],
+                                   columns,
+                                   leases[j].shoebox(),
+                                   reflections[j].get<std::size_t>("flags"));
+        remaining.push_back(reflections[j]);
+        remaining_adjacent.push_back(std::vector<af::Reflection>());
+        remaining_adjacent.back().swap(adjacent_reflections[j]);
+      }
+      clock.lap(IntegrationTiming::Summation);
+
+      // Compute the profile fitted intensities
+      if (detail::has_profile_stage<IntensityCalculator>::value) {
+        IntensityCall::intensity_batch(
+          compute_intensity_, remaining, remaining_adjacent, success);
+        DIALS_ASSERT(success.size() == remaining.size());
+        for (std::size_t i = 0; i < remaining.size(); ++i) {
+          if (!success[i]) {
+            std::size_t flags = remaining[i].get<std::size_t>("flags");
+            flags |= af::FailedDuringProfileFitting;
+            remaining[i]["flags"] = flags;
+          }
+        }
+      }
+      clock.lap(IntegrationTiming::Profile);
+
+      // Inspect the pixels and set the reflection data
+      for (std::size_t i = 0; i < remaining.size(); ++i) {
+        std::size_t j = selected[i];
+        std::size_t index = indices[j];
+        const Shoebox<> &shoebox = leases[j].shoebox();
+        remaining[i]["flags"] = inspect_pixels(index,
+                                               columns,
+                                               shoebox,
+                                               remaining[i].get<std::size_t>("flags"),
+                                               underload_,
+                                               overload_);
+        columns.set_row(index, remaining[i]);
+        if (debug_) {
+          columns.set_shoebox(index, shoebox);
+        }
+      }
+      clock.lap(IntegrationTiming::Write);
     }
 
   protected:
+    template <typename, typename, typename>
+    friend class ReflectionIntegratorT;
+
+    typedef detail::CalculatorCall<MaskCalculator> MaskCall;
+    typedef detail::CalculatorCall<BackgroundCalculator> BackgroundCall;
+    typedef detail::CalculatorCall<IntensityCalculator> IntensityCall;
+
     /**
-     * Get the reflection data in a thread safe manner
+     * Get the reflection data. The rows are read straight from the typed
+     * columns. Adjacent reflections only read columns which are never written
+     * during integration, so this is safe while other threads are running.
      * @param index The reflection index
-     * @param reflection_list The reflection list
+     * @param columns The reflection column view
      * @param adjacency_list The adjacency list
      * @param reflection The reflection data
      * @param adjacent_reflections The adjacent reflections
      */
     void get_reflection(std::size_t index,
-                        const af::const_ref<af::Reflection> &reflection_list,
+                        const ReflectionColumns &columns,
                         const AdjacencyList &adjacency_list,
                         af::Reflection &reflection,
                         std::vector<af::Reflection> &adjacent_reflections) const {
-      DIALS_ASSERT(index < reflection_list.size());
-
-      // Get the lock
-      boost::lock_guard<boost::mutex> guard(mutex_);
+      DIALS_ASSERT(index < columns.size());
 
       // Get the reflection
-      reflection = reflection_list[index];
+      reflection = columns.row(index);
 
       // Get the adjacent reflections
-      adjacent_reflections.reserve(adjacency_list.vertex_num_edges(index));
-      AdjacencyList::edge_iterator_range edges = adjacency_list.edges(index);
-      for (AdjacencyList::edge_iterator it = edges.first; it != edges.second; ++it) {
-        DIALS_ASSERT(it->first == index);
-        DIALS_ASSERT(it->second < reflection_list.size());
-        adjacent_reflections.push_back(reflection_list[it->second]);
+      AdjacencyList::adjacent_vertex_iterator_range adjacent =
+        adjacency_list.adjacent_vertices(index);
+      adjacent_reflections.reserve(adjacent.second - adjacent.first);
+      for (AdjacencyList::adjacent_vertex_iterator it = adjacent.first;
+           it != adjacent.second;
+           ++it) {
+        DIALS_ASSERT(*it < columns.size());
+        adjacent_reflections.push_back(columns.adjacent_row(*it));
       }
     }
 
-    /**
-     * Set the reflection data in a thread safe way
-     * @param index The reflection index
-     * @param reflection_list The reflection list
-     * @param reflection The reflection data
-     */
-    void set_reflection(std::size_t index,
-                        af::ref<af::Reflection> reflection_list,
-                        const af::Reflection &reflection) const {
-      DIALS_ASSERT(index < reflection_list.size());
-      boost::lock_guard<boost::mutex> guard(mutex_);
-      reflection_list[index] = reflection;
-    }
-
-    /**
-     * Before exiting do some stuff on the shoebox
-     * @param reflection The reflection
-     * @param adjacent_reflections The adjancent reflections
-     */
-    void finalize_shoebox(af::Reflection &reflection,
-                          std::vector<af::Reflection> &adjacent_reflections,
-                          double underload,
-                          double overload) const {
-      // Inspect the pixels
-      inspect_pixels(reflection, underload, overload);
-
-      // Delete the shoebox
-      delete_shoebox(reflection, adjacent_reflections);
-    }
-
     /**
      * Inspect the pixel and mask values
-     * @param reflection The reflection
-     */
-    void inspect_pixels(af::Reflection &reflection,
-                        double underload,
-                        double overload) const {
+     * @param index The reflection index
+     * @param columns The reflection column view
+     * @param sbox The shoebox
+     * @param flags The reflection flags
+     * @returns The updated flags
+     */
+    std::size_t inspect_pixels(std::size_t index,
+                               ReflectionColumns &columns,
+                               const Shoebox<> &sbox,
+                               std::size_t flags,
+                               double underload,
+                               double overload) const {
       typedef Shoebox<>::float_type float_type;
 
-      // Get the shoebox
-      Shoebox<> &sbox = reflection.get<Shoebox<> >("shoebox");
-      std::size_t flags = reflection.get<std::size_t>("flags");
-
       // Get the pixel data
       af::const_ref<float_type, af::c_grid<3> > data = sbox.data.const_ref();
       af::const_ref<int, af::c_grid<3> > mask = sbox.mask.const_ref();
@@ -631,42 +1532,24 @@ namespace dials { namespace algorithms {
       }
 
       // Set some information in the reflection
-      reflection["num_pixels.valid"] = (int)n_valid;
-      reflection["num_pixels.background"] = (int)n_background;
-      reflection["num_pixels.background_used"] = (int)n_background_used;
-      reflection["num_pixels.foreground"] = (int)n_foreground;
-      reflection["flags"] = flags;
-    }
-
-    /**
-     * Delete the shoebox
-     * @param reflection The reflection
-     * @param adjacent_reflections The adjancent reflections
-     */
-    void delete_shoebox(af::Reflection &reflection,
-                        std::vector<af::Reflection> &adjacent_reflections) const {
-      // Erase the shoebox from the reflection
-      if (!debug_) {
-        reflection.erase("shoebox");
-        for (std::size_t i = 0; i < adjacent_reflections.size(); ++i) {
-          adjacent_reflections[i].erase("shoebox");
-        }
-      }
+      columns.set_num_pixels(index,
+                             (int)n_valid,
+                             (int)n_background,
+                             (int)n_background_used,
+                             (int)n_foreground);
+      return flags;
     }
 
     /**
      * Extract the shoebox data from the buffer
      */
     void extract_shoebox(const Buffer &buffer,
-                         af::Reflection &reflection,
+                         Shoebox<> &shoebox,
                          int zstart,
                          double underload,
                          double overload) const {
-      typedef af::const_ref<Buffer::float_type, af::c_grid<2> > data_buffer_type;
-      std::size_t panel = reflection.get<std::size_t>("panel");
-      int6 bbox = reflection.get<int6>("bbox");
-      Shoebox<> shoebox(panel, bbox);
-      shoebox.allocate();
+      std::size_t panel = shoebox.panel;
+      const int6 &bbox = shoebox.bbox;
       af::ref<float, af::c_grid<3> > data = shoebox.data.ref();
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int x0 = bbox[0];
@@ -690,7 +1573,7 @@ namespace dials { namespace algorithms {
         if (kk < 0 || kk >= buffer.num_images()) {
           continue;
         }
-        data_buffer_type data_buffer = buffer.data(panel, kk);
+        BufferFrame data_buffer = buffer.frame(panel, kk);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
             int jj = y0 + j;
@@ -708,44 +1591,27 @@ namespace dials { namespace algorithms {
           }
         }
       }
-      reflection["shoebox"] = shoebox;
-    }
-
-    /**
-     * Compute the centroid
-     */
-    void compute_centroid(af::Reflection &reflection) const {
-      using dials::model::Centroid;
-
-      // Get the shoebox and compute centroid
-      Shoebox<> shoebox = reflection.get<Shoebox<> >("shoebox");
-      Centroid centroid = shoebox.centroid_foreground_minus_background();
-
-      // Set the centroid values
-      reflection["xyzobs.px.value"] = centroid.px.position;
-      reflection["xyzobs.px.variance"] = centroid.px.variance;
     }
 
     /**
      * Compute the summed intensity
+     * @returns The updated flags
      */
-    void compute_summed_intensity(af::Reflection &reflection) const {
+    std::size_t compute_summed_intensity(std::size_t index,
+                                         ReflectionColumns &columns,
+                                         const Shoebox<> &shoebox,
+                                         std::size_t flags) const {
       using dials::model::Intensity;
 
-      // Get flags and reset
-      std::size_t flags = reflection.get<std::size_t>("flags");
+      // Reset the flags
       flags &= ~af::IntegratedSum;
       flags &= ~af::FailedDuringSummation;
 
-      // Get the shoebox and compute the summed intensity
-      Shoebox<> shoebox = reflection.get<Shoebox<> >("shoebox");
+      // Compute the summed intensity
       Intensity intensity = shoebox.summed_intensity();
 
       // Set the intensities
-      reflection["intensity.sum.value"] = intensity.observed.value;
-      reflection["intensity.sum.variance"] = intensity.observed.variance;
-      reflection["background.sum.value"] = intensity.background.value;
-      reflection["background.sum.variance"] = intensity.background.variance;
+      columns.set_summed_intensity(index, intensity);
 
       // Set the appropriate flag
       if (intensity.observed.success) {
@@ -753,20 +1619,91 @@ namespace dials { namespace algorithms {
       } else {
         flags |= af::FailedDuringSummation;
       }
-      reflection["flags"] = flags;
+      return flags;
     }
 
-    const MaskCalculatorIface &compute_mask_;
-    const BackgroundCalculatorIface &compute_background_;
-    const IntensityCalculatorIface &compute_intensity_;
+    const MaskCalculator &compute_mask_;
+    const BackgroundCalculator &compute_background_;
+    const IntensityCalculator &compute_intensity_;
     const Buffer &buffer_;
     int zstart_;
     double underload_;
     double overload_;
     bool debug_;
-    mutable boost::mutex mutex_;
+    IntegrationTimer &timer_;
+    ShoeboxPool &shoebox_pool_;
   };
 
+  /**
+   * The reflection integrator for any calculators
+   */
+  typedef ReflectionIntegratorT<MaskCalculatorIface,
+                                BackgroundCalculatorIface,
+                                IntensityCalculatorIface>
+    ReflectionIntegrator;
+
+  /**
+   * Create an integrator specialised for the given calculator types, if the
+   * calculators of an integrator have those types
+   * @param integrator The integrator
+   * @returns The specialised integrator or NULL
+   */
+  template <typename MaskCalculator,
+            typename BackgroundCalculator,
+            typename IntensityCalculator>
+  ReflectionIntegratorIface *make_specialised_integrator(
+    const ReflectionIntegrator &integrator) {
+    const MaskCalculator *compute_mask =
+      dynamic_cast<const MaskCalculator *>(&integrator.compute_mask());
+    const BackgroundCalculator *compute_background =
+      dynamic_cast<const BackgroundCalculator *>(&integrator.compute_background());
+    const IntensityCalculator *compute_intensity =
+      dynamic_cast<const IntensityCalculator *>(&integrator.compute_intensity());
+    if (compute_mask == NULL || compute_background == NULL
+        || compute_intensity == NULL) {
+      return NULL;
+    }
+    return new ReflectionIntegratorT<MaskCalculator,
+                                     BackgroundCalculator,
+                                     IntensityCalculator>(
+      *compute_mask, *compute_background, *compute_intensity, integrator);
+  }
+
+  /**
+   * Create an integrator specialised for the calculators of an integrator.
+   * Only the common configurations are instantiated: the multi crystal mask
+   * with each background model, with and without profile fitting.
+   * @param integrator The integrator
+   * @returns The specialised integrator, or NULL for other configurations
+   */
+  inline ReflectionIntegratorIface *specialise_reflection_integrator(
+    const ReflectionIntegrator &integrator) {
+    typedef GaussianRSMultiCrystalMaskCalculator Mask;
+    typedef SimpleBackgroundCalculator Simple;
+    typedef GLMBackgroundCalculator GLM;
+    typedef GModelBackgroundCalculator GModel;
+    typedef GaussianRSIntensityCalculator Fitting;
+    typedef NullIntensityCalculator NoFitting;
+    ReflectionIntegratorIface *result =
+      make_specialised_integrator<Mask, GLM, Fitting>(integrator);
+    if (result == NULL) {
+      result = make_specialised_integrator<Mask, Simple, Fitting>(integrator);
+    }
+    if (result == NULL) {
+      result = make_specialised_integrator<Mask, GModel, Fitting>(integrator);
+    }
+    if (result == NULL) {
+      result = make_specialised_integrator<Mask, GLM, NoFitting>(integrator);
+    }
+    if (result == NULL) {
+      result = make_specialised_integrator<Mask, Simple, NoFitting>(integrator);
+    }
+    if (result == NULL) {
+      result = make_specialised_integrator<Mask, GModel, NoFitting>(integrator);
+    }
+    return result;
+  }
+
   /**
    * a class to sort the indices of all reflections that are fully recorded
    * after a particular image.
@@ -778,15 +1715,15 @@ namespace dials { namespace algorithms {
      * @param zstart the first frame number
      * @param n the number of frames
      */
-    Lookup(af::const_ref<int6> bbox, int zstart, std::size_t n)
-        : indices_(bbox.size()) {
-      // fill the index array
-      for (std::size_t i = 0; i < indices_.size(); ++i) {
-        indices_[i] = i;
-      }
-
+    Lookup(af::const_ref<int6> bbox, int zstart, std::size_t n) {
       // sort the indices by the final frame number
-      std::sort(indices_.begin(), indices_.end(), sort_by_frame(bbox));
+      std::vector<int> frame(bbox.size());
+      for (std::size_t i = 0; i < frame.size(); ++i) {
+        frame[i] = bbox[i][5];
+      }
+      af::shared<std::size_t> indices = af::radix_sort_index(
+        af::const_ref<int>(frame.empty() ? 0 : &frame[0], frame.size()));
+      indices_.assign(indices.begin(), indices.end());
       DIALS_ASSERT(bbox[indices_.front()][5] - zstart >= 1);
       DIALS_ASSERT(bbox[indices_.back()][5] - zstart <= n);
 
@@ -815,20 +1752,326 @@ namespace dials { namespace algorithms {
       return af::const_ref<std::size_t>(&indices_[i], n);
     }
 
-  private:
+  private:
+    std::vector<std::size_t> indices_;
+    std::vector<std::size_t> offset_;
+  };
+
+  /**
+   * The data for a single image read from the imageset. Integer data are kept
+   * in their native type; otherwise the corrected data are stored as double.
+   */
+  struct ImageFrame {
+    ImageFrame() : index(0), rejected(false), has_mask(false), is_int(false) {}
+
+    std::size_t index;
+    bool rejected;
+    bool has_mask;
+    bool is_int;
+    Image<double> data;
+    Image<int> int_data;
+    Image<bool> mask;
+  };
+
+  /**
+   * A class to read images from the imageset. If there is no gain or pedestal
+   * correction then the corrected data are just the raw data converted to
+   * double, so integer raw data are passed through as they are rather than
+   * converting every pixel to double and then again to the buffer type.
+   */
+  class ImageReader {
+  public:
+    /**
+     * @param imageset The imageset
+     * @param use_dynamic_mask Use the dynamic mask if present
+     */
+    ImageReader(ImageSequence imageset, bool use_dynamic_mask)
+        : imageset_(imageset),
+          use_dynamic_mask_(use_dynamic_mask),
+          use_raw_data_(is_uncorrected(imageset)) {}
+
+    /**
+     * @returns The number of images
+     */
+    std::size_t size() const {
+      return imageset_.size();
+    }
+
+    /**
+     * Read the image data and mask
+     * @param index The image index
+     * @returns The image
+     */
+    ImageFrame operator()(std::size_t index) {
+      DIALS_TRACE_SCOPE("io", "read_image");
+      ImageFrame frame;
+      frame.index = index;
+      frame.rejected = imageset_.is_marked_for_rejection(index);
+      if (use_raw_data_) {
+        ImageBuffer buffer = imageset_.get_raw_data(index);
+        if (buffer.is_int()) {
+          frame.is_int = true;
+          frame.int_data = buffer.as_int();
+        } else {
+          frame.data = buffer.as_double();
+        }
+      } else {
+        frame.data = imageset_.get_corrected_data(index);
+      }
+      if (!frame.rejected && use_dynamic_mask_) {
+        frame.has_mask = true;
+        frame.mask = imageset_.get_dynamic_mask(index);
+      }
+      return frame;
+    }
+
+  protected:
+    /**
+     * @returns True/False the corrected data are the same as the raw data
+     */
+    static bool is_uncorrected(ImageSequence imageset) {
+      if (!imageset.external_lookup().gain().get_data().empty()
+          || !imageset.external_lookup().pedestal().get_data().empty()) {
+        return false;
+      }
+      DIALS_ASSERT(imageset.get_detector() != NULL);
+      const Detector &detector = *imageset.get_detector();
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        if (detector[i].get_gain() != 1.0) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    ImageSequence imageset_;
+    bool use_dynamic_mask_;
+    bool use_raw_data_;
+  };
+
+  /**
+   * A class to read images ahead of processing on a pool of I/O threads.
+   *
+   * Reading and decoding the images can be as expensive as integrating them,
+   * so the images are read on dedicated threads and handed to the processing
+   * thread in order, up to read_ahead images ahead of the image currently being
+   * processed. Each reader claims the next unread image, so with more than one
+   * reader the images can complete out of order; they are held until the
+   * processing thread reaches them.
+   *
+   * The imageset may call into python, so a reader holds the GIL while reading
+   * and the processing thread must release it while the prefetcher is active.
+   * More than one reader therefore only helps when the format releases the GIL
+   * while reading or decompressing the data. The image data are deep copied by
+   * the reader and ownership is passed across under the lock so that no array
+   * handle is ever shared between threads.
+   */
+  class ImagePrefetcher : private boost::noncopyable {
+  public:
+    /**
+     * Start reading the images. This must be called holding the GIL.
+     * @param imageset The imageset
+     * @param read_ahead The maximum number of images to read ahead
+     * @param num_threads The number of reader threads
+     * @param use_dynamic_mask Use the dynamic mask if present
+     */
+    ImagePrefetcher(ImageSequence imageset,
+                    std::size_t read_ahead,
+                    std::size_t num_threads,
+                    bool use_dynamic_mask)
+        : read_image_(imageset, use_dynamic_mask),
+          num_images_(imageset.size()),
+          read_ahead_(read_ahead),
+          next_read_(0),
+          next_frame_(0),
+          stop_(false),
+          failed_(false),
+          error_index_(0) {
+      DIALS_ASSERT(read_ahead > 0);
+      if (num_threads == 0) {
+        num_threads = 1;
+      }
+      for (std::size_t i = 0; i < num_threads; ++i) {
+        threads_.create_thread(boost::bind(&ImagePrefetcher::run, this));
+      }
+    }
+
+    /**
+     * Stop reading and join the I/O threads. This must be called holding the
+     * GIL which is released while waiting for the threads to finish.
+     */
+    ~ImagePrefetcher() {
+      {
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        stop_ = true;
+      }
+      cond_.notify_all();
+      dials::util::ScopedReleaseGIL release_gil;
+      threads_.join_all();
+    }
+
+    /**
+     * Get the next image, blocking until it has been read. This must be called
+     * without holding the GIL. If reading the image failed then the error is
+     * raised here.
+     * @returns The image
+     */
+    ImageFrame next() {
+      DIALS_TRACE_SCOPE("io", "wait_image");
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      for (;;) {
+        std::map<std::size_t, ImageFrame>::iterator it = ready_.find(next_frame_);
+        if (it != ready_.end()) {
+          ImageFrame frame = it->second;
+          ready_.erase(it);
+          next_frame_++;
+          cond_.notify_all();
+          return frame;
+        }
+        if (failed_ && next_frame_ >= error_index_) {
+          throw DIALS_ERROR(error_message_);
+        }
+        if (next_frame_ >= num_images_) {
+          throw DIALS_ERROR("No more images to read");
+        }
+        cond_.wait(lock);
+      }
+    }
+
+  protected:
+    /**
+     * The I/O thread main loop
+     */
+    void run() {
+      dials::util::ScopedAcquireGIL acquire_gil;
+      for (;;) {
+        // Claim the next image to read once it is within the read ahead window
+        std::size_t index = 0;
+        {
+          dials::util::ScopedReleaseGIL release_gil;
+          boost::unique_lock<boost::mutex> lock(mutex_);
+          while (!stop_ && !failed_ && next_read_ < num_images_
+                 && next_read_ >= next_frame_ + read_ahead_) {
+            cond_.wait(lock);
+          }
+          if (stop_ || failed_ || next_read_ >= num_images_) {
+            return;
+          }
+          index = next_read_++;
+        }
+
+        // Read the image
+        ImageFrame frame;
+        try {
+          read(index, frame);
+        } catch (boost::python::error_already_set const &) {
+          set_error(index, python_error_message());
+          return;
+        } catch (std::exception const &e) {
+          set_error(index, e.what());
+          return;
+        }
+
+        // Hand the image over without holding the GIL
+        {
+          dials::util::ScopedReleaseGIL release_gil;
+          boost::lock_guard<boost::mutex> guard(mutex_);
+          ready_[index] = frame;
+          frame = ImageFrame();
+          cond_.notify_all();
+        }
+      }
+    }
+
+    /**
+     * Read the image and copy the data
+     * @param index The image index
+     * @param frame The frame to fill
+     */
+    void read(std::size_t index, ImageFrame &frame) {
+      ImageFrame image = read_image_(index);
+      frame.index = image.index;
+      frame.rejected = image.rejected;
+      frame.has_mask = image.has_mask;
+      frame.is_int = image.is_int;
+      frame.data = deep_copy(image.data);
+      frame.int_data = deep_copy(image.int_data);
+      frame.mask = deep_copy(image.mask);
+    }
+
+    /**
+     * Copy the image so that it shares no memory with the imageset
+     * @param image The image
+     * @returns The copied image
+     */
+    template <typename T>
+    static Image<T> deep_copy(const Image<T> &image) {
+      Image<T> result;
+      for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+        af::versa<T, af::c_grid<2> > src = image.tile(i).data();
+        af::versa<T, af::c_grid<2> > dst(src.accessor());
+        std::copy(src.begin(), src.end(), dst.begin());
+        result.append(ImageTile<T>(dst));
+      }
+      return result;
+    }
+
+    /**
+     * Fetch and clear the current python error
+     * @returns The error message
+     */
+    static std::string python_error_message() {
+      std::string message = "Unknown python error reading image";
+      PyObject *type = NULL;
+      PyObject *value = NULL;
+      PyObject *traceback = NULL;
+      PyErr_Fetch(&type, &value, &traceback);
+      if (value != NULL) {
+        PyObject *str = PyObject_Str(value);
+        if (str != NULL) {
+          boost::python::extract<std::string> text(str);
+          if (text.check()) {
+            message = text();
+          }
+          Py_DECREF(str);
+        }
+      }
+      PyErr_Clear();
+      Py_XDECREF(type);
+      Py_XDECREF(value);
+      Py_XDECREF(traceback);
+      return message;
+    }
+
     /**
-     * helper function to sort by final bbox frame
+     * Record the error for the earliest failed image and wake the processing
+     * thread. Images before it are still handed over before the error is raised.
+     * @param index The image index
+     * @param message The error message
      */
-    struct sort_by_frame {
-      af::const_ref<int6> bbox_;
-      sort_by_frame(af::const_ref<int6> bbox) : bbox_(bbox) {}
-      bool operator()(std::size_t a, std::size_t b) const {
-        return bbox_[a][5] < bbox_[b][5];
+    void set_error(std::size_t index, const std::string &message) {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (!failed_ || index < error_index_) {
+        failed_ = true;
+        error_index_ = index;
+        error_message_ = message;
       }
-    };
+      cond_.notify_all();
+    }
 
-    std::vector<std::size_t> indices_;
-    std::vector<std::size_t> offset_;
+    ImageReader read_image_;
+    std::size_t num_images_;
+    std::size_t read_ahead_;
+    boost::thread_group threads_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::map<std::size_t, ImageFrame> ready_;
+    std::size_t next_read_;
+    std::size_t next_frame_;
+    bool stop_;
+    bool failed_;
+    std::size_t error_index_;
+    std::string error_message_;
   };
 
   /**
@@ -836,7 +2079,8 @@ namespace dials { namespace algorithms {
    * the manager when they are done. We maintain a counter of reflections which
    * require each image. After each reflection is processed, the appropriate
    * atomic counter is decremented. When the counter reaches zero, the image is no
-   * longer needed.
+   * longer needed and the reader, if it is waiting for the slot holding that
+   * image, is woken so the slot can be refilled immediately.
    */
   class BufferManager {
   public:
@@ -853,19 +2097,22 @@ namespace dials { namespace algorithms {
         : buffer_(buffer),
           notifier_(bbox, flags, first_image, buffer.num_images(), buffer.num_buffer()),
           first_image_(first_image),
-          max_images_(buffer.num_buffer()) {}
+          max_images_(buffer.num_buffer()),
+          stall_time_(0),
+          copy_time_(0) {}
 
     /**
      * Copy the image to the buffer when we are able to accept more images
      * @param data The image data
      * @param index The image index
      */
-    void copy_when_ready(const Image<double> &data, std::size_t index) {
-      if (index >= max_images_) {
-        while (!notifier_.complete(buffer_.buffer_range()[0]))
-          ;
-      }
+    template <typename T>
+    void copy_when_ready(const Image<T> &data, std::size_t index) {
+      wait_for_free_slot(index);
+      DIALS_TRACE_SCOPE("buffer", "copy_image");
+      double start_time = dials::util::monotonic_time();
       buffer_.copy(data, index);
+      copy_time_ += dials::util::monotonic_time() - start_time;
     }
 
     /**
@@ -874,12 +2121,13 @@ namespace dials { namespace algorithms {
      * @param mask A single value mask
      * @param index The image index
      */
-    void copy_when_ready(const Image<double> &data, bool mask, std::size_t index) {
-      if (index >= max_images_) {
-        while (!notifier_.complete(buffer_.buffer_range()[0]))
-          ;
-      }
+    template <typename T>
+    void copy_when_ready(const Image<T> &data, bool mask, std::size_t index) {
+      wait_for_free_slot(index);
+      DIALS_TRACE_SCOPE("buffer", "copy_image");
+      double start_time = dials::util::monotonic_time();
       buffer_.copy(data, mask, index);
+      copy_time_ += dials::util::monotonic_time() - start_time;
     }
 
     /**
@@ -888,14 +2136,44 @@ namespace dials { namespace algorithms {
      * @param mask The image mask
      * @param index The image index
      */
-    void copy_when_ready(const Image<double> &data,
+    template <typename T>
+    void copy_when_ready(const Image<T> &data,
                          const Image<bool> &mask,
                          std::size_t index) {
-      if (index >= max_images_) {
-        while (!notifier_.complete(buffer_.buffer_range()[0]))
-          ;
-      }
+      wait_for_free_slot(index);
+      DIALS_TRACE_SCOPE("buffer", "copy_image");
+      double start_time = dials::util::monotonic_time();
       buffer_.copy(data, mask, index);
+      copy_time_ += dials::util::monotonic_time() - start_time;
+    }
+
+    /**
+     * Copy an image read from the imageset to the buffer when we are able to
+     * accept more images
+     * @param image The image
+     * @param index The image index
+     */
+    void copy_when_ready(const ImageFrame &image, std::size_t index) {
+      DIALS_ASSERT(image.index == index);
+      if (image.is_int) {
+        copy_when_ready(image.int_data, image, index);
+      } else {
+        copy_when_ready(image.data, image, index);
+      }
+    }
+
+    /**
+     * @returns The time spent waiting for a free slot in the buffer
+     */
+    double stall_time() const {
+      return stall_time_;
+    }
+
+    /**
+     * @returns The time spent copying images into the buffer
+     */
+    double copy_time() const {
+      return copy_time_;
     }
 
     /**
@@ -911,6 +2189,45 @@ namespace dials { namespace algorithms {
         JobWrapper<Function>(function, notifier_, bbox_first_image - first_image_));
     }
 
+    /**
+     * Post the job to the pool to run preferentially on a NUMA node
+     * @param pool The thread pool
+     * @param function The function to post
+     * @param bbox_first_image The image index
+     * @param node The NUMA node
+     */
+    template <typename ThreadPoolType, typename Function>
+    void post(ThreadPoolType &pool,
+              Function function,
+              int bbox_first_image,
+              std::size_t node) {
+      DIALS_ASSERT(bbox_first_image >= first_image_);
+      pool.post(
+        JobWrapper<Function>(function, notifier_, bbox_first_image - first_image_),
+        node);
+    }
+
+    /**
+     * Post a job processing several reflections to the pool to run
+     * preferentially on a NUMA node
+     * @param pool The thread pool
+     * @param function The function to post
+     * @param bbox_first_image The first image of each reflection
+     * @param node The NUMA node
+     */
+    template <typename ThreadPoolType, typename Function>
+    void post(ThreadPoolType &pool,
+              Function function,
+              const std::vector<int> &bbox_first_image,
+              std::size_t node) {
+      std::vector<std::size_t> index(bbox_first_image.size());
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        DIALS_ASSERT(bbox_first_image[i] >= first_image_);
+        index[i] = bbox_first_image[i] - first_image_;
+      }
+      pool.post(BatchJobWrapper<Function>(function, notifier_, index), node);
+    }
+
     /**
      * Wait and check all are complete
      * @param pool The thread pool
@@ -922,6 +2239,39 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * Copy the image data with the mask given by the image
+     * @param data The image data
+     * @param image The image
+     * @param index The image index
+     */
+    template <typename T>
+    void copy_when_ready(const Image<T> &data,
+                         const ImageFrame &image,
+                         std::size_t index) {
+      if (image.rejected) {
+        copy_when_ready(data, false, index);
+      } else if (image.has_mask) {
+        copy_when_ready(data, image.mask, index);
+      } else {
+        copy_when_ready(data, index);
+      }
+    }
+
+    /**
+     * If the buffer is full, block until all the jobs using the oldest image in
+     * the buffer have finished so that its slot can be reused.
+     * @param index The image index to be copied
+     */
+    void wait_for_free_slot(std::size_t index) {
+      if (index >= max_images_) {
+        DIALS_TRACE_SCOPE("buffer", "wait_free_slot");
+        double start_time = dials::util::monotonic_time();
+        notifier_.wait(buffer_.buffer_range()[0]);
+        stall_time_ += dials::util::monotonic_time() - start_time;
+      }
+    }
+
     /**
      * A class to notify the buffer manager when all jobs that need to access an
      * image have completed so that the image can be deleted.
@@ -968,12 +2318,32 @@ namespace dials { namespace algorithms {
 
       /**
        * Notify about a reflection using this image is finished.
-       * Reduce the atomic counter for the image
+       * Reduce the atomic counter for the image and wake any thread waiting on
+       * the image if this was the last reflection using it.
        * @param image_index The image index
        */
       void notify(std::size_t index) {
         DIALS_ASSERT(index < counter_.size());
-        counter_[index]--;
+        if (--counter_[index] == 0) {
+          boost::lock_guard<boost::mutex> guard(mutex_);
+          cond_.notify_all();
+        }
+      }
+
+      /**
+       * Block until all reflections needing this image are finished. The
+       * counter is checked without the lock first so there is no locking when
+       * the image is already complete.
+       * @param index The image index
+       */
+      void wait(std::size_t index) {
+        if (complete(index)) {
+          return;
+        }
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (!complete(index)) {
+          cond_.wait(lock);
+        }
       }
 
       /**
@@ -1012,6 +2382,8 @@ namespace dials { namespace algorithms {
     protected:
       int first_image_;
       boost::ptr_vector<boost::atomic<int> > counter_;
+      boost::mutex mutex_;
+      boost::condition_variable cond_;
     };
 
     /**
@@ -1042,10 +2414,44 @@ namespace dials { namespace algorithms {
       std::size_t index_;
     };
 
+    /**
+     * A class to wrap a job processing several reflections
+     */
+    template <typename Function>
+    class BatchJobWrapper {
+    public:
+      /**
+       * Construct
+       * @param function The function to call
+       * @param notifier The notifier function
+       * @param index The image index of each reflection
+       */
+      BatchJobWrapper(Function function,
+                      Notifier &notifier,
+                      const std::vector<std::size_t> &index)
+          : function_(function), notifier_(notifier), index_(index) {}
+
+      /**
+       * Call the function and notify for each reflection
+       */
+      void operator()() {
+        function_();
+        for (std::size_t i = 0; i < index_.size(); ++i) {
+          notifier_.notify(index_[i]);
+        }
+      }
+
+      Function function_;
+      Notifier &notifier_;
+      std::vector<std::size_t> index_;
+    };
+
     Buffer &buffer_;
     Notifier notifier_;
     int first_image_;
     std::size_t max_images_;
+    double stall_time_;
+    double copy_time_;
   };
 
   /**
@@ -1065,6 +2471,14 @@ namespace dials { namespace algorithms {
      * @param buffer_size The buffer_size
      * @param use_dynamic_mask Use the dynamic mask if present
      * @param debug Add debug output
+     * @param read_ahead The number of images to read ahead on I/O threads
+     * @param read_threads The number of I/O threads used to read ahead
+     * @param compact_buffer Store the image buffer in compact 16 bit form
+     * @param compress_buffer Store the compact image buffer compressed in tiles
+     * @param batch_size The number of reflections passed to the calculators
+     *                   at once
+     * @param thread_pool A thread pool shared with other jobs or NULL to create
+     *                    one with nthreads threads
      */
     ParallelIntegrator(af::reflection_table reflections,
                        ImageSequence imageset,
@@ -1075,11 +2489,18 @@ namespace dials { namespace algorithms {
                        std::size_t nthreads,
                        std::size_t buffer_size,
                        bool use_dynamic_mask,
-                       bool debug) {
+                       bool debug,
+                       std::size_t read_ahead,
+                       std::size_t read_threads,
+                       bool compact_buffer,
+                       bool compress_buffer,
+                       std::size_t batch_size,
+                       boost::shared_ptr<dials::util::ThreadPool> thread_pool) {
       using dials::algorithms::shoebox::find_overlapping_multi_panel;
 
       // Check the input
       DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(batch_size > 0);
 
       // Check the models
       DIALS_ASSERT(imageset.get_detector() != NULL);
@@ -1114,33 +2535,50 @@ namespace dials { namespace algorithms {
       reset_flags(flags);
 
       // Find the overlapping reflections
-      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel);
+      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel, nthreads);
+
+      // Use the thread pool given if there is one, otherwise the process-wide
+      // pool or a new one
+      boost::shared_ptr<dials::util::ThreadPool> job_pool =
+        dials::util::job_thread_pool(thread_pool, nthreads);
+      dials::util::ThreadPool &pool = *job_pool;
 
       // Allocate the array for the image data
-      Buffer buffer(
-        detector, zsize, buffer_size, underload, imageset.get_static_mask());
+      Buffer buffer(detector,
+                    zsize,
+                    buffer_size,
+                    underload,
+                    imageset.get_static_mask(),
+                    compact_buffer,
+                    compress_buffer,
+                    &pool);
 
       // If we have shoeboxes then delete
       if (reflections.contains("shoebox")) {
         reflections.erase("shoebox");
       }
 
-      // Transform reflection data from column major to row major. The
-      // reason for doing this is because we want to process each reflection
-      // in parallel. Therefore passing a reflection object is better than
-      // passing the whole table. Additionally, because the reflection table
-      // uses a std::map, it may not be thread safe, so we want to avoid
-      // accessing this across multiple threads.
-      af::shared<af::Reflection> reflection_array =
-        reflection_table_to_array(reflections);
+      // Resolve the typed columns read and written during integration. Each
+      // reflection is processed by a single thread which reads and writes its
+      // own row directly so there is no need to copy the table into an array
+      // of reflection objects or to lock when accessing it.
+      ReflectionColumns columns(reflections, debug);
 
       // The lookup class gives the indices of reflections whose bounding boxes
       // are complete at a given image. This is used to submit reflections for
       // integration after each image is processed.
       Lookup lookup(bbox, zstart, zsize);
 
+      // The timer accumulates the time spent in each stage of processing
+      IntegrationTimer timer;
+      double start_time = dials::util::monotonic_time();
+
+      // The shoebox arrays are recycled between reflections on each thread
+      ShoeboxPool shoebox_pool;
+
       // Create the reflection integrator. This class is called for each
-      // reflection to integrate the data
+      // reflection to integrate the data. For the common configurations of
+      // calculators an integrator specialised for their types is used.
       ReflectionIntegrator integrator(compute_mask,
                                       compute_background,
                                       compute_intensity,
@@ -1148,23 +2586,38 @@ namespace dials { namespace algorithms {
                                       zstart,
                                       underload,
                                       overload,
-                                      debug);
+                                      debug,
+                                      timer,
+                                      shoebox_pool);
+      boost::scoped_ptr<ReflectionIntegratorIface> specialised(
+        specialise_reflection_integrator(integrator));
+      const ReflectionIntegratorIface &selected =
+        specialised ? *specialised
+                    : static_cast<const ReflectionIntegratorIface &>(integrator);
 
       // Do the integration
       process(lookup,
-              integrator,
+              selected,
               buffer,
-              reflection_array.ref(),
+              columns,
               overlaps,
               imageset,
               bbox,
+              panel,
               flags,
-              nthreads,
               use_dynamic_mask,
+              read_ahead,
+              read_threads,
+              batch_size,
+              pool,
+              timer,
               logger);
+      timing_ =
+        timer.summary(pool.size(), dials::util::monotonic_time() - start_time);
 
-      // Transform the row major reflection array to the reflection table
-      reflections_ = reflection_table_from_array(reflection_array.const_ref());
+      // Remove any optional columns which were not written
+      columns.finalize();
+      reflections_ = reflections;
     }
 
     /**
@@ -1174,12 +2627,22 @@ namespace dials { namespace algorithms {
       return reflections_;
     }
 
+    /**
+     * @returns The time spent in each stage of processing
+     */
+    IntegrationTiming timing() const {
+      return timing_;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
+     * @param block_size The number of images in the buffer
+     * @param compact Is the buffer stored in compact form
      */
     static std::size_t compute_required_memory(ImageSequence imageset,
-                                               std::size_t block_size) {
+                                               std::size_t block_size,
+                                               bool compact) {
       DIALS_ASSERT(imageset.get_detector() != NULL);
       DIALS_ASSERT(imageset.get_scan() != NULL);
       Detector detector = *imageset.get_detector();
@@ -1192,7 +2655,8 @@ namespace dials { namespace algorithms {
         nelements += xsize * ysize;
       }
       nelements *= block_size;
-      std::size_t nbytes = nelements * sizeof(Buffer::float_type);
+      std::size_t nbytes =
+        nelements * (compact ? sizeof(BufferFrame::compact_type) : sizeof(Buffer::float_type));
       return nbytes;
     }
 
@@ -1200,9 +2664,11 @@ namespace dials { namespace algorithms {
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
      * @param max_memory_usage The maximum memory usage
+     * @param compact Is the buffer stored in compact form
      */
     static std::size_t compute_max_block_size(ImageSequence imageset,
-                                              std::size_t max_memory_usage) {
+                                              std::size_t max_memory_usage,
+                                              bool compact) {
       DIALS_ASSERT(max_memory_usage > 0);
       DIALS_ASSERT(imageset.get_detector() != NULL);
       Detector detector = *imageset.get_detector();
@@ -1212,7 +2678,8 @@ namespace dials { namespace algorithms {
         std::size_t ysize = detector[i].get_image_size()[1];
         nelements += xsize * ysize;
       }
-      std::size_t nbytes = nelements * sizeof(Buffer::float_type);
+      std::size_t nbytes =
+        nelements * (compact ? sizeof(BufferFrame::compact_type) : sizeof(Buffer::float_type));
       DIALS_ASSERT(nbytes > 0);
       DIALS_ASSERT(max_memory_usage > nbytes);
       return (std::size_t)std::floor((float)max_memory_usage / (float)nbytes);
@@ -1237,23 +2704,30 @@ namespace dials { namespace algorithms {
      * 3. Copy the images to a buffer
      * 4. Loop through all reflections complete on the image
      * 5. For each complete reflection post a reflection integration job to the
-     *    thread pool.
+     *    thread pool, preferring a thread on the NUMA node of its panel. If
+     *    the batch size is more than 1, the reflections on each node are
+     *    grouped into batches and a job is posted for each batch.
      */
     void process(const Lookup &lookup,
-                 const ReflectionIntegrator &integrator,
+                 const ReflectionIntegratorIface &integrator,
                  Buffer &buffer,
-                 af::ref<af::Reflection> reflections,
+                 ReflectionColumns &columns,
                  const AdjacencyList &overlaps,
                  ImageSequence imageset,
                  af::const_ref<int6> bbox,
+                 af::const_ref<std::size_t> panel,
                  af::const_ref<std::size_t> flags,
-                 std::size_t nthreads,
                  bool use_dynamic_mask,
+                 std::size_t read_ahead,
+                 std::size_t read_threads,
+                 std::size_t batch_size,
+                 dials::util::ThreadPool &thread_pool,
+                 IntegrationTimer &timer,
                  const Logger &logger) const {
-      using dials::util::ThreadPool;
-
-      // Create the thread pool
-      ThreadPool pool(nthreads);
+      // The reflections are posted as a task group so that only the reflections
+      // from this imageset are waited on when the pool is shared.
+      dials::util::ThreadPool::TaskGroup pool(thread_pool);
+      std::vector<std::vector<std::size_t> > batches(pool.num_nodes());
 
       // Get the size of the array
       int zstart = imageset.get_scan()->get_array_range()[0];
@@ -1262,19 +2736,27 @@ namespace dials { namespace algorithms {
       // Create the buffer manager
       BufferManager bm(buffer, bbox, flags, zstart);
 
+      // If requested, read the images ahead on separate I/O threads. The
+      // imageset is then only accessed by those threads, which need the GIL, so
+      // release it here and only reacquire it to write the log.
+      ImageReader read_image(imageset, use_dynamic_mask);
+      boost::scoped_ptr<ImagePrefetcher> prefetcher;
+      boost::scoped_ptr<dials::util::ScopedReleaseGIL> release_gil;
+      if (read_ahead > 0) {
+        prefetcher.reset(new ImagePrefetcher(
+          imageset, read_ahead, read_threads, use_dynamic_mask));
+        release_gil.reset(new dials::util::ScopedReleaseGIL());
+      }
+
       // Loop through all the images
       for (std::size_t i = 0; i < zsize; ++i) {
         // Copy the image to the buffer. If the image number is greater than the
         // buffer size (i.e. we are now deleting old images) then wait for the
         // threads to finish so that we don't end up reading the wrong data
-        if (imageset.is_marked_for_rejection(i)) {
-          bm.copy_when_ready(imageset.get_corrected_data(i), false, i);
-        } else if (use_dynamic_mask) {
-          bm.copy_when_ready(
-            imageset.get_corrected_data(i), imageset.get_dynamic_mask(i), i);
-        } else {
-          bm.copy_when_ready(imageset.get_corrected_data(i), i);
-        }
+        double read_start_time = dials::util::monotonic_time();
+        ImageFrame image = prefetcher ? prefetcher->next() : read_image(i);
+        timer.add_read(dials::util::monotonic_time() - read_start_time);
+        bm.copy_when_ready(image, i);
 
         // Get the reflections recorded at this point
         af::const_ref<std::size_t> indices = lookup.indices(i);
@@ -1296,29 +2778,262 @@ namespace dials { namespace algorithms {
             count++;
           }
 
-          // Post the integration job
-          bm.post(
-            pool,
-            boost::bind(&ReflectionIntegrator::operator(),
-                        boost::ref(integrator),
-                        k,
-                        af::ref<af::Reflection>(&reflections[0], reflections.size()),
-                        boost::ref(overlaps)),
-            bbox[k][4]);
+          // Post the integration job or add the reflection to the batch
+          std::size_t node = buffer.node(panel[k]);
+          if (batch_size == 1) {
+            bm.post(pool,
+                    boost::bind(&ReflectionIntegratorIface::operator(),
+                                boost::ref(integrator),
+                                k,
+                                boost::ref(columns),
+                                boost::ref(overlaps)),
+                    bbox[k][4],
+                    node);
+          } else {
+            batches[node].push_back(k);
+            if (batches[node].size() == batch_size) {
+              post_batch(
+                bm, pool, integrator, columns, overlaps, bbox, batches[node], node);
+            }
+          }
+        }
+
+        // Post the partial batches. The reflections are not held back for the
+        // next image since the buffer may be waiting for them to finish.
+        for (std::size_t node = 0; node < batches.size(); ++node) {
+          if (!batches[node].empty()) {
+            post_batch(
+              bm, pool, integrator, columns, overlaps, bbox, batches[node], node);
+          }
         }
 
         // Print some output
         std::ostringstream ss;
         ss << "Integrating " << std::setw(5) << count << " reflections on image "
            << std::setw(6) << zstart + i;
-        logger.info(ss.str().c_str());
+        {
+          dials::util::ScopedAcquireGIL acquire_gil;
+          logger.info(ss.str().c_str());
+        }
       }
 
       // Wait for all the integration jobs to complete
       bm.wait(pool);
+      timer.add_stall(bm.stall_time());
+      timer.add_copy(bm.copy_time());
+    }
+
+    /**
+     * Post a batch of reflections to the thread pool and clear the batch
+     */
+    void post_batch(BufferManager &bm,
+                    dials::util::ThreadPool::TaskGroup &pool,
+                    const ReflectionIntegratorIface &integrator,
+                    ReflectionColumns &columns,
+                    const AdjacencyList &overlaps,
+                    af::const_ref<int6> bbox,
+                    std::vector<std::size_t> &batch,
+                    std::size_t node) const {
+      std::vector<int> first_image(batch.size());
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        first_image[i] = bbox[batch[i]][4];
+      }
+      bm.post(pool,
+              boost::bind(&ReflectionIntegratorIface::batch,
+                          boost::ref(integrator),
+                          batch,
+                          boost::ref(columns),
+                          boost::ref(overlaps)),
+              first_image,
+              node);
+      batch.clear();
+    }
+
+    af::reflection_table reflections_;
+    IntegrationTiming timing_;
+  };
+
+  /**
+   * A class to profile fit a single reflection from a shoebox which was
+   * extracted, masked and had its background computed in an earlier pass.
+   */
+  class ReflectionProfileFitter {
+  public:
+    /**
+     * @param compute_intensity The intensity calculation function
+     * @param timer The timer to accumulate the time in each stage
+     */
+    ReflectionProfileFitter(const IntensityCalculatorIface &compute_intensity,
+                            IntegrationTimer &timer)
+        : compute_intensity_(compute_intensity), timer_(timer) {}
+
+    /**
+     * Compute the profile fitted intensity of a reflection. Reflections with
+     * no shoebox data were not processed in the earlier pass and are skipped.
+     * @param index The reflection index
+     * @param columns The reflection column view
+     * @param adjacency_list The adjacency list
+     */
+    void operator()(std::size_t index,
+                    ReflectionColumns &columns,
+                    const AdjacencyList &adjacency_list) const {
+      IntegrationTimer::StageClock clock(timer_.local());
+
+      // Get the shoebox and check it has been processed
+      Shoebox<> shoebox = columns.shoebox(index);
+      if (shoebox.data.size() == 0) {
+        return;
+      }
+      DIALS_ASSERT(shoebox.is_consistent());
+
+      // Get the reflection data
+      af::Reflection reflection = columns.row(index);
+      reflection["shoebox"] = shoebox;
+      std::vector<af::Reflection> adjacent_reflections;
+      AdjacencyList::adjacent_vertex_iterator_range adjacent =
+        adjacency_list.adjacent_vertices(index);
+      adjacent_reflections.reserve(adjacent.second - adjacent.first);
+      for (AdjacencyList::adjacent_vertex_iterator it = adjacent.first;
+           it != adjacent.second;
+           ++it) {
+        DIALS_ASSERT(*it < columns.size());
+        adjacent_reflections.push_back(columns.adjacent_row(*it));
+        adjacent_reflections.back()["bbox"] = shoebox.bbox;
+        adjacent_reflections.back()["shoebox"] = shoebox;
+      }
+      clock.lap(IntegrationTiming::Extract);
+
+      // Compute the profile fitted intensity
+      try {
+        compute_intensity_(reflection, adjacent_reflections);
+      } catch (dials::error) {
+        std::size_t flags = reflection.get<std::size_t>("flags");
+        flags |= af::FailedDuringProfileFitting;
+        reflection["flags"] = flags;
+      }
+      clock.lap(IntegrationTiming::Profile);
+
+      // Set the reflection data
+      columns.set_row(index, reflection);
+      clock.lap(IntegrationTiming::Write);
+    }
+
+  protected:
+    const IntensityCalculatorIface &compute_intensity_;
+    IntegrationTimer &timer_;
+  };
+
+  /**
+   * A class to do the profile fitting of reflections whose shoeboxes were kept
+   * from the reference profiling pass. The shoebox data, mask and background
+   * are reused as they are, so the images are not read again and only the
+   * fitting step is repeated.
+   */
+  class ParallelProfileFitter {
+  public:
+    /**
+     * Do the profile fitting
+     * @param reflections The reflection table with shoeboxes
+     * @param compute_intensity The intensity calculation function
+     * @param nthreads The number of parallel threads
+     * @param thread_pool A thread pool shared with other jobs or NULL to create
+     *                    one with nthreads threads
+     */
+    ParallelProfileFitter(af::reflection_table reflections,
+                          const IntensityCalculatorIface &compute_intensity,
+                          std::size_t nthreads,
+                          boost::shared_ptr<dials::util::ThreadPool> thread_pool) {
+      using dials::algorithms::shoebox::find_overlapping_multi_panel;
+      using dials::util::ThreadPool;
+
+      // Check the input
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(reflections.contains("shoebox"));
+
+      // Get the reflection flags and bbox
+      af::const_ref<std::size_t> panel =
+        reflections.get<std::size_t>("panel").const_ref();
+      af::const_ref<int6> bbox = reflections.get<int6>("bbox").const_ref();
+      af::ref<std::size_t> flags = reflections.get<std::size_t>("flags").ref();
+
+      // Reset the profile fitting flags. The summation flags were set in the
+      // earlier pass and are kept.
+      for (std::size_t i = 0; i < flags.size(); ++i) {
+        flags[i] &= ~af::IntegratedPrf;
+      }
+
+      // Find the overlapping reflections
+      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel, nthreads);
+
+      // Resolve the typed columns
+      ReflectionColumns columns(reflections, true);
+
+      // The timer accumulates the time spent in each stage of processing
+      IntegrationTimer timer;
+      double start_time = dials::util::monotonic_time();
+
+      // Create the reflection profile fitter
+      ReflectionProfileFitter fitter(compute_intensity, timer);
+
+      // Fit the reflections in batches on the thread pool. The GIL is released
+      // while waiting so that other jobs sharing the pool can proceed.
+      {
+        const std::size_t batch_size = 64;
+        boost::shared_ptr<ThreadPool> job_pool =
+          dials::util::job_thread_pool(thread_pool, nthreads);
+        ThreadPool::TaskGroup pool(*job_pool);
+        dials::util::ScopedReleaseGIL release_gil;
+        for (std::size_t first = 0; first < flags.size(); first += batch_size) {
+          std::size_t last = std::min(first + batch_size, flags.size());
+          pool.post(boost::bind(&ParallelProfileFitter::fit_batch,
+                                boost::cref(fitter),
+                                first,
+                                last,
+                                boost::ref(columns),
+                                boost::cref(overlaps)));
+        }
+        pool.wait();
+      }
+      timing_ = timer.summary(thread_pool ? thread_pool->size() : nthreads,
+                              dials::util::monotonic_time() - start_time);
+
+      // Remove any optional columns which were not written
+      columns.finalize();
+      reflections_ = reflections;
+    }
+
+    /**
+     * @returns The integrated reflections
+     */
+    af::reflection_table reflections() const {
+      return reflections_;
+    }
+
+    /**
+     * @returns The time spent in each stage of processing
+     */
+    IntegrationTiming timing() const {
+      return timing_;
+    }
+
+  protected:
+    /**
+     * Fit a batch of reflections, ignoring those which are not integrated
+     */
+    static void fit_batch(const ReflectionProfileFitter &fitter,
+                          std::size_t first,
+                          std::size_t last,
+                          ReflectionColumns &columns,
+                          const AdjacencyList &overlaps) {
+      for (std::size_t i = first; i < last; ++i) {
+        if ((columns.flags(i) & af::DontIntegrate) == 0) {
+          fitter(i, columns, overlaps);
+        }
+      }
     }
 
     af::reflection_table reflections_;
+    IntegrationTiming timing_;
   };
 
   /**
@@ -1537,6 +3252,13 @@ namespace dials { namespace algorithms {
       return data_;
     }
 
+    /**
+     * Free the reflection data, keeping the lookup of reflections in each block
+     */
+    void release() {
+      data_ = af::reflection_table();
+    }
+
     /**
      * Get the indices of reflections in this block
      * @param index The block index
@@ -1740,7 +3462,8 @@ namespace dials { namespace algorithms {
         : lookup_(blocks, data),
           njobs_(std::min(njobs, blocks.size())),
           finished_(njobs_, false),
-          job_blocks_(njobs_) {
+          job_blocks_(njobs_),
+          released_(false) {
       DIALS_ASSERT(njobs_ > 0);
       std::size_t nblocks = blocks.size();
       DIALS_ASSERT(nblocks > 0);
@@ -1775,6 +3498,7 @@ namespace dials { namespace algorithms {
      */
     af::reflection_table data() {
       DIALS_ASSERT(finished());
+      DIALS_ASSERT(!released_);
       return lookup_.data();
     }
 
@@ -1792,6 +3516,27 @@ namespace dials { namespace algorithms {
       return finished_.size();
     }
 
+    /**
+     * @returns Is a job finished
+     */
+    bool job_finished(std::size_t index) const {
+      DIALS_ASSERT(index < finished_.size());
+      return finished_[index];
+    }
+
+    /**
+     * @returns The indices of the jobs which are not finished
+     */
+    af::shared<std::size_t> unfinished_jobs() const {
+      af::shared<std::size_t> result;
+      for (std::size_t i = 0; i < finished_.size(); ++i) {
+        if (!finished_[i]) {
+          result.push_back(i);
+        }
+      }
+      return result;
+    }
+
     /**
      * @returns The block
      */
@@ -1829,12 +3574,29 @@ namespace dials { namespace algorithms {
       return n;
     }
 
+    /**
+     * @returns The rows of the table processed in a job, in the order of the
+     * reflections from split
+     */
+    af::shared<std::size_t> indices(std::size_t index) const {
+      DIALS_ASSERT(index < finished_.size());
+      tiny<int, 2> blocks = job_blocks_[index];
+      DIALS_ASSERT(blocks[0] < blocks[1]);
+      af::shared<std::size_t> result;
+      for (std::size_t block = blocks[0]; block < blocks[1]; ++block) {
+        af::const_ref<std::size_t> temp = lookup_.indices(block);
+        result.insert(result.end(), temp.begin(), temp.end());
+      }
+      return result;
+    }
+
     /**
      * @returns The reflections for a particular block.
      */
     af::reflection_table split(std::size_t index) {
       using namespace af::boost_python::flex_table_suite;
       DIALS_ASSERT(index < finished_.size());
+      DIALS_ASSERT(!released_);
 
       // Get the job range
       tiny<int, 2> frame = job(index);
@@ -1843,13 +3605,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(blocks[0] < blocks[1]);
 
       // Select reflections to process in block
-      af::shared<std::size_t> indices;
-      for (std::size_t block = blocks[0]; block < blocks[1]; ++block) {
-        af::const_ref<std::size_t> temp = lookup_.indices(block);
-        indices.insert(indices.end(), temp.begin(), temp.end());
-      }
-
-      // Select reflections to process in block
+      af::shared<std::size_t> indices = this->indices(index);
       af::reflection_table data =
         select_rows_index(lookup_.data(), indices.const_ref());
 
@@ -1906,6 +3662,7 @@ namespace dials { namespace algorithms {
       using namespace af::boost_python::flex_table_suite;
       DIALS_ASSERT(index < finished_.size());
       DIALS_ASSERT(finished_[index] == false);
+      DIALS_ASSERT(!released_);
 
       // Get the job range
       tiny<int, 2> frame = job(index);
@@ -1914,11 +3671,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(blocks[0] < blocks[1]);
 
       // Select reflections to process in block
-      af::shared<std::size_t> indices;
-      for (std::size_t block = blocks[0]; block < blocks[1]; ++block) {
-        af::const_ref<std::size_t> temp = lookup_.indices(block);
-        indices.insert(indices.end(), temp.begin(), temp.end());
-      }
+      af::shared<std::size_t> indices = this->indices(index);
 
       // Get the total number of reflections to integrate
       std::size_t num_reflections = indices.size();
@@ -1937,11 +3690,32 @@ namespace dials { namespace algorithms {
       finished_[index] = true;
     }
 
+    /**
+     * Mark a job as finished without storing the results. This is used when
+     * the results are written straight to disk.
+     */
+    void skip(std::size_t index) {
+      DIALS_ASSERT(index < finished_.size());
+      DIALS_ASSERT(finished_[index] == false);
+      finished_[index] = true;
+    }
+
+    /**
+     * Free the reflection table once the reflections of every job have been
+     * split out. The jobs and the rows of each job are kept, but the
+     * reflections can no longer be split, accumulated or returned.
+     */
+    void release() {
+      lookup_.release();
+      released_ = true;
+    }
+
   private:
     SimpleReflectionLookup lookup_;
     std::size_t njobs_;
     af::shared<bool> finished_;
     af::shared<tiny<int, 2> > job_blocks_;
+    bool released_;
   };
 
 }}  // namespace dials::algorithms
@@ -1,23 +1,35 @@
 from __future__ import absolute_import, division, print_function
 
+import glob
+import json
 import logging
 import math
+import os
+import shutil
+import struct
+import tempfile
 
 import psutil
 
 from libtbx import Auto
 
 import dials.algorithms.integration
-from dials.algorithms.integration.processor import NullTask, execute_parallel_task
+from dials.algorithms.integration.processor import (
+    BlockPlanner,
+    NullTask,
+    block_plan_summary,
+    execute_parallel_task,
+)
 from dials.array_family import flex
 from dials.util import tabulate
-from dials.util.mp import multi_node_parallel_map
+from dials.util.mp import mpi_parallel_map, multi_node_parallel_map
 
 # Need this import first because loads extension that parallel_integrator_ext
 # relies on - it assumes the binding for EmpiricalProfileModeller exists
 import dials.algorithms.profile_model.modeller  # noqa: F401 # isort: split
 
 from dials_algorithms_integration_parallel_integrator_ext import (
+    BayesianIntensityCalculator,
     GaussianRSIntensityCalculator,
     GaussianRSMaskCalculator,
     GaussianRSMultiCrystalMaskCalculator,
@@ -27,15 +39,18 @@
     GLMBackgroundCalculator,
     Logger,
     MultiThreadedIntegrator,
+    MultiThreadedProfileFitter,
     MultiThreadedReferenceProfiler,
     ReferenceProfileData,
     SimpleBackgroundCalculator,
     SimpleBlockList,
     SimpleReflectionManager,
+    ThreadPool,
 )
 
 __all__ = [
     "BackgroundCalculatorFactory",
+    "BayesianIntensityCalculator",
     "GLMBackgroundCalculator",
     "GaussianRSIntensityCalculator",
     "GaussianRSMaskCalculator",
@@ -50,6 +65,7 @@
     "Logger",
     "MaskCalculatorFactory",
     "MultiThreadedIntegrator",
+    "MultiThreadedProfileFitter",
     "MultiThreadedReferenceProfiler",
     "ReferenceCalculatorFactory",
     "ReferenceCalculatorJob",
@@ -59,6 +75,7 @@
     "SimpleBackgroundCalculator",
     "SimpleBlockList",
     "SimpleReflectionManager",
+    "ThreadPool",
 ]
 
 logger = logging.getLogger(__name__)
@@ -84,10 +101,17 @@ def create(experiments, params=None):
 
             params = phil_scope.extract()
 
+        # Use the bayesian estimate of the summed intensity for very weak data
+        if params.integration.summation.estimator == "bayesian":
+            return BayesianIntensityCalculator()
+
         # Select the factory function
         selection = params.profile.algorithm
         if selection == "gaussian_rs":
-            algorithm = GaussianRSMaskCalculatorFactory.create(experiments)
+            algorithm = GaussianRSMaskCalculatorFactory.create(
+                experiments,
+                pixel_directions=params.integration.pixel_direction_table,
+            )
         else:
             raise RuntimeError("Unknown profile model algorithm")
 
@@ -263,6 +287,7 @@ def create(experiments, params=None):
         if selection == "gaussian_rs":
 
             # Get the parameters
+            pixel_directions = params.integration.pixel_direction_table
             params = params.profile.gaussian_rs.fitting
 
             # Create the algorithm
@@ -271,6 +296,7 @@ def create(experiments, params=None):
                 grid_size=params.grid_size,
                 scan_step=params.scan_step,
                 grid_method=params.grid_method,
+                pixel_directions=pixel_directions,
             )
 
         else:
@@ -308,12 +334,258 @@ def _assert_enough_memory(required_memory, max_memory_usage):
         logger.info("Allocating %.1f MB memory", required_memory / 1e6)
 
 
+class StreamingReflectionWriter(object):
+    """
+    Append the integrated reflections from each job to a single file.
+
+    Each job is written as a length prefixed msgpack reflection table as soon
+    as it finishes, so the jobs are in the order they finished and nothing is
+    held back in memory. The row of each reflection in the table given to the
+    integration manager is saved in the table_row column, so the original
+    order can be restored by StreamedReflections.
+    """
+
+    def __init__(self, filename):
+        """
+        Open the file
+
+        :param filename: The output filename
+        """
+        self.filename = filename
+        self._outfile = open(filename, "wb")
+        self._written = set()
+
+    def write(self, index, reflections, rows):
+        """
+        Write the reflections for a job
+
+        :param index: The job index
+        :param reflections: The integrated reflections from the job
+        :param rows: The row of each reflection in the table
+        """
+        assert index not in self._written, "Job %d already written" % index
+        assert len(rows) == len(reflections)
+        self._written.add(index)
+        if len(reflections) > 0:
+            reflections[StreamedReflections.row_column] = rows
+            data = reflections.as_msgpack()
+            del reflections[StreamedReflections.row_column]
+            self._outfile.write(struct.pack("<Q", len(data)))
+            self._outfile.write(data)
+            self._outfile.flush()
+
+    def close(self):
+        """
+        Close the file
+        """
+        self._outfile.close()
+
+
+class StreamedReflections(object):
+    """
+    Read back a file written by StreamingReflectionWriter. The reflections of
+    each job can be read one job at a time, in the order the jobs finished, or
+    all together in the order of the table given to the integration manager.
+    """
+
+    row_column = "table_row"
+
+    def __init__(self, filename):
+        """
+        :param filename: The filename
+        """
+        self.filename = filename
+
+    def __iter__(self):
+        """
+        Iterate through the reflections of each job. The row of each reflection
+        in the table is in the table_row column.
+        """
+        with open(self.filename, "rb") as infile:
+            while True:
+                header = infile.read(8)
+                if not header:
+                    break
+                assert len(header) == 8, "Truncated streamed reflection file"
+                (size,) = struct.unpack("<Q", header)
+                data = infile.read(size)
+                assert len(data) == size, "Truncated streamed reflection file"
+                yield flex.reflection_table.from_msgpack(data)
+
+    def read(self):
+        """
+        Read all the reflections
+
+        :return: The reflection table in the original row order
+        """
+        result = flex.reflection_table()
+        for reflections in self:
+            result.extend(reflections)
+        if len(result) > 0:
+            result = result.select(flex.sort_permutation(result[self.row_column]))
+            del result[self.row_column]
+        return result
+
+
+class IntegrationCheckpoint(object):
+    """
+    Save the integrated reflections from each job to a directory as the job
+    finishes, so that an interrupted run can be resumed without integrating
+    the finished jobs again.
+
+    Each job is saved as a msgpack reflection table. The table is written to a
+    temporary file which is then renamed, so a job is either saved completely
+    or not at all. The frames and number of reflections of every job are kept
+    in a manifest, and a run can only resume from a checkpoint with the same
+    jobs.
+    """
+
+    manifest_name = "manifest.json"
+
+    def __init__(self, directory, jobs, resume=False):
+        """
+        Open the checkpoint directory
+
+        :param directory: The checkpoint directory
+        :param jobs: The (first frame, last frame, number of reflections) of
+                     each job
+        :param resume: Keep the jobs saved by an earlier run with the same jobs
+        """
+        self.directory = directory
+        self.jobs = [[int(value) for value in job] for job in jobs]
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        manifest = os.path.join(directory, self.manifest_name)
+        if resume and os.path.exists(manifest):
+            with open(manifest) as infile:
+                if json.load(infile) != self.jobs:
+                    raise RuntimeError(
+                        "The checkpoint in %s was made with different jobs" % directory
+                    )
+        else:
+            for filename in glob.glob(os.path.join(directory, "job_*.mpack")):
+                os.remove(filename)
+            with open(manifest, "w") as outfile:
+                json.dump(self.jobs, outfile)
+
+    def filename(self, index):
+        """
+        :param index: The job index
+        :return: The file holding the reflections of a job
+        """
+        first, last, _ = self.jobs[index]
+        return os.path.join(self.directory, "job_%d_%d_%d.mpack" % (index, first, last))
+
+    def saved(self):
+        """
+        :return: The indices of the saved jobs
+        """
+        return [
+            index
+            for index in range(len(self.jobs))
+            if os.path.exists(self.filename(index))
+        ]
+
+    def save(self, index, reflections):
+        """
+        Save the reflections of a job
+
+        :param index: The job index
+        :param reflections: The integrated reflections of the job
+        """
+        assert len(reflections) == self.jobs[index][2]
+        filename = self.filename(index)
+        reflections.as_msgpack_file(filename + ".tmp")
+        os.rename(filename + ".tmp", filename)
+
+    def load(self, index):
+        """
+        Load the reflections of a job
+
+        :param index: The job index
+        :return: The integrated reflections of the job
+        """
+        reflections = flex.reflection_table.from_msgpack_file(self.filename(index))
+        assert len(reflections) == self.jobs[index][2], (
+            "Checkpoint of job %d is inconsistent" % index
+        )
+        return reflections
+
+
+def _spill_filename(spill_directory, index, job):
+    """
+    Get the name of the file holding the shoeboxes kept from a modelling job
+
+    :param spill_directory: The directory holding the shoeboxes
+    :param index: The index of the job
+    :param job: The frames of the job
+    :return: The filename
+    """
+    return os.path.join(
+        spill_directory, "shoeboxes_%d_%d_%d.mpack" % (index, job[0], job[1])
+    )
+
+
+def _log_timing(timing):
+    """
+    Log the per stage timing of a multi threaded integrator
+
+    :param timing: The IntegrationTiming object
+    """
+    total = timing.total if timing.total > 0 else 1.0
+    busy = sum(timing.thread_time)
+    rows = [["Stage", "Time (s)", "% of worker time"]]
+    names = [
+        "Extract",
+        "Mask",
+        "Background",
+        "Centroid",
+        "Summation",
+        "Profile",
+        "Write",
+    ]
+    for name in names:
+        value = getattr(timing, name.lower())
+        rows.append(
+            [name, "%.2f" % value, "%.1f" % (100.0 * value / busy if busy > 0 else 0)]
+        )
+    logger.info("")
+    logger.info(
+        "Timing for %d reflections on %d threads",
+        timing.num_reflections,
+        timing.num_threads,
+    )
+    logger.info(tabulate(rows, headers="firstrow"))
+    logger.info("")
+    rows = [
+        ["Read images (s)", "%.2f" % timing.read],
+        ["Waiting for buffer (s)", "%.2f" % timing.stall],
+        ["Copy to buffer (s)", "%.2f" % timing.copy],
+        ["Total (s)", "%.2f" % timing.total],
+        [
+            "Thread utilisation (%)",
+            "%.1f" % (100.0 * busy / (total * max(timing.num_threads, 1))),
+        ],
+    ]
+    logger.info(tabulate(rows))
+
+
 class IntegrationJob(object):
     """
     A class to represent an integration job
     """
 
-    def __init__(self, index, job, experiments, reflections, reference, params=None):
+    def __init__(
+        self,
+        index,
+        job,
+        experiments,
+        reflections,
+        reference,
+        params=None,
+        spill_directory=None,
+        thread_pool=None,
+    ):
         """
         Initialise the task.
 
@@ -324,6 +596,9 @@ def __init__(self, index, job, experiments, reflections, reference, params=None)
         :param job: The frames to integrate
         :param flatten: Flatten the shoeboxes
         :param executor: The executor class
+        :param spill_directory: The directory holding the shoeboxes kept from
+                                the modelling pass
+        :param thread_pool: A thread pool shared with other jobs
         """
 
         # Get the parameters
@@ -345,6 +620,8 @@ def __init__(self, index, job, experiments, reflections, reference, params=None)
         self.reflections = reflections
         self.reference = reference
         self.params = params
+        self.spill_directory = spill_directory
+        self.thread_pool = thread_pool
 
     def __call__(self):
         """
@@ -382,14 +659,24 @@ def __call__(self):
         except Exception:
             raise RuntimeError("Programmer Error: bad array range")
 
-        # Check the memory requirements
-        _assert_enough_memory(
-            self.compute_required_memory(imageset),
-            self.params.integration.block.max_memory_usage,
-        )
+        # If the shoeboxes were kept from the modelling pass then only the
+        # profile fitting needs to be done
+        spilled = None
+        if self.spill_directory is not None:
+            spilled = _spill_filename(self.spill_directory, self.index, self.job)
+            if not os.path.exists(spilled):
+                spilled = None
 
         # Integrate
-        self.integrate(imageset)
+        if spilled is not None:
+            self.fit(spilled)
+        else:
+            # Check the memory requirements
+            _assert_enough_memory(
+                self.compute_required_memory(imageset),
+                self.params.integration.block.max_memory_usage,
+            )
+            self.integrate(imageset)
 
         # Write some debug files
         self.write_debug_files()
@@ -399,10 +686,10 @@ def __call__(self):
             index=self.index,
             reflections=self.reflections,
             data=None,
-            read_time=0,
-            extract_time=0,
-            process_time=0,
-            total_time=0,
+            read_time=self.timing.read,
+            extract_time=self.timing.extract,
+            process_time=sum(self.timing.thread_time) - self.timing.extract,
+            total_time=self.timing.total,
         )
 
     def compute_required_memory(self, imageset):
@@ -410,7 +697,10 @@ def compute_required_memory(self, imageset):
         Compute the required memory
         """
         return MultiThreadedIntegrator.compute_required_memory(
-            imageset, self.params.integration.block.size
+            imageset,
+            self.params.integration.block.size,
+            compact=self.params.integration.block.compact_buffer
+            or self.params.integration.block.compress_buffer,
         )
 
     def integrate(self, imageset):
@@ -487,11 +777,69 @@ def integrate(self, imageset):
             buffer_size=self.params.integration.block.size,
             use_dynamic_mask=self.params.integration.use_dynamic_mask,
             debug=self.params.integration.debug.output,
+            read_ahead=self.params.integration.block.read_ahead,
+            read_threads=self.params.integration.block.read_threads,
+            compact_buffer=self.params.integration.block.compact_buffer,
+            compress_buffer=self.params.integration.block.compress_buffer,
+            batch_size=self.params.integration.block.batch_size,
+            thread_pool=self.thread_pool,
         )
 
         # Assign the reflections
         self.reflections = integrator.reflections()
 
+        # Log the time spent in each stage
+        self.timing = integrator.timing()
+        _log_timing(self.timing)
+
+    def fit(self, filename):
+        """
+        Profile fit the reflections using the shoeboxes, masks and backgrounds
+        kept from the modelling pass.
+
+        :param filename: The file holding the shoeboxes
+        """
+        reflections = flex.reflection_table.from_msgpack_file(filename)
+        os.remove(filename)
+        assert len(reflections) == len(
+            self.reflections
+        ), "Kept shoeboxes do not match the job"
+        assert "shoebox" in reflections, "Kept reflections have no shoeboxes"
+
+        logger.info(" Beginning integration job %d" % self.index)
+        logger.info("")
+        logger.info(" Frames: %d -> %d" % tuple(self.job))
+        logger.info("")
+        logger.info(
+            " Reusing %d shoeboxes from the modelling pass" % len(reflections)
+        )
+        logger.info("")
+
+        # The partiality was computed for the same predictions in the modelling
+        # pass so it only needs computing if it wasn't kept
+        if "partiality" not in reflections:
+            reflections.compute_partiality(self.experiments)
+
+        # Construct the intensity algorithm
+        compute_intensity = IntensityCalculatorFactory.create(
+            self.experiments, self.reference, self.params
+        )
+
+        # Call the multi threaded profile fitter
+        fitter = MultiThreadedProfileFitter(
+            reflections=reflections,
+            compute_intensity=compute_intensity,
+            nthreads=self.params.integration.mp.nproc,
+            thread_pool=self.thread_pool,
+        )
+
+        # Assign the reflections
+        self.reflections = fitter.reflections()
+
+        # Log the time spent in each stage
+        self.timing = fitter.timing()
+        _log_timing(self.timing)
+
     def write_debug_files(self):
         """
         Write some debug output
@@ -521,7 +869,15 @@ class IntegrationManager(object):
     A class to manage processing book-keeping
     """
 
-    def __init__(self, experiments, reflections, reference, params):
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        reference,
+        params,
+        spill_directory=None,
+        thread_pool=None,
+    ):
         """
         Initialise the manager.
 
@@ -529,12 +885,17 @@ def __init__(self, experiments, reflections, reference, params):
         :param reflections: The list of reflections
         :param reference: The reference profiles
         :param params: The phil parameters
+        :param spill_directory: The directory holding the shoeboxes kept from
+                                the modelling pass
+        :param thread_pool: A thread pool shared with other jobs
         """
 
         # Save some data
         self.experiments = experiments
         self.reflections = reflections
         self.reference = reference
+        self.spill_directory = spill_directory
+        self.thread_pool = thread_pool
 
         # Save some parameters
         self.params = params
@@ -554,18 +915,60 @@ def initialize(self):
         # Ensure the reflections contain bounding boxes
         assert "bbox" in self.reflections, "Reflections have no bbox"
 
-        # Compute the block size and jobs
+        # Compute the block size and jobs. The reflections longer than a block
+        # are split first so the block planner only places the rest.
         self.compute_blocks()
-        self.compute_jobs()
         self.reflections = split_partials_over_boundaries(
             self.reflections, self.params.integration.block.size
         )
+        self.compute_jobs()
 
         # Create the reflection manager
         self.manager = SimpleReflectionManager(
             self.blocks, self.reflections, self.params.integration.mp.njobs
         )
 
+        # Optionally write the results to disk as each job finishes. The input
+        # reflections of each job are then kept on disk until the job has been
+        # written, so the manager does not hold the whole table.
+        block = self.params.integration.block
+        if block.stream_output:
+            self.writer = StreamingReflectionWriter(block.stream_output)
+            self.job_directory = tempfile.mkdtemp(
+                prefix="dials_jobs_",
+                dir=os.path.dirname(os.path.abspath(block.stream_output)),
+            )
+            for index in range(len(self.manager)):
+                self.manager.split(index).as_msgpack_file(self._job_filename(index))
+            self.manager.release()
+            self.reflections = None
+        else:
+            self.writer = None
+            self.job_directory = None
+
+        # Optionally save the results of each job as it finishes, and reload
+        # the jobs saved by an interrupted run
+        if block.checkpoint:
+            self.checkpoint = IntegrationCheckpoint(
+                block.checkpoint,
+                [
+                    tuple(self.manager.job(i)) + (self.manager.num_reflections(i),)
+                    for i in range(len(self.manager))
+                ],
+                resume=block.resume,
+            )
+            saved = self.checkpoint.saved()
+            for index in saved:
+                self._store(index, self.checkpoint.load(index))
+            if saved:
+                logger.info(
+                    " Resumed %d of %d jobs from checkpoint\n",
+                    len(saved),
+                    len(self.manager),
+                )
+        else:
+            self.checkpoint = None
+
         # Parallel reading of HDF5 from the same handle is not allowed. Python
         # multiprocessing is a bit messed up and used fork on linux so need to
         # close and reopen file.
@@ -578,7 +981,12 @@ def task(self, index):
         frames = self.manager.job(index)
         experiments = self.experiments
         reference = self.reference
-        reflections = self.manager.split(index)
+        if self.job_directory is not None:
+            reflections = flex.reflection_table.from_msgpack_file(
+                self._job_filename(index)
+            )
+        else:
+            reflections = self.manager.split(index)
         if len(reflections) == 0:
             logger.warning("No reflections in job %d ***", index)
             task = NullTask(index=index, reflections=reflections)
@@ -590,24 +998,57 @@ def task(self, index):
                 reflections=reflections,
                 reference=reference,
                 params=self.params,
+                spill_directory=self.spill_directory,
+                thread_pool=self.thread_pool,
             )
         return task
 
     def tasks(self):
         """
-        Iterate through the tasks.
+        Iterate through the tasks which have not finished.
         """
-        for i in range(len(self)):
+        for i in self.manager.unfinished_jobs():
             yield self.task(i)
 
     def accumulate(self, result):
         """Accumulate the results."""
-        self.manager.accumulate(result.index, result.reflections)
+        if self.checkpoint is not None:
+            num_reflections = self.manager.num_reflections(result.index)
+            reflections = result.reflections[:num_reflections]
+            self.checkpoint.save(result.index, reflections)
+            self._store(result.index, reflections)
+        else:
+            self._store(result.index, result.reflections)
         # self.time.read += result.read_time
         # self.time.extract += result.extract_time
         # self.time.process += result.process_time
         # self.time.total += result.total_time
 
+    def _store(self, index, reflections):
+        """
+        Store the integrated reflections of a job
+
+        :param index: The job index
+        :param reflections: The reflections, of which the first rows are the
+                            reflections integrated in the job
+        """
+        if self.writer is not None:
+            num_reflections = self.manager.num_reflections(index)
+            self.writer.write(
+                index, reflections[:num_reflections], self.manager.indices(index)
+            )
+            self.manager.skip(index)
+            os.remove(self._job_filename(index))
+        else:
+            self.manager.accumulate(index, reflections)
+
+    def _job_filename(self, index):
+        """
+        :param index: The job index
+        :return: The file holding the input reflections of a job
+        """
+        return os.path.join(self.job_directory, "job_%d.mpack" % index)
+
     def finalize(self):
         """
         Finalize the processing and finish.
@@ -615,15 +1056,23 @@ def finalize(self):
         # Check manager is finished
         assert self.manager.finished(), "Manager is not finished"
 
+        # Close the output file
+        if self.writer is not None:
+            self.writer.close()
+            shutil.rmtree(self.job_directory, ignore_errors=True)
+
         self.finalized = True
 
     def result(self):
         """
         Return the result.
 
-        :return: The result
+        :return: The reflection table, or with streamed output a reader for the
+                 file holding the reflections
         """
         assert self.finalized, "Manager is not finalized"
+        if self.writer is not None:
+            return StreamedReflections(self.writer.filename)
         return self.manager.data()
 
     def finished(self):
@@ -652,7 +1101,10 @@ def compute_max_block_size(self):
         assert max_memory_usage <= 1.0, "maximum memory usage must be <= 1"
         limit_memory = int(math.floor(total_memory * max_memory_usage))
         return MultiThreadedIntegrator.compute_max_block_size(
-            self.experiments[0].imageset, max_memory_usage=limit_memory
+            self.experiments[0].imageset,
+            max_memory_usage=limit_memory,
+            compact=self.params.integration.block.compact_buffer
+            or self.params.integration.block.compress_buffer,
         )
 
     def compute_blocks(self):
@@ -661,6 +1113,7 @@ def compute_blocks(self):
         """
         block = self.params.integration.block
         max_block_size = self.compute_max_block_size()
+        self.max_block_size = max_block_size
         if block.size in [Auto, "auto", "Auto"]:
             assert block.threshold > 0, "Threshold must be > 0"
             assert block.threshold <= 1.0, "Threshold must be < 1"
@@ -710,7 +1163,14 @@ def compute_jobs(self):
         block = self.params.integration.block
         assert block.units == "frames"
         assert block.size > 0
-        self.blocks = SimpleBlockList(array_range, block.size)
+        if block.adaptive:
+            planner = BlockPlanner(
+                array_range, self.reflections["bbox"], block.size, self.max_block_size
+            )
+            logger.info(block_plan_summary(planner))
+            self.blocks = SimpleBlockList(planner.blocks())
+        else:
+            self.blocks = SimpleBlockList(array_range, block.size)
         assert len(self.blocks) > 0, "Invalid number of jobs"
 
     def summary(self):
@@ -770,7 +1230,16 @@ class ReferenceCalculatorJob(object):
     A class to represent an integration job
     """
 
-    def __init__(self, index, job, experiments, reflections, params=None):
+    def __init__(
+        self,
+        index,
+        job,
+        experiments,
+        reflections,
+        params=None,
+        spill_directory=None,
+        thread_pool=None,
+    ):
         """
         Initialise the task.
 
@@ -781,6 +1250,9 @@ def __init__(self, index, job, experiments, reflections, params=None):
         :param job: The frames to integrate
         :param flatten: Flatten the shoeboxes
         :param executor: The executor class
+        :param spill_directory: The directory to keep the shoeboxes in for the
+                                integration pass
+        :param thread_pool: A thread pool shared with other jobs
         """
 
         # Get the parameters
@@ -801,6 +1273,8 @@ def __init__(self, index, job, experiments, reflections, params=None):
         self.experiments = experiments
         self.reflections = reflections
         self.params = params
+        self.spill_directory = spill_directory
+        self.thread_pool = thread_pool
 
     def __call__(self):
         """
@@ -847,6 +1321,12 @@ def __call__(self):
         # Integrate
         self.compute_reference_profiles(imageset)
 
+        # Keep the shoeboxes for the integration pass
+        if self.spill_directory is not None:
+            self.reflections.as_msgpack_file(
+                _spill_filename(self.spill_directory, self.index, self.job)
+            )
+
         # Write some debug files
         self.write_debug_files()
 
@@ -855,15 +1335,18 @@ def __call__(self):
             index=self.index,
             reflections=self.reflections,
             data=self.reference,
-            read_time=0,
-            extract_time=0,
-            process_time=0,
-            total_time=0,
+            read_time=self.timing.read,
+            extract_time=self.timing.extract,
+            process_time=sum(self.timing.thread_time) - self.timing.extract,
+            total_time=self.timing.total,
         )
 
     def compute_required_memory(self, imageset):
         return MultiThreadedIntegrator.compute_required_memory(
-            imageset, self.params.integration.block.size
+            imageset,
+            self.params.integration.block.size,
+            compact=self.params.integration.block.compact_buffer
+            or self.params.integration.block.compress_buffer,
         )
 
     def compute_reference_profiles(self, imageset):
@@ -939,12 +1422,24 @@ def compute_reference_profiles(self, imageset):
             nthreads=self.params.integration.mp.nproc,
             buffer_size=self.params.integration.block.size,
             use_dynamic_mask=self.params.integration.use_dynamic_mask,
-            debug=self.params.integration.debug.output,
+            debug=(
+                self.params.integration.debug.output
+                or self.spill_directory is not None
+            ),
+            read_ahead=self.params.integration.block.read_ahead,
+            read_threads=self.params.integration.block.read_threads,
+            compact_buffer=self.params.integration.block.compact_buffer,
+            compress_buffer=self.params.integration.block.compress_buffer,
+            thread_pool=self.thread_pool,
         )
 
         # Assign the reflections
         self.reflections = reference_calculator.reflections()
 
+        # Log the time spent in each stage
+        self.timing = reference_calculator.timing()
+        _log_timing(self.timing)
+
         # Assign the reference profiles
         self.reference = compute_reference
 
@@ -990,19 +1485,26 @@ class ReferenceCalculatorManager(object):
     A class to manage processing book-keeping
     """
 
-    def __init__(self, experiments, reflections, params):
+    def __init__(
+        self, experiments, reflections, params, spill_directory=None, thread_pool=None
+    ):
         """
         Initialise the manager.
 
         :param experiments: The list of experiments
         :param reflections: The list of reflections
         :param params: The phil parameters
+        :param spill_directory: The directory to keep the shoeboxes in for the
+                                integration pass
+        :param thread_pool: A thread pool shared with other jobs
         """
 
         # Save some data
         self.experiments = experiments
         self.reflections = reflections
         self.reference = None
+        self.spill_directory = spill_directory
+        self.thread_pool = thread_pool
 
         # Save some parameters
         self.params = params
@@ -1022,18 +1524,22 @@ def initialize(self):
         # Ensure the reflections contain bounding boxes
         assert "bbox" in self.reflections, "Reflections have no bbox"
 
-        # Select only those reflections used in refinement
+        # Select only those reflections used in refinement. If the shoeboxes
+        # are being kept for the integration pass then all the reflections are
+        # processed and only the reference spots are used in modelling.
         selection = self.reflections.get_flags(self.reflections.flags.reference_spot)
         if selection.count(True) == 0:
             raise RuntimeError("No reference reflections given")
-        self.reflections = self.reflections.select(selection)
+        if self.spill_directory is None:
+            self.reflections = self.reflections.select(selection)
 
-        # Compute the block size and jobs
+        # Compute the block size and jobs. The reflections longer than a block
+        # are split first so the block planner only places the rest.
         self.compute_blocks()
-        self.compute_jobs()
         self.reflections = split_partials_over_boundaries(
             self.reflections, self.params.integration.block.size
         )
+        self.compute_jobs()
 
         # Create the reflection manager
         self.manager = SimpleReflectionManager(
@@ -1062,6 +1568,8 @@ def task(self, index):
                 experiments=experiments,
                 reflections=reflections,
                 params=self.params,
+                spill_directory=self.spill_directory,
+                thread_pool=self.thread_pool,
             )
         return task
 
@@ -1128,7 +1636,10 @@ def compute_max_block_size(self):
         assert max_memory_usage <= 1.0, "maximum memory usage must be <= 1"
         limit_memory = int(math.floor(total_memory * max_memory_usage))
         return MultiThreadedReferenceProfiler.compute_max_block_size(
-            self.experiments[0].imageset, max_memory_usage=limit_memory
+            self.experiments[0].imageset,
+            max_memory_usage=limit_memory,
+            compact=self.params.integration.block.compact_buffer
+            or self.params.integration.block.compress_buffer,
         )
 
     def compute_blocks(self):
@@ -1137,6 +1648,7 @@ def compute_blocks(self):
         """
         block = self.params.integration.block
         max_block_size = self.compute_max_block_size()
+        self.max_block_size = max_block_size
         if block.size in [Auto, "auto", "Auto"]:
             assert block.threshold > 0, "Threshold must be > 0"
             assert block.threshold <= 1.0, "Threshold must be < 1"
@@ -1183,7 +1695,14 @@ def compute_jobs(self):
         block = self.params.integration.block
         assert block.units == "frames"
         assert block.size > 0
-        self.blocks = SimpleBlockList(array_range, block.size)
+        if block.adaptive:
+            planner = BlockPlanner(
+                array_range, self.reflections["bbox"], block.size, self.max_block_size
+            )
+            logger.info(block_plan_summary(planner))
+            self.blocks = SimpleBlockList(planner.blocks())
+        else:
+            self.blocks = SimpleBlockList(array_range, block.size)
         assert len(self.blocks) > 0, "Invalid number of jobs"
 
     def summary(self):
@@ -1238,57 +1757,96 @@ def summary(self):
         return fmt % (block_size, self.params.integration.block.units, task_table)
 
 
-def compute_required_memory(imageset, block_size):
+def compute_required_memory(imageset, block_size, compact=False):
     """
     Compute the required memory
 
     """
-    return MultiThreadedIntegrator.compute_required_memory(imageset, block_size)
-
+    return MultiThreadedIntegrator.compute_required_memory(
+        imageset, block_size, compact=compact
+    )
 
-class ReferenceCalculatorProcessor(object):
-    def __init__(self, experiments, reflections, params=None):
-        from dials.util import pprint
-
-        # Create the reference manager
-        reference_manager = ReferenceCalculatorManager(experiments, reflections, params)
 
-        # Print some output
-        logger.info(reference_manager.summary())
+def _process_tasks(manager, experiments, params):
+    """
+    Run the tasks of a manager and accumulate the results. The tasks are run
+    in this process, as cluster jobs or, with MPI, on the other ranks. With MPI
+    the results are gathered on rank 0 in the order the tasks finish.
 
-        # Execute each task
-        if params.integration.mp.njobs > 1:
-
-            if params.integration.mp.method == "multiprocessing":
-                _assert_enough_memory(
-                    params.integration.mp.njobs
-                    * compute_required_memory(
-                        experiments[0].imageset, params.integration.block.size
-                    ),
-                    params.integration.block.max_memory_usage,
-                )
+    :param manager: The reference calculator or integration manager
+    :param experiments: The list of experiments
+    :param params: The phil parameters
+    """
+    mp = params.integration.mp
+    if mp.method == "mpi" or mp.njobs > 1:
+
+        if mp.method == "multiprocessing":
+            _assert_enough_memory(
+                mp.njobs
+                * compute_required_memory(
+                    experiments[0].imageset,
+                    params.integration.block.size,
+                    compact=params.integration.block.compact_buffer
+                    or params.integration.block.compress_buffer,
+                ),
+                params.integration.block.max_memory_usage,
+            )
 
-            def process_output(result):
-                for message in result[1]:
-                    logger.log(message.levelno, message.msg)
-                reference_manager.accumulate(result[0])
-                result[0].reflections = None
-                result[0].data = None
+        def process_output(result):
+            for message in result[1]:
+                logger.log(message.levelno, message.msg)
+            manager.accumulate(result[0])
+            result[0].reflections = None
+            result[0].data = None
 
+        if mp.method == "mpi":
+            mpi_parallel_map(
+                func=execute_parallel_task,
+                iterable=manager.tasks(),
+                callback=process_output,
+            )
+        else:
             multi_node_parallel_map(
                 func=execute_parallel_task,
-                iterable=reference_manager.tasks(),
-                nproc=params.integration.mp.nproc,
-                njobs=params.integration.mp.njobs,
+                iterable=manager.tasks(),
+                nproc=mp.nproc,
+                njobs=mp.njobs,
                 callback=process_output,
-                cluster_method=params.integration.mp.method,
+                cluster_method=mp.method,
                 preserve_order=True,
                 preserve_exception_message=True,
             )
-        else:
-            for task in reference_manager.tasks():
-                result = task()
-                reference_manager.accumulate(result)
+    else:
+        for task in manager.tasks():
+            result = task()
+            manager.accumulate(result)
+
+
+class ReferenceCalculatorProcessor(object):
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        params=None,
+        spill_directory=None,
+        thread_pool=None,
+    ):
+        from dials.util import pprint
+
+        # Create the reference manager
+        reference_manager = ReferenceCalculatorManager(
+            experiments,
+            reflections,
+            params,
+            spill_directory=spill_directory,
+            thread_pool=thread_pool,
+        )
+
+        # Print some output
+        logger.info(reference_manager.summary())
+
+        # Execute each task
+        _process_tasks(reference_manager, experiments, params)
 
         # Finalize the processing
         reference_manager.finalize()
@@ -1326,49 +1884,31 @@ def profiles(self):
 
 
 class IntegratorProcessor(object):
-    def __init__(self, experiments, reflections, reference=None, params=None):
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        reference=None,
+        params=None,
+        spill_directory=None,
+        thread_pool=None,
+    ):
 
         # Create the reference manager
         integration_manager = IntegrationManager(
-            experiments, reflections, reference, params
+            experiments,
+            reflections,
+            reference,
+            params,
+            spill_directory=spill_directory,
+            thread_pool=thread_pool,
         )
 
         # Print some output
         logger.info(integration_manager.summary())
 
         # Execute each task
-        if params.integration.mp.njobs > 1:
-
-            if params.integration.mp.method == "multiprocessing":
-                _assert_enough_memory(
-                    params.integration.mp.njobs
-                    * compute_required_memory(
-                        experiments[0].imageset, params.integration.block.size
-                    ),
-                    params.integration.block.max_memory_usage,
-                )
-
-            def process_output(result):
-                for message in result[1]:
-                    logger.log(message.levelno, message.msg)
-                integration_manager.accumulate(result[0])
-                result[0].reflections = None
-                result[0].data = None
-
-            multi_node_parallel_map(
-                func=execute_parallel_task,
-                iterable=integration_manager.tasks(),
-                nproc=params.integration.mp.nproc,
-                njobs=params.integration.mp.njobs,
-                callback=process_output,
-                cluster_method=params.integration.mp.method,
-                preserve_order=True,
-                preserve_exception_message=True,
-            )
-        else:
-            for task in integration_manager.tasks():
-                result = task()
-                integration_manager.accumulate(result)
+        _process_tasks(integration_manager, experiments, params)
 
         # Finalize the processing
         integration_manager.finalize()
@@ -1377,6 +1917,8 @@ def process_output(result):
         self._reflections = integration_manager.result()
 
     def reflections(self):
+        if isinstance(self._reflections, StreamedReflections):
+            return self._reflections.read()
         return self._reflections
 
 
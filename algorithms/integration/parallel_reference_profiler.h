@@ -20,6 +20,7 @@
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/error.h>
+#include <dials/util/shared_executor.h>
 #include <dials/util/thread_pool.h>
 #include <dials/algorithms/shoebox/find_overlapping.h>
 #include <dials/algorithms/integration/parallel_integrator.h>
@@ -29,6 +30,9 @@
 #include <map>
 
 #include <dials/algorithms/integration/interfaces.h>
+#include <dials/algorithms/integration/reflection_columns.h>
+#include <dials/algorithms/integration/integration_timer.h>
+#include <dials/algorithms/integration/shoebox_pool.h>
 
 namespace dials { namespace algorithms {
 
@@ -59,6 +63,9 @@ namespace dials { namespace algorithms {
      * @param zstart The first image index
      * @param underload The underload value
      * @param overload The overload value
+     * @param debug Keep the shoeboxes
+     * @param timer The timer to accumulate the time in each stage
+     * @param shoebox_pool The pool to allocate the shoebox arrays from
      */
     ReflectionReferenceProfiler(const MaskCalculatorIface &compute_mask,
                                 const BackgroundCalculatorIface &compute_background,
@@ -67,7 +74,9 @@ namespace dials { namespace algorithms {
                                 int zstart,
                                 double underload,
                                 double overload,
-                                bool debug)
+                                bool debug,
+                                IntegrationTimer &timer,
+                                ShoeboxPool &shoebox_pool)
         : compute_mask_(compute_mask),
           compute_background_(compute_background),
           compute_reference_(compute_reference),
@@ -75,7 +84,9 @@ namespace dials { namespace algorithms {
           zstart_(zstart),
           underload_(underload),
           overload_(overload),
-          debug_(debug) {}
+          debug_(debug),
+          timer_(timer),
+          shoebox_pool_(shoebox_pool) {}
 
     /**
      * Integrate a reflection using the following procedure:
@@ -87,23 +98,35 @@ namespace dials { namespace algorithms {
      * 5. Compute the reflection centroid
      * 6. Compute the summed intensity
      * 7. Compute the profile fitted intensity
-     * 8. Delete the shoebox unless debuf has been set
+     * 8. Return the shoebox arrays to the pool unless debug has been set
      *
-     * @param reflection The reflection object
-     * @param adjacent_reflections The list of adjacent reflections
+     * The results are written directly into the rows of the column view. Each
+     * row is only written by the thread processing it so no lock is needed.
+     *
+     * @param index The reflection index
+     * @param columns The reflection column view
+     * @param adjacency_list The adjacency list
      */
     void operator()(std::size_t index,
-                    af::ref<af::Reflection> reflection_list,
+                    ReflectionColumns &columns,
                     const AdjacencyList &adjacency_list) const {
+      IntegrationTimer::StageClock clock(timer_.local());
+
+      // Borrow the shoebox arrays from the pool. The lease must outlive every
+      // copy of the shoebox made below so that the arrays can be reused.
+      ShoeboxPool::Lease lease(
+        shoebox_pool_.local(), columns.panel(index), columns.bbox(index));
       af::Reflection reflection;
       std::vector<af::Reflection> adjacent_reflections;
 
       // Get the reflection data
-      get_reflection(
-        index, reflection_list, adjacency_list, reflection, adjacent_reflections);
+      get_reflection(index, columns, adjacency_list, reflection, adjacent_reflections);
 
       // Extract the shoebox data
-      extract_shoebox(buffer_, reflection, zstart_, underload_, overload_);
+      Shoebox<> &shoebox = lease.shoebox();
+      extract_shoebox(buffer_, shoebox, zstart_, underload_, overload_);
+      reflection["shoebox"] = shoebox;
+      clock.lap(IntegrationTiming::Extract);
 
       // Compute the mask
       compute_mask_(reflection);
@@ -111,24 +134,30 @@ namespace dials { namespace algorithms {
       // Set all the bounding boxes of adjacent reflections
       // And compute the mask for these reflections too.
       for (std::size_t i = 0; i < adjacent_reflections.size(); ++i) {
-        adjacent_reflections[i]["bbox"] = reflection.get<int6>("bbox");
-        adjacent_reflections[i]["shoebox"] = reflection.get<Shoebox<> >("shoebox");
+        adjacent_reflections[i]["bbox"] = shoebox.bbox;
+        adjacent_reflections[i]["shoebox"] = shoebox;
         compute_mask_(adjacent_reflections[i], true);
       }
+      clock.lap(IntegrationTiming::Mask);
 
       // Compute the background
       try {
         compute_background_(reflection);
       } catch (dials::error) {
-        finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+        clock.lap(IntegrationTiming::Background);
         return;
       }
+      clock.lap(IntegrationTiming::Background);
 
       // Compute the centroid
-      compute_centroid(reflection);
+      columns.set_centroid(index, shoebox.centroid_foreground_minus_background());
+      clock.lap(IntegrationTiming::Centroid);
 
       // Compute the summed intensity
-      compute_summed_intensity(reflection);
+      std::size_t flags = compute_summed_intensity(
+        index, columns, shoebox, reflection.get<std::size_t>("flags"));
+      reflection["flags"] = flags;
+      clock.lap(IntegrationTiming::Summation);
 
       // Compute the profile fitted intensity
       try {
@@ -136,89 +165,73 @@ namespace dials { namespace algorithms {
       } catch (dials::error) {
         // pass
       }
-
-      // Erase the shoebox
-      finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
-
-      // Set the reflection data
-      set_reflection(index, reflection_list, reflection);
+      clock.lap(IntegrationTiming::Profile);
+
+      // Inspect the pixels and set the reflection data
+      reflection["flags"] = inspect_pixels(index,
+                                           columns,
+                                           shoebox,
+                                           reflection.get<std::size_t>("flags"),
+                                           underload_,
+                                           overload_);
+      columns.set_row(index, reflection);
+
+      // Keep the shoebox if debug has been set
+      if (debug_) {
+        columns.set_shoebox(index, shoebox);
+      }
+      clock.lap(IntegrationTiming::Write);
     }
 
   protected:
     /**
-     * Get the reflection data in a thread safe manner
+     * Get the reflection data. The rows are read straight from the typed
+     * columns. Adjacent reflections only read columns which are never written
+     * during integration, so this is safe while other threads are running.
      * @param index The reflection index
-     * @param reflection_list The reflection list
+     * @param columns The reflection column view
      * @param adjacency_list The adjacency list
      * @param reflection The reflection data
      * @param adjacent_reflections The adjacent reflections
      */
     void get_reflection(std::size_t index,
-                        const af::const_ref<af::Reflection> &reflection_list,
+                        const ReflectionColumns &columns,
                         const AdjacencyList &adjacency_list,
                         af::Reflection &reflection,
                         std::vector<af::Reflection> &adjacent_reflections) const {
-      DIALS_ASSERT(index < reflection_list.size());
-
-      // Get the lock
-      boost::lock_guard<boost::mutex> guard(mutex_);
+      DIALS_ASSERT(index < columns.size());
 
       // Get the reflection
-      reflection = reflection_list[index];
+      reflection = columns.row(index);
 
       // Get the adjacent reflections
-      adjacent_reflections.reserve(adjacency_list.vertex_num_edges(index));
-      AdjacencyList::edge_iterator_range edges = adjacency_list.edges(index);
-      for (AdjacencyList::edge_iterator it = edges.first; it != edges.second; ++it) {
-        DIALS_ASSERT(it->first == index);
-        DIALS_ASSERT(it->second < reflection_list.size());
-        adjacent_reflections.push_back(reflection_list[it->second]);
+      AdjacencyList::adjacent_vertex_iterator_range adjacent =
+        adjacency_list.adjacent_vertices(index);
+      adjacent_reflections.reserve(adjacent.second - adjacent.first);
+      for (AdjacencyList::adjacent_vertex_iterator it = adjacent.first;
+           it != adjacent.second;
+           ++it) {
+        DIALS_ASSERT(*it < columns.size());
+        adjacent_reflections.push_back(columns.adjacent_row(*it));
       }
     }
 
-    /**
-     * Set the reflection data in a thread safe way
-     * @param index The reflection index
-     * @param reflection_list The reflection list
-     * @param reflection The reflection data
-     */
-    void set_reflection(std::size_t index,
-                        af::ref<af::Reflection> reflection_list,
-                        const af::Reflection &reflection) const {
-      DIALS_ASSERT(index < reflection_list.size());
-      boost::lock_guard<boost::mutex> guard(mutex_);
-      reflection_list[index] = reflection;
-    }
-
-    /**
-     * Before exiting do some stuff on the shoebox
-     * @param reflection The reflection
-     * @param adjacent_reflections The adjancent reflections
-     */
-    void finalize_shoebox(af::Reflection &reflection,
-                          std::vector<af::Reflection> &adjacent_reflections,
-                          double underload,
-                          double overload) const {
-      // Inspect the pixels
-      inspect_pixels(reflection, underload, overload);
-
-      // Delete the shoebox
-      delete_shoebox(reflection, adjacent_reflections);
-    }
-
     /**
      * Inspect the pixel and mask values
-     * @param reflection The reflection
+     * @param index The reflection index
+     * @param columns The reflection column view
+     * @param sbox The shoebox
+     * @param flags The reflection flags
+     * @returns The updated flags
      */
-    void inspect_pixels(af::Reflection &reflection,
-                        double underload,
-                        double overload) const {
+    std::size_t inspect_pixels(std::size_t index,
+                               ReflectionColumns &columns,
+                               const Shoebox<> &sbox,
+                               std::size_t flags,
+                               double underload,
+                               double overload) const {
       typedef Shoebox<>::float_type float_type;
 
-      // Get the shoebox
-      Shoebox<> &sbox = reflection.get<Shoebox<> >("shoebox");
-      std::size_t flags = reflection.get<std::size_t>("flags");
-
       // Get the pixel data
       af::const_ref<float_type, af::c_grid<3> > data = sbox.data.const_ref();
       af::const_ref<int, af::c_grid<3> > mask = sbox.mask.const_ref();
@@ -275,42 +288,24 @@ namespace dials { namespace algorithms {
       }
 
       // Set some information in the reflection
-      reflection["num_pixels.valid"] = (int)n_valid;
-      reflection["num_pixels.background"] = (int)n_background;
-      reflection["num_pixels.background_used"] = (int)n_background_used;
-      reflection["num_pixels.foreground"] = (int)n_foreground;
-      reflection["flags"] = flags;
-    }
-
-    /**
-     * Delete the shoebox
-     * @param reflection The reflection
-     * @param adjacent_reflections The adjancent reflections
-     */
-    void delete_shoebox(af::Reflection &reflection,
-                        std::vector<af::Reflection> &adjacent_reflections) const {
-      // Erase the shoebox from the reflection
-      if (!debug_) {
-        reflection.erase("shoebox");
-        for (std::size_t i = 0; i < adjacent_reflections.size(); ++i) {
-          adjacent_reflections[i].erase("shoebox");
-        }
-      }
+      columns.set_num_pixels(index,
+                             (int)n_valid,
+                             (int)n_background,
+                             (int)n_background_used,
+                             (int)n_foreground);
+      return flags;
     }
 
     /**
      * Extract the shoebox data from the buffer
      */
     void extract_shoebox(const Buffer &buffer,
-                         af::Reflection &reflection,
+                         Shoebox<> &shoebox,
                          int zstart,
                          double underload,
                          double overload) const {
-      typedef af::const_ref<Buffer::float_type, af::c_grid<2> > data_buffer_type;
-      std::size_t panel = reflection.get<std::size_t>("panel");
-      int6 bbox = reflection.get<int6>("bbox");
-      Shoebox<> shoebox(panel, bbox);
-      shoebox.allocate();
+      std::size_t panel = shoebox.panel;
+      const int6 &bbox = shoebox.bbox;
       af::ref<float, af::c_grid<3> > data = shoebox.data.ref();
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int x0 = bbox[0];
@@ -334,7 +329,7 @@ namespace dials { namespace algorithms {
         if (kk < 0 || kk >= buffer.num_images()) {
           continue;
         }
-        data_buffer_type data_buffer = buffer.data(panel, kk);
+        BufferFrame data_buffer = buffer.frame(panel, kk);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
             int jj = y0 + j;
@@ -352,44 +347,27 @@ namespace dials { namespace algorithms {
           }
         }
       }
-      reflection["shoebox"] = shoebox;
-    }
-
-    /**
-     * Compute the centroid
-     */
-    void compute_centroid(af::Reflection &reflection) const {
-      using dials::model::Centroid;
-
-      // Get the shoebox and compute centroid
-      Shoebox<> shoebox = reflection.get<Shoebox<> >("shoebox");
-      Centroid centroid = shoebox.centroid_foreground_minus_background();
-
-      // Set the centroid values
-      reflection["xyzobs.px.value"] = centroid.px.position;
-      reflection["xyzobs.px.variance"] = centroid.px.variance;
     }
 
     /**
      * Compute the summed intensity
+     * @returns The updated flags
      */
-    void compute_summed_intensity(af::Reflection &reflection) const {
+    std::size_t compute_summed_intensity(std::size_t index,
+                                         ReflectionColumns &columns,
+                                         const Shoebox<> &shoebox,
+                                         std::size_t flags) const {
       using dials::model::Intensity;
 
-      // Get flags and reset
-      std::size_t flags = reflection.get<std::size_t>("flags");
+      // Reset the flags
       flags &= ~af::IntegratedSum;
       flags &= ~af::FailedDuringSummation;
 
-      // Get the shoebox and compute the summed intensity
-      Shoebox<> shoebox = reflection.get<Shoebox<> >("shoebox");
+      // Compute the summed intensity
       Intensity intensity = shoebox.summed_intensity();
 
       // Set the intensities
-      reflection["intensity.sum.value"] = intensity.observed.value;
-      reflection["intensity.sum.variance"] = intensity.observed.variance;
-      reflection["background.sum.value"] = intensity.background.value;
-      reflection["background.sum.variance"] = intensity.background.variance;
+      columns.set_summed_intensity(index, intensity);
 
       // Set the appropriate flag
       if (intensity.observed.success) {
@@ -397,7 +375,7 @@ namespace dials { namespace algorithms {
       } else {
         flags |= af::FailedDuringSummation;
       }
-      reflection["flags"] = flags;
+      return flags;
     }
 
     const MaskCalculatorIface &compute_mask_;
@@ -408,7 +386,8 @@ namespace dials { namespace algorithms {
     double underload_;
     double overload_;
     bool debug_;
-    mutable boost::mutex mutex_;
+    IntegrationTimer &timer_;
+    ShoeboxPool &shoebox_pool_;
   };
 
   /**
@@ -428,6 +407,12 @@ namespace dials { namespace algorithms {
      * @param buffer_size The buffer_size
      * @param use_dynamic_mask Use the dynamic mask if present
      * @param debug Add debug output
+     * @param read_ahead The number of images to read ahead on I/O threads
+     * @param read_threads The number of I/O threads used to read ahead
+     * @param compact_buffer Store the image buffer in compact 16 bit form
+     * @param compress_buffer Store the compact image buffer compressed in tiles
+     * @param thread_pool A thread pool shared with other jobs or NULL to create
+     *                    one with nthreads threads
      */
     ParallelReferenceProfiler(af::reflection_table reflections,
                               ImageSequence imageset,
@@ -438,7 +423,12 @@ namespace dials { namespace algorithms {
                               std::size_t nthreads,
                               std::size_t buffer_size,
                               bool use_dynamic_mask,
-                              bool debug) {
+                              bool debug,
+                              std::size_t read_ahead,
+                              std::size_t read_threads,
+                              bool compact_buffer,
+                              bool compress_buffer,
+                              boost::shared_ptr<dials::util::ThreadPool> thread_pool) {
       using dials::algorithms::shoebox::find_overlapping_multi_panel;
 
       // Check the input
@@ -477,31 +467,47 @@ namespace dials { namespace algorithms {
       reset_flags(flags);
 
       // Find the overlapping reflections
-      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel);
+      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel, nthreads);
+
+      // Use the thread pool given if there is one, otherwise the process-wide
+      // pool or a new one
+      boost::shared_ptr<dials::util::ThreadPool> job_pool =
+        dials::util::job_thread_pool(thread_pool, nthreads);
+      dials::util::ThreadPool &pool = *job_pool;
 
       // Allocate the array for the image data
-      Buffer buffer(
-        detector, zsize, buffer_size, underload, imageset.get_static_mask());
+      Buffer buffer(detector,
+                    zsize,
+                    buffer_size,
+                    underload,
+                    imageset.get_static_mask(),
+                    compact_buffer,
+                    compress_buffer,
+                    &pool);
 
       // If we have shoeboxes then delete
       if (reflections.contains("shoebox")) {
         reflections.erase("shoebox");
       }
 
-      // Transform reflection data from column major to row major. The
-      // reason for doing this is because we want to process each reflection
-      // in parallel. Therefore passing a reflection object is better than
-      // passing the whole table. Additionally, because the reflection table
-      // uses a std::map, it may not be thread safe, so we want to avoid
-      // accessing this across multiple threads.
-      af::shared<af::Reflection> reflection_array =
-        reflection_table_to_array(reflections);
+      // Resolve the typed columns read and written during profiling. Each
+      // reflection is processed by a single thread which reads and writes its
+      // own row directly so there is no need to copy the table into an array
+      // of reflection objects or to lock when accessing it.
+      ReflectionColumns columns(reflections, debug);
 
       // The lookup class gives the indices of reflections whose bounding boxes
       // are complete at a given image. This is used to submit reflections for
       // integration after each image is processed.
       Lookup lookup(bbox, zstart, zsize);
 
+      // The timer accumulates the time spent in each stage of processing
+      IntegrationTimer timer;
+      double start_time = dials::util::monotonic_time();
+
+      // The shoebox arrays are recycled between reflections on each thread
+      ShoeboxPool shoebox_pool;
+
       // Create the reflection parallel_reference_profiler. This class is called for
       // each reflection to integrate the data
       ReflectionReferenceProfiler parallel_reference_profiler(compute_mask,
@@ -511,23 +517,35 @@ namespace dials { namespace algorithms {
                                                               zstart,
                                                               underload,
                                                               overload,
-                                                              debug);
+                                                              debug,
+                                                              timer,
+                                                              shoebox_pool);
 
       // Do the integration
       process(lookup,
               parallel_reference_profiler,
               buffer,
-              reflection_array.ref(),
+              columns,
               overlaps,
               imageset,
               bbox,
+              panel,
               flags,
-              nthreads,
               use_dynamic_mask,
+              read_ahead,
+              read_threads,
+              pool,
+              timer,
               logger);
 
-      // Transform the row major reflection array to the reflection table
-      reflections_ = reflection_table_from_array(reflection_array.const_ref());
+      // Combine the profiles added by each thread
+      compute_reference.reduce();
+      timing_ =
+        timer.summary(pool.size(), dials::util::monotonic_time() - start_time);
+
+      // Remove any optional columns which were not written
+      columns.finalize();
+      reflections_ = reflections;
     }
 
     /**
@@ -537,12 +555,22 @@ namespace dials { namespace algorithms {
       return reflections_;
     }
 
+    /**
+     * @returns The time spent in each stage of processing
+     */
+    IntegrationTiming timing() const {
+      return timing_;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
+     * @param block_size The number of images in the buffer
+     * @param compact Is the buffer stored in compact form
      */
     static std::size_t compute_required_memory(ImageSequence imageset,
-                                               std::size_t block_size) {
+                                               std::size_t block_size,
+                                               bool compact) {
       DIALS_ASSERT(imageset.get_detector() != NULL);
       DIALS_ASSERT(imageset.get_scan() != NULL);
       Detector detector = *imageset.get_detector();
@@ -555,7 +583,8 @@ namespace dials { namespace algorithms {
         nelements += xsize * ysize;
       }
       nelements *= block_size;
-      std::size_t nbytes = nelements * sizeof(double);
+      std::size_t nbytes =
+        nelements * (compact ? sizeof(BufferFrame::compact_type) : sizeof(double));
       return nbytes;
     }
 
@@ -563,9 +592,11 @@ namespace dials { namespace algorithms {
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
      * @param max_memory_usage The maximum memory usage
+     * @param compact Is the buffer stored in compact form
      */
     static std::size_t compute_max_block_size(ImageSequence imageset,
-                                              std::size_t max_memory_usage) {
+                                              std::size_t max_memory_usage,
+                                              bool compact) {
       DIALS_ASSERT(max_memory_usage > 0);
       DIALS_ASSERT(imageset.get_detector() != NULL);
       Detector detector = *imageset.get_detector();
@@ -575,7 +606,8 @@ namespace dials { namespace algorithms {
         std::size_t ysize = detector[i].get_image_size()[1];
         nelements += xsize * ysize;
       }
-      std::size_t nbytes = nelements * sizeof(double);
+      std::size_t nbytes =
+        nelements * (compact ? sizeof(BufferFrame::compact_type) : sizeof(double));
       DIALS_ASSERT(nbytes > 0);
       DIALS_ASSERT(max_memory_usage > nbytes);
       return (std::size_t)std::floor((float)max_memory_usage / (float)nbytes);
@@ -601,23 +633,26 @@ namespace dials { namespace algorithms {
      * 3. Copy the images to a buffer
      * 4. Loop through all reflections complete on the image
      * 5. For each complete reflection post a reflection integration job to the
-     *    thread pool.
+     *    thread pool, preferring a thread on the NUMA node of its panel.
      */
     void process(const Lookup &lookup,
                  const ReflectionReferenceProfiler &parallel_reference_profiler,
                  Buffer &buffer,
-                 af::ref<af::Reflection> reflections,
+                 ReflectionColumns &columns,
                  const AdjacencyList &overlaps,
                  ImageSequence imageset,
                  af::const_ref<int6> bbox,
+                 af::const_ref<std::size_t> panel,
                  af::const_ref<std::size_t> flags,
-                 std::size_t nthreads,
                  bool use_dynamic_mask,
+                 std::size_t read_ahead,
+                 std::size_t read_threads,
+                 dials::util::ThreadPool &thread_pool,
+                 IntegrationTimer &timer,
                  const Logger &logger) const {
-      using dials::util::ThreadPool;
-
-      // Create the thread pool
-      ThreadPool pool(nthreads);
+      // The reflections are posted as a task group so that only the reflections
+      // from this imageset are waited on when the pool is shared.
+      dials::util::ThreadPool::TaskGroup pool(thread_pool);
 
       // Get the size of the array
       int zstart = imageset.get_scan()->get_array_range()[0];
@@ -626,19 +661,27 @@ namespace dials { namespace algorithms {
       // Create the buffer manager
       BufferManager bm(buffer, bbox, flags, zstart);
 
+      // If requested, read the images ahead on separate I/O threads. The
+      // imageset is then only accessed by those threads, which need the GIL, so
+      // release it here and only reacquire it to write the log.
+      ImageReader read_image(imageset, use_dynamic_mask);
+      boost::scoped_ptr<ImagePrefetcher> prefetcher;
+      boost::scoped_ptr<dials::util::ScopedReleaseGIL> release_gil;
+      if (read_ahead > 0) {
+        prefetcher.reset(new ImagePrefetcher(
+          imageset, read_ahead, read_threads, use_dynamic_mask));
+        release_gil.reset(new dials::util::ScopedReleaseGIL());
+      }
+
       // Loop through all the images
       for (std::size_t i = 0; i < zsize; ++i) {
         // Copy the image to the buffer. If the image number is greater than the
         // buffer size (i.e. we are now deleting old images) then wait for the
         // threads to finish so that we don't end up reading the wrong data
-        if (imageset.is_marked_for_rejection(i)) {
-          bm.copy_when_ready(imageset.get_corrected_data(i), false, i);
-        } else if (use_dynamic_mask) {
-          bm.copy_when_ready(
-            imageset.get_corrected_data(i), imageset.get_dynamic_mask(i), i);
-        } else {
-          bm.copy_when_ready(imageset.get_corrected_data(i), i);
-        }
+        double read_start_time = dials::util::monotonic_time();
+        ImageFrame image = prefetcher ? prefetcher->next() : read_image(i);
+        timer.add_read(dials::util::monotonic_time() - read_start_time);
+        bm.copy_when_ready(image, i);
 
         // Get the reflections recorded at this point
         af::const_ref<std::size_t> indices = lookup.indices(i);
@@ -666,23 +709,30 @@ namespace dials { namespace algorithms {
             boost::bind(&ReflectionReferenceProfiler::operator(),
                         boost::ref(parallel_reference_profiler),
                         k,
-                        af::ref<af::Reflection>(&reflections[0], reflections.size()),
+                        boost::ref(columns),
                         boost::ref(overlaps)),
-            bbox[k][4]);
+            bbox[k][4],
+            buffer.node(panel[k]));
         }
 
         // Print some output
         std::ostringstream ss;
         ss << "Modelling " << std::setw(5) << count << " reflections on image "
            << std::setw(6) << zstart + i;
-        logger.info(ss.str().c_str());
+        {
+          dials::util::ScopedAcquireGIL acquire_gil;
+          logger.info(ss.str().c_str());
+        }
       }
 
       // Wait for all the integration jobs to complete
       bm.wait(pool);
+      timer.add_stall(bm.stall_time());
+      timer.add_copy(bm.copy_time());
     }
 
     af::reflection_table reflections_;
+    IntegrationTiming timing_;
   };
 
 }}  // namespace dials::algorithms
@@ -20,6 +20,9 @@
 #include <list>
 #include <vector>
 #include <ctime>
+#include <boost/bind.hpp>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/util/thread_pool.h>
 #include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/array_family/reflection_table.h>
@@ -62,7 +65,8 @@ namespace dials { namespace algorithms {
                      std::size_t npanels,
                      int frame0,
                      int frame1,
-                     bool save)
+                     bool save,
+                     std::size_t nthreads = 1)
         : data_(data),
           extract_time_(0.0),
           process_time_(0.0),
@@ -71,9 +75,12 @@ namespace dials { namespace algorithms {
           frame0_(frame0),
           frame1_(frame1),
           frame_(frame0),
-          nframes_(frame1 - frame0) {
+          nframes_(frame1 - frame0),
+          nthreads_(nthreads),
+          pending_frame_(frame0) {
       DIALS_ASSERT(frame0_ < frame1_);
       DIALS_ASSERT(npanels_ > 0);
+      DIALS_ASSERT(nthreads_ > 0);
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.contains("shoebox"));
       DIALS_ASSERT(data.size() > 0);
@@ -112,112 +119,76 @@ namespace dials { namespace algorithms {
 
     /**
      * Extract the pixels from the image and copy to the relevant shoeboxes.
+     *
+     * With more than one thread, the reflections completed on a frame are
+     * processed during the call for the next frame, while its pixels are
+     * extracted in the background. The executor is always called from this
+     * thread. The reflections being processed are finished with, so the
+     * extraction never touches their shoeboxes. At most one frame of
+     * reflections waits to be processed, and the last frame is processed
+     * before the final call returns.
      * @param image The image to process
-     * @param frame The current image frame
+     * @param executor The executor to process completed reflections
      */
     template <typename T>
     void next(const Image<T>& image, Executor& executor) {
-      using dials::af::boost_python::flex_table_suite::select_rows_index;
-      using dials::af::boost_python::flex_table_suite::set_selected_rows_index;
-      typedef Shoebox<>::float_type float_type;
-      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
-      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
       DIALS_ASSERT(frame_ >= frame0_ && frame_ < frame1_);
       DIALS_ASSERT(image.npanels() == npanels_);
+      for (std::size_t p = 0; p < image.npanels(); ++p) {
+        DIALS_ASSERT(image.data(p).accessor().all_eq(image.mask(p).accessor()));
+      }
 
-      // Get the initial time
-      double start_time = timestamp();
-
-      // For each image, extract shoeboxes of reflections recorded.
-      // Allocate data where necessary
+      // The reflections on the frame are consecutive in the index array,
+      // panel by panel. Allocate data where necessary before extracting the
+      // pixels, since allocation replaces the arrays.
       af::ref<Shoebox<> > shoebox = data_["shoebox"];
-      af::shared<std::size_t> process_indices;
-      for (std::size_t p = 0; p < image.npanels(); ++p) {
-        af::const_ref<std::size_t> ind = indices(frame_, p);
-        af::const_ref<T, af::c_grid<2> > data = image.data(p);
-        af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
-        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-        for (std::size_t i = 0; i < ind.size(); ++i) {
-          DIALS_ASSERT(ind[i] < shoebox.size());
-          Shoebox<>& sbox = shoebox[ind[i]];
-          if (frame_ == sbox.bbox[4]) {
-            DIALS_ASSERT(sbox.is_allocated() == false);
-            sbox.allocate();
-          }
-          int6 b = sbox.bbox;
-          sbox_data_type sdata = sbox.data.ref();
-          sbox_mask_type smask = sbox.mask.ref();
-          DIALS_ASSERT(b[1] > b[0]);
-          DIALS_ASSERT(b[3] > b[2]);
-          DIALS_ASSERT(b[5] > b[4]);
-          DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
-          int x0 = b[0];
-          int x1 = b[1];
-          int y0 = b[2];
-          int y1 = b[3];
-          int z0 = b[4];
-          int xs = x1 - x0;
-          int ys = y1 - y0;
-          int z = frame_ - z0;
-          int yi = (int)data.accessor()[0];
-          int xi = (int)data.accessor()[1];
-          int xb = x0 >= 0 ? 0 : std::abs(x0);
-          int yb = y0 >= 0 ? 0 : std::abs(y0);
-          int xe = x1 <= xi ? xs : xs - (x1 - xi);
-          int ye = y1 <= yi ? ys : ys - (y1 - yi);
-          if (yb >= ye || xb >= xe) {
-            continue;
-          }
-          DIALS_ASSERT(yb >= 0 && ye <= ys);
-          DIALS_ASSERT(xb >= 0 && xe <= xs);
-          DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
-          DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
-          DIALS_ASSERT(sbox.is_consistent());
-          if (flatten_ == false) {
-            for (std::size_t y = yb; y < ye; ++y) {
-              for (std::size_t x = xb; x < xe; ++x) {
-                sdata(z, y, x) = data(y + y0, x + x0);
-                smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
-              }
-            }
-          } else {
-            for (std::size_t y = yb; y < ye; ++y) {
-              for (std::size_t x = xb; x < xe; ++x) {
-                sdata(0, y, x) += data(y + y0, x + x0);
-                bool sv = smask(0, y, x) & Valid;
-                bool mv = mask(y + y0, x + x0);
-                smask(0, y, x) = (mv && (z == 0 ? true : sv) ? Valid : 0);
-              }
-            }
-          }
-          if (frame_ == sbox.bbox[5] - 1) {
-            process_indices.push_back(ind[i]);
-          }
+      std::size_t j0 = (frame_ - frame0_) * npanels_;
+      DIALS_ASSERT(j0 + npanels_ < offset_.size());
+      std::size_t first = offset_[j0];
+      std::size_t last = offset_[j0 + npanels_];
+      for (std::size_t k = first; k < last; ++k) {
+        DIALS_ASSERT(indices_[k] < shoebox.size());
+        Shoebox<>& sbox = shoebox[indices_[k]];
+        if (frame_ == sbox.bbox[4]) {
+          DIALS_ASSERT(sbox.is_allocated() == false);
+          sbox.allocate();
         }
       }
 
-      // Update timing info
-      double end_time = timestamp();
-      extract_time_ += end_time - start_time;
+      // Extract the pixels, processing the previous frame meanwhile
+      std::vector<char> extracted(last - first, false);
+      if (nthreads_ > 1) {
+        dials::util::ThreadPool pool(1);
+        dials::util::ThreadPool::TaskGroup group(pool);
+        group.post(boost::bind(&ShoeboxProcessor::extract_frame<T>,
+                               this,
+                               boost::cref(image),
+                               shoebox,
+                               first,
+                               last,
+                               boost::ref(extracted)));
+        process(executor);
+        group.wait();
+      } else {
+        extract_frame(image, shoebox, first, last, extracted);
+      }
 
-      // Process all the reflections and set the reflections
-      if (process_indices.size() > 0) {
-        double start_time = timestamp();
-        af::const_ref<std::size_t> ind = process_indices.const_ref();
-        af::reflection_table reflections = select_rows_index(data_, ind);
-        executor.process(frame_, reflections);
-        set_selected_rows_index(data_, ind, reflections);
-        if (!save_) {
-          for (std::size_t i = 0; i < ind.size(); ++i) {
-            shoebox[ind[i]].deallocate();
-          }
+      // Queue the reflections whose last frame this is
+      DIALS_ASSERT(pending_indices_.size() == 0);
+      for (std::size_t k = first; k < last; ++k) {
+        if (extracted[k - first] && frame_ == shoebox[indices_[k]].bbox[5] - 1) {
+          pending_indices_.push_back(indices_[k]);
         }
-        double end_time = timestamp();
-        process_time_ += end_time - start_time;
       }
+      pending_frame_ = frame_;
 
       // Update the frame counter
       frame_++;
+
+      // Process the reflections now unless they can wait for the next frame
+      if (nthreads_ == 1 || finished()) {
+        process(executor);
+      }
     }
 
     /** @returns The first frame.  */
@@ -267,6 +238,154 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Extract the pixels for the reflections [first, last) of the index array
+     * on the current frame, in parallel bands
+     */
+    template <typename T>
+    void extract_frame(const Image<T>& image,
+                       af::ref<Shoebox<> > shoebox,
+                       std::size_t first,
+                       std::size_t last,
+                       std::vector<char>& extracted) {
+      double start_time = timestamp();
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&ShoeboxProcessor::extract_band<T>,
+                    this,
+                    boost::cref(image),
+                    shoebox,
+                    first,
+                    boost::ref(extracted),
+                    _1,
+                    _2),
+        last - first,
+        nthreads_);
+      extract_time_ += timestamp() - start_time;
+    }
+
+    /**
+     * Process the reflections waiting to be processed and set the results
+     */
+    void process(Executor& executor) {
+      using dials::af::boost_python::flex_table_suite::select_rows_index;
+      using dials::af::boost_python::flex_table_suite::set_selected_rows_index;
+      if (pending_indices_.size() == 0) {
+        return;
+      }
+      double start_time = timestamp();
+      af::const_ref<std::size_t> ind = pending_indices_.const_ref();
+      af::reflection_table reflections = select_rows_index(data_, ind);
+      executor.process(pending_frame_, reflections);
+      set_selected_rows_index(data_, ind, reflections);
+      if (!save_) {
+        af::ref<Shoebox<> > shoebox = data_["shoebox"];
+        for (std::size_t i = 0; i < ind.size(); ++i) {
+          shoebox[ind[i]].deallocate();
+        }
+      }
+      pending_indices_ = af::shared<std::size_t>();
+      process_time_ += timestamp() - start_time;
+    }
+
+    /**
+     * Extract the pixels for the reflections [first, last) of the current
+     * frame, counting from the index array position offset. Each reflection is
+     * recorded on one panel per frame, so each shoebox is only written by one
+     * thread. Reflections that overlap the image are flagged as extracted.
+     */
+    template <typename T>
+    void extract_band(const Image<T>& image,
+                      af::ref<Shoebox<> > shoebox,
+                      std::size_t offset,
+                      std::vector<char>& extracted,
+                      std::size_t first,
+                      std::size_t last) {
+      if (first == last) {
+        return;
+      }
+
+      // Find the panel of the first reflection in the band
+      const std::size_t* panel_offset = &offset_[(frame_ - frame0_) * npanels_];
+      std::size_t p =
+        std::upper_bound(panel_offset, panel_offset + npanels_ + 1, offset + first)
+        - panel_offset - 1;
+      af::const_ref<T, af::c_grid<2> > data = image.data(p);
+      af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
+      for (std::size_t k = offset + first; k < offset + last; ++k) {
+        if (panel_offset[p + 1] <= k) {
+          while (panel_offset[p + 1] <= k) {
+            p++;
+          }
+          data = image.data(p);
+          mask = image.mask(p);
+        }
+        extracted[k - offset] = extract(data, mask, shoebox[indices_[k]]);
+      }
+    }
+
+    /**
+     * Copy the pixels on the current frame into a shoebox, a row at a time
+     * @returns False if the shoebox does not overlap the image
+     */
+    template <typename T>
+    bool extract(const af::const_ref<T, af::c_grid<2> >& data,
+                 const af::const_ref<bool, af::c_grid<2> >& mask,
+                 Shoebox<>& sbox) {
+      typedef Shoebox<>::float_type float_type;
+      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
+      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
+      int6 b = sbox.bbox;
+      sbox_data_type sdata = sbox.data.ref();
+      sbox_mask_type smask = sbox.mask.ref();
+      DIALS_ASSERT(b[1] > b[0]);
+      DIALS_ASSERT(b[3] > b[2]);
+      DIALS_ASSERT(b[5] > b[4]);
+      DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
+      int x0 = b[0];
+      int x1 = b[1];
+      int y0 = b[2];
+      int y1 = b[3];
+      int z0 = b[4];
+      int xs = x1 - x0;
+      int ys = y1 - y0;
+      int z = frame_ - z0;
+      int yi = (int)data.accessor()[0];
+      int xi = (int)data.accessor()[1];
+      int xb = x0 >= 0 ? 0 : std::abs(x0);
+      int yb = y0 >= 0 ? 0 : std::abs(y0);
+      int xe = x1 <= xi ? xs : xs - (x1 - xi);
+      int ye = y1 <= yi ? ys : ys - (y1 - yi);
+      if (yb >= ye || xb >= xe) {
+        return false;
+      }
+      DIALS_ASSERT(yb >= 0 && ye <= ys);
+      DIALS_ASSERT(xb >= 0 && xe <= xs);
+      DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
+      DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
+      DIALS_ASSERT(sbox.is_consistent());
+      std::size_t n = xe - xb;
+      for (int y = yb; y < ye; ++y) {
+        const T* data_row = &data(y + y0, xb + x0);
+        const bool* mask_row = &mask(y + y0, xb + x0);
+        if (flatten_ == false) {
+          std::copy(data_row, data_row + n, &sdata(z, y, xb));
+          int* smask_row = &smask(z, y, xb);
+          for (std::size_t x = 0; x < n; ++x) {
+            smask_row[x] = mask_row[x] ? Valid : 0;
+          }
+        } else {
+          float_type* sdata_row = &sdata(0, y, xb);
+          int* smask_row = &smask(0, y, xb);
+          for (std::size_t x = 0; x < n; ++x) {
+            sdata_row[x] += data_row[x];
+            bool sv = smask_row[x] & Valid;
+            smask_row[x] = (mask_row[x] && (z == 0 ? true : sv) ? Valid : 0);
+          }
+        }
+      }
+      return true;
+    }
+
     /**
      * Get an index array specifying which reflections are recorded on a given
      * frame and panel.
@@ -297,6 +416,9 @@ namespace dials { namespace algorithms {
     int frame1_;
     int frame_;
     std::size_t nframes_;
+    std::size_t nthreads_;
+    af::shared<std::size_t> pending_indices_;
+    int pending_frame_;
     std::vector<std::size_t> indices_;
     std::vector<std::size_t> offset_;
   };
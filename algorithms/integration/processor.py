@@ -20,11 +20,13 @@
 from dials.util import tabulate
 from dials.util.mp import multi_node_parallel_map
 from dials_algorithms_integration_integrator_ext import (
+    BlockPlanner,
     Executor,
     Group,
     GroupList,
     Job,
     JobList,
+    ReflectionLookup,
     ReflectionManager,
     ReflectionManagerPerImage,
     ShoeboxProcessor,
@@ -38,6 +40,8 @@
 
 __all__ = [
     "Block",
+    "block_plan_summary",
+    "BlockPlanner",
     "build_processor",
     "Debug",
     "Executor",
@@ -55,6 +59,7 @@
     "ProcessorFlat3D",
     "ProcessorSingle2D",
     "ProcessorStills",
+    "ReflectionLookup",
     "ReflectionManager",
     "ReflectionManagerPerImage",
     "Shoebox",
@@ -65,6 +70,34 @@
 logger = logging.getLogger(__name__)
 
 
+def block_plan_summary(planner):
+    """
+    Get a summary of the planned blocks
+
+    :param planner: The block planner
+    :return: The summary string
+    """
+    rows = [["#", "Frame From", "Frame To", "# Reflections", "# Pixels"]]
+    for i, (block, n, p) in enumerate(
+        zip(planner.blocks(), planner.num_reflections(), planner.num_pixels())
+    ):
+        rows.append([str(i), str(block[0]), str(block[1]), str(n), str(p)])
+    if planner.adaptive():
+        kind = "adaptive"
+    else:
+        kind = "uniform"
+    return (
+        " Using %s blocks: %d reflections split between blocks (%d with uniform"
+        " blocks)\n\n%s\n"
+        % (
+            kind,
+            planner.num_split(),
+            planner.num_split_uniform(),
+            tabulate(rows, headers="firstrow"),
+        )
+    )
+
+
 def _average_bbox_size(reflections):
     """Calculate the average bbox size for debugging"""
 
@@ -134,6 +167,7 @@ def __init__(self):
         self.units = "degrees"
         self.threshold = 0.99
         self.force = False
+        self.adaptive = False
         self.max_memory_usage = 0.90
 
     def update(self, other):
@@ -141,6 +175,7 @@ def update(self, other):
         self.units = other.units
         self.threshold = other.threshold
         self.force = other.force
+        self.adaptive = other.adaptive
         self.max_memory_usage = other.max_memory_usage
 
 
@@ -459,6 +494,7 @@ def __call__(self):
             frame0,
             frame1,
             self.params.debug.output,
+            nthreads=self.params.mp.nthreads,
         )
 
         # Loop through the imageset, extract pixels and process reflections
@@ -543,6 +579,9 @@ def __init__(self, experiments, reflections, params):
         # Other data
         self.data = {}
 
+        # The job of each reflection
+        self.lookup = None
+
         # Save some parameters
         self.params = params
 
@@ -566,10 +605,11 @@ def initialize(self):
         self.compute_blocks()
         self.compute_jobs()
         self.split_reflections()
+        self.compute_lookup()
         self.compute_processors()
 
         # Create the reflection manager
-        self.manager = ReflectionManager(self.jobs, self.reflections)
+        self.manager = ReflectionManager(self.jobs, self.reflections, self.lookup)
 
         # Parallel reading of HDF5 from the same handle is not allowed. Python
         # multiprocessing is a bit messed up and used fork on linux so need to
@@ -703,8 +743,9 @@ def compute_jobs(self):
             if scan is not None:
                 assert len(imgs) >= len(scan), "Invalid scan range"
                 array_range = scan.get_array_range()
+            nframes = array_range[1] - array_range[0]
             if self.params.block.size is None:
-                block_size_frames = array_range[1] - array_range[0]
+                block_size_frames = nframes
             elif self.params.block.units == "radians":
                 phi0, dphi = scan.get_oscillation(deg=False)
                 block_size_frames = int(math.ceil(self.params.block.size / dphi))
@@ -717,7 +758,20 @@ def compute_jobs(self):
                 raise RuntimeError(
                     "Unknown block_size units %r" % self.params.block.units
                 )
-            self.jobs.add((i0, i1), array_range, block_size_frames)
+            if self.params.block.adaptive and self.params.block.size is not None:
+                selection = (self.reflections["id"] >= i0) & (
+                    self.reflections["id"] < i1
+                )
+                planner = BlockPlanner(
+                    array_range,
+                    self.reflections["bbox"].select(selection),
+                    block_size_frames,
+                    nframes,
+                )
+                logger.info(block_plan_summary(planner))
+                self.jobs.add((i0, i1), array_range, planner.blocks())
+            else:
+                self.jobs.add((i0, i1), array_range, block_size_frames)
         assert len(self.jobs) > 0, "Invalid number of jobs"
 
     def split_reflections(self):
@@ -751,15 +805,30 @@ def split_reflections(self):
         # Compute the partiality
         self.reflections.compute_partiality(self.experiments)
 
+    def compute_lookup(self):
+        """
+        Compute the job of each reflection once, to share between the shoebox
+        memory estimate and the reflection manager
+        """
+        self.lookup = ReflectionLookup(
+            self.jobs, self.reflections, nthreads=self.params.mp.nthreads
+        )
+
     def compute_processors(self):
         """
         Compute the number of processors
         """
 
         # Get the maximum shoebox memory to estimate memory use for one process
-        memory_required_per_process = flex.max(
-            self.jobs.shoebox_memory(self.reflections, self.params.shoebox.flatten)
-        )
+        if self.lookup is not None:
+            shoebox_memory = self.jobs.shoebox_memory(
+                self.reflections, self.params.shoebox.flatten, self.lookup
+            )
+        else:
+            shoebox_memory = self.jobs.shoebox_memory(
+                self.reflections, self.params.shoebox.flatten
+            )
+        memory_required_per_process = flex.max(shoebox_memory)
 
         # Obtain information about system memory
         available_memory = psutil.virtual_memory().available
@@ -0,0 +1,376 @@
+/*
+ * reflection_columns.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_INTEGRATION_REFLECTION_COLUMNS_H
+#define DIALS_ALGORITHMS_INTEGRATION_REFLECTION_COLUMNS_H
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <dials/array_family/reflection_table.h>
+#include <dials/array_family/reflection.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Shoebox;
+  using scitbx::vec3;
+  using scitbx::af::int6;
+
+  /**
+   * A typed view of the reflection table columns used during integration.
+   *
+   * All the columns which are read or written while integrating are resolved
+   * once up front so that worker threads can read and write the rows they own
+   * directly without going through the string keyed column map. Each row is
+   * only ever written by the thread processing that reflection and the input
+   * columns used for adjacent reflections are never written, so no locking is
+   * needed on the fast path.
+   *
+   * The mask, background, intensity and reference calculators still take an
+   * af::Reflection, so a compact row containing only the columns they use is
+   * built on demand. Values the calculators write which have no typed column
+   * fall back to a locked generic write into the table.
+   */
+  class ReflectionColumns {
+  public:
+    /**
+     * Resolve the columns of the table
+     * @param table The reflection table
+     * @param keep_shoebox Write the shoebox back to the table
+     */
+    ReflectionColumns(af::reflection_table table, bool keep_shoebox)
+        : table_(table),
+          keep_shoebox_(keep_shoebox),
+          has_id_(table.contains("id")),
+          has_s1_(table.contains("s1")),
+          has_xyzcal_px_(table.contains("xyzcal.px")),
+          has_xyzcal_mm_(table.contains("xyzcal.mm")),
+          has_partiality_(table.contains("partiality")),
+          optional_(boost::make_shared<OptionalColumns>()) {
+      DIALS_ASSERT(table.is_consistent());
+      DIALS_ASSERT(table.contains("panel"));
+      DIALS_ASSERT(table.contains("bbox"));
+      DIALS_ASSERT(table.contains("flags"));
+
+      // Input columns
+      panel_ = table.get<std::size_t>("panel");
+      bbox_ = table.get<int6>("bbox");
+      flags_ = table.get<std::size_t>("flags");
+      if (has_id_) id_ = table.get<int>("id");
+      if (has_s1_) s1_ = table.get<vec3<double> >("s1");
+      if (has_xyzcal_px_) xyzcal_px_ = table.get<vec3<double> >("xyzcal.px");
+      if (has_xyzcal_mm_) xyzcal_mm_ = table.get<vec3<double> >("xyzcal.mm");
+
+      // Output columns always written by the integrator
+      xyzobs_px_value_ = table.get<vec3<double> >("xyzobs.px.value");
+      xyzobs_px_variance_ = table.get<vec3<double> >("xyzobs.px.variance");
+      intensity_sum_value_ = table.get<double>("intensity.sum.value");
+      intensity_sum_variance_ = table.get<double>("intensity.sum.variance");
+      background_sum_value_ = table.get<double>("background.sum.value");
+      background_sum_variance_ = table.get<double>("background.sum.variance");
+      num_pixels_valid_ = table.get<int>("num_pixels.valid");
+      num_pixels_background_ = table.get<int>("num_pixels.background");
+      num_pixels_background_used_ = table.get<int>("num_pixels.background_used");
+      num_pixels_foreground_ = table.get<int>("num_pixels.foreground");
+      if (keep_shoebox_) {
+        shoebox_ = table.get<Shoebox<> >("shoebox");
+      }
+
+      // Output columns which only some calculators write. These are removed
+      // again in finalize() if nothing was written to them.
+      optional_->existed[PARTIALITY] = has_partiality_;
+      optional_->existed[PARTIALITY_OLD] = table.contains("partiality_old");
+      optional_->existed[INTENSITY_PRF_VALUE] = table.contains("intensity.prf.value");
+      optional_->existed[INTENSITY_PRF_VARIANCE] =
+        table.contains("intensity.prf.variance");
+      optional_->existed[INTENSITY_PRF_CORRELATION] =
+        table.contains("intensity.prf.correlation");
+      for (std::size_t i = 0; i < NUM_OPTIONAL; ++i) {
+        optional_->written[i] = false;
+        optional_->column[i] = table.get<double>(optional_name(i));
+      }
+    }
+
+    /** @returns The number of rows */
+    std::size_t size() const {
+      return bbox_.size();
+    }
+
+    /** @returns The panel of the reflection */
+    std::size_t panel(std::size_t index) const {
+      return panel_[index];
+    }
+
+    /** @returns The bounding box of the reflection */
+    const int6 &bbox(std::size_t index) const {
+      return bbox_[index];
+    }
+
+    /** @returns The flags of the reflection */
+    std::size_t flags(std::size_t index) const {
+      return flags_[index];
+    }
+
+    /**
+     * Build the compact row passed to the algorithm interfaces
+     * @param index The reflection index
+     * @returns The reflection
+     */
+    af::Reflection row(std::size_t index) const {
+      DIALS_ASSERT(index < size());
+      af::Reflection result = adjacent_row(index);
+      result["flags"] = flags_[index];
+      if (has_partiality_) {
+        result["partiality"] = optional_->column[PARTIALITY][index];
+      }
+      return result;
+    }
+
+    /**
+     * Build the compact row for an adjacent reflection. This only contains
+     * the columns which are never written during integration so that it is
+     * safe to read while another thread is processing the reflection.
+     * @param index The reflection index
+     * @returns The reflection
+     */
+    af::Reflection adjacent_row(std::size_t index) const {
+      DIALS_ASSERT(index < size());
+      af::Reflection result;
+      result["panel"] = panel_[index];
+      result["bbox"] = bbox_[index];
+      if (has_id_) result["id"] = id_[index];
+      if (has_s1_) result["s1"] = s1_[index];
+      if (has_xyzcal_px_) result["xyzcal.px"] = xyzcal_px_[index];
+      if (has_xyzcal_mm_) result["xyzcal.mm"] = xyzcal_mm_[index];
+      return result;
+    }
+
+    /**
+     * Set the centroid of the reflection
+     */
+    void set_centroid(std::size_t index, const dials::model::Centroid &centroid) {
+      xyzobs_px_value_[index] = centroid.px.position;
+      xyzobs_px_variance_[index] = centroid.px.variance;
+    }
+
+    /**
+     * Set the summed intensity of the reflection
+     */
+    void set_summed_intensity(std::size_t index,
+                              const dials::model::Intensity &intensity) {
+      intensity_sum_value_[index] = intensity.observed.value;
+      intensity_sum_variance_[index] = intensity.observed.variance;
+      background_sum_value_[index] = intensity.background.value;
+      background_sum_variance_[index] = intensity.background.variance;
+    }
+
+    /**
+     * Set the pixel counts of the reflection
+     */
+    void set_num_pixels(std::size_t index,
+                        int valid,
+                        int background,
+                        int background_used,
+                        int foreground) {
+      num_pixels_valid_[index] = valid;
+      num_pixels_background_[index] = background;
+      num_pixels_background_used_[index] = background_used;
+      num_pixels_foreground_[index] = foreground;
+    }
+
+    /**
+     * Set the flags of the reflection
+     */
+    void set_flags(std::size_t index, std::size_t flags) {
+      flags_[index] = flags;
+    }
+
+    /**
+     * @returns The shoebox of the reflection if shoeboxes are being kept
+     */
+    const Shoebox<> &shoebox(std::size_t index) const {
+      DIALS_ASSERT(keep_shoebox_);
+      DIALS_ASSERT(index < size());
+      return shoebox_[index];
+    }
+
+    /**
+     * Set the shoebox of the reflection if shoeboxes are being kept
+     */
+    void set_shoebox(std::size_t index, const Shoebox<> &shoebox) {
+      if (keep_shoebox_) {
+        shoebox_[index] = shoebox;
+      }
+    }
+
+    /**
+     * Write back the values set by the algorithm interfaces on the compact row.
+     * The input columns are ignored since they are never modified.
+     * @param index The reflection index
+     * @param reflection The compact row
+     */
+    void set_row(std::size_t index, const af::Reflection &reflection) {
+      DIALS_ASSERT(index < size());
+      typedef af::Reflection::const_iterator iterator;
+      for (iterator it = reflection.begin(); it != reflection.end(); ++it) {
+        const std::string &key = it->first;
+        if (key == "flags") {
+          flags_[index] = boost::get<std::size_t>(it->second);
+        } else if (is_input(key)) {
+          continue;
+        } else if (set_summed(index, key, it->second)) {
+          continue;
+        } else {
+          std::size_t column = find_optional(key);
+          const double *value = boost::get<double>(&it->second);
+          if (column < NUM_OPTIONAL && value != NULL) {
+            optional_->column[column][index] = *value;
+            if (!optional_->written[column]) {
+              optional_->written[column] = true;
+            }
+          } else {
+            set_generic(index, key, it->second);
+          }
+        }
+      }
+    }
+
+    /**
+     * Remove optional output columns which did not exist before integration
+     * and which were not written by any of the algorithms.
+     */
+    void finalize() {
+      for (std::size_t i = 0; i < NUM_OPTIONAL; ++i) {
+        if (!optional_->existed[i] && !optional_->written[i]) {
+          table_.erase(optional_name(i));
+        }
+      }
+    }
+
+  protected:
+    enum OptionalColumn {
+      PARTIALITY,
+      PARTIALITY_OLD,
+      INTENSITY_PRF_VALUE,
+      INTENSITY_PRF_VARIANCE,
+      INTENSITY_PRF_CORRELATION,
+      NUM_OPTIONAL
+    };
+
+    /**
+     * Storage for the optional columns. This is shared so that the view can be
+     * copied while the written flags are updated from multiple threads.
+     */
+    struct OptionalColumns {
+      af::shared<double> column[NUM_OPTIONAL];
+      bool existed[NUM_OPTIONAL];
+      boost::atomic<bool> written[NUM_OPTIONAL];
+      boost::mutex mutex;
+    };
+
+    /**
+     * @returns The name of the optional column
+     */
+    static const char *optional_name(std::size_t index) {
+      static const char *names[NUM_OPTIONAL] = {"partiality",
+                                                "partiality_old",
+                                                "intensity.prf.value",
+                                                "intensity.prf.variance",
+                                                "intensity.prf.correlation"};
+      DIALS_ASSERT(index < NUM_OPTIONAL);
+      return names[index];
+    }
+
+    /**
+     * @returns The index of the optional column or NUM_OPTIONAL
+     */
+    static std::size_t find_optional(const std::string &key) {
+      for (std::size_t i = 0; i < NUM_OPTIONAL; ++i) {
+        if (key == optional_name(i)) {
+          return i;
+        }
+      }
+      return NUM_OPTIONAL;
+    }
+
+    /**
+     * @returns Is the column one of the read only inputs
+     */
+    static bool is_input(const std::string &key) {
+      return key == "panel" || key == "bbox" || key == "id" || key == "s1"
+             || key == "xyzcal.px" || key == "xyzcal.mm" || key == "shoebox";
+    }
+
+    /**
+     * Write a summed intensity value to its typed column
+     * @returns True/False the key was a summed intensity column
+     */
+    bool set_summed(std::size_t index,
+                    const std::string &key,
+                    const af::Reflection::data_type &value) {
+      const double *v = boost::get<double>(&value);
+      if (v == NULL) {
+        return false;
+      } else if (key == "intensity.sum.value") {
+        intensity_sum_value_[index] = *v;
+      } else if (key == "intensity.sum.variance") {
+        intensity_sum_variance_[index] = *v;
+      } else if (key == "background.sum.value") {
+        background_sum_value_[index] = *v;
+      } else if (key == "background.sum.variance") {
+        background_sum_variance_[index] = *v;
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * Write a value with no typed column. This may create a column in the
+     * table so it is done under a lock.
+     */
+    void set_generic(std::size_t index,
+                     const std::string &key,
+                     const af::Reflection::data_type &value) {
+      boost::lock_guard<boost::mutex> guard(optional_->mutex);
+      af::detail::reflection_to_row_visitor visitor(table_, index, key);
+      value.apply_visitor(visitor);
+    }
+
+    af::reflection_table table_;
+    bool keep_shoebox_;
+    bool has_id_;
+    bool has_s1_;
+    bool has_xyzcal_px_;
+    bool has_xyzcal_mm_;
+    bool has_partiality_;
+    af::shared<std::size_t> panel_;
+    af::shared<int6> bbox_;
+    af::shared<std::size_t> flags_;
+    af::shared<int> id_;
+    af::shared<vec3<double> > s1_;
+    af::shared<vec3<double> > xyzcal_px_;
+    af::shared<vec3<double> > xyzcal_mm_;
+    af::shared<vec3<double> > xyzobs_px_value_;
+    af::shared<vec3<double> > xyzobs_px_variance_;
+    af::shared<double> intensity_sum_value_;
+    af::shared<double> intensity_sum_variance_;
+    af::shared<double> background_sum_value_;
+    af::shared<double> background_sum_variance_;
+    af::shared<int> num_pixels_valid_;
+    af::shared<int> num_pixels_background_;
+    af::shared<int> num_pixels_background_used_;
+    af::shared<int> num_pixels_foreground_;
+    af::shared<Shoebox<> > shoebox_;
+    boost::shared_ptr<OptionalColumns> optional_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_REFLECTION_COLUMNS_H
@@ -0,0 +1,201 @@
+/*
+ * shoebox_pool.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_POOL_H
+#define DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_POOL_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/util/thread_local.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Shoebox;
+  using scitbx::af::int6;
+
+  /**
+   * A pool of shoebox arrays which are recycled between reflections.
+   *
+   * Each worker thread has its own cache of free data, mask and background
+   * arrays. When a reflection is integrated the arrays are taken from the
+   * cache of the calling thread if one with enough capacity is available and
+   * are given back to it once the reflection has been processed, so in the
+   * steady state no memory is allocated or freed per reflection. The array
+   * handles are never shared between threads since their reference counts are
+   * not atomic. The caches are owned by the pool and are freed when the pool
+   * is destroyed at the end of the job.
+   */
+  class ShoeboxPool : private boost::noncopyable {
+  public:
+    typedef Shoebox<>::float_type float_type;
+    typedef af::versa<float_type, af::c_grid<3> > float_array_type;
+    typedef af::versa<int, af::c_grid<3> > int_array_type;
+
+    /**
+     * The free arrays for a single thread
+     */
+    class Cache : private boost::noncopyable {
+    public:
+      /**
+       * @param max_cached The maximum number of free arrays of each type
+       */
+      Cache(std::size_t max_cached) : max_cached_(max_cached) {}
+
+      /**
+       * Allocate the shoebox arrays, reusing free arrays where possible. All
+       * the elements are initialised to zero as with Shoebox::allocate.
+       * @param shoebox The shoebox to allocate
+       */
+      void allocate(Shoebox<> &shoebox) {
+        std::size_t zs = shoebox.flat ? 1 : shoebox.zsize();
+        af::c_grid<3> accessor(zs, shoebox.ysize(), shoebox.xsize());
+        shoebox.data = take(data_, accessor);
+        shoebox.mask = take(mask_, accessor);
+        shoebox.background = take(background_, accessor);
+        shoebox.charge_memory();
+      }
+
+      /**
+       * Give the shoebox arrays back to the cache. Arrays which are still
+       * referenced elsewhere (e.g. kept in the reflection table) are left
+       * alone.
+       * @param shoebox The shoebox to release
+       */
+      void release(Shoebox<> &shoebox) {
+        give(data_, shoebox.data);
+        give(mask_, shoebox.mask);
+        give(background_, shoebox.background);
+      }
+
+    protected:
+      /**
+       * Take the smallest free array with enough capacity or allocate a new
+       * one if there is none.
+       */
+      template <typename T>
+      static af::versa<T, af::c_grid<3> > take(
+        std::vector<af::versa<T, af::c_grid<3> > > &free,
+        const af::c_grid<3> &accessor) {
+        std::size_t size = accessor.size_1d();
+        std::size_t best = free.size();
+        for (std::size_t i = 0; i < free.size(); ++i) {
+          if (free[i].capacity() >= size
+              && (best == free.size() || free[i].capacity() < free[best].capacity())) {
+            best = i;
+          }
+        }
+        if (best == free.size()) {
+          return af::versa<T, af::c_grid<3> >(accessor, T(0));
+        }
+        af::versa<T, af::c_grid<3> > result = free[best];
+        free[best] = free.back();
+        free.pop_back();
+        result.resize(accessor);
+        std::fill(result.begin(), result.end(), T(0));
+        return result;
+      }
+
+      /**
+       * Add the array to the free list if nothing else references it. If the
+       * free list is full the smallest array is dropped.
+       */
+      template <typename T>
+      void give(std::vector<af::versa<T, af::c_grid<3> > > &free,
+                af::versa<T, af::c_grid<3> > &array) {
+        if (array.capacity() == 0 || array.handle()->use_count != 1) {
+          return;
+        }
+        if (free.size() < max_cached_) {
+          free.push_back(array);
+          return;
+        }
+        std::size_t smallest = 0;
+        for (std::size_t i = 1; i < free.size(); ++i) {
+          if (free[i].capacity() < free[smallest].capacity()) {
+            smallest = i;
+          }
+        }
+        if (!free.empty() && free[smallest].capacity() < array.capacity()) {
+          free[smallest] = array;
+        }
+      }
+
+      std::size_t max_cached_;
+      std::vector<float_array_type> data_;
+      std::vector<int_array_type> mask_;
+      std::vector<float_array_type> background_;
+    };
+
+    /**
+     * Allocate a shoebox from the cache of the calling thread for the lifetime
+     * of the object. The lease should be created before anything which takes
+     * a copy of the shoebox so that the copies are gone by the time the arrays
+     * are returned to the cache.
+     */
+    class Lease : private boost::noncopyable {
+    public:
+      /**
+       * @param cache The cache of the calling thread
+       * @param panel The panel of the shoebox
+       * @param bbox The bounding box of the shoebox
+       */
+      Lease(Cache &cache, std::size_t panel, const int6 &bbox)
+          : cache_(cache), shoebox_(panel, bbox) {
+        cache_.allocate(shoebox_);
+      }
+
+      ~Lease() {
+        cache_.release(shoebox_);
+      }
+
+      /** @returns The shoebox */
+      Shoebox<> &shoebox() {
+        return shoebox_;
+      }
+
+    protected:
+      Cache &cache_;
+      Shoebox<> shoebox_;
+    };
+
+    /**
+     * @param max_cached The maximum number of free arrays of each type per thread
+     */
+    ShoeboxPool(std::size_t max_cached = 16) : max_cached_(max_cached) {}
+
+    /**
+     * @returns The cache for the calling thread
+     */
+    Cache &local() {
+      Cache *cache = local_.get();
+      if (cache == NULL) {
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        caches_.push_back(new Cache(max_cached_));
+        cache = &caches_.back();
+        local_.reset(cache);
+      }
+      return *cache;
+    }
+
+  protected:
+    // The caches are owned by the pool, not the thread
+    dials::util::ThreadLocalPtr<Cache> local_;
+    boost::mutex mutex_;
+    boost::ptr_vector<Cache> caches_;
+    std::size_t max_cached_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_POOL_H
@@ -6,6 +6,8 @@
 from dials_algorithms_integration_sum_ext import sum_image_volume
 
 __all__ = (  # noqa: F405
+    "SummationBatchDouble",
+    "SummationBatchFloat",
     "SummationDouble",
     "SummationFloat",
     "integrate_by_summation",
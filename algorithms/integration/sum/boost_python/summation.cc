@@ -49,6 +49,29 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("success", &SummationType::success);
   }
 
+  template <typename FloatType>
+  void summation_batch_wrapper(const char *name) {
+    typedef SummationBatch<FloatType> SummationBatchType;
+
+    class_<SummationBatchType>(name, no_init)
+      .def(init<const af::const_ref<FloatType> &,
+                const af::const_ref<FloatType> &,
+                const af::const_ref<int> &,
+                const af::const_ref<std::size_t> &>(
+        (boost::python::arg("signal"),
+         boost::python::arg("background"),
+         boost::python::arg("mask"),
+         boost::python::arg("offsets"))))
+      .def("intensity", &SummationBatchType::intensity)
+      .def("variance", &SummationBatchType::variance)
+      .def("background", &SummationBatchType::background)
+      .def("background_variance", &SummationBatchType::background_variance)
+      .def("n_signal", &SummationBatchType::n_signal)
+      .def("n_background", &SummationBatchType::n_background)
+      .def("success", &SummationBatchType::success)
+      .def("__len__", &SummationBatchType::size);
+  }
+
   template <typename FloatType>
   Summation<FloatType> make_summation_1d(const af::const_ref<FloatType> &image,
                                          const af::const_ref<FloatType> &background,
@@ -96,6 +119,8 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_summation() {
     summation_wrapper<float>("SummationFloat");
     summation_wrapper<double>("SummationDouble");
+    summation_batch_wrapper<float>("SummationBatchFloat");
+    summation_batch_wrapper<double>("SummationBatchDouble");
 
     summation_suite<float>();
     summation_suite<double>();
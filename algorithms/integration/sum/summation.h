@@ -29,6 +29,65 @@ namespace dials { namespace algorithms {
   using scitbx::af::int6;
   using scitbx::af::sqrt;
 
+  /**
+   * The inner loop of the summation integration.
+   *
+   * The mask codes are tested with bit operations and the pixels are
+   * accumulated with selects rather than branches, so the loop has no data
+   * dependent control flow and the compiler is free to vectorise the mask
+   * tests and counts. The floating point sums are kept in pixel order so the
+   * result is identical to the branching loop. SummationBatch runs the
+   * kernel over each shoebox of a contiguous batch.
+   */
+  template <typename FloatType>
+  struct SummationKernel {
+    FloatType sum_p;
+    FloatType sum_b;
+    std::size_t n_signal;
+    std::size_t n_background;
+    std::size_t n_bad;
+
+    SummationKernel() : sum_p(0), sum_b(0), n_signal(0), n_background(0), n_bad(0) {}
+
+    /**
+     * Accumulate the pixels
+     * @param signal The signal array
+     * @param background The background array
+     * @param mask The mask array
+     * @param size The number of pixels
+     */
+    void operator()(const FloatType *signal,
+                    const FloatType *background,
+                    const int *mask,
+                    std::size_t size) {
+      const int fg_code = Foreground;
+      const int fg_test = Foreground | Valid | Overlapped;
+      const int fg_good = Foreground | Valid;
+      const int bg_code = Valid | Background | BackgroundUsed;
+      FloatType p = sum_p;
+      FloatType b = sum_b;
+      std::size_t ns = 0;
+      std::size_t nb = 0;
+      std::size_t nbad = 0;
+      for (std::size_t i = 0; i < size; ++i) {
+        int m = mask[i];
+        int is_fg = (m & fg_code) == fg_code;
+        int is_good = (m & fg_test) == fg_good;
+        int is_bg = ((m & bg_code) == bg_code) & !is_fg;
+        p += is_good ? signal[i] : FloatType(0);
+        b += is_good ? background[i] : FloatType(0);
+        ns += is_good;
+        nbad += is_fg & !is_good;
+        nb += is_bg;
+      }
+      sum_p = p;
+      sum_b = b;
+      n_signal += ns;
+      n_background += nb;
+      n_bad += nbad;
+    }
+  };
+
   /**
    * Class to sum the intensity in 3D
    */
@@ -141,25 +200,13 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(signal.size() == mask.size());
 
       // Calculate the signal and background intensity
-      int bg_code = Valid | Background | BackgroundUsed;
-      success_ = true;
-      n_background_ = 0;
-      n_signal_ = 0;
-      sum_p_ = 0.0;
-      sum_b_ = 0.0;
-      for (std::size_t i = 0; i < signal.size(); ++i) {
-        if ((mask[i] & Foreground) == Foreground) {
-          if ((mask[i] & Valid) == Valid && (mask[i] & Overlapped) == 0) {
-            sum_p_ += signal[i];
-            sum_b_ += background[i];
-            n_signal_++;
-          } else {
-            success_ = false;
-          }
-        } else if ((mask[i] & bg_code) == bg_code) {
-          n_background_++;
-        }
-      }
+      SummationKernel<FloatType> kernel;
+      kernel(signal.begin(), background.begin(), mask.begin(), signal.size());
+      success_ = kernel.n_bad == 0;
+      n_background_ = kernel.n_background;
+      n_signal_ = kernel.n_signal;
+      sum_p_ = kernel.sum_p;
+      sum_b_ = kernel.sum_b;
     }
 
     FloatType sum_p_;
@@ -169,6 +216,123 @@ namespace dials { namespace algorithms {
     bool success_;
   };
 
+  /**
+   * Class to sum the intensity of a batch of shoeboxes whose pixels are
+   * stored one after another in the same arrays. The pixels of shoebox i are
+   * in the range [offsets[i], offsets[i + 1]) and the result for each shoebox
+   * is the same as from Summation on its pixels.
+   */
+  template <typename FloatType = double>
+  class SummationBatch {
+  public:
+    /**
+     * Perform the summation integration
+     * @param signal The signal array
+     * @param background The background array
+     * @param mask The mask array
+     * @param offsets The offset of each shoebox, then the total size
+     */
+    SummationBatch(const af::const_ref<FloatType> &signal,
+                   const af::const_ref<FloatType> &background,
+                   const af::const_ref<int> &mask,
+                   const af::const_ref<std::size_t> &offsets) {
+      DIALS_ASSERT(signal.size() == background.size());
+      DIALS_ASSERT(signal.size() == mask.size());
+      DIALS_ASSERT(offsets.size() > 0);
+      DIALS_ASSERT(offsets[0] == 0);
+      DIALS_ASSERT(offsets[offsets.size() - 1] == signal.size());
+      std::size_t num = offsets.size() - 1;
+      intensity_.reserve(num);
+      variance_.reserve(num);
+      background_.reserve(num);
+      background_variance_.reserve(num);
+      n_signal_.reserve(num);
+      n_background_.reserve(num);
+      success_.reserve(num);
+      for (std::size_t i = 0; i < num; ++i) {
+        DIALS_ASSERT(offsets[i] <= offsets[i + 1]);
+        std::size_t first = offsets[i];
+        std::size_t size = offsets[i + 1] - first;
+        Summation<FloatType> summation(
+          af::const_ref<FloatType>(signal.begin() + first, size),
+          af::const_ref<FloatType>(background.begin() + first, size),
+          af::const_ref<int>(mask.begin() + first, size));
+        intensity_.push_back(summation.intensity());
+        variance_.push_back(summation.variance());
+        background_.push_back(summation.background());
+        background_variance_.push_back(summation.background_variance());
+        n_signal_.push_back(summation.n_signal());
+        n_background_.push_back(summation.n_background());
+        success_.push_back(summation.success());
+      }
+    }
+
+    /**
+     * @returns The number of shoeboxes
+     */
+    std::size_t size() const {
+      return intensity_.size();
+    }
+
+    /**
+     * @returns The intensity of each shoebox
+     */
+    af::shared<FloatType> intensity() const {
+      return intensity_;
+    }
+
+    /**
+     * @returns The variance on the intensity of each shoebox
+     */
+    af::shared<FloatType> variance() const {
+      return variance_;
+    }
+
+    /**
+     * @returns The background of each shoebox
+     */
+    af::shared<FloatType> background() const {
+      return background_;
+    }
+
+    /**
+     * @returns The background variance of each shoebox
+     */
+    af::shared<FloatType> background_variance() const {
+      return background_variance_;
+    }
+
+    /**
+     * @returns The number of signal pixels in each shoebox
+     */
+    af::shared<std::size_t> n_signal() const {
+      return n_signal_;
+    }
+
+    /**
+     * @returns The number of background pixels in each shoebox
+     */
+    af::shared<std::size_t> n_background() const {
+      return n_background_;
+    }
+
+    /**
+     * @returns Was the algorithm successful for each shoebox
+     */
+    af::shared<bool> success() const {
+      return success_;
+    }
+
+  private:
+    af::shared<FloatType> intensity_;
+    af::shared<FloatType> variance_;
+    af::shared<FloatType> background_;
+    af::shared<FloatType> background_variance_;
+    af::shared<std::size_t> n_signal_;
+    af::shared<std::size_t> n_background_;
+    af::shared<bool> success_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_INTEGRATION_SUMMATION_H */
@@ -34,6 +34,10 @@ namespace dials { namespace algorithms { namespace polygon { namespace clip {
       def("quad_with_convex_quad",
           &quad_with_convex_quad,
           (arg("subject"), arg("target")));
+      def("triangle_with_rect_area",
+          &triangle_with_rect_area,
+          (arg("subject"), arg("rect")));
+      def("quad_with_rect_area", &quad_with_rect_area, (arg("subject"), arg("rect")));
       def("line_with_rect", &line_with_rect, (arg("line"), arg("rect")));
     }
 
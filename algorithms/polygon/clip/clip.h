@@ -101,6 +101,28 @@ namespace dials { namespace algorithms { namespace polygon { namespace clip {
     return sutherland_hodgman_simple_convex<vert4, vert4, vert8, 8>(subject, target);
   }
 
+  /**
+   * Clip a convex triangle with an axis aligned rectangle and return the area
+   * of the intersection, without building the clipped polygon.
+   * @param subject The subject polygon
+   * @param rect The rectangle (min and max corners)
+   * @returns The signed area of the intersecting polygon
+   */
+  inline double triangle_with_rect_area(const vert3 &subject, const vert2 &rect) {
+    return sutherland_hodgman_rect_area<3>(subject, rect);
+  }
+
+  /**
+   * Clip a convex quad with an axis aligned rectangle and return the area of
+   * the intersection, without building the clipped polygon.
+   * @param subject The subject polygon
+   * @param rect The rectangle (min and max corners)
+   * @returns The signed area of the intersecting polygon
+   */
+  inline double quad_with_rect_area(const vert4 &subject, const vert2 &rect) {
+    return sutherland_hodgman_rect_area<4>(subject, rect);
+  }
+
   /**
    * Clip a line with an axis aligned bounding box.
    * @param line The line to clip
@@ -314,6 +314,77 @@ namespace dials { namespace algorithms { namespace polygon {
     return result2;
   }
 
+  /**
+   * Clip a polygon by an axis aligned edge. The inside of the edge has the
+   * coordinate on the given axis greater than the value if Greater is true or
+   * less than the value otherwise.
+   * @param input The input vertices
+   * @param n The number of input vertices
+   * @param value The value of the coordinate at the edge
+   * @param output The output vertices (at least n + 1)
+   * @returns The number of output vertices
+   */
+  template <std::size_t Axis, bool Greater, typename PointType>
+  std::size_t sutherland_hodgman_axis_aligned_edge(const PointType *input,
+                                                   std::size_t n,
+                                                   double value,
+                                                   PointType *output) {
+    const std::size_t other = 1 - Axis;
+    std::size_t m = 0;
+    if (n == 0) {
+      return m;
+    }
+    PointType p1 = input[n - 1];
+    bool inside1 = Greater ? p1[Axis] > value : p1[Axis] < value;
+    for (std::size_t k = 0; k < n; ++k) {
+      PointType p2 = input[k];
+      bool inside2 = Greater ? p2[Axis] > value : p2[Axis] < value;
+      if (inside1 != inside2) {
+        double t = (value - p1[Axis]) / (p2[Axis] - p1[Axis]);
+        output[m][Axis] = value;
+        output[m][other] = p1[other] + t * (p2[other] - p1[other]);
+        ++m;
+      }
+      if (inside2) {
+        output[m++] = p2;
+      }
+      p1 = p2;
+      inside1 = inside2;
+    }
+    return m;
+  }
+
+  /**
+   * Clip a convex polygon with N vertices against an axis aligned rectangle
+   * and return the signed area of the result. The polygon is clipped by the
+   * left, bottom, right and top edges in turn in fixed size buffers on the
+   * stack, so nothing is allocated. Each edge adds at most one vertex to a
+   * convex polygon, so the buffers hold N + 4 vertices.
+   * @param poly The polygon to clip
+   * @param rect The rectangle to clip against (min and max corners)
+   * @returns The area of the clipped polygon.
+   */
+  template <std::size_t N, typename PolygonType, typename RectType>
+  double sutherland_hodgman_rect_area(const PolygonType &poly, const RectType &rect) {
+    typedef typename PolygonType::value_type PointType;
+    DIALS_ASSERT(poly.size() == N);
+    PointType buffer1[N + 4];
+    PointType buffer2[N + 4];
+    for (std::size_t k = 0; k < N; ++k) {
+      buffer1[k] = poly[k];
+    }
+    std::size_t n = N;
+    n = sutherland_hodgman_axis_aligned_edge<0, true>(buffer1, n, rect[0][0], buffer2);
+    n = sutherland_hodgman_axis_aligned_edge<1, true>(buffer2, n, rect[0][1], buffer1);
+    n = sutherland_hodgman_axis_aligned_edge<0, false>(buffer1, n, rect[1][0], buffer2);
+    n = sutherland_hodgman_axis_aligned_edge<1, false>(buffer2, n, rect[1][1], buffer1);
+    double area = 0.0;
+    for (std::size_t k = 0, l = n - 1; k < n; l = k++) {
+      area += buffer1[l][0] * buffer1[k][1] - buffer1[k][0] * buffer1[l][1];
+    }
+    return area * 0.5;
+  }
+
 }}}  // namespace dials::algorithms::polygon
 
 #endif /* DIALS_ALGORITHMS_POLYGON_CLIPPING_SUTHERLAND_HODGMAN_H */
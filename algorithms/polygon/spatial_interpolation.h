@@ -24,9 +24,9 @@ namespace dials { namespace algorithms { namespace polygon {
   namespace spatial_interpolation {
 
     using dials::algorithms::polygon::simple_area;
-    using dials::algorithms::polygon::clip::quad_with_convex_quad;
+    using dials::algorithms::polygon::clip::quad_with_rect_area;
+    using dials::algorithms::polygon::clip::vert2;
     using dials::algorithms::polygon::clip::vert4;
-    using dials::algorithms::polygon::clip::vert8;
     using scitbx::vec2;
     using scitbx::af::double4;
     using scitbx::af::int2;
@@ -87,33 +87,31 @@ namespace dials { namespace algorithms { namespace polygon {
     }
 
     /**
-     * Get the intersection of a quad with a regular grid point
+     * Get the intersection of a quad with a regular grid point.
      * @param a The quad
      * @param i The fast grid index
      * @param j The slow grid index
      * @returns The area
      */
     inline double quad_grid_intersection_area(const vert4 &a, int i, int j) {
-      vert4 b(vec2<double>(i, j),
-              vec2<double>(i + 1, j),
-              vec2<double>(i + 1, j + 1),
-              vec2<double>(i, j + 1));
-      return simple_area(quad_with_convex_quad(a, b));
+      vert2 rect(vec2<double>(i, j), vec2<double>(i + 1, j + 1));
+      return quad_with_rect_area(a, rect);
     }
 
     /**
-     * Get the overlaps between an input quad and the grid points
+     * Get the overlaps between an input quad and the grid points and append
+     * them to an existing list of matches
      * @param input The quad
      * @param output_size The size of the output grid
      * @param index The index of the quad
-     * @returns The matches between the quad and the grid
+     * @param matches The list of matches to append to
      */
-    inline af::shared<Match> quad_to_grid(vert4 input,
-                                          af::c_grid<2> output_size,
-                                          int index) {
-      af::shared<Match> matches;
+    inline void quad_to_grid(vert4 input,
+                             af::c_grid<2> output_size,
+                             int index,
+                             af::shared<Match> &matches) {
       int4 range = quad_grid_range(input, output_size);
-      if (range[0] >= range[1] || range[2] >= range[3]) return matches;
+      if (range[0] >= range[1] || range[2] >= range[3]) return;
       double target_area = reverse_quad_inplace_if_backward(input);
       for (std::size_t jj = range[2]; jj < range[3]; ++jj) {
         for (std::size_t ii = range[0]; ii < range[1]; ++ii) {
@@ -124,6 +122,20 @@ namespace dials { namespace algorithms { namespace polygon {
           }
         }
       }
+    }
+
+    /**
+     * Get the overlaps between an input quad and the grid points
+     * @param input The quad
+     * @param output_size The size of the output grid
+     * @param index The index of the quad
+     * @returns The matches between the quad and the grid
+     */
+    inline af::shared<Match> quad_to_grid(vert4 input,
+                                          af::c_grid<2> output_size,
+                                          int index) {
+      af::shared<Match> matches;
+      quad_to_grid(input, output_size, index, matches);
       return matches;
     }
 
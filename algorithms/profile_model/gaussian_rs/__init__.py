@@ -18,6 +18,7 @@
     PartialityCalculator3D,
     PartialityCalculatorIface,
     PartialityMultiCalculator,
+    PixelDirectionTable,
     ideal_profile_double,
     ideal_profile_float,
     zeta_factor,
@@ -43,6 +44,7 @@
     "PartialityCalculator3D",
     "PartialityCalculatorIface",
     "PartialityMultiCalculator",
+    "PixelDirectionTable",
     "ideal_profile_double",
     "ideal_profile_float",
     "phil_scope",
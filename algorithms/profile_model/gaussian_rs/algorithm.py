@@ -1,13 +1,34 @@
 from __future__ import absolute_import, division, print_function
 
 
+def pixel_direction_tables(experiments):
+    """
+    Create a pixel direction table for each detector
+
+    :param experiments: The experiment list
+    :return: The table for each experiment
+    """
+    from dials.algorithms.profile_model.gaussian_rs import PixelDirectionTable
+
+    detectors = []
+    tables = []
+    for experiment in experiments:
+        for detector, table in zip(detectors, tables):
+            if detector is experiment.detector:
+                break
+        else:
+            detectors.append(experiment.detector)
+            tables.append(PixelDirectionTable(experiment.detector))
+    return [tables[detectors.index(e.detector)] for e in experiments]
+
+
 class GaussianRSMaskCalculatorFactory(object):
     """
     Factory class for mask calculator
     """
 
     @staticmethod
-    def create(experiments):
+    def create(experiments, pixel_directions=False):
         """
         Create the mask calculator
         """
@@ -16,8 +37,10 @@ def create(experiments):
             GaussianRSMultiCrystalMaskCalculator,
         )
 
+        if pixel_directions:
+            tables = pixel_direction_tables(experiments)
         result = GaussianRSMultiCrystalMaskCalculator()
-        for e in experiments:
+        for i, e in enumerate(experiments):
             alg = GaussianRSMaskCalculator(
                 e.beam,
                 e.detector,
@@ -26,6 +49,8 @@ def create(experiments):
                 e.profile.delta_b(deg=False),
                 e.profile.delta_m(deg=False),
             )
+            if pixel_directions:
+                alg.set_pixel_direction_table(tables[i])
             result.append(alg)
         return result
 
@@ -54,7 +79,13 @@ class GaussianRSReferenceCalculatorFactory(object):
     """
 
     @staticmethod
-    def create(experiments, grid_size=5, scan_step=5, grid_method="circular_grid"):
+    def create(
+        experiments,
+        grid_size=5,
+        scan_step=5,
+        grid_method="circular_grid",
+        pixel_directions=False,
+    ):
         """
         Create the intensity calculator
         """
@@ -100,8 +131,10 @@ def create(experiments, grid_size=5, scan_step=5, grid_method="circular_grid"):
             raise RuntimeError("Unknown grid type")
 
         # Create the spec list
+        if pixel_directions:
+            tables = pixel_direction_tables(experiments)
         spec_list = []
-        for experiment in experiments:
+        for i, experiment in enumerate(experiments):
 
             spec = TransformSpec(
                 experiment.beam,
@@ -113,6 +146,8 @@ def create(experiments, grid_size=5, scan_step=5, grid_method="circular_grid"):
                 experiment.profile.n_sigma() * 1.5,
                 grid_size,
             )
+            if pixel_directions:
+                spec.set_pixel_direction_table(tables[i])
 
             spec_list.append(spec)
 
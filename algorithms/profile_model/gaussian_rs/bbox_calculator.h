@@ -12,6 +12,7 @@
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_BBOX_CALCULATOR_H
 
 #include <cmath>
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <scitbx/constants.h>
 #include <scitbx/vec3.h>
@@ -23,6 +24,7 @@
 #include <dxtbx/model/scan.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials {
   namespace algorithms {
@@ -57,11 +59,56 @@ namespace dials {
     virtual af::shared<int6> array(const af::const_ref<vec3<double> > &s1,
                                    const af::const_ref<double> &frame,
                                    const af::const_ref<std::size_t> &panel) const = 0;
+
+    /**
+     * Calculate the rois for an array of reflections with the reflections
+     * split between a number of threads.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param panel The array of panel numbers
+     * @param nthreads The number of threads
+     */
+    af::shared<int6> array(const af::const_ref<vec3<double> > &s1,
+                           const af::const_ref<double> &frame,
+                           const af::const_ref<std::size_t> &panel,
+                           std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == panel.size());
+      af::shared<int6> result(s1.size(), af::init_functor_null<int6>());
+      detail::parallel_bands(boost::bind(&BBoxCalculatorIface::array_range,
+                                         this,
+                                         boost::cref(s1),
+                                         boost::cref(frame),
+                                         boost::cref(panel),
+                                         result.ref(),
+                                         _1,
+                                         _2),
+                             s1.size(),
+                             nthreads);
+      return result;
+    }
+
+  private:
+    /**
+     * Calculate the rois for a range of reflections
+     */
+    void array_range(const af::const_ref<vec3<double> > &s1,
+                     const af::const_ref<double> &frame,
+                     const af::const_ref<std::size_t> &panel,
+                     af::ref<int6> result,
+                     std::size_t first,
+                     std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        result[i] = single(s1[i], frame[i], panel[i]);
+      }
+    }
   };
 
   /** Calculate the bounding box for each reflection */
   class BBoxCalculator3D : public BBoxCalculatorIface {
   public:
+    using BBoxCalculatorIface::array;
+
     /**
      * Initialise the bounding box calculation.
      * @param beam The beam parameters
@@ -245,6 +292,8 @@ namespace dials {
   /** Calculate the bounding box for each reflection */
   class BBoxCalculator2D : public BBoxCalculatorIface {
   public:
+    using BBoxCalculatorIface::array;
+
     /**
      * Initialise the bounding box calculation.
      * @param beam The beam parameters
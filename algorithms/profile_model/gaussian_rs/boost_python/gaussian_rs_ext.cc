@@ -8,16 +8,21 @@
  *  This code is distributed under the BSD license, a copy of which is
  *  included in the root directory of this package.
  */
+#include <algorithm>
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <boost_adaptbx/std_pair_conversion.h>
+#include <scitbx/array_family/flex_types.h>
 #include <dials/algorithms/profile_model/gaussian_rs/bbox_calculator.h>
 #include <dials/algorithms/profile_model/gaussian_rs/partiality_calculator.h>
 #include <dials/algorithms/profile_model/gaussian_rs/mask_calculator.h>
+#include <dials/algorithms/profile_model/gaussian_rs/pixel_direction_table.h>
 #include <dials/algorithms/profile_model/gaussian_rs/ideal_profile.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
 #include <dials/algorithms/profile_model/gaussian_rs/modeller.h>
 #include <dials/algorithms/profile_model/modeller/boost_python/empirical_profile_modeller_wrapper.h>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials {
   namespace algorithms {
@@ -85,10 +90,10 @@ namespace dials {
         for (std::size_t i = 0; i < obj.size(); ++i) {
           nref_list.append(obj.n_reflections(i));
           try {
-            data_list.append(obj.data(i));
+            data_list.append(to_float(obj.data(i)));
             mask_list.append(obj.mask(i));
           } catch (dials::error) {
-            data_list.append(data_type());
+            data_list.append(to_float(data_type()));
             mask_list.append(mask_type());
           }
         }
@@ -108,7 +113,7 @@ namespace dials {
         DIALS_ASSERT(boost::python::len(data_list) == obj.size());
         DIALS_ASSERT(boost::python::len(nref_list) == obj.size());
         for (std::size_t i = 0; i < obj.size(); ++i) {
-          af::flex_double d = boost::python::extract<af::flex_double>(data_list[i]);
+          af::flex_double d = to_double(data_list[i]);
           af::flex_bool m = boost::python::extract<af::flex_bool>(mask_list[i]);
           DIALS_ASSERT(d.accessor().all().size() == 3);
           DIALS_ASSERT(m.accessor().all().size() == 3);
@@ -118,6 +123,33 @@ namespace dials {
         }
         obj.set_finalized(finalized);
       }
+
+      /**
+       * The profiles are pickled in single precision to halve the size of
+       * the state passed between processes.
+       */
+      static af::flex_float to_float(
+        const GaussianRSProfileModeller::data_type& data) {
+        af::c_grid<3> grid = data.accessor();
+        af::flex_float result(af::flex_grid<>(grid[0], grid[1], grid[2]));
+        std::copy(data.begin(), data.end(), result.begin());
+        return result;
+      }
+
+      /**
+       * Get the double precision profile from the state. Profiles pickled in
+       * double precision are also accepted.
+       */
+      static af::flex_double to_double(boost::python::object data) {
+        boost::python::extract<af::flex_float> get_float(data);
+        if (!get_float.check()) {
+          return boost::python::extract<af::flex_double>(data)();
+        }
+        af::flex_float d = get_float();
+        af::flex_double result(d.accessor());
+        std::copy(d.begin(), d.end(), result.begin());
+        return result;
+      }
     };
 
     void export_modeller() {
@@ -144,6 +176,11 @@ namespace dials {
                   int,
                   int>())
         .def("coord", &GaussianRSProfileModeller::coord)
+        .def("model",
+             static_cast<void (GaussianRSProfileModeller::*)(af::reflection_table,
+                                                             std::size_t)>(
+               &GaussianRSProfileModeller::model),
+             (arg("reflections"), arg("nthreads")))
         .def_pickle(GaussianRSProfileModellerPickleSuite());
 
       scope in_modeller = result;
@@ -165,6 +202,8 @@ namespace dials {
     }
 
     BOOST_PYTHON_MODULE(dials_algorithms_profile_model_gaussian_rs_ext) {
+      dials::util::boost_python::import_memory_accounting();
+      dials::util::boost_python::import_shared_executor();
       export_modeller();
 
       class_<BBoxCalculatorIface, boost::noncopyable>("BBoxCalculatorIface", no_init)
@@ -172,8 +211,13 @@ namespace dials {
              &BBoxCalculatorIface::single,
              (arg("s1"), arg("frame"), arg("panel")))
         .def("__call__",
-             &BBoxCalculatorIface::array,
-             (arg("s1"), arg("frame"), arg("panel")));
+             (af::shared<int6>(BBoxCalculatorIface::*)(
+               const af::const_ref<vec3<double> >&,
+               const af::const_ref<double>&,
+               const af::const_ref<std::size_t>&,
+               std::size_t) const)
+               & BBoxCalculatorIface::array,
+             (arg("s1"), arg("frame"), arg("panel"), arg("nthreads") = 1));
 
       class_<BBoxCalculator3D, bases<BBoxCalculatorIface> >("BBoxCalculator3D", no_init)
         .def(init<const BeamBase&,
@@ -250,6 +294,12 @@ namespace dials {
         .def("__len__", &PartialityMultiCalculator::size)
         .def("__call__", &PartialityMultiCalculator::operator());
 
+      class_<PixelDirectionTable, boost::shared_ptr<PixelDirectionTable> >(
+        "PixelDirectionTable", no_init)
+        .def(init<const Detector&>((arg("detector"))))
+        .def("__len__", &PixelDirectionTable::size)
+        .def("memory", &PixelDirectionTable::memory);
+
       class_<MaskCalculator3D, bases<MaskCalculatorIface> >("MaskCalculator3D", no_init)
         .def(init<const BeamBase&,
                   const Detector&,
@@ -272,7 +322,8 @@ namespace dials {
                                                  arg("goniometer"),
                                                  arg("scan"),
                                                  arg("delta_divergence"),
-                                                 arg("delta_mosaicity"))));
+                                                 arg("delta_mosaicity"))))
+        .def("set_pixel_direction_table", &MaskCalculator3D::set_pixel_direction_table);
 
       class_<MaskCalculator2D, bases<MaskCalculatorIface> >("MaskCalculator2D", no_init)
         .def(init<const BeamBase&, const Detector&, double, double>(
@@ -310,6 +361,7 @@ namespace dials {
         .def("e1_axis", &CoordinateSystem2d::e1_axis)
         .def("e2_axis", &CoordinateSystem2d::e2_axis)
         .def("from_beam_vector", &CoordinateSystem2d::from_beam_vector)
+        .def("from_beam_vector", &CoordinateSystem2d::from_beam_vector_array)
         .def("to_beam_vector", &CoordinateSystem2d::to_beam_vector);
 
       // Export coordinate system
@@ -330,8 +382,11 @@ namespace dials {
         .def("path_length_increase", &CoordinateSystem::path_length_increase)
         .def("limits", &CoordinateSystem::limits)
         .def("from_beam_vector", &CoordinateSystem::from_beam_vector)
+        .def("from_beam_vector", &CoordinateSystem::from_beam_vector_array)
         .def("from_rotation_angle", &CoordinateSystem::from_rotation_angle)
         .def("from_rotation_angle_fast", &CoordinateSystem::from_rotation_angle_fast)
+        .def("from_rotation_angle_fast",
+             &CoordinateSystem::from_rotation_angle_fast_array)
         .def("from_beam_vector_and_rotation_angle",
              &CoordinateSystem::from_beam_vector_and_rotation_angle)
         .def("to_beam_vector", &CoordinateSystem::to_beam_vector)
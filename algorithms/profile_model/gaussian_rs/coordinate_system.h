@@ -15,6 +15,7 @@
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dxtbx/model/panel.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials {
@@ -71,7 +72,10 @@ namespace dials {
           s1_(s1.normalize() * s0.length()),
           p_star_(s1 - s0),
           e1_(s1.cross(s0).normalize()),
-          e2_(s1.cross(e1_).normalize()) {}
+          e2_(s1.cross(e1_).normalize()),
+          s1_length_(s1_.length()),
+          scaled_e1_(e1_ / s1_length_),
+          scaled_e2_(e2_ / s1_length_) {}
 
     /** @returns the incident beam vector */
     vec3<double> s0() const {
@@ -104,11 +108,26 @@ namespace dials {
      * @returns The e1, e2 coordinates
      */
     vec2<double> from_beam_vector(const vec3<double> &s_dash) const {
-      double s1_length = s1_.length();
-      DIALS_ASSERT(s1_length > 0);
-      vec3<double> scaled_e1 = e1_ / s1_length;
-      vec3<double> scaled_e2 = e2_ / s1_length;
-      return vec2<double>(scaled_e1 * (s_dash - s1_), scaled_e2 * (s_dash - s1_));
+      DIALS_ASSERT(s1_length_ > 0);
+      return vec2<double>(scaled_e1_ * (s_dash - s1_), scaled_e2_ * (s_dash - s1_));
+    }
+
+    /**
+     * Transform an array of beam vectors to the reciprocal space coordinate
+     * system.
+     * @param s_dash The beam vectors
+     * @returns The e1, e2 coordinates
+     */
+    af::shared<vec2<double> > from_beam_vector_array(
+      const af::const_ref<vec3<double> > &s_dash) const {
+      DIALS_ASSERT(s1_length_ > 0);
+      af::shared<vec2<double> > result(s_dash.size(),
+                                       af::init_functor_null<vec2<double> >());
+      for (std::size_t i = 0; i < s_dash.size(); ++i) {
+        vec3<double> ds = s_dash[i] - s1_;
+        result[i] = vec2<double>(scaled_e1_ * ds, scaled_e2_ * ds);
+      }
+      return result;
     }
 
     /**
@@ -117,7 +136,7 @@ namespace dials {
      * @returns The beam vector
      */
     vec3<double> to_beam_vector(const vec2<double> &c12) const {
-      double radius = s1_.length();
+      double radius = s1_length_;
       DIALS_ASSERT(radius > 0);
       vec3<double> scaled_e1 = e1_ * radius;
       vec3<double> scaled_e2 = e2_ * radius;
@@ -136,6 +155,9 @@ namespace dials {
     vec3<double> p_star_;
     vec3<double> e1_;
     vec3<double> e2_;
+    double s1_length_;
+    vec3<double> scaled_e1_;
+    vec3<double> scaled_e2_;
   };
 
   /**
@@ -161,7 +183,10 @@ namespace dials {
           e1_(s1.cross(s0).normalize()),
           e2_(s1.cross(e1_).normalize()),
           e3_((s1 + s0).normalize()),
-          zeta_(zeta_factor(m2_, e1_)) {}
+          zeta_(zeta_factor(m2_, e1_)),
+          s1_length_(s1_.length()),
+          scaled_e1_(e1_ / s1_length_),
+          scaled_e2_(e2_ / s1_length_) {}
 
     /** @returns The rotation axis */
     vec3<double> m2() const {
@@ -255,11 +280,26 @@ namespace dials {
      * @returns The e1, e2 coordinates
      */
     vec2<double> from_beam_vector(const vec3<double> &s_dash) const {
-      double s1_length = s1_.length();
-      DIALS_ASSERT(s1_length > 0);
-      vec3<double> scaled_e1 = e1_ / s1_length;
-      vec3<double> scaled_e2 = e2_ / s1_length;
-      return vec2<double>(scaled_e1 * (s_dash - s1_), scaled_e2 * (s_dash - s1_));
+      DIALS_ASSERT(s1_length_ > 0);
+      return vec2<double>(scaled_e1_ * (s_dash - s1_), scaled_e2_ * (s_dash - s1_));
+    }
+
+    /**
+     * Transform an array of beam vectors to the reciprocal space coordinate
+     * system.
+     * @param s_dash The beam vectors
+     * @returns The e1, e2 coordinates
+     */
+    af::shared<vec2<double> > from_beam_vector_array(
+      const af::const_ref<vec3<double> > &s_dash) const {
+      DIALS_ASSERT(s1_length_ > 0);
+      af::shared<vec2<double> > result(s_dash.size(),
+                                       af::init_functor_null<vec2<double> >());
+      for (std::size_t i = 0; i < s_dash.size(); ++i) {
+        vec3<double> ds = s_dash[i] - s1_;
+        result[i] = vec2<double>(scaled_e1_ * ds, scaled_e2_ * ds);
+      }
+      return result;
     }
 
     /**
@@ -285,6 +325,21 @@ namespace dials {
       return zeta_ * (phi_dash - phi_);
     }
 
+    /**
+     * Transform an array of rotation angles to the reciprocal space
+     * coordinate system using the fast approximate method.
+     * @param phi_dash The rotation angles
+     * @returns The e3 coordinates
+     */
+    af::shared<double> from_rotation_angle_fast_array(
+      const af::const_ref<double> &phi_dash) const {
+      af::shared<double> result(phi_dash.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < phi_dash.size(); ++i) {
+        result[i] = zeta_ * (phi_dash[i] - phi_);
+      }
+      return result;
+    }
+
     /**
      * Transform the beam vector and rotation angle to get the full
      * reciprocal space coordinate
@@ -304,7 +359,7 @@ namespace dials {
      * @returns The beam vector
      */
     vec3<double> to_beam_vector(const vec2<double> &c12) const {
-      double radius = s1_.length();
+      double radius = s1_length_;
       DIALS_ASSERT(radius > 0);
       vec3<double> scaled_e1 = e1_ * radius;
       vec3<double> scaled_e2 = e2_ * radius;
@@ -372,6 +427,9 @@ namespace dials {
     vec3<double> e2_;
     vec3<double> e3_;
     double zeta_;
+    double s1_length_;
+    vec3<double> scaled_e1_;
+    vec3<double> scaled_e2_;
   };
 
 }}}}  // namespace dials::algorithms::profile_model::gaussian_rs
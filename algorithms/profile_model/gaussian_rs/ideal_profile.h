@@ -12,6 +12,7 @@
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_IDEAL_PROFILE_H
 
 #include <cmath>
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/error.h>
@@ -35,7 +36,9 @@ namespace dials {
   }
 
   /**
-   * Generate an ideal profile in the reflection frame
+   * Generate an ideal profile in the reflection frame. The gaussian is
+   * separable, so it is evaluated once along an axis and the profile is
+   * the outer product of that with itself.
    * @param size The size of the grid (2 * size + 1)
    * @param nsig The number of standard deviations
    * @returns The profile
@@ -47,15 +50,17 @@ namespace dials {
     size = 2 * size + 1;
     FloatType sig = centre / nsig;
 
+    std::vector<FloatType> g(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      g[i] = evaluate_gaussian<FloatType>(i, centre, sig);
+    }
+
     af::c_grid<3> accessor(size, size, size);
     af::versa<FloatType, af::c_grid<3> > profile(accessor, 0.0);
     for (std::size_t k = 0; k < size; ++k) {
       for (std::size_t j = 0; j < size; ++j) {
         for (std::size_t i = 0; i < size; ++i) {
-          FloatType gx = evaluate_gaussian<FloatType>(i, centre, sig);
-          FloatType gy = evaluate_gaussian<FloatType>(j, centre, sig);
-          FloatType gz = evaluate_gaussian<FloatType>(k, centre, sig);
-          profile(k, j, i) = gx * gy * gz;
+          profile(k, j, i) = g[i] * g[j] * g[k];
         }
       }
     }
@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_MASK_FOREGROUND_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_MASK_FOREGROUND_H
 
+#include <algorithm>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
@@ -21,6 +23,7 @@
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/image_volume.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/shoebox_geometry.h>
 #include <dials/algorithms/shoebox/mask_code.h>
 #include <dials/error.h>
 
@@ -45,6 +48,66 @@ namespace dials {
   using scitbx::vec3;
   using scitbx::af::int6;
 
+  /**
+   * Scratch space for the mask calculation which can be reused for each
+   * reflection in a batch.
+   */
+  struct MaskScratch {
+    std::vector<double> corner;
+    std::vector<double> pixel;
+    std::vector<double> frame;
+  };
+
+  namespace detail {
+
+    /**
+     * Compute the minimum of the values at the four corners of each pixel.
+     * The minimum of each pair of neighbouring corners along a row is taken in
+     * place first so each row is only read twice.
+     * @param corner The (ysize + 1, xsize + 1) corner values (overwritten)
+     * @param ysize The number of rows of pixels
+     * @param xsize The number of columns of pixels
+     * @param pixel The (ysize, xsize) pixel values
+     */
+    inline void min_over_pixel_corners(std::vector<double> &corner,
+                                       std::size_t ysize,
+                                       std::size_t xsize,
+                                       std::vector<double> &pixel) {
+      DIALS_ASSERT(corner.size() == (ysize + 1) * (xsize + 1));
+      pixel.resize(ysize * xsize);
+      for (std::size_t j = 0; j <= ysize; ++j) {
+        double *row = &corner[j * (xsize + 1)];
+        for (std::size_t i = 0; i < xsize; ++i) {
+          row[i] = std::min(row[i], row[i + 1]);
+        }
+      }
+      for (std::size_t j = 0; j < ysize; ++j) {
+        const double *row0 = &corner[j * (xsize + 1)];
+        const double *row1 = row0 + (xsize + 1);
+        double *out = &pixel[j * xsize];
+        for (std::size_t i = 0; i < xsize; ++i) {
+          out[i] = std::min(row0[i], row1[i]);
+        }
+      }
+    }
+
+    /**
+     * Set pixels as foreground if the value of the ellipse equation is at
+     * most one and as background otherwise.
+     * @param pixel The pixel values
+     * @param n The number of pixels
+     * @param mask The mask to set
+     */
+    inline void set_foreground_background(const double *pixel,
+                                          std::size_t n,
+                                          int *mask) {
+      for (std::size_t i = 0; i < n; ++i) {
+        mask[i] |= (pixel[i] <= 1.0) ? Foreground : Background;
+      }
+    }
+
+  }  // namespace detail
+
   /**
    * Interface for bounding mask calculator.
    */
@@ -153,14 +216,83 @@ namespace dials {
                         double frame,
                         std::size_t panel,
                         bool adjacent = false) const {
+      MaskScratch scratch;
+      single(shoebox, s1, frame, panel, adjacent, scratch);
+    }
+
+    /**
+     * Set all the foreground/background pixels in the shoebox mask using the
+     * given scratch space.
+     * @param shoebox The shoebox to mask
+     * @param s1 The beam vector
+     * @param frame The frame number
+     * @param panel The panel number
+     * @param adjacent Is this an adjacent reflection
+     * @param scratch The scratch space
+     */
+    void single(Shoebox<> &shoebox,
+                vec3<double> s1,
+                double frame,
+                std::size_t panel,
+                bool adjacent,
+                MaskScratch &scratch) const {
+      DIALS_ASSERT(shoebox.is_consistent());
+      if (shoebox.flat) {
+        single_flat(shoebox, s1, frame, panel, scratch);
+      } else {
+        CoordinateSystem cs(m2_, s0_, s1, phi(frame));
+        ShoeboxGeometry geometry(detector_[panel],
+                                 cs,
+                                 shoebox.bbox,
+                                 pixel_directions_ ? pixel_directions_->panel(panel)
+                                                   : NULL);
+        single_normal(shoebox, cs, geometry, frame, adjacent, scratch);
+      }
+    }
+
+    /**
+     * Set all the foreground/background pixels in the shoebox mask using the
+     * precomputed shoebox geometry of the reflection.
+     * @param shoebox The shoebox to mask
+     * @param geometry The shoebox geometry
+     * @param frame The frame number
+     * @param panel The panel number
+     * @param adjacent Is this an adjacent reflection
+     */
+    void single(Shoebox<> &shoebox,
+                const ShoeboxGeometry &geometry,
+                double frame,
+                std::size_t panel,
+                bool adjacent = false) const {
       DIALS_ASSERT(shoebox.is_consistent());
+      MaskScratch scratch;
       if (shoebox.flat) {
-        single_flat(shoebox, s1, frame, panel);
+        single_flat(shoebox, geometry.s1(), frame, panel, scratch);
       } else {
-        single_normal(shoebox, s1, frame, panel, adjacent);
+        DIALS_ASSERT(geometry.matches(shoebox.bbox));
+        CoordinateSystem cs(m2_, s0_, geometry.s1(), phi(frame));
+        single_normal(shoebox, cs, geometry, frame, adjacent, scratch);
       }
     }
 
+    /**
+     * Use a table of pixel corner directions instead of computing them for
+     * each reflection
+     * @param table The pixel direction table for the detector or NULL
+     */
+    void set_pixel_direction_table(boost::shared_ptr<PixelDirectionTable> table) {
+      DIALS_ASSERT(!table || table->size() == detector_.size());
+      pixel_directions_ = table;
+    }
+
+    /**
+     * @param frame The frame number
+     * @returns The rotation angle at the frame
+     */
+    double phi(double frame) const {
+      return phi0_ + (frame - index0_) * dphi_;
+    }
+
     /**
      * Mask all the foreground/background pixels for all the shoeboxes
      * @param shoeboxes The shoebox list
@@ -175,8 +307,9 @@ namespace dials {
       DIALS_ASSERT(shoeboxes.size() == s1.size());
       DIALS_ASSERT(shoeboxes.size() == frame.size());
       DIALS_ASSERT(shoeboxes.size() == panel.size());
+      MaskScratch scratch;
       for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
-        this->single(shoeboxes[i], s1[i], frame[i], panel[i]);
+        single(shoeboxes[i], s1[i], frame[i], panel[i], false, scratch);
       }
     }
 
@@ -301,19 +434,21 @@ namespace dials {
     /**
      * Set all the foreground/background pixels in the shoebox mask.
      * @param shoebox The shoebox to mask
-     * @param s1 The beam vector
+     * @param cs The reflection coordinate system
+     * @param geometry The shoebox geometry
      * @param frame The frame number
-     * @param panel The panel number
+     * @param adjacent Is this an adjacent reflection
+     * @param scratch The scratch space
      */
     void single_normal(Shoebox<> &shoebox,
-                       vec3<double> s1,
+                       const CoordinateSystem &cs,
+                       const ShoeboxGeometry &geometry,
                        double frame,
-                       std::size_t panel_number,
-                       bool adjacent = false) const {
+                       bool adjacent,
+                       MaskScratch &scratch) const {
       // Get some bits from the shoebox
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int6 bbox = shoebox.bbox;
-      double phi = phi0_ + (frame - index0_) * dphi_;
       int x0 = bbox[0], x1 = bbox[1];
       int y0 = bbox[2], y1 = bbox[3];
       int z0 = bbox[4], z1 = bbox[5];
@@ -342,16 +477,10 @@ namespace dials {
         }
       }
 
-      // Get the panel
-      const Panel &panel = detector_[panel_number];
-
       // Check the size of the mask
       DIALS_ASSERT(mask.accessor()[0] == zsize);
       DIALS_ASSERT(mask.accessor()[1] == ysize);
       DIALS_ASSERT(mask.accessor()[2] == xsize);
-
-      // Create the coordinate system and generators
-      CoordinateSystem cs(m2_, s0_, s1, phi);
       double s0_length = s0_.length();
 
       // Loop through all the pixels in the shoebox, transform the point
@@ -360,46 +489,44 @@ namespace dials {
       // (c1 / delta_b)^2 + (c2 / delta_b)^2 <= 1
       // Mark those points within as Foreground and those without as
       // Background.
-
-      vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1);
-      double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
-
-      af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
-          vec2<double> gxy = cs.from_beam_vector(
-            panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j), attenuation_length)
-              .normalize()
-            * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
+      std::vector<double> &dxy_array = scratch.corner;
+      dxy_array.resize((ysize + 1) * (xsize + 1));
+      for (int j = 0, l = 0; j <= ysize; ++j) {
+        for (int i = 0; i <= xsize; ++i, ++l) {
+          vec2<double> gxy = geometry.from_corner(j, i, s0_length);
+          dxy_array[l] = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
+        }
+      }
+      std::vector<double> &dxy = scratch.pixel;
+      detail::min_over_pixel_corners(dxy_array, ysize, xsize, dxy);
+
+      // The e3 distance only depends on the frame so compute it once for each
+      // frame in the shoebox. Frames outside the scan are not masked.
+      std::vector<double> &gzc2_array = scratch.frame;
+      gzc2_array.assign(zsize, -1.0);
+      for (std::size_t k = 0; k < zsize; ++k) {
+        if (z0 + (int)k >= index0_ && z0 + (int)k < index1_) {
+          double gz1 = cs.from_rotation_angle_fast(phi0_ + (z0 + k - index0_) * dphi_);
+          double gz2 =
+            cs.from_rotation_angle_fast(phi0_ + (z0 + k + 1 - index0_) * dphi_);
+          double gz = std::abs(gz1) < std::abs(gz2) ? gz1 : gz2;
+          gzc2_array[k] = gz * gz * delta_m_r2;
         }
       }
 
-      for (int j = 0; j < ysize; ++j) {
-        for (int i = 0; i < xsize; ++i) {
-          double dxy1 = dxy_array(j, i);
-          double dxy2 = dxy_array(j + 1, i);
-          double dxy3 = dxy_array(j, i + 1);
-          double dxy4 = dxy_array(j + 1, i + 1);
-          double dxy = std::min(std::min(dxy1, dxy2), std::min(dxy3, dxy4));
-          for (std::size_t k = 0; k < zsize; ++k) {
-            if (z0 + (int)k >= index0_ && z0 + (int)k < index1_) {
-              double gz1 =
-                cs.from_rotation_angle_fast(phi0_ + (z0 + k - index0_) * dphi_);
-              double gz2 =
-                cs.from_rotation_angle_fast(phi0_ + (z0 + k + 1 - index0_) * dphi_);
-              double gz = std::abs(gz1) < std::abs(gz2) ? gz1 : gz2;
-              double gzc2 = gz * gz * delta_m_r2;
-              /* int mask_value = (dxy + gzc2 <= 1.0) ? Foreground : Background; */
-              if (!adjacent) {
-                int mask_value = (dxy <= 1.0) ? Foreground : Background;
-                mask(k, j, i) |= mask_value;
-              } else {
-                if (dxy + gzc2 <= 1.0) {
-                  mask(k, j, i) |= Overlapped;
-                }
-              }
-            }
+      // Mask each frame in turn so the pixels are written in order
+      std::size_t npixels = ysize * xsize;
+      for (std::size_t k = 0; k < zsize; ++k) {
+        double gzc2 = gzc2_array[k];
+        if (gzc2 < 0) {
+          continue;
+        }
+        int *mask_frame = &mask[k * npixels];
+        if (!adjacent) {
+          detail::set_foreground_background(&dxy[0], npixels, mask_frame);
+        } else {
+          for (std::size_t i = 0; i < npixels; ++i) {
+            mask_frame[i] |= (dxy[i] + gzc2 <= 1.0) ? Overlapped : 0;
           }
         }
       }
@@ -411,11 +538,13 @@ namespace dials {
      * @param s1 The beam vector
      * @param frame The frame number
      * @param panel The panel number
+     * @param scratch The scratch space
      */
     void single_flat(Shoebox<> &shoebox,
                      vec3<double> s1,
                      double frame,
-                     std::size_t panel_number) const {
+                     std::size_t panel_number,
+                     MaskScratch &scratch) const {
       // Get some bits from the shoebox
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int6 bbox = shoebox.bbox;
@@ -468,26 +597,18 @@ namespace dials {
       // (c1 / delta_b)^2 + (c2 / delta_b)^2 <= 1
       // Mark those points within as Foreground and those without as
       // Background.
-      af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
+      std::vector<double> &dxy_array = scratch.corner;
+      dxy_array.resize((ysize + 1) * (xsize + 1));
+      for (int j = 0, l = 0; j <= ysize; ++j) {
+        for (int i = 0; i <= xsize; ++i, ++l) {
           vec2<double> gxy = cs.from_beam_vector(
             panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j)).normalize()
             * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
-      for (int j = 0; j < ysize; ++j) {
-        for (int i = 0; i < xsize; ++i) {
-          double dxy1 = dxy_array(j, i);
-          double dxy2 = dxy_array(j + 1, i);
-          double dxy3 = dxy_array(j, i + 1);
-          double dxy4 = dxy_array(j + 1, i + 1);
-          double dxy = std::min(std::min(dxy1, dxy2), std::min(dxy3, dxy4));
-          int mask_value = (dxy <= 1.0) ? Foreground : Background;
-          mask(0, j, i) |= mask_value;
+          dxy_array[l] = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
         }
       }
+      detail::min_over_pixel_corners(dxy_array, ysize, xsize, scratch.pixel);
+      detail::set_foreground_background(&scratch.pixel[0], ysize * xsize, &mask[0]);
     }
 
     Detector detector_;
@@ -499,6 +620,7 @@ namespace dials {
     int index1_;
     af::shared<double> delta_b_r_;
     af::shared<double> delta_m_r_;
+    boost::shared_ptr<PixelDirectionTable> pixel_directions_;
   };
 
   /**
@@ -538,6 +660,26 @@ namespace dials {
                         double frame,
                         std::size_t panel_number,
                         bool adjacent = false) const {
+      MaskScratch scratch;
+      single(shoebox, s1, frame, panel_number, adjacent, scratch);
+    }
+
+    /**
+     * Set all the foreground/background pixels in the shoebox mask using the
+     * given scratch space.
+     * @param shoebox The shoebox to mask
+     * @param s1 The beam vector
+     * @param frame The frame number
+     * @param panel The panel number
+     * @param adjacent Is this an adjacent reflection
+     * @param scratch The scratch space
+     */
+    void single(Shoebox<> &shoebox,
+                vec3<double> s1,
+                double frame,
+                std::size_t panel_number,
+                bool adjacent,
+                MaskScratch &scratch) const {
       DIALS_ASSERT(shoebox.is_consistent());
       // Get some bits from the shoebox
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
@@ -572,26 +714,18 @@ namespace dials {
       // (c1 / delta_b)^2 + (c2 / delta_b)^2 <= 1
       // Mark those points within as Foreground and those without as
       // Background.
-      af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
+      std::vector<double> &dxy_array = scratch.corner;
+      dxy_array.resize((ysize + 1) * (xsize + 1));
+      for (int j = 0, l = 0; j <= ysize; ++j) {
+        for (int i = 0; i <= xsize; ++i, ++l) {
           vec2<double> gxy = cs.from_beam_vector(
             panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j)).normalize()
             * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
-      for (int j = 0; j < ysize; ++j) {
-        for (int i = 0; i < xsize; ++i) {
-          double dxy1 = dxy_array(j, i);
-          double dxy2 = dxy_array(j + 1, i);
-          double dxy3 = dxy_array(j, i + 1);
-          double dxy4 = dxy_array(j + 1, i + 1);
-          double dxy = std::min(std::min(dxy1, dxy2), std::min(dxy3, dxy4));
-          int mask_value = (dxy <= 1.0) ? Foreground : Background;
-          mask(0, j, i) |= mask_value;
+          dxy_array[l] = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
         }
       }
+      detail::min_over_pixel_corners(dxy_array, ysize, xsize, scratch.pixel);
+      detail::set_foreground_background(&scratch.pixel[0], ysize * xsize, &mask[0]);
     }
 
     /**
@@ -608,8 +742,9 @@ namespace dials {
       DIALS_ASSERT(shoeboxes.size() == s1.size());
       DIALS_ASSERT(shoeboxes.size() == frame.size());
       DIALS_ASSERT(shoeboxes.size() == panel.size());
+      MaskScratch scratch;
       for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
-        this->single(shoeboxes[i], s1[i], frame[i], panel[i]);
+        single(shoeboxes[i], s1[i], frame[i], panel[i], false, scratch);
       }
     }
 
@@ -487,6 +487,7 @@ def compute_bbox(
         goniometer=None,
         scan=None,
         sigma_b_multiplier=2.0,
+        nthreads=1,
         **kwargs
     ):
         """Given an experiment and list of reflections, compute the
@@ -498,6 +499,7 @@ def compute_bbox(
         :param detector: The detector model
         :param goniometer: The goniometer model
         :param scan: The scan model
+        :param nthreads: The number of threads to use
         """
         from dials.algorithms.profile_model.gaussian_rs import BBoxCalculator
 
@@ -516,7 +518,10 @@ def compute_bbox(
 
         # Calculate the bounding boxes of all the reflections
         bbox = calculate(
-            reflections["s1"], reflections["xyzcal.px"].parts()[2], reflections["panel"]
+            reflections["s1"],
+            reflections["xyzcal.px"].parts()[2],
+            reflections["panel"],
+            nthreads=nthreads,
         )
 
         # Return the bounding boxes
@@ -12,7 +12,10 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_MODELLER_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_MODELLER_H
 
+#include <algorithm>
 #include <fstream>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/transform.h>
 #include <dials/algorithms/profile_model/modeller/empirical_modeller.h>
 #include <dials/algorithms/profile_model/modeller/single_sampler.h>
@@ -20,14 +23,17 @@
 #include <dials/algorithms/profile_model/modeller/circle_sampler.h>
 #include <dials/algorithms/profile_model/modeller/ewald_sphere_sampler.h>
 #include <dials/algorithms/integration/fit/fitting.h>
+#include <dials/util/thread_pool.h>
 
 namespace dials { namespace algorithms {
 
   using dials::algorithms::profile_model::gaussian_rs::CoordinateSystem;
+  using dials::algorithms::profile_model::gaussian_rs::transform::SparseProfile;
   using dials::algorithms::profile_model::gaussian_rs::transform::TransformForward;
   using dials::algorithms::profile_model::gaussian_rs::transform::TransformReverse;
   using dials::algorithms::profile_model::gaussian_rs::transform::TransformSpec;
   using dials::model::Shoebox;
+  using dials::util::ThreadPool;
   using dxtbx::model::BeamBase;
   using dxtbx::model::Detector;
   using dxtbx::model::Goniometer;
@@ -264,7 +270,20 @@ namespace dials { namespace algorithms {
      * @param reflections The reflection list
      */
     void model(af::reflection_table reflections) {
+      model(reflections, 1);
+    }
+
+    /**
+     * Model the profiles from the reflections. The reflections are split into
+     * contiguous bands and each thread adds its band to its own set of
+     * profiles. These are then added to the model in band order, so the
+     * result only depends on the number of threads.
+     * @param reflections The reflection list
+     * @param nthreads The number of threads
+     */
+    void model(af::reflection_table reflections, std::size_t nthreads) {
       // Check input is OK
+      DIALS_ASSERT(nthreads > 0);
       DIALS_ASSERT(reflections.is_consistent());
       DIALS_ASSERT(reflections.contains("shoebox"));
       DIALS_ASSERT(reflections.contains("flags"));
@@ -280,52 +299,37 @@ namespace dials { namespace algorithms {
       af::const_ref<vec3<double> > xyzpx = reflections["xyzcal.px"];
       af::const_ref<vec3<double> > xyzmm = reflections["xyzcal.mm"];
       af::ref<std::size_t> flags = reflections["flags"];
+      ModelColumns columns = {sbox, partiality, s1, xyzpx, xyzmm, flags};
+
+      // If there is only one band then add the reflections directly
+      std::size_t n = reflections.size();
+      std::size_t nbands = std::min(nthreads, n);
+      if (nbands <= 1) {
+        model_range(*this, columns, 0, n);
+        return;
+      }
 
-      // Loop through all the reflections and add them to the model
-      for (std::size_t i = 0; i < reflections.size(); ++i) {
-        DIALS_ASSERT(sbox[i].is_consistent());
-
-        // Check if we want to use this reflection
-        if (check1(flags[i], partiality[i], sbox[i])) {
-          // Create the coordinate system
-          vec3<double> m2 = spec_.goniometer().get_rotation_axis();
-          vec3<double> s0 = spec_.beam()->get_s0();
-          CoordinateSystem cs(m2, s0, s1[i], xyzmm[i][2]);
-
-          // Create the data array
-          af::versa<double, af::c_grid<3> > data(sbox[i].data.accessor());
-          std::transform(sbox[i].data.begin(),
-                         sbox[i].data.end(),
-                         sbox[i].background.begin(),
-                         data.begin(),
-                         std::minus<double>());
-
-          // Create the mask array
-          af::versa<bool, af::c_grid<3> > mask(sbox[i].mask.accessor());
-          std::transform(sbox[i].mask.begin(),
-                         sbox[i].mask.end(),
-                         mask.begin(),
-                         detail::check_mask_code(Valid | Foreground));
-
-          // Compute the transform
-          TransformForward<double> transform(
-            spec_, cs, sbox[i].bbox, sbox[i].panel, data.const_ref(), mask.const_ref());
-
-          // Get the indices and weights of the profiles
-          af::shared<std::size_t> indices =
-            sampler_->nearest_n(sbox[i].panel, xyzpx[i]);
-          af::shared<double> weights(indices.size());
-          for (std::size_t j = 0; j < indices.size(); ++j) {
-            weights[j] = sampler_->weight(indices[j], sbox[i].panel, xyzpx[i]);
-          }
-
-          // Add the profile
-          add(
-            indices.const_ref(), weights.const_ref(), transform.profile().const_ref());
-
-          // Set the flags
-          flags[i] |= af::UsedInModelling;
+      // Model each band of reflections on a thread
+      std::size_t band_size = (n + nbands - 1) / nbands;
+      boost::ptr_vector<EmpiricalProfileModeller> partial;
+      {
+        ThreadPool pool(nbands);
+        ThreadPool::TaskGroup group(pool);
+        for (std::size_t first = 0; first < n; first += band_size) {
+          partial.push_back(new EmpiricalProfileModeller(size(), datasize(), threshold()));
+          group.post(boost::bind(&GaussianRSProfileModeller::model_range,
+                                 this,
+                                 boost::ref(partial.back()),
+                                 boost::cref(columns),
+                                 first,
+                                 std::min(first + band_size, n)));
         }
+        group.wait();
+      }
+
+      // Add the profiles of each band
+      for (std::size_t i = 0; i < partial.size(); ++i) {
+        accumulate_raw_pointer(&partial[i]);
       }
     }
 
@@ -440,18 +444,19 @@ namespace dials { namespace algorithms {
                                                background.const_ref(),
                                                mask.const_ref());
 
-            // Get the transformed shoebox
-            data_const_reference c = transform.profile().const_ref();
-            data_const_reference b = transform.background().const_ref();
-            mask_const_reference mask2 = transform.mask().const_ref();
-            af::versa<bool, af::c_grid<3> > m(mask2.accessor());
-            DIALS_ASSERT(mask1.size() == mask2.size());
-            for (std::size_t j = 0; j < m.size(); ++j) {
-              m[j] = mask1[j] && mask2[j];
-            }
+            // Get the grid points in both the transformed shoebox and the
+            // reference profile
+            SparseProfile<double> transformed = transform.sparse(mask1);
+            af::shared<double> reference = transformed.gather(p);
+            af::shared<bool> m(transformed.index.size(), true);
 
             // Do the profile fitting
-            ProfileFitter<double> fit(c, b, m.const_ref(), p, 1e-3, 100);
+            ProfileFitter<double> fit(transformed.profile.const_ref(),
+                                      transformed.background.const_ref(),
+                                      m.const_ref(),
+                                      reference.const_ref(),
+                                      1e-3,
+                                      100);
             // DIALS_ASSERT(fit.niter() < 100);
 
             // Set the data in the reflection
@@ -497,7 +502,9 @@ namespace dials { namespace algorithms {
       af::ref<double> intensity_var = reflections["intensity.prf.variance"];
       af::ref<double> reference_cor = reflections["profile.correlation"];
 
-      // Loop through all the reflections and process them
+      // Loop through all the reflections and process them, reusing the work
+      // arrays of the reverse transform
+      TransformReverse transform;
       af::shared<bool> success(reflections.size(), false);
       for (std::size_t i = 0; i < reflections.size(); ++i) {
         DIALS_ASSERT(sbox[i].is_consistent());
@@ -521,10 +528,11 @@ namespace dials { namespace algorithms {
             CoordinateSystem cs(m2, s0, s1[i], xyzmm[i][2]);
 
             // Compute the transform
-            TransformReverse transform(spec_, cs, sbox[i].bbox, sbox[i].panel, d);
+            af::versa<double, af::c_grid<3> > p_arr(sbox[i].data.accessor());
+            transform.compute(spec_, cs, sbox[i].bbox, sbox[i].panel, d, p_arr.ref());
 
             // Get the transformed shoebox
-            data_const_reference p = transform.profile().const_ref();
+            data_const_reference p = p_arr.const_ref();
 
             // Create the data array
             af::versa<double, af::c_grid<3> > c(sbox[i].data.accessor());
@@ -584,8 +592,7 @@ namespace dials { namespace algorithms {
       result.n_reflections_.assign(n_reflections_.begin(), n_reflections_.end());
       for (std::size_t i = 0; i < data_.size(); ++i) {
         if (data_[i].size() > 0) {
-          result.data_[i] = data_type(accessor_, 0);
-          result.mask_[i] = mask_type(accessor_, true);
+          result.allocate_profile(i);
           std::copy(data_[i].begin(), data_[i].end(), result.data_[i].begin());
           std::copy(mask_[i].begin(), mask_[i].end(), result.mask_[i].begin());
         }
@@ -594,6 +601,75 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * The columns of the reflection table used in modelling. These are got
+     * before starting any threads so the threads do not share the handles
+     * to the column data.
+     */
+    struct ModelColumns {
+      af::const_ref<Shoebox<> > sbox;
+      af::const_ref<double> partiality;
+      af::const_ref<vec3<double> > s1;
+      af::const_ref<vec3<double> > xyzpx;
+      af::const_ref<vec3<double> > xyzmm;
+      af::ref<std::size_t> flags;
+    };
+
+    /**
+     * Add a range of reflections to a set of profiles
+     * @param modeller The profiles to add to
+     * @param columns The reflection data
+     * @param first The first reflection
+     * @param last The last reflection
+     */
+    void model_range(EmpiricalProfileModeller &modeller,
+                     const ModelColumns &columns,
+                     std::size_t first,
+                     std::size_t last) const {
+      const af::const_ref<Shoebox<> > &sbox = columns.sbox;
+      vec3<double> m2 = spec_.goniometer().get_rotation_axis();
+      vec3<double> s0 = spec_.beam()->get_s0();
+      for (std::size_t i = first; i < last; ++i) {
+        DIALS_ASSERT(sbox[i].is_consistent());
+
+        // Check if we want to use this reflection
+        if (check1(columns.flags[i], columns.partiality[i], sbox[i])) {
+          // Create the coordinate system
+          CoordinateSystem cs(m2, s0, columns.s1[i], columns.xyzmm[i][2]);
+
+          // Create the data array
+          af::versa<double, af::c_grid<3> > data(sbox[i].data.accessor());
+          std::transform(sbox[i].data.begin(),
+                         sbox[i].data.end(),
+                         sbox[i].background.begin(),
+                         data.begin(),
+                         std::minus<double>());
+
+          // Create the mask array
+          af::versa<bool, af::c_grid<3> > mask(sbox[i].mask.accessor());
+          std::transform(sbox[i].mask.begin(),
+                         sbox[i].mask.end(),
+                         mask.begin(),
+                         detail::check_mask_code(Valid | Foreground));
+
+          // Compute the transform
+          TransformForward<double> transform(
+            spec_, cs, sbox[i].bbox, sbox[i].panel, data.const_ref(), mask.const_ref());
+
+          // Get the indices and weights of the profiles
+          SamplerNeighbours nearest;
+          sampler_->nearest_n_weights(sbox[i].panel, columns.xyzpx[i], nearest);
+
+          // Add the profile
+          modeller.add(
+            nearest.indices(), nearest.weights(), transform.profile().const_ref());
+
+          // Set the flags
+          columns.flags[i] |= af::UsedInModelling;
+        }
+      }
+    }
+
     /**
      * Do we want to use the reflection in profile modelling
      * @param flags The reflection flags
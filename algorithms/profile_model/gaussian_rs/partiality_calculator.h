@@ -111,6 +111,39 @@ namespace dials {
      * @returns The partiality as a fraction of the total phi extent
      */
     virtual double single(vec3<double> s1, double frame, int6 bbox) const {
+      return compute(m2_.normalize(), s1, frame, bbox);
+    }
+
+    /**
+     * Calculate the partiality for an array of reflections. The rotation axis
+     * is normalized once for all the reflections.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bboxes
+     */
+    virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
+                                     const af::const_ref<double> &frame,
+                                     const af::const_ref<int6> &bbox) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == bbox.size());
+      vec3<double> m2 = m2_.normalize();
+      af::shared<double> result(s1.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < s1.size(); ++i) {
+        result[i] = compute(m2, s1[i], frame[i], bbox[i]);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Calculate the partiality of the reflection
+     * @param m2 The normalized rotation axis
+     * @param s1 The diffracted beam vector
+     * @param frame The frame number
+     * @param bbox The bounding box
+     * @returns The partiality as a fraction of the total phi extent
+     */
+    double compute(vec3<double> m2, vec3<double> s1, double frame, int6 bbox) const {
       // Ensure our values are ok
       DIALS_ASSERT(s1.length_sq() > 0);
       DIALS_ASSERT(bbox[4] < bbox[5]);
@@ -137,32 +170,13 @@ namespace dials {
       double phib = scan_.get_angle_from_array_index(bbox[5]);
 
       // Compute the partiality
-      double zeta = profile_model::gaussian_rs::zeta_factor(m2_.normalize(), s0_, s1);
+      double zeta = profile_model::gaussian_rs::zeta_factor(m2, s0_, s1);
       double c = std::abs(zeta) / (sqrt(2.0) * sigma_m);
       double p = 0.5 * (erf(c * (phib - phi)) - erf(c * (phia - phi)));
       DIALS_ASSERT(p >= 0.0 && p <= 1.0);
       return p;
     }
 
-    /**
-     * Calculate the partiality for an array of reflections
-     * @param s1 The array of diffracted beam vectors
-     * @param frame The array of frame numbers.
-     * @param bbox The array of bboxes
-     */
-    virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
-                                     const af::const_ref<double> &frame,
-                                     const af::const_ref<int6> &bbox) const {
-      DIALS_ASSERT(s1.size() == frame.size());
-      DIALS_ASSERT(s1.size() == bbox.size());
-      af::shared<double> result(s1.size(), af::init_functor_null<double>());
-      for (std::size_t i = 0; i < s1.size(); ++i) {
-        result[i] = single(s1[i], frame[i], bbox[i]);
-      }
-      return result;
-    }
-
-  private:
     vec3<double> s0_;
     vec3<double> m2_;
     Scan scan_;
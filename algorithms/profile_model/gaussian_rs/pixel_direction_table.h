@@ -0,0 +1,186 @@
+/*
+ * pixel_direction_table.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PIXEL_DIRECTION_TABLE_H
+#define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PIXEL_DIRECTION_TABLE_H
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/model/detector.h>
+#include <dials/error.h>
+
+namespace dials {
+  namespace algorithms {
+    namespace profile_model {
+      namespace gaussian_rs {
+
+  using dxtbx::model::Detector;
+  using dxtbx::model::Panel;
+  using scitbx::vec2;
+  using scitbx::vec3;
+
+  /**
+   * A table of the unit vectors in the direction of the lab coordinate of each
+   * pixel corner on a panel. The table is stored in single precision and is
+   * only built the first time it is used.
+   *
+   * The lab coordinates depend on the attenuation length if the panel has a
+   * parallax correction. The table is built with the attenuation length at the
+   * centre of the panel, so it can only be used for other attenuation lengths
+   * if the pixel to millimetre conversion does not depend on it.
+   */
+  class PanelDirectionTable : private boost::noncopyable {
+  public:
+    /**
+     * @param panel The panel
+     */
+    PanelDirectionTable(const Panel &panel)
+        : panel_(panel), built_(false), attenuation_length_(0), parallax_(false) {}
+
+    /**
+     * Check if the table gives the pixel corner directions for this
+     * attenuation length, building the table if needed.
+     * @param attenuation_length The attenuation length
+     * @returns True/False the table can be used
+     */
+    bool usable(double attenuation_length) const {
+      build();
+      return !parallax_ || attenuation_length == attenuation_length_;
+    }
+
+    /**
+     * @param x The x pixel coordinate of the corner
+     * @param y The y pixel coordinate of the corner
+     * @returns True/False the corner is in the table
+     */
+    bool contains(int x, int y) const {
+      return x >= 0 && y >= 0 && x < (int)corners_.accessor()[1]
+             && y < (int)corners_.accessor()[0];
+    }
+
+    /**
+     * @param x The x pixel coordinate of the corner
+     * @param y The y pixel coordinate of the corner
+     * @returns The unit vector to the corner
+     */
+    vec3<double> corner(int x, int y) const {
+      DIALS_ASSERT(contains(x, y));
+      const vec3<float> &v = corners_(y, x);
+      return vec3<double>(v[0], v[1], v[2]);
+    }
+
+    /**
+     * @returns The memory used by the table in bytes
+     */
+    std::size_t memory() const {
+      return built_ ? corners_.size() * sizeof(vec3<float>) : 0;
+    }
+
+  protected:
+    /**
+     * Build the table. This is done once by the first thread to use it.
+     */
+    void build() const {
+      if (built_.load(boost::memory_order_acquire)) {
+        return;
+      }
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (built_.load(boost::memory_order_relaxed)) {
+        return;
+      }
+
+      // Get the attenuation length at the centre of the panel and check
+      // whether the lab coordinates depend on it
+      vec2<std::size_t> image_size = panel_.get_image_size();
+      vec2<double> centre(image_size[0] / 2.0, image_size[1] / 2.0);
+      attenuation_length_ = panel_.attenuation_length(centre);
+      parallax_ = panel_.get_pixel_lab_coord(vec2<double>(0, 0), attenuation_length_)
+                    != panel_.get_pixel_lab_coord(vec2<double>(0, 0),
+                                                  2.0 * attenuation_length_ + 1.0);
+
+      // Compute the direction to each pixel corner
+      std::size_t xsize = image_size[0] + 1;
+      std::size_t ysize = image_size[1] + 1;
+      corners_ = scitbx::af::versa<vec3<float>, scitbx::af::c_grid<2> >(
+        scitbx::af::c_grid<2>(ysize, xsize));
+      for (std::size_t j = 0; j < ysize; ++j) {
+        for (std::size_t i = 0; i < xsize; ++i) {
+          vec3<double> v =
+            panel_.get_pixel_lab_coord(vec2<double>(i, j), attenuation_length_)
+              .normalize();
+          corners_(j, i) = vec3<float>(v[0], v[1], v[2]);
+        }
+      }
+      built_.store(true, boost::memory_order_release);
+    }
+
+    Panel panel_;
+    mutable boost::atomic<bool> built_;
+    mutable boost::mutex mutex_;
+    mutable double attenuation_length_;
+    mutable bool parallax_;
+    mutable scitbx::af::versa<vec3<float>, scitbx::af::c_grid<2> > corners_;
+  };
+
+  /**
+   * The pixel corner direction tables for each panel of a detector. The table
+   * for each panel is built when it is first used, so the memory is only used
+   * for the panels which have reflections.
+   */
+  class PixelDirectionTable {
+  public:
+    /**
+     * @param detector The detector model
+     */
+    PixelDirectionTable(const Detector &detector) {
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        panels_.push_back(
+          boost::shared_ptr<PanelDirectionTable>(new PanelDirectionTable(detector[i])));
+      }
+    }
+
+    /**
+     * @returns The number of panels
+     */
+    std::size_t size() const {
+      return panels_.size();
+    }
+
+    /**
+     * @param panel The panel number
+     * @returns The table for the panel
+     */
+    const PanelDirectionTable *panel(std::size_t panel) const {
+      DIALS_ASSERT(panel < panels_.size());
+      return panels_[panel].get();
+    }
+
+    /**
+     * @returns The memory used by the tables which have been built in bytes
+     */
+    std::size_t memory() const {
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < panels_.size(); ++i) {
+        result += panels_[i]->memory();
+      }
+      return result;
+    }
+
+  protected:
+    std::vector<boost::shared_ptr<PanelDirectionTable> > panels_;
+  };
+
+}}}}  // namespace dials::algorithms::profile_model::gaussian_rs
+
+#endif  // DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PIXEL_DIRECTION_TABLE_H
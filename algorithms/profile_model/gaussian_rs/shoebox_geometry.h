@@ -0,0 +1,158 @@
+/*
+ * shoebox_geometry.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_SHOEBOX_GEOMETRY_H
+#define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_SHOEBOX_GEOMETRY_H
+
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/model/panel.h>
+#include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/pixel_direction_table.h>
+#include <dials/error.h>
+
+namespace dials {
+  namespace algorithms {
+    namespace profile_model {
+      namespace gaussian_rs {
+
+  using dxtbx::model::Panel;
+  using scitbx::vec2;
+  using scitbx::vec3;
+  using scitbx::af::int6;
+
+  /**
+   * The geometry of a reflection shoebox which is needed both to compute the
+   * mask and to transform the shoebox to the reciprocal space grid. This holds
+   * the directions of the lab coordinates of the pixel corners of the shoebox,
+   * the e1 and e2 axes of the coordinate system scaled by 1 / |s1| and zeta.
+   * These only depend on the diffracted beam vector, the panel and the x and y
+   * extent of the shoebox, so they can be computed once for a reflection and
+   * shared by each stage instead of calling Panel::get_pixel_lab_coord for
+   * each corner in each stage.
+   */
+  class ShoeboxGeometry {
+  public:
+    /**
+     * Compute the geometry
+     * @param panel The panel
+     * @param cs The reflection coordinate system
+     * @param bbox The shoebox bounding box
+     * @param table The pixel direction table for the panel or NULL
+     */
+    ShoeboxGeometry(const Panel &panel,
+                    const CoordinateSystem &cs,
+                    const int6 &bbox,
+                    const PanelDirectionTable *table = NULL)
+        : s1_(cs.s1()),
+          zeta_(cs.zeta()),
+          x0_(bbox[0]),
+          x1_(bbox[1]),
+          y0_(bbox[2]),
+          y1_(bbox[3]) {
+      DIALS_ASSERT(x1_ > x0_);
+      DIALS_ASSERT(y1_ > y0_);
+      double s1_length = s1_.length();
+      DIALS_ASSERT(s1_length > 0);
+      e1_ = cs.e1_axis() / s1_length;
+      e2_ = cs.e2_axis() / s1_length;
+
+      // The attenuation length at the centre of the spot is used for every
+      // pixel corner in the shoebox
+      vec2<double> centroid_px = panel.get_ray_intersection_px(s1_);
+      double attenuation_length = panel.attenuation_length(centroid_px);
+
+      // Compute the direction to each pixel corner, taking them from the
+      // table where possible
+      if (table != NULL && !table->usable(attenuation_length)) {
+        table = NULL;
+      }
+      int xsize = x1_ - x0_;
+      int ysize = y1_ - y0_;
+      corners_ = scitbx::af::versa<vec3<double>, scitbx::af::c_grid<2> >(
+        scitbx::af::c_grid<2>(ysize + 1, xsize + 1));
+      for (int j = 0; j <= ysize; ++j) {
+        for (int i = 0; i <= xsize; ++i) {
+          int x = x0_ + i;
+          int y = y0_ + j;
+          if (table != NULL && table->contains(x, y)) {
+            corners_(j, i) = table->corner(x, y);
+          } else {
+            corners_(j, i) =
+              panel.get_pixel_lab_coord(vec2<double>(x, y), attenuation_length)
+                .normalize();
+          }
+        }
+      }
+    }
+
+    /**
+     * Check the geometry is for the given shoebox
+     * @param bbox The bounding box
+     * @returns True/False the geometry can be used
+     */
+    bool matches(const int6 &bbox) const {
+      return bbox[0] == x0_ && bbox[1] == x1_ && bbox[2] == y0_ && bbox[3] == y1_;
+    }
+
+    /** @returns The diffracted beam vector */
+    vec3<double> s1() const {
+      return s1_;
+    }
+
+    /** @returns The e1 axis divided by |s1| */
+    vec3<double> scaled_e1_axis() const {
+      return e1_;
+    }
+
+    /** @returns The e2 axis divided by |s1| */
+    vec3<double> scaled_e2_axis() const {
+      return e2_;
+    }
+
+    /** @returns The zeta factor */
+    double zeta() const {
+      return zeta_;
+    }
+
+    /**
+     * @param j The y index of the corner in the shoebox
+     * @param i The x index of the corner in the shoebox
+     * @returns The unit vector in the direction of the pixel corner
+     */
+    const vec3<double> &corner(std::size_t j, std::size_t i) const {
+      return corners_(j, i);
+    }
+
+    /**
+     * Get the e1 and e2 coordinates of a pixel corner. This gives the same
+     * result as CoordinateSystem::from_beam_vector of the corner direction
+     * scaled to the given length.
+     * @param j The y index of the corner in the shoebox
+     * @param i The x index of the corner in the shoebox
+     * @param length The length of the beam vector
+     * @returns The e1 and e2 coordinates
+     */
+    vec2<double> from_corner(std::size_t j, std::size_t i, double length) const {
+      vec3<double> ds = corners_(j, i) * length - s1_;
+      return vec2<double>(e1_ * ds, e2_ * ds);
+    }
+
+  protected:
+    vec3<double> s1_;
+    vec3<double> e1_;
+    vec3<double> e2_;
+    double zeta_;
+    int x0_, x1_, y0_, y1_;
+    scitbx::af::versa<vec3<double>, scitbx::af::c_grid<2> > corners_;
+  };
+
+}}}}  // namespace dials::algorithms::profile_model::gaussian_rs
+
+#endif  // DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_SHOEBOX_GEOMETRY_H
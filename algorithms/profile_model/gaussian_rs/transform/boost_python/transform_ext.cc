@@ -233,6 +233,7 @@ namespace dials {
         .def("grid_size", &TransformSpec::grid_size)
         .def("step_size", &TransformSpec::step_size)
         .def("grid_centre", &TransformSpec::grid_centre)
+        .def("set_pixel_direction_table", &TransformSpec::set_pixel_direction_table)
         .def_pickle(TransformSpecPickleSuite());
 
       transform_forward_wrapper<double>("TransformForward");
@@ -13,6 +13,7 @@
 
 #include <cmath>
 #include <algorithm>
+#include <vector>
 #include <boost/math/special_functions/erf.hpp>
 #include <scitbx/constants.h>
 #include <scitbx/vec2.h>
@@ -34,6 +35,83 @@ namespace dials {
     using boost::math::erf;
     using scitbx::vec2;
 
+    namespace detail {
+
+      /**
+       * The range of phi covered by each frame and the erf at each end
+       */
+      struct FrameEnds {
+        std::vector<double> a, b, erf_a, erf_b;
+
+        /**
+         * @param j0 The first frame
+         * @param j1 The last frame
+         * @param starting_frame The first frame of the scan
+         * @param starting_angle The angle at the first frame of the scan
+         * @param oscillation The angular range covered by each frame
+         * @param phi The rotation angle of the reflection
+         * @param sigr2 The scale of the erf argument
+         */
+        FrameEnds(int j0,
+                  int j1,
+                  int starting_frame,
+                  double starting_angle,
+                  double oscillation,
+                  double phi,
+                  double sigr2)
+            : a(j1 - j0), b(j1 - j0), erf_a(j1 - j0), erf_b(j1 - j0) {
+          for (int j = j0; j < j1; ++j) {
+            std::size_t k = j - j0;
+            a[k] = starting_angle + (j - starting_frame) * oscillation;
+            b[k] = a[k] + oscillation;
+            erf_a[k] = erf((a[k] - phi) * sigr2);
+            erf_b[k] = erf((b[k] - phi) * sigr2);
+          }
+        }
+      };
+
+      /**
+       * The range of phi covered by each grid point and the erf at each end.
+       * Neighbouring grid points share an end.
+       */
+      struct GridEnds {
+        std::vector<double> a, b, erf_a, erf_b;
+
+        /**
+         * @param v30 The first grid point relative to the centre
+         * @param v31 The last grid point relative to the centre
+         * @param step_size The size of each grid point
+         * @param phi The rotation angle of the reflection
+         * @param zeta The lorentz correction factor
+         * @param sigr2 The scale of the erf argument
+         */
+        GridEnds(int v30,
+                 int v31,
+                 double step_size,
+                 double phi,
+                 double zeta,
+                 double sigr2)
+            : a(v31 - v30), b(v31 - v30), erf_a(v31 - v30), erf_b(v31 - v30) {
+          std::vector<double> x(v31 - v30 + 1);
+          std::vector<double> erf_x(x.size());
+          for (std::size_t k = 0; k < x.size(); ++k) {
+            x[k] = ((v30 + (int)k - 0.5) * step_size) / zeta + phi;
+            erf_x[k] = erf((x[k] - phi) * sigr2);
+          }
+          for (std::size_t k = 0; k < a.size(); ++k) {
+            std::size_t ka = k + 1;
+            std::size_t kb = k;
+            if (x[ka] > x[kb]) std::swap(ka, kb);
+            a[k] = x[ka];
+            b[k] = x[kb];
+            erf_a[k] = erf_x[ka];
+            erf_b[k] = erf_x[kb];
+          }
+        }
+      };
+
+    }  // namespace detail
+
     /**
      * A class to calculate calculate the fraction of counts contributed by each
      * data frame, j, around the reflection to each grid point, v3 in the profile
@@ -129,17 +207,24 @@ namespace dials {
       DIALS_ASSERT(mosaicity_ > 0);
       double sigr2 = std::abs(zeta) / (std::sqrt(2.0) * mosaicity_);
 
+      // The ends of the intersections below are always the ends of a frame or
+      // a grid point, so compute the erf at each of these once.
+      detail::FrameEnds frame_ends(
+        j0, j1, starting_frame_, starting_angle_, oscillation_, phi, sigr2);
+      detail::GridEnds grid_ends(
+        -offset, v31 - offset, step_size_e3_, phi, zeta, sigr2);
+
       // Loop over all j data frames in the region around the reflection
       for (int i = 0, j = j0; j < j1; ++j) {
         // The data frame j covers the range of phi such that
         // rj = {phi':phi0 + j*dphi <= phi' >= phi0 + (j+1)*dpi}
         // Therefore the range of phi for j is given as follows.
-        double aj = starting_angle_ + (j - starting_frame_) * oscillation_;
-        double bj = aj + oscillation_;
+        double aj = frame_ends.a[j - j0];
+        double bj = frame_ends.b[j - j0];
 
         // Calculate the integral over rj (leaving out scaling factors):
         // I[exp(-(phi' - phi)^2 / (2 sigma^2)]
-        double integral_j = (erf((bj - phi) * sigr2) - erf((aj - phi) * sigr2));
+        double integral_j = frame_ends.erf_b[j - j0] - frame_ends.erf_a[j - j0];
 
         // If integral is zero then set fractions to 0.0
         if (integral_j == 0.0) {
@@ -154,13 +239,14 @@ namespace dials {
             // The grid coordinate v3 cover the range phi such that
             // rv3 = {phi':(v3 - 0.5)d3 <= (phi' - phi)zeta <= (v3 + 0.5)d3}
             // Therefore the range of phi for v3 is given as follows.
-            double bv3 = ((v3 - offset - 0.5) * step_size_e3_) / zeta + phi;
-            double av3 = ((v3 - offset + 0.5) * step_size_e3_) / zeta + phi;
-            if (av3 > bv3) std::swap(av3, bv3);
+            double av3 = grid_ends.a[v3 - v30];
+            double bv3 = grid_ends.b[v3 - v30];
 
             // We need to integrate over the intersection of sets rv3 and rj
-            double av3j = std::max(av3, aj);
-            double bv3j = std::min(bv3, bj);
+            bool a_is_frame = av3 < aj;
+            bool b_is_frame = bj < bv3;
+            double av3j = a_is_frame ? aj : av3;
+            double bv3j = b_is_frame ? bj : bv3;
 
             // If there is no intersection then set the fraction of the
             // counts contributed by data frame j to grid coordinate v3 to
@@ -169,8 +255,11 @@ namespace dials {
             if (av3j >= bv3j) {
               fraction[i] = 0.0;
             } else {
-              fraction[i] = (FloatType)(
-                (erf((bv3j - phi) * sigr2) - erf((av3j - phi) * sigr2)) * integral_j_r);
+              double erf_a =
+                a_is_frame ? frame_ends.erf_a[j - j0] : grid_ends.erf_a[v3 - v30];
+              double erf_b =
+                b_is_frame ? frame_ends.erf_b[j - j0] : grid_ends.erf_b[v3 - v30];
+              fraction[i] = (FloatType)((erf_b - erf_a) * integral_j_r);
             }
 
             // Increment array index
@@ -275,18 +364,23 @@ namespace dials {
       DIALS_ASSERT(mosaicity_ > 0);
       double sigr2 = std::abs(zeta) / (std::sqrt(2.0) * mosaicity_);
 
+      // The ends of the intersections below are always the ends of a frame or
+      // a grid point, so compute the erf at each of these once.
+      detail::FrameEnds frame_ends(
+        j0, j1, starting_frame_, starting_angle_, oscillation_, phi, sigr2);
+      detail::GridEnds grid_ends(v30, v31, step_size_e3_, phi, zeta, sigr2);
+
       // Loop over all v3 grid points in the profile
       for (int i = 0, v3 = v30; v3 < v31; ++v3) {
         // The grid coordinate v3 cover the range phi such that
         // rv3 = {phi':(v3 - 0.5)d3 <= (phi' - phi)zeta <= (v3 + 0.5)d3}
         // Therefore the range of phi for v3 is given as follows.
-        double bv3 = ((v3 - 0.5) * step_size_e3_) / zeta + phi;
-        double av3 = ((v3 + 0.5) * step_size_e3_) / zeta + phi;
-        if (av3 > bv3) std::swap(av3, bv3);
+        double av3 = grid_ends.a[v3 - v30];
+        double bv3 = grid_ends.b[v3 - v30];
 
         // Calculate the integral over rv3 (leaving out scaling factors):
         // I[exp(-(phi' - phi)^2 / (2 sigma^2)]
-        double integral_v3 = (erf((bv3 - phi) * sigr2) - erf((av3 - phi) * sigr2));
+        double integral_v3 = grid_ends.erf_b[v3 - v30] - grid_ends.erf_a[v3 - v30];
 
         // If integral is zero then set fractions to 0.0
         if (integral_v3 == 0.0) {
@@ -301,12 +395,14 @@ namespace dials {
             // The data frame j covers the range of phi such that
             // rj = {phi':phi0 + j*dphi <= phi' >= phi0 + (j+1)*dpi}
             // Therefore the range of phi for j is given as follows.
-            double aj = starting_angle_ + (j - starting_frame_) * oscillation_;
-            double bj = aj + oscillation_;
+            double aj = frame_ends.a[j - j0];
+            double bj = frame_ends.b[j - j0];
 
             // We need to integrate over the intersection of sets rv3 and rj
-            double av3j = std::max(av3, aj);
-            double bv3j = std::min(bv3, bj);
+            bool a_is_frame = av3 < aj;
+            bool b_is_frame = bj < bv3;
+            double av3j = a_is_frame ? aj : av3;
+            double bv3j = b_is_frame ? bj : bv3;
 
             // If there is no intersection then set the fraction of the
             // counts contributed by data frame j to grid coordinate v3 to
@@ -315,9 +411,11 @@ namespace dials {
             if (av3j >= bv3j) {
               fraction[i] = 0.0;
             } else {
-              fraction[i] =
-                (FloatType)((erf((bv3j - phi) * sigr2) - erf((av3j - phi) * sigr2))
-                            * integral_v3_r);
+              double erf_a =
+                a_is_frame ? frame_ends.erf_a[j - j0] : grid_ends.erf_a[v3 - v30];
+              double erf_b =
+                b_is_frame ? frame_ends.erf_b[j - j0] : grid_ends.erf_b[v3 - v30];
+              fraction[i] = (FloatType)((erf_b - erf_a) * integral_v3_r);
             }
 
             // Increment array index
@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_TRANSFORM_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_TRANSFORM_H
 
+#include <algorithm>
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
@@ -20,6 +22,7 @@
 #include <dxtbx/model/scan.h>
 #include <dials/algorithms/polygon/spatial_interpolation.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/shoebox_geometry.h>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/map_frames.h>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/beam_vector_map.h>
 #include <dials/model/data/shoebox.h>
@@ -31,9 +34,9 @@ namespace dials {
   namespace transform {
 
     using dials::algorithms::polygon::simple_area;
-    using dials::algorithms::polygon::clip::quad_with_convex_quad;
+    using dials::algorithms::polygon::clip::quad_with_rect_area;
+    using dials::algorithms::polygon::clip::vert2;
     using dials::algorithms::polygon::clip::vert4;
-    using dials::algorithms::polygon::clip::vert8;
     using dials::algorithms::polygon::spatial_interpolation::Match;
     using dials::algorithms::polygon::spatial_interpolation::quad_to_grid;
     using dials::algorithms::polygon::spatial_interpolation::
@@ -118,6 +121,24 @@ namespace dials {
         return detector_;
       }
 
+      /**
+       * Use a table of pixel corner directions instead of computing them for
+       * each reflection
+       * @param table The pixel direction table for the detector or NULL
+       */
+      void set_pixel_direction_table(boost::shared_ptr<PixelDirectionTable> table) {
+        DIALS_ASSERT(!table || table->size() == detector_.size());
+        pixel_directions_ = table;
+      }
+
+      /**
+       * @param panel The panel number
+       * @returns The pixel direction table for the panel or NULL
+       */
+      const PanelDirectionTable *pixel_directions(std::size_t panel) const {
+        return pixel_directions_ ? pixel_directions_->panel(panel) : NULL;
+      }
+
       /** @return the goniometer */
       const Goniometer &goniometer() const {
         return goniometer_;
@@ -175,6 +196,35 @@ namespace dials {
       int3 grid_size_;
       double3 step_size_;
       double3 grid_centre_;
+      boost::shared_ptr<PixelDirectionTable> pixel_directions_;
+    };
+
+    /**
+     * The grid points of a transformed reflection which are used in profile
+     * fitting, stored as the index of each point in the grid and its values.
+     * If the transform has no background then the background is empty.
+     */
+    template <typename FloatType>
+    struct SparseProfile {
+      af::shared<std::size_t> index;
+      af::shared<FloatType> profile;
+      af::shared<FloatType> background;
+
+      /**
+       * Gather the values of another grid, such as a reference profile, at
+       * the same grid points
+       * @param grid The grid to gather from
+       * @returns The values at each grid point
+       */
+      template <typename T>
+      af::shared<T> gather(const af::const_ref<T, af::c_grid<3> > &grid) const {
+        af::shared<T> result(index.size(), af::init_functor_null<T>());
+        for (std::size_t k = 0; k < index.size(); ++k) {
+          DIALS_ASSERT(index[k] < grid.size());
+          result[k] = grid[index[k]];
+        }
+        return result;
+      }
     };
 
     /**
@@ -204,7 +254,10 @@ namespace dials {
                        const af::const_ref<FloatType, af::c_grid<3> > &image,
                        const af::const_ref<bool, af::c_grid<3> > &mask) {
         init(spec, cs, bbox, panel);
-        call(spec.detector()[panel], image, mask);
+        call(ShoeboxGeometry(
+               spec.detector()[panel], cs, bbox, spec.pixel_directions(panel)),
+             image,
+             mask);
       }
 
       TransformForward(const TransformSpec &spec,
@@ -215,7 +268,28 @@ namespace dials {
                        const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
                        const af::const_ref<bool, af::c_grid<3> > &mask) {
         init(spec, cs, bbox, panel);
-        call(spec.detector()[panel], image, bkgrd, mask);
+        call(ShoeboxGeometry(
+               spec.detector()[panel], cs, bbox, spec.pixel_directions(panel)),
+             image,
+             bkgrd,
+             mask);
+      }
+
+      /**
+       * Transform using the precomputed shoebox geometry of the reflection,
+       * saving the pixel corner lab coordinates from being recomputed
+       */
+      TransformForward(const TransformSpec &spec,
+                       const CoordinateSystem &cs,
+                       const ShoeboxGeometry &geometry,
+                       int6 bbox,
+                       std::size_t panel,
+                       const af::const_ref<FloatType, af::c_grid<3> > &image,
+                       const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
+                       const af::const_ref<bool, af::c_grid<3> > &mask) {
+        DIALS_ASSERT(geometry.matches(bbox));
+        init(spec, cs, bbox, panel);
+        call(geometry, image, bkgrd, mask);
       }
 
       /** @returns The transformed profile */
@@ -232,6 +306,30 @@ namespace dials {
         return mask_;
       }
 
+      /**
+       * Gather the grid points which are valid in the transform and in the
+       * given mask, such as the mask of the reference profile, so that the
+       * profile can be fitted without touching the other grid points.
+       * @param mask The mask of grid points to use
+       * @returns The index, profile and background of each grid point
+       */
+      SparseProfile<FloatType> sparse(
+        const af::const_ref<bool, af::c_grid<3> > &mask) const {
+        DIALS_ASSERT(mask.accessor().all_eq(mask_.accessor()));
+        bool has_background = background_.size() == profile_.size();
+        SparseProfile<FloatType> result;
+        for (std::size_t i = 0; i < mask.size(); ++i) {
+          if (mask[i] && mask_[i]) {
+            result.index.push_back(i);
+            result.profile.push_back(profile_[i]);
+            if (has_background) {
+              result.background.push_back(background_[i]);
+            }
+          }
+        }
+        return result;
+      }
+
     private:
       /** Initialise using a coordinate system struct */
       void init(const TransformSpec &spec,
@@ -279,10 +377,11 @@ namespace dials {
 
       /**
        * Map the pixel values from the input image to the output grid.
+       * @param geometry The shoebox geometry
        * @param image The image to transform
        * @param mask The mask accompanying the image
        */
-      void call(const Panel &panel,
+      void call(const ShoeboxGeometry &geometry,
                 const af::const_ref<FloatType, af::c_grid<3> > &image,
                 const af::const_ref<bool, af::c_grid<3> > &mask) {
         // Check the input
@@ -312,43 +411,53 @@ namespace dials {
           }
         }
 
-        vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
-        double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
-
         af::versa<vec2<double>, af::c_grid<2> > gc_array(
           af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
         for (int j = 0; j <= shoebox_size_[1]; ++j) {
           for (int i = 0; i <= shoebox_size_[2]; ++i) {
-            gc_array(j, i) = gc(panel, j, i, attenuation_length);
+            gc_array(j, i) = gc(geometry, j, i);
           }
         }
 
-        // Loop through all the points in the shoebox. Calculate the polygon
-        // formed by the pixel in the local coordinate system. Find the points
+        // Loop through all the points in the shoebox. First map the frames of
+        // the pixel to the frames of the grid. Then calculate the polygon
+        // formed by the pixel in the local coordinate system, find the points
         // on the grid which intersect with the polygon and the fraction of the
-        // pixel area shared with each grid point. For each intersection, loop
-        // through the frames, mapping the fraction of the pixel value in each
-        // frame to the grid point.
+        // pixel area shared with each grid point, and add that fraction of the
+        // mapped frames to each grid point. Pixels which are masked on every
+        // frame contribute nothing so are not mapped to the grid.
         af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
+        std::size_t grid_frame = grid_size_[1] * grid_size_[2];
+        std::vector<FloatType> column(grid_size_[0]);
+        af::shared<Match> matches;
         for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
           for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
+            bool valid = false;
+            std::fill(column.begin(), column.end(), FloatType(0));
+            for (int k = 0; k < shoebox_size_[0]; ++k) {
+              if (mask(k, j, i)) {
+                valid = true;
+                FloatType value = image(k, j, i);
+                const FloatType *zf = &zfraction(k, 0);
+                for (int kk = 0; kk < grid_size_[0]; ++kk) {
+                  column[kk] += value * zf[kk];
+                }
+              }
+            }
+            if (!valid) {
+              continue;
+            }
             vert4 input(gc_array(j, i),
                         gc_array(j, i + 1),
                         gc_array(j + 1, i + 1),
                         gc_array(j + 1, i));
-            af::shared<Match> matches = quad_to_grid(input, grid_size2, 0);
-            for (int m = 0; m < matches.size(); ++m) {
+            matches.clear();
+            quad_to_grid(input, grid_size2, 0, matches);
+            for (std::size_t m = 0; m < matches.size(); ++m) {
               FloatType fraction = matches[m].fraction;
-              int index = matches[m].out;
-              int ii = index % grid_size_[2];
-              int jj = index / grid_size_[2];
-              for (int k = 0; k < shoebox_size_[0]; ++k) {
-                if (mask(k, j, i)) {
-                  FloatType value = image(k, j, i) * fraction;
-                  for (int kk = 0; kk < grid_size_[0]; ++kk) {
-                    profile_(kk, jj, ii) += value * zfraction(k, kk);
-                  }
-                }
+              FloatType *p = &profile_[matches[m].out];
+              for (int kk = 0; kk < grid_size_[0]; ++kk) {
+                p[kk * grid_frame] += fraction * column[kk];
               }
             }
           }
@@ -357,11 +466,12 @@ namespace dials {
 
       /**
        * Map the pixel values from the input image to the output grid.
+       * @param geometry The shoebox geometry
        * @param image The image to transform
        * @param bkgrd The background image to transform
        * @param mask The mask accompanying the image
        */
-      void call(const Panel &panel,
+      void call(const ShoeboxGeometry &geometry,
                 const af::const_ref<FloatType, af::c_grid<3> > &image,
                 const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
                 const af::const_ref<bool, af::c_grid<3> > &mask) {
@@ -394,46 +504,55 @@ namespace dials {
           }
         }
 
-        vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
-        double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
-
         af::versa<vec2<double>, af::c_grid<2> > gc_array(
           af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
         for (int j = 0; j <= shoebox_size_[1]; ++j) {
           for (int i = 0; i <= shoebox_size_[2]; ++i) {
-            gc_array(j, i) = gc(panel, j, i, attenuation_length);
+            gc_array(j, i) = gc(geometry, j, i);
           }
         }
 
-        // Loop through all the points in the shoebox. Calculate the polygon
-        // formed by the pixel in the local coordinate system. Find the points
-        // on the grid which intersect with the polygon and the fraction of the
-        // pixel area shared with each grid point. For each intersection, loop
-        // through the frames, mapping the fraction of the pixel value in each
-        // frame to the grid point.
+        // Loop through all the points in the shoebox, mapping the frames of
+        // the pixel to the frames of the grid and then the pixel to the grid
+        // points it overlaps, as above.
         af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
+        std::size_t grid_frame = grid_size_[1] * grid_size_[2];
+        std::vector<FloatType> icolumn(grid_size_[0]);
+        std::vector<FloatType> bcolumn(grid_size_[0]);
+        af::shared<Match> matches;
         for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
           for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
+            bool valid = false;
+            std::fill(icolumn.begin(), icolumn.end(), FloatType(0));
+            std::fill(bcolumn.begin(), bcolumn.end(), FloatType(0));
+            for (int k = 0; k < shoebox_size_[0]; ++k) {
+              if (mask(k, j, i)) {
+                valid = true;
+                FloatType ivalue = image(k, j, i);
+                FloatType bvalue = bkgrd(k, j, i);
+                const FloatType *zf = &zfraction(k, 0);
+                for (int kk = 0; kk < grid_size_[0]; ++kk) {
+                  icolumn[kk] += ivalue * zf[kk];
+                  bcolumn[kk] += bvalue * zf[kk];
+                }
+              }
+            }
+            if (!valid) {
+              continue;
+            }
             vert4 input(gc_array(j, i),
                         gc_array(j, i + 1),
                         gc_array(j + 1, i + 1),
                         gc_array(j + 1, i));
-            af::shared<Match> matches = quad_to_grid(input, grid_size2, 0);
-            for (int m = 0; m < matches.size(); ++m) {
+            matches.clear();
+            quad_to_grid(input, grid_size2, 0, matches);
+            for (std::size_t m = 0; m < matches.size(); ++m) {
               FloatType fraction = matches[m].fraction;
-              int index = matches[m].out;
-              int jj = index / grid_size_[2];
-              int ii = index % grid_size_[2];
-              for (int k = 0; k < shoebox_size_[0]; ++k) {
-                if (mask(k, j, i)) {
-                  FloatType ivalue = image(k, j, i) * fraction;
-                  FloatType bvalue = bkgrd(k, j, i) * fraction;
-                  for (int kk = 0; kk < grid_size_[0]; ++kk) {
-                    FloatType zf = zfraction(k, kk);
-                    profile_(kk, jj, ii) += ivalue * zf;
-                    background_(kk, jj, ii) += bvalue * zf;
-                  }
-                }
+              FloatType *p = &profile_[matches[m].out];
+              FloatType *b = &background_[matches[m].out];
+              for (int kk = 0; kk < grid_size_[0]; ++kk) {
+                p[kk * grid_frame] += fraction * icolumn[kk];
+                b[kk * grid_frame] += fraction * bcolumn[kk];
               }
             }
           }
@@ -453,15 +572,12 @@ namespace dials {
                             grid_cent_[1] + (e2_ * ds) / step_size_[1]);
       }
 
-      vec2<double> gc(const Panel &panel,
+      vec2<double> gc(const ShoeboxGeometry &geometry,
                       std::size_t j,
-                      std::size_t i,
-                      double attenuation_length) const {
-        vec3<double> sp =
-          panel.get_pixel_lab_coord(vec2<double>(x0_ + i, y0_ + j), attenuation_length);
-        vec3<double> ds = sp.normalize() * s1_.length() - s1_;
-        return vec2<double>(grid_cent_[2] + (e1_ * ds) / step_size_[2],
-                            grid_cent_[1] + (e2_ * ds) / step_size_[1]);
+                      std::size_t i) const {
+        vec2<double> c12 = geometry.from_corner(j, i, s1_.length());
+        return vec2<double>(grid_cent_[2] + c12[0] / step_size_[2],
+                            grid_cent_[1] + c12[1] / step_size_[1]);
       }
 
       int x0_, y0_;
@@ -605,14 +721,8 @@ namespace dials {
             reverse_quad_inplace_if_backward(p1);
             for (std::size_t jj = y0; jj < y1; ++jj) {
               for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
+                vert2 p2(vec2<double>(ii, jj), vec2<double>(ii + 1, jj + 1));
+                double area = quad_with_rect_area(p1, p2);
                 const double EPS = 1e-7;
                 if (area < 0.0) {
                   DIALS_ASSERT(area > -EPS);
@@ -658,6 +768,231 @@ namespace dials {
       af::versa<double, af::c_grid<3> > background_;
     };
 
+    namespace detail {
+
+      /**
+       * Map a profile on the reciprocal space grid back to the detector pixels
+       * of a bounding box. The overlap of each grid point with the pixels is
+       * found once and the area weighted grid columns are summed on each pixel,
+       * and then the grid slices are spread over the frames in one pass over
+       * the pixels. The work arrays are kept between calls so one mapper can be
+       * reused for many reflections.
+       */
+      class ReverseMapper {
+      public:
+        /**
+         * @param spec The transform spec
+         * @param cs The coordinate system of the reflection
+         * @param bbox The bounding box
+         * @param panel The panel
+         * @param data The profile on the grid
+         * @param model Use the phi model to map the grid slices to frames
+         * @param profile The profile on the pixels of the bounding box
+         */
+        void operator()(const TransformSpec &spec,
+                        const CoordinateSystem &cs,
+                        int6 bbox,
+                        std::size_t panel,
+                        const af::const_ref<double, af::c_grid<3> > &data,
+                        bool model,
+                        af::ref<double, af::c_grid<3> > profile) {
+          DIALS_ASSERT(data.accessor().all_eq(spec.grid_size()));
+          DIALS_ASSERT(bbox[1] > bbox[0]);
+          DIALS_ASSERT(bbox[3] > bbox[2]);
+          DIALS_ASSERT(bbox[5] > bbox[4]);
+
+          // Check the profile array
+          std::size_t xs = bbox[1] - bbox[0];
+          std::size_t ys = bbox[3] - bbox[2];
+          std::size_t zs = bbox[5] - bbox[4];
+          DIALS_ASSERT(profile.accessor()[0] == zs);
+          DIALS_ASSERT(profile.accessor()[1] == ys);
+          DIALS_ASSERT(profile.accessor()[2] == xs);
+          std::fill(profile.begin(), profile.end(), 0.0);
+
+          // The grid size
+          std::size_t gz = data.accessor()[0];
+          std::size_t gy = data.accessor()[1];
+          std::size_t gx = data.accessor()[2];
+
+          // Compute the deltas
+          double delta_b = spec.sigma_b() * spec.n_sigma();
+          double delta_m = spec.sigma_m() * spec.n_sigma();
+
+          // Compute the grid step and offset
+          double xoff = -delta_b;
+          double yoff = -delta_b;
+          double zoff = -delta_m;
+          double xstep = (2.0 * delta_b) / gx;
+          double ystep = (2.0 * delta_b) / gy;
+          double zstep = (2.0 * delta_m) / gz;
+
+          // Get the panel
+          const Panel &dp = spec.detector()[panel];
+
+          // Compute the detector coordinates of each point on the grid
+          xy_.resize((gy + 1) * (gx + 1));
+          for (std::size_t j = 0; j <= gy; ++j) {
+            for (std::size_t i = 0; i <= gx; ++i) {
+              double c1 = xoff + i * xstep;
+              double c2 = yoff + j * ystep;
+              vec3<double> s1p = cs.to_beam_vector(vec2<double>(c1, c2));
+              vec2<double> xyp = dp.get_ray_intersection_px(s1p);
+              xyp[0] -= bbox[0];
+              xyp[1] -= bbox[2];
+              xy_[j * (gx + 1) + i] = xyp;
+            }
+          }
+
+          // Compute the frame numbers of each slice on the grid
+          z_.resize(gz + 1);
+          for (std::size_t k = 0; k <= gz; ++k) {
+            double c3 = zoff + k * zstep;
+            double phip = cs.to_rotation_angle_fast(c3);
+            z_[k] = spec.scan().get_array_index_from_angle(phip) - bbox[4];
+          }
+
+          // Compute the fraction of each grid slice on each frame
+          compute_zfraction(spec, cs, bbox, gz, zs, model);
+
+          // Copy the grid data so that the slices of each grid point are
+          // contiguous
+          data_.resize(gz * gy * gx);
+          for (std::size_t k = 0; k < gz; ++k) {
+            for (std::size_t j = 0; j < gy; ++j) {
+              for (std::size_t i = 0; i < gx; ++i) {
+                data_[(j * gx + i) * gz + k] = data(k, j, i);
+              }
+            }
+          }
+
+          // Sum the area weighted grid columns on each pixel
+          columns_.assign(ys * xs * gz, 0.0);
+          for (std::size_t j = 0; j < gy; ++j) {
+            for (std::size_t i = 0; i < gx; ++i) {
+              vec2<double> xy00 = xy_[j * (gx + 1) + i];
+              vec2<double> xy01 = xy_[j * (gx + 1) + i + 1];
+              vec2<double> xy11 = xy_[(j + 1) * (gx + 1) + i + 1];
+              vec2<double> xy10 = xy_[(j + 1) * (gx + 1) + i];
+              int x0 = (int)std::floor(min4(xy00[0], xy01[0], xy11[0], xy10[0]));
+              int x1 = (int)std::ceil(max4(xy00[0], xy01[0], xy11[0], xy10[0]));
+              int y0 = (int)std::floor(min4(xy00[1], xy01[1], xy11[1], xy10[1]));
+              int y1 = (int)std::ceil(max4(xy00[1], xy01[1], xy11[1], xy10[1]));
+              DIALS_ASSERT(x0 < x1);
+              DIALS_ASSERT(y0 < y1);
+              x0 = std::max(x0, 0);
+              y0 = std::max(y0, 0);
+              x1 = std::min(x1, (int)xs);
+              y1 = std::min(y1, (int)ys);
+              vert4 p1(xy00, xy01, xy11, xy10);
+              double p1_area = simple_area(p1);
+              DIALS_ASSERT(p1_area > 0);
+              reverse_quad_inplace_if_backward(p1);
+              const double *d = &data_[(j * gx + i) * gz];
+              for (int jj = y0; jj < y1; ++jj) {
+                for (int ii = x0; ii < x1; ++ii) {
+                  vert2 p2(vec2<double>(ii, jj), vec2<double>(ii + 1, jj + 1));
+                  double area = quad_with_rect_area(p1, p2);
+                  area /= p1_area;
+                  const double EPS = 1e-7;
+                  if (area < 0.0) {
+                    DIALS_ASSERT(area > -EPS);
+                    area = 0.0;
+                  }
+                  if (area > 1.0) {
+                    DIALS_ASSERT(area <= (1.0 + EPS));
+                    area = 1.0;
+                  }
+                  if (area > 0) {
+                    double *c = &columns_[(jj * xs + ii) * gz];
+                    for (std::size_t k = 0; k < gz; ++k) {
+                      c[k] += area * d[k];
+                    }
+                  }
+                }
+              }
+            }
+          }
+
+          // Spread the grid slices on each pixel over the frames
+          for (std::size_t jj = 0; jj < ys; ++jj) {
+            for (std::size_t ii = 0; ii < xs; ++ii) {
+              const double *c = &columns_[(jj * xs + ii) * gz];
+              for (std::size_t k = 0; k < gz; ++k) {
+                if (c[k] == 0) {
+                  continue;
+                }
+                const double *f = &zfraction_[k * zs];
+                for (int kk = zrange_[k][0]; kk < zrange_[k][1]; ++kk) {
+                  profile(kk, jj, ii) += f[kk] * c[k];
+                }
+              }
+            }
+          }
+        }
+
+      private:
+        /**
+         * Compute the range of frames covered by each grid slice and the
+         * fraction of the slice on each of the frames, either from the phi
+         * model or from the overlap of the slice with the frame.
+         */
+        void compute_zfraction(const TransformSpec &spec,
+                               const CoordinateSystem &cs,
+                               int6 bbox,
+                               std::size_t gz,
+                               std::size_t zs,
+                               bool model) {
+          af::versa<double, af::c_grid<2> > zfraction_arr;
+          if (model) {
+            vec2<int> zrange(bbox[4], bbox[5]);
+            MapFramesReverse<double> map_frames(spec.scan().get_array_range()[0],
+                                                spec.scan().get_oscillation()[0],
+                                                spec.scan().get_oscillation()[1],
+                                                spec.sigma_m(),
+                                                spec.n_sigma(),
+                                                spec.grid_size()[2] / 2);
+            zfraction_arr = map_frames(zrange, cs.phi(), cs.zeta());
+          }
+          af::const_ref<double, af::c_grid<2> > zfraction = zfraction_arr.const_ref();
+          zrange_.resize(gz);
+          zfraction_.assign(gz * zs, 0.0);
+          for (std::size_t k = 0; k < gz; ++k) {
+            double f00 = std::min(z_[k], z_[k + 1]);
+            double f01 = std::max(z_[k], z_[k + 1]);
+            DIALS_ASSERT(f01 > f00);
+            double fr = f01 - f00;
+            int z0 = std::max((int)0, (int)std::floor(f00));
+            int z1 = std::min((int)zs, (int)std::ceil(f01));
+            zrange_[k] = int2(z0, std::max(z0, z1));
+            for (int kk = z0; kk < z1; ++kk) {
+              double fraction = 0.0;
+              if (model) {
+                DIALS_ASSERT(kk < zfraction.accessor()[1]);
+                DIALS_ASSERT(k < zfraction.accessor()[0]);
+                fraction = zfraction(k, kk);
+              } else {
+                double f0 = std::max(f00, (double)kk);
+                double f1 = std::min(f01, (double)(kk + 1));
+                fraction = f1 > f0 ? (f1 - f0) / fr : 0.0;
+              }
+              DIALS_ASSERT(fraction <= 1.0);
+              DIALS_ASSERT(fraction >= 0.0);
+              zfraction_[k * zs + kk] = fraction;
+            }
+          }
+        }
+
+        std::vector<vec2<double> > xy_;
+        std::vector<double> z_;
+        std::vector<int2> zrange_;
+        std::vector<double> zfraction_;
+        std::vector<double> data_;
+        std::vector<double> columns_;
+      };
+
+    }  // namespace detail
+
     /**
      * A class to do a reverse transform with no phi model
      */
@@ -670,7 +1005,9 @@ namespace dials {
                               int6 bbox,
                               std::size_t panel,
                               const af::const_ref<double, af::c_grid<3> > &data) {
-        init(spec, cs, bbox, panel, data);
+        profile_ = af::versa<double, af::c_grid<3> >(af::c_grid<3>(
+          bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0]));
+        compute(spec, cs, bbox, panel, data, profile_.ref());
       }
 
       /** @returns The transformed profile */
@@ -678,136 +1015,26 @@ namespace dials {
         return profile_;
       }
 
-    private:
-      void init(const TransformSpec &spec,
-                const CoordinateSystem &cs,
-                int6 bbox,
-                std::size_t panel,
-                const af::const_ref<double, af::c_grid<3> > &data) {
-        DIALS_ASSERT(data.accessor().all_eq(spec.grid_size()));
-        DIALS_ASSERT(bbox[1] > bbox[0]);
-        DIALS_ASSERT(bbox[3] > bbox[2]);
-        DIALS_ASSERT(bbox[5] > bbox[4]);
-
-        // Create the profile array
-        std::size_t xs = bbox[1] - bbox[0];
-        std::size_t ys = bbox[3] - bbox[2];
-        std::size_t zs = bbox[5] - bbox[4];
-        profile_ = af::versa<double, af::c_grid<3> >(af::c_grid<3>(zs, ys, xs), 0);
-
-        // Compute the deltas
-        double delta_b = spec.sigma_b() * spec.n_sigma();
-        double delta_m = spec.sigma_m() * spec.n_sigma();
-
-        // Compute the grid step and offset
-        double xoff = -delta_b;
-        double yoff = -delta_b;
-        double zoff = -delta_m;
-        double xstep = (2.0 * delta_b) / data.accessor()[2];
-        double ystep = (2.0 * delta_b) / data.accessor()[1];
-        double zstep = (2.0 * delta_m) / data.accessor()[0];
-
-        // Get the panel
-        const Panel &dp = spec.detector()[panel];
-
-        // Compute the detector coordinates of each point on the grid
-        af::versa<vec2<double>, af::c_grid<2> > xy(
-          af::c_grid<2>(data.accessor()[1] + 1, data.accessor()[2] + 1));
-        for (std::size_t j = 0; j <= data.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i <= data.accessor()[2]; ++i) {
-            double c1 = xoff + i * xstep;
-            double c2 = yoff + j * ystep;
-            vec3<double> s1p = cs.to_beam_vector(vec2<double>(c1, c2));
-            vec2<double> xyp = dp.get_ray_intersection_px(s1p);
-            xyp[0] -= bbox[0];
-            xyp[1] -= bbox[2];
-            xy(j, i) = xyp;
-          }
-        }
-
-        // Compute the frame numbers of each slice on the grid
-        af::shared<double> z(data.accessor()[0] + 1);
-        for (std::size_t k = 0; k <= data.accessor()[0]; ++k) {
-          double c3 = zoff + k * zstep;
-          double phip = cs.to_rotation_angle_fast(c3);
-          z[k] = spec.scan().get_array_index_from_angle(phip) - bbox[4];
-        }
-
-        // Get a list of pairs of overlapping polygons
-        for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
-            vec2<double> xy00 = xy(j, i);
-            vec2<double> xy01 = xy(j, i + 1);
-            vec2<double> xy11 = xy(j + 1, i + 1);
-            vec2<double> xy10 = xy(j + 1, i);
-            int x0 = (int)std::floor(min4(xy00[0], xy01[0], xy11[0], xy10[0]));
-            int x1 = (int)std::ceil(max4(xy00[0], xy01[0], xy11[0], xy10[0]));
-            int y0 = (int)std::floor(min4(xy00[1], xy01[1], xy11[1], xy10[1]));
-            int y1 = (int)std::ceil(max4(xy00[1], xy01[1], xy11[1], xy10[1]));
-            DIALS_ASSERT(x0 < x1);
-            DIALS_ASSERT(y0 < y1);
-            if (x0 < 0) x0 = 0;
-            if (y0 < 0) y0 = 0;
-            if (x1 > xs) x1 = xs;
-            if (y1 > ys) y1 = ys;
-            vert4 p1(xy00, xy01, xy11, xy10);
-            double p1_area = simple_area(p1);
-            DIALS_ASSERT(p1_area > 0);
-            reverse_quad_inplace_if_backward(p1);
-            for (std::size_t jj = y0; jj < y1; ++jj) {
-              for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
-                area /= p1_area;
-                const double EPS = 1e-7;
-                if (area < 0.0) {
-                  DIALS_ASSERT(area > -EPS);
-                  area = 0.0;
-                }
-                if (area > 1.0) {
-                  DIALS_ASSERT(area <= (1.0 + EPS));
-                  area = 1.0;
-                }
-                DIALS_ASSERT(0.0 <= area && area <= 1.0);
-                if (area > 0) {
-                  for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
-                    double f00 = std::min(z[k], z[k + 1]);
-                    double f01 = std::max(z[k], z[k + 1]);
-                    DIALS_ASSERT(f01 > f00);
-                    double fr = f01 - f00;
-                    int z0 = std::max((int)0, (int)std::floor(f00));
-                    int z1 = std::min((int)zs, (int)std::ceil(f01));
-                    DIALS_ASSERT(z0 >= 0 && z1 <= (int)zs);
-                    for (int kk = z0; kk < z1; ++kk) {
-                      std::size_t f10 = kk;
-                      std::size_t f11 = kk + 1;
-                      double f0 = std::max(f00, (double)f10);
-                      double f1 = std::min(f01, (double)f11);
-                      double fraction = f1 > f0 ? (f1 - f0) / fr : 0.0;
-                      DIALS_ASSERT(fraction <= 1.0);
-                      DIALS_ASSERT(fraction >= 0.0);
-                      double value = fraction * area * data(k, j, i);
-                      profile_(kk, jj, ii) += value;
-                    }
-                  }
-                }
-              }
-            }
-          }
-        }
+      /**
+       * Compute the transform into a preallocated profile with the size of the
+       * bounding box, reusing the work arrays of this object.
+       */
+      void compute(const TransformSpec &spec,
+                   const CoordinateSystem &cs,
+                   int6 bbox,
+                   std::size_t panel,
+                   const af::const_ref<double, af::c_grid<3> > &data,
+                   af::ref<double, af::c_grid<3> > profile) {
+        mapper_(spec, cs, bbox, panel, data, false, profile);
       }
 
+    private:
+      detail::ReverseMapper mapper_;
       af::versa<double, af::c_grid<3> > profile_;
     };
 
     /**
-     * A class to do a reverse transform with no phi model
+     * A class to do a reverse transform with the phi model
      */
     class TransformReverse {
     public:
@@ -818,7 +1045,9 @@ namespace dials {
                        int6 bbox,
                        std::size_t panel,
                        const af::const_ref<double, af::c_grid<3> > &data) {
-        init(spec, cs, bbox, panel, data);
+        profile_ = af::versa<double, af::c_grid<3> >(af::c_grid<3>(
+          bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0]));
+        compute(spec, cs, bbox, panel, data, profile_.ref());
       }
 
       /** @returns The transformed profile */
@@ -826,140 +1055,22 @@ namespace dials {
         return profile_;
       }
 
-    private:
-      void init(const TransformSpec &spec,
-                const CoordinateSystem &cs,
-                int6 bbox,
-                std::size_t panel,
-                const af::const_ref<double, af::c_grid<3> > &data) {
-        DIALS_ASSERT(data.accessor().all_eq(spec.grid_size()));
-        DIALS_ASSERT(bbox[1] > bbox[0]);
-        DIALS_ASSERT(bbox[3] > bbox[2]);
-        DIALS_ASSERT(bbox[5] > bbox[4]);
-
-        // Create the profile array
-        std::size_t xs = bbox[1] - bbox[0];
-        std::size_t ys = bbox[3] - bbox[2];
-        std::size_t zs = bbox[5] - bbox[4];
-        profile_ = af::versa<double, af::c_grid<3> >(af::c_grid<3>(zs, ys, xs), 0);
-
-        // Compute the deltas
-        double delta_b = spec.sigma_b() * spec.n_sigma();
-        double delta_m = spec.sigma_m() * spec.n_sigma();
-
-        // Compute the grid step and offset
-        double xoff = -delta_b;
-        double yoff = -delta_b;
-        double zoff = -delta_m;
-        double xstep = (2.0 * delta_b) / data.accessor()[2];
-        double ystep = (2.0 * delta_b) / data.accessor()[1];
-        double zstep = (2.0 * delta_m) / data.accessor()[0];
-
-        // Get the panel
-        const Panel &dp = spec.detector()[panel];
-
-        // Compute the detector coordinates of each point on the grid
-        af::versa<vec2<double>, af::c_grid<2> > xy(
-          af::c_grid<2>(data.accessor()[1] + 1, data.accessor()[2] + 1));
-        for (std::size_t j = 0; j <= data.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i <= data.accessor()[2]; ++i) {
-            double c1 = xoff + i * xstep;
-            double c2 = yoff + j * ystep;
-            vec3<double> s1p = cs.to_beam_vector(vec2<double>(c1, c2));
-            vec2<double> xyp = dp.get_ray_intersection_px(s1p);
-            xyp[0] -= bbox[0];
-            xyp[1] -= bbox[2];
-            xy(j, i) = xyp;
-          }
-        }
-
-        // Compute the frame numbers of each slice on the grid
-        af::shared<double> z(data.accessor()[0] + 1);
-        for (std::size_t k = 0; k <= data.accessor()[0]; ++k) {
-          double c3 = zoff + k * zstep;
-          double phip = cs.to_rotation_angle_fast(c3);
-          z[k] = spec.scan().get_array_index_from_angle(phip) - bbox[4];
-        }
-
-        // Create the frame mapper
-        vec2<int> zrange(bbox[4], bbox[5]);
-        MapFramesReverse<double> map_frames(spec.scan().get_array_range()[0],
-                                            spec.scan().get_oscillation()[0],
-                                            spec.scan().get_oscillation()[1],
-                                            spec.sigma_m(),
-                                            spec.n_sigma(),
-                                            spec.grid_size()[2] / 2);
-        af::versa<double, af::c_grid<2> > zfraction_arr =
-          map_frames(zrange, cs.phi(), cs.zeta());
-        af::const_ref<double, af::c_grid<2> > zfraction = zfraction_arr.const_ref();
-
-        // Get a list of pairs of overlapping polygons
-        for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
-            vec2<double> xy00 = xy(j, i);
-            vec2<double> xy01 = xy(j, i + 1);
-            vec2<double> xy11 = xy(j + 1, i + 1);
-            vec2<double> xy10 = xy(j + 1, i);
-            int x0 = (int)std::floor(min4(xy00[0], xy01[0], xy11[0], xy10[0]));
-            int x1 = (int)std::ceil(max4(xy00[0], xy01[0], xy11[0], xy10[0]));
-            int y0 = (int)std::floor(min4(xy00[1], xy01[1], xy11[1], xy10[1]));
-            int y1 = (int)std::ceil(max4(xy00[1], xy01[1], xy11[1], xy10[1]));
-            DIALS_ASSERT(x0 < x1);
-            DIALS_ASSERT(y0 < y1);
-            if (x0 < 0) x0 = 0;
-            if (y0 < 0) y0 = 0;
-            if (x1 > xs) x1 = xs;
-            if (y1 > ys) y1 = ys;
-            vert4 p1(xy00, xy01, xy11, xy10);
-            double p1_area = simple_area(p1);
-            DIALS_ASSERT(p1_area > 0);
-            reverse_quad_inplace_if_backward(p1);
-            for (std::size_t jj = y0; jj < y1; ++jj) {
-              for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
-                area /= p1_area;
-                const double EPS = 1e-7;
-                if (area < 0.0) {
-                  DIALS_ASSERT(area > -EPS);
-                  area = 0.0;
-                }
-                if (area > 1.0) {
-                  DIALS_ASSERT(area <= (1.0 + EPS));
-                  area = 1.0;
-                }
-                DIALS_ASSERT(0.0 <= area && area <= 1.0);
-                if (area > 0) {
-                  for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
-                    double f00 = std::min(z[k], z[k + 1]);
-                    double f01 = std::max(z[k], z[k + 1]);
-                    DIALS_ASSERT(f01 > f00);
-                    int z0 = std::max((int)0, (int)std::floor(f00));
-                    int z1 = std::min((int)zs, (int)std::ceil(f01));
-                    DIALS_ASSERT(z0 >= 0 && z1 <= (int)zs);
-                    for (int kk = z0; kk < z1; ++kk) {
-                      DIALS_ASSERT(kk < zfraction.accessor()[1]);
-                      DIALS_ASSERT(k < zfraction.accessor()[0]);
-                      double fraction = zfraction(k, kk);
-                      DIALS_ASSERT(fraction <= 1.0);
-                      DIALS_ASSERT(fraction >= 0.0);
-                      double value = fraction * area * data(k, j, i);
-                      profile_(kk, jj, ii) += value;
-                    }
-                  }
-                }
-              }
-            }
-          }
-        }
+      /**
+       * Compute the transform into a preallocated profile with the size of the
+       * bounding box, reusing the work arrays of this object, so that one
+       * object can be kept to transform many reflections.
+       */
+      void compute(const TransformSpec &spec,
+                   const CoordinateSystem &cs,
+                   int6 bbox,
+                   std::size_t panel,
+                   const af::const_ref<double, af::c_grid<3> > &data,
+                   af::ref<double, af::c_grid<3> > profile) {
+        mapper_(spec, cs, bbox, panel, data, true, profile);
       }
 
+    private:
+      detail::ReverseMapper mapper_;
       af::versa<double, af::c_grid<3> > profile_;
     };
 
@@ -18,7 +18,7 @@ namespace dials { namespace algorithms { namespace boost_python {
     result.def("add", &T::add)
       .def("valid", &T::valid)
       .def("n_reflections", &T::n_reflections)
-      .def("model", &T::model)
+      .def("model", static_cast<void (T::*)(af::reflection_table)>(&T::model))
       .def("fit", &T::fit)
       .def("validate", &T::validate)
       .def("accumulate", &T::accumulate)
@@ -11,6 +11,8 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <iostream>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -20,6 +22,8 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_modeller();
 
   BOOST_PYTHON_MODULE(dials_algorithms_profile_model_modeller_ext) {
+    dials::util::boost_python::import_memory_accounting();
+    dials::util::boost_python::import_shared_executor();
     export_sampler();
     export_modeller();
   }
@@ -107,6 +107,8 @@ namespace dials { namespace algorithms { namespace boost_python {
   };
 
   void export_modeller() {
+    void (ProfileModellerIface::*finalize_all)() = &ProfileModellerIface::finalize;
+
     class_<ProfileModellerIfaceWrapper,
            boost::shared_ptr<ProfileModellerIfaceWrapper>,
            boost::noncopyable>("ProfileModellerIface")
@@ -114,7 +116,7 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("fit", pure_virtual(&ProfileModellerIface::fit))
       .def("validate", pure_virtual(&ProfileModellerIface::validate))
       .def("accumulate", pure_virtual(&ProfileModellerIface::accumulate))
-      .def("finalize", pure_virtual(&ProfileModellerIface::finalize))
+      .def("finalize", pure_virtual(finalize_all))
       .def("finalized", pure_virtual(&ProfileModellerIface::finalized))
       .def("data", pure_virtual(&ProfileModellerIface::data))
       .def("mask", pure_virtual(&ProfileModellerIface::mask))
@@ -135,11 +137,15 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<MultiExpProfileModeller>("MultiExpProfileModeller")
       .def("add", &MultiExpProfileModeller::add)
       .def("__getitem__", &MultiExpProfileModeller::operator[])
-      .def("model", &MultiExpProfileModeller::model)
+      .def("model",
+           &MultiExpProfileModeller::model,
+           (arg("reflections"), arg("nthreads") = 1))
       .def("accumulate", &MultiExpProfileModeller::accumulate)
-      .def("finalize", &MultiExpProfileModeller::finalize)
+      .def("finalize", &MultiExpProfileModeller::finalize, (arg("nthreads") = 1))
       .def("finalized", &MultiExpProfileModeller::finalized)
-      .def("fit", &MultiExpProfileModeller::fit)
+      .def("fit",
+           &MultiExpProfileModeller::fit,
+           (arg("reflections"), arg("nthreads") = 1))
       .def("validate", &MultiExpProfileModeller::validate)
       .def("__len__", &MultiExpProfileModeller::size)
       .def("copy", &MultiExpProfileModeller::copy)
@@ -52,6 +52,16 @@ namespace dials { namespace algorithms {
       r1_ = r0_ / 3.0;
       r2_ = r1_ * std::sqrt(5.0);
       step_size_ = (double)scan_size / (double)num_z_;
+
+      // Tabulate the nearest n profiles of each profile
+      table_offset_.push_back(0);
+      for (std::size_t i = 0; i < size(); ++i) {
+        af::shared<std::size_t> n = nearest_n_index(i);
+        for (std::size_t j = 0; j < n.size(); ++j) {
+          table_index_.push_back(n[j]);
+        }
+        table_offset_.push_back(table_index_.size());
+      }
     }
 
     /**
@@ -139,25 +149,26 @@ namespace dials { namespace algorithms {
      */
     af::shared<std::size_t> nearest_n(std::size_t panel, double3 xyz) const {
       DIALS_ASSERT(panel == 0);
+      std::size_t index = nearest(panel, xyz);
+      return af::shared<std::size_t>(table_index_.begin() + table_offset_[index],
+                                     table_index_.begin() + table_offset_[index + 1]);
+    }
 
-      // Get the main index
-      std::size_t main_index = nearest(panel, xyz);
-      std::size_t image_index = main_index % 9;
-      std::size_t zero_index = (main_index / 9) * 9;
-
-      // Get the adjacent indices
-      af::shared<std::size_t> result;
-      if (image_index == 0) {
-        for (std::size_t i = 0; i < 9; ++i) {
-          result.push_back(main_index + i);
-        }
-      } else {
-        result.push_back(main_index);
-        result.push_back(zero_index);
-        result.push_back(zero_index + (image_index) % 8 + 1);
-        result.push_back(zero_index + (image_index - 2) % 8 + 1);
+    /**
+     * Find the nearest n reference profiles to the given point and their
+     * weights from the table of neighbours.
+     * @param xyz The coordinate
+     * @param result The profile indices and weights
+     */
+    void nearest_n_weights(std::size_t panel,
+                           double3 xyz,
+                           SamplerNeighbours &result) const {
+      DIALS_ASSERT(panel == 0);
+      std::size_t index = nearest(panel, xyz);
+      result.size = 0;
+      for (std::size_t i = table_offset_[index]; i < table_offset_[index + 1]; ++i) {
+        result.push_back(table_index_[i], weight(table_index_[i], panel, xyz));
       }
-      return result;
     }
 
     /**
@@ -220,6 +231,30 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Get the nearest n reference profiles to a profile
+     * @param main_index The index of the profile
+     * @returns A list of reference profile indices
+     */
+    af::shared<std::size_t> nearest_n_index(std::size_t main_index) const {
+      std::size_t image_index = main_index % 9;
+      std::size_t zero_index = (main_index / 9) * 9;
+
+      // Get the adjacent indices
+      af::shared<std::size_t> result;
+      if (image_index == 0) {
+        for (std::size_t i = 0; i < 9; ++i) {
+          result.push_back(main_index + i);
+        }
+      } else {
+        result.push_back(main_index);
+        result.push_back(zero_index);
+        result.push_back(zero_index + (image_index) % 8 + 1);
+        result.push_back(zero_index + (image_index - 2) % 8 + 1);
+      }
+      return result;
+    }
+
     /**
      * Find the nearest reference profile to the given point.
      * @param xy The coordinate
@@ -270,6 +305,8 @@ namespace dials { namespace algorithms {
     std::size_t nprofile_;
     double step_size_;
     double r0_, r1_, r2_;
+    af::shared<std::size_t> table_offset_;
+    af::shared<std::size_t> table_index_;
   };
 
 }}  // namespace dials::algorithms
@@ -13,9 +13,12 @@
 #define DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_EMPIRICAL_MODELLER_H
 
 #include <vector>
+#include <boost/bind.hpp>
 #include <boost/pointer_cast.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/algorithms/profile_model/modeller/modeller_interface.h>
+#include <dials/util/memory_accounting.h>
 
 namespace dials { namespace algorithms {
 
@@ -36,7 +39,8 @@ namespace dials { namespace algorithms {
           n_reflections_(n, 0),
           accessor_(af::c_grid<3>(datasize[0], datasize[1], datasize[2])),
           threshold_(threshold),
-          finalized_(false) {
+          finalized_(false),
+          memory_(dials::util::make_memory_charge(dials::util::ProfileModelMemory)) {
       DIALS_ASSERT(n > 0);
       DIALS_ASSERT(datasize.all_gt(0));
       DIALS_ASSERT(threshold_ >= 0);
@@ -64,8 +68,7 @@ namespace dials { namespace algorithms {
           double weight = weights[j];
           DIALS_ASSERT(index < data_.size());
           if (data_[index].size() == 0) {
-            data_[index] = data_type(accessor_, 0);
-            mask_[index] = mask_type(accessor_, true);
+            allocate_profile(index);
           } else {
             DIALS_ASSERT(data_[index].accessor().all_eq(accessor_));
             DIALS_ASSERT(mask_[index].accessor().all_eq(accessor_));
@@ -92,8 +95,7 @@ namespace dials { namespace algorithms {
       double sum_data = sum(profile);
       if (sum_data > 0) {
         if (data_[index].size() == 0) {
-          data_[index] = data_type(accessor_, 0);
-          mask_[index] = mask_type(accessor_, true);
+          allocate_profile(index);
         } else {
           DIALS_ASSERT(data_[index].accessor().all_eq(accessor_));
           DIALS_ASSERT(mask_[index].accessor().all_eq(accessor_));
@@ -135,8 +137,7 @@ namespace dials { namespace algorithms {
         n_reflections_[i] += other->n_reflections_[i];
         if (other->data_[i].size() != 0) {
           if (data_[i].size() == 0) {
-            data_[i] = data_type(accessor_, 0);
-            mask_[i] = mask_type(accessor_, true);
+            allocate_profile(i);
           }
           data_reference d1 = data_[i].ref();
           mask_reference m1 = mask_[i].ref();
@@ -156,12 +157,20 @@ namespace dials { namespace algorithms {
      * Finalize the modeller
      */
     void finalize() {
+      finalize(1);
+    }
+
+    /**
+     * Finalize the modeller, normalising bands of the profiles in parallel
+     * @param nthreads The number of threads
+     */
+    void finalize(std::size_t nthreads) {
       DIALS_ASSERT(finalized_ == false);
-      for (std::size_t i = 0; i < data_.size(); ++i) {
-        if (data_[i].size() != 0) {
-          finalize(i);
-        }
-      }
+      DIALS_ASSERT(nthreads > 0);
+      detail::parallel_bands(
+        boost::bind(&EmpiricalProfileModeller::finalize_profiles, this, _1, _2),
+        data_.size(),
+        nthreads);
       finalized_ = true;
     }
 
@@ -185,6 +194,9 @@ namespace dials { namespace algorithms {
     void set_data(std::size_t index, data_type value) {
       DIALS_ASSERT(index < data_.size());
       DIALS_ASSERT(value.size() == 0 || value.accessor().all_eq(accessor_));
+      if (data_[index].size() == 0 && value.size() != 0) {
+        memory_->add(profile_nbytes());
+      }
       data_[index] = value;
     }
 
@@ -287,30 +299,56 @@ namespace dials { namespace algorithms {
 
   protected:
     /**
-     * Finalize a single profile
+     * Allocate the data and mask of a profile and charge them to the profile
+     * model subsystem
+     * @param index The index of the profile
+     */
+    void allocate_profile(std::size_t index) {
+      data_[index] = data_type(accessor_, 0);
+      mask_[index] = mask_type(accessor_, true);
+      memory_->add(profile_nbytes());
+    }
+
+    /**
+     * @returns The number of bytes in the data and mask of a profile
+     */
+    std::size_t profile_nbytes() const {
+      return accessor_.size_1d() * (sizeof(double) + sizeof(bool));
+    }
+
+    /**
+     * Finalize a band of the profiles
+     * @param first The first profile
+     * @param last The last profile
+     */
+    void finalize_profiles(std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        if (data_[i].size() != 0) {
+          finalize_profile(i);
+        }
+      }
+    }
+
+    /**
+     * Finalize a single profile. Negative pixels are set to zero in the same
+     * pass as the signal pixels are summed, and the profile is then divided by
+     * the sum so the sum of the signal pixels is 1.
      * @param index The index of the profile to finalize
      */
-    void finalize(std::size_t index) {
+    void finalize_profile(std::size_t index) {
       // Check data
       DIALS_ASSERT(data_[index].accessor().all_eq(accessor_));
       DIALS_ASSERT(mask_[index].accessor().all_eq(accessor_));
 
       // Get the reference profile at the index
       data_reference data = data_[index].ref();
-      // mask_reference mask = mask_[index].ref();
-
-      // Calculate the profile maximum and signal threshold
-      // double threshold = threshold_ * max(data);
 
       // Get the sum of signal pixels
       double signal_sum = 0.0;
       for (std::size_t i = 0; i < data.size(); ++i) {
-        if (data[i] >= 0.0) {  // threshold) {
-          signal_sum += data[i];
-        } else {
-          data[i] = 0.0;
-          // mask[i] = false;
-        }
+        double value = data[i] >= 0.0 ? data[i] : 0.0;
+        data[i] = value;
+        signal_sum += value;
       }
 
       // Normalize the profile such that sum of signal pixels == 1
@@ -326,6 +364,7 @@ namespace dials { namespace algorithms {
     af::c_grid<3> accessor_;
     double threshold_;
     bool finalized_;
+    boost::shared_ptr<dials::util::MemoryCharge> memory_;
   };
 
 }}  // namespace dials::algorithms
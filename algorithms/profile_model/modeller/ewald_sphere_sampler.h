@@ -31,6 +31,7 @@ namespace dials { namespace algorithms {
   using dxtbx::model::Scan;
   using scitbx::vec2;
   using scitbx::vec3;
+  using scitbx::af::double2;
   using scitbx::af::double3;
   using scitbx::af::int2;
   using scitbx::af::int3;
@@ -269,25 +270,28 @@ namespace dials { namespace algorithms {
      * @returns The weight (between 1.0 and 0.0)
      */
     double weight(std::size_t index, std::size_t panel, double3 xyz) const {
-      vec3<double> s1 =
-        detector_[panel].get_pixel_lab_coord(vec2<double>(xyz[0], xyz[1])).normalize();
-      xyz[2] -= scan_range_[0];
-      double z = s1 * zaxis_;
-      double y = s1 * yaxis_;
-      double x = s1 * xaxis_;
-      double p1 = pi / 2 - std::acos(z);
-      double l1 = std::atan2(y, x);
-      double3 c = coord_[index];
-      double p2 = pi / 2 - c[0];
-      double l2 = c[1];
-      double q = std::sin(p1) * std::sin(p2)
-                 + std::cos(p1) * std::cos(p2) * std::cos(std::abs(l1 - l2));
-      if (q > 1) q = 1;
-      if (q < -1) q = -1;
-      std::size_t idx = indx1_[index];
-      double step = (idx == 0 ? 2 * step1_[idx] : step1_[idx] - step1_[idx - 1]);
-      double d = std::acos(q) / step;
-      return std::exp(-4.0 * d * d * std::log(2.0));
+      double2 pl = latitude_longitude(panel, xyz);
+      return weight_at(index, pl[0], pl[1]);
+    }
+
+    /**
+     * Find the nearest n reference profiles to the given point and their
+     * weights. The direction of the point is only computed once for all the
+     * weights.
+     * @param xyz The coordinate
+     * @param result The profile indices and weights
+     */
+    void nearest_n_weights(std::size_t panel,
+                           double3 xyz,
+                           SamplerNeighbours &result) const {
+      std::size_t index = nearest(panel, xyz);
+      const af::shared<std::size_t> &neighbours = neighbours_[index];
+      double2 pl = latitude_longitude(panel, xyz);
+      result.size = 0;
+      for (std::size_t i = 0; i < neighbours.size(); ++i) {
+        result.push_back(neighbours[i], weight_at(neighbours[i], pl[0], pl[1]));
+      }
+      result.push_back(index, weight_at(index, pl[0], pl[1]));
     }
 
     /**
@@ -331,6 +335,42 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Get the latitude and longitude of the direction of a point
+     * @param panel The panel
+     * @param xyz The coordinate
+     * @returns The latitude and longitude
+     */
+    double2 latitude_longitude(std::size_t panel, double3 xyz) const {
+      vec3<double> s1 =
+        detector_[panel].get_pixel_lab_coord(vec2<double>(xyz[0], xyz[1])).normalize();
+      double z = s1 * zaxis_;
+      double y = s1 * yaxis_;
+      double x = s1 * xaxis_;
+      return double2(pi / 2 - std::acos(z), std::atan2(y, x));
+    }
+
+    /**
+     * Get the weight for the given profile at the given direction
+     * @param index The profile index
+     * @param p1 The latitude
+     * @param l1 The longitude
+     * @returns The weight (between 1.0 and 0.0)
+     */
+    double weight_at(std::size_t index, double p1, double l1) const {
+      double3 c = coord_[index];
+      double p2 = pi / 2 - c[0];
+      double l2 = c[1];
+      double q = std::sin(p1) * std::sin(p2)
+                 + std::cos(p1) * std::cos(p2) * std::cos(std::abs(l1 - l2));
+      if (q > 1) q = 1;
+      if (q < -1) q = -1;
+      std::size_t idx = indx1_[index];
+      double step = (idx == 0 ? 2 * step1_[idx] : step1_[idx] - step1_[idx - 1]);
+      double d = std::acos(q) / step;
+      return std::exp(-4.0 * d * d * std::log(2.0));
+    }
+
     std::size_t index(std::size_t ix, std::size_t iy, std::size_t iz) const {
       int tot_sum = af::sum(num1_.const_ref());
       int par_sum = 0;
@@ -48,6 +48,18 @@ namespace dials { namespace algorithms {
       step_size_[0] = (double)image_size_[0] / (double)grid_size_[0];
       step_size_[1] = (double)image_size_[1] / (double)grid_size_[1];
       step_size_[2] = (double)scan_size_ / (double)grid_size_[2];
+
+      // Tabulate the nearest n profiles of each grid point, which are the
+      // neighbours of the grid point followed by the grid point itself
+      table_offset_.push_back(0);
+      for (std::size_t i = 0; i < size(); ++i) {
+        af::shared<std::size_t> n = neighbours(i);
+        for (std::size_t j = 0; j < n.size(); ++j) {
+          table_index_.push_back(n[j]);
+        }
+        table_index_.push_back(i);
+        table_offset_.push_back(table_index_.size());
+      }
     }
 
     /**
@@ -119,9 +131,25 @@ namespace dials { namespace algorithms {
     af::shared<std::size_t> nearest_n(std::size_t panel, double3 xyz) const {
       DIALS_ASSERT(panel == 0);
       std::size_t index = nearest(panel, xyz);
-      af::shared<std::size_t> result = neighbours(index);
-      result.push_back(index);
-      return result;
+      return af::shared<std::size_t>(table_index_.begin() + table_offset_[index],
+                                     table_index_.begin() + table_offset_[index + 1]);
+    }
+
+    /**
+     * Find the nearest n reference profiles to the given point and their
+     * weights from the table of neighbours.
+     * @param xyz The coordinate
+     * @param result The profile indices and weights
+     */
+    void nearest_n_weights(std::size_t panel,
+                           double3 xyz,
+                           SamplerNeighbours &result) const {
+      DIALS_ASSERT(panel == 0);
+      std::size_t index = nearest(panel, xyz);
+      result.size = 0;
+      for (std::size_t i = table_offset_[index]; i < table_offset_[index + 1]; ++i) {
+        result.push_back(table_index_[i], weight(table_index_[i], panel, xyz));
+      }
     }
 
     /**
@@ -199,6 +227,8 @@ namespace dials { namespace algorithms {
     int scan_size_;
     int3 grid_size_;
     double3 step_size_;
+    af::shared<std::size_t> table_offset_;
+    af::shared<std::size_t> table_index_;
   };
 
 }}  // namespace dials::algorithms
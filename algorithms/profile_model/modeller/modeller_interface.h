@@ -38,6 +38,14 @@ namespace dials { namespace algorithms {
 
     virtual void finalize() = 0;
 
+    /**
+     * Finalize the profiles with a number of threads. Modellers which cannot
+     * finalize their profiles in parallel just finalize them on this thread.
+     */
+    virtual void finalize(std::size_t nthreads) {
+      finalize();
+    }
+
     virtual bool finalized() const = 0;
 
     virtual data_type data(std::size_t) const = 0;
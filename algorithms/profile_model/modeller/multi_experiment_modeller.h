@@ -12,14 +12,19 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_MULTI_EXPERIMENT_MODELLER_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_MULTI_EXPERIMENT_MODELLER_H
 
+#include <algorithm>
 #include <vector>
 #include <numeric>
+#include <boost/bind.hpp>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <dials/algorithms/profile_model/modeller/modeller_interface.h>
+#include <dials/util/thread_pool.h>
 
 namespace dials { namespace algorithms {
 
+  using dials::util::ThreadPool;
+
   /**
    * A class to compute reference profiles for each experiment.
    */
@@ -52,147 +57,125 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Model the reflections
+     * Model the reflections. The experiments are modelled in parallel, with
+     * each modeller used by one thread only. The results are copied back to
+     * the reflection table in experiment order.
      * @param reflections The reflection table
+     * @param nthreads The number of threads
      */
-    void model(af::reflection_table reflections) {
+    void model(af::reflection_table reflections, std::size_t nthreads = 1) {
       using af::boost_python::flex_table_suite::select_rows_index;
       using af::boost_python::flex_table_suite::set_selected_rows_index;
 
       // Check some stuff
-      DIALS_ASSERT(size() > 0);
-      DIALS_ASSERT(reflections.size() > 0);
-      DIALS_ASSERT(reflections.contains("id"));
-
-      // Get the experiment id
-      af::const_ref<int> id = reflections["id"];
-
-      // Compute the number of reflections for each experiment
-      std::vector<std::size_t> num1(size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < num1.size());
-        num1[id[i]]++;
-      }
-
-      // Compute the offset array
-      std::vector<std::size_t> offset(1, 0);
-      std::partial_sum(num1.begin(), num1.end(), std::back_inserter(offset));
-      DIALS_ASSERT(offset.size() == num1.size() + 1);
-      DIALS_ASSERT(offset.back() == id.size());
-
-      // Compute the indices
-      std::vector<std::size_t> indices(id.size());
-      std::vector<std::size_t> num2(num1.size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] < num1.size());
-        std::size_t o1 = offset[id[i]];
-        std::size_t o2 = offset[id[i] + 1];
-        std::size_t n1 = num1[id[i]];
-        std::size_t n2 = num2[id[i]];
-        std::size_t j = o1 + n2;
-        DIALS_ASSERT(j < o2);
-        DIALS_ASSERT(n2 < n1);
-        DIALS_ASSERT(j < indices.size());
-        indices[j] = i;
-        num2[id[i]]++;
-      }
+      DIALS_ASSERT(nthreads > 0);
 
-      // Check we've assigned everything
-      for (std::size_t i = 0; i < num1.size(); ++i) {
-        DIALS_ASSERT(num1[i] == num2[i]);
-      }
+      // Get the reflections for each experiment
+      std::vector<std::size_t> offset;
+      std::vector<std::size_t> indices;
+      group_by_experiment(reflections, offset, indices);
 
-      // Process all the reflections
+      // Select the reflections for each experiment with reflections
+      std::vector<std::size_t> experiment;
+      std::vector<af::reflection_table> subset;
       for (std::size_t i = 0; i < modellers_.size(); ++i) {
-        // Get the indices
-        std::size_t o1 = offset[i];
-        std::size_t o2 = offset[i + 1];
-        DIALS_ASSERT(o2 <= indices.size());
-        DIALS_ASSERT(o1 <= o2);
-        std::size_t n = o2 - o1;
-
-        // If there are reflections for this experiment do some modelling
+        std::size_t n = offset[i + 1] - offset[i];
         if (n > 0) {
-          af::const_ref<std::size_t> ind(&indices[o1], n);
-          af::reflection_table subset = select_rows_index(reflections, ind);
+          af::const_ref<std::size_t> ind(&indices[offset[i]], n);
           DIALS_ASSERT(modellers_[i] != NULL);
-          modellers_[i]->model(subset);
-          set_selected_rows_index(reflections, ind, subset);
+          experiment.push_back(i);
+          subset.push_back(select_rows_index(reflections, ind));
+        }
+      }
+
+      // Do the modelling
+      if (nthreads == 1 || subset.size() == 1) {
+        for (std::size_t j = 0; j < subset.size(); ++j) {
+          modellers_[experiment[j]]->model(subset[j]);
+        }
+      } else {
+        ThreadPool pool(std::min(nthreads, subset.size()));
+        for (std::size_t j = 0; j < subset.size(); ++j) {
+          pool.post(boost::bind(
+            &ProfileModellerIface::model, modellers_[experiment[j]], subset[j]));
         }
+        pool.wait();
+      }
+
+      // Set the results
+      for (std::size_t j = 0; j < subset.size(); ++j) {
+        std::size_t i = experiment[j];
+        af::const_ref<std::size_t> ind(&indices[offset[i]], offset[i + 1] - offset[i]);
+        set_selected_rows_index(reflections, ind, subset[j]);
       }
     }
 
     /**
-     * Do the profile fitting
-     * @param reflections
+     * Do the profile fitting. The reflections of each experiment are split
+     * into chunks of about equal size which are fitted in parallel. The
+     * results are copied back to the reflection table in order, so they do
+     * not depend on the number of threads.
+     * @param reflections The reflection table
+     * @param nthreads The number of threads
      */
-    af::shared<bool> fit(af::reflection_table reflections) const {
+    af::shared<bool> fit(af::reflection_table reflections,
+                         std::size_t nthreads = 1) const {
       using af::boost_python::flex_table_suite::select_rows_index;
       using af::boost_python::flex_table_suite::set_selected_rows_index;
 
       // Check some stuff
-      DIALS_ASSERT(size() > 0);
-      DIALS_ASSERT(reflections.size() > 0);
-      DIALS_ASSERT(reflections.contains("id"));
-
-      // Get the experiment id
-      af::const_ref<int> id = reflections["id"];
-
-      // Compute the number of reflections for each experiment
-      std::vector<std::size_t> num1(size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < num1.size());
-        num1[id[i]]++;
+      DIALS_ASSERT(nthreads > 0);
+
+      // Get the reflections for each experiment
+      std::vector<std::size_t> offset;
+      std::vector<std::size_t> indices;
+      group_by_experiment(reflections, offset, indices);
+
+      // Split the reflections of each experiment into chunks
+      std::size_t chunk_size = (indices.size() + nthreads - 1) / nthreads;
+      std::vector<std::size_t> experiment;
+      std::vector<std::size_t> first;
+      std::vector<std::size_t> last;
+      for (std::size_t i = 0; i < modellers_.size(); ++i) {
+        for (std::size_t o1 = offset[i]; o1 < offset[i + 1]; o1 += chunk_size) {
+          experiment.push_back(i);
+          first.push_back(o1);
+          last.push_back(std::min(o1 + chunk_size, offset[i + 1]));
+        }
       }
 
-      // Compute the offset array
-      std::vector<std::size_t> offset(1, 0);
-      std::partial_sum(num1.begin(), num1.end(), std::back_inserter(offset));
-      DIALS_ASSERT(offset.size() == num1.size() + 1);
-      DIALS_ASSERT(offset.back() == id.size());
-
-      // Compute the indices
-      std::vector<std::size_t> indices(id.size());
-      std::vector<std::size_t> num2(num1.size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] < num1.size());
-        std::size_t o1 = offset[id[i]];
-        std::size_t o2 = offset[id[i] + 1];
-        std::size_t n1 = num1[id[i]];
-        std::size_t n2 = num2[id[i]];
-        std::size_t j = o1 + n2;
-        DIALS_ASSERT(j < o2);
-        DIALS_ASSERT(n2 < n1);
-        indices[j] = i;
-        num2[id[i]]++;
+      // Select the reflections for each chunk
+      std::vector<af::reflection_table> subset;
+      for (std::size_t j = 0; j < experiment.size(); ++j) {
+        af::const_ref<std::size_t> ind(&indices[first[j]], last[j] - first[j]);
+        subset.push_back(select_rows_index(reflections, ind));
       }
 
-      // Check we've assigned everything
-      for (std::size_t i = 0; i < num1.size(); ++i) {
-        DIALS_ASSERT(num1[i] == num2[i]);
+      // Do the fitting
+      std::vector<af::shared<bool> > subset_success(subset.size());
+      if (nthreads == 1 || subset.size() == 1) {
+        for (std::size_t j = 0; j < subset.size(); ++j) {
+          fit_subset(modellers_[experiment[j]].get(), subset[j], &subset_success[j]);
+        }
+      } else {
+        ThreadPool pool(std::min(nthreads, subset.size()));
+        for (std::size_t j = 0; j < subset.size(); ++j) {
+          pool.post(boost::bind(&MultiExpProfileModeller::fit_subset,
+                                modellers_[experiment[j]].get(),
+                                subset[j],
+                                &subset_success[j]));
+        }
+        pool.wait();
       }
 
-      // Process all the reflections
+      // Set the results
       af::shared<bool> success(reflections.size(), false);
-      for (std::size_t i = 0; i < modellers_.size(); ++i) {
-        // Get the indices
-        std::size_t o1 = offset[i];
-        std::size_t o2 = offset[i + 1];
-        DIALS_ASSERT(o2 <= indices.size());
-        DIALS_ASSERT(o1 <= o2);
-        std::size_t n = o2 - o1;
-
-        // If there are any reflections, do the fitting
-        if (n > 0) {
-          af::const_ref<std::size_t> ind(&indices[o1], n);
-          af::reflection_table subset = select_rows_index(reflections, ind);
-          af::shared<bool> subset_success = modellers_[i]->fit(subset);
-          set_selected_rows_index(reflections, ind, subset);
-          for (std::size_t j = 0; j < ind.size(); ++j) {
-            success[ind[j]] = subset_success[j];
-          }
+      for (std::size_t j = 0; j < subset.size(); ++j) {
+        af::const_ref<std::size_t> ind(&indices[first[j]], last[j] - first[j]);
+        set_selected_rows_index(reflections, ind, subset[j]);
+        DIALS_ASSERT(subset_success[j].size() == ind.size());
+        for (std::size_t k = 0; k < ind.size(); ++k) {
+          success[ind[k]] = subset_success[j][k];
         }
       }
 
@@ -208,48 +191,10 @@ namespace dials { namespace algorithms {
       using af::boost_python::flex_table_suite::select_rows_index;
       using af::boost_python::flex_table_suite::set_selected_rows_index;
 
-      // Check some stuff
-      DIALS_ASSERT(size() > 0);
-      DIALS_ASSERT(reflections.size() > 0);
-      DIALS_ASSERT(reflections.contains("id"));
-
-      // Get the experiment id
-      af::const_ref<int> id = reflections["id"];
-
-      // Compute the number of reflections for each experiment
-      std::vector<std::size_t> num1(size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < num1.size());
-        num1[id[i]]++;
-      }
-
-      // Compute the offset array
-      std::vector<std::size_t> offset(1, 0);
-      std::partial_sum(num1.begin(), num1.end(), std::back_inserter(offset));
-      DIALS_ASSERT(offset.size() == num1.size() + 1);
-      DIALS_ASSERT(offset.back() == id.size());
-
-      // Compute the indices
-      std::vector<std::size_t> indices(id.size());
-      std::vector<std::size_t> num2(num1.size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] < num1.size());
-        std::size_t o1 = offset[id[i]];
-        std::size_t o2 = offset[id[i] + 1];
-        std::size_t n1 = num1[id[i]];
-        std::size_t n2 = num2[id[i]];
-        std::size_t j = o1 + n2;
-        DIALS_ASSERT(j < o2);
-        DIALS_ASSERT(n2 < n1);
-        indices[j] = i;
-        num2[id[i]]++;
-      }
-
-      // Check we've assigned everything
-      for (std::size_t i = 0; i < num1.size(); ++i) {
-        DIALS_ASSERT(num1[i] == num2[i]);
-      }
+      // Get the reflections for each experiment
+      std::vector<std::size_t> offset;
+      std::vector<std::size_t> indices;
+      group_by_experiment(reflections, offset, indices);
 
       // Process all the reflections
       for (std::size_t i = 0; i < modellers_.size(); ++i) {
@@ -286,11 +231,14 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Finalize the profiles
+     * Finalize the profiles. The profiles of each modeller are finalized in
+     * parallel in turn.
+     * @param nthreads The number of threads
      */
-    void finalize() {
+    void finalize(std::size_t nthreads = 1) {
+      DIALS_ASSERT(nthreads > 0);
       for (std::size_t i = 0; i < modellers_.size(); ++i) {
-        modellers_[i]->finalize();
+        modellers_[i]->finalize(nthreads);
       }
     }
 
@@ -327,6 +275,69 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Sort the reflections by experiment
+     * @param reflections The reflection table
+     * @param offset The offset of each experiment in the indices
+     * @param indices The reflection indices sorted by experiment
+     */
+    void group_by_experiment(af::reflection_table reflections,
+                             std::vector<std::size_t> &offset,
+                             std::vector<std::size_t> &indices) const {
+      // Check some stuff
+      DIALS_ASSERT(size() > 0);
+      DIALS_ASSERT(reflections.size() > 0);
+      DIALS_ASSERT(reflections.contains("id"));
+
+      // Get the experiment id
+      af::const_ref<int> id = reflections["id"];
+
+      // Compute the number of reflections for each experiment
+      std::vector<std::size_t> num1(size(), 0);
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] >= 0);
+        DIALS_ASSERT(id[i] < num1.size());
+        num1[id[i]]++;
+      }
+
+      // Compute the offset array
+      offset.assign(1, 0);
+      std::partial_sum(num1.begin(), num1.end(), std::back_inserter(offset));
+      DIALS_ASSERT(offset.size() == num1.size() + 1);
+      DIALS_ASSERT(offset.back() == id.size());
+
+      // Compute the indices
+      indices.resize(id.size());
+      std::vector<std::size_t> num2(num1.size(), 0);
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] < num1.size());
+        std::size_t o1 = offset[id[i]];
+        std::size_t o2 = offset[id[i] + 1];
+        std::size_t n1 = num1[id[i]];
+        std::size_t n2 = num2[id[i]];
+        std::size_t j = o1 + n2;
+        DIALS_ASSERT(j < o2);
+        DIALS_ASSERT(n2 < n1);
+        indices[j] = i;
+        num2[id[i]]++;
+      }
+
+      // Check we've assigned everything
+      for (std::size_t i = 0; i < num1.size(); ++i) {
+        DIALS_ASSERT(num1[i] == num2[i]);
+      }
+    }
+
+    /**
+     * Fit a subset of the reflections with a modeller
+     */
+    static void fit_subset(const ProfileModellerIface *modeller,
+                           af::reflection_table subset,
+                           af::shared<bool> *success) {
+      DIALS_ASSERT(modeller != NULL);
+      *success = modeller->fit(subset);
+    }
+
     std::vector<modeller_pointer> modellers_;
   };
 
@@ -13,12 +13,49 @@
 
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using scitbx::af::double3;
   using scitbx::af::int3;
 
+  /**
+   * The nearest reference profiles to a point and their weights. These are
+   * held in fixed size arrays so looking them up for each reflection does
+   * not allocate.
+   */
+  struct SamplerNeighbours {
+    enum { max_size = 32 };
+    std::size_t size;
+    std::size_t index[max_size];
+    double weight[max_size];
+
+    SamplerNeighbours() : size(0) {}
+
+    /**
+     * Add a profile
+     * @param index_ The profile index
+     * @param weight_ The weight of the profile
+     */
+    void push_back(std::size_t index_, double weight_) {
+      DIALS_ASSERT(size < max_size);
+      index[size] = index_;
+      weight[size] = weight_;
+      size++;
+    }
+
+    /** @returns The profile indices */
+    af::const_ref<std::size_t> indices() const {
+      return af::const_ref<std::size_t>(index, size);
+    }
+
+    /** @returns The profile weights */
+    af::const_ref<double> weights() const {
+      return af::const_ref<double>(weight, size);
+    }
+  };
+
   /**
    * Class for sampler interface
    */
@@ -68,6 +105,24 @@ namespace dials { namespace algorithms {
      * Return the neighbouring grid points.
      */
     virtual af::shared<std::size_t> neighbours(std::size_t index) const = 0;
+
+    /**
+     * Find the nearest n reference profiles to the given point, as given by
+     * nearest_n, and their weights. Samplers may override this to use tables
+     * of neighbours and to share work between the weights.
+     * @param panel The panel
+     * @param xyz The coordinate
+     * @param result The profile indices and weights
+     */
+    virtual void nearest_n_weights(std::size_t panel,
+                                   double3 xyz,
+                                   SamplerNeighbours &result) const {
+      af::shared<std::size_t> indices = nearest_n(panel, xyz);
+      result.size = 0;
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        result.push_back(indices[i], weight(indices[i], panel, xyz));
+      }
+    }
   };
 
 }}  // namespace dials::algorithms
@@ -9,6 +9,7 @@ namespace dials { namespace refinement { namespace boost_python {
 
   void export_gallego_yezzi() {
     def("dRq_de", &dRq_de, (arg("theta"), arg("e1"), arg("q")));
+    def("dRq_de_dot", &dRq_de_dot, (arg("theta"), arg("e1"), arg("q"), arg("w")));
   }
 
 }}}  // namespace dials::refinement::boost_python
@@ -27,7 +27,8 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("spacing", &GaussianSmoother::spacing)
       .def("positions", &GaussianSmoother::positions)
       .def("value_weight", &GaussianSmoother::value_weight)
-      .def("multi_value_weight", &GaussianSmoother::multi_value_weight);
+      .def("multi_value_weight", &GaussianSmoother::multi_value_weight)
+      .def("multi_value", &GaussianSmoother::multi_value);
 
     class_<SingleValueWeights>("SingleValueWeights", no_init)
       .def("get_value", &SingleValueWeights::get_value)
@@ -37,7 +37,8 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("y_positions", &GaussianSmoother3D::y_positions)
       .def("z_positions", &GaussianSmoother3D::z_positions)
       .def("value_weight", &GaussianSmoother3D::value_weight)
-      .def("multi_value_weight", &GaussianSmoother3D::multi_value_weight);
+      .def("multi_value_weight", &GaussianSmoother3D::multi_value_weight)
+      .def("multi_value", &GaussianSmoother3D::multi_value);
   }
 
 }}}  // namespace dials::refinement::boost_python
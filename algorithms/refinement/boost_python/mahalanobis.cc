@@ -8,7 +8,19 @@ using namespace boost::python;
 namespace dials { namespace refinement { namespace boost_python {
 
   void export_mahalanobis() {
-    def("maha_dist_sq", &maha_dist_sq, (arg("obs"), arg("center"), arg("cov")));
+    def("maha_dist_sq",
+        &maha_dist_sq,
+        (arg("obs"), arg("center"), arg("cov"), arg("nthreads") = 1));
+
+    class_<MCDSubset>("MCDSubset", no_init)
+      .def(init<const af::const_ref<double, af::c_grid<2> > &,
+                std::size_t,
+                std::size_t>((arg("obs"), arg("h"), arg("nthreads") = 1)))
+      .def("concentration_step",
+           &MCDSubset::concentration_step,
+           (arg("T"), arg("S")))
+      .def("center", &MCDSubset::center)
+      .def("covariance", &MCDSubset::covariance);
   }
 
 }}}  // namespace dials::refinement::boost_python
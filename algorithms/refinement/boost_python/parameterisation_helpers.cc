@@ -77,6 +77,52 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("d2", &PanelGroupCompose::d2)
       .def("origin", &PanelGroupCompose::origin)
       .def("derivatives_for_panel", &PanelGroupCompose::derivatives_for_panel);
+
+    class_<CrystalOrientationComposeMulti>("CrystalOrientationComposeMulti", no_init)
+      .def(init<mat3<double>,
+                af::const_ref<double>,
+                vec3<double>,
+                af::const_ref<double>,
+                vec3<double>,
+                af::const_ref<double>,
+                vec3<double>,
+                std::size_t>((arg("U0"),
+                              arg("phi1"),
+                              arg("phi1_axis"),
+                              arg("phi2"),
+                              arg("phi2_axis"),
+                              arg("phi3"),
+                              arg("phi3_axis"),
+                              arg("nthreads") = 1)))
+      .def("U", &CrystalOrientationComposeMulti::U)
+      .def("dU_dphi1", &CrystalOrientationComposeMulti::dU_dphi1)
+      .def("dU_dphi2", &CrystalOrientationComposeMulti::dU_dphi2)
+      .def("dU_dphi3", &CrystalOrientationComposeMulti::dU_dphi3);
+
+    class_<PanelGroupComposeMulti>("PanelGroupComposeMulti", no_init)
+      .def(init<vec3<double>,
+                vec3<double>,
+                vec3<double>,
+                vec3<double>,
+                af::const_ref<double, af::c_grid<2> >,
+                af::const_ref<vec3<double> >,
+                af::const_ref<vec3<double> >,
+                af::const_ref<vec3<double> >,
+                af::const_ref<vec3<double> >,
+                std::size_t>((arg("initial_d1"),
+                              arg("initial_d2"),
+                              arg("initial_dn"),
+                              arg("initial_gp_offset"),
+                              arg("param_vals"),
+                              arg("param_axes"),
+                              arg("offsets"),
+                              arg("dir1s"),
+                              arg("dir2s"),
+                              arg("nthreads") = 1)))
+      .def("d1", &PanelGroupComposeMulti::d1)
+      .def("d2", &PanelGroupComposeMulti::d2)
+      .def("origin", &PanelGroupComposeMulti::origin)
+      .def("derivatives_for_panel", &PanelGroupComposeMulti::derivatives_for_panel);
   }
 
 }}}  // namespace dials::refinement::boost_python
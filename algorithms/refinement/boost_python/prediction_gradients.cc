@@ -0,0 +1,59 @@
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <scitbx/array_family/boost_python/flex_wrapper.h>
+#include "../parameterisation/prediction_gradients.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  void export_prediction_gradients() {
+    class_<XYPhiGradients>("XYPhiGradients", no_init)
+      .def("dX", &XYPhiGradients::dX)
+      .def("dY", &XYPhiGradients::dY)
+      .def("dphi", &XYPhiGradients::dphi);
+
+    class_<XYPhiGradientCalculator>("XYPhiGradientCalculator", no_init)
+      .def(init<af::shared<mat3<double> >,
+                af::shared<double>,
+                af::shared<double>,
+                af::shared<double>,
+                af::shared<vec3<double> >,
+                af::shared<double>,
+                std::size_t>((arg("D"),
+                              arg("w_inv"),
+                              arg("u_w_inv"),
+                              arg("v_w_inv"),
+                              arg("e_X_r"),
+                              arg("e_r_s0"),
+                              arg("nthreads") = 1)))
+      .def("size", &XYPhiGradientCalculator::size)
+      .def("detector_gradients",
+           &XYPhiGradientCalculator::detector_gradients,
+           (arg("dd_dp"), arg("pv")))
+      .def("beam_gradients",
+           &XYPhiGradientCalculator::beam_gradients,
+           (arg("ds0_dp"), arg("r")))
+      .def("crystal_gradients",
+           &XYPhiGradientCalculator::crystal_gradients,
+           (arg("der"),
+            arg("other"),
+            arg("b_matrix"),
+            arg("fixed_rotation"),
+            arg("setting_rotation"),
+            arg("axis"),
+            arg("phi_calc"),
+            arg("h"),
+            arg("s1")))
+      .def("goniometer_gradients",
+           &XYPhiGradientCalculator::goniometer_gradients,
+           (arg("dS_dp"),
+            arg("UB"),
+            arg("fixed_rotation"),
+            arg("axis"),
+            arg("phi_calc"),
+            arg("h"),
+            arg("s1")));
+  }
+
+}}}  // namespace dials::refinement::boost_python
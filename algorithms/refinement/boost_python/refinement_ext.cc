@@ -1,6 +1,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/error.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 using namespace boost::python;
 
@@ -15,8 +16,10 @@ namespace dials { namespace refinement { namespace boost_python {
   void export_gaussian_smoother();
   void export_gaussian_smoother_2D();
   void export_gaussian_smoother_3D();
+  void export_prediction_gradients();
 
   BOOST_PYTHON_MODULE(dials_refinement_helpers_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_parameterisation_helpers();
     export_gallego_yezzi();
     export_mahalanobis();
@@ -26,5 +29,6 @@ namespace dials { namespace refinement { namespace boost_python {
     export_gaussian_smoother();
     export_gaussian_smoother_2D();
     export_gaussian_smoother_3D();
+    export_prediction_gradients();
   }
 }}}  // namespace dials::refinement::boost_python
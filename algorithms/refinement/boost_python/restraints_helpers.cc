@@ -24,7 +24,27 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("dc_dp", &CalculateCellGradients::dc_dp)
       .def("daa_dp", &CalculateCellGradients::daa_dp)
       .def("dbb_dp", &CalculateCellGradients::dbb_dp)
-      .def("dcc_dp", &CalculateCellGradients::dcc_dp);
+      .def("dcc_dp", &CalculateCellGradients::dcc_dp)
+      .def("cell_parameters", &CalculateCellGradients::cell_parameters);
+
+    class_<CalculateCellGradientsMulti>("CalculateCellGradientsMulti", no_init)
+      .def(init<af::const_ref<mat3<double> >,
+                af::const_ref<mat3<double> >,
+                af::const_ref<std::size_t>,
+                std::size_t>(
+        (arg("B"), arg("dB_dp"), arg("nparam"), arg("nthreads") = 1)))
+      .def("a", &CalculateCellGradientsMulti::a)
+      .def("b", &CalculateCellGradientsMulti::b)
+      .def("c", &CalculateCellGradientsMulti::c)
+      .def("alpha", &CalculateCellGradientsMulti::alpha)
+      .def("beta", &CalculateCellGradientsMulti::beta)
+      .def("gamma", &CalculateCellGradientsMulti::gamma)
+      .def("da_dp", &CalculateCellGradientsMulti::da_dp)
+      .def("db_dp", &CalculateCellGradientsMulti::db_dp)
+      .def("dc_dp", &CalculateCellGradientsMulti::dc_dp)
+      .def("daa_dp", &CalculateCellGradientsMulti::daa_dp)
+      .def("dbb_dp", &CalculateCellGradientsMulti::dbb_dp)
+      .def("dcc_dp", &CalculateCellGradientsMulti::dcc_dp);
   }
 
 }}}  // namespace dials::refinement::boost_python
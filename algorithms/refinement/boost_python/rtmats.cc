@@ -20,6 +20,9 @@ namespace dials { namespace refinement { namespace boost_python {
     def("dR_from_axis_and_angle",
         &dR_from_axis_and_angle,
         (arg("axis"), arg("angle"), arg("deg") = false));
+    def("dRv_from_axis_and_angle",
+        &dRv_from_axis_and_angle,
+        (arg("axis"), arg("angle"), arg("v"), arg("deg") = false));
   }
 
 }}}  // namespace dials::refinement::boost_python
@@ -23,6 +23,92 @@ namespace dials { namespace refinement {
     return v[0] * L1 + v[1] * L2 + v[2] * L3;
   }
 
+  namespace detail {
+
+    /**
+     * The parts of the Gallego & Yezzi derivative that depend only on the
+     * angle and axis of rotation. They are kept while consecutive elements
+     * share the same angle and axis, as in scan-varying refinement where many
+     * reflections are on the same frame.
+     */
+    class GallegoYezziTerms {
+    public:
+      GallegoYezziTerms()
+          : theta_(0.0), zero_(true), valid_(false), changed_(false) {}
+
+      /**
+       * Update the terms for an angle and axis
+       * @returns False if the angle is near zero and the derivative is null
+       */
+      bool update(double theta, const vec3<double> &e1) {
+        changed_ = !(valid_ && theta == theta_ && e1 == e1_);
+        if (!changed_) {
+          return !zero_;
+        }
+        theta_ = theta;
+        e1_ = e1;
+        valid_ = true;
+
+        // for angle near zero the derivative is null
+        zero_ = fabs(theta) < 1.e-20;
+        if (zero_) {
+          return false;
+        }
+
+        // ensure the axis is unit
+        vec3<double> e1_u = e1.normalize();
+
+        // rotation matrix R, scaled by -1/theta, and R^T
+        mat3<double> R = axis_and_angle_as_matrix(e1_u, theta);
+        A_ = (-1.0 / theta) * R;
+        Rt_ = R.transpose();
+
+        // rotation vector v
+        v_ = theta * e1_u;
+        return true;
+      }
+
+      /**
+       * @returns (-1/theta) R
+       */
+      const mat3<double> &A() const {
+        return A_;
+      }
+
+      /**
+       * @returns The transpose of the rotation matrix R
+       */
+      const mat3<double> &Rt() const {
+        return Rt_;
+      }
+
+      /**
+       * @returns The rotation vector v
+       */
+      const vec3<double> &v() const {
+        return v_;
+      }
+
+      /**
+       * @returns True if the last update changed the angle or axis
+       */
+      bool changed() const {
+        return changed_;
+      }
+
+    private:
+      double theta_;
+      vec3<double> e1_;
+      bool zero_;
+      bool valid_;
+      bool changed_;
+      mat3<double> A_;
+      mat3<double> Rt_;
+      vec3<double> v_;
+    };
+
+  }  // namespace detail
+
   af::shared<mat3<double> > dRq_de(const af::const_ref<double> &theta,
                                    const af::const_ref<vec3<double> > &e1,
                                    const af::const_ref<vec3<double> > &q) {
@@ -42,44 +128,82 @@ namespace dials { namespace refinement {
     // null matrix
     mat3<double> null_mat(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
 
+    // the terms that depend only on the angle and axis, and the product
+    // (v * v^T + (R^T - I) * [v]_x) built from them
+    detail::GallegoYezziTerms terms;
+    mat3<double> M;
+
     for (std::size_t i = 0; i < result.size(); i++) {
       // for angle near zero immediately return null mat
-      if (fabs(theta[i]) < 1.e-20) {
+      if (!terms.update(theta[i], e1[i])) {
         result[i] = null_mat;
         continue;
       }
 
-      // ensure the axis is unit
-      vec3<double> e1_u = e1[i].normalize();
-
-      // rotation matrix R
-      mat3<double> R = axis_and_angle_as_matrix(e1_u, theta[i]);
-
-      // rotation vector v
-      vec3<double> v = theta[i] * e1_u;
+      if (terms.changed()) {
+        // rotation vector v
+        const vec3<double> &v = terms.v();
+
+        // skew v
+        mat3<double> v_x = skew_symm(v);
+
+        // outer product, v * v^T
+        mat3<double> vvt(v[0] * v[0],
+                         v[0] * v[1],
+                         v[0] * v[2],
+                         v[1] * v[0],
+                         v[1] * v[1],
+                         v[1] * v[2],
+                         v[2] * v[0],
+                         v[2] * v[1],
+                         v[2] * v[2]);
+
+        M = vvt + (terms.Rt() - I3) * v_x;
+      }
 
-      // skew q
-      mat3<double> q_x = skew_symm(q[i]);
+      // do calculation and put this element in the result
+      result[i] = terms.A() * skew_symm(q[i]) * M;
+    }
 
-      // skew v
-      mat3<double> v_x = skew_symm(v);
+    return result;
+  }
 
-      // outer product, v * v^T
-      mat3<double> vvt(v[0] * v[0],
-                       v[0] * v[1],
-                       v[0] * v[2],
-                       v[1] * v[0],
-                       v[1] * v[1],
-                       v[1] * v[2],
-                       v[2] * v[0],
-                       v[2] * v[1],
-                       v[2] * v[2]);
+  /**
+   * Calculate the derivative of each rotated vector with respect to the axis
+   * of rotation, multiplied by a vector. This is dRq_de(theta, e1, q) * w
+   * without forming the matrices, so with [a]_x b = a x b it is
+   *
+   *   (-1/theta) R (q x (v (v.w) + (R^T - I) (v x w)))
+   *
+   * The rotation matrix is only recomputed when the angle or axis changes
+   * from one element to the next.
+   * @param theta The angles of rotation
+   * @param e1 The axes of rotation
+   * @param q The vectors before rotation
+   * @param w The vectors to multiply the derivatives by
+   * @returns The derivatives (dR/de1 q) w
+   */
+  af::shared<vec3<double> > dRq_de_dot(const af::const_ref<double> &theta,
+                                       const af::const_ref<vec3<double> > &e1,
+                                       const af::const_ref<vec3<double> > &q,
+                                       const af::const_ref<vec3<double> > &w) {
+    DIALS_ASSERT(theta.size() == e1.size());
+    DIALS_ASSERT(theta.size() == q.size());
+    DIALS_ASSERT(theta.size() == w.size());
 
-      // R^T
-      mat3<double> Rt = R.transpose();
+    af::shared<vec3<double> > result(theta.size(),
+                                     af::init_functor_null<vec3<double> >());
 
-      // do calculation and put this element in the result
-      result[i] = (-1.0 / theta[i]) * R * q_x * (vvt + (Rt - I3) * v_x);
+    detail::GallegoYezziTerms terms;
+    for (std::size_t i = 0; i < result.size(); i++) {
+      if (!terms.update(theta[i], e1[i])) {
+        result[i] = vec3<double>(0.0, 0.0, 0.0);
+        continue;
+      }
+      const vec3<double> &v = terms.v();
+      vec3<double> vxw = v.cross(w[i]);
+      vec3<double> u = v * (v * w[i]) + terms.Rt() * vxw - vxw;
+      result[i] = terms.A() * q[i].cross(u);
     }
 
     return result;
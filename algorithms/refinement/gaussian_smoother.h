@@ -255,6 +255,35 @@ namespace dials { namespace refinement {
       return MultiValueWeights(value, weight, sumweight);
     }
 
+    /**
+     * Calculate multiple interpolated values of the parameters at points using
+     * the original unnormalised coordinate. This is multi_value_weight without
+     * the matrix of weights, for when only the values are needed.
+     * @param x The array of points to interpolate at
+     * @param param The parameter values
+     */
+    af::shared<double> multi_value(const af::const_ref<double> x,
+                                   const af::const_ref<double> values) {
+      af::shared<double> value(x.size(), af::init_functor_null<double>());
+      for (std::size_t irow = 0; irow < x.size(); ++irow) {
+        // normalised coordinate
+        double z = (x[irow] - x0) / spacing_;
+        double sumw = 0.0;
+        double sumwv = 0.0;
+
+        vec2<int> irange = idx_range(z);
+
+        for (int icol = irange[0]; icol < irange[1]; ++icol) {
+          double ds = (z - positions_[icol]) / sigma_;
+          double w = exp(-ds * ds);
+          sumw += w;
+          sumwv += w * values[icol];
+        }
+        value[irow] = sumw > 0.0 ? sumwv / sumw : 0.0;
+      }
+      return value;
+    }
+
   protected:
     vec2<int> idx_range(double z) {
       int i1, i2;
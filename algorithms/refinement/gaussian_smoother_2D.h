@@ -1,7 +1,7 @@
 #ifndef DIALS_REFINEMENT_GAUSSIAN_SMOOTHER_2D_H
 #define DIALS_REFINEMENT_GAUSSIAN_SMOOTHER_2D_H
 
-#include <cmath>      // for exp, pow
+#include <cmath>      // for exp
 #include <algorithm>  // for std::min, std::max
 #include <scitbx/vec2.h>
 #include <scitbx/sparse/vector.h>
@@ -183,13 +183,16 @@ namespace dials { namespace refinement {
       vec2<int> irange = idx_range(z1, nxvalues, half_nxaverage, n_x_average);
       vec2<int> jrange = idx_range(z2, nyvalues, half_nyaverage, n_y_average);
 
+      // the gaussian is separable, so the weight is a product of one factor
+      // for each axis
+      double wx[max_range], wy[max_range];
+      axis_weights(z1, x_positions_, irange, wx);
+      axis_weights(z2, y_positions_, jrange, wy);
+
       for (int i = irange[0]; i < irange[1]; ++i) {
         for (int j = jrange[0]; j < jrange[1]; ++j) {
-          double ds =
-            pow(pow(z1 - x_positions_[i], 2) + pow(z2 - y_positions_[j], 2), 0.5)
-            / sigma_;
           int idx = i + (j * nxvalues);
-          weight[idx] = exp(-ds * ds);
+          weight[idx] = wx[i - irange[0]] * wy[j - jrange[0]];
           sumwv += weight[idx] * values[idx];
           sumweight += weight[idx];
         }
@@ -242,13 +245,13 @@ namespace dials { namespace refinement {
         vec2<int> irange = idx_range(z1, nxvalues, half_nxaverage, n_x_average);
         vec2<int> jrange = idx_range(z2, nyvalues, half_nyaverage, n_y_average);
 
+        double wx[max_range], wy[max_range];
+        axis_weights(z1, x_positions_, irange, wx);
+        axis_weights(z2, y_positions_, jrange, wy);
+
         for (int icol = irange[0]; icol < irange[1]; ++icol) {
           for (int jcol = jrange[0]; jcol < jrange[1]; ++jcol) {
-            double ds =
-              pow(pow(z1 - x_positions_[icol], 2) + pow(z2 - y_positions_[jcol], 2),
-                  0.5)
-              / sigma_;
-            double w = exp(-ds * ds);
+            double w = wx[icol - irange[0]] * wy[jcol - jrange[0]];
             int idx = icol + (jcol * nxvalues);
             weight(irow, idx) = w;
             sumw += w;
@@ -267,7 +270,61 @@ namespace dials { namespace refinement {
       return MultiValueWeights(value, weight, sumweight);
     }
 
+    /**
+     * Calculate multiple interpolated values of the parameters at points using
+     * the original unnormalised coordinate. This is multi_value_weight without
+     * the matrix of weights, for when only the values are needed.
+     * @param x The array of points to interpolate at
+     * @param param The parameter values
+     */
+    af::shared<double> multi_value(const af::const_ref<double> x,
+                                   const af::const_ref<double> y,
+                                   const af::const_ref<double> values) {
+      DIALS_ASSERT(y.size() == x.size());
+      af::shared<double> value(x.size(), af::init_functor_null<double>());
+      for (std::size_t irow = 0; irow < x.size(); ++irow) {
+        // normalised coordinate
+        double z1 = (x[irow] - x0) / x_spacing_;
+        double z2 = (y[irow] - y0) / y_spacing_;
+        double sumw = 0.0;
+        double sumwv = 0.0;
+
+        vec2<int> irange = idx_range(z1, nxvalues, half_nxaverage, n_x_average);
+        vec2<int> jrange = idx_range(z2, nyvalues, half_nyaverage, n_y_average);
+
+        double wx[max_range], wy[max_range];
+        axis_weights(z1, x_positions_, irange, wx);
+        axis_weights(z2, y_positions_, jrange, wy);
+
+        for (int icol = irange[0]; icol < irange[1]; ++icol) {
+          for (int jcol = jrange[0]; jcol < jrange[1]; ++jcol) {
+            double w = wx[icol - irange[0]] * wy[jcol - jrange[0]];
+            int idx = icol + (jcol * nxvalues);
+            sumw += w;
+            sumwv += w * values[idx];
+          }
+        }
+        value[irow] = sumw > 0.0 ? sumwv / sumw : 0.0;
+      }
+      return value;
+    }
+
   private:
+    // the largest number of positions that idx_range can select
+    static const int max_range = 5;
+
+    // the gaussian factor along one axis for each position in the range
+    void axis_weights(double z,
+                      af::shared<double> const& positions,
+                      vec2<int> range,
+                      double* w) const {
+      DIALS_ASSERT(range[1] - range[0] <= max_range);
+      for (int i = range[0]; i < range[1]; ++i) {
+        double ds = (z - positions[i]) / sigma_;
+        w[i - range[0]] = exp(-ds * ds);
+      }
+    }
+
     vec2<int> idx_range(double z,
                         std::size_t nvalues,
                         double half_naverage,
@@ -2,15 +2,110 @@
 #ifndef DIALS_REFINEMENT_MAHALANOBIS_H
 #define DIALS_REFINEMENT_MAHALANOBIS_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/array_family/versa_matrix.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
 
+  namespace detail {
+
+    /**
+     * Cholesky factorisation cov = L L^T of a symmetric matrix. L is returned
+     * in the lower triangle of a row-major array. Returns false if the matrix
+     * is not positive definite.
+     */
+    inline bool cholesky_lower(const af::const_ref<double, af::c_grid<2> > &cov,
+                               std::vector<double> &L) {
+      std::size_t n = cov.accessor()[0];
+      L.assign(n * n, 0.0);
+      for (std::size_t j = 0; j < n; j++) {
+        double d = cov(j, j);
+        for (std::size_t k = 0; k < j; k++) {
+          d -= L[j * n + k] * L[j * n + k];
+        }
+        if (!(d > 0.0)) {
+          return false;
+        }
+        L[j * n + j] = std::sqrt(d);
+        for (std::size_t i = j + 1; i < n; i++) {
+          double s = cov(i, j);
+          for (std::size_t k = 0; k < j; k++) {
+            s -= L[i * n + k] * L[j * n + k];
+          }
+          L[i * n + j] = s / L[j * n + j];
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Mahalanobis distance squared of the observations [first, last) by
+     * forward substitution with the Cholesky factor L of the covariance, as
+     * (x - mu)^T [S]^-1 (x - mu) = y^T y where L y = (x - mu)
+     */
+    inline void maha_dist_sq_cholesky_band(
+      af::const_ref<double, af::c_grid<2> > obs,
+      af::const_ref<double> center,
+      const std::vector<double> &L,
+      af::ref<double> d2,
+      std::size_t first,
+      std::size_t last) {
+      std::size_t nparam = center.size();
+      std::vector<double> y(nparam);
+      for (std::size_t i = first; i < last; i++) {
+        double sum = 0.0;
+        for (std::size_t j = 0; j < nparam; j++) {
+          double r = obs(i, j) - center[j];
+          for (std::size_t k = 0; k < j; k++) {
+            r -= L[j * nparam + k] * y[k];
+          }
+          y[j] = r / L[j * nparam + j];
+          sum += y[j] * y[j];
+        }
+        d2[i] = sum;
+      }
+    }
+
+    /**
+     * Mahalanobis distance squared of the observations [first, last) using
+     * the inverse of the covariance, for when it is not positive definite
+     */
+    inline void maha_dist_sq_inverse_band(af::const_ref<double, af::c_grid<2> > obs,
+                                          af::const_ref<double> center,
+                                          af::const_ref<double, af::c_grid<2> > covinv,
+                                          af::ref<double> d2,
+                                          std::size_t first,
+                                          std::size_t last) {
+      std::size_t nparam = center.size();
+      std::vector<double> row(nparam);
+      for (std::size_t i = first; i < last; i++) {
+        for (std::size_t j = 0; j < nparam; j++) {
+          row[j] = obs(i, j) - center[j];
+        }
+        double sum = 0.0;
+        for (std::size_t j = 0; j < nparam; j++) {
+          double prod = 0.0;
+          for (std::size_t k = 0; k < nparam; k++) {
+            prod += covinv(j, k) * row[k];
+          }
+          sum += row[j] * prod;
+        }
+        d2[i] = sum;
+      }
+    }
+
+  }  // namespace detail
+
   af::shared<double> maha_dist_sq(const af::const_ref<double, af::c_grid<2> > &obs,
                                   const af::const_ref<double> &center,
-                                  const af::const_ref<double, af::c_grid<2> > &cov) {
+                                  const af::const_ref<double, af::c_grid<2> > &cov,
+                                  std::size_t nthreads = 1) {
     std::size_t nobs = obs.accessor()[0];
     std::size_t nparam = obs.accessor()[1];
 
@@ -20,41 +115,193 @@ namespace dials { namespace refinement {
     DIALS_ASSERT(cov.accessor()[0] == nparam);
     DIALS_ASSERT(cov.accessor().is_square());
 
-    // invert covariance matrix
+    // create output array
+    af::shared<double> d2(nobs);
+
+    // factorise the covariance matrix once, then solve for all observations
+    std::vector<double> L;
+    if (detail::cholesky_lower(cov, L)) {
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&detail::maha_dist_sq_cholesky_band,
+                    obs,
+                    center,
+                    boost::cref(L),
+                    d2.ref(),
+                    _1,
+                    _2),
+        nobs,
+        nthreads);
+      return d2;
+    }
+
+    // otherwise invert the covariance matrix
     af::versa<double, af::c_grid<2> > covinv(cov.accessor());
     std::copy(cov.begin(), cov.end(), covinv.begin());
     af::matrix_inversion_in_place(covinv.ref());
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&detail::maha_dist_sq_inverse_band,
+                  obs,
+                  center,
+                  covinv.const_ref(),
+                  d2.ref(),
+                  _1,
+                  _2),
+      nobs,
+      nthreads);
+    return d2;
+  }
 
-    // create output array
-    af::shared<double> d2(nobs);
+  /**
+   * A subset of h observations for the concentration steps (C-steps) of the
+   * FAST-MCD algorithm. The sums of the observations and of their outer
+   * products over the subset are kept, so that a C-step updates the location
+   * and covariance from the observations that enter or leave the subset,
+   * rather than recalculating them over all h observations.
+   */
+  class MCDSubset {
+  public:
+    /**
+     * @param obs The observations, one per row
+     * @param h The size of the subset
+     * @param nthreads The number of threads for the distance calculation
+     */
+    MCDSubset(const af::const_ref<double, af::c_grid<2> > &obs,
+              std::size_t h,
+              std::size_t nthreads = 1)
+        : obs_(obs.accessor()),
+          n_(obs.accessor()[0]),
+          p_(obs.accessor()[1]),
+          h_(h),
+          nthreads_(nthreads),
+          shift_(p_, 0.0),
+          sum_(p_, 0.0),
+          sumsq_(p_ * p_, 0.0),
+          in_subset_(n_, false) {
+      DIALS_ASSERT(h_ > p_ && h_ <= n_);
+
+      // Store the observations relative to their means, to limit the loss of
+      // precision in the covariance from sums of squares
+      for (std::size_t i = 0; i < n_; i++) {
+        for (std::size_t j = 0; j < p_; j++) {
+          shift_[j] += obs(i, j);
+        }
+      }
+      for (std::size_t j = 0; j < p_; j++) {
+        shift_[j] /= n_;
+      }
+      for (std::size_t i = 0; i < n_; i++) {
+        for (std::size_t j = 0; j < p_; j++) {
+          obs_(i, j) = obs(i, j) - shift_[j];
+        }
+      }
+    }
 
-    // loop over observations
-    std::size_t k = 0;
-    for (std::size_t i = 0; i < nobs; i++) {
-      // copy row from obs and shift by means
-      af::shared<double> row(nparam);
+    /**
+     * Set the subset to the h observations with the smallest Mahalanobis
+     * distances for the location T and covariance S
+     */
+    void concentration_step(const af::const_ref<double> &T,
+                            const af::const_ref<double, af::c_grid<2> > &S) {
+      DIALS_ASSERT(T.size() == p_);
+      af::shared<double> center(p_);
+      for (std::size_t j = 0; j < p_; j++) {
+        center[j] = T[j] - shift_[j];
+      }
+      af::shared<double> d2 =
+        maha_dist_sq(obs_.const_ref(), center.const_ref(), S, nthreads_);
 
-      for (std::size_t j = 0; j < nparam; j++) {
-        row[j] = obs[k] - center[j];
-        k++;
+      // select the h closest observations
+      std::vector<std::size_t> order(n_);
+      for (std::size_t i = 0; i < n_; i++) {
+        order[i] = i;
+      }
+      std::stable_sort(order.begin(), order.end(), CompareDistance(d2.const_ref()));
+      std::vector<bool> selected(n_, false);
+      for (std::size_t i = 0; i < h_; i++) {
+        selected[order[i]] = true;
       }
 
-      // Mahalanobis distance squared is defined by the matrix product
-      //
-      // (x - mu)^T [S]^-1 (x - mu)
-      //
-      // (x - mu) is in 'row' and [S]^-1 is 'covinv'. Perform the right
-      // hand part of the product first with matrix_multiply and the
-      // second step is just a dot product.
-      af::shared<double> prod =
-        af::matrix_multiply(covinv.const_ref(), row.const_ref());
-      d2[i] = 0.0;
-      for (std::size_t j = 0; j < nparam; j++) {
-        d2[i] += row[j] * prod[j];
+      // update the sums from the observations that changed, or start again if
+      // that is no cheaper
+      std::size_t nchanged = 0;
+      for (std::size_t i = 0; i < n_; i++) {
+        if (selected[i] != in_subset_[i]) {
+          nchanged++;
+        }
       }
+      if (nchanged >= h_) {
+        std::fill(sum_.begin(), sum_.end(), 0.0);
+        std::fill(sumsq_.begin(), sumsq_.end(), 0.0);
+        for (std::size_t i = 0; i < n_; i++) {
+          if (selected[i]) {
+            accumulate(i, 1.0);
+          }
+        }
+      } else {
+        for (std::size_t i = 0; i < n_; i++) {
+          if (selected[i] != in_subset_[i]) {
+            accumulate(i, selected[i] ? 1.0 : -1.0);
+          }
+        }
+      }
+      in_subset_.swap(selected);
     }
-    return d2;
-  }
+
+    /**
+     * @returns The mean of the observations in the subset
+     */
+    af::shared<double> center() const {
+      af::shared<double> result(p_);
+      for (std::size_t j = 0; j < p_; j++) {
+        result[j] = shift_[j] + sum_[j] / h_;
+      }
+      return result;
+    }
+
+    /**
+     * @returns The sample covariance matrix of the observations in the subset
+     */
+    af::versa<double, af::c_grid<2> > covariance() const {
+      af::versa<double, af::c_grid<2> > result(af::c_grid<2>(p_, p_));
+      for (std::size_t j = 0; j < p_; j++) {
+        for (std::size_t k = j; k < p_; k++) {
+          double c = (sumsq_[j * p_ + k] - sum_[j] * sum_[k] / h_) / (h_ - 1);
+          result(j, k) = c;
+          result(k, j) = c;
+        }
+      }
+      return result;
+    }
+
+  private:
+    struct CompareDistance {
+      af::const_ref<double> d2;
+      CompareDistance(af::const_ref<double> d2_) : d2(d2_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return d2[a] < d2[b];
+      }
+    };
+
+    void accumulate(std::size_t i, double sign) {
+      for (std::size_t j = 0; j < p_; j++) {
+        double yj = sign * obs_(i, j);
+        sum_[j] += yj;
+        for (std::size_t k = j; k < p_; k++) {
+          sumsq_[j * p_ + k] += yj * obs_(i, k);
+        }
+      }
+    }
+
+    af::versa<double, af::c_grid<2> > obs_;
+    std::size_t n_;
+    std::size_t p_;
+    std::size_t h_;
+    std::size_t nthreads_;
+    std::vector<double> shift_;
+    std::vector<double> sum_;
+    std::vector<double> sumsq_;
+    std::vector<bool> in_subset_;
+  };
 
 }}  // namespace dials::refinement
 
@@ -2,13 +2,16 @@
 #ifndef DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
 #define DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
 
+#include <boost/bind.hpp>
 #include <scitbx/vec3.h>
 #include <scitbx/mat3.h>
+#include <scitbx/array_family/accessors/c_grid.h>
 #include <cctbx/miller.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/panel.h>
 #include <dials/error.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 //#include <dials/algorithms/refinement/rtmats.h>
 #include <scitbx/math/r3_rotation.h>
 
@@ -926,6 +929,201 @@ namespace dials { namespace refinement {
     mat3<double> dU_dphi3_;
   };
 
+  /**
+   * Batch version of PanelGroupCompose for the values of the six panel group
+   * parameters at many scan points. The new group frame and the derivatives of
+   * the d matrix of each panel in the group are calculated for all scan points
+   * in a single call, split over threads by scan point.
+   */
+  class PanelGroupComposeMulti {
+  public:
+    /**
+     * @param param_vals The parameter values, with one row per parameter and
+     * one column per scan point
+     * @param offsets The offsets of each panel in the group
+     * @param dir1s The dir1 of each panel in the group frame basis
+     * @param dir2s The dir2 of each panel in the group frame basis
+     * @param nthreads The number of threads
+     */
+    PanelGroupComposeMulti(const vec3<double> &initial_d1,
+                           const vec3<double> &initial_d2,
+                           const vec3<double> &initial_dn,
+                           const vec3<double> &initial_gp_offset,
+                           const af::const_ref<double, af::c_grid<2> > &param_vals,
+                           const af::const_ref<vec3<double> > &param_axes,
+                           const af::const_ref<vec3<double> > &offsets,
+                           const af::const_ref<vec3<double> > &dir1s,
+                           const af::const_ref<vec3<double> > &dir2s,
+                           std::size_t nthreads = 1)
+        : id1_(initial_d1),
+          id2_(initial_d2),
+          idn_(initial_dn),
+          igp_offset_(initial_gp_offset),
+          param_axes_(param_axes.begin(), param_axes.end()),
+          n_(param_vals.accessor()[1]),
+          npanel_(offsets.size()),
+          d1_(n_, af::init_functor_null<vec3<double> >()),
+          d2_(n_, af::init_functor_null<vec3<double> >()),
+          origin_(n_, af::init_functor_null<vec3<double> >()),
+          derivatives_(npanel_ * 6 * n_, af::init_functor_null<mat3<double> >()) {
+      DIALS_ASSERT(param_vals.accessor()[0] == 6 && param_axes.size() == 6);
+      DIALS_ASSERT(dir1s.size() == npanel_ && dir2s.size() == npanel_);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PanelGroupComposeMulti::compose_band,
+                    this,
+                    param_vals,
+                    offsets,
+                    dir1s,
+                    dir2s,
+                    _1,
+                    _2),
+        n_,
+        nthreads);
+    }
+
+    af::shared<vec3<double> > d1() const {
+      return d1_;
+    }
+
+    af::shared<vec3<double> > d2() const {
+      return d2_;
+    }
+
+    af::shared<vec3<double> > origin() const {
+      return origin_;
+    }
+
+    /**
+     * Get the derivatives of the d matrix of one panel in the group wrt each
+     * of the six parameters. The derivatives for the first parameter at every
+     * scan point come first, followed by those for the second parameter, etc.
+     * @param ipanel The index of the panel within the group
+     */
+    af::shared<mat3<double> > derivatives_for_panel(std::size_t ipanel) const {
+      DIALS_ASSERT(ipanel < npanel_);
+      const mat3<double> *first = derivatives_.begin() + ipanel * 6 * n_;
+      return af::shared<mat3<double> >(first, first + 6 * n_);
+    }
+
+  private:
+    void compose_band(af::const_ref<double, af::c_grid<2> > param_vals,
+                      af::const_ref<vec3<double> > offsets,
+                      af::const_ref<vec3<double> > dir1s,
+                      af::const_ref<vec3<double> > dir2s,
+                      std::size_t first,
+                      std::size_t last) {
+      af::shared<double> vals(6);
+      for (std::size_t i = first; i < last; ++i) {
+        for (std::size_t j = 0; j < 6; ++j) {
+          vals[j] = param_vals(j, i);
+        }
+        PanelGroupCompose pgc(
+          id1_, id2_, idn_, igp_offset_, vals.const_ref(), param_axes_.const_ref());
+        d1_[i] = pgc.d1();
+        d2_[i] = pgc.d2();
+        origin_[i] = pgc.origin();
+        for (std::size_t p = 0; p < npanel_; ++p) {
+          af::shared<mat3<double> > d =
+            pgc.derivatives_for_panel(offsets[p], dir1s[p], dir2s[p]);
+          for (std::size_t j = 0; j < 6; ++j) {
+            derivatives_[(p * 6 + j) * n_ + i] = d[j];
+          }
+        }
+      }
+    }
+
+    vec3<double> id1_;
+    vec3<double> id2_;
+    vec3<double> idn_;
+    vec3<double> igp_offset_;
+    af::shared<vec3<double> > param_axes_;
+    std::size_t n_;
+    std::size_t npanel_;
+    af::shared<vec3<double> > d1_;
+    af::shared<vec3<double> > d2_;
+    af::shared<vec3<double> > origin_;
+    af::shared<mat3<double> > derivatives_;
+  };
+
+  /**
+   * Batch version of CrystalOrientationCompose. Given the values of phi1, phi2
+   * and phi3 (in mrad) at many scan points, calculate U plus the derivatives
+   * dU/dphi1, dU/dphi2 and dU/dphi3 at every scan point in a single call,
+   * split over threads by scan point.
+   */
+  class CrystalOrientationComposeMulti {
+  public:
+    CrystalOrientationComposeMulti(const mat3<double> &U0,
+                                   const af::const_ref<double> &phi1,
+                                   const vec3<double> &phi1_axis,
+                                   const af::const_ref<double> &phi2,
+                                   const vec3<double> &phi2_axis,
+                                   const af::const_ref<double> &phi3,
+                                   const vec3<double> &phi3_axis,
+                                   std::size_t nthreads = 1)
+        : U0_(U0),
+          phi1_axis_(phi1_axis),
+          phi2_axis_(phi2_axis),
+          phi3_axis_(phi3_axis),
+          U_(phi1.size(), af::init_functor_null<mat3<double> >()),
+          dU_dphi1_(phi1.size(), af::init_functor_null<mat3<double> >()),
+          dU_dphi2_(phi1.size(), af::init_functor_null<mat3<double> >()),
+          dU_dphi3_(phi1.size(), af::init_functor_null<mat3<double> >()) {
+      DIALS_ASSERT(phi2.size() == phi1.size() && phi3.size() == phi1.size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&CrystalOrientationComposeMulti::compose_band,
+                    this,
+                    phi1,
+                    phi2,
+                    phi3,
+                    _1,
+                    _2),
+        phi1.size(),
+        nthreads);
+    }
+
+    af::shared<mat3<double> > U() const {
+      return U_;
+    }
+
+    af::shared<mat3<double> > dU_dphi1() const {
+      return dU_dphi1_;
+    }
+
+    af::shared<mat3<double> > dU_dphi2() const {
+      return dU_dphi2_;
+    }
+
+    af::shared<mat3<double> > dU_dphi3() const {
+      return dU_dphi3_;
+    }
+
+  private:
+    void compose_band(af::const_ref<double> phi1,
+                      af::const_ref<double> phi2,
+                      af::const_ref<double> phi3,
+                      std::size_t first,
+                      std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        CrystalOrientationCompose coc(
+          U0_, phi1[i], phi1_axis_, phi2[i], phi2_axis_, phi3[i], phi3_axis_);
+        U_[i] = coc.U();
+        dU_dphi1_[i] = coc.dU_dphi1();
+        dU_dphi2_[i] = coc.dU_dphi2();
+        dU_dphi3_[i] = coc.dU_dphi3();
+      }
+    }
+
+    mat3<double> U0_;
+    vec3<double> phi1_axis_;
+    vec3<double> phi2_axis_;
+    vec3<double> phi3_axis_;
+    af::shared<mat3<double> > U_;
+    af::shared<mat3<double> > dU_dphi1_;
+    af::shared<mat3<double> > dU_dphi2_;
+    af::shared<mat3<double> > dU_dphi3_;
+  };
+
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
@@ -0,0 +1,350 @@
+
+#ifndef DIALS_REFINEMENT_PREDICTION_GRADIENTS_H
+#define DIALS_REFINEMENT_PREDICTION_GRADIENTS_H
+
+#include <boost/bind.hpp>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <dials/error.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+
+namespace dials { namespace refinement {
+
+  using scitbx::mat3;
+  using scitbx::vec3;
+
+  /**
+   * The gradients of the predicted X, Y and phi of a set of reflections with
+   * respect to one parameter
+   */
+  class XYPhiGradients {
+  public:
+    XYPhiGradients(std::size_t n) : dX_(n), dY_(n), dphi_(n) {}
+
+    af::shared<double> dX() const {
+      return dX_;
+    }
+
+    af::shared<double> dY() const {
+      return dY_;
+    }
+
+    af::shared<double> dphi() const {
+      return dphi_;
+    }
+
+    af::shared<double> dX_;
+    af::shared<double> dY_;
+    af::shared<double> dphi_;
+  };
+
+  namespace detail {
+
+    /**
+     * Convert the derivative of pv to derivatives of X and Y by the quotient
+     * rule, as _calc_dX_dp_and_dY_dp_from_dpv_dp
+     */
+    inline void set_dX_dY(const vec3<double> &dpv,
+                          double w_inv,
+                          double u_w_inv,
+                          double v_w_inv,
+                          double &dX,
+                          double &dY) {
+      dX = w_inv * (dpv[0] - dpv[2] * u_w_inv);
+      dY = w_inv * (dpv[1] - dpv[2] * v_w_inv);
+    }
+
+    /**
+     * The reflection data common to the gradients of all parameters, selected
+     * for the reflections affected by a parameterisation
+     */
+    struct XYPhiGradientData {
+      af::const_ref<mat3<double> > D;
+      af::const_ref<double> w_inv;
+      af::const_ref<double> u_w_inv;
+      af::const_ref<double> v_w_inv;
+      af::const_ref<vec3<double> > e_X_r;
+      af::const_ref<double> e_r_s0;
+    };
+
+    inline void detector_gradients_band(af::const_ref<mat3<double> > D,
+                                        af::const_ref<mat3<double> > dd_dp,
+                                        af::const_ref<vec3<double> > pv,
+                                        af::const_ref<double> w_inv,
+                                        af::const_ref<double> u_w_inv,
+                                        af::const_ref<double> v_w_inv,
+                                        XYPhiGradients &result,
+                                        std::size_t first,
+                                        std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        vec3<double> dpv = (D[i] * (dd_dp[i] * -1.0)) * pv[i];
+        set_dX_dY(
+          dpv, w_inv[i], u_w_inv[i], v_w_inv[i], result.dX_[i], result.dY_[i]);
+      }
+    }
+
+    inline void beam_gradients_band(XYPhiGradientData data,
+                                    af::const_ref<vec3<double> > ds0_dp,
+                                    af::const_ref<vec3<double> > r,
+                                    XYPhiGradients &result,
+                                    std::size_t first,
+                                    std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        double dphi = (r[i] * ds0_dp[i] / data.e_r_s0[i]) * -1.0;
+        vec3<double> dpv = data.D[i] * (data.e_X_r[i] * dphi + ds0_dp[i]);
+        result.dphi_[i] = dphi;
+        set_dX_dY(dpv,
+                  data.w_inv[i],
+                  data.u_w_inv[i],
+                  data.v_w_inv[i],
+                  result.dX_[i],
+                  result.dY_[i]);
+      }
+    }
+
+    /**
+     * The gradients from the derivative of the rotated reciprocal lattice
+     * vector r, for the crystal and goniometer parameters
+     */
+    inline void set_r_gradients(const XYPhiGradientData &data,
+                                const vec3<double> &dr,
+                                const vec3<double> &s1,
+                                std::size_t i,
+                                XYPhiGradients &result) {
+      double dphi = -1.0 * (dr * s1) / data.e_r_s0[i];
+      vec3<double> dpv = data.D[i] * (dr + data.e_X_r[i] * dphi);
+      result.dphi_[i] = dphi;
+      set_dX_dY(dpv,
+                data.w_inv[i],
+                data.u_w_inv[i],
+                data.v_w_inv[i],
+                result.dX_[i],
+                result.dY_[i]);
+    }
+
+    /**
+     * The rotation geometry of each reflection, grouped so that the band
+     * functions stay within the argument limit of boost::bind
+     */
+    struct RotationGeometry {
+      af::const_ref<mat3<double> > fixed_rotation;
+      af::const_ref<vec3<double> > axis;
+      af::const_ref<double> phi_calc;
+      af::const_ref<vec3<double> > h;
+      af::const_ref<vec3<double> > s1;
+    };
+
+    inline void crystal_gradients_band(XYPhiGradientData data,
+                                       af::const_ref<mat3<double> > der,
+                                       af::const_ref<mat3<double> > other,
+                                       bool b_matrix,
+                                       af::const_ref<mat3<double> > setting_rotation,
+                                       RotationGeometry geom,
+                                       XYPhiGradients &result,
+                                       std::size_t first,
+                                       std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        vec3<double> tmp =
+          b_matrix ? geom.fixed_rotation[i] * (der[i] * other[i] * geom.h[i])
+                   : geom.fixed_rotation[i] * (other[i] * der[i] * geom.h[i]);
+        vec3<double> dr = setting_rotation[i]
+                          * tmp.rotate_around_origin(geom.axis[i], geom.phi_calc[i]);
+        set_r_gradients(data, dr, geom.s1[i], i, result);
+      }
+    }
+
+    inline void goniometer_gradients_band(XYPhiGradientData data,
+                                          af::const_ref<mat3<double> > dS_dp,
+                                          af::const_ref<mat3<double> > UB,
+                                          RotationGeometry geom,
+                                          XYPhiGradients &result,
+                                          std::size_t first,
+                                          std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        vec3<double> tmp = geom.fixed_rotation[i] * (UB[i] * geom.h[i]);
+        vec3<double> dr =
+          dS_dp[i] * tmp.rotate_around_origin(geom.axis[i], geom.phi_calc[i]);
+        set_r_gradients(data, dr, geom.s1[i], i, result);
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * Calculate the gradients of X, Y and phi for the reflections affected by a
+   * parameterisation in one pass per parameter, in parallel over reflections,
+   * instead of building the flex temporaries of each step of the calculation.
+   * The data common to every parameter is held here; the derivatives of the
+   * model state are given per reflection, so that these can be used for both
+   * scan-static and scan-varying refinement.
+   */
+  class XYPhiGradientCalculator {
+  public:
+    XYPhiGradientCalculator(af::shared<mat3<double> > D,
+                            af::shared<double> w_inv,
+                            af::shared<double> u_w_inv,
+                            af::shared<double> v_w_inv,
+                            af::shared<vec3<double> > e_X_r,
+                            af::shared<double> e_r_s0,
+                            std::size_t nthreads = 1)
+        : D_(D),
+          w_inv_(w_inv),
+          u_w_inv_(u_w_inv),
+          v_w_inv_(v_w_inv),
+          e_X_r_(e_X_r),
+          e_r_s0_(e_r_s0),
+          nthreads_(nthreads) {
+      DIALS_ASSERT(w_inv.size() == D.size());
+      DIALS_ASSERT(u_w_inv.size() == D.size());
+      DIALS_ASSERT(v_w_inv.size() == D.size());
+      DIALS_ASSERT(e_X_r.size() == D.size());
+      DIALS_ASSERT(e_r_s0.size() == D.size());
+      DIALS_ASSERT(nthreads > 0);
+    }
+
+    std::size_t size() const {
+      return D_.size();
+    }
+
+    /**
+     * Gradients of X and Y for a detector parameter, from dD/dp for each
+     * reflection. phi does not depend on the detector.
+     */
+    XYPhiGradients detector_gradients(af::const_ref<mat3<double> > dd_dp,
+                                      af::const_ref<vec3<double> > pv) const {
+      DIALS_ASSERT(dd_dp.size() == size());
+      DIALS_ASSERT(pv.size() == size());
+      XYPhiGradients result(size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&detail::detector_gradients_band,
+                    D_.const_ref(),
+                    dd_dp,
+                    pv,
+                    w_inv_.const_ref(),
+                    u_w_inv_.const_ref(),
+                    v_w_inv_.const_ref(),
+                    boost::ref(result),
+                    _1,
+                    _2),
+        size(),
+        nthreads_);
+      return result;
+    }
+
+    /**
+     * Gradients for a beam parameter, from ds0/dp for each reflection
+     */
+    XYPhiGradients beam_gradients(af::const_ref<vec3<double> > ds0_dp,
+                                  af::const_ref<vec3<double> > r) const {
+      DIALS_ASSERT(ds0_dp.size() == size());
+      DIALS_ASSERT(r.size() == size());
+      XYPhiGradients result(size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&detail::beam_gradients_band,
+                    data(),
+                    ds0_dp,
+                    r,
+                    boost::ref(result),
+                    _1,
+                    _2),
+        size(),
+        nthreads_);
+      return result;
+    }
+
+    /**
+     * Gradients for a crystal parameter. If b_matrix, der is dU/dp and other
+     * is B; otherwise der is dB/dp and other is U.
+     */
+    XYPhiGradients crystal_gradients(af::const_ref<mat3<double> > der,
+                                     af::const_ref<mat3<double> > other,
+                                     bool b_matrix,
+                                     af::const_ref<mat3<double> > fixed_rotation,
+                                     af::const_ref<mat3<double> > setting_rotation,
+                                     af::const_ref<vec3<double> > axis,
+                                     af::const_ref<double> phi_calc,
+                                     af::const_ref<vec3<double> > h,
+                                     af::const_ref<vec3<double> > s1) const {
+      DIALS_ASSERT(der.size() == size());
+      DIALS_ASSERT(other.size() == size());
+      DIALS_ASSERT(fixed_rotation.size() == size());
+      DIALS_ASSERT(setting_rotation.size() == size());
+      DIALS_ASSERT(axis.size() == size());
+      DIALS_ASSERT(phi_calc.size() == size());
+      DIALS_ASSERT(h.size() == size());
+      DIALS_ASSERT(s1.size() == size());
+      detail::RotationGeometry geom = {fixed_rotation, axis, phi_calc, h, s1};
+      XYPhiGradients result(size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&detail::crystal_gradients_band,
+                    data(),
+                    der,
+                    other,
+                    b_matrix,
+                    setting_rotation,
+                    geom,
+                    boost::ref(result),
+                    _1,
+                    _2),
+        size(),
+        nthreads_);
+      return result;
+    }
+
+    /**
+     * Gradients for a goniometer parameter, from dS/dp for each reflection
+     */
+    XYPhiGradients goniometer_gradients(af::const_ref<mat3<double> > dS_dp,
+                                        af::const_ref<mat3<double> > UB,
+                                        af::const_ref<mat3<double> > fixed_rotation,
+                                        af::const_ref<vec3<double> > axis,
+                                        af::const_ref<double> phi_calc,
+                                        af::const_ref<vec3<double> > h,
+                                        af::const_ref<vec3<double> > s1) const {
+      DIALS_ASSERT(dS_dp.size() == size());
+      DIALS_ASSERT(UB.size() == size());
+      DIALS_ASSERT(fixed_rotation.size() == size());
+      DIALS_ASSERT(axis.size() == size());
+      DIALS_ASSERT(phi_calc.size() == size());
+      DIALS_ASSERT(h.size() == size());
+      DIALS_ASSERT(s1.size() == size());
+      detail::RotationGeometry geom = {fixed_rotation, axis, phi_calc, h, s1};
+      XYPhiGradients result(size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&detail::goniometer_gradients_band,
+                    data(),
+                    dS_dp,
+                    UB,
+                    geom,
+                    boost::ref(result),
+                    _1,
+                    _2),
+        size(),
+        nthreads_);
+      return result;
+    }
+
+  private:
+    detail::XYPhiGradientData data() const {
+      detail::XYPhiGradientData d = {D_.const_ref(),
+                                     w_inv_.const_ref(),
+                                     u_w_inv_.const_ref(),
+                                     v_w_inv_.const_ref(),
+                                     e_X_r_.const_ref(),
+                                     e_r_s0_.const_ref()};
+      return d;
+    }
+
+    af::shared<mat3<double> > D_;
+    af::shared<double> w_inv_;
+    af::shared<double> u_w_inv_;
+    af::shared<double> v_w_inv_;
+    af::shared<vec3<double> > e_X_r_;
+    af::shared<double> e_r_s0_;
+    std::size_t nthreads_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_PREDICTION_GRADIENTS_H
@@ -6,6 +6,7 @@
 
 from dials.algorithms.refinement import DialsRefineConfigError
 from dials.array_family import flex
+from dials_refinement_helpers_ext import XYPhiGradientCalculator, XYPhiGradients
 
 """The PredictionParameterisation class ties together parameterisations for
 individual experimental models: beam, crystal orientation, crystal unit cell
@@ -744,6 +745,47 @@ def _local_setup(self, reflections):
             print(matrix.col(reflections["s1"][imin]).accute_angle(vecn))
             raise e
 
+    def _gradient_calculator(self, isel):
+        """Return a calculator for the gradients of X, Y and phi of the
+        reflections selected by isel, which does each step of the calculation for
+        a parameter in a single pass over the reflections"""
+
+        return XYPhiGradientCalculator(
+            self._D.select(isel),
+            self._w_inv.select(isel),
+            self._u_w_inv.select(isel),
+            self._v_w_inv.select(isel),
+            self._e_X_r.select(isel),
+            self._e_r_s0.select(isel),
+        )
+
+    def _detector_derivatives(
+        self, isel, panel_id, parameterisation=None, dd_ddet_p=None, reflections=None
+    ):
+        """helper function to calculate the gradients of X and Y for the
+        parameters of a detector parameterisation. Derivatives that would all be
+        zero are replaced with None"""
+
+        if dd_ddet_p is None:
+
+            # get the derivatives of detector d matrix for this panel
+            dd_ddet_p = parameterisation.get_ds_dp(
+                multi_state_elt=panel_id, use_none_as_null=True
+            )
+
+            # replace explicit null derivatives with None
+            dd_ddet_p = [
+                None if e is None else flex.mat3_double(len(isel), e.elems)
+                for e in dd_ddet_p
+            ]
+
+        calculator = self._gradient_calculator(isel)
+        pv = self._pv.select(isel)
+        return [
+            None if der is None else calculator.detector_gradients(der, pv)
+            for der in dd_ddet_p
+        ]
+
     def _beam_derivatives(
         self, isel, parameterisation=None, ds0_dbeam_p=None, reflections=None
     ):
@@ -752,9 +794,6 @@ def _beam_derivatives(
 
         # Get required data
         r = self._r.select(isel)
-        e_X_r = self._e_X_r.select(isel)
-        e_r_s0 = self._e_r_s0.select(isel)
-        D = self._D.select(isel)
 
         if ds0_dbeam_p is None:
 
@@ -766,25 +805,12 @@ def _beam_derivatives(
                 for e in ds0_dbeam_p
             ]
 
-        dphi_dp = []
-        dpv_dp = []
-
-        # loop through the parameters
-        for der in ds0_dbeam_p:
-
-            if der is None:
-                dphi_dp.append(None)
-                dpv_dp.append(None)
-                continue
-
-            # calculate the derivative of phi for this parameter
-            dphi = (r.dot(der) / e_r_s0) * -1.0
-            dphi_dp.append(dphi)
-
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (e_X_r * dphi + der))
-
-        return dpv_dp, dphi_dp
+        calculator = self._gradient_calculator(isel)
+        grads = [
+            None if der is None else calculator.beam_gradients(der, r)
+            for der in ds0_dbeam_p
+        ]
+        return grads, [None if g is None else g.dphi() for g in grads]
 
     def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
         """helper function to extend the derivatives lists by derivatives of
@@ -797,13 +823,10 @@ def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
         phi_calc = self._phi_calc.select(isel)
         h = self._h.select(isel)
         s1 = self._s1.select(isel)
-        e_X_r = self._e_X_r.select(isel)
-        e_r_s0 = self._e_r_s0.select(isel)
         if b_matrix:
-            B = self._B.select(isel)
+            other = self._B.select(isel)
         else:
-            U = self._U.select(isel)
-        D = self._D.select(isel)
+            other = self._U.select(isel)
 
         if derivatives is None:
             # get derivatives of the B/U matrix wrt the parameters
@@ -812,31 +835,24 @@ def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
                 for der in parameterisation.get_ds_dp(use_none_as_null=True)
             ]
 
-        dphi_dp = []
-        dpv_dp = []
-
-        # loop through the parameters
-        for der in derivatives:
-            if der is None:
-                dphi_dp.append(None)
-                dpv_dp.append(None)
-                continue
-
-            # calculate the derivative of r for this parameter
-            if b_matrix:
-                tmp = fixed_rotation * (der * B * h)
-            else:
-                tmp = fixed_rotation * (U * der * h)
-            dr = setting_rotation * tmp.rotate_around_origin(axis, phi_calc)
-
-            # calculate the derivative of phi for this parameter
-            dphi = -1.0 * dr.dot(s1) / e_r_s0
-            dphi_dp.append(dphi)
-
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (dr + e_X_r * dphi))
-
-        return dpv_dp, dphi_dp
+        calculator = self._gradient_calculator(isel)
+        grads = [
+            None
+            if der is None
+            else calculator.crystal_gradients(
+                der,
+                other,
+                b_matrix,
+                fixed_rotation,
+                setting_rotation,
+                axis,
+                phi_calc,
+                h,
+                s1,
+            )
+            for der in derivatives
+        ]
+        return grads, [None if g is None else g.dphi() for g in grads]
 
     def _xl_orientation_derivatives(
         self, isel, parameterisation=None, dU_dxlo_p=None, reflections=None
@@ -868,10 +884,7 @@ def _goniometer_derivatives(
         phi_calc = self._phi_calc.select(isel)
         h = self._h.select(isel)
         s1 = self._s1.select(isel)
-        e_X_r = self._e_X_r.select(isel)
-        e_r_s0 = self._e_r_s0.select(isel)
         UB = self._UB.select(isel)
-        D = self._D.select(isel)
 
         if dS_dgon_p is None:
 
@@ -881,34 +894,22 @@ def _goniometer_derivatives(
                 for der in parameterisation.get_ds_dp(use_none_as_null=True)
             ]
 
-        dphi_dp = []
-        dpv_dp = []
-
-        # loop through the parameters
-        for der in dS_dgon_p:
-
-            if der is None:
-                dphi_dp.append(None)
-                dpv_dp.append(None)
-                continue
-
-            # calculate the derivative of r for this parameter
-            tmp = fixed_rotation * (UB * h)
-            dr = der * tmp.rotate_around_origin(axis, phi_calc)
-
-            # calculate the derivative of phi for this parameter
-            dphi = -1.0 * dr.dot(s1) / e_r_s0
-            dphi_dp.append(dphi)
-
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (dr + e_X_r * dphi))
-
-        return dpv_dp, dphi_dp
+        calculator = self._gradient_calculator(isel)
+        grads = [
+            None
+            if der is None
+            else calculator.goniometer_gradients(
+                der, UB, fixed_rotation, axis, phi_calc, h, s1
+            )
+            for der in dS_dgon_p
+        ]
+        return grads, [None if g is None else g.dphi() for g in grads]
 
     @staticmethod
     def _calc_dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, dpv_dp):
         """helper function to calculate positional derivatives from
-        dpv_dp using the quotient rule"""
+        dpv_dp using the quotient rule. Elements that are XYPhiGradients
+        already contain the positional derivatives."""
 
         dX_dp = []
         dY_dp = []
@@ -917,6 +918,9 @@ def _calc_dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, dpv_dp):
             if der is None:
                 dX_dp.append(None)
                 dY_dp.append(None)
+            elif isinstance(der, XYPhiGradients):
+                dX_dp.append(der.dX())
+                dY_dp.append(der.dY())
             else:
                 du_dp, dv_dp, dw_dp = der.parts()
 
@@ -5,7 +5,7 @@
     SparseGradientVectorMixin,
 )
 from dials.array_family import flex
-from dials_refinement_helpers_ext import dRq_de
+from dials_refinement_helpers_ext import dRq_de_dot
 
 
 class StillsPredictionParameterisation(PredictionParameterisation):
@@ -99,8 +99,7 @@ def _beam_derivatives(self, isel, parameterisation=None, reflections=None):
 
             # calculate (d[r]/d[e1])(d[e1]/dp)
             de1_dp = c0.cross(ds0u)
-            dr_de1 = dRq_de(DeltaPsi, e1, q)
-            drde_dedp = dr_de1 * de1_dp
+            drde_dedp = dRq_de_dot(DeltaPsi, e1, q, de1_dp)
 
             # dp = 1.e-8 # finite step size for the parameter
             # del_e1 = de1_dp * dp
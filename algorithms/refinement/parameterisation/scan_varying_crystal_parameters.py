@@ -12,6 +12,7 @@
     ScanVaryingParameterSet,
 )
 from dials.algorithms.refinement.refinement_helpers import CrystalOrientationCompose
+from dials_refinement_helpers_ext import CrystalOrientationComposeMulti
 
 
 class ScanVaryingCrystalOrientationParameterisation(
@@ -63,6 +64,10 @@ def parameter_type(value, axis, ptype, name):
     def compose(self, t):
         """calculate state and derivatives for model at image number t"""
 
+        if t in self._precomposed:
+            self._U_at_t, self._dstate_dp = self._precomposed[t]
+            return
+
         # Extract orientation from the initial state
         U0 = self._initial_state
 
@@ -104,6 +109,50 @@ def compose(self, t):
 
         return
 
+    def precompose(self, frames):
+        """calculate state and derivatives for model at each image number in
+        frames with single calls to the smoother and the compose helper"""
+
+        self._precomposed = {}
+        frames = sorted(set(frames))
+        if len(frames) < 2:
+            # the multi-value smoother needs at least two points
+            return
+
+        # smoothed angles at every frame, and their derivatives wrt the underlying
+        # parameters as one sparse vector per frame
+        values = []
+        dphi_dp = []
+        for phi_set in self._param:
+            vals, weights, sumweights = self._smoother.multi_value_weight(
+                frames, phi_set
+            )
+            values.append(vals)
+            rows = weights.transpose().cols()
+            dphi_dp.append([w * (1.0 / sw) for w, sw in zip(rows, sumweights)])
+
+        coc = CrystalOrientationComposeMulti(
+            self._initial_state,
+            values[0],
+            self._param[0].axis,
+            values[1],
+            self._param[1].axis,
+            values[2],
+            self._param[2].axis,
+        )
+        U = coc.U()
+        dU_dphi = (coc.dU_dphi1(), coc.dU_dphi2(), coc.dU_dphi3())
+
+        for i, t in enumerate(frames):
+            dstate_dp = []
+            for dU, dphi in zip(dU_dphi, dphi_dp):
+                dU_dphi_t = matrix.sqr(dU[i])
+                dU_dp = [None] * dphi[i].size
+                for (j, v) in dphi[i]:
+                    dU_dp[j] = dU_dphi_t * v
+                dstate_dp.append(dU_dp)
+            self._precomposed[t] = (matrix.sqr(U[i]), dstate_dp)
+
     def get_state(self):
         """Return crystal orientation matrix [U] at image number t"""
 
@@ -3,6 +3,7 @@
 from collections import namedtuple
 
 from scitbx import matrix
+from scitbx.array_family import flex
 
 from dials.algorithms.refinement.parameterisation.detector_parameters import (
     DetectorMixin,
@@ -12,6 +13,7 @@
     ScanVaryingModelParameterisation,
     ScanVaryingParameterSet,
 )
+from dials_refinement_helpers_ext import PanelGroupComposeMulti
 
 # bucket to provide value and axis attributes to model the Parameter class
 Param = namedtuple("Param", ["value", "axis"])
@@ -56,6 +58,10 @@ def parameter_type(value, axis, ptype, name):
     def compose(self, t):
         """calculate state and derivatives for model at image number t"""
 
+        if t in self._precomposed:
+            self._d_at_t, self._dstate_dp = self._precomposed[t]
+            return
+
         # extract parameter sets from the internal list
         dist_set, shift1_set, shift2_set, tau1_set, tau2_set, tau3_set = self._param
 
@@ -126,6 +132,61 @@ def compose(self, t):
 
         return
 
+    def precompose(self, frames):
+        """calculate state and derivatives for model at each image number in
+        frames with single calls to the smoother and the compose helper"""
+
+        self._precomposed = {}
+        frames = sorted(set(frames))
+        if len(frames) < 2:
+            # the multi-value smoother needs at least two points
+            return
+
+        # smoothed values at every frame, with one row per parameter set, and
+        # their derivatives wrt the underlying parameters as one sparse vector
+        # per frame
+        param_vals = flex.double()
+        dval_dp = []
+        for pset in self._param:
+            vals, weights, sumweights = self._smoother.multi_value_weight(frames, pset)
+            param_vals.extend(vals)
+            rows = weights.transpose().cols()
+            dval_dp.append([w * (1.0 / sw) for w, sw in zip(rows, sumweights)])
+        param_vals.reshape(flex.grid(len(self._param), len(frames)))
+        param_axes = flex.vec3_double([pset.axis for pset in self._param])
+
+        # compose the single panel as a group with no offset, placing the panel
+        # origin at the initial offset in the group frame basis
+        offset = self._initial_state["offset"]
+        pgc = PanelGroupComposeMulti(
+            self._initial_state["d1"],
+            self._initial_state["d2"],
+            self._initial_state["dn"],
+            (0.0, 0.0, 0.0),
+            param_vals,
+            param_axes,
+            flex.vec3_double([offset]),
+            flex.vec3_double([(1.0, 0.0, 0.0)]),
+            flex.vec3_double([(0.0, 1.0, 0.0)]),
+        )
+        d1s, d2s, dorgs = pgc.d1(), pgc.d2(), pgc.origin()
+        dd_dval = pgc.derivatives_for_panel(0)
+
+        for i, t in enumerate(frames):
+            d1 = matrix.col(d1s[i])
+            d2 = matrix.col(d2s[i])
+            o = matrix.col(dorgs[i]) + offset[0] * d1 + offset[1] * d2
+            d_at_t = matrix.sqr(d1.elems + d2.elems + o.elems).transpose()
+
+            dstate_dp = []
+            for k, dval in enumerate(dval_dp):
+                dd_dval_t = matrix.sqr(dd_dval[k * len(frames) + i])
+                dd_dp = [None] * dval[i].size
+                for (j, v) in dval[i]:
+                    dd_dp[j] = dd_dval_t * v
+                dstate_dp.append(dd_dp)
+            self._precomposed[t] = (d_at_t, dstate_dp)
+
     def get_state(self):
         """Return detector matrix [d] at image number t"""
         # only a single panel exists, so no multi_state_elt argument is allowed
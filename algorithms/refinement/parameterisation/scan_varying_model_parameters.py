@@ -160,6 +160,10 @@ def __init__(
         # parameters
         self._var_cov = None
 
+        # cache of states and derivatives composed in a batch by precompose,
+        # keyed by image number
+        self._precomposed = {}
+
         return
 
     def num_samples(self):
@@ -191,6 +195,16 @@ def compose(self, t):
 
         raise NotImplementedError()
 
+    def precompose(self, frames):
+        """compose the model state and its derivatives at each of the image
+        numbers in frames in a single batch, so that subsequent calls to compose
+        at those image numbers are lookups. The results are discarded when the
+        parameter values change.
+
+        By default nothing is cached and compose does the full calculation."""
+
+        self._precomposed = {}
+
     def get_param_vals(self, only_free=True):
         """export the values of the internal list of parameters as a
         sequence of floats.
@@ -234,6 +248,9 @@ def set_param_vals(self, vals):
                 p.value = new_vals
                 i += self._num_samples
 
+        # any precomposed states are now out of date
+        self._precomposed = {}
+
         # compose with the new parameter values
         # self.compose()
 
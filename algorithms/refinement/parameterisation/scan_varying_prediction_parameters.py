@@ -307,6 +307,14 @@ def compose(self, reflections, skip_derivatives=False):
             # reset current frame cache for scan-varying parameterisations
             self._current_frame = {}
 
+            # compose the scan-varying parameterisations at every frame needed for
+            # this experiment in a batch, so the per-block calls below are lookups
+            block_centres = set(reflections["block_centre"].select(isel))
+            frames = set(int(math.floor(f)) for f in block_centres)
+            for p in (xl_op, xl_ucp, bp, dp, gp):
+                if hasattr(p, "precompose"):
+                    p.precompose(frames)
+
             # get state and derivatives for each block
             for block in range(flex.min(blocks), flex.max(blocks) + 1):
 
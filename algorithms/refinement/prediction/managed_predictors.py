@@ -111,7 +111,15 @@ def _predict_one_experiment(self, experiment, reflections):
             s0 = reflections["s0_vector"]
             dmat = reflections["d_matrix"]
             Smat = reflections["S_matrix"]
-            predictor.for_reflection_table(reflections, UB, s0, dmat, Smat)
+            if "block" in reflections:
+                # reflections in a block share their models, so the predictor
+                # can set these up once per block
+                block = reflections["block"]
+                predictor.for_reflection_table_by_block(
+                    reflections, block, UB, s0, dmat, Smat
+                )
+            else:
+                predictor.for_reflection_table(reflections, UB, s0, dmat, Smat)
         # scan static
         else:
             predictor = sc(experiment)
@@ -6,7 +6,10 @@
 from scitbx import sparse
 from scitbx.array_family import flex
 
-from dials_refinement_helpers_ext import CalculateCellGradients
+from dials_refinement_helpers_ext import (
+    CalculateCellGradients,
+    CalculateCellGradientsMulti,
+)
 
 logger = logging.getLogger(__name__)
 
@@ -230,6 +233,10 @@ def __init__(self, model_parameterisations, sigma):
         # initially want to calculate all gradients
         self._sel = [True] * 6
 
+        # cell parameters and gradients from the last call to residuals, for
+        # reuse by gradients
+        self._cell_gradients = None
+
         # identify any cell dimensions constrained to be equal. If any are and a
         # restraint has been requested for that cell dimension, remove the restraint
         # for all crystals and warn in the log
@@ -240,18 +247,18 @@ def __init__(self, model_parameterisations, sigma):
             "of these restraints will be retained for all crystals in "
             "the restrained group."
         )
+        ccg, offsets = self._calculate_cell_gradients()
+        all_grads = [
+            ccg.da_dp(),
+            ccg.db_dp(),
+            ccg.dc_dp(),
+            ccg.daa_dp(),
+            ccg.dbb_dp(),
+            ccg.dcc_dp(),
+        ]
         for ixl, xlucp in enumerate(self._xlucp):
-            B = xlucp.get_state()
-            dB_dp = flex.mat3_double(xlucp.get_ds_dp())
-            ccg = CalculateCellGradients(B, dB_dp)
-            grads = [
-                ccg.da_dp(),
-                ccg.db_dp(),
-                ccg.dc_dp(),
-                ccg.daa_dp(),
-                ccg.dbb_dp(),
-                ccg.dcc_dp(),
-            ]
+            start, end = offsets[ixl], offsets[ixl + 1]
+            grads = [g[start:end] for g in all_grads]
             a, b, c, aa, bb, cc = xlucp.get_model().get_unit_cell().parameters()
             if abs(a - b) < 1e-10:
                 grad_diff = [abs(e1 - e2) for (e1, e2) in zip(grads[0], grads[1])]
@@ -326,13 +333,31 @@ def __init__(self, model_parameterisations, sigma):
     def average_fn(vals):
         return flex.mean(vals)
 
+    def _calculate_cell_gradients(self):
+        """Calculate the cell parameters and their gradients for all crystals in
+        a single call. Return the calculator and the offsets of each crystal's
+        gradients in the concatenated gradient arrays"""
+
+        B = flex.mat3_double()
+        dB_dp = flex.mat3_double()
+        nparam = flex.size_t()
+        offsets = [0]
+        for xlucp in self._xlucp:
+            B.append(xlucp.get_state())
+            ds_dp = flex.mat3_double(xlucp.get_ds_dp())
+            dB_dp.extend(ds_dp)
+            nparam.append(len(ds_dp))
+            offsets.append(offsets[-1] + len(ds_dp))
+        return CalculateCellGradientsMulti(B, dB_dp, nparam), offsets
+
     def residuals(self):
-        """Calculate and return the residuals"""
+        """Calculate and return the residuals. The cell gradients calculated
+        here are kept for the following call to gradients"""
 
-        cells = [
-            xlucp.get_model().get_unit_cell().parameters() for xlucp in self._xlucp
-        ]
-        a, b, c, aa, bb, cc = [flex.double(e) for e in zip(*cells)]
+        self._cell_gradients = self._calculate_cell_gradients()
+        ccg = self._cell_gradients[0]
+        a, b, c = ccg.a(), ccg.b(), ccg.c()
+        aa, bb, cc = ccg.alpha(), ccg.beta(), ccg.gamma()
         resid_a = a - self.average_fn(a) if self._sel[0] else None
         resid_b = b - self.average_fn(b) if self._sel[1] else None
         resid_c = c - self.average_fn(c) if self._sel[2] else None
@@ -384,24 +409,25 @@ def gradients(self):
         being restrained. Gradients of zero are detected and not set in the sparse
         matrices to save memory."""
 
-        for i, xlucp in enumerate(self._xlucp):
-            B = xlucp.get_state()
-            dB_dp = flex.mat3_double(xlucp.get_ds_dp())
-            # Use C++ function for speed
-            ccg = CalculateCellGradients(B, dB_dp)
-            dRdp = []
-            if self._sel[0]:
-                dRdp.append(self._construct_grad_block(ccg.da_dp(), i))
-            if self._sel[1]:
-                dRdp.append(self._construct_grad_block(ccg.db_dp(), i))
-            if self._sel[2]:
-                dRdp.append(self._construct_grad_block(ccg.dc_dp(), i))
-            if self._sel[3]:
-                dRdp.append(self._construct_grad_block(ccg.daa_dp(), i))
-            if self._sel[4]:
-                dRdp.append(self._construct_grad_block(ccg.dbb_dp(), i))
-            if self._sel[5]:
-                dRdp.append(self._construct_grad_block(ccg.dcc_dp(), i))
+        # Reuse the gradients calculated for the residuals, if available
+        if self._cell_gradients is None:
+            ccg, offsets = self._calculate_cell_gradients()
+        else:
+            ccg, offsets = self._cell_gradients
+            self._cell_gradients = None
+        all_grads = [
+            ccg.da_dp(),
+            ccg.db_dp(),
+            ccg.dc_dp(),
+            ccg.daa_dp(),
+            ccg.dbb_dp(),
+            ccg.dcc_dp(),
+        ]
+        all_grads = [g for g, sel in zip(all_grads, self._sel) if sel]
+
+        for i in range(self._nxls):
+            start, end = offsets[i], offsets[i + 1]
+            dRdp = [self._construct_grad_block(g[start:end], i) for g in all_grads]
 
             yield dRdp
 
@@ -15,11 +15,16 @@
 #define RAD2DEG(x) ((x)*57.29577951308232087721)
 #endif
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
 #include <scitbx/mat3.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny.h>
 #include <scitbx/math/angle_derivative.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
@@ -137,7 +142,22 @@ namespace dials { namespace refinement {
       return result;
     }
 
+    // the real space cell parameters, with angles in degrees
+    af::tiny<double, 6> cell_parameters() const {
+      return af::tiny<double, 6>(a_,
+                                 b_,
+                                 c_,
+                                 angle_degrees(bvec_, cvec_),
+                                 angle_degrees(avec_, cvec_),
+                                 angle_degrees(avec_, bvec_));
+    }
+
   private:
+    static double angle_degrees(const vec3<double> &u, const vec3<double> &v) {
+      double cos_angle = (u * v) / (u.length() * v.length());
+      return RAD2DEG(std::acos(std::max(-1.0, std::min(1.0, cos_angle))));
+    }
+
     mat3<double> Omat_;
     double a_, b_, c_;
     af::shared<mat3<double> > dO_dp_;
@@ -146,6 +166,120 @@ namespace dials { namespace refinement {
     vec3<double> dbeta_da_, dbeta_dc_;
     vec3<double> dgamma_da_, dgamma_db_;
   };
+
+  /**
+   * Calculate the real space cell gradients for a group of crystals in one
+   * call, split over threads by crystal. The dB/dp of all crystals are given
+   * concatenated, with nparam[i] of them for crystal i, and the gradients of
+   * each cell parameter are returned concatenated in the same order. The cell
+   * parameters of each crystal, needed for the restraint residuals, are
+   * calculated in the same pass.
+   */
+  class CalculateCellGradientsMulti {
+  public:
+    CalculateCellGradientsMulti(const af::const_ref<mat3<double> > &B,
+                                const af::const_ref<mat3<double> > &dB_dp,
+                                const af::const_ref<std::size_t> &nparam,
+                                std::size_t nthreads = 1)
+        : start_(B.size() + 1, 0),
+          cells_(6, af::shared<double>(B.size())),
+          grads_(6, af::shared<double>(dB_dp.size())) {
+      DIALS_ASSERT(nparam.size() == B.size());
+      for (std::size_t i = 0; i < B.size(); ++i) {
+        start_[i + 1] = start_[i] + nparam[i];
+      }
+      DIALS_ASSERT(start_.back() == dB_dp.size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(
+          &CalculateCellGradientsMulti::calculate_band, this, B, dB_dp, _1, _2),
+        B.size(),
+        nthreads);
+    }
+
+    // cell parameters of each crystal
+    af::shared<double> a() const {
+      return cells_[0];
+    }
+
+    af::shared<double> b() const {
+      return cells_[1];
+    }
+
+    af::shared<double> c() const {
+      return cells_[2];
+    }
+
+    af::shared<double> alpha() const {
+      return cells_[3];
+    }
+
+    af::shared<double> beta() const {
+      return cells_[4];
+    }
+
+    af::shared<double> gamma() const {
+      return cells_[5];
+    }
+
+    // gradients of the cell parameters for all crystals
+    af::shared<double> da_dp() const {
+      return grads_[0];
+    }
+
+    af::shared<double> db_dp() const {
+      return grads_[1];
+    }
+
+    af::shared<double> dc_dp() const {
+      return grads_[2];
+    }
+
+    af::shared<double> daa_dp() const {
+      return grads_[3];
+    }
+
+    af::shared<double> dbb_dp() const {
+      return grads_[4];
+    }
+
+    af::shared<double> dcc_dp() const {
+      return grads_[5];
+    }
+
+  private:
+    void calculate_band(af::const_ref<mat3<double> > B,
+                        af::const_ref<mat3<double> > dB_dp,
+                        std::size_t first,
+                        std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        std::size_t start = start_[i];
+        std::size_t n = start_[i + 1] - start;
+        af::const_ref<mat3<double> > dB(dB_dp.begin() + start, n);
+        CalculateCellGradients ccg(B[i], dB);
+        af::tiny<double, 6> cell = ccg.cell_parameters();
+        for (std::size_t k = 0; k < 6; ++k) {
+          cells_[k][i] = cell[k];
+        }
+        set_gradients(0, start, ccg.da_dp());
+        set_gradients(1, start, ccg.db_dp());
+        set_gradients(2, start, ccg.dc_dp());
+        set_gradients(3, start, ccg.daa_dp());
+        set_gradients(4, start, ccg.dbb_dp());
+        set_gradients(5, start, ccg.dcc_dp());
+      }
+    }
+
+    void set_gradients(std::size_t k,
+                       std::size_t start,
+                       const af::shared<double> &grads) {
+      std::copy(grads.begin(), grads.end(), grads_[k].begin() + start);
+    }
+
+    std::vector<std::size_t> start_;
+    std::vector<af::shared<double> > cells_;
+    std::vector<af::shared<double> > grads_;
+  };
+
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_RESTRAINTS_HELPERS_H
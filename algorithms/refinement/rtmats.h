@@ -18,6 +18,7 @@
 #include <cmath>
 #include <scitbx/mat3.h>
 #include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
@@ -51,6 +52,46 @@ namespace dials { namespace refinement {
                         sa * axis_[2] * axis_[2] - sa);
   }
 
+  /**
+   * Calculate the first derivative of a rotation matrix R with respect to the
+   * angle of rotation, multiplied by a vector, for arrays of angles and
+   * vectors about a common axis. Since dR/dangle = sin(angle) (a a^T - I) +
+   * cos(angle) [a]_x for the unit axis a, each element is
+   *
+   *   sin(angle) (a (a.v) - v) + cos(angle) (a x v)
+   *
+   * The sine and cosine are only recomputed when the angle changes from one
+   * element to the next, so angles shared by runs of elements, such as the
+   * frame angles in scan-varying refinement, are only evaluated once.
+   * @param axis The axis of rotation
+   * @param angle The angles of rotation
+   * @param v The vectors
+   * @param deg True if the angles are in degrees
+   * @returns The derivatives dR/dangle v
+   */
+  af::shared<vec3<double> > dRv_from_axis_and_angle(
+    const vec3<double> &axis,
+    const af::const_ref<double> &angle,
+    const af::const_ref<vec3<double> > &v,
+    bool deg = false) {
+    DIALS_ASSERT(angle.size() == v.size());
+    af::shared<vec3<double> > result(v.size(), af::init_functor_null<vec3<double> >());
+    vec3<double> axis_ = axis.normalize();
+    double last = 0.0;
+    double ca = 1.0;
+    double sa = 0.0;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      if (i == 0 || angle[i] != last) {
+        last = angle[i];
+        double a = deg ? DEG2RAD(last) : last;
+        ca = cos(a);
+        sa = sin(a);
+      }
+      result[i] = sa * (axis_ * (axis_ * v[i]) - v[i]) + ca * axis_.cross(v[i]);
+    }
+    return result;
+  }
+
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_RTMATS_H
@@ -33,7 +33,9 @@
     gradient_calculation_blocksize = None
       .help = "Maximum number of reflections to use for gradient calculation."
               "If there are more reflections than this in the manager then"
-              "the minimiser must do the full calculation in blocks."
+              "the minimiser must do the full calculation in blocks. If unset,"
+              "blocks are still used where a dense Jacobian for all reflections"
+              "would be very large."
       .type = int(value_min=1)
 """
 phil_scope = parse(phil_str)
@@ -131,6 +133,10 @@ class Target(object):
     rmsd_names = ["RMSD_X", "RMSD_Y", "RMSD_Phi"]
     rmsd_units = ["mm", "mm", "rad"]
 
+    # Limit on the number of elements of the dense Jacobians held at once when
+    # no gradient_calculation_blocksize is set (2**26 doubles is 512 MB)
+    _max_jacobian_elements = 2 ** 26
+
     def __init__(
         self,
         experiments,
@@ -379,7 +385,9 @@ def split_matches_into_blocks(self, nproc=1):
         """Return a list of the matches, split into blocks according to the
         gradient_calculation_blocksize parameter and the number of processes (if relevant).
         The number of blocks will be set such that the total number of reflections
-        being processed by concurrent processes does not exceed gradient_calculation_blocksize"""
+        being processed by concurrent processes does not exceed gradient_calculation_blocksize.
+        If that is not set, the blocks are sized so that the dense Jacobians held by
+        concurrent processes do not exceed _max_jacobian_elements in total"""
 
         self.update_matches()
 
@@ -394,6 +402,10 @@ def split_matches_into_blocks(self, nproc=1):
                     len(self._matches) * nproc / self._gradient_calculation_blocksize
                 )
             )
+        elif self._max_jacobian_elements:
+            nparam = max(len(self._prediction_parameterisation), 1)
+            max_refl = max(self._max_jacobian_elements // (self.dim * nparam), 1)
+            nblocks = max(nproc, int(math.ceil(len(self._matches) * nproc / max_refl)))
         else:
             nblocks = nproc
         # ensure at least 100 reflections per block
@@ -650,6 +662,9 @@ class SparseGradientsMixin:
     formula stored as sparse vectors, and allow concatenation of gradient vectors
     that employed sparse storage."""
 
+    # Sparse Jacobians are not limited in size by the number of parameters
+    _max_jacobian_elements = None
+
     @staticmethod
     def _build_jacobian(grads_each_dim, nelem=None, nparam=None):
         """construct Jacobian from lists of sparse gradient vectors."""
@@ -1,8 +1,13 @@
 #include <boost/python.hpp>
+#include <boost/bind.hpp>
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/flex_types.h>
+#include <scitbx/math/r3_rotation.h>
 #include <cctype>
+#include <vector>
 #include <dxtbx/model/panel.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 #include <iostream>
 
 namespace recviewer { namespace ext {
@@ -65,11 +70,179 @@ namespace recviewer { namespace ext {
     }
   }
 
+  /**
+   * Map a sweep of images into a voxel grid in reciprocal space. The
+   * scattering vector of each target pixel is calculated once, and for each
+   * image the vectors are rotated back by the rotation matrix of the image
+   * and added to the grid. The pixels are split into a chunk per thread and
+   * each chunk has its own grid, so the grids are only combined at the end.
+   */
+  class VoxelMapper {
+  public:
+    /**
+     * @param panel The detector panel
+     * @param s0 The beam vector
+     * @param axis The rotation axis
+     * @param xlim The size of the image in x
+     * @param ylim The size of the image in y
+     * @param maxres The resolution limit
+     * @param grid_size The number of voxels along each side of the grid
+     * @param nthreads The number of threads
+     */
+    VoxelMapper(dxtbx::model::Panel panel,
+                vec3<double> s0,
+                vec3<double> axis,
+                int xlim,
+                int ylim,
+                double maxres,
+                int grid_size,
+                std::size_t nthreads = 1)
+        : axis_(axis),
+          xlim_(xlim),
+          ylim_(ylim),
+          npoints_(grid_size),
+          step_(2.0 / maxres / grid_size),
+          xy_(get_target_pixels(panel, s0, xlim, ylim, maxres)),
+          image_index_(xy_.size()),
+          S_(xy_.size()),
+          nchunks_(std::max((std::size_t)1, std::min(nthreads, xy_.size()))),
+          grid_(nchunks_),
+          counts_(nchunks_) {
+      DIALS_ASSERT(grid_size > 0);
+      DIALS_ASSERT(nthreads > 0);
+      double pixel_size = panel.get_pixel_size()[0];
+      double wavenumber = s0.length();
+      for (std::size_t i = 0; i < xy_.size(); i++) {
+        vec3<double> s1 = panel.get_lab_coord(xy_[i] * pixel_size);
+        S_[i] = s1 / s1.length() * wavenumber - s0;
+        // The images have the size (xlim, ylim) and are indexed as (y, x)
+        image_index_[i] = (std::size_t)xy_[i][1] * ylim + (std::size_t)xy_[i][0];
+      }
+      std::size_t size = (std::size_t)npoints_ * npoints_ * npoints_;
+      for (std::size_t c = 0; c < nchunks_; c++) {
+        grid_[c].assign(size, 0.0);
+        counts_[c].assign(size, 0);
+      }
+    }
+
+    /**
+     * Add an image to the grid. Masked pixels are counted with a value of
+     * zero.
+     * @param image The image
+     * @param mask The mask
+     * @param angle The rotation angle (radians) to rotate the pixels back by
+     */
+    template <typename T>
+    void add_image(const af::const_ref<T, af::c_grid<2> > &image,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   double angle) {
+      DIALS_ASSERT(image.accessor()[0] == xlim_ && image.accessor()[1] == ylim_);
+      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+      mat3<double> R =
+        scitbx::math::r3_rotation::axis_and_angle_as_matrix(axis_, angle);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&VoxelMapper::add_image_chunks<T>,
+                    this,
+                    boost::cref(image),
+                    boost::cref(mask),
+                    R,
+                    _1,
+                    _2),
+        nchunks_,
+        nchunks_);
+    }
+
+    /**
+     * Add the sums and counts of the voxels to existing grids
+     * @param grid The sum of the pixel values in each voxel
+     * @param counts The number of pixels in each voxel
+     */
+    void accumulate(af::ref<double, af::c_grid<3> > grid,
+                    af::ref<int, af::c_grid<3> > counts) const {
+      DIALS_ASSERT(grid.accessor().all_eq(af::c_grid<3>(npoints_, npoints_, npoints_)));
+      DIALS_ASSERT(counts.accessor().all_eq(grid.accessor()));
+      for (std::size_t c = 0; c < nchunks_; c++) {
+        for (std::size_t i = 0; i < grid.size(); i++) {
+          grid[i] += grid_[c][i];
+          counts[i] += counts_[c][i];
+        }
+      }
+    }
+
+    /** @returns The number of target pixels */
+    std::size_t num_pixels() const {
+      return xy_.size();
+    }
+
+  private:
+    template <typename T>
+    void add_image_chunks(const af::const_ref<T, af::c_grid<2> > &image,
+                          const af::const_ref<bool, af::c_grid<2> > &mask,
+                          mat3<double> R,
+                          std::size_t first,
+                          std::size_t last) {
+      int half = npoints_ / 2;
+      for (std::size_t c = first; c < last; c++) {
+        std::size_t i0 = (c * xy_.size()) / nchunks_;
+        std::size_t i1 = ((c + 1) * xy_.size()) / nchunks_;
+        double *grid = &grid_[c][0];
+        int *counts = &counts_[c][0];
+        for (std::size_t i = i0; i < i1; i++) {
+          vec3<double> S = R * S_[i];
+          int ind_x = S[0] / step_ + half + 0.5;
+          int ind_y = S[1] / step_ + half + 0.5;
+          int ind_z = S[2] / step_ + half + 0.5;
+          if (ind_x >= npoints_ || ind_y >= npoints_ || ind_z >= npoints_ || ind_x < 0
+              || ind_y < 0 || ind_z < 0) {
+            continue;
+          }
+          std::size_t k = ((std::size_t)ind_x * npoints_ + ind_y) * npoints_ + ind_z;
+          std::size_t j = image_index_[i];
+          grid[k] += mask[j] ? (double)image[j] : 0.0;
+          counts[k]++;
+        }
+      }
+    }
+
+    vec3<double> axis_;
+    std::size_t xlim_;
+    std::size_t ylim_;
+    int npoints_;
+    double step_;
+    af::shared<vec2<double> > xy_;
+    std::vector<std::size_t> image_index_;
+    std::vector<vec3<double> > S_;
+    std::size_t nchunks_;
+    std::vector<std::vector<double> > grid_;
+    std::vector<std::vector<int> > counts_;
+  };
+
   void init_module() {
     using namespace boost::python;
     def("get_target_pixels", get_target_pixels);
     def("fill_voxels", fill_voxels);
     def("normalize_voxels", normalize_voxels);
+
+    class_<VoxelMapper>("VoxelMapper", no_init)
+      .def(init<dxtbx::model::Panel,
+                vec3<double>,
+                vec3<double>,
+                int,
+                int,
+                double,
+                int,
+                std::size_t>((arg("panel"),
+                              arg("s0"),
+                              arg("axis"),
+                              arg("xlim"),
+                              arg("ylim"),
+                              arg("maxres"),
+                              arg("grid_size"),
+                              arg("nthreads") = 1)))
+      .def("add_image", &VoxelMapper::add_image<int>)
+      .def("add_image", &VoxelMapper::add_image<double>)
+      .def("accumulate", &VoxelMapper::accumulate)
+      .def("num_pixels", &VoxelMapper::num_pixels);
   }
 
 }}  // namespace recviewer::ext
@@ -12,6 +12,7 @@
 from scitbx import sparse
 
 from dials.array_family import flex
+from dials_scaling_ext import IhTableGroups
 
 
 def map_indices_to_asu(miller_indices, space_group, anomalous=False):
@@ -452,6 +453,8 @@ def __init__(self, n_groups, n_refl, n_datasets=1):
         self.h_expand_matrix = None
         self.derivatives = None
         self.binner = None
+        self._jacobian_pattern = None
+        self._groups = None
 
     def add_data(self, dataset_id, group_ids, reflections):
         """
@@ -545,15 +548,22 @@ def select_on_groups_isel(self, isel):
         nz_row_sel = (unity * reduced_h_idx.transpose()) > 0
         return self.select(nz_row_sel)
 
+    @property
+    def groups(self):
+        """The reflections of each symmetry group, for calculating group sums.
+
+        This is recalculated if the h_index_matrix is replaced."""
+        if self._groups is None or self._groups[0] is not self.h_index_matrix:
+            self._groups = (self.h_index_matrix, IhTableGroups(self.h_index_matrix))
+        return self._groups[1]
+
     def calc_Ih(self):
         """Calculate the current best estimate for Ih for each reflection group."""
-        scale_factors = self.Ih_table["inverse_scale_factor"]
-        gsq = flex.pow2(scale_factors) * self.Ih_table["weights"]
-        sumgsq = gsq * self.h_index_matrix
-        gI = (scale_factors * self.Ih_table["intensity"]) * self.Ih_table["weights"]
-        sumgI = gI * self.h_index_matrix
-        Ih = sumgI / sumgsq
-        self.Ih_table["Ih_values"] = Ih * self.h_expand_matrix
+        self.Ih_table["Ih_values"] = self.groups.calc_Ih(
+            self.Ih_table["intensity"],
+            self.Ih_table["inverse_scale_factor"],
+            self.Ih_table["weights"],
+        )
 
     def update_error_model(self, error_model):
         """Update the scaling weights based on an error model."""
@@ -570,9 +580,7 @@ def calc_nh(self):
         """Calculate the number of refls in the group to which the reflection belongs.
 
         This is a vector of length n_refl."""
-        return (
-            flex.double(self.size, 1.0) * self.h_index_matrix
-        ) * self.h_expand_matrix
+        return self.groups.nh()
 
     def match_Ih_values_to_target(self, target_Ih_table):
         """
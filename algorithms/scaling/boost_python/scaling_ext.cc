@@ -1,5 +1,6 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/shared_executor.h>
 
 using namespace boost::python;
 
@@ -14,6 +15,8 @@ namespace dials_scaling { namespace boost_python {
   void export_determine_outlier_indices();
   void export_calc_dIh_by_dpi();
   void export_calc_jacobian();
+  void export_ih_table_groups();
+  void export_scaling_jacobian_pattern();
   void export_calculate_harmonic_tables_from_selections();
   void export_calc_lookup_index();
   void export_create_sph_harm_lookup_table();
@@ -21,6 +24,7 @@ namespace dials_scaling { namespace boost_python {
   void export_limit_outlier_weights();
 
   BOOST_PYTHON_MODULE(dials_scaling_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_elementwise_square();
     export_sph_harm_table();
     export_rotate_vectors_about_axis();
@@ -30,6 +34,8 @@ namespace dials_scaling { namespace boost_python {
     export_determine_outlier_indices();
     export_calc_dIh_by_dpi();
     export_calc_jacobian();
+    export_ih_table_groups();
+    export_scaling_jacobian_pattern();
     export_calculate_harmonic_tables_from_selections();
     export_calc_lookup_index();
     export_create_sph_harm_lookup_table();
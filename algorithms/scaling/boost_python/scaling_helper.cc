@@ -15,7 +15,9 @@ namespace dials_scaling { namespace boost_python {
   }
 
   void export_elementwise_square() {
-    def("elementwise_square", &elementwise_square, (arg("m")));
+    def("elementwise_square",
+        &elementwise_square,
+        (arg("m"), arg("nthreads") = 1));
   }
 
   void export_calc_dIh_by_dpi() {
@@ -35,10 +37,64 @@ namespace dials_scaling { namespace boost_python {
          arg("sumgsq")));
   }
 
+  void export_ih_table_groups() {
+    class_<IhTableGroups>("IhTableGroups", no_init)
+      .def(init<matrix<double> >((arg("h_index_mat"))))
+      .def("n_groups", &IhTableGroups::n_groups)
+      .def("n_refl", &IhTableGroups::n_refl)
+      .def("nh", &IhTableGroups::nh)
+      .def("sum_gsq",
+           &IhTableGroups::sum_gsq,
+           (arg("scales"), arg("weights"), arg("nthreads") = 1))
+      .def("calc_Ih",
+           &IhTableGroups::calc_Ih,
+           (arg("intensities"), arg("scales"), arg("weights"), arg("nthreads") = 1))
+      .def("normdev_outliers",
+           &IhTableGroups::normdev_outliers,
+           (arg("intensities"),
+            arg("scales"),
+            arg("weights"),
+            arg("zmax"),
+            arg("flags"),
+            arg("nthreads") = 1))
+      .def("simple_normdev_outliers",
+           &IhTableGroups::simple_normdev_outliers,
+           (arg("intensities"),
+            arg("scales"),
+            arg("weights"),
+            arg("zmax"),
+            arg("flags"),
+            arg("nthreads") = 1))
+      .setattr("outlier_flag", int(IhTableGroups::outlier_flag))
+      .setattr("potential_outlier_flag", int(IhTableGroups::potential_outlier_flag));
+  }
+
+  void export_scaling_jacobian_pattern() {
+    typedef ScalingJacobianPattern w_t;
+    class_<w_t>("ScalingJacobianPattern", no_init)
+      .def(init<matrix<double>, matrix<double> >(
+        (arg("h_index_mat"), arg("derivatives"))))
+      .def("matches", &w_t::matches, (arg("derivatives")))
+      .def("dIh_by_dpi",
+           &w_t::dIh_by_dpi,
+           (arg("dIh"), arg("sumgsq"), arg("derivatives"), arg("nthreads") = 1))
+      .def("jacobian",
+           &w_t::jacobian,
+           (arg("derivatives"),
+            arg("Ih"),
+            arg("g"),
+            arg("dIh"),
+            arg("sumgsq"),
+            arg("nthreads") = 1));
+  }
+
   void export_sph_harm_table() {
     def("create_sph_harm_table",
         &create_sph_harm_table,
         (arg("s0_theta_phi"), arg("s1_theta_phi"), arg("lmax")));
+    def("calculate_sph_harm_table",
+        &calculate_sph_harm_table,
+        (arg("s0c"), arg("s1c"), arg("lmax"), arg("nthreads") = 1));
   }
 
   void export_rotate_vectors_about_axis() {
@@ -52,11 +108,13 @@ namespace dials_scaling { namespace boost_python {
   }
 
   void export_calc_sigmasq() {
-    def("calc_sigmasq", &calc_sigmasq, (arg("jacobian_transpose"), arg("var_cov")));
+    def("calc_sigmasq",
+        &calc_sigmasq,
+        (arg("jacobian_transpose"), arg("var_cov"), arg("nthreads") = 1));
   }
 
   void export_row_multiply() {
-    def("row_multiply", &row_multiply, (arg("m"), arg("v")));
+    def("row_multiply", &row_multiply, (arg("m"), arg("v"), arg("nthreads") = 1));
   }
 
   void export_limit_outlier_weights() {
@@ -97,6 +155,7 @@ namespace dials_scaling { namespace boost_python {
       .def("value_weight_first_fixed",
            &GaussianSmootherFirstFixed::value_weight_first_fixed)
       .def("multi_value_weight", &GaussianSmootherFirstFixed::multi_value_weight)
+      .def("multi_value", &GaussianSmootherFirstFixed::multi_value)
       .def("multi_value_weight_first_fixed",
            &GaussianSmootherFirstFixed::multi_value_weight_first_fixed);
   }
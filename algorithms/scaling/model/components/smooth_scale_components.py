@@ -271,7 +271,7 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """"Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
+            value = self._smoother.multi_value(
                 self._normalised_values[block_id], self.value
             )
         elif self._n_refl[block_id] == 1:
@@ -466,7 +466,7 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
+            value = self._smoother.multi_value(
                 self._normalised_x_values[block_id],
                 self._normalised_y_values[block_id],
                 self.value,
@@ -631,7 +631,7 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """"Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
+            value = self._smoother.multi_value(
                 self._normalised_x_values[block_id],
                 self._normalised_y_values[block_id],
                 self._normalised_z_values[block_id],
@@ -15,7 +15,7 @@
 from scitbx.array_family import flex
 
 from dials.algorithms.scaling.Ih_table import IhTable
-from dials_scaling_ext import determine_outlier_indices, limit_outlier_weights
+from dials_scaling_ext import IhTableGroups, limit_outlier_weights
 
 logger = logging.getLogger("dials")
 
@@ -72,7 +72,9 @@ def reject_outliers(reflection_table, experiment, method="standard", zmax=6.0):
     return reflection_table
 
 
-def determine_outlier_index_arrays(Ih_table, method="standard", zmax=6.0, target=None):
+def determine_outlier_index_arrays(
+    Ih_table, method="standard", zmax=6.0, target=None, nproc=1
+):
     """
     Run an outlier algorithm and return the outlier indices.
 
@@ -84,6 +86,8 @@ def determine_outlier_index_arrays(Ih_table, method="standard", zmax=6.0, target
         zmax (float): Normalised deviation threshold for classifying an outlier.
         target (Optional[IhTable]): An IhTable to use to obtain target Ih for
             outlier rejectiob, if method=target.
+        nproc (int): The number of threads to use for the standard and simple
+            methods.
 
     Returns:
         outlier_index_arrays (list): A list of flex.size_t arrays, with one
@@ -97,9 +101,9 @@ def determine_outlier_index_arrays(Ih_table, method="standard", zmax=6.0, target
     """
     outlier_rej = None
     if method == "standard":
-        outlier_rej = NormDevOutlierRejection(Ih_table, zmax)
+        outlier_rej = NormDevOutlierRejection(Ih_table, zmax, nproc=nproc)
     elif method == "simple":
-        outlier_rej = SimpleNormDevOutlierRejection(Ih_table, zmax)
+        outlier_rej = SimpleNormDevOutlierRejection(Ih_table, zmax, nproc=nproc)
     elif method == "target":
         assert target is not None
         outlier_rej = TargetedOutlierRejection(Ih_table, zmax, target)
@@ -254,8 +258,9 @@ class SimpleNormDevOutlierRejection(OutlierRejectionBase):
     the symmetry group excluding the test reflection.
     """
 
-    def __init__(self, Ih_table, zmax):
+    def __init__(self, Ih_table, zmax, nproc=1):
         super(SimpleNormDevOutlierRejection, self).__init__(Ih_table, zmax)
+        self._nproc = nproc
         self.weights = limit_outlier_weights(
             copy.deepcopy(self._Ih_table_block.weights),
             self._Ih_table_block.h_index_matrix,
@@ -264,27 +269,18 @@ def __init__(self, Ih_table, zmax):
     def _do_outlier_rejection(self):
         """Add indices (w.r.t. the Ih_table data) to self._outlier_indices."""
         Ih_table = self._Ih_table_block
-        intensity = Ih_table.intensities
-        g = Ih_table.inverse_scale_factors
-        w = self.weights
-        wgIsum = (
-            (w * g * intensity) * Ih_table.h_index_matrix
-        ) * Ih_table.h_expand_matrix
-        wg2sum = ((w * g * g) * Ih_table.h_index_matrix) * Ih_table.h_expand_matrix
-
-        # guard against zero divison errors - can happen due to rounding errors
-        # or bad data giving g values are very small
-        zero_sel = wg2sum == 0.0
-        # set as one for now, then mark as outlier below. This will only affect if
-        # g is near zero, if w is zero then throw an assertionerror.
-        wg2sum.set_selected(zero_sel, 1.0)
-
-        assert w.all_gt(0)  # guard against division by zero
-        norm_dev = (intensity - (g * wgIsum / wg2sum)) / (
-            flex.sqrt((1.0 / w) + flex.pow2(g / wg2sum))
+        # reflections with a zero sum of wg^2 for their group (due to rounding
+        # errors or bad data giving very small g values) are marked as outliers
+        flags = flex.int(Ih_table.size, 0)
+        Ih_table.groups.simple_normdev_outliers(
+            Ih_table.intensities,
+            Ih_table.inverse_scale_factors,
+            self.weights,
+            self._zmax,
+            flags,
+            nthreads=self._nproc,
         )
-        norm_dev.set_selected(zero_sel, 1000)  # to trigger rejection
-        outliers = flex.abs(norm_dev) > self._zmax
+        outliers = flags == IhTableGroups.outlier_flag
 
         self._outlier_indices.extend(Ih_table.Ih_table["loc_indices"].select(outliers))
         self._datasets.extend(
@@ -299,8 +295,9 @@ class NormDevOutlierRejection(OutlierRejectionBase):
     the symmetry group excluding the test reflection.
     """
 
-    def __init__(self, Ih_table, zmax):
+    def __init__(self, Ih_table, zmax, nproc=1):
         super(NormDevOutlierRejection, self).__init__(Ih_table, zmax)
+        self._nproc = nproc
         self.weights = limit_outlier_weights(
             copy.deepcopy(self._Ih_table_block.weights),
             self._Ih_table_block.h_index_matrix,
@@ -319,44 +316,20 @@ def _do_outlier_rejection(self):
     def _round_of_outlier_rejection(self):
         """
         Calculate normal deviations from the data in the Ih_table.
+
+        In each group of more than two reflections, the reflection with the
+        largest normalised deviation above zmax is an outlier, and the other
+        reflections in the group are tested again in the next round.
         """
         Ih_table = self._Ih_table_block
-        intensity = Ih_table.intensities
-        g = Ih_table.inverse_scale_factors
-        w = self.weights
-        wgIsum = (
-            (w * g * intensity) * Ih_table.h_index_matrix
-        ) * Ih_table.h_expand_matrix
-        wg2sum = ((w * g * g) * Ih_table.h_index_matrix) * Ih_table.h_expand_matrix
-        wgIsum_others = wgIsum - (w * g * intensity)
-        wg2sum_others = wg2sum - (w * g * g)
-        # Now do the rejection analyis if n_in_group > 2
-        nh = Ih_table.calc_nh()
-        sel = nh > 2
-        wg2sum_others_sel = wg2sum_others.select(sel)
-        wgIsum_others_sel = wgIsum_others.select(sel)
-
-        # guard against zero divison errors - can happen due to rounding errors
-        # or bad data giving g values are very small
-        zero_sel = wg2sum_others_sel == 0.0
-        # set as one for now, then mark as outlier below. This will only affect if
-        # g is near zero, if w is zero then throw an assertionerror.
-        wg2sum_others_sel.set_selected(zero_sel, 1.0)
-        g_sel = g.select(sel)
-        I_sel = intensity.select(sel)
-        w_sel = w.select(sel)
-
-        assert w_sel.all_gt(0)  # guard against division by zero
-        norm_dev = (I_sel - (g_sel * wgIsum_others_sel / wg2sum_others_sel)) / (
-            flex.sqrt((1.0 / w_sel) + (flex.pow2(g_sel) / wg2sum_others_sel))
-        )
-        norm_dev.set_selected(zero_sel, 1000)  # to trigger rejection
-        z_score = flex.abs(norm_dev)
-        # Want an array same size as Ih table.
-        all_z_scores = flex.double(Ih_table.size, 0.0)
-        all_z_scores.set_selected(sel.iselection(), z_score)
-        outlier_indices, other_potential_outliers = determine_outlier_indices(
-            Ih_table.h_index_matrix, all_z_scores, self._zmax
+        flags = flex.int(Ih_table.size, 0)
+        outlier_indices = Ih_table.groups.normdev_outliers(
+            Ih_table.intensities,
+            Ih_table.inverse_scale_factors,
+            self.weights,
+            self._zmax,
+            flags,
+            nthreads=self._nproc,
         )
         self._outlier_indices.extend(
             self._Ih_table_block.Ih_table["loc_indices"].select(outlier_indices)
@@ -364,7 +337,6 @@ def _round_of_outlier_rejection(self):
         self._datasets.extend(
             self._Ih_table_block.Ih_table["dataset_id"].select(outlier_indices)
         )
-        sel = flex.bool(Ih_table.size, False)
-        sel.set_selected(other_potential_outliers, True)
+        sel = flags == IhTableGroups.potential_outlier_flag
         self._Ih_table_block = self._Ih_table_block.select(sel)
         self.weights = self.weights.select(sel)
@@ -593,15 +593,18 @@ def expand_scales_to_all_reflections(self, caller=None, calc_cov=False):
             if calc_cov and self.var_cov_matrix.non_zeroes > 0:
                 n_cumulative_param = 0
                 for j, component in enumerate(self.components):
-                    d_block = derivs_list[j]
                     n_param = self.components[component].n_params
+                    multipliers = flex.double(block_isel.size(), 1.0)
                     for k, component_2 in enumerate(self.components):
                         if component_2 != component:
-                            d_block = row_multiply(d_block, scales_list[k])
+                            multipliers *= scales_list[k]
+                    d_block = row_multiply(derivs_list[j], multipliers, n_blocks)
                     jacobian.assign_block(d_block, 0, n_cumulative_param)
                     n_cumulative_param += n_param
                 all_invsfvars.extend(
-                    cpp_calc_sigmasq(jacobian.transpose(), self._var_cov_matrix)
+                    cpp_calc_sigmasq(
+                        jacobian.transpose(), self._var_cov_matrix, n_blocks
+                    )
                 )
         scaled_isel = self.suitable_refl_for_scaling_sel.iselection()
         self.reflection_table["inverse_scale_factor"].set_selected(
@@ -802,6 +805,7 @@ def round_of_outlier_rejection(self):
                 self.global_Ih_table,
                 self.params.scaling_options.outlier_rejection,
                 self.params.scaling_options.outlier_zmax,
+                nproc=self.params.scaling_options.nproc,
             )[0]
             self.outliers = flex.bool(self.n_suitable_refl, False)
             self.outliers.set_selected(outlier_indices, True)
@@ -810,6 +814,7 @@ def round_of_outlier_rejection(self):
                     self._free_Ih_table,
                     self.params.scaling_options.outlier_rejection,
                     self.params.scaling_options.outlier_zmax,
+                    nproc=self.params.scaling_options.nproc,
                 )[0]
                 self.outliers.set_selected(free_outlier_indices, True)
 
@@ -1089,6 +1094,7 @@ def _round_of_outlier_rejection(self, target=None):
                 self.params.scaling_options.outlier_rejection,
                 self.params.scaling_options.outlier_zmax,
                 target=target,
+                nproc=self.params.scaling_options.nproc,
             )
             for outlier_indices, scaler in zip(
                 outlier_index_arrays, self.active_scalers
@@ -1101,6 +1107,7 @@ def _round_of_outlier_rejection(self, target=None):
                     self.params.scaling_options.outlier_rejection,
                     self.params.scaling_options.outlier_zmax,
                     target=target,
+                    nproc=self.params.scaling_options.nproc,
                 )
                 for outlier_indices, scaler in zip(
                     free_outlier_index_arrays, self.active_scalers
@@ -1590,11 +1597,12 @@ def calc_sf_variances(components, var_cov):
         scales_list.append(s)
         derivs_list.append(d)
     for i, component in enumerate(components):
-        d_block = derivs_list[i]
         n_param = components[component].n_params
+        multipliers = flex.double(n_refl, 1.0)
         for j, component_2 in enumerate(components):
             if component_2 != component:
-                d_block = row_multiply(d_block, scales_list[j])
+                multipliers *= scales_list[j]
+        d_block = row_multiply(derivs_list[i], multipliers)
         jacobian.assign_block(d_block, 0, n_cumulative_param)
         n_cumulative_param += n_param
     return cpp_calc_sigmasq(jacobian.transpose(), var_cov)
@@ -7,7 +7,12 @@
 #include <scitbx/math/basic_statistics.h>
 #include <dials/error.h>
 #include <math.h>
+#include <cmath>
 #include <dials/algorithms/refinement/gaussian_smoother.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
 
 typedef scitbx::sparse::matrix<double>::column_type col_type;
 
@@ -102,22 +107,83 @@ public:
   }
 };
 
+namespace detail {
+
+  inline void elementwise_square_columns(const scitbx::sparse::matrix<double>& m,
+                                         scitbx::sparse::matrix<double>& result,
+                                         std::size_t first,
+                                         std::size_t last) {
+    for (std::size_t j = first; j < last; j++) {
+      const col_type column = m.col(j);
+      for (col_type::const_iterator p = column.begin(); p != column.end(); ++p) {
+        std::size_t i = p.index();
+        result(i, j) = *p * *p;
+      }
+    }
+  }
+
+  inline void row_multiply_columns(const scitbx::sparse::matrix<double>& m,
+                                   scitbx::af::const_ref<double> v,
+                                   scitbx::sparse::matrix<double>& result,
+                                   std::size_t first,
+                                   std::size_t last) {
+    for (std::size_t j = first; j < last; j++) {
+      const col_type column = m.col(j);
+      for (col_type::const_iterator p = column.begin(); p != column.end(); ++p) {
+        std::size_t i = p.index();
+        result(i, j) = *p * v[i];
+      }
+    }
+  }
+
+  inline void sigmasq_columns(const scitbx::sparse::matrix<double>& jacobian_transpose,
+                              scitbx::af::const_ref<double> var_cov,
+                              scitbx::af::ref<double> sigmasq,
+                              std::size_t first,
+                              std::size_t last) {
+    std::size_t n_params = jacobian_transpose.n_rows();
+    std::vector<std::size_t> index;
+    std::vector<double> value;
+    for (std::size_t i = first; i < last; i++) {
+      const col_type column = jacobian_transpose.col(i);
+      index.clear();
+      value.clear();
+      for (col_type::const_iterator p = column.begin(); p != column.end(); ++p) {
+        index.push_back(p.index());
+        value.push_back(*p);
+      }
+      // sigmasq = J V J^T, using only the nonzero elements of J
+      double sum = 0.0;
+      for (std::size_t a = 0; a < index.size(); ++a) {
+        const double* var_cov_col = &var_cov[index[a] * n_params];
+        double dot = 0.0;
+        for (std::size_t b = 0; b < index.size(); ++b) {
+          dot += value[b] * var_cov_col[index[b]];
+        }
+        sum += value[a] * dot;
+      }
+      sigmasq[i] = sum;
+    }
+  }
+
+}  // namespace detail
+
 /**
  * Elementwise squaring of a matrix
  */
-scitbx::sparse::matrix<double> elementwise_square(scitbx::sparse::matrix<double> m) {
+scitbx::sparse::matrix<double> elementwise_square(scitbx::sparse::matrix<double> m,
+                                                  std::size_t nthreads = 1) {
+  m.compact();
   scitbx::sparse::matrix<double> result(m.n_rows(), m.n_cols());
-
-  // outer loop iterate over the columns
-  for (std::size_t j = 0; j < m.n_cols(); j++) {
-    // inner loop iterate over the non-zero elements of the column
-    for (scitbx::sparse::matrix<double>::row_iterator p = m.col(j).begin();
-         p != m.col(j).end();
-         ++p) {
-      std::size_t i = p.index();
-      result(i, j) = *p * *p;
-    }
-  }
+  // columns are independent, so can be filled in parallel
+  dials::algorithms::detail::parallel_bands(
+    boost::bind(&detail::elementwise_square_columns,
+                boost::cref(m),
+                boost::ref(result),
+                _1,
+                _2),
+    m.n_cols(),
+    nthreads);
   return result;
 }
 
@@ -253,8 +319,574 @@ scitbx::sparse::matrix<double> calc_jacobian(scitbx::sparse::matrix<double> deri
   return Jacobian;
 }
 
+/**
+ * The reflections of each symmetry group of an Ih table block, stored by
+ * group, to calculate the Ih values and group sums without the temporary
+ * arrays of the equivalent sparse matrix products.
+ */
+class IhTableGroups {
+public:
+  /**
+   * @param h_index_mat The reflection to group matrix (n_refl x n_groups)
+   */
+  IhTableGroups(scitbx::sparse::matrix<double> h_index_mat)
+      : n_refl_(h_index_mat.n_rows()), group_start_(h_index_mat.n_cols() + 1, 0) {
+    for (std::size_t i = 0; i < h_index_mat.n_cols(); ++i) {
+      const col_type column = h_index_mat.col(i);
+      column.compact();
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        group_refl_.push_back(it.index());
+      }
+      group_start_[i + 1] = group_refl_.size();
+    }
+  }
+
+  std::size_t n_groups() const {
+    return group_start_.size() - 1;
+  }
+
+  std::size_t n_refl() const {
+    return n_refl_;
+  }
+
+  /**
+   * The number of reflections in the group of each reflection
+   */
+  scitbx::af::shared<double> nh() const {
+    scitbx::af::shared<double> result(n_refl_, 0.0);
+    for (std::size_t i = 0; i < n_groups(); ++i) {
+      double n = group_start_[i + 1] - group_start_[i];
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        result[group_refl_[k]] = n;
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Calculate sum(w g^2) for each group
+   */
+  scitbx::af::shared<double> sum_gsq(scitbx::af::const_ref<double> scales,
+                                     scitbx::af::const_ref<double> weights,
+                                     std::size_t nthreads = 1) const {
+    DIALS_ASSERT(scales.size() == n_refl_);
+    DIALS_ASSERT(weights.size() == n_refl_);
+    scitbx::af::shared<double> result(n_groups(), 0.0);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(
+        &IhTableGroups::sum_gsq_groups, this, scales, weights, result.ref(), _1, _2),
+      n_groups(),
+      nthreads);
+    return result;
+  }
+
+  /**
+   * Calculate the best estimate of the intensity of the group of each
+   * reflection, Ih = sum(w g I) / sum(w g^2)
+   */
+  scitbx::af::shared<double> calc_Ih(scitbx::af::const_ref<double> intensities,
+                                     scitbx::af::const_ref<double> scales,
+                                     scitbx::af::const_ref<double> weights,
+                                     std::size_t nthreads = 1) const {
+    DIALS_ASSERT(intensities.size() == n_refl_);
+    DIALS_ASSERT(scales.size() == n_refl_);
+    DIALS_ASSERT(weights.size() == n_refl_);
+    scitbx::af::shared<double> result(n_refl_, 0.0);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&IhTableGroups::calc_Ih_groups,
+                  this,
+                  intensities,
+                  scales,
+                  weights,
+                  result.ref(),
+                  _1,
+                  _2),
+      n_groups(),
+      nthreads);
+    return result;
+  }
+
+  /**
+   * One round of the normalised deviation outlier rejection. In each group of
+   * more than two reflections, the normalised deviation of each reflection is
+   * calculated from the weighted mean of the others in the group, and the
+   * reflection with the largest deviation above zmax is marked as an outlier.
+   * The other reflections of a group with an outlier are marked as potential
+   * outliers, to be tested in the next round.
+   * @param flags Set to outlier_flag, potential_outlier_flag or zero for
+   *              each reflection
+   * @returns The outliers, in group order
+   */
+  scitbx::af::shared<std::size_t> normdev_outliers(
+    scitbx::af::const_ref<double> intensities,
+    scitbx::af::const_ref<double> scales,
+    scitbx::af::const_ref<double> weights,
+    double zmax,
+    scitbx::af::ref<int> flags,
+    std::size_t nthreads = 1) const {
+    DIALS_ASSERT(intensities.size() == n_refl_);
+    DIALS_ASSERT(scales.size() == n_refl_);
+    DIALS_ASSERT(weights.size() == n_refl_);
+    DIALS_ASSERT(flags.size() == n_refl_);
+    for (std::size_t i = 0; i < n_groups(); ++i) {
+      if (group_start_[i + 1] - group_start_[i] > 2) {
+        for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+          DIALS_ASSERT(weights[group_refl_[k]] > 0);
+        }
+      }
+    }
+    scitbx::af::shared<std::size_t> group_outlier(n_groups(), n_refl_);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&IhTableGroups::normdev_outlier_groups,
+                  this,
+                  intensities,
+                  scales,
+                  weights,
+                  zmax,
+                  flags,
+                  group_outlier.ref(),
+                  _1,
+                  _2),
+      n_groups(),
+      nthreads);
+    scitbx::af::shared<std::size_t> outliers;
+    for (std::size_t i = 0; i < n_groups(); ++i) {
+      if (group_outlier[i] < n_refl_) {
+        outliers.push_back(group_outlier[i]);
+      }
+    }
+    return outliers;
+  }
+
+  /**
+   * The simple normalised deviation outlier rejection, where the normalised
+   * deviation of each reflection is calculated from the weighted mean of its
+   * group, including itself.
+   * @param flags Set to outlier_flag or zero for each reflection
+   */
+  void simple_normdev_outliers(scitbx::af::const_ref<double> intensities,
+                               scitbx::af::const_ref<double> scales,
+                               scitbx::af::const_ref<double> weights,
+                               double zmax,
+                               scitbx::af::ref<int> flags,
+                               std::size_t nthreads = 1) const {
+    DIALS_ASSERT(intensities.size() == n_refl_);
+    DIALS_ASSERT(scales.size() == n_refl_);
+    DIALS_ASSERT(weights.size() == n_refl_);
+    DIALS_ASSERT(flags.size() == n_refl_);
+    for (std::size_t r = 0; r < n_refl_; ++r) {
+      DIALS_ASSERT(weights[r] > 0);
+    }
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&IhTableGroups::simple_normdev_outlier_groups,
+                  this,
+                  intensities,
+                  scales,
+                  weights,
+                  zmax,
+                  flags,
+                  _1,
+                  _2),
+      n_groups(),
+      nthreads);
+  }
+
+  enum { outlier_flag = 1, potential_outlier_flag = 2 };
+
+private:
+  void normdev_outlier_groups(scitbx::af::const_ref<double> intensities,
+                              scitbx::af::const_ref<double> scales,
+                              scitbx::af::const_ref<double> weights,
+                              double zmax,
+                              scitbx::af::ref<int> flags,
+                              scitbx::af::ref<std::size_t> group_outlier,
+                              std::size_t first,
+                              std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      std::size_t begin = group_start_[i];
+      std::size_t end = group_start_[i + 1];
+      for (std::size_t k = begin; k < end; ++k) {
+        flags[group_refl_[k]] = 0;
+      }
+      if (end - begin <= 2) {
+        continue;
+      }
+      double wgIsum = 0.0;
+      double wg2sum = 0.0;
+      for (std::size_t k = begin; k < end; ++k) {
+        std::size_t r = group_refl_[k];
+        wgIsum += weights[r] * scales[r] * intensities[r];
+        wg2sum += weights[r] * scales[r] * scales[r];
+      }
+      double max_z = zmax;
+      std::size_t index_of_max = n_refl_;
+      for (std::size_t k = begin; k < end; ++k) {
+        std::size_t r = group_refl_[k];
+        double g = scales[r];
+        double w = weights[r];
+        double wgIsum_others = wgIsum - (w * g * intensities[r]);
+        double wg2sum_others = wg2sum - (w * g * g);
+        // guard against zero division, which can happen due to rounding
+        // errors or bad data giving very small g values, by rejecting
+        double z = 1000.0;
+        if (wg2sum_others != 0.0) {
+          z = std::abs((intensities[r] - (g * wgIsum_others / wg2sum_others))
+                       / std::sqrt((1.0 / w) + (g * g / wg2sum_others)));
+        }
+        if (z > max_z) {
+          max_z = z;
+          index_of_max = r;
+        }
+      }
+      if (index_of_max < n_refl_) {
+        group_outlier[i] = index_of_max;
+        for (std::size_t k = begin; k < end; ++k) {
+          flags[group_refl_[k]] = potential_outlier_flag;
+        }
+        flags[index_of_max] = outlier_flag;
+      }
+    }
+  }
+
+  void simple_normdev_outlier_groups(scitbx::af::const_ref<double> intensities,
+                                     scitbx::af::const_ref<double> scales,
+                                     scitbx::af::const_ref<double> weights,
+                                     double zmax,
+                                     scitbx::af::ref<int> flags,
+                                     std::size_t first,
+                                     std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      double wgIsum = 0.0;
+      double wg2sum = 0.0;
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        wgIsum += weights[r] * scales[r] * intensities[r];
+        wg2sum += weights[r] * scales[r] * scales[r];
+      }
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        double g = scales[r];
+        // guard against zero division by rejecting, as above
+        double z = 1000.0;
+        if (wg2sum != 0.0) {
+          z = std::abs((intensities[r] - (g * wgIsum / wg2sum))
+                       / std::sqrt((1.0 / weights[r]) + (g * g / (wg2sum * wg2sum))));
+        }
+        flags[r] = z > zmax ? outlier_flag : 0;
+      }
+    }
+  }
+
+  void sum_gsq_groups(scitbx::af::const_ref<double> scales,
+                      scitbx::af::const_ref<double> weights,
+                      scitbx::af::ref<double> result,
+                      std::size_t first,
+                      std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      double sumgsq = 0.0;
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        sumgsq += scales[r] * scales[r] * weights[r];
+      }
+      result[i] = sumgsq;
+    }
+  }
+
+  void calc_Ih_groups(scitbx::af::const_ref<double> intensities,
+                      scitbx::af::const_ref<double> scales,
+                      scitbx::af::const_ref<double> weights,
+                      scitbx::af::ref<double> result,
+                      std::size_t first,
+                      std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      double sumgsq = 0.0;
+      double sumgI = 0.0;
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        sumgsq += scales[r] * scales[r] * weights[r];
+        sumgI += scales[r] * intensities[r] * weights[r];
+      }
+      double Ih = sumgI / sumgsq;
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        result[group_refl_[k]] = Ih;
+      }
+    }
+  }
+
+  std::size_t n_refl_;
+  scitbx::af::shared<std::size_t> group_start_;
+  scitbx::af::shared<std::size_t> group_refl_;
+};
+
+/**
+ * The sparsity pattern of dIh/dp and of the Jacobian for a fixed grouping of
+ * reflections (h_index_mat) and a fixed pattern of the derivatives. These do
+ * not change during a scaling run, so the pattern is found once and each
+ * cycle only calculates the values, in parallel over groups.
+ */
+class ScalingJacobianPattern {
+public:
+  /**
+   * @param h_index_mat The reflection to group matrix (n_refl x n_groups)
+   * @param derivatives The derivatives (n_params x n_refl)
+   */
+  ScalingJacobianPattern(scitbx::sparse::matrix<double> h_index_mat,
+                         scitbx::sparse::matrix<double> derivatives)
+      : n_params_(derivatives.n_rows()),
+        n_refl_(derivatives.n_cols()),
+        n_groups_(h_index_mat.n_cols()),
+        group_start_(h_index_mat.n_cols() + 1, 0),
+        deriv_start_(derivatives.n_cols() + 1, 0) {
+    DIALS_ASSERT(h_index_mat.n_rows() == n_refl_);
+
+    // the reflections of each group, in order
+    for (std::size_t i = 0; i < n_groups_; ++i) {
+      const col_type column = h_index_mat.col(i);
+      column.compact();
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        group_refl_.push_back(it.index());
+      }
+      group_start_[i + 1] = group_refl_.size();
+    }
+
+    // the pattern of the derivatives of each reflection
+    for (std::size_t r = 0; r < n_refl_; ++r) {
+      const col_type column = derivatives.col(r);
+      column.compact();
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        deriv_param_.push_back(it.index());
+      }
+      deriv_start_[r + 1] = deriv_param_.size();
+    }
+    deriv_pos_.resize(deriv_param_.size());
+
+    // the sorted parameters with a nonzero derivative in each group, and the
+    // position of each derivative element among them
+    scitbx::af::shared<int> position(n_params_, -1);
+    param_start_.push_back(0);
+    for (std::size_t i = 0; i < n_groups_; ++i) {
+      std::size_t first = params_.size();
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        for (std::size_t d = deriv_start_[r]; d < deriv_start_[r + 1]; ++d) {
+          if (position[deriv_param_[d]] < 0) {
+            position[deriv_param_[d]] = 0;
+            params_.push_back(deriv_param_[d]);
+          }
+        }
+      }
+      std::sort(params_.begin() + first, params_.end());
+      for (std::size_t k = first; k < params_.size(); ++k) {
+        position[params_[k]] = k - first;
+      }
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        for (std::size_t d = deriv_start_[r]; d < deriv_start_[r + 1]; ++d) {
+          deriv_pos_[d] = position[deriv_param_[d]];
+        }
+      }
+      for (std::size_t k = first; k < params_.size(); ++k) {
+        position[params_[k]] = -1;
+      }
+      param_start_.push_back(params_.size());
+    }
+  }
+
+  /**
+   * Check that the derivatives have the pattern this was constructed with
+   */
+  bool matches(scitbx::sparse::matrix<double> derivatives) const {
+    if (derivatives.n_rows() != n_params_ || derivatives.n_cols() != n_refl_) {
+      return false;
+    }
+    for (std::size_t r = 0; r < n_refl_; ++r) {
+      const col_type column = derivatives.col(r);
+      column.compact();
+      std::size_t d = deriv_start_[r];
+      for (col_type::const_iterator it = column.begin(); it != column.end();
+           ++it, ++d) {
+        if (d >= deriv_start_[r + 1] || deriv_param_[d] != it.index()) {
+          return false;
+        }
+      }
+      if (d != deriv_start_[r + 1]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Calculate dIh/dp (n_groups x n_params), as calculate_dIh_by_dpi
+   */
+  scitbx::sparse::matrix<double> dIh_by_dpi(scitbx::af::const_ref<double> dIh,
+                                            scitbx::af::const_ref<double> sumgsq,
+                                            scitbx::sparse::matrix<double> derivatives,
+                                            std::size_t nthreads = 1) const {
+    scitbx::af::shared<double> values = dIh_by_dpi_values(
+      dIh, sumgsq, extract_derivatives(derivatives).const_ref(), nthreads);
+    scitbx::sparse::matrix<double> result(n_groups_, n_params_);
+    for (std::size_t i = 0; i < n_groups_; ++i) {
+      for (std::size_t k = param_start_[i]; k < param_start_[i + 1]; ++k) {
+        result(i, params_[k]) = values[k];
+      }
+    }
+    result.compact();
+    return result;
+  }
+
+  /**
+   * Calculate the Jacobian (n_refl x n_params), as calc_jacobian
+   */
+  scitbx::sparse::matrix<double> jacobian(scitbx::sparse::matrix<double> derivatives,
+                                          scitbx::af::const_ref<double> Ih,
+                                          scitbx::af::const_ref<double> g,
+                                          scitbx::af::const_ref<double> dIh,
+                                          scitbx::af::const_ref<double> sumgsq,
+                                          std::size_t nthreads = 1) const {
+    DIALS_ASSERT(Ih.size() == n_refl_);
+    DIALS_ASSERT(g.size() == n_refl_);
+    scitbx::af::shared<double> deriv_values = extract_derivatives(derivatives);
+    scitbx::af::shared<double> values =
+      dIh_by_dpi_values(dIh, sumgsq, deriv_values.const_ref(), nthreads);
+
+    // each reflection has an element for every parameter of its group
+    scitbx::af::shared<std::size_t> row_start(n_refl_ + 1, 0);
+    for (std::size_t i = 0; i < n_groups_; ++i) {
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        row_start[group_refl_[k] + 1] = param_start_[i + 1] - param_start_[i];
+      }
+    }
+    for (std::size_t r = 0; r < n_refl_; ++r) {
+      row_start[r + 1] += row_start[r];
+    }
+    scitbx::af::shared<double> jacobian_values(row_start[n_refl_], 0);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&ScalingJacobianPattern::jacobian_groups,
+                  this,
+                  Ih,
+                  g,
+                  deriv_values.const_ref(),
+                  values.const_ref(),
+                  row_start.const_ref(),
+                  jacobian_values.ref(),
+                  _1,
+                  _2),
+      n_groups_,
+      nthreads);
+
+    scitbx::sparse::matrix<double> result(n_refl_, n_params_);
+    for (std::size_t i = 0; i < n_groups_; ++i) {
+      std::size_t n = param_start_[i + 1] - param_start_[i];
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        for (std::size_t p = 0; p < n; ++p) {
+          result(r, params_[param_start_[i] + p]) = jacobian_values[row_start[r] + p];
+        }
+      }
+    }
+    result.compact();
+    return result;
+  }
+
+private:
+  // the values of the derivatives in the order of the pattern
+  scitbx::af::shared<double> extract_derivatives(
+    scitbx::sparse::matrix<double> derivatives) const {
+    DIALS_ASSERT(derivatives.n_rows() == n_params_);
+    DIALS_ASSERT(derivatives.n_cols() == n_refl_);
+    scitbx::af::shared<double> values(deriv_param_.size());
+    for (std::size_t r = 0; r < n_refl_; ++r) {
+      const col_type column = derivatives.col(r);
+      column.compact();
+      std::size_t d = deriv_start_[r];
+      for (col_type::const_iterator it = column.begin(); it != column.end();
+           ++it, ++d) {
+        DIALS_ASSERT(d < deriv_start_[r + 1] && deriv_param_[d] == it.index());
+        values[d] = *it;
+      }
+      DIALS_ASSERT(d == deriv_start_[r + 1]);
+    }
+    return values;
+  }
+
+  scitbx::af::shared<double> dIh_by_dpi_values(
+    scitbx::af::const_ref<double> dIh,
+    scitbx::af::const_ref<double> sumgsq,
+    scitbx::af::const_ref<double> deriv_values,
+    std::size_t nthreads) const {
+    DIALS_ASSERT(dIh.size() == n_refl_);
+    DIALS_ASSERT(sumgsq.size() == n_groups_);
+    scitbx::af::shared<double> values(params_.size(), 0);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&ScalingJacobianPattern::dIh_by_dpi_groups,
+                  this,
+                  dIh,
+                  sumgsq,
+                  deriv_values,
+                  values.ref(),
+                  _1,
+                  _2),
+      n_groups_,
+      nthreads);
+    return values;
+  }
+
+  void dIh_by_dpi_groups(scitbx::af::const_ref<double> dIh,
+                         scitbx::af::const_ref<double> sumgsq,
+                         scitbx::af::const_ref<double> deriv_values,
+                         scitbx::af::ref<double> values,
+                         std::size_t first,
+                         std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      double* group_values = &values[param_start_[i]];
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        for (std::size_t d = deriv_start_[r]; d < deriv_start_[r + 1]; ++d) {
+          group_values[deriv_pos_[d]] += dIh[r] * deriv_values[d] / sumgsq[i];
+        }
+      }
+    }
+  }
+
+  void jacobian_groups(scitbx::af::const_ref<double> Ih,
+                       scitbx::af::const_ref<double> g,
+                       scitbx::af::const_ref<double> deriv_values,
+                       scitbx::af::const_ref<double> values,
+                       scitbx::af::const_ref<std::size_t> row_start,
+                       scitbx::af::ref<double> jacobian_values,
+                       std::size_t first,
+                       std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      std::size_t n = param_start_[i + 1] - param_start_[i];
+      for (std::size_t k = group_start_[i]; k < group_start_[i + 1]; ++k) {
+        std::size_t r = group_refl_[k];
+        double* row = &jacobian_values[row_start[r]];
+        for (std::size_t d = deriv_start_[r]; d < deriv_start_[r + 1]; ++d) {
+          row[deriv_pos_[d]] -= deriv_values[d] * Ih[r];
+        }
+        for (std::size_t p = 0; p < n; ++p) {
+          row[p] -= g[r] * values[param_start_[i] + p];
+        }
+      }
+    }
+  }
+
+  std::size_t n_params_;
+  std::size_t n_refl_;
+  std::size_t n_groups_;
+  scitbx::af::shared<std::size_t> group_start_;
+  scitbx::af::shared<std::size_t> group_refl_;
+  scitbx::af::shared<std::size_t> deriv_start_;
+  scitbx::af::shared<std::size_t> deriv_param_;
+  scitbx::af::shared<std::size_t> deriv_pos_;
+  scitbx::af::shared<std::size_t> param_start_;
+  scitbx::af::shared<std::size_t> params_;
+};
+
 scitbx::sparse::matrix<double> row_multiply(scitbx::sparse::matrix<double> m,
-                                            scitbx::af::const_ref<double> v) {
+                                            scitbx::af::const_ref<double> v,
+                                            std::size_t nthreads = 1) {
   DIALS_ASSERT(m.n_rows() == v.size());
 
   // call compact to ensure that each elt of the matrix is only defined once
@@ -262,16 +894,12 @@ scitbx::sparse::matrix<double> row_multiply(scitbx::sparse::matrix<double> m,
 
   scitbx::sparse::matrix<double> result(m.n_rows(), m.n_cols());
 
-  // outer loop iterate over the columns
-  for (std::size_t j = 0; j < m.n_cols(); j++) {
-    // inner loop iterate over the non-zero elements of the column
-    for (scitbx::sparse::matrix<double>::row_iterator p = m.col(j).begin();
-         p != m.col(j).end();
-         ++p) {
-      std::size_t i = p.index();
-      result(i, j) = *p * v[i];
-    }
-  }
+  // columns are independent, so can be filled in parallel
+  dials::algorithms::detail::parallel_bands(
+    boost::bind(
+      &detail::row_multiply_columns, boost::cref(m), v, boost::ref(result), _1, _2),
+    m.n_cols(),
+    nthreads);
   return result;
 }
 
@@ -338,24 +966,32 @@ boost::python::tuple determine_outlier_indices(
 
 scitbx::af::shared<double> calc_sigmasq(
   scitbx::sparse::matrix<double> jacobian_transpose,
-  scitbx::sparse::matrix<double> var_cov_matrix) {
-  int n_cols = jacobian_transpose.n_cols();
-  scitbx::af::shared<double> sigmasq(n_cols);
-  for (int i = 0; i < n_cols; i++) {
-    // scitbx::af::shared<double> result(n_refl);
-    // for (int j=0; j < n_refl; j++){
-    //  result[j] += jacobian_transpose.col(i) * var_cov_matrix.col(j);
-    //  }
-
-    for (scitbx::sparse::matrix<double>::row_iterator p =
-           jacobian_transpose.col(i).begin();
-         p != jacobian_transpose.col(i).end();
-         ++p) {
-      int k = p.index();
-      sigmasq[i] +=
-        *p * (jacobian_transpose.col(i) * var_cov_matrix.col(k));  // *p * result[k];
+  scitbx::sparse::matrix<double> var_cov_matrix,
+  std::size_t nthreads = 1) {
+  std::size_t n_params = jacobian_transpose.n_rows();
+  DIALS_ASSERT(var_cov_matrix.n_rows() == n_params);
+  DIALS_ASSERT(var_cov_matrix.n_cols() == n_params);
+  jacobian_transpose.compact();
+
+  // the var_cov_matrix is small, so use a dense copy for the inner products
+  scitbx::af::shared<double> var_cov(n_params * n_params, 0.0);
+  for (std::size_t k = 0; k < n_params; k++) {
+    const col_type column = var_cov_matrix.col(k);
+    for (col_type::const_iterator p = column.begin(); p != column.end(); ++p) {
+      var_cov[k * n_params + p.index()] += *p;
     }
   }
+
+  scitbx::af::shared<double> sigmasq(jacobian_transpose.n_cols(), 0.0);
+  dials::algorithms::detail::parallel_bands(
+    boost::bind(&detail::sigmasq_columns,
+                boost::cref(jacobian_transpose),
+                var_cov.const_ref(),
+                sigmasq.ref(),
+                _1,
+                _2),
+    jacobian_transpose.n_cols(),
+    nthreads);
   return sigmasq;
 }
 
@@ -485,6 +1121,169 @@ matrix<double> create_sph_harm_table(
   return sph_harm_terms_;
 }
 
+namespace detail {
+
+  /**
+   * The associated Legendre functions P_l^m(x) for 0 <= m <= l <= lmax,
+   * without normalisation or phase, by the standard recursion in l. The
+   * value for (l, m) is stored at l * (lmax + 1) + m.
+   */
+  inline void associated_legendre(int lmax, double x, double sin_theta, double *p) {
+    double pmm = 1.0;
+    for (int m = 0; m <= lmax; ++m) {
+      if (m > 0) {
+        pmm *= (2 * m - 1) * sin_theta;
+      }
+      p[m * (lmax + 1) + m] = pmm;
+      if (m < lmax) {
+        double a = pmm;
+        double b = x * (2 * m + 1) * pmm;
+        p[(m + 1) * (lmax + 1) + m] = b;
+        for (int l = m + 2; l <= lmax; ++l) {
+          double c = ((2 * l - 1) * x * b - (l + m - 1) * a) / (l - m);
+          p[l * (lmax + 1) + m] = c;
+          a = b;
+          b = c;
+        }
+      }
+    }
+  }
+
+  /**
+   * Add the values of the real harmonic basis functions for a crystal frame
+   * vector to the values array (n_param), using the coefficients that convert
+   * P_l^|m|(cos theta) cos(m phi) or sin(|m| phi) to each basis function.
+   */
+  inline void add_sph_harm_values(int lmax,
+                                  scitbx::vec3<double> v,
+                                  const double *coefficients,
+                                  double *legendre,
+                                  double *cos_m_phi,
+                                  double *sin_m_phi,
+                                  double *values) {
+    double rho = std::sqrt(v[0] * v[0] + v[1] * v[1]);
+    double r = std::sqrt(rho * rho + v[2] * v[2]);
+    // theta = atan2(rho, z) and phi = atan2(y, x), as in calc_theta_phi
+    double cos_theta = r > 0 ? v[2] / r : 1.0;
+    double sin_theta = r > 0 ? rho / r : 0.0;
+    double cos_phi = rho > 0 ? v[0] / rho : (v[0] < 0 ? -1.0 : 1.0);
+    double sin_phi = rho > 0 ? v[1] / rho : 0.0;
+    associated_legendre(lmax, cos_theta, sin_theta, legendre);
+    cos_m_phi[0] = 1.0;
+    sin_m_phi[0] = 0.0;
+    for (int m = 1; m <= lmax; ++m) {
+      cos_m_phi[m] = cos_m_phi[m - 1] * cos_phi - sin_m_phi[m - 1] * sin_phi;
+      sin_m_phi[m] = sin_m_phi[m - 1] * cos_phi + cos_m_phi[m - 1] * sin_phi;
+    }
+    int k = 0;
+    for (int l = 1; l <= lmax; ++l) {
+      for (int m = -l; m <= l; ++m, ++k) {
+        int mm = m < 0 ? -m : m;
+        double trig = m < 0 ? sin_m_phi[mm] : cos_m_phi[mm];
+        values[k] += coefficients[k] * legendre[l * (lmax + 1) + mm] * trig;
+      }
+    }
+  }
+
+  inline void sph_harm_table_columns(int lmax,
+                                     scitbx::af::const_ref<scitbx::vec3<double> > s0c,
+                                     scitbx::af::const_ref<scitbx::vec3<double> > s1c,
+                                     scitbx::af::const_ref<double> coefficients,
+                                     matrix<double> &result,
+                                     std::size_t first,
+                                     std::size_t last) {
+    std::size_t n_param = coefficients.size();
+    std::vector<double> legendre((lmax + 1) * (lmax + 1));
+    std::vector<double> cos_m_phi(lmax + 1);
+    std::vector<double> sin_m_phi(lmax + 1);
+    std::vector<double> values(n_param);
+    for (std::size_t i = first; i < last; ++i) {
+      std::fill(values.begin(), values.end(), 0.0);
+      add_sph_harm_values(lmax,
+                          s0c[i],
+                          coefficients.begin(),
+                          &legendre[0],
+                          &cos_m_phi[0],
+                          &sin_m_phi[0],
+                          &values[0]);
+      add_sph_harm_values(lmax,
+                          s1c[i],
+                          coefficients.begin(),
+                          &legendre[0],
+                          &cos_m_phi[0],
+                          &sin_m_phi[0],
+                          &values[0]);
+      for (std::size_t k = 0; k < n_param; ++k) {
+        result(k, i) = values[k];
+      }
+    }
+  }
+
+}  // namespace detail
+
+/**
+ * Calculate the same spherical harmonic table as create_sph_harm_table, but
+ * directly from the crystal frame s0 and s1 vectors, using the recursion for
+ * the associated Legendre functions to calculate all harmonics of a vector at
+ * once, in parallel over reflections.
+ */
+matrix<double> calculate_sph_harm_table(
+  scitbx::af::const_ref<scitbx::vec3<double> > s0c,
+  scitbx::af::const_ref<scitbx::vec3<double> > s1c,
+  int lmax,
+  std::size_t nthreads = 1) {
+  DIALS_ASSERT(lmax >= 0);
+  DIALS_ASSERT(s0c.size() == s1c.size());
+  nss_spherical_harmonics<double> nsssphe(
+    lmax, 50000, log_factorial_generator<double>((2 * lmax) + 1));
+  double sqrt2 = 1.414213562;
+
+  // The normalisation and phase of each harmonic are found by comparison
+  // with nss_spherical_harmonics at a reference direction, so that the table
+  // matches create_sph_harm_table. These also include the prefactors for the
+  // real harmonic basis functions.
+  int n_param = (2 * lmax) + (lmax * lmax);
+  scitbx::af::shared<double> coefficients(n_param);
+  std::vector<double> legendre((lmax + 1) * (lmax + 1));
+  int k = 0;
+  for (int l = 1; l <= lmax; ++l) {
+    for (int m = -l; m <= l; ++m, ++k) {
+      int mm = m < 0 ? -m : m;
+      double phi = mm > 0 ? scitbx::constants::pi / (4 * mm) : 0.0;
+      double theta = 1.0;
+      for (; theta < 2.0; theta += 0.1) {
+        detail::associated_legendre(
+          lmax, std::cos(theta), std::sin(theta), &legendre[0]);
+        if (std::abs(legendre[l * (lmax + 1) + mm]) > 1e-6) {
+          break;
+        }
+      }
+      std::complex<double> ylm = nsssphe.spherical_harmonic_direct(l, mm, theta, phi);
+      double p = legendre[l * (lmax + 1) + mm];
+      double prefactor = m == 0 ? 0.5 : sqrt2 * pow(-1.0, m) / 2.0;
+      if (m < 0) {
+        coefficients[k] = prefactor * ylm.imag() / (p * std::sin(mm * phi));
+      } else {
+        coefficients[k] = prefactor * ylm.real() / (p * std::cos(mm * phi));
+      }
+    }
+  }
+
+  matrix<double> result(n_param, s0c.size());
+  dials::algorithms::detail::parallel_bands(
+    boost::bind(&detail::sph_harm_table_columns,
+                lmax,
+                s0c,
+                s1c,
+                coefficients.const_ref(),
+                boost::ref(result),
+                _1,
+                _2),
+    s0c.size(),
+    nthreads);
+  return result;
+}
+
 boost::python::list create_sph_harm_lookup_table(int lmax, int points_per_degree) {
   nss_spherical_harmonics<double> nsssphe(
     lmax, 50000, log_factorial_generator<double>((2 * lmax) + 1));
@@ -11,11 +11,7 @@
 from cctbx import miller, uctbx
 
 from dials.array_family import flex
-from dials_scaling_ext import (
-    calc_theta_phi,
-    create_sph_harm_table,
-    rotate_vectors_about_axis,
-)
+from dials_scaling_ext import calculate_sph_harm_table, rotate_vectors_about_axis
 
 logger = logging.getLogger("dials")
 
@@ -105,10 +101,9 @@ def align_rotation_axis_along_z(exp_rot_axis, vectors):
 def sph_harm_table(reflection_table, lmax):
     """Calculate the spherical harmonic table for a spherical
     harmonic absorption correction."""
-    theta_phi = calc_theta_phi(reflection_table["s0c"])
-    theta_phi_2 = calc_theta_phi(reflection_table["s1c"])
-    sph_h_t = create_sph_harm_table(theta_phi, theta_phi_2, lmax)
-    return sph_h_t
+    return calculate_sph_harm_table(
+        reflection_table["s0c"], reflection_table["s1c"], lmax
+    )
 
 
 def quasi_normalisation(reflection_table, experiment):
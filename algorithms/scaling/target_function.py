@@ -9,7 +9,28 @@
 
 from dials.algorithms.scaling.scaling_restraints import ScalingRestraintsCalculator
 from dials.array_family import flex
-from dials_scaling_ext import calc_dIh_by_dpi, calc_jacobian, row_multiply
+from dials_scaling_ext import ScalingJacobianPattern, row_multiply
+
+
+def jacobian_pattern(Ih_table, derivatives):
+    """
+    Return the sparsity pattern of dIh/dp and the jacobian for an Ih_table.
+
+    The pattern is cached on the Ih_table and only recalculated if the
+    h_index_matrix is replaced or the pattern of the derivatives changes.
+    """
+    cached = getattr(Ih_table, "_jacobian_pattern", None)
+    if (
+        cached is None
+        or cached[0] is not Ih_table.h_index_matrix
+        or not cached[1].matches(derivatives)
+    ):
+        cached = (
+            Ih_table.h_index_matrix,
+            ScalingJacobianPattern(Ih_table.h_index_matrix, derivatives),
+        )
+        Ih_table._jacobian_pattern = cached
+    return cached[1]
 
 
 class ScalingTarget(object):
@@ -75,8 +96,9 @@ def calculate_gradients(Ih_table):
             Ih_table.intensities
             - (Ih_table.Ih_values * 2.0 * Ih_table.inverse_scale_factors)
         ) * Ih_table.weights
-        dIh_by_dpi = calc_dIh_by_dpi(
-            dIh, sumgsq, Ih_table.h_index_matrix, Ih_table.derivatives.transpose()
+        derivatives = Ih_table.derivatives.transpose()
+        dIh_by_dpi = jacobian_pattern(Ih_table, derivatives).dIh_by_dpi(
+            dIh, sumgsq, derivatives
         )
         term_1 = (prefactor * Ih_table.Ih_values) * Ih_table.derivatives
         term_2 = (
@@ -94,13 +116,9 @@ def calculate_jacobian(Ih_table):
             Ih_table.intensities
             - (Ih_table.Ih_values * 2.0 * Ih_table.inverse_scale_factors)
         ) * Ih_table.weights
-        jacobian = calc_jacobian(
-            Ih_table.derivatives.transpose(),
-            Ih_table.h_index_matrix,
-            Ih_table.Ih_values,
-            Ih_table.inverse_scale_factors,
-            dIh,
-            sumgsq,
+        derivatives = Ih_table.derivatives.transpose()
+        jacobian = jacobian_pattern(Ih_table, derivatives).jacobian(
+            derivatives, Ih_table.Ih_values, Ih_table.inverse_scale_factors, dIh, sumgsq
         )
         return jacobian
 
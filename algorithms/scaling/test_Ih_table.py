@@ -189,6 +189,20 @@ def test_IhTableblock_onedataset(large_reflection_table, test_sg):
 
     assert list(block.calc_nh()) == [2, 1, 2, 1, 1, 2, 2]
 
+    # The group sums should match those from the h_index_matrix
+    groups = block.groups
+    assert groups is block.groups
+    assert groups.n_groups() == block.n_groups
+    assert groups.n_refl() == block.size
+    gsq = flex.pow2(block.inverse_scale_factors) * block.weights
+    assert list(groups.sum_gsq(block.inverse_scale_factors, block.weights)) == (
+        pytest.approx(list(gsq * block.h_index_matrix))
+    )
+    Ih = groups.calc_Ih(
+        block.intensities, block.inverse_scale_factors, block.weights, nthreads=2
+    )
+    assert list(Ih) == pytest.approx(list(block.Ih_values))
+
     # Test update error model
     block.update_error_model(mock_error_model())
     assert list(block.weights) == pytest.approx(
@@ -25,6 +25,7 @@ def test_2DGaussianSmoother():
     y = flex.double([1.0, 0.75])
     value, weight, sumw = GS2D.multi_value_weight(x, y, parameters)
     assert weight.non_zeroes == 6 * 2
+    assert list(GS2D.multi_value(x, y, parameters)) == pytest.approx(list(value))
     assert GS2D.sigma() == 0.65
     # Calculate tand verify the expected value at the first position.
     expected_sumw = (2.0 * exp(-2.5 / (0.65 ** 2))) + 4.0 * exp(-0.5 / (0.65 ** 2))
@@ -71,6 +72,7 @@ def test_3DGaussianSmoother():
     z = flex.double([0.5, 0.25])
     value, weight, sumw = GS3D.multi_value_weight(x, y, z, parameters)
     assert weight.non_zeroes == 6 * 2 * 2
+    assert list(GS3D.multi_value(x, y, z, parameters)) == pytest.approx(list(value))
     assert GS3D.sigma() == 0.65
 
     # Calculate tand verify the expected value at the first position.
@@ -372,6 +372,12 @@ def test_determine_outlier_index_arrays(generated_Ih_table, outlier_target_table
     outliers = determine_outlier_index_arrays(generated_Ih_table, "simple")
     assert list(outliers[0]) == [4, 5, 6, 7, 8, 9]
 
+    # Same results when run over several threads
+    outliers = determine_outlier_index_arrays(generated_Ih_table, "standard", nproc=2)
+    assert list(outliers[0]) == [4, 9, 8, 7]
+    outliers = determine_outlier_index_arrays(generated_Ih_table, "simple", nproc=2)
+    assert list(outliers[0]) == [4, 5, 6, 7, 8, 9]
+
     outliers = determine_outlier_index_arrays(
         generated_Ih_table, "target", target=outlier_target_table
     )
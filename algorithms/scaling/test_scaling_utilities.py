@@ -27,10 +27,14 @@
 from dials.util.options import OptionParser
 from dials_scaling_ext import (
     calc_lookup_index,
+    calc_sigmasq,
     calc_theta_phi,
     calculate_harmonic_tables_from_selections,
+    calculate_sph_harm_table,
     create_sph_harm_lookup_table,
     create_sph_harm_table,
+    elementwise_square,
+    row_multiply,
 )
 
 
@@ -227,6 +231,23 @@ def test_create_sph_harm_table(test_reflection_table, mock_exp):
     assert sph_h_t[5, 1] == pytest.approx(Y20)
     assert sph_h_t[5, 2] == pytest.approx(Y20)
     # Now test that you get the same by just calling the function.
+    for nthreads in (1, 2):
+        table = calculate_sph_harm_table(
+            reflection_table["s0c"], reflection_table["s1c"], 2, nthreads=nthreads
+        )
+        assert table.n_rows == sph_h_t.n_rows
+        assert table.n_cols == sph_h_t.n_cols
+        assert list(table.as_dense_matrix()) == pytest.approx(
+            list(sph_h_t.as_dense_matrix()), abs=1e-12
+        )
+    lmax = 6
+    s0c = flex.vec3_double([(0.3, -0.5, 0.81), (-0.7, 0.2, -0.1), (0.0, 0.0, 1.0)])
+    s1c = flex.vec3_double([(-0.1, 0.9, 0.4), (0.5, 0.5, 0.5), (0.6, -0.8, 0.0)])
+    table = calculate_sph_harm_table(s0c, s1c, lmax)
+    expected = create_sph_harm_table(calc_theta_phi(s0c), calc_theta_phi(s1c), lmax)
+    assert list(table.as_dense_matrix()) == pytest.approx(
+        list(expected.as_dense_matrix()), abs=1e-10
+    )
 
 
 def test_calculate_wilson_outliers(wilson_test_reflection_table):
@@ -386,3 +407,27 @@ def test_calc_lookup_index():
     assert list(indices) == [0, 64799, 359, 64440]
     indices = calc_lookup_index(theta_phi, 2)
     assert list(indices) == [0, 259199, 719, 258480]
+
+
+def test_sparse_matrix_kernels():
+    """Test row_multiply, elementwise_square and calc_sigmasq."""
+    m = matrix(3, 2)
+    m[0, 0] = 1.0
+    m[2, 0] = 2.0
+    m[1, 1] = 3.0
+    m[2, 1] = 4.0
+    v = flex.double([2.0, 3.0, 4.0])
+    var_cov = matrix(2, 2)
+    var_cov[0, 0] = 0.2
+    var_cov[0, 1] = 0.1
+    var_cov[1, 0] = 0.1
+    var_cov[1, 1] = 0.3
+    for nthreads in (1, 2):
+        r = row_multiply(m, v, nthreads=nthreads)
+        assert list(r.as_dense_matrix()) == [2.0, 0.0, 0.0, 9.0, 8.0, 16.0]
+        sq = elementwise_square(m, nthreads=nthreads)
+        assert list(sq.as_dense_matrix()) == [1.0, 0.0, 0.0, 9.0, 4.0, 16.0]
+        sigmasq = calc_sigmasq(m.transpose(), var_cov, nthreads=nthreads)
+        assert list(sigmasq) == pytest.approx(
+            [0.2, 9.0 * 0.3, 4.0 * 0.2 + 16.0 * 0.3 + 2.0 * 8.0 * 0.1]
+        )
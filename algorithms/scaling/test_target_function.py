@@ -23,6 +23,7 @@
 from dials.algorithms.scaling.target_function import ScalingTarget, ScalingTargetFixedIH
 from dials.array_family import flex
 from dials.util.options import OptionParser
+from dials_scaling_ext import ScalingJacobianPattern, calc_dIh_by_dpi, calc_jacobian
 
 
 @pytest.fixture
@@ -307,6 +308,39 @@ def test_target_fixedIh():
     assert target._rmsds == pytest.approx([expected_rmsd])
 
 
+def test_scaling_jacobian_pattern():
+    """Test the cached pattern against calc_dIh_by_dpi and calc_jacobian."""
+    # 5 reflections in 2 groups, 3 parameters
+    h_index_matrix = sparse.matrix(5, 2)
+    for i, j in enumerate([0, 1, 0, 1, 1]):
+        h_index_matrix[i, j] = 1.0
+    derivatives = sparse.matrix(3, 5)
+    for (i, j), v in zip(
+        [(0, 0), (2, 0), (1, 1), (0, 2), (2, 3), (1, 4), (2, 4)],
+        [1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0],
+    ):
+        derivatives[i, j] = v
+    Ih = flex.double([1.0, 2.0, 3.0, 4.0, 5.0])
+    g = flex.double([1.1, 0.9, 1.2, 0.8, 1.0])
+    dIh = flex.double([0.5, -1.0, 1.5, 2.0, -0.5])
+    sumgsq = flex.double([2.5, 3.5])
+
+    pattern = ScalingJacobianPattern(h_index_matrix, derivatives)
+    assert pattern.matches(derivatives)
+    assert not pattern.matches(sparse.matrix(3, 5))
+    for nthreads in (1, 2):
+        expected = calc_dIh_by_dpi(dIh, sumgsq, h_index_matrix, derivatives)
+        result = pattern.dIh_by_dpi(dIh, sumgsq, derivatives, nthreads=nthreads)
+        assert list(result.as_dense_matrix()) == pytest.approx(
+            list(expected.as_dense_matrix())
+        )
+        expected = calc_jacobian(derivatives, h_index_matrix, Ih, g, dIh, sumgsq)
+        result = pattern.jacobian(derivatives, Ih, g, dIh, sumgsq, nthreads=nthreads)
+        assert list(result.as_dense_matrix()) == pytest.approx(
+            list(expected.as_dense_matrix())
+        )
+
+
 # For testing the targetfunction calculations using finite difference methods,
 # need to initialise real instances of the scaling datastructures to allow
 # variation of the parameters and updating of the linked datastructures.
@@ -20,7 +20,10 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
     class_<MaskOverlapping>("MaskOverlapping")
       .def("__call__",
            &MaskOverlapping::operator(),
-           (arg("shoeboxes"), arg("coords"), arg("adjacency_list")));
+           (arg("shoeboxes"),
+            arg("coords"),
+            arg("adjacency_list"),
+            arg("nthreads") = 1));
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -20,7 +20,9 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
   void export_overload_checker() {
     class_<OverloadChecker>("OverloadChecker")
       .def("add", &OverloadChecker::add)
-      .def("__call__", &OverloadChecker::operator());
+      .def("__call__",
+           &OverloadChecker::operator(),
+           (arg("id"), arg("shoebox"), arg("nthreads") = 1));
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -10,6 +10,7 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace shoebox { namespace boost_python {
 
@@ -23,6 +24,7 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
   void export_overload_checker();
 
   BOOST_PYTHON_MODULE(dials_algorithms_shoebox_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_mask_code();
     export_find_overlapping();
     export_mask_empirical();
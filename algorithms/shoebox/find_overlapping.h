@@ -17,6 +17,7 @@
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/adjacency_list.h>
 #include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/algorithms/shoebox/overlap_grid.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -62,176 +63,75 @@ namespace dials { namespace algorithms { namespace shoebox {
 
   /**
    * Given a set of reflections, find the bounding_boxes that overlap.
-   * This function uses a single shot collision detection algorithm to
-   * find the colliding bounding_boxes and then puts all the pairs of colliding
-   * indices into an adjacency list. Vertices are referred to in the
-   * adjacency list by index.
+   * This function uses a uniform grid to find the colliding bounding_boxes
+   * and puts all the pairs of colliding indices into an adjacency list.
+   * Vertices are referred to in the adjacency list by index.
    * @param bbox The list of bounding boxes
+   * @param nthreads The number of threads to use
    * @returns An adjacency list
    */
-  inline AdjacencyList find_overlapping(const af::const_ref<int6> &bboxes) {
+  inline AdjacencyList find_overlapping(const af::const_ref<int6> &bboxes,
+                                        std::size_t nthreads = 1) {
     // Ensure we have a valid number of bboxes
     DIALS_ASSERT(bboxes.size() > 0);
 
-    // Create a list of all the pairs of collisions between bouding boxes.
-    std::vector<std::pair<int, int> > collisions;
-    detect_collisions3d(bboxes.begin(), bboxes.end(), collisions);
-
-    // Put all the collisions into an adjacency list
-    AdjacencyList list(bboxes.size());
-    for (std::size_t i = 0; i < collisions.size(); ++i) {
-      list.add_edge(collisions[i].first, collisions[i].second);
-    }
-    list.finish();
-
-    // Return the adjacency list
-    return list;
+    // All the bounding boxes are in the same group
+    std::vector<std::size_t> group(bboxes.size(), 0);
+    OverlapGrid grid(
+      af::const_ref<std::size_t>(&group[0], group.size()), bboxes, nthreads);
+    return grid.adjacency_list();
   }
 
-  namespace detail {
-
-    // Struct to help sort data
-    struct sort_by_panel {
-      const af::const_ref<std::size_t> p_;
-      sort_by_panel(const af::const_ref<std::size_t> &p) : p_(p) {}
-      bool operator()(std::size_t a, std::size_t b) {
-        return p_[a] < p_[b];
-      }
-    };
-  }  // namespace detail
-
   /**
    * Given a set of reflections, find the bounding_boxes that overlap.
-   * This function uses a single shot collision detection algorithm to
-   * find the colliding bounding_boxes and then puts all the pairs of colliding
-   * indices into an adjacency list. Vertices are referred to in the
-   * adjacency list by index.
+   * Bounding boxes on different panels never overlap.
    * @param panel The list of panels
    * @param bbox The list of bounding boxes
+   * @param nthreads The number of threads to use
    * @returns An adjacency list
    */
   inline AdjacencyList find_overlapping_multi_panel(
     const af::const_ref<int6> &bbox,
-    const af::const_ref<std::size_t> &panel) {
+    const af::const_ref<std::size_t> &panel,
+    std::size_t nthreads = 1) {
     DIALS_ASSERT(panel.size() > 0);
     DIALS_ASSERT(panel.size() == bbox.size());
-
-    // The arrays to use in the collision detection
-    std::vector<int6> data(panel.size());
-    std::vector<std::size_t> index(panel.size());
-    for (std::size_t i = 0; i < index.size(); ++i) {
-      index[i] = i;
-    }
-    std::vector<std::size_t> offset;
-
-    // Sort arrays by panel
-    std::sort(index.begin(), index.end(), detail::sort_by_panel(panel));
-
-    // Create an array of offsets where the panel number is the same
-    // and put the sorted list of bboxes into an new array
-    offset.push_back(0);
-    std::size_t p = panel[index[0]];
-    for (std::size_t i = 0; i < index.size(); ++i) {
-      std::size_t j = index[i];
-      data[i] = bbox[j];
-      if (panel[j] != p) {
-        p = panel[j];
-        offset.push_back(i);
-      }
-    }
-    offset.push_back(index.size());
-
-    // Do the collision detection for all bboxes in the same panel
-    AdjacencyList list(bbox.size());
-    for (std::size_t j = 0; j < offset.size() - 1; ++j) {
-      std::size_t d0 = offset[j];
-      std::size_t d1 = offset[j + 1];
-      std::vector<std::pair<int, int> > collisions;
-
-      // Detect the collisions
-      detect_collisions3d(data.begin() + d0, data.begin() + d1, collisions);
-
-      // Put all the collisions into an adjacency list
-      for (std::size_t i = 0; i < collisions.size(); ++i) {
-        list.add_edge(index[d0 + collisions[i].first],
-                      index[d0 + collisions[i].second]);
-      }
-    }
-    list.finish();
-    return list;
+    OverlapGrid grid(panel, bbox, nthreads);
+    return grid.adjacency_list();
   }
 
+  /**
+   * Find the overlapping bounding boxes. Bounding boxes belonging to
+   * different experiments or on different panels never overlap.
+   */
   class OverlapFinder {
   public:
     OverlapFinder() {}
 
-    struct sort_by_group {
-      const std::vector<std::size_t> &g_;
-      sort_by_group(const std::vector<std::size_t> &g) : g_(g) {}
-      bool operator()(std::size_t a, std::size_t b) {
-        return g_[a] < g_[b];
-      }
-    };
-
+    /**
+     * @param id The experiment id of each bounding box
+     * @param panel The panel of each bounding box
+     * @param bbox The bounding boxes
+     * @param nthreads The number of threads to use
+     * @returns An adjacency list
+     */
     AdjacencyList operator()(const af::const_ref<std::size_t> &id,
                              const af::const_ref<std::size_t> &panel,
-                             const af::const_ref<int6> &bbox) const {
+                             const af::const_ref<int6> &bbox,
+                             std::size_t nthreads = 1) const {
       DIALS_ASSERT(panel.size() > 0);
       DIALS_ASSERT(panel.size() == bbox.size());
       DIALS_ASSERT(panel.size() == id.size());
 
-      // Get the maximum panel number
+      // Each experiment and panel is a separate group
       std::size_t max_panel = af::max(panel);
-      std::size_t max_id = af::max(id);
-      std::size_t max_group = (max_panel + 1) * (max_id + 1);
-
-      // The arrays to use in the collision detection
       std::vector<std::size_t> group(panel.size());
-      std::vector<int6> data(panel.size());
-      std::vector<std::size_t> index(panel.size());
-      for (std::size_t i = 0; i < index.size(); ++i) {
+      for (std::size_t i = 0; i < group.size(); ++i) {
         group[i] = id[i] * (max_panel + 1) + panel[i];
-        index[i] = i;
-      }
-      std::vector<std::size_t> offset;
-
-      // Sort arrays by group
-      std::sort(index.begin(), index.end(), sort_by_group(group));
-
-      // Create an array of offsets where the group number is the same and put
-      // the sorted list of bboxes into an new array
-      offset.push_back(0);
-      std::size_t g = group[index[0]];
-      for (std::size_t i = 0; i < index.size(); ++i) {
-        std::size_t j = index[i];
-        data[i] = bbox[j];
-        if (group[j] != g) {
-          DIALS_ASSERT(group[j] > g);
-          g = group[j];
-          offset.push_back(i);
-        }
-      }
-      offset.push_back(index.size());
-      DIALS_ASSERT(offset.size() <= max_group + 1);
-
-      // Do the collision detection for all bboxes in the same group
-      AdjacencyList list(bbox.size());
-      for (std::size_t j = 0; j < offset.size() - 1; ++j) {
-        std::size_t d0 = offset[j];
-        std::size_t d1 = offset[j + 1];
-        std::vector<std::pair<int, int> > collisions;
-
-        // Detect the collisions
-        detect_collisions3d(data.begin() + d0, data.begin() + d1, collisions);
-
-        // Put all the collisions into an adjacency list
-        for (std::size_t i = 0; i < collisions.size(); ++i) {
-          list.add_edge(index[d0 + collisions[i].first],
-                        index[d0 + collisions[i].second]);
-        }
       }
-      list.finish();
-      return list;
+      OverlapGrid grid(
+        af::const_ref<std::size_t>(&group[0], group.size()), bbox, nthreads);
+      return grid.adjacency_list();
     }
   };
 
@@ -18,11 +18,17 @@
 #include <dials/array_family/reflection_table.h>
 #include <annlib_adaptbx/ann_adaptor.h>
 #include <dials/error.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/math/special_functions/round.hpp>
 
 namespace dials { namespace algorithms { namespace shoebox {
 
   using annlib_adaptbx::AnnAdaptor;
+  using dials::algorithms::detail::parallel_bands;
   using dials::model::Shoebox;
   using scitbx::vec2;
   using scitbx::vec3;
@@ -34,56 +40,72 @@ namespace dials { namespace algorithms { namespace shoebox {
   class MaskEmpirical {
   public:
     /**
-     * Initialise the stuff needed to create the mask.
-     * @param beam The beam model
-     * @param detector The detector model
+     * Initialise the stuff needed to create the mask. The search tree of the
+     * reference reflections is built here once and used for every call.
+     * @param reference The reference reflections with shoeboxes
      */
-    MaskEmpirical(const af::reflection_table &reference) : reference_(reference) {}
+    MaskEmpirical(const af::reflection_table &reference)
+        : reference_(reference),
+          reference_shoeboxes_(reference.get<Shoebox<> >("shoebox")),
+          nn_window_(10) {
+      // Convert the reference xyz mm values to a single array for AnnAdaptor,
+      // instead of a vec3 double array
+      af::const_ref<vec3<double> > reference_xyz_mm =
+        reference.get<vec3<double> >("xyzcal.mm").const_ref();
+      af::shared<double> reference_xyz_mm_values(3 * reference_xyz_mm.size());
+      for (std::size_t iter = 0; iter < reference_xyz_mm.size(); ++iter) {
+        for (std::size_t k = 0; k < 3; ++k) {
+          reference_xyz_mm_values[3 * iter + k] = reference_xyz_mm[iter][k];
+        }
+      }
+      ann_ = boost::make_shared<AnnAdaptor>(reference_xyz_mm_values, 3, nn_window_);
+    }
 
     /**
      * Set all the foreground/background pixels in the shoebox mask by looking at the
      * nearest bright spots
      * @param table Reflection table with a shoebox array and a bbox array for masking
+     * @param nthreads The number of threads to mask the shoeboxes with
      */
-    void mask(af::reflection_table &table) {
-      // Convert the reference xyz mm values to a single array for AnnAdaptor, instead
-      // of a vec3 double array
-      af::shared<vec3<double> > reference_xyz_mm;
-      reference_xyz_mm = reference_.get<vec3<double> >("xyzcal.mm");
-
-      af::shared<double> reference_xyz_mm_values;
-      for (std::size_t iter = 0; iter < reference_xyz_mm.size(); ++iter) {
-        vec3<double> item = reference_xyz_mm[iter];
-        reference_xyz_mm_values.push_back(item[0]);
-        reference_xyz_mm_values.push_back(item[1]);
-        reference_xyz_mm_values.push_back(item[2]);
-      }
-
+    void mask(af::reflection_table &table, std::size_t nthreads = 1) {
       // Convert the query xyz mm values to a single array for AnnAdaptor, instead of a
       // vec3 double array
-      af::shared<vec3<double> > query_xyz_mm;
-      query_xyz_mm = table.get<vec3<double> >("xyzcal.mm");
-
-      af::shared<double> query_xyz_mm_values;
+      af::const_ref<vec3<double> > query_xyz_mm =
+        table.get<vec3<double> >("xyzcal.mm").const_ref();
+      af::shared<double> query_xyz_mm_values(3 * query_xyz_mm.size());
       for (std::size_t iter = 0; iter < query_xyz_mm.size(); ++iter) {
-        vec3<double> item = query_xyz_mm[iter];
-        query_xyz_mm_values.push_back(item[0]);
-        query_xyz_mm_values.push_back(item[1]);
-        query_xyz_mm_values.push_back(item[2]);
+        for (std::size_t k = 0; k < 3; ++k) {
+          query_xyz_mm_values[3 * iter + k] = query_xyz_mm[iter][k];
+        }
       }
 
       // Calculate the nearest neighbors for the query reflections in the reference set
-      int nn_window = 10;
-      AnnAdaptor A = AnnAdaptor(reference_xyz_mm_values, 3, nn_window);
-      A.query(query_xyz_mm_values);
+      ann_->query(query_xyz_mm_values);
+      af::shared<int> nn(ann_->nn.begin(), ann_->nn.end());
 
-      af::shared<Shoebox<> > reference_shoeboxes =
-        reference_.get<Shoebox<> >("shoebox");
+      // Generate the mask for each query reflection, each task writing only
+      // the masks of its own reflections
       af::shared<Shoebox<> > table_shoeboxes = table.get<Shoebox<> >("shoebox");
+      parallel_bands(boost::bind(&MaskEmpirical::mask_band,
+                                 this,
+                                 table_shoeboxes.const_ref(),
+                                 nn.const_ref(),
+                                 _1,
+                                 _2),
+                     table.size(),
+                     nthreads);
+    }
 
-      // Generate the mask for each query reflection
-      for (std::size_t query_iter = 0; query_iter < table.size(); ++query_iter) {
-        Shoebox<> table_shoebox = table_shoeboxes[query_iter];
+  private:
+    /**
+     * Mask the query reflections [first, last)
+     */
+    void mask_band(af::const_ref<Shoebox<> > table_shoeboxes,
+                   af::const_ref<int> nn,
+                   std::size_t first,
+                   std::size_t last) const {
+      for (std::size_t query_iter = first; query_iter < last; ++query_iter) {
+        const Shoebox<> &table_shoebox = table_shoeboxes[query_iter];
         af::ref<int, af::c_grid<3> > table_mask = table_shoebox.mask.ref();
         int6 table_bbox = table_shoebox.bbox;
         int tblx1 = table_bbox[0];
@@ -92,6 +114,9 @@ namespace dials { namespace algorithms { namespace shoebox {
         int tblx2 = table_bbox[1];
         int tbly2 = table_bbox[3];
         int tblz2 = table_bbox[5];
+        int tx = tblx2 - tblx1;
+        int ty = tbly2 - tbly1;
+        int tz = tblz2 - tblz1;
 
         // Calculate the midpoint of the query reflection.  Center the union of the
         // reference masks around this point
@@ -100,32 +125,34 @@ namespace dials { namespace algorithms { namespace shoebox {
         int tmid_z = boost::math::iround((tblz2 - tblz1) / 2);
 
         // Iterate over the nearest bright neigbors of this query reflection
-        for (std::size_t nn_iter = query_iter * nn_window;
-             nn_iter < (query_iter * nn_window) + nn_window;
+        for (std::size_t nn_iter = query_iter * nn_window_;
+             nn_iter < (query_iter * nn_window_) + nn_window_;
              ++nn_iter) {
-          Shoebox<> reference_shoebox = reference_shoeboxes[A.nn[nn_iter]];
-          af::ref<int, af::c_grid<3> > reference_mask = reference_shoebox.mask.ref();
+          const Shoebox<> &reference_shoebox = reference_shoeboxes_[nn[nn_iter]];
+          af::const_ref<int, af::c_grid<3> > reference_mask =
+            reference_shoebox.mask.const_ref();
           int6 bbox_nn = reference_shoebox.bbox;
-          int nnx1 = bbox_nn[0];
-          int nny1 = bbox_nn[2];
-          int nnz1 = bbox_nn[4];
-          int nnx2 = bbox_nn[1];
-          int nny2 = bbox_nn[3];
-          int nnz2 = bbox_nn[5];
+          int rx = bbox_nn[1] - bbox_nn[0];
+          int ry = bbox_nn[3] - bbox_nn[2];
+          int rz = bbox_nn[5] - bbox_nn[4];
 
           // Calculate the midpoint of the reference reflection.  Center the union of
           // this reflection's mask on the query reflection around this point
-          int rmid_x = boost::math::iround((nnx2 - nnx1) / 2);
-          int rmid_y = boost::math::iround((nny2 - nny1) / 2);
-          int rmid_z = boost::math::iround((nnz2 - nnz1) / 2);
-
-          // Union this reflection's mask with the query reflection
-          for (std::size_t z = 0; z < nnz2 - nnz1; z++) {
-            for (std::size_t y = 0; y < nny2 - nny1; y++) {
-              for (std::size_t x = 0; x < nnx2 - nnx1; x++) {
-                table_mask(
-                  tmid_z - rmid_z + z, tmid_y - rmid_y + y, tmid_x - rmid_x + x) |=
-                  reference_mask(z, y, x);
+          int dx = tmid_x - boost::math::iround(rx / 2);
+          int dy = tmid_y - boost::math::iround(ry / 2);
+          int dz = tmid_z - boost::math::iround(rz / 2);
+
+          // Union this reflection's mask with the query reflection a row at a
+          // time, over the part which lies inside the query shoebox
+          int x0 = std::max(0, -dx), x1 = std::min(rx, tx - dx);
+          int y0 = std::max(0, -dy), y1 = std::min(ry, ty - dy);
+          int z0 = std::max(0, -dz), z1 = std::min(rz, tz - dz);
+          for (int z = z0; z < z1; z++) {
+            for (int y = y0; y < y1; y++) {
+              const int *src = &reference_mask(z, y, 0);
+              int *dst = &table_mask(z + dz, y + dy, dx);
+              for (int x = x0; x < x1; x++) {
+                dst[x] |= src[x];
               }
             }
           }
@@ -133,16 +160,17 @@ namespace dials { namespace algorithms { namespace shoebox {
 
         // Finally, need to explicitly set the background flags for the rest of the
         // pixels as they are not set by spotfinder in the reference set
-        for (std::size_t z = 0; z < tblz2 - tblz1; z++)
-          for (std::size_t y = 0; y < tbly2 - tbly1; y++)
-            for (std::size_t x = 0; x < tblx2 - tblx1; x++)
-              if ((table_mask(z, y, x) & Foreground) != Foreground)
-                table_mask(z, y, x) |= Background;
+        for (std::size_t i = 0; i < table_mask.size(); i++) {
+          int code = table_mask[i];
+          table_mask[i] = code | (Background & -((code & Foreground) != Foreground));
+        }
       }
     }
 
-  private:
     af::reflection_table reference_;
+    af::shared<Shoebox<> > reference_shoeboxes_;
+    std::size_t nn_window_;
+    boost::shared_ptr<AnnAdaptor> ann_;
   };
 
 }}}  // namespace dials::algorithms::shoebox
@@ -11,9 +11,12 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_MASK_OVERLAPPING_H
 #define DIALS_ALGORITHMS_INTEGRATION_MASK_OVERLAPPING_H
 
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/model/data/adjacency_list.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/algorithms/shoebox/mask_code.h>
 #include <dials/error.h>
 
@@ -29,8 +32,9 @@ namespace dials { namespace algorithms { namespace shoebox {
   class MaskOverlapping {
   public:
     // Useful typedefs
-    typedef AdjacencyList::edge_iterator edge_iterator;
-    typedef AdjacencyList::edge_iterator_range edge_iterator_range;
+    typedef AdjacencyList::adjacent_vertex_iterator adjacent_vertex_iterator;
+    typedef AdjacencyList::adjacent_vertex_iterator_range
+      adjacent_vertex_iterator_range;
 
     /**
      * Initialise the algorithm
@@ -46,79 +50,82 @@ namespace dials { namespace algorithms { namespace shoebox {
      * reflection whose predicted central location is closer to the pixel
      * will gain ownership of the pixel (mask value 1).
      *
+     * Each shoebox is only written when processing its own edges, so the
+     * shoeboxes are split into bands which are processed in parallel.
+     *
      * @param shoeboxes The list of shoeboxes
      * @param coords The pixel coordinate
      * @param adjacency_list The adjacency_list
+     * @param nthreads The number of threads
      */
     void operator()(af::ref<Shoebox<> > shoeboxes,
                     const af::const_ref<vec3<double> > &coords,
-                    const boost::shared_ptr<AdjacencyList> &adjacency_list) const {
-      // Loop through all the reflections
+                    const boost::shared_ptr<AdjacencyList> &adjacency_list,
+                    std::size_t nthreads = 1) const {
+      DIALS_ASSERT(shoeboxes.size() == coords.size());
       if (adjacency_list) {
-        for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
-          // Get a reference to the reflection
-          Shoebox<> &s = shoeboxes[i];
-          vec3<double> c = coords[i];
-
-          // Get the list of overlapping shoeboxes
-          edge_iterator_range range = adjacency_list->edges(i);
-          for (edge_iterator it = range.first; it != range.second; ++it) {
-            std::size_t index1 = it->first;
-            std::size_t index2 = it->second;
-            DIALS_ASSERT(index1 == i);
-            if (index1 < index2) {
-              assign_ownership(s, c, shoeboxes[index2], coords[index2]);
-            }
-          }
-        }
+        DIALS_ASSERT(adjacency_list->num_vertices() == shoeboxes.size());
+        dials::algorithms::detail::parallel_bands(
+          boost::bind(&MaskOverlapping::assign_band,
+                      this,
+                      shoeboxes,
+                      coords,
+                      boost::cref(*adjacency_list),
+                      _1,
+                      _2),
+          shoeboxes.size(),
+          nthreads);
       }
     }
 
   private:
     /**
-     * The distance between two points
-     * @param a Point a
-     * @param b Point b
-     * @returns The distance from a to b
-     */
-    double distance(vec3<double> a, vec3<double> b) const {
-      return (b - a).length_sq();
-    }
-
-    /**
-     * Get a coordinate from the voxel.
-     * @param i The voxel x index
-     * @param j The voxel y index
-     * @param k THe voxel z index
-     * @returns An (x, y, z) coordinate
+     * Assign the ownership of the pixels of the shoeboxes [first, last)
+     * against all their overlapping shoeboxes.
      */
-    vec3<double> voxel_coord(double i, double j, double k) const {
-      return vec3<double>(i + 0.5, j + 0.5, k + 0.5);
+    void assign_band(af::ref<Shoebox<> > shoeboxes,
+                     const af::const_ref<vec3<double> > &coords,
+                     const AdjacencyList &adjacency_list,
+                     std::size_t first,
+                     std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        adjacent_vertex_iterator_range range = adjacency_list.adjacent_vertices(i);
+        for (adjacent_vertex_iterator it = range.first; it != range.second; ++it) {
+          std::size_t j = *it;
+          DIALS_ASSERT(j < shoeboxes.size());
+          assign_ownership(
+            shoeboxes[i], coords[i], shoeboxes[j].bbox, coords[j], i < j);
+        }
+      }
     }
 
     /**
-     * Assign ownership of all the pixels in the overlapping range.
+     * Remove the pixels in the overlapping range which are closer to the
+     * centre of b than to the centre of a from the mask of a. The pixel c is
+     * closer to a when |c - a|^2 < |c - b|^2, that is when
+     * c . (b - a) < (|b|^2 - |a|^2) / 2, so the comparison is linear in the
+     * pixel coordinate and is precomputed for each row. Pixels equidistant
+     * from both centres are given to the shoebox with the higher index.
      * @param a Shoebox a
      * @param coord_a The coordinate of a
-     * @param b Shoebox b
+     * @param bbox_b The bounding box of b
      * @param coord_b The coordinate of b
+     * @param a_first Is the index of a lower than the index of b
      * @throws RuntimeError if reflections to do overlap.
      */
     void assign_ownership(Shoebox<> &a,
                           vec3<double> coord_a,
-                          Shoebox<> &b,
-                          vec3<double> coord_b) const {
-      // Get the reflection mask arrays
+                          int6 bbox_b,
+                          vec3<double> coord_b,
+                          bool a_first) const {
+      // Get the reflection mask array
       af::ref<int, af::c_grid<3> > mask_a = a.mask.ref();
-      af::ref<int, af::c_grid<3> > mask_b = b.mask.ref();
 
-      // Get the sizes of the masks
+      // Get the size of the mask
       af::c_grid<3> size_a = mask_a.accessor();
-      af::c_grid<3> size_b = mask_b.accessor();
 
-      // Get the bounding boxes
+      // Get the bounding box
       int6 bbox_a = a.bbox;
-      int6 bbox_b = b.bbox;
 
       // Get range to iterate over
       int i0 = std::max(bbox_a[0], bbox_b[0]);
@@ -130,35 +137,25 @@ namespace dials { namespace algorithms { namespace shoebox {
 
       // Ensure ranges are valid
       DIALS_ASSERT(k1 > k0 && j1 > j0 && i1 > i0);
-
       DIALS_ASSERT(i0 - bbox_a[0] >= 0 && i1 - bbox_a[0] <= size_a[2]);
       DIALS_ASSERT(j0 - bbox_a[2] >= 0 && j1 - bbox_a[2] <= size_a[1]);
       DIALS_ASSERT(k0 - bbox_a[4] >= 0 && k1 - bbox_a[4] <= size_a[0]);
 
-      DIALS_ASSERT(i0 - bbox_b[0] >= 0 && i1 - bbox_b[0] <= size_b[2]);
-      DIALS_ASSERT(j0 - bbox_b[2] >= 0 && j1 - bbox_b[2] <= size_b[1]);
-      DIALS_ASSERT(k0 - bbox_b[4] >= 0 && k1 - bbox_b[4] <= size_b[0]);
+      // The difference between the centres and the threshold
+      vec3<double> delta = coord_b - coord_a;
+      double threshold = 0.5 * (coord_b.length_sq() - coord_a.length_sq());
 
-      // Iterate over range of indices
+      // Iterate over range of indices. Where the lower index is closer, the
+      // other loses the pixel, otherwise the lower index loses the pixel.
+      std::size_t n = i1 - i0;
       for (int k = k0; k < k1; ++k) {
         for (int j = j0; j < j1; ++j) {
-          for (int i = i0; i < i1; ++i) {
-            // Set the coordinate
-            vec3<double> coord_c(voxel_coord(i, j, k));
-
-            // Set the mask indices
-            int ka = k - bbox_a[4], kb = k - bbox_b[4];
-            int ja = j - bbox_a[2], jb = j - bbox_b[2];
-            int ia = i - bbox_a[0], ib = i - bbox_b[0];
-
-            // If the distance from a to c is less than b to c then
-            // set the mask for a to 1 and b to 0, otherwise set
-            // b to 1 and a to 0.
-            if (distance(coord_a, coord_c) < distance(coord_b, coord_c)) {
-              mask_b(kb, jb, ib) = 0;
-            } else {
-              mask_a(ka, ja, ia) = 0;
-            }
+          int *mask_row = &mask_a(k - bbox_a[4], j - bbox_a[2], i0 - bbox_a[0]);
+          double row = threshold - (j + 0.5) * delta[1] - (k + 0.5) * delta[2];
+          for (std::size_t i = 0; i < n; ++i) {
+            double s = row - (i0 + i + 0.5) * delta[0];
+            int keep = a_first ? s > 0 : s >= 0;
+            mask_row[i] &= -keep;
           }
         }
       }
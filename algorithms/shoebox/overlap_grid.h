@@ -0,0 +1,401 @@
+/*
+ * overlap_grid.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SHOEBOX_OVERLAP_GRID_H
+#define DIALS_ALGORITHMS_SHOEBOX_OVERLAP_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/model/data/adjacency_list.h>
+#include <dials/util/thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace shoebox {
+
+  using dials::model::AdjacencyList;
+  using dials::util::ThreadPool;
+  using scitbx::af::int6;
+
+  /**
+   * Find overlapping bounding boxes using a uniform grid.
+   *
+   * Space is divided into cells about twice the mean size of a bounding box.
+   * Each box is entered into every cell it touches, keyed on (group, z, y, x),
+   * and the entries are sorted on the key so that each cell is a contiguous
+   * bucket. Only boxes sharing a bucket can overlap. A pair is reported only
+   * from the cell containing the lower corner of the intersection of the two
+   * boxes, so no pair is reported twice. Boxes in different groups (e.g.
+   * panels) never overlap. The boxes are half open, so boxes which only touch
+   * are not overlapping.
+   *
+   * The entry table, the sort and the pair search are split between threads
+   * and the result is written straight into the compressed rows of an
+   * AdjacencyList.
+   */
+  class OverlapGrid {
+  public:
+    typedef boost::uint64_t key_type;
+
+    /**
+     * Find the overlaps
+     * @param group The group of each box
+     * @param bbox The bounding boxes
+     * @param nthreads The number of threads
+     */
+    OverlapGrid(const af::const_ref<std::size_t> &group,
+                const af::const_ref<int6> &bbox,
+                std::size_t nthreads)
+        : group_(group), bbox_(bbox), nthreads_(std::max(nthreads, (std::size_t)1)) {
+      DIALS_ASSERT(group.size() == bbox.size());
+      compute_grid();
+      compute_entries();
+      sort_entries();
+      find_pairs();
+    }
+
+    /**
+     * @returns The adjacency list
+     */
+    AdjacencyList adjacency_list() const {
+      std::size_t n = bbox_.size();
+
+      // Count the edges leaving each vertex
+      std::vector<std::size_t> offset(n + 1, 0);
+      for (std::size_t t = 0; t < pairs_.size(); ++t) {
+        const std::vector<std::pair<std::size_t, std::size_t> > &pairs = pairs_[t];
+        for (std::size_t i = 0; i < pairs.size(); ++i) {
+          offset[pairs[i].first + 1]++;
+          offset[pairs[i].second + 1]++;
+        }
+      }
+      for (std::size_t i = 0; i < n; ++i) {
+        offset[i + 1] += offset[i];
+      }
+
+      // Fill in the targets
+      std::vector<AdjacencyList::vertex_type> target(offset.back());
+      std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+      for (std::size_t t = 0; t < pairs_.size(); ++t) {
+        const std::vector<std::pair<std::size_t, std::size_t> > &pairs = pairs_[t];
+        for (std::size_t i = 0; i < pairs.size(); ++i) {
+          std::size_t a = pairs[i].first;
+          std::size_t b = pairs[i].second;
+          target[next[a]++] = static_cast<AdjacencyList::vertex_type>(b);
+          target[next[b]++] = static_cast<AdjacencyList::vertex_type>(a);
+        }
+      }
+
+      // Sort the targets of each vertex
+      run(boost::bind(&OverlapGrid::sort_targets,
+                      _1,
+                      _2,
+                      boost::cref(offset),
+                      boost::ref(target)),
+          n);
+
+      AdjacencyList result(n);
+      result.assign(offset, target);
+      return result;
+    }
+
+  protected:
+    /**
+     * An entry of a box in a cell
+     */
+    struct Entry {
+      key_type key;
+      std::size_t index;
+
+      bool operator<(const Entry &other) const {
+        return key < other.key || (key == other.key && index < other.index);
+      }
+    };
+
+    /**
+     * Floor division for possibly negative coordinates
+     */
+    static int floor_div(int a, int b) {
+      return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    /**
+     * Choose the cell size and the range of the grid
+     */
+    void compute_grid() {
+      double sum[3] = {0, 0, 0};
+      std::size_t count = 0;
+      int lower[3] = {0, 0, 0};
+      int upper[3] = {0, 0, 0};
+      max_group_ = 0;
+      for (std::size_t i = 0; i < bbox_.size(); ++i) {
+        const int6 &b = bbox_[i];
+        for (std::size_t d = 0; d < 3; ++d) {
+          int b0 = b[2 * d];
+          int b1 = std::max(b0 + 1, b[2 * d + 1]);
+          sum[d] += b1 - b0;
+          if (count == 0 || b0 < lower[d]) lower[d] = b0;
+          if (count == 0 || b1 > upper[d]) upper[d] = b1;
+        }
+        max_group_ = std::max(max_group_, group_[i]);
+        count++;
+      }
+      for (std::size_t d = 0; d < 3; ++d) {
+        double mean = count > 0 ? sum[d] / count : 1.0;
+        cell_size_[d] = std::max(1, (int)std::ceil(2.0 * mean));
+        cell_min_[d] = floor_div(lower[d], cell_size_[d]);
+        int cell_max = floor_div(upper[d] - 1, cell_size_[d]);
+        num_cells_[d] = count > 0 ? (key_type)(cell_max - cell_min_[d] + 1) : 1;
+      }
+
+      // Check the key can not overflow
+      double num_keys = (double)(max_group_ + 1) * num_cells_[0] * num_cells_[1]
+                        * num_cells_[2];
+      DIALS_ASSERT(num_keys < 1.8e19);
+    }
+
+    /**
+     * @returns The range of cells touched by the box along a dimension. An
+     * empty or inverted box is entered into the cell of its lower bound, which
+     * is where any overlap with it would be reported from.
+     */
+    void cell_range(const int6 &b, std::size_t d, int &c0, int &c1) const {
+      int b0 = b[2 * d];
+      int b1 = std::max(b0 + 1, b[2 * d + 1]);
+      c0 = floor_div(b0, cell_size_[d]) - cell_min_[d];
+      c1 = floor_div(b1 - 1, cell_size_[d]) - cell_min_[d] + 1;
+    }
+
+    /**
+     * @returns The key of a cell
+     */
+    key_type make_key(std::size_t group, int cx, int cy, int cz) const {
+      return (((key_type)group * num_cells_[2] + (key_type)cz) * num_cells_[1]
+              + (key_type)cy)
+               * num_cells_[0]
+             + (key_type)cx;
+    }
+
+    /**
+     * @returns The number of cells touched by a box
+     */
+    std::size_t num_box_cells(std::size_t i) const {
+      const int6 &b = bbox_[i];
+      std::size_t n = 1;
+      for (std::size_t d = 0; d < 3; ++d) {
+        int c0, c1;
+        cell_range(b, d, c0, c1);
+        n *= (std::size_t)(c1 - c0);
+      }
+      return n;
+    }
+
+    /**
+     * Enter each box into the cells it touches
+     */
+    void compute_entries() {
+      std::size_t n = bbox_.size();
+      entry_offset_.resize(n + 1);
+      entry_offset_[0] = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        entry_offset_[i + 1] = entry_offset_[i] + num_box_cells(i);
+      }
+      entries_.resize(entry_offset_.back());
+      run(boost::bind(&OverlapGrid::fill_entries, this, _1, _2), n);
+    }
+
+    /**
+     * Fill the entries for a range of boxes
+     */
+    void fill_entries(std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        const int6 &b = bbox_[i];
+        std::size_t k = entry_offset_[i];
+        int x0, x1, y0, y1, z0, z1;
+        cell_range(b, 0, x0, x1);
+        cell_range(b, 1, y0, y1);
+        cell_range(b, 2, z0, z1);
+        for (int z = z0; z < z1; ++z) {
+          for (int y = y0; y < y1; ++y) {
+            for (int x = x0; x < x1; ++x) {
+              entries_[k].key = make_key(group_[i], x, y, z);
+              entries_[k].index = i;
+              k++;
+            }
+          }
+        }
+        DIALS_ASSERT(k == entry_offset_[i + 1]);
+      }
+    }
+
+    /**
+     * Sort the entries. Each thread sorts a chunk and the chunks are then
+     * merged in pairs.
+     */
+    void sort_entries() {
+      std::vector<std::size_t> bounds = split(entries_.size());
+      run_chunks(boost::bind(&OverlapGrid::sort_range, this, _1, _2), bounds);
+      while (bounds.size() > 2) {
+        std::vector<std::size_t> merged;
+        std::vector<std::size_t> middle;
+        for (std::size_t i = 0; i + 1 < bounds.size(); i += 2) {
+          merged.push_back(bounds[i]);
+          middle.push_back(bounds[i + 1]);
+        }
+        merged.push_back(bounds.back());
+        std::size_t nmerge = merged.size() - 1;
+        if (nthreads_ == 1 || nmerge == 1) {
+          for (std::size_t i = 0; i < nmerge; ++i) {
+            merge_range(merged[i], middle[i], merged[i + 1]);
+          }
+        } else {
+          ThreadPool pool(std::min(nthreads_, nmerge));
+          for (std::size_t i = 0; i < nmerge; ++i) {
+            pool.post(boost::bind(
+              &OverlapGrid::merge_range, this, merged[i], middle[i], merged[i + 1]));
+          }
+          pool.wait();
+        }
+        bounds.swap(merged);
+      }
+    }
+
+    void sort_range(std::size_t first, std::size_t last) {
+      std::sort(entries_.begin() + first, entries_.begin() + last);
+    }
+
+    void merge_range(std::size_t first, std::size_t middle, std::size_t last) {
+      if (middle < last) {
+        std::inplace_merge(
+          entries_.begin() + first, entries_.begin() + middle, entries_.begin() + last);
+      }
+    }
+
+    /**
+     * Find the overlapping pairs. The entries are split between threads at
+     * cell boundaries.
+     */
+    void find_pairs() {
+      std::vector<std::size_t> bounds = split(entries_.size());
+      for (std::size_t i = 1; i + 1 < bounds.size(); ++i) {
+        std::size_t k = std::max(bounds[i], bounds[i - 1]);
+        while (k > 0 && k < entries_.size() && entries_[k].key == entries_[k - 1].key) {
+          k++;
+        }
+        bounds[i] = k;
+      }
+      pairs_.resize(bounds.size() - 1);
+      if (pairs_.size() == 1) {
+        find_pairs_in_range(0, bounds[0], bounds[1]);
+      } else {
+        ThreadPool pool(pairs_.size());
+        for (std::size_t t = 0; t < pairs_.size(); ++t) {
+          pool.post(boost::bind(
+            &OverlapGrid::find_pairs_in_range, this, t, bounds[t], bounds[t + 1]));
+        }
+        pool.wait();
+      }
+    }
+
+    /**
+     * Find the overlapping pairs in a range of whole cells
+     */
+    void find_pairs_in_range(std::size_t thread, std::size_t first, std::size_t last) {
+      std::vector<std::pair<std::size_t, std::size_t> > &pairs = pairs_[thread];
+      std::size_t k0 = first;
+      while (k0 < last) {
+        key_type key = entries_[k0].key;
+        std::size_t k1 = k0 + 1;
+        while (k1 < last && entries_[k1].key == key) {
+          k1++;
+        }
+        for (std::size_t a = k0; a + 1 < k1; ++a) {
+          std::size_t i = entries_[a].index;
+          const int6 &bi = bbox_[i];
+          for (std::size_t b = a + 1; b < k1; ++b) {
+            std::size_t j = entries_[b].index;
+            const int6 &bj = bbox_[j];
+            if (bi[0] < bj[1] && bj[0] < bi[1] && bi[2] < bj[3] && bj[2] < bi[3]
+                && bi[4] < bj[5] && bj[4] < bi[5]) {
+              // Only report the pair from the cell with the lower corner
+              int x = floor_div(std::max(bi[0], bj[0]), cell_size_[0]) - cell_min_[0];
+              int y = floor_div(std::max(bi[2], bj[2]), cell_size_[1]) - cell_min_[1];
+              int z = floor_div(std::max(bi[4], bj[4]), cell_size_[2]) - cell_min_[2];
+              if (make_key(group_[i], x, y, z) == key) {
+                pairs.push_back(std::make_pair(i, j));
+              }
+            }
+          }
+        }
+        k0 = k1;
+      }
+    }
+
+    /**
+     * Sort the targets of a range of vertices
+     */
+    static void sort_targets(std::size_t first,
+                             std::size_t last,
+                             const std::vector<std::size_t> &offset,
+                             std::vector<AdjacencyList::vertex_type> &target) {
+      for (std::size_t i = first; i < last; ++i) {
+        std::sort(target.begin() + offset[i], target.begin() + offset[i + 1]);
+      }
+    }
+
+    /**
+     * @returns The bounds splitting a range between the threads
+     */
+    std::vector<std::size_t> split(std::size_t n) const {
+      std::size_t nchunks = std::max((std::size_t)1, std::min(nthreads_, n));
+      std::vector<std::size_t> bounds(nchunks + 1);
+      for (std::size_t i = 0; i <= nchunks; ++i) {
+        bounds[i] = (n * i) / nchunks;
+      }
+      return bounds;
+    }
+
+    /**
+     * Call the function on ranges split between the threads
+     */
+    template <typename Function>
+    void run(Function function, std::size_t n) const {
+      run_chunks(function, split(n));
+    }
+
+    template <typename Function>
+    void run_chunks(Function function, const std::vector<std::size_t> &bounds) const {
+      DIALS_ASSERT(bounds.size() >= 2);
+      if (bounds.size() == 2) {
+        function(bounds[0], bounds[1]);
+        return;
+      }
+      ThreadPool pool(bounds.size() - 1);
+      for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+        pool.post(boost::bind(function, bounds[i], bounds[i + 1]));
+      }
+      pool.wait();
+    }
+
+    af::const_ref<std::size_t> group_;
+    af::const_ref<int6> bbox_;
+    std::size_t nthreads_;
+    std::size_t max_group_;
+    int cell_size_[3];
+    int cell_min_[3];
+    key_type num_cells_[3];
+    std::vector<std::size_t> entry_offset_;
+    std::vector<Entry> entries_;
+    std::vector<std::vector<std::pair<std::size_t, std::size_t> > > pairs_;
+  };
+
+}}}  // namespace dials::algorithms::shoebox
+
+#endif  // DIALS_ALGORITHMS_SHOEBOX_OVERLAP_GRID_H
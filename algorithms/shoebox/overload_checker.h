@@ -12,88 +12,117 @@
 #define DIALS_ALGORITHMS_SHOEBOX_OVERLOAD_CHECKER_H
 
 #include <vector>
+#include <boost/bind.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms { namespace shoebox {
 
   using dials::model::Shoebox;
+  using dials::model::Valid;
+
+  /**
+   * Mark the overloaded pixels of a shoebox as invalid. The maximum of the
+   * data is found first with a branch free reduction, so that the mask is
+   * only touched for the few shoeboxes which contain overloads.
+   * @param overload The overload value
+   * @param data The data array
+   * @param mask The mask array
+   * @returns True/False the shoebox contains overloads
+   */
+  template <typename FloatType>
+  bool mark_overloaded_pixels(double overload,
+                              const af::const_ref<FloatType, af::c_grid<3> > &data,
+                              af::ref<int, af::c_grid<3> > mask) {
+    DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+    DIALS_ASSERT(data.size() == mask.size());
+    if (data.size() == 0) {
+      return false;
+    }
+    const FloatType *d = data.begin();
+    FloatType max_value = d[0];
+    for (std::size_t i = 1; i < data.size(); ++i) {
+      max_value = d[i] > max_value ? d[i] : max_value;
+    }
+    if (max_value < overload) {
+      return false;
+    }
+    int *m = mask.begin();
+    for (std::size_t i = 0; i < data.size(); ++i) {
+      m[i] &= ~(Valid & -(int)(d[i] >= overload));
+    }
+    return true;
+  }
 
   /**
    * A class to check for and mark overloaded pixels
    */
   class OverloadChecker {
-    /**
-     * The internal class used to do the checking
-     */
-    class Checker {
-    public:
-      typedef Shoebox<>::float_type float_type;
-
-      /**
-       * @param overload - The overload values for each pixel
-       */
-      Checker(const af::const_ref<double> &overload)
-          : overload_(overload.begin(), overload.end()) {}
-
-      /**
-       * Mark all pixels that are overloaded as invalid
-       * @param panel The panel number
-       * @param data The data array
-       * @param mask The mask array
-       */
-      bool operator()(std::size_t panel,
-                      const af::const_ref<float_type, af::c_grid<3> > &data,
-                      af::ref<int, af::c_grid<3> > mask) const {
-        DIALS_ASSERT(panel < overload_.size());
-        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-        DIALS_ASSERT(data.size() == mask.size());
-        bool result = false;
-        double overload_value = overload_[panel];
-        for (std::size_t i = 0; i < data.size(); ++i) {
-          if (data[i] >= overload_value) {
-            mask[i] &= ~Valid;
-            result = true;
-          }
-        }
-        return result;
-      }
-
-    private:
-      af::shared<double> overload_;
-    };
-
   public:
+    typedef Shoebox<>::float_type float_type;
+
     /**
      * Add the overload values for this detector
      * @param overload The overloads for each panel
      */
     void add(const af::const_ref<double> &overload) {
-      checker_.push_back(Checker(overload));
+      offset_.push_back(overload_.size());
+      npanels_.push_back(overload.size());
+      overload_.insert(overload_.end(), overload.begin(), overload.end());
     }
 
     /**
      * Check each shoebox to see if it contains overloads
      * @param id The experiment id
      * @param shoebox The shoebox data
+     * @param nthreads The number of threads to use
      * @returns flex.bool True contains outliers
      */
     af::shared<bool> operator()(const af::const_ref<int> id,
-                                af::ref<Shoebox<> > shoebox) const {
+                                af::ref<Shoebox<> > shoebox,
+                                std::size_t nthreads = 1) const {
       DIALS_ASSERT(id.size() == shoebox.size());
-      af::shared<bool> result(id.size(), false);
+
+      // Look up the overload value of every shoebox up front
+      af::shared<double> overload(id.size());
       for (std::size_t i = 0; i < id.size(); ++i) {
         DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < checker_.size());
-        result[i] = checker_[id[i]](
-          shoebox[i].panel, shoebox[i].data.const_ref(), shoebox[i].mask.ref());
+        DIALS_ASSERT(id[i] < offset_.size());
+        DIALS_ASSERT(shoebox[i].panel < npanels_[id[i]]);
+        overload[i] = overload_[offset_[id[i]] + shoebox[i].panel];
       }
+
+      // Check the shoeboxes, each band writing only its own
+      af::shared<bool> result(id.size(), false);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&OverloadChecker::check_band,
+                    overload.const_ref(),
+                    shoebox,
+                    result.ref(),
+                    _1,
+                    _2),
+        id.size(),
+        nthreads);
       return result;
     }
 
   private:
-    std::vector<Checker> checker_;
+    static void check_band(af::const_ref<double> overload,
+                           af::ref<Shoebox<> > shoebox,
+                           af::ref<bool> result,
+                           std::size_t first,
+                           std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        result[i] = mark_overloaded_pixels(
+          overload[i], shoebox[i].data.const_ref(), shoebox[i].mask.ref());
+      }
+    }
+
+    std::vector<double> overload_;
+    std::vector<std::size_t> offset_;
+    std::vector<std::size_t> npanels_;
   };
 
 }}}  // namespace dials::algorithms::shoebox
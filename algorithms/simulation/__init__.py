@@ -5,4 +5,5 @@
 __all__ = (  # noqa: F405
     "integrate_reciprocal_space_gaussian",
     "simulate_reciprocal_space_gaussian",
+    "SweepSimulator",
 )
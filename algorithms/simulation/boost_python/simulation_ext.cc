@@ -11,14 +11,49 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/simulation/reciprocal_space_helpers.h>
+#include <dials/algorithms/simulation/sweep_simulator.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
   BOOST_PYTHON_MODULE(dials_algorithms_simulation_ext) {
+    dials::util::boost_python::import_shared_executor();
     def("simulate_reciprocal_space_gaussian", &simulate_reciprocal_space_gaussian);
     def("integrate_reciprocal_space_gaussian", &integrate_reciprocal_space_gaussian);
+
+    class_<SweepSimulator>("SweepSimulator", no_init)
+      .def(init<const BeamBase &,
+                const Detector &,
+                const Goniometer &,
+                const Scan &,
+                double,
+                double,
+                double,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<double> &,
+                double,
+                std::size_t>((arg("beam"),
+                              arg("detector"),
+                              arg("goniometer"),
+                              arg("scan"),
+                              arg("sigma_b"),
+                              arg("sigma_m"),
+                              arg("n_sigma"),
+                              arg("s1"),
+                              arg("phi"),
+                              arg("panel"),
+                              arg("intensity"),
+                              arg("background") = 0,
+                              arg("seed") = 0)))
+      .def("bbox", &SweepSimulator::bbox)
+      .def("render",
+           &SweepSimulator::render,
+           (arg("panel"), arg("first"), arg("last"), arg("nthreads") = 1))
+      .def("signal_counts", &SweepSimulator::signal_counts, (arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
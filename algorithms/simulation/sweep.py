@@ -0,0 +1,84 @@
+from __future__ import absolute_import, division, print_function
+
+from dxtbx.imageset import ImageSequence, ImageSetData, MemReader
+
+from dials.algorithms.simulation import SweepSimulator
+from dials.array_family import flex
+
+
+class SimulatedImage(object):
+    """An image of a simulated sweep, rendered when its data are read."""
+
+    def __init__(self, simulator, detector, frame, nthreads):
+        self._simulator = simulator
+        self._detector = detector
+        self._frame = frame
+        self._nthreads = nthreads
+
+    def get_raw_data(self):
+        data = []
+        for panel in range(len(self._detector)):
+            image = self._simulator.render(
+                panel, self._frame, self._frame + 1, nthreads=self._nthreads
+            )
+            image.reshape(flex.grid(image.all()[1:]))
+            data.append(image)
+        return tuple(data)
+
+
+def simulated_imageset(
+    experiment,
+    reflections,
+    intensity,
+    sigma_b,
+    sigma_m,
+    n_sigma=3,
+    background=0,
+    seed=0,
+    nthreads=1,
+):
+    """
+    Create an image sequence for an experiment with the images simulated from
+    a set of reflections, for example the predicted reflections.
+
+    The images are held in memory only as the simulator: each image is rendered
+    when it is read, and is the same every time it is read.
+
+    :param experiment: The experiment
+    :param reflections: The reflections, with s1, xyzcal.mm and panel
+    :param intensity: The mean number of photons of each reflection
+    :param sigma_b: The beam divergence (radians)
+    :param sigma_m: The mosaicity (radians)
+    :param n_sigma: The number of standard deviations of the bounding boxes
+    :param background: The mean background counts in each pixel
+    :param seed: The random seed
+    :param nthreads: The number of threads to render each image with
+    :returns: The image sequence
+    """
+    simulator = SweepSimulator(
+        experiment.beam,
+        experiment.detector,
+        experiment.goniometer,
+        experiment.scan,
+        sigma_b,
+        sigma_m,
+        n_sigma,
+        reflections["s1"],
+        reflections["xyzcal.mm"].parts()[2],
+        reflections["panel"],
+        intensity,
+        background=background,
+        seed=seed,
+    )
+    first, last = experiment.scan.get_array_range()
+    images = [
+        SimulatedImage(simulator, experiment.detector, frame, nthreads)
+        for frame in range(first, last)
+    ]
+    return ImageSequence(
+        ImageSetData(MemReader(images), None),
+        beam=experiment.beam,
+        detector=experiment.detector,
+        goniometer=experiment.goniometer,
+        scan=experiment.scan,
+    )
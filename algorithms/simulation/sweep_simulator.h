@@ -0,0 +1,345 @@
+/*
+ * sweep_simulator.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SIMULATION_SWEEP_SIMULATOR_H
+#define DIALS_ALGORITHMS_SIMULATION_SWEEP_SIMULATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/poisson_distribution.hpp>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <dxtbx/model/beam.h>
+#include <dxtbx/model/detector.h>
+#include <dxtbx/model/goniometer.h>
+#include <dxtbx/model/scan.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/algorithms/profile_model/gaussian_rs/bbox_calculator.h>
+#include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/util/splitmix64.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::util::SplitMix64;
+  using dxtbx::model::BeamBase;
+  using dxtbx::model::Detector;
+  using dxtbx::model::Goniometer;
+  using dxtbx::model::Panel;
+  using dxtbx::model::Scan;
+  using profile_model::gaussian_rs::BBoxCalculator3D;
+  using profile_model::gaussian_rs::CoordinateSystem;
+  using scitbx::vec2;
+  using scitbx::vec3;
+  using scitbx::af::int6;
+
+  namespace detail {
+
+    // Sort reflections by the first frame of their bounding box
+    struct sort_by_first_frame {
+      const std::vector<int6> &bbox;
+      sort_by_first_frame(const std::vector<int6> &bbox_) : bbox(bbox_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return bbox[a][4] < bbox[b][4];
+      }
+    };
+
+    // Add the photons falling on a range of lines (frame * ysize + y) of an
+    // image stack starting at the given frame
+    struct add_photon_to_lines {
+      af::ref<int, af::c_grid<3> > image;
+      int first;
+      long line0;
+      long line1;
+      add_photon_to_lines(af::ref<int, af::c_grid<3> > image_,
+                          int first_,
+                          long line0_,
+                          long line1_)
+          : image(image_), first(first_), line0(line0_), line1(line1_) {}
+      void operator()(int x, int y, int z) {
+        long line = (long)(z - first) * (long)image.accessor()[1] + y;
+        if (z >= first && line >= line0 && line < line1) {
+          image[line * image.accessor()[2] + x] += 1;
+        }
+      }
+    };
+
+    // Count the photons
+    struct count_photons {
+      int count;
+      count_photons() : count(0) {}
+      void operator()(int x, int y, int z) {
+        count++;
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Simulate the images of a rotation sweep from a set of reflections. The
+   * photons of each reflection are drawn from a gaussian in reciprocal space,
+   * as in simulate_reciprocal_space_gaussian, with the number of photons drawn
+   * from a Poisson distribution about the intensity of the reflection, and are
+   * kept if they fall within its bounding box. A Poisson background is added
+   * to every pixel; overlapping reflections add up.
+   *
+   * The random numbers come from counter based streams, one for each
+   * reflection and one for each pixel, so any range of frames can be rendered
+   * on its own, in any order and with any number of threads, and always gives
+   * the same counts.
+   */
+  class SweepSimulator {
+  public:
+    /**
+     * @param beam The beam model
+     * @param detector The detector model
+     * @param goniometer The goniometer model
+     * @param scan The scan model
+     * @param sigma_b The beam divergence
+     * @param sigma_m The mosaicity
+     * @param n_sigma The number of standard deviations of the bounding boxes
+     * @param s1 The diffracted beam vectors
+     * @param phi The rotation angles
+     * @param panel The panel numbers
+     * @param intensity The mean number of photons of each reflection
+     * @param background The mean background counts in each pixel
+     * @param seed The random seed
+     */
+    SweepSimulator(const BeamBase &beam,
+                   const Detector &detector,
+                   const Goniometer &goniometer,
+                   const Scan &scan,
+                   double sigma_b,
+                   double sigma_m,
+                   double n_sigma,
+                   const af::const_ref<vec3<double> > &s1,
+                   const af::const_ref<double> &phi,
+                   const af::const_ref<std::size_t> &panel,
+                   const af::const_ref<double> &intensity,
+                   double background,
+                   std::size_t seed)
+        : detector_(detector),
+          scan_(scan),
+          s0_(beam.get_s0()),
+          m2_(goniometer.get_rotation_axis()),
+          sigma_b_(sigma_b),
+          sigma_m_(sigma_m),
+          s1_(s1.begin(), s1.end()),
+          phi_(phi.begin(), phi.end()),
+          panel_(panel.begin(), panel.end()),
+          intensity_(intensity.begin(), intensity.end()),
+          background_(background),
+          seed_(seed),
+          max_pixels_(0),
+          max_depth_(0) {
+      DIALS_ASSERT(sigma_b > 0);
+      DIALS_ASSERT(sigma_m > 0);
+      DIALS_ASSERT(n_sigma > 0);
+      DIALS_ASSERT(background >= 0);
+      DIALS_ASSERT(phi.size() == s1.size());
+      DIALS_ASSERT(panel.size() == s1.size());
+      DIALS_ASSERT(intensity.size() == s1.size());
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        std::size_t size = detector[i].get_image_size()[0];
+        size *= detector[i].get_image_size()[1];
+        max_pixels_ = std::max(max_pixels_, size);
+      }
+
+      // Compute the bounding boxes
+      BBoxCalculator3D calculator(
+        beam, detector, goniometer, scan, n_sigma * sigma_b, n_sigma * sigma_m);
+      bbox_.resize(s1.size());
+      for (std::size_t i = 0; i < s1.size(); ++i) {
+        DIALS_ASSERT(panel[i] < detector.size());
+        DIALS_ASSERT(intensity[i] >= 0);
+        double frame = scan.get_array_index_from_angle(phi[i]);
+        bbox_[i] = calculator.single(s1[i], frame, panel[i]);
+        max_depth_ = std::max(max_depth_, bbox_[i][5] - bbox_[i][4]);
+      }
+
+      // Order the reflections by their first frame
+      order_.resize(s1.size());
+      for (std::size_t i = 0; i < order_.size(); ++i) {
+        order_[i] = i;
+      }
+      std::sort(order_.begin(), order_.end(), detail::sort_by_first_frame(bbox_));
+      first_frame_.resize(order_.size());
+      for (std::size_t i = 0; i < order_.size(); ++i) {
+        first_frame_[i] = bbox_[order_[i]][4];
+      }
+    }
+
+    /**
+     * @returns The bounding boxes of the reflections
+     */
+    af::shared<int6> bbox() const {
+      return af::shared<int6>(bbox_.begin(), bbox_.end());
+    }
+
+    /**
+     * Render the images of a panel
+     * @param panel The panel number
+     * @param first The first frame (array index)
+     * @param last The last frame (array index)
+     * @param nthreads The number of threads to use
+     * @returns The image stack
+     */
+    af::versa<int, af::c_grid<3> > render(std::size_t panel,
+                                          int first,
+                                          int last,
+                                          std::size_t nthreads = 1) const {
+      DIALS_ASSERT(panel < detector_.size());
+      DIALS_ASSERT(first < last);
+      DIALS_ASSERT(first >= scan_.get_array_range()[0]);
+      DIALS_ASSERT(last <= scan_.get_array_range()[1]);
+      std::size_t xsize = detector_[panel].get_image_size()[0];
+      std::size_t ysize = detector_[panel].get_image_size()[1];
+      af::versa<int, af::c_grid<3> > result(af::c_grid<3>(last - first, ysize, xsize),
+                                            0);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(
+          &SweepSimulator::render_lines, this, panel, first, result.ref(), _1, _2),
+        (last - first) * ysize,
+        nthreads);
+      return result;
+    }
+
+    /**
+     * @param nthreads The number of threads to use
+     * @returns The number of photons of each reflection on the images
+     */
+    af::shared<int> signal_counts(std::size_t nthreads = 1) const {
+      af::shared<int> result(s1_.size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&SweepSimulator::count_band, this, result.ref(), _1, _2),
+        s1_.size(),
+        nthreads);
+      return result;
+    }
+
+  private:
+    /**
+     * Simulate the photons of a reflection, passing the pixel and frame of
+     * each one that falls within the bounding box and on the images to the
+     * visitor
+     */
+    template <typename Visitor>
+    void simulate(std::size_t index, Visitor &visitor) const {
+      if (intensity_[index] <= 0) {
+        return;
+      }
+      SplitMix64 gen(seed_, 2 * (boost::uint64_t)index);
+      boost::random::poisson_distribution<int, double> dist_n(intensity_[index]);
+      boost::random::normal_distribution<double> dist_b(0, sigma_b_);
+      boost::random::normal_distribution<double> dist_m(0, sigma_m_);
+      const Panel &panel = detector_[panel_[index]];
+      const int6 &bbox = bbox_[index];
+      int x0 = std::max(bbox[0], 0);
+      int x1 = std::min(bbox[1], (int)panel.get_image_size()[0]);
+      int y0 = std::max(bbox[2], 0);
+      int y1 = std::min(bbox[3], (int)panel.get_image_size()[1]);
+      int z0 = std::max(bbox[4], scan_.get_array_range()[0]);
+      int z1 = std::min(bbox[5], scan_.get_array_range()[1]);
+      CoordinateSystem cs(m2_, s0_, s1_[index], phi_[index]);
+      int n = dist_n(gen);
+      for (int i = 0; i < n; ++i) {
+        double e1 = dist_b(gen);
+        double e2 = dist_b(gen);
+        double e3 = dist_m(gen);
+        vec3<double> s1_dash = cs.to_beam_vector(vec2<double>(e1, e2));
+        double phi_dash = cs.to_rotation_angle_fast(e3);
+        vec2<double> px = panel.get_ray_intersection_px(s1_dash);
+        double frame = scan_.get_array_index_from_angle(phi_dash);
+        if (px[0] < x0 || px[0] >= x1 || px[1] < y0 || px[1] >= y1 || frame < z0
+            || frame >= z1) {
+          continue;
+        }
+        visitor((int)std::floor(px[0]), (int)std::floor(px[1]), (int)std::floor(frame));
+      }
+    }
+
+    void render_lines(std::size_t panel,
+                      int first,
+                      af::ref<int, af::c_grid<3> > image,
+                      std::size_t line0,
+                      std::size_t line1) const {
+      long ysize = image.accessor()[1];
+      long xsize = image.accessor()[2];
+      int frame0 = first + line0 / ysize;
+      int frame1 = first + (line1 - 1) / ysize + 1;
+
+      // Draw the background counts
+      if (background_ > 0) {
+        boost::uint64_t frame_offset = scan_.get_array_range()[0];
+        boost::random::poisson_distribution<int, double> dist(background_);
+        for (std::size_t line = line0; line < line1; ++line) {
+          boost::uint64_t frame = first + line / ysize - frame_offset;
+          boost::uint64_t pixel =
+            (frame * detector_.size() + panel) * max_pixels_ + (line % ysize) * xsize;
+          for (long x = 0; x < xsize; ++x) {
+            SplitMix64 gen(seed_, 2 * (pixel + x) + 1);
+            image[line * xsize + x] = dist(gen);
+          }
+        }
+      }
+
+      // Add the photons of the reflections that may fall on these lines
+      detail::add_photon_to_lines visitor(image, first, line0, line1);
+      std::vector<int>::const_iterator begin = std::lower_bound(
+        first_frame_.begin(), first_frame_.end(), frame0 - max_depth_ + 1);
+      std::vector<int>::const_iterator end =
+        std::lower_bound(first_frame_.begin(), first_frame_.end(), frame1);
+      for (std::vector<int>::const_iterator it = begin; it != end; ++it) {
+        std::size_t index = order_[it - first_frame_.begin()];
+        const int6 &bbox = bbox_[index];
+        if (panel_[index] != panel || bbox[5] <= frame0) {
+          continue;
+        }
+        long bbox_line0 = (long)(bbox[4] - first) * ysize + bbox[2];
+        long bbox_line1 = (long)(bbox[5] - 1 - first) * ysize + bbox[3];
+        if (bbox_line1 <= (long)line0 || bbox_line0 >= (long)line1) {
+          continue;
+        }
+        simulate(index, visitor);
+      }
+    }
+
+    void count_band(af::ref<int> result, std::size_t first, std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        detail::count_photons visitor;
+        simulate(i, visitor);
+        result[i] = visitor.count;
+      }
+    }
+
+    Detector detector_;
+    Scan scan_;
+    vec3<double> s0_;
+    vec3<double> m2_;
+    double sigma_b_;
+    double sigma_m_;
+    std::vector<vec3<double> > s1_;
+    std::vector<double> phi_;
+    std::vector<std::size_t> panel_;
+    std::vector<double> intensity_;
+    std::vector<int6> bbox_;
+    std::vector<std::size_t> order_;
+    std::vector<int> first_frame_;
+    double background_;
+    std::size_t seed_;
+    std::size_t max_pixels_;
+    int max_depth_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SIMULATION_SWEEP_SIMULATOR_H
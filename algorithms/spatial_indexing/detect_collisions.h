@@ -12,13 +12,18 @@
 #define DIALS_ALGORITHMS_SPATIAL_INDEXING_DETECT_COLLISIONS_H
 
 #include <cstdlib>
+#include <deque>
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <boost/bind.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/mpl/range_c.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <cmath>
 #include <dials/error.h>
+#include <dials/util/thread_pool.h>
 #include <dials/algorithms/spatial_indexing/log2.h>
 
 namespace dials { namespace algorithms {
@@ -320,6 +325,9 @@ namespace dials { namespace algorithms {
     typedef ListType CollisionList;
     typedef typename CollisionList::value_type Collision;
 
+    // The list of collisions found by a single task
+    typedef std::vector<std::pair<IndexType, IndexType> > LocalList;
+
     // Bounding box and box size types
     typedef BoundingBox<DIM, CoordType> BoxType;
     typedef BoxSize<DIM, CoordType> DimType;
@@ -330,14 +338,29 @@ namespace dials { namespace algorithms {
     // The threshold to resort to a brute-force search
     static const int BF_THRESHOLD = 10;
 
+    // The number of objects above which a subdivision is a separate task
+    static const int TASK_THRESHOLD = 1000;
+
+    /**
+     * @param nthreads The number of threads to use
+     */
+    DetectCollisions(std::size_t nthreads = 1) : nthreads_(nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+    }
+
     /**
      * The "quick collide" aka "trevor" collision detection algorithm.
      *
-     * The algorithm works by recursively splitting the space along each
-     * dimension and partitioning the data that belongs in each side of the
-     * split. Objects that span a split are handled by shuffling before
-     * each side of the split if processed. Objects that collide are added
-     * to a list of pairs of collisions.
+     * The algorithm works by splitting the space along each dimension in turn
+     * and dividing the data between each side of the split. Objects that span
+     * a split go to both sides. Objects that collide are added to a list of
+     * pairs of collisions.
+     *
+     * The subdivisions are processed from an explicit stack rather than by
+     * recursion. With more than one thread, subdivisions with more than
+     * TASK_THRESHOLD objects are posted as separate tasks; each task keeps its
+     * own list of collisions and the lists are appended to the output at the
+     * end.
      *
      * The list assumes there is a method "push_back" where new
      * elements can be added. Additionally it assumes that it defines a
@@ -354,9 +377,10 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(n > 0);
 
       // Create and fill a vector with the indices of the input data range
-      IndexList index(n);
+      boost::shared_ptr<Node> root(new Node());
+      root->index.resize(n);
       for (std::size_t i = 0; i < n; ++i) {
-        index[i] = i;
+        root->index[i] = i;
       }
 
       // Get the bounding box of the whole data range
@@ -380,135 +404,215 @@ namespace dials { namespace algorithms {
       if (max_depth_ < 1) max_depth_ = 1;
       max_depth_ *= DIM;
 
-      // Start the recursive partitioning of the data to find the collisions.
-      partition_data<0>(index.begin(), index.end(), first, collisions, box, 0);
+      // Start the partitioning of the data to find the collisions.
+      root->box = box;
+      root->depth = 0;
+      root->axis = 0;
+      std::deque<LocalList> results;
+      if (nthreads_ == 1) {
+        results.push_back(LocalList());
+        partition_data(root, first, results.back(), NULL);
+      } else {
+        dials::util::ThreadPool pool(nthreads_);
+        TaskContext context(pool, results);
+        post_task(root, first, &context);
+        context.group.wait();
+      }
+
+      // Append the collisions from each task to the list
+      for (std::size_t i = 0; i < results.size(); ++i) {
+        for (std::size_t k = 0; k < results[i].size(); ++k) {
+          collisions.push_back(Collision(results[i][k].first, results[i][k].second));
+        }
+      }
     }
 
   private:
+    /**
+     * A subdivision of the space and the objects within it
+     */
+    struct Node {
+      IndexList index;
+      BoxType box;
+      int depth;
+      int axis;
+
+      /** Take the contents of another node, leaving its index empty */
+      void take(Node &other) {
+        index.swap(other.index);
+        box = other.box;
+        depth = other.depth;
+        axis = other.axis;
+      }
+    };
+
+    std::size_t nthreads_;
     int max_depth_;
 
+    /**
+     * The state shared by the tasks when running on a thread pool
+     */
+    struct TaskContext {
+      dials::util::ThreadPool::TaskGroup group;
+      std::deque<LocalList> &results;
+      boost::mutex mutex;
+
+      TaskContext(dials::util::ThreadPool &pool, std::deque<LocalList> &results_)
+          : group(pool), results(results_) {}
+    };
+
+    /**
+     * Post a subdivision as a task with its own list of collisions
+     */
+    void post_task(boost::shared_ptr<Node> node,
+                   DataIterator data,
+                   TaskContext *context) const {
+      context->group.post(
+        boost::bind(&DetectCollisions::run_task, this, node, data, context));
+    }
+
+    void run_task(boost::shared_ptr<Node> node,
+                  DataIterator data,
+                  TaskContext *context) const {
+      LocalList *collisions = NULL;
+      {
+        boost::lock_guard<boost::mutex> guard(context->mutex);
+        context->results.push_back(LocalList());
+        collisions = &context->results.back();
+      }
+      partition_data(node, data, *collisions, context);
+    }
+
     /**
      * The main body of the algorithm.
      *
-     * This function is templated to partition along each axis (0 <= D < DIM).
-     * This allows the same code to be used to instantiate a co-recursive
-     * function call. If partition_data is called with D = 0, then the function
-     * will then call partition_data with D = 1 which in 2D will call
-     * partition_data with D = 0 again etc.
+     * Subdivisions are taken from a stack until it is empty. For each, first
+     * check the exit criteria, namely have we reached the maximum depth or
+     * are there fewer elements than the hard coded threshold to do a
+     * brute-force search of collisions.
      *
-     * The function performs the following tasks. It first checks the exit
-     * criteria, namely have we reached the maximum recursion depth or are
-     * there fewer elements than the hard coded threshold to do a brute-force
-     * search of collisions.
-     *
-     * If we haven't reached the exit criteria then split the bouding box in
-     * half along the current axis. Parition the index array so that all
-     * elements with the lower bound of their bounding box less than the split
-     * are to the left and all those greater to the right. Then partition along
-     * the next axis recursively.
-     *
-     * Next partition the data such that all elements with their upper bound
-     * greater than the split are to the right and all those less than to the
-     * less. This will move some elements from the previous partition but is
-     * necessary to ensure that those elements that are not wholely within a
-     * single partition are properly accounted for. Then partition along the
-     * next axis recursively.
+     * If we haven't reached the exit criteria then split the bounding box in
+     * half along the current axis. All elements with the lower bound of their
+     * bounding box less than the split go to the lower subdivision and all
+     * those with the upper bound greater than or equal to the split go to the
+     * upper subdivision, which are then split along the next axis: X -> Y ->
+     * Z -> X ... Elements that are not wholely within a single subdivision
+     * are in both.
      *
      * Once the exit condition has been met, do a brute-force search for
      * collisions amoung the remaining elements.
      *
-     * @todo The algorithm uses a dumb max recursion depth to exit, this could
+     * @todo The algorithm uses a dumb max depth to exit, this could
      *    be improved on since it is non-optimal for highly clustered data with
      *    outliers. Similarly, the current implementation splits the bounding
      *    box in half, a more optimal behaviour could be to split along the
      *    median of the data (as in quicksort etc).
      *
-     * @tparam D the dimension to split on
-     *
-     * @param first The iterator pointing to the start of the range to partition
-     * @param last The iterator pointing to the end of the range to partition
+     * @param root The subdivision to start from
      * @param data The start of the data range
      * @param collisions The collision list
-     * @param box The bouding box of the range we're to partition
-     * @param depth The current recusion depth.
+     * @param context The task context if running on a thread pool
      */
-    template <int D>
-    void partition_data(IndexIterator first,
-                        IndexIterator last,
+    void partition_data(boost::shared_ptr<Node> root,
                         DataIterator data,
-                        ListType &collisions,
-                        const BoxType &box,
-                        int depth) const {
-      // The next dimensions: X -> Y -> Z -> X ...
-      const int D_NEXT = (D + 1) % DIM;
-
-      // Keep recusing until we either reach the maximum recusion depth or
-      // the threshold of number of objects for brute force search is reached.
-      if (depth < max_depth_ && last - first > BF_THRESHOLD) {
-        IndexIterator mid;
-
-        // Copy the current level bounding box and starting with the lower
-        // bound of the sub-division, split the box so that the max in the
-        // current dimensio_along_axis is 1/2 of the current level box.
-        BoxType sub_box(box);
-        sub_box.max[D] = box.min[D] + (box.max[D] - box.min[D]) / 2;
-
-        // Partition the space by the lower bound of the current dimension.
-        // Then call the partition function on the next dimension, the order
-        // of this is X -> Y -> Z -> X ...
-        mid = std::partition(first, last, by_lower<D>(data, sub_box.max[D]));
-        partition_data<D_NEXT>(first, mid, data, collisions, sub_box, depth + 1);
-
-        // Rejig the subdivided box to set the maximum of the current dimension
-        // back to that of the current level box and the minimum to the maximum
-        // of the lower bound box.
-        sub_box.min[D] = sub_box.max[D];
-        sub_box.max[D] = box.max[D];
-
-        // Partition the space by the upper bound of the current dimension.
-        // Then call the partition function on the next dimension, the order
-        // of this is X -> Y -> Z -> X ...
-        mid = std::partition(first, last, by_upper<D>(data, sub_box.min[D]));
-        partition_data<D_NEXT>(mid, last, data, collisions, sub_box, depth + 1);
+                        LocalList &collisions,
+                        TaskContext *context) const {
+      std::deque<Node> stack(1);
+      stack.back().take(*root);
+      root.reset();
+      while (!stack.empty()) {
+        Node node;
+        node.take(stack.back());
+        stack.pop_back();
+
+        // Subdivisions with fewer than two objects have no collisions
+        if (node.index.size() < 2) {
+          continue;
+        }
 
-      } else {
-        // If the stopping condition has been met, then proceed with a
-        // brute-force search for all the collison in the current level.
-        detect_brute_force_w_check(first, last, data, collisions, box);
+        // Keep splitting until we either reach the maximum depth or the
+        // threshold of number of objects for brute force search is reached.
+        if (node.depth >= max_depth_ || node.index.size() <= BF_THRESHOLD) {
+          detect_brute_force_w_check(
+            node.index.begin(), node.index.end(), data, collisions, node.box);
+          continue;
+        }
+
+        // Split the box in half along the current axis, and divide the
+        // objects between the lower and upper halves
+        boost::shared_ptr<Node> lower(new Node());
+        boost::shared_ptr<Node> upper(new Node());
+        const int D = node.axis;
+        CoordType div = node.box.min[D] + (node.box.max[D] - node.box.min[D]) / 2;
+        lower->box = node.box;
+        lower->box.max[D] = div;
+        upper->box = node.box;
+        upper->box.min[D] = div;
+        lower->depth = upper->depth = node.depth + 1;
+        lower->axis = upper->axis = (D + 1) % DIM;
+        for_each<range_c<int, 0, DIM> >(
+          split_index(node.index, data, D, div, lower->index, upper->index));
+
+        // Push the upper subdivision then the lower one, so that the lower one
+        // is processed first. Large subdivisions are posted as separate tasks.
+        push_or_post(upper, data, stack, context);
+        push_or_post(lower, data, stack, context);
       }
     }
 
-    /**
-     * Parition the data based on the lower bound of the data in the given
-     * axis. All elements with their lower bound lower than the split to the
-     * left, all others to the right.
-     */
-    template <int D>
-    struct by_lower {
-      const Iterator &data_;
-      CoordType div_;
-
-      by_lower(const DataIterator &data, CoordType div) : data_(data), div_(div) {}
-
-      bool operator()(const IndexType &a) const {
-        return get_minimum_bound<D>(*(data_ + a)) < div_;
+    void push_or_post(boost::shared_ptr<Node> node,
+                      DataIterator data,
+                      std::deque<Node> &stack,
+                      TaskContext *context) const {
+      if (context != NULL && node->index.size() > TASK_THRESHOLD) {
+        post_task(node, data, context);
+      } else {
+        stack.push_back(Node());
+        stack.back().take(*node);
       }
-    };
+    }
 
     /**
-     * Parition the data based on the upper bound of the data in the given
-     * axis. All elements with their upper bound lower than the split to the
-     * left, all others to the right.
+     * Divide the objects by the split in the given axis. All elements with
+     * their lower bound lower than the split go to the lower list, and all
+     * elements with their upper bound not lower than the split go to the
+     * upper list.
      */
-    template <int D>
-    struct by_upper {
+    struct split_index {
+      const IndexList &index_;
       const DataIterator &data_;
+      int axis_;
       CoordType div_;
-
-      by_upper(const Iterator &data, CoordType div) : data_(data), div_(div) {}
-
-      bool operator()(const int &a) const {
-        return get_maximum_bound<D>(*(data_ + a)) < div_;
+      IndexList &lower_;
+      IndexList &upper_;
+
+      split_index(const IndexList &index,
+                  const DataIterator &data,
+                  int axis,
+                  CoordType div,
+                  IndexList &lower,
+                  IndexList &upper)
+          : index_(index),
+            data_(data),
+            axis_(axis),
+            div_(div),
+            lower_(lower),
+            upper_(upper) {}
+
+      template <typename I>
+      void operator()(I) {
+        if (I::value != axis_) {
+          return;
+        }
+        for (std::size_t i = 0; i < index_.size(); ++i) {
+          const ObjectType &object = *(data_ + index_[i]);
+          if (get_minimum_bound<I::value>(object) < div_) {
+            lower_.push_back(index_[i]);
+          }
+          if (!(get_maximum_bound<I::value>(object) < div_)) {
+            upper_.push_back(index_[i]);
+          }
+        }
       }
     };
 
@@ -519,7 +623,7 @@ namespace dials { namespace algorithms {
     void detect_brute_force_w_check(IndexIterator first,
                                     IndexIterator last,
                                     DataIterator data,
-                                    ListType &collisions,
+                                    LocalList &collisions,
                                     const BoxType &box) const {
       // Do a brute force collision test using the collision checker to ensure
       // no pairs are added that have already been visited and added.
@@ -599,16 +703,101 @@ namespace dials { namespace algorithms {
 
   /** Wrapper function specialised for 2D collision detection */
   template <typename Iterator, typename ListType>
-  void detect_collisions2d(Iterator first, Iterator last, ListType &collisions) {
+  void detect_collisions2d(Iterator first,
+                           Iterator last,
+                           ListType &collisions,
+                           std::size_t nthreads = 1) {
     // Create the collision detection object and call
-    DetectCollisions<2, Iterator, ListType, false>()(first, last, collisions);
+    DetectCollisions<2, Iterator, ListType, false> detect(nthreads);
+    detect(first, last, collisions);
   }
 
   /** Wrapper function specialised for 3D collision detection */
   template <typename Iterator, typename ListType>
-  void detect_collisions3d(Iterator first, Iterator last, ListType &collisions) {
+  void detect_collisions3d(Iterator first,
+                           Iterator last,
+                           ListType &collisions,
+                           std::size_t nthreads = 1) {
     // Create the collision detection object and call
-    DetectCollisions<3, Iterator, ListType, false>()(first, last, collisions);
+    DetectCollisions<3, Iterator, ListType, false> detect(nthreads);
+    detect(first, last, collisions);
+  }
+
+  //
+  // Boxes with single precision coordinates
+  //
+
+  /**
+   * A box with single precision bounds, for collision detection between
+   * large numbers of small objects such as spots.
+   */
+  template <int DIM>
+  struct FloatBox {
+    float min[DIM];
+    float max[DIM];
+  };
+
+  typedef FloatBox<2> FloatBox2d;
+  typedef FloatBox<3> FloatBox3d;
+
+  template <>
+  struct bound_coord_type<FloatBox2d> {
+    typedef float type;
+  };
+
+  template <>
+  struct bound_coord_type<FloatBox3d> {
+    typedef float type;
+  };
+
+  template <>
+  inline float get_minimum_bound<0, FloatBox2d>(const FloatBox2d &b) {
+    return b.min[0];
+  }
+
+  template <>
+  inline float get_minimum_bound<1, FloatBox2d>(const FloatBox2d &b) {
+    return b.min[1];
+  }
+
+  template <>
+  inline float get_maximum_bound<0, FloatBox2d>(const FloatBox2d &b) {
+    return b.max[0];
+  }
+
+  template <>
+  inline float get_maximum_bound<1, FloatBox2d>(const FloatBox2d &b) {
+    return b.max[1];
+  }
+
+  template <>
+  inline float get_minimum_bound<0, FloatBox3d>(const FloatBox3d &b) {
+    return b.min[0];
+  }
+
+  template <>
+  inline float get_minimum_bound<1, FloatBox3d>(const FloatBox3d &b) {
+    return b.min[1];
+  }
+
+  template <>
+  inline float get_minimum_bound<2, FloatBox3d>(const FloatBox3d &b) {
+    return b.min[2];
+  }
+
+  template <>
+  inline float get_maximum_bound<0, FloatBox3d>(const FloatBox3d &b) {
+    return b.max[0];
+  }
+
+  template <>
+  inline float get_maximum_bound<1, FloatBox3d>(const FloatBox3d &b) {
+    return b.max[1];
+  }
+
+  template <>
+  inline float get_maximum_bound<2, FloatBox3d>(const FloatBox3d &b) {
+    return b.max[2];
   }
 
 }}  // namespace dials::algorithms
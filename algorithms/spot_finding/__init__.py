@@ -2,4 +2,9 @@
 
 from dials_algorithms_spot_finding_ext import *  # noqa: F403; lgtm
 
-__all__ = ("StrongSpotCombiner",)  # noqa: F405
+__all__ = (  # noqa: F405
+    "PerImageAnalysis",
+    "SpotFinderEngine",
+    "StrongSpotCentroider",
+    "StrongSpotCombiner",
+)
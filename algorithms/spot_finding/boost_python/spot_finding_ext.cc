@@ -10,16 +10,199 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <string>
+#include <dials/algorithms/spot_finding/engine.h>
 #include <dials/algorithms/spot_finding/helpers.h>
+#include <dials/algorithms/spot_finding/per_image_analysis.h>
+#include <dials/algorithms/spot_finding/strong_spots.h>
+#include <dials/util/boost_python/buffer_view.h>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/release_gil.h>
+#include <dials/util/gil.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
+  using dials::util::boost_python::python_buffer_view;
+
+  /**
+   * Find the spots on an image held in a buffer of raw pixels
+   */
+  template <typename T>
+  StrongSpotCentroider find_spots_in_view(SpotFinderEngine &self,
+                                          const python_buffer_view &buffer,
+                                          int frame) {
+    int2 size = self.image_size();
+    DIALS_ASSERT(buffer.size() == sizeof(T) * size[0] * size[1]);
+    DIALS_ASSERT(reinterpret_cast<std::size_t>(buffer.data()) % sizeof(T) == 0);
+    af::const_ref<T, af::c_grid<2> > image(reinterpret_cast<const T *>(buffer.data()),
+                                           af::c_grid<2>(size[0], size[1]));
+    return self.find_spots(image, frame);
+  }
+
+  /**
+   * Find the spots on an image held in any object supporting the buffer
+   * protocol (e.g. bytes, a numpy array or a ZeroMQ frame) without copying
+   * the pixels. The GIL is released while the spots are found.
+   * @param self The engine
+   * @param buffer The C ordered pixels of the image
+   * @param dtype The type of the pixels (int32, uint16 or float64)
+   * @param frame The frame number
+   * @returns The spots
+   */
+  StrongSpotCentroider find_spots_in_buffer(SpotFinderEngine &self,
+                                            object buffer,
+                                            std::string dtype,
+                                            int frame) {
+    if (dtype != "int32" && dtype != "uint16" && dtype != "float64") {
+      DIALS_ERROR("Unknown pixel type: " + dtype);
+    }
+    python_buffer_view view(buffer);
+    dials::util::ScopedReleaseGIL release;
+    if (dtype == "int32") {
+      return find_spots_in_view<int>(self, view, frame);
+    } else if (dtype == "uint16") {
+      return find_spots_in_view<unsigned short>(self, view, frame);
+    }
+    return find_spots_in_view<double>(self, view, frame);
+  }
+
+  /**
+   * Compute the per image analysis statistics with the GIL released
+   */
+  PerImageAnalysis *make_per_image_analysis(const af::const_ref<int> &image,
+                                            const af::const_ref<double> &rlp_norm,
+                                            const af::const_ref<double> &intensity,
+                                            const af::const_ref<double> &variance,
+                                            std::size_t num_images,
+                                            const af::const_ref<double> &ice_rings,
+                                            double ice_ring_width,
+                                            const af::const_ref<double> &shells,
+                                            bool resolution_analysis,
+                                            std::size_t nthreads) {
+    dials::util::ScopedReleaseGIL release;
+    return new PerImageAnalysis(image,
+                                rlp_norm,
+                                intensity,
+                                variance,
+                                num_images,
+                                ice_rings,
+                                ice_ring_width,
+                                shells,
+                                resolution_analysis,
+                                nthreads);
+  }
 
   BOOST_PYTHON_MODULE(dials_algorithms_spot_finding_ext) {
+    dials::util::boost_python::import_memory_accounting();
+    dials::util::boost_python::import_shared_executor();
     class_<StrongSpotCombiner>("StrongSpotCombiner")
       .def("add", &StrongSpotCombiner::add)
       .def("shoeboxes", &StrongSpotCombiner::shoeboxes);
+
+    class_<StrongSpotCentroider>("StrongSpotCentroider", no_init)
+      .def(init<std::size_t,
+                int,
+                const af::const_ref<double, af::c_grid<2> > &,
+                const af::const_ref<bool, af::c_grid<2> > &,
+                std::size_t,
+                std::size_t>((arg("panel"),
+                              arg("frame"),
+                              arg("image"),
+                              arg("mask"),
+                              arg("min_pixels"),
+                              arg("max_pixels"))))
+      .def("size", &StrongSpotCentroider::size)
+      .def("__len__", &StrongSpotCentroider::size)
+      .def("num_strong_pixels", &StrongSpotCentroider::num_strong_pixels)
+      .def("num_too_small", &StrongSpotCentroider::num_too_small)
+      .def("num_too_large", &StrongSpotCentroider::num_too_large)
+      .def("spot_size", &StrongSpotCentroider::spot_size)
+      .def("bboxes", &StrongSpotCentroider::bboxes)
+      .def("peak_coordinates", &StrongSpotCentroider::peak_coordinates)
+      .def("observations", &StrongSpotCentroider::observations);
+
+    class_<SpotFinderEngine, boost::noncopyable>("SpotFinderEngine", no_init)
+      .def(init<int2,
+                double,
+                double,
+                double,
+                int,
+                const af::const_ref<bool, af::c_grid<2> > &,
+                double,
+                std::size_t,
+                std::size_t,
+                std::size_t>((arg("kernel_size"),
+                              arg("n_sigma_b"),
+                              arg("n_sigma_s"),
+                              arg("threshold"),
+                              arg("min_count"),
+                              arg("mask"),
+                              arg("max_valid"),
+                              arg("min_spot_size"),
+                              arg("max_spot_size"),
+                              arg("nthreads") = 1)))
+      .def(init<int2,
+                double,
+                double,
+                double,
+                int,
+                const af::const_ref<bool, af::c_grid<2> > &,
+                const af::const_ref<double, af::c_grid<2> > &,
+                double,
+                std::size_t,
+                std::size_t,
+                std::size_t>((arg("kernel_size"),
+                              arg("n_sigma_b"),
+                              arg("n_sigma_s"),
+                              arg("threshold"),
+                              arg("min_count"),
+                              arg("mask"),
+                              arg("gain"),
+                              arg("max_valid"),
+                              arg("min_spot_size"),
+                              arg("max_spot_size"),
+                              arg("nthreads") = 1)))
+      .def("image_size", &SpotFinderEngine::image_size)
+      .def("num_bands", &SpotFinderEngine::num_bands)
+      .def("has_gain", &SpotFinderEngine::has_gain)
+      .def("strong_pixels", &SpotFinderEngine::strong_pixels)
+      .def("__call__",
+           DIALS_RELEASE_GIL(&SpotFinderEngine::find_spots<int>),
+           (arg("image"), arg("frame") = 0))
+      .def("__call__",
+           DIALS_RELEASE_GIL(&SpotFinderEngine::find_spots<double>),
+           (arg("image"), arg("frame") = 0))
+      .def("find_spots_in_buffer",
+           &find_spots_in_buffer,
+           (arg("buffer"), arg("dtype"), arg("frame") = 0));
+
+    class_<PerImageAnalysis>("PerImageAnalysis", no_init)
+      .def("__init__",
+           make_constructor(&make_per_image_analysis,
+                            default_call_policies(),
+                            (arg("image"),
+                             arg("rlp_norm"),
+                             arg("intensity"),
+                             arg("variance"),
+                             arg("num_images"),
+                             arg("ice_rings"),
+                             arg("ice_ring_width"),
+                             arg("shells"),
+                             arg("resolution_analysis") = true,
+                             arg("nthreads") = 1)))
+      .def("n_spots_total", &PerImageAnalysis::n_spots_total)
+      .def("n_spots_no_ice", &PerImageAnalysis::n_spots_no_ice)
+      .def("n_spots_4A", &PerImageAnalysis::n_spots_4A)
+      .def("total_intensity", &PerImageAnalysis::total_intensity)
+      .def("ice_ring_fraction", &PerImageAnalysis::ice_ring_fraction)
+      .def("estimated_d_min", &PerImageAnalysis::estimated_d_min)
+      .def("d_min_distl_method_1", &PerImageAnalysis::d_min_distl_method_1)
+      .def("noisiness_method_1", &PerImageAnalysis::noisiness_method_1)
+      .def("d_min_distl_method_2", &PerImageAnalysis::d_min_distl_method_2)
+      .def("noisiness_method_2", &PerImageAnalysis::noisiness_method_2)
+      .def("shell_counts", &PerImageAnalysis::shell_counts);
   }
 
 }}}  // namespace dials::algorithms::boost_python
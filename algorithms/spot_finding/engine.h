@@ -0,0 +1,308 @@
+/*
+ * engine.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_ENGINE_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_ENGINE_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/spot_finding/strong_spots.h>
+#include <dials/util/thread_pool.h>
+#include <dials/util/trace.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::util::ThreadPool;
+
+  /**
+   * A long lived spot finder for a stream of single panel images with the
+   * same static mask and gain map, as used for live feedback during data
+   * collection.
+   *
+   * Everything which only depends on the mask and gain is done once when the
+   * engine is created: the image is split into horizontal bands (as for
+   * TiledThreshold) and a DispersionThresholdPrepared is created for each
+   * band and its halo, together with the buffers for the threshold mask. Each
+   * image is then thresholded in parallel on the thread pool and the spots
+   * are found and centroided directly from the threshold mask with the
+   * StrongSpotCentroider, so no memory is allocated for an image other than
+   * for the spots themselves.
+   *
+   * Pixels with values above max_valid (e.g. overloads) are excluded from
+   * the threshold. Bands with such pixels fall back to the unprepared
+   * algorithm with the mask of the valid pixels.
+   *
+   * Images are processed one at a time; calls from several threads are
+   * serialised.
+   */
+  class SpotFinderEngine : private boost::noncopyable {
+  public:
+    /**
+     * Create the engine
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param mask The static mask
+     * @param max_valid The largest valid pixel value
+     * @param min_spot_size The minimum number of pixels in a spot
+     * @param max_spot_size The maximum number of pixels in a spot
+     * @param nthreads The number of threads
+     */
+    SpotFinderEngine(int2 kernel_size,
+                     double nsig_b,
+                     double nsig_s,
+                     double threshold,
+                     int min_count,
+                     const af::const_ref<bool, af::c_grid<2> > &mask,
+                     double max_valid,
+                     std::size_t min_spot_size,
+                     std::size_t max_spot_size,
+                     std::size_t nthreads)
+        : image_size_(mask.accessor()[0], mask.accessor()[1]),
+          max_valid_(max_valid),
+          min_spot_size_(min_spot_size),
+          max_spot_size_(max_spot_size),
+          has_gain_(false) {
+      init(kernel_size, nsig_b, nsig_s, threshold, min_count, mask, NULL, nthreads);
+    }
+
+    /**
+     * Create the engine with a gain map
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param mask The static mask
+     * @param gain The gain map
+     * @param max_valid The largest valid pixel value
+     * @param min_spot_size The minimum number of pixels in a spot
+     * @param max_spot_size The maximum number of pixels in a spot
+     * @param nthreads The number of threads
+     */
+    SpotFinderEngine(int2 kernel_size,
+                     double nsig_b,
+                     double nsig_s,
+                     double threshold,
+                     int min_count,
+                     const af::const_ref<bool, af::c_grid<2> > &mask,
+                     const af::const_ref<double, af::c_grid<2> > &gain,
+                     double max_valid,
+                     std::size_t min_spot_size,
+                     std::size_t max_spot_size,
+                     std::size_t nthreads)
+        : image_size_(mask.accessor()[0], mask.accessor()[1]),
+          max_valid_(max_valid),
+          min_spot_size_(min_spot_size),
+          max_spot_size_(max_spot_size),
+          has_gain_(true) {
+      DIALS_ASSERT(gain.accessor().all_eq(mask.accessor()));
+      init(kernel_size, nsig_b, nsig_s, threshold, min_count, mask, &gain, nthreads);
+    }
+
+    /** @returns The size of the images */
+    int2 image_size() const {
+      return image_size_;
+    }
+
+    /** @returns The number of bands */
+    std::size_t num_bands() const {
+      return bands_.size();
+    }
+
+    /** @returns True/False the engine uses a gain map */
+    bool has_gain() const {
+      return has_gain_;
+    }
+
+    /**
+     * Find the spots on an image
+     * @param image The image
+     * @param frame The frame number of the image
+     * @returns The spots
+     */
+    template <typename T>
+    StrongSpotCentroider find_spots(const af::const_ref<T, af::c_grid<2> > &image,
+                                    int frame) {
+      DIALS_TRACE_SCOPE("spot_finding", "engine_find_spots");
+      DIALS_ASSERT(image.accessor().all_eq(image_size_));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      ThreadPool::TaskGroup group(*pool_);
+      for (std::size_t i = 0; i < bands_.size(); ++i) {
+        group.post(
+          boost::bind(&SpotFinderEngine::threshold_band<T>, this, i, image));
+      }
+      group.wait();
+      return StrongSpotCentroider(
+        0, frame, image, strong_.const_ref(), min_spot_size_, max_spot_size_);
+    }
+
+    /**
+     * @returns A copy of the strong pixel mask of the last image
+     */
+    af::versa<bool, af::c_grid<2> > strong_pixels() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      af::versa<bool, af::c_grid<2> > result(strong_.accessor());
+      std::copy(strong_.begin(), strong_.end(), result.begin());
+      return result;
+    }
+
+  private:
+    /**
+     * A band of the image
+     */
+    struct Band {
+      int first;       // The first row of the band
+      int last;        // One past the last row of the band
+      int halo_first;  // The first row including the halo
+      int halo_last;   // One past the last row including the halo
+      boost::shared_ptr<DispersionThresholdPrepared> prepared;
+      boost::shared_ptr<DispersionThreshold> fallback;
+      af::versa<bool, af::c_grid<2> > mask;
+      af::versa<bool, af::c_grid<2> > result;
+    };
+
+    /**
+     * Split the image into bands and prepare the threshold for each
+     */
+    void init(int2 kernel_size,
+              double nsig_b,
+              double nsig_s,
+              double threshold,
+              int min_count,
+              const af::const_ref<bool, af::c_grid<2> > &mask,
+              const af::const_ref<double, af::c_grid<2> > *gain,
+              std::size_t nthreads) {
+      DIALS_ASSERT(image_size_.all_gt(0));
+      DIALS_ASSERT(min_spot_size_ <= max_spot_size_);
+      DIALS_ASSERT(nthreads > 0);
+      pool_ = boost::make_shared<ThreadPool>(nthreads);
+      mask_ = af::versa<bool, af::c_grid<2> >(mask.accessor());
+      std::copy(mask.begin(), mask.end(), mask_.begin());
+      if (gain != NULL) {
+        gain_ = af::versa<double, af::c_grid<2> >(gain->accessor());
+        std::copy(gain->begin(), gain->end(), gain_.begin());
+      }
+      strong_ = af::versa<bool, af::c_grid<2> >(mask.accessor(), false);
+
+      // Create the prepared threshold for each band
+      int ysize = image_size_[0];
+      int xsize = image_size_[1];
+      std::size_t num_bands = std::min(nthreads, (std::size_t)ysize);
+      int band_size = (ysize + num_bands - 1) / num_bands;
+      int halo = DispersionThreshold::halo(kernel_size);
+      for (int first = 0; first < ysize; first += band_size) {
+        Band band;
+        band.first = first;
+        band.last = std::min(first + band_size, ysize);
+        band.halo_first = std::max(first - halo, 0);
+        band.halo_last = std::min(band.last + halo, ysize);
+        int2 size(band.halo_last - band.halo_first, xsize);
+        if (gain != NULL) {
+          band.prepared =
+            boost::make_shared<DispersionThresholdPrepared>(size,
+                                                            kernel_size,
+                                                            nsig_b,
+                                                            nsig_s,
+                                                            threshold,
+                                                            min_count,
+                                                            view(band, mask),
+                                                            view(band, *gain));
+        } else {
+          band.prepared = boost::make_shared<DispersionThresholdPrepared>(
+            size, kernel_size, nsig_b, nsig_s, threshold, min_count, view(band, mask));
+        }
+        band.fallback = boost::make_shared<DispersionThreshold>(
+          size, kernel_size, nsig_b, nsig_s, threshold, min_count);
+        band.mask = af::versa<bool, af::c_grid<2> >(af::c_grid<2>(size[0], size[1]));
+        band.result =
+          af::versa<bool, af::c_grid<2> >(af::c_grid<2>(size[0], size[1]));
+        bands_.push_back(band);
+      }
+    }
+
+    /**
+     * Get a view of the band and its halo
+     * @param band The band
+     * @param data The image data
+     * @returns The rows of the image in the band and halo
+     */
+    template <typename T>
+    af::const_ref<T, af::c_grid<2> > view(
+      const Band &band,
+      const af::const_ref<T, af::c_grid<2> > &data) const {
+      std::size_t xsize = image_size_[1];
+      return af::const_ref<T, af::c_grid<2> >(
+        data.begin() + band.halo_first * xsize,
+        af::c_grid<2>(band.halo_last - band.halo_first, xsize));
+    }
+
+    /**
+     * Threshold a single band and copy it into the strong pixel mask
+     */
+    template <typename T>
+    void threshold_band(std::size_t index, af::const_ref<T, af::c_grid<2> > image) {
+      Band &band = bands_[index];
+      af::const_ref<T, af::c_grid<2> > src = view(band, image);
+      af::const_ref<bool, af::c_grid<2> > mask = view(band, mask_.const_ref());
+
+      // Check for invalid pixels on this image and mask them if there are any
+      bool all_valid = true;
+      for (std::size_t i = 0; i < src.size(); ++i) {
+        all_valid &= !(mask[i] && src[i] > max_valid_);
+      }
+      if (!all_valid) {
+        for (std::size_t i = 0; i < src.size(); ++i) {
+          band.mask[i] = mask[i] && !(src[i] > max_valid_);
+        }
+      }
+
+      if (all_valid) {
+        band.prepared->threshold(src, band.result.ref());
+      } else if (has_gain_) {
+        band.fallback->threshold_w_gain(src,
+                                        band.mask.const_ref(),
+                                        view(band, gain_.const_ref()),
+                                        band.result.ref());
+      } else {
+        band.fallback->threshold(src, band.mask.const_ref(), band.result.ref());
+      }
+
+      std::size_t xsize = image_size_[1];
+      std::copy(band.result.begin() + (band.first - band.halo_first) * xsize,
+                band.result.begin() + (band.last - band.halo_first) * xsize,
+                strong_.begin() + band.first * xsize);
+    }
+
+    int2 image_size_;
+    double max_valid_;
+    std::size_t min_spot_size_;
+    std::size_t max_spot_size_;
+    bool has_gain_;
+    boost::shared_ptr<ThreadPool> pool_;
+    af::versa<bool, af::c_grid<2> > mask_;
+    af::versa<double, af::c_grid<2> > gain_;
+    af::versa<bool, af::c_grid<2> > strong_;
+    std::vector<Band> bands_;
+    mutable boost::mutex mutex_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_ENGINE_H
@@ -0,0 +1,137 @@
+from __future__ import absolute_import, division, print_function
+
+import logging
+
+import libtbx
+from dxtbx.model.experiment_list import ExperimentList
+
+from dials.algorithms.spot_finding import SpotFinderEngine, per_image_analysis
+from dials.array_family import flex
+from dials.util.masking import MaskGenerator
+
+logger = logging.getLogger(__name__)
+
+
+class SpotFinderService(object):
+    """
+    A persistent spot finder for a stream of images from a single panel
+    detector, e.g. for live feedback during data collection.
+
+    The mask, gain map and threshold buffers are prepared once, when the
+    service is created, and kept for every image. Images may be given as flex
+    arrays or as any object supporting the buffer protocol (bytes, numpy
+    arrays, ZeroMQ frames) with the type of the pixels, in which case the
+    pixels are not copied. The GIL is released while the spots are found.
+    """
+
+    def __init__(self, experiment, params, nthreads=1):
+        """
+        Prepare the spot finder
+
+        :param experiment: The experiment giving the detector and static mask
+        :param params: The dials.find_spots parameters
+        :param nthreads: The number of threads used for each image
+        """
+        self._experiments = ExperimentList([experiment])
+        detector = experiment.detector
+        if len(detector) != 1:
+            raise ValueError("The spot finding service needs a single panel detector")
+        spotfinder = params.spotfinder
+        dispersion = spotfinder.threshold.dispersion
+        if dispersion.global_threshold is libtbx.Auto:
+            raise ValueError("The spot finding service needs a fixed global_threshold")
+
+        # The static mask
+        mask = MaskGenerator(spotfinder.filter).generate(experiment.imageset)[0]
+        if spotfinder.lookup.mask is not None:
+            lookup = spotfinder.lookup.mask
+            if not isinstance(lookup, tuple):
+                from dials.algorithms.spot_finding.factory import SpotFinderFactory
+
+                lookup = SpotFinderFactory.load_image(lookup)
+            mask = mask & lookup[0]
+
+        min_spot_size = spotfinder.filter.min_spot_size
+        if min_spot_size is libtbx.Auto:
+            min_spot_size = 3 if detector[0].get_type() == "SENSOR_PAD" else 6
+
+        args = [
+            dispersion.kernel_size,
+            dispersion.sigma_background,
+            dispersion.sigma_strong,
+            dispersion.global_threshold,
+            dispersion.min_local,
+            mask,
+        ]
+        if dispersion.gain is not None:
+            args.append(flex.double(mask.accessor(), dispersion.gain))
+        args.extend(
+            [
+                detector[0].get_trusted_range()[1],
+                min_spot_size,
+                spotfinder.filter.max_spot_size,
+                nthreads,
+            ]
+        )
+        self._engine = SpotFinderEngine(*args)
+        logger.debug(
+            "Prepared spot finder for %dx%d images in %d bands",
+            self._engine.image_size()[1],
+            self._engine.image_size()[0],
+            self._engine.num_bands(),
+        )
+
+    def find_spots(self, image, frame=0, dtype=None):
+        """
+        Find the spots on an image
+
+        :param image: The image as a flex array, or a buffer of C ordered pixels
+        :param frame: The frame number of the image
+        :param dtype: The pixel type of a buffer (int32, uint16 or float64)
+        :returns: The reflection table of spots and the number of strong pixels
+        """
+        if dtype is None:
+            spots = self._engine(image, frame)
+        else:
+            spots = self._engine.find_spots_in_buffer(image, dtype, frame)
+        observed = spots.observations()
+        centroids = observed.centroids()
+        intensities = observed.intensities()
+        reflections = flex.reflection_table()
+        reflections["id"] = flex.int(len(observed), 0)
+        reflections["panel"] = observed.panels()
+        reflections["xyzobs.px.value"] = centroids.px_position()
+        reflections["xyzobs.px.variance"] = centroids.px_std_err_eq()
+        reflections["intensity.sum.value"] = intensities.observed_value()
+        reflections["intensity.sum.variance"] = intensities.observed_variance()
+        reflections["bbox"] = spots.bboxes()
+        return reflections, spots.num_strong_pixels()
+
+    def stats(self, reflections, filter_ice=True, ice_rings_width=0.004):
+        """
+        Compute the per image analysis statistics of the spots on an image
+
+        :param reflections: The spots from find_spots
+        :param filter_ice: Exclude the spots on ice rings
+        :param ice_rings_width: The width of the ice rings
+        :returns: The statistics as a dictionary
+        """
+        reflections.centroid_px_to_mm(self._experiments)
+        reflections.map_centroids_to_reciprocal_space(self._experiments)
+        return per_image_analysis.stats_for_reflection_table(
+            reflections, filter_ice=filter_ice, ice_rings_width=ice_rings_width
+        )._asdict()
+
+    def __call__(self, image, frame=0, dtype=None):
+        """
+        Find the spots on an image and compute their statistics
+
+        :param image: The image as a flex array, or a buffer of C ordered pixels
+        :param frame: The frame number of the image
+        :param dtype: The pixel type of a buffer (int32, uint16 or float64)
+        :returns: The statistics as a dictionary
+        """
+        reflections, num_strong_pixels = self.find_spots(image, frame, dtype)
+        stats = self.stats(reflections)
+        stats["num_strong_pixels"] = num_strong_pixels
+        return stats
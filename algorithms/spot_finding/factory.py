@@ -58,6 +58,38 @@ def generate_phil_scope():
       .type = bool
       .help = "Compute the mean background for each image"
 
+    prescreen
+      .help = "A cheap screen for blank images, for which the full threshold is"
+              "skipped. Useful for serial data where most images have no spots."
+      .expert_level = 1
+    {
+      enable = False
+        .type = bool
+        .help = "Screen each image for spots before thresholding"
+
+      binning = 4
+        .type = int(value_min=1)
+        .help = "The number of pixels along each side of the square bins"
+
+      kernel_size = 3 3
+        .type = ints(size=2, value_min=1)
+        .help = "The size of the local area in binned pixels"
+
+      sigma_background = 3
+        .type = float(value_min=0)
+        .help = "The dispersion threshold applied to the binned image"
+
+      sigma_strong = 2
+        .type = float(value_min=0)
+        .help = "The strong pixel threshold applied to the binned image"
+
+      min_strong = 1
+        .type = int(value_min=1)
+        .help = "The minimum number of strong binned pixels for an image to be"
+                "thresholded in full. Lower thresholds pass more images with"
+                "weak spots."
+    }
+
     filter
       .help = "Parameters used in the spot finding filter strategy."
 
@@ -156,6 +188,13 @@ def __init__(self, filters=None):
         else:
             self.filters = filters
 
+    @property
+    def needs_shoeboxes(self):
+        """
+        Check if any of the filters need the spot shoeboxes
+        """
+        return any(getattr(f, "needs_shoeboxes", True) for f in self.filters)
+
     def __call__(self, flags, **kwargs):
         """
         Call the filters one by one.
@@ -206,6 +245,10 @@ def check_flags(
 
 
 class PeakCentroidDistanceFilter(object):
+
+    # The peak coordinates can be given instead of the shoeboxes
+    needs_shoeboxes = False
+
     def __init__(self, maxd):
         """
         Initialise
@@ -214,14 +257,19 @@ def __init__(self, maxd):
         """
         self.maxd = maxd
 
-    def run(self, flags, observations=None, shoeboxes=None, **kwargs):
+    def run(
+        self, flags, observations=None, shoeboxes=None, peak_coordinates=None, **kwargs
+    ):
         """
         Run the filtering.
         """
 
         # Get the peak locations and the centroids and return the flags of
         # those closer than the min distance
-        peak = shoeboxes.peak_coordinates()
+        if peak_coordinates is not None:
+            peak = peak_coordinates
+        else:
+            peak = shoeboxes.peak_coordinates()
         cent = observations.centroids().px_position()
         return flags.__and__((peak - cent).norms() <= self.maxd)
 
@@ -239,6 +287,9 @@ def __call__(self, flags, **kwargs):
 
 
 class BackgroundGradientFilter(object):
+
+    needs_shoeboxes = True
+
     def __init__(self, background_size=2, gradient_cutoff=4):
         self.background_size = background_size
         self.gradient_cutoff = gradient_cutoff
@@ -333,6 +384,9 @@ def __call__(self, flags, **kwargs):
 
 
 class SpotDensityFilter(object):
+
+    needs_shoeboxes = False
+
     def __init__(self, nbins=50, gradient_cutoff=0.002):
         self.nbins = nbins
         self.gradient_cutoff = gradient_cutoff
@@ -490,7 +544,26 @@ def configure_threshold(params):
         Algorithm = dials.extensions.SpotFinderThreshold.load(
             params.spotfinder.threshold.algorithm
         )
-        return Algorithm(params)
+        algorithm = Algorithm(params)
+
+        # Skip the threshold on blank images
+        prescreen = params.spotfinder.prescreen
+        if prescreen.enable:
+            from dials.algorithms.spot_finding.threshold import (
+                BlankImageScreen,
+                PrescreenedThreshold,
+            )
+
+            screen = BlankImageScreen(
+                binning=prescreen.binning,
+                kernel_size=prescreen.kernel_size,
+                n_sigma_b=prescreen.sigma_background,
+                n_sigma_s=prescreen.sigma_strong,
+                min_strong=prescreen.min_strong,
+                gain=params.spotfinder.threshold.dispersion.gain,
+            )
+            algorithm = PrescreenedThreshold(algorithm, screen)
+        return algorithm
 
     @staticmethod
     def configure_filter(params):
@@ -8,6 +8,7 @@
 
 from dials.array_family import flex
 from dials.util import Sorry
+from dials.util.memory_accounting import log_memory_usage
 
 logger = logging.getLogger(__name__)
 
@@ -73,10 +74,26 @@ def __call__(self, index):
 
         :param index: The index of the image
         """
-        from dxtbx.imageset import ImageSequence
-
         from dials.model.data import PixelList
 
+        # Threshold the images and create the pixel lists
+        frame, image, threshold_mask = self.threshold_image(index)
+        pixel_list = [
+            PixelList(frame, im, tm) for im, tm in zip(image, threshold_mask)
+        ]
+
+        # Return the result
+        return Result(pixel_list)
+
+    def threshold_image(self, index):
+        """
+        Compute the strong pixel mask for each panel of an image
+
+        :param index: The index of the image
+        :return: The frame number, the image data and the strong pixel masks
+        """
+        from dxtbx.imageset import ImageSequence
+
         # Parallel reading of HDF5 from the same handle is not allowed. Python
         # multiprocessing is a bit messed up and used fork on linux so need to
         # close and reopen file.
@@ -94,9 +111,6 @@ def __call__(self, index):
                 assert all(i1 + 1 == i2 for i1, i2 in zip(ind[0:-1], ind[1:-1]))
             frame = ind[index]
 
-        # Create the list of pixel lists
-        pixel_list = []
-
         # Get the image and mask
         image = self.imageset.get_corrected_data(index)
         mask = self.imageset.get_mask(index)
@@ -111,7 +125,8 @@ def __call__(self, index):
             % (index, sum(m.count(False) for m in mask))
         )
 
-        # Add the images to the pixel lists
+        # Threshold each panel
+        threshold_masks = []
         num_strong = 0
         average_background = 0
         for im, mk in zip(image, mask):
@@ -132,9 +147,7 @@ def __call__(self, index):
             else:
                 threshold_mask = self.threshold_function.compute_threshold(im, mk)
 
-            # Add the pixel list
-            plist = PixelList(frame, im, threshold_mask)
-            pixel_list.append(plist)
+            threshold_masks.append(threshold_mask)
 
             # Get average background
             if self.compute_mean_background:
@@ -142,7 +155,7 @@ def __call__(self, index):
                 average_background += flex.mean(background)
 
             # Add to the spot count
-            num_strong += len(plist)
+            num_strong += threshold_mask.count(True)
 
         # Make average background
         average_background /= len(image)
@@ -171,8 +184,7 @@ def __call__(self, index):
         else:
             logger.info("Found %d strong pixels on image %d" % (num_strong, frame + 1))
 
-        # Return the result
-        return Result(pixel_list)
+        return frame, image, threshold_masks
 
 
 class ExtractPixelsFromImage2DNoShoeboxes(ExtractPixelsFromImage):
@@ -219,6 +231,68 @@ def __call__(self, index):
         """
         Extract strong pixels from an image
 
+        :param index: The index of the image
+        """
+        if getattr(self.filter_spots, "needs_shoeboxes", True):
+            return self._extract_via_shoeboxes(index)
+        from dials.algorithms.spot_finding import StrongSpotCentroider
+
+        # Find the spots and their centroids directly from the threshold masks
+        frame, image, threshold_mask = self.threshold_image(index)
+        observed = flex.observation()
+        bbox = flex.int6()
+        peaks = flex.vec3_double()
+        ntoosmall = 0
+        ntoolarge = 0
+        for panel, (im, tm) in enumerate(zip(image, threshold_mask)):
+            spots = StrongSpotCentroider(
+                panel=panel,
+                frame=frame,
+                image=im,
+                mask=tm,
+                min_pixels=self.min_spot_size,
+                max_pixels=self.max_spot_size,
+            )
+            observed.extend(spots.observations())
+            bbox.extend(spots.bboxes())
+            peaks.extend(spots.peak_coordinates())
+            ntoosmall += spots.num_too_small()
+            ntoolarge += spots.num_too_large()
+        logger.info("")
+        logger.info("Extracted {} spots".format(len(observed) + ntoosmall + ntoolarge))
+        logger.info(
+            "Removed %d spots with size < %d pixels" % (ntoosmall, self.min_spot_size)
+        )
+        logger.info(
+            "Removed %d spots with size > %d pixels" % (ntoolarge, self.max_spot_size)
+        )
+
+        # Filter the spots
+        flags = self.filter_spots(
+            None,
+            sequence=self.imageset,
+            observations=observed,
+            peak_coordinates=peaks,
+        )
+        observed = observed.select(flags)
+        bbox = bbox.select(flags)
+
+        # Create the reflection table
+        centroids = observed.centroids()
+        intensities = observed.intensities()
+        reflections = flex.reflection_table()
+        reflections["panel"] = observed.panels()
+        reflections["xyzobs.px.value"] = centroids.px_position()
+        reflections["xyzobs.px.variance"] = centroids.px_std_err_eq()
+        reflections["intensity.sum.value"] = intensities.observed_value()
+        reflections["intensity.sum.variance"] = intensities.observed_variance()
+        reflections["bbox"] = bbox
+        return [reflections]
+
+    def _extract_via_shoeboxes(self, index):
+        """
+        Extract the spots by creating shoeboxes, for filters which need them
+
         :param index: The index of the image
         """
         from dials.model.data import PixelListLabeller
@@ -291,20 +365,11 @@ def __call__(self, imageset, pixel_labeller):
         """
         Convert the pixel list to shoeboxes
         """
-        from dxtbx.imageset import ImageSequence
-
         # Extract the pixel lists into a list of reflections
         shoeboxes = flex.shoebox()
         spotsizes = flex.size_t()
         hotpixels = tuple(flex.size_t() for i in range(len(imageset.get_detector())))
-        if isinstance(imageset, ImageSequence):
-            scan = imageset.get_scan()
-            if scan.is_still():
-                twod = True
-            else:
-                twod = False
-        else:
-            twod = True
+        twod = is_twod(imageset)
         for i, (p, hp) in enumerate(zip(pixel_labeller, hotpixels)):
             if p.num_pixels() > 0:
                 creator = flex.PixelListShoeboxCreator(
@@ -319,47 +384,139 @@ def __call__(self, imageset, pixel_labeller):
                 shoeboxes.extend(creator.result())
                 spotsizes.extend(creator.spot_size())
                 hp.extend(creator.hot_pixels())
-        logger.info("")
-        logger.info("Extracted {} spots".format(len(shoeboxes)))
-
-        # Get the unallocated spots and print some info
-        selection = shoeboxes.is_allocated()
-        shoeboxes = shoeboxes.select(selection)
-        ntoosmall = (spotsizes < self.min_spot_size).count(True)
-        ntoolarge = (spotsizes > self.max_spot_size).count(True)
-        assert ntoosmall + ntoolarge == selection.count(False)
-        logger.info(
-            "Removed %d spots with size < %d pixels" % (ntoosmall, self.min_spot_size)
-        )
-        logger.info(
-            "Removed %d spots with size > %d pixels" % (ntoolarge, self.max_spot_size)
+        shoeboxes = select_allocated_shoeboxes(
+            shoeboxes, spotsizes, self.min_spot_size, self.max_spot_size
         )
 
         # Return the shoeboxes
         return shoeboxes, hotpixels
 
 
+class IncrementalPixelListToShoeboxes(object):
+    """
+    A helper class to convert the pixel lists to shoeboxes as the images are
+    processed. Each spot is converted to a shoebox as soon as an image is
+    added which has no pixels connected to it, so the strong pixels from the
+    whole imageset do not need to be kept. The shoeboxes are the same and in
+    the same order as those from PixelListToShoeboxes.
+    """
+
+    def __init__(self, imageset, min_spot_size, max_spot_size, write_hot_pixel_mask):
+        """
+        Initialize
+        """
+        self.min_spot_size = min_spot_size
+        self.max_spot_size = max_spot_size
+        twod = is_twod(imageset)
+        self.creators = [
+            flex.IncrementalPixelListShoeboxCreator(
+                panel=i,
+                zstart=0,
+                twod=twod,
+                min_pixels=min_spot_size,
+                max_pixels=max_spot_size,
+                find_hot_pixels=write_hot_pixel_mask,
+            )
+            for i in range(len(imageset.get_detector()))
+        ]
+        self.shoeboxes = [flex.shoebox() for c in self.creators]
+        self.spotsizes = [flex.size_t() for c in self.creators]
+        self.order = [flex.size_t() for c in self.creators]
+
+    def add(self, pixel_list):
+        """
+        Add the pixel lists for the next image
+        """
+        assert len(self.creators) == len(pixel_list), "Inconsistent size"
+        for i, (creator, plist) in enumerate(zip(self.creators, pixel_list)):
+            creator.add(plist)
+            self._collect(i)
+
+    def finish(self):
+        """
+        Finish the spots and return the shoeboxes
+        """
+        shoeboxes = flex.shoebox()
+        spotsizes = flex.size_t()
+        hotpixels = []
+        for i, creator in enumerate(self.creators):
+            creator.finish()
+            self._collect(i)
+            order = flex.sort_permutation(self.order[i])
+            shoeboxes.extend(self.shoeboxes[i].select(order))
+            spotsizes.extend(self.spotsizes[i].select(order))
+            hotpixels.append(creator.hot_pixels())
+        self.shoeboxes = self.spotsizes = self.order = None
+        shoeboxes = select_allocated_shoeboxes(
+            shoeboxes, spotsizes, self.min_spot_size, self.max_spot_size
+        )
+        return shoeboxes, tuple(hotpixels)
+
+    def _collect(self, i):
+        """
+        Take the finished shoeboxes from a creator
+        """
+        creator = self.creators[i]
+        self.shoeboxes[i].extend(creator.result())
+        self.spotsizes[i].extend(creator.spot_size())
+        self.order[i].extend(creator.spot_order())
+        creator.clear()
+
+
+def is_twod(imageset):
+    """
+    Check if the spots should be labelled on each image separately
+    """
+    from dxtbx.imageset import ImageSequence
+
+    if isinstance(imageset, ImageSequence):
+        return imageset.get_scan().is_still()
+    return True
+
+
+def select_allocated_shoeboxes(shoeboxes, spotsizes, min_spot_size, max_spot_size):
+    """
+    Remove the shoeboxes which are too big or too small and print some info
+    """
+    logger.info("")
+    logger.info("Extracted {} spots".format(len(shoeboxes)))
+
+    # Get the unallocated spots and print some info
+    selection = shoeboxes.is_allocated()
+    shoeboxes = shoeboxes.select(selection)
+    ntoosmall = (spotsizes < min_spot_size).count(True)
+    ntoolarge = (spotsizes > max_spot_size).count(True)
+    assert ntoosmall + ntoolarge == selection.count(False)
+    logger.info("Removed %d spots with size < %d pixels" % (ntoosmall, min_spot_size))
+    logger.info("Removed %d spots with size > %d pixels" % (ntoolarge, max_spot_size))
+    return shoeboxes
+
+
 class ShoeboxesToReflectionTable(object):
     """
     A class to filter shoeboxes and create reflection table
     """
 
-    def __init__(self, filter_spots):
+    def __init__(self, filter_spots, nthreads=1):
         """
         Initialise the reflection table creator
+
+        :param filter_spots: The spot filter
+        :param nthreads: The number of threads for the shoebox calculations
         """
         self.filter_spots = filter_spots
+        self.nthreads = nthreads
 
     def __call__(self, imageset, shoeboxes):
         """
         Filter shoeboxes and create reflection table
         """
         # Calculate the spot centroids
-        centroid = shoeboxes.centroid_valid()
+        centroid = shoeboxes.centroid_valid(nthreads=self.nthreads)
         logger.info("Calculated {} spot centroids".format(len(shoeboxes)))
 
         # Calculate the spot intensities
-        intensity = shoeboxes.summed_intensity()
+        intensity = shoeboxes.summed_intensity(nthreads=self.nthreads)
         logger.info("Calculated {} spot intensities".format(len(shoeboxes)))
 
         # Create the observations
@@ -488,7 +645,6 @@ def _find_spots(self, imageset):
         :param imageset: The imageset to process
         :return: The list of spot shoeboxes
         """
-        from dials.model.data import PixelListLabeller
         from dials.util.mp import batch_multi_node_parallel_map
 
         # Change the number of processors if necessary
@@ -534,9 +690,13 @@ def _find_spots(self, imageset):
         # The indices to iterate over
         indices = list(range(len(imageset)))
 
-        # Initialise the pixel labeller
-        num_panels = len(imageset.get_detector())
-        pixel_labeller = [PixelListLabeller() for p in range(num_panels)]
+        # Initialise the conversion of the pixel lists to shoeboxes
+        to_shoeboxes = IncrementalPixelListToShoeboxes(
+            imageset,
+            self.min_spot_size,
+            self.max_spot_size,
+            self.write_hot_pixel_mask,
+        )
 
         # Do the processing
         logger.info("Extracting strong pixels from images")
@@ -552,11 +712,7 @@ def _find_spots(self, imageset):
             def process_output(result):
                 for message in result[1]:
                     logger.log(message.levelno, message.msg)
-                assert len(pixel_labeller) == len(
-                    result[0].pixel_list
-                ), "Inconsistent size"
-                for plabeller, plist in zip(pixel_labeller, result[0].pixel_list):
-                    plabeller.add(plist)
+                to_shoeboxes.add(result[0].pixel_list)
                 result[0].pixel_list = None
 
             batch_multi_node_parallel_map(
@@ -571,21 +727,18 @@ def process_output(result):
         else:
             for task in indices:
                 result = function(task)
-                assert len(pixel_labeller) == len(
-                    result.pixel_list
-                ), "Inconsistent size"
-                for plabeller, plist in zip(pixel_labeller, result.pixel_list):
-                    plabeller.add(plist)
-                    result.pixel_list = None
-
-        # Create shoeboxes from pixel list
-        converter = PixelListToReflectionTable(
-            self.min_spot_size,
-            self.max_spot_size,
-            self.filter_spots,
-            self.write_hot_pixel_mask,
+                to_shoeboxes.add(result.pixel_list)
+                result.pixel_list = None
+
+        # Create the reflection table from the shoeboxes
+        log_memory_usage("strong pixel extraction")
+        shoeboxes, hot_pixels = to_shoeboxes.finish()
+        converter = ShoeboxesToReflectionTable(
+            self.filter_spots, nthreads=self.mp_nproc
         )
-        return converter(imageset, pixel_labeller)
+        reflections = converter(imageset, shoeboxes)
+        log_memory_usage("spot extraction")
+        return reflections, hot_pixels
 
     def _find_spots_2d_no_shoeboxes(self, imageset):
         """
@@ -11,6 +11,10 @@
 #ifndef DIALS_ALGORITHMS_SPOT_FINDING_HELPERS_H
 #define DIALS_ALGORITHMS_SPOT_FINDING_HELPERS_H
 
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <dials/algorithms/image/connected_components/connected_components.h>
@@ -33,55 +37,30 @@ namespace dials { namespace algorithms {
 
     af::shared<Shoebox<> > shoeboxes() {
       typedef Shoebox<>::float_type float_type;
+      if (shoeboxes_.size() == 0) {
+        return af::shared<Shoebox<> >();
+      }
 
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
-
-      // Create the edges between shoeboxes
-      AdjacencyList graph(shoeboxes_.size());
-      for (std::size_t s1 = 0; s1 < shoeboxes_.size() - 1; ++s1) {
-        std::size_t panel1 = shoeboxes_[s1].panel;
-        int6 bbox1 = shoeboxes_[s1].bbox;
-        for (std::size_t s2 = s1 + 1; s2 < shoeboxes_.size(); ++s2) {
-          std::size_t panel2 = shoeboxes_[s2].panel;
-          int6 bbox2 = shoeboxes_[s2].bbox;
-          if (panel1 == panel2 && bbox1[5] == bbox2[4]
-              && (bbox1[0] < bbox2[1] && bbox1[1] > bbox2[0] && bbox1[2] < bbox2[3]
-                  && bbox1[3] > bbox2[2])) {
-            af::const_ref<int, af::c_grid<3> > mask1 = shoeboxes_[s1].mask.const_ref();
-            af::const_ref<int, af::c_grid<3> > mask2 = shoeboxes_[s2].mask.const_ref();
-            int x0 = std::max(bbox1[0], bbox2[0]);
-            int x1 = std::min(bbox1[1], bbox2[1]);
-            int y0 = std::max(bbox1[2], bbox2[2]);
-            int y1 = std::min(bbox1[3], bbox2[3]);
-            int k1 = mask1.accessor()[0] - 1;
-            int k2 = 0;
-            for (int y = y0; y < y1; ++y) {
-              for (int x = x0; x < x1; ++x) {
-                int i1 = x - bbox1[0];
-                int i2 = x - bbox2[0];
-                int j1 = y - bbox1[2];
-                int j2 = y - bbox2[2];
-                DIALS_ASSERT(i1 >= 0 && i1 < mask1.accessor()[2]);
-                DIALS_ASSERT(i2 >= 0 && i2 < mask2.accessor()[2]);
-                DIALS_ASSERT(j1 >= 0 && j1 < mask1.accessor()[1]);
-                DIALS_ASSERT(j2 >= 0 && j2 < mask2.accessor()[1]);
-                if ((mask1(k1, j1, i1) & Foreground)
-                    && (mask2(k2, j2, i2) & Foreground)) {
-                  boost::add_edge(s1, s2, graph);
-                }
-              }
-            }
-          }
-        }
+      // Group the shoeboxes by panel and by the frames they start and end
+      // on, since a shoebox can only be joined to one which starts on the
+      // frame where it ends. The shoeboxes in each group are then compared
+      // with a sweep over x so only those which overlap have their masks
+      // compared.
+      typedef std::map<std::pair<std::size_t, int>, BoundaryGroup> group_map;
+      group_map groups;
+      for (std::size_t i = 0; i < shoeboxes_.size(); ++i) {
+        std::size_t panel = shoeboxes_[i].panel;
+        groups[std::make_pair(panel, shoeboxes_[i].bbox[5])].ending.push_back(i);
+        groups[std::make_pair(panel, shoeboxes_[i].bbox[4])].starting.push_back(i);
+      }
+      UnionFind forest(shoeboxes_.size());
+      for (group_map::iterator it = groups.begin(); it != groups.end(); ++it) {
+        join_group(forest, it->second);
       }
 
       // Do the connected components
-      af::shared<int> labels(num_vertices(graph), af::init_functor_null<int>());
+      af::shared<int> labels = forest.labels();
       DIALS_ASSERT(labels.size() == shoeboxes_.size());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
 
       // Get the number of labels and allocate the array
       std::size_t max_label = af::max(labels.const_ref());
@@ -158,6 +137,108 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * The shoeboxes on a panel which end and start on the same frame
+     */
+    struct BoundaryGroup {
+      std::vector<std::size_t> ending;
+      std::vector<std::size_t> starting;
+    };
+
+    /**
+     * Compare the shoeboxes by the start of their bounding box in x
+     */
+    struct XStartLess {
+      const af::shared<Shoebox<> > &shoeboxes;
+      XStartLess(const af::shared<Shoebox<> > &shoeboxes_) : shoeboxes(shoeboxes_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return shoeboxes[a].bbox[0] < shoeboxes[b].bbox[0];
+      }
+    };
+
+    /**
+     * Join the shoeboxes in a group which end and start on the same frame.
+     * The shoeboxes are visited in order of the start of their bounding box
+     * in x and each is compared to the shoeboxes of the other kind which are
+     * still open at that x.
+     * @param forest The union find forest
+     * @param group The group of shoeboxes
+     */
+    void join_group(UnionFind &forest, BoundaryGroup &group) const {
+      if (group.ending.empty() || group.starting.empty()) {
+        return;
+      }
+      XStartLess less(shoeboxes_);
+      std::sort(group.ending.begin(), group.ending.end(), less);
+      std::sort(group.starting.begin(), group.starting.end(), less);
+      std::vector<std::size_t> open_ending, open_starting;
+      std::size_t ie = 0, is = 0;
+      while (ie < group.ending.size() || is < group.starting.size()) {
+        bool is_ending = is == group.starting.size()
+                         || (ie < group.ending.size()
+                             && less(group.ending[ie], group.starting[is]));
+        std::size_t s = is_ending ? group.ending[ie++] : group.starting[is++];
+        std::vector<std::size_t> &open = is_ending ? open_starting : open_ending;
+        const int6 &bbox = shoeboxes_[s].bbox;
+
+        // Drop the shoeboxes which end before this one starts and compare
+        // those which overlap in y
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < open.size(); ++i) {
+          const int6 &other = shoeboxes_[open[i]].bbox;
+          if (other[1] <= bbox[0]) {
+            continue;
+          }
+          open[n++] = open[i];
+          if (other[2] < bbox[3] && other[3] > bbox[2]) {
+            std::size_t s1 = is_ending ? s : open[i];
+            std::size_t s2 = is_ending ? open[i] : s;
+            if (s1 < s2 && foreground_touches(s1, s2)) {
+              forest.join(s1, s2);
+            }
+          }
+        }
+        open.resize(n);
+        (is_ending ? open_ending : open_starting).push_back(s);
+      }
+    }
+
+    /**
+     * Check if the foreground on the last frame of one shoebox touches the
+     * foreground on the first frame of the next.
+     * @param s1 The shoebox which ends on the frame
+     * @param s2 The shoebox which starts on the frame
+     * @returns True/False the shoeboxes are connected
+     */
+    bool foreground_touches(std::size_t s1, std::size_t s2) const {
+      const int6 &bbox1 = shoeboxes_[s1].bbox;
+      const int6 &bbox2 = shoeboxes_[s2].bbox;
+      af::const_ref<int, af::c_grid<3> > mask1 = shoeboxes_[s1].mask.const_ref();
+      af::const_ref<int, af::c_grid<3> > mask2 = shoeboxes_[s2].mask.const_ref();
+      int x0 = std::max(bbox1[0], bbox2[0]);
+      int x1 = std::min(bbox1[1], bbox2[1]);
+      int y0 = std::max(bbox1[2], bbox2[2]);
+      int y1 = std::min(bbox1[3], bbox2[3]);
+      int k1 = mask1.accessor()[0] - 1;
+      int k2 = 0;
+      for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+          int i1 = x - bbox1[0];
+          int i2 = x - bbox2[0];
+          int j1 = y - bbox1[2];
+          int j2 = y - bbox2[2];
+          DIALS_ASSERT(i1 >= 0 && i1 < mask1.accessor()[2]);
+          DIALS_ASSERT(i2 >= 0 && i2 < mask2.accessor()[2]);
+          DIALS_ASSERT(j1 >= 0 && j1 < mask1.accessor()[1]);
+          DIALS_ASSERT(j2 >= 0 && j2 < mask2.accessor()[1]);
+          if ((mask1(k1, j1, i1) & Foreground) && (mask2(k2, j2, i2) & Foreground)) {
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
     af::shared<Shoebox<> > shoeboxes_;
   };
 
@@ -0,0 +1,641 @@
+/*
+ * per_image_analysis.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_ANALYSIS_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_ANALYSIS_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/math/special_functions/sign.hpp>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    /**
+     * A spot with a non zero reciprocal lattice vector
+     */
+    struct AnalysisSpot {
+      double norm;       // The length of the reciprocal lattice vector
+      double d_star_sq;  // 1/d^2
+      double d;          // The resolution
+      double intensity;
+      double variance;
+      bool ice;  // On an ice ring
+    };
+
+    /**
+     * Index of the first maximum, as flex.max_index
+     */
+    inline std::size_t max_index(const std::vector<double> &a, std::size_t first = 0) {
+      DIALS_ASSERT(first < a.size());
+      std::size_t result = first;
+      for (std::size_t i = first + 1; i < a.size(); ++i) {
+        if (a[i] > a[result]) {
+          result = i;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * A stable sort permutation, as flex.sort_permutation
+     */
+    struct LessByValue {
+      const std::vector<double> *values;
+      bool operator()(std::size_t a, std::size_t b) const {
+        return (*values)[a] < (*values)[b];
+      }
+    };
+
+    struct GreaterByValue {
+      const std::vector<double> *values;
+      bool operator()(std::size_t a, std::size_t b) const {
+        return (*values)[a] > (*values)[b];
+      }
+    };
+
+    inline std::vector<std::size_t> sort_permutation(const std::vector<double> &a,
+                                                     bool reverse) {
+      std::vector<std::size_t> result(a.size());
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = i;
+      }
+      if (reverse) {
+        GreaterByValue compare = {&a};
+        std::stable_sort(result.begin(), result.end(), compare);
+      } else {
+        LessByValue compare = {&a};
+        std::stable_sort(result.begin(), result.end(), compare);
+      }
+      return result;
+    }
+
+    /**
+     * A least squares straight line, as flex.linear_regression
+     */
+    inline void linear_regression(const std::vector<double> &x,
+                                  const std::vector<double> &y,
+                                  double &slope,
+                                  double &intercept) {
+      DIALS_ASSERT(x.size() == y.size());
+      slope = 0;
+      intercept = 0;
+      if (x.empty()) {
+        return;
+      }
+      double x_mean = 0, y_mean = 0;
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        x_mean += x[i];
+        y_mean += y[i];
+      }
+      x_mean /= x.size();
+      y_mean /= y.size();
+      double sum_xx = 0, sum_xy = 0;
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        double dx = x[i] - x_mean;
+        sum_xx += dx * dx;
+        sum_xy += dx * (y[i] - y_mean);
+      }
+      if (sum_xx > 1e-15) {
+        slope = sum_xy / sum_xx;
+        intercept = y_mean - slope * x_mean;
+      }
+    }
+
+    /**
+     * Flag the outliers from the Wilson distribution in a resolution shell,
+     * iterating until there are none left. The mean is taken from the spots
+     * which are not on ice rings.
+     */
+    inline std::vector<bool> wilson_outliers(const std::vector<double> &intensity,
+                                             const std::vector<bool> &ice) {
+      const double E_cutoff = std::sqrt(-std::log(1e-2));
+      std::vector<bool> outliers(intensity.size(), false);
+      double sigma_n = 0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < intensity.size(); ++i) {
+        if (!ice[i]) {
+          sigma_n += intensity[i];
+          count++;
+        }
+      }
+      if (count == 0) {
+        return outliers;
+      }
+      sigma_n /= count;
+      std::vector<double> inlier_intensity;
+      std::vector<bool> inlier_ice;
+      std::vector<std::size_t> inliers;
+      for (std::size_t i = 0; i < intensity.size(); ++i) {
+        outliers[i] = std::sqrt(intensity[i]) / std::sqrt(sigma_n) >= E_cutoff;
+        if (!outliers[i]) {
+          inliers.push_back(i);
+          inlier_intensity.push_back(intensity[i]);
+          inlier_ice.push_back(ice[i]);
+        }
+      }
+      if (inliers.size() < intensity.size()) {
+        std::vector<bool> more = wilson_outliers(inlier_intensity, inlier_ice);
+        for (std::size_t i = 0; i < inliers.size(); ++i) {
+          outliers[inliers[i]] = more[i];
+        }
+      }
+      return outliers;
+    }
+
+    /**
+     * Estimate the resolution limit from the fall off of I/sigma, as
+     * per_image_analysis.estimate_resolution_limit. The spots must all have a
+     * positive variance.
+     */
+    inline double estimate_resolution_limit(const std::vector<AnalysisSpot> &spots) {
+      std::size_t n = spots.size();
+      if (n == 0) {
+        return -1;
+      }
+      std::vector<double> d_star_sq(n), log_i_over_sigi(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        d_star_sq[i] = spots[i].d_star_sq;
+        log_i_over_sigi[i] =
+          std::log(spots[i].intensity / std::sqrt(spots[i].variance));
+      }
+
+      // Bins with an equal number of spots
+      std::size_t n_slots = std::max(std::min(n / 20, (std::size_t)20), (std::size_t)5);
+      double n_per_bin = (double)n / n_slots;
+      std::vector<double> d_sorted(d_star_sq);
+      std::sort(d_sorted.begin(), d_sorted.end());
+      for (std::size_t i = 0; i < n; ++i) {
+        d_sorted[i] = 1.0 / std::sqrt(d_sorted[i]);
+      }
+
+      // The upper and lower percentiles of I/sigma in each bin
+      std::vector<double> lower_x, lower_y, upper_x, upper_y;
+      std::vector<bool> outliers_all(n, false);
+      double d_max = d_sorted[0];
+      for (std::size_t slot = 0; slot < n_slots; ++slot) {
+        int index = (int)std::floor((slot + 1) * n_per_bin + 0.5) - 1;
+        DIALS_ASSERT(index >= 0 && index < (int)n);
+        double d_min = d_sorted[index];
+        std::vector<std::size_t> in_slot;
+        std::size_t num_no_ice = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+          if (spots[i].d < d_max && spots[i].d >= d_min) {
+            in_slot.push_back(i);
+            num_no_ice += spots[i].ice ? 0 : 1;
+          }
+        }
+        d_max = d_min;
+        if (num_no_ice == 0) {
+          continue;
+        }
+        std::vector<double> intensity(in_slot.size());
+        std::vector<bool> ice(in_slot.size());
+        for (std::size_t i = 0; i < in_slot.size(); ++i) {
+          intensity[i] = spots[in_slot[i]].intensity;
+          ice[i] = spots[in_slot[i]].ice;
+        }
+        std::vector<bool> outliers = wilson_outliers(intensity, ice);
+        std::vector<double> x, y;
+        for (std::size_t i = 0; i < in_slot.size(); ++i) {
+          outliers_all[in_slot[i]] = outliers[i];
+          if (!outliers[i] && !ice[i]) {
+            x.push_back(d_star_sq[in_slot[i]]);
+            y.push_back(log_i_over_sigi[in_slot[i]]);
+          }
+        }
+        std::vector<std::size_t> perm = sort_permutation(y, false);
+        std::size_t i_lower = perm[(std::size_t)std::floor(0.1 * perm.size())];
+        std::size_t i_upper = perm[(std::size_t)std::floor(0.9 * perm.size())];
+        lower_y.push_back(y[i_lower]);
+        upper_y.push_back(y[i_upper]);
+        upper_x.push_back(x[i_lower]);
+        lower_x.push_back(x[i_upper]);
+      }
+
+      // The spots below the upper line
+      double m_upper, c_upper, m_lower, c_lower;
+      linear_regression(upper_x, upper_y, m_upper, c_upper);
+      linear_regression(lower_x, lower_y, m_lower, c_lower);
+      if (m_upper == m_lower) {
+        return -1;
+      }
+      double d_star_sq_max = 0;
+      bool found = false;
+      for (std::size_t i = 0; i < n; ++i) {
+        // The side of the line as points_below_line, including -0
+        double side = d_star_sq[i] * -m_upper + (log_i_over_sigi[i] - c_upper);
+        if (boost::math::signbit(side) && !outliers_all[i] && !spots[i].ice) {
+          if (!found || d_star_sq[i] > d_star_sq_max) {
+            d_star_sq_max = d_star_sq[i];
+            found = true;
+          }
+        }
+      }
+      return found ? 1.0 / std::sqrt(d_star_sq_max) : -1;
+    }
+
+    /**
+     * Method 1 (section 2.4.4) of Zhang et al. J. Appl. Cryst. (2006). 39,
+     * 112-119, as per_image_analysis.estimate_resolution_limit_distl_method1.
+     * The spots must all have a positive variance.
+     */
+    inline void estimate_resolution_limit_distl_method1(
+      const std::vector<AnalysisSpot> &spots,
+      double &d_min,
+      double &noisiness) {
+      std::size_t n = spots.size();
+      std::vector<double> d(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        d[i] = spots[i].d;
+      }
+      std::size_t step = 2;
+      while ((double)n / step > 40) {
+        step++;
+      }
+      std::vector<std::size_t> order = sort_permutation(d, true);
+      std::vector<double> ds3, d_subset;
+      for (std::size_t i = 0; i < n / step; ++i) {
+        ds3.push_back(std::pow(spots[order[i * step]].norm, 3.0));
+        d_subset.push_back(d[order[i * step]]);
+      }
+      if (ds3.size() < 5) {
+        d_min = -1;
+        noisiness = -1;
+        return;
+      }
+
+      // (i) The point with the largest slope from the first point
+      std::vector<double> slopes(ds3.size() - 1);
+      for (std::size_t i = 1; i < ds3.size(); ++i) {
+        slopes[i - 1] = (ds3[i] - ds3[0]) / i;
+      }
+      std::size_t p_m = max_index(slopes, 3) + 1;
+
+      // (ii) The gaps between the points and the line to the point
+      double vx = ds3[p_m] - ds3[0];
+      double vy = -(double)p_m;
+      double length = std::sqrt(vx * vx + vy * vy);
+      vx /= length;
+      vy /= length;
+      std::vector<double> gaps(1, 0.0);
+      for (std::size_t i = 1; i < p_m; ++i) {
+        gaps.push_back(std::abs(vx * (0.0 - i) + vy * (ds3[0] - ds3[i])));
+      }
+      double mean = 0;
+      for (std::size_t i = 0; i < gaps.size(); ++i) {
+        mean += gaps[i];
+      }
+      mean /= gaps.size();
+      double var = 0;
+      for (std::size_t i = 0; i < gaps.size(); ++i) {
+        var += (gaps[i] - mean) * (gaps[i] - mean);
+      }
+      double s = std::sqrt(var / (gaps.size() - 1));
+
+      // (iii) The last point with a gap close to the largest
+      std::size_t p_k = max_index(gaps);
+      double g_k = gaps[p_k];
+      std::size_t p_g = p_k;
+      for (std::size_t i = p_k + 1; i < gaps.size(); ++i) {
+        if (gaps[i] > g_k - 0.5 * s) {
+          p_g = i;
+        }
+      }
+      d_min = d_subset[p_g];
+
+      double count = 0;
+      std::size_t m = ds3.size();
+      for (std::size_t i = 0; i + 1 < m; ++i) {
+        for (std::size_t j = i + 1; j + 1 < m; ++j) {
+          if (slopes[i] >= slopes[j]) {
+            count += 1;
+          }
+        }
+      }
+      noisiness = count / ((m - 1) * (m - 2) / 2.0);
+    }
+
+    /**
+     * Method 2 (section 2.4.4) of Zhang et al. J. Appl. Cryst. (2006). 39,
+     * 112-119, as per_image_analysis.estimate_resolution_limit_distl_method2.
+     * The spots must all have a positive variance.
+     */
+    inline void estimate_resolution_limit_distl_method2(
+      const std::vector<AnalysisSpot> &spots,
+      double &d_min,
+      double &noisiness) {
+      // Bins of equal volume in reciprocal space from the unique d spacings
+      std::vector<double> unique(spots.size());
+      for (std::size_t i = 0; i < spots.size(); ++i) {
+        unique[i] = spots[i].d;
+      }
+      std::sort(unique.begin(), unique.end(), std::greater<double>());
+      unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+      std::size_t n = unique.size();
+      std::size_t low_res_count = (std::size_t)std::ceil(
+        std::min(std::max(25.0, 0.05 * n), 0.25 * n));
+      if (low_res_count >= n) {
+        d_min = -1;
+        noisiness = -1;
+        return;
+      }
+      std::vector<double> ds3(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        ds3[i] = std::pow(1.0 / unique[i], 3.0);
+      }
+      double bin_step = ds3[low_res_count] - ds3[0];
+      DIALS_ASSERT(bin_step > 0);
+      std::size_t n_slots = (std::size_t)std::ceil((ds3[n - 1] - ds3[0]) / bin_step);
+      n_slots = std::max(std::min(n_slots, (std::size_t)40), (std::size_t)20);
+      bin_step = (ds3[n - 1] - ds3[0]) / n_slots;
+      std::vector<double> slot_d_min(n_slots), slot_d_max(n_slots);
+      double ds3_max = ds3[0];
+      for (std::size_t i = 0; i < n_slots; ++i) {
+        double ds3_min = ds3[0] + (i + 1) * bin_step;
+        slot_d_min[i] = 1.0 / std::pow(ds3_min, 1.0 / 3.0);
+        slot_d_max[i] = 1.0 / std::pow(ds3_max, 1.0 / 3.0);
+        ds3_max = ds3_min;
+      }
+
+      // Count the spots in each bin
+      std::vector<std::size_t> counts(n_slots, 0);
+      for (std::size_t i = 0; i < n_slots; ++i) {
+        for (std::size_t j = 0; j < spots.size(); ++j) {
+          if (spots[j].d < slot_d_max[i] && spots[j].d >= slot_d_min[i]) {
+            counts[i]++;
+          }
+        }
+      }
+
+      // The first pair of bins with few spots
+      double t0 = (counts[0] + counts[1]) / 2.0;
+      const double mu = 0.15;
+      std::size_t i = 0;
+      for (; i + 1 < n_slots; ++i) {
+        if (counts[i] < mu * t0 && counts[i + 1] < mu * t0) {
+          break;
+        }
+      }
+      d_min = slot_d_min[std::min(i, n_slots - 2)];
+
+      double count = 0;
+      for (std::size_t i = 0; i < n_slots; ++i) {
+        for (std::size_t j = i + 1; j < n_slots; ++j) {
+          if (counts[i] <= counts[j]) {
+            count += 1;
+          }
+        }
+      }
+      noisiness = count / (0.5 * n_slots * (n_slots - 1));
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute the per image analysis statistics for the strong spots on every
+   * image of a sweep in one pass. The spots are grouped by image and the
+   * images are analysed in parallel. The statistics are the same as those
+   * of per_image_analysis.stats_for_reflection_table for the spots on each
+   * image, together with the fraction of spots on ice rings and the number
+   * of spots in each of a set of resolution shells.
+   */
+  class PerImageAnalysis {
+  public:
+    /**
+     * Compute the statistics
+     * @param image The image index of each spot (from 0)
+     * @param rlp_norm The length of the reciprocal lattice vector of each spot
+     * @param intensity The summed intensity of each spot
+     * @param variance The variance of the summed intensity of each spot
+     * @param num_images The number of images
+     * @param ice_rings The 1/d^2 of the ice rings (empty to not filter)
+     * @param ice_ring_width The width of the ice rings in 1/d^2
+     * @param shells The 1/d^2 bounds of the resolution shells to count
+     * @param resolution_analysis Estimate the resolution limits
+     * @param nthreads The number of threads
+     */
+    PerImageAnalysis(const af::const_ref<int> &image,
+                     const af::const_ref<double> &rlp_norm,
+                     const af::const_ref<double> &intensity,
+                     const af::const_ref<double> &variance,
+                     std::size_t num_images,
+                     const af::const_ref<double> &ice_rings,
+                     double ice_ring_width,
+                     const af::const_ref<double> &shells,
+                     bool resolution_analysis,
+                     std::size_t nthreads)
+        : n_spots_total_(num_images),
+          n_spots_no_ice_(num_images),
+          n_spots_4A_(num_images),
+          total_intensity_(num_images),
+          ice_ring_fraction_(num_images),
+          estimated_d_min_(num_images),
+          d_min_distl_method_1_(num_images),
+          noisiness_method_1_(num_images),
+          d_min_distl_method_2_(num_images),
+          noisiness_method_2_(num_images),
+          shell_counts_(
+            af::c_grid<2>(num_images, shells.size() > 0 ? shells.size() - 1 : 0),
+            0),
+          ice_rings_(ice_rings.begin(), ice_rings.end()),
+          ice_ring_half_width_(ice_ring_width / 2.0),
+          shells_(shells.begin(), shells.end()),
+          resolution_analysis_(resolution_analysis) {
+      DIALS_ASSERT(rlp_norm.size() == image.size());
+      DIALS_ASSERT(intensity.size() == image.size());
+      DIALS_ASSERT(variance.size() == image.size());
+      DIALS_ASSERT(nthreads > 0);
+      for (std::size_t i = 1; i < shells_.size(); ++i) {
+        DIALS_ASSERT(shells_[i] > shells_[i - 1]);
+      }
+
+      // Group the spots by image, keeping them in order
+      offset_.assign(num_images + 1, 0);
+      for (std::size_t i = 0; i < image.size(); ++i) {
+        if (image[i] >= 0 && image[i] < (int)num_images && rlp_norm[i] > 0) {
+          offset_[image[i] + 1]++;
+        }
+      }
+      for (std::size_t i = 0; i < num_images; ++i) {
+        offset_[i + 1] += offset_[i];
+      }
+      spots_.resize(offset_[num_images]);
+      std::vector<std::size_t> next(offset_.begin(), offset_.end() - 1);
+      for (std::size_t i = 0; i < image.size(); ++i) {
+        if (image[i] >= 0 && image[i] < (int)num_images && rlp_norm[i] > 0) {
+          detail::AnalysisSpot &spot = spots_[next[image[i]]++];
+          spot.norm = rlp_norm[i];
+          spot.d_star_sq = rlp_norm[i] * rlp_norm[i];
+          spot.d = 1.0 / std::sqrt(spot.d_star_sq);
+          spot.intensity = intensity[i];
+          spot.variance = variance[i];
+          spot.ice = false;
+        }
+      }
+
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PerImageAnalysis::analyse_images, this, _1, _2),
+        num_images,
+        nthreads);
+      std::vector<detail::AnalysisSpot>().swap(spots_);
+    }
+
+    /** @returns The number of spots on each image */
+    af::shared<std::size_t> n_spots_total() const {
+      return n_spots_total_;
+    }
+
+    /** @returns The number of spots not on ice rings on each image */
+    af::shared<std::size_t> n_spots_no_ice() const {
+      return n_spots_no_ice_;
+    }
+
+    /** @returns The number of spots at lower resolution than 4A on each image */
+    af::shared<std::size_t> n_spots_4A() const {
+      return n_spots_4A_;
+    }
+
+    /** @returns The total intensity of the spots not on ice rings */
+    af::shared<double> total_intensity() const {
+      return total_intensity_;
+    }
+
+    /** @returns The fraction of spots on ice rings on each image */
+    af::shared<double> ice_ring_fraction() const {
+      return ice_ring_fraction_;
+    }
+
+    /** @returns The resolution estimated from I/sigma (or -1) */
+    af::shared<double> estimated_d_min() const {
+      return estimated_d_min_;
+    }
+
+    /** @returns The resolution estimated by distl method 1 (or -1) */
+    af::shared<double> d_min_distl_method_1() const {
+      return d_min_distl_method_1_;
+    }
+
+    /** @returns The noisiness of distl method 1 (or -1) */
+    af::shared<double> noisiness_method_1() const {
+      return noisiness_method_1_;
+    }
+
+    /** @returns The resolution estimated by distl method 2 (or -1) */
+    af::shared<double> d_min_distl_method_2() const {
+      return d_min_distl_method_2_;
+    }
+
+    /** @returns The noisiness of distl method 2 (or -1) */
+    af::shared<double> noisiness_method_2() const {
+      return noisiness_method_2_;
+    }
+
+    /** @returns The number of spots in each shell on each image */
+    af::versa<std::size_t, af::c_grid<2> > shell_counts() const {
+      return shell_counts_;
+    }
+
+  private:
+    /**
+     * Analyse the spots on a range of images
+     */
+    void analyse_images(std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        analyse_image(i);
+      }
+    }
+
+    /**
+     * Analyse the spots on an image
+     */
+    void analyse_image(std::size_t index) {
+      std::vector<detail::AnalysisSpot> spots(spots_.begin() + offset_[index],
+                                              spots_.begin() + offset_[index + 1]);
+      std::size_t n_total = spots.size();
+      std::size_t n_no_ice = 0;
+      std::size_t n_4A = 0;
+      double total_intensity = 0;
+      std::size_t num_shells = shell_counts_.accessor()[1];
+      for (std::size_t i = 0; i < spots.size(); ++i) {
+        detail::AnalysisSpot &spot = spots[i];
+        double d_star_sq = 1.0 / (spot.d * spot.d);
+        for (std::size_t j = 0; j < ice_rings_.size(); ++j) {
+          if (std::abs(d_star_sq - ice_rings_[j]) < ice_ring_half_width_) {
+            spot.ice = true;
+            break;
+          }
+        }
+        if (!spot.ice) {
+          n_no_ice++;
+          total_intensity += spot.intensity;
+        }
+        n_4A += spot.d > 4 ? 1 : 0;
+        if (num_shells > 0 && spot.d_star_sq >= shells_.front()
+            && spot.d_star_sq < shells_.back()) {
+          std::size_t shell =
+            std::upper_bound(shells_.begin(), shells_.end(), spot.d_star_sq)
+            - shells_.begin() - 1;
+          shell_counts_(index, shell)++;
+        }
+      }
+      n_spots_total_[index] = n_total;
+      n_spots_no_ice_[index] = n_no_ice;
+      n_spots_4A_[index] = n_4A;
+      total_intensity_[index] = total_intensity;
+      ice_ring_fraction_[index] =
+        n_total > 0 ? (double)(n_total - n_no_ice) / n_total : 0.0;
+
+      estimated_d_min_[index] = -1;
+      d_min_distl_method_1_[index] = -1;
+      noisiness_method_1_[index] = -1;
+      d_min_distl_method_2_[index] = -1;
+      noisiness_method_2_[index] = -1;
+      if (resolution_analysis_ && n_no_ice > 10) {
+        std::vector<detail::AnalysisSpot> valid;
+        for (std::size_t i = 0; i < spots.size(); ++i) {
+          if (spots[i].variance > 0) {
+            valid.push_back(spots[i]);
+          }
+        }
+        estimated_d_min_[index] = detail::estimate_resolution_limit(valid);
+        detail::estimate_resolution_limit_distl_method1(
+          valid, d_min_distl_method_1_[index], noisiness_method_1_[index]);
+        detail::estimate_resolution_limit_distl_method2(
+          valid, d_min_distl_method_2_[index], noisiness_method_2_[index]);
+      }
+    }
+
+    af::shared<std::size_t> n_spots_total_;
+    af::shared<std::size_t> n_spots_no_ice_;
+    af::shared<std::size_t> n_spots_4A_;
+    af::shared<double> total_intensity_;
+    af::shared<double> ice_ring_fraction_;
+    af::shared<double> estimated_d_min_;
+    af::shared<double> d_min_distl_method_1_;
+    af::shared<double> noisiness_method_1_;
+    af::shared<double> d_min_distl_method_2_;
+    af::shared<double> noisiness_method_2_;
+    af::versa<std::size_t, af::c_grid<2> > shell_counts_;
+    std::vector<double> ice_rings_;
+    double ice_ring_half_width_;
+    std::vector<double> shells_;
+    bool resolution_analysis_;
+    std::vector<std::size_t> offset_;
+    std::vector<detail::AnalysisSpot> spots_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_ANALYSIS_H
@@ -8,6 +8,7 @@
 from scitbx import matrix
 
 from dials.algorithms.integration import filtering
+from dials.algorithms.spot_finding import PerImageAnalysis
 from dials.array_family import flex
 from dials.util import tabulate
 
@@ -623,49 +624,49 @@ def stats_for_reflection_table(
     )
 
 
-def stats_per_image(experiment, reflections, resolution_analysis=True):
-    n_spots_total = []
-    n_spots_no_ice = []
-    n_spots_4A = []
-    total_intensity = []
-    estimated_d_min = []
-    d_min_distl_method_1 = []
-    d_min_distl_method_2 = []
-    noisiness_method_1 = []
-    noisiness_method_2 = []
-
-    image_number = reflections["xyzobs.px.value"].parts()[2]
-    image_number = flex.floor(image_number)
-
+def stats_per_image(experiment, reflections, resolution_analysis=True, nthreads=1):
+    """
+    Compute the statistics of the spots on each image of a sweep in one pass
+    with the native kernel. The results are the same as those of
+    stats_for_reflection_table for the spots on each image.
+    """
     try:
         start, end = experiment.scan.get_array_range()
     except AttributeError:
         start, end = 0, 1
-    for i in range(start, end):
-        stats = stats_for_reflection_table(
-            reflections.select(image_number == i),
-            resolution_analysis=resolution_analysis,
-        )
-        n_spots_total.append(stats.n_spots_total)
-        n_spots_no_ice.append(stats.n_spots_no_ice)
-        n_spots_4A.append(stats.n_spots_4A)
-        total_intensity.append(stats.total_intensity)
-        estimated_d_min.append(stats.estimated_d_min)
-        d_min_distl_method_1.append(stats.d_min_distl_method_1)
-        noisiness_method_1.append(stats.noisiness_method_1)
-        d_min_distl_method_2.append(stats.d_min_distl_method_2)
-        noisiness_method_2.append(stats.noisiness_method_2)
 
+    image = flex.floor(reflections["xyzobs.px.value"].parts()[2]).iround() - start
+    rlp_norm = reflections["rlp"].norms()
+
+    # The rings only depend on the highest resolution spot, so are computed
+    # once for the sweep
+    ice_rings = flex.double()
+    ice_rings_width = 0.004
+    d_star_sq = flex.pow2(rlp_norm.select(rlp_norm > 0))
+    if d_star_sq:
+        unit_cell = uctbx.unit_cell((4.498, 4.498, 7.338, 90, 90, 120))
+        space_group = sgtbx.space_group_info(number=194).group()
+        ice_rings = filtering.PowderRingFilter(
+            unit_cell,
+            space_group,
+            uctbx.d_star_sq_as_d(flex.max(d_star_sq)),
+            ice_rings_width,
+        ).d_star_sq
+
+    analysis = PerImageAnalysis(
+        image=image,
+        rlp_norm=rlp_norm,
+        intensity=reflections["intensity.sum.value"],
+        variance=reflections["intensity.sum.variance"],
+        num_images=end - start,
+        ice_rings=ice_rings,
+        ice_ring_width=ice_rings_width,
+        shells=flex.double(),
+        resolution_analysis=resolution_analysis,
+        nthreads=nthreads,
+    )
     return StatsMultiImage(
-        n_spots_total=n_spots_total,
-        n_spots_no_ice=n_spots_no_ice,
-        n_spots_4A=n_spots_4A,
-        total_intensity=total_intensity,
-        estimated_d_min=estimated_d_min,
-        d_min_distl_method_1=d_min_distl_method_1,
-        noisiness_method_1=noisiness_method_1,
-        d_min_distl_method_2=d_min_distl_method_2,
-        noisiness_method_2=noisiness_method_2,
+        **{name: list(getattr(analysis, name)()) for name in _stats_field_names}
     )
 
 
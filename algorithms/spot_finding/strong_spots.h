@@ -0,0 +1,350 @@
+/*
+ * strong_spots.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_STRONG_SPOTS_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_STRONG_SPOTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/algorithms/image/connected_components/union_find.h>
+#include <dials/model/data/observation.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Centroid;
+  using dials::model::Intensity;
+  using dials::model::Observation;
+  using scitbx::vec3;
+  using scitbx::af::int6;
+
+  /**
+   * The running sums needed for the centroid and intensity of a spot. The
+   * pixel coordinates are those of the pixel centres.
+   */
+  struct SpotMoments {
+    std::size_t count;
+    double sum;
+    double sum_sq;
+    double sum_x;
+    double sum_y;
+    double sum_xx;
+    double sum_yy;
+    int x0, x1, y0, y1;
+    double peak;
+    int peak_x, peak_y;
+
+    SpotMoments()
+        : count(0),
+          sum(0),
+          sum_sq(0),
+          sum_x(0),
+          sum_y(0),
+          sum_xx(0),
+          sum_yy(0),
+          x0(0),
+          x1(0),
+          y0(0),
+          y1(0),
+          peak(0),
+          peak_x(0),
+          peak_y(0) {}
+
+    /**
+     * Add a run of pixels on a row. The bounding box and peak are set
+     * from the run so it must be the first thing added.
+     * @param row The pixel values on the row
+     * @param j The row
+     * @param first The first pixel in the run
+     * @param last One past the last pixel in the run
+     */
+    template <typename T>
+    void add_run(const T *row, int j, int first, int last) {
+      double y = j + 0.5;
+      double sx = 0, sxx = 0, s = 0, ss = 0;
+      peak = row[first];
+      peak_x = first;
+      peak_y = j;
+      for (int i = first; i < last; ++i) {
+        double v = row[i];
+        double x = i + 0.5;
+        s += v;
+        ss += v * v;
+        sx += v * x;
+        sxx += v * x * x;
+        if (v > peak) {
+          peak = v;
+          peak_x = i;
+        }
+      }
+      count = last - first;
+      sum = s;
+      sum_sq = ss;
+      sum_x = sx;
+      sum_y = s * y;
+      sum_xx = sxx;
+      sum_yy = s * y * y;
+      x0 = first;
+      x1 = last;
+      y0 = j;
+      y1 = j + 1;
+    }
+
+    /**
+     * Add the moments of another part of the same spot. The peak is the
+     * first maximum pixel in raster order.
+     * @param other The other moments
+     */
+    void merge(const SpotMoments &other) {
+      count += other.count;
+      sum += other.sum;
+      sum_sq += other.sum_sq;
+      sum_x += other.sum_x;
+      sum_y += other.sum_y;
+      sum_xx += other.sum_xx;
+      sum_yy += other.sum_yy;
+      x0 = std::min(x0, other.x0);
+      x1 = std::max(x1, other.x1);
+      y0 = std::min(y0, other.y0);
+      y1 = std::max(y1, other.y1);
+      if (other.peak > peak
+          || (other.peak == peak
+              && (other.peak_y < peak_y
+                  || (other.peak_y == peak_y && other.peak_x < peak_x)))) {
+        peak = other.peak;
+        peak_x = other.peak_x;
+        peak_y = other.peak_y;
+      }
+    }
+  };
+
+  /**
+   * Find the strong spots on a single image and compute their centroids and
+   * intensities in one pass over the threshold mask.
+   *
+   * Each row of the mask is split into runs of strong pixels, the moments of
+   * each run are computed as the row is read and the runs which overlap runs
+   * on the previous row are joined in a union find forest. The moments of the
+   * runs are then summed for each spot. This gives the same spots, in the
+   * same order, as labelling a pixel list in 2D and the same centroids and
+   * intensities as Shoebox::centroid_valid and Shoebox::summed_intensity on
+   * the shoeboxes of the pixels, up to rounding, without creating the pixel
+   * list or the shoeboxes.
+   */
+  class StrongSpotCentroider {
+  public:
+    /**
+     * Find the spots
+     * @param panel The panel number
+     * @param frame The frame number
+     * @param image The image
+     * @param mask The strong pixel mask
+     * @param min_pixels The minimum number of pixels in a spot
+     * @param max_pixels The maximum number of pixels in a spot
+     */
+    template <typename T>
+    StrongSpotCentroider(std::size_t panel,
+                         int frame,
+                         const af::const_ref<T, af::c_grid<2> > &image,
+                         const af::const_ref<bool, af::c_grid<2> > &mask,
+                         std::size_t min_pixels,
+                         std::size_t max_pixels)
+        : panel_(panel),
+          frame_(frame),
+          num_strong_pixels_(0),
+          num_too_small_(0),
+          num_too_large_(0) {
+      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(min_pixels <= max_pixels);
+
+      // Find the runs and their moments and join the overlapping runs
+      int ysize = mask.accessor()[0];
+      int xsize = mask.accessor()[1];
+      UnionFind forest;
+      std::vector<SpotMoments> moments;
+      std::vector<detail::PixelRun> previous, current;
+      for (int j = 0; j < ysize; ++j) {
+        const T *row = &image[j * xsize];
+        const bool *msk = &mask[j * xsize];
+        current.clear();
+        int i = 0;
+        while (i < xsize) {
+          if (!msk[i]) {
+            ++i;
+            continue;
+          }
+          int first = i;
+          while (i < xsize && msk[i]) {
+            ++i;
+          }
+          current.push_back(detail::PixelRun(first, i, forest.add()));
+          moments.push_back(SpotMoments());
+          moments.back().add_run(row, j, first, i);
+          num_strong_pixels_ += i - first;
+        }
+        if (!previous.empty() && !current.empty()) {
+          detail::join_runs(forest,
+                            &previous[0],
+                            &previous[0] + previous.size(),
+                            &current[0],
+                            &current[0] + current.size());
+        }
+        std::swap(previous, current);
+      }
+
+      // Sum the moments for each spot. The spots are labelled in order of
+      // their first run so the runs are added in raster order.
+      af::shared<int> labels = forest.labels();
+      std::vector<SpotMoments> spots;
+      for (std::size_t i = 0; i < labels.size(); ++i) {
+        std::size_t l = labels[i];
+        if (l == spots.size()) {
+          spots.push_back(moments[i]);
+        } else {
+          DIALS_ASSERT(l < spots.size());
+          spots[l].merge(moments[i]);
+        }
+      }
+
+      // Keep the spots with the right number of pixels
+      for (std::size_t i = 0; i < spots.size(); ++i) {
+        if (spots[i].count < min_pixels) {
+          num_too_small_++;
+        } else if (spots[i].count > max_pixels) {
+          num_too_large_++;
+        } else {
+          spots_.push_back(spots[i]);
+        }
+      }
+    }
+
+    /**
+     * @returns The number of spots
+     */
+    std::size_t size() const {
+      return spots_.size();
+    }
+
+    /**
+     * @returns The number of strong pixels, including those in rejected spots
+     */
+    std::size_t num_strong_pixels() const {
+      return num_strong_pixels_;
+    }
+
+    /**
+     * @returns The number of spots with too few pixels
+     */
+    std::size_t num_too_small() const {
+      return num_too_small_;
+    }
+
+    /**
+     * @returns The number of spots with too many pixels
+     */
+    std::size_t num_too_large() const {
+      return num_too_large_;
+    }
+
+    /**
+     * @returns The number of pixels in each spot
+     */
+    af::shared<std::size_t> spot_size() const {
+      af::shared<std::size_t> result(spots_.size());
+      for (std::size_t i = 0; i < spots_.size(); ++i) {
+        result[i] = spots_[i].count;
+      }
+      return result;
+    }
+
+    /**
+     * @returns The bounding box of each spot
+     */
+    af::shared<int6> bboxes() const {
+      af::shared<int6> result(spots_.size());
+      for (std::size_t i = 0; i < spots_.size(); ++i) {
+        const SpotMoments &s = spots_[i];
+        result[i] = int6(s.x0, s.x1, s.y0, s.y1, frame_, frame_ + 1);
+      }
+      return result;
+    }
+
+    /**
+     * @returns The coordinate of the centre of the peak pixel of each spot
+     */
+    af::shared<vec3<double> > peak_coordinates() const {
+      af::shared<vec3<double> > result(spots_.size());
+      for (std::size_t i = 0; i < spots_.size(); ++i) {
+        const SpotMoments &s = spots_[i];
+        result[i] = vec3<double>(s.peak_x + 0.5, s.peak_y + 0.5, frame_ + 0.5);
+      }
+      return result;
+    }
+
+    /**
+     * @returns The centroid and intensity of each spot
+     */
+    af::shared<Observation> observations() const {
+      af::shared<Observation> result(spots_.size());
+      for (std::size_t i = 0; i < spots_.size(); ++i) {
+        const SpotMoments &s = spots_[i];
+        Intensity intensity;
+        intensity.observed.value = s.sum;
+        intensity.observed.variance = std::abs(s.sum);
+        intensity.observed.success = true;
+        result[i] = Observation(panel_, centroid(s), intensity);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Compute the centroid from the moments in the same way as
+     * Shoebox::centroid_valid
+     */
+    Centroid centroid(const SpotMoments &s) const {
+      Centroid result;
+      if (!(s.sum > 0)) {
+        result.px.position =
+          vec3<double>((s.x0 + s.x1) / 2.0, (s.y0 + s.y1) / 2.0, frame_ + 0.5);
+        result.px.variance = vec3<double>(0, 0, 0);
+        result.px.std_err_sq = vec3<double>(0, 0, 0);
+        return result;
+      }
+      double mx = s.sum_x / s.sum;
+      double my = s.sum_y / s.sum;
+      result.px.position = vec3<double>(mx, my, frame_ + 0.5);
+      double denom = s.sum * s.sum - s.sum_sq;
+      if (denom > 0) {
+        double scale = s.sum / denom;
+        double vx = (s.sum_xx - mx * s.sum_x) * scale;
+        double vy = (s.sum_yy - my * s.sum_y) * scale;
+        result.px.variance = vec3<double>(vx, vy, 0);
+        result.px.std_err_sq =
+          vec3<double>(vx / s.sum + 1.0 / 12.0, vy / s.sum + 1.0 / 12.0, 1.0 / 12.0);
+      } else {
+        result.px.variance = vec3<double>(0, 0, 0);
+        result.px.std_err_sq = vec3<double>(1.0 / 12.0, 1.0 / 12.0, 1.0 / 12.0);
+      }
+      return result;
+    }
+
+    std::size_t panel_;
+    int frame_;
+    std::size_t num_strong_pixels_;
+    std::size_t num_too_small_;
+    std::size_t num_too_large_;
+    std::vector<SpotMoments> spots_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_STRONG_SPOTS_H
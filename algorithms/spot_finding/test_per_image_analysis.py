@@ -133,6 +133,54 @@ def test_stats_per_image(centroid_test_data):
     assert [tt[0] for tt in t[1:]] == [str(i + 1) for i in perm]
 
 
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_stats_per_image_matches_single_image(centroid_test_data, nthreads):
+    experiments, reflections = centroid_test_data
+    stats = per_image_analysis.stats_per_image(
+        experiments[0], reflections, nthreads=nthreads
+    )
+    image_number = flex.floor(reflections["xyzobs.px.value"].parts()[2])
+    start, end = experiments[0].scan.get_array_range()
+    for i in range(start, end):
+        expected = per_image_analysis.stats_for_reflection_table(
+            reflections.select(image_number == i)
+        )
+        for k, v in expected._asdict().items():
+            assert getattr(stats, k)[i - start] == pytest.approx(v)
+
+
+def test_per_image_analysis_shells(centroid_test_data):
+    experiments, reflections = centroid_test_data
+    image = flex.floor(reflections["xyzobs.px.value"].parts()[2]).iround()
+    rlp_norm = reflections["rlp"].norms()
+    shells = flex.double([0, 0.05, 0.1, 0.2, 0.5])
+    analysis = per_image_analysis.PerImageAnalysis(
+        image=image,
+        rlp_norm=rlp_norm,
+        intensity=reflections["intensity.sum.value"],
+        variance=reflections["intensity.sum.variance"],
+        num_images=len(experiments[0].scan),
+        ice_rings=flex.double(),
+        ice_ring_width=0.004,
+        shells=shells,
+        resolution_analysis=False,
+        nthreads=2,
+    )
+    counts = analysis.shell_counts()
+    assert counts.all() == (len(experiments[0].scan), 4)
+    assert list(analysis.ice_ring_fraction()) == [0] * len(experiments[0].scan)
+    d_star_sq = flex.pow2(rlp_norm)
+    for i in range(len(experiments[0].scan)):
+        for j in range(4):
+            sel = (
+                (image == i)
+                & (rlp_norm > 0)
+                & (d_star_sq >= shells[j])
+                & (d_star_sq < shells[j + 1])
+            )
+            assert counts[i, j] == sel.count(True)
+
+
 def test_stats_table_no_resolution_analysis(centroid_test_data):
     experiments, reflections = centroid_test_data
     stats = per_image_analysis.stats_per_image(
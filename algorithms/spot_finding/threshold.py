@@ -39,6 +39,7 @@ def __init__(self, **kwargs):
         self._n_sigma_s = kwargs.get("n_sigma_s", 3)
         self._min_count = kwargs.get("min_count", 2)
         self._threshold = kwargs.get("global_threshold", 0)
+        self._nthreads = kwargs.get("nthreads", 1)
 
         # Save the constant gain
         self._gain_map = None
@@ -46,6 +47,11 @@ def __init__(self, **kwargs):
         # Create a buffer
         self.algorithm = {}
 
+        # The thresholds prepared for the mask of each image size and the
+        # last mask seen for each image size
+        self._prepared = {}
+        self._last_mask = {}
+
     def __call__(self, image, mask):
         """
         Call the thresholding function
@@ -57,26 +63,46 @@ def __call__(self, image, mask):
         from dials.algorithms.image import threshold
         from dials.array_family import flex
 
+        # Set the gain
+        if self._gain is not None:
+            assert self._gain > 0
+            if self._gain_map is None or self._gain_map.all() != image.all():
+                self._gain_map = flex.double(image.accessor(), self._gain)
+
+        # The mask is usually the same for every image, so once it has been
+        # seen twice prepare the threshold for it
+        if self._nthreads == 1:
+            prepared = self._prepared_algorithm(image, mask)
+            if prepared is not None:
+                result = flex.bool(flex.grid(image.all()))
+                prepared(image, result)
+                return result
+
         # Initialise the algorithm
         try:
             algorithm = self.algorithm[image.all()]
         except Exception:
-            algorithm = threshold.DispersionThreshold(
-                image.all(),
-                self._kernel_size,
-                self._n_sigma_b,
-                self._n_sigma_s,
-                self._threshold,
-                self._min_count,
-            )
+            if self._nthreads > 1:
+                algorithm = threshold.DispersionThresholdTiled(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                    nthreads=self._nthreads,
+                )
+            else:
+                algorithm = threshold.DispersionThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                )
             self.algorithm[image.all()] = algorithm
 
-        # Set the gain
-        if self._gain is not None:
-            assert self._gain > 0
-            self._gain_map = flex.double(image.accessor(), self._gain)
-            self._gain = None
-
         # Compute the threshold
         result = flex.bool(flex.grid(image.all()))
         if self._gain_map:
@@ -87,6 +113,39 @@ def __call__(self, image, mask):
         # Return the result
         return result
 
+    def _prepared_algorithm(self, image, mask):
+        """
+        Get the threshold prepared for the mask
+
+        :param image: The image to process
+        :param mask: The mask to use
+        :return: The prepared threshold or None
+        """
+        from dials.algorithms.image import threshold
+
+        size = image.all()
+        prepared = self._prepared.get(size)
+        if prepared is not None and prepared.mask().all_eq(mask):
+            return prepared
+        last_mask = self._last_mask.get(size)
+        self._last_mask[size] = mask.deep_copy()
+        if last_mask is None or not last_mask.all_eq(mask):
+            return None
+        args = [
+            size,
+            self._kernel_size,
+            self._n_sigma_b,
+            self._n_sigma_s,
+            self._threshold,
+            self._min_count,
+            mask,
+        ]
+        if self._gain_map:
+            args.append(self._gain_map)
+        prepared = threshold.DispersionThresholdPrepared(*args)
+        self._prepared[size] = prepared
+        return prepared
+
 
 class DispersionExtendedThresholdStrategy(ThresholdStrategy):
     """
@@ -108,6 +167,7 @@ def __init__(self, **kwargs):
         self._n_sigma_s = kwargs.get("n_sigma_s", 3)
         self._min_count = kwargs.get("min_count", 2)
         self._threshold = kwargs.get("global_threshold", 0)
+        self._nthreads = kwargs.get("nthreads", 1)
 
         # Save the constant gain
         self._gain_map = None
@@ -130,21 +190,32 @@ def __call__(self, image, mask):
         try:
             algorithm = self.algorithm[image.all()]
         except Exception:
-            algorithm = threshold.DispersionExtendedThreshold(
-                image.all(),
-                self._kernel_size,
-                self._n_sigma_b,
-                self._n_sigma_s,
-                self._threshold,
-                self._min_count,
-            )
+            if self._nthreads > 1:
+                algorithm = threshold.DispersionExtendedThresholdTiled(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                    nthreads=self._nthreads,
+                )
+            else:
+                algorithm = threshold.DispersionExtendedThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                )
             self.algorithm[image.all()] = algorithm
 
         # Set the gain
         if self._gain is not None:
             assert self._gain > 0
-            self._gain_map = flex.double(image.accessor(), self._gain)
-            self._gain = None
+            if self._gain_map is None or self._gain_map.all() != image.all():
+                self._gain_map = flex.double(image.accessor(), self._gain)
 
         # Compute the threshold
         result = flex.bool(flex.grid(image.all()))
@@ -155,3 +226,111 @@ def __call__(self, image, mask):
 
         # Return the result
         return result
+
+
+class BlankImageScreen(object):
+    """
+    A cheap test for images with no spots, used to skip the full threshold.
+
+    The image is summed in square bins and the dispersion criteria are applied
+    to the binned image using the masked index of dispersion filter. The sum
+    of the Poisson distributed background in a bin is still Poisson
+    distributed, so the criteria are as for the dispersion threshold, but the
+    number of pixels to process is reduced by the square of the binning. The
+    image is blank if fewer binned pixels than min_strong pass both criteria.
+    Lowering the thresholds reduces the chance of rejecting an image with
+    spots at the cost of thresholding more blank images in full.
+    """
+
+    def __init__(self, **kwargs):
+        """
+        Set the screen up
+        """
+        self._binning = kwargs.get("binning", 4)
+        self._kernel_size = kwargs.get("kernel_size", (3, 3))
+        self._n_sigma_b = kwargs.get("n_sigma_b", 3)
+        self._n_sigma_s = kwargs.get("n_sigma_s", 2)
+        self._min_count = kwargs.get("min_count", 2)
+        self._min_strong = kwargs.get("min_strong", 1)
+        self._gain = kwargs.get("gain")
+        if self._gain is None:
+            self._gain = 1.0
+        assert self._binning > 0
+        assert self._gain > 0
+
+    def count_strong(self, image, mask):
+        """
+        Count the strong pixels in the binned image
+
+        :param image: The image to process
+        :param mask: The mask to use
+        :return: The number of strong binned pixels
+        """
+        from dials.algorithms.image.filter import (
+            bin_image,
+            bin_mask,
+            index_of_dispersion_filter,
+        )
+        from dials.array_family import flex
+
+        # Bin the image and mask
+        binned = bin_image(image, mask, self._binning)
+        binned_mask = bin_mask(mask, self._binning)
+        ysize, xsize = binned.all()
+        if ysize <= 2 * self._kernel_size[0] or xsize <= 2 * self._kernel_size[1]:
+            return self._min_strong
+
+        # Compute the local mean and index of dispersion
+        filtered = index_of_dispersion_filter(
+            binned, binned_mask, self._kernel_size, self._min_count
+        )
+        selection = filtered.mask().as_1d() != 0
+        value = binned.as_1d().select(selection)
+        mean = filtered.mean().as_1d().select(selection)
+        dispersion = filtered.index_of_dispersion().as_1d().select(selection)
+        count = filtered.count().as_1d().select(selection).as_double()
+
+        # Apply the dispersion criteria
+        two = flex.double(len(count), 2.0)
+        bound_b = self._gain * (1.0 + self._n_sigma_b * flex.sqrt(two / (count - 1)))
+        bound_s = mean + self._n_sigma_s * flex.sqrt(self._gain * mean)
+        return ((dispersion > bound_b) & (value > bound_s)).count(True)
+
+    def is_blank(self, image, mask):
+        """
+        Check if the image is blank
+
+        :param image: The image to process
+        :param mask: The mask to use
+        :return: True/False the image has no spots
+        """
+        return self.count_strong(image, mask) < self._min_strong
+
+
+class PrescreenedThreshold(object):
+    """
+    Apply a threshold algorithm only to images which pass a blank image screen.
+    Blank images have no strong pixels.
+    """
+
+    def __init__(self, algorithm, screen):
+        """
+        :param algorithm: The threshold algorithm
+        :param screen: The blank image screen
+        """
+        self.algorithm = algorithm
+        self.screen = screen
+
+    def compute_threshold(self, image, mask):
+        """
+        Compute the threshold.
+
+        :param image: The image to process
+        :param mask: The pixel mask on the image
+        :returns: A boolean mask showing foreground/background pixels
+        """
+        from dials.array_family import flex
+
+        if self.screen.is_blank(image, mask):
+            return flex.bool(image.accessor(), False)
+        return self.algorithm.compute_threshold(image, mask)
@@ -4,9 +4,11 @@
 from dials_algorithms_spot_prediction_ext import (
     IndexGenerator,
     NaveStillsReflectionPredictor,
+    PanelLookup,
     PixelLabeller,
     PixelToMillerIndex,
     ReekeIndexGenerator,
+    ResolutionOrderedIndices,
     RotationAngles,
     ScanStaticRayPredictor,
     ScanVaryingRayPredictor,
@@ -19,10 +21,12 @@
 __all__ = [
     "IndexGenerator",
     "NaveStillsReflectionPredictor",
+    "PanelLookup",
     "PixelLabeller",
     "PixelToMillerIndex",
     "ray_intersection",
     "ReekeIndexGenerator",
+    "ResolutionOrderedIndices",
     "RotationAngles",
     "ScanStaticRayPredictor",
     "ScanStaticReflectionPredictor",
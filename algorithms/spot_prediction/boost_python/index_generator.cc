@@ -24,6 +24,18 @@ namespace dials { namespace algorithms { namespace boost_python {
         (arg("unit_cell"), arg("space_group_type"), arg("resolution_d_min"))))
       .def("next", &IndexGenerator::next)
       .def("to_array", &IndexGenerator::to_array);
+
+    class_<ResolutionOrderedIndices>("ResolutionOrderedIndices", no_init)
+      .def(init<cctbx::uctbx::unit_cell const&,
+                cctbx::sgtbx::space_group_type const&,
+                double>(
+        (arg("unit_cell"), arg("space_group_type"), arg("resolution_d_min"))))
+      .def("__len__", &ResolutionOrderedIndices::size)
+      .def("indices", &ResolutionOrderedIndices::indices)
+      .def("d_star_sq", &ResolutionOrderedIndices::d_star_sq)
+      .def("select",
+           &ResolutionOrderedIndices::select,
+           (arg("d_min"), arg("d_max")));
   }
 
 }}}  // namespace dials::algorithms::boost_python
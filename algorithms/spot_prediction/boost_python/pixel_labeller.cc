@@ -18,18 +18,23 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   static af::shared<cctbx::miller::index<> > label(const PixelLabeller &self,
                                                    mat3<double> A,
-                                                   std::size_t panel_number) {
+                                                   std::size_t panel_number,
+                                                   std::size_t nthreads) {
     af::c_grid<2> size = self.panel_size(panel_number);
     af::shared<cctbx::miller::index<> > result(size[0] * size[1]);
-    self.label(result.ref(), A, panel_number);
+    self.label(result.ref(), A, panel_number, nthreads);
     return result;
   }
 
   void export_pixel_labeller() {
     class_<PixelLabeller>("PixelLabeller", no_init)
       .def(init<BeamBase &, Detector>())
-      .def("label", &PixelLabeller::label)
-      .def("label", label);
+      .def("label",
+           &PixelLabeller::label,
+           (arg("index"), arg("A"), arg("panel_number"), arg("nthreads") = 1))
+      .def("label",
+           label,
+           (arg("A"), arg("panel_number"), arg("nthreads") = 1));
     ;
   }
 
@@ -31,6 +31,22 @@ namespace dials { namespace algorithms { namespace boost_python {
     return self.h(panel, x, y);
   }
 
+  static void PixelToMillerIndex_h_for_panel_rotation(
+    const PixelToMillerIndex &self,
+    af::ref<vec3<double> > result,
+    std::size_t panel,
+    const af::const_ref<double> &frames,
+    std::size_t nthreads) {
+    self.h_for_panel(result, panel, frames, nthreads);
+  }
+
+  static void PixelToMillerIndex_h_for_panel_stills(const PixelToMillerIndex &self,
+                                                    af::ref<vec3<double> > result,
+                                                    std::size_t panel,
+                                                    std::size_t nthreads) {
+    self.h_for_panel(result, panel, nthreads);
+  }
+
   void export_pixel_to_miller_index() {
     class_<PixelToMillerIndex>("PixelToMillerIndex", no_init)
       .def(init<const BeamBase &,
@@ -41,7 +57,13 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<const BeamBase &, const Detector &, const CrystalBase &>())
       .def("h", &PixelToMillerIndex_h_rotation)
       .def("h", &PixelToMillerIndex_h_stills)
-      .def("q", &PixelToMillerIndex::q);
+      .def("q", &PixelToMillerIndex::q)
+      .def("h_for_panel",
+           &PixelToMillerIndex_h_for_panel_rotation,
+           (arg("result"), arg("panel"), arg("frames"), arg("nthreads") = 1))
+      .def("h_for_panel",
+           &PixelToMillerIndex_h_for_panel_stills,
+           (arg("result"), arg("panel"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
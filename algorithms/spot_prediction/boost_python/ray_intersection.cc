@@ -17,6 +17,12 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  boost::python::tuple panel_lookup_get_ray_intersection(const PanelLookup &self,
+                                                         vec3<double> s1) {
+    Detector::coord_type coord = self.get_ray_intersection(s1);
+    return boost::python::make_tuple(coord.first, coord.second);
+  }
+
   void export_ray_intersection() {
     af::shared<bool> (*ray_intersection_table)(const Detector&, af::reflection_table) =
       &ray_intersection;
@@ -48,6 +54,12 @@ namespace dials { namespace algorithms { namespace boost_python {
     //.def(from_s1_single_panel)
     //.def(from_s1_panel_array);
 
+    class_<PanelLookup>("PanelLookup", no_init)
+      .def(init<const Detector &, std::size_t>(
+        (arg("detector"), arg("grid_size") = 16)))
+      .def("candidates", &PanelLookup::candidates)
+      .def("get_ray_intersection", &panel_lookup_get_ray_intersection);
+
     // Export all the ray intersection functions
     def("ray_intersection",
         ray_intersection_table,
@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/spot_prediction/reflection_predictor.h>
+#include <dials/util/boost_python/release_gil.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -30,11 +31,21 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 double>())
       .def("for_ub_old_index_generator", &Predictor::for_ub_old_index_generator)
-      .def("for_ub", &Predictor::for_ub)
-      .def("for_hkl", &Predictor::for_hkl)
-      .def("for_hkl", &Predictor::for_hkl_with_individual_ub)
-      .def("for_reflection_table", &Predictor::for_reflection_table)
-      .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub);
+      .def("for_ub",
+           DIALS_RELEASE_GIL(&Predictor::for_ub),
+           (arg("ub"), arg("block_size") = 1))
+      .def("for_hkl",
+           DIALS_RELEASE_GIL(&Predictor::for_hkl),
+           (arg("h"), arg("entering"), arg("panel"), arg("ub"), arg("nthreads") = 1))
+      .def("for_hkl",
+           DIALS_RELEASE_GIL(&Predictor::for_hkl_with_individual_ub),
+           (arg("h"), arg("entering"), arg("panel"), arg("ub"), arg("nthreads") = 1))
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table,
+           (arg("table"), arg("ub"), arg("nthreads") = 1))
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table_with_individual_ub,
+           (arg("table"), arg("ub"), arg("nthreads") = 1));
   }
 
   void export_scan_varying_reflection_predictor() {
@@ -49,12 +60,19 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 std::size_t,
                 double>())
-      .def("for_ub", &Predictor::for_ub)
+      .def("for_ub",
+           DIALS_RELEASE_GIL(&Predictor::for_ub),
+           (arg("A"), arg("nthreads") = 1))
       .def("for_ub_on_single_image", &Predictor::for_ub_on_single_image)
-      .def("for_varying_models", &Predictor::for_varying_models)
+      .def("for_varying_models",
+           DIALS_RELEASE_GIL(&Predictor::for_varying_models),
+           (arg("A"), arg("s0"), arg("S"), arg("nthreads") = 1))
       .def("for_varying_models_on_single_image",
            &Predictor::for_varying_models_on_single_image)
-      .def("for_reflection_table", &Predictor::for_reflection_table);
+      .def("for_reflection_table", &Predictor::for_reflection_table)
+      .def("for_reflection_table_by_block",
+           &Predictor::for_reflection_table_by_block,
+           (arg("table"), arg("block"), arg("ub"), arg("s0"), arg("d"), arg("S")));
   }
 
   void export_stills_delta_psi_reflection_predictor() {
@@ -85,8 +103,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("__call__", predict_observed)
       .def("__call__", predict_observed_with_panel)
       .def("__call__", predict_observed_with_panel_list)
-      .def("for_reflection_table", &Predictor::for_reflection_table)
-      .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub);
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table,
+           (arg("table"), arg("ub"), arg("nthreads") = 1))
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table_with_individual_ub,
+           (arg("table"), arg("ub"), arg("nthreads") = 1));
   }
 
   void export_nave_stills_reflection_predictor() {
@@ -119,8 +141,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("__call__", predict_observed)
       .def("__call__", predict_observed_with_panel)
       .def("__call__", predict_observed_with_panel_list)
-      .def("for_reflection_table", &Predictor::for_reflection_table)
-      .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub);
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table,
+           (arg("table"), arg("ub"), arg("nthreads") = 1))
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table_with_individual_ub,
+           (arg("table"), arg("ub"), arg("nthreads") = 1));
   }
 
   void export_spherical_relp_stills_reflection_predictor() {
@@ -151,8 +177,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("__call__", predict_observed)
       .def("__call__", predict_observed_with_panel)
       .def("__call__", predict_observed_with_panel_list)
-      .def("for_reflection_table", &Predictor::for_reflection_table)
-      .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub);
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table,
+           (arg("table"), arg("ub"), arg("nthreads") = 1))
+      .def("for_reflection_table",
+           &Predictor::for_reflection_table_with_individual_ub,
+           (arg("table"), arg("ub"), arg("nthreads") = 1));
   }
 
   void export_reflection_predictor() {
@@ -16,6 +16,15 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  static boost::python::tuple calculate_array(
+    const RotationAngles &self,
+    const af::const_ref<scitbx::vec3<double> > &pstar0) {
+    af::shared<scitbx::vec2<double> > phi(pstar0.size());
+    af::shared<bool> valid(pstar0.size());
+    self.calculate(pstar0, phi.ref(), valid.ref());
+    return boost::python::make_tuple(phi, valid);
+  }
+
   void export_rotation_angles() {
     scitbx::vec2<double> (RotationAngles::*calculate_pstar0)(scitbx::vec3<double>)
       const = &RotationAngles::operator();
@@ -27,7 +36,8 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<scitbx::vec3<double>, scitbx::vec3<double> >(
         (arg("beam_direction"), arg("rotation_axis"))))
       .def("__call__", calculate_pstar0)
-      .def("__call__", calculate_miller);
+      .def("__call__", calculate_miller)
+      .def("calculate", calculate_array, (arg("pstar0")));
   }
 
 }}}  // namespace dials::algorithms::boost_python
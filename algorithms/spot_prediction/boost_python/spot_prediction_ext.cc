@@ -12,6 +12,9 @@
 #include <boost/python/def.hpp>
 #include <scitbx/array_family/small.h>
 #include <scitbx/boost_python/container_conversions.h>
+#include <dials/util/boost_python/trace.h>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -31,6 +34,9 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_pixel_to_miller_index();
 
   BOOST_PYTHON_MODULE(dials_algorithms_spot_prediction_ext) {
+    dials::util::boost_python::import_memory_accounting();
+    dials::util::boost_python::import_trace_recorder();
+    dials::util::boost_python::import_shared_executor();
     tuple_mapping_fixed_capacity<scitbx::af::small<double, 2> >();
 
     export_index_generator();
@@ -11,10 +11,15 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_INDEX_GENERATOR_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_INDEX_GENERATOR_H
 
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
 #include <cctbx/uctbx.h>
 #include <cctbx/sgtbx/space_group_type.h>
 #include <scitbx/array_family/loops.h>
 #include <dials/array_family/import_scitbx_af.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
@@ -98,6 +103,95 @@ namespace dials { namespace algorithms {
     af::nested_loop<cctbx::miller::index<> > loop_;
   };
 
+  /**
+   * The reflection indices from the IndexGenerator, computed once and sorted
+   * in order of increasing resolution so that the indices in a resolution
+   * shell can be looked up with a binary search. The object can be kept and
+   * reused for any number of predictions with the same unit cell.
+   */
+  class ResolutionOrderedIndices {
+  public:
+    typedef cctbx::miller::index<> miller_index;
+
+    /**
+     * Generate and sort the indices.
+     * @param unit_cell The unit cell structure
+     * @param space_group_type The space group type structure
+     * @param d_min The resolution
+     */
+    ResolutionOrderedIndices(cctbx::uctbx::unit_cell const& unit_cell,
+                             cctbx::sgtbx::space_group_type const& space_group_type,
+                             double d_min) {
+      DIALS_ASSERT(d_min > 0);
+      af::shared<miller_index> h =
+        IndexGenerator(unit_cell, space_group_type, d_min).to_array();
+      std::vector<std::pair<double, std::size_t> > order(h.size());
+      for (std::size_t i = 0; i < h.size(); ++i) {
+        order[i] = std::make_pair(unit_cell.d_star_sq(h[i]), i);
+      }
+      std::sort(order.begin(), order.end());
+      indices_.reserve(h.size());
+      d_star_sq_.reserve(h.size());
+      for (std::size_t i = 0; i < order.size(); ++i) {
+        indices_.push_back(h[order[i].second]);
+        d_star_sq_.push_back(order[i].first);
+      }
+    }
+
+    /**
+     * @returns The number of indices
+     */
+    std::size_t size() const {
+      return indices_.size();
+    }
+
+    /**
+     * @returns The indices in order of increasing resolution
+     */
+    af::shared<miller_index> indices() const {
+      return indices_;
+    }
+
+    /**
+     * @returns The 1/d^2 of each index
+     */
+    af::shared<double> d_star_sq() const {
+      return d_star_sq_;
+    }
+
+    /**
+     * Get the range of the sorted indices with d_max >= d >= d_min.
+     * @param d_min The high resolution limit
+     * @param d_max The low resolution limit
+     * @returns The first and last positions in the sorted indices
+     */
+    std::pair<std::size_t, std::size_t> shell(double d_min, double d_max) const {
+      DIALS_ASSERT(d_min > 0);
+      DIALS_ASSERT(d_max >= d_min);
+      const double* first = std::lower_bound(
+        d_star_sq_.begin(), d_star_sq_.end(), 1.0 / (d_max * d_max));
+      const double* last =
+        std::upper_bound(first, d_star_sq_.end(), 1.0 / (d_min * d_min));
+      return std::make_pair(first - d_star_sq_.begin(), last - d_star_sq_.begin());
+    }
+
+    /**
+     * Select the indices with d_max >= d >= d_min.
+     * @param d_min The high resolution limit
+     * @param d_max The low resolution limit
+     * @returns The indices in the resolution shell
+     */
+    af::shared<miller_index> select(double d_min, double d_max) const {
+      std::pair<std::size_t, std::size_t> range = shell(d_min, d_max);
+      return af::shared<miller_index>(indices_.begin() + range.first,
+                                      indices_.begin() + range.second);
+    }
+
+  private:
+    af::shared<miller_index> indices_;
+    af::shared<double> d_star_sq_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_SPOT_PREDICTION_INDEX_GENERATOR_H
@@ -12,6 +12,7 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_LABELLER_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_LABELLER_H
 
+#include <boost/bind.hpp>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <scitbx/vec2.h>
@@ -19,6 +20,7 @@
 #include <scitbx/mat3.h>
 #include <cctbx/miller.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -80,16 +82,37 @@ namespace dials { namespace algorithms {
      * @param index The index labels
      * @param A The setting matrix
      * @param panel_number The panel
+     * @param nthreads The number of threads
      */
     void label(af::ref<cctbx::miller::index<> > index,
                mat3<double> A,
-               std::size_t panel_number) const {
+               std::size_t panel_number,
+               std::size_t nthreads = 1) const {
       DIALS_ASSERT(panel_number < size());
       af::c_grid<2> size = panel_size(panel_number);
       DIALS_ASSERT(index.size() == size[0] * size[1]);
       mat3<double> A1 = A.inverse();
-      pstar_array_type ps = p_star_[panel_number];
-      for (std::size_t j = 0; j < size[0]; ++j) {
+      detail::parallel_bands(boost::bind(&PixelLabeller::label_rows,
+                                         p_star_[panel_number].const_ref(),
+                                         A1,
+                                         index,
+                                         _1,
+                                         _2),
+                             size[0],
+                             nthreads);
+    }
+
+  private:
+    /**
+     * Label a range of rows of a panel
+     */
+    static void label_rows(const af::const_ref<vec3<double>, af::c_grid<2> > &ps,
+                           mat3<double> A1,
+                           af::ref<cctbx::miller::index<> > index,
+                           std::size_t first,
+                           std::size_t last) {
+      af::c_grid<2> size = ps.accessor();
+      for (std::size_t j = first; j < last; ++j) {
         for (std::size_t i = 0; i < size[1]; ++i) {
           vec3<double> hf = A1 * ps(j, i);
           cctbx::miller::index<> h((int)std::floor(hf[0] + 0.5),
@@ -100,7 +123,6 @@ namespace dials { namespace algorithms {
       }
     }
 
-  private:
     array_type p_star_;
   };
 
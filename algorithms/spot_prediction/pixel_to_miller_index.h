@@ -11,11 +11,15 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_TO_MILLER_INDEX_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_TO_MILLER_INDEX_H
 
+#include <boost/bind.hpp>
+#include <scitbx/math/r3_rotation.h>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dxtbx/model/scan.h>
 #include <dxtbx/model/crystal.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -128,7 +132,125 @@ namespace dials { namespace algorithms {
       return s1 - s0_;
     }
 
+    /**
+     * Compute the fractional miller index at the centre of every pixel of a
+     * panel on a list of frames. The reciprocal lattice vectors of the pixels
+     * are computed once and then transformed by the matrix for each frame.
+     * Bands of rows are done in parallel.
+     * @param result The miller indices for each frame, row and column
+     * @param panel The panel number
+     * @param frames The frame numbers
+     * @param nthreads The number of threads
+     */
+    void h_for_panel(af::ref<vec3<double> > result,
+                     std::size_t panel,
+                     const af::const_ref<double> &frames,
+                     std::size_t nthreads) const {
+      DIALS_ASSERT(!(m2_[0] == 0 && m2_[1] == 0 && m2_[2] == 0));
+      af::versa<vec3<double>, af::c_grid<2> > r = panel_q(panel, nthreads);
+      std::size_t height = r.accessor()[0];
+      DIALS_ASSERT(result.size() == frames.size() * r.size());
+      af::shared<mat3<double> > M(frames.size());
+      for (std::size_t k = 0; k < frames.size(); ++k) {
+        double angle = scan_.get_angle_from_array_index(frames[k]);
+        mat3<double> R =
+          scitbx::math::r3_rotation::axis_and_angle_as_matrix(m2_, angle);
+        M[k] = A_inv_ * F_inv_ * R.transpose() * S_inv_;
+      }
+      detail::parallel_bands(boost::bind(&PixelToMillerIndex::transform_rows,
+                                         r.const_ref(),
+                                         M.const_ref(),
+                                         result,
+                                         _1,
+                                         _2),
+                             frames.size() * height,
+                             nthreads);
+    }
+
+    /**
+     * Compute the fractional miller index at the centre of every pixel of a
+     * panel for stills. Bands of rows are done in parallel.
+     * @param result The miller indices for each row and column
+     * @param panel The panel number
+     * @param nthreads The number of threads
+     */
+    void h_for_panel(af::ref<vec3<double> > result,
+                     std::size_t panel,
+                     std::size_t nthreads) const {
+      af::versa<vec3<double>, af::c_grid<2> > r = panel_q(panel, nthreads);
+      DIALS_ASSERT(result.size() == r.size());
+      af::shared<mat3<double> > M(1, A_inv_);
+      detail::parallel_bands(boost::bind(&PixelToMillerIndex::transform_rows,
+                                         r.const_ref(),
+                                         M.const_ref(),
+                                         result,
+                                         _1,
+                                         _2),
+                             r.accessor()[0],
+                             nthreads);
+    }
+
   protected:
+    /**
+     * Compute the reciprocal lattice vector at the centre of every pixel
+     */
+    af::versa<vec3<double>, af::c_grid<2> > panel_q(std::size_t panel,
+                                                    std::size_t nthreads) const {
+      DIALS_ASSERT(panel < detector_.size());
+      vec2<std::size_t> image_size = detector_[panel].get_image_size();
+      af::versa<vec3<double>, af::c_grid<2> > r(
+        af::c_grid<2>(image_size[1], image_size[0]));
+      detail::parallel_bands(boost::bind(&PixelToMillerIndex::q_rows,
+                                         this,
+                                         panel,
+                                         r.ref(),
+                                         _1,
+                                         _2),
+                             image_size[1],
+                             nthreads);
+      return r;
+    }
+
+    /**
+     * Compute the reciprocal lattice vectors for a range of rows
+     */
+    void q_rows(std::size_t panel,
+                af::ref<vec3<double>, af::c_grid<2> > r,
+                std::size_t first,
+                std::size_t last) const {
+      const dxtbx::model::Panel &p = detector_[panel];
+      double s0_length = s0_.length();
+      for (std::size_t j = first; j < last; ++j) {
+        for (std::size_t i = 0; i < r.accessor()[1]; ++i) {
+          vec3<double> s1 =
+            p.get_pixel_lab_coord(vec2<double>(i + 0.5, j + 0.5)).normalize()
+            * s0_length;
+          r(j, i) = s1 - s0_;
+        }
+      }
+    }
+
+    /**
+     * Transform a range of rows of the reciprocal lattice vectors, where
+     * the rows of all the frames are numbered consecutively
+     */
+    static void transform_rows(const af::const_ref<vec3<double>, af::c_grid<2> > &r,
+                               const af::const_ref<mat3<double> > &M,
+                               af::ref<vec3<double> > result,
+                               std::size_t first,
+                               std::size_t last) {
+      std::size_t height = r.accessor()[0];
+      std::size_t width = r.accessor()[1];
+      for (std::size_t row = first; row < last; ++row) {
+        const mat3<double> &m = M[row / height];
+        const vec3<double> *rj = &r[(row % height) * width];
+        vec3<double> *hj = &result[row * width];
+        for (std::size_t i = 0; i < width; ++i) {
+          hj[i] = m * rj[i];
+        }
+      }
+    }
+
     Detector detector_;
     Scan scan_;
     vec3<double> s0_;
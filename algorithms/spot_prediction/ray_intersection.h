@@ -11,8 +11,13 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_RAY_INTERSECTOR_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_RAY_INTERSECTOR_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/optional.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
+#include <dxtbx/error.h>
 #include <dxtbx/model/detector.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/error.h>
@@ -94,6 +99,163 @@ namespace dials { namespace algorithms {
   // af::shared< std::size_t > panel_;
   //};
 
+  /**
+   * A lookup from the direction of a ray to the panels of a detector that it
+   * may intersect. The sphere of directions is divided into the cells of a
+   * cube map, and each cell lists the panels whose projection onto the sphere
+   * covers or is next to the cell. Only these panels are tested for a ray,
+   * instead of every panel of the detector, and the intersection chosen
+   * between them is the same as for Detector::get_ray_intersection.
+   */
+  class PanelLookup {
+  public:
+    /**
+     * Build the lookup
+     * @param detector The detector model
+     * @param grid_size The number of cells along each edge of a cube face
+     */
+    PanelLookup(const Detector &detector, std::size_t grid_size = 16)
+        : detector_(detector), grid_size_(grid_size) {
+      DIALS_ASSERT(detector.size() > 0);
+      DIALS_ASSERT(grid_size > 0);
+      std::vector<std::vector<std::size_t> > cells(6 * grid_size_ * grid_size_);
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        add_panel(cells, i);
+      }
+      offset_.push_back(0);
+      for (std::size_t c = 0; c < cells.size(); ++c) {
+        index_.insert(index_.end(), cells[c].begin(), cells[c].end());
+        offset_.push_back(index_.size());
+      }
+    }
+
+    /**
+     * @returns The detector model
+     */
+    const Detector &detector() const {
+      return detector_;
+    }
+
+    /**
+     * @param s1 The ray direction
+     * @returns The panels which the ray may intersect
+     */
+    af::shared<std::size_t> candidates(const vec3<double> &s1) const {
+      std::size_t c = cell(s1);
+      return af::shared<std::size_t>(&index_[0] + offset_[c],
+                                     &index_[0] + offset_[c + 1]);
+    }
+
+    /**
+     * Find the intersection of the ray with the detector. Of the candidate
+     * panels which the ray hits, the closest along the ray is chosen.
+     * @param s1 The ray direction
+     * @returns The panel and the millimetre coordinate on the panel
+     * @throws dxtbx::error if the ray does not hit a panel
+     */
+    Detector::coord_type get_ray_intersection(const vec3<double> &s1) const {
+      Detector::coord_type pxy(-1, vec2<double>(0, 0));
+      double w_max = 0;
+      std::size_t c = cell(s1);
+      for (std::size_t k = offset_[c]; k < offset_[c + 1]; ++k) {
+        const Panel &panel = detector_[index_[k]];
+        vec3<double> v = panel.get_D_matrix() * s1;
+        if (v[2] > w_max) {
+          vec2<double> xy(v[0] / v[2], v[1] / v[2]);
+          if (panel.is_coord_valid_mm(xy)) {
+            pxy = Detector::coord_type(index_[k], xy);
+            w_max = v[2];
+          }
+        }
+      }
+      DXTBX_ASSERT(w_max > 0);
+      return pxy;
+    }
+
+  private:
+    /**
+     * @returns The cube map cell containing the direction
+     */
+    std::size_t cell(const vec3<double> &d) const {
+      std::size_t axis = 0;
+      for (std::size_t a = 1; a < 3; ++a) {
+        if (std::abs(d[a]) > std::abs(d[axis])) {
+          axis = a;
+        }
+      }
+      double length = std::abs(d[axis]);
+      if (length == 0) {
+        return 0;
+      }
+      std::size_t face = 2 * axis + (d[axis] < 0 ? 1 : 0);
+      std::size_t i = bin(d[(axis + 1) % 3] / length);
+      std::size_t j = bin(d[(axis + 2) % 3] / length);
+      return (face * grid_size_ + j) * grid_size_ + i;
+    }
+
+    /**
+     * @returns The bin of a cube face coordinate in the range [-1, 1]
+     */
+    std::size_t bin(double u) const {
+      double x = std::max(0.0, (u + 1.0) * 0.5 * grid_size_);
+      return std::min(grid_size_ - 1, (std::size_t)x);
+    }
+
+    /**
+     * Add the panel to the cells covered by its projection onto the sphere.
+     * The panel is sampled more finely than the smallest cell, and each
+     * sample also marks the cells one cell width away from it, so that rays
+     * hitting the edge of a panel always find it.
+     */
+    void add_panel(std::vector<std::vector<std::size_t> > &cells,
+                   std::size_t index) const {
+      const Panel &panel = detector_[index];
+      vec2<double> size = panel.get_image_size_mm();
+      double distance = std::abs(panel.get_normal() * panel.get_origin());
+
+      // The angular size of a cell is between 2/N at the centre of a face and
+      // 2/(3N) at its corners
+      double cell_angle = 2.0 / grid_size_;
+      double step = distance * cell_angle / 6.0;
+      if (!(step > 0)) {
+        for (std::size_t c = 0; c < cells.size(); ++c) {
+          mark(cells[c], index);
+        }
+        return;
+      }
+      std::size_t nx = (std::size_t)std::ceil(size[0] / step) + 2;
+      std::size_t ny = (std::size_t)std::ceil(size[1] / step) + 2;
+      for (std::size_t iy = 0; iy < ny; ++iy) {
+        for (std::size_t ix = 0; ix < nx; ++ix) {
+          vec2<double> mm(size[0] * ix / (nx - 1), size[1] * iy / (ny - 1));
+          vec3<double> d = panel.get_lab_coord(mm).normalize();
+          vec3<double> t1 = d.ortho().normalize();
+          vec3<double> t2 = d.cross(t1);
+          for (int b = -1; b <= 1; ++b) {
+            for (int a = -1; a <= 1; ++a) {
+              mark(cells[cell(d + (t1 * a + t2 * b) * cell_angle)], index);
+            }
+          }
+        }
+      }
+    }
+
+    /**
+     * Add the panel to the cell if it is not there already. The panels are
+     * added in order, so each cell lists its panels in increasing order.
+     */
+    static void mark(std::vector<std::size_t> &cell, std::size_t index) {
+      if (cell.empty() || cell.back() != index) {
+        cell.push_back(index);
+      }
+    }
+
+    Detector detector_;
+    std::size_t grid_size_;
+    std::vector<std::size_t> offset_;
+    std::vector<std::size_t> index_;
+  };
+
   inline af::shared<bool> ray_intersection(const Detector &detector,
                                            af::reflection_table reflections) {
     DIALS_ASSERT(reflections.is_consistent());
@@ -104,9 +266,16 @@ namespace dials { namespace algorithms {
     af::ref<std::size_t> panel = reflections["panel"];
     af::ref<vec3<double> > xyzcalmm = reflections["xyzcal.mm"];
     af::shared<bool> success(reflections.size(), true);
+
+    // For multi-panel detectors only test the panels near each ray
+    boost::optional<PanelLookup> lookup;
+    if (detector.size() > 1) {
+      lookup = PanelLookup(detector);
+    }
     for (std::size_t i = 0; i < reflections.size(); ++i) {
       try {
-        Detector::coord_type coord = detector.get_ray_intersection(s1[i]);
+        Detector::coord_type coord = lookup ? lookup->get_ray_intersection(s1[i])
+                                            : detector.get_ray_intersection(s1[i]);
         xyzcalmm[i][0] = coord.second[0];
         xyzcalmm[i][1] = coord.second[1];
         xyzcalmm[i][2] = phi[i];
@@ -13,6 +13,9 @@
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_REFLECTION_PREDICTOR_H
 
 #include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/optional.hpp>
 #include <scitbx/math/r3_rotation.h>
 #include <scitbx/constants.h>
 #include <dxtbx/model/beam.h>
@@ -27,11 +30,15 @@
 #include <dials/algorithms/spot_prediction/scan_varying_ray_predictor.h>
 #include <dials/algorithms/spot_prediction/stills_ray_predictor.h>
 #include <dials/algorithms/spot_prediction/ray_intersection.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/util/thread_pool.h>
+#include <dials/util/trace.h>
 
 namespace dials { namespace algorithms {
 
   using boost::shared_ptr;
   using dials::model::Ray;
+  using dials::util::ThreadPool;
   using dxtbx::model::BeamBase;
   using dxtbx::model::Detector;
   using dxtbx::model::Goniometer;
@@ -65,6 +72,20 @@ namespace dials { namespace algorithms {
       xyz_mm = table.get<vec3<double> >("xyzcal.mm");
       flags = table.get<std::size_t>("flags");
     }
+
+    /**
+     * Append the predictions from another set of prediction data
+     * @param other The other prediction data
+     */
+    void extend(const prediction_data &other) {
+      hkl.extend(other.hkl.begin(), other.hkl.end());
+      panel.extend(other.panel.begin(), other.panel.end());
+      enter.extend(other.enter.begin(), other.enter.end());
+      s1.extend(other.s1.begin(), other.s1.end());
+      xyz_px.extend(other.xyz_px.begin(), other.xyz_px.end());
+      xyz_mm.extend(other.xyz_mm.begin(), other.xyz_mm.end());
+      flags.extend(other.flags.begin(), other.flags.end());
+    }
   };
 
   struct stills_prediction_data : prediction_data {
@@ -133,11 +154,20 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Predict reflections for UB
+     * Predict reflections for UB. The indices are generated for blocks of
+     * frames at a time, so that the Reeke model and its loops over the p and q
+     * planes are set up once per block rather than once per frame. The
+     * predictions are independent of the block size but, within a block, are
+     * not ordered by frame.
      * @param ub The UB matrix
+     * @param block_size The number of frames to generate indices for at once
      * @returns A reflection table.
      */
-    af::reflection_table for_ub(const mat3<double> &ub) const {
+    af::reflection_table for_ub(const mat3<double> &ub,
+                                std::size_t block_size = 1) const {
+      DIALS_TRACE_SCOPE("prediction", "scan_static_for_ub");
+      DIALS_ASSERT(block_size > 0);
+
       // Get the array range and loop through all the images
       double a0 = scan_.get_oscillation_range()[0];
       double a1 = scan_.get_oscillation_range()[1];
@@ -153,10 +183,11 @@ namespace dials { namespace algorithms {
       // Create the reflection table and the local container
       af::reflection_table table;
       prediction_data predictions(table);
-      for (int frame = z0; frame < z1; ++frame) {
+      for (int first = z0; first < z1; first += block_size) {
+        int last = std::min(first + (int)block_size, z1);
         mat3<double> A1 = ub;
         mat3<double> A2 = ub;
-        compute_setting_matrices(A1, A2, frame);
+        compute_setting_matrices(A1, A2, first, last);
 
         // Create the index generate and loop through the indices. For each index,
         // predict the rays and append to the reflection table
@@ -166,7 +197,7 @@ namespace dials { namespace algorithms {
           if (h.is_zero()) {
             break;
           }
-          append_for_index(predictions, ub, h, frame);
+          append_for_index(predictions, ub, h, first, last);
         }
       }
 
@@ -181,39 +212,61 @@ namespace dials { namespace algorithms {
      * @param entering The array of entering flags
      * @param panel The array of panels
      * @param ub A UB matrix
+     * @param nthreads The number of threads
      * @returns A reflection table.
      */
     af::reflection_table for_hkl(const af::const_ref<miller_index> &h,
                                  const af::const_ref<bool> &entering,
                                  const af::const_ref<std::size_t> &panel,
-                                 const mat3<double> &ub) const {
+                                 const mat3<double> &ub,
+                                 std::size_t nthreads = 1) const {
       af::shared<mat3<double> > uba(h.size(), ub);
-      return for_hkl_with_individual_ub(h, entering, panel, uba.const_ref());
+      return for_hkl_with_individual_ub(h, entering, panel, uba.const_ref(), nthreads);
     }
 
     /**
      * Predict reflections for specific Miller indices, entering flags, panels
-     * with individual UB matrices
+     * with individual UB matrices. The table has one row for each Miller
+     * index, so bands of rows are predicted in parallel straight into the
+     * columns of the table.
      * @param h The array of Miller indices
      * @param entering The array of entering flags
      * @param panel The array of panels
      * @param ub The array of UB matrices
+     * @param nthreads The number of threads
      * @returns A reflection table.
      */
     af::reflection_table for_hkl_with_individual_ub(
       const af::const_ref<miller_index> &h,
       const af::const_ref<bool> &entering,
       const af::const_ref<std::size_t> &panel,
-      const af::const_ref<mat3<double> > &ub) const {
+      const af::const_ref<mat3<double> > &ub,
+      std::size_t nthreads = 1) const {
       DIALS_ASSERT(ub.size() == h.size());
       DIALS_ASSERT(ub.size() == panel.size());
       DIALS_ASSERT(ub.size() == entering.size());
       DIALS_ASSERT(scan_.get_oscillation()[1] > 0.0);
-      af::reflection_table table;
+      af::reflection_table table(h.size());
       prediction_data predictions(table);
-      for (std::size_t i = 0; i < h.size(); ++i) {
-        append_for_index(predictions, ub[i], h[i], entering[i], panel[i]);
-      }
+      std::copy(h.begin(), h.end(), predictions.hkl.begin());
+      std::copy(entering.begin(), entering.end(), predictions.enter.begin());
+      std::copy(panel.begin(), panel.end(), predictions.panel.begin());
+      hkl_prediction data = {h,
+                             entering,
+                             panel,
+                             ub,
+                             predictions.s1.ref(),
+                             predictions.xyz_px.ref(),
+                             predictions.xyz_mm.ref(),
+                             predictions.flags.ref()};
+      detail::parallel_bands(
+        boost::bind(&ScanStaticReflectionPredictor::predict_hkl_range,
+                    this,
+                    boost::cref(data),
+                    _1,
+                    _2),
+        h.size(),
+        nthreads);
       DIALS_ASSERT(table.nrows() == h.size());
       return table;
     }
@@ -223,11 +276,13 @@ namespace dials { namespace algorithms {
      * matrix
      * @param table The reflection table
      * @param ub The ub matrix
+     * @param nthreads The number of threads
      */
     void for_reflection_table(af::reflection_table table,
-                              const mat3<double> &ub) const {
+                              const mat3<double> &ub,
+                              std::size_t nthreads = 1) const {
       af::shared<mat3<double> > uba(table.nrows(), ub);
-      for_reflection_table_with_individual_ub(table, uba.const_ref());
+      for_reflection_table_with_individual_ub(table, uba.const_ref(), nthreads);
     }
 
     /**
@@ -235,13 +290,15 @@ namespace dials { namespace algorithms {
      * matrices
      * @param table The reflection table
      * @param ub The list of ub matrices
+     * @param nthreads The number of threads
      */
     void for_reflection_table_with_individual_ub(
       af::reflection_table table,
-      const af::const_ref<mat3<double> > &ub) const {
+      const af::const_ref<mat3<double> > &ub,
+      std::size_t nthreads = 1) const {
       DIALS_ASSERT(ub.size() == table.nrows());
       af::reflection_table new_table = for_hkl_with_individual_ub(
-        table["miller_index"], table["entering"], table["panel"], ub);
+        table["miller_index"], table["entering"], table["panel"], ub, nthreads);
       DIALS_ASSERT(new_table.nrows() == table.nrows());
       table["miller_index"] = new_table["miller_index"];
       table["entering"] = new_table["entering"];
@@ -260,16 +317,19 @@ namespace dials { namespace algorithms {
 
   private:
     /**
-     * Helper function to compute the setting matrix and the beginning and end
-     * of a frame.
+     * Helper function to compute the setting matrix at the beginning and end
+     * of a range of frames.
      */
-    void compute_setting_matrices(mat3<double> &A1, mat3<double> &A2, int frame) const {
+    void compute_setting_matrices(mat3<double> &A1,
+                                  mat3<double> &A2,
+                                  int first,
+                                  int last) const {
       // Get the rotation axis and beam vector
       vec3<double> m2 = goniometer_.get_rotation_axis_datum();
 
       // Calculate the setting matrix at the beginning and end
-      double phi_beg = scan_.get_angle_from_array_index(frame);
-      double phi_end = scan_.get_angle_from_array_index(frame + 1);
+      double phi_beg = scan_.get_angle_from_array_index(first);
+      double phi_end = scan_.get_angle_from_array_index(last);
       mat3<double> r_fixed = goniometer_.get_fixed_rotation();
       mat3<double> r_setting = goniometer_.get_setting_rotation();
       mat3<double> r_beg = axis_and_angle_as_matrix(m2, phi_beg);
@@ -278,10 +338,15 @@ namespace dials { namespace algorithms {
       A2 = r_setting * r_end * r_fixed * A2;
     }
 
+    /**
+     * Predict the rays for a Miller index and keep those which are observed
+     * on one of the frames in the range [first, last)
+     */
     void append_for_index(prediction_data &p,
                           const mat3<double> ub,
                           const miller_index &h,
-                          int frame) const {
+                          int first,
+                          int last) const {
       af::small<Ray, 2> rays = predict_rays_(h, ub);
       for (std::size_t i = 0; i < rays.size(); ++i) {
         try {
@@ -292,7 +357,8 @@ namespace dials { namespace algorithms {
           af::shared<vec2<double> > frames =
             scan_.get_array_indices_with_angle(rays[i].angle, padding_, true);
           for (std::size_t j = 0; j < frames.size(); ++j) {
-            if (frame < frames[j][1] && frame + 1 > frames[j][1]) {
+            double z = frames[j][1];
+            if (first < z && z < last && z != std::floor(z)) {
               p.hkl.push_back(h);
               p.enter.push_back(rays[i].entering);
               p.s1.push_back(rays[i].s1);
@@ -300,7 +366,6 @@ namespace dials { namespace algorithms {
               p.flags.push_back(af::Predicted);
               p.xyz_mm.push_back(vec3<double>(mm[0], mm[1], frames[j][0]));
               p.xyz_px.push_back(vec3<double>(px[0], px[1], frames[j][1]));
-              break;
             }
           }
         } catch (dxtbx::error) {
@@ -336,37 +401,61 @@ namespace dials { namespace algorithms {
       }
     }
 
-    void append_for_index(prediction_data &p,
-                          const mat3<double> ub,
-                          const miller_index &h,
-                          bool entering,
-                          std::size_t panel) const {
-      p.hkl.push_back(h);
-      p.enter.push_back(entering);
-      p.panel.push_back(panel);
-      af::small<Ray, 2> rays = predict_rays_(h, ub);
-      for (std::size_t i = 0; i < rays.size(); ++i) {
-        if (rays[i].entering == entering) {
-          p.s1.push_back(rays[i].s1);
-          double frame = scan_.get_array_index_from_angle(rays[i].angle);
-          try {
-            vec2<double> mm = detector_[panel].get_ray_intersection(rays[i].s1);
-            vec2<double> px = detector_[panel].millimeter_to_pixel(mm);
-            p.xyz_mm.push_back(vec3<double>(mm[0], mm[1], rays[i].angle));
-            p.xyz_px.push_back(vec3<double>(px[0], px[1], frame));
-            p.flags.push_back(af::Predicted);
-          } catch (dxtbx::error) {
-            p.xyz_mm.push_back(vec3<double>(0, 0, rays[i].angle));
-            p.xyz_px.push_back(vec3<double>(0, 0, frame));
-            p.flags.push_back(0);
+    /**
+     * The input and output columns for predicting specific Miller indices
+     */
+    struct hkl_prediction {
+      af::const_ref<miller_index> h;
+      af::const_ref<bool> entering;
+      af::const_ref<std::size_t> panel;
+      af::const_ref<mat3<double> > ub;
+      af::ref<vec3<double> > s1;
+      af::ref<vec3<double> > xyz_px;
+      af::ref<vec3<double> > xyz_mm;
+      af::ref<std::size_t> flags;
+    };
+
+    /**
+     * Predict a range of rows for specific Miller indices. The product of the
+     * fixed rotation and the UB matrix is only recomputed when the UB matrix
+     * changes, which for a single UB matrix means once per range.
+     */
+    void predict_hkl_range(const hkl_prediction &data,
+                           std::size_t first,
+                           std::size_t last) const {
+      mat3<double> fixed_rotation = predict_rays_.fixed_rotation();
+      mat3<double> ub;
+      mat3<double> fixed_ub;
+      for (std::size_t k = first; k < last; ++k) {
+        if (k == first || !std::equal(ub.begin(), ub.end(), data.ub[k].begin())) {
+          ub = data.ub[k];
+          fixed_ub = fixed_rotation * ub;
+        }
+        data.s1[k] = vec3<double>(0, 0, 0);
+        data.xyz_mm[k] = vec3<double>(0, 0, 0);
+        data.xyz_px[k] = vec3<double>(0, 0, 0);
+        data.flags[k] = 0;
+        af::small<Ray, 2> rays =
+          predict_rays_.from_reciprocal_lattice_vector(fixed_ub * data.h[k]);
+        for (std::size_t i = 0; i < rays.size(); ++i) {
+          if (rays[i].entering == data.entering[k]) {
+            data.s1[k] = rays[i].s1;
+            double frame = scan_.get_array_index_from_angle(rays[i].angle);
+            try {
+              const Panel &panel = detector_[data.panel[k]];
+              vec2<double> mm = panel.get_ray_intersection(rays[i].s1);
+              vec2<double> px = panel.millimeter_to_pixel(mm);
+              data.xyz_mm[k] = vec3<double>(mm[0], mm[1], rays[i].angle);
+              data.xyz_px[k] = vec3<double>(px[0], px[1], frame);
+              data.flags[k] = af::Predicted;
+            } catch (dxtbx::error) {
+              data.xyz_mm[k] = vec3<double>(0, 0, rays[i].angle);
+              data.xyz_px[k] = vec3<double>(0, 0, frame);
+            }
+            break;
           }
-          return;
         }
       }
-      p.s1.push_back(vec3<double>(0, 0, 0));
-      p.xyz_mm.push_back(vec3<double>(0, 0, 0));
-      p.xyz_px.push_back(vec3<double>(0, 0, 0));
-      p.flags.push_back(0);
     }
 
     boost::shared_ptr<BeamBase> beam_;
@@ -454,35 +543,29 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Predict all the reflections given an array of UB matrices.
+     * Predict all the reflections given an array of UB matrices. The frames
+     * are split into blocks which are predicted in parallel and the results
+     * are joined in frame order, so they do not depend on the number of
+     * threads.
      * @param A The UB matrix recorded at scan points
+     * @param nthreads The number of threads
      * @returns The reflection table
      */
-    af::reflection_table for_ub(const af::const_ref<mat3<double> > &A) const {
+    af::reflection_table for_ub(const af::const_ref<mat3<double> > &A,
+                                std::size_t nthreads = 1) const {
+      DIALS_TRACE_SCOPE("prediction", "scan_varying_for_ub");
       DIALS_ASSERT(A.size() == scan_.get_num_images() + 1);
-
-      // Create the table and local stuff
-      af::reflection_table table;
-      prediction_data predictions(table);
-
-      // Get the array range and loop through all the images
-      vec2<int> array_range = scan_.get_array_range();
-      double a0 = scan_.get_oscillation_range()[0];
-      double a1 = scan_.get_oscillation_range()[1];
-      int z0 =
-        std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
-      int z1 =
-        std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
-      const int offset = array_range[0];
-      for (int frame = z0; frame < z1; ++frame) {
-        int i = frame - offset;
-        if (i < 0) i = 0;
-        if (i >= A.size() - 1) i = A.size() - 2;
-        append_for_image(predictions, frame, A[i], A[i + 1]);
-      }
-
-      // Return the reflection table
-      return table;
+      vec2<int> frames = frame_range();
+      return predict_frames(
+        boost::bind(&ScanVaryingReflectionPredictor::append_for_ub_frames,
+                    this,
+                    _1,
+                    boost::cref(A),
+                    _2,
+                    _3),
+        frames[0],
+        frames[1],
+        nthreads);
     }
 
     /**
@@ -517,39 +600,29 @@ namespace dials { namespace algorithms {
      * @param A The UB matrix recorded at scan points
      * @param s0 The s0 vector recorded at scan points
      * @param S The setting rotation matrix recorded at scan points
+     * @param nthreads The number of threads
      * @returns The reflection table
      */
-    af::reflection_table for_varying_models(
-      const af::const_ref<mat3<double> > &A,
-      const af::const_ref<vec3<double> > &s0,
-      const af::const_ref<mat3<double> > &S) const {
+    af::reflection_table for_varying_models(const af::const_ref<mat3<double> > &A,
+                                            const af::const_ref<vec3<double> > &s0,
+                                            const af::const_ref<mat3<double> > &S,
+                                            std::size_t nthreads = 1) const {
       DIALS_ASSERT(A.size() == scan_.get_num_images() + 1);
       DIALS_ASSERT(s0.size() == A.size());
       DIALS_ASSERT(S.size() == A.size());
-
-      // Create the table and local stuff
-      af::reflection_table table;
-      prediction_data predictions(table);
-
-      // Get the array range and loop through all the images
-      vec2<int> array_range = scan_.get_array_range();
-      double a0 = scan_.get_oscillation_range()[0];
-      double a1 = scan_.get_oscillation_range()[1];
-      int z0 =
-        std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
-      int z1 =
-        std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
-      const int offset = array_range[0];
-      for (int frame = z0; frame < z1; ++frame) {
-        int i = frame - offset;
-        if (i < 0) i = 0;
-        if (i >= A.size() - 1) i = A.size() - 2;
-        append_for_image(
-          predictions, frame, A[i], A[i + 1], s0[i], s0[i + 1], S[i], S[i + 1]);
-      }
-
-      // Return the reflection table
-      return table;
+      vec2<int> frames = frame_range();
+      return predict_frames(
+        boost::bind(&ScanVaryingReflectionPredictor::append_for_varying_models_frames,
+                    this,
+                    _1,
+                    boost::cref(A),
+                    boost::cref(s0),
+                    boost::cref(S),
+                    _2,
+                    _3),
+        frames[0],
+        frames[1],
+        nthreads);
     }
 
     /**
@@ -617,9 +690,10 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(scan_.get_oscillation()[1] > 0.0);
       af::reflection_table table;
       prediction_data predictions(table);
+      model_state_cache cache;
       for (std::size_t i = 0; i < h.size(); ++i) {
         append_for_index(
-          predictions, ub[i], s0[i], d[i], S[i], h[i], entering[i], panel[i]);
+          predictions, cache, ub[i], s0[i], d[i], S[i], h[i], entering[i], panel[i]);
       }
       DIALS_ASSERT(table.nrows() == h.size());
       return table;
@@ -645,6 +719,123 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(S.size() == table.nrows());
       af::reflection_table new_table = for_hkl_with_individual_model(
         table["miller_index"], table["entering"], table["panel"], ub, s0, d, S);
+      update_reflection_table(table, new_table);
+    }
+
+    /**
+     * Predict reflections for specific Miller indices, entering flags and
+     * panels, where the reflections are grouped into blocks that share a UB
+     * matrix, s0 vector and S (goniometer setting) matrix, and a d matrix for
+     * each panel, as in scan-varying refinement. The ray predictor and the
+     * rotated UB matrix are set up once per block and the panel frames once
+     * per block and panel, rather than for each reflection. A reflection whose
+     * models differ from those of the first reflection in its block is
+     * predicted with its own models.
+     * @param h The array of miller indices
+     * @param entering The array of entering flags
+     * @param panel The array of panels
+     * @param block The array of block numbers
+     * @param ub The array of UB matrices
+     * @param s0 The array of s0 vectors
+     * @param d The array of d matrices
+     * @param S The array of setting matrices
+     * @returns A reflection table.
+     */
+    af::reflection_table for_hkl_by_block(const af::const_ref<miller_index> &h,
+                                          const af::const_ref<bool> &entering,
+                                          const af::const_ref<std::size_t> &panel,
+                                          const af::const_ref<std::size_t> &block,
+                                          const af::const_ref<mat3<double> > &ub,
+                                          const af::const_ref<vec3<double> > &s0,
+                                          const af::const_ref<mat3<double> > &d,
+                                          const af::const_ref<mat3<double> > &S) const {
+      DIALS_ASSERT(ub.size() == h.size());
+      DIALS_ASSERT(ub.size() == panel.size());
+      DIALS_ASSERT(ub.size() == entering.size());
+      DIALS_ASSERT(ub.size() == block.size());
+      DIALS_ASSERT(ub.size() == s0.size());
+      DIALS_ASSERT(ub.size() == d.size());
+      DIALS_ASSERT(ub.size() == S.size());
+      DIALS_ASSERT(scan_.get_oscillation()[1] > 0.0);
+      af::reflection_table table;
+      prediction_data predictions(table);
+      model_state_cache cache;
+
+      // The model states of each block, set from its first reflection
+      std::size_t num_blocks = 0;
+      for (std::size_t i = 0; i < block.size(); ++i) {
+        num_blocks = std::max(num_blocks, block[i] + 1);
+      }
+      std::vector<block_state> states(num_blocks);
+
+      for (std::size_t i = 0; i < h.size(); ++i) {
+        DIALS_ASSERT(panel[i] < detector_.size());
+        block_state &state = states[block[i]];
+        if (!state.predictor) {
+          set_block_state(state, ub[i], s0[i], S[i]);
+        }
+        std::size_t p = panel[i];
+        if (!state.local_panel[p]) {
+          state.local_panel[p] = local_panel(p, d[i]);
+          state.d[p] = d[i];
+        }
+        if (!same_elements(state.ub, ub[i]) || !same_elements(state.s0, s0[i])
+            || !same_elements(state.S, S[i]) || !same_elements(state.d[p], d[i])) {
+          append_for_index(
+            predictions, cache, ub[i], s0[i], d[i], S[i], h[i], entering[i], p);
+          continue;
+        }
+        predictions.hkl.push_back(h[i]);
+        predictions.enter.push_back(entering[i]);
+        predictions.panel.push_back(p);
+        vec3<double> pstar0 = state.rub * h[i];
+        append_for_rays(predictions,
+                        state.predictor->from_reciprocal_lattice_vector(pstar0),
+                        *state.local_panel[p],
+                        entering[i]);
+      }
+      DIALS_ASSERT(table.nrows() == h.size());
+      return table;
+    }
+
+    /**
+     * Predict reflections and add to the entries in the table, for reflections
+     * grouped into blocks that share their models
+     * @param table The reflection table
+     * @param block The block number array
+     * @param ub The ub matrix array
+     * @param s0 The s0 vector array
+     * @param d The d matrix array
+     * @param S The S (goniometer setting) matrix array
+     */
+    void for_reflection_table_by_block(af::reflection_table table,
+                                       const af::const_ref<std::size_t> &block,
+                                       const af::const_ref<mat3<double> > &ub,
+                                       const af::const_ref<vec3<double> > &s0,
+                                       const af::const_ref<mat3<double> > &d,
+                                       const af::const_ref<mat3<double> > &S) const {
+      DIALS_ASSERT(block.size() == table.nrows());
+      DIALS_ASSERT(ub.size() == table.nrows());
+      DIALS_ASSERT(s0.size() == table.nrows());
+      DIALS_ASSERT(d.size() == table.nrows());
+      DIALS_ASSERT(S.size() == table.nrows());
+      af::reflection_table new_table = for_hkl_by_block(table["miller_index"],
+                                                        table["entering"],
+                                                        table["panel"],
+                                                        block,
+                                                        ub,
+                                                        s0,
+                                                        d,
+                                                        S);
+      update_reflection_table(table, new_table);
+    }
+
+  private:
+    /**
+     * Copy the predictions into the table
+     */
+    void update_reflection_table(af::reflection_table table,
+                                 af::reflection_table new_table) const {
       DIALS_ASSERT(new_table.nrows() == table.nrows());
       table["miller_index"] = new_table["miller_index"];
       table["entering"] = new_table["entering"];
@@ -661,7 +852,104 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(table.is_consistent());
     }
 
-  private:
+    /**
+     * @returns The range of frames to predict on, including the padding
+     */
+    vec2<int> frame_range() const {
+      double a0 = scan_.get_oscillation_range()[0];
+      double a1 = scan_.get_oscillation_range()[1];
+      int z0 =
+        std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
+      int z1 =
+        std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
+      return vec2<int>(z0, z1);
+    }
+
+    /**
+     * Predict the reflections for a range of frames. Each block of frames is
+     * predicted into its own table and the tables are joined in order.
+     * @param function The function to predict a range of frames
+     * @param z0 The first frame
+     * @param z1 The last frame
+     * @param nthreads The number of threads
+     * @returns The reflection table
+     */
+    template <typename Function>
+    af::reflection_table predict_frames(Function function,
+                                        int z0,
+                                        int z1,
+                                        std::size_t nthreads) const {
+      DIALS_ASSERT(nthreads > 0);
+      af::reflection_table table;
+      prediction_data predictions(table);
+      std::size_t num_frames = z1 > z0 ? z1 - z0 : 0;
+      nthreads = std::min(nthreads, num_frames);
+      if (nthreads <= 1) {
+        function(predictions, z0, z1);
+        return table;
+      }
+
+      // Create the tables for each block in this thread
+      int block_size = (num_frames + nthreads - 1) / nthreads;
+      std::vector<af::reflection_table> block_table;
+      std::vector<prediction_data> block_predictions;
+      for (int first = z0; first < z1; first += block_size) {
+        block_table.push_back(af::reflection_table());
+        block_predictions.push_back(prediction_data(block_table.back()));
+      }
+
+      // Predict each block of frames
+      ThreadPool pool(nthreads);
+      for (std::size_t b = 0; b < block_predictions.size(); ++b) {
+        int first = z0 + b * block_size;
+        int last = std::min(first + block_size, z1);
+        pool.post(boost::bind(function, boost::ref(block_predictions[b]), first, last));
+      }
+      pool.wait();
+
+      // Join the blocks in frame order
+      for (std::size_t b = 0; b < block_predictions.size(); ++b) {
+        predictions.extend(block_predictions[b]);
+      }
+      return table;
+    }
+
+    /**
+     * Predict the reflections on a range of frames given an array of UB
+     * matrices.
+     */
+    void append_for_ub_frames(prediction_data &p,
+                              const af::const_ref<mat3<double> > &A,
+                              int first,
+                              int last) const {
+      const int offset = scan_.get_array_range()[0];
+      for (int frame = first; frame < last; ++frame) {
+        int i = frame - offset;
+        if (i < 0) i = 0;
+        if (i >= A.size() - 1) i = A.size() - 2;
+        append_for_image(p, frame, A[i], A[i + 1]);
+      }
+    }
+
+    /**
+     * Predict the reflections on a range of frames given arrays of UB
+     * matrices, s0 vectors and setting rotations.
+     */
+    void append_for_varying_models_frames(prediction_data &p,
+                                          const af::const_ref<mat3<double> > &A,
+                                          const af::const_ref<vec3<double> > &s0,
+                                          const af::const_ref<mat3<double> > &S,
+                                          int first,
+                                          int last) const {
+      const int offset = scan_.get_array_range()[0];
+      for (int frame = first; frame < last; ++frame) {
+        int i = frame - offset;
+        if (i < 0) i = 0;
+        if (i >= A.size() - 1) i = A.size() - 2;
+        append_for_image(p, frame, A[i], A[i + 1], s0[i], s0[i + 1], S[i], S[i + 1]);
+      }
+    }
+
     /**
      * Helper function to compute the crystal setting matrix at the beginning
      * and end of a frame.
@@ -848,9 +1136,110 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * The ray predictor and local panel for the last model state used in
+     * for_hkl_with_individual_model. Consecutive reflections usually share
+     * the same s0 vector, setting rotation and panel frame, even when the UB
+     * matrix varies, so these are only rebuilt when the model state changes.
+     */
+    struct model_state_cache {
+      boost::optional<ScanStaticRayPredictor> predictor;
+      vec3<double> s0;
+      mat3<double> S;
+      boost::optional<Panel> local_panel;
+      std::size_t panel;
+      mat3<double> d;
+    };
+
+    /**
+     * The models shared by the reflections in a block, with the ray predictor,
+     * the UB matrix rotated by the fixed rotation and the local panels made
+     * from them
+     */
+    struct block_state {
+      boost::optional<ScanStaticRayPredictor> predictor;
+      mat3<double> ub;
+      vec3<double> s0;
+      mat3<double> S;
+      mat3<double> rub;
+      std::vector<boost::optional<Panel> > local_panel;
+      std::vector<mat3<double> > d;
+    };
+
+    /**
+     * Set up the state of a block from its models
+     */
+    void set_block_state(block_state &state,
+                         const mat3<double> &ub,
+                         const vec3<double> &s0,
+                         const mat3<double> &S) const {
+      state.predictor = ScanStaticRayPredictor(s0,
+                                               goniometer_.get_rotation_axis_datum(),
+                                               goniometer_.get_fixed_rotation(),
+                                               S,
+                                               vec2<double>(0.0, two_pi));
+      state.ub = ub;
+      state.s0 = s0;
+      state.S = S;
+      state.rub = state.predictor->fixed_rotation() * ub;
+      state.local_panel.resize(detector_.size());
+      state.d.resize(detector_.size());
+    }
+
+    /**
+     * @returns True if the elements of a and b are all equal
+     */
+    template <typename T>
+    static bool same_elements(const T &a, const T &b) {
+      return std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    /**
+     * @returns The ray predictor for the s0 vector and setting rotation
+     */
+    const ScanStaticRayPredictor &ray_predictor(model_state_cache &cache,
+                                                const vec3<double> &s0,
+                                                const mat3<double> &S) const {
+      if (!cache.predictor || !same_elements(cache.s0, s0)
+          || !same_elements(cache.S, S)) {
+        cache.predictor = ScanStaticRayPredictor(s0,
+                                                 goniometer_.get_rotation_axis_datum(),
+                                                 goniometer_.get_fixed_rotation(),
+                                                 S,
+                                                 vec2<double>(0.0, two_pi));
+        cache.s0 = s0;
+        cache.S = S;
+      }
+      return *cache.predictor;
+    }
+
+    /**
+     * @returns A copy of the panel with the given d matrix
+     */
+    const Panel &local_panel(model_state_cache &cache,
+                             std::size_t panel,
+                             const mat3<double> &d) const {
+      if (!cache.local_panel || cache.panel != panel || !same_elements(cache.d, d)) {
+        cache.local_panel = local_panel(panel, d);
+        cache.panel = panel;
+        cache.d = d;
+      }
+      return *cache.local_panel;
+    }
+
+    /**
+     * @returns A copy of the panel with the given d matrix
+     */
+    Panel local_panel(std::size_t panel, const mat3<double> &d) const {
+      Panel result(detector_[panel]);
+      result.set_frame(d.get_column(0), d.get_column(1), d.get_column(2));
+      return result;
+    }
+
     /**
      * Predict for a given miller index and all model states.
      * @param p The reflection data
+     * @param cache The ray predictor and panel for the last model state
      * @param ub The UB matrix
      * @param s0 The s0 vector
      * @param d The d matrix
@@ -860,6 +1249,7 @@ namespace dials { namespace algorithms {
      * @param panel The panel number
      */
     void append_for_index(prediction_data &p,
+                          model_state_cache &cache,
                           const mat3<double> ub,
                           const vec3<double> s0,
                           const mat3<double> d,
@@ -871,22 +1261,30 @@ namespace dials { namespace algorithms {
       p.enter.push_back(entering);
       p.panel.push_back(panel);
       // Need a local ray predictor for just this reflection's s0
-      ScanStaticRayPredictor local_predict_rays_(s0,
-                                                 goniometer_.get_rotation_axis_datum(),
-                                                 goniometer_.get_fixed_rotation(),
-                                                 S,
-                                                 vec2<double>(0.0, two_pi));
-      af::small<Ray, 2> rays = local_predict_rays_(h, ub);
+      af::small<Ray, 2> rays = ray_predictor(cache, s0, S)(h, ub);
+      // Need a local panel with the right D matrix
+      append_for_rays(p, rays, local_panel(cache, panel, d), entering);
+    }
+
+    /**
+     * Add the prediction for the ray with the given entering flag, or an
+     * unpredicted entry if there is none.
+     * @param p The reflection data
+     * @param rays The rays predicted for the miller index
+     * @param local The panel with the d matrix for the reflection
+     * @param entering The entering flag
+     */
+    void append_for_rays(prediction_data &p,
+                         const af::small<Ray, 2> &rays,
+                         const Panel &local,
+                         bool entering) const {
       for (std::size_t i = 0; i < rays.size(); ++i) {
         if (rays[i].entering == entering) {
           p.s1.push_back(rays[i].s1);
           double frame = scan_.get_array_index_from_angle(rays[i].angle);
           try {
-            // Need a local panel with the right D matrix
-            Panel local_panel(detector_[panel]);
-            local_panel.set_frame(d.get_column(0), d.get_column(1), d.get_column(2));
-            vec2<double> mm = local_panel.get_ray_intersection(rays[i].s1);
-            vec2<double> px = local_panel.millimeter_to_pixel(mm);
+            vec2<double> mm = local.get_ray_intersection(rays[i].s1);
+            vec2<double> px = local.millimeter_to_pixel(mm);
             p.xyz_mm.push_back(vec3<double>(mm[0], mm[1], rays[i].angle));
             p.xyz_px.push_back(vec3<double>(px[0], px[1], frame));
             p.flags.push_back(af::Predicted);
@@ -959,19 +1357,17 @@ namespace dials { namespace algorithms {
       af::reflection_table table;
       stills_prediction_data predictions(table);
 
-      // Create the index generate and loop through the indices. For each index,
-      // predict the rays and append to the reflection table
-      IndexGenerator indices(unit_cell_, space_group_type_, dmin_);
-      for (;;) {
-        miller_index h = indices.next();
-        if (h.is_zero()) {
-          break;
-        }
+      // Loop through the indices. For each index, predict the rays and append
+      // to the reflection table
+      const af::shared<miller_index> &indices = all_indices();
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        const miller_index &h = indices[i];
 
-        Ray ray;
-        ray = predict_ray_(h, ub);
-        double delpsi = std::abs(predict_ray_.get_delpsi());
-        if (delpsi < 0.0015) append_for_index(predictions, ub, h);
+        double delpsi = 0;
+        Ray ray = predict_ray(h, ub, delpsi);
+        if (std::abs(delpsi) < 0.0015) {
+          append_for_ray(predictions, h, ray, -1, delpsi);
+        }
       }
 
       // Return the reflection table
@@ -1023,24 +1419,45 @@ namespace dials { namespace algorithms {
 
     /**
      * Predict reflections for specific Miller indices, panels and individual
-     * UB matrices
+     * UB matrices. The table has one row for each Miller index, so bands of
+     * rows are predicted in parallel straight into the columns of the table.
+     * Every reflection must intersect its panel.
      * @param h The array of miller indices
      * @param panel The array of panels
      * @param ub The array of setting matrices
+     * @param nthreads The number of threads
      * @returns A reflection table.
      */
     af::reflection_table for_hkl_with_individual_ub(
       const af::const_ref<miller_index> &h,
       const af::const_ref<std::size_t> &panel,
-      const af::const_ref<mat3<double> > &ub) {
+      const af::const_ref<mat3<double> > &ub,
+      std::size_t nthreads = 1) const {
       DIALS_ASSERT(ub.size() == h.size());
       DIALS_ASSERT(ub.size() == panel.size());
-      af::reflection_table table;
-      af::shared<double> column;
-      table["delpsical.rad"] = column;
+      af::reflection_table table(h.size());
       stills_prediction_data predictions(table);
-      for (std::size_t i = 0; i < h.size(); ++i) {
-        append_for_index(predictions, ub[i], h[i], panel[i]);
+      std::copy(h.begin(), h.end(), predictions.hkl.begin());
+      std::copy(panel.begin(), panel.end(), predictions.panel.begin());
+      std::fill(predictions.enter.begin(), predictions.enter.end(), false);
+      hkl_prediction data = {h,
+                             panel,
+                             ub,
+                             predictions.s1.ref(),
+                             predictions.xyz_px.ref(),
+                             predictions.xyz_mm.ref(),
+                             predictions.flags.ref(),
+                             predictions.delpsi.ref()};
+      detail::parallel_bands(
+        boost::bind(&StillsDeltaPsiReflectionPredictor::predict_hkl_range,
+                    this,
+                    boost::cref(data),
+                    _1,
+                    _2),
+        h.size(),
+        nthreads);
+      for (std::size_t i = 0; i < predictions.flags.size(); ++i) {
+        DIALS_ASSERT(predictions.flags[i] & af::Predicted);
       }
       DIALS_ASSERT(table.nrows() == h.size());
       return table;
@@ -1051,23 +1468,29 @@ namespace dials { namespace algorithms {
      * matrix
      * @param table The reflection table
      * @param ub The ub matrix
+     * @param nthreads The number of threads
      */
-    void for_reflection_table(af::reflection_table table, const mat3<double> &ub) {
+    void for_reflection_table(af::reflection_table table,
+                              const mat3<double> &ub,
+                              std::size_t nthreads = 1) const {
       af::shared<mat3<double> > uba(table.nrows(), ub);
-      for_reflection_table_with_individual_ub(table, uba.const_ref());
+      for_reflection_table_with_individual_ub(table, uba.const_ref(), nthreads);
     }
 
     /**
      * Predict reflections and add to the entries in the table for an array of
      * UB matrices
      * @param table The reflection table
+     * @param ub The array of UB matrices
+     * @param nthreads The number of threads
      */
     void for_reflection_table_with_individual_ub(
       af::reflection_table table,
-      const af::const_ref<mat3<double> > &ub) {
+      const af::const_ref<mat3<double> > &ub,
+      std::size_t nthreads = 1) const {
       DIALS_ASSERT(ub.size() == table.nrows());
-      af::reflection_table new_table =
-        for_hkl_with_individual_ub(table["miller_index"], table["panel"], ub);
+      af::reflection_table new_table = for_hkl_with_individual_ub(
+        table["miller_index"], table["panel"], ub, nthreads);
       DIALS_ASSERT(new_table.nrows() == table.nrows());
       table["miller_index"] = new_table["miller_index"];
       table["panel"] = new_table["panel"];
@@ -1098,17 +1521,46 @@ namespace dials { namespace algorithms {
      * @param h The miller index
      * @param panel The panel index
      */
-    virtual void append_for_index(stills_prediction_data &p,
-                                  const mat3<double> ub,
-                                  const miller_index &h,
-                                  int panel = -1) {
-      // af::small<Ray, 2> rays = predict_rays_(h, ub_);
-      Ray ray;
-      ray = predict_ray_(h, ub);
-      double delpsi = predict_ray_.get_delpsi();
+    void append_for_index(stills_prediction_data &p,
+                          const mat3<double> ub,
+                          const miller_index &h,
+                          int panel = -1) const {
+      double delpsi = 0;
+      Ray ray = predict_ray(h, ub, delpsi);
       append_for_ray(p, h, ray, panel, delpsi);
     }
 
+    /**
+     * The indices are generated on the first call and kept, since they depend
+     * only on the unit cell, space group and resolution and not on the UB
+     * matrix.
+     * @returns All the indices to the resolution limit
+     */
+    const af::shared<miller_index> &all_indices() {
+      if (!indices_) {
+        indices_ = IndexGenerator(unit_cell_, space_group_type_, dmin_).to_array();
+      }
+      return *indices_;
+    }
+
+    /**
+     * Predict the ray for the given Miller index and UB matrix. The ray
+     * predictor keeps the last delta psi, so a copy is used to allow this to
+     * be called from several threads.
+     * @param h The miller index
+     * @param ub The UB matrix
+     * @param delpsi The calculated minimum rotation to Ewald sphere
+     * @returns The ray
+     */
+    virtual Ray predict_ray(const miller_index &h,
+                            const mat3<double> &ub,
+                            double &delpsi) const {
+      StillsRayPredictor predictor = predict_ray_;
+      Ray ray = predictor(h, ub);
+      delpsi = predictor.get_delpsi();
+      return ray;
+    }
+
     /**
      * Predict for the given Miller index, ray, panel number and delta psi
      * @param p The reflection data
@@ -1145,6 +1597,48 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * The input and output columns for predicting specific Miller indices
+     */
+    struct hkl_prediction {
+      af::const_ref<miller_index> h;
+      af::const_ref<std::size_t> panel;
+      af::const_ref<mat3<double> > ub;
+      af::ref<vec3<double> > s1;
+      af::ref<vec3<double> > xyz_px;
+      af::ref<vec3<double> > xyz_mm;
+      af::ref<std::size_t> flags;
+      af::ref<double> delpsi;
+    };
+
+    /**
+     * Predict a range of rows for specific Miller indices. Rows which do not
+     * intersect their panel are left without the predicted flag.
+     */
+    void predict_hkl_range(const hkl_prediction &data,
+                           std::size_t first,
+                           std::size_t last) const {
+      for (std::size_t k = first; k < last; ++k) {
+        double delpsi = 0;
+        Ray ray = predict_ray(data.h[k], data.ub[k], delpsi);
+        data.s1[k] = ray.s1;
+        data.delpsi[k] = delpsi;
+        data.xyz_mm[k] = vec3<double>(0, 0, 0);
+        data.xyz_px[k] = vec3<double>(0, 0, 0);
+        data.flags[k] = 0;
+        try {
+          const Panel &panel = detector_[data.panel[k]];
+          vec2<double> mm = panel.get_ray_intersection(ray.s1);
+          vec2<double> px = panel.millimeter_to_pixel(mm);
+          data.xyz_mm[k] = vec3<double>(mm[0], mm[1], 0.0);
+          data.xyz_px[k] = vec3<double>(px[0], px[1], 0.0);
+          data.flags[k] = af::Predicted;
+        } catch (dxtbx::error) {
+          // do nothing
+        }
+      }
+    }
+
     /**
      * Helper function to do ray intersection with/without panel set.
      */
@@ -1167,6 +1661,7 @@ namespace dials { namespace algorithms {
     cctbx::sgtbx::space_group_type space_group_type_;
     const double dmin_;
     StillsRayPredictor predict_ray_;
+    boost::optional<af::shared<miller_index> > indices_;
   };
 
   class NaveStillsReflectionPredictor : public StillsDeltaPsiReflectionPredictor {
@@ -1204,23 +1699,20 @@ namespace dials { namespace algorithms {
       af::reflection_table table;
       stills_prediction_data predictions(table);
 
-      // Create the index generate and loop through the indices. For each index,
-      // predict the rays and append to the reflection table
-      IndexGenerator indices(unit_cell_, space_group_type_, dmin_);
-      for (;;) {
-        miller_index h = indices.next();
-        if (h.is_zero()) {
-          break;
-        }
+      // Loop through the indices. For each index, predict the rays and append
+      // to the reflection table
+      const af::shared<miller_index> &indices = all_indices();
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        const miller_index &h = indices[i];
         double d = unit_cell_.d(h);
         double deltapsi_model = (d / ML_domain_size_ang_)
                                 + (ML_half_mosaicity_deg_ * pi_180 / 2);  // equation 16
 
-        Ray ray;
-        ray = predict_ray_(h, ub);
-        double delpsi = std::abs(predict_ray_.get_delpsi());
-        if (delpsi < deltapsi_model)  // equation 17
-          append_for_index(predictions, ub, h);
+        double delpsi = 0;
+        Ray ray = predict_ray(h, ub, delpsi);
+        if (std::abs(delpsi) < deltapsi_model) {  // equation 17
+          append_for_ray(predictions, h, ray, -1, delpsi);
+        }
       }
 
       // Return the reflection table
@@ -1269,19 +1761,17 @@ namespace dials { namespace algorithms {
       af::reflection_table table;
       stills_prediction_data predictions(table);
 
-      // Create the index generate and loop through the indices. For each index,
-      // predict the rays and append to the reflection table
-      IndexGenerator indices(unit_cell_, space_group_type_, dmin_);
-      for (;;) {
-        miller_index h = indices.next();
-        if (h.is_zero()) {
-          break;
-        }
+      // Loop through the indices. For each index, predict the rays and append
+      // to the reflection table
+      const af::shared<miller_index> &indices = all_indices();
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        const miller_index &h = indices[i];
 
-        Ray ray;
-        ray = spherical_relp_predict_ray_(h, ub);
-        double delpsi = std::abs(spherical_relp_predict_ray_.get_delpsi());
-        if (delpsi < 0.0015) append_for_index(predictions, ub, h);
+        double delpsi = 0;
+        Ray ray = predict_ray(h, ub, delpsi);
+        if (std::abs(delpsi) < 0.0015) {
+          append_for_ray(predictions, h, ray, -1, delpsi);
+        }
       }
 
       // Return the reflection table
@@ -1290,20 +1780,20 @@ namespace dials { namespace algorithms {
 
   protected:
     /**
-     * Predict for the given Miller index, UB matrix and panel number.
+     * Predict the ray for the given Miller index and UB matrix.
      * Override uses SphericalRelpStillsRayPredictor.
-     * @param p The reflection data
      * @param h The miller index
+     * @param ub The UB matrix
+     * @param delpsi The calculated minimum rotation to Ewald sphere
+     * @returns The ray
      */
-    virtual void append_for_index(stills_prediction_data &p,
-                                  const mat3<double> ub,
-                                  const miller_index &h,
-                                  int panel = -1) {
-      // af::small<Ray, 2> rays = predict_rays_(h, ub_);
-      Ray ray;
-      ray = spherical_relp_predict_ray_(h, ub);
-      double delpsi = spherical_relp_predict_ray_.get_delpsi();
-      append_for_ray(p, h, ray, panel, delpsi);
+    virtual Ray predict_ray(const miller_index &h,
+                            const mat3<double> &ub,
+                            double &delpsi) const {
+      SphericalRelpStillsRayPredictor predictor = spherical_relp_predict_ray_;
+      Ray ray = predictor(h, ub);
+      delpsi = predictor.get_delpsi();
+      return ray;
     }
 
     SphericalRelpStillsRayPredictor spherical_relp_predict_ray_;
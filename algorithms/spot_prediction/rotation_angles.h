@@ -16,6 +16,7 @@
 #include <scitbx/vec3.h>
 #include <scitbx/mat3.h>
 #include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -49,7 +50,8 @@ namespace dials { namespace algorithms {
           m1_(calculate_goniometer_m1_axis()),
           m3_(calculate_goniometer_m3_axis()),
           s0_d_m2(s0_ * m2_),
-          s0_d_m3(s0_ * m3_) {}
+          s0_d_m3(s0_ * m3_),
+          four_s0_len_sq(4 * s0_.length_sq()) {}
 
     /**
      * Calculate the rotation angles using the XDS method
@@ -58,9 +60,45 @@ namespace dials { namespace algorithms {
      * @throws error if no angles exist.
      */
     vec2<double> operator()(vec3<double> pstar0) const {
+      vec2<double> phi;
+      DIALS_ASSERT(calculate(pstar0, phi));
+      return phi;
+    }
+
+    /**
+     * Calculate the rotation angles for an array of reciprocal space vectors.
+     * Vectors which never reach the diffracting condition are flagged as not
+     * valid and their angles set to zero.
+     * @param pstar0 The unrotated reciprocal space vectors
+     * @param phi The two rotation angles for each vector
+     * @param valid Whether each vector has rotation angles
+     */
+    void calculate(const af::const_ref<vec3<double> > &pstar0,
+                   af::ref<vec2<double> > phi,
+                   af::ref<bool> valid) const {
+      DIALS_ASSERT(phi.size() == pstar0.size());
+      DIALS_ASSERT(valid.size() == pstar0.size());
+      for (std::size_t i = 0; i < pstar0.size(); ++i) {
+        valid[i] = calculate(pstar0[i], phi[i]);
+        if (!valid[i]) {
+          phi[i] = vec2<double>(0, 0);
+        }
+      }
+    }
+
+    /**
+     * Calculate the rotation angles using the XDS method without throwing an
+     * exception when there are none, for use in loops over many vectors.
+     * @param pstar0 The unrotated reciprocal space vector
+     * @param phi The two rotation angles that satisfy the laue equations
+     * @returns True if the angles exist
+     */
+    bool calculate(vec3<double> pstar0, vec2<double> &phi) const {
       // Calculate sq length of pstar0 and ensure p*^2 <= 4s0^2
       double pstar0_len_sq = pstar0.length_sq();
-      DIALS_ASSERT(pstar0_len_sq <= 4 * s0_.length_sq());
+      if (!(pstar0_len_sq <= four_s0_len_sq)) {
+        return false;
+      }
 
       // Calculate dot product of p*0 with m1 and m3
       double pstar0_d_m1 = pstar0 * m1_;
@@ -73,7 +111,9 @@ namespace dials { namespace algorithms {
       // Calculate sq distance of p*0 from rotation axis and ensure that
       // rho^2 >= (p*.m3)^2
       double rho_sq = (pstar0_len_sq - sqr(pstar0_d_m2));
-      DIALS_ASSERT(rho_sq >= sqr(pstar_d_m3));
+      if (!(rho_sq >= sqr(pstar_d_m3))) {
+        return false;
+      }
 
       // Calculate dot product of p* with m1
       double pstar_d_m1 = sqrt(rho_sq - sqr(pstar_d_m3));
@@ -86,7 +126,8 @@ namespace dials { namespace algorithms {
       sinphi2 = (-(pstar_d_m1 * pstar0_d_m3) - (pstar_d_m3 * pstar0_d_m1));
 
       // Return the two angles
-      return vec2<double>(atan2(sinphi1, cosphi1), atan2(sinphi2, cosphi2));
+      phi = vec2<double>(atan2(sinphi1, cosphi1), atan2(sinphi2, cosphi2));
+      return true;
     }
 
     /**
@@ -118,6 +159,7 @@ namespace dials { namespace algorithms {
     vec3<double> m3_;
     double s0_d_m2;
     double s0_d_m3;
+    double four_s0_len_sq;
   };
 
   /**
@@ -5,8 +5,12 @@
 __all__ = (  # noqa: F405
     "BinnedGMMSingle1D",
     "BinnedGMMSingle1DFixedMean",
+    "BinnedGMMSingle1DMulti",
+    "DeltaCChalf",
+    "PearsonCorrelationAccumulator",
     "kolmogorov_smirnov_one_sided_cdf",
     "kolmogorov_smirnov_test_standard_normal",
+    "kolmogorov_smirnov_test_standard_normal_batch",
     "kolmogorov_smirnov_two_sided_cdf",
     "pearson_correlation_coefficient",
     "poisson_expected_max_counts",
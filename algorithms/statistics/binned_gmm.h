@@ -13,8 +13,11 @@
 #define DIALS_ALGORITHMS_STATISTICS_BINNED_GMM_H
 
 #include <cmath>
+#include <boost/bind.hpp>
 #include <boost/math/special_functions/erf.hpp>
 #include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -24,6 +27,14 @@ namespace dials { namespace algorithms {
 
   namespace detail {
 
+    /**
+     * The value of the normal density at x
+     */
+    inline double normal_density(double x, double mu, double sigma) {
+      return std::exp(-(x - mu) * (x - mu) / (2 * sigma * sigma))
+             / (std::sqrt(2.0 * pi) * sigma);
+    }
+
     /**
      * Compute the expectations required for the 1d gaussian model
      */
@@ -37,17 +48,37 @@ namespace dials { namespace algorithms {
        * @param sigma The standard deviation parameter
        */
       Expectation(double a, double b, double mu, double sigma) {
-        double e1 = erf((b - mu) / (std::sqrt(2.0) * sigma));
-        double e2 = erf((a - mu) / (std::sqrt(2.0) * sigma));
-        double e3 = std::exp(-(a - mu) * (a - mu) / (2 * sigma * sigma))
-                    / (std::sqrt(2.0 * pi) * sigma);
-        double e4 = std::exp(-(b - mu) * (b - mu) / (2 * sigma * sigma))
-                    / (std::sqrt(2.0 * pi) * sigma);
-        expectation0_ = 0.5 * (e1 - e2);
-        expectation1_ =
-          0.5 * mu * (e1 - e2) + (sigma * sigma / std::sqrt(2 * pi)) * (e3 - e4);
-        expectation2_ = (sigma * sigma / 2.0) * (e1 - e2)
-                        + sigma * sigma * ((a - mu) * e3 - (b - mu) * e4);
+        init(a,
+             b,
+             mu,
+             sigma,
+             erf((a - mu) / (std::sqrt(2.0) * sigma)),
+             erf((b - mu) / (std::sqrt(2.0) * sigma)),
+             normal_density(a, mu, sigma),
+             normal_density(b, mu, sigma));
+      }
+
+      /**
+       * Compute the expectations given erf and the normal density at the
+       * bounds of the bin
+       * @param a The lower bound of the bin
+       * @param b The upper bound of the bin
+       * @param mu The mean parameters
+       * @param sigma The standard deviation parameter
+       * @param erf_a The value of erf((a - mu) / (sqrt(2) sigma))
+       * @param erf_b The value of erf((b - mu) / (sqrt(2) sigma))
+       * @param density_a The normal density at a
+       * @param density_b The normal density at b
+       */
+      Expectation(double a,
+                  double b,
+                  double mu,
+                  double sigma,
+                  double erf_a,
+                  double erf_b,
+                  double density_a,
+                  double density_b) {
+        init(a, b, mu, sigma, erf_a, erf_b, density_a, density_b);
       }
 
       /**
@@ -72,11 +103,132 @@ namespace dials { namespace algorithms {
       }
 
     protected:
+      void init(double a,
+                double b,
+                double mu,
+                double sigma,
+                double erf_a,
+                double erf_b,
+                double density_a,
+                double density_b) {
+        expectation0_ = 0.5 * (erf_b - erf_a);
+        expectation1_ = 0.5 * mu * (erf_b - erf_a)
+                        + (sigma * sigma / std::sqrt(2 * pi)) * (density_a - density_b);
+        expectation2_ = (sigma * sigma / 2.0) * (erf_b - erf_a)
+                        + sigma * sigma * ((a - mu) * density_a - (b - mu) * density_b);
+      }
+
       double expectation0_;
       double expectation1_;
       double expectation2_;
     };
 
+    /**
+     * Do one iteration of expectation maximization for the binned gaussian
+     * model, updating mu (unless it is fixed) and sigma. The values of erf
+     * and the normal density at a bin bound are computed once and reused for
+     * the next bin when the bins are contiguous.
+     * @param a The lower bounds of the bins
+     * @param b The upper bounds of the bins
+     * @param n The number of counts in the bins
+     * @param c The total number of counts
+     * @param fix_mean Keep the mean fixed
+     * @param mu The mean parameter
+     * @param sigma The standard deviation parameter
+     * @returns The log likelihood measure used to check convergence
+     */
+    inline double binned_gmm_iteration(const af::const_ref<double> &a,
+                                       const af::const_ref<double> &b,
+                                       const af::const_ref<double> &n,
+                                       double c,
+                                       bool fix_mean,
+                                       double &mu,
+                                       double &sigma) {
+      const double scale = 1.0 / (std::sqrt(2.0) * sigma);
+      const double min_log_p = std::log(1e-100);
+      double sum_n_log_p = 0;
+      double sum_n = 0;
+      double sum_log_p = 0;
+      double mu_new = 0;
+      double va_new = 0;
+      double last_b = 0;
+      double erf_b = 0;
+      double density_b = 0;
+      for (std::size_t i = 0; i < n.size(); ++i) {
+        double erf_a = erf_b;
+        double density_a = density_b;
+        if (i == 0 || a[i] != last_b) {
+          erf_a = erf((a[i] - mu) * scale);
+          density_a = normal_density(a[i], mu, sigma);
+        }
+        erf_b = erf((b[i] - mu) * scale);
+        density_b = normal_density(b[i], mu, sigma);
+        last_b = b[i];
+        Expectation e(a[i], b[i], mu, sigma, erf_a, erf_b, density_a, density_b);
+        double P = e.expectation0();
+        if (fix_mean) {
+          if (n[i] >= 1) {
+            if (P > 1e-100) {
+              va_new += n[i] * e.expectation2() / P;
+            }
+            double log_p = P > 1e-100 ? std::log(P) : min_log_p;
+            sum_n_log_p += n[i] * log_p;
+            sum_n += n[i];
+            sum_log_p += log_p;
+          }
+        } else if (n[i] > 0 && P > 1e-10) {
+          double log_p = std::log(P);
+          mu_new += n[i] * e.expectation1() / P;
+          va_new += n[i] * e.expectation2() / P;
+          sum_n_log_p += n[i] * log_p;
+          sum_n += n[i];
+          sum_log_p += log_p;
+        }
+      }
+      if (!fix_mean) {
+        mu = mu_new / c;
+      }
+      sigma = std::sqrt(va_new / c);
+      return sum_n_log_p - sum_n * sum_log_p;
+    }
+
+    /**
+     * Fit the binned gaussian model by expectation maximization
+     * @returns The number of iterations
+     */
+    inline std::size_t binned_gmm_fit(const af::const_ref<double> &a,
+                                      const af::const_ref<double> &b,
+                                      const af::const_ref<double> &n,
+                                      bool fix_mean,
+                                      double epsilon,
+                                      std::size_t max_iter,
+                                      double &mu,
+                                      double &sigma) {
+      DIALS_ASSERT(epsilon > 0);
+      DIALS_ASSERT(max_iter > 1);
+      DIALS_ASSERT(sigma > 0);
+      DIALS_ASSERT(a.size() == b.size());
+      DIALS_ASSERT(a.size() == n.size());
+
+      // The E step in this case is constant
+      double c = af::sum(n);
+      double logL0 = 0.0;
+
+      // Do the iterations
+      std::size_t num_iter = 0;
+      for (; num_iter < max_iter; ++num_iter) {
+        double logL = binned_gmm_iteration(a, b, n, c, fix_mean, mu, sigma);
+
+        // Check the convergence
+        double error = std::abs((logL - logL0) / std::max(logL0, 1e-10));
+        if (num_iter > 0 && error < epsilon) {
+          break;
+        }
+        logL0 = logL;
+      }
+      return num_iter;
+    }
+
   }  // namespace detail
 
   /**
@@ -103,71 +255,7 @@ namespace dials { namespace algorithms {
                                double epsilon,
                                std::size_t max_iter)
         : max_iter_(max_iter), num_iter_(0), epsilon_(epsilon), mu_(mu), sigma_(sigma) {
-      // Check the input
-      DIALS_ASSERT(epsilon > 0);
-      DIALS_ASSERT(max_iter > 1);
-      DIALS_ASSERT(sigma > 0);
-      DIALS_ASSERT(a.size() == b.size());
-      DIALS_ASSERT(a.size() == n.size());
-
-      // The E step in this case is constant
-      af::const_ref<double> m = n;
-      double c = af::sum(m);
-      double logL0 = 0.0;
-
-      af::shared<bool> use(a.size(), true);
-      for (std::size_t i = 0; i < m.size(); ++i) {
-        detail::Expectation e(a[i], b[i], mu_, sigma_);
-        if (m[i] < 1) {
-          use[i] = false;
-        }
-      }
-
-      // Do the iterations
-      for (num_iter_ = 0; num_iter_ < max_iter; ++num_iter_) {
-        double sum_n_log_p = 0;
-        double sum_n = 0;
-        double sum_log_p = 0;
-        double va_new = 0;
-        double min_P = 1;
-
-        double sum_P = 0;
-        double sum_E2 = 0;
-
-        for (std::size_t i = 0; i < m.size(); ++i) {
-          detail::Expectation e(a[i], b[i], mu_, sigma_);
-          double P = e.expectation0();
-          double E2 = e.expectation2();
-          if (use[i]) {
-            if (P > 1e-100) {
-              va_new += m[i] * E2 / P;
-            } else {
-            }
-            sum_n_log_p += n[i] * (P > 1e-100 ? std::log(P) : std::log(1e-100));
-            sum_n += n[i];
-            sum_log_p += (P > 1e-100 ? std::log(P) : std::log(1e-100));
-            if (P < min_P) min_P = P;
-            sum_P += P;
-            sum_E2 += E2;
-          }
-        }
-
-        /* double Pr = (1.0 - sum_P); */
-        /* double mr = sum_n * Pr; */
-        /* double E2r = (sigma_*sigma_ - sum_E2); */
-        /* double XX = mr * E2r / Pr; */
-        /* va_new += XX; */
-
-        sigma_ = std::sqrt(va_new / c);
-
-        // Check if we've converged
-        double logL = sum_n_log_p - sum_n * sum_log_p;
-        double error = std::abs((logL - logL0) / std::max(logL0, 1e-10));
-        if (num_iter_ > 0 && error < epsilon) {
-          break;
-        }
-        logL0 = logL;
-      }
+      num_iter_ = detail::binned_gmm_fit(a, b, n, true, epsilon, max_iter, mu_, sigma_);
     }
 
     /**
@@ -237,47 +325,8 @@ namespace dials { namespace algorithms {
                       double epsilon,
                       std::size_t max_iter)
         : max_iter_(max_iter), num_iter_(0), epsilon_(epsilon), mu_(mu), sigma_(sigma) {
-      // Check the input
-      DIALS_ASSERT(epsilon > 0);
-      DIALS_ASSERT(max_iter > 1);
-      DIALS_ASSERT(sigma > 0);
-      DIALS_ASSERT(a.size() == b.size());
-      DIALS_ASSERT(a.size() == n.size());
-
-      // The E step in this case is constant
-      af::const_ref<double> m = n;
-      double c = af::sum(m);
-      double logL0 = 0.0;
-
-      // Do the iterations
-      for (num_iter_ = 0; num_iter_ < max_iter; ++num_iter_) {
-        double sum_n_log_p = 0;
-        double sum_n = 0;
-        double sum_log_p = 0;
-        double mu_new = 0;
-        double va_new = 0;
-        for (std::size_t i = 0; i < m.size(); ++i) {
-          detail::Expectation e(a[i], b[i], mu_, sigma_);
-          double P = e.expectation0();
-          if (n[i] > 0 && P > 1e-10) {
-            mu_new += m[i] * e.expectation1() / P;
-            va_new += m[i] * e.expectation2() / P;
-            sum_n_log_p += n[i] * std::log(P);
-            sum_n += n[i];
-            sum_log_p += std::log(P);
-          }
-        }
-        mu_ = mu_new / c;
-        sigma_ = std::sqrt(va_new / c);
-
-        // Check the convergence
-        double logL = sum_n_log_p - sum_n * sum_log_p;
-        double error = std::abs((logL - logL0) / std::max(logL0, 1e-10));
-        if (num_iter_ > 0 && error < epsilon) {
-          break;
-        }
-        logL0 = logL;
-      }
+      num_iter_ =
+        detail::binned_gmm_fit(a, b, n, false, epsilon, max_iter, mu_, sigma_);
     }
 
     /**
@@ -323,6 +372,120 @@ namespace dials { namespace algorithms {
     double sigma_;
   };
 
+  /**
+   * Compute the binned gaussian model for many independent histograms, stored
+   * one after another, using expectation maximization. The histograms are
+   * fitted in parallel bands and each stops iterating once it has converged.
+   */
+  class BinnedGMMSingle1DMulti {
+  public:
+    /**
+     * Compute the parameters
+     * @param a The lower bounds of the bins
+     * @param b The upper bounds of the bins
+     * @param n The number of counts in the bins
+     * @param size The number of bins in each histogram
+     * @param mu The mean parameter estimate of each histogram
+     * @param sigma The sigma parameter estimate of each histogram
+     * @param epsilon The convergence tolerance
+     * @param max_iter The maximum number of iterations
+     * @param fix_mean Keep the mean parameters fixed
+     * @param nthreads The number of threads to use
+     */
+    BinnedGMMSingle1DMulti(const af::const_ref<double> &a,
+                           const af::const_ref<double> &b,
+                           const af::const_ref<double> &n,
+                           const af::const_ref<std::size_t> &size,
+                           const af::const_ref<double> &mu,
+                           const af::const_ref<double> &sigma,
+                           double epsilon,
+                           std::size_t max_iter,
+                           bool fix_mean = false,
+                           std::size_t nthreads = 1)
+        : max_iter_(max_iter),
+          epsilon_(epsilon),
+          offset_(size.size() + 1, 0),
+          num_iter_(size.size(), 0),
+          mu_(mu.begin(), mu.end()),
+          sigma_(sigma.begin(), sigma.end()) {
+      DIALS_ASSERT(epsilon > 0);
+      DIALS_ASSERT(max_iter > 1);
+      DIALS_ASSERT(a.size() == b.size());
+      DIALS_ASSERT(a.size() == n.size());
+      DIALS_ASSERT(mu.size() == size.size());
+      DIALS_ASSERT(sigma.size() == size.size());
+      for (std::size_t i = 0; i < size.size(); ++i) {
+        DIALS_ASSERT(sigma[i] > 0);
+        offset_[i + 1] = offset_[i] + size[i];
+      }
+      DIALS_ASSERT(offset_.back() == a.size());
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&BinnedGMMSingle1DMulti::fit_band, this, a, b, n, fix_mean, _1, _2),
+        size.size(),
+        nthreads);
+    }
+
+    /**
+     * @returns The maximum number of iterations
+     */
+    std::size_t max_iter() const {
+      return max_iter_;
+    }
+
+    /**
+     * @returns The number of iterations for each histogram
+     */
+    af::shared<std::size_t> num_iter() const {
+      return num_iter_;
+    }
+
+    /**
+     * @returns The epsilon
+     */
+    double epsilon() const {
+      return epsilon_;
+    }
+
+    /**
+     * @returns The mu parameter estimates
+     */
+    af::shared<double> mu() const {
+      return mu_;
+    }
+
+    /**
+     * @returns The sigma parameter estimates
+     */
+    af::shared<double> sigma() const {
+      return sigma_;
+    }
+
+  protected:
+    void fit_band(af::const_ref<double> a,
+                  af::const_ref<double> b,
+                  af::const_ref<double> n,
+                  bool fix_mean,
+                  std::size_t first,
+                  std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        std::size_t i0 = offset_[i];
+        std::size_t size = offset_[i + 1] - i0;
+        af::const_ref<double> ai(a.begin() + i0, size);
+        af::const_ref<double> bi(b.begin() + i0, size);
+        af::const_ref<double> ni(n.begin() + i0, size);
+        num_iter_[i] = detail::binned_gmm_fit(
+          ai, bi, ni, fix_mean, epsilon_, max_iter_, mu_[i], sigma_[i]);
+      }
+    }
+
+    std::size_t max_iter_;
+    double epsilon_;
+    af::shared<std::size_t> offset_;
+    af::shared<std::size_t> num_iter_;
+    af::shared<double> mu_;
+    af::shared<double> sigma_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_BINNED_GMM_H
@@ -17,7 +17,9 @@
 #include <dials/algorithms/statistics/kolmogorov_smirnov_test.h>
 #include <dials/algorithms/statistics/poisson_test.h>
 #include <dials/algorithms/statistics/correlation.h>
+#include <dials/algorithms/statistics/delta_cchalf.h>
 #include <dials/algorithms/statistics/binned_gmm.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -39,11 +41,7 @@ namespace dials { namespace algorithms { namespace boost_python {
   // return pdf(kolmogorov_smirnov_one_sided_distribution<RealType>(n), x);
   //}
 
-  template <typename RealType>
-  boost::python::tuple kolmogorov_smirnov_test_standard_normal(
-    const af::const_ref<RealType> &data,
-    std::string type) {
-    // Get the enumeration
+  inline KSType kolmogorov_smirnov_test_type(std::string type) {
     KSType etype = TwoSided;
     if (type.compare("less") == 0) {
       etype = Less;
@@ -52,6 +50,15 @@ namespace dials { namespace algorithms { namespace boost_python {
     } else {
       DIALS_ASSERT(type.compare("two_sided") == 0);
     }
+    return etype;
+  }
+
+  template <typename RealType>
+  boost::python::tuple kolmogorov_smirnov_test_standard_normal(
+    const af::const_ref<RealType> &data,
+    std::string type) {
+    // Get the enumeration
+    KSType etype = kolmogorov_smirnov_test_type(type);
 
     // Perform the test
     std::pair<RealType, RealType> result =
@@ -62,7 +69,24 @@ namespace dials { namespace algorithms { namespace boost_python {
     return boost::python::make_tuple(result.first, result.second);
   }
 
+  template <typename RealType>
+  boost::python::tuple kolmogorov_smirnov_test_standard_normal_batch(
+    const af::const_ref<RealType> &data,
+    const af::const_ref<std::size_t> &sizes,
+    std::string type) {
+    af::shared<RealType> D(sizes.size());
+    af::shared<RealType> p(sizes.size());
+    kolmogorov_smirnov_test_batch(boost::math::normal_distribution<RealType>(0, 1),
+                                  data,
+                                  sizes,
+                                  kolmogorov_smirnov_test_type(type),
+                                  D.ref(),
+                                  p.ref());
+    return boost::python::make_tuple(D, p);
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_statistics_ext) {
+    dials::util::boost_python::import_shared_executor();
     def("kolmogorov_smirnov_one_sided_cdf", &kolmogorov_smirnov_one_sided_cdf<double>);
     def("kolmogorov_smirnov_two_sided_cdf", &kolmogorov_smirnov_two_sided_cdf<double>);
     // def("kolmogorov_smirnov_one_sided_pdf",
@@ -70,12 +94,57 @@ namespace dials { namespace algorithms { namespace boost_python {
     def("kolmogorov_smirnov_test_standard_normal",
         &kolmogorov_smirnov_test_standard_normal<double>,
         (arg("data"), arg("type") = "two_sided"));
+    def("kolmogorov_smirnov_test_standard_normal_batch",
+        &kolmogorov_smirnov_test_standard_normal_batch<double>,
+        (arg("data"), arg("sizes"), arg("type") = "two_sided"));
 
     def("poisson_expected_max_counts", &poisson_expected_max_counts);
 
-    def("spearman_correlation_coefficient", &spearman_correlation_coefficient<double>);
+    def("spearman_correlation_coefficient",
+        &spearman_correlation_coefficient<double>,
+        (arg("a"), arg("b"), arg("nthreads") = 1));
     def("pearson_correlation_coefficient", &pearson_correlation_coefficient<double>);
 
+    {
+      typedef PearsonCorrelationAccumulator<double> accumulator_type;
+      void (accumulator_type::*add_pair)(double, double) = &accumulator_type::add;
+      void (accumulator_type::*remove_pair)(double, double) = &accumulator_type::remove;
+      void (accumulator_type::*add_arrays)(const af::const_ref<double> &,
+                                           const af::const_ref<double> &) =
+        &accumulator_type::add;
+      void (accumulator_type::*remove_arrays)(const af::const_ref<double> &,
+                                              const af::const_ref<double> &) =
+        &accumulator_type::remove;
+      void (accumulator_type::*add_other)(const accumulator_type &) =
+        &accumulator_type::add;
+      void (accumulator_type::*remove_other)(const accumulator_type &) =
+        &accumulator_type::remove;
+      class_<accumulator_type>("PearsonCorrelationAccumulator")
+        .def(init<const af::const_ref<double> &, const af::const_ref<double> &>(
+          (arg("x"), arg("y"))))
+        .def("add", add_pair, (arg("x"), arg("y")))
+        .def("remove", remove_pair, (arg("x"), arg("y")))
+        .def("add", add_arrays, (arg("x"), arg("y")))
+        .def("remove", remove_arrays, (arg("x"), arg("y")))
+        .def("add", add_other, (arg("other")))
+        .def("remove", remove_other, (arg("other")))
+        .def("n", &accumulator_type::n)
+        .def("coefficient", &accumulator_type::coefficient);
+    }
+
+    class_<DeltaCChalf>("DeltaCChalf", no_init)
+      .def(init<const af::const_ref<std::size_t> &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<double> &,
+                const af::const_ref<std::size_t> &,
+                std::size_t>(
+        (arg("unique"), arg("group"), arg("intensity"), arg("bin"), arg("nbins"))))
+      .def("ngroups", &DeltaCChalf::ngroups)
+      .def("mean_cchalf", &DeltaCChalf::mean_cchalf)
+      .def("cchalf_excluding_each_group",
+           &DeltaCChalf::cchalf_excluding_each_group,
+           (arg("nthreads") = 1));
+
     class_<BinnedGMMSingle1DFixedMean>("BinnedGMMSingle1DFixedMean", no_init)
       .def(init<const af::const_ref<double> &,
                 const af::const_ref<double> &,
@@ -103,6 +172,32 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("epsilon", &BinnedGMMSingle1D::epsilon)
       .def("mu", &BinnedGMMSingle1D::mu)
       .def("sigma", &BinnedGMMSingle1D::sigma);
+
+    class_<BinnedGMMSingle1DMulti>("BinnedGMMSingle1DMulti", no_init)
+      .def(init<const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                double,
+                std::size_t,
+                bool,
+                std::size_t>((arg("a"),
+                              arg("b"),
+                              arg("n"),
+                              arg("size"),
+                              arg("mu"),
+                              arg("sigma"),
+                              arg("epsilon"),
+                              arg("max_iter"),
+                              arg("fix_mean") = false,
+                              arg("nthreads") = 1)))
+      .def("max_iter", &BinnedGMMSingle1DMulti::max_iter)
+      .def("num_iter", &BinnedGMMSingle1DMulti::num_iter)
+      .def("epsilon", &BinnedGMMSingle1DMulti::epsilon)
+      .def("mu", &BinnedGMMSingle1DMulti::mu)
+      .def("sigma", &BinnedGMMSingle1DMulti::sigma);
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -13,6 +13,11 @@
 #define DIALS_ALGORITHMS_STATISTICS_CORRELATION_H
 
 #include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -29,23 +34,52 @@ namespace dials { namespace algorithms {
       }
     };
 
+    // Sort the indices [first, last) by the data
+    template <typename T>
+    void sort_index_band(af::const_ref<T> data,
+                         af::ref<std::size_t> index,
+                         std::size_t first,
+                         std::size_t last) {
+      std::sort(&index[0] + first, &index[0] + last, sort_by_index<T>(data));
+    }
+
   }  // namespace detail
 
   /**
-   * A function to compute the rank of an array
+   * A function to compute the rank of an array. The indices are sorted in
+   * bands on separate threads and the bands are then merged.
    * @param data The data to rank
+   * @param nthreads The number of threads to use
    * @return The rank
    */
   template <typename T>
-  af::shared<T> rank(const af::const_ref<T> data) {
+  af::shared<T> rank(const af::const_ref<T> data, std::size_t nthreads = 1) {
+    DIALS_ASSERT(nthreads > 0);
+    if (data.size() == 0) {
+      return af::shared<T>();
+    }
+
     // Construct the indices
-    std::vector<std::size_t> index(data.size());
+    af::shared<std::size_t> index(data.size());
     for (std::size_t i = 0; i < index.size(); ++i) {
       index[i] = i;
     }
 
-    // Sort by index
-    std::sort(index.begin(), index.end(), detail::sort_by_index<T>(data));
+    // Sort by index, in the same bands as parallel_bands, then merge the bands
+    std::size_t n = index.size();
+    std::size_t band_size = (n + std::min(nthreads, n) - 1) / std::min(nthreads, n);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&detail::sort_index_band<T>, data, index.ref(), _1, _2),
+      n,
+      nthreads);
+    for (std::size_t width = band_size; width < n; width *= 2) {
+      for (std::size_t first = 0; first + width < n; first += 2 * width) {
+        std::inplace_merge(index.begin() + first,
+                           index.begin() + first + width,
+                           index.begin() + std::min(first + 2 * width, n),
+                           detail::sort_by_index<T>(data));
+      }
+    }
 
     // Loop through
     af::shared<T> result(index.size());
@@ -73,16 +107,18 @@ namespace dials { namespace algorithms {
    * Compute the rank correlation between two arrays
    * @param a an array
    * @param b an array
+   * @param nthreads The number of threads to use for ranking
    * @return The rank correlation coefficient
    */
   template <typename T>
   T spearman_correlation_coefficient(const af::const_ref<T> &a,
-                                     const af::const_ref<T> &b) {
+                                     const af::const_ref<T> &b,
+                                     std::size_t nthreads = 1) {
     DIALS_ASSERT(a.size() == b.size());
 
     // Rank the two datasets
-    af::shared<T> ra = rank(a);
-    af::shared<T> rb = rank(b);
+    af::shared<T> ra = rank(a, nthreads);
+    af::shared<T> rb = rank(b, nthreads);
 
     // The numerator
     T num = 0.0;
@@ -133,6 +169,125 @@ namespace dials { namespace algorithms {
     return sdxy / (std::sqrt(sdx2) * std::sqrt(sdy2));
   }
 
+  /**
+   * Accumulate the sums needed for the correlation coefficient between two
+   * variables. Pairs can be removed as well as added, so the correlation with
+   * a subset of the data left out can be found without a pass over the rest,
+   * and accumulators for separate subsets can be combined.
+   */
+  template <typename T>
+  class PearsonCorrelationAccumulator {
+  public:
+    PearsonCorrelationAccumulator()
+        : n_(0), sum_x_(0), sum_y_(0), sum_xx_(0), sum_yy_(0), sum_xy_(0) {}
+
+    /**
+     * Add the pairs from two arrays
+     */
+    PearsonCorrelationAccumulator(const af::const_ref<T> &x,
+                                  const af::const_ref<T> &y)
+        : n_(0), sum_x_(0), sum_y_(0), sum_xx_(0), sum_yy_(0), sum_xy_(0) {
+      add(x, y);
+    }
+
+    /**
+     * Add a pair of values
+     */
+    void add(T x, T y) {
+      n_ += 1;
+      sum_x_ += x;
+      sum_y_ += y;
+      sum_xx_ += x * x;
+      sum_yy_ += y * y;
+      sum_xy_ += x * y;
+    }
+
+    /**
+     * Remove a pair of values which was added before
+     */
+    void remove(T x, T y) {
+      DIALS_ASSERT(n_ > 0);
+      n_ -= 1;
+      sum_x_ -= x;
+      sum_y_ -= y;
+      sum_xx_ -= x * x;
+      sum_yy_ -= y * y;
+      sum_xy_ -= x * y;
+    }
+
+    /**
+     * Add the pairs from two arrays
+     */
+    void add(const af::const_ref<T> &x, const af::const_ref<T> &y) {
+      DIALS_ASSERT(x.size() == y.size());
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        add(x[i], y[i]);
+      }
+    }
+
+    /**
+     * Remove the pairs from two arrays
+     */
+    void remove(const af::const_ref<T> &x, const af::const_ref<T> &y) {
+      DIALS_ASSERT(x.size() == y.size());
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        remove(x[i], y[i]);
+      }
+    }
+
+    /**
+     * Add the sums from another accumulator
+     */
+    void add(const PearsonCorrelationAccumulator &other) {
+      n_ += other.n_;
+      sum_x_ += other.sum_x_;
+      sum_y_ += other.sum_y_;
+      sum_xx_ += other.sum_xx_;
+      sum_yy_ += other.sum_yy_;
+      sum_xy_ += other.sum_xy_;
+    }
+
+    /**
+     * Remove the sums of another accumulator, whose pairs were added before
+     */
+    void remove(const PearsonCorrelationAccumulator &other) {
+      DIALS_ASSERT(n_ >= other.n_);
+      n_ -= other.n_;
+      sum_x_ -= other.sum_x_;
+      sum_y_ -= other.sum_y_;
+      sum_xx_ -= other.sum_xx_;
+      sum_yy_ -= other.sum_yy_;
+      sum_xy_ -= other.sum_xy_;
+    }
+
+    /**
+     * @returns The number of pairs
+     */
+    std::size_t n() const {
+      return n_;
+    }
+
+    /**
+     * @returns The correlation coefficient
+     */
+    T coefficient() const {
+      DIALS_ASSERT(n_ > 0);
+      T sdx2 = sum_xx_ - sum_x_ * sum_x_ / n_;
+      T sdy2 = sum_yy_ - sum_y_ * sum_y_ / n_;
+      T sdxy = sum_xy_ - sum_x_ * sum_y_ / n_;
+      DIALS_ASSERT(sdx2 > 0 && sdy2 > 0);
+      return sdxy / (std::sqrt(sdx2) * std::sqrt(sdy2));
+    }
+
+  private:
+    std::size_t n_;
+    T sum_x_;
+    T sum_y_;
+    T sum_xx_;
+    T sum_yy_;
+    T sum_xy_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_CORRELATION_H
@@ -0,0 +1,228 @@
+/*
+ * delta_cchalf.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_STATISTICS_DELTA_CCHALF_H
+#define DIALS_ALGORITHMS_STATISTICS_DELTA_CCHALF_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    // Sort observations by group then by unique reflection
+    struct sort_by_group_and_unique {
+      af::const_ref<std::size_t> group;
+      af::const_ref<std::size_t> unique;
+      sort_by_group_and_unique(const af::const_ref<std::size_t> &group_,
+                               const af::const_ref<std::size_t> &unique_)
+          : group(group_), unique(unique_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return group[a] < group[b] || (group[a] == group[b] && unique[a] < unique[b]);
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the CC 1/2 using the formula from Assmann, Brehm and Diederichs
+   * 2016, averaged over resolution bins, for all the data and with each group
+   * of observations left out.
+   *
+   * The sums of the intensities of each unique reflection, and the sums of
+   * the mean intensities and their variances over the unique reflections in
+   * each bin, are accumulated once. Leaving out a group then only updates the
+   * bin sums for the unique reflections the group contributes to.
+   */
+  class DeltaCChalf {
+  public:
+    /**
+     * @param unique The index of the unique reflection of each observation
+     * @param group The group of each observation (0 to ngroups - 1)
+     * @param intensity The intensity of each observation
+     * @param bin The resolution bin of each unique reflection
+     * @param nbins The number of resolution bins
+     */
+    DeltaCChalf(const af::const_ref<std::size_t> &unique,
+                const af::const_ref<std::size_t> &group,
+                const af::const_ref<double> &intensity,
+                const af::const_ref<std::size_t> &bin,
+                std::size_t nbins)
+        : intensity_(intensity.begin(), intensity.end()),
+          unique_(unique.begin(), unique.end()),
+          bin_(bin.begin(), bin.end()),
+          reflection_sums_(bin.size()),
+          bin_sums_(nbins),
+          ngroups_(0) {
+      DIALS_ASSERT(unique.size() == intensity.size());
+      DIALS_ASSERT(group.size() == intensity.size());
+      DIALS_ASSERT(nbins > 0);
+      for (std::size_t i = 0; i < bin.size(); ++i) {
+        DIALS_ASSERT(bin[i] < nbins);
+      }
+
+      // Accumulate the sums for each unique reflection
+      for (std::size_t i = 0; i < unique.size(); ++i) {
+        DIALS_ASSERT(unique[i] < bin.size());
+        reflection_sums_[unique[i]].add(intensity[i]);
+        ngroups_ = std::max(ngroups_, group[i] + 1);
+      }
+
+      // Accumulate the sums for each resolution bin
+      for (std::size_t i = 0; i < reflection_sums_.size(); ++i) {
+        bin_sums_[bin[i]].add(reflection_sums_[i]);
+      }
+
+      // Order the observations by group and unique reflection
+      order_.resize(unique.size());
+      for (std::size_t i = 0; i < order_.size(); ++i) {
+        order_[i] = i;
+      }
+      std::sort(
+        order_.begin(), order_.end(), detail::sort_by_group_and_unique(group, unique));
+      group_offset_.assign(ngroups_ + 1, 0);
+      for (std::size_t i = 0; i < group.size(); ++i) {
+        group_offset_[group[i] + 1]++;
+      }
+      for (std::size_t i = 0; i < ngroups_; ++i) {
+        group_offset_[i + 1] += group_offset_[i];
+      }
+    }
+
+    /**
+     * @returns The number of groups
+     */
+    std::size_t ngroups() const {
+      return ngroups_;
+    }
+
+    /**
+     * @returns The CC 1/2 of all the data
+     */
+    double mean_cchalf() const {
+      return compute_mean_cchalf(bin_sums_);
+    }
+
+    /**
+     * @param nthreads The number of threads to use
+     * @returns The CC 1/2 with the observations of each group left out
+     */
+    af::shared<double> cchalf_excluding_each_group(std::size_t nthreads = 1) const {
+      af::shared<double> result(ngroups_);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&DeltaCChalf::group_band, this, result.ref(), _1, _2),
+        ngroups_,
+        nthreads);
+      return result;
+    }
+
+  private:
+    /**
+     * The sums of the intensities of a unique reflection
+     */
+    struct ReflectionSum {
+      double sum_x;
+      double sum_x2;
+      std::size_t n;
+
+      ReflectionSum() : sum_x(0), sum_x2(0), n(0) {}
+
+      void add(double x) {
+        sum_x += x;
+        sum_x2 += x * x;
+        n += 1;
+      }
+    };
+
+    /**
+     * The sums of the mean intensities and their variances in a bin, over the
+     * unique reflections with more than one observation
+     */
+    struct BinSum {
+      double sum_mean;
+      double sum_mean2;
+      double sum_var;
+      std::size_t n;
+
+      BinSum() : sum_mean(0), sum_mean2(0), sum_var(0), n(0) {}
+
+      void add(const ReflectionSum &r, double sign = 1.0) {
+        if (r.n > 1) {
+          double mean = r.sum_x / r.n;
+          double var = (r.sum_x2 - r.sum_x * r.sum_x / r.n) / (r.n - 1) / r.n;
+          sum_mean += sign * mean;
+          sum_mean2 += sign * mean * mean;
+          sum_var += sign * var;
+          n = sign > 0 ? n + 1 : n - 1;
+        }
+      }
+
+      void remove(const ReflectionSum &r) {
+        add(r, -1.0);
+      }
+
+      double cchalf() const {
+        double sigma_e = sum_var / n;
+        double sigma_y = (sum_mean2 - sum_mean * sum_mean / n) / (n - 1);
+        return (sigma_y - sigma_e) / (sigma_y + sigma_e);
+      }
+    };
+
+    static double compute_mean_cchalf(const std::vector<BinSum> &bin_sums) {
+      double mean_cchalf = 0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < bin_sums.size(); ++i) {
+        if (bin_sums[i].n > 1) {
+          mean_cchalf += bin_sums[i].n * bin_sums[i].cchalf();
+          count += bin_sums[i].n;
+        }
+      }
+      DIALS_ASSERT(count > 0);
+      return mean_cchalf / count;
+    }
+
+    void group_band(af::ref<double> result,
+                    std::size_t first,
+                    std::size_t last) const {
+      std::vector<BinSum> bin_sums(bin_sums_.size());
+      for (std::size_t g = first; g < last; ++g) {
+        std::copy(bin_sums_.begin(), bin_sums_.end(), bin_sums.begin());
+        std::size_t k = group_offset_[g];
+        while (k < group_offset_[g + 1]) {
+          std::size_t u = unique_[order_[k]];
+          ReflectionSum excluded = reflection_sums_[u];
+          for (; k < group_offset_[g + 1] && unique_[order_[k]] == u; ++k) {
+            double x = intensity_[order_[k]];
+            excluded.sum_x -= x;
+            excluded.sum_x2 -= x * x;
+            excluded.n -= 1;
+          }
+          bin_sums[bin_[u]].remove(reflection_sums_[u]);
+          bin_sums[bin_[u]].add(excluded);
+        }
+        result[g] = compute_mean_cchalf(bin_sums);
+      }
+    }
+
+    std::vector<double> intensity_;
+    std::vector<std::size_t> unique_;
+    std::vector<std::size_t> bin_;
+    std::vector<ReflectionSum> reflection_sums_;
+    std::vector<BinSum> bin_sums_;
+    std::vector<std::size_t> order_;
+    std::vector<std::size_t> group_offset_;
+    std::size_t ngroups_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_STATISTICS_DELTA_CCHALF_H
@@ -3,13 +3,13 @@
 from __future__ import absolute_import, division, print_function
 
 import logging
-from collections import defaultdict
 from math import floor, sqrt
 
 import six
 
 from cctbx import crystal, miller
 
+from dials.algorithms.statistics import DeltaCChalf
 from dials.array_family import flex
 
 logger = logging.getLogger("dials.command_line.compute_delta_cchalf")
@@ -74,89 +74,6 @@ def index(self, h):
         return bin_index
 
 
-class ReflectionSum(object):
-    """
-    A helper class to store sums of X and X**2
-    """
-
-    def __init__(self, sum_x=0, sum_x2=0, n=0):
-        self.sum_x = sum_x
-        self.sum_x2 = sum_x2
-        self.n = n
-
-
-class BinData(object):
-    """
-    A helper class to store mean and variance
-    """
-
-    def __init__(self):
-        self.mean = []
-        self.var = []
-
-
-def compute_cchalf(mean, var):
-    """
-    Compute the CC 1/2 using the formular from Assmann, Brehm and Diederichs 2016
-
-    :param mean: The list of mean intensities
-    :param var: The list of variances on the half set of mean intensities
-    :returns: The CC 1/2
-    """
-    assert len(mean) == len(var)
-    n = len(mean)
-    mean_of_means = sum(mean) / n
-    sigma_e = sum(var) / n
-    sigma_y = sum((m - mean_of_means) ** 2 for m in mean) / (n - 1)
-    cchalf = (sigma_y - sigma_e) / (sigma_y + sigma_e)
-    return cchalf
-
-
-def compute_mean_cchalf_in_bins(bin_data):
-    """
-    Compute the mean cchalf averaged across resolution bins
-
-    :param bin_data: The mean and variance in each bin
-    :returns: The mean CC 1/2
-    """
-    mean_cchalf = 0
-    count = 0
-    for bin_i in bin_data:
-        mean = bin_i.mean
-        var = bin_i.var
-        n = len(mean)
-        if n > 1:
-            cchalf = compute_cchalf(mean, var)
-            mean_cchalf += n * cchalf
-            count += n
-    mean_cchalf /= count
-    return mean_cchalf
-
-
-def compute_cchalf_from_reflection_sums(reflection_sums, binner):
-    """
-    Compute the CC 1/2 by computing the CC 1/2 in resolution bins and then
-    computing the weighted mean of the binned CC 1/2 values
-    """
-    # Compute Mean and variance of reflection intensities
-    bin_data = [BinData() for _ in range(binner.nbins())]
-    for h in reflection_sums:
-        sum_x = reflection_sums[h].sum_x
-        sum_x2 = reflection_sums[h].sum_x2
-        n = reflection_sums[h].n
-
-        if n > 1:
-            mean = sum_x / n
-            var = (sum_x2 - (sum_x) ** 2 / n) / (n - 1)
-            var = var / n
-            index = binner.index(h)
-            bin_data[index].mean.append(mean)
-            bin_data[index].var.append(var)
-
-    # Compute the mean cchalf in resolution bins
-    return compute_mean_cchalf_in_bins(bin_data)
-
-
 class PerGroupCChalfStatistics(object):
     def __init__(
         self,
@@ -196,30 +113,36 @@ def __init__(
             self.d_max = flex.max(self.reflection_table["d"])
         self.binner = ResolutionBinner(mean_unit_cell, self.d_min, self.d_max, n_bins)
 
-        self.reflection_sums = defaultdict(ReflectionSum)
         self.compute_overall_stats()
 
     def compute_overall_stats(self):
-        # Create lookups for elements by miller index
-        index_lookup = defaultdict(list)
-        for i, h in enumerate(self.reflection_table["miller_index"]):
-            index_lookup[h].append(i)
+        # Number the unique reflections and the groups
+        unique_lookup = {}
+        unique = flex.size_t(
+            [
+                unique_lookup.setdefault(h, len(unique_lookup))
+                for h in self.reflection_table["miller_index"]
+            ]
+        )
+        bins = flex.size_t(len(unique_lookup))
+        for h, i in six.iteritems(unique_lookup):
+            bins[i] = self.binner.index(h)
+        self._groups = sorted(set(self.reflection_table["group"]))
+        group_lookup = {g: i for i, g in enumerate(self._groups)}
+        group = flex.size_t(
+            [group_lookup[g] for g in self.reflection_table["group"]]
+        )
 
         # Compute the Overall Sum(X) and Sum(X^2) for each unique reflection
-
-        for h in index_lookup:
-            sel = flex.size_t(index_lookup[h])
-            intensities = self.reflection_table["intensity"].select(sel)
-            n = intensities.size()
-            sum_x = flex.sum(intensities)
-            sum_x2 = flex.sum(flex.pow2(intensities))
-            self.reflection_sums[h] = ReflectionSum(sum_x, sum_x2, n)
+        self._statistics = DeltaCChalf(
+            unique, group, self.reflection_table["intensity"], bins, self._num_bins
+        )
 
         # Compute some numbers
         self._num_datasets = len(set(self.reflection_table["dataset"]))
-        self._num_groups = len(set(self.reflection_table["group"]))
+        self._num_groups = len(self._groups)
         self._num_reflections = self.reflection_table.size()
-        self._num_unique = len(self.reflection_sums)
+        self._num_unique = len(unique_lookup)
 
         logger.info(
             """
@@ -257,57 +180,22 @@ def d_filter(self):
 
     def run(self):
         """Compute the ΔCC½ for all the data"""
-        self._cchalf_mean = compute_cchalf_from_reflection_sums(
-            self.reflection_sums, self.binner
-        )
+        self._cchalf_mean = self._statistics.mean_cchalf()
         logger.info("CC 1/2 mean: %.3f", (100 * self._cchalf_mean))
         self._cchalf = self._compute_cchalf_excluding_each_group()
 
     def _compute_cchalf_excluding_each_group(self):
-        #   self, reflection_sums, binner, miller_index, dataset, intensity
-        # ):
         """
         Compute the CC 1/2 with an image excluded.
 
         For each image, update the sums by removing the contribution from the image
         and then compute the CC 1/2 of the remaining data
         """
-
-        # Create a lookup table for each reflection by dataset i.e. group of images
-        dataset_lookup = defaultdict(list)
-        for i, b in enumerate(self.reflection_table["group"]):
-            dataset_lookup[b].append(i)
-
-        # Compute CC1/2 minus each dataset
         cchalf_i = {}
-        for dataset in dataset_lookup:
-
-            # Find all observations from this dataset and create a lookup based on
-            # miller index
-            index_lookup = defaultdict(list)
-            for i in dataset_lookup[dataset]:
-                index_lookup[self.reflection_table["miller_index"][i]].append(i)
-
-            # Loop through all the reflections and remove the contribution of
-            # reflections from the current dataset
-            dataset_reflection_sums = defaultdict(ReflectionSum)
-            for h in self.reflection_sums:
-                sum_x = self.reflection_sums[h].sum_x
-                sum_x2 = self.reflection_sums[h].sum_x2
-                n = self.reflection_sums[h].n
-                for i in index_lookup[h]:
-                    sum_x -= self.reflection_table["intensity"][i]
-                    sum_x2 -= self.reflection_table["intensity"][i] ** 2
-                    n -= 1
-                dataset_reflection_sums[h] = ReflectionSum(sum_x, sum_x2, n)
-
-            # Compute the CC 1/2 without the reflections from the current dataset
-            cchalf = compute_cchalf_from_reflection_sums(
-                dataset_reflection_sums, self.binner
-            )
-            cchalf_i[dataset] = cchalf
-            logger.info("CC 1/2 excluding group %d: %.3f", dataset, 100 * cchalf)
-
+        cchalf = self._statistics.cchalf_excluding_each_group()
+        for dataset, cc in zip(self._groups, cchalf):
+            cchalf_i[dataset] = cc
+            logger.info("CC 1/2 excluding group %d: %.3f", dataset, 100 * cc)
         return cchalf_i
 
     def num_datasets(self):
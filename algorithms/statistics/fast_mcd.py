@@ -4,6 +4,7 @@
 
 from scitbx.array_family import flex
 
+from dials_refinement_helpers_ext import MCDSubset
 from dials_refinement_helpers_ext import maha_dist_sq as maha_dist_sq_cpp
 from dials_refinement_helpers_ext import mcd_consistency
 
@@ -33,21 +34,25 @@ def cov(*args):
     return cov
 
 
-def maha_dist_sq(cols, center, cov):
+def observation_matrix(cols):
+    """Paste the vectors contained in the list cols into the columns of a matrix
+    with one observation per row"""
+
+    obs = flex.double(flex.grid(len(cols[0]), len(cols)))
+    for i, col in enumerate(cols):
+        obs.matrix_paste_column_in_place(col, i)
+    return obs
+
+
+def maha_dist_sq(cols, center, cov, nproc=1):
     """Calculate squared Mahalanobis distance of all observations (rows in the
     vectors contained in the list cols) from the center vector with respect to
     the covariance matrix cov"""
 
-    n = len(cols[0])
-    p = len(cols)
-    assert len(center) == p
+    assert len(center) == len(cols)
+    obs = observation_matrix(cols)
 
-    # observation matrix
-    obs = flex.double(flex.grid(n, p))
-    for i, col in enumerate(cols):
-        obs.matrix_paste_column_in_place(col, i)
-
-    d2 = maha_dist_sq_cpp(obs, flex.double(center), cov)
+    d2 = maha_dist_sq_cpp(obs, flex.double(center), cov, nthreads=nproc)
     return d2
 
 
@@ -142,6 +147,7 @@ def __init__(
         k1=2,
         k2=2,
         k3=100,
+        nproc=1,
     ):
         """data expected to be a list of flex.double arrays of the same length,
         representing the vectors of observations in each dimension"""
@@ -149,6 +155,9 @@ def __init__(
         # the full dataset as separate vectors
         self._data = data
 
+        # number of threads for the Mahalanobis distance calculations
+        self._nproc = nproc
+
         # number of variables
         self._p = len(self._data)
         # p == 1 is the univariate case, best dealt with using a different (exact)
@@ -163,6 +172,9 @@ def __init__(
         # some input checks
         assert self._n > self._p
 
+        # the full dataset as a matrix with one observation per row
+        self._obs = observation_matrix(self._data)
+
         # default initial subset size
         self._alpha = alpha
         n2 = (self._n + self._p + 1) // 2
@@ -265,8 +277,9 @@ def split_into_groups(self, sample, ngroups):
 
         return groups
 
-    def form_initial_subset(self, h, data):
-        """Method 2 of subsection 3.1 of R&vD"""
+    def form_initial_subset(self, h, data, obs):
+        """Method 2 of subsection 3.1 of R&vD. The data vectors are also given
+        as the matrix obs, from which the subset is selected"""
 
         # permutation of input data for sampling
         p = flex.random_permutation(len(data[0]))
@@ -282,17 +295,19 @@ def form_initial_subset(self, h, data):
             T0, S0 = self.means_and_covariance(J)
             detS0 = S0.matrix_determinant_via_lu()
 
-        H1 = self.concentration_step(h, data, T0, S0)
+        H1 = MCDSubset(obs, h, nthreads=self._nproc)
+        H1.concentration_step(T0, S0)
         return H1
 
     @staticmethod
-    def concentration_step(h, data, T, S):
-        """Practical application of Theorem 1 of R&vD"""
+    def concentration_step(H, T, S):
+        """Practical application of Theorem 1 of R&vD. Update the subset H to
+        the observations closest to T with respect to S and return the location
+        and covariance of the new subset. The subset keeps running sums, so the
+        location and covariance are updated from the observations that changed"""
 
-        d2s = maha_dist_sq(data, T, S)
-        p = flex.sort_permutation(d2s)
-        H1 = [col.select(p)[0:h] for col in data]
-        return H1
+        H.concentration_step(T, S)
+        return H.center(), H.covariance()
 
     def small_dataset_estimate(self):
         """When a dataset is small, perform the initial trials directly on the
@@ -301,16 +316,15 @@ def small_dataset_estimate(self):
         trials = []
         for i in range(self._n_trials):
 
-            H1 = self.form_initial_subset(h=self._h, data=self._data)
-            T1, S1 = self.means_and_covariance(H1)
+            H = self.form_initial_subset(h=self._h, data=self._data, obs=self._obs)
+            T1, S1 = H.center(), H.covariance()
             detS1 = S1.matrix_determinant_via_lu()
 
             # perform concentration steps
             detScurr, Tcurr, Scurr = detS1, T1, S1
             for j in range(self._k1):  # take maximum of k1 steps
 
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
+                Tnew, Snew = self.concentration_step(H, Tcurr, Scurr)
                 detSnew = Snew.matrix_determinant_via_lu()
 
                 # detS3 < detS2 < detS1 by Theorem 1. In practice (rounding errors?)
@@ -326,9 +340,9 @@ def small_dataset_estimate(self):
         best_trials = []
         for i in range(10):
             detCurr, Tcurr, Scurr = trials[i]
+            H = MCDSubset(self._obs, self._h, nthreads=self._nproc)
             for j in range(self._k3):  # take maximum of k3 steps
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
+                Tnew, Snew = self.concentration_step(H, Tcurr, Scurr)
                 detNew = Snew.matrix_determinant_via_lu()
                 if detNew == detCurr:
                     # print "trial {0}; iteration {1}; convergence".format(i,j)
@@ -365,19 +379,19 @@ def large_dataset_estimate(self):
         for group in groups:
 
             h_sub = int(len(group[0]) * h_frac)
+            group_obs = observation_matrix(group)
             gp_trials = []
             for i in range(n_trials):
 
-                H1 = self.form_initial_subset(h=h_sub, data=group)
-                T1, S1 = self.means_and_covariance(H1)
+                H = self.form_initial_subset(h=h_sub, data=group, obs=group_obs)
+                T1, S1 = H.center(), H.covariance()
                 detS1 = S1.matrix_determinant_via_lu()
 
                 # perform concentration steps
                 detScurr, Tcurr, Scurr = detS1, T1, S1
                 for j in range(self._k1):  # take k1 steps
 
-                    Hnew = self.concentration_step(h_sub, group, Tcurr, Scurr)
-                    Tnew, Snew = self.means_and_covariance(Hnew)
+                    Tnew, Snew = self.concentration_step(H, Tcurr, Scurr)
                     detSnew = Snew.matrix_determinant_via_lu()
 
                     # detS3 < detS2 < detS1 by Theorem 1. In practice (rounding errors?)
@@ -396,13 +410,14 @@ def large_dataset_estimate(self):
         # set
         mrgd_trials = []
         h_mrgd = int(sample_size * h_frac)
+        sampled_obs = observation_matrix(sampled)
         for trial in trials:
 
             detScurr, Tcurr, Scurr = trial
+            H = MCDSubset(sampled_obs, h_mrgd, nthreads=self._nproc)
             for j in range(self._k2):  # take k2 steps
 
-                Hnew = self.concentration_step(h_mrgd, sampled, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
+                Tnew, Snew = self.concentration_step(H, Tcurr, Scurr)
                 detSnew = Snew.matrix_determinant_via_lu()
                 detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
 
@@ -442,9 +457,9 @@ def large_dataset_estimate(self):
         best_trials = []
         for i in range(n_reps):
             detCurr, Tcurr, Scurr = mrgd_trials[i]
+            H = MCDSubset(self._obs, self._h, nthreads=self._nproc)
             for j in range(k4):  # take maximum of k4 steps
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
+                Tnew, Snew = self.concentration_step(H, Tcurr, Scurr)
                 detNew = Snew.matrix_determinant_via_lu()
                 if detNew == detCurr:
                     # print "trial {0}; iteration {1}; convergence".format(i,j)
@@ -12,9 +12,11 @@
 #ifndef DIALS_ALGORITHMS_STATISTICS_KOLMOGOROV_SMIRNOV_ONE_SIDED_DISTRIBUTION_H
 #define DIALS_ALGORITHMS_STATISTICS_KOLMOGOROV_SMIRNOV_ONE_SIDED_DISTRIBUTION_H
 
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <cmath>
+#include <vector>
 #include <boost/math/special_functions.hpp>
 #include <dials/error.h>
 
@@ -204,6 +206,51 @@ namespace dials { namespace algorithms {
              : detail::cdf_large(dist, x);
   }
 
+  /**
+   * The CDF of the kolmogorov smirnov one sided distribution for a given n,
+   * tabulated on a regular grid and linearly interpolated. Evaluating the
+   * exact CDF costs O(n) per call, so this is for when it is needed many times
+   * for the same n.
+   */
+  template <typename RealType = double>
+  class kolmogorov_smirnov_one_sided_table {
+  public:
+    typedef RealType value_type;
+
+    /**
+     * @param n The number of samples
+     * @param npoints The number of grid points
+     */
+    kolmogorov_smirnov_one_sided_table(std::size_t n, std::size_t npoints = 1024)
+        : n_(n), table_(npoints) {
+      DIALS_ASSERT(npoints > 1);
+      kolmogorov_smirnov_one_sided_distribution<RealType> dist(n);
+      for (std::size_t i = 0; i < npoints; ++i) {
+        table_[i] = cdf(dist, std::min((RealType)i / (npoints - 1), (RealType)1.0));
+      }
+    }
+
+    std::size_t n() const {
+      return n_;
+    }
+
+    /**
+     * @param x A value between 0 and 1
+     * @returns The interpolated value of the CDF at x
+     */
+    RealType operator()(RealType x) const {
+      DIALS_ASSERT(x >= 0 && x <= 1.0);
+      RealType u = x * (table_.size() - 1);
+      std::size_t i = std::min((std::size_t)u, table_.size() - 2);
+      RealType f = u - i;
+      return table_[i] + f * (table_[i + 1] - table_[i]);
+    }
+
+  private:
+    std::size_t n_;
+    std::vector<RealType> table_;
+  };
+
   /**
    * Return the PDF for the kolmogorov smirnov one sided distribution.
    * @param dist The distribution
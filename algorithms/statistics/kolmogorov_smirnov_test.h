@@ -12,7 +12,11 @@
 #ifndef DIALS_ALGORITHMS_STATISTICS_KOLMOGOROV_SMIRNOV_TEST_H
 #define DIALS_ALGORITHMS_STATISTICS_KOLMOGOROV_SMIRNOV_TEST_H
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/statistics/kolmogorov_smirnov_one_sided_distribution.h>
 #include <dials/algorithms/statistics/kolmogorov_smirnov_two_sided_distribution.h>
 #include <dials/error.h>
@@ -24,6 +28,189 @@ namespace dials { namespace algorithms {
    */
   enum KSType { Less, Greater, TwoSided };
 
+  namespace detail {
+
+    /**
+     * The pairs to compare and exchange in the sorting networks for 2 to 8
+     * values, with the offset of the network for each n
+     */
+    static const unsigned char ks_sorting_network[][2] = {
+      // n = 2
+      {0, 1},
+      // n = 3
+      {1, 2},
+      {0, 2},
+      {0, 1},
+      // n = 4
+      {0, 1},
+      {2, 3},
+      {0, 2},
+      {1, 3},
+      {1, 2},
+      // n = 5
+      {0, 1},
+      {3, 4},
+      {2, 4},
+      {2, 3},
+      {0, 3},
+      {0, 2},
+      {1, 4},
+      {1, 3},
+      {1, 2},
+      // n = 6
+      {1, 2},
+      {4, 5},
+      {0, 2},
+      {3, 5},
+      {0, 1},
+      {3, 4},
+      {1, 4},
+      {0, 3},
+      {2, 5},
+      {1, 3},
+      {2, 4},
+      {2, 3},
+      // n = 7
+      {1, 2},
+      {3, 4},
+      {5, 6},
+      {0, 2},
+      {3, 5},
+      {4, 6},
+      {0, 1},
+      {4, 5},
+      {2, 6},
+      {0, 4},
+      {1, 5},
+      {0, 3},
+      {2, 5},
+      {1, 3},
+      {2, 4},
+      {2, 3},
+      // n = 8
+      {0, 1},
+      {2, 3},
+      {4, 5},
+      {6, 7},
+      {0, 2},
+      {1, 3},
+      {4, 6},
+      {5, 7},
+      {1, 2},
+      {5, 6},
+      {0, 4},
+      {3, 7},
+      {1, 5},
+      {2, 6},
+      {1, 4},
+      {3, 6},
+      {2, 4},
+      {3, 5},
+      {3, 4}};
+
+    static const std::size_t ks_sorting_network_offset[] = {
+      0, 0, 0, 1, 4, 9, 18, 30, 46, 65};
+
+    /**
+     * Sort a small sample in place: with a sorting network for up to 8
+     * values, by insertion for up to 32 and with std::sort otherwise
+     */
+    template <typename RealType>
+    void ks_sort(RealType *x, std::size_t n) {
+      if (n <= 8) {
+        for (std::size_t k = ks_sorting_network_offset[n];
+             k < ks_sorting_network_offset[n + 1];
+             ++k) {
+          RealType &a = x[ks_sorting_network[k][0]];
+          RealType &b = x[ks_sorting_network[k][1]];
+          RealType lo = std::min(a, b);
+          b = std::max(a, b);
+          a = lo;
+        }
+      } else if (n <= 32) {
+        for (std::size_t i = 1; i < n; ++i) {
+          RealType v = x[i];
+          std::size_t j = i;
+          for (; j > 0 && v < x[j - 1]; --j) {
+            x[j] = x[j - 1];
+          }
+          x[j] = v;
+        }
+      } else {
+        std::sort(x, x + n);
+      }
+    }
+
+    /**
+     * The exact one sided CDF
+     */
+    template <typename RealType>
+    struct ks_one_sided_exact_cdf {
+      RealType operator()(std::size_t n, RealType x) const {
+        return cdf(kolmogorov_smirnov_one_sided_distribution<RealType>(n), x);
+      }
+    };
+
+    /**
+     * The one sided CDF from a table for each n, built when first needed
+     */
+    template <typename RealType>
+    class ks_one_sided_table_cdf {
+    public:
+      RealType operator()(std::size_t n, RealType x) const {
+        typename table_map::iterator it = tables_.find(n);
+        if (it == tables_.end()) {
+          it = tables_
+                 .insert(std::make_pair(
+                   n, kolmogorov_smirnov_one_sided_table<RealType>(n)))
+                 .first;
+        }
+        return it->second(x);
+      }
+
+    private:
+      typedef std::map<std::size_t, kolmogorov_smirnov_one_sided_table<RealType> >
+        table_map;
+      mutable table_map tables_;
+    };
+
+    /**
+     * Perform the test given the CDF at the sorted sample values
+     */
+    template <typename RealType, typename OneSidedCdf>
+    std::pair<RealType, RealType> kolmogorov_smirnov_test_cdfv(
+      const RealType *cdfv,
+      std::size_t n,
+      const KSType &kstype,
+      const OneSidedCdf &cdf1) {
+      RealType Dm = 0.0;
+      RealType Dp = 0.0;
+      for (std::size_t i = 0; i < n; ++i) {
+        Dm = std::max(Dm, cdfv[i] - (RealType)i / (RealType)n);
+        Dp = std::max(Dp, (RealType)(i + 1) / (RealType)n - cdfv[i]);
+      }
+      switch (kstype) {
+      case Less:
+        return std::make_pair(Dm, 1.0 - cdf1(n, Dm));
+      case Greater:
+        return std::make_pair(Dp, 1.0 - cdf1(n, Dp));
+      case TwoSided: {
+        typedef kolmogorov_smirnov_two_sided_distribution<RealType> ks_dist2;
+        RealType D = std::max(Dm, Dp);
+        RealType pa = 1.0 - cdf(ks_dist2(), (D * std::sqrt((RealType)n)));
+        if (n > 2666 || pa > 0.8 - n * 0.3 / 1000.0) {
+          return std::make_pair(D, pa);
+        }
+        return std::make_pair(D, (1.0 - cdf1(n, D)) * 2.0);
+      }
+      default:
+        DIALS_ASSERT(false);
+      };
+      return std::pair<RealType, RealType>(0, 0);
+    }
+
+  }  // namespace detail
+
   /**
    * Calculate D-
    */
@@ -62,9 +249,8 @@ namespace dials { namespace algorithms {
   template <typename RealType>
   std::pair<RealType, RealType> kolmogorov_smirnov_test_less(
     const std::vector<RealType> &cdfv) {
-    typedef kolmogorov_smirnov_one_sided_distribution<RealType> ks_dist;
-    RealType Dm = kolmogorov_smirnov_test_d_minus(cdfv);
-    return std::make_pair(Dm, 1.0 - cdf(ks_dist(cdfv.size()), Dm));
+    return detail::kolmogorov_smirnov_test_cdfv(
+      &cdfv[0], cdfv.size(), Less, detail::ks_one_sided_exact_cdf<RealType>());
   }
 
   /**
@@ -73,9 +259,8 @@ namespace dials { namespace algorithms {
   template <typename RealType>
   std::pair<RealType, RealType> kolmogorov_smirnov_test_greater(
     const std::vector<RealType> &cdfv) {
-    typedef kolmogorov_smirnov_one_sided_distribution<RealType> ks_dist;
-    RealType Dp = kolmogorov_smirnov_test_d_plus(cdfv);
-    return std::make_pair(Dp, 1.0 - cdf(ks_dist(cdfv.size()), Dp));
+    return detail::kolmogorov_smirnov_test_cdfv(
+      &cdfv[0], cdfv.size(), Greater, detail::ks_one_sided_exact_cdf<RealType>());
   }
 
   /**
@@ -84,17 +269,8 @@ namespace dials { namespace algorithms {
   template <typename RealType>
   std::pair<RealType, RealType> kolmogorov_smirnov_test_two_sided(
     const std::vector<RealType> &cdfv) {
-    typedef kolmogorov_smirnov_one_sided_distribution<RealType> ks_dist1;
-    typedef kolmogorov_smirnov_two_sided_distribution<RealType> ks_dist2;
-    std::size_t n = cdfv.size();
-    RealType Dm = kolmogorov_smirnov_test_d_minus(cdfv);
-    RealType Dp = kolmogorov_smirnov_test_d_plus(cdfv);
-    RealType D = std::max(Dm, Dp);
-    RealType pa = 1.0 - cdf(ks_dist2(), (D * std::sqrt((RealType)n)));
-    if (n > 2666 || pa > 0.8 - n * 0.3 / 1000.0) {
-      return std::make_pair(D, pa);
-    }
-    return std::make_pair(D, (1.0 - cdf(ks_dist1(n), D)) * 2.0);
+    return detail::kolmogorov_smirnov_test_cdfv(
+      &cdfv[0], cdfv.size(), TwoSided, detail::ks_one_sided_exact_cdf<RealType>());
   }
 
   /**
@@ -120,31 +296,65 @@ namespace dials { namespace algorithms {
 
     // Sort the sample values into ascending order
     std::vector<value_type> x(first, last);
-    std::sort(x.begin(), x.end());
+    DIALS_ASSERT(x.size() > 0);
+    detail::ks_sort(&x[0], x.size());
 
     // Calculate the value of the CDF at the sample points
-    std::vector<value_type> cdfv(x.size());
     for (std::size_t i = 0; i < x.size(); ++i) {
-      cdfv[i] = cdf(dist, x[i]);
+      x[i] = cdf(dist, x[i]);
     }
 
     // Do the ks test
-    std::pair<value_type, value_type> result(0, 0);
-    switch (kstype) {
-    case Less:
-      result = kolmogorov_smirnov_test_less(cdfv);
-      break;
-    case Greater:
-      result = kolmogorov_smirnov_test_greater(cdfv);
-      break;
-    case TwoSided:
-      result = kolmogorov_smirnov_test_two_sided(cdfv);
-      break;
-    default:
-      DIALS_ASSERT(false);
-      break;
-    };
-    return result;
+    return detail::kolmogorov_smirnov_test_cdfv(
+      &x[0], x.size(), kstype, detail::ks_one_sided_exact_cdf<value_type>());
+  }
+
+  /**
+   * Perform the kolmogorov smirnov test on many small samples, stored one
+   * after another. The samples are sorted and transformed in a single scratch
+   * buffer, and the one sided distribution is tabulated and interpolated for
+   * each sample size, so the p-values may differ slightly from those of
+   * kolmogorov_smirnov_test.
+   * @param dist The distribution
+   * @param data The concatenated samples
+   * @param sizes The size of each sample
+   * @param kstype The type of test to perform (less, greater, two_sided)
+   * @param D The test statistic of each sample
+   * @param p The p-value of each sample
+   */
+  template <typename Dist>
+  void kolmogorov_smirnov_test_batch(
+    const Dist &dist,
+    const af::const_ref<typename Dist::value_type> &data,
+    const af::const_ref<std::size_t> &sizes,
+    const KSType &kstype,
+    af::ref<typename Dist::value_type> D,
+    af::ref<typename Dist::value_type> p) {
+    typedef typename Dist::value_type value_type;
+    DIALS_ASSERT(D.size() == sizes.size());
+    DIALS_ASSERT(p.size() == sizes.size());
+    std::size_t total = 0;
+    std::size_t max_size = 0;
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+      DIALS_ASSERT(sizes[i] > 0);
+      total += sizes[i];
+      max_size = std::max(max_size, sizes[i]);
+    }
+    DIALS_ASSERT(total == data.size());
+    std::vector<value_type> scratch(max_size);
+    detail::ks_one_sided_table_cdf<value_type> cdf1;
+    for (std::size_t i = 0, offset = 0; i < sizes.size(); offset += sizes[i++]) {
+      std::size_t n = sizes[i];
+      std::copy(&data[offset], &data[offset] + n, scratch.begin());
+      detail::ks_sort(&scratch[0], n);
+      for (std::size_t j = 0; j < n; ++j) {
+        scratch[j] = cdf(dist, scratch[j]);
+      }
+      std::pair<value_type, value_type> result =
+        detail::kolmogorov_smirnov_test_cdfv(&scratch[0], n, kstype, cdf1);
+      D[i] = result.first;
+      p[i] = result.second;
+    }
   }
 
 }}  // namespace dials::algorithms
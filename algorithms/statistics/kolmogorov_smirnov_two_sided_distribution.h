@@ -15,6 +15,7 @@
 #include <iostream>
 #include <limits>
 #include <cmath>
+#include <boost/math/constants/constants.hpp>
 #include <boost/math/special_functions.hpp>
 #include <dials/error.h>
 
@@ -38,6 +39,15 @@ namespace dials { namespace algorithms {
    *  P(x) = 1 - 2 * SIGMA (-1)^(j-1) * exp(-2 * j^2 * x^2)
    *                  j=1
    *
+   * The series converges slowly for small x, where the equivalent form
+   *
+   *         sqrt(2 pi)  inf
+   *  P(x) = ---------- SIGMA exp(-(2j - 1)^2 pi^2 / (8 x^2))
+   *             x       j=1
+   *
+   * is used instead. Either way, a fixed number of terms gives the CDF to
+   * within machine precision.
+   *
    * @param dist The distribution
    * @param x A value between -inf and inf
    * @returns The value of the CDF at x
@@ -45,16 +55,25 @@ namespace dials { namespace algorithms {
   template <typename RealType>
   RealType cdf(const kolmogorov_smirnov_two_sided_distribution<RealType> &dist,
                const RealType &x) {
-    const RealType epsilon = std::numeric_limits<RealType>::epsilon();
+    const RealType pi = boost::math::constants::pi<RealType>();
+    if (x <= 0) {
+      return 0.0;
+    }
+    if (x < 1.18) {
+      RealType y = -pi * pi / (8.0 * x * x);
+      RealType s = 0.0;
+      for (int j = 1; j <= 4; ++j) {
+        s += std::exp(y * (2 * j - 1) * (2 * j - 1));
+      }
+      return std::sqrt(2.0 * pi) / x * s;
+    }
     RealType y = -2.0 * x * x;
-    RealType s = 0.0, t = 0.0;
-    int j = 1, sign = 1;
-    do {
-      t = std::exp(y * j * j);
-      s += sign * t;
-      ++j;
-      sign *= -1;
-    } while (s > 0.0 && (t / s) > epsilon);
+    RealType s = 0.0;
+    int sign = 1;
+    for (int j = 1; j <= 5; ++j) {
+      s += sign * std::exp(y * j * j);
+      sign = -sign;
+    }
     return 1.0 - 2.0 * s;
   }
 
@@ -0,0 +1,48 @@
+/*
+ * cosym_ext.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/symmetry/cosym/pairwise_correlation.h>
+#include <dials/util/gil.h>
+#include <dials/util/boost_python/shared_executor.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  PairwiseCorrelationMatrix *make_pairwise_correlation_matrix(
+    const af::const_ref<double> &intensities,
+    const af::const_ref<std::size_t> &offsets,
+    const af::const_ref<cctbx::miller::index<> > &indices,
+    const af::const_ref<bool> &epsilon_one,
+    const af::const_ref<std::size_t, af::c_grid<2> > &relative_op,
+    std::size_t min_pairs,
+    std::size_t nthreads) {
+    dials::util::ScopedReleaseGIL release_gil;
+    return new PairwiseCorrelationMatrix(
+      intensities, offsets, indices, epsilon_one, relative_op, min_pairs, nthreads);
+  }
+
+  BOOST_PYTHON_MODULE(dials_algorithms_symmetry_cosym_ext) {
+    dials::util::boost_python::import_shared_executor();
+
+    class_<PairwiseCorrelationMatrix>("PairwiseCorrelationMatrix", no_init)
+      .def("__init__",
+           make_constructor(&make_pairwise_correlation_matrix,
+                            default_call_policies(),
+                            (arg("intensities"),
+                             arg("offsets"),
+                             arg("indices"),
+                             arg("epsilon_one"),
+                             arg("relative_op"),
+                             arg("min_pairs") = 0,
+                             arg("nthreads") = 1)))
+      .def("rij", &PairwiseCorrelationMatrix::rij)
+      .def("nij", &PairwiseCorrelationMatrix::nij);
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,276 @@
+/*
+ * pairwise_correlation.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SYMMETRY_COSYM_PAIRWISE_CORRELATION_H
+#define DIALS_ALGORITHMS_SYMMETRY_COSYM_PAIRWISE_CORRELATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    /**
+     * Compare the Miller indices of two reflections
+     */
+    struct miller_index_less {
+      const cctbx::miller::index<> *index;
+
+      miller_index_less(const cctbx::miller::index<> *index_) : index(index_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        const cctbx::miller::index<> &ha = index[a];
+        const cctbx::miller::index<> &hb = index[b];
+        if (ha[0] != hb[0]) return ha[0] < hb[0];
+        if (ha[1] != hb[1]) return ha[1] < hb[1];
+        return ha[2] < hb[2];
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the correlation coefficients between the intensities of all pairs
+   * of datasets under all pairs of symmetry operators, for cosym.
+   *
+   * The reflections of all datasets are given in one array, ordered by
+   * dataset, together with their asu Miller indices under each operator.
+   * For each operator and dataset the reflections are sorted by Miller index
+   * once, and the common reflections of two datasets are then found with a
+   * merge join. Only reflections with an epsilon of one are used. The
+   * correlation for a pair of operators depends only on their relative
+   * operator, so it is computed once for each relative operator and pair of
+   * datasets. The rows of the matrix are computed in bands of datasets on
+   * separate threads.
+   *
+   * The matrix has a row and column for each operator and dataset, with
+   * index i + n * k for dataset i and operator k. Pairs with an ill defined
+   * correlation or fewer than the minimum number of common reflections are
+   * left as zero and have a count of zero.
+   */
+  class PairwiseCorrelationMatrix {
+  public:
+    /**
+     * @param intensities The intensities, ordered by dataset
+     * @param offsets The first reflection of each dataset and the total
+     * @param indices The asu Miller indices under each operator, one block of
+     *                intensities.size() for each operator
+     * @param epsilon_one Is the epsilon of each index one, in the same order
+     * @param relative_op The relative operator of each pair of operators
+     * @param min_pairs The minimum number of common reflections
+     * @param nthreads The number of threads
+     */
+    PairwiseCorrelationMatrix(
+      const af::const_ref<double> &intensities,
+      const af::const_ref<std::size_t> &offsets,
+      const af::const_ref<cctbx::miller::index<> > &indices,
+      const af::const_ref<bool> &epsilon_one,
+      const af::const_ref<std::size_t, af::c_grid<2> > &relative_op,
+      std::size_t min_pairs = 0,
+      std::size_t nthreads = 1)
+        : intensities_(intensities.begin(), intensities.end()),
+          offsets_(offsets.begin(), offsets.end()),
+          indices_(indices.begin(), indices.end()),
+          epsilon_one_(epsilon_one.begin(), epsilon_one.end()),
+          relative_op_(relative_op.begin(), relative_op.end()),
+          num_reflections_(intensities.size()),
+          num_datasets_(offsets.size() - 1),
+          num_ops_(relative_op.accessor()[0]),
+          num_relative_ops_(0),
+          min_pairs_(min_pairs) {
+      DIALS_ASSERT(offsets.size() > 1);
+      DIALS_ASSERT(offsets[0] == 0);
+      DIALS_ASSERT(offsets[num_datasets_] == num_reflections_);
+      for (std::size_t i = 0; i < num_datasets_; ++i) {
+        DIALS_ASSERT(offsets[i] <= offsets[i + 1]);
+      }
+      DIALS_ASSERT(num_ops_ > 0);
+      DIALS_ASSERT(relative_op.accessor()[1] == num_ops_);
+      DIALS_ASSERT(indices.size() == num_ops_ * num_reflections_);
+      DIALS_ASSERT(epsilon_one.size() == indices.size());
+      for (std::size_t k = 0; k < relative_op_.size(); ++k) {
+        num_relative_ops_ = std::max(num_relative_ops_, relative_op_[k] + 1);
+      }
+
+      // Sort the reflections of each dataset by Miller index under each
+      // operator
+      order_.resize(indices_.size());
+      for (std::size_t i = 0; i < order_.size(); ++i) {
+        order_[i] = i;
+      }
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PairwiseCorrelationMatrix::sort_blocks, this, _1, _2),
+        num_ops_ * num_datasets_,
+        nthreads);
+
+      // Compute the rows of the matrix
+      std::size_t size = num_datasets_ * num_ops_;
+      rij_ = af::versa<double, af::c_grid<2> >(af::c_grid<2>(size, size), 0.0);
+      nij_ = af::versa<std::size_t, af::c_grid<2> >(af::c_grid<2>(size, size), 0);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&PairwiseCorrelationMatrix::compute_rows, this, _1, _2),
+        num_datasets_,
+        nthreads);
+    }
+
+    /**
+     * @returns The matrix of correlation coefficients
+     */
+    af::versa<double, af::c_grid<2> > rij() const {
+      return rij_;
+    }
+
+    /**
+     * @returns The number of common reflections for each coefficient
+     */
+    af::versa<std::size_t, af::c_grid<2> > nij() const {
+      return nij_;
+    }
+
+  private:
+    /**
+     * Sort the reflections of a band of (operator, dataset) blocks
+     */
+    void sort_blocks(std::size_t first, std::size_t last) {
+      for (std::size_t b = first; b < last; ++b) {
+        std::size_t k = b / num_datasets_;
+        std::size_t i = b % num_datasets_;
+        std::size_t *begin = &order_[0] + k * num_reflections_ + offsets_[i];
+        std::size_t *end = &order_[0] + k * num_reflections_ + offsets_[i + 1];
+        std::sort(begin, end, detail::miller_index_less(&indices_[0]));
+      }
+    }
+
+    /**
+     * Compute the correlation between dataset i under operator k and dataset
+     * j under operator kk
+     * @returns The number of common reflections, or zero if the correlation
+     *          is not defined
+     */
+    std::size_t correlation(std::size_t i,
+                            std::size_t k,
+                            std::size_t j,
+                            std::size_t kk,
+                            std::vector<double> &x,
+                            std::vector<double> &y,
+                            double &cc) const {
+      // Find the common reflections with a merge join
+      detail::miller_index_less less(&indices_[0]);
+      const std::size_t *order_k = &order_[0] + k * num_reflections_;
+      const std::size_t *order_kk = &order_[0] + kk * num_reflections_;
+      const std::size_t *a = order_k + offsets_[i];
+      const std::size_t *a_end = order_k + offsets_[i + 1];
+      const std::size_t *b = order_kk + offsets_[j];
+      const std::size_t *b_end = order_kk + offsets_[j + 1];
+      x.clear();
+      y.clear();
+      while (a != a_end && b != b_end) {
+        if (less(*a, *b)) {
+          ++a;
+        } else if (less(*b, *a)) {
+          ++b;
+        } else {
+          if (epsilon_one_[*a]) {
+            x.push_back(intensities_[*a % num_reflections_]);
+            y.push_back(intensities_[*b % num_reflections_]);
+          }
+          ++a;
+          ++b;
+        }
+      }
+
+      // Compute the correlation coefficient
+      std::size_t n = x.size();
+      if (n == 0) {
+        return 0;
+      }
+      double mean_x = 0;
+      double mean_y = 0;
+      for (std::size_t m = 0; m < n; ++m) {
+        mean_x += x[m];
+        mean_y += y[m];
+      }
+      mean_x /= n;
+      mean_y /= n;
+      double sxy = 0;
+      double sxx = 0;
+      double syy = 0;
+      for (std::size_t m = 0; m < n; ++m) {
+        double dx = x[m] - mean_x;
+        double dy = y[m] - mean_y;
+        sxy += dx * dy;
+        sxx += dx * dx;
+        syy += dy * dy;
+      }
+      double denominator = std::sqrt(sxx * syy);
+      if (denominator < 1e-15) {
+        return 0;
+      }
+      cc = sxy / denominator;
+      return n;
+    }
+
+    /**
+     * Compute the rows of a band of datasets
+     */
+    void compute_rows(std::size_t first, std::size_t last) {
+      std::vector<double> x;
+      std::vector<double> y;
+      std::vector<bool> cached(num_relative_ops_);
+      std::vector<double> cached_cc(num_relative_ops_);
+      std::vector<std::size_t> cached_n(num_relative_ops_);
+      for (std::size_t i = first; i < last; ++i) {
+        for (std::size_t j = 0; j < num_datasets_; ++j) {
+          std::fill(cached.begin(), cached.end(), false);
+          for (std::size_t k = 0; k < num_ops_; ++k) {
+            for (std::size_t kk = 0; kk < num_ops_; ++kk) {
+              // Don't include the correlation of a dataset with itself
+              if (i == j && k == kk) {
+                continue;
+              }
+              std::size_t r = relative_op_[k * num_ops_ + kk];
+              if (!cached[r]) {
+                cached_n[r] = correlation(i, k, j, kk, x, y, cached_cc[r]);
+                cached[r] = true;
+              }
+              if (cached_n[r] == 0 || cached_n[r] < min_pairs_) {
+                continue;
+              }
+              std::size_t ik = i + num_datasets_ * k;
+              std::size_t jk = j + num_datasets_ * kk;
+              rij_(ik, jk) = cached_cc[r];
+              nij_(ik, jk) = cached_n[r];
+            }
+          }
+        }
+      }
+    }
+
+    std::vector<double> intensities_;
+    std::vector<std::size_t> offsets_;
+    std::vector<cctbx::miller::index<> > indices_;
+    std::vector<bool> epsilon_one_;
+    std::vector<std::size_t> relative_op_;
+    std::vector<std::size_t> order_;
+    std::size_t num_reflections_;
+    std::size_t num_datasets_;
+    std::size_t num_ops_;
+    std::size_t num_relative_ops_;
+    std::size_t min_pairs_;
+    af::versa<double, af::c_grid<2> > rij_;
+    af::versa<std::size_t, af::c_grid<2> > nij_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SYMMETRY_COSYM_PAIRWISE_CORRELATION_H
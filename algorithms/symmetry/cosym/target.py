@@ -3,15 +3,14 @@
 
 import copy
 import logging
-import math
-
+import numpy as np
 from orderedset import OrderedSet
-from scipy import sparse
 
 import cctbx.sgtbx.cosets
 from cctbx import miller, sgtbx
 from cctbx.array_family import flex
-from libtbx import easy_mp
+
+from dials_algorithms_symmetry_cosym_ext import PairwiseCorrelationMatrix
 
 logger = logging.getLogger(__name__)
 
@@ -161,146 +160,57 @@ def _compute_rij_wij(self, use_cache=True):
 
         NN = n_lattices * n_sym_ops
 
-        self.rij_matrix = flex.double(flex.grid(NN, NN), 0.0)
-        if self._weights is None:
-            self.wij_matrix = None
-        else:
-            self.wij_matrix = flex.double(flex.grid(NN, NN), 0.0)
-
-        indices = {}
+        # The asu indices of the reflections under each operator, and whether
+        # each index has an epsilon of one in the Patterson group
         space_group_type = self._data.space_group().type()
-        for cb_op in self._sym_ops:
-            cb_op = sgtbx.change_of_basis_op(cb_op)
+        cb_ops = [sgtbx.change_of_basis_op(cb_op) for cb_op in self._sym_ops]
+        indices = flex.miller_index()
+        epsilon_one = flex.bool()
+        for cb_op in cb_ops:
             indices_reindexed = cb_op.apply(self._data.indices())
             miller.map_to_asu(space_group_type, False, indices_reindexed)
-            indices[cb_op.as_xyz()] = indices_reindexed
-
-        def _compute_rij_matrix_one_row_block(i):
-            rij_cache = {}
-
-            n_sym_ops = len(self._sym_ops)
-            NN = n_lattices * n_sym_ops
-
-            rij_row = []
-            rij_col = []
-            rij_data = []
-            if self._weights is not None:
-                wij_row = []
-                wij_col = []
-                wij_data = []
-            else:
-                wij = None
-
-            i_lower, i_upper = self._lattice_lower_upper_index(i)
-            intensities_i = self._data.data()[i_lower:i_upper]
-
-            for j in range(n_lattices):
-
-                j_lower, j_upper = self._lattice_lower_upper_index(j)
-                intensities_j = self._data.data()[j_lower:j_upper]
-
-                for k, cb_op_k in enumerate(self._sym_ops):
-                    cb_op_k = sgtbx.change_of_basis_op(cb_op_k)
-
-                    indices_i = indices[cb_op_k.as_xyz()][i_lower:i_upper]
-
-                    for kk, cb_op_kk in enumerate(self._sym_ops):
-                        if i == j and k == kk:
-                            # don't include correlation of dataset with itself
-                            continue
-                        cb_op_kk = sgtbx.change_of_basis_op(cb_op_kk)
-
-                        ik = i + (n_lattices * k)
-                        jk = j + (n_lattices * kk)
-
-                        key = (i, j, str(cb_op_k.inverse() * cb_op_kk))
-                        if use_cache and key in rij_cache:
-                            cc, n = rij_cache[key]
-                        else:
-                            indices_j = indices[cb_op_kk.as_xyz()][j_lower:j_upper]
-
-                            matches = miller.match_indices(indices_i, indices_j)
-                            pairs = matches.pairs()
-                            isel_i = pairs.column(0)
-                            isel_j = pairs.column(1)
-                            isel_i = isel_i.select(
-                                self._patterson_group.epsilon(indices_i.select(isel_i))
-                                == 1
-                            )
-                            isel_j = isel_j.select(
-                                self._patterson_group.epsilon(indices_j.select(isel_j))
-                                == 1
-                            )
-                            corr = flex.linear_correlation(
-                                intensities_i.select(isel_i),
-                                intensities_j.select(isel_j),
-                            )
-
-                            if corr.is_well_defined():
-                                cc = corr.coefficient()
-                                n = corr.n()
-                                rij_cache[key] = (cc, n)
-                            else:
-                                cc = None
-                                n = None
-
-                        if (
-                            n is None
-                            or cc is None
-                            or (self._min_pairs is not None and n < self._min_pairs)
-                        ):
-                            continue
-
-                        if self._weights == "count":
-                            wij_row.extend([ik, jk])
-                            wij_col.extend([jk, ik])
-                            wij_data.extend([n, n])
-                        elif self._weights == "standard_error":
-                            assert n > 2
-                            # http://www.sjsu.edu/faculty/gerstman/StatPrimer/correlation.pdf
-                            se = math.sqrt((1 - cc ** 2) / (n - 2))
-                            wij = 1 / se
-                            wij_row.extend([ik, jk])
-                            wij_col.extend([jk, ik])
-                            wij_data.extend([wij, wij])
-
-                        rij_row.append(ik)
-                        rij_col.append(jk)
-                        rij_data.append(cc)
-
-            rij = sparse.coo_matrix((rij_data, (rij_row, rij_col)), shape=(NN, NN))
-            if self._weights is not None:
-                wij = sparse.coo_matrix((wij_data, (wij_row, wij_col)), shape=(NN, NN))
-
-            return rij, wij
-
-        args = [(i,) for i in range(n_lattices)]
-        results = easy_mp.parallel_map(
-            _compute_rij_matrix_one_row_block,
-            args,
-            processes=self._nproc,
-            iterable_type=easy_mp.posiargs,
-            method="multiprocessing",
-        )
-
-        rij_matrix = None
-        wij_matrix = None
-        for i, (rij, wij) in enumerate(results):
-            if rij_matrix is None:
-                rij_matrix = rij
-            else:
-                rij_matrix += rij
-            if wij is not None:
-                if wij_matrix is None:
-                    wij_matrix = wij
+            indices.extend(indices_reindexed)
+            epsilon_one.extend(self._patterson_group.epsilon(indices_reindexed) == 1)
+
+        # The correlation between two datasets under a pair of operators only
+        # depends on the relative operator, so it is computed once for each
+        relative_ops = {}
+        relative_op = flex.size_t(flex.grid(n_sym_ops, n_sym_ops), 0)
+        for k, cb_op_k in enumerate(cb_ops):
+            for kk, cb_op_kk in enumerate(cb_ops):
+                if use_cache:
+                    key = str(cb_op_k.inverse() * cb_op_kk)
                 else:
-                    wij_matrix += wij
-
-        self.rij_matrix = flex.double(rij_matrix.todense())
-        if wij_matrix is not None:
-            import numpy as np
+                    key = (k, kk)
+                relative_op[k, kk] = relative_ops.setdefault(key, len(relative_ops))
+
+        offsets = flex.size_t(list(self._lattices) + [self._data.size()])
+        matrix = PairwiseCorrelationMatrix(
+            self._data.data(),
+            offsets,
+            indices,
+            epsilon_one,
+            relative_op,
+            min_pairs=self._min_pairs if self._min_pairs is not None else 0,
+            nthreads=self._nproc,
+        )
+        self.rij_matrix = matrix.rij()
 
-            self.wij_matrix = flex.double(wij_matrix.todense().astype(np.float64))
+        if self._weights is None:
+            self.wij_matrix = None
+        else:
+            n = matrix.nij().as_double().as_numpy_array().reshape(NN, NN)
+            if self._weights == "count":
+                wij = n
+            elif self._weights == "standard_error":
+                defined = n > 0
+                assert (n[defined] > 2).all()
+                # http://www.sjsu.edu/faculty/gerstman/StatPrimer/correlation.pdf
+                cc = self.rij_matrix.as_numpy_array()[defined]
+                se = np.sqrt((1 - cc ** 2) / (n[defined] - 2))
+                wij = np.zeros((NN, NN))
+                wij[defined] = 1 / se
+            self.wij_matrix = flex.double(wij + wij.T)
 
         return self.rij_matrix, self.wij_matrix
 
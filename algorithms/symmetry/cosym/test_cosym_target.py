@@ -2,7 +2,7 @@
 
 import pytest
 
-from cctbx import sgtbx
+from cctbx import miller, sgtbx
 from scitbx.array_family import flex
 
 from dials.algorithms.symmetry.cosym import engine, target
@@ -46,3 +46,66 @@ def test_cosym_target(space_group):
         assert f < f0
         assert pytest.approx(g, abs=1e-3) == [0] * len(g)
         assert pytest.approx(g_fd, abs=1e-3) == [0] * len(g)
+
+
+def reference_rij_wij(t, weights):
+    """Compute the rij and wij matrices with miller.match_indices."""
+    n_lattices = t._lattices.size()
+    cb_ops = [sgtbx.change_of_basis_op(cb_op) for cb_op in t.get_sym_ops()]
+    NN = n_lattices * len(cb_ops)
+    rij = flex.double(flex.grid(NN, NN), 0)
+    wij = flex.double(flex.grid(NN, NN), 0)
+    space_group_type = t._data.space_group().type()
+    indices = []
+    for cb_op in cb_ops:
+        indices_reindexed = cb_op.apply(t._data.indices())
+        miller.map_to_asu(space_group_type, False, indices_reindexed)
+        indices.append(indices_reindexed)
+    for i in range(n_lattices):
+        i_lower, i_upper = t._lattice_lower_upper_index(i)
+        for j in range(n_lattices):
+            j_lower, j_upper = t._lattice_lower_upper_index(j)
+            for k in range(len(cb_ops)):
+                indices_i = indices[k][i_lower:i_upper]
+                for kk in range(len(cb_ops)):
+                    if i == j and k == kk:
+                        continue
+                    indices_j = indices[kk][j_lower:j_upper]
+                    pairs = miller.match_indices(indices_i, indices_j).pairs()
+                    isel = pairs.select(
+                        t._patterson_group.epsilon(indices_i.select(pairs.column(0)))
+                        == 1
+                    )
+                    corr = flex.linear_correlation(
+                        t._data.data()[i_lower:i_upper].select(isel.column(0)),
+                        t._data.data()[j_lower:j_upper].select(isel.column(1)),
+                    )
+                    if not corr.is_well_defined():
+                        continue
+                    ik = i + n_lattices * k
+                    jk = j + n_lattices * kk
+                    rij[ik, jk] = corr.coefficient()
+                    if weights == "count":
+                        wij[ik, jk] += corr.n()
+                        wij[jk, ik] += corr.n()
+    return rij, wij
+
+
+@pytest.mark.parametrize("space_group", ["P2", "P6"])
+def test_cosym_target_rij_wij(space_group):
+    datasets, expected_reindexing_ops = generate_test_data(
+        space_group=sgtbx.space_group_info(symbol=space_group).group(), sample_size=10
+    )
+
+    intensities = datasets[0]
+    dataset_ids = flex.double(intensities.size(), 0)
+    for i, d in enumerate(datasets[1:]):
+        intensities = intensities.concatenate(d, assert_is_similar_symmetry=False)
+        dataset_ids.extend(flex.double(d.size(), i + 1))
+
+    for nproc in (1, 4):
+        t = target.Target(intensities, dataset_ids, weights="count", nproc=nproc)
+        rij, wij = reference_rij_wij(t, "count")
+        assert list(t.rij_matrix) == pytest.approx(list(rij))
+        assert t.rij_matrix.all() == rij.all()
+        assert list(t.wij_matrix) == list(wij)
@@ -11,12 +11,90 @@
 #ifndef DIALS_ARRAY_FAMILY_BINNER_H
 #define DIALS_ARRAY_FAMILY_BINNER_H
 
-#include <map>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/bind.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace af {
 
+  /**
+   * The count, sum, sum of squares, minimum and maximum of values in bins
+   */
+  class BinStatistics {
+  public:
+    BinStatistics(af::shared<std::size_t> count,
+                  af::shared<double> sum,
+                  af::shared<double> sum_sq,
+                  af::shared<double> min,
+                  af::shared<double> max)
+        : count_(count), sum_(sum), sum_sq_(sum_sq), min_(min), max_(max) {
+      DIALS_ASSERT(sum_.size() == count_.size());
+      DIALS_ASSERT(sum_sq_.size() == count_.size());
+      DIALS_ASSERT(min_.size() == count_.size());
+      DIALS_ASSERT(max_.size() == count_.size());
+    }
+
+    /**
+     * @returns The number of values in each bin
+     */
+    af::shared<std::size_t> count() const {
+      return count_;
+    }
+
+    /**
+     * @returns The sum of the values in each bin
+     */
+    af::shared<double> sum() const {
+      return sum_;
+    }
+
+    /**
+     * @returns The sum of the squares of the values in each bin
+     */
+    af::shared<double> sum_sq() const {
+      return sum_sq_;
+    }
+
+    /**
+     * @returns The minimum value in each bin, or zero if the bin is empty
+     */
+    af::shared<double> min() const {
+      return min_;
+    }
+
+    /**
+     * @returns The maximum value in each bin, or zero if the bin is empty
+     */
+    af::shared<double> max() const {
+      return max_;
+    }
+
+    /**
+     * @returns The mean value in each bin, or zero if the bin is empty
+     */
+    af::shared<double> mean() const {
+      af::shared<double> result(count_.size(), 0);
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        if (count_[i] > 0) {
+          result[i] = sum_[i] / count_[i];
+        }
+      }
+      return result;
+    }
+
+  private:
+    af::shared<std::size_t> count_;
+    af::shared<double> sum_;
+    af::shared<double> sum_sq_;
+    af::shared<double> min_;
+    af::shared<double> max_;
+  };
+
   /**
    * A class to compute the count, sum and mean of values in bins
    */
@@ -54,7 +132,6 @@ namespace dials { namespace af {
     af::shared<std::size_t> count() const {
       af::shared<std::size_t> result(nbins_, 0);
       for (std::size_t i = 0; i < index_.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
         result[index_[i]]++;
       }
       return result;
@@ -68,7 +145,6 @@ namespace dials { namespace af {
       DIALS_ASSERT(y.size() == index_.size());
       af::shared<double> result(nbins_, 0);
       for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
         result[index_[i]] += y[i];
       }
       return result;
@@ -82,7 +158,6 @@ namespace dials { namespace af {
       DIALS_ASSERT(y.size() == index_.size());
       af::shared<int> result(nbins_, 0);
       for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
         result[index_[i]] += y[i];
       }
       return result;
@@ -96,7 +171,6 @@ namespace dials { namespace af {
       DIALS_ASSERT(y.size() == index_.size());
       af::shared<int> result(nbins_, 0);
       for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
         result[index_[i]] += (int)y[i];
       }
       return result;
@@ -108,10 +182,10 @@ namespace dials { namespace af {
      */
     af::shared<double> mean(const af::const_ref<double> &y) const {
       DIALS_ASSERT(y.size() == index_.size());
-      af::shared<std::size_t> num = count();
+      std::vector<std::size_t> num(nbins_, 0);
       af::shared<double> result(nbins_, 0);
       for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
+        num[index_[i]]++;
         result[index_[i]] += y[i];
       }
       for (std::size_t i = 0; i < result.size(); ++i) {
@@ -122,7 +196,95 @@ namespace dials { namespace af {
       return result;
     }
 
+    /**
+     * Compute the count, sum, sum of squares, minimum and maximum of y in
+     * each bin in a single pass. With multiple threads, each thread
+     * accumulates a contiguous chunk of the values into its own bins, which
+     * are then combined.
+     * @param y The quantity
+     * @param nthreads The number of threads
+     * @returns The statistics of y in each bin
+     */
+    BinStatistics statistics(const af::const_ref<double> &y,
+                             std::size_t nthreads = 1) const {
+      DIALS_ASSERT(y.size() == index_.size());
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t nchunks = std::max((std::size_t)1, std::min(nthreads, y.size()));
+      std::vector<partial_statistics> partial(nchunks, partial_statistics(nbins_));
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&BinIndexer::statistics_chunks,
+                    this,
+                    y,
+                    boost::ref(partial),
+                    _1,
+                    _2),
+        nchunks,
+        nchunks);
+
+      // Combine the bins from each chunk
+      af::shared<std::size_t> count(nbins_, 0);
+      af::shared<double> sum(nbins_, 0);
+      af::shared<double> sum_sq(nbins_, 0);
+      af::shared<double> min(nbins_, 0);
+      af::shared<double> max(nbins_, 0);
+      for (std::size_t j = 0; j < nbins_; ++j) {
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -std::numeric_limits<double>::infinity();
+        for (std::size_t c = 0; c < nchunks; ++c) {
+          count[j] += partial[c].count[j];
+          sum[j] += partial[c].sum[j];
+          sum_sq[j] += partial[c].sum_sq[j];
+          lo = std::min(lo, partial[c].min[j]);
+          hi = std::max(hi, partial[c].max[j]);
+        }
+        if (count[j] > 0) {
+          min[j] = lo;
+          max[j] = hi;
+        }
+      }
+      return BinStatistics(count, sum, sum_sq, min, max);
+    }
+
   private:
+    struct partial_statistics {
+      std::vector<std::size_t> count;
+      std::vector<double> sum;
+      std::vector<double> sum_sq;
+      std::vector<double> min;
+      std::vector<double> max;
+
+      partial_statistics(std::size_t nbins)
+          : count(nbins, 0),
+            sum(nbins, 0),
+            sum_sq(nbins, 0),
+            min(nbins, std::numeric_limits<double>::infinity()),
+            max(nbins, -std::numeric_limits<double>::infinity()) {}
+    };
+
+    /**
+     * Accumulate the statistics for the chunks [first, last) of the values
+     */
+    void statistics_chunks(af::const_ref<double> y,
+                           std::vector<partial_statistics> &partial,
+                           std::size_t first,
+                           std::size_t last) const {
+      std::size_t nchunks = partial.size();
+      for (std::size_t c = first; c < last; ++c) {
+        partial_statistics &p = partial[c];
+        std::size_t i0 = (c * y.size()) / nchunks;
+        std::size_t i1 = ((c + 1) * y.size()) / nchunks;
+        for (std::size_t i = i0; i < i1; ++i) {
+          std::size_t j = index_[i];
+          double v = y[i];
+          p.count[j]++;
+          p.sum[j] += v;
+          p.sum_sq[j] += v * v;
+          p.min[j] = std::min(p.min[j], v);
+          p.max[j] = std::max(p.max[j], v);
+        }
+      }
+    }
+
     std::size_t nbins_;
     af::shared<std::size_t> index_;
   };
@@ -132,14 +294,20 @@ namespace dials { namespace af {
    */
   class Binner {
   public:
-    typedef std::map<double, std::size_t> map_type;
-
-    Binner(const af::const_ref<double> &bins) {
+    Binner(const af::const_ref<double> &bins)
+        : bins_(bins.begin(), bins.end()), uniform_(false), step_(0) {
       DIALS_ASSERT(bins.size() > 1);
-      bins_.insert(std::pair<double, std::size_t>(bins[0], 0));
       for (std::size_t i = 1; i < bins.size(); ++i) {
         DIALS_ASSERT(bins[i] > bins[i - 1]);
-        bins_.insert(bins_.end(), std::pair<double, std::size_t>(bins[i], i));
+      }
+
+      // If the bins are evenly spaced then a value's bin can be computed
+      // directly, otherwise it is found by binary search
+      std::size_t n = bins_.size() - 1;
+      step_ = (bins_[n] - bins_[0]) / n;
+      uniform_ = step_ > 0 && step_ < std::numeric_limits<double>::infinity();
+      for (std::size_t i = 1; uniform_ && i < n; ++i) {
+        uniform_ = std::abs(bins_[i] - (bins_[0] + i * step_)) <= 1e-6 * step_;
       }
     }
 
@@ -147,29 +315,21 @@ namespace dials { namespace af {
      * @returns The bins
      */
     af::shared<double> bins() const {
-      af::shared<double> result(bins_.size());
-      std::size_t i = 0;
-      for (map_type::const_iterator it = bins_.begin(); it != bins_.end(); ++it) {
-        DIALS_ASSERT(it->second == i++);
-        result[it->second] = it->first;
-      }
-      return result;
+      return af::shared<double>(bins_.begin(), bins_.end());
     }
 
     /**
      * @param x The x value
+     * @param nthreads The number of threads
      * @returns an indexer
      */
-    BinIndexer indexer(const af::const_ref<double> &x) {
+    BinIndexer indexer(const af::const_ref<double> &x, std::size_t nthreads = 1) const {
       // Find the indices of elements
       af::shared<std::size_t> index(x.size());
-      for (std::size_t i = 0; i < x.size(); ++i) {
-        map_type::const_iterator it = bins_.upper_bound(x[i]);
-        if (it != bins_.begin()) {
-          --it;
-        }
-        index[i] = it->second;
-      }
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&Binner::index_band, this, x, index.ref(), _1, _2),
+        x.size(),
+        nthreads);
 
       // Return the indexer
       return BinIndexer(bins_.size(), index);
@@ -183,7 +343,60 @@ namespace dials { namespace af {
     }
 
   private:
-    map_type bins_;
+    /**
+     * Find the bins of the values [first, last). A value is in the bin of
+     * the last edge not greater than it, or the first bin if it is below all
+     * of the edges.
+     */
+    void index_band(af::const_ref<double> x,
+                    af::ref<std::size_t> index,
+                    std::size_t first,
+                    std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        index[i] = uniform_ ? find_uniform(x[i]) : find_search(x[i]);
+      }
+    }
+
+    /**
+     * Compute the bin from the spacing of the edges, then correct it against
+     * the edges themselves so the result matches the binary search exactly.
+     */
+    std::size_t find_uniform(double x) const {
+      std::size_t n = bins_.size();
+      double t = (x - bins_[0]) / step_;
+      std::size_t i = 0;
+      if (!(t < n)) {
+        i = n - 1;
+      } else if (t > 0) {
+        i = (std::size_t)t;
+      }
+      while (i + 1 < n && !(x < bins_[i + 1])) {
+        ++i;
+      }
+      while (i > 0 && x < bins_[i]) {
+        --i;
+      }
+      return i;
+    }
+
+    /**
+     * Binary search for the bin, with a conditional move rather than a
+     * branch at each step
+     */
+    std::size_t find_search(double x) const {
+      const double *base = &bins_[0];
+      std::size_t n = bins_.size();
+      while (n > 1) {
+        std::size_t half = n / 2;
+        base = (x < base[half]) ? base : base + half;
+        n -= half;
+      }
+      return base - &bins_[0];
+    }
+
+    std::vector<double> bins_;
+    bool uniform_;
+    double step_;
   };
 
 }}  // namespace dials::af
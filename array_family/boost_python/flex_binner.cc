@@ -30,18 +30,27 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   void export_flex_binner() {
+    class_<BinStatistics>("BinStatistics", no_init)
+      .def("count", &BinStatistics::count)
+      .def("sum", &BinStatistics::sum)
+      .def("sum_sq", &BinStatistics::sum_sq)
+      .def("min", &BinStatistics::min)
+      .def("max", &BinStatistics::max)
+      .def("mean", &BinStatistics::mean);
+
     class_<BinIndexer>("BinIndexer", no_init)
       .def("indices", &BinIndexer::indices)
       .def("count", &BinIndexer::count)
       .def("sum", &sum_double)
       .def("sum", &sum_int)
       .def("sum", &sum_bool)
-      .def("mean", &BinIndexer::mean);
+      .def("mean", &BinIndexer::mean)
+      .def("statistics", &BinIndexer::statistics, (arg("y"), arg("nthreads") = 1));
 
     class_<Binner>("Binner", no_init)
       .def(init<const af::const_ref<double> &>())
       .def("bins", &Binner::bins)
-      .def("indexer", &Binner::indexer)
+      .def("indexer", &Binner::indexer, (arg("x"), arg("nthreads") = 1))
       .def("__len__", &Binner::size);
   }
 
@@ -16,6 +16,8 @@
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/ray.h>
 #include <dials/config.h>
+#include <dials/util/boost_python/memory_accounting.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace af { namespace boost_python {
 
@@ -30,6 +32,7 @@ namespace dials { namespace af { namespace boost_python {
   void export_flex_reflection_table();
   void export_flex_unit_cell();
   void export_flex_shoebox_extractor();
+  void export_flex_shoebox_file();
   void export_flex_binner();
 
   template <typename FloatType>
@@ -46,6 +49,8 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   BOOST_PYTHON_MODULE(dials_array_family_flex_ext) {
+    dials::util::boost_python::import_memory_accounting();
+    dials::util::boost_python::import_shared_executor();
     export_flex_int6();
     export_flex_shoebox();
     export_flex_centroid();
@@ -54,6 +59,7 @@ namespace dials { namespace af { namespace boost_python {
     export_flex_reflection_table();
     export_flex_unit_cell();
     export_flex_shoebox_extractor();
+    export_flex_shoebox_file();
     export_flex_binner();
 
     def("get_real_type", &get_real_type<ProfileFloatType>);
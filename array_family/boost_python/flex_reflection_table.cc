@@ -12,8 +12,10 @@
 #include <boost/python/def.hpp>
 #include <boost/python/suite/indexing/map_indexing_suite.hpp>
 #include <dials/util/python_streambuf.h>
+#include <dials/util/boost_python/buffer_view.h>
 #include <numeric>
 #include <dials/array_family/boost_python/flex_table_suite.h>
+#include <dials/array_family/group_by.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/array_family/reflection_table_msgpack_adapter.h>
@@ -25,10 +27,12 @@
 #include <scitbx/vec3.h>
 #include <scitbx/vec2.h>
 #include <cctbx/miller.h>
+#include <dials/util/gil.h>
 
 namespace dials { namespace af { namespace boost_python {
 
   using namespace boost::python;
+  using dials::util::boost_python::python_buffer_view;
   using dials::algorithms::profile_model::gaussian_rs::CoordinateSystem;
   using dials::model::Observation;
   using dials::model::Shoebox;
@@ -586,12 +590,14 @@ namespace dials { namespace af { namespace boost_python {
    * Select a number of rows from the table via an index array
    * @param self The current table
    * @param index The index array
+   * @param nthreads The number of threads to share the columns between
    * @returns The new table with the requested rows
    */
   template <typename T>
   T reflection_table_select_rows_index(const T &self,
-                                       const af::const_ref<std::size_t> &index) {
-    T result = flex_table_suite::select_rows_index<T>(self, index);
+                                       const af::const_ref<std::size_t> &index,
+                                       std::size_t nthreads) {
+    T result = flex_table_suite::select_rows_index<T>(self, index, nthreads);
     return result;
   }
 
@@ -599,12 +605,14 @@ namespace dials { namespace af { namespace boost_python {
    * Select a number of rows from the table via an index array
    * @param self The current table
    * @param flags The flag array
+   * @param nthreads The number of threads to share the columns between
    * @returns The new table with the requested rows
    */
   template <typename T>
   T reflection_table_select_rows_flags(const T &self,
-                                       const af::const_ref<bool> &flags) {
-    T result = flex_table_suite::select_rows_flags<T>(self, flags);
+                                       const af::const_ref<bool> &flags,
+                                       std::size_t nthreads) {
+    T result = flex_table_suite::select_rows_flags<T>(self, flags, nthreads);
     return result;
   }
 
@@ -638,9 +646,11 @@ namespace dials { namespace af { namespace boost_python {
   /**
    * Extend the reflection table
    */
-  void reflection_table_extend(reflection_table &self, const reflection_table &other) {
+  void reflection_table_extend(reflection_table &self,
+                               const reflection_table &other,
+                               std::size_t nthreads) {
     flex_table_suite::reflection_table_extend_identifiers(self, other);
-    flex_table_suite::extend(self, other);
+    flex_table_suite::extend(self, other, nthreads);
   }
 
   /**
@@ -651,6 +661,100 @@ namespace dials { namespace af { namespace boost_python {
     flex_table_suite::update(self, other);
   }
 
+  /**
+   * A visitor to add a column to a set of row keys
+   */
+  struct add_row_key_visitor : public boost::static_visitor<void> {
+    RowKeys &keys;
+
+    add_row_key_visitor(RowKeys &keys_) : keys(keys_) {}
+
+    void operator()(const af::shared<int> &col) {
+      keys.add(col.const_ref());
+    }
+
+    void operator()(const af::shared<std::size_t> &col) {
+      keys.add(col.const_ref());
+    }
+
+    void operator()(const af::shared<bool> &col) {
+      keys.add(col.const_ref());
+    }
+
+    void operator()(const af::shared<cctbx::miller::index<> > &col) {
+      keys.add(col.const_ref());
+    }
+
+    template <typename U>
+    void operator()(const U &) {
+      throw DIALS_ERROR("Column type can not be used as a key");
+    }
+  };
+
+  /**
+   * Get the keys of the rows of a table from a sequence of column names
+   */
+  template <typename T>
+  RowKeys make_row_keys(const T &self, boost::python::object keys) {
+    RowKeys result(self.nrows());
+    for (std::size_t i = 0; i < len(keys); ++i) {
+      std::string key = extract<std::string>(keys[i]);
+      typename T::const_iterator it = self.find(key);
+      DIALS_ASSERT(it != self.end());
+      add_row_key_visitor visitor(result);
+      it->second.apply_visitor(visitor);
+    }
+    return result;
+  }
+
+  /**
+   * Group the rows of the table with equal values of the key columns
+   * @param self The table
+   * @param keys The key column names
+   * @param nthreads The number of threads
+   * @returns The group of each row, and the offsets and rows of each group
+   */
+  template <typename T>
+  boost::python::tuple group_by(const T &self,
+                                boost::python::object keys,
+                                std::size_t nthreads) {
+    RowKeys row_keys = make_row_keys(self, keys);
+    af::shared<std::size_t> group, offsets, indices;
+    {
+      dials::util::ScopedReleaseGIL release_gil;
+      KeyIndex index(row_keys, nthreads);
+      group = index.group();
+      offsets = index.offsets();
+      indices = index.indices();
+    }
+    return boost::python::make_tuple(group, offsets, indices);
+  }
+
+  /**
+   * Find the pairs of rows of two tables with equal values of the key columns
+   * @param self The table
+   * @param other The other table
+   * @param keys The key column names
+   * @param nthreads The number of threads
+   * @returns The rows of each pair in the table and the other table
+   */
+  template <typename T>
+  boost::python::tuple hash_join(const T &self,
+                                 const T &other,
+                                 boost::python::object keys,
+                                 std::size_t nthreads) {
+    RowKeys left_keys = make_row_keys(self, keys);
+    RowKeys right_keys = make_row_keys(other, keys);
+    af::shared<std::size_t> left, right;
+    {
+      dials::util::ScopedReleaseGIL release_gil;
+      HashJoin join(left_keys, right_keys, nthreads);
+      left = join.left();
+      right = join.right();
+    }
+    return boost::python::make_tuple(left, right);
+  }
+
   /**
    * A visitor to convert an item to an object
    */
@@ -848,16 +952,31 @@ namespace dials { namespace af { namespace boost_python {
 
   /**
    * Unpack the reflection table from msgpack format
-   * @param the msgpack string
+   * @param packed The msgpack data, as bytes or any object supporting the
+   *               buffer protocol, such as a memory mapped file
+   * @param columns The names of the columns to read, or None to read them all
    * @returns The reflection table
    */
-  reflection_table reflection_table_from_msgpack(boost::python::object packed) {
-    const char *data = PyBytes_AsString(packed.ptr());
-    std::size_t size = PyBytes_Size(packed.ptr());
+  reflection_table reflection_table_from_msgpack(boost::python::object packed,
+                                                 boost::python::object columns) {
+    std::set<std::string> column_set;
+    if (!columns.is_none()) {
+      for (std::size_t i = 0; i < boost::python::len(columns); ++i) {
+        column_set.insert(boost::python::extract<std::string>(columns[i])());
+      }
+    }
+
+    // The column data is unpacked by reference into the buffer, so only the
+    // columns that are converted are read from it
+    python_buffer_view buffer(packed);
     msgpack::unpacked result;
     std::size_t off = 0;
-    msgpack::unpack(result, data, size, off, reflection_table_reference_func);
-    reflection_table r = result.get().as<reflection_table>();
+    msgpack::unpack(
+      result, buffer.data(), buffer.size(), off, reflection_table_reference_func);
+    reflection_table r;
+    msgpack::adaptor::convert<reflection_table> reader(
+      columns.is_none() ? NULL : &column_set);
+    reader(result.get(), r);
     return r;
   }
 
@@ -1002,15 +1121,25 @@ namespace dials { namespace af { namespace boost_python {
         .def("compute_phi_range", &compute_phi_range<flex_table_type>)
         .def("as_msgpack", &reflection_table_as_msgpack)
         .def("as_msgpack_to_file", &reflection_table_as_msgpack_to_file)
-        .def("from_msgpack", &reflection_table_from_msgpack)
+        .def("from_msgpack",
+             &reflection_table_from_msgpack,
+             (arg("packed"), arg("columns") = boost::python::object()))
         .staticmethod("from_msgpack")
         .def("experiment_identifiers", &T::experiment_identifiers)
-        .def("select", &reflection_table_select_rows_index<flex_table_type>)
-        .def("select", &reflection_table_select_rows_flags<flex_table_type>)
+        .def("select",
+             &reflection_table_select_rows_index<flex_table_type>,
+             (arg("index"), arg("nthreads") = 1))
+        .def("select",
+             &reflection_table_select_rows_flags<flex_table_type>,
+             (arg("flags"), arg("nthreads") = 1))
         .def("select", &reflection_table_select_cols_keys<flex_table_type>)
         .def("select", &reflection_table_select_cols_tuple<flex_table_type>)
-        .def("extend", reflection_table_extend)
+        .def("extend", reflection_table_extend, (arg("other"), arg("nthreads") = 1))
         .def("update", reflection_table_update)
+        .def("group_by", &group_by<flex_table_type>, (arg("keys"), arg("nthreads") = 1))
+        .def("hash_join",
+             &hash_join<flex_table_type>,
+             (arg("other"), arg("keys"), arg("nthreads") = 1))
         .def_pickle(flex_reflection_table_pickle_suite());
 
       // Create the flags enum in the reflection table scope
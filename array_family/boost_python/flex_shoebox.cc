@@ -11,6 +11,8 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <cmath>
+#include <boost/bind.hpp>
+#include <boost/mem_fn.hpp>
 #include <scitbx/array_family/boost_python/flex_wrapper.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <scitbx/array_family/boost_python/ref_pickle_double_buffered.h>
@@ -20,7 +22,10 @@
 #include <dials/model/data/pixel_list.h>
 #include <dials/model/data/observation.h>
 #include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/algorithms/spot_prediction/pixel_to_miller_index.h>
+#include <dials/util/gil.h>
+#include <dials/util/boost_python/release_gil.h>
 #include <dials/config.h>
 
 namespace dials { namespace af { namespace boost_python {
@@ -38,8 +43,10 @@ namespace dials { namespace af { namespace boost_python {
   using dials::model::BackgroundUsed;
   using dials::model::Centroid;
   using dials::model::Foreground;
+  using dials::model::IncrementalPixelListLabeller;
   using dials::model::Intensity;
   using dials::model::Observation;
+  using dials::model::PixelList;
   using dials::model::PixelListLabeller;
   using dials::model::Shoebox;
   using dials::model::Valid;
@@ -50,6 +57,80 @@ namespace dials { namespace af { namespace boost_python {
   using dxtbx::model::Scan;
   using scitbx::vec3;
 
+  namespace detail {
+
+    /**
+     * Set the results of a function for the shoeboxes [first, last)
+     */
+    template <typename Result, typename FloatType, typename Function>
+    void map_shoeboxes_band(const_ref<Shoebox<FloatType> > a,
+                            ref<Result> result,
+                            const Function &function,
+                            std::size_t first,
+                            std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        result[i] = function(a[i]);
+      }
+    }
+
+    /**
+     * Apply a function to each shoebox in bands over a number of threads. The
+     * shoeboxes are only read, so they can be shared between the threads. The
+     * GIL is released while the function runs.
+     */
+    template <typename Result, typename FloatType, typename Function>
+    af::shared<Result> map_shoeboxes(const const_ref<Shoebox<FloatType> > &a,
+                                     Function function,
+                                     std::size_t nthreads) {
+      af::shared<Result> result(a.size(), Result());
+      dials::util::ScopedReleaseGIL release_gil;
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&map_shoeboxes_band<Result, FloatType, Function>,
+                    a,
+                    result.ref(),
+                    boost::cref(function),
+                    _1,
+                    _2),
+        a.size(),
+        nthreads);
+      return result;
+    }
+
+    /**
+     * Apply a function to the shoeboxes [first, last)
+     */
+    template <typename FloatType, typename Function>
+    void for_each_shoebox_band(ref<Shoebox<FloatType> > a,
+                               const Function &function,
+                               std::size_t first,
+                               std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        function(a[i]);
+      }
+    }
+
+    /**
+     * Apply a function that modifies each shoebox in bands over a number of
+     * threads, with the GIL released. Each shoebox is only modified by the
+     * thread that owns its band.
+     */
+    template <typename FloatType, typename Function>
+    void for_each_shoebox(ref<Shoebox<FloatType> > a,
+                          Function function,
+                          std::size_t nthreads) {
+      dials::util::ScopedReleaseGIL release_gil;
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&for_each_shoebox_band<FloatType, Function>,
+                    a,
+                    boost::cref(function),
+                    _1,
+                    _2),
+        a.size(),
+        nthreads);
+    }
+
+  }  // namespace detail
+
   /**
    * Construct from an array of panels and bounding boxes.
    */
@@ -212,6 +293,176 @@ namespace dials { namespace af { namespace boost_python {
     af::shared<std::size_t> hot_pixels_;
   };
 
+  /**
+   * Construct shoeboxes from the spots as they are finished by an incremental
+   * pixel list labeller. The spots are the same as those from
+   * PixelListShoeboxCreator but are available as soon as the frame after the
+   * spot is added; the index of the first pixel of each spot is given so the
+   * spots can be put in the same order.
+   */
+  template <typename FloatType>
+  class IncrementalPixelListShoeboxCreator {
+  public:
+    IncrementalPixelListShoeboxCreator(std::size_t panel,
+                                       std::size_t zstart,
+                                       bool twod,
+                                       std::size_t min_pixels,
+                                       std::size_t max_pixels,
+                                       bool find_hot_pixels)
+        : labeller_(twod),
+          panel_(panel),
+          zstart_(zstart),
+          min_pixels_(min_pixels),
+          max_pixels_(max_pixels),
+          find_hot_pixels_(find_hot_pixels) {
+      DIALS_ASSERT(min_pixels > 0);
+      DIALS_ASSERT(max_pixels > min_pixels);
+    }
+
+    /**
+     * Add the pixels from the next frame
+     * @param pixel_list The pixel list
+     */
+    void add(const PixelList &pixel_list) {
+      labeller_.add(pixel_list);
+
+      // Track the pixels which are strong on every frame
+      if (find_hot_pixels_) {
+        int first_frame = labeller_.first_frame();
+        int frame = pixel_list.frame();
+        if (frame == first_frame) {
+          int2 size = labeller_.size();
+          hot_mask_ = af::versa<int, af::c_grid<2> >(af::c_grid<2>(size[0], size[1]),
+                                                     first_frame - 1);
+        }
+        af::shared<std::size_t> index = pixel_list.index();
+        for (std::size_t i = 0; i < index.size(); ++i) {
+          int &h = hot_mask_[index[i]];
+          h = (frame == first_frame || h == frame - 1) ? frame : first_frame - 1;
+        }
+      }
+      create_shoeboxes();
+    }
+
+    /**
+     * Finish the spots at the end of the sweep
+     */
+    void finish() {
+      labeller_.finish();
+      create_shoeboxes();
+      if (find_hot_pixels_ && hot_mask_.size() > 0) {
+        int last_frame = labeller_.last_frame();
+        for (std::size_t i = 0; i < hot_mask_.size(); ++i) {
+          if (hot_mask_[i] == last_frame - 1) {
+            hot_pixels_.push_back(i);
+          }
+        }
+      }
+    }
+
+    /**
+     * Discard the shoeboxes which have been created
+     */
+    void clear() {
+      result_ = af::shared<Shoebox<FloatType> >();
+      spot_size_ = af::shared<std::size_t>();
+      spot_order_ = af::shared<std::size_t>();
+    }
+
+    /** @returns The number of spots still being labelled */
+    std::size_t num_active() const {
+      return labeller_.num_active();
+    }
+
+    af::shared<Shoebox<FloatType> > result() const {
+      DIALS_ASSERT(result_.size() == spot_size_.size());
+      return result_;
+    }
+
+    af::shared<std::size_t> spot_size() const {
+      DIALS_ASSERT(result_.size() == spot_size_.size());
+      return spot_size_;
+    }
+
+    af::shared<std::size_t> spot_order() const {
+      DIALS_ASSERT(result_.size() == spot_order_.size());
+      return spot_order_;
+    }
+
+    af::shared<std::size_t> hot_pixels() const {
+      return hot_pixels_;
+    }
+
+  private:
+    typedef IncrementalPixelListLabeller::Component Component;
+
+    /**
+     * Create the shoeboxes for the spots which have been finished
+     */
+    void create_shoeboxes() {
+      const std::vector<Component> &finished = labeller_.finished();
+      for (std::size_t i = 0; i < finished.size(); ++i) {
+        const Component &spot = finished[i];
+        af::const_ref<vec3<int> > coords = spot.coords.const_ref();
+        af::const_ref<double> values = spot.values.const_ref();
+        DIALS_ASSERT(coords.size() > 0);
+        DIALS_ASSERT(coords.size() == values.size());
+
+        // Compute the bounding box
+        Shoebox<FloatType> shoebox;
+        shoebox.panel = panel_;
+        shoebox.bbox = int6(coords[0][2],
+                            coords[0][2] + 1,
+                            coords[0][1],
+                            coords[0][1] + 1,
+                            coords[0][0],
+                            coords[0][0] + 1);
+        for (std::size_t j = 1; j < coords.size(); ++j) {
+          const vec3<int> &c = coords[j];
+          if (c[2] < shoebox.bbox[0]) shoebox.bbox[0] = c[2];
+          if (c[2] >= shoebox.bbox[1]) shoebox.bbox[1] = c[2] + 1;
+          if (c[1] < shoebox.bbox[2]) shoebox.bbox[2] = c[1];
+          if (c[1] >= shoebox.bbox[3]) shoebox.bbox[3] = c[1] + 1;
+          if (c[0] < shoebox.bbox[4]) shoebox.bbox[4] = c[0];
+          if (c[0] >= shoebox.bbox[5]) shoebox.bbox[5] = c[0] + 1;
+        }
+
+        // Set the mask and data points if the spot is not too big or small
+        if (min_pixels_ <= coords.size() && coords.size() <= max_pixels_) {
+          shoebox.allocate();
+          for (std::size_t j = 0; j < coords.size(); ++j) {
+            const vec3<int> &c = coords[j];
+            int ii = c[2] - shoebox.bbox[0];
+            int jj = c[1] - shoebox.bbox[2];
+            int kk = c[0] - shoebox.bbox[4];
+            shoebox.data(kk, jj, ii) = values[j];
+            shoebox.mask(kk, jj, ii) = Valid | Foreground;
+          }
+        }
+
+        // Shift bbox z start position
+        shoebox.bbox[4] += zstart_;
+        shoebox.bbox[5] += zstart_;
+        result_.push_back(shoebox);
+        spot_size_.push_back(coords.size());
+        spot_order_.push_back(spot.first);
+      }
+      labeller_.clear_finished();
+    }
+
+    IncrementalPixelListLabeller labeller_;
+    std::size_t panel_;
+    std::size_t zstart_;
+    std::size_t min_pixels_;
+    std::size_t max_pixels_;
+    bool find_hot_pixels_;
+    af::versa<int, af::c_grid<2> > hot_mask_;
+    af::shared<Shoebox<FloatType> > result_;
+    af::shared<std::size_t> spot_size_;
+    af::shared<std::size_t> spot_order_;
+    af::shared<std::size_t> hot_pixels_;
+  };
+
   /**
    * Construct an array of shoebxoes from a spot labelling class
    */
@@ -380,8 +631,16 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   void deallocate(af::ref<Shoebox<FloatType> > a) {
+    // Share one set of empty arrays between the shoeboxes, rather than
+    // allocating three new ones for each
+    af::c_grid<3> accessor(0, 0, 0);
+    af::versa<FloatType, af::c_grid<3> > data(accessor);
+    af::versa<int, af::c_grid<3> > mask(accessor);
+    af::versa<FloatType, af::c_grid<3> > background(accessor);
     for (std::size_t i = 0; i < a.size(); ++i) {
-      a[i].deallocate();
+      a[i].data = data;
+      a[i].mask = mask;
+      a[i].background = background;
     }
   }
 
@@ -415,12 +674,15 @@ namespace dials { namespace af { namespace boost_python {
   template <typename FloatType>
   shared<bool> is_bbox_within_image_volume(const const_ref<Shoebox<FloatType> > &a,
                                            int2 image_size,
-                                           int2 scan_range) {
-    shared<bool> result(a.size(), af::init_functor_null<bool>());
-    for (std::size_t i = 0; i < a.size(); ++i) {
-      result[i] = a[i].is_bbox_within_image_volume(image_size, scan_range);
-    }
-    return result;
+                                           int2 scan_range,
+                                           std::size_t nthreads) {
+    return detail::map_shoeboxes<bool>(
+      a,
+      boost::bind(&Shoebox<FloatType>::is_bbox_within_image_volume,
+                  _1,
+                  image_size,
+                  scan_range),
+      nthreads);
   }
 
   /**
@@ -428,24 +690,23 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   shared<bool> does_bbox_contain_bad_pixels(const const_ref<Shoebox<FloatType> > &a,
-                                            const const_ref<bool, c_grid<2> > &mask) {
-    shared<bool> result(a.size(), af::init_functor_null<bool>());
-    for (std::size_t i = 0; i < a.size(); ++i) {
-      result[i] = a[i].does_bbox_contain_bad_pixels(mask);
-    }
-    return result;
+                                            const const_ref<bool, c_grid<2> > &mask,
+                                            std::size_t nthreads) {
+    return detail::map_shoeboxes<bool>(
+      a,
+      boost::bind(&Shoebox<FloatType>::does_bbox_contain_bad_pixels, _1, mask),
+      nthreads);
   }
 
   /**
    * Count the number of mask pixels with the given code
    */
   template <typename FloatType>
-  shared<int> count_mask_values(const const_ref<Shoebox<FloatType> > &a, int code) {
-    shared<int> result(a.size(), af::init_functor_null<int>());
-    for (std::size_t i = 0; i < a.size(); ++i) {
-      result[i] = a[i].count_mask_values(code);
-    }
-    return result;
+  shared<int> count_mask_values(const const_ref<Shoebox<FloatType> > &a,
+                                int code,
+                                std::size_t nthreads) {
+    return detail::map_shoeboxes<int>(
+      a, boost::bind(&Shoebox<FloatType>::count_mask_values, _1, code), nthreads);
   }
 
   /**
@@ -493,12 +754,10 @@ namespace dials { namespace af { namespace boost_python {
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_all(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_all();
-    }
-    return result;
+  af::shared<Centroid> centroid_all(const const_ref<Shoebox<FloatType> > &a,
+                                    std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::mem_fn(&Shoebox<FloatType>::centroid_all), nthreads);
   }
 
   /**
@@ -506,48 +765,40 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_masked(const const_ref<Shoebox<FloatType> > &a,
-                                       int code) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_masked(code);
-    }
-    return result;
+                                       int code,
+                                       std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::bind(&Shoebox<FloatType>::centroid_masked, _1, code), nthreads);
   }
 
   /**
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_valid(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_valid();
-    }
-    return result;
+  af::shared<Centroid> centroid_valid(const const_ref<Shoebox<FloatType> > &a,
+                                      std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::mem_fn(&Shoebox<FloatType>::centroid_valid), nthreads);
   }
 
   /**
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_foreground(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_foreground();
-    }
-    return result;
+  af::shared<Centroid> centroid_foreground(const const_ref<Shoebox<FloatType> > &a,
+                                           std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::mem_fn(&Shoebox<FloatType>::centroid_foreground), nthreads);
   }
 
   /**
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_strong(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_strong();
-    }
-    return result;
+  af::shared<Centroid> centroid_strong(const const_ref<Shoebox<FloatType> > &a,
+                                       std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::mem_fn(&Shoebox<FloatType>::centroid_strong), nthreads);
   }
 
   /**
@@ -555,12 +806,10 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_all_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_all_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::mem_fn(&Shoebox<FloatType>::centroid_all_minus_background), nthreads);
   }
 
   /**
@@ -569,12 +818,12 @@ namespace dials { namespace af { namespace boost_python {
   template <typename FloatType>
   af::shared<Centroid> centroid_masked_minus_background(
     const const_ref<Shoebox<FloatType> > &a,
-    int code) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_masked_minus_background(code);
-    }
-    return result;
+    int code,
+    std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a,
+      boost::bind(&Shoebox<FloatType>::centroid_masked_minus_background, _1, code),
+      nthreads);
   }
 
   /**
@@ -582,12 +831,10 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_valid_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_valid_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a, boost::mem_fn(&Shoebox<FloatType>::centroid_valid_minus_background), nthreads);
   }
 
   /**
@@ -595,12 +842,12 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_foreground_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_foreground_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a,
+      boost::mem_fn(&Shoebox<FloatType>::centroid_foreground_minus_background),
+      nthreads);
   }
 
   /**
@@ -608,36 +855,32 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_strong_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_strong_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return detail::map_shoeboxes<Centroid>(
+      a,
+      boost::mem_fn(&Shoebox<FloatType>::centroid_strong_minus_background),
+      nthreads);
   }
 
   /**
    * Get a list of intensities
    */
   template <typename FloatType>
-  af::shared<Intensity> summed_intensity(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Intensity> result(a.size(), Intensity());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].summed_intensity();
-    }
-    return result;
+  af::shared<Intensity> summed_intensity(const const_ref<Shoebox<FloatType> > &a,
+                                         std::size_t nthreads) {
+    return detail::map_shoeboxes<Intensity>(
+      a, boost::mem_fn(&Shoebox<FloatType>::summed_intensity), nthreads);
   }
 
   /**
    * Get a list of intensities
    */
   template <typename FloatType>
-  af::shared<Intensity> bayesian_intensity(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Intensity> result(a.size(), Intensity());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].bayesian_intensity();
-    }
-    return result;
+  af::shared<Intensity> bayesian_intensity(const const_ref<Shoebox<FloatType> > &a,
+                                           std::size_t nthreads) {
+    return detail::map_shoeboxes<Intensity>(
+      a, boost::mem_fn(&Shoebox<FloatType>::bayesian_intensity), nthreads);
   }
 
   /**
@@ -647,8 +890,8 @@ namespace dials { namespace af { namespace boost_python {
   af::shared<double> mean_background(const const_ref<Shoebox<FloatType> > &a) {
     af::shared<double> result(a.size());
     for (std::size_t i = 0; i < result.size(); ++i) {
-      af::versa<FloatType, af::c_grid<3> > data = a[i].data;
-      af::versa<int, af::c_grid<3> > mask = a[i].mask;
+      af::const_ref<FloatType, af::c_grid<3> > data = a[i].data.const_ref();
+      af::const_ref<int, af::c_grid<3> > mask = a[i].mask.const_ref();
       double mean = 0.0;
       std::size_t count = 0;
       for (std::size_t j = 0; j < data.size(); ++j) {
@@ -674,8 +917,8 @@ namespace dials { namespace af { namespace boost_python {
   af::shared<double> mean_modelled_background(const const_ref<Shoebox<FloatType> > &a) {
     af::shared<double> result(a.size());
     for (std::size_t i = 0; i < result.size(); ++i) {
-      af::versa<FloatType, af::c_grid<3> > data = a[i].background;
-      af::versa<int, af::c_grid<3> > mask = a[i].mask;
+      af::const_ref<FloatType, af::c_grid<3> > data = a[i].background.const_ref();
+      af::const_ref<int, af::c_grid<3> > mask = a[i].mask.const_ref();
       double mean = 0.0;
       std::size_t count = 0;
       for (std::size_t j = 0; j < data.size(); ++j) {
@@ -698,10 +941,9 @@ namespace dials { namespace af { namespace boost_python {
    * Flatten the shoeboxes
    */
   template <typename FloatType>
-  void flatten(ref<Shoebox<FloatType> > self) {
-    for (std::size_t i = 0; i < self.size(); ++i) {
-      self[i].flatten();
-    }
+  void flatten(ref<Shoebox<FloatType> > self, std::size_t nthreads) {
+    detail::for_each_shoebox(
+      self, boost::mem_fn(&Shoebox<FloatType>::flatten), nthreads);
   }
 
   /**
@@ -1020,36 +1262,65 @@ namespace dials { namespace af { namespace boost_python {
         .def("is_allocated", &is_allocated<FloatType>)
         .def("panels", &panels<FloatType>)
         .def("bounding_boxes", &bounding_boxes<FloatType>)
-        .def("count_mask_values", &count_mask_values<FloatType>)
+        .def("count_mask_values",
+             &count_mask_values<FloatType>,
+             (boost::python::arg("code"), boost::python::arg("nthreads") = 1))
         .def("is_bbox_within_image_volume",
              &is_bbox_within_image_volume<FloatType>,
-             (boost::python::arg("image_size"), boost::python::arg("scan_range")))
+             (boost::python::arg("image_size"),
+              boost::python::arg("scan_range"),
+              boost::python::arg("nthreads") = 1))
         .def("does_bbox_contain_bad_pixels",
              &does_bbox_contain_bad_pixels<FloatType>,
-             (boost::python::arg("mask")))
+             (boost::python::arg("mask"), boost::python::arg("nthreads") = 1))
         .def("peak_coordinates", &peak_coordinates<FloatType>)
-        .def("centroid_all", &centroid_all<FloatType>)
-        .def("centroid_masked", &centroid_masked<FloatType>)
-        .def("centroid_valid", &centroid_valid<FloatType>)
-        .def("centroid_foreground", &centroid_foreground<FloatType>)
-        .def("centroid_strong", &centroid_strong<FloatType>)
-        .def("centroid_all_minus_background", &centroid_all_minus_background<FloatType>)
+        .def("centroid_all",
+             &centroid_all<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_masked",
+             &centroid_masked<FloatType>,
+             (boost::python::arg("code"), boost::python::arg("nthreads") = 1))
+        .def("centroid_valid",
+             &centroid_valid<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_foreground",
+             &centroid_foreground<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_strong",
+             &centroid_strong<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_all_minus_background",
+             &centroid_all_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_masked_minus_background",
-             &centroid_masked_minus_background<FloatType>)
+             &centroid_masked_minus_background<FloatType>,
+             (boost::python::arg("code"), boost::python::arg("nthreads") = 1))
         .def("centroid_valid_minus_background",
-             &centroid_valid_minus_background<FloatType>)
+             &centroid_valid_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_foreground_minus_background",
-             &centroid_foreground_minus_background<FloatType>)
+             &centroid_foreground_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_strong_minus_background",
-             &centroid_strong_minus_background<FloatType>)
-        .def("bayesian_intensity", &bayesian_intensity<FloatType>)
-        .def("summed_intensity", &summed_intensity<FloatType>)
-        .def("mean_background", &mean_background<FloatType>)
-        .def("mean_modelled_background", &mean_modelled_background<FloatType>)
-        .def("flatten", &flatten<FloatType>)
-        .def("apply_background_mask", &apply_background_mask<FloatType>)
+             &centroid_strong_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("bayesian_intensity",
+             &bayesian_intensity<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("summed_intensity",
+             &summed_intensity<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("mean_background", DIALS_RELEASE_GIL_TPL(&mean_background<FloatType>))
+        .def("mean_modelled_background",
+             DIALS_RELEASE_GIL_TPL(&mean_modelled_background<FloatType>))
+        .def("flatten",
+             &flatten<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("apply_background_mask",
+             DIALS_RELEASE_GIL_TPL(&apply_background_mask<FloatType>))
         .def("apply_pixel_data", &apply_pixel_data<FloatType>)
-        .def("mask_neighbouring", &mask_neighbouring<FloatType>)
+        .def("mask_neighbouring",
+             DIALS_RELEASE_GIL_TPL(&mask_neighbouring<FloatType>))
         .def_pickle(flex_pickle_double_buffered<shoebox_type,
                                                 shoebox_to_string<FloatType>,
                                                 shoebox_from_string<FloatType> >());
@@ -1076,6 +1347,24 @@ namespace dials { namespace af { namespace boost_python {
       .def("result", &PixelListShoeboxCreator<ProfileFloatType>::result)
       .def("spot_size", &PixelListShoeboxCreator<ProfileFloatType>::spot_size)
       .def("hot_pixels", &PixelListShoeboxCreator<ProfileFloatType>::hot_pixels);
+
+    typedef IncrementalPixelListShoeboxCreator<ProfileFloatType> incremental_creator_type;
+    class_<incremental_creator_type>("IncrementalPixelListShoeboxCreator", no_init)
+      .def(init<std::size_t, std::size_t, bool, std::size_t, std::size_t, bool>(
+        (boost::python::arg("panel") = 0,
+         boost::python::arg("zstart") = 0,
+         boost::python::arg("twod") = false,
+         boost::python::arg("min_pixels") = 1,
+         boost::python::arg("max_pixels") = 20,
+         boost::python::arg("find_hot_pixels") = false)))
+      .def("add", &incremental_creator_type::add)
+      .def("finish", &incremental_creator_type::finish)
+      .def("clear", &incremental_creator_type::clear)
+      .def("num_active", &incremental_creator_type::num_active)
+      .def("result", &incremental_creator_type::result)
+      .def("spot_size", &incremental_creator_type::spot_size)
+      .def("spot_order", &incremental_creator_type::spot_order)
+      .def("hot_pixels", &incremental_creator_type::hot_pixels);
   }
 
 }}}  // namespace dials::af::boost_python
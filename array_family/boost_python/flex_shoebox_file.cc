@@ -0,0 +1,49 @@
+/*
+ * flex_shoebox_file.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/model/serialize/shoebox.h>
+
+namespace dials { namespace af { namespace boost_python {
+
+  using namespace boost::python;
+  using model::ShoeboxReader;
+  using model::ShoeboxWriter;
+
+  void export_flex_shoebox_file() {
+    class_<ShoeboxWriter, boost::noncopyable>("ShoeboxWriter", no_init)
+      .def(init<const std::string &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<int6> &,
+                const af::const_ref<int> &,
+                std::size_t,
+                std::size_t>((boost::python::arg("filename"),
+                              boost::python::arg("panel"),
+                              boost::python::arg("bbox"),
+                              boost::python::arg("blocks"),
+                              boost::python::arg("npanels"),
+                              boost::python::arg("nthreads") = 1)))
+      .def("add_image", &ShoeboxWriter::add_image<int>)
+      .def("add_image", &ShoeboxWriter::add_image<float>)
+      .def("add_image", &ShoeboxWriter::add_image<double>)
+      .def("filename", &ShoeboxWriter::filename)
+      .def("frame", &ShoeboxWriter::frame)
+      .def("num_written", &ShoeboxWriter::num_written)
+      .def("finished", &ShoeboxWriter::finished);
+
+    class_<ShoeboxReader>("ShoeboxReader", no_init)
+      .def(init<const std::string &>((boost::python::arg("filename"))))
+      .def("filename", &ShoeboxReader::filename)
+      .def("blocks", &ShoeboxReader::blocks)
+      .def("block", &ShoeboxReader::block)
+      .def("num_shoeboxes", &ShoeboxReader::num_shoeboxes)
+      .def("indices", &ShoeboxReader::indices)
+      .def("__len__", &ShoeboxReader::size)
+      .def("__getitem__", &ShoeboxReader::operator[]);
+  }
+
+}}}  // namespace dials::af::boost_python
@@ -12,6 +12,7 @@
 #ifndef DIALS_FRAMEWORK_TABLE_BOOST_PYTHON_FLEX_TABLE_SUITE_H
 #define DIALS_FRAMEWORK_TABLE_BOOST_PYTHON_FLEX_TABLE_SUITE_H
 
+#include <algorithm>
 #include <string>
 #include <iterator>
 #include <iostream>
@@ -27,7 +28,9 @@
 #include <scitbx/boost_python/slice.h>
 #include <scitbx/boost_python/utils.h>
 #include <dials/array_family/flex_table.h>
+#include <dials/array_family/radix_sort_index.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 #include <dxtbx/model/experiment.h>
 #include <dxtbx/model/experiment_list.h>
@@ -140,7 +143,8 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     template <typename U>
     void operator()(const U &other_column) {
       U self_column = self[key];
-      for (std::size_t i = 0, j = slice.start; i < self.nrows(); ++i, j += slice.step) {
+      std::size_t n = self_column.size();
+      for (std::size_t i = 0, j = slice.start; i < n; ++i, j += slice.step) {
         DIALS_ASSERT(i < self_column.size());
         DIALS_ASSERT(j < other_column.size());
         self_column[i] = other_column[j];
@@ -324,7 +328,9 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
   };
 
   /**
-   * A visitor to remove elements by flag
+   * A visitor to remove elements by flag. The kept elements are moved down in
+   * place a run at a time, so the column buffer is reused and the rows before
+   * the first removed row are not touched.
    */
   struct remove_if_flag_visitor : public boost::static_visitor<void> {
     af::const_ref<bool> flags;
@@ -333,14 +339,190 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
 
     template <typename T>
     void operator()(T &col) {
-      for (std::size_t i = 0, j = 0; i < col.size(); ++i) {
-        if (!flags[i]) {
-          col[j++] = col[i];
+      std::size_t n = col.size();
+      DIALS_ASSERT(flags.size() == n);
+      std::size_t j = std::find(flags.begin(), flags.end(), true) - flags.begin();
+      for (std::size_t i = j; i < n;) {
+        while (i < n && flags[i]) {
+          ++i;
         }
+        std::size_t first = i;
+        while (i < n && !flags[i]) {
+          ++i;
+        }
+        std::copy(col.begin() + first, col.begin() + i, col.begin() + j);
+        j += i - first;
       }
     }
   };
 
+  /**
+   * A visitor to add a column of the same type to another table
+   */
+  template <typename T>
+  struct add_column_visitor : public boost::static_visitor<void> {
+    T &result;
+    typename T::key_type key;
+
+    add_column_visitor(T &result_, typename T::key_type key_)
+        : result(result_), key(key_) {}
+
+    template <typename U>
+    void operator()(const U &) {
+      U result_column = result[key];
+    }
+  };
+
+  /**
+   * A visitor to sort an index array by a numeric or Miller index column. The
+   * index array is sorted with a parallel radix sort, which is stable, so the
+   * result is the same for any number of threads.
+   */
+  struct parallel_sort_visitor : public boost::static_visitor<void> {
+    af::ref<std::size_t> index;
+    bool reverse;
+    std::size_t nthreads;
+
+    parallel_sort_visitor(af::ref<std::size_t> index_,
+                          bool reverse_,
+                          std::size_t nthreads_)
+        : index(index_), reverse(reverse_), nthreads(nthreads_) {}
+
+    void operator()(const af::shared<int> &col) {
+      sort_by(col.const_ref());
+    }
+
+    void operator()(const af::shared<std::size_t> &col) {
+      sort_by(col.const_ref());
+    }
+
+    void operator()(const af::shared<double> &col) {
+      sort_by(col.const_ref());
+    }
+
+    void operator()(const af::shared<cctbx::miller::index<> > &col) {
+      sort_by(col.const_ref());
+    }
+
+    template <typename T>
+    void operator()(const T &) {
+      throw DIALS_ERROR("Column type can not be sorted in parallel");
+    }
+
+    template <typename T>
+    void sort_by(af::const_ref<T> col) {
+      DIALS_ASSERT(col.size() == index.size());
+      af::shared<std::size_t> result = radix_sort_index(col, reverse, nthreads);
+      std::copy(result.begin(), result.end(), index.begin());
+    }
+  };
+
+  /**
+   * Apply copies of a visitor to each of a band of columns, with the key of
+   * each copy set to that of its column
+   */
+  template <typename Visitor, typename Iterator>
+  void visit_keyed_columns_band(const Visitor &visitor,
+                                const std::vector<Iterator> &columns,
+                                std::size_t first,
+                                std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      Visitor column_visitor(visitor);
+      column_visitor.key = columns[i]->first;
+      columns[i]->second.apply_visitor(column_visitor);
+    }
+  }
+
+  /**
+   * Apply copies of a visitor to each of a band of columns
+   */
+  template <typename Visitor, typename Iterator>
+  void visit_columns_band(const Visitor &visitor,
+                          const std::vector<Iterator> &columns,
+                          std::size_t first,
+                          std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      Visitor column_visitor(visitor);
+      columns[i]->second.apply_visitor(column_visitor);
+    }
+  }
+
+  /**
+   * @returns Iterators to all the columns of a table
+   */
+  template <typename Iterator>
+  std::vector<Iterator> column_iterators(Iterator first, Iterator last) {
+    std::vector<Iterator> columns;
+    for (; first != last; ++first) {
+      columns.push_back(first);
+    }
+    return columns;
+  }
+
+  /**
+   * Apply a visitor with a key to every column of a table, sharing the columns
+   * between threads. Each column is visited by a single thread. The column
+   * map must not change while the threads run, so any columns the visitor
+   * writes to in another table must already exist there.
+   * @param first The first column
+   * @param last The end of the columns
+   * @param visitor The visitor
+   * @param nthreads The number of threads
+   */
+  template <typename Iterator, typename Visitor>
+  void visit_keyed_columns(Iterator first,
+                           Iterator last,
+                           const Visitor &visitor,
+                           std::size_t nthreads) {
+    std::vector<Iterator> columns = column_iterators(first, last);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&visit_keyed_columns_band<Visitor, Iterator>,
+                  boost::cref(visitor),
+                  boost::cref(columns),
+                  _1,
+                  _2),
+      columns.size(),
+      nthreads);
+  }
+
+  /**
+   * Apply a visitor to every column of a table, sharing the columns between
+   * threads. Each column is visited by a single thread.
+   * @param first The first column
+   * @param last The end of the columns
+   * @param visitor The visitor
+   * @param nthreads The number of threads
+   */
+  template <typename Iterator, typename Visitor>
+  void visit_columns(Iterator first,
+                     Iterator last,
+                     const Visitor &visitor,
+                     std::size_t nthreads) {
+    std::vector<Iterator> columns = column_iterators(first, last);
+    dials::algorithms::detail::parallel_bands(
+      boost::bind(&visit_columns_band<Visitor, Iterator>,
+                  boost::cref(visitor),
+                  boost::cref(columns),
+                  _1,
+                  _2),
+      columns.size(),
+      nthreads);
+  }
+
+  /**
+   * Add a column to a table for every column in another table, with the same
+   * key and type, if it is not already present.
+   * @param result The table to add the columns to
+   * @param other The table with the columns
+   */
+  template <typename T>
+  void add_columns(T &result, const T &other) {
+    for (typename T::const_iterator it = other.begin(); it != other.end(); ++it) {
+      add_column_visitor<T> visitor(result, it->first);
+      it->second.apply_visitor(visitor);
+    }
+  }
+
   /**
    * Initialise the column table from a list of (key, column) pairs
    * @param columns The list of columns
@@ -476,14 +658,13 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    * @param flags The list of flags
    */
   template <typename T>
-  void remove_if_flag(T &self, const af::const_ref<bool> &flags) {
+  void remove_if_flag(T &self,
+                      const af::const_ref<bool> &flags,
+                      std::size_t nthreads = 1) {
     DIALS_ASSERT(flags.size() == self.nrows());
     std::size_t n = std::count(flags.begin(), flags.end(), false);
-    typedef typename T::iterator iterator;
     remove_if_flag_visitor visitor(flags);
-    for (iterator it = self.begin(); it != self.end(); ++it) {
-      it->second.apply_visitor(visitor);
-    }
+    visit_columns(self.begin(), self.end(), visitor, nthreads);
     self.resize(n);
   }
 
@@ -583,17 +764,16 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    * all the columns from the other table onto the end of the current table.
    * @param self The current table
    * @param other The other table
+   * @param nthreads The number of threads to share the columns between
    */
   template <typename T>
-  void extend(T &self, const T &other) {
-    typedef typename T::const_iterator iterator;
+  void extend(T &self, const T &other, std::size_t nthreads = 1) {
     typename T::size_type ns = self.nrows();
     typename T::size_type no = other.nrows();
     self.resize(ns + no);
-    for (iterator it = other.begin(); it != other.end(); ++it) {
-      extend_column_visitor<T> visitor(self, it->first, ns, no);
-      it->second.apply_visitor(visitor);
-    }
+    add_columns(self, other);
+    extend_column_visitor<T> visitor(self, "", ns, no);
+    visit_keyed_columns(other.begin(), other.end(), visitor, nthreads);
     // now extend identifiers
     reflection_table_extend_identifiers(self, other);
   }
@@ -622,10 +802,13 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    * Select a number of rows from the table via an index array
    * @param self The current table
    * @param index The index array
+   * @param nthreads The number of threads to share the columns between
    * @returns The new table with the requested rows
    */
   template <typename T>
-  T select_rows_index(const T &self, const af::const_ref<std::size_t> &index) {
+  T select_rows_index(const T &self,
+                      const af::const_ref<std::size_t> &index,
+                      std::size_t nthreads = 1) {
     // Check that indices are valid
     std::size_t nrows = self.nrows();
     for (std::size_t i = 0; i < index.size(); ++i) {
@@ -634,10 +817,9 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
 
     // Get the indices from the table
     T result(index.size());
-    for (typename T::const_iterator it = self.begin(); it != self.end(); ++it) {
-      copy_from_indices_visitor<T> visitor(result, it->first, index);
-      it->second.apply_visitor(visitor);
-    }
+    add_columns(result, self);
+    copy_from_indices_visitor<T> visitor(result, "", index);
+    visit_keyed_columns(self.begin(), self.end(), visitor, nthreads);
 
     // Get the id column (if it exists) and make a set of unique values
     if (self.contains("id")) {
@@ -664,16 +846,19 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    * Select a number of rows from the table via an index array
    * @param self The current table
    * @param flags The flag array
+   * @param nthreads The number of threads to share the columns between
    * @returns The new table with the requested rows
    */
   template <typename T>
-  T select_rows_flags(const T &self, const af::const_ref<bool> &flags) {
+  T select_rows_flags(const T &self,
+                      const af::const_ref<bool> &flags,
+                      std::size_t nthreads = 1) {
     DIALS_ASSERT(self.nrows() == flags.size());
     af::shared<std::size_t> index;
     for (std::size_t i = 0; i < flags.size(); ++i) {
       if (flags[i]) index.push_back(i);
     }
-    return select_rows_index(self, index.const_ref());
+    return select_rows_index(self, index.const_ref(), nthreads);
   }
 
   /**
@@ -872,25 +1057,31 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    * Delete selected items by flags
    * @param self The table
    * @param flags The array of boolean flags
+   * @param nthreads The number of threads to share the columns between
    */
   template <typename T>
-  void del_selected_rows_flags(T &self, const af::const_ref<bool> &flags) {
-    remove_if_flag(self, flags);
+  void del_selected_rows_flags(T &self,
+                               const af::const_ref<bool> &flags,
+                               std::size_t nthreads = 1) {
+    remove_if_flag(self, flags, nthreads);
   }
 
   /**
    * Delete the selected rows from the table
    * @param self The table
    * @param index The index array
+   * @param nthreads The number of threads to share the columns between
    */
   template <typename T>
-  void del_selected_rows_index(T &self, const af::const_ref<std::size_t> &index) {
+  void del_selected_rows_index(T &self,
+                               const af::const_ref<std::size_t> &index,
+                               std::size_t nthreads = 1) {
     af::shared<bool> flags(self.nrows(), false);
     for (std::size_t i = 0; i < index.size(); ++i) {
       DIALS_ASSERT(index[i] < flags.size());
       flags[index[i]] = true;
     }
-    del_selected_rows_flags(self, flags.const_ref());
+    del_selected_rows_flags(self, flags.const_ref(), nthreads);
   }
 
   /**
@@ -948,15 +1139,15 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    * Reorder all the columns according to the input indices
    * @param self The table object
    * @param indices The array of indices
+   * @param nthreads The number of threads to share the columns between
    */
   template <typename T>
-  void reorder(T &self, const af::const_ref<std::size_t> &index) {
-    typedef typename T::iterator iterator;
+  void reorder(T &self,
+               const af::const_ref<std::size_t> &index,
+               std::size_t nthreads = 1) {
     DIALS_ASSERT(self.is_consistent());
     reorder_visitor visitor(index);
-    for (iterator it = self.begin(); it != self.end(); ++it) {
-      it->second.apply_visitor(visitor);
-    }
+    visit_columns(self.begin(), self.end(), visitor, nthreads);
   }
 
   /**
@@ -977,6 +1168,29 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     reorder(self, index.const_ref());
   }
 
+  /**
+   * Get the permutation that sorts the table by an int, size_t, double or
+   * Miller index column. The sort is stable and the result does not depend on
+   * the number of threads.
+   * @param self The table object
+   * @param key The column key
+   * @param reverse True/False reverse the sort
+   * @param nthreads The number of threads
+   * @returns The permutation
+   */
+  template <typename T>
+  af::shared<std::size_t> sort_permutation(const T &self,
+                                           typename T::key_type key,
+                                           bool reverse,
+                                           std::size_t nthreads) {
+    typename T::const_iterator it = self.find(key);
+    DIALS_ASSERT(it != self.end());
+    af::shared<std::size_t> index(self.nrows());
+    parallel_sort_visitor visitor(index.ref(), reverse, nthreads);
+    it->second.apply_visitor(visitor);
+    return index;
+  }
+
   /**
    * Perform a shallow copy
    */
@@ -1270,7 +1484,7 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
         .def("resize", &flex_table_type::resize)
         .def("append", &append<flex_table_type>)
         .def("insert", &insert<flex_table_type>)
-        .def("extend", &extend<flex_table_type>)
+        .def("extend", &extend<flex_table_type>, (arg("other"), arg("nthreads") = 1))
         .def("update", &update<flex_table_type>)
         .def("nrows", &flex_table_type::nrows)
         .def("ncols", &flex_table_type::ncols)
@@ -1291,8 +1505,12 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
         .def("items", make_iterator<column_iterator<flex_table_type> >::range())
         .def("rows", make_iterator<row_iterator<flex_table_type> >::range())
         .def("keys", make_iterator<key_iterator<flex_table_type> >::range())
-        .def("select", &select_rows_index<flex_table_type>)
-        .def("select", &select_rows_flags<flex_table_type>)
+        .def("select",
+             &select_rows_index<flex_table_type>,
+             (arg("index"), arg("nthreads") = 1))
+        .def("select",
+             &select_rows_flags<flex_table_type>,
+             (arg("flags"), arg("nthreads") = 1))
         .def("select", &select_cols_keys<flex_table_type>)
         .def("select", &select_cols_tuple<flex_table_type>)
         .def("select", &select_using_experiment<flex_table_type>)
@@ -1301,11 +1519,18 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
         .def("set_selected", &set_selected_rows_flags<flex_table_type>)
         .def("set_selected", &set_selected_cols_keys<flex_table_type>)
         .def("set_selected", &set_selected_cols_tuple<flex_table_type>)
-        .def("del_selected", &del_selected_rows_index<flex_table_type>)
-        .def("del_selected", &del_selected_rows_flags<flex_table_type>)
+        .def("del_selected",
+             &del_selected_rows_index<flex_table_type>,
+             (arg("index"), arg("nthreads") = 1))
+        .def("del_selected",
+             &del_selected_rows_flags<flex_table_type>,
+             (arg("flags"), arg("nthreads") = 1))
         .def("del_selected", &del_selected_cols_keys<flex_table_type>)
         .def("del_selected", &del_selected_cols_tuple<flex_table_type>)
-        .def("reorder", &reorder<flex_table_type>)
+        .def("reorder", &reorder<flex_table_type>, (arg("index"), arg("nthreads") = 1))
+        .def("sort_permutation",
+             &sort_permutation<flex_table_type>,
+             (arg("column"), arg("reverse") = false, arg("nthreads") = 1))
         .def("__copy__", &copy<flex_table_type>)
         .def("__deepcopy__", &deepcopy<flex_table_type>)
         //.def("sort", &sort<flex_table_type>, (
@@ -130,7 +130,10 @@
 )
 from dials_array_family_flex_ext import (  # noqa: F401; lgtm
     Binner,
+    IncrementalPixelListShoeboxCreator,
     PixelListShoeboxCreator,
+    ShoeboxReader,
+    ShoeboxWriter,
     int6,
     observation,
     reflection_table,
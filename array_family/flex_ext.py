@@ -13,12 +13,10 @@
 import os
 
 import six
-import six.moves.cPickle as pickle
 
 import boost_adaptbx.boost.python
 import cctbx.array_family.flex
-import cctbx.miller
-import libtbx.smart_open
+import libtbx
 from scitbx import matrix
 
 import dials.extensions.glm_background_ext
@@ -181,6 +179,9 @@ def from_pickle(filename):
         :param filename: The pickle filename
         :return: The reflection table
         """
+        import libtbx.smart_open
+        import six.moves.cPickle as pickle
+
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
         with libtbx.smart_open.for_reading(filename, "rb") as infile:
@@ -195,21 +196,41 @@ def as_msgpack_file(self, filename):
         """
         Write the reflection table to file in msgpack format
         """
+        import libtbx.smart_open
+
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
         with libtbx.smart_open.for_writing(filename, "wb") as outfile:
             self.as_msgpack_to_file(dials.util.ext.streambuf(python_file_obj=outfile))
 
     @staticmethod
-    def from_msgpack_file(filename):
+    def from_msgpack_file(filename, columns=None):
         """
         Read the reflection table from file in msgpack format
+
+        :param filename: The msgpack file
+        :param columns: A list of the columns to read, or None to read all the
+                        columns. When given, an uncompressed file is memory
+                        mapped so the data of the other columns is not read.
         """
+        import libtbx.smart_open
+
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
+        if columns is not None and not filename.endswith((".gz", ".bz2")):
+            import mmap
+
+            with open(filename, "rb") as infile:
+                packed = mmap.mmap(infile.fileno(), 0, access=mmap.ACCESS_READ)
+            try:
+                return dials_array_family_flex_ext.reflection_table.from_msgpack(
+                    packed, columns=list(columns)
+                )
+            finally:
+                packed.close()
         with libtbx.smart_open.for_reading(filename, "rb") as infile:
             return dials_array_family_flex_ext.reflection_table.from_msgpack(
-                infile.read()
+                infile.read(), columns=columns
             )
 
     def as_file(self, filename):
@@ -343,6 +364,9 @@ def as_pickle(self, filename):
 
         :param filename: The output filename
         """
+        import libtbx.smart_open
+        import six.moves.cPickle as pickle
+
         # Clean up any removed experiments from the identifiers map
         self.clean_experiment_identifiers_map()
 
@@ -380,6 +404,7 @@ def as_miller_array(self, experiment, intensity="sum"):
         Raises:
             KeyError: If chosen intensity values cannot be found in the table.
         """
+        import cctbx.miller
 
         try:
             intensities, variances = (
@@ -417,16 +442,25 @@ def copy(self):
         """
         return self.select(cctbx.array_family.flex.bool(len(self), True))
 
-    def sort(self, name, reverse=False, order=None):
+    def sort(self, name, reverse=False, order=None, nthreads=1):
         """
         Sort the reflection table by a key.
 
         :param name: The name of the column
         :param reverse: Reverse the sort order
         :param order: For multi element items specify order
-        """
-
-        if type(self[name]) in (
+        :param nthreads: The number of threads for sorting int, double and
+                         Miller index columns and reordering the table
+        """
+
+        column_type = type(self[name])
+        if column_type in (
+            cctbx.array_family.flex.int,
+            cctbx.array_family.flex.size_t,
+            cctbx.array_family.flex.double,
+        ) or (column_type is cctbx.array_family.flex.miller_index and not order):
+            perm = self.sort_permutation(name, reverse=reverse, nthreads=nthreads)
+        elif column_type in (
             cctbx.array_family.flex.vec2_double,
             cctbx.array_family.flex.vec3_double,
             cctbx.array_family.flex.mat3_double,
@@ -451,7 +485,7 @@ def sort(self, name, reverse=False, order=None):
             perm = cctbx.array_family.flex.sort_permutation(
                 self[name], reverse=reverse, stable=True
             )
-        self.reorder(perm)
+        self.reorder(perm, nthreads=nthreads)
 
     """
     Sorting the reflection table within an already sorted column
@@ -496,63 +530,26 @@ def match_with_reference(self, other):
         logger.info(" %d observed reflections input" % len(other))
         logger.info(" %d reflections predicted" % len(self))
 
-        # Get the miller index, entering flag and turn number for
-        # Both sets of reflections
-        i1 = self["id"]
-        h1 = self["miller_index"]
-        e1 = self["entering"].as_int()
-        x1, y1, z1 = self["xyzcal.px"].parts()
-        p1 = self["panel"]
-
-        i2 = other["id"]
-        h2 = other["miller_index"]
-        e2 = other["entering"].as_int()
-        x2, y2, z2 = other["xyzcal.px"].parts()
-        p2 = other["panel"]
-
-        class Match(object):
-            def __init__(self):
-                self.a = []
-                self.b = []
-
-        # Create the match lookup
-        lookup = collections.defaultdict(Match)
-        for i in range(len(self)):
-            item = h1[i] + (e1[i], i1[i], p1[i])
-            lookup[item].a.append(i)
-
-        # Add matches from input reflections
-        for i in range(len(other)):
-            item = h2[i] + (e2[i], i2[i], p2[i])
-            if item in lookup:
-                lookup[item].b.append(i)
-
-        # Create the list of matches
-        match1 = []
-        match2 = []
-        for item, value in lookup.items():
-            if len(value.b) == 0:
-                continue
-            elif len(value.a) == 1 and len(value.b) == 1:
-                match1.append(value.a[0])
-                match2.append(value.b[0])
-            else:
-                matched = {}
-                for i in value.a:
-                    d = []
-                    for j in value.b:
-                        dx = x1[i] - x2[j]
-                        dy = y1[i] - y2[j]
-                        dz = z1[i] - z2[j]
-                        d.append((i, j, dx ** 2 + dy ** 2 + dz ** 2))
-                    i, j, d = min(d, key=lambda x: x[2])
-                    if j not in matched:
-                        matched[j] = (i, d)
-                    elif d < matched[j][1]:
-                        matched[j] = (i, d)
-                for key1, value1 in matched.items():
-                    match1.append(value1[0])
-                    match2.append(key1)
+        # Find the pairs of reflections with the same miller index, entering
+        # flag, experiment and panel
+        left, right = self.hash_join(other, ("miller_index", "entering", "id", "panel"))
+        xyz1 = self["xyzcal.px"].select(left)
+        xyz2 = other["xyzcal.px"].select(right)
+        distance = (xyz1 - xyz2).dot()
+
+        # Match each reflection to the nearest one with the same key, and keep
+        # the nearest of those matched to the same reflection
+        nearest = {}
+        for i, j, d in zip(left, right, distance):
+            if i not in nearest or d < nearest[i][1]:
+                nearest[i] = (j, d)
+        matched = {}
+        for i in sorted(nearest):
+            j, d = nearest[i]
+            if j not in matched or d < matched[j][1]:
+                matched[j] = (i, d)
+        match1 = [value[0] for value in matched.values()]
+        match2 = list(matched.keys())
 
         # Select everything which matches
         sind = cctbx.array_family.flex.size_t(match1)
@@ -667,13 +664,14 @@ def compute_d(self, experiments):
         )
         return self["d"]
 
-    def compute_bbox(self, experiments, sigma_b_multiplier=2.0):
+    def compute_bbox(self, experiments, sigma_b_multiplier=2.0, nthreads=1):
         """
         Compute the bounding boxes.
 
         :param experiments: The list of experiments
         :param profile_model: The profile models
         :param sigma_b_multiplier: Multiplier to cover extra background
+        :param nthreads: The number of threads to use
         :return: The bounding box for each reflection
         """
         self["bbox"] = dials_array_family_flex_ext.int6(len(self))
@@ -688,6 +686,7 @@ def compute_bbox(self, experiments, sigma_b_multiplier=2.0):
                     expr.goniometer,
                     expr.scan,
                     sigma_b_multiplier=sigma_b_multiplier,
+                    nthreads=nthreads,
                 ),
             )
         return self["bbox"]
@@ -763,14 +762,15 @@ def compute_background(self, experiments, image_volume=None):
         )
         self.set_flags(~success, self.flags.failed_during_background_modelling)
 
-    def compute_centroid(self, experiments, image_volume=None):
+    def compute_centroid(self, experiments, image_volume=None, nthreads=1):
         """
         Helper function to compute the centroid.
 
         :param experiments: The list of experiments
+        :param nthreads: The number of threads to use
         """
         self.centroid_algorithm(experiments).compute_centroid(
-            self, image_volume=image_volume
+            self, image_volume=image_volume, nthreads=nthreads
         )
 
     def compute_summed_intensity(self, image_volume=None):
@@ -793,11 +793,12 @@ def compute_fitted_intensity(self, fitter):
         success = fitter.fit(self)
         self.set_flags(~success, self.flags.failed_during_profile_fitting)
 
-    def compute_corrections(self, experiments):
+    def compute_corrections(self, experiments, nthreads=1):
         """
         Helper function to correct the intensity.
 
         :param experiments: The list of experiments
+        :param nthreads: The number of threads to use
         :return: The LP correction for each reflection
         """
         from dials.algorithms.integration import Corrections, CorrectionsMulti
@@ -812,20 +813,22 @@ def compute_corrections(self, experiments):
                 )
             else:
                 compute.append(Corrections(experiment.beam, experiment.detector))
-        lp = compute.lp(self["id"], self["s1"])
+        lp = compute.lp(self["id"], self["s1"], nthreads=nthreads)
         self["lp"] = lp
         if experiment.detector[0].get_mu() > 0:
-            qe = compute.qe(self["id"], self["s1"], self["panel"])
+            qe = compute.qe(self["id"], self["s1"], self["panel"], nthreads=nthreads)
             self["qe"] = qe
         return lp
 
-    def extract_shoeboxes(self, imageset, mask=None, nthreads=1):
+    def extract_shoeboxes(self, imageset, mask=None, nthreads=1, flag_overloaded=False):
         """
         Helper function to read a load of shoebox data.
 
         :param imageset: The imageset
         :param mask: The mask to apply
         :param nthreads: The number of threads to use
+        :param flag_overloaded: Check for overloads while extracting, as
+                                is_overloaded does
         :return: A tuple containing read time and extract time
         """
         from time import time
@@ -839,8 +842,14 @@ def extract_shoeboxes(self, imageset, mask=None, nthreads=1):
         except Exception:
             frame0, frame1 = (0, len(imageset))
         extractor = dials_array_family_flex_ext.ShoeboxExtractor(
-            self, len(detector), frame0, frame1
+            self, len(detector), frame0, frame1, nthreads=nthreads
         )
+        if flag_overloaded:
+            extractor.set_overload(
+                cctbx.array_family.flex.double(
+                    p.get_trusted_range()[1] for p in detector
+                )
+            )
         logger.info(" Beginning to read images")
         read_time = 0
         extract_time = 0
@@ -858,6 +867,8 @@ def extract_shoeboxes(self, imageset, mask=None, nthreads=1):
             extract_time += time() - st
             del image
         assert extractor.finished()
+        if flag_overloaded:
+            self.set_flags(extractor.overloaded(), self.flags.overloaded)
         logger.info("  successfully read %d images", frame1 - frame0)
         logger.info("  read time: %.1f seconds", read_time)
         logger.info("  extract time: %.1f seconds", extract_time)
@@ -1005,6 +1016,9 @@ def compute_miller_indices_in_asu(self, experiments):
         """
         Compute miller indices in the asu
         """
+        import cctbx.crystal
+        import cctbx.miller
+
         self["miller_index_asu"] = cctbx.array_family.flex.miller_index(len(self))
         for idx, experiment in enumerate(experiments):
 
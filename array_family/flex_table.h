@@ -22,6 +22,7 @@
 #include <boost/mpl/remove_if.hpp>
 #include <boost/mpl/transform.hpp>
 #include <dials/error.h>
+#include <dials/util/memory_accounting.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 
 namespace dials { namespace af {
@@ -69,14 +70,7 @@ namespace dials { namespace af {
       copy_column_visitor(flex_table *t, key_type &k) : t_(t), k_(k) {}
       template <typename T>
       void operator()(const af::shared<T> &other_column) const {
-        size_type n = t_->nrows();
-        boost::shared_ptr<map_type> table = t_->table_;
-        iterator it = table->lower_bound(k_);
-        if (it == table->end() || table->key_comp()(k_, it->first)) {
-          it = table->insert(
-            it, map_value_type(k_, mapped_type(af::shared<T>(n, init_zero<T>()))));
-        }
-        af::shared<T> this_column = boost::get<af::shared<T> >(it->second);
+        af::shared<T> this_column = t_->template column<T>(k_);
         DIALS_ASSERT(this_column.size() == other_column.size());
         for (std::size_t i = 0; i < this_column.size(); ++i) {
           this_column[i] = other_column[i];
@@ -98,8 +92,8 @@ namespace dials { namespace af {
        */
       template <typename T>
       void operator=(const af::shared<T> other_column) {
-        DIALS_ASSERT(other_column.size() == t_->nrows());
         af::shared<T> this_column = (af::shared<T>)(*this);
+        DIALS_ASSERT(other_column.size() == this_column.size());
         for (std::size_t i = 0; i < this_column.size(); ++i) {
           this_column[i] = other_column[i];
         }
@@ -128,14 +122,7 @@ namespace dials { namespace af {
        */
       template <typename T>
       operator af::shared<T>() const {
-        size_type n = t_->nrows();
-        boost::shared_ptr<map_type> table = t_->table_;
-        iterator it = table->lower_bound(k_);
-        if (it == table->end() || table->key_comp()(k_, it->first)) {
-          it = table->insert(
-            it, map_value_type(k_, mapped_type(af::shared<T>(n, init_zero<T>()))));
-        }
-        return boost::get<af::shared<T> >(it->second);
+        return t_->template column<T>(k_);
       }
 
       /**
@@ -178,6 +165,14 @@ namespace dials { namespace af {
       }
     };
 
+    /** Get the number of bytes allocated for each column */
+    struct nbytes_visitor : boost::static_visitor<std::size_t> {
+      template <typename T>
+      std::size_t operator()(const T &v) const {
+        return v.capacity() * sizeof(typename T::value_type);
+      }
+    };
+
     /** Resize each column */
     struct resize_visitor : boost::static_visitor<void> {
       size_type n_;
@@ -212,14 +207,21 @@ namespace dials { namespace af {
 
   public:
     /** Initialise the table */
-    flex_table() : table_(boost::make_shared<map_type>()), default_nrows_(0) {}
+    flex_table()
+        : table_(boost::make_shared<map_type>()),
+          default_nrows_(0),
+          memory_(
+            dials::util::make_memory_charge(dials::util::ReflectionTableMemory)) {}
 
     /**
      * Initialise the table to a certain size
      * @param n The size to initialise to
      */
     flex_table(size_type n)
-        : table_(boost::make_shared<map_type>()), default_nrows_(n) {}
+        : table_(boost::make_shared<map_type>()),
+          default_nrows_(n),
+          memory_(
+            dials::util::make_memory_charge(dials::util::ReflectionTableMemory)) {}
 
     /**
      * Virtual destructor
@@ -242,8 +244,7 @@ namespace dials { namespace af {
      */
     template <typename T>
     af::shared<T> get(const key_type &key) {
-      af::shared<T> result = proxy(this, key);
-      return result;
+      return column<T>(key);
     }
 
     /**
@@ -309,6 +310,20 @@ namespace dials { namespace af {
       return table_->empty();
     }
 
+    /**
+     * @returns The number of bytes allocated for the columns. Strings and
+     * other columns of heap allocated elements are counted by the size of the
+     * element alone.
+     */
+    std::size_t nbytes() const {
+      nbytes_visitor visitor;
+      std::size_t result = 0;
+      for (const_iterator it = begin(); it != end(); ++it) {
+        result += it->second.apply_visitor(visitor);
+      }
+      return result;
+    }
+
     /** @returns Are the column sizes consistent */
     bool is_consistent() const {
       if (!empty()) {
@@ -359,6 +374,7 @@ namespace dials { namespace af {
       }
       DIALS_ASSERT(is_consistent());
       default_nrows_ = n;
+      update_memory();
     }
 
     /**
@@ -383,6 +399,7 @@ namespace dials { namespace af {
       }
       DIALS_ASSERT(is_consistent());
       default_nrows_ = nr + n;
+      update_memory();
     }
 
     /**
@@ -407,6 +424,7 @@ namespace dials { namespace af {
       }
       DIALS_ASSERT(is_consistent());
       default_nrows_ = nr - n;
+      update_memory();
     }
 
     /**
@@ -415,7 +433,9 @@ namespace dials { namespace af {
      * @returns The number of columns removed
      */
     size_type erase(const key_type &key) {
-      return table_->erase(key);
+      size_type result = table_->erase(key);
+      update_memory();
+      return result;
     }
 
     /** Clear the table */
@@ -431,8 +451,36 @@ namespace dials { namespace af {
     }
 
   private:
+    /**
+     * Find the column with the given key, creating it if it is not present.
+     * The number of rows, which visits every column, is only needed when the
+     * column is created, so finding an existing column is a single lookup.
+     * The column shares its data with the table, so loops should fetch it
+     * once rather than on every row.
+     */
+    template <typename T>
+    af::shared<T> column(const key_type &key) {
+      iterator it = table_->lower_bound(key);
+      if (it == table_->end() || table_->key_comp()(key, it->first)) {
+        size_type n = nrows();
+        it = table_->insert(
+          it, map_value_type(key, mapped_type(af::shared<T>(n, init_zero<T>()))));
+        update_memory();
+      }
+      return boost::get<af::shared<T> >(it->second);
+    }
+
+    /**
+     * Update the memory charged for the table. Columns which are resized
+     * from outside the table are counted at the next change to the table.
+     */
+    void update_memory() {
+      memory_->set(nbytes());
+    }
+
     boost::shared_ptr<map_type> table_;
     size_type default_nrows_;
+    boost::shared_ptr<dials::util::MemoryCharge> memory_;
   };
 
   struct null_type {};
@@ -0,0 +1,386 @@
+/*
+ * group_by.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_GROUP_BY_H
+#define DIALS_ARRAY_FAMILY_GROUP_BY_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/shared.h>
+#include <cctbx/miller.h>
+#include <dials/array_family/import_scitbx_af.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace af {
+
+  /**
+   * The key of a row, with the 32 bit key components packed in pairs into
+   * 64 bit words. Unused words are zero.
+   */
+  struct RowKey {
+    static const std::size_t max_words = 4;
+    boost::uint64_t word[max_words];
+
+    bool operator==(const RowKey &other) const {
+      return std::equal(word, word + max_words, other.word);
+    }
+  };
+
+  /**
+   * The keys of the rows of a table, made from a set of key columns. Each int,
+   * size_t or bool column adds one component to the key and each Miller index
+   * column adds three, up to eight components in all, so a Miller index and
+   * an experiment id pack into two words.
+   */
+  class RowKeys {
+  public:
+    static const std::size_t max_components = 2 * RowKey::max_words;
+
+    /**
+     * @param size The number of rows
+     */
+    RowKeys(std::size_t size) : size_(size) {}
+
+    void add(const af::const_ref<int> &column) {
+      boost::uint32_t *c = add_component();
+      for (std::size_t i = 0; i < size_; ++i) {
+        c[i] = static_cast<boost::uint32_t>(column[i]);
+      }
+    }
+
+    void add(const af::const_ref<std::size_t> &column) {
+      boost::uint32_t *c = add_component();
+      for (std::size_t i = 0; i < size_; ++i) {
+        DIALS_ASSERT(column[i] <= 0xffffffffu);
+        c[i] = static_cast<boost::uint32_t>(column[i]);
+      }
+    }
+
+    void add(const af::const_ref<bool> &column) {
+      boost::uint32_t *c = add_component();
+      for (std::size_t i = 0; i < size_; ++i) {
+        c[i] = column[i];
+      }
+    }
+
+    void add(const af::const_ref<cctbx::miller::index<> > &column) {
+      for (std::size_t j = 0; j < 3; ++j) {
+        boost::uint32_t *c = add_component();
+        for (std::size_t i = 0; i < size_; ++i) {
+          c[i] = static_cast<boost::uint32_t>(column[i][j]);
+        }
+      }
+    }
+
+    /**
+     * @returns The number of rows
+     */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /**
+     * @returns The number of key components
+     */
+    std::size_t num_components() const {
+      return components_.size();
+    }
+
+    /**
+     * @returns The packed key of a row
+     */
+    RowKey operator[](std::size_t i) const {
+      RowKey key;
+      std::fill(key.word, key.word + RowKey::max_words, 0);
+      for (std::size_t j = 0; j < components_.size(); ++j) {
+        key.word[j / 2] |= boost::uint64_t(components_[j][i]) << (32 * (j % 2));
+      }
+      return key;
+    }
+
+  private:
+    boost::uint32_t *add_component() {
+      DIALS_ASSERT(components_.size() < max_components);
+      components_.push_back(std::vector<boost::uint32_t>(size_));
+      return size_ > 0 ? &components_.back()[0] : 0;
+    }
+
+    std::size_t size_;
+    std::vector<std::vector<boost::uint32_t> > components_;
+  };
+
+  /**
+   * Hash a row key by mixing in each word with the SplitMix64 finaliser
+   */
+  inline boost::uint64_t hash_row_key(const RowKey &key) {
+    boost::uint64_t h = 0;
+    for (std::size_t j = 0; j < RowKey::max_words; ++j) {
+      h = (h ^ key.word[j]) + 0x9E3779B97F4A7C15ULL;
+      h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+      h ^= h >> 31;
+    }
+    return h;
+  }
+
+  /**
+   * Group the rows of a table with equal keys. The groups are numbered in
+   * the order of their first row and stored in compressed sparse row form, so
+   * the rows of group g are indices()[offsets()[g]:offsets()[g+1]] in
+   * increasing order.
+   *
+   * The groups are found with open addressing hash tables. The keys are split
+   * into one partition per thread by their hash, and each thread fills the
+   * table for its partition, so the result does not depend on the number of
+   * threads. The tables are kept so that other keys can be looked up.
+   */
+  class KeyIndex {
+  public:
+    /**
+     * @param keys The row keys
+     * @param nthreads The number of threads
+     */
+    KeyIndex(const RowKeys &keys, std::size_t nthreads = 1)
+        : keys_(keys),
+          num_partitions_(std::max(nthreads, std::size_t(1))),
+          hash_(keys.size()),
+          first_(keys.size()),
+          group_(keys.size()) {
+      std::size_t n = keys.size();
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&KeyIndex::hash_rows, this, _1, _2), n, nthreads);
+
+      // Size the tables for at most half full
+      std::vector<std::size_t> count(num_partitions_, 0);
+      for (std::size_t i = 0; i < n; ++i) {
+        count[partition(hash_[i])]++;
+      }
+      tables_.resize(num_partitions_);
+      masks_.resize(num_partitions_);
+      for (std::size_t p = 0; p < num_partitions_; ++p) {
+        std::size_t capacity = 2;
+        while (capacity < 2 * count[p]) {
+          capacity *= 2;
+        }
+        tables_[p].assign(capacity, 0);
+        masks_[p] = capacity - 1;
+      }
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&KeyIndex::fill_partitions, this, _1, _2),
+        num_partitions_,
+        nthreads);
+
+      // Number the groups in the order of their first row
+      std::vector<std::size_t> rank(n);
+      std::size_t num_groups = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (first_[i] == i) {
+          rank[i] = num_groups++;
+        }
+      }
+      offsets_ = af::shared<std::size_t>(num_groups + 1, 0);
+      for (std::size_t i = 0; i < n; ++i) {
+        group_[i] = rank[first_[i]];
+        offsets_[group_[i] + 1]++;
+      }
+      for (std::size_t g = 0; g < num_groups; ++g) {
+        offsets_[g + 1] += offsets_[g];
+      }
+      indices_ = af::shared<std::size_t>(n);
+      std::vector<std::size_t> position(offsets_.begin(), offsets_.end() - 1);
+      for (std::size_t i = 0; i < n; ++i) {
+        indices_[position[group_[i]]++] = i;
+      }
+    }
+
+    /**
+     * @returns The number of groups
+     */
+    std::size_t num_groups() const {
+      return offsets_.size() - 1;
+    }
+
+    /**
+     * @returns The group of each row
+     */
+    af::shared<std::size_t> group() const {
+      return group_;
+    }
+
+    /**
+     * @returns The offset of each group in the list of indices
+     */
+    af::shared<std::size_t> offsets() const {
+      return offsets_;
+    }
+
+    /**
+     * @returns The rows of each group
+     */
+    af::shared<std::size_t> indices() const {
+      return indices_;
+    }
+
+    /**
+     * Find the group with a key
+     * @param key The key
+     * @returns The group, or num_groups() if there is no group with the key
+     */
+    std::size_t find(const RowKey &key) const {
+      boost::uint64_t hash = hash_row_key(key);
+      const std::vector<std::size_t> &table = tables_[partition(hash)];
+      std::size_t mask = masks_[partition(hash)];
+      for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        std::size_t entry = table[slot];
+        if (entry == 0) {
+          return num_groups();
+        }
+        if (hash_[entry - 1] == hash && keys_[entry - 1] == key) {
+          return group_[entry - 1];
+        }
+      }
+    }
+
+  private:
+    std::size_t partition(boost::uint64_t hash) const {
+      return (std::size_t)((hash >> 40) % num_partitions_);
+    }
+
+    void hash_rows(std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        hash_[i] = hash_row_key(keys_[i]);
+      }
+    }
+
+    /**
+     * Insert the rows of a band of partitions into their tables. The tables
+     * hold the first row of each group plus one, with zero for an empty slot.
+     */
+    void fill_partitions(std::size_t first, std::size_t last) {
+      for (std::size_t p = first; p < last; ++p) {
+        std::vector<std::size_t> &table = tables_[p];
+        std::size_t mask = masks_[p];
+        for (std::size_t i = 0; i < hash_.size(); ++i) {
+          if (partition(hash_[i]) != p) {
+            continue;
+          }
+          RowKey key = keys_[i];
+          for (std::size_t slot = hash_[i] & mask;; slot = (slot + 1) & mask) {
+            std::size_t entry = table[slot];
+            if (entry == 0) {
+              table[slot] = i + 1;
+              first_[i] = i;
+              break;
+            }
+            if (hash_[entry - 1] == hash_[i] && keys_[entry - 1] == key) {
+              first_[i] = entry - 1;
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    const RowKeys &keys_;
+    std::size_t num_partitions_;
+    std::vector<boost::uint64_t> hash_;
+    std::vector<std::size_t> first_;
+    af::shared<std::size_t> group_;
+    af::shared<std::size_t> offsets_;
+    af::shared<std::size_t> indices_;
+    std::vector<std::vector<std::size_t> > tables_;
+    std::vector<std::size_t> masks_;
+  };
+
+  /**
+   * Find all the pairs of rows of two tables with equal keys (an inner join).
+   * The right hand keys are grouped with a KeyIndex, and the left hand keys
+   * are looked up in parallel. The pairs are ordered by the left row and then
+   * by the right row.
+   */
+  class HashJoin {
+  public:
+    /**
+     * @param left The keys of the left hand table
+     * @param right The keys of the right hand table
+     * @param nthreads The number of threads
+     */
+    HashJoin(const RowKeys &left, const RowKeys &right, std::size_t nthreads = 1)
+        : left_keys_(left),
+          index_(right, nthreads),
+          right_offsets_(index_.offsets()),
+          right_indices_(index_.indices()),
+          match_(left.size()),
+          count_(left.size() + 1, 0) {
+      DIALS_ASSERT(left.num_components() == right.num_components());
+      std::size_t n = left.size();
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&HashJoin::probe, this, _1, _2), n, nthreads);
+      for (std::size_t i = 0; i < n; ++i) {
+        count_[i + 1] += count_[i];
+      }
+      left_ = af::shared<std::size_t>(count_[n]);
+      right_ = af::shared<std::size_t>(count_[n]);
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&HashJoin::fill, this, _1, _2), n, nthreads);
+    }
+
+    /**
+     * @returns The left hand row of each pair
+     */
+    af::shared<std::size_t> left() const {
+      return left_;
+    }
+
+    /**
+     * @returns The right hand row of each pair
+     */
+    af::shared<std::size_t> right() const {
+      return right_;
+    }
+
+  private:
+    void probe(std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        std::size_t g = index_.find(left_keys_[i]);
+        match_[i] = g;
+        if (g < index_.num_groups()) {
+          count_[i + 1] = right_offsets_[g + 1] - right_offsets_[g];
+        }
+      }
+    }
+
+    void fill(std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        std::size_t g = match_[i];
+        if (g < index_.num_groups()) {
+          std::size_t k = count_[i];
+          for (std::size_t j = right_offsets_[g]; j < right_offsets_[g + 1]; ++j) {
+            left_[k] = i;
+            right_[k] = right_indices_[j];
+            ++k;
+          }
+        }
+      }
+    }
+
+    const RowKeys &left_keys_;
+    KeyIndex index_;
+    af::shared<std::size_t> right_offsets_;
+    af::shared<std::size_t> right_indices_;
+    std::vector<std::size_t> match_;
+    std::vector<std::size_t> count_;
+    af::shared<std::size_t> left_;
+    af::shared<std::size_t> right_;
+  };
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_GROUP_BY_H
@@ -0,0 +1,353 @@
+/*
+ * radix_sort_index.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_RADIX_SORT_INDEX_H
+#define DIALS_ARRAY_FAMILY_RADIX_SORT_INDEX_H
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/shared.h>
+#include <cctbx/miller.h>
+#include <dials/array_family/import_scitbx_af.h>
+#include <dials/array_family/sort_index.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace af {
+
+  namespace detail {
+
+    /**
+     * The unsigned key type for each type of value
+     */
+    template <typename T>
+    struct radix_key_type {};
+
+    template <>
+    struct radix_key_type<int> {
+      typedef boost::uint32_t type;
+    };
+
+    template <>
+    struct radix_key_type<std::size_t> {
+      typedef boost::uint64_t type;
+    };
+
+    template <>
+    struct radix_key_type<double> {
+      typedef boost::uint64_t type;
+    };
+
+    /**
+     * Map a value to an unsigned key with the same order
+     */
+    inline boost::uint32_t radix_key(int x) {
+      return static_cast<boost::uint32_t>(x) ^ 0x80000000u;
+    }
+
+    inline boost::uint64_t radix_key(std::size_t x) {
+      return x;
+    }
+
+    /**
+     * Map a double to an unsigned key with the same order. Negative values
+     * have all their bits flipped and positive values just the sign bit, and
+     * -0 is mapped to the same key as 0 since they compare equal.
+     */
+    inline boost::uint64_t radix_key(double x) {
+      if (x == 0) {
+        x = 0;
+      }
+      boost::uint64_t bits;
+      std::memcpy(&bits, &x, sizeof(bits));
+      const boost::uint64_t sign = boost::uint64_t(1) << 63;
+      return (bits & sign) ? ~bits : (bits | sign);
+    }
+
+    /**
+     * The number of bits in each digit of the radix sort
+     */
+    const std::size_t radix_bits = 8;
+    const std::size_t radix_size = 1 << radix_bits;
+
+    /**
+     * Sort a list of keys and an index array together by key with a stable
+     * LSD radix sort. Each pass counts the digits of a band of the keys, and
+     * then scatters each band to the positions given by the prefix sum of the
+     * counts, so the bands are processed in parallel and the result does not
+     * depend on the number of threads. Passes where every key has the same
+     * digit are skipped.
+     */
+    template <typename Key>
+    class RadixSorter {
+    public:
+      RadixSorter(std::vector<Key> &keys,
+                  std::vector<std::size_t> &index,
+                  std::size_t nthreads)
+          : keys_(keys),
+            index_(index),
+            keys_tmp_(keys.size()),
+            index_tmp_(index.size()),
+            nthreads_(std::max(nthreads, std::size_t(1))),
+            nbands_(std::min(nthreads_, std::max(keys.size(), std::size_t(1)))),
+            band_size_((keys.size() + nbands_ - 1) / nbands_),
+            counts_(nbands_ * radix_size),
+            shift_(0) {
+        DIALS_ASSERT(keys.size() == index.size());
+      }
+
+      void sort() {
+        std::size_t n = keys_.size();
+        std::vector<Key> *src_keys = &keys_, *dst_keys = &keys_tmp_;
+        std::vector<std::size_t> *src_index = &index_, *dst_index = &index_tmp_;
+        for (shift_ = 0; shift_ < 8 * sizeof(Key); shift_ += radix_bits) {
+          src_keys_ = src_keys;
+          src_index_ = src_index;
+          dst_keys_ = dst_keys;
+          dst_index_ = dst_index;
+          std::fill(counts_.begin(), counts_.end(), 0);
+          run(&RadixSorter::count_bands);
+          if (!prefix_sum(n)) {
+            continue;
+          }
+          run(&RadixSorter::scatter_bands);
+          std::swap(src_keys, dst_keys);
+          std::swap(src_index, dst_index);
+        }
+        if (src_keys != &keys_) {
+          keys_.swap(keys_tmp_);
+          index_.swap(index_tmp_);
+        }
+      }
+
+    private:
+      typedef void (RadixSorter::*band_function)(std::size_t);
+
+      void run(band_function function) {
+        dials::algorithms::detail::parallel_bands(
+          boost::bind(&RadixSorter::bands, this, function, _1, _2), nbands_, nthreads_);
+      }
+
+      void bands(band_function function, std::size_t first, std::size_t last) {
+        for (std::size_t b = first; b < last; ++b) {
+          (this->*function)(b);
+        }
+      }
+
+      std::size_t digit(Key key) const {
+        return (std::size_t)((key >> shift_) & (radix_size - 1));
+      }
+
+      void count_bands(std::size_t b) {
+        std::size_t *counts = &counts_[b * radix_size];
+        const std::vector<Key> &keys = *src_keys_;
+        std::size_t last = std::min((b + 1) * band_size_, keys.size());
+        for (std::size_t i = b * band_size_; i < last; ++i) {
+          counts[digit(keys[i])]++;
+        }
+      }
+
+      /**
+       * Turn the counts into the first output position of each digit in each
+       * band. Returns false if all the keys have the same digit.
+       */
+      bool prefix_sum(std::size_t n) {
+        std::size_t offset = 0;
+        for (std::size_t d = 0; d < radix_size; ++d) {
+          std::size_t total = 0;
+          for (std::size_t b = 0; b < nbands_; ++b) {
+            total += counts_[b * radix_size + d];
+          }
+          if (total == n) {
+            return false;
+          }
+          for (std::size_t b = 0; b < nbands_; ++b) {
+            std::size_t count = counts_[b * radix_size + d];
+            counts_[b * radix_size + d] = offset;
+            offset += count;
+          }
+        }
+        return true;
+      }
+
+      void scatter_bands(std::size_t b) {
+        std::size_t *offset = &counts_[b * radix_size];
+        const std::vector<Key> &src_keys = *src_keys_;
+        const std::vector<std::size_t> &src_index = *src_index_;
+        std::vector<Key> &dst_keys = *dst_keys_;
+        std::vector<std::size_t> &dst_index = *dst_index_;
+        std::size_t last = std::min((b + 1) * band_size_, src_keys.size());
+        for (std::size_t i = b * band_size_; i < last; ++i) {
+          std::size_t j = offset[digit(src_keys[i])]++;
+          dst_keys[j] = src_keys[i];
+          dst_index[j] = src_index[i];
+        }
+      }
+
+      std::vector<Key> &keys_;
+      std::vector<std::size_t> &index_;
+      std::vector<Key> keys_tmp_;
+      std::vector<std::size_t> index_tmp_;
+      std::size_t nthreads_;
+      std::size_t nbands_;
+      std::size_t band_size_;
+      std::vector<std::size_t> counts_;
+      std::size_t shift_;
+      const std::vector<Key> *src_keys_;
+      const std::vector<std::size_t> *src_index_;
+      std::vector<Key> *dst_keys_;
+      std::vector<std::size_t> *dst_index_;
+    };
+
+    /**
+     * Copy the sorted index array to the result
+     */
+    inline af::shared<std::size_t> to_shared(const std::vector<std::size_t> &index) {
+      af::shared<std::size_t> result(index.size());
+      std::copy(index.begin(), index.end(), result.begin());
+      return result;
+    }
+
+    /**
+     * Sort the index array by the keys of the values it points to
+     */
+    template <typename T>
+    void radix_sort_index_by(std::vector<std::size_t> &index,
+                             const af::const_ref<T> &v,
+                             bool reverse,
+                             std::size_t nthreads) {
+      typedef typename radix_key_type<T>::type key_type;
+      std::vector<key_type> keys(index.size());
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        keys[i] = reverse ? ~radix_key(v[index[i]]) : radix_key(v[index[i]]);
+      }
+      RadixSorter<key_type>(keys, index, nthreads).sort();
+    }
+
+    /**
+     * Functor to compare in reverse in radix_sort_index.
+     */
+    template <class RandomAccessIterator>
+    struct index_greater {
+      index_greater(const RandomAccessIterator &v) : v_(v) {}
+
+      template <class IndexType>
+      bool operator()(const IndexType &x, const IndexType &y) const {
+        return v_[y] < v_[x];
+      }
+      const RandomAccessIterator &v_;
+    };
+
+  }  // namespace detail
+
+  /**
+   * Get the permutation which sorts a list of values. The sort is stable, so
+   * equal values are kept in the order of their indices, in both the forward
+   * and reverse directions. This is the fallback for value types with no
+   * radix key, and compares the values directly.
+   * @param v The list of values
+   * @param reverse Sort in descending order
+   * @param nthreads The number of threads (unused)
+   * @returns The permutation
+   */
+  template <typename T>
+  af::shared<std::size_t> radix_sort_index(const af::const_ref<T> &v,
+                                           bool reverse = false,
+                                           std::size_t nthreads = 1) {
+    af::shared<std::size_t> index(v.size());
+    for (std::size_t i = 0; i < index.size(); ++i) {
+      index[i] = i;
+    }
+    if (reverse) {
+      std::stable_sort(index.begin(),
+                       index.end(),
+                       detail::index_greater<const T *>(v.begin()));
+    } else {
+      std::stable_sort(index.begin(), index.end(), index_less<const T *>(v.begin()));
+    }
+    return index;
+  }
+
+  namespace detail {
+
+    template <typename T>
+    af::shared<std::size_t> radix_sort_index_scalar(const af::const_ref<T> &v,
+                                                    bool reverse,
+                                                    std::size_t nthreads) {
+      std::vector<std::size_t> index(v.size());
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        index[i] = i;
+      }
+      radix_sort_index_by(index, v, reverse, nthreads);
+      return detail::to_shared(index);
+    }
+
+  }  // namespace detail
+
+  /**
+   * Get the permutation which sorts a list of values with a parallel, stable
+   * LSD radix sort. Doubles are sorted by an order preserving transform of
+   * their bits.
+   * @param v The list of values
+   * @param reverse Sort in descending order
+   * @param nthreads The number of threads
+   * @returns The permutation
+   */
+  inline af::shared<std::size_t> radix_sort_index(const af::const_ref<int> &v,
+                                                  bool reverse = false,
+                                                  std::size_t nthreads = 1) {
+    return detail::radix_sort_index_scalar(v, reverse, nthreads);
+  }
+
+  inline af::shared<std::size_t> radix_sort_index(const af::const_ref<std::size_t> &v,
+                                                  bool reverse = false,
+                                                  std::size_t nthreads = 1) {
+    return detail::radix_sort_index_scalar(v, reverse, nthreads);
+  }
+
+  inline af::shared<std::size_t> radix_sort_index(const af::const_ref<double> &v,
+                                                  bool reverse = false,
+                                                  std::size_t nthreads = 1) {
+    return detail::radix_sort_index_scalar(v, reverse, nthreads);
+  }
+
+  /**
+   * Get the permutation which sorts a list of Miller indices in lexicographic
+   * order, by sorting on l, k and then h.
+   * @param v The list of Miller indices
+   * @param reverse Sort in descending order
+   * @param nthreads The number of threads
+   * @returns The permutation
+   */
+  inline af::shared<std::size_t> radix_sort_index(
+    const af::const_ref<cctbx::miller::index<> > &v,
+    bool reverse = false,
+    std::size_t nthreads = 1) {
+    std::vector<std::size_t> index(v.size());
+    for (std::size_t i = 0; i < index.size(); ++i) {
+      index[i] = i;
+    }
+    if (v.size() == 0) {
+      return af::shared<std::size_t>();
+    }
+    std::vector<int> component(v.size());
+    for (std::size_t k = 3; k > 0; --k) {
+      for (std::size_t i = 0; i < v.size(); ++i) {
+        component[i] = v[i][k - 1];
+      }
+      detail::radix_sort_index_by(
+        index, af::const_ref<int>(&component[0], component.size()), reverse, nthreads);
+    }
+    return detail::to_shared(index);
+  }
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_RADIX_SORT_INDEX_H
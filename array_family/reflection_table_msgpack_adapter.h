@@ -11,6 +11,9 @@
 #ifndef DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MSGPACK_ADAPTER_H
 #define DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MSGPACK_ADAPTER_H
 
+#include <algorithm>
+#include <set>
+#include <string>
 #include <scitbx/array_family/shared.h>
 #include <dials/array_family/reflection_table.h>
 #include <msgpack.hpp>
@@ -179,7 +182,10 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
      * Pack a shared<Shoebox<>> into a msgpack array.
      *
      * Shoebox arrays are treated differently because they are themselves
-     * structs with multiple items.
+     * structs with multiple items. The shoeboxes are packed into a single
+     * binary blob, whose size is found first so that the shoeboxes can be
+     * written straight to the stream rather than through an intermediate
+     * buffer holding the whole column.
      */
     template <typename T>
     struct pack<scitbx::af::const_ref<dials::af::Shoebox<T> > > {
@@ -189,59 +195,68 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         const scitbx::af::const_ref<dials::af::Shoebox<T> >& v) const {
         typedef typename scitbx::af::const_ref<dials::af::Shoebox<T> >::const_iterator
           iterator;
-        std::stringstream buffer;
-        for (iterator it = v.begin(); it != v.end(); ++it) {
-          // Write the panel
-          write(buffer, (uint32_t)it->panel);
 
+        // Check the shoeboxes and compute the size of the binary data
+        std::size_t binary_size = 0;
+        for (iterator it = v.begin(); it != v.end(); ++it) {
           // Check the bounding box makes sense
           DIALS_ASSERT(it->bbox[1] >= it->bbox[0]);
           DIALS_ASSERT(it->bbox[3] >= it->bbox[2]);
           DIALS_ASSERT(it->bbox[5] >= it->bbox[4]);
 
-          // Write the bounding box
-          write(buffer, (int32_t)it->bbox[0]);
-          write(buffer, (int32_t)it->bbox[1]);
-          write(buffer, (int32_t)it->bbox[2]);
-          write(buffer, (int32_t)it->bbox[3]);
-          write(buffer, (int32_t)it->bbox[4]);
-          write(buffer, (int32_t)it->bbox[5]);
+          // The panel, bounding box and data flag
+          binary_size += sizeof(uint32_t) + 6 * sizeof(int32_t) + sizeof(uint8_t);
 
-          // Serialise data
+          // The data, mask and background arrays
           if (it->data.size() > 0) {
             DIALS_ASSERT(it->is_consistent());
+            binary_size += it->data.size() * element_size_helper<T>::size();
+            binary_size += it->mask.size() * element_size_helper<int>::size();
+            binary_size += it->background.size() * element_size_helper<T>::size();
+          }
+        }
+
+        o.pack_bin(binary_size);
+        for (iterator it = v.begin(); it != v.end(); ++it) {
+          // Write the panel
+          write(o, (uint32_t)it->panel);
+
+          // Write the bounding box
+          write(o, (int32_t)it->bbox[0]);
+          write(o, (int32_t)it->bbox[1]);
+          write(o, (int32_t)it->bbox[2]);
+          write(o, (int32_t)it->bbox[3]);
+          write(o, (int32_t)it->bbox[4]);
+          write(o, (int32_t)it->bbox[5]);
 
+          // Serialise data
+          if (it->data.size() > 0) {
             // Write 1 to indicate data is present
-            write(buffer, (uint8_t)1);
+            write(o, (uint8_t)1);
 
             // Write data array
-            buffer.write((const char*)&it->data[0],
-                         it->data.size() * element_size_helper<T>::size());
+            o.pack_bin_body((const char*)&it->data[0],
+                            it->data.size() * element_size_helper<T>::size());
 
             // Write mask array
-            buffer.write((const char*)&it->mask[0],
-                         it->mask.size() * element_size_helper<int>::size());
+            o.pack_bin_body((const char*)&it->mask[0],
+                            it->mask.size() * element_size_helper<int>::size());
 
             // Write background array
-            buffer.write((const char*)&it->background[0],
-                         it->background.size() * element_size_helper<T>::size());
+            o.pack_bin_body((const char*)&it->background[0],
+                            it->background.size() * element_size_helper<T>::size());
 
           } else {
             // Write zero to indicate data is not present
-            write(buffer, (uint8_t)0);
+            write(o, (uint8_t)0);
           }
         }
-
-        // Serialise the string to msgpack binary
-        std::string buffer_string = buffer.str();
-        o.pack_bin(buffer_string.size());
-        o.pack_bin_body(buffer_string.c_str(), buffer_string.size());
         return o;
       }
 
       template <typename Stream, typename ValueType>
-      void write(Stream& buffer, const ValueType& x) const {
-        buffer.write((const char*)&x, sizeof(ValueType));
+      void write(msgpack::packer<Stream>& o, const ValueType& x) const {
+        o.pack_bin_body((const char*)&x, sizeof(ValueType));
       }
     };
 
@@ -441,10 +456,10 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
           throw DIALS_ERROR("scitbx::af::ref<Shoebox>: msgpack type is not BIN");
         }
 
-        // Get the data and size
-        std::size_t binary_size = o.via.bin.size;
-        const char* binary_data = reinterpret_cast<const char*>(o.via.bin.ptr);
-        std::stringstream buffer(std::string(binary_data, binary_size));
+        // Read straight from the binary data, rather than copying it to a
+        // stream first
+        binary_reader buffer(reinterpret_cast<const char*>(o.via.bin.ptr),
+                             o.via.bin.size);
 
         // Stream into shoeboxes
         for (iterator it = v.begin(); it != v.end(); ++it) {
@@ -501,6 +516,23 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         return o;
       }
 
+      /**
+       * Read consecutive values from a block of binary data
+       */
+      struct binary_reader {
+        const char* ptr;
+        const char* end;
+
+        binary_reader(const char* data, std::size_t size)
+            : ptr(data), end(data + size) {}
+
+        void read(char* x, std::size_t n) {
+          DIALS_ASSERT(n <= (std::size_t)(end - ptr));
+          std::copy(ptr, ptr + n, x);
+          ptr += n;
+        }
+      };
+
       template <typename ValueType, typename Stream>
       ValueType read(Stream& buffer) const {
         ValueType x;
@@ -706,9 +738,18 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
      * The first entry identifies the data as a reflection table.
      * The second entry gives the version number in case this changes
      * The third entry is a dictionary containing data and metadata
+     *
+     * If a set of column names is given then only those columns are read. The
+     * data of the other columns is not touched, so when the msgpack buffer is
+     * a memory mapped file and the column data is unpacked by reference, it is
+     * never read from disk.
      */
     template <>
     struct convert<dials::af::reflection_table> {
+      const std::set<std::string>* columns_;
+
+      convert(const std::set<std::string>* columns = NULL) : columns_(columns) {}
+
       msgpack::object const& operator()(msgpack::object const& o,
                                         dials::af::reflection_table& v) const {
         typedef dials::af::reflection_table::key_type key_type;
@@ -829,6 +870,9 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
             key_type key;
             mapped_type value;
             it->key.convert(key);
+            if (columns_ != NULL && columns_->count(key) == 0) {
+              continue;
+            }
             it->val.convert(value);
             v[key] = value;
           }
@@ -18,8 +18,11 @@
 #include <iomanip>
 #include <algorithm>
 #include <numeric>
+#include <limits>
 #include <list>
 #include <vector>
+#include <boost/bind.hpp>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/array_family/reflection_table.h>
@@ -39,23 +42,33 @@ namespace dials { namespace af {
      * Initialise the index array. Determine which reflections are recorded on
      * each frame and panel ahead of time to enable quick lookup of the
      * reflections to be written to when processing each image.
+     * @param data The reflection table
+     * @param npanels The number of panels
+     * @param frame0 The first frame
+     * @param frame1 The last frame
+     * @param nthreads The number of threads to extract each frame with
      */
     ShoeboxExtractor(af::reflection_table data,
                      std::size_t npanels,
                      int frame0,
-                     int frame1)
+                     int frame1,
+                     std::size_t nthreads = 1)
         : npanels_(npanels),
           frame0_(frame0),
           frame1_(frame1),
           frame_(frame0),
-          nframes_(frame1 - frame0) {
+          nframes_(frame1 - frame0),
+          nthreads_(nthreads),
+          overload_(npanels, std::numeric_limits<double>::infinity()) {
       DIALS_ASSERT(frame0_ < frame1_);
       DIALS_ASSERT(npanels_ > 0);
+      DIALS_ASSERT(nthreads_ > 0);
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.contains("panel"));
       DIALS_ASSERT(data.contains("bbox"));
       DIALS_ASSERT(data.contains("shoebox"));
       shoebox_ = data["shoebox"];
+      overloaded_ = af::shared<bool>(shoebox_.size(), false);
       af::const_ref<std::size_t> panel = data["panel"];
       af::const_ref<int6> bbox = data["bbox"];
       std::size_t size = nframes_ * npanels_;
@@ -91,61 +104,50 @@ namespace dials { namespace af {
 
     /**
      * Extract the pixels from the image and copy to the relevant shoeboxes.
+     * The reflections recorded on the frame are consecutive in the index
+     * array, panel by panel, so they are split into bands across all the
+     * panels. Each reflection is recorded on one panel per frame, so each
+     * shoebox is only written by one thread.
      * @param image The image to process
-     * @param frame The current image frame
      */
     template <typename T>
     void next(const Image<T>& image) {
-      typedef Shoebox<>::float_type float_type;
-      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
-      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
       DIALS_ASSERT(frame_ >= frame0_ && frame_ < frame1_);
       DIALS_ASSERT(image.npanels() == npanels_);
       for (std::size_t p = 0; p < image.npanels(); ++p) {
-        af::const_ref<std::size_t> ind = indices(frame_, p);
-        af::const_ref<T, af::c_grid<2> > data = image.data(p);
-        af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
-        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-        for (std::size_t i = 0; i < ind.size(); ++i) {
-          DIALS_ASSERT(ind[i] < shoebox_.size());
-          Shoebox<>& sbox = shoebox_[ind[i]];
-          int6 b = sbox.bbox;
-          sbox_data_type sdata = sbox.data.ref();
-          sbox_mask_type smask = sbox.mask.ref();
-          DIALS_ASSERT(b[1] > b[0]);
-          DIALS_ASSERT(b[3] > b[2]);
-          DIALS_ASSERT(b[5] > b[4]);
-          DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
-          int x0 = b[0];
-          int x1 = b[1];
-          int y0 = b[2];
-          int y1 = b[3];
-          int z0 = b[4];
-          std::size_t xs = x1 - x0;
-          std::size_t ys = y1 - y0;
-          std::size_t z = frame_ - z0;
-          std::size_t yi = data.accessor()[0];
-          std::size_t xi = data.accessor()[1];
-          int xb = x0 >= 0 ? 0 : std::abs(x0);
-          int yb = y0 >= 0 ? 0 : std::abs(y0);
-          int xe = x1 <= xi ? xs : xs - (x1 - (int)xi);
-          int ye = y1 <= yi ? ys : ys - (y1 - (int)yi);
-          DIALS_ASSERT(ye > yb && yb >= 0 && ye <= ys);
-          DIALS_ASSERT(xe > xb && xb >= 0 && xe <= xs);
-          DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
-          DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
-          DIALS_ASSERT(sbox.is_consistent());
-          for (std::size_t y = yb; y < ye; ++y) {
-            for (std::size_t x = xb; x < xe; ++x) {
-              sdata(z, y, x) = data(y + y0, x + x0);
-              smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
-            }
-          }
-        }
+        DIALS_ASSERT(image.data(p).accessor().all_eq(image.mask(p).accessor()));
       }
+      std::size_t j0 = (frame_ - frame0_) * npanels_;
+      DIALS_ASSERT(j0 + npanels_ < offset_.size());
+      std::size_t first = offset_[j0];
+      std::size_t last = offset_[j0 + npanels_];
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(
+          &ShoeboxExtractor::extract_band<T>, this, boost::cref(image), first, _1, _2),
+        last - first,
+        nthreads_);
       frame_++;
     }
 
+    /**
+     * Check for overloads while extracting the pixels. Pixels at or above the
+     * overload value of their panel are not marked as valid, as by the
+     * OverloadChecker, but without a second pass over the shoeboxes.
+     * @param overload The overload value for each panel
+     */
+    void set_overload(const af::const_ref<double>& overload) {
+      DIALS_ASSERT(overload.size() == npanels_);
+      DIALS_ASSERT(frame_ == frame0_);
+      std::copy(overload.begin(), overload.end(), overload_.begin());
+    }
+
+    /**
+     * @returns True/False the shoebox contains overloaded pixels
+     */
+    af::shared<bool> overloaded() const {
+      return overloaded_;
+    }
+
     /** @returns The first frame.  */
     int frame0() const {
       return frame0_;
@@ -179,6 +181,95 @@ namespace dials { namespace af {
     }
 
   private:
+    /**
+     * Extract the pixels for the reflections [first, last) of the current
+     * frame, counting from the index array position offset.
+     */
+    template <typename T>
+    void extract_band(const Image<T>& image,
+                      std::size_t offset,
+                      std::size_t first,
+                      std::size_t last) {
+      if (first == last) {
+        return;
+      }
+
+      // Find the panel of the first reflection in the band
+      const std::size_t* panel_offset = &offset_[(frame_ - frame0_) * npanels_];
+      std::size_t p =
+        std::upper_bound(panel_offset, panel_offset + npanels_ + 1, offset + first)
+        - panel_offset - 1;
+      af::const_ref<T, af::c_grid<2> > data = image.data(p);
+      af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
+      for (std::size_t k = offset + first; k < offset + last; ++k) {
+        if (panel_offset[p + 1] <= k) {
+          while (panel_offset[p + 1] <= k) {
+            p++;
+          }
+          data = image.data(p);
+          mask = image.mask(p);
+        }
+        DIALS_ASSERT(indices_[k] < shoebox_.size());
+        if (extract(data, mask, overload_[p], shoebox_[indices_[k]])) {
+          overloaded_[indices_[k]] = true;
+        }
+      }
+    }
+
+    /**
+     * Copy the pixels on the current frame into a shoebox, a row at a time.
+     * Returns true if any pixels were at or above the overload value.
+     */
+    template <typename T>
+    bool extract(const af::const_ref<T, af::c_grid<2> >& data,
+                 const af::const_ref<bool, af::c_grid<2> >& mask,
+                 double overload,
+                 Shoebox<>& sbox) {
+      typedef Shoebox<>::float_type float_type;
+      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
+      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
+      int6 b = sbox.bbox;
+      sbox_data_type sdata = sbox.data.ref();
+      sbox_mask_type smask = sbox.mask.ref();
+      DIALS_ASSERT(b[1] > b[0]);
+      DIALS_ASSERT(b[3] > b[2]);
+      DIALS_ASSERT(b[5] > b[4]);
+      DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
+      int x0 = b[0];
+      int x1 = b[1];
+      int y0 = b[2];
+      int y1 = b[3];
+      int z0 = b[4];
+      std::size_t xs = x1 - x0;
+      std::size_t ys = y1 - y0;
+      std::size_t z = frame_ - z0;
+      std::size_t yi = data.accessor()[0];
+      std::size_t xi = data.accessor()[1];
+      int xb = x0 >= 0 ? 0 : std::abs(x0);
+      int yb = y0 >= 0 ? 0 : std::abs(y0);
+      int xe = x1 <= xi ? xs : xs - (x1 - (int)xi);
+      int ye = y1 <= yi ? ys : ys - (y1 - (int)yi);
+      DIALS_ASSERT(ye > yb && yb >= 0 && ye <= ys);
+      DIALS_ASSERT(xe > xb && xb >= 0 && xe <= xs);
+      DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
+      DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
+      DIALS_ASSERT(sbox.is_consistent());
+      std::size_t n = xe - xb;
+      int noverload = 0;
+      for (std::size_t y = yb; y < ye; ++y) {
+        const T* data_row = &data(y + y0, xb + x0);
+        const bool* mask_row = &mask(y + y0, xb + x0);
+        std::copy(data_row, data_row + n, &sdata(z, y, xb));
+        int* smask_row = &smask(z, y, xb);
+        for (std::size_t x = 0; x < n; ++x) {
+          int over = data_row[x] >= overload;
+          smask_row[x] = Valid & -((int)mask_row[x] & (over ^ 1));
+          noverload += over;
+        }
+      }
+      return noverload > 0;
+    }
+
     /**
      * Get an index array specifying which reflections are recorded on a given
      * frame and panel.
@@ -204,6 +295,9 @@ namespace dials { namespace af {
     int frame1_;
     int frame_;
     std::size_t nframes_;
+    std::size_t nthreads_;
+    std::vector<double> overload_;
+    af::shared<bool> overloaded_;
     af::shared<Shoebox<> > shoebox_;
     std::vector<std::size_t> indices_;
     std::vector<std::size_t> offset_;
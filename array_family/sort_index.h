@@ -39,6 +39,41 @@ namespace dials { namespace af {
     std::sort(begin, end, index_less<RandomAccessIterator>(v));
   }
 
+  /**
+   * Functor to compare in select_index. Equal values are ordered by index so
+   * the order is total and the selected indices do not depend on the order
+   * of the input.
+   */
+  template <class RandomAccessIterator>
+  struct index_less_or_first {
+    index_less_or_first(const RandomAccessIterator& v) : v_(v) {}
+
+    template <class IndexType>
+    bool operator()(const IndexType& x, const IndexType& y) const {
+      return v_[x] < v_[y] || (!(v_[y] < v_[x]) && x < y);
+    }
+    const RandomAccessIterator& v_;
+  };
+
+  /**
+   * Partially order a list of indices so that the nth index is the one that
+   * would be there if the list were sorted by value, with the indices before
+   * it having lower values and those after it higher values. This takes
+   * linear time rather than the time to sort the list. Equal values are
+   * ordered by index.
+   * @param begin The start of the indices
+   * @param nth The index to select
+   * @param end The end of the indices
+   * @param v The list of values
+   */
+  template <typename IndexIterator, typename RandomAccessIterator>
+  void select_index(IndexIterator begin,
+                    IndexIterator nth,
+                    IndexIterator end,
+                    RandomAccessIterator v) {
+    std::nth_element(begin, nth, end, index_less_or_first<RandomAccessIterator>(v));
+  }
+
 }}  // namespace dials::af
 
 #endif /* DIALS_ARRAY_FAMILY_SORT_INDEX_H */
@@ -35,6 +35,7 @@
 from dials.array_family import flex
 from dials.util import show_mail_on_error
 from dials.util.command_line import heading
+from dials.util.mp import mpi_stop_workers, mpi_worker
 from dials.util.options import OptionParser, reflections_and_experiments_from_files
 from dials.util.slice import slice_crystal
 from dials.util.version import dials_version
@@ -642,6 +643,29 @@ def run(args=None, phil=phil_scope):
 
     params, options = parser.parse_args(args=args, show_diff_phil=False)
 
+    # With MPI every rank runs this program. The other ranks only run the jobs
+    # sent to them by rank 0, which splits the blocks into at least one job for
+    # each of them.
+    if params.integration.mp.method == "mpi":
+        from mpi4py import MPI
+
+        comm = MPI.COMM_WORLD
+        if comm.Get_rank() > 0:
+            mpi_worker()
+            return
+        params.integration.mp.njobs = max(
+            params.integration.mp.njobs, comm.Get_size() - 1
+        )
+        try:
+            _run(parser, params, options)
+        finally:
+            mpi_stop_workers()
+    else:
+        _run(parser, params, options)
+
+
+def _run(parser, params, options):
+    """Integrate the data once the command line has been parsed."""
     # Configure the logging
     dials.util.log.config(verbosity=options.verbose, logfile=params.output.log)
 
@@ -83,6 +83,11 @@
       .type = choice
       .help = "Which image to use"
 
+    images_per_task = 1
+      .type = int(value_min=1)
+      .help = "The number of consecutive images to process in each task. Larger"
+              "values reduce the per task overhead when there are many images."
+
   }
 
   include scope dials.algorithms.integration.integrator.phil_scope
@@ -48,6 +48,9 @@
     .type = bool
     .optional = True
     .short_caption = Ignore masks from dxtbx class
+  nproc = 1
+    .type = int(value_min=1)
+    .short_caption = Number of threads to map the images with
 }
 """,
     process_includes=True,
@@ -90,6 +93,7 @@ def run(self):
         self.grid_size = params.rs_mapper.grid_size
         self.max_resolution = params.rs_mapper.max_resolution
         self.ignore_mask = params.rs_mapper.ignore_mask
+        self.nproc = params.rs_mapper.nproc
 
         self.grid = flex.double(
             flex.grid(self.grid_size, self.grid_size, self.grid_size), 0
@@ -120,8 +124,6 @@ def run(self):
         )
 
     def process_imageset(self, imageset):
-        rec_range = 1 / self.max_resolution
-
         if len(imageset.get_detector()) != 1:
             raise Sorry("This program does not support multi-panel detectors.")
 
@@ -134,29 +136,35 @@ def process_imageset(self, imageset):
             raise Sorry("This program does not support non-square pixels.")
 
         # cache transformation
-        xy = recviewer.get_target_pixels(panel, s0, xlim, ylim, self.max_resolution)
-        s1 = panel.get_lab_coord(xy * pixel_size[0])
-        s1 = s1 / s1.norms() * (1 / beam.get_wavelength())
-        S = s1 - s0
+        axis = imageset.get_goniometer().get_rotation_axis()
+        mapper = recviewer.VoxelMapper(
+            panel,
+            s0,
+            axis,
+            xlim,
+            ylim,
+            self.max_resolution,
+            self.grid_size,
+            nthreads=self.nproc,
+        )
 
         for i in range(len(imageset)):
-            axis = imageset.get_goniometer().get_rotation_axis()
             osc_range = imageset.get_scan(i).get_oscillation_range()
             print("Oscillation range: %.2f - %.2f" % (osc_range[0], osc_range[1]))
             angle = (osc_range[0] + osc_range[1]) / 2 / 180 * math.pi
             if not self.reverse_phi:
                 # the pixel is in S AFTER rotation. Thus we have to rotate BACK.
                 angle *= -1
-            rotated_S = S.rotate_around_origin(axis, angle)
 
             data = imageset.get_raw_data(i)[0]
-            if not self.ignore_mask:
+            if self.ignore_mask:
+                mask = flex.bool(data.accessor(), True)
+            else:
                 mask = imageset.get_mask(i)[0]
-                data.set_selected(~mask, 0)
 
-            recviewer.fill_voxels(
-                data, self.grid, self.counts, rotated_S, xy, rec_range
-            )
+            mapper.add_image(data, mask, angle)
+
+        mapper.accumulate(self.grid, self.counts)
 
 
 if __name__ == "__main__":
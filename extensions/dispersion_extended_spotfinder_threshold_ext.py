@@ -31,6 +31,13 @@ def __init__(self, params):
         :param params: The input parameters
         """
         self.params = params
+        self._algorithm = None
+
+    def __getstate__(self):
+        # The threshold algorithm is not pickleable
+        state = self.__dict__.copy()
+        state["_algorithm"] = None
+        return state
 
     def compute_threshold(self, image, mask):
         """
@@ -51,6 +58,12 @@ def compute_threshold(self, image, mask):
                 % (params.spotfinder.threshold.dispersion.global_threshold)
             )
 
+        # The threaded algorithm holds a thread pool, so keep it for the
+        # next image rather than starting new threads each time
+        nthreads = params.spotfinder.threshold.dispersion.nthreads
+        if self._algorithm is not None and nthreads > 1:
+            return self._algorithm(image, mask)
+
         self._algorithm = DispersionExtendedThresholdStrategy(
             kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
             gain=params.spotfinder.threshold.dispersion.gain,
@@ -59,6 +72,7 @@ def compute_threshold(self, image, mask):
             n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
             min_count=params.spotfinder.threshold.dispersion.min_local,
             global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
+            nthreads=nthreads,
         )
 
         return self._algorithm(image, mask)
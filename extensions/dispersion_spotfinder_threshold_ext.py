@@ -61,6 +61,15 @@ def phil():
         .type = float
         .help = "The global threshold value. Consider all pixels less than this"
                 "value to be part of the background."
+
+      nthreads = 1
+        .type = int(value_min=1)
+        .help = "The number of threads used to threshold each image. If more"
+                "than one, each image is split into horizontal bands which are"
+                "thresholded in parallel. This is independent of"
+                "spotfinder.mp.nproc, which processes images in separate"
+                "processes."
+        .expert_level = 1
     """
         )
         return phil
@@ -72,6 +81,13 @@ def __init__(self, params):
         :param params: The input parameters
         """
         self.params = params
+        self._algorithm = None
+
+    def __getstate__(self):
+        # The threshold algorithm is not pickleable
+        state = self.__dict__.copy()
+        state["_algorithm"] = None
+        return state
 
     def compute_threshold(self, image, mask):
         """
@@ -96,6 +112,13 @@ def compute_threshold(self, image, mask):
 
         from dials.algorithms.spot_finding.threshold import DispersionThresholdStrategy
 
+        # The threaded algorithm holds a thread pool and the serial algorithm
+        # holds the threshold prepared for the mask, so keep them for the next
+        # image rather than creating them again each time
+        nthreads = params.spotfinder.threshold.dispersion.nthreads
+        if self._algorithm is not None:
+            return self._algorithm(image, mask)
+
         self._algorithm = DispersionThresholdStrategy(
             kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
             gain=params.spotfinder.threshold.dispersion.gain,
@@ -104,6 +127,7 @@ def compute_threshold(self, image, mask):
             n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
             min_count=params.spotfinder.threshold.dispersion.min_local,
             global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
+            nthreads=nthreads,
         )
 
         return self._algorithm(image, mask)
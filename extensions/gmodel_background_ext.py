@@ -30,7 +30,9 @@ def phil():
 
       model = None
         .type = str
-        .help = "The model filename"
+        .help = "The model filename. This is either a pickled model or a"
+                "model file written by StaticBackgroundModel.write, which"
+                "is mapped into memory and shared between processes"
     """
         )
         return phil
@@ -16,14 +16,18 @@ def __init__(self, params, experiments):
         """
         self.experiments = experiments
 
-    def compute_centroid(self, reflections, image_volume=None):
+    def compute_centroid(self, reflections, image_volume=None, nthreads=1):
         """
         Compute the centroid.
 
         :param reflections: The list of reflections
+        :param nthreads: The number of threads to use
         """
         import dials.algorithms.centroid.simple
 
         return dials.algorithms.centroid.simple.centroid(
-            self.experiments, reflections, image_volume=image_volume
+            self.experiments,
+            reflections,
+            image_volume=image_volume,
+            nthreads=nthreads,
         )
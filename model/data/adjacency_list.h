@@ -11,9 +11,11 @@
 #ifndef DIALS_MODEL_ADJACENCY_LIST_H
 #define DIALS_MODEL_ADJACENCY_LIST_H
 
+#include <algorithm>
 #include <iostream>
-#include <deque>
 #include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 #include <dials/error.h>
 
 namespace dials { namespace model {
@@ -27,15 +29,88 @@ namespace dials { namespace model {
   // typedef boost_adaptbx::graph_type::adjacency_list_undirected_vecS_setS_type
   // AdjacencyList;
 
+  /**
+   * An undirected graph stored in compressed sparse row form. Each edge is
+   * stored once in each direction; the targets of the edges leaving vertex i
+   * are held sorted in target_[offset_[i]] to target_[offset_[i + 1]]. Edges
+   * added with add_edge are held in a pending list until finish() is called.
+   * The targets are stored as 32 bit indices so the graph takes 8 bytes per
+   * overlap plus the offsets.
+   */
   class AdjacencyList {
   public:
+    typedef boost::uint32_t vertex_type;
     typedef std::pair<std::size_t, std::size_t> edge_descriptor;
-    typedef std::deque<edge_descriptor> edge_list;
-    typedef edge_list::const_iterator edge_iterator;
+    typedef const vertex_type *adjacent_vertex_iterator;
+    typedef std::pair<adjacent_vertex_iterator, adjacent_vertex_iterator>
+      adjacent_vertex_iterator_range;
+
+    /**
+     * An iterator over the edges. The edges are generated from the compressed
+     * rows so the iterator dereferences to a value rather than a reference.
+     */
+    class edge_iterator : public boost::iterator_facade<edge_iterator,
+                                                        const edge_descriptor,
+                                                        boost::forward_traversal_tag,
+                                                        edge_descriptor> {
+    public:
+      edge_iterator() : offset_(0), target_(0), num_vertices_(0), vertex_(0), index_(0) {}
+
+      edge_iterator(const std::size_t *offset,
+                    const vertex_type *target,
+                    std::size_t num_vertices,
+                    std::size_t vertex,
+                    std::size_t index)
+          : offset_(offset),
+            target_(target),
+            num_vertices_(num_vertices),
+            vertex_(vertex),
+            index_(index) {
+        skip_empty();
+      }
+
+    private:
+      friend class boost::iterator_core_access;
+
+      edge_descriptor dereference() const {
+        return edge_descriptor(vertex_, target_[index_]);
+      }
+
+      bool equal(const edge_iterator &other) const {
+        return index_ == other.index_;
+      }
+
+      void increment() {
+        ++index_;
+        skip_empty();
+      }
+
+      void skip_empty() {
+        while (vertex_ < num_vertices_ && offset_[vertex_ + 1] <= index_) {
+          ++vertex_;
+        }
+      }
+
+      const std::size_t *offset_;
+      const vertex_type *target_;
+      std::size_t num_vertices_;
+      std::size_t vertex_;
+      std::size_t index_;
+    };
+
     typedef std::pair<edge_iterator, edge_iterator> edge_iterator_range;
 
     AdjacencyList(std::size_t num_vertices)
-        : offset_(num_vertices + 1), num_vertices_(num_vertices), consistent_(false) {}
+        : offset_(num_vertices + 1, 0), num_vertices_(num_vertices), consistent_(true) {
+      DIALS_ASSERT(num_vertices <= max_vertices());
+    }
+
+    /**
+     * @returns The maximum number of vertices which can be indexed
+     */
+    static std::size_t max_vertices() {
+      return static_cast<std::size_t>(static_cast<vertex_type>(-1));
+    }
 
     std::size_t source(edge_descriptor edge) const {
       DIALS_ASSERT(consistent_);
@@ -49,39 +124,105 @@ namespace dials { namespace model {
 
     edge_iterator_range edges() const {
       DIALS_ASSERT(consistent_);
-      return edge_iterator_range(edges_.begin(), edges_.end());
+      return edge_iterator_range(make_iterator(0, 0),
+                                 make_iterator(num_vertices_, target_.size()));
     }
 
     edge_iterator_range edges(std::size_t i) const {
       DIALS_ASSERT(consistent_);
       DIALS_ASSERT(i < num_vertices());
-      DIALS_ASSERT(i < offset_.size() - 1);
       std::size_t o1 = offset_[i];
       std::size_t o2 = offset_[i + 1];
       DIALS_ASSERT(o2 >= o1);
-      DIALS_ASSERT(o2 <= edges_.size());
-      return edge_iterator_range(edges_.begin() + o1, edges_.begin() + o2);
+      DIALS_ASSERT(o2 <= target_.size());
+      return edge_iterator_range(make_iterator(i, o1), make_iterator(i, o2));
+    }
+
+    /**
+     * Get the vertices adjacent to a vertex in constant time.
+     * @param i The vertex
+     * @returns The sorted range of adjacent vertices
+     */
+    adjacent_vertex_iterator_range adjacent_vertices(std::size_t i) const {
+      DIALS_ASSERT(consistent_);
+      DIALS_ASSERT(i < num_vertices());
+      const vertex_type *first = target_.empty() ? NULL : &target_[0];
+      return adjacent_vertex_iterator_range(first + offset_[i], first + offset_[i + 1]);
     }
 
     void add_edge(std::size_t a, std::size_t b) {
       consistent_ = false;
-      DIALS_ASSERT(num_vertices());
-      DIALS_ASSERT(num_vertices());
-      edges_.push_back(edge_descriptor(a, b));
-      edges_.push_back(edge_descriptor(b, a));
+      DIALS_ASSERT(a < num_vertices());
+      DIALS_ASSERT(b < num_vertices());
+      pending_.push_back(edge_descriptor(a, b));
     }
 
+    /**
+     * Build the compressed rows from the existing and pending edges
+     */
     void finish() {
-      std::sort(edges_.begin(), edges_.end());
-      std::vector<std::size_t> num(num_vertices());
-      for (std::size_t i = 0; i < edges_.size(); ++i) {
-        num[edges_[i].first]++;
+      if (pending_.empty()) {
+        consistent_ = true;
+        return;
+      }
+
+      // Count the edges leaving each vertex
+      std::vector<std::size_t> offset(num_vertices_ + 1, 0);
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        offset[i + 1] = offset_[i + 1] - offset_[i];
       }
-      offset_[0] = 0;
-      for (std::size_t i = 0; i < num.size(); ++i) {
-        offset_[i + 1] = offset_[i] + num[i];
+      for (std::size_t i = 0; i < pending_.size(); ++i) {
+        offset[pending_[i].first + 1]++;
+        offset[pending_[i].second + 1]++;
+      }
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        offset[i + 1] += offset[i];
+      }
+
+      // Fill in the targets and sort the targets of each vertex
+      std::vector<vertex_type> target(offset.back());
+      std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        for (std::size_t j = offset_[i]; j < offset_[i + 1]; ++j) {
+          target[next[i]++] = target_[j];
+        }
       }
-      DIALS_ASSERT(offset_.back() == edges_.size());
+      for (std::size_t i = 0; i < pending_.size(); ++i) {
+        std::size_t a = pending_[i].first;
+        std::size_t b = pending_[i].second;
+        target[next[a]++] = static_cast<vertex_type>(b);
+        target[next[b]++] = static_cast<vertex_type>(a);
+      }
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        std::sort(target.begin() + offset[i], target.begin() + offset[i + 1]);
+      }
+      std::vector<edge_descriptor>().swap(pending_);
+      offset_.swap(offset);
+      target_.swap(target);
+      consistent_ = true;
+    }
+
+    /**
+     * Replace the graph with prebuilt compressed rows. The targets of each
+     * vertex must be sorted and every edge must be present in both
+     * directions. The input vectors are swapped into the graph.
+     * @param offset The row offsets (num_vertices + 1)
+     * @param target The edge targets
+     */
+    void assign(std::vector<std::size_t> &offset, std::vector<vertex_type> &target) {
+      DIALS_ASSERT(offset.size() == num_vertices_ + 1);
+      DIALS_ASSERT(offset.front() == 0);
+      DIALS_ASSERT(offset.back() == target.size());
+      DIALS_ASSERT((target.size() & 1) == 0);
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        DIALS_ASSERT(offset[i] <= offset[i + 1]);
+      }
+      for (std::size_t i = 0; i < target.size(); ++i) {
+        DIALS_ASSERT(target[i] < num_vertices_);
+      }
+      offset_.swap(offset);
+      target_.swap(target);
+      pending_.clear();
       consistent_ = true;
     }
 
@@ -90,8 +231,20 @@ namespace dials { namespace model {
     }
 
     std::size_t num_edges() const {
-      DIALS_ASSERT((edges_.size() & 1) == 0);
-      return edges_.size() / 2;
+      DIALS_ASSERT((target_.size() & 1) == 0);
+      return target_.size() / 2 + pending_.size();
+    }
+
+    /** @returns The row offsets */
+    const std::vector<std::size_t> &offsets() const {
+      DIALS_ASSERT(consistent_);
+      return offset_;
+    }
+
+    /** @returns The edge targets */
+    const std::vector<vertex_type> &targets() const {
+      DIALS_ASSERT(consistent_);
+      return target_;
     }
 
     std::size_t vertex_num_edges(std::size_t i) const {
@@ -103,8 +256,17 @@ namespace dials { namespace model {
     }
 
   private:
-    edge_list edges_;
+    edge_iterator make_iterator(std::size_t vertex, std::size_t index) const {
+      return edge_iterator(&offset_[0],
+                           target_.empty() ? NULL : &target_[0],
+                           num_vertices_,
+                           vertex,
+                           index);
+    }
+
     std::vector<std::size_t> offset_;
+    std::vector<vertex_type> target_;
+    std::vector<edge_descriptor> pending_;
     std::size_t num_vertices_;
     bool consistent_;
   };
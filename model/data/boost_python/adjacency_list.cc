@@ -8,23 +8,28 @@
  *  This code is distributed under the BSD license, a copy of which is
  *  included in the root directory of this package.
  */
+#include <sstream>
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <boost/python/iterator.hpp>
 #include <boost_adaptbx/std_pair_conversion.h>
 #include <boost/iterator/transform_iterator.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/adjacency_list.h>
+#include <dials/error.h>
+#include <msgpack.hpp>
 
 namespace dials { namespace model { namespace boost_python {
 
   using namespace boost::python;
 
   struct adjacent_vertices_iterator {
-    AdjacencyList::edge_iterator first_;
-    AdjacencyList::edge_iterator last_;
+    AdjacencyList::adjacent_vertex_iterator first_;
+    AdjacencyList::adjacent_vertex_iterator last_;
 
-    adjacent_vertices_iterator(AdjacencyList::edge_iterator first,
-                               AdjacencyList::edge_iterator last)
+    adjacent_vertices_iterator(AdjacencyList::adjacent_vertex_iterator first,
+                               AdjacencyList::adjacent_vertex_iterator last)
         : first_(first), last_(last) {}
 
     std::size_t next() {
@@ -32,7 +37,7 @@ namespace dials { namespace model { namespace boost_python {
         PyErr_SetString(PyExc_StopIteration, "No more data.");
         boost::python::throw_error_already_set();
       }
-      std::size_t result = first_->second;
+      std::size_t result = *first_;
       first_++;
       return result;
     }
@@ -62,23 +67,167 @@ namespace dials { namespace model { namespace boost_python {
 
   adjacent_vertices_iterator make_adjacent_vertices_iterator(const AdjacencyList &self,
                                                              std::size_t index) {
-    return adjacent_vertices_iterator(self.edges(index).first,
-                                      self.edges(index).second);
+    AdjacencyList::adjacent_vertex_iterator_range range =
+      self.adjacent_vertices(index);
+    return adjacent_vertices_iterator(range.first, range.second);
   }
 
+  /**
+   * @returns The row offsets of the compressed graph
+   */
+  af::shared<std::size_t> get_offsets(const AdjacencyList &self) {
+    const std::vector<std::size_t> &offsets = self.offsets();
+    return af::shared<std::size_t>(offsets.begin(), offsets.end());
+  }
+
+  /**
+   * @returns The edge targets of the compressed graph
+   */
+  af::shared<std::size_t> get_targets(const AdjacencyList &self) {
+    const std::vector<AdjacencyList::vertex_type> &targets = self.targets();
+    return af::shared<std::size_t>(targets.begin(), targets.end());
+  }
+
+  /**
+   * Construct the graph from the compressed rows
+   */
+  AdjacencyList *make_from_csr(std::size_t num_vertices,
+                               const af::const_ref<std::size_t> &offsets,
+                               const af::const_ref<std::size_t> &targets) {
+    std::vector<std::size_t> offset(offsets.begin(), offsets.end());
+    std::vector<AdjacencyList::vertex_type> target(targets.size());
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+      DIALS_ASSERT(targets[i] < num_vertices);
+      target[i] = static_cast<AdjacencyList::vertex_type>(targets[i]);
+    }
+    AdjacencyList *result = new AdjacencyList(num_vertices);
+    try {
+      result->assign(offset, target);
+    } catch (...) {
+      delete result;
+      throw;
+    }
+    return result;
+  }
+
+  /**
+   * Pack the graph in msgpack format. The graph is stored as an array of the
+   * number of vertices, the row offsets as 64 bit integers and the targets as
+   * 32 bit integers, with the arrays packed as binary blobs.
+   * @param self The adjacency list
+   * @returns The msgpack string
+   */
+  boost::python::object adjacency_list_as_msgpack(const AdjacencyList &self) {
+    const std::vector<std::size_t> &offsets = self.offsets();
+    const std::vector<AdjacencyList::vertex_type> &targets = self.targets();
+    std::vector<boost::uint64_t> offset(offsets.begin(), offsets.end());
+    std::stringstream buffer;
+    msgpack::packer<std::stringstream> packer(buffer);
+    packer.pack_array(3);
+    packer.pack(self.num_vertices());
+    packer.pack_bin(offset.size() * sizeof(boost::uint64_t));
+    packer.pack_bin_body(reinterpret_cast<const char *>(&offset[0]),
+                         offset.size() * sizeof(boost::uint64_t));
+    packer.pack_bin(targets.size() * sizeof(AdjacencyList::vertex_type));
+    packer.pack_bin_body(
+      targets.empty() ? NULL : reinterpret_cast<const char *>(&targets[0]),
+      targets.size() * sizeof(AdjacencyList::vertex_type));
+    std::string data = buffer.str();
+    return boost::python::object(
+      boost::python::handle<>(PyBytes_FromStringAndSize(data.c_str(), data.size())));
+  }
+
+  /**
+   * Unpack the graph from msgpack format
+   * @param packed The msgpack string
+   * @returns The adjacency list
+   */
+  AdjacencyList *adjacency_list_from_msgpack(boost::python::object packed) {
+    const char *data = PyBytes_AsString(packed.ptr());
+    DIALS_ASSERT(data != NULL);
+    std::size_t size = PyBytes_Size(packed.ptr());
+    msgpack::unpacked result;
+    msgpack::unpack(result, data, size);
+    msgpack::object obj = result.get();
+    if (obj.type != msgpack::type::ARRAY || obj.via.array.size != 3) {
+      throw DIALS_ERROR("AdjacencyList: msgpack object is not an array of size 3");
+    }
+    const msgpack::object &offset_obj = obj.via.array.ptr[1];
+    const msgpack::object &target_obj = obj.via.array.ptr[2];
+    if (offset_obj.type != msgpack::type::BIN || target_obj.type != msgpack::type::BIN) {
+      throw DIALS_ERROR("AdjacencyList: msgpack arrays are not BIN");
+    }
+    if (offset_obj.via.bin.size % sizeof(boost::uint64_t) != 0
+        || target_obj.via.bin.size % sizeof(AdjacencyList::vertex_type) != 0) {
+      throw DIALS_ERROR("AdjacencyList: msgpack bin data does not have correct size");
+    }
+    std::size_t num_vertices = obj.via.array.ptr[0].as<std::size_t>();
+    const boost::uint64_t *offset_first =
+      reinterpret_cast<const boost::uint64_t *>(offset_obj.via.bin.ptr);
+    const AdjacencyList::vertex_type *target_first =
+      reinterpret_cast<const AdjacencyList::vertex_type *>(target_obj.via.bin.ptr);
+    std::vector<std::size_t> offset(
+      offset_first, offset_first + offset_obj.via.bin.size / sizeof(boost::uint64_t));
+    std::vector<AdjacencyList::vertex_type> target(
+      target_first,
+      target_first + target_obj.via.bin.size / sizeof(AdjacencyList::vertex_type));
+    AdjacencyList *list = new AdjacencyList(num_vertices);
+    try {
+      list->assign(offset, target);
+    } catch (...) {
+      delete list;
+      throw;
+    }
+    return list;
+  }
+
+  /**
+   * Pickle the graph using the msgpack representation
+   */
+  struct AdjacencyListPickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const AdjacencyList &obj) {
+      return boost::python::make_tuple(obj.num_vertices());
+    }
+
+    static boost::python::tuple getstate(const AdjacencyList &obj) {
+      return boost::python::make_tuple(adjacency_list_as_msgpack(obj));
+    }
+
+    static void setstate(AdjacencyList &obj, boost::python::tuple state) {
+      DIALS_ASSERT(boost::python::len(state) == 1);
+      boost::scoped_ptr<AdjacencyList> other(adjacency_list_from_msgpack(state[0]));
+      DIALS_ASSERT(other->num_vertices() == obj.num_vertices());
+      obj = *other;
+    }
+  };
+
   void export_adjacency_list() {
     class_<AdjacencyList::edge_descriptor>("EdgeDescriptor", no_init);
 
     iterator_wrapper<adjacent_vertices_iterator>::wrap("AdjacentVerticesIter");
 
     class_<AdjacencyList>("AdjacencyList", no_init)
+      .def(init<std::size_t>((arg("num_vertices"))))
+      .def("__init__",
+           make_constructor(&make_from_csr,
+                            default_call_policies(),
+                            (arg("num_vertices"), arg("offsets"), arg("targets"))))
       .def("source", &AdjacencyList::source)
       .def("target", &AdjacencyList::target)
       .def("adjacent_vertices", &make_adjacent_vertices_iterator)
       .def("edges", boost::python::range(edges_begin, edges_end))
       .def("add_edge", &AdjacencyList::add_edge)
+      .def("finish", &AdjacencyList::finish)
       .def("num_vertices", &AdjacencyList::num_vertices)
-      .def("num_edges", &AdjacencyList::num_edges);
+      .def("num_edges", &AdjacencyList::num_edges)
+      .def("offsets", &get_offsets)
+      .def("targets", &get_targets)
+      .def("as_msgpack", &adjacency_list_as_msgpack)
+      .def("from_msgpack",
+           &adjacency_list_from_msgpack,
+           return_value_policy<manage_new_object>())
+      .staticmethod("from_msgpack")
+      .def_pickle(AdjacencyListPickleSuite());
   }
 
 }}}  // namespace dials::model::boost_python
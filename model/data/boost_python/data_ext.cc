@@ -10,6 +10,7 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/memory_accounting.h>
 
 namespace dials { namespace model { namespace boost_python {
 
@@ -25,6 +26,7 @@ namespace dials { namespace model { namespace boost_python {
   void export_adjacency_list();
 
   BOOST_PYTHON_MODULE(dials_model_data_ext) {
+    dials::util::boost_python::import_memory_accounting();
     export_image_volume();
     export_observation();
     export_prediction();
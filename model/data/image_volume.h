@@ -11,7 +11,9 @@
 #ifndef DIALS_MODEL_DATA_IMAGE_VOLUME_H
 #define DIALS_MODEL_DATA_IMAGE_VOLUME_H
 
+#include <vector>
 #include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/image.h>
@@ -35,6 +37,88 @@ namespace dials { namespace model {
     int second;
   };
 
+  /**
+   * The labels of the pixels in an image volume. Only foreground pixels are
+   * labelled, so the labels are stored in tiles of 64x64 pixels on each frame
+   * which are only allocated when a pixel in them is first labelled. Copies
+   * share the same labels, like the other image volume arrays.
+   */
+  class LabelTiles {
+  public:
+    static const std::size_t tile_size = 64;
+
+    LabelTiles() : ny_(0), nx_(0), tiles_(new tile_list()) {}
+
+    /**
+     * @param grid The size of the image volume
+     */
+    LabelTiles(af::c_grid<3> grid)
+        : grid_(grid),
+          ny_((grid[1] + tile_size - 1) / tile_size),
+          nx_((grid[2] + tile_size - 1) / tile_size),
+          tiles_(new tile_list(grid[0] * ny_ * nx_)) {}
+
+    /**
+     * @returns The size of the image volume
+     */
+    af::c_grid<3> accessor() const {
+      return grid_;
+    }
+
+    /**
+     * @returns The label of a pixel, which is empty if it was never set
+     */
+    const Label &get(std::size_t k, std::size_t j, std::size_t i) const {
+      static const Label empty;
+      const tile_type &tile = (*tiles_)[tile_index(k, j, i)];
+      return tile.empty() ? empty : tile[pixel_index(j, i)];
+    }
+
+    /**
+     * @returns The label of a pixel to modify, allocating its tile if needed
+     */
+    Label &set(std::size_t k, std::size_t j, std::size_t i) {
+      tile_type &tile = (*tiles_)[tile_index(k, j, i)];
+      if (tile.empty()) {
+        tile.resize(tile_size * tile_size);
+      }
+      return tile[pixel_index(j, i)];
+    }
+
+    /**
+     * @returns The labels as a full array
+     */
+    af::versa<Label, af::c_grid<3> > as_versa() const {
+      af::versa<Label, af::c_grid<3> > result(grid_);
+      for (std::size_t k = 0; k < grid_[0]; ++k) {
+        for (std::size_t j = 0; j < grid_[1]; ++j) {
+          for (std::size_t i = 0; i < grid_[2]; ++i) {
+            result(k, j, i) = get(k, j, i);
+          }
+        }
+      }
+      return result;
+    }
+
+  private:
+    typedef std::vector<Label> tile_type;
+    typedef std::vector<tile_type> tile_list;
+
+    std::size_t tile_index(std::size_t k, std::size_t j, std::size_t i) const {
+      DIALS_ASSERT(k < grid_[0] && j < grid_[1] && i < grid_[2]);
+      return (k * ny_ + j / tile_size) * nx_ + i / tile_size;
+    }
+
+    std::size_t pixel_index(std::size_t j, std::size_t i) const {
+      return (j % tile_size) * tile_size + i % tile_size;
+    }
+
+    af::c_grid<3> grid_;
+    std::size_t ny_;
+    std::size_t nx_;
+    boost::shared_ptr<tile_list> tiles_;
+  };
+
   /**
    * A class to hold stuff for an image volume
    */
@@ -113,7 +197,7 @@ namespace dials { namespace model {
      * @returns The labels
      */
     af::versa<Label, af::c_grid<3> > label1() const {
-      return label_;
+      return label_.as_versa();
     }
 
     /**
@@ -218,7 +302,7 @@ namespace dials { namespace model {
             std::size_t l = grid_(k + k0, j + j0, i + i0);
             int value = mask_[l];
             if (value & Foreground) {
-              const Label &label = label_[l];
+              const Label &label = label_.get(k + k0, j + j0, i + i0);
               if (!label.contains(index)) {
                 value &= ~Foreground;
                 value &= ~Valid;
@@ -343,7 +427,7 @@ namespace dials { namespace model {
       }
       if (value2 & Foreground) {
         value1 &= ~Background;
-        Label &label = label_[l];
+        Label &label = label_.set(k, j, i);
         if (label.first < 0) {
           label.first = (int)index;
         } else if (label.second < 0) {
@@ -399,7 +483,7 @@ namespace dials { namespace model {
     af::versa<FloatType, af::c_grid<3> > data_;
     af::versa<FloatType, af::c_grid<3> > background_;
     af::versa<int, af::c_grid<3> > mask_;
-    af::versa<Label, af::c_grid<3> > label_;
+    LabelTiles label_;
   };
 
   /**
@@ -11,31 +11,21 @@
 #ifndef DIALS_MODEL_DATA_PIXEL_LIST_H
 #define DIALS_MODEL_DATA_PIXEL_LIST_H
 
+#include <algorithm>
+#include <limits>
+#include <vector>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/image/connected_components/connected_components.h>
 #include <dials/error.h>
+#include <dials/util/memory_accounting.h>
 
 namespace dials { namespace model {
 
   using scitbx::vec3;
   using scitbx::af::int2;
 
-  namespace detail {
-
-    inline bool lessthan(const vec3<int> &a, const vec3<int> &b) {
-      return (
-        a[0] < b[0]
-          ? true
-          : (a[0] == b[0]
-               ? (a[1] < b[1] ? true
-                              : (a[1] == b[1] ? (a[2] < b[2] ? true : false) : false))
-               : false));
-    }
-
-  }  // namespace detail
-
   /**
    * A class to hold a list of pixels
    */
@@ -169,17 +159,25 @@ namespace dials { namespace model {
   };
 
   /**
-   * A class to label the pixels as spots
+   * A class to label the pixels as spots. The pixels on each row of a frame
+   * are stored as runs of consecutive pixels, rather than as a coordinate for
+   * each pixel, and the spots are found by joining the overlapping runs.
    */
   class PixelListLabeller {
   public:
-    PixelListLabeller() : size_(0, 0), first_frame_(0), last_frame_(0) {}
+    PixelListLabeller()
+        : size_(0, 0),
+          first_frame_(0),
+          last_frame_(0),
+          memory_(dials::util::make_memory_charge(dials::util::PixelListMemory)) {}
 
     /**
      * Add a pixel list
      * @param pixel_list The pixel list
      */
     void add(const PixelList &pixel_list) {
+      typedef algorithms::detail::PixelRun PixelRun;
+
       // Check the frame number
       if (last_frame_ == first_frame_) {
         first_frame_ = pixel_list.frame();
@@ -199,18 +197,29 @@ namespace dials { namespace model {
       af::const_ref<std::size_t> index = pixel_list.index().const_ref();
       DIALS_ASSERT(value.size() == index.size());
 
-      // Add the values and coordinates
+      // Add the values and split the pixels into runs on each row
       for (std::size_t i = 0; i < value.size(); ++i) {
         std::size_t k = index[i];
-        DIALS_ASSERT(i < size[0] * size[1]);
-        std::size_t y = k / size[1];
-        std::size_t x = k - y * size[1];
-        DIALS_ASSERT(x < size[1]);
-        DIALS_ASSERT(y < size[0]);
-        vec3<int> coord(frame, y, x);
+        DIALS_ASSERT(k < size[0] * size[1]);
+        DIALS_ASSERT(i == 0 || index[i - 1] < k);
+        int y = k / size[1];
+        int x = k - y * size[1];
+        if (i > 0 && k == index[i - 1] + 1 && x > 0) {
+          runs_.back().last++;
+        } else {
+          if (rows_.size() == 0 || rows_.back().frame != frame
+              || rows_.back().y != y) {
+            rows_.push_back(Row(frame, y, runs_.size()));
+          }
+          runs_.push_back(PixelRun(x, x + 1, runs_.size()));
+        }
         values_.push_back(value[i]);
-        coords_.push_back(coord);
       }
+
+      // Charge the rows, runs and values to the pixel list subsystem
+      memory_->set(rows_.capacity() * sizeof(Row)
+                   + runs_.capacity() * sizeof(PixelRun)
+                   + values_.capacity() * sizeof(double));
     }
 
     /**
@@ -251,7 +260,17 @@ namespace dials { namespace model {
      * @returns The list of valid point coordinates
      */
     af::shared<vec3<int> > coords() const {
-      return coords_;
+      af::shared<vec3<int> > result;
+      result.reserve(values_.size());
+      for (std::size_t r = 0; r < rows_.size(); ++r) {
+        for (std::size_t i = rows_[r].first; i < row_end(r); ++i) {
+          for (int x = runs_[i].first; x < runs_[i].last; ++x) {
+            result.push_back(vec3<int>(rows_[r].frame, rows_[r].y, x));
+          }
+        }
+      }
+      DIALS_ASSERT(result.size() == values_.size());
+      return result;
     }
 
     /**
@@ -265,109 +284,355 @@ namespace dials { namespace model {
      * Label the pixels in 3D
      */
     af::shared<int> labels_3d() const {
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
+      return labels(true);
+    }
 
-      if (coords_.size() == 0) {
-        return af::shared<int>();
+    /**
+     * Label the pixels in 2D
+     */
+    af::shared<int> labels_2d() const {
+      return labels(false);
+    }
+
+  private:
+    /**
+     * The runs on a row of a frame
+     */
+    struct Row {
+      int frame;
+      int y;
+      std::size_t first;  // The index of the first run on the row
+
+      Row(int frame_, int y_, std::size_t first_)
+          : frame(frame_), y(y_), first(first_) {}
+
+      bool operator<(const Row &other) const {
+        return frame < other.frame || (frame == other.frame && y < other.y);
       }
+    };
 
-      // Calculate the coordinate indices
-      for (std::size_t i = 0; i < coords_.size(); ++i) {
-        if (i > 0) {
-          DIALS_ASSERT(detail::lessthan(coords_[i - 1], coords_[i]));
-        }
+    /**
+     * @returns One past the index of the last run on a row
+     */
+    std::size_t row_end(std::size_t r) const {
+      return r + 1 < rows_.size() ? rows_[r + 1].first : runs_.size();
+    }
+
+    /**
+     * Join the runs on each row to the overlapping runs on the row above and,
+     * in 3D, on the same row of the previous frame. The spots are then
+     * numbered in the order of their first pixel.
+     */
+    af::shared<int> labels(bool threed) const {
+      if (values_.size() == 0) {
+        return af::shared<int>();
       }
 
-      // Create a graph of coordinates
-      AdjacencyList graph(coords_.size());
-      std::size_t i1 = 0, i2 = 0, i3 = 0;
-      for (; i1 < coords_.size() - 1; ++i1) {
-        vec3<int> a0 = coords_[i1];
-        vec3<int> a1(a0[0], a0[1], a0[2] + 1);
-        vec3<int> a2(a0[0], a0[1] + 1, a0[2]);
-        vec3<int> a3(a0[0] + 1, a0[1], a0[2]);
-        if (coords_[i1 + 1] == a1) {
-          boost::add_edge(i1, i1 + 1, graph);
+      // Join the neighbouring runs. The rows are sorted, so the row on the
+      // previous frame is found by advancing a single cursor.
+      algorithms::UnionFind forest(runs_.size());
+      const algorithms::detail::PixelRun *runs = &runs_[0];
+      std::size_t previous = 0;
+      for (std::size_t r = 0; r < rows_.size(); ++r) {
+        const Row &row = rows_[r];
+        if (r > 0) {
+          DIALS_ASSERT(rows_[r - 1] < row);
         }
-        if (a0[1] < size_[0] - 1) {
-          for (; detail::lessthan(coords_[i2], a2) && i2 < coords_.size() - 1; ++i2)
-            ;
-          if (coords_[i2] == a2) {
-            boost::add_edge(i1, i2, graph);
-          }
+        if (r > 0 && rows_[r - 1].frame == row.frame && rows_[r - 1].y == row.y - 1) {
+          algorithms::detail::join_runs(forest,
+                                        runs + rows_[r - 1].first,
+                                        runs + row.first,
+                                        runs + row.first,
+                                        runs + row_end(r));
         }
-        if (a0[0] < last_frame_ - 1) {
-          if (i2 > i3) i3 = i2;
-          for (; detail::lessthan(coords_[i3], a3) && i3 < coords_.size() - 1; ++i3)
+        if (threed) {
+          Row target(row.frame - 1, row.y, 0);
+          for (; previous < r && rows_[previous] < target; ++previous)
             ;
-          if (coords_[i3] == a3) {
-            boost::add_edge(i1, i3, graph);
+          if (previous < r && rows_[previous].frame == target.frame
+              && rows_[previous].y == target.y) {
+            algorithms::detail::join_runs(forest,
+                                          runs + rows_[previous].first,
+                                          runs + row_end(previous),
+                                          runs + row.first,
+                                          runs + row_end(r));
           }
         }
       }
 
-      // Do the connected components
-      af::shared<int> labels(num_vertices(graph), af::init_functor_null<int>());
-      DIALS_ASSERT(labels.size() == coords_.size());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
+      // Do the connected components and give each pixel the label of its run
+      af::shared<int> run_labels = forest.labels();
+      af::shared<int> labels(values_.size(), af::init_functor_null<int>());
+      std::size_t k = 0;
+      for (std::size_t i = 0; i < runs_.size(); ++i) {
+        for (int x = runs_[i].first; x < runs_[i].last; ++x) {
+          labels[k++] = run_labels[i];
+        }
+      }
+      DIALS_ASSERT(k == labels.size());
       return labels;
     }
 
+    int2 size_;
+    int first_frame_;
+    int last_frame_;
+    std::vector<Row> rows_;
+    std::vector<algorithms::detail::PixelRun> runs_;
+    af::shared<double> values_;
+    boost::shared_ptr<dials::util::MemoryCharge> memory_;
+  };
+
+  /**
+   * A class to label the pixels as spots as the frames are added. This gives
+   * the same spots as PixelListLabeller::labels_3d (or labels_2d) but a spot
+   * is finished as soon as a frame is added which has no pixels connected to
+   * it, so only the pixels of the spots which are still growing and the runs
+   * of pixels on the last frame are kept.
+   *
+   * Each row of a frame is split into runs of consecutive pixels. The runs
+   * are joined to the overlapping runs on the row above and to the runs on
+   * the same row of the previous frame, whose spots are already known, in a
+   * union find forest. The spots which are not joined to any run on the new
+   * frame are then finished. The finished spots from each frame are sorted by
+   * the index of their first pixel, which is the order in which the labels
+   * from PixelListLabeller are numbered.
+   */
+  class IncrementalPixelListLabeller {
+  public:
     /**
-     * Label the pixels in 2D
+     * A connected set of pixels
      */
-    af::shared<int> labels_2d() const {
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
+    struct Component {
+      std::size_t first;  // The index of the first pixel of the spot
+      af::shared<vec3<int> > coords;
+      af::shared<double> values;
 
-      if (coords_.size() == 0) {
-        return af::shared<int>();
+      Component() : first(std::numeric_limits<std::size_t>::max()) {}
+    };
+
+    /**
+     * @param twod Label the pixels on each frame separately
+     */
+    IncrementalPixelListLabeller(bool twod = false)
+        : twod_(twod), size_(0, 0), first_frame_(0), last_frame_(0), num_pixels_(0) {}
+
+    /**
+     * Add a pixel list and finish any spots which are not on the frame
+     * @param pixel_list The pixel list
+     */
+    void add(const PixelList &pixel_list) {
+      typedef algorithms::detail::PixelRun PixelRun;
+
+      // Check the frame number
+      if (last_frame_ == first_frame_) {
+        first_frame_ = pixel_list.frame();
+        size_ = pixel_list.size();
+        DIALS_ASSERT(size_.all_gt(0));
+        previous_offset_.assign(size_[0] + 1, 0);
+      } else {
+        DIALS_ASSERT(pixel_list.frame() == last_frame_);
+        DIALS_ASSERT(pixel_list.size().all_eq(size_));
       }
+      int frame = pixel_list.frame();
+      last_frame_ = frame + 1;
 
-      // Calculate the coordinate indices
-      for (std::size_t i = 0; i < coords_.size(); ++i) {
-        if (i > 0) {
-          DIALS_ASSERT(detail::lessthan(coords_[i - 1], coords_[i]));
+      // Get pixel list info
+      af::shared<double> value = pixel_list.value();
+      af::shared<std::size_t> index = pixel_list.index();
+      DIALS_ASSERT(value.size() == index.size());
+      std::size_t xsize = size_[1];
+      std::size_t ysize = size_[0];
+
+      // Split the pixels into runs on each row. The element in the forest for
+      // each run comes after those of the spots on the previous frame.
+      std::size_t num_active = active_.size();
+      std::vector<PixelRun> runs;
+      std::vector<std::size_t> run_start;
+      std::vector<std::size_t> offset(ysize + 1, 0);
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        DIALS_ASSERT(i == 0 || index[i - 1] < index[i]);
+        std::size_t y = index[i] / xsize;
+        std::size_t x = index[i] - y * xsize;
+        DIALS_ASSERT(y < ysize);
+        if (i > 0 && index[i] == index[i - 1] + 1 && x > 0) {
+          runs.back().last++;
+        } else {
+          runs.push_back(PixelRun(x, x + 1, num_active + runs.size()));
+          run_start.push_back(i);
+          offset[y + 1]++;
         }
       }
+      run_start.push_back(index.size());
+      for (std::size_t y = 0; y < ysize; ++y) {
+        offset[y + 1] += offset[y];
+      }
 
-      // Create a graph of coordinates
-      AdjacencyList graph(coords_.size());
-      std::size_t i1 = 0, i2 = 0;
-      for (; i1 < coords_.size() - 1; ++i1) {
-        vec3<int> a0 = coords_[i1];
-        vec3<int> a1(a0[0], a0[1], a0[2] + 1);
-        vec3<int> a2(a0[0], a0[1] + 1, a0[2]);
-        if (coords_[i1 + 1] == a1) {
-          boost::add_edge(i1, i1 + 1, graph);
+      // Join the runs to those on the row above and the same row of the
+      // previous frame
+      algorithms::UnionFind forest(num_active + runs.size());
+      for (std::size_t y = 0; y < ysize; ++y) {
+        if (offset[y] == offset[y + 1]) {
+          continue;
         }
-        if (a0[1] < size_[0] - 1) {
-          for (; detail::lessthan(coords_[i2], a2) && i2 < coords_.size() - 1; ++i2)
-            ;
-          if (coords_[i2] == a2) {
-            boost::add_edge(i1, i2, graph);
-          }
+        const PixelRun *r0 = &runs[0] + offset[y];
+        const PixelRun *r1 = &runs[0] + offset[y + 1];
+        if (y > 0 && offset[y - 1] != offset[y]) {
+          algorithms::detail::join_runs(forest, &runs[0] + offset[y - 1], r0, r0, r1);
+        }
+        if (previous_offset_[y] != previous_offset_[y + 1]) {
+          algorithms::detail::join_runs(forest,
+                                        &previous_[0] + previous_offset_[y],
+                                        &previous_[0] + previous_offset_[y + 1],
+                                        r0,
+                                        r1);
         }
       }
 
-      // Do the connected components
-      af::shared<int> labels(num_vertices(graph));
-      DIALS_ASSERT(labels.size() == coords_.size());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
-      return labels;
+      // Create a spot for each set of joined runs
+      std::vector<Component> next;
+      std::vector<std::size_t> slot(forest.size(), runs.size());
+      for (std::size_t r = 0; r < runs.size(); ++r) {
+        std::size_t root = forest.find(num_active + r);
+        if (slot[root] == runs.size()) {
+          slot[root] = next.size();
+          next.push_back(Component());
+        }
+      }
+
+      // Merge the spots from the previous frame into the new spots or finish
+      // them if they are not joined to any run
+      std::size_t num_finished = finished_.size();
+      for (std::size_t i = 0; i < num_active; ++i) {
+        std::size_t root = forest.find(i);
+        if (slot[root] == runs.size()) {
+          finished_.push_back(active_[i]);
+        } else {
+          merge(next[slot[root]], active_[i]);
+        }
+      }
+
+      // Add the pixels in each run to their spot
+      for (std::size_t r = 0; r < runs.size(); ++r) {
+        std::size_t s = slot[forest.find(num_active + r)];
+        Component &component = next[s];
+        component.first = std::min(component.first, num_pixels_ + run_start[r]);
+        for (std::size_t i = run_start[r]; i < run_start[r + 1]; ++i) {
+          std::size_t y = index[i] / xsize;
+          std::size_t x = index[i] - y * xsize;
+          component.coords.push_back(vec3<int>(frame, y, x));
+          component.values.push_back(value[i]);
+        }
+        runs[r].id = s;
+      }
+      num_pixels_ += index.size();
+
+      // Keep the runs on this frame for the next
+      active_.swap(next);
+      previous_.swap(runs);
+      previous_offset_.swap(offset);
+      if (twod_) {
+        finish_active();
+      }
+      sort_finished(num_finished);
+    }
+
+    /**
+     * Finish all the spots at the end of the sweep
+     */
+    void finish() {
+      std::size_t num_finished = finished_.size();
+      finish_active();
+      sort_finished(num_finished);
+    }
+
+    /**
+     * @returns The image size
+     */
+    int2 size() const {
+      return size_;
+    }
+
+    /** @returns The number of pixels added */
+    std::size_t num_pixels() const {
+      return num_pixels_;
+    }
+
+    /** @returns The first frame number */
+    int first_frame() const {
+      return first_frame_;
+    }
+
+    /** @returns The last frame number */
+    int last_frame() const {
+      return last_frame_;
+    }
+
+    /** @returns The frame range */
+    int2 frame_range() const {
+      DIALS_ASSERT(last_frame_ >= first_frame_);
+      return int2(first_frame_, last_frame_);
+    }
+
+    /** @returns The number of spots still being labelled */
+    std::size_t num_active() const {
+      return active_.size();
+    }
+
+    /** @returns The spots which have been finished */
+    const std::vector<Component> &finished() const {
+      return finished_;
+    }
+
+    /** Discard the spots which have been finished */
+    void clear_finished() {
+      finished_.clear();
     }
 
   private:
+    static bool first_less(const Component &a, const Component &b) {
+      return a.first < b.first;
+    }
+
+    /**
+     * Merge the pixels of one spot into another
+     */
+    static void merge(Component &a, const Component &b) {
+      a.first = std::min(a.first, b.first);
+      if (a.coords.size() == 0) {
+        a.coords = b.coords;
+        a.values = b.values;
+      } else {
+        a.coords.insert(a.coords.end(), b.coords.begin(), b.coords.end());
+        a.values.insert(a.values.end(), b.values.begin(), b.values.end());
+      }
+    }
+
+    /**
+     * Move all the spots which are still being labelled to the finished list
+     */
+    void finish_active() {
+      finished_.insert(finished_.end(), active_.begin(), active_.end());
+      active_.clear();
+      previous_.clear();
+      std::fill(previous_offset_.begin(), previous_offset_.end(), 0);
+    }
+
+    /**
+     * Sort the spots finished after the given index by their first pixel
+     */
+    void sort_finished(std::size_t first) {
+      std::sort(finished_.begin() + first, finished_.end(), first_less);
+    }
+
+    bool twod_;
     int2 size_;
     int first_frame_;
     int last_frame_;
-    af::shared<vec3<int> > coords_;
-    af::shared<double> values_;
+    std::size_t num_pixels_;
+    std::vector<Component> active_;
+    std::vector<Component> finished_;
+    std::vector<algorithms::detail::PixelRun> previous_;
+    std::vector<std::size_t> previous_offset_;
   };
 
 }}  // namespace dials::model
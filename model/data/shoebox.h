@@ -11,6 +11,7 @@
 #ifndef DIALS_MODEL_DATA_SHOEBOX_H
 #define DIALS_MODEL_DATA_SHOEBOX_H
 
+#include <algorithm>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/small.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -22,6 +23,7 @@
 #include <dials/model/data/mask_code.h>
 #include <dials/config.h>
 #include <dials/error.h>
+#include <dials/util/memory_accounting.h>
 
 namespace dials { namespace model {
 
@@ -58,6 +60,59 @@ namespace dials { namespace model {
     return result;
   }
 
+  namespace detail {
+
+    /**
+     * Select the pixels which have all the bits of the mask code and are not
+     * overlapped, for use with the centroid algorithms.
+     */
+    struct ShoeboxMaskCode {
+      const int *mask;
+      int code;
+
+      ShoeboxMaskCode(const int *mask_, int code_) : mask(mask_), code(code_) {}
+
+      bool operator[](std::size_t i) const {
+        return (mask[i] & code) == code && (mask[i] & Overlapped) == 0;
+      }
+    };
+
+    /**
+     * The background subtracted pixels, for use with the centroid algorithms.
+     */
+    template <typename FloatType>
+    struct ShoeboxForeground {
+      const FloatType *data;
+      const FloatType *background;
+
+      ShoeboxForeground(const FloatType *data_, const FloatType *background_)
+          : data(data_), background(background_) {}
+
+      FloatType operator[](std::size_t i) const {
+        return data[i] - background[i];
+      }
+    };
+
+    /**
+     * Select the pixels which have all the bits of the mask code, are not
+     * overlapped and are above the background.
+     */
+    template <typename FloatType>
+    struct ShoeboxPositiveMaskCode {
+      ShoeboxMaskCode mask;
+      ShoeboxForeground<FloatType> foreground;
+
+      ShoeboxPositiveMaskCode(const ShoeboxMaskCode &mask_,
+                              const ShoeboxForeground<FloatType> &foreground_)
+          : mask(mask_), foreground(foreground_) {}
+
+      bool operator[](std::size_t i) const {
+        return mask[i] && foreground[i] > 0;
+      }
+    };
+
+  }  // namespace detail
+
   /**
    * A class to hold shoebox information
    */
@@ -72,6 +127,9 @@ namespace dials { namespace model {
     af::versa<int, af::c_grid<3> > mask;              ///< The shoebox mask
     af::versa<FloatType, af::c_grid<3> > background;  ///< The shoebox background
 
+    /// The memory charged for the arrays
+    boost::shared_ptr<dials::util::MemoryCharge> memory;
+
     /**
      * Initialise the shoebox
      */
@@ -131,6 +189,7 @@ namespace dials { namespace model {
       data = af::versa<FloatType, af::c_grid<3> >(accessor, 0.0);
       mask = af::versa<int, af::c_grid<3> >(accessor, maskcode);
       background = af::versa<FloatType, af::c_grid<3> >(accessor, 0.0);
+      charge_memory();
     }
 
     /**
@@ -148,6 +207,20 @@ namespace dials { namespace model {
       data = af::versa<FloatType, af::c_grid<3> >(accessor);
       mask = af::versa<int, af::c_grid<3> >(accessor);
       background = af::versa<FloatType, af::c_grid<3> >(accessor);
+      memory.reset();
+    }
+
+    /**
+     * Charge the memory of the arrays to the shoebox subsystem. The charge is
+     * shared by copies of the shoebox and released with the last of them.
+     */
+    void charge_memory() {
+      if (dials::util::memory_accounting() != NULL) {
+        memory = dials::util::make_memory_charge(
+          dials::util::ShoeboxMemory,
+          (data.size() + background.size()) * sizeof(FloatType)
+            + mask.size() * sizeof(int));
+      }
     }
 
     /** @returns The x offset */
@@ -254,11 +327,13 @@ namespace dials { namespace model {
       int j1 = bbox[3] < ysize ? bbox[3] : ysize;
       int i0 = bbox[0] > 0 ? bbox[0] : 0;
       int i1 = bbox[1] < xsize ? bbox[1] : xsize;
+      if (i1 <= i0) {
+        return false;
+      }
       for (int j = j0; j < j1; ++j) {
-        for (int i = i0; i < i1; ++i) {
-          if (mask(j, i) == false) {
-            return true;
-          }
+        const bool *row = &mask(j, 0);
+        if (std::find(row + i0, row + i1, false) != row + i1) {
+          return true;
         }
       }
       return false;
@@ -270,11 +345,13 @@ namespace dials { namespace model {
      * @returns The number of pixels with that code
      */
     int count_mask_values(int code) const {
+      // Accumulate the comparison rather than branch on it, so the loop can be
+      // vectorised
+      const int *m = mask.begin();
+      std::size_t n = mask.size();
       int count = 0;
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        if ((mask[i] & code) == code) {
-          count++;
-        }
+      for (std::size_t i = 0; i < n; ++i) {
+        count += (m[i] & code) == code;
       }
       return count;
     }
@@ -284,8 +361,10 @@ namespace dials { namespace model {
      * @returns a bool
      */
     bool all_foreground_valid() const {
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        if (((mask[i] & Valid) != Valid) && ((mask[i] & Foreground) == Foreground)) {
+      const int *m = mask.begin();
+      std::size_t n = mask.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        if ((m[i] & (Valid | Foreground)) == Foreground) {
           return false;
         }
       }
@@ -311,19 +390,15 @@ namespace dials { namespace model {
     Centroid centroid_masked(int code) const {
       typedef CentroidMaskedImage3d<FloatType> Centroider;
 
-      // Calculate the foreground mask
-      af::versa<bool, af::c_grid<3> > fg_mask_arr(mask.accessor());
-      af::ref<bool, af::c_grid<3> > foreground_mask = fg_mask_arr.ref();
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        foreground_mask[i] = (mask[i] & code) == code && ((mask[i] & Overlapped) == 0);
-      }
-
-      // Calculate the centroid
+      // Calculate the centroid of the foreground pixels. The foreground mask
+      // is computed as the pixels are read.
       int zoff = flat ? (bbox[5] + bbox[4]) / 2 : bbox[4];
       vec3<double> offset(bbox[0], bbox[2], zoff);
       Centroid result;
       try {
-        Centroider centroid(data.const_ref(), foreground_mask);
+        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+        detail::ShoeboxMaskCode foreground_mask(mask.begin(), code);
+        Centroider centroid(data.accessor(), data.const_ref().as_1d(), foreground_mask);
         result = extract_centroid_object(centroid, offset);
         if (bbox[5] == bbox[4] + 1) {
           result.px.position[2] = bbox[4] + 0.5;
@@ -370,16 +445,12 @@ namespace dials { namespace model {
     Centroid centroid_all_minus_background() const {
       typedef CentroidImage3d<FloatType> Centroider;
 
-      // Calculate the foreground mask and data
+      // Calculate the centroid of the foreground data. The background is
+      // subtracted as the pixels are read.
       DIALS_ASSERT(data.size() == background.size());
-      af::versa<FloatType, af::c_grid<3> > fg_data_arr(data.accessor());
-      af::ref<FloatType, af::c_grid<3> > foreground_data = fg_data_arr.ref();
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        foreground_data[i] = data[i] - background[i];
-      }
-
-      // Calculate the centroid
-      Centroider centroid(foreground_data);
+      detail::ShoeboxForeground<FloatType> foreground_data(data.begin(),
+                                                           background.begin());
+      Centroider centroid(data.accessor(), foreground_data);
       int zoff = flat ? (bbox[5] + bbox[4]) / 2 : bbox[4];
       vec3<double> offset(bbox[0], bbox[2], zoff);
       return extract_centroid_object(centroid, offset);
@@ -392,25 +463,20 @@ namespace dials { namespace model {
     Centroid centroid_masked_minus_background(int code) const {
       typedef CentroidMaskedImage3d<FloatType> Centroider;
 
-      // Calculate the foreground mask and data
+      // The foreground data and mask are computed as the pixels are read
       DIALS_ASSERT(data.size() == mask.size());
       DIALS_ASSERT(data.size() == background.size());
-      af::versa<bool, af::c_grid<3> > fg_mask_arr(mask.accessor());
-      af::versa<FloatType, af::c_grid<3> > fg_data_arr(data.accessor());
-      af::ref<FloatType, af::c_grid<3> > foreground_data = fg_data_arr.ref();
-      af::ref<bool, af::c_grid<3> > foreground_mask = fg_mask_arr.ref();
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        foreground_data[i] = data[i] - background[i];
-        foreground_mask[i] = ((mask[i] & code) == code) && ((mask[i] & Overlapped) == 0)
-                             && (foreground_data[i] > 0);
-      }
+      detail::ShoeboxForeground<FloatType> foreground_data(data.begin(),
+                                                           background.begin());
+      detail::ShoeboxPositiveMaskCode<FloatType> foreground_mask(
+        detail::ShoeboxMaskCode(mask.begin(), code), foreground_data);
 
       // Calculate the centroid
       int zoff = flat ? (bbox[5] + bbox[4]) / 2 : bbox[4];
       vec3<double> offset(bbox[0], bbox[2], zoff);
       Centroid result;
       try {
-        Centroider centroid(foreground_data, foreground_mask);
+        Centroider centroid(data.accessor(), foreground_data, foreground_mask);
         result = extract_centroid_object(centroid, offset);
       } catch (dials::error) {
         double xmid = (bbox[1] + bbox[0]) / 2.0;
@@ -510,16 +576,17 @@ namespace dials { namespace model {
     void flatten() {
       DIALS_ASSERT(is_consistent());
       if (flat == false) {
+        // Sum the data and combine the mask codes of each frame into the first
+        // frame. The frames are contiguous, so each is added as a flat array.
+        std::size_t nxy = ysize() * xsize();
+        FloatType *data0 = data.begin();
+        int *mask0 = mask.begin();
         for (std::size_t k = 1; k < zsize(); ++k) {
-          for (std::size_t j = 0; j < ysize(); ++j) {
-            for (std::size_t i = 0; i < xsize(); ++i) {
-              data(0, j, i) += data(k, j, i);
-              mask(0, j, i) |= mask(k, j, i);
-              bool valid = (mask(0, j, i) & Valid) && (mask(0, j, i) & Valid);
-              if (!valid) {
-                mask(0, j, i) &= ~Valid;
-              }
-            }
+          const FloatType *datak = data0 + k * nxy;
+          const int *maskk = mask0 + k * nxy;
+          for (std::size_t i = 0; i < nxy; ++i) {
+            data0[i] += datak[i];
+            mask0[i] |= maskk[i];
           }
         }
         af::c_grid<3> accessor(1, ysize(), xsize());
@@ -3,37 +3,355 @@
 #ifndef DIALS_MODEL_SERIALIZE_SHOEBOX_H
 #define DIALS_MODEL_SERIALIZE_SHOEBOX_H
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/array_family/reflection_table.h>
+#include <dials/array_family/shoebox_extractor.h>
+#include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
-#include <string>
+#include <dials/error.h>
 
 namespace dials { namespace model {
 
-  class ShoeboxReaderInternal {
+  /**
+   * The layout of the intermediate shoebox file.
+   *
+   * The file starts with an 8 byte magic string, followed by the number of
+   * shoeboxes, the number of blocks and the offset of the index as 64 bit
+   * integers. The index offset is zero until the file is complete. Next come
+   * the shoeboxes, each as its float data followed by its integer mask, in the
+   * order in which they were completed, so that the shoeboxes of each block
+   * are contiguous. The index, aligned to 8 bytes, contains the z boundaries
+   * of the blocks, the position of the first shoebox of each block, and then
+   * the reflection index, panel, bounding box and data offset of each shoebox,
+   * all as 64 bit integers in the native byte order.
+   */
+  namespace shoebox_file {
+
+    typedef Shoebox<>::float_type float_type;
+
+    /**
+     * An entry in the index
+     */
+    struct Entry {
+      boost::uint64_t index;
+      boost::uint64_t panel;
+      boost::int64_t bbox[6];
+      boost::uint64_t offset;
+    };
+
+    inline const char *magic() {
+      return "DIALSSBX";
+    }
+
+    inline std::size_t header_size() {
+      return 32;
+    }
+
+    /**
+     * @returns The number of bytes used to store a shoebox
+     */
+    inline std::size_t shoebox_size(const int6 &bbox) {
+      std::size_t n =
+        (std::size_t)(bbox[1] - bbox[0]) * (bbox[3] - bbox[2]) * (bbox[5] - bbox[4]);
+      return n * (sizeof(float_type) + sizeof(int));
+    }
+
+  }  // namespace shoebox_file
+
+  /**
+   * Write shoeboxes to the intermediate file as the images are read. Each
+   * shoebox is extracted into memory from the frame on which it starts and is
+   * appended to the file, and released, after the frame on which it ends. The
+   * shoeboxes are assigned to the z block containing their last frame, so
+   * that the shoeboxes of each block are written contiguously.
+   */
+  class ShoeboxWriter {
   public:
-    ShoeboxReaderInternal(const std::string &filename) {}
+    /**
+     * Open the file and index the shoeboxes by their first and last frames
+     * @param filename The file to write to
+     * @param panel The panel of each shoebox
+     * @param bbox The bounding box of each shoebox
+     * @param blocks The z boundaries of the blocks
+     * @param npanels The number of panels
+     * @param nthreads The number of threads to extract each frame with
+     */
+    ShoeboxWriter(const std::string &filename,
+                  const af::const_ref<std::size_t> &panel,
+                  const af::const_ref<int6> &bbox,
+                  const af::const_ref<int> &blocks,
+                  std::size_t npanels,
+                  std::size_t nthreads = 1)
+        : filename_(filename),
+          blocks_(check_blocks(blocks)),
+          table_(make_table(panel, bbox)),
+          shoebox_(table_["shoebox"]),
+          extractor_(table_,
+                     npanels,
+                     blocks_.front(),
+                     blocks_.back(),
+                     nthreads),
+          frame_(blocks_.front()),
+          offset_(shoebox_file::header_size()),
+          file_(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc) {
+      if (!file_.is_open()) {
+        throw DIALS_ERROR("Unable to open shoebox file for writing");
+      }
+
+      // Index the shoeboxes by the frames on which they start and end
+      std::size_t nframes = blocks_.back() - blocks_.front();
+      std::vector<std::size_t> num_first(nframes, 0);
+      std::vector<std::size_t> num_last(nframes, 0);
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        num_first[bbox[i][4] - blocks_.front()]++;
+        num_last[bbox[i][5] - 1 - blocks_.front()]++;
+      }
+      first_offset_ = cumulative(num_first);
+      last_offset_ = cumulative(num_last);
+      first_index_.resize(bbox.size());
+      last_index_.resize(bbox.size());
+      std::vector<std::size_t> first_count(first_offset_);
+      std::vector<std::size_t> last_count(last_offset_);
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        first_index_[first_count[bbox[i][4] - blocks_.front()]++] = i;
+        last_index_[last_count[bbox[i][5] - 1 - blocks_.front()]++] = i;
+      }
+      block_first_.push_back(0);
+      entries_.reserve(bbox.size());
+
+      // Write the header with no index, so an incomplete file is rejected
+      write_header(0);
+    }
+
+    /**
+     * Close the file. If not all the images were added, the file is left
+     * without an index and cannot be read.
+     */
+    ~ShoeboxWriter() {
+      if (file_.is_open()) {
+        file_.close();
+      }
+    }
+
+    /**
+     * Extract the shoeboxes from the next image and write those which end on
+     * this frame. The index is written after the last image.
+     * @param image The image to process
+     */
+    template <typename T>
+    void add_image(const Image<T> &image) {
+      DIALS_ASSERT(!finished());
+      DIALS_ASSERT(file_.is_open());
+      std::size_t j = frame_ - blocks_.front();
+
+      // Allocate the shoeboxes which start on this frame
+      for (std::size_t k = first_offset_[j]; k < first_offset_[j + 1]; ++k) {
+        shoebox_[first_index_[k]].allocate();
+      }
+
+      // Extract the pixels
+      extractor_.next(image);
+
+      // Write and release the shoeboxes which end on this frame
+      for (std::size_t k = last_offset_[j]; k < last_offset_[j + 1]; ++k) {
+        write_shoebox(last_index_[k]);
+        shoebox_[last_index_[k]].deallocate();
+      }
+      frame_++;
+      if (frame_ == blocks_[block_first_.size()]) {
+        block_first_.push_back(entries_.size());
+      }
+
+      // Write the index after the last image
+      if (finished()) {
+        close();
+      }
+    }
+
+    /** @returns The filename */
+    std::string filename() const {
+      return filename_;
+    }
+
+    /** @returns The current frame */
+    int frame() const {
+      return frame_;
+    }
 
-    af::shared<Shoebox<double> > read(std::size_t z0, std::size_t z1) const {}
+    /** @returns The number of shoeboxes written */
+    std::size_t num_written() const {
+      return entries_.size();
+    }
+
+    /** @returns Have all the images been added */
+    bool finished() const {
+      return frame_ == blocks_.back();
+    }
 
   private:
+    static std::vector<int> check_blocks(const af::const_ref<int> &blocks) {
+      DIALS_ASSERT(blocks.size() >= 2);
+      for (std::size_t i = 1; i < blocks.size(); ++i) {
+        DIALS_ASSERT(blocks[i] > blocks[i - 1]);
+      }
+      return std::vector<int>(blocks.begin(), blocks.end());
+    }
+
+    static af::reflection_table make_table(const af::const_ref<std::size_t> &panel,
+                                           const af::const_ref<int6> &bbox) {
+      DIALS_ASSERT(panel.size() == bbox.size());
+      af::reflection_table table(bbox.size());
+      af::shared<std::size_t> panel_column = table["panel"];
+      af::shared<int6> bbox_column = table["bbox"];
+      af::shared<Shoebox<> > shoebox_column = table["shoebox"];
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        panel_column[i] = panel[i];
+        bbox_column[i] = bbox[i];
+        shoebox_column[i] = Shoebox<>(panel[i], bbox[i]);
+      }
+      return table;
+    }
+
+    static std::vector<std::size_t> cumulative(const std::vector<std::size_t> &num) {
+      std::vector<std::size_t> result(1, 0);
+      for (std::size_t i = 0; i < num.size(); ++i) {
+        result.push_back(result.back() + num[i]);
+      }
+      return result;
+    }
+
+    void write_header(boost::uint64_t index_offset) {
+      boost::uint64_t header[3] = {
+        entries_.size(), blocks_.size() - 1, index_offset};
+      file_.seekp(0);
+      file_.write(shoebox_file::magic(), 8);
+      file_.write(reinterpret_cast<const char *>(header), sizeof(header));
+      DIALS_ASSERT(file_.good());
+    }
+
+    void write_shoebox(std::size_t index) {
+      const Shoebox<> &sbox = shoebox_[index];
+      DIALS_ASSERT(sbox.is_consistent());
+      shoebox_file::Entry entry;
+      entry.index = index;
+      entry.panel = sbox.panel;
+      std::copy(sbox.bbox.begin(), sbox.bbox.end(), entry.bbox);
+      entry.offset = offset_;
+      entries_.push_back(entry);
+      file_.write(reinterpret_cast<const char *>(sbox.data.begin()),
+                  sbox.data.size() * sizeof(shoebox_file::float_type));
+      file_.write(reinterpret_cast<const char *>(sbox.mask.begin()),
+                  sbox.mask.size() * sizeof(int));
+      DIALS_ASSERT(file_.good());
+      offset_ += shoebox_file::shoebox_size(sbox.bbox);
+    }
+
+    void close() {
+      DIALS_ASSERT(entries_.size() == shoebox_.size());
+      DIALS_ASSERT(block_first_.size() == blocks_.size());
+
+      // Pad the index to 8 bytes
+      std::size_t padding = (8 - offset_ % 8) % 8;
+      const char zeros[8] = {0};
+      file_.write(zeros, padding);
+      boost::uint64_t index_offset = offset_ + padding;
+
+      // Write the index and then the header which points to it
+      std::vector<boost::int64_t> blocks(blocks_.begin(), blocks_.end());
+      std::vector<boost::uint64_t> block_first(block_first_.begin(),
+                                               block_first_.end());
+      file_.write(reinterpret_cast<const char *>(&blocks[0]),
+                  blocks.size() * sizeof(boost::int64_t));
+      file_.write(reinterpret_cast<const char *>(&block_first[0]),
+                  block_first.size() * sizeof(boost::uint64_t));
+      if (entries_.size() > 0) {
+        file_.write(reinterpret_cast<const char *>(&entries_[0]),
+                    entries_.size() * sizeof(shoebox_file::Entry));
+      }
+      write_header(index_offset);
+      file_.close();
+    }
+
+    std::string filename_;
+    std::vector<int> blocks_;
+    af::reflection_table table_;
+    af::shared<Shoebox<> > shoebox_;
+    af::ShoeboxExtractor extractor_;
+    int frame_;
+    std::size_t offset_;
+    std::ofstream file_;
+    std::vector<std::size_t> first_offset_;
+    std::vector<std::size_t> first_index_;
+    std::vector<std::size_t> last_offset_;
+    std::vector<std::size_t> last_index_;
+    std::vector<std::size_t> block_first_;
+    std::vector<shoebox_file::Entry> entries_;
   };
 
   /**
-   * Interface for reading shoeboxes from the intermediate file.
+   * Interface for reading shoeboxes from the intermediate file. The file is
+   * mapped read only and the shoeboxes of a block are copied from the mapping
+   * when the block is read.
    */
   class ShoeboxReader {
   public:
     /**
-     * Create the shoebox reader with the filename and block.
+     * Map the shoebox file and read the index
      * @param filename The file to read from
-     * @param blocks The list of blocks to read
      */
-    ShoeboxReader(const std::string &filename, const af::const_ref<std::size_t> &blocks)
-        : filename_(filename), blocks_(blocks.begin(), blocks.end()) {
-      // Check we have atleast 1 block and that block array is valid
-      DIALS_ASSERT(blocks.size() >= 2);
-      for (std::size_t i = 1; i < blocks.size(); ++i) {
-        DIALS_ASSERT(blocks[i] > blocks[i - 1]);
+    ShoeboxReader(const std::string &filename) : filename_(filename) {
+      using boost::interprocess::file_mapping;
+      using boost::interprocess::mapped_region;
+      using boost::interprocess::read_only;
+      file_mapping file(filename.c_str(), read_only);
+      region_ = boost::make_shared<mapped_region>(file, read_only);
+      begin_ = static_cast<const char *>(region_->get_address());
+      std::size_t size = region_->get_size();
+      if (size < shoebox_file::header_size()
+          || std::memcmp(begin_, shoebox_file::magic(), 8) != 0) {
+        throw DIALS_ERROR("Not a shoebox file");
+      }
+      const boost::uint64_t *header =
+        reinterpret_cast<const boost::uint64_t *>(begin_ + 8);
+      std::size_t num_shoeboxes = header[0];
+      std::size_t num_blocks = header[1];
+      std::size_t index_offset = header[2];
+      if (index_offset == 0) {
+        throw DIALS_ERROR("Shoebox file is incomplete");
+      }
+      DIALS_ASSERT(num_blocks > 0);
+      DIALS_ASSERT(index_offset % 8 == 0);
+      DIALS_ASSERT(size == index_offset + (num_blocks + 1) * 16
+                             + num_shoeboxes * sizeof(shoebox_file::Entry));
+
+      // Read the block boundaries and the index of the shoeboxes
+      const boost::int64_t *blocks =
+        reinterpret_cast<const boost::int64_t *>(begin_ + index_offset);
+      const boost::uint64_t *block_first =
+        reinterpret_cast<const boost::uint64_t *>(blocks + num_blocks + 1);
+      blocks_.assign(blocks, blocks + num_blocks + 1);
+      block_first_.assign(block_first, block_first + num_blocks + 1);
+      entries_ =
+        reinterpret_cast<const shoebox_file::Entry *>(block_first + num_blocks + 1);
+      DIALS_ASSERT(block_first_.front() == 0);
+      DIALS_ASSERT(block_first_.back() == num_shoeboxes);
+      for (std::size_t i = 0; i < num_blocks; ++i) {
+        DIALS_ASSERT(blocks_[i + 1] > blocks_[i]);
+        DIALS_ASSERT(block_first_[i + 1] >= block_first_[i]);
+      }
+      for (std::size_t i = 0; i < num_shoeboxes; ++i) {
+        DIALS_ASSERT(entries_[i].offset + shoebox_file::shoebox_size(bbox(i))
+                     <= index_offset);
       }
     }
 
@@ -47,8 +365,8 @@ namespace dials { namespace model {
     /**
      * @returns A list of blocks
      */
-    af::shared<std::size_t> blocks() const {
-      return af::shared<std::size_t>(blocks_.begin(), blocks_.end());
+    af::shared<int> blocks() const {
+      return af::shared<int>(blocks_.begin(), blocks_.end());
     }
 
     /**
@@ -58,6 +376,13 @@ namespace dials { namespace model {
       return blocks_.size() - 1;
     }
 
+    /**
+     * @returns The number of shoeboxes
+     */
+    std::size_t num_shoeboxes() const {
+      return block_first_.back();
+    }
+
     /**
      * Return the specific block
      * @param index The index of the block
@@ -68,77 +393,55 @@ namespace dials { namespace model {
       return int2(blocks_[index], blocks_[index + 1]);
     }
 
+    /**
+     * @param index The block index
+     * @returns The reflection indices of the shoeboxes in the block
+     */
+    af::shared<std::size_t> indices(std::size_t index) const {
+      DIALS_ASSERT(index < size());
+      af::shared<std::size_t> result;
+      for (std::size_t i = block_first_[index]; i < block_first_[index + 1]; ++i) {
+        result.push_back(entries_[i].index);
+      }
+      return result;
+    }
+
     /**
      * Read the shoeboxes in a block
      * @param index The block index
      * @returns The list of shoeboxes in the block
      */
-    af::shared<Shoebox<double> > operator[](std::size_t index) const {
+    af::shared<Shoebox<> > operator[](std::size_t index) const {
+      typedef shoebox_file::float_type float_type;
       DIALS_ASSERT(index < size());
-      return af::shared<Shoebox<double> >();
+      af::shared<Shoebox<> > result;
+      result.reserve(block_first_[index + 1] - block_first_[index]);
+      for (std::size_t i = block_first_[index]; i < block_first_[index + 1]; ++i) {
+        Shoebox<> sbox(entries_[i].panel, bbox(i));
+        sbox.allocate();
+        std::size_t n = sbox.data.size();
+        const char *ptr = begin_ + entries_[i].offset;
+        std::memcpy(sbox.data.begin(), ptr, n * sizeof(float_type));
+        std::memcpy(sbox.mask.begin(), ptr + n * sizeof(float_type), n * sizeof(int));
+        result.push_back(sbox);
+      }
+      return result;
     }
 
   private:
+    int6 bbox(std::size_t i) const {
+      const boost::int64_t *b = entries_[i].bbox;
+      return int6(b[0], b[1], b[2], b[3], b[4], b[5]);
+    }
+
     std::string filename_;
-    af::shared<std::size_t> blocks_;
+    boost::shared_ptr<boost::interprocess::mapped_region> region_;
+    const char *begin_;
+    std::vector<int> blocks_;
+    std::vector<std::size_t> block_first_;
+    const shoebox_file::Entry *entries_;
   };
 
-  // class ShoeboxFile {
-  // public:
-
-  // ShoeboxFile(const std::string filename)
-  //: filename_(filename) {
-
-  //}
-
-  // std::string filename() const {
-  // return filename_;
-  //}
-
-  // int* block(std::size_t n) {
-
-  //}
-
-  // private:
-
-  // std::string filename_;
-  //};
-
-  // class ShoeboxWriter {
-  // public:
-
-  // ShoeboxWriter(const std::string &filename
-  // const af::const_ref<std::size_t> &panel,
-  // const af::const_ref<int6> &bbox,
-  // std::size_t max_block_size) {
-
-  //}
-
-  //~ShoeboxWriter() {
-  // defragment();
-  //}
-
-  // void add_image(std::size_t z, std::size_t panel, const af::const_ref &image) {
-
-  //// Ensure we can't go backward and panels are valid
-  // DIALS_ASSERT(z >= current_frame_);
-  // DIALS_ASSERT(panel < num_panels_);
-  // current_frame_ = z;
-
-  //// Get the current
-
-  //}
-
-  // private:
-
-  // void defragment() {
-
-  //}
-
-  // std::size_t current_frame_;
-  // std::size_t num_panels_;
-  //};
-
 }}  // namespace dials::model
 
 #endif  // DIALS_MODEL_SERIALIZE_SHOEBOX_H
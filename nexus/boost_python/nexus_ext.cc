@@ -13,8 +13,12 @@
 #include <boost/function.hpp>
 #include <boost_adaptbx/optional_conversions.h>
 #include <scitbx/array_family/boost_python/flex_wrapper.h>
+#include <sys/stat.h>
+#include <deque>
+#include <map>
 #include <H5Cpp.h>
 #include <dials/nexus/nxmx.h>
+#include <dials/nexus/chunked_reader.h>
 #include <dials/error.h>
 
 namespace dials { namespace nexus { namespace boost_python {
@@ -67,6 +71,103 @@ namespace dials { namespace nexus { namespace boost_python {
         setter<Type, Class>(ptr), default_call_policies(), signature());
     }
 
+    template <typename Type, typename Class>
+    struct lazy_getter {
+      typedef Class class_type;
+      typedef lazy_dataset<Type> class_type::*pointer_type;
+
+      const pointer_type variable;
+
+      lazy_getter(pointer_type p) : variable(p) {}
+
+      Type operator()(const class_type &obj) const {
+        return (obj.*variable).get();
+      }
+    };
+
+    template <typename Type, typename Class>
+    struct lazy_setter {
+      typedef Class class_type;
+      typedef lazy_dataset<Type> class_type::*pointer_type;
+
+      pointer_type variable;
+
+      lazy_setter(pointer_type p) : variable(p) {}
+
+      void operator()(class_type &obj, Type value) const {
+        (obj.*variable).set(value);
+      }
+    };
+
+    template <typename Type, typename Class>
+    object make_getter(lazy_dataset<Type> Class::*ptr) {
+      typedef boost::mpl::vector<Type, const Class &> signature;
+      return make_function(
+        lazy_getter<Type, Class>(ptr), default_call_policies(), signature());
+    }
+
+    template <typename Type, typename Class>
+    object make_setter(lazy_dataset<Type> Class::*ptr) {
+      typedef boost::mpl::vector<void, Class &, Type> signature;
+      return make_function(
+        lazy_setter<Type, Class>(ptr), default_call_policies(), signature());
+    }
+
+    /**
+     * The identity of a file: its name, device, inode, size and modification
+     * time, so that a cached file is read again if it changes
+     */
+    struct file_identity {
+      std::string filename;
+      dev_t device;
+      ino_t inode;
+      off_t size;
+      time_t mtime;
+
+      bool operator<(const file_identity &other) const {
+        if (filename != other.filename) return filename < other.filename;
+        if (device != other.device) return device < other.device;
+        if (inode != other.inode) return inode < other.inode;
+        if (size != other.size) return size < other.size;
+        return mtime < other.mtime;
+      }
+    };
+
+    /**
+     * A cache of the NXmx entries loaded from files, so that opening the same
+     * files again in a run costs only a stat of the file. The oldest entries
+     * are removed when it is full.
+     */
+    class nxmx_cache {
+    public:
+      static const std::size_t max_size = 256;
+
+      bool find(const file_identity &key, af::shared<NXmx> &result) const {
+        std::map<file_identity, af::shared<NXmx> >::const_iterator it =
+          entries_.find(key);
+        if (it == entries_.end()) {
+          return false;
+        }
+        result = af::shared<NXmx>(it->second.begin(), it->second.end());
+        return true;
+      }
+
+      void insert(const file_identity &key, const af::shared<NXmx> &value) {
+        if (entries_.find(key) == entries_.end()) {
+          order_.push_back(key);
+        }
+        entries_[key] = af::shared<NXmx>(value.begin(), value.end());
+        while (order_.size() > max_size) {
+          entries_.erase(order_.front());
+          order_.pop_front();
+        }
+      }
+
+    private:
+      std::map<file_identity, af::shared<NXmx> > entries_;
+      std::deque<file_identity> order_;
+    };
+
   }  // namespace detail
 
   af::shared<NXmx> load(const char *filename) {
@@ -76,6 +177,22 @@ namespace dials { namespace nexus { namespace boost_python {
     // The result
     af::shared<NXmx> result;
 
+    // Return the entries from the cache if the file has not changed
+    static detail::nxmx_cache cache;
+    detail::file_identity key;
+    struct stat status;
+    bool cacheable = stat(filename, &status) == 0;
+    if (cacheable) {
+      key.filename = filename;
+      key.device = status.st_dev;
+      key.inode = status.st_ino;
+      key.size = status.st_size;
+      key.mtime = status.st_mtime;
+      if (cache.find(key, result)) {
+        return result;
+      }
+    }
+
     // Open the hdf file
     H5::H5File handle(filename, H5F_ACC_RDONLY);
 
@@ -97,6 +214,9 @@ namespace dials { namespace nexus { namespace boost_python {
     }
 
     // Return the result
+    if (cacheable) {
+      cache.insert(key, result);
+    }
     return result;
   };
 
@@ -286,6 +406,15 @@ namespace dials { namespace nexus { namespace boost_python {
     to_and_from_python<boost::optional<NXbeam> >();
     to_and_from_python<boost::optional<NXdata> >();
 
+    class_<ChunkedImageReader, boost::noncopyable>("ChunkedImageReader", no_init)
+      .def(init<const char *, const char *>((arg("filename"), arg("path"))))
+      .def("num_frames", &ChunkedImageReader::num_frames)
+      .def("image_size", &ChunkedImageReader::image_size)
+      .def("is_direct", &ChunkedImageReader::is_direct)
+      .def("read_frames",
+           &ChunkedImageReader::read_frames,
+           (arg("first"), arg("last"), arg("nthreads") = 1));
+
     // Methods to load and dump NXmx
     def("load", load);
     def("dump", dump);
@@ -0,0 +1,417 @@
+
+#ifndef DIALS_NEXUS_CHUNKED_READER_H
+#define DIALS_NEXUS_CHUNKED_READER_H
+
+#include <H5Cpp.h>
+#include <H5DOpublic.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace nexus {
+
+  namespace detail {
+
+    /** The HDF5 filter id of bitshuffle */
+    const H5Z_filter_t BSHUF_FILTER_ID = 32008;
+
+    /** The bitshuffle filter option for LZ4 compression */
+    const unsigned int BSHUF_LZ4 = 2;
+
+    inline boost::uint64_t read_uint64_be(const unsigned char *p) {
+      boost::uint64_t result = 0;
+      for (std::size_t i = 0; i < 8; ++i) {
+        result = (result << 8) | p[i];
+      }
+      return result;
+    }
+
+    inline boost::uint32_t read_uint32_be(const unsigned char *p) {
+      return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16)
+             | ((boost::uint32_t)p[2] << 8) | (boost::uint32_t)p[3];
+    }
+
+    /**
+     * Decompress an LZ4 block which must fill the destination exactly
+     * @returns The number of bytes of the source used
+     */
+    inline std::size_t lz4_decompress(const unsigned char *src,
+                                      std::size_t src_size,
+                                      unsigned char *dst,
+                                      std::size_t dst_size) {
+      const unsigned char *ip = src;
+      const unsigned char *iend = src + src_size;
+      unsigned char *op = dst;
+      unsigned char *oend = dst + dst_size;
+      while (op < oend) {
+        DIALS_ASSERT(ip < iend);
+        unsigned int token = *ip++;
+
+        // Copy the literals
+        std::size_t length = token >> 4;
+        if (length == 15) {
+          unsigned char b;
+          do {
+            DIALS_ASSERT(ip < iend);
+            b = *ip++;
+            length += b;
+          } while (b == 255);
+        }
+        DIALS_ASSERT(length <= (std::size_t)(iend - ip));
+        DIALS_ASSERT(length <= (std::size_t)(oend - op));
+        std::memcpy(op, ip, length);
+        ip += length;
+        op += length;
+        if (op == oend) {
+          break;
+        }
+
+        // Copy the match, which may overlap the output
+        DIALS_ASSERT(iend - ip >= 2);
+        std::size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        DIALS_ASSERT(offset > 0 && offset <= (std::size_t)(op - dst));
+        length = token & 15;
+        if (length == 15) {
+          unsigned char b;
+          do {
+            DIALS_ASSERT(ip < iend);
+            b = *ip++;
+            length += b;
+          } while (b == 255);
+        }
+        length += 4;
+        DIALS_ASSERT(length <= (std::size_t)(oend - op));
+        const unsigned char *match = op - offset;
+        for (std::size_t i = 0; i < length; ++i) {
+          op[i] = match[i];
+        }
+        op += length;
+      }
+      return ip - src;
+    }
+
+    /**
+     * Undo the bit transpose of a bitshuffle block of n elements of size
+     * elem_size, where n is a multiple of 8. Bit k of byte j of element i is
+     * stored at bit i of row (8 * j + k).
+     */
+    inline void bitunshuffle(const unsigned char *src,
+                             unsigned char *dst,
+                             std::size_t n,
+                             std::size_t elem_size) {
+      std::size_t row_size = n / 8;
+      std::memset(dst, 0, n * elem_size);
+      for (std::size_t j = 0; j < elem_size; ++j) {
+        for (std::size_t k = 0; k < 8; ++k) {
+          const unsigned char *row = src + (8 * j + k) * row_size;
+          for (std::size_t b = 0; b < row_size; ++b) {
+            unsigned int bits = row[b];
+            unsigned char *out = dst + 8 * b * elem_size + j;
+            while (bits != 0) {
+              std::size_t i = 0;
+              while (((bits >> i) & 1) == 0) {
+                ++i;
+              }
+              out[i * elem_size] |= (unsigned char)(1 << k);
+              bits &= bits - 1;
+            }
+          }
+        }
+      }
+    }
+
+    /**
+     * Decompress a chunk written by the bitshuffle filter with LZ4
+     * compression into dst, which has space for size bytes.
+     */
+    inline void bitshuffle_lz4_decompress(const unsigned char *src,
+                                          std::size_t src_size,
+                                          unsigned char *dst,
+                                          std::size_t size,
+                                          std::size_t elem_size) {
+      DIALS_ASSERT(src_size >= 12);
+      DIALS_ASSERT(read_uint64_be(src) == size);
+      std::size_t block_size = read_uint32_be(src + 8) / elem_size;
+      DIALS_ASSERT(block_size > 0 && block_size % 8 == 0);
+      const unsigned char *ip = src + 12;
+      const unsigned char *iend = src + src_size;
+      std::size_t nelem = size / elem_size;
+      std::vector<unsigned char> block(block_size * elem_size);
+
+      // The full blocks, then a last block of a multiple of 8 elements
+      std::size_t done = 0;
+      while (nelem - done >= 8) {
+        std::size_t n = std::min(block_size, nelem - done);
+        n -= n % 8;
+        DIALS_ASSERT(iend - ip >= 4);
+        std::size_t nbytes = read_uint32_be(ip);
+        ip += 4;
+        DIALS_ASSERT(nbytes <= (std::size_t)(iend - ip));
+        lz4_decompress(ip, nbytes, &block[0], n * elem_size);
+        ip += nbytes;
+        bitunshuffle(&block[0], dst + done * elem_size, n, elem_size);
+        done += n;
+      }
+
+      // The remaining elements are stored as they are
+      std::size_t leftover = (nelem - done) * elem_size;
+      DIALS_ASSERT(leftover <= (std::size_t)(iend - ip));
+      std::memcpy(dst + done * elem_size, ip, leftover);
+    }
+
+    /**
+     * Convert n little endian integers of the given size and signedness to
+     * int. Unsigned values too large for an int are clamped, as HDF5 does.
+     */
+    inline void convert_to_int(const unsigned char *src,
+                               int *dst,
+                               std::size_t n,
+                               std::size_t elem_size,
+                               bool is_signed) {
+      for (std::size_t i = 0; i < n; ++i) {
+        const unsigned char *p = src + i * elem_size;
+        boost::uint32_t value = 0;
+        for (std::size_t b = 0; b < elem_size; ++b) {
+          value |= (boost::uint32_t)p[b] << (8 * b);
+        }
+        if (is_signed && elem_size < 4 && (value >> (8 * elem_size - 1)) & 1) {
+          value |= ~boost::uint32_t(0) << (8 * elem_size);
+        }
+        if (!is_signed && elem_size == 4 && value > 0x7FFFFFFF) {
+          value = 0x7FFFFFFF;
+        }
+        dst[i] = (int)value;
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * Read frames from a 3D image dataset of a NeXus file chunk by chunk. When
+   * the dataset is chunked by whole frames of little endian integers, and is
+   * uncompressed or compressed with bitshuffle/LZ4, the raw chunks are read
+   * with the HDF5 direct chunk read and decompressed on a thread pool.
+   * Otherwise the frames are read with HDF5 as usual.
+   */
+  class ChunkedImageReader {
+  public:
+    /**
+     * @param filename The NeXus file
+     * @param path The path to the image dataset in the file
+     */
+    ChunkedImageReader(const char *filename, const char *path)
+        : file_(filename, H5F_ACC_RDONLY),
+          dataset_(file_.openDataSet(path)),
+          direct_(false),
+          compressed_(false),
+          elem_size_(0),
+          is_signed_(false),
+          frames_per_chunk_(1) {
+      H5::DataSpace space = dataset_.getSpace();
+      DIALS_ASSERT(space.getSimpleExtentNdims() == 3);
+      space.getSimpleExtentDims(dims_);
+
+      // Check the element type
+      H5::DataType dtype = dataset_.getDataType();
+      if (dtype.getClass() != H5T_INTEGER) {
+        return;
+      }
+      H5::IntType itype = dataset_.getIntType();
+      elem_size_ = itype.getSize();
+      is_signed_ = itype.getSign() == H5T_SGN_2;
+      if (elem_size_ > 4 || itype.getOrder() != H5T_ORDER_LE) {
+        return;
+      }
+
+      // Check the chunks hold whole frames
+      H5::DSetCreatPropList plist = dataset_.getCreatePlist();
+      if (plist.getLayout() != H5D_CHUNKED) {
+        return;
+      }
+      hsize_t chunk[3];
+      DIALS_ASSERT(plist.getChunk(3, chunk) == 3);
+      if (chunk[1] != dims_[1] || chunk[2] != dims_[2]) {
+        return;
+      }
+      frames_per_chunk_ = chunk[0];
+
+      // Check the filters are ones that can be undone here
+      int nfilters = plist.getNfilters();
+      if (nfilters > 1) {
+        return;
+      }
+      if (nfilters == 1) {
+        unsigned int flags = 0;
+        unsigned int cd_values[8];
+        std::size_t cd_nelmts = 8;
+        char name[64];
+        unsigned int config = 0;
+        H5Z_filter_t filter =
+          plist.getFilter(0, flags, cd_nelmts, cd_values, sizeof(name), name, config);
+        if (filter != detail::BSHUF_FILTER_ID || cd_nelmts < 5
+            || cd_values[4] != detail::BSHUF_LZ4) {
+          return;
+        }
+        compressed_ = true;
+      }
+      direct_ = true;
+    }
+
+    /**
+     * @returns The number of frames
+     */
+    std::size_t num_frames() const {
+      return dims_[0];
+    }
+
+    /**
+     * @returns The size of the frames (ny, nx)
+     */
+    af::tiny<std::size_t, 2> image_size() const {
+      return af::tiny<std::size_t, 2>(dims_[1], dims_[2]);
+    }
+
+    /**
+     * @returns Whether the chunks are read and decompressed directly
+     */
+    bool is_direct() const {
+      return direct_;
+    }
+
+    /**
+     * Read the frames [first, last)
+     * @param first The first frame
+     * @param last The last frame
+     * @param nthreads The number of threads for decompression
+     */
+    af::versa<int, af::c_grid<3> > read_frames(std::size_t first,
+                                               std::size_t last,
+                                               std::size_t nthreads = 1) {
+      DIALS_ASSERT(first <= last && last <= dims_[0]);
+      af::versa<int, af::c_grid<3> > result(
+        af::c_grid<3>(last - first, dims_[1], dims_[2]));
+      if (first == last) {
+        return result;
+      }
+      if (!direct_) {
+        read_hyperslab(first, last, result.begin());
+        return result;
+      }
+
+      // Read the raw chunks from the file; HDF5 calls are not thread safe so
+      // this is done serially
+      std::size_t first_chunk = first / frames_per_chunk_;
+      std::size_t last_chunk = (last - 1) / frames_per_chunk_ + 1;
+      std::vector<Chunk> chunks(last_chunk - first_chunk);
+      for (std::size_t i = 0; i < chunks.size(); ++i) {
+        read_chunk(first_chunk + i, chunks[i]);
+      }
+
+      // Decompress the chunks into the frames on the thread pool
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&ChunkedImageReader::decode_chunks,
+                    this,
+                    boost::cref(chunks),
+                    first_chunk,
+                    first,
+                    last,
+                    result.begin(),
+                    _1,
+                    _2),
+        chunks.size(),
+        nthreads);
+      return result;
+    }
+
+  private:
+    struct Chunk {
+      std::vector<unsigned char> data;
+      boost::uint32_t filter_mask;
+      std::size_t nframes;
+    };
+
+    void read_chunk(std::size_t index, Chunk &chunk) {
+      hsize_t offset[3] = {index * frames_per_chunk_, 0, 0};
+      hsize_t nbytes = 0;
+      DIALS_ASSERT(H5Dget_chunk_storage_size(dataset_.getId(), offset, &nbytes) >= 0);
+      chunk.data.resize(nbytes);
+      chunk.nframes = std::min(frames_per_chunk_, dims_[0] - offset[0]);
+#if H5_VERSION_GE(1, 10, 3)
+      herr_t status = H5Dread_chunk(
+        dataset_.getId(), H5P_DEFAULT, offset, &chunk.filter_mask, &chunk.data[0]);
+#else
+      herr_t status = H5DOread_chunk(
+        dataset_.getId(), H5P_DEFAULT, offset, &chunk.filter_mask, &chunk.data[0]);
+#endif
+      DIALS_ASSERT(status >= 0);
+    }
+
+    /**
+     * Decode the chunks [first, last) into the frames [first_frame,
+     * last_frame) of the result
+     */
+    void decode_chunks(const std::vector<Chunk> &chunks,
+                       std::size_t first_chunk,
+                       std::size_t first_frame,
+                       std::size_t last_frame,
+                       int *result,
+                       std::size_t first,
+                       std::size_t last) const {
+      std::size_t frame_size = dims_[1] * dims_[2];
+      std::vector<unsigned char> buffer;
+      for (std::size_t i = first; i < last; ++i) {
+        const Chunk &chunk = chunks[i];
+
+        // The raw chunk holds frames of all chunk rows, even at the end
+        std::size_t chunk_bytes = frames_per_chunk_ * frame_size * elem_size_;
+        const unsigned char *data = &chunk.data[0];
+        if (compressed_ && (chunk.filter_mask & 1) == 0) {
+          buffer.resize(chunk_bytes);
+          detail::bitshuffle_lz4_decompress(
+            data, chunk.data.size(), &buffer[0], chunk_bytes, elem_size_);
+          data = &buffer[0];
+        } else {
+          DIALS_ASSERT(chunk.data.size() >= chunk.nframes * frame_size * elem_size_);
+        }
+
+        // Convert the frames of the chunk which are wanted
+        std::size_t chunk_first = (first_chunk + i) * frames_per_chunk_;
+        std::size_t f0 = std::max(chunk_first, first_frame);
+        std::size_t f1 = std::min(chunk_first + chunk.nframes, last_frame);
+        detail::convert_to_int(data + (f0 - chunk_first) * frame_size * elem_size_,
+                               result + (f0 - first_frame) * frame_size,
+                               (f1 - f0) * frame_size,
+                               elem_size_,
+                               is_signed_);
+      }
+    }
+
+    void read_hyperslab(std::size_t first, std::size_t last, int *result) {
+      hsize_t offset[3] = {first, 0, 0};
+      hsize_t count[3] = {last - first, dims_[1], dims_[2]};
+      H5::DataSpace filespace = dataset_.getSpace();
+      filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+      H5::DataSpace memspace(3, count);
+      dataset_.read(result, H5::PredType::NATIVE_INT, memspace, filespace);
+    }
+
+    H5::H5File file_;
+    H5::DataSet dataset_;
+    hsize_t dims_[3];
+    bool direct_;
+    bool compressed_;
+    std::size_t elem_size_;
+    bool is_signed_;
+    std::size_t frames_per_chunk_;
+  };
+
+}}  // namespace dials::nexus
+
+#endif  // DIALS_NEXUS_CHUNKED_READER_H
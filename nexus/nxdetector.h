@@ -30,10 +30,10 @@ namespace dials { namespace nexus {
     boost::optional<bool> flatfield_applied;
     boost::optional<bool> pixel_mask_applied;
     boost::optional<bool> countrate_correction_applied_applied;
-    af::versa<double, af::c_grid<2> > angular_calibration;
-    af::versa<double, af::c_grid<2> > flatfield;
-    af::versa<double, af::c_grid<2> > flatfield_error;
-    af::versa<int, af::c_grid<2> > pixel_mask;
+    lazy_dataset<af::versa<double, af::c_grid<2> > > angular_calibration;
+    lazy_dataset<af::versa<double, af::c_grid<2> > > flatfield;
+    lazy_dataset<af::versa<double, af::c_grid<2> > > flatfield_error;
+    lazy_dataset<af::versa<int, af::c_grid<2> > > pixel_mask;
     af::shared<NXdetector_module> module;
   };
 
@@ -100,15 +100,14 @@ namespace dials { namespace nexus {
             result.countrate_correction_applied_applied = serialize<bool>::load(dset);
           } else if (name == "angular_calibration") {
             result.angular_calibration =
-              serialize<af::versa<double, af::c_grid<2> > >::load(dset);
+              lazy_dataset<af::versa<double, af::c_grid<2> > >(dset);
           } else if (name == "flatfield") {
-            result.flatfield =
-              serialize<af::versa<double, af::c_grid<2> > >::load(dset);
+            result.flatfield = lazy_dataset<af::versa<double, af::c_grid<2> > >(dset);
           } else if (name == "flatfield_error") {
             result.flatfield_error =
-              serialize<af::versa<double, af::c_grid<2> > >::load(dset);
+              lazy_dataset<af::versa<double, af::c_grid<2> > >(dset);
           } else if (name == "pixel_mask") {
-            result.pixel_mask = serialize<af::versa<int, af::c_grid<2> > >::load(dset);
+            result.pixel_mask = lazy_dataset<af::versa<int, af::c_grid<2> > >(dset);
           }
         } break;
 
@@ -3,6 +3,8 @@
 #define DIALS_NEXUS_SERIALIZE_H
 
 #include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -15,9 +17,9 @@ namespace dials { namespace nexus {
 
   std::string dataset_name(const H5::DataSet &ds) {
     size_t len = H5Iget_name(ds.getId(), NULL, 0);
-    char buffer[len];
-    H5Iget_name(ds.getId(), buffer, len + 1);
-    std::string n = buffer;
+    std::vector<char> buffer(len + 1);
+    H5Iget_name(ds.getId(), &buffer[0], len + 1);
+    std::string n = &buffer[0];
     return n;
   }
 
@@ -199,6 +201,56 @@ namespace dials { namespace nexus {
     static void dump(const af::versa<int, af::c_grid<2> > &obj, Handle &handle) {}
   };
 
+  /**
+   * The value of a dataset which is read from the file the first time it is
+   * needed, so that large arrays are not read when the metadata is loaded.
+   * Copies share the value, so it is read at most once.
+   */
+  template <typename T>
+  class lazy_dataset {
+  public:
+    lazy_dataset() : state_(new state()) {
+      state_->loaded = true;
+    }
+
+    lazy_dataset(const H5::DataSet &dataset) : state_(new state()) {
+      state_->filename = dataset.getFileName();
+      state_->path = dataset_name(dataset);
+      state_->loaded = false;
+    }
+
+    /**
+     * @returns The value, reading it from the file if not yet read
+     */
+    const T &get() const {
+      if (!state_->loaded) {
+        H5::H5File handle(state_->filename, H5F_ACC_RDONLY);
+        state_->value = serialize<T>::load(handle.openDataSet(state_->path));
+        state_->loaded = true;
+      }
+      return state_->value;
+    }
+
+    /**
+     * Set the value, which will then not be read from the file
+     */
+    void set(const T &value) {
+      state_.reset(new state());
+      state_->value = value;
+      state_->loaded = true;
+    }
+
+  private:
+    struct state {
+      std::string filename;
+      std::string path;
+      T value;
+      bool loaded;
+    };
+
+    boost::shared_ptr<state> state_;
+  };
+
   template <typename Handle>
   bool is_nx_class(const Handle &handle, std::string test_name) {
     if (handle.attrExists("NX_class")) {
@@ -11,6 +11,10 @@
 #ifndef DIALS_PYCHEF_H
 #define DIALS_PYCHEF_H
 
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <boost/bind.hpp>
 #include <cctbx/miller.h>
 #include <cctbx/miller/asu.h>
 #include <cctbx/miller/bins.h>
@@ -20,6 +24,7 @@
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/versa.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace pychef {
@@ -70,6 +75,12 @@ namespace dials { namespace pychef {
     bool centric_;
   };
 
+  /**
+   * The observations grouped by their unique miller index. The reflection
+   * indices are sorted by asu index, so each group is a contiguous range of
+   * the sorted indices, with the I(+) observations before the I(-)
+   * observations.
+   */
   struct Observations {
     Observations(scitbx::af::const_ref<cctbx::miller::index<> > const &miller_indices,
                  sgtbx::space_group space_group,
@@ -79,55 +90,175 @@ namespace dials { namespace pychef {
       cctbx::miller::map_to_asu(space_group.type(), anomalous_flag, asu_indices.ref());
       sgtbx::reciprocal_space::asu asu(space_group.type());
 
-      std::size_t n_minus = 0;
-      std::size_t n_plus = 0;
-
+      std::vector<char> minus(asu_indices.size(), false);
+      std::vector<char> centric(asu_indices.size(), false);
       for (std::size_t iref = 0; iref < asu_indices.size(); iref++) {
-        cctbx::miller::index<> h_uniq = asu_indices[iref];
-        int flag;
+        cctbx::miller::index<> &h_uniq = asu_indices[iref];
         miller::sym_equiv_indices sym_equiv(space_group, h_uniq);
         if (sym_equiv.is_centric()) {
-          flag = CENTRIC;
+          centric[iref] = true;
         } else {
           int asu_which = asu.which(h_uniq);
           DIALS_ASSERT((asu_which == 1) || (asu_which == -1));
-          if (asu_which == 1) {
-            flag = PLUS;
-          }
           if (asu_which != 1) {
             for (std::size_t i = 0; i < 3; i++) {
               h_uniq[i] *= -1;
             }
-            flag = MINUS;
+            minus[iref] = true;
           }
         }
-        ObservationGroup group;
-        map_type::iterator it = observation_groups_.find(h_uniq);
-        if (it == observation_groups_.end()) {
-          group = ObservationGroup(h_uniq, flag == CENTRIC);
-          observation_groups_[h_uniq] = group;
-        } else {
-          group = observation_groups_[h_uniq];
+      }
+
+      // Sort the reflections by unique index, then I(+) before I(-)
+      order_.resize(asu_indices.size());
+      for (std::size_t iref = 0; iref < order_.size(); iref++) {
+        order_[iref] = iref;
+      }
+      std::sort(order_.begin(),
+                order_.end(),
+                CompareObservation(asu_indices.const_ref(), minus));
+
+      // Find the start of each group and of its I(-) observations
+      for (std::size_t k = 0; k < order_.size(); k++) {
+        std::size_t iref = order_[k];
+        if (k == 0 || asu_indices[iref] != miller_index_.back()) {
+          group_offset_.push_back(k);
+          minus_offset_.push_back(k);
+          miller_index_.push_back(asu_indices[iref]);
+          centric_.push_back(centric[iref]);
         }
-        if (flag == MINUS) {
-          n_minus++;
-          group.add_iminus(iref);
-        } else {
-          n_plus++;
-          group.add_iplus(iref);
+        if (!minus[iref]) {
+          minus_offset_.back() = k + 1;
         }
       }
+      group_offset_.push_back(order_.size());
     }
 
     typedef std::map<cctbx::miller::index<>, ObservationGroup> map_type;
 
-    map_type observation_groups_;
+    /**
+     * @returns The observation groups keyed by unique miller index
+     */
+    map_type observation_groups() const {
+      map_type result;
+      for (std::size_t g = 0; g < size(); g++) {
+        ObservationGroup group(miller_index_[g], centric_[g]);
+        af::const_ref<std::size_t> plus = iplus(g);
+        af::const_ref<std::size_t> minus = iminus(g);
+        for (std::size_t i = 0; i < plus.size(); i++) {
+          group.add_iplus(plus[i]);
+        }
+        for (std::size_t i = 0; i < minus.size(); i++) {
+          group.add_iminus(minus[i]);
+        }
+        result[miller_index_[g]] = group;
+      }
+      return result;
+    }
+
+    /** @returns The number of groups */
+    std::size_t size() const {
+      return miller_index_.size();
+    }
+
+    /** @returns The I(+) (or centric) reflection indices of a group */
+    af::const_ref<std::size_t> iplus(std::size_t g) const {
+      DIALS_ASSERT(g < size());
+      return af::const_ref<std::size_t>(&order_[0] + group_offset_[g],
+                                        minus_offset_[g] - group_offset_[g]);
+    }
 
-    map_type observation_groups() {
-      return observation_groups_;
+    /** @returns The I(-) reflection indices of a group */
+    af::const_ref<std::size_t> iminus(std::size_t g) const {
+      DIALS_ASSERT(g < size());
+      return af::const_ref<std::size_t>(&order_[0] + minus_offset_[g],
+                                        group_offset_[g + 1] - minus_offset_[g]);
     }
+
+    /** @returns Is the group centric */
+    bool is_centric(std::size_t g) const {
+      DIALS_ASSERT(g < size());
+      return centric_[g];
+    }
+
+  private:
+    struct CompareObservation {
+      af::const_ref<cctbx::miller::index<> > h;
+      const std::vector<char> &minus;
+
+      CompareObservation(af::const_ref<cctbx::miller::index<> > h_,
+                         const std::vector<char> &minus_)
+          : h(h_), minus(minus_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        if (h[a] != h[b]) {
+          return h[a] < h[b];
+        }
+        if (minus[a] != minus[b]) {
+          return minus[a] < minus[b];
+        }
+        return a < b;
+      }
+    };
+
+    std::vector<std::size_t> order_;
+    std::vector<std::size_t> group_offset_;
+    std::vector<std::size_t> minus_offset_;
+    std::vector<cctbx::miller::index<> > miller_index_;
+    std::vector<char> centric_;
   };
 
+  namespace detail {
+
+    /**
+     * Counts and sums of a growing set of values, held in a Fenwick tree over
+     * the ranks of the values in a sorted list of all the values that will be
+     * inserted. This gives the sum of the absolute differences between the set
+     * and any value in logarithmic time.
+     */
+    class RankSums {
+    public:
+      RankSums(std::vector<double> const &sorted)
+          : sorted_(sorted),
+            count_(sorted.size() + 1, 0),
+            sum_(sorted.size() + 1, 0.0),
+            total_count_(0),
+            total_sum_(0.0) {}
+
+      void insert(double x) {
+        std::size_t i =
+          std::lower_bound(sorted_.begin(), sorted_.end(), x) - sorted_.begin();
+        DIALS_ASSERT(i < sorted_.size());
+        for (i++; i < count_.size(); i += i & (~i + 1)) {
+          count_[i]++;
+          sum_[i] += x;
+        }
+        total_count_++;
+        total_sum_ += x;
+      }
+
+      double sum_abs_difference(double x) const {
+        std::size_t count = 0;
+        double sum = 0.0;
+        std::size_t i =
+          std::upper_bound(sorted_.begin(), sorted_.end(), x) - sorted_.begin();
+        for (; i > 0; i -= i & (~i + 1)) {
+          count += count_[i];
+          sum += sum_[i];
+        }
+        return (x * count - sum) + ((total_sum_ - sum) - x * (total_count_ - count));
+      }
+
+    private:
+      std::vector<double> const &sorted_;
+      std::vector<std::size_t> count_;
+      std::vector<double> sum_;
+      std::size_t total_count_;
+      double total_sum_;
+    };
+
+  }  // namespace detail
+
   namespace accumulator {
 
     class CompletenessAccumulator {
@@ -150,14 +281,34 @@ namespace dials { namespace pychef {
             ieither_comp_overall(n_steps, 0.0),
             iboth_comp_overall(n_steps, 0.0) {}
 
-      void operator()(ObservationGroup group) {
+      /**
+       * The counts accumulated from a subset of the groups
+       */
+      struct Partial {
+        std::vector<double> iplus_count, iminus_count, ieither_count, iboth_count;
+
+        Partial(std::size_t n)
+            : iplus_count(n, 0.0),
+              iminus_count(n, 0.0),
+              ieither_count(n, 0.0),
+              iboth_count(n, 0.0) {}
+      };
+
+      Partial partial() const {
+        return Partial(binner_.n_bins_used() * n_steps_);
+      }
+
+      void operator()(Partial &p,
+                      af::const_ref<std::size_t> const &iplus,
+                      af::const_ref<std::size_t> const &iminus,
+                      bool centric) const {
         std::size_t dose_min_iplus = 1e8;
         std::size_t dose_min_iminus = 1e8;
         std::size_t i_bin;
-        if (group.iplus().size()) {
-          i_bin = binner_.get_i_bin(d_star_sq_[group.iplus()[0]]);
+        if (iplus.size()) {
+          i_bin = binner_.get_i_bin(d_star_sq_[iplus[0]]);
         } else {
-          i_bin = binner_.get_i_bin(d_star_sq_[group.iminus()[0]]);
+          i_bin = binner_.get_i_bin(d_star_sq_[iminus[0]]);
         }
 
         if (i_bin == 0) {
@@ -167,33 +318,44 @@ namespace dials { namespace pychef {
 
         i_bin -= 1;
 
-        for (std::size_t i = 0; i < group.iplus().size(); i++) {
-          std::size_t dose_i = dose_[group.iplus()[i]];
+        for (std::size_t i = 0; i < iplus.size(); i++) {
+          std::size_t dose_i = dose_[iplus[i]];
           dose_min_iplus = std::min(dose_i, dose_min_iplus);
-          if (group.is_centric()) {
+          if (centric) {
             dose_min_iminus = std::min(dose_i, dose_min_iminus);
           }
         }
 
-        for (std::size_t i = 0; i < group.iminus().size(); i++) {
-          for (std::size_t j = 0; j < group.iplus().size(); j++) {
-            DIALS_ASSERT(group.iminus()[i] != group.iplus()[j]);
-          }
-          std::size_t dose_i = dose_[group.iminus()[i]];
+        for (std::size_t i = 0; i < iminus.size(); i++) {
+          std::size_t dose_i = dose_[iminus[i]];
           dose_min_iminus = std::min(dose_i, dose_min_iminus);
         }
 
+        std::size_t k = i_bin * n_steps_;
+        std::size_t dose_min_either = std::min(dose_min_iplus, dose_min_iminus);
+        std::size_t dose_min_both = std::max(dose_min_iplus, dose_min_iminus);
         if (dose_min_iplus < n_steps_) {
-          iplus_count(i_bin, dose_min_iplus) += 1.0;
+          p.iplus_count[k + dose_min_iplus] += 1.0;
         }
         if (dose_min_iminus < n_steps_) {
-          iminus_count(i_bin, dose_min_iminus) += 1.0;
+          p.iminus_count[k + dose_min_iminus] += 1.0;
         }
-        if (std::min(dose_min_iplus, dose_min_iminus) < n_steps_) {
-          ieither_count(i_bin, std::min(dose_min_iplus, dose_min_iminus)) += 1.0;
+        if (dose_min_either < n_steps_) {
+          p.ieither_count[k + dose_min_either] += 1.0;
         }
-        if (std::max(dose_min_iplus, dose_min_iminus) < n_steps_) {
-          iboth_count(i_bin, std::max(dose_min_iplus, dose_min_iminus)) += 1.0;
+        if (dose_min_both < n_steps_) {
+          p.iboth_count[k + dose_min_both] += 1.0;
+        }
+      }
+
+      void merge(Partial const &p) {
+        DIALS_ASSERT(!finalised_);
+        DIALS_ASSERT(p.iplus_count.size() == iplus_count.size());
+        for (std::size_t k = 0; k < iplus_count.size(); k++) {
+          iplus_count[k] += p.iplus_count[k];
+          iminus_count[k] += p.iminus_count[k];
+          ieither_count[k] += p.ieither_count[k];
+          iboth_count[k] += p.iboth_count[k];
         }
       }
 
@@ -323,52 +485,113 @@ namespace dials { namespace pychef {
             rcp_(n_steps, 0.0),
             scp_(n_steps, 0.0) {}
 
-      void operator()(ObservationGroup group) {
-        if (group.iplus().size()) {
-          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iplus()[0]]);
-          if (i_bin > binner_.n_bins_used()) {
-          }
+      /**
+       * The sums accumulated from a subset of the groups
+       */
+      struct Partial {
+        std::vector<double> A, B, isigma;
+        std::vector<std::size_t> count;
+
+        Partial(std::size_t n) : A(n, 0.0), B(n, 0.0), isigma(n, 0.0), count(n, 0) {}
+      };
+
+      Partial partial() const {
+        return Partial(binner_.n_bins_used() * n_steps_);
+      }
+
+      void operator()(Partial &p,
+                      af::const_ref<std::size_t> const &iplus,
+                      af::const_ref<std::size_t> const &iminus,
+                      bool centric) const {
+        if (iplus.size()) {
+          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[iplus[0]]);
           DIALS_ASSERT(i_bin <= binner_.n_bins_used())(i_bin);
           if (i_bin == 0) {
             // outside "used" bins
             return;
           }
-          accumulate(group.iplus(), i_bin - 1);
+          accumulate(p, iplus, i_bin - 1);
         }
-        if (group.iminus().size()) {
-          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iminus()[0]]);
+        if (iminus.size()) {
+          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[iminus[0]]);
           DIALS_ASSERT(i_bin <= binner_.n_bins_used())(i_bin);
           if (i_bin == 0) {
             // outside "used" bins
             return;
           }
-          accumulate(group.iminus(), i_bin - 1);
+          accumulate(p, iminus, i_bin - 1);
+        }
+      }
+
+      void merge(Partial const &p) {
+        DIALS_ASSERT(!finalised_);
+        DIALS_ASSERT(p.A.size() == A.size());
+        for (std::size_t k = 0; k < A.size(); k++) {
+          A[k] += p.A[k];
+          B[k] += p.B[k];
+          isigma[k] += p.isigma[k];
+          count[k] += p.count[k];
         }
       }
 
     private:
-      void accumulate(scitbx::af::shared<std::size_t> irefs, std::size_t i_bin) {
+      /**
+       * Accumulate the terms for all pairs of observations. Each pair is
+       * counted at the later of the two doses, so with the observations sorted
+       * by dose, the pairs of observation j with the observations before it
+       * all fall at the dose of j. The sums of the pair terms are then found
+       * from the prefix sums of the earlier observations, with a Fenwick tree
+       * over the ranks of the intensities for the absolute values, rather
+       * than from a loop over the pairs.
+       */
+      void accumulate(Partial &p,
+                      af::const_ref<std::size_t> const &irefs,
+                      std::size_t i_bin) const {
         DIALS_ASSERT(i_bin < binner_.n_bins_used());
-        for (std::size_t i = 0; i < irefs.size(); i++) {
-          std::size_t dose_i = dose_[irefs[i]];
-          double I_i = intensities_[irefs[i]];
-          double sigi_i = sigmas_[irefs[i]];
-          for (std::size_t j = i + 1; j < irefs.size(); j++) {
-            std::size_t dose_j = dose_[irefs[j]];
-            double I_j = intensities_[irefs[j]];
-            double sigi_j = sigmas_[irefs[j]];
-            double A_part = std::fabs(I_i - I_j);
-            double B_part = 0.5 * std::fabs(I_i + I_j);
-            std::size_t dose_0 = std::max(dose_i, dose_j);
-            DIALS_ASSERT(dose_0 < n_steps_);
-            A(i_bin, dose_0) += A_part;
-            B(i_bin, dose_0) += B_part;
-            isigma(i_bin, dose_0) += ((I_i / sigi_i) + (I_j / sigi_j));
-            count(i_bin, dose_0) += 2;
+        std::size_t n = irefs.size();
+        if (n < 2) {
+          return;
+        }
+
+        // Sort the observations by dose
+        std::vector<std::size_t> order(irefs.begin(), irefs.end());
+        std::stable_sort(order.begin(), order.end(), CompareDose(dose_.const_ref()));
+        std::vector<double> values(n);
+        for (std::size_t i = 0; i < n; i++) {
+          values[i] = intensities_[order[i]];
+        }
+        std::sort(values.begin(), values.end());
+        detail::RankSums earlier(values);
+
+        double sum_isigma = 0;
+        double *A_row = &p.A[i_bin * n_steps_];
+        double *B_row = &p.B[i_bin * n_steps_];
+        double *isigma_row = &p.isigma[i_bin * n_steps_];
+        std::size_t *count_row = &p.count[i_bin * n_steps_];
+        for (std::size_t j = 0; j < n; j++) {
+          std::size_t dose_j = dose_[order[j]];
+          double I_j = intensities_[order[j]];
+          double isigma_j = I_j / sigmas_[order[j]];
+          if (j > 0) {
+            DIALS_ASSERT(dose_j < n_steps_);
+            A_row[dose_j] += earlier.sum_abs_difference(I_j);
+            B_row[dose_j] += 0.5 * earlier.sum_abs_difference(-I_j);
+            isigma_row[dose_j] += j * isigma_j + sum_isigma;
+            count_row[dose_j] += 2 * j;
           }
+          earlier.insert(I_j);
+          sum_isigma += isigma_j;
         }
       }
 
+      struct CompareDose {
+        af::const_ref<std::size_t> dose;
+        CompareDose(af::const_ref<std::size_t> dose_) : dose(dose_) {}
+        bool operator()(std::size_t a, std::size_t b) const {
+          return dose[a] < dose[b];
+        }
+      };
+
     public:
       void finalise() {
         DIALS_ASSERT(!finalised_);
@@ -470,27 +693,62 @@ namespace dials { namespace pychef {
             rd_bottom(n_steps, 0.0),
             rd_(n_steps, 0.0) {}
 
-      void operator()(ObservationGroup group) {
-        if (group.iplus().size()) {
-          accumulate(group.iplus());
+      /**
+       * The sums accumulated from a subset of the groups
+       */
+      struct Partial {
+        std::vector<double> rd_top, rd_bottom;
+
+        Partial(std::size_t n) : rd_top(n, 0.0), rd_bottom(n, 0.0) {}
+      };
+
+      Partial partial() const {
+        return Partial(n_steps_);
+      }
+
+      void operator()(Partial &p,
+                      af::const_ref<std::size_t> const &iplus,
+                      af::const_ref<std::size_t> const &iminus,
+                      bool centric) const {
+        if (iplus.size()) {
+          accumulate(p, iplus);
         }
-        if (group.iminus().size()) {
-          accumulate(group.iminus());
+        if (iminus.size()) {
+          accumulate(p, iminus);
+        }
+      }
+
+      void merge(Partial const &p) {
+        DIALS_ASSERT(!finalised_);
+        DIALS_ASSERT(p.rd_top.size() == rd_top.size());
+        for (std::size_t k = 0; k < rd_top.size(); k++) {
+          rd_top[k] += p.rd_top[k];
+          rd_bottom[k] += p.rd_bottom[k];
         }
       }
 
     private:
-      void accumulate(scitbx::af::shared<std::size_t> irefs) {
-        for (std::size_t i = 0; i < irefs.size(); i++) {
-          int dose_i = dose_[irefs[i]];
-          double I_i = intensities_[irefs[i]];
-          for (std::size_t j = i + 1; j < irefs.size(); j++) {
-            int dose_j = dose_[irefs[j]];
-            double I_j = intensities_[irefs[j]];
-            std::size_t d_dose = std::abs(dose_i - dose_j);
+      /**
+       * Accumulate the terms for all pairs of observations at their difference
+       * in dose. The terms depend on both doses, so the pairs are visited in
+       * turn, but from local copies of the doses and intensities.
+       */
+      void accumulate(Partial &p, af::const_ref<std::size_t> const &irefs) const {
+        std::size_t n = irefs.size();
+        std::vector<int> dose(n);
+        std::vector<double> intensity(n);
+        for (std::size_t i = 0; i < n; i++) {
+          dose[i] = dose_[irefs[i]];
+          intensity[i] = intensities_[irefs[i]];
+        }
+        for (std::size_t i = 0; i < n; i++) {
+          int dose_i = dose[i];
+          double I_i = intensity[i];
+          for (std::size_t j = i + 1; j < n; j++) {
+            std::size_t d_dose = std::abs(dose_i - dose[j]);
             DIALS_ASSERT(d_dose < n_steps_);
-            rd_top[d_dose] += std::fabs(I_i - I_j);
-            rd_bottom[d_dose] += 0.5 * (I_i + I_j);
+            p.rd_top[d_dose] += std::fabs(I_i - intensity[j]);
+            p.rd_bottom[d_dose] += 0.5 * (I_i + intensity[j]);
           }
         }
       }
@@ -536,19 +794,28 @@ namespace dials { namespace pychef {
                    cctbx::miller::binner const &binner,
                    sgtbx::space_group space_group,
                    bool anomalous_flag,
-                   int n_steps)
+                   int n_steps,
+                   std::size_t nthreads = 1)
         : observations(miller_indices, space_group, anomalous_flag),
           completeness_accumulator(dose, d_star_sq, binner, n_steps),
           rcp_scp_accumulator(intensities, sigmas, dose, d_star_sq, binner, n_steps),
           rd_accumulator(intensities, dose, n_steps) {
-      typedef Observations::map_type map_t;
-      map_t groups = observations.observation_groups();
-
-      for (map_t::iterator it = groups.begin(); it != groups.end(); it++) {
-        ObservationGroup group = it->second;
-        completeness_accumulator(group);
-        rcp_scp_accumulator(group);
-        rd_accumulator(group);
+      DIALS_ASSERT(nthreads > 0);
+
+      // Accumulate contiguous chunks of the groups in parallel, each into its
+      // own partial sums, and then add the partial sums in order
+      std::size_t nchunks =
+        std::max((std::size_t)1, std::min(nthreads, observations.size()));
+      std::vector<Partial> partial(nchunks, Partial(*this));
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(
+          &ChefStatistics::accumulate_chunks, this, boost::ref(partial), _1, _2),
+        nchunks,
+        nchunks);
+      for (std::size_t c = 0; c < nchunks; c++) {
+        completeness_accumulator.merge(partial[c].completeness);
+        rcp_scp_accumulator.merge(partial[c].rcp_scp);
+        rd_accumulator.merge(partial[c].rd);
       }
 
       completeness_accumulator.finalise(counts_complete);
@@ -609,6 +876,38 @@ namespace dials { namespace pychef {
     }
 
   private:
+    struct Partial {
+      accumulator::CompletenessAccumulator::Partial completeness;
+      accumulator::RcpScpAccumulator::Partial rcp_scp;
+      accumulator::RdAccumulator::Partial rd;
+
+      Partial(ChefStatistics const &stats)
+          : completeness(stats.completeness_accumulator.partial()),
+            rcp_scp(stats.rcp_scp_accumulator.partial()),
+            rd(stats.rd_accumulator.partial()) {}
+    };
+
+    /**
+     * Accumulate the groups of the chunks [first, last)
+     */
+    void accumulate_chunks(std::vector<Partial> &partial,
+                           std::size_t first,
+                           std::size_t last) const {
+      std::size_t nchunks = partial.size();
+      for (std::size_t c = first; c < last; c++) {
+        std::size_t g0 = (c * observations.size()) / nchunks;
+        std::size_t g1 = ((c + 1) * observations.size()) / nchunks;
+        for (std::size_t g = g0; g < g1; g++) {
+          af::const_ref<std::size_t> iplus = observations.iplus(g);
+          af::const_ref<std::size_t> iminus = observations.iminus(g);
+          bool centric = observations.is_centric(g);
+          completeness_accumulator(partial[c].completeness, iplus, iminus, centric);
+          rcp_scp_accumulator(partial[c].rcp_scp, iplus, iminus, centric);
+          rd_accumulator(partial[c].rd, iplus, iminus, centric);
+        }
+      }
+    }
+
     Observations observations;
 
     accumulator::CompletenessAccumulator completeness_accumulator;
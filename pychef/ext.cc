@@ -12,6 +12,7 @@
 #include <boost/python/def.hpp>
 #include <boost/python/suite/indexing/map_indexing_suite.hpp>
 #include <dials/pychef/Chef.h>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace pychef { namespace boost_python {
 
@@ -51,16 +52,18 @@ namespace dials { namespace pychef { namespace boost_python {
                 cctbx::miller::binner const &,
                 sgtbx::space_group,
                 bool,
-                int>((arg("miller_index"),
-                      arg("intensities"),
-                      arg("sigmas"),
-                      arg("d_star_sq"),
-                      arg("dose"),
-                      arg("counts_complete"),
-                      arg("binner"),
-                      arg("space_group"),
-                      arg("anomalous_flag"),
-                      arg("n_steps"))))
+                int,
+                std::size_t>((arg("miller_index"),
+                              arg("intensities"),
+                              arg("sigmas"),
+                              arg("d_star_sq"),
+                              arg("dose"),
+                              arg("counts_complete"),
+                              arg("binner"),
+                              arg("space_group"),
+                              arg("anomalous_flag"),
+                              arg("n_steps"),
+                              arg("nthreads") = 1)))
       .def("iplus_completeness", &chef_statistics_t::iplus_completeness)
       .def("iminus_completeness", &chef_statistics_t::iminus_completeness)
       .def("ieither_completeness", &chef_statistics_t::ieither_completeness)
@@ -77,6 +80,7 @@ namespace dials { namespace pychef { namespace boost_python {
   }
 
   BOOST_PYTHON_MODULE(dials_pychef_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_observations();
     export_observation_group();
     export_chef_statistics();
@@ -135,3 +135,103 @@ def test_robust(dials_data, model, tmpdir):
 
     scale4 = integrated4["background.scale"]
     assert (scale4 > 0).count(False) == 0
+
+
+def test_mapped_model(tmpdir):
+    import six.moves.cPickle as pickle
+
+    from dials.algorithms.background.gmodel import StaticBackgroundModel
+    from dials.array_family import flex
+
+    model = StaticBackgroundModel()
+    model.add(flex.double(flex.grid(5, 6), 1.5))
+    model.add(flex.double(flex.grid(3, 4), 0.25))
+    model_file = tmpdir.join("model.dat")
+    model.write(model_file.strpath)
+
+    mapped = StaticBackgroundModel(model_file.strpath)
+    assert mapped.filename() == model_file.strpath
+    assert len(mapped) == 2
+    for i in range(2):
+        assert list(mapped.data(i)) == list(model.data(i))
+        assert mapped.data(i).all() == model.data(i).all()
+
+    # Only the filename is pickled for a mapped model
+    copy = pickle.loads(pickle.dumps(mapped, pickle.HIGHEST_PROTOCOL))
+    assert copy.filename() == model_file.strpath
+    assert list(copy.data(1)) == list(model.data(1))
+
+    extracted = mapped.extract(0, (-1, 2, 3, 7, 0, 2))
+    assert extracted.all() == (2, 4, 3)
+    assert list(extracted) == ([0, 1.5, 1.5] * 2 + [0, 0, 0] * 2) * 2
+
+
+def test_model_builder():
+    from dxtbx.model import DetectorFactory
+
+    from dials.algorithms.background.gmodel import StaticBackgroundModelBuilder
+    from dials.array_family import flex
+
+    detector = DetectorFactory.simple(
+        "PAD", 100, (5, 5), "+x", "-y", (0.172, 0.172), (12, 10)
+    )
+    builder = StaticBackgroundModelBuilder(detector)
+    mask = flex.bool(flex.grid(10, 12), True)
+    mask[3, 0] = False
+    for frame in range(10):
+        data = flex.double(flex.grid(10, 12), 4 + frame % 2)
+        if frame == 5:
+            data[6, 6] = 1000
+        builder.add(0, data, mask, nthreads=2)
+    assert builder.num_images(0) == 10
+
+    # The pixel which is never valid and the one with an outlier are filled
+    # from their neighbours
+    model = builder.compute(min_count=5, nsigma=6)
+    assert len(model) == 1
+    assert list(model.data(0)) == pytest.approx([4.5] * 120)
+
+
+def test_polar_transform_threads():
+    from dxtbx.model import BeamFactory, DetectorFactory, GoniometerFactory
+
+    from dials.algorithms.background.gmodel import PolarTransform
+    from dials.algorithms.background.modeller import polar_transform
+    from dials.array_family import flex
+
+    beam = BeamFactory.simple(1.0)
+    detector = DetectorFactory.simple(
+        "PAD", 100, (3, 4), "+x", "-y", (0.172, 0.172), (60, 50)
+    )
+    goniometer = GoniometerFactory.known_axis((1, 0, 0))
+    data = flex.random_double(50 * 60) * 100
+    data.reshape(flex.grid(50, 60))
+    mask = flex.random_bool(50 * 60, 0.95)
+    mask.reshape(flex.grid(50, 60))
+
+    # The maps and transforms do not depend on the number of threads
+    results = []
+    for nthreads in (1, 4):
+        transform = PolarTransform(beam, detector[0], goniometer, nthreads=nthreads)
+        polar = transform.to_polar(data, mask, nthreads=nthreads)
+        image = transform.from_polar(polar.data(), polar.mask(), nthreads=nthreads)
+        results.append(
+            (
+                list(transform.image_xmap()),
+                list(transform.image_ymap()),
+                list(transform.discontinuity()),
+                list(polar.data()),
+                list(polar.mask()),
+                list(image.data()),
+                list(image.mask()),
+            )
+        )
+    assert results[0] == results[1]
+    assert results[0][3] != [0] * len(results[0][3])
+
+    # Transforms are shared between panels with the same geometry
+    transform = polar_transform(beam, detector[0], goniometer)
+    assert polar_transform(beam, detector[0], goniometer) is transform
+    assert list(transform.image_xmap()) == results[0][0]
+    goniometer = GoniometerFactory.known_axis((0, 1, 0))
+    assert polar_transform(beam, detector[0], goniometer) is not transform
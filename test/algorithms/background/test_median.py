@@ -0,0 +1,43 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+
+def generate_shoeboxes(num):
+    from dials.algorithms.shoebox import MaskCode
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    shoeboxes = flex.shoebox()
+    expected = []
+    for n in range(num):
+        sbox = Shoebox((0, random.randint(2, 8), 0, random.randint(2, 8), 0, 3))
+        sbox.allocate()
+        values = []
+        for i in range(len(sbox.data)):
+            if n % 2 == 0:
+                sbox.data[i] = random.randint(0, 20)
+            else:
+                sbox.data[i] = random.uniform(0, 1000)
+            if random.random() < 0.8:
+                sbox.mask[i] = MaskCode.Valid | MaskCode.Background
+                values.append(sbox.data[i])
+            else:
+                sbox.mask[i] = MaskCode.Valid | MaskCode.Foreground
+        shoeboxes.append(sbox)
+        expected.append(sorted(values)[len(values) // 2] if values else None)
+    return shoeboxes, expected
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_median(nthreads):
+    from dials.algorithms.background.median import create
+
+    shoeboxes, expected = generate_shoeboxes(20)
+    success = create(shoeboxes, nthreads=nthreads)
+    for sbox, median, s in zip(shoeboxes, expected, success):
+        assert s == (median is not None)
+        if median is not None:
+            assert list(sbox.background) == [median] * len(sbox.background)
@@ -6,6 +6,7 @@
     NormalOutlierRejector,
     NSigmaOutlierRejector,
     TruncatedOutlierRejector,
+    TukeyOutlierRejector,
 )
 from dials.algorithms.shoebox import MaskCode
 from dials.algorithms.simulation.generate_test_reflections import (
@@ -116,6 +117,41 @@ def assert_is_correct(data, mask):
         assert_is_correct(data, mask)
 
 
+def test_tukey():
+    lower = 1.5
+    upper = 1.5
+    reject = TukeyOutlierRejector(lower, upper)
+    size = (9, 9, 9)
+    ninvalid = 5
+    nforeground = 20
+    mean = 20
+
+    def assert_is_correct(data, mask):
+        (
+            invalid,
+            foreground,
+            background,
+            background_used,
+            background_valid,
+        ) = assert_basic_mask_is_correct(mask, ninvalid, nforeground)
+        subdata = data.select(background_valid)
+        values = sorted(subdata)
+        mid = len(values) // 2
+        q1 = values[mid // 2]
+        q3 = values[mid + (len(values) - mid) // 2]
+        p0 = q1 - lower * (q3 - q1)
+        p1 = q3 + upper * (q3 - q1)
+        mask = (subdata >= p0) & (subdata <= p1)
+        exp = background_valid.select(mask)
+        assert len(exp) == len(background_used)
+        assert all(ii == jj for ii, jj in zip(exp, background_used))
+
+    for i in range(10):
+        data, mask = generate_shoebox(size, mean, nforeground, ninvalid)
+        reject(data, mask)
+        assert_is_correct(data, mask)
+
+
 def test_normal():
     min_data = 10
     reject = NormalOutlierRejector(min_data)
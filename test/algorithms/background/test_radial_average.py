@@ -0,0 +1,69 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+
+@pytest.fixture
+def geometry():
+    from dxtbx.model import BeamFactory, DetectorFactory
+
+    beam = BeamFactory.make_beam(unit_s0=(0, 0, -1), wavelength=1.0)
+    detector = DetectorFactory.make_detector(
+        "PAD",
+        (1, 0, 0),
+        (0, -1, 0),
+        (-5.1, 4.7, -50),
+        (0.172, 0.172),
+        (61, 53),
+        (0, 2e20),
+    )
+    return beam, detector
+
+
+def generate_image(size):
+    from dials.array_family import flex
+
+    data = flex.double(flex.grid(size))
+    mask = flex.bool(flex.grid(size))
+    for k in range(len(data)):
+        data[k] = random.uniform(0, 100)
+        mask[k] = random.random() > 0.1
+    return data, mask
+
+
+def test_radial_average(geometry):
+    from dials.algorithms.background import RadialAverage
+
+    beam, detector = geometry
+    panel = detector[0]
+    vmin, vmax, num_bins = 0.0, 0.05, 20
+    width, height = panel.get_image_size()
+    images = [generate_image((height, width)) for i in range(3)]
+
+    # Compute the expected sums directly from the geometry
+    s0 = beam.get_s0()
+    expected_sum = [0.0] * num_bins
+    expected_weight = [0.0] * num_bins
+    for data, mask in images:
+        for j in range(height):
+            for i in range(width):
+                if mask[j, i]:
+                    d = panel.get_resolution_at_pixel(s0, (i, j))
+                    d2 = 1.0 / (d * d)
+                    if vmin <= d2 < vmax:
+                        index = int((d2 - vmin) / ((vmax - vmin) / num_bins))
+                        expected_sum[index] += data[j, i]
+                        expected_weight[index] += 1
+
+    for nthreads in [1, 4]:
+        average = RadialAverage(beam, detector, vmin, vmax, num_bins)
+        for data, mask in images:
+            average.add(data, mask, nthreads=nthreads)
+        assert list(average.weight()) == expected_weight
+        for mean, s, w in zip(average.mean(), expected_sum, expected_weight):
+            if w > 0:
+                assert mean == pytest.approx(s / w)
+            else:
+                assert mean == 0
@@ -0,0 +1,75 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from dxtbx.model import DetectorFactory, Experiment, ScanFactory
+
+from dials.algorithms.centroid.simple import centroid
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+
+
+def make_reflections(n, num_experiments):
+    reflections = flex.reflection_table()
+    reflections["id"] = flex.int(
+        [random.randint(0, num_experiments - 1) for i in range(n)]
+    )
+    reflections["panel"] = flex.size_t(n, 0)
+    bbox = flex.int6()
+    for i in range(n):
+        x0 = random.randint(0, 40)
+        y0 = random.randint(0, 40)
+        z0 = random.randint(0, 5)
+        bbox.append((x0, x0 + 5, y0, y0 + 6, z0, z0 + 3))
+    reflections["bbox"] = bbox
+    reflections["shoebox"] = flex.shoebox(
+        reflections["panel"], reflections["bbox"], allocate=True
+    )
+    for sbox in reflections["shoebox"]:
+        for j in range(len(sbox.data)):
+            sbox.data[j] = random.uniform(0, 100)
+            sbox.background[j] = random.uniform(0, 10)
+            sbox.mask[j] = MaskCode.Valid | MaskCode.Foreground
+    return reflections
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_simple_centroid(nthreads):
+    detector = DetectorFactory.simple(
+        "PAD", 100, (25, 25), "+x", "-y", (0.172, 0.172), (50, 50)
+    )
+    experiments = [
+        Experiment(
+            detector=detector,
+            scan=ScanFactory.make_scan((1, 10), 0.1, (0, 0.5), list(range(10))),
+        ),
+        Experiment(
+            detector=detector,
+            scan=ScanFactory.make_scan((1, 10), 0.1, (5, 0.2), list(range(10))),
+        ),
+        Experiment(detector=detector),
+    ]
+    reflections = make_reflections(500, len(experiments))
+    centroid(experiments, reflections, nthreads=nthreads)
+
+    # Check the centroids against the shoebox centroids
+    for i, sbox in enumerate(reflections["shoebox"]):
+        experiment = experiments[reflections["id"][i]]
+        expected = sbox.centroid_foreground_minus_background()
+        px = expected.px.position
+        assert reflections["xyzobs.px.value"][i] == px
+        assert reflections["xyzobs.px.variance"][i] == expected.px.std_err_sq
+        x, y = detector[0].pixel_to_millimeter(px[0:2])
+        mm = reflections["xyzobs.mm.value"][i]
+        assert mm[0:2] == pytest.approx((x, y))
+        variance = reflections["xyzobs.mm.variance"][i]
+        assert variance[0] == pytest.approx(expected.px.std_err_sq[0] * 0.172 ** 2)
+        if experiment.scan is None:
+            assert mm[2] == 0 and variance[2] == 0
+        else:
+            phi = experiment.scan.get_angle_from_array_index(px[2], deg=False)
+            width = experiment.scan.get_oscillation(deg=False)[1]
+            assert mm[2] == pytest.approx(phi)
+            assert variance[2] == pytest.approx(expected.px.std_err_sq[2] * width ** 2)
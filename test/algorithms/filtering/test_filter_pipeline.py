@@ -0,0 +1,129 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from dxtbx.model import BeamFactory, DetectorFactory, GoniometerFactory
+from scitbx import matrix
+
+from dials.algorithms import filtering
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+
+
+def make_reflections(n, s0, image_size, num_images):
+    reflections = flex.reflection_table()
+    s1 = flex.vec3_double()
+    bbox = flex.int6()
+    xyzobs = flex.vec3_double()
+    xyzcal = flex.vec3_double()
+    for i in range(n):
+        direction = matrix.col(
+            (random.uniform(-1, 1), random.uniform(-1, 1), random.uniform(-1, 1))
+        )
+        s1.append((direction.normalize() * s0.length()).elems)
+        x0 = random.randint(-2, image_size[1] - 2)
+        y0 = random.randint(-2, image_size[0] - 2)
+        z0 = random.randint(-1, num_images - 1)
+        bbox.append(
+            (
+                x0,
+                x0 + random.randint(1, 6),
+                y0,
+                y0 + random.randint(1, 6),
+                z0,
+                z0 + random.randint(1, 3),
+            )
+        )
+        x = random.uniform(0, image_size[1])
+        y = random.uniform(0, image_size[0])
+        xyzcal.append((x, y, random.uniform(0, num_images)))
+        xyzobs.append(
+            (x + random.gauss(0, 1), y + random.gauss(0, 1), random.uniform(0, 10))
+        )
+    reflections["s1"] = s1
+    reflections["bbox"] = bbox
+    reflections["panel"] = flex.size_t(n, 0)
+    reflections["xyzobs.px.value"] = xyzobs
+    reflections["xyzcal.px"] = xyzcal
+    return reflections
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_filter_pipeline(nthreads):
+    image_size = (50, 60)
+    num_images = 10
+    beam = BeamFactory.simple(1.0)
+    detector = DetectorFactory.simple(
+        "PAD", 100, (5, 5), "+x", "-y", (0.172, 0.172), image_size[::-1]
+    )
+    goniometer = GoniometerFactory.known_axis((1, 0, 0))
+    mask = flex.random_bool(image_size[0] * image_size[1], 0.99)
+    mask.reshape(flex.grid(image_size))
+    scan_range = (0, num_images)
+    reflections = make_reflections(
+        2000, matrix.col(beam.get_s0()), image_size, num_images
+    )
+
+    # Add some shoeboxes with invalid foreground pixels
+    reflections["shoebox"] = flex.shoebox(
+        reflections["panel"], reflections["bbox"], allocate=True
+    )
+    for i in range(0, len(reflections), 7):
+        sbox = reflections["shoebox"][i]
+        sbox.mask[0] = MaskCode.Foreground
+        if i % 2:
+            sbox.mask[0] |= MaskCode.Valid
+
+    s1 = reflections["s1"]
+    bbox = reflections["bbox"]
+    expected = (
+        filtering.by_zeta(goniometer, beam, s1, 0.05)
+        & filtering.by_xds_small_angle(goniometer, beam, s1, 0.01)
+        & filtering.by_xds_angle(goniometer, beam, s1, 0.01)
+        & filtering.by_bbox_volume(bbox)
+        & filtering.by_detector_mask(bbox, mask, scan_range)
+        & filtering.by_centroid_prediction_separation(
+            reflections["xyzobs.px.value"], reflections["xyzcal.px"], 2.0
+        )
+        & filtering.by_resolution_at_centroid(
+            reflections["panel"], reflections["xyzcal.px"], beam, detector, 1.5, -1
+        )
+        & filtering.by_shoebox_mask(reflections["shoebox"], image_size, scan_range)
+    )
+    assert 0 < expected.count(True) < len(reflections)
+
+    pipeline = filtering.FilterPipeline()
+    pipeline.add_zeta(goniometer, beam, 0.05)
+    pipeline.add_xds_small_angle(goniometer, beam, 0.01)
+    pipeline.add_xds_angle(goniometer, beam, 0.01)
+    pipeline.add_bbox_volume()
+    pipeline.add_detector_mask((mask,), scan_range)
+    pipeline.add_centroid_prediction_separation(2.0)
+    pipeline.add_resolution(beam, detector, 1.5)
+    pipeline.add_shoebox_mask(image_size, scan_range)
+    assert len(pipeline) == 8
+
+    assert list(pipeline(reflections, nthreads=nthreads)) == list(expected)
+    assert list(pipeline.selection(reflections, nthreads=nthreads)) == list(
+        expected.iselection()
+    )
+
+
+def test_filter_pipeline_missing_column():
+    beam = BeamFactory.simple(1.0)
+    goniometer = GoniometerFactory.known_axis((1, 0, 0))
+    reflections = flex.reflection_table()
+    reflections["bbox"] = flex.int6(10, (0, 1, 0, 1, 0, 1))
+
+    # Only the columns used by the filters are needed
+    pipeline = filtering.FilterPipeline()
+    pipeline.add_centroid_prediction_separation(2.0)
+    with pytest.raises(RuntimeError):
+        pipeline(reflections)
+    pipeline = filtering.FilterPipeline()
+    pipeline.add_zeta(goniometer, beam, 0.05)
+    with pytest.raises(RuntimeError):
+        pipeline(reflections)
+    assert list(filtering.FilterPipeline()(reflections)) == [True] * 10
@@ -174,3 +174,32 @@ def test_labels_are_valid(self):
                             l2 = label_map[k, j, i - 1]
                             assert l2 == l1
                         vi += 1
+
+
+def test_labels_are_ordered_by_first_pixel():
+    from dials.algorithms.image.connected_components import (
+        LabelImageStack2d,
+        LabelImageStack3d,
+    )
+    from scitbx.array_family import flex
+
+    def make_mask(rows):
+        mask = flex.bool([c == "1" for row in rows for c in row])
+        mask.reshape(flex.grid(len(rows), len(rows[0])))
+        return mask
+
+    # The two arms of a U which are only joined on the last row and two
+    # separate pixels on the right which are joined through the next image
+    mask1 = make_mask(["1.1.1", "1.1..", "111.1"])
+    mask2 = make_mask(["....1", "....1", "....1"])
+    data = flex.int(flex.grid(3, 5), 1)
+
+    label2d = LabelImageStack2d((3, 5))
+    label2d.add_image(data, mask1)
+    label2d.add_image(data, mask2)
+    assert list(label2d.labels()) == [0, 0, 1, 0, 0, 0, 0, 0, 2] + [3, 3, 3]
+
+    label3d = LabelImageStack3d((3, 5))
+    label3d.add_image(data, mask1)
+    label3d.add_image(data, mask2)
+    assert list(label3d.labels()) == [0, 0, 1, 0, 0, 0, 0, 0, 1] + [1, 1, 1]
@@ -23,3 +23,34 @@ def test():
     filled = result.as_1d().select(~mask.as_1d())
     assert flex.max(filled) <= flex.max(known)
     assert flex.min(filled) >= flex.min(known)
+
+
+def test_fill_order():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.fill_holes import SimpleFill, simple_fill
+
+    mask = flex.bool(flex.grid(5, 6), True)
+    data = flex.double(flex.grid(5, 6), 0)
+    for j in range(5):
+        for i in range(6):
+            data[j, i] = j * 6 + i
+    holes = [(1, 2), (1, 3), (2, 2), (2, 3)]
+    for j, i in holes:
+        mask[j, i] = False
+
+    # The pixels nearest the valid pixels are filled first, in raster order,
+    # from their valid and already filled neighbours
+    result = simple_fill(data, mask)
+    f12 = (data[0, 2] + data[1, 1]) / 2
+    f13 = (data[0, 3] + f12 + data[1, 4]) / 3
+    f22 = (f12 + data[2, 1] + data[3, 2]) / 3
+    f23 = (f13 + f22 + data[3, 3] + data[2, 4]) / 4
+    for (j, i), value in zip(holes, [f12, f13, f22, f23]):
+        assert abs(result[j, i] - value) < 1e-12
+
+    # The fill can be reused for images with the same mask
+    fill = SimpleFill(mask)
+    assert fill.mask().all_eq(mask)
+    assert fill(data).all_eq(result)
+    assert fill(data * 2).all_eq(simple_fill(data * 2, mask))
@@ -0,0 +1,80 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+
+def generate_image(xsize, ysize):
+    from scitbx.array_family import flex
+
+    image = flex.random_double(xsize * ysize) * 100
+    image.reshape(flex.grid(ysize, xsize))
+    return image
+
+
+def reference(image, mask, niter, kappa, gamma):
+    # A direct implementation of the update for each pixel
+    from scitbx.array_family import flex
+
+    ysize, xsize = image.all()
+    A = image.deep_copy()
+    for n in range(niter):
+        B = flex.double(flex.grid(ysize, xsize), 0)
+        for j in range(1, ysize - 1):
+            for i in range(1, xsize - 1):
+                if not mask[j, i]:
+                    continue
+                P = A[j, i]
+                AN = A[j - 1, i] if mask[j - 1, i] else P
+                AS = A[j + 1, i] if mask[j + 1, i] else P
+                AE = A[j, i - 1] if mask[j, i - 1] else P
+                AW = A[j, i + 1] if mask[j, i + 1] else P
+                flux = 0
+                for D, sign in ((P - AN, -1), (P - AE, -1), (AS - P, 1), (AW - P, 1)):
+                    flux += sign * D / (1.0 + D * D / kappa ** 2)
+                B[j, i] = gamma * flux
+        A += B
+    return A
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_anisotropic_diffusion(nthreads):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import anisotropic_diffusion
+
+    image = generate_image(23, 17)
+    mask = flex.random_bool(23 * 17, 0.9)
+    mask.reshape(flex.grid(17, 23))
+    all_valid = flex.bool(flex.grid(17, 23), True)
+
+    for niter in (1, 4):
+        result = anisotropic_diffusion(image, niter, 50, 0.1, nthreads=nthreads)
+        expected = reference(image, all_valid, niter, 50, 0.1)
+        assert flex.max(flex.abs((result - expected).as_1d())) < 1e-10
+
+        result = anisotropic_diffusion(image, mask, niter, 50, 0.1, nthreads=nthreads)
+        expected = reference(image, mask, niter, 50, 0.1)
+        assert flex.max(flex.abs((result - expected).as_1d())) < 1e-10
+
+
+def test_anisotropic_diffusion_batch():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import (
+        anisotropic_diffusion,
+        anisotropic_diffusion_batch,
+    )
+
+    images = [generate_image(23, 17) for k in range(4)]
+    mask = flex.random_bool(23 * 17, 0.9)
+    mask.reshape(flex.grid(17, 23))
+    data = flex.double()
+    for image in images:
+        data.extend(image.as_1d())
+    data.reshape(flex.grid(4, 17, 23))
+
+    # Each image in the batch is filtered in the same way as on its own
+    result = anisotropic_diffusion_batch(data, mask, 3, 50, 0.1, nthreads=2)
+    for k, image in enumerate(images):
+        expected = anisotropic_diffusion(image, mask, 3, 50, 0.1)
+        assert result[k : k + 1, :, :].as_1d().all_eq(expected.as_1d())
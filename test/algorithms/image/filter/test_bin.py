@@ -0,0 +1,23 @@
+from __future__ import absolute_import, division, print_function
+
+
+def test_bin_image():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import bin_image, bin_mask
+
+    image = flex.random_double(50 * 42)
+    image.reshape(flex.grid(50, 42))
+    mask = flex.random_bool(50 * 42, 0.9)
+    mask.reshape(flex.grid(50, 42))
+
+    binned = bin_image(image, mask, 4)
+    binned_mask = bin_mask(mask, 4)
+    assert binned.all() == (12, 10)
+    assert binned_mask.all() == (12, 10)
+    for j in range(12):
+        for i in range(10):
+            im = image[j * 4 : j * 4 + 4, i * 4 : i * 4 + 4].as_1d()
+            mk = mask[j * 4 : j * 4 + 4, i * 4 : i * 4 + 4].as_1d()
+            assert abs(binned[j, i] - flex.sum(im.select(mk))) < 1e-7
+            assert binned_mask[j, i] == int(mk.all_eq(True))
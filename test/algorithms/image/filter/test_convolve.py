@@ -0,0 +1,75 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+
+def generate_image(xsize, ysize):
+    from scitbx.array_family import flex
+
+    image = flex.random_double(xsize * ysize)
+    image.reshape(flex.grid(ysize, xsize))
+    return image
+
+
+def assert_close(a, b, eps=1e-10):
+    from scitbx.array_family import flex
+
+    assert a.all() == b.all()
+    assert flex.max(flex.abs((a - b).as_1d())) < eps
+
+
+def test_direct():
+    from dials.algorithms.image.filter import convolve_direct
+
+    image = generate_image(13, 11)
+    kernel = generate_image(3, 5)
+    result = convolve_direct(image, kernel)
+
+    # The pixels at the edges are repeated
+    for j in range(11):
+        for i in range(13):
+            expected = 0
+            for jj in range(5):
+                for ii in range(3):
+                    y = min(max(j + jj - 2, 0), 10)
+                    x = min(max(i + ii - 1, 0), 12)
+                    expected += image[y, x] * kernel[jj, ii]
+            assert result[j, i] == pytest.approx(expected)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+@pytest.mark.parametrize("kernel_size", [(3, 3), (15, 15), (21, 9), (1, 31)])
+def test_fft(kernel_size, nthreads):
+    from dials.algorithms.image.filter import convolve, convolve_direct, convolve_fft
+
+    image = generate_image(70, 90)
+    kernel = generate_image(kernel_size[1], kernel_size[0])
+    expected = convolve_direct(image, kernel)
+    assert_close(convolve_fft(image, kernel, nthreads=nthreads), expected)
+    assert_close(convolve(image, kernel, nthreads=nthreads), expected)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_separable(nthreads):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import (
+        convolve,
+        convolve_col,
+        convolve_direct,
+        convolve_row,
+    )
+
+    image = generate_image(70, 90)
+    col = flex.random_double(7)
+    row = flex.random_double(11) - 0.5
+    kernel = flex.double(flex.grid(7, 11))
+    for j in range(7):
+        for i in range(11):
+            kernel[j, i] = col[j] * row[i]
+
+    # A separable kernel gives the same result as the row and column kernels
+    expected = convolve_direct(image, kernel)
+    separable = convolve_col(convolve_row(image, row), col, nthreads=nthreads)
+    assert_close(separable, expected)
+    assert_close(convolve(image, kernel, nthreads=nthreads), expected)
@@ -45,6 +45,22 @@ def test_manhattan():
             break
 
 
+def test_manhattan_border():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import manhattan_distance
+
+    data = flex.bool(flex.grid(5, 6), True)
+    data[2, 0] = False
+    data[4, 5] = False
+
+    distance = manhattan_distance(data, True)
+    expected = [0] * 30
+    expected[2 * 6 + 0] = 1
+    expected[4 * 6 + 5] = 1
+    assert list(distance) == expected
+
+
 def test_chebyshev():
     from scitbx.array_family import flex
 
@@ -110,3 +126,25 @@ def test_chebyshev_small():
     known.reshape(distance.accessor())
 
     assert (known == distance).count(False) == 0
+
+
+def test_euclidean():
+    import random
+
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import euclidean_distance, euclidean_distance_sq
+
+    data = flex.bool(flex.grid(31, 47), False)
+    points = [(random.randint(0, 30), random.randint(0, 46)) for n in range(15)]
+    for j, i in points:
+        data[j, i] = True
+
+    for nthreads in (1, 3):
+        distance_sq = euclidean_distance_sq(data, True, nthreads=nthreads)
+        distance = euclidean_distance(data, True, nthreads=nthreads)
+        for j in range(31):
+            for i in range(47):
+                expected = min((j - y) ** 2 + (i - x) ** 2 for y, x in points)
+                assert distance_sq[j, i] == expected
+                assert abs(distance[j, i] - math.sqrt(expected)) < 1e-12
@@ -47,3 +47,54 @@ def test():
         assert m1 == pytest.approx(m2, abs=eps)
         assert v1 == pytest.approx(v2, abs=eps)
         assert f1 == pytest.approx(f2, abs=eps)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_3d(nthreads):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import IndexOfDispersionFilter3DDouble
+
+    # Create a stack of images
+    nframes, ysize, xsize = 7, 20, 30
+    images = []
+    masks = []
+    for k in range(nframes):
+        image = flex.random_double(ysize * xsize) * 10
+        image.reshape(flex.grid(ysize, xsize))
+        mask = flex.random_bool(ysize * xsize, 0.9).as_int()
+        mask.reshape(flex.grid(ysize, xsize))
+        images.append(image)
+        masks.append(mask)
+
+    # Filter the stack one image at a time
+    depth = 1
+    algorithm = IndexOfDispersionFilter3DDouble(
+        (ysize, xsize), (2, 2), depth, 2, nthreads
+    )
+    results = []
+    for image, mask in zip(images, masks):
+        if algorithm.push(image, mask):
+            results.append((algorithm.frame(), algorithm.index_of_dispersion()))
+    while algorithm.flush():
+        results.append((algorithm.frame(), algorithm.index_of_dispersion()))
+    assert [frame for frame, _ in results] == list(range(nframes))
+
+    # Compare with the values computed directly for a selection of points
+    eps = 1e-7
+    for frame, index_of_dispersion in results:
+        for n in range(50):
+            j = random.randint(0, ysize - 1)
+            i = random.randint(0, xsize - 1)
+            p = []
+            for k in range(max(frame - depth, 0), min(frame + depth + 1, nframes)):
+                for jj in range(max(j - 2, 0), min(j + 3, ysize)):
+                    for ii in range(max(i - 2, 0), min(i + 3, xsize)):
+                        if masks[k][jj, ii]:
+                            p.append(images[k][jj, ii])
+            if masks[frame][j, i] and len(p) >= 2:
+                mv = flex.mean_and_variance(flex.double(p))
+                expected = mv.unweighted_sample_variance() / mv.mean()
+            else:
+                expected = 1.0
+            assert index_of_dispersion[j, i] == pytest.approx(expected, abs=eps)
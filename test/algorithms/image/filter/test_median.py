@@ -75,3 +75,30 @@ def test_masked_filter():
                     pixels = sorted(list(pixels))
                     value = pixels[len(pixels) // 2]
                 assert result[j, i] == pytest.approx(value, abs=eps)
+
+
+@pytest.mark.parametrize("kernel", [(0, 0), (3, 3), (2, 7), (12, 0)])
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_histogram_filter(kernel, nthreads):
+    from random import randint
+
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import median_filter, median_filter_histogram
+
+    xsize = 53
+    ysize = 41
+    image = flex.int([randint(-10, 1000) for i in range(xsize * ysize)])
+    image.reshape(flex.grid(ysize, xsize))
+    mask = generate_mask(xsize, ysize)
+
+    # The histogram filter must give the same result as the reference
+    expected = median_filter(image, kernel)
+    result = median_filter_histogram(image, kernel, nthreads=nthreads)
+    assert result.all_eq(expected)
+    for periodic in (False, True):
+        expected = median_filter(image, mask, kernel, periodic=periodic)
+        result = median_filter_histogram(
+            image, mask, kernel, periodic=periodic, nthreads=nthreads
+        )
+        assert result.all_eq(expected)
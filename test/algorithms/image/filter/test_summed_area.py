@@ -25,3 +25,25 @@ def test():
         v = sa[j, i]
         e = flex.sum(image[j - 3 : j + 4, i - 3 : i + 4])
         assert e == pytest.approx(v, abs=1e-7)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_threads(nthreads):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import summed_area, summed_area_table
+
+    # An integer image has an exact summed area table
+    image = flex.int([random.randint(-5, 20) for i in range(37 * 23)])
+    image.reshape(flex.grid(37, 23))
+    table = summed_area_table(image, nthreads=nthreads)
+    for j in range(37):
+        for i in range(23):
+            assert table[j, i] == flex.sum(image[: j + 1, : i + 1])
+
+    # The result for a double image must not depend on the number of threads
+    image = flex.random_double(200 * 100)
+    image.reshape(flex.grid(200, 100))
+    for size in [(0, 0), (3, 3), (1, 60)]:
+        expected = summed_area(image, size)
+        assert summed_area(image, size, nthreads=nthreads).all_eq(expected)
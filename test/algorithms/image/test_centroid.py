@@ -103,6 +103,44 @@ def test_centroid_bias(self):
         assert centroid.average_bias_estimate()[0] < 1e-7
         assert centroid.average_bias_estimate()[1] < 1e-7
 
+    def test_centroid_image_matches_points(self):
+        from random import randint, random
+
+        from scitbx.array_family import flex
+
+        from dials.algorithms.image.centroid import centroid_image, centroid_points
+
+        pixels = flex.double(flex.grid(3, 4, 6))
+        mask = flex.bool(flex.grid(3, 4, 6))
+        points = flex.vec3_double(flex.grid(3, 4, 6))
+        for k in range(3):
+            for j in range(4):
+                for i in range(6):
+                    pixels[k, j, i] = random()
+                    mask[k, j, i] = bool(randint(0, 3))
+                    points[k, j, i] = (i + 0.5, j + 0.5, k + 0.5)
+        selection = mask.as_1d()
+        for image, expected in [
+            (
+                centroid_image(pixels),
+                centroid_points(pixels.as_1d(), points.as_1d()),
+            ),
+            (
+                centroid_image(pixels, mask),
+                centroid_points(
+                    pixels.as_1d().select(selection), points.as_1d().select(selection)
+                ),
+            ),
+        ]:
+            assert image.sum_pixels() == expected.sum_pixels()
+            for a, b in [
+                (image.mean(), expected.mean()),
+                (image.variance(), expected.variance()),
+                (image.sum_pixels_delta_cross(), expected.sum_pixels_delta_cross()),
+                (image.covariance_matrix(), expected.covariance_matrix()),
+            ]:
+                assert max(abs(x - y) for x, y in zip(a, b)) < self.EPS
+
     @classmethod
     def generate_data(cls):
         from random import randint, random
@@ -11,8 +11,11 @@
 from dials.algorithms.image.threshold import (
     DispersionExtendedThreshold,
     DispersionExtendedThresholdDebug,
+    DispersionExtendedThresholdTiled,
     DispersionThreshold,
     DispersionThresholdDebug,
+    DispersionThresholdPrepared,
+    DispersionThresholdTiled,
 )
 
 
@@ -262,6 +265,71 @@ def transpose_a_flex_bool(arr):
 
         assert (result1 == result2_t).all_eq(True)
 
+    @pytest.mark.parametrize(
+        "algorithm", [DispersionThreshold, DispersionExtendedThreshold]
+    )
+    @pytest.mark.parametrize("scale", [1, 1000])
+    def test_dispersion_algorithm_integer(self, algorithm, scale):
+
+        nsig_b = 3
+        nsig_s = 3
+
+        # The integer tables are summed exactly, so an integer image must give
+        # the same result as the same values as doubles, including counts
+        # whose squares do not fit in 32 bits
+        image = self.image * scale
+        thresholder = algorithm(
+            image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        result1 = flex.bool(flex.grid(image.all()))
+        result2 = flex.bool(flex.grid(image.all()))
+        thresholder(image, self.mask, result1)
+        thresholder(image.iround(), self.mask, result2)
+        assert result1 == result2
+
+        thresholder(image, self.mask, self.gain, result1)
+        thresholder(image.iround(), self.mask, self.gain, result2)
+        assert result1 == result2
+
+    @pytest.mark.parametrize(
+        "algorithm,tiled",
+        [
+            (DispersionThreshold, DispersionThresholdTiled),
+            (DispersionExtendedThreshold, DispersionExtendedThresholdTiled),
+        ],
+    )
+    @pytest.mark.parametrize("num_bands", [0, 3, 16])
+    def test_dispersion_algorithm_tiled(self, algorithm, tiled, num_bands):
+
+        nsig_b = 3
+        nsig_s = 3
+
+        serial = algorithm(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        threaded = tiled(
+            self.image.all(),
+            self.size,
+            nsig_b,
+            nsig_s,
+            0,
+            self.min_count,
+            nthreads=2,
+            num_bands=num_bands,
+        )
+        assert threaded.num_bands() == (num_bands or 2)
+
+        # The bands must stitch together to give the serial result
+        result1 = flex.bool(flex.grid(self.image.all()))
+        result2 = flex.bool(flex.grid(self.image.all()))
+        serial(self.image, self.mask, result1)
+        threaded(self.image, self.mask, result2)
+        assert result1 == result2
+
+        serial(self.image, self.mask, self.gain, result1)
+        threaded(self.image, self.mask, self.gain, result2)
+        assert result1 == result2
+
     @pytest.mark.parametrize(
         "algorithm", [DispersionThresholdDebug, DispersionExtendedThresholdDebug]
     )
@@ -294,3 +362,100 @@ def transpose_a_flex_bool(arr):
         result2_t = transpose_a_flex_bool(result2)
 
         assert (result1 == result2_t).all_eq(True)
+
+
+@pytest.mark.parametrize(
+    "image_size,kernel_size",
+    [((50, 60), (3, 3)), ((7, 9), (3, 3)), ((2, 30), (5, 1)), ((64, 40), (10, 2))],
+)
+def test_dispersion_threshold_kernel_covers_edges(image_size, kernel_size):
+    # The table rows are only kept for the kernel so check the images where
+    # the kernel is clipped by most or all of the edges
+    from dials.algorithms.image.threshold import dispersion, dispersion_w_gain
+
+    num_pixels = image_size[0] * image_size[1]
+    image = flex.double([randint(0, 20) for i in range(num_pixels)])
+    image.reshape(flex.grid(image_size))
+    mask = flex.random_bool(num_pixels, 0.95)
+    mask.reshape(flex.grid(image_size))
+    gain = flex.random_double(num_pixels) + 1.0
+    gain.reshape(flex.grid(image_size))
+
+    algorithm = DispersionThreshold(image_size, kernel_size, 1, 1, 0, 2)
+    result1 = flex.bool(flex.grid(image_size))
+    result2 = flex.bool(flex.grid(image_size))
+    algorithm(image, mask, result1)
+    algorithm(image, mask, gain, result2)
+    assert result1 == dispersion(image, mask, kernel_size, 1, 1, 2)
+    assert result2 == dispersion_w_gain(image, mask, gain, kernel_size, 1, 1, 2)
+
+
+@pytest.mark.parametrize("with_gain", [False, True])
+@pytest.mark.parametrize("kernel_size", [(3, 3), (5, 2)])
+def test_dispersion_threshold_prepared(with_gain, kernel_size):
+    # The prepared algorithm must give the same result as the original for
+    # every image thresholded with the same mask and gain, including images
+    # with pixels too big to be counted
+    image_size = (64, 50)
+    num_pixels = image_size[0] * image_size[1]
+    mask = flex.random_bool(num_pixels, 0.95)
+    mask.reshape(flex.grid(image_size))
+    gain = flex.random_double(num_pixels) + 1.0
+    gain.reshape(flex.grid(image_size))
+
+    original = DispersionThreshold(image_size, kernel_size, 3, 3, 0, 2)
+    if with_gain:
+        prepared = DispersionThresholdPrepared(
+            image_size, kernel_size, 3, 3, 0, 2, mask, gain
+        )
+    else:
+        prepared = DispersionThresholdPrepared(
+            image_size, kernel_size, 3, 3, 0, 2, mask
+        )
+    assert prepared.has_gain() == with_gain
+    assert prepared.mask() == mask
+
+    for big in (False, True):
+        image = flex.int([randint(0, 20) for i in range(num_pixels)])
+        image.reshape(flex.grid(image_size))
+        if big:
+            image[10, 10] = 1 << 24
+        for data in (image, image.as_double()):
+            result1 = flex.bool(flex.grid(image_size))
+            result2 = flex.bool(flex.grid(image_size))
+            if with_gain:
+                original(data, mask, gain, result1)
+            else:
+                original(data, mask, result1)
+            prepared(data, result2)
+            assert result1 == result2
+
+
+def test_dispersion_threshold_from_python_threads():
+    # The GIL is released while the threshold runs. Calls on the same algorithm
+    # from several python threads are serialised, since it holds the working
+    # tables, so they give the same results
+    from concurrent.futures import ThreadPoolExecutor
+
+    image_size = (100, 80)
+    num_pixels = image_size[0] * image_size[1]
+    mask = flex.random_bool(num_pixels, 0.95)
+    mask.reshape(flex.grid(image_size))
+    images = []
+    for n in range(8):
+        image = flex.double([randint(0, 20) for i in range(num_pixels)])
+        image.reshape(flex.grid(image_size))
+        images.append(image)
+
+    algorithm = DispersionThreshold(image_size, (3, 3), 3, 3, 0, 2)
+
+    def threshold(image):
+        result = flex.bool(flex.grid(image_size))
+        algorithm(image, mask, result)
+        return result
+
+    expected = [threshold(image) for image in images]
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        results = list(pool.map(threshold, images))
+    for result1, result2 in zip(expected, results):
+        assert result1 == result2
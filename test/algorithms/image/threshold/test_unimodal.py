@@ -0,0 +1,57 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from scitbx.array_family import flex
+
+from dials.algorithms.image.threshold import (
+    UnimodalHistogram,
+    maximum_deviation,
+    probability_distribution,
+)
+
+
+def make_image(height, width, max_value):
+    image = flex.int(flex.grid(height, width))
+    for i in range(len(image)):
+        image[i] = min(int(random.expovariate(0.2)), max_value) - 2
+    return image
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_unimodal_histogram(nthreads):
+    random.seed(0)
+    images = [make_image(50, 40, 60) for i in range(3)]
+    for upper in (30, 100):
+        histogram = UnimodalHistogram((0, upper))
+        for image in images:
+            histogram.add(image, nthreads=nthreads)
+
+        # Adding and subtracting an image leaves the histogram unchanged
+        histogram.add(images[0], nthreads=nthreads)
+        histogram.subtract(images[0], nthreads=nthreads)
+
+        # The histograms of separate images can be added together
+        reduced = UnimodalHistogram((0, upper))
+        for image in images:
+            other = UnimodalHistogram((0, upper))
+            other.add(image)
+            reduced += other
+        assert list(reduced.counts()) == list(histogram.counts())
+
+        # The distribution is the same as for the stacked images
+        stacked = flex.int()
+        for image in images:
+            stacked.extend(image.as_1d())
+        stacked.reshape(flex.grid(150, 40))
+        expected = probability_distribution(stacked, (0, upper))
+        p = histogram.probability_distribution()
+        assert list(p) == pytest.approx(list(expected))
+        assert maximum_deviation(p) == maximum_deviation(expected)
+
+    # Subtracting an image which was not added is an error
+    histogram = UnimodalHistogram((0, 10))
+    with pytest.raises(RuntimeError):
+        histogram.subtract(images[0])
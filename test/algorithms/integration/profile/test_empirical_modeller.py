@@ -102,6 +102,28 @@ def test_with_systematically_offset_profiles(self):
                 profile = reference
             assert abs(flex.sum(reference) - 1.0) <= eps
 
+    def test_finalize_with_threads(self):
+        from dials.algorithms.profile_model.modeller import MultiExpProfileModeller
+
+        reflections, profiles = self.generate_systematically_offset_profiles()
+        for p in profiles[::3]:
+            p[0] = -1.0
+
+        # Finalize the same profiles with one and several threads
+        data = []
+        for nthreads in (1, 4):
+            modeller = Modeller(self.n, self.grid_size, self.threshold)
+            modeller.model(reflections, profiles)
+            multi_modeller = MultiExpProfileModeller()
+            multi_modeller.add(modeller)
+            multi_modeller.finalize(nthreads=nthreads)
+            assert modeller.finalized()
+            data.append([list(modeller.data(i)) for i in range(len(modeller))])
+        assert data[0] == data[1]
+        for profile in data[1]:
+            assert min(profile) >= 0
+            assert abs(sum(profile) - 1.0) <= 1e-10
+
     def normalize_profile(self, profile):
         from scitbx.array_family import flex
 
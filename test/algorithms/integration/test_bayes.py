@@ -0,0 +1,48 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+import pytest
+
+from dials.algorithms.integration.bayes import integrate_by_bayesian_integrator
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+
+
+def poisson_cdf(C, B):
+    """Q(C + 1, B) by summing the poisson probabilities directly"""
+    return sum(
+        math.exp(k * math.log(B) - B - math.lgamma(k + 1)) for k in range(int(C) + 1)
+    )
+
+
+@pytest.mark.parametrize(
+    "counts,background", [(0, 0.5), (3, 0.1), (3, 10.0), (20, 4.0), (500, 480.0)]
+)
+def test_bayesian_integrator_low_counts(counts, background):
+    n = 10
+    fg = MaskCode.Valid | MaskCode.Foreground
+    bg = MaskCode.Valid | MaskCode.Background | MaskCode.BackgroundUsed
+    signal = flex.double([0] * (n - 1) + [counts] + [1] * n)
+    bgrd = flex.double([background / n] * (2 * n))
+    mask = flex.int([fg] * n + [bg] * n)
+
+    result = integrate_by_bayesian_integrator(signal, bgrd, mask)
+    assert result.success()
+    assert result.n_signal() == n
+    assert result.n_background() == n
+    assert result.background() == pytest.approx(background)
+
+    C = counts
+    B = background
+    q = poisson_cdf(C, B)
+    assert result.intensity() == pytest.approx(q * ((C + 1) * q - B * q), rel=1e-9)
+
+
+def test_bayesian_integrator_invalid_foreground():
+    signal = flex.double([1, 2, 3])
+    bgrd = flex.double([0.1, 0.1, 0.1])
+    mask = flex.int([MaskCode.Valid | MaskCode.Foreground, MaskCode.Foreground, 0])
+    result = integrate_by_bayesian_integrator(signal, bgrd, mask)
+    assert not result.success()
+    assert result.n_signal() == 1
@@ -1,5 +1,7 @@
 from __future__ import absolute_import, division, print_function
 
+import math
+
 from dxtbx.model.experiment_list import ExperimentListFactory
 from scitbx import matrix
 
@@ -30,6 +32,18 @@ def test_run(dials_data):
     diff = flex.abs(lp1 - lp2)
     assert diff.all_lt(1e-7)
 
+    lp3 = corrector.lp(rlist["id"], rlist["s1"], nthreads=3)
+    assert lp3.all_eq(lp1)
+
+    qe1 = corrector.qe(rlist["id"], rlist["s1"], rlist["panel"], nthreads=3)
+    qe2 = flex.double(
+        [
+            QE_calculation(exlist[i], s1, p)
+            for i, s1, p in zip(rlist["id"], rlist["s1"], rlist["panel"])
+        ]
+    )
+    assert flex.abs(qe1 - qe2).all_lt(1e-7)
+
 
 def LP_calculations(experiment, s1):
     """See Kabsch, J. Appl. Cryst 1988 21 916-924."""
@@ -52,3 +66,16 @@ def LP_calculations(experiment, s1):
     )
 
     return L_f / P_f
+
+
+def QE_calculation(experiment, s1, panel):
+    """Efficiency of a sensor of thickness t0 for a ray along s1."""
+
+    panel = experiment.detector[panel]
+    mu = panel.get_mu()
+    t0 = panel.get_thickness()
+    n = matrix.col(panel.get_normal())
+    s = matrix.col(s1)
+
+    cos_angle = abs(n.dot(s)) / (n.length() * s.length())
+    return 1.0 - math.exp(-mu * t0 / cos_angle)
@@ -248,6 +248,43 @@ def test_split_blocks_overlapping():
         assert bb[3] == bbox[3]
 
 
+def test_block_planner():
+    from dials.algorithms.integration.processor import BlockPlanner, JobList
+    from dials.array_family import flex
+
+    # Most of the reflections are in the middle of the scan and some are long
+    random.seed(0)
+    bbox = flex.int6()
+    for i in range(2000):
+        if random.random() < 0.5:
+            z0 = random.randint(0, 199)
+        else:
+            z0 = random.randint(80, 119)
+        z1 = z0 + random.choice([1, 2, 3, 4, 5, 12])
+        bbox.append((0, 5, 0, 5, z0, z1))
+
+    planner = BlockPlanner((0, 200), bbox, block_size=10, max_block_size=40)
+    blocks = planner.blocks()
+    assert blocks[0][0] == 0
+    assert blocks[-1][1] == 200
+    for b0, b1 in zip(blocks[:-1], blocks[1:]):
+        assert b0[0] < b1[0] <= b0[1] < b1[1]
+    assert all(b[1] - b[0] <= 40 for b in blocks)
+    assert sum(planner.num_reflections()) == len(bbox)
+    assert planner.num_split() <= planner.num_split_uniform()
+    assert planner.adaptive()
+
+    jobs = JobList()
+    jobs.add((0, 1), (0, 200), blocks)
+    assert len(jobs) == len(blocks)
+    assert [jobs[i].frames() for i in range(len(jobs))] == list(blocks)
+
+    # The blocks are one frame each if they can be no larger
+    planner = BlockPlanner((0, 20), bbox, block_size=10, max_block_size=1)
+    assert len(planner.blocks()) == 20
+    assert not planner.adaptive()
+
+
 def test_reflection_manager():
     from dials.array_family import flex
 
@@ -401,6 +438,87 @@ def test_reflection_manager():
     # Test passed
 
 
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_reflection_lookup(nthreads):
+    from dials.algorithms.integration.processor import (
+        JobList,
+        ReflectionLookup,
+        ReflectionManager,
+    )
+    from dials.array_family import flex
+
+    random.seed(0)
+    reflections = flex.reflection_table()
+    bbox = flex.int6()
+    flags = flex.size_t()
+    for i in range(1000):
+        z0 = random.randint(0, 125)
+        bbox.append((0, 2, 0, 2, z0, z0 + random.randint(1, 5)))
+        flags.append(
+            flex.reflection_table.flags.dont_integrate
+            if i % 10 == 0
+            else flex.reflection_table.flags.reference_spot
+        )
+    reflections["bbox"] = bbox
+    reflections["flags"] = flags
+    reflections["id"] = flex.int(len(reflections), 0)
+    reflections["panel"] = flex.size_t(len(reflections), 0)
+
+    jobs = JobList()
+    jobs.add((0, 1), (0, 130), 20)
+    lookup = ReflectionLookup(jobs, reflections, nthreads=nthreads)
+    assert len(lookup) == len(jobs)
+    assert lookup.num_rows() == len(reflections)
+
+    # Every reflection to integrate is in exactly one job which contains it
+    seen = []
+    for i in range(len(lookup)):
+        indices = list(lookup.indices(i))
+        assert indices == sorted(indices)
+        z0, z1 = lookup.job(i).frames()
+        for j in indices:
+            assert z0 <= bbox[j][4] and bbox[j][5] <= z1
+        seen.extend(indices)
+    assert sorted(seen) == [i for i in range(len(reflections)) if i % 10]
+
+    # The lookup gives the same as computing it in the manager or memory estimate
+    assert list(jobs.shoebox_memory(reflections, False, lookup)) == list(
+        jobs.shoebox_memory(reflections, False)
+    )
+    manager1 = ReflectionManager(jobs, reflections)
+    manager2 = ReflectionManager(jobs, reflections, lookup)
+    for i in range(len(jobs)):
+        assert list(manager1.split(i)["bbox"]) == list(manager2.split(i)["bbox"])
+
+
+@pytest.mark.parametrize("batch_size", [1, 4, 200])
+def test_reflection_manager_per_image(batch_size):
+    from dials.algorithms.integration.processor import ReflectionManagerPerImage
+    from dials.array_family import flex
+
+    random.seed(0)
+    reflections = flex.reflection_table()
+    reflections["bbox"] = flex.int6(
+        [(0, 2, 0, 2, z, z + 1) for z in (random.randint(5, 104) for i in range(500))]
+    )
+    reflections["id"] = flex.int(len(reflections), 0)
+
+    manager = ReflectionManagerPerImage((5, 105), reflections, batch_size=batch_size)
+    assert len(manager) == (100 + batch_size - 1) // batch_size
+    for i in range(len(manager)):
+        z0, z1 = manager.frames(i)
+        assert z0 == 5 + i * batch_size
+        assert z1 == min(z0 + batch_size, 105)
+        data = manager.split(i)
+        assert all(z0 <= b[4] and b[5] <= z1 for b in data["bbox"])
+        data["data"] = flex.double(len(data), i)
+        manager.accumulate(i, data)
+    assert manager.finished()
+    result = manager.data()
+    for b, i in zip(result["bbox"], result["data"]):
+        assert (b[4] - 5) // batch_size == i
+
+
 @pytest.mark.parametrize("nproc", [1, 2])
 def test_integrator_3d(dials_data, nproc):
     from math import pi
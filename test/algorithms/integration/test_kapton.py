@@ -1,6 +1,7 @@
 from __future__ import absolute_import, division, print_function
 
 import os
+import random
 
 import pytest
 
@@ -146,3 +147,33 @@ def test_kapton(run_in_tmpdir):
     # y < 0; kapton correction should average out but should be slightly higher
     assert without_kapton_medians[3] == pytest.approx(with_kapton_medians[3], abs=5.0)
     assert without_kapton_medians[3] < with_kapton_medians[3]
+
+
+def test_kapton_absorption_path_lengths():
+    """The slab intersection of KaptonAbsorption should match the path lengths
+    found by intersecting the rays with the faces of the kapton model"""
+    from dials.algorithms.integration import get_kapton_path_cpp
+    from dials.algorithms.integration.kapton_2019_correction import KaptonTape_2019
+
+    tape = KaptonTape_2019(0.04, 0.025, 0.665, 0.55, wavelength_ang=1.3)
+
+    random.seed(0)
+    s1 = flex.vec3_double()
+    for i in range(1000):
+        v = (random.uniform(-1, 0), random.uniform(-1, 1), random.uniform(-1, 1))
+        s1.append(v)
+    s1 = s1.each_normalize()
+
+    path1 = get_kapton_path_cpp(tape.faces, s1)
+    path2 = tape.absorption.path_lengths(s1, nthreads=3)
+    assert path1.all_ge(0)
+    assert flex.max(path2) > 0
+
+    # The faces are finite pixel grids, so rays passing within a pixel of an
+    # edge of the tape may disagree
+    mismatch = flex.abs(path1 - path2) > 1e-6
+    assert mismatch.count(True) <= len(s1) // 100
+
+    corrections = tape.abs_correction_flex(s1)
+    assert corrections.all_ge(1)
+    assert corrections.all_approx_equal(flex.exp(tape.abs_coeff * path2))
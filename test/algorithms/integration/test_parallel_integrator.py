@@ -423,3 +423,74 @@ def check_job(index):
     check_job(2)
     check_job(3)
     check_job(4)
+
+
+def test_streaming_reflection_writer(tmpdir):
+    from dials.algorithms.integration.parallel_integrator import (
+        StreamedReflections,
+        StreamingReflectionWriter,
+    )
+
+    # Each job takes every fourth row of the table
+    tables = []
+    for index in range(4):
+        table = flex.reflection_table()
+        n = 0 if index == 1 else 5
+        table["job"] = flex.int(n, index)
+        table["value"] = flex.double(range(n))
+        tables.append(table)
+    rows = [flex.size_t(range(index, 20, 4)) for index in range(4)]
+    rows[1] = flex.size_t()
+
+    # The jobs are written in the order they finish
+    filename = tmpdir.join("streamed.refl").strpath
+    writer = StreamingReflectionWriter(filename)
+    for index in (2, 0, 3, 1):
+        writer.write(index, tables[index], rows[index])
+    writer.close()
+    assert "table_row" not in tables[2]
+
+    reader = StreamedReflections(filename)
+    assert [table["job"][0] for table in reader] == [2, 0, 3]
+
+    # Reading the whole file restores the order of the rows in the table
+    result = reader.read()
+    assert len(result) == 15
+    assert "table_row" not in result
+    assert list(result["job"]) == [0, 2, 3] * 5
+    assert list(result["value"]) == [value for value in range(5) for _ in range(3)]
+
+
+def test_integration_checkpoint(tmpdir):
+    from dials.algorithms.integration.parallel_integrator import IntegrationCheckpoint
+
+    jobs = [(0, 10, 5), (10, 20, 0), (20, 30, 5)]
+    tables = []
+    for index, job in enumerate(jobs):
+        table = flex.reflection_table()
+        table["job"] = flex.int(job[2], index)
+        table["value"] = flex.double(range(job[2])) / 3.0
+        tables.append(table)
+
+    # Save two of the jobs, as if the run was interrupted
+    directory = tmpdir.join("checkpoint").strpath
+    checkpoint = IntegrationCheckpoint(directory, jobs)
+    assert checkpoint.saved() == []
+    checkpoint.save(2, tables[2])
+    checkpoint.save(1, tables[1])
+
+    # Resuming reloads the saved jobs exactly
+    checkpoint = IntegrationCheckpoint(directory, jobs, resume=True)
+    assert checkpoint.saved() == [1, 2]
+    result = checkpoint.load(2)
+    assert list(result["job"]) == [2] * 5
+    assert list(result["value"]) == list(tables[2]["value"])
+    assert len(checkpoint.load(1)) == 0
+
+    # A checkpoint with different jobs cannot be resumed
+    with pytest.raises(RuntimeError):
+        IntegrationCheckpoint(directory, jobs[:2], resume=True)
+
+    # Without resuming the saved jobs are discarded
+    checkpoint = IntegrationCheckpoint(directory, jobs)
+    assert checkpoint.saved() == []
@@ -0,0 +1,97 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from dials.algorithms.integration.sum import (
+    SummationBatchDouble,
+    integrate_by_summation,
+)
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+
+
+def reference_summation(signal, background, mask):
+    fg_code = MaskCode.Foreground
+    bg_code = MaskCode.Valid | MaskCode.Background | MaskCode.BackgroundUsed
+    sum_p = 0.0
+    sum_b = 0.0
+    n_signal = 0
+    n_background = 0
+    success = True
+    for s, b, m in zip(signal, background, mask):
+        if m & fg_code:
+            if m & MaskCode.Valid and not m & MaskCode.Overlapped:
+                sum_p += s
+                sum_b += b
+                n_signal += 1
+            else:
+                success = False
+        elif m & bg_code == bg_code:
+            n_background += 1
+    return sum_p - sum_b, sum_b, n_signal, n_background, success
+
+
+@pytest.mark.parametrize("bad_pixels", [False, True])
+def test_summation_matches_reference(bad_pixels):
+    random.seed(0)
+    codes = [
+        MaskCode.Valid | MaskCode.Foreground,
+        MaskCode.Valid | MaskCode.Background,
+        MaskCode.Valid | MaskCode.Background | MaskCode.BackgroundUsed,
+        MaskCode.Background | MaskCode.BackgroundUsed,
+        0,
+    ]
+    if bad_pixels:
+        codes += [
+            MaskCode.Foreground,
+            MaskCode.Valid | MaskCode.Foreground | MaskCode.Overlapped,
+        ]
+    n = 1000
+    signal = flex.double([random.uniform(0, 100) for i in range(n)])
+    background = flex.double([random.uniform(0, 10) for i in range(n)])
+    mask = flex.int([random.choice(codes) for i in range(n)])
+
+    result = integrate_by_summation(signal, background, mask)
+    intensity, bg, n_signal, n_background, success = reference_summation(
+        signal, background, mask
+    )
+    assert result.intensity() == pytest.approx(intensity)
+    assert result.background() == pytest.approx(bg)
+    assert result.n_signal() == n_signal
+    assert result.n_background() == n_background
+    assert result.success() == success
+
+
+def test_summation_batch_matches_single_shoeboxes():
+    random.seed(0)
+    codes = [
+        MaskCode.Valid | MaskCode.Foreground,
+        MaskCode.Valid | MaskCode.Background | MaskCode.BackgroundUsed,
+        MaskCode.Foreground,
+        0,
+    ]
+    sizes = [10, 0, 25, 1, 40]
+    offsets = flex.size_t([0])
+    for size in sizes:
+        offsets.append(offsets[-1] + size)
+    n = offsets[-1]
+    signal = flex.double([random.uniform(0, 100) for i in range(n)])
+    background = flex.double([random.uniform(0, 10) for i in range(n)])
+    mask = flex.int([random.choice(codes) for i in range(n)])
+
+    batch = SummationBatchDouble(signal, background, mask, offsets)
+    assert len(batch) == len(sizes)
+    for i in range(len(sizes)):
+        first, last = offsets[i], offsets[i + 1]
+        result = integrate_by_summation(
+            signal[first:last], background[first:last], mask[first:last]
+        )
+        assert batch.intensity()[i] == result.intensity()
+        assert batch.variance()[i] == result.variance()
+        assert batch.background()[i] == result.background()
+        assert batch.background_variance()[i] == result.background_variance()
+        assert batch.n_signal()[i] == result.n_signal()
+        assert batch.n_background()[i] == result.n_background()
+        assert batch.success()[i] == result.success()
@@ -280,3 +280,48 @@ def is_outside(self, point):
             or point[0] > self.box[1][0]
             or point[1] > self.box[1][1]
         )
+
+
+def polygon_area(poly):
+    return 0.5 * sum(
+        poly[i - 1][0] * poly[i][1] - poly[i][0] * poly[i - 1][1]
+        for i in range(len(poly))
+    )
+
+
+def test_QuadWithRectArea():
+    rect = ((0, 0), (10, 10))
+    square = [(0, 0), (10, 0), (10, 10), (0, 10)]
+    for i in range(10000):
+
+        # Generate intersecting and nonintersecting polygons
+        subject, target = generate_intersecting(4, 4)
+        if random.randint(0, 1):
+            subject, target = generate_non_intersecting(4, 4)
+
+        # The area should match that of the clipped polygon
+        area = clip.quad_with_rect_area(subject, rect)
+        result = clip.simple_with_convex(
+            flex.vec2_double(subject), flex.vec2_double(square)
+        )
+        expected = polygon_area(result)
+        assert abs(area - expected) < 1e-7
+
+
+def test_TriangleWithRectArea():
+    rect = ((0, 0), (10, 10))
+    square = [(0, 0), (10, 0), (10, 10), (0, 10)]
+    for i in range(10000):
+
+        # Generate intersecting and nonintersecting polygons
+        subject, target = generate_intersecting(3, 4)
+        if random.randint(0, 1):
+            subject, target = generate_non_intersecting(3, 4)
+
+        # The area should match that of the clipped polygon
+        area = clip.triangle_with_rect_area(subject, rect)
+        result = clip.simple_with_convex(
+            flex.vec2_double(subject), flex.vec2_double(square)
+        )
+        expected = polygon_area(result)
+        assert abs(area - expected) < 1e-7
@@ -1,5 +1,8 @@
 from __future__ import absolute_import, division, print_function
 
+import math
+import random
+
 
 def test_load_and_dump():
     from dials.algorithms.profile_model.gaussian_rs import Model
@@ -14,3 +17,141 @@ def test_load_and_dump():
     assert model2.n_sigma() == 2
     assert model2.sigma_b() == 4
     assert model2.sigma_m() == 5
+
+
+def make_detector():
+    from dxtbx.model import DetectorFactory
+
+    return DetectorFactory.simple(
+        "PAD", 100, (8.6, 8.6), "+x", "-y", (0.172, 0.172), (100, 100)
+    )
+
+
+def make_modeller():
+    from dxtbx.model import BeamFactory, GoniometerFactory, Scan
+
+    from dials.algorithms.profile_model.gaussian_rs import GaussianRSProfileModeller
+
+    beam = BeamFactory.make_beam(unit_s0=(0, 0, -1), wavelength=1.0)
+    detector = make_detector()
+    goniometer = GoniometerFactory.known_axis((1, 0, 0))
+    scan = Scan((1, 10), (0, 1))
+    GridMethod = GaussianRSProfileModeller.GridMethod
+    FitMethod = GaussianRSProfileModeller.FitMethod
+    return GaussianRSProfileModeller(
+        beam,
+        detector,
+        goniometer,
+        scan,
+        0.01,
+        0.01,
+        3,
+        2,
+        1,
+        0.02,
+        int(GridMethod.regular_grid),
+        int(FitMethod.reciprocal_space),
+    )
+
+
+def make_reflections(num):
+    from scitbx import matrix
+
+    from dials.algorithms.shoebox import MaskCode
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    panel = make_detector()[0]
+    shoebox = flex.shoebox()
+    s1 = flex.vec3_double()
+    xyzpx = flex.vec3_double()
+    xyzmm = flex.vec3_double()
+    for _ in range(num):
+        x = random.randint(40, 60)
+        y = random.choice([random.randint(20, 35), random.randint(65, 80)])
+        z = random.randint(3, 6)
+        sbox = Shoebox(0, (x - 5, x + 6, y - 5, y + 6, z - 3, z + 3))
+        sbox.allocate()
+        for k in range(6):
+            for j in range(11):
+                for i in range(11):
+                    d2 = (i - 5) ** 2 + (j - 5) ** 2 + (k - 2.5) ** 2
+                    sbox.data[k, j, i] = 1 + 100 * math.exp(-d2 / 4)
+                    sbox.mask[k, j, i] = MaskCode.Valid | MaskCode.Foreground
+        shoebox.append(sbox)
+        s = matrix.col(panel.get_pixel_lab_coord((x + 0.5, y + 0.5)))
+        s1.append(s.normalize().elems)
+        xyzpx.append((x + 0.5, y + 0.5, z))
+        xyzmm.append((0, 0, math.radians(z)))
+    reflections = flex.reflection_table()
+    reflections["shoebox"] = shoebox
+    reflections["s1"] = s1
+    reflections["xyzcal.px"] = xyzpx
+    reflections["xyzcal.mm"] = xyzmm
+    reflections["partiality"] = flex.double(num, 1.0)
+    reflections["flags"] = flex.size_t(num, int(reflections.flags.integrated_sum))
+    return reflections
+
+
+def assert_same_profiles(modeller1, modeller2):
+    from dials.array_family import flex
+
+    assert len(modeller1) == len(modeller2)
+    for i in range(len(modeller1)):
+        assert modeller1.valid(i) == modeller2.valid(i)
+        assert modeller1.n_reflections(i) == modeller2.n_reflections(i)
+        if modeller1.valid(i):
+            data1 = modeller1.data(i)
+            data2 = modeller2.data(i)
+            assert data1.all() == data2.all()
+            assert flex.max(flex.abs(data1 - data2)) < 1e-6
+            assert list(modeller1.mask(i)) == list(modeller2.mask(i))
+
+
+def test_modeller_pickle():
+    import pickle
+
+    from dials.array_family import flex
+
+    modeller = make_modeller()
+    profile = flex.double(flex.grid(5, 5, 5))
+    for i in range(len(profile)):
+        profile[i] = random.uniform(0, 100)
+    modeller.add(flex.size_t([0, 2]), flex.double([1.0, 0.5]), profile)
+
+    # The profiles are pickled in single precision
+    state = modeller.__getstate__()
+    assert all(isinstance(d, flex.float) for d in state[0])
+
+    assert_same_profiles(pickle.loads(pickle.dumps(modeller)), modeller)
+
+
+def test_modeller_model_nthreads():
+    import copy
+    import pickle
+
+    modeller1 = make_modeller()
+    reflections1 = make_reflections(20)
+    reflections2 = copy.deepcopy(reflections1)
+    reflections3 = copy.deepcopy(reflections1)
+    modeller1.model(reflections1)
+    assert reflections1.get_flags(reflections1.flags.used_in_modelling).count(
+        True
+    ) == len(reflections1)
+    assert any(modeller1.valid(i) for i in range(len(modeller1)))
+
+    # Modelling on threads should give the same profiles
+    modeller2 = make_modeller()
+    modeller2.model(reflections2, nthreads=3)
+    assert list(reflections2["flags"]) == list(reflections1["flags"])
+    assert_same_profiles(modeller1, modeller2)
+
+    # Model half the reflections, checkpoint and merge with the other half
+    half = len(reflections3) // 2
+    modeller3 = make_modeller()
+    modeller3.model(reflections3[:half], nthreads=2)
+    modeller3 = pickle.loads(pickle.dumps(modeller3))
+    modeller4 = make_modeller()
+    modeller4.model(reflections3[half:], nthreads=2)
+    modeller3.accumulate(modeller4)
+    assert_same_profiles(modeller1, modeller3)
@@ -228,3 +228,62 @@ def dangle(u, v):
         assert approx_equal(daa_dp, fd_grad[i]["daa_dp"])
         assert approx_equal(dbb_dp, fd_grad[i]["dbb_dp"])
         assert approx_equal(dcc_dp, fd_grad[i]["dcc_dp"])
+
+
+def test_calculate_cell_gradients_multi():
+    from libtbx.phil import parse
+    from libtbx.test_utils import approx_equal
+    from scitbx.array_family import flex
+
+    from dials.algorithms.refinement.parameterisation.crystal_parameters import (
+        CrystalUnitCellParameterisation,
+    )
+    from dials.test.algorithms.refinement import setup_geometry
+    from dials_refinement_helpers_ext import (
+        CalculateCellGradients,
+        CalculateCellGradientsMulti,
+    )
+
+    master_phil = parse(
+        """
+      include scope dials.test.algorithms.refinement.geometry_phil
+      """,
+        process_includes=True,
+    )
+
+    # a few crystals with differently oriented cells
+    xlucps = []
+    for sd in (1, 3, 5):
+        args = [
+            "a.direction.close_to.sd=%d" % sd,
+            "b.direction.close_to.sd=%d" % sd,
+            "c.direction.close_to.sd=%d" % sd,
+        ]
+        models = setup_geometry.Extract(master_phil, cmdline_args=args)
+        xlucps.append(CrystalUnitCellParameterisation(models.crystal))
+
+    B = flex.mat3_double()
+    dB_dp = flex.mat3_double()
+    nparam = flex.size_t()
+    for xlucp in xlucps:
+        B.append(xlucp.get_state())
+        ds_dp = flex.mat3_double(xlucp.get_ds_dp())
+        dB_dp.extend(ds_dp)
+        nparam.append(len(ds_dp))
+    multi = CalculateCellGradientsMulti(B, dB_dp, nparam, nthreads=2)
+
+    start = 0
+    for i, xlucp in enumerate(xlucps):
+        end = start + nparam[i]
+        ccg = CalculateCellGradients(B[i], dB_dp[start:end])
+        for name in ("da_dp", "db_dp", "dc_dp", "daa_dp", "dbb_dp", "dcc_dp"):
+            assert approx_equal(
+                getattr(multi, name)()[start:end], getattr(ccg, name)()
+            )
+        cell = xlucp.get_model().get_unit_cell().parameters()
+        multi_cell = [
+            getattr(multi, name)()[i]
+            for name in ("a", "b", "c", "alpha", "beta", "gamma")
+        ]
+        assert approx_equal(multi_cell, cell)
+        start = end
@@ -0,0 +1,61 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+from scitbx import matrix
+from scitbx.array_family import flex
+
+from dials.algorithms.refinement.refinement_helpers import dRq_de as dRq_de_py
+from dials_refinement_helpers_ext import (
+    dR_from_axis_and_angle,
+    dRq_de,
+    dRq_de_dot,
+    dRv_from_axis_and_angle,
+)
+
+
+def random_vector():
+    return matrix.col([random.uniform(-1, 1) for _ in range(3)])
+
+
+def test_dRv_from_axis_and_angle():
+    axis = random_vector()
+
+    # Runs of reflections on the same frame share an angle
+    angles = flex.double()
+    for _ in range(10):
+        angles.extend(flex.double(random.randint(1, 5), random.uniform(-180, 180)))
+    v = flex.vec3_double([random_vector().elems for _ in angles])
+
+    for deg in (True, False):
+        result = dRv_from_axis_and_angle(axis, angles, v, deg=deg)
+        assert len(result) == len(angles)
+        for angle, vi, ri in zip(angles, v, result):
+            dR = matrix.sqr(dR_from_axis_and_angle(axis, angle, deg=deg))
+            expected = dR * matrix.col(vi)
+            assert (matrix.col(ri) - expected).length() < 1e-12
+
+
+def test_dRq_de():
+    # Runs of reflections with the same angle and axis, and some zero angles
+    theta = flex.double()
+    e1 = flex.vec3_double()
+    for i in range(10):
+        n = random.randint(1, 5)
+        theta.extend(flex.double(n, 0.0 if i % 4 == 0 else random.uniform(-1, 1)))
+        e1.extend(flex.vec3_double(n, random_vector().elems))
+    q = flex.vec3_double([random_vector().elems for _ in theta])
+    w = flex.vec3_double([random_vector().elems for _ in theta])
+
+    dr_de = dRq_de(theta, e1, q)
+    dr_de_w = dRq_de_dot(theta, e1, q, w)
+    assert len(dr_de) == len(dr_de_w) == len(theta)
+    for ti, ei, qi, wi, m, mw in zip(theta, e1, q, w, dr_de, dr_de_w):
+        if ti == 0:
+            assert m == (0,) * 9
+            assert mw == (0, 0, 0)
+            continue
+        expected = dRq_de_py(ti, matrix.col(ei), matrix.col(qi))
+        assert (matrix.sqr(m) - expected).norm_sq() < 1e-24
+        expected = expected * matrix.col(wi)
+        assert (matrix.col(mw) - expected).length() < 1e-12
@@ -496,3 +496,37 @@ def test_ScanVaryingDetectorParameterisation(nintervals, plots=False):
 
     for e, f in zip(an_ds_dp, fd_ds_dp):
         assert approx_equal((e - f), null_mat, eps=1.0e-6)
+
+
+def test_ScanVaryingParameterisation_precompose():
+    """Check that states and derivatives composed in a batch match those composed
+    one image at a time"""
+
+    vmp = _TestScanVaryingModelParameterisation()
+    xl_op = ScanVaryingCrystalOrientationParameterisation(vmp.xl, vmp.image_range, 5)
+    det_p = ScanVaryingDetectorParameterisationSinglePanel(
+        vmp.detector, vmp.image_range, 5
+    )
+
+    frames = [1, 17, 50, 83, 100]
+    for p in (xl_op, det_p):
+        p_vals = p.get_param_vals()
+        p.set_param_vals([v + random.uniform(-1, 1) for v in p_vals])
+
+        expected = {}
+        for t in frames:
+            p.compose(t)
+            expected[t] = (p.get_state(), p.get_ds_dp())
+
+        p.precompose(frames)
+        for t in frames:
+            p.compose(t)
+            state, ds_dp = expected[t]
+            assert p.get_state().elems == pytest.approx(state.elems, abs=1e-10)
+            for e, f in zip(p.get_ds_dp(), ds_dp):
+                assert e.elems == pytest.approx(f.elems, abs=1e-10)
+
+        # new parameter values discard the precomposed states
+        p.set_param_vals(p_vals)
+        p.compose(frames[0])
+        assert p.get_state().elems != pytest.approx(expected[frames[0]][0].elems)
@@ -120,6 +120,22 @@ def test_beamvector_coordinate_of_s1(beamvector):
     assert c2 == pytest.approx(0.0)
 
 
+def test_beamvector_array(beamvector):
+    """Ensure the array transform matches the single one"""
+    from dials.array_family import flex
+
+    s1 = matrix.col(beamvector["s1"])
+    s_dash = flex.vec3_double(
+        (s1 + matrix.col((random.uniform(-0.01, 0.01), 0.01 * i, 0))).elems
+        for i in range(10)
+    )
+    cs = beamvector["cs"]
+    c12 = cs.from_beam_vector(s_dash)
+    assert len(c12) == len(s_dash)
+    for s, c in zip(s_dash, c12):
+        assert c == cs.from_beam_vector(s)
+
+
 def test_beamvector_limit(beamvector):
     """Calculate the coordinate at the limits.
 
@@ -185,6 +201,18 @@ def test_from_rotation_angle_e3_coordinate_approximation(rotationangle):
     assert c3 == pytest.approx(c3_2, abs=1e-4)
 
 
+def test_from_rotation_angle_fast_array(rotationangle):
+    """Ensure the array transform matches the single one"""
+    from dials.array_family import flex
+
+    cs = rotationangle["cs"]
+    phi_dash = flex.double(
+        rotationangle["phi"] + 0.1 * i * math.pi / 180 for i in range(-5, 6)
+    )
+    c3 = cs.from_rotation_angle_fast(phi_dash)
+    assert list(c3) == [cs.from_rotation_angle_fast(p) for p in phi_dash]
+
+
 ### Test the ToBeamVector class
 
 
@@ -179,3 +179,25 @@ def test_radius(setup):
             if bbox[2] > 0 and bbox[3] < height:
                 assert math.sqrt(e11 ** 2 + e21 ** 2) >= radius12
                 assert math.sqrt(e12 ** 2 + e22 ** 2) >= radius12
+
+
+def test_array_nthreads(setup):
+    from dials.array_family import flex
+
+    s0_length = matrix.col(setup["beam"].get_s0()).length()
+    s1 = flex.vec3_double()
+    frame = flex.double()
+    for i in range(200):
+        x = random.uniform(0, 2000)
+        y = random.uniform(0, 2000)
+        s1.append(
+            matrix.col(setup["detector"][0].get_pixel_lab_coord((x, y))).normalize()
+            * s0_length
+        )
+        frame.append(random.uniform(0, 9))
+    panel = flex.size_t(len(s1), 0)
+
+    expected = [setup["calculate_bbox"](s, z, 0) for s, z in zip(s1, frame)]
+    for nthreads in [1, 4]:
+        bbox = setup["calculate_bbox"](s1, frame, panel, nthreads=nthreads)
+        assert list(bbox) == expected
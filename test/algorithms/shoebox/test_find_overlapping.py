@@ -2,10 +2,13 @@
 
 import random
 
+import pytest
+
 from dials.algorithms.shoebox import find_overlapping
 
 
-def test_single_panel():
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_single_panel(nthreads):
     from dials.array_family import flex
 
     nrefl = 1000
@@ -22,7 +25,7 @@ def test_single_panel():
         bbox[i] = (x0, x1, y0, y1, z0, z1)
 
     # Find the overlaps
-    overlaps = find_overlapping(bbox)
+    overlaps = find_overlapping(bbox, nthreads=nthreads)
 
     assert overlaps.num_vertices() == nrefl
     overlaps2 = brute_force(bbox)
@@ -37,7 +40,8 @@ def test_single_panel():
         assert edge in edges
 
 
-def test_multiple_panels():
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_multiple_panels(nthreads):
     from dials.array_family import flex
 
     nrefl = 1000
@@ -56,7 +60,7 @@ def test_multiple_panels():
         panel[i] = random.randint(0, 2)
 
     # Find the overlaps
-    overlaps = find_overlapping(bbox, panel)
+    overlaps = find_overlapping(bbox, panel, nthreads=nthreads)
     assert overlaps.num_vertices() == nrefl
     overlaps2 = brute_force(bbox, panel)
     assert overlaps.num_edges() == len(overlaps2)
@@ -1,6 +1,7 @@
 from __future__ import absolute_import, division, print_function
 
 import numpy as np
+import pytest
 
 
 def predict_reflections(sequence, crystal):
@@ -43,7 +44,8 @@ def predict_reflections(sequence, crystal):
     return predicted, overlaps
 
 
-def test(dials_data):
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test(dials_data, nthreads):
     from dxtbx.serialize import load
 
     from dials.algorithms import shoebox
@@ -71,7 +73,7 @@ def test(dials_data):
     shoeboxes = reflections["shoebox"]
     coords = reflections["xyzcal.px"]
     shoebox_masker = shoebox.MaskOverlapping()
-    shoebox_masker(shoeboxes, coords, adjacency_list)
+    shoebox_masker(shoeboxes, coords, adjacency_list, nthreads=nthreads)
 
     # Loop through all edges
     overlapping = []
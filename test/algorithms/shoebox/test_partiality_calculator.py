@@ -68,3 +68,9 @@ def test(dials_data):
     # Should have all partials
     assert len(partiality) == len(predicted)
     assert partiality.all_le(1.0) and partiality.all_gt(0)
+
+    # The batch calculation should match the single one
+    z = predicted["xyzcal.px"].parts()[2]
+    for i in range(0, len(predicted), 100):
+        single = calculator(predicted["s1"][i], z[i], predicted["bbox"][i])
+        assert single == partiality[i]
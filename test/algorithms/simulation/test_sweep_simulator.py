@@ -0,0 +1,135 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+import pytest
+
+from dxtbx.model import BeamFactory, DetectorFactory, GoniometerFactory, ScanFactory
+from dxtbx.model.experiment_list import Experiment
+from scitbx import matrix
+
+from dials.algorithms.simulation import SweepSimulator
+from dials.algorithms.simulation.sweep import simulated_imageset
+from dials.array_family import flex
+
+
+@pytest.fixture
+def experiment():
+    beam = BeamFactory.make_beam(wavelength=1.0, sample_to_source=(0, 0, 1))
+    detector = DetectorFactory.simple(
+        sensor="PAD",
+        distance=100,
+        beam_centre=(10.32, 10.32),
+        fast_direction="+x",
+        slow_direction="-y",
+        pixel_size=(0.172, 0.172),
+        image_size=(120, 120),
+        trusted_range=(-1, 1e8),
+    )
+    goniometer = GoniometerFactory.single_axis()
+    scan = ScanFactory.make_scan(
+        image_range=(1, 10),
+        exposure_times=0.1,
+        oscillation=(0, 0.5),
+        epochs=list(range(10)),
+    )
+    return Experiment(beam=beam, detector=detector, goniometer=goniometer, scan=scan)
+
+
+@pytest.fixture
+def reflections(experiment):
+    # Reflections away from the rotation axis, on a grid of pixels
+    panel = experiment.detector[0]
+    s0_length = matrix.col(experiment.beam.get_s0()).length()
+    reflections = flex.reflection_table()
+    s1 = flex.vec3_double()
+    xyz = flex.vec3_double()
+    for j, y in enumerate(range(10, 50, 8)):
+        for i, x in enumerate(range(10, 110, 10)):
+            lab = matrix.col(panel.get_pixel_lab_coord((x, y)))
+            s1.append(lab.normalize() * s0_length)
+            xyz.append((0, 0, math.radians(1.0 + 0.3 * (i + j))))
+    reflections["s1"] = s1
+    reflections["xyzcal.mm"] = xyz
+    reflections["panel"] = flex.size_t(len(s1), 0)
+    return reflections
+
+
+def is_inside(bbox, size):
+    return all(bbox[2 * i] >= 0 and bbox[2 * i + 1] <= size[i] for i in range(3))
+
+
+def make_simulator(experiment, reflections, intensity, background):
+    return SweepSimulator(
+        experiment.beam,
+        experiment.detector,
+        experiment.goniometer,
+        experiment.scan,
+        math.radians(0.05),
+        math.radians(0.1),
+        3,
+        reflections["s1"],
+        reflections["xyzcal.mm"].parts()[2],
+        reflections["panel"],
+        flex.double(len(reflections), intensity),
+        background=background,
+        seed=42,
+    )
+
+
+def test_render_is_independent_of_threads_and_frames(experiment, reflections):
+    simulator = make_simulator(experiment, reflections, 1000, 1.0)
+    images = simulator.render(0, 0, 10)
+    assert images.all() == (10, 120, 120)
+    assert images.all_eq(simulator.render(0, 0, 10, nthreads=4))
+    for frame in range(10):
+        image = simulator.render(0, frame, frame + 1, nthreads=3)
+        expected = images.as_1d()[frame * 14400 : (frame + 1) * 14400]
+        assert image.as_1d().all_eq(expected)
+
+
+def test_signal_counts(experiment, reflections):
+    simulator = make_simulator(experiment, reflections, 1000, 0)
+    counts = simulator.signal_counts()
+    assert counts.all_eq(simulator.signal_counts(nthreads=4))
+
+    # With no background the images hold only the photons of the reflections
+    images = simulator.render(0, 0, 10)
+    assert flex.sum(images) == flex.sum(counts)
+
+    # Most of the photons fall within the bounding boxes
+    bbox = simulator.bbox()
+    inside = flex.bool([is_inside(b, (120, 120, 10)) for b in bbox])
+    assert inside.count(True) > 0
+    mean = flex.mean(counts.select(inside).as_double())
+    assert mean == pytest.approx(1000, rel=0.02)
+
+
+def test_background(experiment, reflections):
+    simulator = make_simulator(experiment, reflections, 0, 2.0)
+    images = simulator.render(0, 0, 10).as_double().as_1d()
+    variance = flex.mean_and_variance(images).unweighted_sample_variance()
+    assert flex.mean(images) == pytest.approx(2.0, rel=0.01)
+    assert variance == pytest.approx(2.0, rel=0.05)
+
+
+def test_simulated_imageset(experiment, reflections):
+    intensity = flex.double(len(reflections), 1000)
+    imageset = simulated_imageset(
+        experiment,
+        reflections,
+        intensity,
+        math.radians(0.05),
+        math.radians(0.1),
+        background=1.0,
+        seed=42,
+    )
+    assert len(imageset) == 10
+
+    # Each image is rendered when it is read, the same way each time
+    simulator = make_simulator(experiment, reflections, 1000, 1.0)
+    images = simulator.render(0, 0, 10)
+    data = imageset.get_raw_data(3)[0]
+    assert data.all() == (120, 120)
+    assert data.as_1d().all_eq(images.as_1d()[3 * 14400 : 4 * 14400])
+    assert data.all_eq(imageset.get_raw_data(3)[0])
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <sstream>
 #include <deque>
+#include <set>
 #include <dials/algorithms/spatial_indexing/detect_collisions.h>
 
 struct Box {
@@ -49,6 +50,7 @@ Box3d random_box3d(Box3d bounds, int min_size, int max_size) {
 
 using dials::algorithms::detect_collisions2d;
 using dials::algorithms::detect_collisions3d;
+using dials::algorithms::FloatBox2d;
 using dials::algorithms::get_maximum_bound;
 using dials::algorithms::get_minimum_bound;
 
@@ -189,9 +191,79 @@ void tst_detect_3d() {
   std::cout << "OK" << std::endl;
 }
 
+void tst_detect_2d_threaded() {
+  int num = 10000;
+  std::vector<Box> data(num);
+  std::deque<std::pair<int, int> > collisions1;
+  std::deque<std::pair<int, int> > collisions2;
+
+  Box bounds(0, 0, 2000, 2000);
+
+  // Create a number of random boxes
+  for (std::size_t i = 0; i < num; ++i) {
+    data[i] = random_box(bounds, 3, 8);
+  }
+
+  // The threaded collision check should find the same collisions
+  detect_collisions2d(data.begin(), data.end(), collisions1);
+  detect_collisions2d(data.begin(), data.end(), collisions2, 4);
+  assert(collisions1.size() > 0);
+  assert(collisions2.size() == collisions1.size());
+  std::set<std::pair<int, int> > set1, set2;
+  for (std::size_t i = 0; i < collisions1.size(); ++i) {
+    set1.insert(std::make_pair(std::min(collisions1[i].first, collisions1[i].second),
+                               std::max(collisions1[i].first, collisions1[i].second)));
+    set2.insert(std::make_pair(std::min(collisions2[i].first, collisions2[i].second),
+                               std::max(collisions2[i].first, collisions2[i].second)));
+  }
+  assert(set1 == set2);
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
+void tst_detect_2d_float() {
+  int num = 10000;
+  std::vector<FloatBox2d> data(num);
+  std::deque<std::pair<int, int> > collisions1;
+  std::size_t num_collisions = 0;
+
+  Box bounds(0, 0, 2000, 2000);
+
+  // Create a number of random boxes with float coordinates
+  for (std::size_t i = 0; i < num; ++i) {
+    Box box = random_box(bounds, 3, 8);
+    data[i].min[0] = box.x0 + 0.5f;
+    data[i].min[1] = box.y0 + 0.5f;
+    data[i].max[0] = box.x1 + 0.5f;
+    data[i].max[1] = box.y1 + 0.5f;
+  }
+
+  // Do the collision check
+  detect_collisions2d(data.begin(), data.end(), collisions1, 2);
+
+  // Do a brute force check to see if we get the correct results.
+  for (std::size_t j = 0; j < num - 1; ++j) {
+    for (std::size_t i = j + 1; i < num; ++i) {
+      if (!(data[i].min[0] >= data[j].max[0] || data[j].min[0] >= data[i].max[0]
+            || data[i].min[1] >= data[j].max[1] || data[j].min[1] >= data[i].max[1])) {
+        num_collisions++;
+      }
+    }
+  }
+
+  // Check the sizes are equal
+  assert(num_collisions == collisions1.size());
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
 int main(int argc, char const *argv[]) {
   tst_detect_2d();
   tst_detect_3d();
+  tst_detect_2d_threaded();
+  tst_detect_2d_float();
 
   return 0;
 }
@@ -0,0 +1,23 @@
+from __future__ import absolute_import, division, print_function
+
+
+def test_blank_image_screen():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.spot_finding.threshold import BlankImageScreen
+
+    screen = BlankImageScreen(binning=4)
+    blank = 0
+    for i in range(10):
+        image = flex.random_int_gaussian_distribution(200 * 200, 10, 3)
+        image = image.as_double()
+        image.reshape(flex.grid(200, 200))
+        mask = flex.bool(image.accessor(), True)
+        blank += screen.is_blank(image, mask)
+
+        # Add a spot
+        for j in range(98, 102):
+            for k in range(98, 102):
+                image[j, k] += 200
+        assert not screen.is_blank(image, mask)
+    assert blank >= 8
@@ -0,0 +1,78 @@
+from __future__ import absolute_import, division, print_function
+
+from random import randint
+
+import pytest
+
+from scitbx.array_family import flex
+
+from dials.algorithms.image.threshold import DispersionThreshold
+from dials.algorithms.spot_finding import SpotFinderEngine, StrongSpotCentroider
+
+
+def make_image(size, frame):
+    image = flex.int([randint(0, 10) for i in range(size[0] * size[1])])
+    image.reshape(flex.grid(size))
+    for n in range(20):
+        x, y = randint(2, size[1] - 3), randint(2, size[0] - 3)
+        for j in range(y - 1, y + 2):
+            for i in range(x - 1, x + 2):
+                image[j, i] = 100 + frame
+    return image
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_spot_finder_engine(nthreads):
+    size = (90, 70)
+    mask = flex.random_bool(size[0] * size[1], 0.95)
+    mask.reshape(flex.grid(size))
+    engine = SpotFinderEngine(
+        kernel_size=(3, 3),
+        n_sigma_b=6,
+        n_sigma_s=3,
+        threshold=0,
+        min_count=2,
+        mask=mask,
+        max_valid=1000,
+        min_spot_size=2,
+        max_spot_size=100,
+        nthreads=nthreads,
+    )
+    assert engine.num_bands() == nthreads
+    algorithm = DispersionThreshold(size, (3, 3), 6, 3, 0, 2)
+
+    for frame in range(3):
+        image = make_image(size, frame)
+        if frame == 2:
+            # A pixel above max_valid is excluded from the threshold
+            image[10, 10] = 5000
+            mask = mask.deep_copy()
+            mask[10, 10] = False
+        expected = flex.bool(flex.grid(size))
+        algorithm(image, mask, expected)
+        spots = engine(image, frame)
+        assert engine.strong_pixels() == expected
+        assert spots.num_strong_pixels() == expected.count(True)
+
+        direct = StrongSpotCentroider(0, frame, image.as_double(), expected, 2, 100)
+        assert len(spots) == len(direct)
+        assert list(spots.bboxes()) == list(direct.bboxes())
+
+        # The same image in a raw buffer gives the same spots
+        buffered = engine.find_spots_in_buffer(
+            image.as_numpy_array().astype("int32").tobytes(), "int32", frame
+        )
+        assert list(buffered.bboxes()) == list(spots.bboxes())
+        buffered = engine.find_spots_in_buffer(
+            image.as_numpy_array().astype("uint16"), "uint16", frame
+        )
+        assert list(buffered.bboxes()) == list(spots.bboxes())
+
+
+def test_spot_finder_engine_rejects_bad_buffers():
+    mask = flex.bool(flex.grid(20, 30), True)
+    engine = SpotFinderEngine((3, 3), 6, 3, 0, 2, mask, 1000, 2, 100)
+    with pytest.raises(RuntimeError):
+        engine.find_spots_in_buffer(b"\0" * 100, "int32")
+    with pytest.raises(RuntimeError):
+        engine.find_spots_in_buffer(b"\0" * 600, "int8")
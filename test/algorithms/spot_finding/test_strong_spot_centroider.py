@@ -0,0 +1,47 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+
+def test_strong_spot_centroider():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.spot_finding import StrongSpotCentroider
+    from dials.array_family import flex as dials_flex
+    from dials.model.data import PixelList, PixelListLabeller
+
+    size = (100, 120)
+    frame = 3
+    image = flex.random_int_gaussian_distribution(size[0] * size[1], 100, 5)
+    image = image.as_double()
+    image.reshape(flex.grid(size))
+    mask = flex.random_bool(size[0] * size[1], 0.3)
+    mask.reshape(flex.grid(size))
+
+    # Find the spots by creating the shoeboxes
+    labeller = PixelListLabeller()
+    labeller.add(PixelList(frame, image, mask))
+    creator = dials_flex.PixelListShoeboxCreator(labeller, 1, 0, True, 2, 10, False)
+    shoeboxes = creator.result().select(creator.result().is_allocated())
+    centroids = shoeboxes.centroid_valid()
+    intensities = shoeboxes.summed_intensity()
+
+    # Find the spots directly
+    spots = StrongSpotCentroider(
+        panel=1, frame=frame, image=image, mask=mask, min_pixels=2, max_pixels=10
+    )
+    assert len(spots) == len(shoeboxes)
+    assert spots.num_too_small() + spots.num_too_large() + len(spots) == len(
+        creator.result()
+    )
+    observed = spots.observations()
+    assert list(observed.panels()) == [1] * len(spots)
+    assert list(spots.bboxes()) == list(shoeboxes.bounding_boxes())
+    assert list(spots.spot_size()) == list(shoeboxes.count_mask_values(5))
+    assert list(spots.peak_coordinates()) == list(shoeboxes.peak_coordinates())
+    for c1, c2 in zip(observed.centroids(), centroids):
+        assert c1.px.position == pytest.approx(c2.px.position)
+        assert c1.px.std_err_sq == pytest.approx(c2.px.std_err_sq)
+    for i1, i2 in zip(observed.intensities(), intensities):
+        assert i1.observed.value == pytest.approx(i2.observed.value)
+        assert i1.observed.variance == pytest.approx(i2.observed.variance)
@@ -0,0 +1,38 @@
+from __future__ import absolute_import, division, print_function
+
+
+def test_combine_blocks():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.spot_finding import StrongSpotCombiner
+    from dials.array_family import flex as dials_flex
+    from dials.model.data import PixelList, PixelListLabeller
+
+    size = (50, 60)
+    masks = []
+    for i in range(8):
+        mask = flex.random_bool(size[0] * size[1], 0.3)
+        mask.reshape(flex.grid(size))
+        masks.append(mask)
+    image = flex.random_int_gaussian_distribution(size[0] * size[1], 100, 5)
+    image.reshape(flex.grid(size))
+
+    def find_spots(first, last):
+        labeller = PixelListLabeller()
+        for i in range(first, last):
+            labeller.add(PixelList(i, image, masks[i]))
+        creator = dials_flex.PixelListShoeboxCreator(
+            labeller, 0, 0, False, 1, 100000, False
+        )
+        return creator.result()
+
+    # Labelling the blocks separately and combining should give the same
+    # spots as labelling the whole sweep
+    expected = sorted(tuple(s.bbox) for s in find_spots(0, 8))
+    combiner = StrongSpotCombiner()
+    for first, last in ((0, 3), (3, 5), (5, 8)):
+        combiner.add(find_spots(first, last))
+    combined = combiner.shoeboxes()
+    assert sorted(tuple(s.bbox) for s in combined) == expected
+    num_strong = sum(m.count(True) for m in masks)
+    assert flex.sum(combined.count_mask_values(5)) == num_strong
@@ -58,3 +58,31 @@ def test(dials_regression):
     assert min_gen_h <= min_xds_h and max_gen_h >= max_xds_h
     assert min_gen_k <= min_xds_k and max_gen_k >= max_xds_k
     assert min_gen_l <= min_xds_l and max_gen_l >= max_xds_l
+
+
+def test_resolution_ordered_indices():
+    from cctbx import uctbx
+    from cctbx.sgtbx import space_group_info
+
+    from dials.algorithms.spot_prediction import (
+        IndexGenerator,
+        ResolutionOrderedIndices,
+    )
+
+    unit_cell = uctbx.unit_cell((40, 50, 60, 90, 100, 90))
+    space_group_type = space_group_info("C 2").group().type()
+    d_min = 3.0
+
+    expected = IndexGenerator(unit_cell, space_group_type, d_min).to_array()
+    ordered = ResolutionOrderedIndices(unit_cell, space_group_type, d_min)
+    indices = ordered.indices()
+    d_star_sq = ordered.d_star_sq()
+    assert len(ordered) == len(expected)
+    assert sorted(indices) == sorted(expected)
+    assert list(d_star_sq) == sorted(d_star_sq)
+    assert list(d_star_sq) == [unit_cell.d_star_sq(h) for h in indices]
+
+    d = unit_cell.d(indices)
+    shell = ordered.select(d_min=4.0, d_max=6.0)
+    assert list(shell) == [h for h, dh in zip(indices, d) if 4.0 <= dh <= 6.0]
+    assert len(ordered.select(d_min=d_min, d_max=1000)) == len(expected)
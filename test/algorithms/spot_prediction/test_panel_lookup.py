@@ -0,0 +1,45 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+
+def make_detector():
+    from dxtbx.model import Detector
+
+    # A 4 x 4 grid of tilted modules with gaps between them
+    detector = Detector()
+    for j in range(4):
+        for i in range(4):
+            panel = detector.add_panel()
+            panel.set_image_size((100, 50))
+            panel.set_pixel_size((0.2, 0.2))
+            origin = (-45 + i * 22, -45 + j * 12, -100 - i * 0.5)
+            panel.set_frame((1, 0, 0.01 * j), (0, 1, 0), origin)
+    return detector
+
+
+def test_panel_lookup():
+    from dials.algorithms.spot_prediction import PanelLookup
+
+    detector = make_detector()
+    lookup = PanelLookup(detector)
+    random.seed(0)
+    num_hits = 0
+    for _ in range(5000):
+        s1 = (random.uniform(-0.6, 0.6), random.uniform(-0.6, 0.6), -1)
+        try:
+            expected = detector.get_ray_intersection(s1)
+        except RuntimeError:
+            expected = None
+        if expected is None:
+            with pytest.raises(RuntimeError):
+                lookup.get_ray_intersection(s1)
+        else:
+            num_hits += 1
+            panel, xy = lookup.get_ray_intersection(s1)
+            assert panel == expected[0]
+            assert xy == pytest.approx(expected[1])
+            assert panel in lookup.candidates(s1)
+    assert num_hits > 1000
@@ -29,3 +29,34 @@ def test(dials_data):
         h0 = r["miller_index"]
         h1 = transform.h(panel, x, y, z)
         assert h0 == pytest.approx(h1, abs=1e-7)
+
+
+def test_h_for_panel(dials_data):
+    import random
+
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.algorithms.spot_prediction import PixelToMillerIndex
+    from dials.array_family import flex
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    experiments = ExperimentListFactory.from_json_file(filename)
+    transform = PixelToMillerIndex(
+        experiments[0].beam,
+        experiments[0].detector,
+        experiments[0].goniometer,
+        experiments[0].scan,
+        experiments[0].crystal,
+    )
+    width, height = experiments[0].detector[0].get_image_size()
+
+    frames = flex.double([0.5, 3.5])
+    result = flex.vec3_double(len(frames) * width * height)
+    transform.h_for_panel(result, 0, frames, nthreads=4)
+    random.seed(0)
+    for _ in range(100):
+        k = random.randrange(len(frames))
+        j = random.randrange(height)
+        i = random.randrange(width)
+        expected = transform.h(0, i + 0.5, j + 0.5, frames[k])
+        assert result[(k * height + j) * width + i] == pytest.approx(expected)
@@ -108,3 +108,33 @@ def test(dials_regression, run_in_tmpdir):
 
         # Check the Phi values are the same
         assert xds_phi == pytest.approx(my_phi, abs=0.1)
+
+
+def test_calculate_array():
+    import random
+
+    from dials.algorithms.spot_prediction import RotationAngles
+    from dials.array_family import flex
+
+    s0 = matrix.col((0.01, 0.002, -1.0)).normalize() / 0.98
+    m2 = matrix.col((1.0, 0.01, 0.0)).normalize()
+    ra = RotationAngles(s0, m2)
+
+    random.seed(0)
+    pstar0 = flex.vec3_double(
+        [tuple(random.uniform(-1.5, 1.5) for _ in range(3)) for _ in range(1000)]
+    )
+    angles, valid = ra.calculate(pstar0)
+    assert len(angles) == len(valid) == len(pstar0)
+    assert 0 < valid.count(True) < len(pstar0)
+    for p, phi, v in zip(pstar0, angles, valid):
+        if v:
+            assert phi == pytest.approx(ra(p))
+            for angle in phi:
+                r = m2.axis_and_angle_as_r3_rotation_matrix(angle=angle)
+                s1 = s0 + r * matrix.col(p)
+                assert s1.length() == pytest.approx(s0.length())
+        else:
+            assert phi == (0, 0)
+            with pytest.raises(RuntimeError):
+                ra(p)
@@ -206,3 +206,44 @@ def test_with_reflection_table(data):
     # r_old = self.predict_new()
     # r_new = self.predict_new(indices, panels)
     # assert(len(r_old) < len(r_new))
+
+
+def test_with_reflection_table_nthreads(data):
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+    from dials.array_family import flex
+
+    A = data.experiments[0].crystal.get_A()
+    predict = ScanStaticReflectionPredictor(data.experiments[0])
+    results = []
+    for ub, nthreads in [
+        (A, 1),
+        (A, 3),
+        (flex.mat3_double(len(data.reflections), A), 3),
+    ]:
+        r_new = flex.reflection_table()
+        r_new["miller_index"] = data.reflections["miller_index"]
+        r_new["panel"] = data.reflections["panel"]
+        r_new["entering"] = data.reflections["entering"]
+        predict.for_reflection_table(r_new, ub, nthreads=nthreads)
+        results.append(r_new)
+
+    # The predictions should not depend on the number of threads
+    for r_new in results[1:]:
+        for key in ("s1", "xyzcal.px", "xyzcal.mm", "flags"):
+            assert list(r_new[key]) == list(results[0][key])
+
+
+def test_for_ub_block_size(data):
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+
+    A = data.experiments[0].crystal.get_A()
+    predict = ScanStaticReflectionPredictor(data.experiments[0])
+
+    def predictions(block_size):
+        r = predict.for_ub(A, block_size=block_size)
+        return sorted(zip(r["miller_index"], r["entering"], r["xyzcal.px"]))
+
+    expected = predictions(1)
+    assert len(expected) > 0
+    for block_size in (4, 100):
+        assert predictions(block_size) == expected
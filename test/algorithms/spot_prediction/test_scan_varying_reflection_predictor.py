@@ -301,3 +301,106 @@ def test_for_reflection_table(data):
     assert old_x.all_approx_equal(new_x)
     assert old_y.all_approx_equal(new_y)
     assert old_z.all_approx_equal(new_z)
+
+
+def test_for_ub_nthreads(data):
+    from dials.algorithms.spot_prediction import ScanVaryingReflectionPredictor
+    from dials.array_family import flex
+
+    experiment = data.experiments[0]
+    predict = ScanVaryingReflectionPredictor(experiment)
+    A = flex.mat3_double(
+        [
+            experiment.crystal.get_A_at_scan_point(i)
+            for i in range(experiment.crystal.num_scan_points)
+        ]
+    )
+    n = len(A)
+    s0 = flex.vec3_double(n, experiment.beam.get_s0())
+    S = flex.mat3_double(n, experiment.goniometer.get_setting_rotation())
+
+    # The predictions should be identical and in the same order
+    for r1, r2 in [
+        (predict.for_ub(A), predict.for_ub(A, nthreads=3)),
+        (
+            predict.for_varying_models(A, s0, S),
+            predict.for_varying_models(A, s0, S, nthreads=3),
+        ),
+    ]:
+        assert len(r1) == len(r2)
+        for key in ("miller_index", "entering", "panel", "s1", "xyzcal.px"):
+            assert list(r1[key]) == list(r2[key])
+
+
+def test_for_reflection_table_with_changing_models(data):
+    from dials.algorithms.spot_prediction import (
+        ScanStaticReflectionPredictor,
+        ScanVaryingReflectionPredictor,
+    )
+    from dials.array_family import flex
+
+    experiment = data.experiments[0]
+    preds = ScanStaticReflectionPredictor(experiment).for_ub(experiment.crystal.get_A())
+    n = len(preds)
+    s0 = experiment.beam.get_s0()
+    s0_alt = tuple(0.999 * x for x in s0)
+    preds["ub_matrix"] = flex.mat3_double(n, experiment.crystal.get_A())
+    preds["s0"] = flex.vec3_double([s0 if i % 2 else s0_alt for i in range(n)])
+    preds["d_matrix"] = flex.mat3_double(n)
+    for ipanel, panel in enumerate(experiment.detector):
+        preds["d_matrix"].set_selected(preds["panel"] == ipanel, panel.get_d_matrix())
+    S = experiment.goniometer.get_setting_rotation()
+    preds["S_matrix"] = flex.mat3_double(n, S)
+
+    # Predicting rows with alternating models should give the same result as
+    # predicting the rows for each model separately
+    predict = ScanVaryingReflectionPredictor(experiment)
+    columns = ("ub_matrix", "s0", "d_matrix", "S_matrix")
+    expected = []
+    for parity in (0, 1):
+        sel = flex.bool([i % 2 == parity for i in range(n)])
+        subset = preds.select(sel)
+        predict.for_reflection_table(subset, *[subset[c] for c in columns])
+        expected.append(subset)
+    predict.for_reflection_table(preds, *[preds[c] for c in columns])
+    for parity in (0, 1):
+        sel = flex.bool([i % 2 == parity for i in range(n)])
+        subset = preds.select(sel)
+        for key in ("s1", "xyzcal.px", "xyzcal.mm", "flags"):
+            assert list(subset[key]) == list(expected[parity][key])
+
+
+def test_for_reflection_table_by_block(data):
+    from dials.algorithms.spot_prediction import (
+        ScanStaticReflectionPredictor,
+        ScanVaryingReflectionPredictor,
+    )
+    from dials.array_family import flex
+
+    experiment = data.experiments[0]
+    preds = ScanStaticReflectionPredictor(experiment).for_ub(experiment.crystal.get_A())
+    n = len(preds)
+    s0 = experiment.beam.get_s0()
+    s0_alt = tuple(0.999 * x for x in s0)
+
+    # blocks of rows sharing the same models, with one row in block 0 that
+    # differs from the rest of its block
+    block = flex.size_t([(i // 10) % 3 for i in range(n)])
+    preds["ub_matrix"] = flex.mat3_double(n, experiment.crystal.get_A())
+    preds["s0"] = flex.vec3_double(
+        [s0_alt if b == 1 or i == 5 else s0 for i, b in enumerate(block)]
+    )
+    preds["d_matrix"] = flex.mat3_double(n)
+    for ipanel, panel in enumerate(experiment.detector):
+        preds["d_matrix"].set_selected(preds["panel"] == ipanel, panel.get_d_matrix())
+    preds["S_matrix"] = flex.mat3_double(n, experiment.goniometer.get_setting_rotation())
+
+    # Predicting by block should give the same result as predicting each row
+    # with its own models
+    predict = ScanVaryingReflectionPredictor(experiment)
+    columns = ("ub_matrix", "s0", "d_matrix", "S_matrix")
+    expected = copy.deepcopy(preds)
+    predict.for_reflection_table(expected, *[expected[c] for c in columns])
+    predict.for_reflection_table_by_block(preds, block, *[preds[c] for c in columns])
+    for key in ("s1", "xyzcal.px", "xyzcal.mm", "flags"):
+        assert list(preds[key]) == list(expected[key])
@@ -160,3 +160,22 @@ def test_spherical_relps():
         denom = sqrt(radicand)
         s1 = es_radius * (q + s0) / denom
         assert approx_equal(s1, ref["s1"])
+
+
+@pytest.mark.parametrize("spherical_relp", [False, True])
+def test_for_reflection_table_nthreads(spherical_relp):
+    model = Model()
+    UB = matrix.sqr(model.crystal.get_A())
+
+    from dials.algorithms.spot_prediction import StillsReflectionPredictor
+
+    predictor = StillsReflectionPredictor(
+        model.experiment, spherical_relp=spherical_relp
+    )
+    expected = model.reflections
+    predictor.for_reflection_table(expected, UB)
+    for nthreads in [2, 5]:
+        reflections = model.generate_reflections()
+        predictor.for_reflection_table(reflections, UB, nthreads=nthreads)
+        for key in ["s1", "xyzcal.mm", "xyzcal.px", "delpsical.rad", "flags"]:
+            assert list(reflections[key]) == list(expected[key])
@@ -0,0 +1,54 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from scitbx.array_family import flex
+
+
+@pytest.mark.parametrize("fix_mean", [False, True])
+def test_binned_gmm_single_1d_multi(fix_mean):
+    from dials.algorithms.statistics import (
+        BinnedGMMSingle1D,
+        BinnedGMMSingle1DFixedMean,
+        BinnedGMMSingle1DMulti,
+    )
+
+    random.seed(0)
+    histograms = []
+    for i in range(20):
+        mu, sigma = random.uniform(-2, 2), random.uniform(0.5, 2)
+        edges = [-10 + 0.5 * j for j in range(41)]
+        counts = [0] * 40
+        for k in range(500):
+            j = int((random.gauss(mu, sigma) + 10) / 0.5)
+            if 0 <= j < 40:
+                counts[j] += 1
+        histograms.append((edges[:-1], edges[1:], counts, mu + 0.3, sigma * 1.5))
+
+    a = flex.double()
+    b = flex.double()
+    n = flex.double()
+    size = flex.size_t()
+    for h in histograms:
+        a.extend(flex.double(h[0]))
+        b.extend(flex.double(h[1]))
+        n.extend(flex.double(h[2]))
+        size.append(len(h[0]))
+    mu0 = flex.double([h[3] for h in histograms])
+    sigma0 = flex.double([h[4] for h in histograms])
+
+    for nthreads in (1, 3):
+        result = BinnedGMMSingle1DMulti(
+            a, b, n, size, mu0, sigma0, 1e-7, 100, fix_mean=fix_mean, nthreads=nthreads
+        )
+        for i, h in enumerate(histograms):
+            args = (flex.double(h[0]), flex.double(h[1]), flex.double(h[2]))
+            if fix_mean:
+                expected = BinnedGMMSingle1DFixedMean(*(args + (h[3], h[4], 1e-7, 100)))
+            else:
+                expected = BinnedGMMSingle1D(*(args + (h[3], h[4], 1e-7, 100)))
+            assert result.num_iter()[i] == expected.num_iter()
+            assert result.mu()[i] == pytest.approx(expected.mu())
+            assert result.sigma()[i] == pytest.approx(expected.sigma())
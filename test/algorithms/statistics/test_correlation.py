@@ -0,0 +1,92 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from scitbx.array_family import flex
+
+
+def test_spearman_correlation_coefficient_threads():
+    from dials.algorithms.statistics import spearman_correlation_coefficient
+
+    random.seed(0)
+    a = flex.double([random.randint(0, 50) for i in range(1000)])
+    b = a + flex.double([random.gauss(0, 10) for i in range(1000)])
+    expected = spearman_correlation_coefficient(a, b)
+    for nthreads in (2, 3, 7):
+        result = spearman_correlation_coefficient(a, b, nthreads=nthreads)
+        assert result == pytest.approx(expected)
+
+
+def test_pearson_correlation_accumulator():
+    from dials.algorithms.statistics import (
+        PearsonCorrelationAccumulator,
+        pearson_correlation_coefficient,
+    )
+
+    random.seed(0)
+    x = flex.double([random.gauss(0, 1) for i in range(100)])
+    y = x + flex.double([random.gauss(0, 1) for i in range(100)])
+
+    accumulator = PearsonCorrelationAccumulator(x, y)
+    assert accumulator.n() == 100
+    assert accumulator.coefficient() == pytest.approx(
+        pearson_correlation_coefficient(x, y)
+    )
+
+    # Leave out the first 20 pairs
+    accumulator.remove(x[:20], y[:20])
+    assert accumulator.n() == 80
+    assert accumulator.coefficient() == pytest.approx(
+        pearson_correlation_coefficient(x[20:], y[20:])
+    )
+
+    # Combine accumulators
+    other = PearsonCorrelationAccumulator()
+    for i in range(20):
+        other.add(x[i], y[i])
+    accumulator.add(other)
+    assert accumulator.coefficient() == pytest.approx(
+        pearson_correlation_coefficient(x, y)
+    )
+
+
+def test_delta_cchalf():
+    from dials.algorithms.statistics import DeltaCChalf
+
+    random.seed(0)
+    nunique, ngroups, nbins = 100, 5, 3
+    unique = flex.size_t([random.randrange(nunique) for i in range(1000)])
+    group = flex.size_t([random.randrange(ngroups) for i in range(1000)])
+    intensity = flex.double([random.gauss(100 + u, 10) for u in unique])
+    bins = flex.size_t([random.randrange(nbins) for i in range(nunique)])
+
+    def cchalf(sel):
+        means = [[] for b in range(nbins)]
+        variances = [[] for b in range(nbins)]
+        for u in range(nunique):
+            x = intensity.select(sel & (unique == u))
+            if len(x) > 1:
+                means[bins[u]].append(flex.mean(x))
+                variance = flex.mean_and_variance(x).unweighted_sample_variance()
+                variances[bins[u]].append(variance / len(x))
+        total, count = 0, 0
+        for m, v in zip(means, variances):
+            if len(m) > 1:
+                sigma_e = sum(v) / len(v)
+                sigma_y = flex.mean_and_variance(
+                    flex.double(m)
+                ).unweighted_sample_variance()
+                total += len(m) * (sigma_y - sigma_e) / (sigma_y + sigma_e)
+                count += len(m)
+        return total / count
+
+    statistics = DeltaCChalf(unique, group, intensity, bins, nbins)
+    assert statistics.ngroups() == ngroups
+    assert statistics.mean_cchalf() == pytest.approx(cchalf(flex.bool(1000, True)))
+    for nthreads in (1, 2):
+        result = statistics.cchalf_excluding_each_group(nthreads=nthreads)
+        assert len(result) == ngroups
+        for g in range(ngroups):
+            assert result[g] == pytest.approx(cchalf(group != g))
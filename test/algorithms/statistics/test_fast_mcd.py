@@ -64,6 +64,37 @@ def test_maha():
     assert approx_equal(list(maha), R_result)
 
 
+def test_mcd_subset():
+    from libtbx.test_utils import approx_equal
+    from scitbx.array_family import flex
+
+    from dials.algorithms.statistics.fast_mcd import (
+        FastMCD,
+        MCDSubset,
+        maha_dist_sq,
+        observation_matrix,
+    )
+
+    flex.set_random_seed(42)
+    cols = [flex.random_double(50) for _ in range(3)]
+    cols[1] += cols[0]
+    h = 30
+
+    T, S = FastMCD.means_and_covariance(cols)
+    subset = MCDSubset(observation_matrix(cols), h)
+
+    # repeated concentration steps update the subset incrementally, but should
+    # match the location and covariance of the h closest observations
+    for _ in range(3):
+        d2 = maha_dist_sq(cols, T, S, nproc=2)
+        closest = flex.sort_permutation(d2)[0:h]
+        T_ref, S_ref = FastMCD.means_and_covariance([c.select(closest) for c in cols])
+
+        T, S = FastMCD.concentration_step(subset, T, S)
+        assert approx_equal(T, T_ref)
+        assert approx_equal(S, S_ref)
+
+
 def test_fast_mcd_small():
     # set random seeds to try to avoid assertion errors due to occasionally
     # finding less common solutions
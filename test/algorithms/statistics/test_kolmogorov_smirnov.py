@@ -0,0 +1,32 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from scitbx.array_family import flex
+
+
+@pytest.mark.parametrize("kstype", ["less", "greater", "two_sided"])
+def test_kolmogorov_smirnov_test_standard_normal_batch(kstype):
+    from dials.algorithms.statistics import (
+        kolmogorov_smirnov_test_standard_normal,
+        kolmogorov_smirnov_test_standard_normal_batch,
+    )
+
+    random.seed(0)
+    sizes = flex.size_t([random.randint(1, 50) for i in range(200)])
+    data = flex.double([random.gauss(0.2, 1.1) for i in range(flex.sum(sizes))])
+    D, p = kolmogorov_smirnov_test_standard_normal_batch(data, sizes, type=kstype)
+    assert len(D) == len(sizes)
+    assert len(p) == len(sizes)
+
+    offset = 0
+    for i, n in enumerate(sizes):
+        sample = data[offset : offset + n]
+        offset += n
+        expected_D, expected_p = kolmogorov_smirnov_test_standard_normal(
+            sample, type=kstype
+        )
+        assert D[i] == pytest.approx(expected_D)
+        assert p[i] == pytest.approx(expected_p, abs=1e-3)
@@ -0,0 +1,42 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+from dials.array_family import flex
+
+
+@pytest.mark.parametrize(
+    "bins",
+    [
+        [0.0, 1.0, 2.0, 3.0, 4.0],
+        [0.0, 0.5, 2.0, 2.5, 4.0],
+    ],
+)
+def test_binner_indexer(bins):
+    binner = flex.Binner(flex.double(bins))
+    x = flex.double([-1.0, 0.0, 0.2, 1.0, 1.9, 2.0, 2.4, 2.5, 3.9, 4.0, 10.0])
+
+    # A value is in the bin of the last edge not greater than it
+    expected = [max(0, sum(1 for b in bins if b <= v) - 1) for v in x]
+    assert list(binner.indexer(x).indices(0)) == [
+        i for i, e in enumerate(expected) if e == 0
+    ]
+    for nthreads in (1, 3):
+        count = binner.indexer(x, nthreads=nthreads).count()
+        assert list(count) == [expected.count(i) for i in range(len(bins))]
+
+
+def test_bin_indexer_statistics():
+    binner = flex.Binner(flex.double([0, 10, 20, 30]))
+    x = flex.double([1, 2, 11, 12, 13, 25, 5, 15])
+    y = flex.double([1.0, -2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0])
+    indexer = binner.indexer(x)
+
+    for nthreads in (1, 2, 4):
+        stats = indexer.statistics(y, nthreads=nthreads)
+        assert list(stats.count()) == [3, 4, 1, 0]
+        assert list(stats.sum()) == pytest.approx([6.0, 20.0, 6.0, 0.0])
+        assert list(stats.sum_sq()) == pytest.approx([54.0, 114.0, 36.0, 0.0])
+        assert list(stats.min()) == [-2.0, 3.0, 6.0, 0.0]
+        assert list(stats.max()) == [7.0, 8.0, 6.0, 0.0]
+        assert list(stats.mean()) == pytest.approx(list(indexer.mean(y)))
@@ -118,6 +118,33 @@ def test_count_mask_values():
             shoebox[i].mask[j] = value
 
     assert shoebox.count_mask_values(value) == num
+    assert shoebox.count_mask_values(value, nthreads=3) == num
+
+    centroids = shoebox.centroid_masked(value)
+    threaded = shoebox.centroid_masked(value, nthreads=3)
+    for c1, c2 in zip(centroids, threaded):
+        assert c1.px.position == c2.px.position
+
+    intensity = shoebox.summed_intensity()
+    threaded = shoebox.summed_intensity(nthreads=3)
+    for i1, i2 in zip(intensity, threaded):
+        assert i1.observed.value == i2.observed.value
+
+    expected = []
+    for sbox in shoebox:
+        nz, ny, nx = sbox.mask.all()
+        mask = [0] * (ny * nx)
+        for k in range(nz):
+            for j in range(ny * nx):
+                mask[j] |= sbox.mask[k * ny * nx + j]
+        expected.append(mask)
+    shoebox.flatten(nthreads=3)
+    for sbox, mask in zip(shoebox, expected):
+        assert sbox.flat
+        assert list(sbox.mask) == mask
+
+    shoebox.deallocate()
+    assert shoebox.is_allocated() == flex.bool(10, False)
 
 
 def test_bounding_boxes():
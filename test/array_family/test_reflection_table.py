@@ -638,6 +638,124 @@ def test_sort():
     ]
 
 
+def test_table_operations_with_threads():
+    random.seed(0)
+    n = 1000
+    table = flex.reflection_table()
+    table["a"] = flex.int([random.randint(0, 20) for i in range(n)])
+    table["b"] = flex.double([random.random() for i in range(n)])
+    table["c"] = flex.size_t(range(n))
+    table["d"] = flex.vec3_double(n, (1, 2, 3))
+    table["e"] = flex.std_string(n, "e")
+
+    def assert_tables_equal(t1, t2):
+        assert list(t1.keys()) == list(t2.keys())
+        for key in t1.keys():
+            assert list(t1[key]) == list(t2[key])
+
+    flags = flex.bool([random.random() < 0.5 for i in range(n)])
+    index = flex.size_t(random.sample(range(n), 100))
+    assert_tables_equal(table.select(flags), table.select(flags, nthreads=3))
+    assert_tables_equal(table.select(index), table.select(index, nthreads=3))
+
+    t1, t2 = copy.deepcopy(table), copy.deepcopy(table)
+    t1.extend(table)
+    t2.extend(table, nthreads=3)
+    assert_tables_equal(t1, t2)
+
+    t1, t2 = copy.deepcopy(table), copy.deepcopy(table)
+    t1.del_selected(flags)
+    t2.del_selected(flags, nthreads=3)
+    assert_tables_equal(t1, t2)
+    assert_tables_equal(t1, table.select(~flags))
+
+    # the threaded sort is stable, so ties are kept in the original order
+    for key in ("a", "b"):
+        for reverse in (False, True):
+            expected = flex.sort_permutation(table[key], reverse=reverse, stable=True)
+            for nthreads in (1, 3, 7):
+                perm = table.sort_permutation(key, reverse=reverse, nthreads=nthreads)
+                assert list(perm) == list(expected)
+            t1, t2 = copy.deepcopy(table), copy.deepcopy(table)
+            t1.sort(key, reverse=reverse)
+            t2.sort(key, reverse=reverse, nthreads=3)
+            assert_tables_equal(t1, t2)
+
+
+def test_sort_permutation_radix():
+    random.seed(0)
+    n = 2000
+    table = flex.reflection_table()
+    table["a"] = flex.int([random.randint(-(2 ** 31), 2 ** 31 - 1) for i in range(n)])
+    table["b"] = flex.double(
+        [
+            random.choice((-0.0, 0.0, -1e300, 1e300, random.gauss(0, 1e5)))
+            for i in range(n)
+        ]
+    )
+    table["c"] = flex.size_t([random.randint(0, 2 ** 40) for i in range(n)])
+    table["d"] = flex.miller_index(
+        [
+            (random.randint(-3, 3), random.randint(-3, 3), random.randint(-50, 50))
+            for i in range(n)
+        ]
+    )
+
+    # the radix sort gives the same stable order as a comparison sort
+    for key in table.keys():
+        values = list(table[key])
+        for reverse in (False, True):
+            expected = sorted(range(n), key=lambda i: values[i], reverse=reverse)
+            for nthreads in (1, 4):
+                perm = table.sort_permutation(key, reverse=reverse, nthreads=nthreads)
+                assert list(perm) == expected
+
+
+def test_group_by_and_hash_join():
+    random.seed(0)
+
+    def make_table(n):
+        table = flex.reflection_table()
+        table["miller_index"] = flex.miller_index(
+            [tuple(random.randint(-2, 2) for j in range(3)) for i in range(n)]
+        )
+        table["id"] = flex.int([random.randint(0, 1) for i in range(n)])
+        table["x"] = flex.double(n)
+        return table
+
+    def key(table, i):
+        return table["miller_index"][i] + (table["id"][i],)
+
+    t1, t2 = make_table(500), make_table(300)
+    keys = ("miller_index", "id")
+
+    # the groups are numbered in the order of their first row
+    first = {}
+    for i in range(len(t1)):
+        first.setdefault(key(t1, i), len(first))
+    for nthreads in (1, 3):
+        group, offsets, indices = t1.group_by(keys, nthreads=nthreads)
+        assert list(group) == [first[key(t1, i)] for i in range(len(t1))]
+        assert len(offsets) == len(first) + 1
+        for g in range(len(first)):
+            rows = list(indices[offsets[g] : offsets[g + 1]])
+            assert rows == [i for i in range(len(t1)) if group[i] == g]
+
+    # the pairs of rows with equal keys, ordered by the left and right rows
+    expected = [
+        (i, j)
+        for i in range(len(t1))
+        for j in range(len(t2))
+        if key(t1, i) == key(t2, j)
+    ]
+    for nthreads in (1, 3):
+        left, right = t1.hash_join(t2, keys, nthreads=nthreads)
+        assert list(zip(left, right)) == expected
+
+    with pytest.raises(RuntimeError):
+        t1.group_by(("x",))
+
+
 def test_flags():
     # Create a table with flags all 0
     table = flex.reflection_table()
@@ -744,7 +862,9 @@ def test_copy():
     assert table2.is_consistent()
 
 
-def test_extract_shoeboxes():
+@pytest.mark.parametrize("flag_overloaded", [False, True])
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_extract_shoeboxes(nthreads, flag_overloaded):
     from dials.algorithms.shoebox import MaskCode
 
     random.seed(0)
@@ -818,7 +938,11 @@ def get_mask(self, index):
 
     imageset = FakeImageSet()
 
-    reflections.extract_shoeboxes(imageset)
+    reflections.extract_shoeboxes(
+        imageset, nthreads=nthreads, flag_overloaded=flag_overloaded
+    )
+    if flag_overloaded:
+        overloaded = reflections.get_flags(reflections.flags.overloaded)
 
     for i in range(len(reflections)):
         sbox = reflections[i]["shoebox"]
@@ -828,6 +952,7 @@ def get_mask(self, index):
         bbox = sbox.bbox
         panel = sbox.panel
         x0, x1, y0, y1, z0, z1 = bbox
+        has_overload = False
         for z in range(z1 - z0):
             for y in range(y1 - y0):
                 for x in range(x1 - x0):
@@ -841,11 +966,16 @@ def get_mask(self, index):
                     ):
                         v2 = imageset.data[y + y0, x + x0] + (z + z0) * (panel + 1)
                         m2 = MaskCode.Valid
+                        if flag_overloaded and v2 >= 1000000:
+                            m2 = 0
+                            has_overload = True
                         assert v1 == v2
                         assert m1 == m2
                     else:
                         assert v1 == 0
                         assert m1 == 0
+        if flag_overloaded:
+            assert overloaded[i] == has_overload
 
 
 def test_split_by_experiment_id():
@@ -1179,6 +1309,34 @@ def compare(a, b):
     assert all(tuple(compare(a, b) for a, b in zip(new_table["col11"], c11)))
 
 
+def test_from_msgpack_columns(tmpdir):
+    table = flex.reflection_table()
+    table["id"] = flex.int([0, 1, 0])
+    table["miller_index"] = flex.miller_index([(1, 2, 3), (4, 5, 6), (7, 8, 9)])
+    table["intensity.sum.value"] = flex.double([1.0, 2.0, 3.0])
+    table["xyzcal.px"] = flex.vec3_double(3, (1, 2, 3))
+    table.experiment_identifiers()[0] = "abc"
+    table.experiment_identifiers()[1] = "def"
+    columns = ["miller_index", "intensity.sum.value"]
+
+    def check(new_table):
+        assert new_table.nrows() == 3
+        assert sorted(new_table.keys()) == sorted(columns)
+        for key in columns:
+            assert list(new_table[key]) == list(table[key])
+        identifiers = new_table.experiment_identifiers()
+        assert list(identifiers.keys()) == [0, 1]
+        assert list(identifiers.values()) == ["abc", "def"]
+
+    check(flex.reflection_table.from_msgpack(table.as_msgpack(), columns=columns))
+
+    # Read from a memory mapped file
+    filename = tmpdir.join("reflections.refl").strpath
+    table.as_msgpack_file(filename)
+    check(flex.reflection_table.from_msgpack_file(filename, columns=columns))
+    assert flex.reflection_table.from_msgpack_file(filename).ncols() == 4
+
+
 def test_experiment_identifiers():
     from dxtbx.model import Experiment, ExperimentList
 
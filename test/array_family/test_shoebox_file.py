@@ -0,0 +1,96 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from dials_array_family_flex_ext import ShoeboxExtractor
+
+from dials.array_family import flex
+from dials.model.data import make_image
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_write_and_read_shoeboxes(tmpdir, nthreads):
+    random.seed(0)
+
+    npanels = 2
+    width = 100
+    height = 100
+    frame0 = 10
+    frame1 = 40
+    blocks = flex.int([frame0, 20, 25, frame1])
+
+    panel = flex.size_t()
+    bbox = flex.int6()
+    for i in range(200):
+        xs = random.randint(2, 6)
+        ys = random.randint(2, 6)
+        x0 = random.randint(-xs + 1, width - 1)
+        y0 = random.randint(-ys + 1, height - 1)
+        z0 = random.randint(frame0, frame1 - 1)
+        z1 = min(z0 + random.randint(1, 10), frame1)
+        panel.append(random.randint(0, npanels - 1))
+        bbox.append((x0, x0 + xs, y0, y0 + ys, z0, z1))
+
+    data = flex.double(range(height * width))
+    data.reshape(flex.grid(height, width))
+    mask = data >= 0
+    mask[5] = False
+
+    def image(frame):
+        return make_image(
+            tuple(data + frame * (p + 1) for p in range(npanels)),
+            tuple(mask for p in range(npanels)),
+        )
+
+    filename = tmpdir.join("shoeboxes.dat").strpath
+    writer = flex.ShoeboxWriter(
+        filename, panel, bbox, blocks, npanels, nthreads=nthreads
+    )
+    for frame in range(frame0, frame1):
+        writer.add_image(image(frame))
+    assert writer.finished()
+    assert writer.num_written() == len(bbox)
+    del writer
+
+    # Extract the same shoeboxes in memory to compare with
+    reflections = flex.reflection_table()
+    reflections["panel"] = panel
+    reflections["bbox"] = bbox
+    reflections["shoebox"] = flex.shoebox(panel, bbox)
+    reflections["shoebox"].allocate()
+    extractor = ShoeboxExtractor(reflections, npanels, frame0, frame1)
+    for frame in range(frame0, frame1):
+        extractor.next(image(frame))
+    expected = reflections["shoebox"]
+
+    reader = flex.ShoeboxReader(filename)
+    assert len(reader) == len(blocks) - 1
+    assert list(reader.blocks()) == list(blocks)
+    assert reader.num_shoeboxes() == len(bbox)
+    seen = set()
+    for i in range(len(reader)):
+        z0, z1 = reader.block(i)
+        indices = reader.indices(i)
+        shoeboxes = reader[i]
+        assert len(indices) == len(shoeboxes)
+        for index, sbox in zip(indices, shoeboxes):
+            assert index not in seen
+            seen.add(index)
+            assert z0 < sbox.bbox[5] <= z1
+            assert sbox.bbox == bbox[index]
+            assert sbox.panel == panel[index]
+            assert sbox.data.all_eq(expected[index].data)
+            assert sbox.mask.all_eq(expected[index].mask)
+    assert len(seen) == len(bbox)
+
+
+def test_incomplete_file_is_rejected(tmpdir):
+    filename = tmpdir.join("shoeboxes.dat").strpath
+    bbox = flex.int6()
+    bbox.append((0, 2, 0, 2, 0, 2))
+    writer = flex.ShoeboxWriter(filename, flex.size_t([0]), bbox, flex.int([0, 2]), 1)
+    del writer
+    with pytest.raises(RuntimeError):
+        flex.ShoeboxReader(filename)
@@ -0,0 +1,647 @@
+/*
+ * benchmark_kernels.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ *
+ * Time the native kernels used in spot finding, prediction and integration on
+ * synthetic data generated from fixed seeds, at the size of a Pilatus 6M
+ * detector. Each benchmark writes one JSON object on a line to stdout with the
+ * minimum, median and maximum wall clock time of the repeats, in seconds.
+ *
+ * Usage: benchmark_kernels [--repeat=N] [--nthreads=N] [--list] [name ...]
+ *
+ * If any names are given, only the benchmarks with those names are run.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/poisson_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <scitbx/math/r3_rotation.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <cctbx/uctbx.h>
+#include <cctbx/sgtbx/space_group_type.h>
+#include <dxtbx/model/beam.h>
+#include <dxtbx/model/detector.h>
+#include <dxtbx/model/goniometer.h>
+#include <dxtbx/model/scan.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/array_family/reflection_table.h>
+#include <dials/array_family/reflection_table_msgpack_adapter.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/algorithms/image/filter/summed_area.h>
+#include <dials/algorithms/image/filter/median.h>
+#include <dials/algorithms/integration/sum/summation.h>
+#include <dials/algorithms/integration/fit/fitting.h>
+#include <dials/algorithms/profile_model/gaussian_rs/bbox_calculator.h>
+#include <dials/algorithms/profile_model/gaussian_rs/mask_calculator.h>
+#include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/transform/transform.h>
+#include <dials/algorithms/spot_prediction/reflection_predictor.h>
+#include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/util/timer.h>
+#include <dials/error.h>
+
+using dials::algorithms::detect_collisions3d;
+using dials::algorithms::DispersionExtendedThreshold;
+using dials::algorithms::DispersionThreshold;
+using dials::algorithms::FloatBox3d;
+using dials::algorithms::LabelImageStack;
+using dials::algorithms::median_filter;
+using dials::algorithms::ProfileFitter;
+using dials::algorithms::ScanStaticReflectionPredictor;
+using dials::algorithms::Summation;
+using dials::algorithms::summed_area;
+using dials::algorithms::profile_model::gaussian_rs::BBoxCalculator3D;
+using dials::algorithms::profile_model::gaussian_rs::CoordinateSystem;
+using dials::algorithms::profile_model::gaussian_rs::MaskCalculator3D;
+using dials::algorithms::profile_model::gaussian_rs::transform::TransformForward;
+using dials::algorithms::profile_model::gaussian_rs::transform::TransformSpec;
+using dials::model::Shoebox;
+using dials::util::monotonic_time;
+using dxtbx::model::Beam;
+using dxtbx::model::BeamBase;
+using dxtbx::model::Detector;
+using dxtbx::model::Goniometer;
+using dxtbx::model::Panel;
+using dxtbx::model::Scan;
+using scitbx::mat3;
+using scitbx::vec2;
+using scitbx::vec3;
+using scitbx::af::int2;
+using scitbx::af::int6;
+using scitbx::af::tiny;
+using scitbx::math::r3_rotation::axis_and_angle_as_matrix;
+
+namespace af = dials::af;
+
+namespace {
+
+  // The size of a Pilatus 6M image
+  const std::size_t IMAGE_XSIZE = 2463;
+  const std::size_t IMAGE_YSIZE = 2527;
+
+  // The number of spots on each synthetic image
+  const std::size_t NUM_SPOTS = 2000;
+
+  // The number of images in the stack used for connected components
+  const std::size_t NUM_FRAMES = 5;
+
+  // The number of synthetic shoeboxes for summation and profile fitting
+  const std::size_t NUM_SHOEBOXES = 20000;
+
+  // The number of predicted reflections used for masking and transforming
+  const std::size_t NUM_MASK = 20000;
+  const std::size_t NUM_TRANSFORM = 5000;
+
+  // The beam divergence and mosaicity (radians)
+  const double SIGMA_B = 0.00042;
+  const double SIGMA_M = 0.00105;
+  const double N_SIGMA = 3.0;
+
+  /**
+   * Values accumulated from the result of each benchmark so that the work
+   * cannot be optimised away
+   */
+  double sink = 0;
+
+  struct Options {
+    std::size_t repeat;
+    std::size_t nthreads;
+    bool list;
+    std::vector<std::string> names;
+
+    Options() : repeat(5), nthreads(1), list(false) {}
+  };
+
+  /**
+   * Time a benchmark and print the result as a line of JSON
+   * @param options The command line options
+   * @param name The name of the benchmark
+   * @param size A description of the size of the input
+   * @param nitems The number of items processed in each call
+   * @param func The function to time
+   */
+  void run(const Options &options,
+           const std::string &name,
+           const std::string &size,
+           std::size_t nitems,
+           boost::function<void()> func) {
+    if (options.list) {
+      std::printf("%s\n", name.c_str());
+      return;
+    }
+    if (!options.names.empty()
+        && std::find(options.names.begin(), options.names.end(), name)
+             == options.names.end()) {
+      return;
+    }
+
+    // Call once untimed to warm up the caches and the allocator
+    func();
+    std::vector<double> times;
+    for (std::size_t i = 0; i < options.repeat; ++i) {
+      double t0 = monotonic_time();
+      func();
+      times.push_back(monotonic_time() - t0);
+    }
+    std::sort(times.begin(), times.end());
+    std::printf(
+      "{\"name\": \"%s\", \"size\": \"%s\", \"items\": %lu, \"nthreads\": %lu, "
+      "\"repeat\": %lu, \"min\": %.6f, \"median\": %.6f, \"max\": %.6f}\n",
+      name.c_str(),
+      size.c_str(),
+      (unsigned long)nitems,
+      (unsigned long)options.nthreads,
+      (unsigned long)options.repeat,
+      times.front(),
+      times[times.size() / 2],
+      times.back());
+    std::fflush(stdout);
+  }
+
+  std::string size_string(std::size_t a, std::size_t b) {
+    std::ostringstream ss;
+    ss << a << "x" << b;
+    return ss.str();
+  }
+
+  /**
+   * A synthetic image with Poisson noise on a flat background and Gaussian
+   * spots. The mask has the module gaps of a Pilatus 6M.
+   */
+  struct SyntheticImage {
+    af::versa<double, af::c_grid<2> > data;
+    af::versa<int, af::c_grid<2> > data_int;
+    af::versa<bool, af::c_grid<2> > mask;
+
+    SyntheticImage(boost::uint32_t spot_seed, boost::uint32_t noise_seed)
+        : data(af::c_grid<2>(IMAGE_YSIZE, IMAGE_XSIZE), 0),
+          data_int(af::c_grid<2>(IMAGE_YSIZE, IMAGE_XSIZE), 0),
+          mask(af::c_grid<2>(IMAGE_YSIZE, IMAGE_XSIZE), true) {
+      // Add the spots to the expected counts
+      boost::random::mt19937 spot_gen(spot_seed);
+      boost::random::uniform_real_distribution<double> uniform(0, 1);
+      for (std::size_t i = 0; i < NUM_SPOTS; ++i) {
+        double x0 = uniform(spot_gen) * IMAGE_XSIZE;
+        double y0 = uniform(spot_gen) * IMAGE_YSIZE;
+        double peak = 1000.0 * uniform(spot_gen) * uniform(spot_gen);
+        int xc = (int)x0;
+        int yc = (int)y0;
+        for (int y = std::max(yc - 4, 0); y < std::min(yc + 5, (int)IMAGE_YSIZE); ++y) {
+          for (int x = std::max(xc - 4, 0); x < std::min(xc + 5, (int)IMAGE_XSIZE);
+               ++x) {
+            double dx = x + 0.5 - x0;
+            double dy = y + 0.5 - y0;
+            data(y, x) += peak * std::exp(-(dx * dx + dy * dy) / (2.0 * 1.5 * 1.5));
+          }
+        }
+      }
+
+      // Draw the counts and mask the module gaps
+      boost::random::mt19937 noise_gen(noise_seed);
+      for (std::size_t y = 0; y < IMAGE_YSIZE; ++y) {
+        for (std::size_t x = 0; x < IMAGE_XSIZE; ++x) {
+          boost::random::poisson_distribution<int, double> poisson(1.0 + data(y, x));
+          data_int(y, x) = poisson(noise_gen);
+          data(y, x) = data_int(y, x);
+          if (y % 212 >= 195 || x % 494 >= 487) {
+            mask(y, x) = false;
+            data_int(y, x) = -1;
+            data(y, x) = -1;
+          }
+        }
+      }
+    }
+  };
+
+  /**
+   * A set of synthetic 3D shoeboxes with a Gaussian profile on a flat
+   * background, and the normalised profile to fit to them
+   */
+  struct SyntheticShoeboxes {
+    std::vector<af::versa<double, af::c_grid<3> > > data;
+    af::versa<double, af::c_grid<3> > background;
+    af::versa<int, af::c_grid<3> > mask;
+    af::versa<bool, af::c_grid<3> > fit_mask;
+    af::versa<double, af::c_grid<3> > profile;
+
+    SyntheticShoeboxes(std::size_t n, std::size_t size, boost::uint32_t seed)
+        : background(af::c_grid<3>(size, size, size), 1.0),
+          mask(af::c_grid<3>(size, size, size), 0),
+          fit_mask(af::c_grid<3>(size, size, size), true),
+          profile(af::c_grid<3>(size, size, size), 0) {
+      int code = dials::model::Valid | dials::model::Background;
+      double c = size / 2.0;
+      double total = 0;
+      for (std::size_t k = 0; k < size; ++k) {
+        for (std::size_t j = 0; j < size; ++j) {
+          for (std::size_t i = 0; i < size; ++i) {
+            double dx = i + 0.5 - c;
+            double dy = j + 0.5 - c;
+            double dz = k + 0.5 - c;
+            double r2 = dx * dx + dy * dy + dz * dz;
+            profile(k, j, i) = std::exp(-r2 / (2.0 * 1.5 * 1.5));
+            total += profile(k, j, i);
+            mask(k, j, i) = r2 < c * c ? code | dials::model::Foreground : code;
+          }
+        }
+      }
+      for (std::size_t i = 0; i < profile.size(); ++i) {
+        profile[i] /= total;
+      }
+      boost::random::mt19937 gen(seed);
+      boost::random::uniform_real_distribution<double> uniform(0, 1);
+      for (std::size_t n_i = 0; n_i < n; ++n_i) {
+        af::versa<double, af::c_grid<3> > d(profile.accessor(), 0);
+        double intensity = 10000.0 * uniform(gen);
+        for (std::size_t i = 0; i < d.size(); ++i) {
+          boost::random::poisson_distribution<int, double> poisson(
+            background[i] + intensity * profile[i]);
+          d[i] = poisson(gen);
+        }
+        data.push_back(d);
+      }
+    }
+  };
+
+  /**
+   * The models of a rotation experiment on a tetragonal lysozyme crystal
+   * with a Pilatus 6M detector, and the reflections predicted for it
+   */
+  struct SyntheticExperiment {
+    boost::shared_ptr<BeamBase> beam;
+    Detector detector;
+    Goniometer goniometer;
+    Scan scan;
+    cctbx::uctbx::unit_cell unit_cell;
+    cctbx::sgtbx::space_group_type space_group_type;
+    mat3<double> ub;
+    double dmin;
+
+    SyntheticExperiment()
+        : beam(new Beam(vec3<double>(0, 0, -1.0 / 0.9795))),
+          goniometer(vec3<double>(1, 0, 0)),
+          scan(vec2<int>(1, 900), vec2<double>(0.0, 0.1)),
+          unit_cell(scitbx::af::double6(79.1, 79.1, 37.9, 90, 90, 90)),
+          space_group_type("P 43 21 2"),
+          dmin(1.5) {
+      detector.add_panel(Panel("SENSOR_PAD",
+                               "Panel",
+                               tiny<double, 3>(1, 0, 0),
+                               tiny<double, 3>(0, -1, 0),
+                               tiny<double, 3>(-212.0, 217.0, -200.0),
+                               tiny<double, 2>(0.172, 0.172),
+                               tiny<std::size_t, 2>(IMAGE_XSIZE, IMAGE_YSIZE),
+                               tiny<double, 2>(-1, 1e6),
+                               0.32,
+                               "Si"));
+      mat3<double> u = axis_and_angle_as_matrix(vec3<double>(1, 2, 3).normalize(), 0.5);
+      ub = u * unit_cell.fractionalization_matrix().transpose();
+    }
+
+    ScanStaticReflectionPredictor predictor() const {
+      return ScanStaticReflectionPredictor(
+        beam, detector, goniometer, scan, unit_cell, space_group_type, dmin, 0, 0);
+    }
+  };
+
+  void threshold_image(const SyntheticImage &image, af::ref<bool, af::c_grid<2> > dst) {
+    DispersionThreshold algorithm(
+      int2(IMAGE_YSIZE, IMAGE_XSIZE), int2(3, 3), 6.0, 3.0, 0.0, 2);
+    algorithm.threshold(image.data.const_ref(), image.mask.const_ref(), dst);
+  }
+
+  void bm_dispersion_threshold(const SyntheticImage &image) {
+    af::versa<bool, af::c_grid<2> > dst(image.data.accessor(), false);
+    threshold_image(image, dst.ref());
+    sink += dst[dst.size() / 2];
+  }
+
+  void bm_dispersion_extended_threshold(const SyntheticImage &image) {
+    af::versa<bool, af::c_grid<2> > dst(image.data.accessor(), false);
+    DispersionExtendedThreshold algorithm(
+      int2(IMAGE_YSIZE, IMAGE_XSIZE), int2(3, 3), 6.0, 3.0, 0.0, 2);
+    algorithm.threshold(image.data.const_ref(), image.mask.const_ref(), dst.ref());
+    sink += dst[dst.size() / 2];
+  }
+
+  template <std::size_t DIM>
+  void bm_label_image_stack(
+    const std::vector<SyntheticImage> &images,
+    const std::vector<af::versa<bool, af::c_grid<2> > > &masks) {
+    LabelImageStack<DIM> label(int2(IMAGE_YSIZE, IMAGE_XSIZE));
+    for (std::size_t i = 0; i < images.size(); ++i) {
+      label.add_image(images[i].data_int.const_ref(), masks[i].const_ref());
+    }
+    af::shared<int> labels = label.labels();
+    sink += labels.size();
+  }
+
+  void bm_summed_area(const SyntheticImage &image, std::size_t nthreads) {
+    af::versa<double, af::c_grid<2> > result =
+      summed_area<double>(image.data.const_ref(), int2(3, 3), nthreads);
+    sink += result[result.size() / 2];
+  }
+
+  void bm_median_filter(const SyntheticImage &image) {
+    af::versa<double, af::c_grid<2> > result =
+      median_filter<double>(image.data.const_ref(), int2(3, 3));
+    sink += result[result.size() / 2];
+  }
+
+  void bm_summation(const SyntheticShoeboxes &shoeboxes) {
+    for (std::size_t i = 0; i < shoeboxes.data.size(); ++i) {
+      Summation<double> summation(shoeboxes.data[i].const_ref(),
+                                  shoeboxes.background.const_ref(),
+                                  shoeboxes.mask.const_ref());
+      sink += summation.intensity();
+    }
+  }
+
+  void bm_profile_fitter(const SyntheticShoeboxes &shoeboxes) {
+    for (std::size_t i = 0; i < shoeboxes.data.size(); ++i) {
+      ProfileFitter<double> fitter(shoeboxes.data[i].const_ref(),
+                                   shoeboxes.background.const_ref(),
+                                   shoeboxes.fit_mask.const_ref(),
+                                   shoeboxes.profile.const_ref());
+      sink += fitter.intensity()[0];
+    }
+  }
+
+  void bm_predict(const SyntheticExperiment &experiment) {
+    af::reflection_table table = experiment.predictor().for_ub(experiment.ub);
+    sink += table.nrows();
+  }
+
+  void bm_mask_calculator(const SyntheticExperiment &experiment,
+                          const af::const_ref<int6> &bbox,
+                          const af::const_ref<vec3<double> > &s1,
+                          const af::const_ref<double> &frame,
+                          const af::const_ref<std::size_t> &panel) {
+    af::shared<Shoebox<> > shoeboxes(bbox.size());
+    for (std::size_t i = 0; i < bbox.size(); ++i) {
+      shoeboxes[i] = Shoebox<>(panel[i], bbox[i]);
+      shoeboxes[i].allocate();
+    }
+    MaskCalculator3D calculator(*experiment.beam,
+                                experiment.detector,
+                                experiment.goniometer,
+                                experiment.scan,
+                                N_SIGMA * SIGMA_B,
+                                N_SIGMA * SIGMA_M);
+    calculator.array(shoeboxes.ref(), s1, frame, panel);
+    sink += shoeboxes[0].mask[0];
+  }
+
+  void bm_transform_forward(
+    const SyntheticExperiment &experiment,
+    const af::const_ref<int6> &bbox,
+    const af::const_ref<vec3<double> > &s1,
+    const af::const_ref<double> &phi,
+    const std::vector<af::versa<double, af::c_grid<3> > > &data) {
+    TransformSpec spec(experiment.beam,
+                       experiment.detector,
+                       experiment.goniometer,
+                       experiment.scan,
+                       SIGMA_B,
+                       SIGMA_M,
+                       N_SIGMA + 1,
+                       5);
+    vec3<double> m2 = experiment.goniometer.get_rotation_axis();
+    vec3<double> s0 = experiment.beam->get_s0();
+    for (std::size_t i = 0; i < bbox.size(); ++i) {
+      CoordinateSystem cs(m2, s0, s1[i], phi[i]);
+      af::versa<bool, af::c_grid<3> > mask(data[i].accessor(), true);
+      TransformForward<double> transform(
+        spec, cs, bbox[i], 0, data[i].const_ref(), mask.const_ref());
+      sink += transform.profile()[0];
+    }
+  }
+
+  void bm_detect_collisions(const std::vector<FloatBox3d> &boxes,
+                            std::size_t nthreads) {
+    std::deque<std::pair<int, int> > collisions;
+    detect_collisions3d(boxes.begin(), boxes.end(), collisions, nthreads);
+    sink += collisions.size();
+  }
+
+  void bm_msgpack_pack(const af::reflection_table &table) {
+    std::stringstream buffer;
+    msgpack::pack(buffer, table);
+    sink += buffer.str().size();
+  }
+
+  bool reference_func(msgpack::type::object_type type,
+                      std::size_t length,
+                      void *user_data) {
+    return true;
+  }
+
+  void bm_msgpack_unpack(const std::string &data) {
+    msgpack::unpacked result;
+    std::size_t off = 0;
+    msgpack::unpack(result, data.c_str(), data.size(), off, reference_func);
+    af::reflection_table table;
+    msgpack::adaptor::convert<af::reflection_table> reader(NULL);
+    reader(result.get(), table);
+    sink += table.nrows();
+  }
+
+  Options parse_options(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+      std::string arg(argv[i]);
+      if (arg.compare(0, 9, "--repeat=") == 0) {
+        options.repeat = std::atoi(arg.c_str() + 9);
+      } else if (arg.compare(0, 11, "--nthreads=") == 0) {
+        options.nthreads = std::atoi(arg.c_str() + 11);
+      } else if (arg == "--list") {
+        options.list = true;
+      } else {
+        options.names.push_back(arg);
+      }
+    }
+    DIALS_ASSERT(options.repeat > 0);
+    DIALS_ASSERT(options.nthreads > 0);
+    return options;
+  }
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options = parse_options(argc, argv);
+  std::string image_size = size_string(IMAGE_YSIZE, IMAGE_XSIZE);
+
+  // The image benchmarks
+  std::vector<SyntheticImage> images;
+  std::vector<af::versa<bool, af::c_grid<2> > > masks;
+  for (std::size_t i = 0; i < NUM_FRAMES; ++i) {
+    images.push_back(SyntheticImage(0, i + 1));
+    masks.push_back(
+      af::versa<bool, af::c_grid<2> >(images[i].data.accessor(), false));
+    threshold_image(images[i], masks[i].ref());
+  }
+  run(options,
+      "dispersion_threshold",
+      image_size,
+      1,
+      boost::bind(&bm_dispersion_threshold, boost::cref(images[0])));
+  run(options,
+      "dispersion_extended_threshold",
+      image_size,
+      1,
+      boost::bind(&bm_dispersion_extended_threshold, boost::cref(images[0])));
+  run(options,
+      "label_image_stack_2d",
+      image_size,
+      NUM_FRAMES,
+      boost::bind(&bm_label_image_stack<2>, boost::cref(images), boost::cref(masks)));
+  run(options,
+      "label_image_stack_3d",
+      image_size,
+      NUM_FRAMES,
+      boost::bind(&bm_label_image_stack<3>, boost::cref(images), boost::cref(masks)));
+  run(options,
+      "summed_area",
+      image_size,
+      1,
+      boost::bind(&bm_summed_area, boost::cref(images[0]), options.nthreads));
+  run(options,
+      "median_filter",
+      image_size,
+      1,
+      boost::bind(&bm_median_filter, boost::cref(images[0])));
+
+  // The integration benchmarks on synthetic shoeboxes
+  SyntheticShoeboxes shoeboxes(NUM_SHOEBOXES, 9, 42);
+  std::string shoebox_size = "9x9x9";
+  run(options,
+      "summation",
+      shoebox_size,
+      NUM_SHOEBOXES,
+      boost::bind(&bm_summation, boost::cref(shoeboxes)));
+  run(options,
+      "profile_fitter",
+      shoebox_size,
+      NUM_SHOEBOXES,
+      boost::bind(&bm_profile_fitter, boost::cref(shoeboxes)));
+
+  // The benchmarks on the predicted reflections
+  SyntheticExperiment experiment;
+  af::reflection_table predicted = experiment.predictor().for_ub(experiment.ub);
+  std::size_t num_predicted = predicted.nrows();
+  DIALS_ASSERT(num_predicted >= std::max(NUM_MASK, NUM_TRANSFORM));
+  run(options,
+      "scan_static_reflection_predictor",
+      image_size,
+      num_predicted,
+      boost::bind(&bm_predict, boost::cref(experiment)));
+
+  af::const_ref<vec3<double> > s1 = predicted.get<vec3<double> >("s1").const_ref();
+  af::const_ref<vec3<double> > xyz_px =
+    predicted.get<vec3<double> >("xyzcal.px").const_ref();
+  af::const_ref<vec3<double> > xyz_mm =
+    predicted.get<vec3<double> >("xyzcal.mm").const_ref();
+  af::const_ref<std::size_t> panel = predicted.get<std::size_t>("panel").const_ref();
+  af::shared<double> frame(num_predicted);
+  af::shared<double> phi(num_predicted);
+  for (std::size_t i = 0; i < num_predicted; ++i) {
+    frame[i] = xyz_px[i][2];
+    phi[i] = xyz_mm[i][2];
+  }
+  BBoxCalculator3D bbox_calculator(*experiment.beam,
+                                   experiment.detector,
+                                   experiment.goniometer,
+                                   experiment.scan,
+                                   N_SIGMA * SIGMA_B,
+                                   N_SIGMA * SIGMA_M);
+  af::shared<int6> bbox = predicted.get<int6>("bbox");
+  af::shared<int6> bbox_calculated =
+    bbox_calculator.array(s1, frame.const_ref(), panel);
+  std::copy(bbox_calculated.begin(), bbox_calculated.end(), bbox.begin());
+
+  run(options,
+      "mask_calculator_3d",
+      size_string(NUM_MASK, 1),
+      NUM_MASK,
+      boost::bind(&bm_mask_calculator,
+                  boost::cref(experiment),
+                  af::const_ref<int6>(bbox.begin(), NUM_MASK),
+                  af::const_ref<vec3<double> >(s1.begin(), NUM_MASK),
+                  af::const_ref<double>(frame.begin(), NUM_MASK),
+                  af::const_ref<std::size_t>(panel.begin(), NUM_MASK)));
+
+  std::vector<af::versa<double, af::c_grid<3> > > transform_data;
+  boost::random::mt19937 gen(7);
+  for (std::size_t i = 0; i < NUM_TRANSFORM; ++i) {
+    af::c_grid<3> accessor(bbox[i][5] - bbox[i][4],
+                           bbox[i][3] - bbox[i][2],
+                           bbox[i][1] - bbox[i][0]);
+    af::versa<double, af::c_grid<3> > d(accessor, 0);
+    for (std::size_t j = 0; j < d.size(); ++j) {
+      boost::random::poisson_distribution<int, double> poisson(2.0);
+      d[j] = poisson(gen);
+    }
+    transform_data.push_back(d);
+  }
+  run(options,
+      "transform_forward",
+      size_string(NUM_TRANSFORM, 1),
+      NUM_TRANSFORM,
+      boost::bind(&bm_transform_forward,
+                  boost::cref(experiment),
+                  af::const_ref<int6>(bbox.begin(), NUM_TRANSFORM),
+                  af::const_ref<vec3<double> >(s1.begin(), NUM_TRANSFORM),
+                  af::const_ref<double>(phi.begin(), NUM_TRANSFORM),
+                  boost::cref(transform_data)));
+
+  std::vector<FloatBox3d> boxes(num_predicted);
+  for (std::size_t i = 0; i < num_predicted; ++i) {
+    for (std::size_t j = 0; j < 3; ++j) {
+      boxes[i].min[j] = bbox[i][2 * j];
+      boxes[i].max[j] = bbox[i][2 * j + 1];
+    }
+  }
+  run(options,
+      "detect_collisions",
+      size_string(num_predicted, 1),
+      num_predicted,
+      boost::bind(&bm_detect_collisions, boost::cref(boxes), options.nthreads));
+
+  // The reflection table serialisation benchmarks
+  std::stringstream packed;
+  msgpack::pack(packed, predicted);
+  std::string packed_data = packed.str();
+  run(options,
+      "msgpack_pack",
+      size_string(num_predicted, predicted.ncols()),
+      num_predicted,
+      boost::bind(&bm_msgpack_pack, boost::cref(predicted)));
+  run(options,
+      "msgpack_unpack",
+      size_string(num_predicted, predicted.ncols()),
+      num_predicted,
+      boost::bind(&bm_msgpack_unpack, boost::cref(packed_data)));
+
+  // Print the sink so that none of the results are unused
+  std::fprintf(stderr, "%g\n", sink);
+  return 0;
+}
@@ -202,6 +202,134 @@ def test_integration_with_sample_size(dials_data, tmpdir):
     assert dict(table.experiment_identifiers()) == {0: "foo"}
 
 
+def test_threaded_integrate_reuse_shoeboxes(dials_data, tmpdir):
+    experiments = dials_data("centroid_test_data").join("experiments.json").strpath
+    tables = []
+    for reuse in (False, True):
+        output = "integrated_%s.refl" % reuse
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                experiments,
+                "integration.integrator=3d_threaded",
+                "integration.block.reuse_shoeboxes=%s" % reuse,
+                "prediction.padding=0",
+                "output.reflections=%s" % output,
+            ],
+            working_directory=tmpdir,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(tmpdir / output))
+
+    # The shoeboxes kept from the modelling pass should give the same result
+    # and must not be left on disk
+    assert not tmpdir.listdir(lambda p: p.basename.startswith("dials_shoeboxes_"))
+    table1, table2 = tables
+    assert len(table1) == len(table2)
+    prf = table1.flags.integrated_prf
+    assert table1.get_flags(prf).all_eq(table2.get_flags(prf))
+    selection = table1.get_flags(prf)
+    assert selection.count(True) > 0
+    for name in ("intensity.sum.value", "intensity.prf.value"):
+        diff = table1[name].select(selection) - table2[name].select(selection)
+        assert flex.abs(diff).all_lt(1e-7)
+
+
+def test_threaded_integrate_batch_size(dials_data, tmpdir):
+    experiments = dials_data("centroid_test_data").join("experiments.json").strpath
+    tables = []
+    for batch_size in (1, 8):
+        output = "integrated_%d.refl" % batch_size
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                experiments,
+                "integration.integrator=3d_threaded",
+                "integration.block.batch_size=%d" % batch_size,
+                "prediction.padding=0",
+                "output.reflections=%s" % output,
+            ],
+            working_directory=tmpdir,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(tmpdir / output))
+
+    # Integrating the reflections in batches must give the same result
+    table1, table2 = tables
+    assert len(table1) == len(table2)
+    assert table1["flags"].all_eq(table2["flags"])
+    prf = table1.flags.integrated_prf
+    selection = table1.get_flags(prf)
+    assert selection.count(True) > 0
+    for name in ("intensity.sum.value", "intensity.prf.value"):
+        diff = table1[name].select(selection) - table2[name].select(selection)
+        assert flex.abs(diff).all_lt(1e-7)
+
+
+def test_threaded_integrate_pin_threads(dials_data, tmpdir):
+    experiments = dials_data("centroid_test_data").join("experiments.json").strpath
+    tables = []
+    for pin_threads in (False, True):
+        output = "integrated_%s.refl" % pin_threads
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                experiments,
+                "integration.integrator=3d_threaded",
+                "integration.mp.nproc=2",
+                "integration.mp.pin_threads=%s" % pin_threads,
+                "prediction.padding=0",
+                "output.reflections=%s" % output,
+            ],
+            working_directory=tmpdir,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(tmpdir / output))
+
+    # Pinning the threads must not change the result
+    table1, table2 = tables
+    assert len(table1) == len(table2)
+    sum_flag = table1.flags.integrated_sum
+    assert table1.get_flags(sum_flag).all_eq(table2.get_flags(sum_flag))
+    selection = table1.get_flags(sum_flag)
+    assert selection.count(True) > 0
+    diff = table1["intensity.sum.value"].select(selection) - table2[
+        "intensity.sum.value"
+    ].select(selection)
+    assert flex.abs(diff).all_lt(1e-7)
+
+
+def test_threaded_integrate_pixel_direction_table(dials_data, tmpdir):
+    experiments = dials_data("centroid_test_data").join("experiments.json").strpath
+    tables = []
+    for pixel_direction_table in (False, True):
+        output = "integrated_%s.refl" % pixel_direction_table
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                experiments,
+                "integration.integrator=3d_threaded",
+                "integration.pixel_direction_table=%s" % pixel_direction_table,
+                "prediction.padding=0",
+                "output.reflections=%s" % output,
+            ],
+            working_directory=tmpdir,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(tmpdir / output))
+
+    # The tables are single precision, so a pixel on the edge of a mask may
+    # occasionally change but the intensities must be very close
+    table1, table2 = tables
+    assert len(table1) == len(table2)
+    sum_flag = table1.flags.integrated_sum
+    selection = table1.get_flags(sum_flag) & table2.get_flags(sum_flag)
+    assert selection.count(True) > 0.99 * table1.get_flags(sum_flag).count(True)
+    I1 = table1["intensity.sum.value"].select(selection)
+    I2 = table2["intensity.sum.value"].select(selection)
+    assert flex.mean(flex.abs(I1 - I2)) < 1e-3 * flex.mean(flex.abs(I1))
+
+
 def test_multi_sweep(dials_regression, tmpdir):
 
     expts = os.path.join(
@@ -257,6 +385,37 @@ def test_multi_sweep(dials_regression, tmpdir):
     assert flex.abs(I1 - I2) < 1e-6
 
 
+def test_multi_sweep_threaded(dials_regression, tmpdir):
+    data = os.path.join(dials_regression, "integration_test_data", "multi_sweep")
+    experiments = load.experiment_list(os.path.join(data, "experiments.json"))
+    for i, expt in enumerate(experiments):
+        expt.identifier = str(100 + i)
+    experiments.as_json(tmpdir.join("modified_input.json").strpath)
+
+    # The two sweeps are processed concurrently on a shared thread pool
+    result = procrunner.run(
+        [
+            "dials.integrate",
+            "modified_input.json",
+            os.path.join(data, "indexed.pickle"),
+            "integration.integrator=3d_threaded",
+            "integration.mp.nproc=2",
+            "prediction.padding=0",
+        ],
+        working_directory=tmpdir,
+    )
+    assert not result.returncode and not result.stderr
+
+    table = flex.reflection_table.from_file(tmpdir / "integrated.refl")
+    assert dict(table.experiment_identifiers()) == {0: "100", 1: "101"}
+    T1 = table.select(table["id"] == 0)
+    T2 = table.select(table["id"] == 1)
+    assert len(T1) == len(T2) > 0
+    F1 = T1.get_flags(T1.flags.integrated_prf)
+    F2 = T2.get_flags(T2.flags.integrated_prf)
+    assert F1.count(True) == F2.count(True) > 0
+
+
 def test_multi_lattice(dials_regression, tmpdir):
 
     expts = os.path.join(
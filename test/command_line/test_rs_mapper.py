@@ -4,12 +4,14 @@
 import pytest
 
 
-def test_rs_mapper(dials_data, tmpdir):
+@pytest.mark.parametrize("nproc", [1, 3])
+def test_rs_mapper(dials_data, tmpdir, nproc):
     result = procrunner.run(
         [
             "dials.rs_mapper",
             dials_data("centroid_test_data").join("datablock.json").strpath,
             'map_file="junk.ccp4"',
+            "nproc=%d" % nproc,
         ],
         working_directory=tmpdir.strpath,
     )
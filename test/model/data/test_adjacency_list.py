@@ -0,0 +1,61 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import six.moves.cPickle as pickle
+
+from dials.model.data import AdjacencyList
+
+
+def make_graph(num_vertices=100, num_edges=300):
+    random.seed(0)
+    edges = set()
+    while len(edges) < num_edges:
+        a, b = random.sample(range(num_vertices), 2)
+        edges.add((min(a, b), max(a, b)))
+    graph = AdjacencyList(num_vertices)
+    for a, b in edges:
+        graph.add_edge(a, b)
+    graph.finish()
+    return graph, edges
+
+
+def assert_same_graph(graph1, graph2):
+    assert graph1.num_vertices() == graph2.num_vertices()
+    assert graph1.num_edges() == graph2.num_edges()
+    assert list(graph1.offsets()) == list(graph2.offsets())
+    assert list(graph1.targets()) == list(graph2.targets())
+
+
+def test_compressed_rows():
+    graph, edges = make_graph()
+    assert graph.num_edges() == len(edges)
+    offsets = graph.offsets()
+    assert len(offsets) == graph.num_vertices() + 1
+    assert offsets[-1] == 2 * len(edges)
+    for i in range(graph.num_vertices()):
+        adjacent = list(graph.adjacent_vertices(i))
+        assert adjacent == sorted(adjacent)
+        assert adjacent == list(graph.targets()[offsets[i] : offsets[i + 1]])
+        for j in adjacent:
+            assert (min(i, j), max(i, j)) in edges
+
+    graph2 = AdjacencyList(graph.num_vertices(), graph.offsets(), graph.targets())
+    assert_same_graph(graph, graph2)
+
+
+def test_msgpack():
+    graph, edges = make_graph()
+    graph2 = AdjacencyList.from_msgpack(graph.as_msgpack())
+    assert_same_graph(graph, graph2)
+
+    empty = AdjacencyList(10)
+    empty2 = AdjacencyList.from_msgpack(empty.as_msgpack())
+    assert empty2.num_vertices() == 10
+    assert empty2.num_edges() == 0
+
+
+def test_pickle():
+    graph, edges = make_graph()
+    graph2 = pickle.loads(pickle.dumps(graph))
+    assert_same_graph(graph, graph2)
@@ -178,3 +178,56 @@ def test_with_no_points():
     assert len(coords) == 0
     assert len(labels1) == 0
     assert len(labels2) == 0
+
+
+def test_incremental_shoebox_creator():
+    from scitbx.array_family import flex
+
+    from dials.array_family import flex as dials_flex
+    from dials.model.data import PixelList, PixelListLabeller
+
+    size = (100, 100)
+    sf = 5
+    for twod in (False, True):
+        labeller = PixelListLabeller()
+        incremental = dials_flex.IncrementalPixelListShoeboxCreator(
+            panel=0, twod=twod, min_pixels=2, max_pixels=20, find_hot_pixels=True
+        )
+        shoeboxes = dials_flex.shoebox()
+        spot_size = flex.size_t()
+        spot_order = flex.size_t()
+        for i in range(10):
+            image = flex.random_int_gaussian_distribution(size[0] * size[1], 100, 5)
+            mask = flex.random_bool(size[0] * size[1], 0.2)
+            mask[0] = True
+            image.reshape(flex.grid(size))
+            mask.reshape(flex.grid(size))
+            pl = PixelList(sf + i, image, mask)
+            labeller.add(pl)
+            incremental.add(pl)
+            shoeboxes.extend(incremental.result())
+            spot_size.extend(incremental.spot_size())
+            spot_order.extend(incremental.spot_order())
+            incremental.clear()
+            if twod:
+                assert incremental.num_active() == 0
+        incremental.finish()
+        shoeboxes.extend(incremental.result())
+        spot_size.extend(incremental.spot_size())
+        spot_order.extend(incremental.spot_order())
+        assert incremental.num_active() == 0
+
+        # The spots should be the same as those labelled at the end
+        creator = dials_flex.PixelListShoeboxCreator(labeller, 0, 0, twod, 2, 20, True)
+        order = flex.sort_permutation(spot_order)
+        shoeboxes = shoeboxes.select(order)
+        assert len(shoeboxes) == len(creator.result())
+        assert list(spot_size.select(order)) == list(creator.spot_size())
+        assert list(incremental.hot_pixels()) == list(creator.hot_pixels())
+        assert 0 in incremental.hot_pixels()
+        for s1, s2 in zip(shoeboxes, creator.result()):
+            assert s1.bbox == s2.bbox
+            assert s1.is_allocated() == s2.is_allocated()
+            if s1.is_allocated():
+                assert s1.data.all_eq(s2.data)
+                assert s1.mask.all_eq(s2.mask)
@@ -0,0 +1,30 @@
+from __future__ import absolute_import, division, print_function
+
+import sys
+
+from dials.util.import_profile import ImportProfile
+
+
+def test_import_profile_records_first_imports():
+    sys.modules.pop("colorsys", None)
+    with ImportProfile() as profile:
+        import colorsys  # noqa: F401
+        import os  # noqa: F401
+    assert list(profile.timings) == ["colorsys"]
+    timing = profile.timings["colorsys"]
+    assert timing.cumulative >= timing.self_time >= 0
+    assert not timing.extension
+
+    report = profile.report(limit=1)
+    assert "Imported 1 modules" in report
+    assert report.splitlines()[-1].endswith(" colorsys")
+
+
+def test_import_profile_stops_recording():
+    profile = ImportProfile()
+    profile.start()
+    profile.stop()
+    sys.modules.pop("colorsys", None)
+    import colorsys  # noqa: F401
+
+    assert not profile.timings
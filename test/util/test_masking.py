@@ -175,3 +175,37 @@ def __hash__(self):
     fun(a)
     fun(b)
     assert fun.cache_info() == (1, 1, 1, 1)
+
+
+def test_resolution_mask_generator():
+    from dxtbx.model import BeamFactory, DetectorFactory
+
+    from dials.util.ext import ResolutionMaskGenerator
+
+    beam = BeamFactory.simple(1.0)
+    detector = DetectorFactory.simple(
+        "PAD", 100, (5, 5), "+x", "-y", (0.172, 0.172), (60, 50)
+    )
+    panel = detector[0]
+    resolution = flex.double(
+        panel.get_resolution_at_pixel(beam.get_s0(), (i + 0.5, j + 0.5))
+        for j in range(50)
+        for i in range(60)
+    )
+    d = sorted(resolution)
+    ranges = [(d[100], d[400]), (d[300], d[700]), (d[1500], d[1600]), (0, d[20])]
+
+    generator = ResolutionMaskGenerator(beam, panel)
+    expected = flex.bool(flex.grid(50, 60), True)
+    for d_min, d_max in ranges:
+        generator.apply(expected, d_min, d_max)
+    mask = flex.bool(flex.grid(50, 60), True)
+    generator.apply_ranges(mask, flex.vec2_double(ranges))
+    assert list(mask) == list(expected)
+
+    # The 1/d^2 of the pixels are single precision, so ignore the pixels
+    # within rounding of the limits
+    limits = [d for d_range in ranges for d in d_range if d > 0]
+    for m, r in zip(mask, resolution):
+        if all(abs(r - d) > 1e-6 * d for d in limits):
+            assert m != any(d_min <= r <= d_max for d_min, d_max in ranges)
@@ -0,0 +1,68 @@
+from __future__ import absolute_import, division, print_function
+
+from dials.array_family import flex
+from dials.model.data import PixelList, PixelListLabeller, Shoebox
+from dials.util.memory_accounting import (
+    log_memory_usage,
+    memory_usage,
+    reset_memory_peaks,
+)
+
+
+def current(name):
+    return memory_usage()[name][0]
+
+
+def test_shoebox_memory_is_released_with_the_last_copy():
+    before = current("shoebox")
+    shoebox = Shoebox((0, 10, 0, 10, 0, 10))
+    shoebox.allocate()
+    allocated = current("shoebox") - before
+    assert allocated >= 1000 * 12
+    shoeboxes = flex.shoebox([shoebox])
+    assert current("shoebox") == before + allocated
+    del shoebox
+    assert current("shoebox") == before + allocated
+    del shoeboxes
+    assert current("shoebox") == before
+
+    shoebox = Shoebox((0, 10, 0, 10, 0, 10))
+    shoebox.allocate()
+    shoebox.deallocate()
+    assert current("shoebox") == before
+
+
+def test_reflection_table_memory():
+    before = current("reflection_table")
+    table = flex.reflection_table()
+    table["x"] = flex.double(1000)
+    table["y"] = flex.int(1000)
+    assert current("reflection_table") >= before + 1000 * 12
+    del table["x"]
+    assert current("reflection_table") < before + 1000 * 8
+    del table
+    assert current("reflection_table") == before
+
+
+def test_pixel_list_memory():
+    before = current("pixel_list")
+    labeller = PixelListLabeller()
+    image = flex.double(flex.grid(100, 100), 1)
+    mask = flex.bool(flex.grid(100, 100), True)
+    labeller.add(PixelList(0, image, mask))
+    assert current("pixel_list") >= before + 10000 * 8
+    del labeller
+    assert current("pixel_list") == before
+
+
+def test_peaks():
+    reset_memory_peaks()
+    before = memory_usage()["reflection_table"]
+    assert before[1] == before[0]
+    table = flex.reflection_table()
+    table["x"] = flex.double(1000)
+    del table
+    after = log_memory_usage("test")["reflection_table"]
+    assert after[0] == before[0]
+    assert after[1] >= before[0] + 8000
+    assert memory_usage()["reflection_table"][1] == before[0]
@@ -0,0 +1,114 @@
+from __future__ import absolute_import, division, print_function
+
+import sys
+import threading
+
+import pytest
+import six.moves.cPickle as pickle
+from six.moves import queue
+
+from dials.util.mp import (
+    MPIRemoteError,
+    mpi_parallel_map,
+    mpi_stop_workers,
+    mpi_worker,
+)
+
+
+class FakeStatus(object):
+    def __init__(self):
+        self.source = None
+
+    def Get_source(self):
+        return self.source
+
+
+class FakeComm(object):
+    """An MPI communicator for ranks run as threads in this process"""
+
+    def __init__(self, size):
+        self.size = size
+        self.queues = [queue.Queue() for _ in range(size)]
+        self.local = threading.local()
+
+    def Get_rank(self):
+        return getattr(self.local, "rank", 0)
+
+    def Get_size(self):
+        return self.size
+
+    def send(self, obj, dest):
+        self.queues[dest].put((self.Get_rank(), pickle.dumps(obj)))
+
+    def recv(self, source=None, status=None):
+        rank, data = self.queues[self.Get_rank()].get()
+        assert source in (None, FakeMPI.ANY_SOURCE, rank)
+        if status is not None:
+            status.source = rank
+        return pickle.loads(data)
+
+
+class FakeMPI(object):
+    ANY_SOURCE = -1
+    Status = FakeStatus
+
+
+@pytest.fixture(params=[1, 2, 5])
+def comm(request, monkeypatch):
+    comm = FakeComm(request.param)
+    mpi = FakeMPI()
+    mpi.COMM_WORLD = comm
+    monkeypatch.setitem(sys.modules, "mpi4py", type(sys)("mpi4py"))
+    monkeypatch.setattr(sys.modules["mpi4py"], "MPI", mpi, raising=False)
+
+    def run_worker(rank):
+        comm.local.rank = rank
+        mpi_worker()
+
+    workers = [
+        threading.Thread(target=run_worker, args=(rank,))
+        for rank in range(1, comm.size)
+    ]
+    for worker in workers:
+        worker.start()
+    yield comm
+    mpi_stop_workers()
+    for worker in workers:
+        worker.join()
+
+
+def square(x):
+    return x * x
+
+
+def fail_on_three(x):
+    if x == 3:
+        raise ValueError("three")
+    return x
+
+
+def test_mpi_parallel_map_preserves_order(comm):
+    results = []
+    mpi_parallel_map(square, range(20), callback=results.append)
+    assert results == [x * x for x in range(20)]
+
+
+def test_mpi_parallel_map_without_order(comm):
+    results = []
+    mpi_parallel_map(square, range(20), callback=results.append, preserve_order=False)
+    assert sorted(results) == [x * x for x in range(20)]
+
+
+def test_mpi_parallel_map_raises_remote_errors(comm):
+    if comm.size == 1:
+        with pytest.raises(ValueError):
+            mpi_parallel_map(fail_on_three, range(10))
+    else:
+        with pytest.raises(MPIRemoteError) as e:
+            mpi_parallel_map(fail_on_three, range(10))
+        assert "ValueError: three" in str(e.value)
+
+        # The workers are still running after the error
+        results = []
+        mpi_parallel_map(square, range(4), callback=results.append)
+        assert results == [0, 1, 4, 9]
@@ -0,0 +1,35 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+from scitbx.array_family import flex
+
+from dials.util.ext import scale_down_array, scale_down_image_stack
+
+
+def test_scale_down_array():
+    image = flex.int([-2, 0, 1, 10, 100, 1000, 100000] * 100)
+    result = scale_down_array(image, 0.25, seed=42)
+    assert len(result) == len(image)
+    for i, scaled in zip(image, result):
+        if i <= 0:
+            assert scaled == i
+        else:
+            assert 0 <= scaled <= i
+    counts = result.select(image == 100000)
+    assert flex.mean(counts.as_double()) == pytest.approx(25000, rel=0.01)
+
+    # The result depends on the seed but not on the number of threads
+    for nthreads in (2, 3, 8):
+        assert list(scale_down_array(image, 0.25, 42, nthreads)) == list(result)
+    assert list(scale_down_array(image, 0.25, 43)) != list(result)
+
+    assert list(scale_down_array(image, 1, 42)) == list(image)
+    assert list(scale_down_array(image, 0, 42)) == [min(i, 0) for i in image]
+
+
+def test_scale_down_image_stack():
+    images = flex.int(flex.grid(3, 4, 5), 50)
+    result = scale_down_image_stack(images, 0.5, seed=1, nthreads=2)
+    assert result.all() == (3, 4, 5)
+    assert list(result) == list(scale_down_array(images.as_1d(), 0.5, 1))
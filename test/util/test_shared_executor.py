@@ -0,0 +1,49 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+from dials.array_family import flex
+from dials.util.ext import (
+    executor_statistics,
+    get_num_threads,
+    reset_executor_statistics,
+    set_num_threads,
+)
+
+
+@pytest.fixture
+def num_threads():
+    previous = get_num_threads()
+    yield
+    set_num_threads(previous)
+
+
+def test_parallel_code_in_other_extensions_uses_the_executor(num_threads):
+    set_num_threads(2)
+    assert get_num_threads() == 2
+    reset_executor_statistics()
+
+    # Sorting a table on several threads runs on the shared pool
+    table = flex.reflection_table()
+    table["x"] = flex.random_double(10000)
+    table.sort("x", nthreads=4)
+    assert list(table["x"]) == sorted(table["x"])
+
+    stats = executor_statistics()
+    assert stats["num_threads"] == 2
+    assert stats["started"]
+    assert stats["regions"] > 0
+    assert stats["tasks"] >= stats["regions"]
+    assert stats["busy_time"] >= 0
+    assert 0 <= stats["utilisation"]
+
+    reset_executor_statistics()
+    stats = executor_statistics()
+    assert stats["regions"] == stats["nested_regions"] == stats["tasks"] == 0
+
+
+def test_set_num_threads(num_threads):
+    set_num_threads(3)
+    assert get_num_threads() == 3
+    set_num_threads(0)
+    assert get_num_threads() >= 1
@@ -0,0 +1,59 @@
+from __future__ import absolute_import, division, print_function
+
+import json
+
+from scitbx.array_family import flex
+
+from dials.algorithms.image.threshold import DispersionThreshold
+from dials.util.ext import (
+    start_trace,
+    stop_trace,
+    trace_as_chrome_json,
+    write_chrome_trace,
+)
+
+
+def threshold_image(image_size=(64, 50)):
+    image = flex.double(flex.grid(image_size), 1)
+    mask = flex.bool(flex.grid(image_size), True)
+    result = flex.bool(flex.grid(image_size))
+    algorithm = DispersionThreshold(image_size, (3, 3), 1, 1, 0, 2)
+    algorithm(image, mask, result)
+
+
+def span_names(trace):
+    return [event["name"] for event in trace["traceEvents"] if event["ph"] == "X"]
+
+
+def test_trace_records_spans_from_other_extensions(tmpdir):
+    start_trace()
+    threshold_image()
+    stop_trace()
+
+    # Spans recorded once the trace is stopped are not kept
+    threshold_image()
+    trace = json.loads(trace_as_chrome_json())
+    assert span_names(trace).count("dispersion_threshold") == 1
+    for event in trace["traceEvents"]:
+        if event["ph"] == "X":
+            assert event["cat"] == "spot_finding"
+            assert event["ts"] >= 0 and event["dur"] >= 0
+
+    filename = tmpdir.join("trace.json").strpath
+    write_chrome_trace(filename)
+    with open(filename) as fh:
+        assert json.load(fh) == trace
+
+
+def test_trace_keeps_the_newest_spans():
+    start_trace(capacity=2)
+    for i in range(5):
+        threshold_image()
+    stop_trace()
+    trace = json.loads(trace_as_chrome_json())
+    assert span_names(trace) == ["dispersion_threshold"] * 2
+
+    # Starting again discards the recorded spans
+    start_trace()
+    stop_trace()
+    assert span_names(json.loads(trace_as_chrome_json())) == []
@@ -0,0 +1,48 @@
+/*
+ * buffer_view.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_BOOST_PYTHON_BUFFER_VIEW_H
+#define DIALS_UTIL_BOOST_PYTHON_BUFFER_VIEW_H
+
+#include <boost/python.hpp>
+
+namespace dials { namespace util { namespace boost_python {
+
+  /**
+   * Hold a read only view of a python buffer for the lifetime of the object.
+   * The object must be created and destroyed while holding the GIL, but the
+   * data may be read without it.
+   */
+  class python_buffer_view {
+  public:
+    python_buffer_view(boost::python::object obj) {
+      if (PyObject_GetBuffer(obj.ptr(), &view_, PyBUF_SIMPLE) != 0) {
+        boost::python::throw_error_already_set();
+      }
+    }
+
+    ~python_buffer_view() {
+      PyBuffer_Release(&view_);
+    }
+
+    const char *data() const {
+      return static_cast<const char *>(view_.buf);
+    }
+
+    std::size_t size() const {
+      return view_.len;
+    }
+
+  private:
+    python_buffer_view(const python_buffer_view &);
+    python_buffer_view &operator=(const python_buffer_view &);
+
+    Py_buffer view_;
+  };
+
+}}}  // namespace dials::util::boost_python
+
+#endif  // DIALS_UTIL_BOOST_PYTHON_BUFFER_VIEW_H
@@ -4,8 +4,11 @@
 #include <dials/util/masking.h>
 #include <dials/util/export_mtz_helpers.h>
 #include <dials/util/python_streambuf.h>
+#include <dials/util/memory_accounting.h>
+#include <dials/util/shared_executor.h>
+#include <dials/util/trace.h>
 
-std::size_t dials::util::streambuf::default_buffer_size = 1024;
+std::size_t dials::util::streambuf::default_buffer_size = 65536;
 namespace dials { namespace util { namespace boost_python {
   struct python_streambuf_wrapper {
     typedef dials::util::streambuf wt;
@@ -34,9 +37,154 @@ namespace dials { namespace util { namespace boost_python {
     }
   };
 
+  TraceRecorder &get_trace_recorder() {
+    TraceRecorder *recorder = trace_recorder();
+    DIALS_ASSERT(recorder != NULL);
+    return *recorder;
+  }
+
+  void start_trace(std::size_t capacity) {
+    get_trace_recorder().start(capacity);
+  }
+
+  void stop_trace() {
+    get_trace_recorder().stop();
+  }
+
+  std::string trace_as_chrome_json() {
+    return get_trace_recorder().chrome_json();
+  }
+
+  void write_chrome_trace(const std::string &filename) {
+    get_trace_recorder().write_chrome_json(filename);
+  }
+
+  void export_trace_recorder() {
+    using namespace boost::python;
+
+    // The recorder is shared with the other extension modules through a
+    // capsule and lives for the lifetime of the process
+    TraceRecorder *recorder = new TraceRecorder();
+    set_trace_recorder(recorder);
+    scope().attr("_trace_recorder") = object(
+      handle<>(PyCapsule_New(recorder, "dials_util_ext._trace_recorder", NULL)));
+
+    def("start_trace", &start_trace, (arg("capacity") = 65536));
+    def("stop_trace", &stop_trace);
+    def("trace_as_chrome_json", &trace_as_chrome_json);
+    def("write_chrome_trace", &write_chrome_trace, (arg("filename")));
+  }
+
+  boost::python::dict memory_usage() {
+    MemoryAccounting *accounting = memory_accounting();
+    DIALS_ASSERT(accounting != NULL);
+    boost::python::dict result;
+    for (std::size_t i = 0; i < NumMemoryTags; ++i) {
+      MemoryTag tag = static_cast<MemoryTag>(i);
+      result[MemoryAccounting::name(tag)] =
+        boost::python::make_tuple(accounting->current(tag), accounting->peak(tag));
+    }
+    return result;
+  }
+
+  void reset_memory_peaks() {
+    MemoryAccounting *accounting = memory_accounting();
+    DIALS_ASSERT(accounting != NULL);
+    accounting->reset_peaks();
+  }
+
+  void export_memory_accounting() {
+    using namespace boost::python;
+
+    // As with the trace recorder, the counters are shared with the other
+    // extension modules through a capsule
+    MemoryAccounting *accounting = new MemoryAccounting();
+    set_memory_accounting(accounting);
+    scope().attr("_memory_accounting") = object(handle<>(
+      PyCapsule_New(accounting, "dials_util_ext._memory_accounting", NULL)));
+
+    def("memory_usage", &memory_usage);
+    def("reset_memory_peaks", &reset_memory_peaks);
+  }
+
+  SharedExecutor &get_shared_executor() {
+    SharedExecutor *executor = shared_executor();
+    DIALS_ASSERT(executor != NULL);
+    return *executor;
+  }
+
+  void set_num_threads(std::size_t num_threads) {
+    get_shared_executor().set_num_threads(num_threads);
+  }
+
+  std::size_t get_num_threads() {
+    return get_shared_executor().num_threads();
+  }
+
+  boost::python::dict executor_statistics() {
+    SharedExecutor &executor = get_shared_executor();
+    boost::python::dict result;
+    result["num_threads"] = executor.num_threads();
+    result["started"] = executor.started();
+    result["regions"] = executor.regions();
+    result["nested_regions"] = executor.nested_regions();
+    result["tasks"] = executor.tasks();
+    result["busy_time"] = executor.busy_time();
+    result["elapsed_time"] = executor.elapsed_time();
+    result["utilisation"] = executor.utilisation();
+    return result;
+  }
+
+  void reset_executor_statistics() {
+    get_shared_executor().reset_statistics();
+  }
+
+  void export_shared_executor() {
+    using namespace boost::python;
+
+    // The executor is shared with the other extension modules through a
+    // capsule, and its pool is only created when first used
+    SharedExecutor *executor = new SharedExecutor();
+    set_shared_executor(executor);
+    scope().attr("_shared_executor") = object(
+      handle<>(PyCapsule_New(executor, "dials_util_ext._shared_executor", NULL)));
+
+    def("set_num_threads", &set_num_threads, (arg("num_threads")));
+    def("get_num_threads", &get_num_threads);
+    def("executor_statistics", &executor_statistics);
+    def("reset_executor_statistics", &reset_executor_statistics);
+  }
+
   using namespace boost::python;
   BOOST_PYTHON_MODULE(dials_util_ext) {
-    def("scale_down_array", &scale_down_array, (arg("image"), arg("scale_factor")));
+    af::shared<int> (*scale_down_array_seeded)(
+      const af::const_ref<int> &, const double, std::size_t, std::size_t) =
+      &scale_down_array;
+    af::shared<int> (*scale_down_array_unseeded)(const af::const_ref<int> &,
+                                                 const double) = &scale_down_array;
+    def("scale_down_array",
+        scale_down_array_unseeded,
+        (arg("image"), arg("scale_factor")));
+    def("scale_down_array",
+        scale_down_array_seeded,
+        (arg("image"), arg("scale_factor"), arg("seed"), arg("nthreads") = 1));
+    def("scale_down_image_stack",
+        &scale_down_image_stack,
+        (arg("images"), arg("scale_factor"), arg("seed"), arg("nthreads") = 1));
+
+    class_<MtzColumnWriter>("MtzColumnWriter", no_init)
+      .def(init<std::size_t>())
+      .def("add_double",
+           &MtzColumnWriter::add_double,
+           (arg("column"), arg("values"), arg("square_root") = false))
+      .def("add_int", &MtzColumnWriter::add_int, (arg("column"), arg("values")))
+      .def("add_vec3_component",
+           &MtzColumnWriter::add_vec3_component,
+           (arg("column"), arg("values"), arg("component")))
+      .def("add_constant",
+           &MtzColumnWriter::add_constant,
+           (arg("column"), arg("value")))
+      .def("write", &MtzColumnWriter::write);
 
     def("dials_u_to_mosflm", &dials_u_to_mosflm, (arg("dials_U"), arg("uc")));
 
@@ -59,9 +207,13 @@ namespace dials { namespace util { namespace boost_python {
 
     class_<ResolutionMaskGenerator>("ResolutionMaskGenerator", no_init)
       .def(init<const BeamBase &, const Panel &>())
-      .def("apply", &ResolutionMaskGenerator::apply);
+      .def("apply", &ResolutionMaskGenerator::apply)
+      .def("apply_ranges", &ResolutionMaskGenerator::apply_ranges);
 
     python_streambuf_wrapper::wrap();
     python_ostream_wrapper::wrap();
+    export_trace_recorder();
+    export_memory_accounting();
+    export_shared_executor();
   }
 }}}  // namespace dials::util::boost_python
@@ -0,0 +1,30 @@
+/*
+ * memory_accounting.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_BOOST_PYTHON_MEMORY_ACCOUNTING_H
+#define DIALS_UTIL_BOOST_PYTHON_MEMORY_ACCOUNTING_H
+
+#include <boost/python.hpp>
+#include <dials/util/memory_accounting.h>
+
+namespace dials { namespace util { namespace boost_python {
+
+  /**
+   * Charge the allocations of the calling extension module to the counters
+   * owned by dials_util_ext. This should be called from the module init
+   * function, before any memory is charged.
+   */
+  inline void import_memory_accounting() {
+    void *accounting = PyCapsule_Import("dials_util_ext._memory_accounting", 0);
+    if (accounting == NULL) {
+      boost::python::throw_error_already_set();
+    }
+    set_memory_accounting(static_cast<MemoryAccounting *>(accounting));
+  }
+
+}}}  // namespace dials::util::boost_python
+
+#endif  // DIALS_UTIL_BOOST_PYTHON_MEMORY_ACCOUNTING_H
@@ -0,0 +1,86 @@
+/*
+ * release_gil.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_BOOST_PYTHON_RELEASE_GIL_H
+#define DIALS_UTIL_BOOST_PYTHON_RELEASE_GIL_H
+
+#include <boost/preprocessor/repetition/enum_binary_params.hpp>
+#include <boost/preprocessor/repetition/enum_params.hpp>
+#include <boost/preprocessor/repetition/enum_trailing_binary_params.hpp>
+#include <boost/preprocessor/repetition/enum_trailing_params.hpp>
+#include <boost/preprocessor/repetition/repeat.hpp>
+#include <boost/typeof/typeof.hpp>
+#include <dials/util/gil.h>
+
+#ifndef DIALS_RELEASE_GIL_MAX_ARITY
+#define DIALS_RELEASE_GIL_MAX_ARITY 10
+#endif
+
+namespace dials { namespace util { namespace boost_python {
+
+  /**
+   * Wrap a function or member function so that the python GIL is released
+   * while it runs. The arguments are converted from python before the GIL is
+   * released and the result is converted after it is acquired again, so the
+   * wrapper is safe for any function which does not itself use python
+   * objects. Functions which take python objects, reflection tables (whose
+   * column proxies may raise python errors) or array handles by value (whose
+   * reference counts are not thread safe) should not be wrapped.
+   *
+   * Member functions are wrapped as free functions taking the object as the
+   * first argument, so the result can be passed to class_::def. Use the
+   * DIALS_RELEASE_GIL macro to create the wrapper.
+   */
+  template <typename Function, Function F>
+  struct release_gil;
+
+#define DIALS_RELEASE_GIL_SPECIALIZATION(z, n, unused)                           \
+  template <typename R BOOST_PP_ENUM_TRAILING_PARAMS(n, typename A),             \
+            R (*F)(BOOST_PP_ENUM_PARAMS(n, A))>                                  \
+  struct release_gil<R (*)(BOOST_PP_ENUM_PARAMS(n, A)), F> {                     \
+    static R call(BOOST_PP_ENUM_BINARY_PARAMS(n, A, a)) {                        \
+      ScopedReleaseGIL release;                                                  \
+      return F(BOOST_PP_ENUM_PARAMS(n, a));                                      \
+    }                                                                            \
+  };                                                                             \
+                                                                                 \
+  template <typename R,                                                          \
+            typename C BOOST_PP_ENUM_TRAILING_PARAMS(n, typename A),             \
+            R (C::*F)(BOOST_PP_ENUM_PARAMS(n, A))>                               \
+  struct release_gil<R (C::*)(BOOST_PP_ENUM_PARAMS(n, A)), F> {                  \
+    static R call(C &self BOOST_PP_ENUM_TRAILING_BINARY_PARAMS(n, A, a)) {       \
+      ScopedReleaseGIL release;                                                  \
+      return (self.*F)(BOOST_PP_ENUM_PARAMS(n, a));                              \
+    }                                                                            \
+  };                                                                             \
+                                                                                 \
+  template <typename R,                                                          \
+            typename C BOOST_PP_ENUM_TRAILING_PARAMS(n, typename A),             \
+            R (C::*F)(BOOST_PP_ENUM_PARAMS(n, A)) const>                         \
+  struct release_gil<R (C::*)(BOOST_PP_ENUM_PARAMS(n, A)) const, F> {            \
+    static R call(const C &self BOOST_PP_ENUM_TRAILING_BINARY_PARAMS(n, A, a)) { \
+      ScopedReleaseGIL release;                                                  \
+      return (self.*F)(BOOST_PP_ENUM_PARAMS(n, a));                              \
+    }                                                                            \
+  };
+
+  BOOST_PP_REPEAT(DIALS_RELEASE_GIL_MAX_ARITY, DIALS_RELEASE_GIL_SPECIALIZATION, ~)
+
+#undef DIALS_RELEASE_GIL_SPECIALIZATION
+
+}}}  // namespace dials::util::boost_python
+
+/**
+ * The address of a wrapper of the function f which releases the GIL. The
+ * function must not be overloaded; use DIALS_RELEASE_GIL_TPL within a
+ * template when the function depends on a template parameter.
+ */
+#define DIALS_RELEASE_GIL(f) \
+  &dials::util::boost_python::release_gil<BOOST_TYPEOF(f), f >::call
+#define DIALS_RELEASE_GIL_TPL(f) \
+  &dials::util::boost_python::release_gil<BOOST_TYPEOF_TPL(f), f >::call
+
+#endif  // DIALS_UTIL_BOOST_PYTHON_RELEASE_GIL_H
@@ -0,0 +1,30 @@
+/*
+ * shared_executor.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_BOOST_PYTHON_SHARED_EXECUTOR_H
+#define DIALS_UTIL_BOOST_PYTHON_SHARED_EXECUTOR_H
+
+#include <boost/python.hpp>
+#include <dials/util/shared_executor.h>
+
+namespace dials { namespace util { namespace boost_python {
+
+  /**
+   * Run the parallel code of the calling extension module on the executor
+   * owned by dials_util_ext. This should be called from the module init
+   * function.
+   */
+  inline void import_shared_executor() {
+    void *executor = PyCapsule_Import("dials_util_ext._shared_executor", 0);
+    if (executor == NULL) {
+      boost::python::throw_error_already_set();
+    }
+    set_shared_executor(static_cast<SharedExecutor *>(executor));
+  }
+
+}}}  // namespace dials::util::boost_python
+
+#endif  // DIALS_UTIL_BOOST_PYTHON_SHARED_EXECUTOR_H
@@ -67,6 +67,19 @@ namespace dials { namespace util { namespace {
     return append_status(is, result);
   }
 
+  boost::python::object read_block(streambuf& input) {
+    streambuf::istream is(input);
+    std::string result;
+    char block[32];
+
+    is.read(block, 7);
+    result += std::string(block, is.gcount()) + "|";
+    is.read(block, sizeof(block));
+    result += std::string(block, is.gcount()) + "|";
+
+    return append_status(is, result);
+  }
+
   boost::python::object write_word_ostream(std::ostream& os) {
     std::string result;
 
@@ -93,6 +106,17 @@ namespace dials { namespace util { namespace {
     return append_status(os, result);
   }
 
+  boost::python::object write_block(streambuf& output) {
+    streambuf::ostream os(output);
+    std::string result;
+
+    os.write("2 times ", 8);
+    os.write("1.6 equals 3.2", 14);
+    os.flush();
+
+    return append_status(os, result);
+  }
+
   boost::python::object write_word(streambuf& output) {
     streambuf::ostream os(output);
     return write_word_ostream(os);
@@ -108,9 +132,11 @@ namespace dials { namespace util { namespace {
     def("read_word", read_word);
     def("read_and_seek", read_and_seek);
     def("partial_read", partial_read);
+    def("read_block", read_block);
     def("write_word", write_word);
     def("write_word", write_word_ostream);
     def("write_and_seek", write_and_seek);
+    def("write_block", write_block);
     def("write_and_seek", write_and_seek_ostream);
   }
 
@@ -0,0 +1,29 @@
+/*
+ * trace.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_BOOST_PYTHON_TRACE_H
+#define DIALS_UTIL_BOOST_PYTHON_TRACE_H
+
+#include <boost/python.hpp>
+#include <dials/util/trace.h>
+
+namespace dials { namespace util { namespace boost_python {
+
+  /**
+   * Use the trace recorder owned by dials_util_ext in the calling extension
+   * module. This should be called from the module init function.
+   */
+  inline void import_trace_recorder() {
+    void *recorder = PyCapsule_Import("dials_util_ext._trace_recorder", 0);
+    if (recorder == NULL) {
+      boost::python::throw_error_already_set();
+    }
+    set_trace_recorder(static_cast<TraceRecorder *>(recorder));
+  }
+
+}}}  // namespace dials::util::boost_python
+
+#endif  // DIALS_UTIL_BOOST_PYTHON_TRACE_H
@@ -252,9 +252,6 @@ def write_columns(self, integrated_data):
 
         nref = len(integrated_data["miller_index"])
         assert nref
-        xdet, ydet, _ = [
-            flex.double(x) for x in integrated_data["xyzobs.px.value"].parts()
-        ]
 
         # now add column information...
 
@@ -284,30 +281,30 @@ def write_columns(self, integrated_data):
             "QE": "R",
         }
 
-        # derive index columns from original indices with
-        #
-        # from m.replace_original_index_miller_indices
-        #
-        # so all that is needed now is to make space for the reflections - fill with
-        # zeros...
+        # make space for the reflections, then add the columns with their
+        # sources to a writer which fills them all in a single pass over the
+        # reflections
 
         self.mtz_file.adjust_column_array_sizes(nref)
         self.mtz_file.set_n_reflections(nref)
         dataset = self.current_dataset
+        writer = dials.util.ext.MtzColumnWriter(nref)
+
+        def add_column(label, values, type_=None, square_root=False):
+            column = dataset.add_column(label, type_ or type_table[label])
+            if isinstance(values, (int, float)):
+                writer.add_constant(column, values)
+            elif isinstance(values, flex.int):
+                writer.add_int(column, values)
+            else:
+                writer.add_double(column, values, square_root)
 
-        # assign H, K, L, M_ISYM space
+        # assign H, K, L, M_ISYM space; the index columns are derived from the
+        # original indices after the columns are written
         for column in "H", "K", "L", "M_ISYM":
-            dataset.add_column(column, type_table[column]).set_values(
-                flex.double(nref, 0.0).as_float()
-            )
-
-        self.mtz_file.replace_original_index_miller_indices(
-            integrated_data["miller_index"]
-        )
+            add_column(column, 0)
 
-        dataset.add_column("BATCH", type_table["BATCH"]).set_values(
-            integrated_data["batch"].as_double().as_float()
-        )
+        add_column("BATCH", integrated_data["batch"])
 
         # if intensity values used in scaling exist, then just export these as I, SIGI
         if "intensity.scale.value" in integrated_data:
@@ -315,15 +312,14 @@ def write_columns(self, integrated_data):
             V_scaling = integrated_data["intensity.scale.variance"]
             # Trap negative variances
             assert V_scaling.all_gt(0)
-            dataset.add_column("I", type_table["I"]).set_values(I_scaling.as_float())
-            dataset.add_column("SIGI", type_table["SIGI"]).set_values(
-                flex.sqrt(V_scaling).as_float()
-            )
-            dataset.add_column("SCALEUSED", "R").set_values(
-                integrated_data["inverse_scale_factor"].as_float()
-            )
-            dataset.add_column("SIGSCALEUSED", "R").set_values(
-                flex.sqrt(integrated_data["inverse_scale_factor_variance"]).as_float()
+            add_column("I", I_scaling)
+            add_column("SIGI", V_scaling, square_root=True)
+            add_column("SCALEUSED", integrated_data["inverse_scale_factor"], "R")
+            add_column(
+                "SIGSCALEUSED",
+                integrated_data["inverse_scale_factor_variance"],
+                "R",
+                square_root=True,
             )
         else:
             if "intensity.prf.value" in integrated_data:
@@ -335,59 +331,47 @@ def write_columns(self, integrated_data):
                 V_profile = integrated_data["intensity.prf.variance"]
                 # Trap negative variances
                 assert V_profile.all_gt(0)
-                dataset.add_column(col_names[0], type_table["I"]).set_values(
-                    I_profile.as_float()
-                )
-                dataset.add_column(col_names[1], type_table["SIGI"]).set_values(
-                    flex.sqrt(V_profile).as_float()
+                add_column(col_names[0], I_profile, type_table["I"])
+                add_column(
+                    col_names[1], V_profile, type_table["SIGI"], square_root=True
                 )
             if "intensity.sum.value" in integrated_data:
                 I_sum = integrated_data["intensity.sum.value"]
                 V_sum = integrated_data["intensity.sum.variance"]
                 # Trap negative variances
                 assert V_sum.all_gt(0)
-                dataset.add_column("I", type_table["I"]).set_values(I_sum.as_float())
-                dataset.add_column("SIGI", type_table["SIGI"]).set_values(
-                    flex.sqrt(V_sum).as_float()
-                )
+                add_column("I", I_sum)
+                add_column("SIGI", V_sum, square_root=True)
         if (
             "background.sum.value" in integrated_data
             and "background.sum.variance" in integrated_data
         ):
             bg = integrated_data["background.sum.value"]
             varbg = integrated_data["background.sum.variance"]
-            assert (varbg >= 0).count(False) == 0
-            sigbg = flex.sqrt(varbg)
-            dataset.add_column("BG", type_table["BG"]).set_values(bg.as_float())
-            dataset.add_column("SIGBG", type_table["SIGBG"]).set_values(
-                sigbg.as_float()
-            )
+            assert varbg.all_ge(0)
+            add_column("BG", bg)
+            add_column("SIGBG", varbg, square_root=True)
 
-        dataset.add_column("FRACTIONCALC", type_table["FRACTIONCALC"]).set_values(
-            integrated_data["fractioncalc"].as_float()
-        )
+        add_column("FRACTIONCALC", integrated_data["fractioncalc"])
 
-        dataset.add_column("XDET", type_table["XDET"]).set_values(xdet.as_float())
-        dataset.add_column("YDET", type_table["YDET"]).set_values(ydet.as_float())
-        dataset.add_column("ROT", type_table["ROT"]).set_values(
-            integrated_data["ROT"].as_float()
-        )
+        xyzobs = integrated_data["xyzobs.px.value"]
+        for label, component in (("XDET", 0), ("YDET", 1)):
+            column = dataset.add_column(label, type_table[label])
+            writer.add_vec3_component(column, xyzobs, component)
+        add_column("ROT", integrated_data["ROT"])
         if "lp" in integrated_data:
-            dataset.add_column("LP", type_table["LP"]).set_values(
-                integrated_data["lp"].as_float()
-            )
+            add_column("LP", integrated_data["lp"])
         if "qe" in integrated_data:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                integrated_data["qe"].as_float()
-            )
+            add_column("QE", integrated_data["qe"])
         elif "dqe" in integrated_data:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                integrated_data["dqe"].as_float()
-            )
+            add_column("QE", integrated_data["dqe"])
         else:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                flex.double(nref, 1.0).as_float()
-            )
+            add_column("QE", 1.0)
+
+        writer.write()
+        self.mtz_file.replace_original_index_miller_indices(
+            integrated_data["miller_index"]
+        )
 
 
 def export_mtz(integrated_data, experiment_list, params):
@@ -2,6 +2,7 @@
 #define DIALS_UTIL_EXPORT_MTZ_HELPERS_H
 
 #include <cmath>
+#include <vector>
 #include <scitbx/vec3.h>
 #include <scitbx/vec2.h>
 #include <scitbx/constants.h>
@@ -10,12 +11,16 @@
 #include <scitbx/array_family/tiny_types.h>
 #include <cctbx/uctbx.h>
 #include <iotbx/mtz/object.h>
+#include <iotbx/mtz/column.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
 
 namespace dials { namespace util {
 
   using cctbx::uctbx::unit_cell;
   using iotbx::mtz::object;
   using scitbx::mat3;
+  using scitbx::vec3;
 
   void add_dials_batches(iotbx::mtz::object* mtz,
                          int dataset_id,
@@ -178,6 +183,114 @@ namespace dials { namespace util {
     }
   }
 
+  /**
+   * Fill the columns of an MTZ file from the reflection data. The columns
+   * are added with their sources, then all are filled in a single pass over
+   * the reflections, converting to float as it goes.
+   */
+  class MtzColumnWriter {
+  public:
+    /**
+     * @param nref The number of reflections
+     */
+    MtzColumnWriter(std::size_t nref) : nref_(nref) {}
+
+    /**
+     * Fill a column from doubles, or from the square root of them
+     */
+    void add_double(iotbx::mtz::column column,
+                    af::shared<double> values,
+                    bool square_root) {
+      DIALS_ASSERT(values.size() == nref_);
+      Source source(column, square_root ? SQRT_DOUBLE : DOUBLE);
+      source.double_values = values;
+      sources_.push_back(source);
+    }
+
+    /**
+     * Fill a column from integers
+     */
+    void add_int(iotbx::mtz::column column, af::shared<int> values) {
+      DIALS_ASSERT(values.size() == nref_);
+      Source source(column, INT);
+      source.int_values = values;
+      sources_.push_back(source);
+    }
+
+    /**
+     * Fill a column from one component of vectors
+     */
+    void add_vec3_component(iotbx::mtz::column column,
+                            af::shared<vec3<double> > values,
+                            std::size_t component) {
+      DIALS_ASSERT(values.size() == nref_);
+      DIALS_ASSERT(component < 3);
+      Source source(column, VEC3_COMPONENT);
+      source.vec3_values = values;
+      source.component = component;
+      sources_.push_back(source);
+    }
+
+    /**
+     * Fill a column with a constant value
+     */
+    void add_constant(iotbx::mtz::column column, double value) {
+      Source source(column, CONSTANT);
+      source.constant = value;
+      sources_.push_back(source);
+    }
+
+    /**
+     * Fill all the columns
+     */
+    void write() const {
+      std::vector<float*> data(sources_.size());
+      for (std::size_t j = 0; j < sources_.size(); ++j) {
+        data[j] = sources_[j].column.ptr()->ref;
+        DIALS_ASSERT(data[j] != 0);
+      }
+      for (std::size_t i = 0; i < nref_; ++i) {
+        for (std::size_t j = 0; j < sources_.size(); ++j) {
+          data[j][i] = sources_[j].value(i);
+        }
+      }
+    }
+
+  private:
+    enum SourceType { DOUBLE, SQRT_DOUBLE, INT, VEC3_COMPONENT, CONSTANT };
+
+    struct Source {
+      iotbx::mtz::column column;
+      SourceType type;
+      af::shared<double> double_values;
+      af::shared<int> int_values;
+      af::shared<vec3<double> > vec3_values;
+      std::size_t component;
+      double constant;
+
+      Source(iotbx::mtz::column column_, SourceType type_)
+          : column(column_), type(type_), component(0), constant(0) {}
+
+      float value(std::size_t i) const {
+        switch (type) {
+        case DOUBLE:
+          return double_values[i];
+        case SQRT_DOUBLE:
+          return std::sqrt(double_values[i]);
+        case INT:
+          return int_values[i];
+        case VEC3_COMPONENT:
+          return vec3_values[i][component];
+        default:
+          return constant;
+        }
+      }
+    };
+
+    std::size_t nref_;
+    std::vector<Source> sources_;
+  };
+
   mat3<double> dials_u_to_mosflm(const mat3<double> dials_U, unit_cell uc) {
     scitbx::af::double6 p = uc.parameters();
     scitbx::af::double6 rp = uc.reciprocal_parameters();
@@ -3,10 +3,22 @@
 from dials_util_ext import *  # noqa: F403; lgtm
 
 __all__ = (  # noqa: F405
+    "MtzColumnWriter",
     "ResolutionMaskGenerator",
     "add_dials_batches",
     "dials_u_to_mosflm",
+    "executor_statistics",
+    "get_num_threads",
+    "memory_usage",
     "ostream",
+    "reset_executor_statistics",
+    "reset_memory_peaks",
     "scale_down_array",
+    "scale_down_image_stack",
+    "set_num_threads",
+    "start_trace",
+    "stop_trace",
     "streambuf",
+    "trace_as_chrome_json",
+    "write_chrome_trace",
 )
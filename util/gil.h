@@ -0,0 +1,49 @@
+/*
+ * gil.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_GIL_H
+#define DIALS_UTIL_GIL_H
+
+#include <Python.h>
+#include <boost/noncopyable.hpp>
+
+namespace dials { namespace util {
+
+  /**
+   * Release the python global interpreter lock for the lifetime of the object.
+   * The calling thread must hold the lock when the object is created.
+   */
+  class ScopedReleaseGIL : private boost::noncopyable {
+  public:
+    ScopedReleaseGIL() : state_(PyEval_SaveThread()) {}
+
+    ~ScopedReleaseGIL() {
+      PyEval_RestoreThread(state_);
+    }
+
+  private:
+    PyThreadState *state_;
+  };
+
+  /**
+   * Acquire the python global interpreter lock for the lifetime of the object.
+   * This can be used from threads not created by python.
+   */
+  class ScopedAcquireGIL : private boost::noncopyable {
+  public:
+    ScopedAcquireGIL() : state_(PyGILState_Ensure()) {}
+
+    ~ScopedAcquireGIL() {
+      PyGILState_Release(state_);
+    }
+
+  private:
+    PyGILState_STATE state_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_GIL_H
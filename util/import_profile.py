@@ -0,0 +1,164 @@
+"""
+Measure the time taken to import each module, to find the imports which slow
+down the startup of short-lived processes such as per-image cluster jobs and
+spot finding workers.
+
+Set DIALS_IMPORT_PROFILE in the environment to print a report of the slowest
+imports to stderr when the process exits. The value is the number of modules
+to report, or any other value for the default of 25.
+"""
+
+from __future__ import absolute_import, division, print_function
+
+import atexit
+import os
+import sys
+import time
+
+from six.moves import builtins
+
+__all__ = ["ImportProfile", "profile_imports_at_exit"]
+
+
+class ImportTiming(object):
+    """The time taken to import a module."""
+
+    def __init__(self, name, cumulative, self_time, extension):
+        self.name = name
+        self.cumulative = cumulative
+        self.self_time = self_time
+        self.extension = extension
+
+
+class ImportProfile(object):
+    """
+    Record the time taken by the first import of each module, by wrapping the
+    builtin __import__ while the profile is running. The self time of a module
+    excludes the time spent importing the modules it imports.
+    """
+
+    def __init__(self):
+        self.timings = {}
+        self._original_import = None
+        self._child_time = []
+
+    def start(self):
+        """Start recording imports."""
+        assert self._original_import is None, "The profile is already running"
+        self._original_import = builtins.__import__
+        builtins.__import__ = self._import
+
+    def stop(self):
+        """Stop recording imports."""
+        if self._original_import is not None:
+            builtins.__import__ = self._original_import
+            self._original_import = None
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.stop()
+
+    def _import(self, name, globals=None, locals=None, fromlist=(), level=0):
+        # Modules which are already loaded are passed straight through
+        module_name = _absolute_name(name, globals, level)
+        if module_name is None or module_name in sys.modules:
+            return self._original_import(name, globals, locals, fromlist, level)
+
+        self._child_time.append(0.0)
+        start = time.time()
+        try:
+            return self._original_import(name, globals, locals, fromlist, level)
+        finally:
+            cumulative = time.time() - start
+            child_time = self._child_time.pop()
+            if self._child_time:
+                self._child_time[-1] += cumulative
+            module = sys.modules.get(module_name)
+            if module is not None and module_name not in self.timings:
+                filename = getattr(module, "__file__", None) or ""
+                self.timings[module_name] = ImportTiming(
+                    module_name,
+                    cumulative,
+                    cumulative - child_time,
+                    filename.endswith((".so", ".pyd")),
+                )
+
+    def slowest(self, limit=25):
+        """
+        Get the imports with the largest self time.
+
+        :param limit: The number of imports
+        :return: The list of import timings
+        """
+        timings = sorted(
+            self.timings.values(), key=lambda timing: timing.self_time, reverse=True
+        )
+        return timings[:limit]
+
+    def report(self, limit=25):
+        """
+        Format a report of the slowest imports.
+
+        :param limit: The number of imports to report
+        :return: The report as a string
+        """
+        total = sum(timing.self_time for timing in self.timings.values())
+        lines = [
+            "Imported %d modules in %.3f s, slowest by self time:"
+            % (len(self.timings), total),
+            "%10s %10s  %s" % ("self (s)", "total (s)", "module"),
+        ]
+        for timing in self.slowest(limit):
+            lines.append(
+                "%10.3f %10.3f  %s%s"
+                % (
+                    timing.self_time,
+                    timing.cumulative,
+                    timing.name,
+                    " (extension)" if timing.extension else "",
+                )
+            )
+        return "\n".join(lines)
+
+
+def _absolute_name(name, globals, level):
+    """Get the absolute name of an imported module, or None if unknown."""
+    # Python 2 uses a level of -1 for an implicit relative import, which is
+    # treated as absolute here
+    if level <= 0:
+        return name
+    package = (globals or {}).get("__package__")
+    if not package:
+        return None
+    parts = package.split(".")
+    if level > len(parts):
+        return None
+    base = ".".join(parts[: len(parts) - level + 1])
+    return base + "." + name if name else base
+
+
+def profile_imports_at_exit(limit=None):
+    """
+    Start an import profile and print the report to stderr at exit.
+
+    :param limit: The number of imports to report, by default taken from
+                  DIALS_IMPORT_PROFILE
+    :return: The import profile
+    """
+    if limit is None:
+        try:
+            limit = max(1, int(os.environ.get("DIALS_IMPORT_PROFILE")))
+        except (TypeError, ValueError):
+            limit = 25
+    profile = ImportProfile()
+    profile.start()
+
+    def show_report():
+        profile.stop()
+        print(profile.report(limit), file=sys.stderr)
+
+    atexit.register(show_report)
+    return profile
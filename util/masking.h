@@ -12,6 +12,9 @@
 #define DIALS_UTIL_MASKING_H
 
 #include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/panel.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -25,31 +28,19 @@ namespace dials { namespace util {
   using scitbx::vec3;
 
   /**
-   * A class to mask multiple resolution ranges
+   * A class to mask multiple resolution ranges. The resolution of each pixel
+   * is stored as 1/d^2, computed at the first use of the mask, so that each
+   * range is masked by a comparison of the pixel values with its limits.
    */
   class ResolutionMaskGenerator {
   public:
     /**
-     * Initialise the resolution at each pixel
+     * Initialise the mask generator
      * @param beam The beam model
      * @param panel The panel model
      */
     ResolutionMaskGenerator(const BeamBase &beam, const Panel &panel)
-        : resolution_(
-          af::c_grid<2>(panel.get_image_size()[1], panel.get_image_size()[0])) {
-      vec3<double> s0 = beam.get_s0();
-      for (std::size_t j = 0; j < resolution_.accessor()[0]; ++j) {
-        for (std::size_t i = 0; i < resolution_.accessor()[1]; ++i) {
-          vec2<double> px(i + 0.5, j + 0.5);
-          try {
-            resolution_(j, i) = panel.get_resolution_at_pixel(s0, px);
-          } catch (dxtbx::error) {
-            // Known failure: resolution at beam center is undefined
-            resolution_(j, i) = 0.0;
-          }
-        }
-      }
-    }
+        : s0_(beam.get_s0()), panel_(panel) {}
 
     /**
      * Apply the mask
@@ -59,20 +50,98 @@ namespace dials { namespace util {
      */
     void apply(af::ref<bool, af::c_grid<2> > mask, double d_min, double d_max) const {
       DIALS_ASSERT(d_min < d_max);
-      DIALS_ASSERT(resolution_.accessor()[0] == mask.accessor()[0]);
-      DIALS_ASSERT(resolution_.accessor()[1] == mask.accessor()[1]);
-      for (std::size_t j = 0; j < resolution_.accessor()[0]; ++j) {
-        for (std::size_t i = 0; i < resolution_.accessor()[1]; ++i) {
-          double d = resolution_(j, i);
-          if (d_min <= d && d <= d_max) {
-            mask(j, i) = false;
-          }
+      const af::versa<float, af::c_grid<2> > &d_sq_inv = inverse_d_squared();
+      DIALS_ASSERT(d_sq_inv.accessor().all_eq(mask.accessor()));
+      float lower = inverse_square(d_max);
+      float upper = inverse_square(d_min);
+      const float *v = d_sq_inv.begin();
+      bool *m = mask.begin();
+      for (std::size_t i = 0; i < mask.size(); ++i) {
+        m[i] = m[i] && !(lower <= v[i] && v[i] <= upper);
+      }
+    }
+
+    /**
+     * Apply the mask for several resolution ranges in a single pass over the
+     * pixels
+     * @param mask The mask
+     * @param ranges The (d_min, d_max) of each range
+     */
+    void apply_ranges(af::ref<bool, af::c_grid<2> > mask,
+                      const af::const_ref<vec2<double> > &ranges) const {
+      const af::versa<float, af::c_grid<2> > &d_sq_inv = inverse_d_squared();
+      DIALS_ASSERT(d_sq_inv.accessor().all_eq(mask.accessor()));
+
+      // Sort the ranges in 1/d^2 and merge those which overlap
+      std::vector<std::pair<float, float> > limits;
+      limits.reserve(ranges.size());
+      for (std::size_t i = 0; i < ranges.size(); ++i) {
+        DIALS_ASSERT(ranges[i][0] < ranges[i][1]);
+        limits.push_back(
+          std::make_pair(inverse_square(ranges[i][1]), inverse_square(ranges[i][0])));
+      }
+      std::sort(limits.begin(), limits.end());
+      std::vector<float> lower, upper;
+      for (std::size_t i = 0; i < limits.size(); ++i) {
+        if (!upper.empty() && limits[i].first <= upper.back()) {
+          upper.back() = std::max(upper.back(), limits[i].second);
+        } else {
+          lower.push_back(limits[i].first);
+          upper.push_back(limits[i].second);
+        }
+      }
+      if (lower.empty()) {
+        return;
+      }
+
+      // Find the last range starting below each pixel value
+      const float *v = d_sq_inv.begin();
+      bool *m = mask.begin();
+      for (std::size_t i = 0; i < mask.size(); ++i) {
+        std::size_t k =
+          std::upper_bound(lower.begin(), lower.end(), v[i]) - lower.begin();
+        if (k > 0 && v[i] <= upper[k - 1]) {
+          m[i] = false;
         }
       }
     }
 
   private:
-    af::versa<double, af::c_grid<2> > resolution_;
+    /**
+     * @returns 1/d^2 for the resolution d, infinite for d = 0
+     */
+    static float inverse_square(double d) {
+      return d > 0 ? 1.0 / (d * d) : std::numeric_limits<float>::infinity();
+    }
+
+    /**
+     * Compute the 1/d^2 at each pixel at the first call
+     */
+    const af::versa<float, af::c_grid<2> > &inverse_d_squared() const {
+      if (d_sq_inv_.size() == 0) {
+        std::size_t height = panel_.get_image_size()[1];
+        std::size_t width = panel_.get_image_size()[0];
+        af::versa<float, af::c_grid<2> > d_sq_inv(af::c_grid<2>(height, width));
+        for (std::size_t j = 0; j < height; ++j) {
+          for (std::size_t i = 0; i < width; ++i) {
+            vec2<double> px(i + 0.5, j + 0.5);
+            double d = 0.0;
+            try {
+              d = panel_.get_resolution_at_pixel(s0_, px);
+            } catch (dxtbx::error) {
+              // Known failure: resolution at beam center is undefined
+            }
+            d_sq_inv(j, i) = inverse_square(d);
+          }
+        }
+        d_sq_inv_ = d_sq_inv;
+      }
+      return d_sq_inv_;
+    }
+
+    vec3<double> s0_;
+    Panel panel_;
+    mutable af::versa<float, af::c_grid<2> > d_sq_inv_;
   };
 
 }}  // namespace dials::util
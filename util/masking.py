@@ -188,8 +188,11 @@ def _get_resolution_masker(beam, panel):
     return ResolutionMaskGenerator(beam, panel)
 
 
-def _apply_resolution_mask(mask, beam, panel, *args):
-    _get_resolution_masker(beam, panel).apply(mask, *args)
+def _apply_resolution_mask(mask, beam, panel, ranges):
+    if ranges:
+        _get_resolution_masker(beam, panel).apply_ranges(
+            mask, flex.vec2_double(ranges)
+        )
 
 
 class MaskGenerator(object):
@@ -304,17 +307,19 @@ def generate(self, imageset):
                     if region.pixel is not None:
                         mask[region.pixel] = False
 
-            # Generate high and low resolution masks
+            # Generate high and low resolution masks, collecting the ranges so
+            # that all are masked in a single pass over the pixels
+            resolution_ranges = []
             if self.params.d_min is not None:
                 logger.info("Generating high resolution mask:")
                 logger.info(" d_min = %f" % self.params.d_min)
-                _apply_resolution_mask(mask, beam, panel, 0, self.params.d_min)
+                resolution_ranges.append((0, self.params.d_min))
             if self.params.d_max is not None:
                 logger.info("Generating low resolution mask:")
                 logger.info(" d_max = %f" % self.params.d_max)
                 d_max = self.params.d_max
                 d_inf = max(d_max + 1, 1e9)
-                _apply_resolution_mask(mask, beam, panel, d_max, d_inf)
+                resolution_ranges.append((d_max, d_inf))
 
             try:
                 # Mask out the resolution range
@@ -325,7 +330,7 @@ def generate(self, imageset):
                     logger.info("Generating resolution range mask:")
                     logger.info(" d_min = %f" % d_min)
                     logger.info(" d_max = %f" % d_max)
-                    _apply_resolution_mask(mask, beam, panel, d_min, d_max)
+                    resolution_ranges.append((d_min, d_max))
             except TypeError:
                 # Catch the default value None of self.params.resolution_range
                 if any(self.params.resolution_range):
@@ -341,7 +346,8 @@ def generate(self, imageset):
                 logger.info("Generating ice ring mask:")
                 logger.info(" d_min = %f" % d_min)
                 logger.info(" d_max = %f" % d_max)
-                _apply_resolution_mask(mask, beam, panel, d_min, d_max)
+                resolution_ranges.append((d_min, d_max))
+            _apply_resolution_mask(mask, beam, panel, resolution_ranges)
 
             # Add to the list
             masks.append(mask)
@@ -0,0 +1,206 @@
+/*
+ * memory_accounting.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_MEMORY_ACCOUNTING_H
+#define DIALS_UTIL_MEMORY_ACCOUNTING_H
+
+#include <cstddef>
+#include <boost/atomic.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <dials/error.h>
+
+namespace dials { namespace util {
+
+  /**
+   * The subsystems whose native allocations are counted
+   */
+  enum MemoryTag {
+    BufferMemory,
+    ShoeboxMemory,
+    ReflectionTableMemory,
+    PixelListMemory,
+    ProfileModelMemory,
+    NumMemoryTags
+  };
+
+  /**
+   * Counters of the bytes currently allocated, and the peak, for each
+   * subsystem. The counters are updated with atomic operations so they may
+   * be charged from any thread.
+   */
+  class MemoryAccounting : private boost::noncopyable {
+  public:
+    MemoryAccounting() {
+      for (std::size_t i = 0; i < NumMemoryTags; ++i) {
+        current_[i] = 0;
+        peak_[i] = 0;
+      }
+    }
+
+    /**
+     * @param tag The subsystem
+     * @returns The name of the subsystem
+     */
+    static const char *name(MemoryTag tag) {
+      static const char *names[] = {
+        "buffer", "shoebox", "reflection_table", "pixel_list", "profile_model"};
+      DIALS_ASSERT(tag < NumMemoryTags);
+      return names[tag];
+    }
+
+    /**
+     * Count an allocation
+     * @param tag The subsystem
+     * @param bytes The number of bytes allocated
+     */
+    void allocate(MemoryTag tag, std::size_t bytes) {
+      DIALS_ASSERT(tag < NumMemoryTags);
+      std::size_t current = current_[tag].fetch_add(bytes) + bytes;
+      std::size_t peak = peak_[tag].load();
+      while (current > peak && !peak_[tag].compare_exchange_weak(peak, current)) {
+      }
+    }
+
+    /**
+     * Count a deallocation
+     * @param tag The subsystem
+     * @param bytes The number of bytes freed
+     */
+    void deallocate(MemoryTag tag, std::size_t bytes) {
+      DIALS_ASSERT(tag < NumMemoryTags);
+      current_[tag].fetch_sub(bytes);
+    }
+
+    /**
+     * @param tag The subsystem
+     * @returns The number of bytes currently allocated
+     */
+    std::size_t current(MemoryTag tag) const {
+      DIALS_ASSERT(tag < NumMemoryTags);
+      return current_[tag].load();
+    }
+
+    /**
+     * @param tag The subsystem
+     * @returns The largest number of bytes allocated at once
+     */
+    std::size_t peak(MemoryTag tag) const {
+      DIALS_ASSERT(tag < NumMemoryTags);
+      return peak_[tag].load();
+    }
+
+    /**
+     * Set the peaks to the current number of bytes allocated
+     */
+    void reset_peaks() {
+      for (std::size_t i = 0; i < NumMemoryTags; ++i) {
+        peak_[i] = current_[i].load();
+      }
+    }
+
+  private:
+    boost::atomic<std::size_t> current_[NumMemoryTags];
+    boost::atomic<std::size_t> peak_[NumMemoryTags];
+  };
+
+  namespace detail {
+
+    inline MemoryAccounting *&memory_accounting_pointer() {
+      static MemoryAccounting *accounting = NULL;
+      return accounting;
+    }
+
+  }  // namespace detail
+
+  /**
+   * @returns The memory accounting used by this module, or NULL if not set
+   */
+  inline MemoryAccounting *memory_accounting() {
+    return detail::memory_accounting_pointer();
+  }
+
+  /**
+   * Set the memory accounting used by this module. As with the trace
+   * recorder, the extensions all set the counters owned by dials_util_ext
+   * when they are imported.
+   * @param accounting The memory accounting
+   */
+  inline void set_memory_accounting(MemoryAccounting *accounting) {
+    detail::memory_accounting_pointer() = accounting;
+  }
+
+  /**
+   * The bytes charged to a subsystem by an owner of native memory. The
+   * charge is released when it is destroyed; owners which share their
+   * arrays when copied share the charge through a shared pointer.
+   */
+  class MemoryCharge : private boost::noncopyable {
+  public:
+    /**
+     * @param tag The subsystem
+     * @param bytes The number of bytes to charge
+     */
+    MemoryCharge(MemoryTag tag, std::size_t bytes = 0)
+        : accounting_(memory_accounting()), tag_(tag), bytes_(0) {
+      add(bytes);
+    }
+
+    ~MemoryCharge() {
+      set(0);
+    }
+
+    /** @returns The number of bytes charged */
+    std::size_t bytes() const {
+      return bytes_.load();
+    }
+
+    /**
+     * Charge more bytes
+     * @param bytes The number of bytes allocated
+     */
+    void add(std::size_t bytes) {
+      if (accounting_ != NULL && bytes > 0) {
+        bytes_.fetch_add(bytes);
+        accounting_->allocate(tag_, bytes);
+      }
+    }
+
+    /**
+     * Set the number of bytes charged
+     * @param bytes The number of bytes now allocated
+     */
+    void set(std::size_t bytes) {
+      if (accounting_ != NULL) {
+        std::size_t previous = bytes_.exchange(bytes);
+        if (bytes > previous) {
+          accounting_->allocate(tag_, bytes - previous);
+        } else {
+          accounting_->deallocate(tag_, previous - bytes);
+        }
+      }
+    }
+
+  private:
+    MemoryAccounting *accounting_;
+    MemoryTag tag_;
+    boost::atomic<std::size_t> bytes_;
+  };
+
+  /**
+   * @param tag The subsystem
+   * @param bytes The number of bytes to charge
+   * @returns A shared charge
+   */
+  inline boost::shared_ptr<MemoryCharge> make_memory_charge(MemoryTag tag,
+                                                            std::size_t bytes = 0) {
+    return boost::make_shared<MemoryCharge>(tag, bytes);
+  }
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_MEMORY_ACCOUNTING_H
@@ -0,0 +1,29 @@
+from __future__ import absolute_import, division, print_function
+
+import logging
+
+from dials.util.ext import memory_usage, reset_memory_peaks
+
+__all__ = ["log_memory_usage", "memory_usage", "reset_memory_peaks"]
+
+logger = logging.getLogger(__name__)
+
+
+def log_memory_usage(stage, reset_peaks=True):
+    """Log the native memory allocated by each subsystem at the end of a stage.
+
+    Args:
+        stage (str): The name of the stage which has finished
+        reset_peaks (bool): Set the peaks to the current usage, so the peaks
+            logged at the end of the next stage are for that stage alone
+    """
+    usage = memory_usage()
+    logger.debug("Native memory at the end of %s (current / peak MB):", stage)
+    for name in sorted(usage):
+        current, peak = usage[name]
+        logger.debug(
+            "  %-16s %10.1f / %10.1f", name, current / 1024.0 ** 2, peak / 1024.0 ** 2
+        )
+    if reset_peaks:
+        reset_memory_peaks()
+    return usage
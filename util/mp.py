@@ -184,6 +184,107 @@ def batch_multi_node_parallel_map(
     )
 
 
+class MPIRemoteError(RuntimeError):
+    """An exception raised by a task run on another MPI rank"""
+
+
+def mpi_parallel_map(func, iterable, callback=None, preserve_order=True):
+    """
+    Map a function over an iterable using MPI. This is called on rank 0, which
+    sends each item to the next free rank and passes the results to the
+    callback. If preserve_order is set, results which arrive early are held
+    until the results before them have been passed to the callback. The other
+    ranks must be running mpi_worker. The function and items must be picklable.
+    """
+    from mpi4py import MPI
+
+    comm = MPI.COMM_WORLD
+    assert comm.Get_rank() == 0, "Tasks must be sent from rank 0"
+
+    # With a single rank, run the tasks here
+    if comm.Get_size() == 1:
+        for item in iterable:
+            result = func(item)
+            if callback is not None:
+                callback(result)
+        return
+
+    # Give each rank a task then, as each result arrives, give the rank which
+    # sent it the next task. If a task fails no more tasks are sent, and the
+    # error is raised once the running tasks have finished so that no rank is
+    # left blocked sending its result.
+    items = enumerate(iterable)
+    status = MPI.Status()
+    num_active = 0
+    error = None
+    pending = {}
+    next_index = 0
+    for rank in range(1, comm.Get_size()):
+        task = next(items, None)
+        if task is None:
+            break
+        comm.send((func, task), dest=rank)
+        num_active += 1
+    while num_active > 0:
+        index, result = comm.recv(source=MPI.ANY_SOURCE, status=status)
+        num_active -= 1
+        if error is not None:
+            continue
+        if isinstance(result, MPIRemoteError):
+            error = result
+            continue
+        task = next(items, None)
+        if task is not None:
+            comm.send((func, task), dest=status.Get_source())
+            num_active += 1
+        if not preserve_order:
+            next_index, pending = index, {index: result}
+        else:
+            pending[index] = result
+        while next_index in pending:
+            result = pending.pop(next_index)
+            next_index += 1
+            if callback is not None:
+                callback(result)
+    if error is not None:
+        raise error
+
+
+def mpi_worker():
+    """
+    Run the tasks sent by mpi_parallel_map on this rank until mpi_stop_workers
+    is called on rank 0. An exception raised by a task is sent back to rank 0.
+    """
+    import traceback
+
+    from mpi4py import MPI
+
+    comm = MPI.COMM_WORLD
+    while True:
+        message = comm.recv(source=0)
+        if message is None:
+            break
+        func, (index, item) = message
+        try:
+            result = func(item)
+        except Exception:
+            result = MPIRemoteError(
+                "Task failed on rank %d\n%s" % (comm.Get_rank(), traceback.format_exc())
+            )
+        comm.send((index, result), dest=0)
+
+
+def mpi_stop_workers():
+    """
+    Stop the ranks running mpi_worker. This is called on rank 0.
+    """
+    from mpi4py import MPI
+
+    comm = MPI.COMM_WORLD
+    for rank in range(1, comm.Get_size()):
+        comm.send(None, dest=rank)
+
+
 if __name__ == "__main__":
 
     def func(x):
@@ -4,12 +4,15 @@
 #include <boost/python/object.hpp>
 #include <boost/python/str.hpp>
 #include <boost/python/extract.hpp>
+#include <boost/python/import.hpp>
 
 #include <boost/optional.hpp>
 #include <boost/utility/typed_in_place_factory.hpp>
 
 #include <dials/error.h>
 
+#include <algorithm>
+#include <cstring>
 #include <streambuf>
 #include <iostream>
 
@@ -87,6 +90,14 @@ namespace dials { namespace util {
 
           \c buffer_size is optional. See also: \c default_buffer_size
 
+      \b Objects \b from \b the \c io \b module
+
+        With Python 3, if the file object is an instance of \c io.IOBase, the
+        buffers are handed to it as memoryviews rather than copied into bytes
+        objects: reads are done with \c readinto straight into the read buffer,
+        and reads and writes larger than the buffer bypass it altogether and go
+        to and from the caller's memory in a single call into Python.
+
     Note: references are to the C++ standard (the numbers between parentheses
     at the end of references are margin markers).
   */
@@ -125,6 +136,8 @@ namespace dials { namespace util {
           py_seek(getattr(python_file_obj, "seek", bp::object())),
           py_tell(getattr(python_file_obj, "tell", bp::object())),
           buffer_size(buffer_size_ != 0 ? buffer_size_ : default_buffer_size),
+          use_memoryview(false),
+          read_buffer_data(0),
           write_buffer(0),
           pos_of_read_buffer_end_in_py_file(0),
           pos_of_write_buffer_end_in_py_file(buffer_size),
@@ -147,6 +160,19 @@ namespace dials { namespace util {
         }
       }
 
+#if PY_MAJOR_VERSION >= 3
+      /* The io module specifies that readinto and write only access the
+         buffer during the call, so that the memory may be lent to them.
+       */
+      bp::object io_base = bp::import("io").attr("IOBase");
+      int is_io = PyObject_IsInstance(python_file_obj.ptr(), io_base.ptr());
+      if (is_io == -1) bp::throw_error_already_set();
+      use_memoryview = (is_io == 1);
+      if (use_memoryview && py_read != bp::object()) {
+        py_readinto = getattr(python_file_obj, "readinto", bp::object());
+      }
+#endif
+
       if (py_write != bp::object()) {
         // C-like string to make debugging easier
         write_buffer = new char[buffer_size + 1];
@@ -168,6 +194,7 @@ namespace dials { namespace util {
     /// Mundane destructor freeing the allocated resources
     virtual ~streambuf() {
       if (write_buffer) delete[] write_buffer;
+      if (read_buffer_data) delete[] read_buffer_data;
     }
 
     /// C.f. C++ standard section 27.5.2.4.3
@@ -187,6 +214,14 @@ namespace dials { namespace util {
       if (py_read == bp::object()) {
         throw std::invalid_argument("That Python file object has no 'read' attribute");
       }
+      if (py_readinto != bp::object()) {
+        if (!read_buffer_data) read_buffer_data = new char[buffer_size];
+        off_type n_read = read_into(read_buffer_data, buffer_size);
+        pos_of_read_buffer_end_in_py_file += n_read;
+        setg(read_buffer_data, read_buffer_data, read_buffer_data + n_read);
+        if (n_read == 0) return failure;
+        return traits_type::to_int_type(read_buffer_data[0]);
+      }
       read_buffer = py_read(buffer_size);
       char* read_buffer_data;
       bp::ssize_t py_n_read;
@@ -212,9 +247,7 @@ namespace dials { namespace util {
       }
       farthest_pptr = std::max(farthest_pptr, pptr());
       off_type n_written = (off_type)(farthest_pptr - pbase());
-      boost::python::object data_bytes(
-        boost::python::handle<>(PyBytes_FromStringAndSize(pbase(), n_written)));
-      py_write(data_bytes);
+      write_from(pbase(), n_written);
       if (!traits_type::eq_int_type(c, traits_type::eof())) {
         char trait_char = traits_type::to_char_type(c);
         boost::python::object char_bytes(
@@ -232,6 +265,48 @@ namespace dials { namespace util {
                                                              : c;
     }
 
+    /// C.f. C++ standard section 27.5.2.4.3
+    /** Requests at least as large as the read buffer are read straight into
+        the destination with readinto, once the buffered data has been used.
+     */
+    virtual std::streamsize xsgetn(char_type* s, std::streamsize n) {
+      if (py_readinto == bp::object() || n < (std::streamsize)buffer_size) {
+        return base_t::xsgetn(s, n);
+      }
+      std::streamsize n_copied = 0;
+      if (gptr() && gptr() < egptr()) {
+        n_copied = std::min(n, (std::streamsize)(egptr() - gptr()));
+        std::memcpy(s, gptr(), n_copied);
+        gbump(n_copied);
+        if (n_copied == n) return n;
+      }
+      if (!read_buffer_data) read_buffer_data = new char[buffer_size];
+      while (n_copied < n) {
+        off_type n_read = read_into(s + n_copied, n - n_copied);
+        if (n_read == 0) break;
+        pos_of_read_buffer_end_in_py_file += n_read;
+        n_copied += n_read;
+      }
+      // The read buffer is now empty and ends at the position in the file
+      setg(read_buffer_data, read_buffer_data, read_buffer_data);
+      return n_copied;
+    }
+
+    /// C.f. C++ standard section 27.5.2.4.5
+    /** Requests at least as large as the write buffer are written straight
+        from the source, after what is in the write buffer.
+     */
+    virtual std::streamsize xsputn(const char_type* s, std::streamsize n) {
+      if (!use_memoryview || py_write == bp::object()
+          || n < (std::streamsize)buffer_size || pptr() < farthest_pptr) {
+        return base_t::xsputn(s, n);
+      }
+      if (pptr() > pbase()) overflow();
+      write_from(s, n);
+      pos_of_write_buffer_end_in_py_file += n;
+      return n;
+    }
+
     /// Update the python file to reflect the state of this stream buffer
     /** Empty the write buffer into the Python file object and set the seek
         position of the latter accordingly (C++ standard section 27.5.2.4.2).
@@ -325,10 +400,13 @@ namespace dials { namespace util {
     }
 
   private:
-    bp::object py_read, py_write, py_seek, py_tell;
+    bp::object py_read, py_write, py_seek, py_tell, py_readinto;
 
     std::size_t buffer_size;
 
+    // whether memory may be lent to the Python file object as a memoryview
+    bool use_memoryview;
+
     /* This is actually a Python string and the actual read buffer is
        its internal data, i.e. an array of characters. We use a Boost.Python
        object so as to hold on it: as a result, the actual buffer can't
@@ -336,6 +414,11 @@ namespace dials { namespace util {
     */
     bp::object read_buffer;
 
+    /* The read buffer when reading with readinto, allocated on the heap at
+       the first read and de-allocated only at destruction time.
+    */
+    char* read_buffer_data;
+
     /* A mere array of char's allocated on the heap at construction time and
        de-allocated only at destruction time.
     */
@@ -346,6 +429,37 @@ namespace dials { namespace util {
     // the farthest place the buffer has been written into
     char* farthest_pptr;
 
+    /// Read at most n characters into s with the readinto method
+    off_type read_into(char* s, std::size_t n) {
+#if PY_MAJOR_VERSION >= 3
+      bp::object view(bp::handle<>(PyMemoryView_FromMemory(s, n, PyBUF_WRITE)));
+      bp::object py_n_read = py_readinto(view);
+      if (py_n_read == bp::object()) {
+        throw std::invalid_argument(
+          "The method 'readinto' of the Python file object "
+          "did not return a number of bytes.");
+      }
+      return bp::extract<off_type>(py_n_read);
+#else
+      DIALS_ASSERT(0);
+      return 0;
+#endif
+    }
+
+    /// Write the n characters of s with the write method
+    void write_from(const char* s, off_type n) {
+#if PY_MAJOR_VERSION >= 3
+      if (use_memoryview) {
+        bp::object view(bp::handle<>(
+          PyMemoryView_FromMemory(const_cast<char*>(s), n, PyBUF_READ)));
+        py_write(view);
+        return;
+      }
+#endif
+      bp::object data_bytes(bp::handle<>(PyBytes_FromStringAndSize(s, n)));
+      py_write(data_bytes);
+    }
+
     boost::optional<off_type> seekoff_without_calling_python(
       off_type off,
       std::ios_base::seekdir way,
@@ -422,7 +536,7 @@ namespace dials { namespace util {
   /*Including the definition of default_buffer_size in more than
     one object file appears to preclude linkage of the objects together.
     Instead, define it only where it is needed in meta_ext.cpp.
-  std::size_t streambuf::default_buffer_size = 1024;
+  std::size_t streambuf::default_buffer_size = 65536;
   */
 
   struct streambuf_capsule {
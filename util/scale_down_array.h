@@ -6,42 +6,89 @@
 #define DIALS_UTIL_SCALED_DOWN_ARRAY_H
 
 #include <ctime>
-#include <boost/random.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/random/binomial_distribution.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/util/splitmix64.h>
+#include <dials/error.h>
 
 namespace dials { namespace util {
-  /**
-   * Calculate a randomly downscaled new image with the same dimensions
-   * as the input array.
-   */
-
-  af::shared<int> scale_down_array(const af::const_ref<int> &image,
-                                   const double scale_factor) {
-    // create the RNG
-
-    boost::random::mt19937 gen(time(0));
-    boost::random::uniform_real_distribution<double> dist(0, 1);
 
-    // create the target array
+  namespace detail {
 
-    af::shared<int> result(image.size(), 0);
-
-    // now iterate through the array & do what we need to do...
-
-    for (int j = 0; j < image.size(); ++j) {
-      if (image[j] <= 0) {
-        result[j] = image[j];
-      } else {
-        for (int k = 0; k < image[j]; k++) {
-          if (dist(gen) < scale_factor) {
-            result[j] += 1;
-          }
+    /**
+     * Scale down the pixels [first, last) by drawing the number of counts
+     * kept in each from a binomial distribution
+     */
+    inline void scale_down_band(af::const_ref<int> image,
+                                af::ref<int> result,
+                                double scale_factor,
+                                boost::uint64_t seed,
+                                std::size_t first,
+                                std::size_t last) {
+      for (std::size_t j = first; j < last; ++j) {
+        if (image[j] <= 0 || scale_factor == 1.0) {
+          result[j] = image[j];
+        } else if (scale_factor == 0.0) {
+          result[j] = 0;
+        } else {
+          SplitMix64 gen(seed, j);
+          boost::random::binomial_distribution<int> dist(image[j], scale_factor);
+          result[j] = dist(gen);
         }
       }
     }
 
+  }  // namespace detail
+
+  /**
+   * Calculate a randomly downscaled new image with the same dimensions
+   * as the input array. Each count is kept with a probability of the scale
+   * factor; negative values are flags and are kept as they are. The result
+   * depends only on the seed, not on the number of threads.
+   */
+  af::shared<int> scale_down_array(const af::const_ref<int> &image,
+                                   const double scale_factor,
+                                   std::size_t seed,
+                                   std::size_t nthreads = 1) {
+    DIALS_ASSERT(scale_factor >= 0 && scale_factor <= 1);
+    af::shared<int> result(image.size(), 0);
+    dials::algorithms::detail::parallel_bands(boost::bind(&detail::scale_down_band,
+                                                          image,
+                                                          result.ref(),
+                                                          scale_factor,
+                                                          seed,
+                                                          _1,
+                                                          _2),
+                                              image.size(),
+                                              nthreads);
     return result;
   }
+
+  /**
+   * Calculate a randomly downscaled new image, seeded from the time
+   */
+  af::shared<int> scale_down_array(const af::const_ref<int> &image,
+                                   const double scale_factor) {
+    return scale_down_array(image, scale_factor, time(0));
+  }
+
+  /**
+   * Calculate randomly downscaled images for a stack of images, as for a
+   * single image with the pixels of all the images.
+   */
+  af::versa<int, af::c_grid<3> > scale_down_image_stack(
+    const af::const_ref<int, af::c_grid<3> > &images,
+    const double scale_factor,
+    std::size_t seed,
+    std::size_t nthreads = 1) {
+    af::shared<int> result = scale_down_array(
+      af::const_ref<int>(images.begin(), images.size()), scale_factor, seed, nthreads);
+    return af::versa<int, af::c_grid<3> >(result.handle(), images.accessor());
+  }
+
 }}  // namespace dials::util
 
 #endif
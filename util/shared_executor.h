@@ -0,0 +1,285 @@
+/*
+ * shared_executor.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_SHARED_EXECUTOR_H
+#define DIALS_UTIL_SHARED_EXECUTOR_H
+
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <dials/util/thread_pool.h>
+#include <dials/util/timer.h>
+#include <dials/error.h>
+
+namespace dials { namespace util {
+
+  /**
+   * A thread pool shared by all the native parallel code in the process, with
+   * a total thread budget. The pool is only created when it is first needed,
+   * and is recreated with the new size if the budget is changed. Code running
+   * on one of its workers which asks for more threads is run serially, so
+   * nested parallel regions neither oversubscribe the cores nor deadlock by
+   * waiting on the workers they occupy.
+   */
+  class SharedExecutor : private boost::noncopyable {
+  public:
+    /**
+     * @param num_threads The thread budget, or 0 for the number of cpus
+     */
+    SharedExecutor(std::size_t num_threads = 0)
+        : num_threads_(num_threads > 0 ? num_threads : default_num_threads()),
+          start_time_(0),
+          regions_(0),
+          nested_regions_(0),
+          tasks_(0),
+          busy_ns_(0) {}
+
+    /**
+     * @returns The number of cpus
+     */
+    static std::size_t default_num_threads() {
+      return std::max(boost::thread::hardware_concurrency(), 1u);
+    }
+
+    /**
+     * @returns The thread budget
+     */
+    std::size_t num_threads() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return num_threads_;
+    }
+
+    /**
+     * Set the thread budget. Jobs already running keep the old pool until
+     * they finish.
+     * @param num_threads The thread budget, or 0 for the number of cpus
+     */
+    void set_num_threads(std::size_t num_threads) {
+      if (num_threads == 0) {
+        num_threads = default_num_threads();
+      }
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (num_threads != num_threads_) {
+        num_threads_ = num_threads;
+        pool_.reset();
+      }
+    }
+
+    /**
+     * @returns True/False the pool has been created
+     */
+    bool started() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return pool_.get() != NULL;
+    }
+
+    /**
+     * @returns The pool, which is created on first use
+     */
+    boost::shared_ptr<ThreadPool> pool() {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (!pool_) {
+        pool_ = boost::make_shared<ThreadPool>(num_threads_);
+        if (start_time_ == 0) {
+          start_time_ = monotonic_time();
+        }
+      }
+      return pool_;
+    }
+
+    /**
+     * @returns True/False the calling thread is a worker of the pool
+     */
+    bool in_worker() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return pool_ && pool_->is_worker();
+    }
+
+    /**
+     * Start a parallel region and get the number of threads it should use.
+     * This is the number asked for, limited by the budget, or 1 if the
+     * caller is already running on the pool.
+     * @param nthreads The number of threads asked for
+     * @returns The number of threads to use
+     */
+    std::size_t concurrency(std::size_t nthreads) {
+      if (nthreads <= 1) {
+        return nthreads;
+      }
+      if (in_worker()) {
+        nested_regions_++;
+        return 1;
+      }
+      regions_++;
+      return std::min(nthreads, num_threads());
+    }
+
+    /**
+     * Post a function to a group of tasks on the pool, timing it for the
+     * utilisation statistics
+     * @param group The task group
+     * @param function The function to call
+     */
+    template <typename Function>
+    void post(ThreadPool::TaskGroup &group, Function function) {
+      group.post(TimedTask<Function>(function, *this));
+    }
+
+    /**
+     * @returns The number of parallel regions run on the pool
+     */
+    std::size_t regions() const {
+      return regions_.load();
+    }
+
+    /**
+     * @returns The number of nested parallel regions run serially
+     */
+    std::size_t nested_regions() const {
+      return nested_regions_.load();
+    }
+
+    /**
+     * @returns The number of tasks run through the executor
+     */
+    std::size_t tasks() const {
+      return tasks_.load();
+    }
+
+    /**
+     * @returns The total time spent running the tasks in seconds
+     */
+    double busy_time() const {
+      return 1e-9 * (double)busy_ns_.load();
+    }
+
+    /**
+     * @returns The time since the pool was first created in seconds
+     */
+    double elapsed_time() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return start_time_ > 0 ? monotonic_time() - start_time_ : 0.0;
+    }
+
+    /**
+     * @returns The busy time as a fraction of the thread time available
+     */
+    double utilisation() const {
+      double available = elapsed_time() * num_threads();
+      return available > 0 ? busy_time() / available : 0.0;
+    }
+
+    /**
+     * Reset the statistics
+     */
+    void reset_statistics() {
+      regions_ = 0;
+      nested_regions_ = 0;
+      tasks_ = 0;
+      busy_ns_ = 0;
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      start_time_ = pool_ ? monotonic_time() : 0;
+    }
+
+  protected:
+    /**
+     * A helper class to time a task and count it in the statistics
+     */
+    template <typename Function>
+    class TimedTask {
+    public:
+      TimedTask(Function function, SharedExecutor &executor)
+          : function_(function), executor_(executor) {}
+
+      void operator()() {
+        double start = monotonic_time();
+        try {
+          function_();
+        } catch (...) {
+          executor_.finish(start);
+          throw;
+        }
+        executor_.finish(start);
+      }
+
+    protected:
+      Function function_;
+      SharedExecutor &executor_;
+    };
+
+    void finish(double start) {
+      double elapsed = monotonic_time() - start;
+      tasks_++;
+      busy_ns_ += (boost::uint64_t)(1e9 * std::max(elapsed, 0.0));
+    }
+
+    mutable boost::mutex mutex_;
+    std::size_t num_threads_;
+    boost::shared_ptr<ThreadPool> pool_;
+    double start_time_;
+    boost::atomic<std::size_t> regions_;
+    boost::atomic<std::size_t> nested_regions_;
+    boost::atomic<std::size_t> tasks_;
+    boost::atomic<boost::uint64_t> busy_ns_;
+  };
+
+  namespace detail {
+
+    inline SharedExecutor *&shared_executor_pointer() {
+      static SharedExecutor *executor = NULL;
+      return executor;
+    }
+
+  }  // namespace detail
+
+  /**
+   * @returns The shared executor used by this module, or NULL if not set
+   */
+  inline SharedExecutor *shared_executor() {
+    return detail::shared_executor_pointer();
+  }
+
+  /**
+   * Set the shared executor used by this module. As with the memory
+   * accounting, the extensions all use the executor owned by dials_util_ext
+   * once they are imported.
+   * @param executor The shared executor
+   */
+  inline void set_shared_executor(SharedExecutor *executor) {
+    detail::shared_executor_pointer() = executor;
+  }
+
+  /**
+   * Get the thread pool for a job asking for a number of threads. A pool
+   * given by the caller is used as it is. Otherwise the shared pool is used
+   * if the job asks for at least the whole budget and is not itself running
+   * on the shared pool. Otherwise a private pool of the requested size is
+   * created, as it is when there is no shared executor.
+   * @param pool The pool given by the caller, if any
+   * @param nthreads The number of threads
+   * @returns The thread pool
+   */
+  inline boost::shared_ptr<ThreadPool> job_thread_pool(
+    boost::shared_ptr<ThreadPool> pool,
+    std::size_t nthreads) {
+    if (pool) {
+      return pool;
+    }
+    SharedExecutor *executor = shared_executor();
+    if (executor != NULL && nthreads >= executor->num_threads()
+        && !executor->in_worker()) {
+      return executor->pool();
+    }
+    return boost::make_shared<ThreadPool>(nthreads);
+  }
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_SHARED_EXECUTOR_H
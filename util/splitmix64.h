@@ -0,0 +1,57 @@
+/*
+ * splitmix64.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_UTIL_SPLITMIX64_H
+#define DIALS_UTIL_SPLITMIX64_H
+
+#include <boost/cstdint.hpp>
+
+namespace dials { namespace util {
+
+  /**
+   * A counter based random number engine (SplitMix64). Each item, such as a
+   * pixel, has its own stream, started from a hash of the seed and the index
+   * of the item, so that the random numbers do not depend on the order in
+   * which the items are processed.
+   */
+  class SplitMix64 {
+  public:
+    typedef boost::uint64_t result_type;
+
+    SplitMix64(boost::uint64_t seed, boost::uint64_t stream)
+        : state_(mix(seed ^ mix(stream + increment()))) {}
+
+    static result_type(min)() {
+      return 0;
+    }
+
+    static result_type(max)() {
+      return ~result_type(0);
+    }
+
+    result_type operator()() {
+      state_ += increment();
+      return mix(state_);
+    }
+
+  private:
+    static boost::uint64_t increment() {
+      return 0x9E3779B97F4A7C15ULL;
+    }
+
+    static boost::uint64_t mix(boost::uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      return z ^ (z >> 31);
+    }
+
+    boost::uint64_t state_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_SPLITMIX64_H
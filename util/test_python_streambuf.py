@@ -26,6 +26,8 @@ def run(self):
             self.exercise_seek_and_read()
             self.exercise_partial_read()
             self.exercise_write_and_seek()
+            self.exercise_read_block()
+            self.exercise_write_block()
         streambuf.default_buffer_size = m
 
     def exercise_read(self):
@@ -42,6 +44,12 @@ def exercise_partial_read(self):
         assert trailing == b" be fun"
         self.file_object.close()
 
+    def exercise_read_block(self):
+        self.create_file_object(mode="rb")
+        blocks = ext.read_block(streambuf(self.file_object))
+        assert blocks == b"Coding |should be fun|[ fail, eof ]"
+        self.file_object.close()
+
     def exercise_read_failure(self):
         self.create_file_object(mode="rb")
         self.file_object.close()
@@ -56,6 +64,13 @@ def exercise_write(self):
         assert self.file_content() == b"2 times 1.6 equals 3.2"
         self.file_object.close()
 
+    def exercise_write_block(self):
+        self.create_file_object(mode="wb")
+        report = ext.write_block(streambuf(self.file_object))
+        assert report == b""
+        assert self.file_content() == b"2 times 1.6 equals 3.2"
+        self.file_object.close()
+
     def exercise_seek_and_read(self):
         self.create_file_object(mode="rb")
         instrumented_file = mock.Mock(spec=self.file_object, wraps=self.file_object)
@@ -0,0 +1,110 @@
+/*
+ * thread_affinity.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_THREAD_AFFINITY_H
+#define DIALS_UTIL_THREAD_AFFINITY_H
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <boost/thread.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace dials { namespace util {
+
+  /**
+   * Parse a linux cpu list such as "0-15,32-47"
+   * @param text The cpu list
+   * @returns The list of cpus
+   */
+  inline std::vector<int> parse_cpu_list(const char *text) {
+    std::vector<int> cpus;
+    int first = 0;
+    int last = 0;
+    int count = 0;
+    while (*text != '\0' && *text != '\n') {
+      int n = std::sscanf(text, "%d-%d%n", &first, &last, &count);
+      if (n == 2) {
+        for (int cpu = first; cpu <= last; ++cpu) {
+          cpus.push_back(cpu);
+        }
+      } else if (std::sscanf(text, "%d%n", &first, &count) == 1) {
+        cpus.push_back(first);
+      } else {
+        break;
+      }
+      text += count;
+      if (*text == ',') {
+        ++text;
+      }
+    }
+    return cpus;
+  }
+
+  /**
+   * Get the cpus on each NUMA node. This is read from sysfs on linux. On other
+   * systems, or if the information is not available, all the cpus are
+   * returned as a single node.
+   * @returns The list of cpus on each node
+   */
+  inline std::vector<std::vector<int> > numa_node_cpus() {
+    std::vector<std::vector<int> > nodes;
+#if defined(__linux__)
+    for (int node = 0; node < 1024; ++node) {
+      char filename[64];
+      std::sprintf(filename, "/sys/devices/system/node/node%d/cpulist", node);
+      std::FILE *file = std::fopen(filename, "r");
+      if (file == NULL) {
+        continue;
+      }
+      char buffer[4096];
+      if (std::fgets(buffer, sizeof(buffer), file) != NULL) {
+        std::vector<int> cpus = parse_cpu_list(buffer);
+        if (!cpus.empty()) {
+          nodes.push_back(cpus);
+        }
+      }
+      std::fclose(file);
+    }
+#endif
+    if (nodes.empty()) {
+      std::size_t ncpus = std::max(boost::thread::hardware_concurrency(), 1u);
+      nodes.push_back(std::vector<int>());
+      for (std::size_t i = 0; i < ncpus; ++i) {
+        nodes.back().push_back(i);
+      }
+    }
+    return nodes;
+  }
+
+  /**
+   * Restrict the calling thread to run on the given cpus. This does nothing on
+   * systems other than linux.
+   * @param cpus The list of cpus
+   * @returns True/False the affinity was set
+   */
+  inline bool set_thread_affinity(const std::vector<int> &cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (std::size_t i = 0; i < cpus.size(); ++i) {
+      if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+        CPU_SET(cpus[i], &set);
+      }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_THREAD_AFFINITY_H
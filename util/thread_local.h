@@ -0,0 +1,76 @@
+/*
+ * thread_local.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_THREAD_LOCAL_H
+#define DIALS_UTIL_THREAD_LOCAL_H
+
+#include <cstddef>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace dials { namespace util {
+
+  /**
+   * A per-thread pointer to an object owned by someone else.
+   *
+   * boost::thread_specific_ptr is keyed on its own address and only clears the
+   * value of the thread which destroys it. When the threads outlive the object,
+   * as the workers of a shared thread pool do, a new object created at the
+   * same address would see the stale values of the old one. Here each thread
+   * instead holds a small slot which it owns, tagged with the serial number of
+   * the object which filled it, so a stale slot is simply refilled. The values
+   * themselves are never deleted by the threads.
+   */
+  template <typename T>
+  class ThreadLocalPtr : private boost::noncopyable {
+  public:
+    ThreadLocalPtr() : serial_(next_serial()) {}
+
+    /**
+     * @returns The value for the calling thread or NULL if none has been set
+     */
+    T *get() const {
+      Slot *slot = slot_.get();
+      return (slot != NULL && slot->serial == serial_) ? slot->value : NULL;
+    }
+
+    /**
+     * Set the value for the calling thread
+     * @param value The value
+     */
+    void reset(T *value) {
+      Slot *slot = slot_.get();
+      if (slot == NULL) {
+        slot = new Slot();
+        slot_.reset(slot);
+      }
+      slot->serial = serial_;
+      slot->value = value;
+    }
+
+  protected:
+    struct Slot {
+      Slot() : serial(0), value(NULL) {}
+      std::size_t serial;
+      T *value;
+    };
+
+    /**
+     * @returns A serial number which is unique within the process
+     */
+    static std::size_t next_serial() {
+      static boost::atomic<std::size_t> serial(0);
+      return ++serial;
+    }
+
+    std::size_t serial_;
+    boost::thread_specific_ptr<Slot> slot_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_THREAD_LOCAL_H
@@ -11,33 +11,222 @@
 #ifndef DIALS_ARRAY_FAMILY_THREAD_POOL_H
 #define DIALS_ARRAY_FAMILY_THREAD_POOL_H
 
-#include <boost/asio.hpp>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/atomic.hpp>
+#include <dials/util/thread_affinity.h>
+#include <dials/util/trace.h>
 
 namespace dials { namespace util {
 
   /**
-   * A class to implement a thread pool
+   * A class to implement a work stealing thread pool.
+   *
+   * Each worker thread owns a queue of tasks. Tasks posted from outside the
+   * pool are distributed round robin between the worker queues; tasks posted
+   * from inside a running task are pushed onto the queue of the worker running
+   * it. A worker takes tasks from the back of its own queue and, when that is
+   * empty, steals from the front of the queues of the other workers. Idle
+   * workers and threads calling wait() block on a condition variable rather
+   * than spinning.
+   *
+   * Optionally the workers are pinned to the cpus of the NUMA nodes, with the
+   * workers split evenly between the nodes. Tasks can then be posted to a
+   * particular node, and workers steal from the other workers on their own
+   * node before stealing from those on other nodes.
    */
-  class ThreadPool {
+  class ThreadPool : private boost::noncopyable {
   public:
+    typedef boost::function<void()> task_type;
+
+    /**
+     * A group of tasks which can be waited on independently of other tasks
+     * running on the same pool. Errors raised by the tasks in the group are
+     * kept by the group rather than the pool.
+     */
+    class TaskGroup : private boost::noncopyable {
+    public:
+      /**
+       * Create the task group
+       * @param pool The thread pool to run the tasks on
+       */
+      TaskGroup(ThreadPool &pool)
+          : pool_(pool), started_(0), finished_(0), failed_(false) {}
+
+      /**
+       * Wait for the tasks in the group before destruction
+       */
+      ~TaskGroup() {
+        try {
+          wait();
+        } catch (const std::exception &) {
+          // pass
+        }
+      }
+
+      /**
+       * Post a function to the thread pool as part of this group
+       * @param function The function to call
+       */
+      template <typename Function>
+      void post(Function function) {
+        {
+          boost::lock_guard<boost::mutex> guard(mutex_);
+          started_++;
+        }
+        pool_.post(GroupRunner<Function>(function, *this));
+      }
+
+      /**
+       * Post a function to run preferentially on a NUMA node
+       * @param function The function to call
+       * @param node The node index
+       */
+      template <typename Function>
+      void post(Function function, std::size_t node) {
+        {
+          boost::lock_guard<boost::mutex> guard(mutex_);
+          started_++;
+        }
+        pool_.post(GroupRunner<Function>(function, *this), node);
+      }
+
+      /**
+       * @returns The number of NUMA nodes used by the pool
+       */
+      std::size_t num_nodes() const {
+        return pool_.num_nodes();
+      }
+
+      /**
+       * Wait until all the tasks in the group have finished. If any task threw
+       * an exception then it is rethrown here as a std::runtime_error.
+       */
+      void wait() {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (finished_ < started_) {
+          cond_.wait(lock);
+        }
+        if (failed_) {
+          failed_ = false;
+          throw std::runtime_error(error_message_);
+        }
+      }
+
+    protected:
+      /**
+       * A helper class to call the function and notify the group
+       */
+      template <typename Function>
+      class GroupRunner {
+      public:
+        GroupRunner(Function function, TaskGroup &group)
+            : function_(function), group_(group) {}
+
+        void operator()() {
+          try {
+            function_();
+          } catch (const std::exception &e) {
+            group_.set_error(e.what());
+          } catch (...) {
+            group_.set_error("Unknown exception in thread pool task");
+          }
+          group_.finish();
+        }
+
+      protected:
+        Function function_;
+        TaskGroup &group_;
+      };
+
+      /**
+       * Mark a task as finished
+       */
+      void finish() {
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        finished_++;
+        if (finished_ == started_) {
+          cond_.notify_all();
+        }
+      }
+
+      /**
+       * Record the first error raised by a task in the group
+       * @param message The error message
+       */
+      void set_error(const std::string &message) {
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        if (!failed_) {
+          failed_ = true;
+          error_message_ = message;
+        }
+      }
+
+      ThreadPool &pool_;
+      boost::mutex mutex_;
+      boost::condition_variable cond_;
+      std::size_t started_;
+      std::size_t finished_;
+      bool failed_;
+      std::string error_message_;
+    };
+
     /**
      * Instantiate with the number of required threads
      * @param N The number of threads
+     * @param pin_threads Pin the threads to the cpus of the NUMA nodes
      */
-    ThreadPool(std::size_t N) : work_(io_service_), started_(0), finished_(0) {
+    ThreadPool(std::size_t N, bool pin_threads = false)
+        : stop_(false),
+          next_queue_(0),
+          num_queued_(0),
+          num_sleeping_(0),
+          started_(0),
+          finished_(0),
+          failed_(false) {
+      if (N == 0) {
+        N = 1;
+      }
       for (std::size_t i = 0; i < N; ++i) {
-        threads_.create_thread(
-          boost::bind(&boost::asio::io_service::run, &io_service_));
+        queues_.push_back(new WorkQueue());
+      }
+
+      // Split the workers between the nodes
+      if (pin_threads) {
+        node_cpus_ = numa_node_cpus();
+        if (node_cpus_.size() > N) {
+          node_cpus_.resize(N);
+        }
+      }
+      std::size_t num_nodes = std::max(node_cpus_.size(), (std::size_t)1);
+      node_workers_.resize(num_nodes);
+      for (std::size_t i = 0; i < N; ++i) {
+        worker_node_.push_back(i * num_nodes / N);
+        node_workers_[worker_node_.back()].push_back(i);
+      }
+      for (std::size_t i = 0; i < N; ++i) {
+        threads_.create_thread(boost::bind(&ThreadPool::run, this, i));
       }
     }
 
     /**
-     * Destroy the thread pool and join all threads
+     * Destroy the thread pool and join all threads. Tasks which have not yet
+     * started are discarded.
      */
     ~ThreadPool() {
-      io_service_.stop();
+      {
+        boost::lock_guard<boost::mutex> guard(sleep_mutex_);
+        stop_ = true;
+      }
+      sleep_cond_.notify_all();
       try {
         threads_.join_all();
       } catch (const std::exception &) {
@@ -45,57 +234,247 @@ namespace dials { namespace util {
       }
     }
 
+    /**
+     * @returns The number of worker threads
+     */
+    std::size_t size() const {
+      return queues_.size();
+    }
+
+    /**
+     * @returns The number of NUMA nodes used. This is 1 unless the threads
+     * are pinned.
+     */
+    std::size_t num_nodes() const {
+      return node_workers_.size();
+    }
+
+    /**
+     * @returns True/False the calling thread is one of the workers
+     */
+    bool is_worker() const {
+      return worker_index_.get() != NULL;
+    }
+
     /**
      * Post a function to the thread pool
      * @param function The function to call
      */
     template <typename Function>
     void post(Function function) {
-      started_++;
-      io_service_.post(FunctionRunner<Function>(function, finished_));
+      {
+        boost::lock_guard<boost::mutex> guard(done_mutex_);
+        started_++;
+      }
+      push(task_type(function));
     }
 
     /**
-     * Wait until all posted jobs have finished
+     * Post a function to run preferentially on a NUMA node. The function is
+     * queued on a worker on the node, but may still be stolen by another
+     * worker if the node is busy.
+     * @param function The function to call
+     * @param node The node index
+     */
+    template <typename Function>
+    void post(Function function, std::size_t node) {
+      {
+        boost::lock_guard<boost::mutex> guard(done_mutex_);
+        started_++;
+      }
+      push(task_type(function), node % num_nodes());
+    }
+
+    /**
+     * Wait until all posted jobs have finished. If any job threw an exception
+     * then it is rethrown here as a std::runtime_error.
      */
     void wait() {
-      while (finished_ < started_)
-        ;
+      boost::unique_lock<boost::mutex> lock(done_mutex_);
+      while (finished_ < started_) {
+        done_cond_.wait(lock);
+      }
+      if (failed_) {
+        failed_ = false;
+        throw std::runtime_error(error_message_);
+      }
     }
 
   protected:
     /**
-     * A helper class to call the function increasing an atomic counter
+     * A queue of tasks owned by a single worker
      */
-    template <typename Function>
-    class FunctionRunner {
-    public:
-      /**
-       * Create the helper class instance
-       * @param function The function to call
-       * @param counter The counter to increment
-       */
-      FunctionRunner(Function function, boost::atomic<std::size_t> &counter)
-          : function_(function), counter_(counter) {}
+    struct WorkQueue {
+      boost::mutex mutex;
+      std::deque<task_type> tasks;
+    };
 
-      /**
-       * Call the function and increment the counter
-       */
-      void operator()() {
-        function_();
-        counter_++;
+    /**
+     * Push a task onto a worker queue and wake a sleeping worker
+     * @param task The task
+     */
+    void push(const task_type &task) {
+      std::size_t *current = worker_index_.get();
+      std::size_t index =
+        current != NULL ? *current : (next_queue_.fetch_add(1) % queues_.size());
+      push_to_queue(task, index);
+    }
+
+    /**
+     * Push a task onto the queue of a worker on a node. If the calling thread
+     * is a worker on that node then its own queue is used.
+     * @param task The task
+     * @param node The node index
+     */
+    void push(const task_type &task, std::size_t node) {
+      std::size_t *current = worker_index_.get();
+      std::size_t index = 0;
+      if (current != NULL && worker_node_[*current] == node) {
+        index = *current;
+      } else {
+        const std::vector<std::size_t> &workers = node_workers_[node];
+        index = workers[next_queue_.fetch_add(1) % workers.size()];
       }
+      push_to_queue(task, index);
+    }
 
-    protected:
-      Function function_;
-      boost::atomic<std::size_t> &counter_;
-    };
+    /**
+     * Push a task onto a worker queue and wake a sleeping worker
+     * @param task The task
+     * @param index The worker index
+     */
+    void push_to_queue(const task_type &task, std::size_t index) {
+      {
+        boost::lock_guard<boost::mutex> guard(queues_[index].mutex);
+        queues_[index].tasks.push_back(task);
+      }
+      num_queued_++;
+      if (num_sleeping_ > 0) {
+        boost::lock_guard<boost::mutex> guard(sleep_mutex_);
+        sleep_cond_.notify_one();
+      }
+    }
+
+    /**
+     * Take a task from the back of our own queue or, failing that, steal one
+     * from the front of another worker's queue. The workers on the same node
+     * are tried first.
+     * @param index The worker index
+     * @param task The task to fill
+     * @returns True/False a task was found
+     */
+    bool pop(std::size_t index, task_type &task) {
+      {
+        WorkQueue &own = queues_[index];
+        boost::lock_guard<boost::mutex> guard(own.mutex);
+        if (!own.tasks.empty()) {
+          task.swap(own.tasks.back());
+          own.tasks.pop_back();
+          return true;
+        }
+      }
+      for (std::size_t pass = 0; pass < 2; ++pass) {
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+          std::size_t j = (index + i) % queues_.size();
+          bool local = worker_node_[j] == worker_node_[index];
+          if (local != (pass == 0)) {
+            continue;
+          }
+          WorkQueue &other = queues_[j];
+          boost::lock_guard<boost::mutex> guard(other.mutex);
+          if (!other.tasks.empty()) {
+            task.swap(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    /**
+     * The worker thread main loop
+     * @param index The worker index
+     */
+    void run(std::size_t index) {
+      worker_index_.reset(new std::size_t(index));
+      if (!node_cpus_.empty()) {
+        set_thread_affinity(node_cpus_[worker_node_[index]]);
+      }
+      task_type task;
+      for (;;) {
+        if (stop_) {
+          return;
+        }
+        if (pop(index, task)) {
+          num_queued_--;
+          execute(task);
+          task.clear();
+        } else if (num_queued_ > 0) {
+          // Another worker took the task we saw; try again
+          boost::this_thread::yield();
+        } else {
+          // Nothing to do so sleep until a task is posted
+          boost::unique_lock<boost::mutex> lock(sleep_mutex_);
+          num_sleeping_++;
+          while (!stop_ && num_queued_ == 0) {
+            sleep_cond_.wait(lock);
+          }
+          num_sleeping_--;
+        }
+      }
+    }
+
+    /**
+     * Execute the task and mark it as finished
+     * @param task The task
+     */
+    void execute(task_type &task) {
+      try {
+        DIALS_TRACE_SCOPE("thread_pool", "task");
+        task();
+      } catch (const std::exception &e) {
+        set_error(e.what());
+      } catch (...) {
+        set_error("Unknown exception in thread pool task");
+      }
+      boost::lock_guard<boost::mutex> guard(done_mutex_);
+      finished_++;
+      if (finished_ == started_) {
+        done_cond_.notify_all();
+      }
+    }
+
+    /**
+     * Record the first error raised by a task
+     * @param message The error message
+     */
+    void set_error(const std::string &message) {
+      boost::lock_guard<boost::mutex> guard(done_mutex_);
+      if (!failed_) {
+        failed_ = true;
+        error_message_ = message;
+      }
+    }
 
-    boost::asio::io_service io_service_;
-    boost::asio::io_service::work work_;
+    boost::ptr_vector<WorkQueue> queues_;
+    std::vector<std::vector<int> > node_cpus_;
+    std::vector<std::size_t> worker_node_;
+    std::vector<std::vector<std::size_t> > node_workers_;
     boost::thread_group threads_;
+    boost::thread_specific_ptr<std::size_t> worker_index_;
+    boost::mutex sleep_mutex_;
+    boost::condition_variable sleep_cond_;
+    boost::atomic<bool> stop_;
+    boost::atomic<std::size_t> next_queue_;
+    boost::atomic<std::size_t> num_queued_;
+    boost::atomic<std::size_t> num_sleeping_;
+    boost::mutex done_mutex_;
+    boost::condition_variable done_cond_;
     std::size_t started_;
-    boost::atomic<std::size_t> finished_;
+    std::size_t finished_;
+    bool failed_;
+    std::string error_message_;
   };
 
 }}  // namespace dials::util
@@ -0,0 +1,34 @@
+/*
+ * timer.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_TIMER_H
+#define DIALS_UTIL_TIMER_H
+
+#include <ctime>
+
+namespace dials { namespace util {
+
+  /**
+   * Get a monotonic wall clock timestamp in seconds. This avoids boost::chrono,
+   * which needs boost::system, and unlike clock() on posix systems it measures
+   * elapsed time rather than the CPU time of the whole process, so it can be
+   * used to time work done on multiple threads. On windows clock() already
+   * measures elapsed time.
+   * @returns The timestamp
+   */
+  inline double monotonic_time() {
+#if defined(_WIN32)
+    return ((double)std::clock()) / ((double)CLOCKS_PER_SEC);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+#endif
+  }
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_TIMER_H
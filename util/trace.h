@@ -0,0 +1,321 @@
+/*
+ * trace.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_TRACE_H
+#define DIALS_UTIL_TRACE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread.hpp>
+#include <dials/util/thread_local.h>
+#include <dials/util/timer.h>
+#include <dials/error.h>
+
+namespace dials { namespace util {
+
+  /**
+   * A span of time spent by a thread in a named piece of work. The category
+   * and name must be string literals, or otherwise outlive the recorder.
+   */
+  struct TraceEvent {
+    const char *category;
+    const char *name;
+    double start;
+    double end;
+  };
+
+  /**
+   * A ring buffer of the events recorded by a single thread. When the buffer
+   * is full the oldest events are overwritten.
+   */
+  class TraceBuffer : private boost::noncopyable {
+  public:
+    TraceBuffer(std::size_t thread_id, std::size_t capacity)
+        : thread_id_(thread_id), events_(capacity), next_(0), size_(0) {}
+
+    /** @returns The id of the thread */
+    std::size_t thread_id() const {
+      return thread_id_;
+    }
+
+    /**
+     * Add an event, overwriting the oldest if the buffer is full
+     * @param event The event
+     */
+    void add(const TraceEvent &event) {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (events_.empty()) {
+        return;
+      }
+      events_[next_] = event;
+      next_ = (next_ + 1) % events_.size();
+      size_ = std::min(size_ + 1, events_.size());
+    }
+
+    /**
+     * Remove all the events and set the capacity
+     * @param capacity The maximum number of events
+     */
+    void reset(std::size_t capacity) {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      events_.assign(capacity, TraceEvent());
+      next_ = 0;
+      size_ = 0;
+    }
+
+    /** @returns The events from oldest to newest */
+    std::vector<TraceEvent> events() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      std::vector<TraceEvent> result;
+      result.reserve(size_);
+      std::size_t first = size_ < events_.size() ? 0 : next_;
+      for (std::size_t i = 0; i < size_; ++i) {
+        result.push_back(events_[(first + i) % events_.size()]);
+      }
+      return result;
+    }
+
+  private:
+    std::size_t thread_id_;
+    std::vector<TraceEvent> events_;
+    std::size_t next_;
+    std::size_t size_;
+    mutable boost::mutex mutex_;
+  };
+
+  /**
+   * Record spans of work on the native threads so that pipeline stalls and
+   * idle threads can be seen. Each thread records into its own ring buffer;
+   * the buffers are only locked together when the trace is written. When the
+   * recorder is stopped a span costs a single atomic load, and defining
+   * DIALS_DISABLE_TRACE removes the spans at compile time.
+   *
+   * The trace is written in the Chrome trace event JSON format, which can be
+   * loaded by chrome://tracing or the Perfetto UI.
+   */
+  class TraceRecorder : private boost::noncopyable {
+  public:
+    TraceRecorder() : enabled_(false), capacity_(0), origin_(monotonic_time()) {}
+
+    /**
+     * Clear any recorded events and start recording
+     * @param capacity The maximum number of events kept for each thread
+     */
+    void start(std::size_t capacity = 65536) {
+      DIALS_ASSERT(capacity > 0);
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      enabled_ = false;
+      capacity_ = capacity;
+      for (std::size_t i = 0; i < buffers_.size(); ++i) {
+        buffers_[i].reset(capacity);
+      }
+      origin_ = monotonic_time();
+      enabled_ = true;
+    }
+
+    /**
+     * Stop recording. The recorded events are kept until the next start.
+     */
+    void stop() {
+      enabled_ = false;
+    }
+
+    /** @returns True/False the recorder is recording */
+    bool enabled() const {
+      return enabled_;
+    }
+
+    /**
+     * Record a span on the calling thread
+     * @param category The category of the span
+     * @param name The name of the span
+     * @param start The start time (from monotonic_time)
+     * @param end The end time (from monotonic_time)
+     */
+    void record(const char *category, const char *name, double start, double end) {
+      if (!enabled_) {
+        return;
+      }
+      TraceEvent event;
+      event.category = category;
+      event.name = name;
+      event.start = start;
+      event.end = end;
+      local().add(event);
+    }
+
+    /**
+     * @returns The number of events recorded
+     */
+    std::size_t size() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < buffers_.size(); ++i) {
+        result += buffers_[i].events().size();
+      }
+      return result;
+    }
+
+    /**
+     * @returns The trace in the Chrome trace event JSON format
+     */
+    std::string chrome_json() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      std::ostringstream os;
+      os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+      bool first = true;
+      char line[64];
+      for (std::size_t i = 0; i < buffers_.size(); ++i) {
+        std::size_t tid = buffers_[i].thread_id();
+        os << (first ? "" : ",") << "\n{\"ph\": \"M\", \"name\": \"thread_name\", "
+           << "\"pid\": 1, \"tid\": " << tid << ", \"args\": {\"name\": \"thread "
+           << tid << "\"}}";
+        first = false;
+        std::vector<TraceEvent> events = buffers_[i].events();
+        for (std::size_t j = 0; j < events.size(); ++j) {
+          const TraceEvent &e = events[j];
+          std::sprintf(line,
+                       "\"ts\": %.3f, \"dur\": %.3f",
+                       (e.start - origin_) * 1e6,
+                       (e.end - e.start) * 1e6);
+          os << ",\n{\"ph\": \"X\", \"cat\": \"" << e.category << "\", \"name\": \""
+             << e.name << "\", \"pid\": 1, \"tid\": " << tid << ", " << line << "}";
+        }
+      }
+      os << "\n]}\n";
+      return os.str();
+    }
+
+    /**
+     * Write the trace to a file in the Chrome trace event JSON format
+     * @param filename The name of the file
+     */
+    void write_chrome_json(const std::string &filename) const {
+      std::string json = chrome_json();
+      std::FILE *file = std::fopen(filename.c_str(), "w");
+      DIALS_ASSERT(file != NULL);
+      std::size_t written = std::fwrite(json.data(), 1, json.size(), file);
+      std::fclose(file);
+      DIALS_ASSERT(written == json.size());
+    }
+
+  private:
+    /**
+     * @returns The buffer of the calling thread
+     */
+    TraceBuffer &local() {
+      TraceBuffer *buffer = local_.get();
+      if (buffer == NULL) {
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        buffers_.push_back(new TraceBuffer(buffers_.size() + 1, capacity_));
+        buffer = &buffers_.back();
+        local_.reset(buffer);
+      }
+      return *buffer;
+    }
+
+    boost::atomic<bool> enabled_;
+    std::size_t capacity_;
+    double origin_;
+    ThreadLocalPtr<TraceBuffer> local_;
+    boost::ptr_vector<TraceBuffer> buffers_;
+    mutable boost::mutex mutex_;
+  };
+
+  namespace detail {
+
+    inline TraceRecorder *&trace_recorder_pointer() {
+      static TraceRecorder *recorder = NULL;
+      return recorder;
+    }
+
+  }  // namespace detail
+
+  /**
+   * @returns The trace recorder used by this module, or NULL if not set
+   */
+  inline TraceRecorder *trace_recorder() {
+    return detail::trace_recorder_pointer();
+  }
+
+  /**
+   * Set the trace recorder used by this module. Each python extension holds
+   * its own pointer, so the extensions all set the recorder owned by
+   * dials_util_ext when they are imported.
+   * @param recorder The trace recorder
+   */
+  inline void set_trace_recorder(TraceRecorder *recorder) {
+    detail::trace_recorder_pointer() = recorder;
+  }
+
+  /**
+   * Record the time from construction to destruction as a span if the trace
+   * recorder is recording
+   */
+  class TraceScope : private boost::noncopyable {
+  public:
+    TraceScope(const char *category, const char *name)
+        : recorder_(trace_recorder()), category_(category), name_(name), start_(0) {
+      if (recorder_ != NULL && recorder_->enabled()) {
+        start_ = monotonic_time();
+      } else {
+        recorder_ = NULL;
+      }
+    }
+
+    ~TraceScope() {
+      if (recorder_ != NULL) {
+        recorder_->record(category_, name_, start_, monotonic_time());
+      }
+    }
+
+  private:
+    TraceRecorder *recorder_;
+    const char *category_;
+    const char *name_;
+    double start_;
+  };
+
+  /**
+   * Record a span measured by the caller if the trace recorder is recording
+   * @param category The category of the span
+   * @param name The name of the span
+   * @param start The start time (from monotonic_time)
+   * @param end The end time (from monotonic_time)
+   */
+  inline void trace_span(const char *category,
+                         const char *name,
+                         double start,
+                         double end) {
+    TraceRecorder *recorder = trace_recorder();
+    if (recorder != NULL) {
+      recorder->record(category, name, start, end);
+    }
+  }
+
+}}  // namespace dials::util
+
+#define DIALS_TRACE_CONCAT_IMPL(a, b) a##b
+#define DIALS_TRACE_CONCAT(a, b) DIALS_TRACE_CONCAT_IMPL(a, b)
+
+#ifdef DIALS_DISABLE_TRACE
+#define DIALS_TRACE_SCOPE(category, name)
+#define DIALS_TRACE_SPAN(category, name, start, end)
+#else
+#define DIALS_TRACE_SCOPE(category, name)                                 \
+  dials::util::TraceScope DIALS_TRACE_CONCAT(dials_trace_scope_, __LINE__)( \
+    category, name)
+#define DIALS_TRACE_SPAN(category, name, start, end) \
+  dials::util::trace_span(category, name, start, end)
+#endif
+
+#endif  // DIALS_UTIL_TRACE_H
@@ -24,7 +24,29 @@ namespace dials { namespace viewer { namespace boost_python {
 
       .def("gen_bmp",
            &rgb_img::gen_bmp,
-           (arg("data2d"), arg("mask2d"), arg("show_nums"), arg("palette_num")));
+           (arg("data2d"), arg("mask2d"), arg("show_nums"), arg("palette_num")))
+
+      .def("gen_bmp_tile",
+           &rgb_img::gen_bmp_tile,
+           (arg("data2d"),
+            arg("mask2d"),
+            arg("show_nums"),
+            arg("palette_num"),
+            arg("first_row"),
+            arg("first_col"),
+            arg("nrow"),
+            arg("ncol")))
+
+      .def("gen_bmp_viewport",
+           &rgb_img::gen_bmp_viewport,
+           (arg("data2d"),
+            arg("first_row"),
+            arg("first_col"),
+            arg("nrow"),
+            arg("ncol"),
+            arg("zoom") = 1.0,
+            arg("palette_num") = 1,
+            arg("nthreads") = 1));
 
     // def("tst_ref_prod", &tst_ref_prod, arg("matr01"), arg("matr02"));
   }
@@ -10,11 +10,13 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/util/boost_python/shared_executor.h>
 
 namespace dials { namespace viewer { namespace boost_python {
   using namespace boost::python;
   void export_dials_viewer();
   BOOST_PYTHON_MODULE(dials_viewer_ext) {
+    dials::util::boost_python::import_shared_executor();
     export_dials_viewer();
   }
 }}}  // namespace dials::viewer::boost_python
@@ -11,14 +11,19 @@
 
 #ifndef DIALS_RGB_IMG_BUILDER_H
 #define DIALS_RGB_IMG_BUILDER_H
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
 #include <scitbx/array_family/flex_types.h>
 
 #include <dials/viewer/fonts_2D.h>
 #include <dials/viewer/mask_bmp_2D.h>
 #include <dials/model/data/mask_code.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 
 namespace dials { namespace viewer { namespace boost_python {
   using scitbx::af::flex_double;
@@ -91,6 +96,10 @@ namespace dials { namespace viewer { namespace boost_python {
     int font_vol[14][7][16];
     int mask_vol[85][85][4];
 
+    // The overlay of the mask patterns for each combination of mask flags,
+    // generated when first needed
+    std::vector<unsigned char> mask_overlay_tiles[16];
+
   public:
     rgb_img() {
       // Generating grayscale palette
@@ -158,6 +167,29 @@ namespace dials { namespace viewer { namespace boost_python {
                      flex_double& mask2d,
                      bool show_nums,
                      int palette_num) {
+      return gen_bmp_tile(data2d,
+                          mask2d,
+                          show_nums,
+                          palette_num,
+                          0,
+                          0,
+                          data2d.accessor().all()[0],
+                          data2d.accessor().all()[1]);
+    }
+
+    /**
+     * Render the tile of image pixels starting at (first_row, first_col) as
+     * gen_bmp renders the whole image, so that only the visible tiles of a
+     * large image need be rendered. The tile is clipped to the image.
+     */
+    flex_int gen_bmp_tile(flex_double& data2d,
+                          flex_double& mask2d,
+                          bool show_nums,
+                          int palette_num,
+                          int first_row,
+                          int first_col,
+                          int tile_nrow,
+                          int tile_ncol) {
       // debugging palette number passed from Python
       /*
       std::cout << "\n show_nums =" << show_nums << "\n";
@@ -179,6 +211,13 @@ namespace dials { namespace viewer { namespace boost_python {
 
       int nrow = data2d.accessor().all()[0];
       int ncol = data2d.accessor().all()[1];
+      DIALS_ASSERT(mask2d.accessor().all().all_eq(data2d.accessor().all()));
+      DIALS_ASSERT(first_row >= 0 && first_col >= 0);
+      DIALS_ASSERT(tile_nrow >= 0 && tile_ncol >= 0);
+      int last_row = std::min(first_row + tile_nrow, nrow);
+      int last_col = std::min(first_col + tile_ncol, ncol);
+      tile_nrow = std::max(last_row - first_row, 0);
+      tile_ncol = std::max(last_col - first_col, 0);
       int col, row;
       double loc_cel, dif = 0;
       int loc_cel_int;
@@ -206,6 +245,9 @@ namespace dials { namespace viewer { namespace boost_python {
 
       dif = max - min;
 
+      std::vector<int> lut;
+      palette_lut(palette_num, lut);
+
       int px_scale = 0;
 
       if (ncol < 200 && nrow < 200) {
@@ -216,20 +258,22 @@ namespace dials { namespace viewer { namespace boost_python {
       }
       // std::cout << "\n px_scale = " << px_scale << "\n";
 
-      flex_int bmp_dat(flex_grid<>(nrow * px_scale, ncol * px_scale, 3), 0);
+      flex_int bmp_dat(flex_grid<>(tile_nrow * px_scale, tile_ncol * px_scale, 3), 0);
 
       int digit_val[15];
       int pix_row, pix_col;
 
-      int mask_pix_col, mask_pix_row;
       double scaled_pixel;
 
       // std::cout << "\n ncol =" << ncol << " \n";
       // std::cout << "\n nrow =" << nrow << " \n";
       // std::cout << "\n palette_num =" << palette_num << "\n";
 
-      for (row = 0; row < nrow; row++) {
-        for (col = 0; col < ncol; col++) {
+      for (row = first_row; row < last_row; row++) {
+        for (col = first_col; col < last_col; col++) {
+          // The first row and column of the pixel in the tile
+          int tile_row = (row - first_row) * px_scale;
+          int tile_col = (col - first_col) * px_scale;
           loc_cel = data2d(row, col);
           if (loc_cel > max) {
             loc_cel = max;
@@ -240,61 +284,34 @@ namespace dials { namespace viewer { namespace boost_python {
           scaled_pixel = 255.0 * 3 * ((loc_cel - min) / dif);
 
           loc_cel_int = int(mask2d(row, col));
+          const int* colour = &lut[3 * lut_index(scaled_pixel, palette_num)];
 
           if (px_scale > 1) {
             // painting the scaled pixel with the *hot* color convention
-            for (pix_col = col * px_scale; pix_col < col * px_scale + px_scale;
-                 pix_col++) {
-              for (pix_row = row * px_scale; pix_row < row * px_scale + px_scale;
-                   pix_row++) {
-                if (palette_num == 1) {
-                  bmp_dat(pix_row, pix_col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
-                } else if (palette_num == 2) {
-                  bmp_dat(pix_row, pix_col, 0) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                } else if (palette_num == 3) {
-                  bmp_dat(pix_row, pix_col, 0) = hot_pal_red_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) = hot_pal_green_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
-                } else {
-                  bmp_dat(pix_row, pix_col, 0) =
-                    hot_pal_red_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) =
-                    hot_pal_green_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) =
-                    hot_pal_blue_byte[int(765 - scaled_pixel)];
+            for (pix_col = tile_col; pix_col < tile_col + px_scale; pix_col++) {
+              for (pix_row = tile_row; pix_row < tile_row + px_scale; pix_row++) {
+                for (int k = 0; k < 3; k++) {
+                  bmp_dat(pix_row, pix_col, k) = colour[k];
                 }
               }
             }
 
             // Painting mask into the scaled pixel
-            for (mask_pix_col = 0, pix_col = col * px_scale; mask_pix_col < px_scale;
-                 pix_col++, mask_pix_col++) {
-              for (mask_pix_row = 0, pix_row = row * px_scale; mask_pix_row < px_scale;
-                   pix_row++, mask_pix_row++) {
-                if ((mask_vol[mask_pix_row][mask_pix_col][0] == 1
-                     && ((loc_cel_int & Valid) == Valid))
-                    || (mask_vol[mask_pix_row][mask_pix_col][1] == 1
-                        && ((loc_cel_int & Foreground) == Foreground))
-
-                    || (mask_vol[mask_pix_row][mask_pix_col][2] == 1
-                        && ((loc_cel_int & BackgroundUsed) == BackgroundUsed))
-                    || (mask_vol[mask_pix_row][mask_pix_col][3] == 1
-                        && ((loc_cel_int & Background) == Background))) {
-                  if (palette_num == 1 || palette_num == 2) {
-                    bmp_dat(pix_row, pix_col, 0) = 250;
-                    bmp_dat(pix_row, pix_col, 1) = 50;
-                    bmp_dat(pix_row, pix_col, 2) = 50;
-                  } else {
-                    bmp_dat(pix_row, pix_col, 0) = 150;
-                    bmp_dat(pix_row, pix_col, 1) = 150;
-                    bmp_dat(pix_row, pix_col, 2) = 150;
+            int flags = mask_flags(loc_cel_int);
+            if (flags != 0) {
+              const std::vector<unsigned char>& overlay = mask_overlay(flags);
+              int mask_rgb[3] = {150, 150, 150};
+              if (palette_num == 1 || palette_num == 2) {
+                mask_rgb[0] = 250;
+                mask_rgb[1] = 50;
+                mask_rgb[2] = 50;
+              }
+              for (int i = 0; i < px_scale; i++) {
+                for (int j = 0; j < px_scale; j++) {
+                  if (overlay[i * px_scale + j]) {
+                    for (int k = 0; k < 3; k++) {
+                      bmp_dat(tile_row + i, tile_col + j, k) = mask_rgb[k];
+                    }
                   }
                 }
               }
@@ -307,10 +324,10 @@ namespace dials { namespace viewer { namespace boost_python {
               if (err_conv == 0) {
                 // std::cout << "data2d(row, col) = " << data2d(row, col) << "\n";
                 for (int dg_num = 0; dg_num < 12 && digit_val[dg_num] != 15; dg_num++) {
-                  for (int font_pix_col = 0, pix_col = col * px_scale + dg_num * 7;
+                  for (int font_pix_col = 0, pix_col = tile_col + dg_num * 7;
                        font_pix_col < 7;
                        pix_col++, font_pix_col++) {
-                    for (int font_pix_row = 0, pix_row = row * px_scale + 14;
+                    for (int font_pix_row = 0, pix_row = tile_row + 14;
                          font_pix_row < 14;
                          pix_row++, font_pix_row++) {
                       if (font_vol[font_pix_row][font_pix_col][digit_val[dg_num]]
@@ -352,22 +369,8 @@ namespace dials { namespace viewer { namespace boost_python {
             }
 
           } else {
-            if (palette_num == 1) {
-              bmp_dat(row, col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
-            } else if (palette_num == 2) {
-              bmp_dat(row, col, 0) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 1) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 2) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-            } else if (palette_num == 3) {
-              bmp_dat(row, col, 0) = hot_pal_red_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 1) = hot_pal_green_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
-            } else {
-              bmp_dat(row, col, 0) = hot_pal_red_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 1) = hot_pal_green_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 2) = hot_pal_blue_byte[int(765 - scaled_pixel)];
+            for (int k = 0; k < 3; k++) {
+              bmp_dat(tile_row, tile_col, k) = colour[k];
             }
           }
         }
@@ -376,6 +379,156 @@ namespace dials { namespace viewer { namespace boost_python {
 
       return bmp_dat;
     }
+
+    /**
+     * Render the part of the image seen in a viewport, without masks or
+     * numbers. Output pixel (i, j) shows the image pixel
+     * (first_row + i / zoom, first_col + j / zoom); pixels outside the image
+     * are black. The rows are rendered in bands on several threads.
+     */
+    flex_int gen_bmp_viewport(flex_double& data2d,
+                              int first_row,
+                              int first_col,
+                              int nrow,
+                              int ncol,
+                              double zoom,
+                              int palette_num,
+                              std::size_t nthreads) {
+      DIALS_ASSERT(nrow >= 0 && ncol >= 0);
+      DIALS_ASSERT(zoom > 0);
+      int data_nrow = data2d.accessor().all()[0];
+      int data_ncol = data2d.accessor().all()[1];
+      if (max == -1 && min == -1 && data2d.size() > 0) {
+        min = *std::min_element(data2d.begin(), data2d.end());
+        max = *std::max_element(data2d.begin(), data2d.end());
+        if (max <= min) {
+          max = min + 1;
+        }
+      }
+
+      // The image row and column of each output row and column, or -1
+      Viewport view;
+      view.data = data2d.begin();
+      view.data_ncol = data_ncol;
+      view.palette_num = palette_num;
+      view.src_row.resize(nrow);
+      view.src_col.resize(ncol);
+      for (int i = 0; i < nrow; i++) {
+        int r = first_row + int(std::floor(i / zoom));
+        view.src_row[i] = (r >= 0 && r < data_nrow) ? r : -1;
+      }
+      for (int j = 0; j < ncol; j++) {
+        int c = first_col + int(std::floor(j / zoom));
+        view.src_col[j] = (c >= 0 && c < data_ncol) ? c : -1;
+      }
+      palette_lut(palette_num, view.lut);
+
+      flex_int bmp_dat(flex_grid<>(nrow, ncol, 3), 0);
+      view.bmp = bmp_dat.begin();
+      dials::algorithms::detail::parallel_bands(
+        boost::bind(&rgb_img::render_rows, this, boost::cref(view), _1, _2),
+        nrow,
+        nthreads);
+      return bmp_dat;
+    }
+
+  private:
+    /**
+     * The mask flags drawn on the pixels: Valid, Foreground, BackgroundUsed
+     * and Background in bits 0 to 3
+     */
+    static int mask_flags(int code) {
+      return ((code & Valid) == Valid ? 1 : 0)
+             | ((code & Foreground) == Foreground ? 2 : 0)
+             | ((code & BackgroundUsed) == BackgroundUsed ? 4 : 0)
+             | ((code & Background) == Background ? 8 : 0);
+    }
+
+    /**
+     * The union of the patterns of a combination of mask flags
+     */
+    const std::vector<unsigned char>& mask_overlay(int flags) {
+      std::vector<unsigned char>& overlay = mask_overlay_tiles[flags];
+      if (overlay.empty()) {
+        overlay.resize(85 * 85);
+        for (int i = 0; i < 85; i++) {
+          for (int j = 0; j < 85; j++) {
+            bool set = false;
+            for (int k = 0; k < 4; k++) {
+              set = set || ((flags >> k) & 1 && mask_vol[i][j][k] == 1);
+            }
+            overlay[i * 85 + j] = set;
+          }
+        }
+      }
+      return overlay;
+    }
+
+    struct Viewport {
+      const double* data;
+      int data_ncol;
+      int palette_num;
+      std::vector<int> src_row;
+      std::vector<int> src_col;
+      std::vector<int> lut;
+      int* bmp;
+    };
+
+    /**
+     * The index into the palette for a pixel scaled to [0, 765], reversed
+     * for the descending palettes
+     */
+    static int lut_index(double scaled_pixel, int palette_num) {
+      if (palette_num == 2 || palette_num == 4) {
+        return int(765 - scaled_pixel);
+      }
+      return int(scaled_pixel);
+    }
+
+    /**
+     * Fill the look up table of the RGB triplets of the palette
+     */
+    void palette_lut(int palette_num, std::vector<int>& lut) const {
+      lut.resize(766 * 3);
+      for (int i = 0; i < 766; i++) {
+        if (palette_num == 1 || palette_num == 2) {
+          lut[3 * i + 0] = gray_all_rgb_byte[i];
+          lut[3 * i + 1] = gray_all_rgb_byte[i];
+          lut[3 * i + 2] = gray_all_rgb_byte[i];
+        } else {
+          lut[3 * i + 0] = hot_pal_red_byte[i];
+          lut[3 * i + 1] = hot_pal_green_byte[i];
+          lut[3 * i + 2] = hot_pal_blue_byte[i];
+        }
+      }
+    }
+
+    /**
+     * Render the output rows [first, last) of a viewport
+     */
+    void render_rows(const Viewport& view, std::size_t first, std::size_t last) const {
+      double scale = 255.0 * 3 / (max - min);
+      std::size_t ncol = view.src_col.size();
+      for (std::size_t i = first; i < last; i++) {
+        int* out = view.bmp + i * ncol * 3;
+        if (view.src_row[i] < 0) {
+          continue;
+        }
+        const double* in =
+          view.data + (std::size_t)view.src_row[i] * view.data_ncol;
+        for (std::size_t j = 0; j < ncol; j++) {
+          if (view.src_col[j] < 0) {
+            continue;
+          }
+          double loc_cel = std::min(std::max(in[view.src_col[j]], min), max);
+          const int* colour =
+            &view.lut[3 * lut_index((loc_cel - min) * scale, view.palette_num)];
+          out[3 * j + 0] = colour[0];
+          out[3 * j + 1] = colour[1];
+          out[3 * j + 2] = colour[2];
+        }
+      }
+    }
   };
 
 }}}  // namespace dials::viewer::boost_python